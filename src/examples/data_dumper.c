@@ -40,14 +40,55 @@
 #include <sys/time.h>
 #include <sys/select.h>
 #include <stdlib.h>
+#include <inttypes.h>
 #include <signal.h>
+#include <pthread.h>
 #include "../lib/libplctag.h"
 #include "utils.h"
 
+/*
+ * Tags are grouped into scan classes by RPI.  Each scan class is read with
+ * one plc_tag_read_many() call so that the requests are packed together and
+ * the tags are created with change_detect=1 so that only the values that
+ * changed are logged.  The results are logged as text or recorded in a
+ * binary file.
+ *
+ * The binary recording is append-only and all values are little endian.
+ * It starts with the 8 byte magic and a uint32 version and is followed by
+ * blocks.  Each block starts with a uint8 type, a uint8 pad, a uint16 scan
+ * class and a uint32 payload length.
+ *
+ *  'H' header:  int64 start ms, uint32 tag count, then per tag a uint8 type,
+ *               uint8 value size, uint16 scan class, uint32 RPI, uint16 name
+ *               length and the name.
+ *  'D' data:    int64 timestamp ms, uint32 count, count uint32 tag indexes
+ *               and then the count values packed in the same order.
+ *  'I' index:   uint64 offset of the previous index block (zero for none),
+ *               uint32 count, then count pairs of int64 timestamp ms and
+ *               uint64 data block offset.
+ *  'T' trailer: uint64 offset of the last index block.
+ *
+ * The first scan of a scan class records every tag.
+ */
+
 #define REQUIRED_VERSION 2,1,0
 
-#define MAX_TAGS 5000
-#define RECONNECT_DELAY_MS 5000
+#define MAX_TAGS 20000
+#define MAX_SCAN_CLASSES 64
+#define MIN_SCAN_TIMEOUT_MS 5000
+#define STATS_INTERVAL_MS 10000
+#define DEFAULT_INDEX_INTERVAL 100
+#define REC_FILE_BUF_SIZE (1024*1024)
+
+#define REC_MAGIC "PLCREC\0\0"
+#define REC_MAGIC_SIZE 8
+#define REC_VERSION 1
+#define REC_BLOCK_HEADER_SIZE 8
+
+#define REC_BLOCK_HEADER 'H'
+#define REC_BLOCK_DATA 'D'
+#define REC_BLOCK_INDEX 'I'
+#define REC_BLOCK_TRAILER 'T'
 
 
 typedef enum { UNKNOWN = 0, DINT, INT, SINT, REAL } data_type_t;
@@ -55,20 +96,59 @@ typedef enum { UNKNOWN = 0, DINT, INT, SINT, REAL } data_type_t;
 struct {
     const char *name;
     int rpi;
-    int64_t next_read;
     int32_t tag_id;
-    int reading;
+    int scan_class;
+    int in_flight;
+    int changed;
+    int status;
     data_type_t data_type;
-    union {
-        int32_t DINT_val;
-        int16_t INT_val;
-        int8_t SINT_val;
-        float REAL_val;
-    } val;
 } tags[MAX_TAGS];
 
 int num_tags = 0;
 
+struct {
+    int rpi;
+    int64_t next_read;
+    int64_t start_time;
+    int reading;
+    int pending;
+    int num_tags;
+    int *tag_index;
+    int32_t *tag_ids;
+    int *statuses;
+    int *changed;
+    int64_t scans;
+    int64_t overruns;
+    int64_t timeouts;
+    int64_t errors;
+} scan_classes[MAX_SCAN_CLASSES];
+
+int num_scan_classes = 0;
+
+/* sorted by tag ID so that the callback can find the tag. */
+struct {
+    int32_t tag_id;
+    int index;
+} tag_map[MAX_TAGS];
+
+int num_mapped = 0;
+
+/* protects the tag and scan class state touched by the callback. */
+pthread_mutex_t tag_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* binary recording state */
+FILE *rec_file = NULL;
+uint64_t rec_offset = 0;
+uint8_t *rec_buf = NULL;
+size_t rec_buf_size = 0;
+int index_interval = DEFAULT_INDEX_INTERVAL;
+int index_count = 0;
+int64_t *index_ts = NULL;
+uint64_t *index_offsets = NULL;
+uint64_t last_index_offset = 0;
+
+int64_t values_logged = 0;
+
 
 volatile sig_atomic_t terminate = 0;
 
@@ -161,6 +241,90 @@ char **split_string(const char *str, const char *sep)
 }
 
 
+int type_size(data_type_t data_type)
+{
+    switch(data_type) {
+    case DINT: return 4;
+    case INT: return 2;
+    case SINT: return 1;
+    case REAL: return 4;
+    default: return 0;
+    }
+}
+
+
+int find_scan_class(int rpi)
+{
+    for(int c=0; c < num_scan_classes; c++) {
+        if(scan_classes[c].rpi == rpi) {
+            return c;
+        }
+    }
+
+    if(num_scan_classes >= MAX_SCAN_CLASSES) {
+        return PLCTAG_ERR_TOO_LARGE;
+    }
+
+    scan_classes[num_scan_classes].rpi = rpi;
+
+    return num_scan_classes++;
+}
+
+
+/* called with the tag mutex held. */
+int find_tag(int32_t tag_id)
+{
+    int low = 0;
+    int high = num_mapped - 1;
+
+    while(low <= high) {
+        int mid = (low + high) / 2;
+
+        if(tag_map[mid].tag_id == tag_id) {
+            return tag_map[mid].index;
+        } else if(tag_map[mid].tag_id < tag_id) {
+            low = mid + 1;
+        } else {
+            high = mid - 1;
+        }
+    }
+
+    return -1;
+}
+
+
+void tag_callback(int32_t tag_id, int event, int status)
+{
+    int t;
+
+    pthread_mutex_lock(&tag_mutex);
+
+    t = find_tag(tag_id);
+
+    if(t >= 0) {
+        switch(event) {
+        case PLCTAG_EVENT_READ_COMPLETED:
+        case PLCTAG_EVENT_ABORTED:
+            if(tags[t].in_flight) {
+                tags[t].in_flight = 0;
+                tags[t].status = (event == PLCTAG_EVENT_ABORTED ? PLCTAG_ERR_ABORT : status);
+                scan_classes[tags[t].scan_class].pending--;
+            }
+            break;
+
+        case PLCTAG_EVENT_VALUE_CHANGED:
+            tags[t].changed = 1;
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&tag_mutex);
+}
+
+
 /*
  * line format:
  *
@@ -169,6 +333,13 @@ char **split_string(const char *str, const char *sep)
 int process_line(const char *line)
 {
     char **parts = NULL;
+    char attrs[1100];
+    int scan_class = 0;
+
+    if(num_tags >= MAX_TAGS) {
+        fprintf(stderr, "Too many tags, at most %d are supported!\n", MAX_TAGS);
+        return PLCTAG_ERR_TOO_LARGE;
+    }
 
     parts = split_string(line, "\t");
     if(!parts) {
@@ -180,12 +351,11 @@ int process_line(const char *line)
     for(int i=0; i < 4; i++) {
         if(parts[i] == NULL) {
             fprintf(stderr, "Line does not contain enough parts. Line: %s\n", line);
+            free(parts);
             return PLCTAG_ERR_BAD_CONFIG;
         }
     }
 
-    tags[num_tags].name = strdup(parts[0]);
-
     if(strcasecmp("dint",parts[1]) == 0) {
         tags[num_tags].data_type = DINT;
     } else if(strcasecmp("int", parts[1]) == 0) {
@@ -196,20 +366,43 @@ int process_line(const char *line)
         tags[num_tags].data_type = REAL;
     } else {
         fprintf(stderr, "Unknown data type for %s!\n", parts[1]);
+        free(parts);
         return PLCTAG_ERR_BAD_CONFIG;
     }
 
     tags[num_tags].rpi = atoi(parts[2]);
-    tags[num_tags].next_read = 0;
-    tags[num_tags].tag_id = plc_tag_create(parts[3], 0); /* create async */
+    if(tags[num_tags].rpi <= 0) {
+        fprintf(stderr, "The RPI of %s must be greater than zero!\n", parts[0]);
+        free(parts);
+        return PLCTAG_ERR_BAD_CONFIG;
+    }
+
+    scan_class = find_scan_class(tags[num_tags].rpi);
+    if(scan_class < 0) {
+        fprintf(stderr, "Too many different RPIs, at most %d are supported!\n", MAX_SCAN_CLASSES);
+        free(parts);
+        return scan_class;
+    }
+
+    tags[num_tags].scan_class = scan_class;
+    tags[num_tags].changed = 1;
+
+    /* only record the values that change unless the line sets up its own change detection. */
+    if(strstr(parts[3], "change_detect") || strstr(parts[3], "deadband")) {
+        snprintf(attrs, sizeof(attrs), "%s", parts[3]);
+    } else {
+        snprintf(attrs, sizeof(attrs), "%s&change_detect=1", parts[3]);
+    }
+
+    tags[num_tags].tag_id = plc_tag_create_ex(attrs, tag_callback, 0); /* create async */
 
     if(tags[num_tags].tag_id < 0) {
-        fprintf(stderr, "Error, %s, creating tag %s with string %s!\n", plc_tag_decode_error(tags[num_tags].tag_id), tags[num_tags].name, parts[3]);
+        fprintf(stderr, "Error, %s, creating tag %s with string %s!\n", plc_tag_decode_error(tags[num_tags].tag_id), parts[0], parts[3]);
         free(parts);
         return tags[num_tags].tag_id;
     }
 
-    //printf("Tag %d has name %s, type %s, RPI %d, and tag string %s\n",num_tags, parts[0], parts[1], tags[num_tags].rpi, parts[3]);
+    tags[num_tags].name = strdup(parts[0]);
 
     free(parts);
 
@@ -243,8 +436,6 @@ int read_config(const char *config_filename)
     char line[1024] = {0,};
     int line_num = 0;
 
-//    printf("Reading config file %s.\n", config_filename);
-
     /* open the config file */
     config = fopen(config_filename,"r");
     if(!config) {
@@ -258,8 +449,6 @@ int read_config(const char *config_filename)
 
         trim_line(line);
 
-//        printf("Processing line %d: %s\n", line_num, line);
-
         /* skip blank lines and comments */
         if(strlen(line) < 25 || is_comment(line)) {
             continue;
@@ -274,12 +463,69 @@ int read_config(const char *config_filename)
 
     fclose(config);
 
-    printf("Read %d tags from the config file.\n", num_tags);
+    printf("Read %d tags in %d scan classes from the config file.\n", num_tags, num_scan_classes);
 
     return rc;
 }
 
 
+int compare_tag_map(const void *a, const void *b)
+{
+    int32_t id_a = ((const int32_t *)a)[0];
+    int32_t id_b = ((const int32_t *)b)[0];
+
+    return (id_a > id_b) - (id_a < id_b);
+}
+
+
+int setup_scan_classes(void)
+{
+    for(int c=0; c < num_scan_classes; c++) {
+        int count = 0;
+
+        for(int t=0; t < num_tags; t++) {
+            if(tags[t].scan_class == c) {
+                count++;
+            }
+        }
+
+        scan_classes[c].tag_index = calloc((size_t)count, sizeof(int));
+        scan_classes[c].tag_ids = calloc((size_t)count, sizeof(int32_t));
+        scan_classes[c].statuses = calloc((size_t)count, sizeof(int));
+        scan_classes[c].changed = calloc((size_t)count, sizeof(int));
+
+        if(!scan_classes[c].tag_index || !scan_classes[c].tag_ids || !scan_classes[c].statuses || !scan_classes[c].changed) {
+            fprintf(stderr, "Unable to allocate memory for scan class %d!\n", c);
+            return PLCTAG_ERR_NO_MEM;
+        }
+
+        for(int t=0; t < num_tags; t++) {
+            if(tags[t].scan_class == c) {
+                scan_classes[c].tag_index[scan_classes[c].num_tags] = t;
+                scan_classes[c].tag_ids[scan_classes[c].num_tags] = tags[t].tag_id;
+                scan_classes[c].num_tags++;
+            }
+        }
+    }
+
+    /* let the callback find the tags. */
+    pthread_mutex_lock(&tag_mutex);
+
+    for(int t=0; t < num_tags; t++) {
+        tag_map[t].tag_id = tags[t].tag_id;
+        tag_map[t].index = t;
+    }
+
+    qsort(tag_map, (size_t)num_tags, sizeof(tag_map[0]), compare_tag_map);
+
+    num_mapped = num_tags;
+
+    pthread_mutex_unlock(&tag_mutex);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
 FILE *check_log_file()
 {
     static int log_year = 0;
@@ -299,7 +545,7 @@ FILE *check_log_file()
         log_month = tm_struct->tm_mon;
         log_day = tm_struct->tm_mday;
 
-        snprintf(log_file_name, sizeof(log_file_name),"log-%04d-%02d-%02d.log", 1900+log_year, log_month, log_day);
+        snprintf(log_file_name, sizeof(log_file_name),"log-%04d-%02d-%02d.log", 1900+log_year, log_month+1, log_day);
         if(log) {
             fclose(log);
         }
@@ -312,11 +558,10 @@ FILE *check_log_file()
 
 
 
-int make_prefix(char *prefix_buf, int prefix_buf_size)
+int make_prefix(int64_t epoch_ms, char *prefix_buf, int prefix_buf_size)
 {
     struct tm t;
     time_t epoch;
-    int64_t epoch_ms;
     int remainder_ms;
     int rc = PLCTAG_STATUS_OK;
 
@@ -328,16 +573,16 @@ int make_prefix(char *prefix_buf, int prefix_buf_size)
     /* build the prefix */
 
     /* get the time parts */
-    epoch_ms = util_time_ms();
     epoch = (time_t)(epoch_ms/1000);
     remainder_ms = (int)(epoch_ms % 1000);
 
-    /* FIXME - should capture error return! */
-    localtime_r(&epoch,&t);
+    if(!localtime_r(&epoch,&t)) {
+        return PLCTAG_ERR_BAD_DATA;
+    }
 
     /* create the prefix and format for the file entry. */
     rc = snprintf(prefix_buf, (size_t)prefix_buf_size,"%04d-%02d-%02d %02d:%02d:%02d.%03d",
-                  t.tm_year+1900,t.tm_mon,t.tm_mday,t.tm_hour,t.tm_min,t.tm_sec,remainder_ms);
+                  t.tm_year+1900,t.tm_mon+1,t.tm_mday,t.tm_hour,t.tm_min,t.tm_sec,remainder_ms);
 
     /* enforce zero string termination */
     if(rc > 1 && rc < prefix_buf_size) {
@@ -350,9 +595,308 @@ int make_prefix(char *prefix_buf, int prefix_buf_size)
 }
 
 
+/*
+ * Little endian encoding helpers for the binary recording.
+ */
+
+size_t put_u16(uint8_t *buf, size_t offset, uint16_t val)
+{
+    buf[offset] = (uint8_t)(val & 0xFF);
+    buf[offset + 1] = (uint8_t)((val >> 8) & 0xFF);
+
+    return offset + 2;
+}
+
+
+size_t put_u32(uint8_t *buf, size_t offset, uint32_t val)
+{
+    for(int i=0; i < 4; i++) {
+        buf[offset + (size_t)i] = (uint8_t)((val >> (8*i)) & 0xFF);
+    }
+
+    return offset + 4;
+}
+
+
+size_t put_u64(uint8_t *buf, size_t offset, uint64_t val)
+{
+    for(int i=0; i < 8; i++) {
+        buf[offset + (size_t)i] = (uint8_t)((val >> (8*i)) & 0xFF);
+    }
+
+    return offset + 8;
+}
+
+
+uint64_t get_le(const uint8_t *buf, size_t offset, int size)
+{
+    uint64_t val = 0;
+
+    for(int i=size-1; i >= 0; i--) {
+        val = (val << 8) | buf[offset + (size_t)i];
+    }
+
+    return val;
+}
+
+
+uint32_t tag_raw_value(int t)
+{
+    int32_t tag_id = tags[t].tag_id;
+    float fval;
+    uint32_t val = 0;
+
+    switch(tags[t].data_type) {
+    case DINT:
+        val = (uint32_t)plc_tag_get_int32(tag_id, 0);
+        break;
+
+    case INT:
+        val = (uint16_t)plc_tag_get_int16(tag_id, 0);
+        break;
+
+    case SINT:
+        val = (uint8_t)plc_tag_get_int8(tag_id, 0);
+        break;
+
+    case REAL:
+        fval = plc_tag_get_float32(tag_id, 0);
+        memcpy(&val, &fval, sizeof(val));
+        break;
+
+    default:
+        break;
+    }
+
+    return val;
+}
+
+
+uint8_t *rec_reserve(size_t size)
+{
+    if(size > rec_buf_size) {
+        uint8_t *new_buf = realloc(rec_buf, size);
+
+        if(!new_buf) {
+            return NULL;
+        }
+
+        rec_buf = new_buf;
+        rec_buf_size = size;
+    }
+
+    return rec_buf;
+}
+
+
+/* write one block and return its offset in the file. */
+int rec_write_block(uint8_t type, uint16_t scan_class, size_t payload_size, uint64_t *block_offset)
+{
+    size_t offset = 0;
+    size_t total = REC_BLOCK_HEADER_SIZE + payload_size;
+
+    rec_buf[offset++] = type;
+    rec_buf[offset++] = 0;
+    offset = put_u16(rec_buf, offset, scan_class);
+    put_u32(rec_buf, offset, (uint32_t)payload_size);
+
+    if(fwrite(rec_buf, 1, total, rec_file) != total) {
+        fprintf(stderr, "Error writing to the recording file!\n");
+        return PLCTAG_ERR_WRITE;
+    }
+
+    if(block_offset) {
+        *block_offset = rec_offset;
+    }
+
+    rec_offset += total;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+int rec_write_index(void)
+{
+    size_t offset = REC_BLOCK_HEADER_SIZE;
+    uint64_t block_offset = 0;
+    int rc;
+
+    if(!rec_reserve(REC_BLOCK_HEADER_SIZE + 12 + ((size_t)index_count * 16))) {
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    offset = put_u64(rec_buf, offset, last_index_offset);
+    offset = put_u32(rec_buf, offset, (uint32_t)index_count);
+
+    for(int i=0; i < index_count; i++) {
+        offset = put_u64(rec_buf, offset, (uint64_t)index_ts[i]);
+        offset = put_u64(rec_buf, offset, index_offsets[i]);
+    }
+
+    rc = rec_write_block(REC_BLOCK_INDEX, 0, offset - REC_BLOCK_HEADER_SIZE, &block_offset);
+    if(rc != PLCTAG_STATUS_OK) {
+        return rc;
+    }
+
+    last_index_offset = block_offset;
+    index_count = 0;
+
+    /* an index block marks a point where the file is complete. */
+    fflush(rec_file);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+int rec_open(const char *file_name)
+{
+    size_t size = REC_BLOCK_HEADER_SIZE + 12;
+    size_t offset = REC_BLOCK_HEADER_SIZE;
+
+    index_ts = calloc((size_t)index_interval, sizeof(int64_t));
+    index_offsets = calloc((size_t)index_interval, sizeof(uint64_t));
+    if(!index_ts || !index_offsets) {
+        fprintf(stderr, "Unable to allocate memory for the index!\n");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    rec_file = fopen(file_name, "wb");
+    if(!rec_file) {
+        fprintf(stderr, "Unable to open recording file %s!\n", file_name);
+        return PLCTAG_ERR_OPEN;
+    }
+
+    setvbuf(rec_file, NULL, _IOFBF, REC_FILE_BUF_SIZE);
+
+    for(int t=0; t < num_tags; t++) {
+        size += 10 + strlen(tags[t].name);
+    }
+
+    if(!rec_reserve(size > REC_MAGIC_SIZE + 4 ? size : REC_MAGIC_SIZE + 4)) {
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    memcpy(rec_buf, REC_MAGIC, REC_MAGIC_SIZE);
+    put_u32(rec_buf, REC_MAGIC_SIZE, REC_VERSION);
+
+    if(fwrite(rec_buf, 1, REC_MAGIC_SIZE + 4, rec_file) != REC_MAGIC_SIZE + 4) {
+        fprintf(stderr, "Error writing to the recording file!\n");
+        return PLCTAG_ERR_WRITE;
+    }
+
+    rec_offset = REC_MAGIC_SIZE + 4;
+
+    offset = put_u64(rec_buf, offset, (uint64_t)util_time_ms());
+    offset = put_u32(rec_buf, offset, (uint32_t)num_tags);
+
+    for(int t=0; t < num_tags; t++) {
+        size_t name_len = strlen(tags[t].name);
+
+        rec_buf[offset++] = (uint8_t)tags[t].data_type;
+        rec_buf[offset++] = (uint8_t)type_size(tags[t].data_type);
+        offset = put_u16(rec_buf, offset, (uint16_t)tags[t].scan_class);
+        offset = put_u32(rec_buf, offset, (uint32_t)tags[t].rpi);
+        offset = put_u16(rec_buf, offset, (uint16_t)name_len);
+        memcpy(rec_buf + offset, tags[t].name, name_len);
+        offset += name_len;
+    }
+
+    return rec_write_block(REC_BLOCK_HEADER, 0, offset - REC_BLOCK_HEADER_SIZE, NULL);
+}
+
+
+void rec_close(void)
+{
+    size_t offset = REC_BLOCK_HEADER_SIZE;
+
+    if(!rec_file) {
+        return;
+    }
+
+    if(index_count > 0) {
+        rec_write_index();
+    }
+
+    if(rec_reserve(REC_BLOCK_HEADER_SIZE + 8)) {
+        offset = put_u64(rec_buf, offset, last_index_offset);
+        rec_write_block(REC_BLOCK_TRAILER, 0, offset - REC_BLOCK_HEADER_SIZE, NULL);
+    }
+
+    fclose(rec_file);
+    rec_file = NULL;
+}
 
 
-int log_data()
+int rec_data(int c, int64_t timestamp, int *changed, int num_changed)
+{
+    size_t size = REC_BLOCK_HEADER_SIZE + 12 + ((size_t)num_changed * 8);
+    size_t offset = REC_BLOCK_HEADER_SIZE;
+    uint64_t block_offset = 0;
+    int rc;
+
+    if(!rec_reserve(size)) {
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    offset = put_u64(rec_buf, offset, (uint64_t)timestamp);
+    offset = put_u32(rec_buf, offset, (uint32_t)num_changed);
+
+    /* the tag indexes first and then the values. */
+    for(int i=0; i < num_changed; i++) {
+        offset = put_u32(rec_buf, offset, (uint32_t)changed[i]);
+    }
+
+    for(int i=0; i < num_changed; i++) {
+        uint32_t val = tag_raw_value(changed[i]);
+        int val_size = type_size(tags[changed[i]].data_type);
+
+        for(int b=0; b < val_size; b++) {
+            rec_buf[offset++] = (uint8_t)((val >> (8*b)) & 0xFF);
+        }
+    }
+
+    rc = rec_write_block(REC_BLOCK_DATA, (uint16_t)c, offset - REC_BLOCK_HEADER_SIZE, &block_offset);
+    if(rc != PLCTAG_STATUS_OK) {
+        return rc;
+    }
+
+    index_ts[index_count] = timestamp;
+    index_offsets[index_count] = block_offset;
+    index_count++;
+
+    if(index_count >= index_interval) {
+        return rec_write_index();
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+int print_value(FILE *out, data_type_t data_type, uint32_t val)
+{
+    float fval;
+
+    switch(data_type) {
+    case DINT:
+        return fprintf(out, ",%d\n", (int32_t)val);
+
+    case INT:
+        return fprintf(out, ",%d\n", (int16_t)(uint16_t)val);
+
+    case SINT:
+        return fprintf(out, ",%d\n", (int8_t)(uint8_t)val);
+
+    case REAL:
+        memcpy(&fval, &val, sizeof(fval));
+        return fprintf(out, ",%f\n", (double)fval);
+
+    default:
+        return fprintf(out, ",?\n");
+    }
+}
+
+
+int log_data(int64_t timestamp, int *changed, int num_changed)
 {
     FILE *log = check_log_file();
     char timestamp_buf[128];
@@ -363,42 +907,17 @@ int log_data()
         return PLCTAG_ERR_OPEN;
     }
 
-    rc = make_prefix(timestamp_buf, sizeof(timestamp_buf));
+    rc = make_prefix(timestamp, timestamp_buf, sizeof(timestamp_buf));
     if(rc < 0) {
         fprintf(stderr, "Unable to make prefix, error %s!\n", plc_tag_decode_error(rc));
         return rc;
     }
 
-    for(int tag=0; tag < num_tags; tag++) {
-        /* skip if this tag is not being read. */
-        if(!tags[tag].reading) {
-            continue;
-        }
-
-        fprintf(log,"%s,%s",timestamp_buf, tags[tag].name);
-
-        switch(tags[tag].data_type) {
-        case DINT:
-            fprintf(log,",%d\n",plc_tag_get_int32(tags[tag].tag_id,0));
-            break;
+    for(int i=0; i < num_changed; i++) {
+        int t = changed[i];
 
-        case INT:
-            fprintf(log,",%d\n",plc_tag_get_int16(tags[tag].tag_id,0));
-            break;
-
-        case SINT:
-            fprintf(log,",%d\n",plc_tag_get_int8(tags[tag].tag_id,0));
-            break;
-
-        case REAL:
-            fprintf(log,",%f\n",plc_tag_get_float32(tags[tag].tag_id,0));
-            break;
-
-        default:
-            fprintf(stderr,"Unknown datatype (%d) for tag %d!\n", tags[tag].data_type, tag);
-            return PLCTAG_ERR_BAD_CONFIG;
-            break;
-        }
+        fprintf(log,"%s,%s",timestamp_buf, tags[t].name);
+        print_value(log, tags[t].data_type, tag_raw_value(t));
     }
 
     fflush(log);
@@ -432,36 +951,331 @@ void destroy_tags()
             plc_tag_destroy(tags[t].tag_id);
         }
     }
+
+    for(int c=0; c < num_scan_classes; c++) {
+        free(scan_classes[c].tag_index);
+        free(scan_classes[c].tag_ids);
+        free(scan_classes[c].statuses);
+        free(scan_classes[c].changed);
+    }
 }
 
 
+void start_scan(int c, int64_t now)
+{
+    int num = scan_classes[c].num_tags;
+
+    pthread_mutex_lock(&tag_mutex);
+
+    for(int i=0; i < num; i++) {
+        tags[scan_classes[c].tag_index[i]].in_flight = 1;
+    }
 
-int start_reads()
+    scan_classes[c].pending = num;
+    scan_classes[c].reading = 1;
+    scan_classes[c].start_time = now;
+
+    pthread_mutex_unlock(&tag_mutex);
+
+    /* one call so that all the requests of the scan class are packed together. */
+    plc_tag_read_many(scan_classes[c].tag_ids, num, scan_classes[c].statuses, 0);
+
+    /* reads that could not be started raise no event. */
+    pthread_mutex_lock(&tag_mutex);
+
+    for(int i=0; i < num; i++) {
+        int t = scan_classes[c].tag_index[i];
+        int status = scan_classes[c].statuses[i];
+
+        if(status != PLCTAG_STATUS_PENDING && status != PLCTAG_STATUS_OK && tags[t].in_flight) {
+            tags[t].in_flight = 0;
+            tags[t].status = status;
+            scan_classes[c].pending--;
+        }
+    }
+
+    pthread_mutex_unlock(&tag_mutex);
+}
+
+
+void abort_scan(int c)
+{
+    int num = scan_classes[c].num_tags;
+    int *stuck = scan_classes[c].changed;
+    int num_stuck = 0;
+
+    pthread_mutex_lock(&tag_mutex);
+
+    for(int i=0; i < num; i++) {
+        int t = scan_classes[c].tag_index[i];
+
+        if(tags[t].in_flight) {
+            tags[t].in_flight = 0;
+            tags[t].status = PLCTAG_ERR_TIMEOUT;
+            scan_classes[c].pending--;
+            stuck[num_stuck++] = t;
+        }
+    }
+
+    pthread_mutex_unlock(&tag_mutex);
+
+    for(int i=0; i < num_stuck; i++) {
+        plc_tag_abort(tags[stuck[i]].tag_id);
+    }
+
+    scan_classes[c].timeouts++;
+}
+
+
+int finish_scan(int c, int64_t now)
+{
+    int num = scan_classes[c].num_tags;
+    int *changed = scan_classes[c].changed;
+    int num_changed = 0;
+    int num_errors = 0;
+
+    /* a change event that comes in after the scan is done is recorded with the next scan. */
+    pthread_mutex_lock(&tag_mutex);
+
+    for(int i=0; i < num; i++) {
+        int t = scan_classes[c].tag_index[i];
+
+        if(tags[t].status != PLCTAG_STATUS_OK) {
+            num_errors++;
+        } else if(tags[t].changed) {
+            tags[t].changed = 0;
+            changed[num_changed++] = t;
+        }
+    }
+
+    pthread_mutex_unlock(&tag_mutex);
+
+    scan_classes[c].reading = 0;
+    scan_classes[c].scans++;
+    scan_classes[c].errors += num_errors;
+
+    if(num_changed == 0) {
+        return PLCTAG_STATUS_OK;
+    }
+
+    values_logged += num_changed;
+
+    if(rec_file) {
+        return rec_data(c, now, changed, num_changed);
+    }
+
+    return log_data(now, changed, num_changed);
+}
+
+
+int run_scans(int64_t now)
 {
-    int64_t now = util_time_ms();
     int rc = PLCTAG_STATUS_OK;
 
-    /* kick off any reads that need to happen */
-    for(int t=0; t<num_tags; t++) {
-        /* trigger a read if the interval is overdue. */
-        if(tags[t].next_read < now) {
-            tags[t].next_read = now + tags[t].rpi;
+    for(int c=0; c < num_scan_classes && rc == PLCTAG_STATUS_OK; c++) {
+        int pending;
+
+        if(scan_classes[c].reading) {
+            int64_t timeout = (int64_t)scan_classes[c].rpi * 10;
 
-            tags[t].reading = 1;
+            pthread_mutex_lock(&tag_mutex);
+            pending = scan_classes[c].pending;
+            pthread_mutex_unlock(&tag_mutex);
 
-            rc = plc_tag_read(tags[t].tag_id, 0);
-            if(rc != PLCTAG_STATUS_PENDING) {
-                fprintf(stderr,"Unable to start reading tag %s!\n", plc_tag_decode_error(rc));
-                destroy_tags();
-                return rc;
+            if(pending > 0 && now - scan_classes[c].start_time > (timeout > MIN_SCAN_TIMEOUT_MS ? timeout : MIN_SCAN_TIMEOUT_MS)) {
+                abort_scan(c);
+                pending = 0;
+            }
+
+            if(pending == 0) {
+                rc = finish_scan(c, now);
+            }
+        }
+
+        if(scan_classes[c].next_read <= now) {
+            if(scan_classes[c].reading) {
+                /* the last scan is not done, skip this one. */
+                scan_classes[c].overruns++;
+            } else {
+                start_scan(c, now);
+            }
+
+            /* stay on the RPI grid unless we fell behind. */
+            scan_classes[c].next_read += scan_classes[c].rpi;
+            if(scan_classes[c].next_read <= now) {
+                scan_classes[c].next_read = now + scan_classes[c].rpi;
             }
-        } else {
-            /* this tag is not being read. */
-            tags[t].reading = 0;
         }
     }
 
-    return PLCTAG_STATUS_OK;
+    return rc;
+}
+
+
+void print_stats(int64_t elapsed_ms)
+{
+    for(int c=0; c < num_scan_classes; c++) {
+        printf("Scan class %dms: %d tags, %" PRId64 " scans, %" PRId64 " overruns, %" PRId64 " timeouts, %" PRId64 " read errors.\n",
+               scan_classes[c].rpi, scan_classes[c].num_tags, scan_classes[c].scans, scan_classes[c].overruns,
+               scan_classes[c].timeouts, scan_classes[c].errors);
+    }
+
+    printf("Logged %" PRId64 " changed values in %" PRId64 "ms", values_logged, elapsed_ms);
+
+    if(rec_file) {
+        printf(", %" PRIu64 " bytes recorded", rec_offset);
+    }
+
+    printf(".\n");
+}
+
+
+int dump_recording(const char *file_name)
+{
+    FILE *in = NULL;
+    uint8_t header[REC_MAGIC_SIZE + 4];
+    uint8_t *buf = NULL;
+    size_t buf_size = 0;
+    int rec_num_tags = 0;
+    char **names = NULL;
+    uint8_t *types = NULL;
+    int rc = PLCTAG_STATUS_OK;
+
+    in = fopen(file_name, "rb");
+    if(!in) {
+        fprintf(stderr, "Unable to open recording file %s!\n", file_name);
+        return PLCTAG_ERR_OPEN;
+    }
+
+    if(fread(header, 1, sizeof(header), in) != sizeof(header) || memcmp(header, REC_MAGIC, REC_MAGIC_SIZE) != 0) {
+        fprintf(stderr, "%s is not a recording file!\n", file_name);
+        fclose(in);
+        return PLCTAG_ERR_BAD_DATA;
+    }
+
+    if(get_le(header, REC_MAGIC_SIZE, 4) != REC_VERSION) {
+        fprintf(stderr, "Unsupported recording version %u!\n", (unsigned int)get_le(header, REC_MAGIC_SIZE, 4));
+        fclose(in);
+        return PLCTAG_ERR_UNSUPPORTED;
+    }
+
+    while(rc == PLCTAG_STATUS_OK && fread(header, 1, REC_BLOCK_HEADER_SIZE, in) == REC_BLOCK_HEADER_SIZE) {
+        uint8_t type = header[0];
+        size_t len = (size_t)get_le(header, 4, 4);
+        size_t offset = 0;
+
+        if(len > buf_size) {
+            uint8_t *new_buf = realloc(buf, len);
+
+            if(!new_buf) {
+                rc = PLCTAG_ERR_NO_MEM;
+                break;
+            }
+
+            buf = new_buf;
+            buf_size = len;
+        }
+
+        if(fread(buf, 1, len, in) != len) {
+            /* the recorder was stopped in the middle of a block. */
+            fprintf(stderr, "Recording is truncated.\n");
+            break;
+        }
+
+        if(type == REC_BLOCK_HEADER && !names && len >= 12) {
+            rec_num_tags = (int)get_le(buf, 8, 4);
+            names = calloc((size_t)rec_num_tags + 1, sizeof(char *));
+            types = calloc((size_t)rec_num_tags + 1, 1);
+
+            if(!names || !types) {
+                rc = PLCTAG_ERR_NO_MEM;
+                break;
+            }
+
+            offset = 12;
+
+            for(int t=0; t < rec_num_tags; t++) {
+                size_t name_len;
+
+                if(offset + 10 > len) {
+                    rc = PLCTAG_ERR_BAD_DATA;
+                    break;
+                }
+
+                types[t] = buf[offset];
+                name_len = (size_t)get_le(buf, offset + 8, 2);
+                offset += 10;
+
+                if(offset + name_len > len) {
+                    rc = PLCTAG_ERR_BAD_DATA;
+                    break;
+                }
+
+                names[t] = calloc(name_len + 1, 1);
+                if(!names[t]) {
+                    rc = PLCTAG_ERR_NO_MEM;
+                    break;
+                }
+
+                memcpy(names[t], buf + offset, name_len);
+                offset += name_len;
+            }
+        } else if(type == REC_BLOCK_DATA && names && len >= 12) {
+            char timestamp_buf[128];
+            int count = (int)get_le(buf, 8, 4);
+            size_t val_offset = 12 + ((size_t)count * 4);
+
+            make_prefix((int64_t)get_le(buf, 0, 8), timestamp_buf, sizeof(timestamp_buf));
+
+            for(int i=0; i < count && rc == PLCTAG_STATUS_OK; i++) {
+                int t;
+                int val_size;
+
+                if(12 + ((size_t)i * 4) + 4 > len) {
+                    rc = PLCTAG_ERR_BAD_DATA;
+                    break;
+                }
+
+                t = (int)get_le(buf, 12 + ((size_t)i * 4), 4);
+
+                if(t >= rec_num_tags) {
+                    rc = PLCTAG_ERR_BAD_DATA;
+                    break;
+                }
+
+                val_size = type_size((data_type_t)types[t]);
+
+                if(val_size == 0 || val_offset + (size_t)val_size > len) {
+                    rc = PLCTAG_ERR_BAD_DATA;
+                    break;
+                }
+
+                printf("%s,%s", timestamp_buf, names[t]);
+                print_value(stdout, (data_type_t)types[t], (uint32_t)get_le(buf, val_offset, val_size));
+
+                val_offset += (size_t)val_size;
+            }
+        }
+
+        /* index and trailer blocks are only needed for seeking. */
+    }
+
+    if(rc != PLCTAG_STATUS_OK) {
+        fprintf(stderr, "Error, %s, reading recording file %s!\n", plc_tag_decode_error(rc), file_name);
+    }
+
+    if(names) {
+        for(int t=0; t < rec_num_tags; t++) {
+            free(names[t]);
+        }
+    }
+
+    free(names);
+    free(types);
+    free(buf);
+    fclose(in);
+
+    return rc;
 }
 
 
@@ -474,14 +1288,20 @@ void SIGINT_handler(int not_used)
 
 void usage(void)
 {
-    fprintf(stderr, "Usage: data_dumper <config file>\n");
+    fprintf(stderr, "Usage: data_dumper [-o <recording file>] [-i <blocks per index>] <config file>\n");
+    fprintf(stderr, "       data_dumper -d <recording file>\n");
+    fprintf(stderr, "Without -o, changed values are logged as text to log-YYYY-MM-DD.log files.\n");
+    fprintf(stderr, "\t-o <recording file> = record the changed values to a compact binary file.\n");
+    fprintf(stderr, "\t-i <blocks per index> = data blocks between index blocks, default %d.\n", DEFAULT_INDEX_INTERVAL);
+    fprintf(stderr, "\t-d <recording file> = print a recording as text.\n");
     fprintf(stderr, "The config file must contain tab-delimited rows in the following format:\n");
     fprintf(stderr, "\t<name>\\t<type>\\t<rpi>\\t<tag string>\n");
     fprintf(stderr, "\t<name> = a name used when outputting the data.\n");
     fprintf(stderr, "\t<type> = The type of the tag.  One of 'dint', 'int', 'sint', 'real'.\n");
-    fprintf(stderr, "\t<rpi> = The number of milliseconds between reads of the tag.\n");
+    fprintf(stderr, "\t<rpi> = The number of milliseconds between reads of the tag.  Tags with the same RPI are read together.\n");
     fprintf(stderr, "\t<tag string> = The tag attribute string for this tag.  E.g.:\n");
     fprintf(stderr, "\t\tprotocol=ab-eip&gateway=10.206.1.40&path=1,4&cpu=lgx&elem_size=4&elem_count=10&name=TestDINTArray[0]\n");
+    fprintf(stderr, "\tchange_detect=1 is added to the tag string unless it sets change_detect or a deadband.\n");
     fprintf(stderr, "Example:\n");
     fprintf(stderr, "TestData\tdint\t100\tprotocol=ab-eip&gateway=10.206.1.40&path=1,4&cpu=lgx&elem_size=4&elem_count=10&name=TestDINTArray[0]\n");
 }
@@ -491,6 +1311,9 @@ int main(int argc, char **argv)
 {
     int rc;
     struct sigaction act;
+    const char *config_file = NULL;
+    const char *rec_file_name = NULL;
+    int64_t start_time, next_stats;
 
     /* check the library version. */
     if(plc_tag_check_lib_version(REQUIRED_VERSION) != PLCTAG_STATUS_OK) {
@@ -498,19 +1321,35 @@ int main(int argc, char **argv)
         exit(1);
     }
 
-    /* set up signal handler first. */
-    act.sa_handler = SIGINT_handler;
-    sigaction(SIGINT, &act, NULL);
-
-    memset(&tags, 0, sizeof(tags));
+    for(int i=1; i < argc; i++) {
+        if(strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+            return (dump_recording(argv[i + 1]) == PLCTAG_STATUS_OK) ? 0 : 1;
+        } else if(strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            rec_file_name = argv[++i];
+        } else if(strcmp(argv[i], "-i") == 0 && i + 1 < argc) {
+            index_interval = atoi(argv[++i]);
+        } else if(argv[i][0] != '-' && !config_file) {
+            config_file = argv[i];
+        } else {
+            usage();
+            return 1;
+        }
+    }
 
-    if(argc < 2) {
+    if(!config_file || index_interval <= 0) {
         usage();
 
         return 1;
     }
 
-    if((rc = read_config(argv[1])) != PLCTAG_STATUS_OK) {
+    /* set up signal handler first. */
+    memset(&act, 0, sizeof(act));
+    act.sa_handler = SIGINT_handler;
+    sigaction(SIGINT, &act, NULL);
+
+    memset(&tags, 0, sizeof(tags));
+
+    if((rc = read_config(config_file)) != PLCTAG_STATUS_OK) {
         fprintf(stderr,"Unable to read config or set up tags. %s!\n", plc_tag_decode_error(rc));
         destroy_tags();
         return 1;
@@ -527,53 +1366,54 @@ int main(int argc, char **argv)
         return 1;
     }
 
-    while(!terminate) {
-        int num_tags_read = 0;
-        int64_t start, end;
-
-        start = util_time_ms();
-
-        rc = start_reads();
-
-        if(rc == PLCTAG_STATUS_OK) {
-            /* reads kicked off successfully */
-
-            /* wait for the reads to complete */
-            while((rc = check_tags()) == PLCTAG_STATUS_PENDING) {
-                util_sleep_ms(1);
-            }
-
-            end = util_time_ms();
+    if((rc = setup_scan_classes()) != PLCTAG_STATUS_OK) {
+        destroy_tags();
+        return 1;
+    }
 
-            if(rc == PLCTAG_STATUS_OK) {
-                /* tags are ready. */
+    if(rec_file_name && (rc = rec_open(rec_file_name)) != PLCTAG_STATUS_OK) {
+        rec_close();
+        destroy_tags();
+        return 1;
+    }
 
-                for(int t=0; t<num_tags; t++) {
-                    if(tags[t].reading) {
-                        num_tags_read++;
-                    }
-                }
+    start_time = util_time_ms();
+    next_stats = start_time + STATS_INTERVAL_MS;
 
-                if(num_tags_read > 0) {
-                    printf("Read %d tags in %dms\n", num_tags_read, (int)(end-start));
-                }
+    while(!terminate) {
+        int64_t now = util_time_ms();
 
-                rc = log_data();
-            }
+        rc = run_scans(now);
+        if(rc != PLCTAG_STATUS_OK) {
+            fprintf(stderr, "Error, %s, logging data!\n", plc_tag_decode_error(rc));
+            break;
         }
 
-        if(rc != PLCTAG_STATUS_OK) {
-            /* delay a long delay to let the library reconnect. */
-            util_sleep_ms(RECONNECT_DELAY_MS);
-        } else {
-            /* delay a tiny bit. */
-            util_sleep_ms(1);
+        if(now >= next_stats) {
+            print_stats(now - start_time);
+            next_stats = now + STATS_INTERVAL_MS;
         }
+
+        /* delay a tiny bit. */
+        util_sleep_ms(1);
     }
 
     printf("Terminating!\n");
 
+    print_stats(util_time_ms() - start_time);
+
+    rec_close();
+
+    /* stop the callbacks before the tags go away. */
+    pthread_mutex_lock(&tag_mutex);
+    num_mapped = 0;
+    pthread_mutex_unlock(&tag_mutex);
+
     destroy_tags();
 
-    return 0;
+    free(rec_buf);
+    free(index_ts);
+    free(index_offsets);
+
+    return (rc == PLCTAG_STATUS_OK) ? 0 : 1;
 }
@@ -40,13 +40,30 @@
 #include "../lib/libplctag.h"
 #include "utils.h"
 
+/*
+ * List the tags of one or more Logix controllers.
+ *
+ * All the controllers are worked on at the same time.  First the
+ * controller tags of every PLC are listed, then all the programs of all
+ * the PLCs and last one tag of each UDT type so that the library reads the
+ * templates.  Each step creates and reads its tags together, so the time
+ * taken is about that of the slowest controller instead of the sum of all.
+ *
+ * With -m <file> the results go into the library's metadata cache file so
+ * that later programs using that file start with the instance IDs and UDT
+ * templates already known.
+ */
+
 #define REQUIRED_VERSION 2,2,0
 
-#define TAG_STRING_SIZE (200)
+#define TAG_STRING_SIZE (512)
 #define TIMEOUT_MS (5000)
+#define LIST_TIMEOUT_MS (60000)
 
 #define TAG_IS_SYSTEM ((uint16_t)0x1000)
+#define TAG_IS_STRUCT ((uint16_t)0x8000)
 #define TAG_DIM_MASK ((uint16_t)0x6000)
+#define TAG_TEMPLATE_MASK ((uint16_t)0x0FFF)
 
 struct program_entry_s {
     struct program_entry_s *next;
@@ -63,45 +80,239 @@ struct tag_entry_s {
     uint16_t dimensions[3];
 };
 
+struct controller_s {
+    char *host;
+    char *path;
+    int status;
+    int num_tags;
+    int num_programs;
+    int num_templates;
+    struct tag_entry_s *tags;
+    struct program_entry_s *programs;
+};
+
+struct job_s {
+    struct controller_s *controller;
+    char *prefix;
+    int32_t tag_id;
+    int status;
+    char tag_string[TAG_STRING_SIZE];
+};
+
+static struct controller_s *controllers = NULL;
+static int num_controllers = 0;
+static const char *meta_file = NULL;
+
+
 void usage()
 {
-    printf("Usage: list_tags <PLC IP> <PLC path>\nExample: list_tags 10.1.2.3 1,0\n");
+    printf("Usage: list_tags [-m <metadata cache file>] [-f <controller file>] [<PLC IP> <PLC path>]...\n");
+    printf("The controller file has one \"<PLC IP> <PLC path>\" line per controller, lines starting with # are skipped.\n");
+    printf("Example: list_tags 10.1.2.3 1,0\n");
+    printf("Example: list_tags -m plant.meta 10.1.2.3 1,0 10.1.2.4 1,0\n");
     exit(1);
 }
 
-int32_t setup_tag(char *plc_ip, char *path, char *program)
+
+void add_controller(const char *host, const char *path)
 {
-    int32_t tag = PLCTAG_ERR_CREATE;
-    char tag_string[TAG_STRING_SIZE] = {0,};
+    struct controller_s *new_controllers = NULL;
 
-    if(!program || strlen(program) == 0) {
-        snprintf(tag_string, TAG_STRING_SIZE-1,"protocol=ab-eip&gateway=%s&path=%s&cpu=lgx&name=@tags", plc_ip, path);
-    } else {
-        snprintf(tag_string, TAG_STRING_SIZE-1,"protocol=ab-eip&gateway=%s&path=%s&cpu=lgx&name=%s.@tags", plc_ip, path, program);
+    if(!host || strlen(host) == 0) {
+        printf("Hostname or IP address must not be zero length!\n");
+        usage();
+    }
+
+    if(!path || strlen(path) == 0) {
+        printf("PLC path must not be zero length!\n");
+        usage();
+    }
+
+    new_controllers = realloc(controllers, sizeof(*controllers) * (size_t)(num_controllers + 1));
+    if(!new_controllers) {
+        fprintf(stderr, "Unable to allocate memory for the controller list!\n");
+        exit(1);
     }
 
-    //printf("Using tag string: %s\n", tag_string);
+    controllers = new_controllers;
+
+    memset(&controllers[num_controllers], 0, sizeof(controllers[num_controllers]));
+    controllers[num_controllers].host = strdup(host);
+    controllers[num_controllers].path = strdup(path);
+    controllers[num_controllers].status = PLCTAG_STATUS_OK;
+
+    if(!controllers[num_controllers].host || !controllers[num_controllers].path) {
+        fprintf(stderr, "Unable to allocate memory for the controller list!\n");
+        exit(1);
+    }
+
+    num_controllers++;
+}
 
-    tag = plc_tag_create(tag_string, TIMEOUT_MS);
-    if(tag < 0) {
-        printf("Unable to open tag!  Return code %s\n", plc_tag_decode_error(tag));
+
+void read_controller_file(const char *file_name)
+{
+    FILE *file = fopen(file_name, "r");
+    char line[TAG_STRING_SIZE];
+
+    if(!file) {
+        printf("Unable to open controller file %s!\n", file_name);
         usage();
     }
 
-    return tag;
+    while(fgets(line, sizeof(line), file)) {
+        char *host = strtok(line, " \t\r\n");
+        char *path = strtok(NULL, " \t\r\n");
+
+        if(!host || host[0] == '#') {
+            continue;
+        }
+
+        add_controller(host, path);
+    }
+
+    fclose(file);
+}
+
+
+/* a tag string that does not fit fails the job rather than naming the wrong tag. */
+void set_tag_string(struct job_s *job, const char *name, const char *extra)
+{
+    struct controller_s *controller = job->controller;
+    int len = 0;
+
+    len = snprintf(job->tag_string, TAG_STRING_SIZE, "protocol=ab-eip&gateway=%s&path=%s&cpu=lgx&name=%s%s%s%s",
+                   controller->host, controller->path, name, (extra ? extra : ""),
+                   (meta_file ? "&metadata_cache_file=" : ""), (meta_file ? meta_file : ""));
+
+    if(len < 0 || len >= TAG_STRING_SIZE) {
+        fprintf(stderr, "Tag string for %s on %s %s is too long!\n", name, controller->host, controller->path);
+        job->status = PLCTAG_ERR_TOO_LARGE;
+    }
+}
+
+
+struct job_s *add_job(struct job_s **jobs, int *num_jobs, struct controller_s *controller)
+{
+    struct job_s *new_jobs = realloc(*jobs, sizeof(**jobs) * (size_t)(*num_jobs + 1));
+
+    if(!new_jobs) {
+        fprintf(stderr, "Unable to allocate memory for the job list!\n");
+        exit(1);
+    }
+
+    *jobs = new_jobs;
+
+    memset(&new_jobs[*num_jobs], 0, sizeof(new_jobs[*num_jobs]));
+    new_jobs[*num_jobs].controller = controller;
+
+    return &new_jobs[(*num_jobs)++];
 }
 
 
-void get_list(int32_t tag, char *prefix, struct tag_entry_s **tag_list, struct program_entry_s **prog_list)
+/*
+ * Create all the tags of the jobs at once, wait for them and read them
+ * together.  Each job gets the status of its tag.
+ */
+void run_jobs(struct job_s *jobs, int num_jobs)
+{
+    int32_t *ids = NULL;
+    int *statuses = NULL;
+    int *job_index = NULL;
+    int num_ids = 0;
+    int pending = 0;
+    int64_t deadline = util_time_ms() + TIMEOUT_MS;
+
+    if(num_jobs <= 0) {
+        return;
+    }
+
+    for(int i=0; i < num_jobs; i++) {
+        /* the job already failed if its tag string did not fit. */
+        if(jobs[i].status != PLCTAG_STATUS_OK) {
+            jobs[i].tag_id = PLCTAG_ERR_NOT_FOUND;
+            continue;
+        }
+
+        jobs[i].tag_id = plc_tag_create(jobs[i].tag_string, 0);
+        jobs[i].status = (jobs[i].tag_id < 0 ? jobs[i].tag_id : PLCTAG_STATUS_PENDING);
+    }
+
+    do {
+        pending = 0;
+
+        for(int i=0; i < num_jobs; i++) {
+            if(jobs[i].status == PLCTAG_STATUS_PENDING) {
+                jobs[i].status = plc_tag_status(jobs[i].tag_id);
+
+                if(jobs[i].status == PLCTAG_STATUS_PENDING) {
+                    pending++;
+                }
+            }
+        }
+
+        if(pending > 0) {
+            util_sleep_ms(10);
+        }
+    } while(pending > 0 && util_time_ms() < deadline);
+
+    ids = calloc((size_t)num_jobs, sizeof(*ids));
+    statuses = calloc((size_t)num_jobs, sizeof(*statuses));
+    job_index = calloc((size_t)num_jobs, sizeof(*job_index));
+
+    if(!ids || !statuses || !job_index) {
+        fprintf(stderr, "Unable to allocate memory for the tag reads!\n");
+        exit(1);
+    }
+
+    for(int i=0; i < num_jobs; i++) {
+        if(jobs[i].status == PLCTAG_STATUS_PENDING) {
+            jobs[i].status = PLCTAG_ERR_TIMEOUT;
+        }
+
+        if(jobs[i].status == PLCTAG_STATUS_OK) {
+            ids[num_ids] = jobs[i].tag_id;
+            job_index[num_ids] = i;
+            num_ids++;
+        }
+    }
+
+    /* one call so that the requests to each PLC are packed together. */
+    if(num_ids > 0) {
+        plc_tag_read_many(ids, num_ids, statuses, LIST_TIMEOUT_MS);
+
+        for(int i=0; i < num_ids; i++) {
+            jobs[job_index[i]].status = statuses[i];
+        }
+    }
+
+    free(ids);
+    free(statuses);
+    free(job_index);
+}
+
+
+void destroy_jobs(struct job_s *jobs, int num_jobs)
+{
+    for(int i=0; i < num_jobs; i++) {
+        if(jobs[i].tag_id >= 0) {
+            plc_tag_destroy(jobs[i].tag_id);
+        }
+    }
+
+    free(jobs);
+}
+
+
+int get_list(int32_t tag, char *prefix, struct tag_entry_s **tag_list, struct program_entry_s **prog_list, struct controller_s *controller)
 {
     int rc = PLCTAG_STATUS_OK;
     int offset = 0;
     int prefix_size = 0;
 
-    rc = plc_tag_read(tag, TIMEOUT_MS);
-    if(rc != PLCTAG_STATUS_OK) {
-        printf("Unable to read tag!  Return code %s\n",plc_tag_decode_error(tag));
-        usage();
+    /* an empty program has nothing to list. */
+    if(plc_tag_get_size(tag) <= 0) {
+        return PLCTAG_STATUS_OK;
     }
 
     /* get the prefix length */
@@ -149,12 +360,16 @@ void get_list(int32_t tag, char *prefix, struct tag_entry_s **tag_list, struct p
 
         /* use library support for strings. Offset points to the start of the string. */
         tag_name_len = plc_tag_get_string_length(tag, offset) + 1; /* add +1 for the zero byte. */
+        if(tag_name_len <= 0) {
+            fprintf(stderr, "Unable to get the tag name string length, got error %s!\n", plc_tag_decode_error(tag_name_len - 1));
+            return tag_name_len - 1;
+        }
 
         /* allocate space for the prefix plus the tag name. */
         tag_name = malloc((size_t)(unsigned int)(tag_name_len + prefix_size));
         if(!tag_name) {
             fprintf(stderr, "Unable to allocate memory for the tag name!\n");
-            usage();
+            return PLCTAG_ERR_NO_MEM;
         }
 
         /* copy the prefix string. */
@@ -165,11 +380,10 @@ void get_list(int32_t tag, char *prefix, struct tag_entry_s **tag_list, struct p
         rc = plc_tag_get_string(tag, offset, tag_name + prefix_size, tag_name_len);
         if(rc != PLCTAG_STATUS_OK) {
             fprintf(stderr, "Unable to get the tag name string, got error %s!\n", plc_tag_decode_error(rc));
-            usage();
+            free(tag_name);
+            return rc;
         }
 
-        /* fprintf(stderr, "Tag %s, string length: %d.\n", tag_name, (int)(unsigned int)strlen(tag_name)); */
-
         /* skip past the string. */
         offset += plc_tag_get_string_total_length(tag, offset);
 
@@ -179,27 +393,27 @@ void get_list(int32_t tag, char *prefix, struct tag_entry_s **tag_list, struct p
 
             if(!entry) {
                 fprintf(stderr,"Unable to allocate memory for program entry!\n");
-                usage();
+                free(tag_name);
+                return PLCTAG_ERR_NO_MEM;
             }
 
-            //printf("index %d: Found program: %s\n", index, tag_name);
-
             entry->next = *prog_list;
             entry->program_name = tag_name;
 
             *prog_list = entry;
+
+            controller->num_programs++;
         } else if(!(tag_type & TAG_IS_SYSTEM)) {
             struct tag_entry_s *tag_entry = calloc(1, sizeof(*tag_entry));
 
             if(!tag_entry) {
                 fprintf(stderr, "Unable to allocate memory for tag entry!\n");
-                usage();
+                free(tag_name);
+                return PLCTAG_ERR_NO_MEM;
             }
 
             tag_entry->elem_count = 1;
 
-            //printf("index %d: Found tag name=%s, tag instance ID=%x, tag type=%x, element length (in bytes) = %d, array dimensions = (%d, %d, %d)\n", index, tag_name, tag_instance_id, tag_type, (int)element_length, (int)array_dims[0], (int)array_dims[1], (int)array_dims[2]);
-
             /* fill in the fields. */
             tag_entry->name = tag_name;
             tag_entry->type = tag_type;
@@ -216,76 +430,156 @@ void get_list(int32_t tag, char *prefix, struct tag_entry_s **tag_list, struct p
             /* link it up to the list */
             tag_entry->next = *tag_list;
             *tag_list = tag_entry;
+
+            controller->num_tags++;
         } else {
-            //printf("index %d: Found system tag name=%s, tag instance ID=%x, tag type=%x, element length (in bytes) = %d, array dimensions = (%d, %d, %d)\n", index, tag_name, tag_instance_id, tag_type, (int)element_length, (int)array_dims[0], (int)array_dims[1], (int)array_dims[2]);
             free(tag_name);
         }
     } while(rc == PLCTAG_STATUS_OK && offset < plc_tag_get_size(tag));
 
-    plc_tag_destroy(tag);
+    return rc;
 }
 
 
+void list_controllers(void)
+{
+    struct job_s *jobs = NULL;
+    int num_jobs = 0;
 
+    fprintf(stderr, "Getting controller tags from %d controllers.\n", num_controllers);
 
-int main(int argc, char **argv)
-{
-    char *host = NULL;
-    char *path = NULL;
-    int32_t tag;
-    struct program_entry_s *programs = NULL;
-    struct tag_entry_s *tags = NULL;
+    for(int c=0; c < num_controllers; c++) {
+        struct job_s *job = add_job(&jobs, &num_jobs, &controllers[c]);
 
-    /* check the library version. */
-    if(plc_tag_check_lib_version(REQUIRED_VERSION) != PLCTAG_STATUS_OK) {
-        fprintf(stderr, "Required compatible library version %d.%d.%d not available!", REQUIRED_VERSION);
-        exit(1);
+        set_tag_string(job, "@tags", NULL);
     }
 
-    if(argc < 3) {
-        usage();
+    run_jobs(jobs, num_jobs);
+
+    for(int i=0; i < num_jobs; i++) {
+        struct controller_s *controller = jobs[i].controller;
+
+        if(jobs[i].status == PLCTAG_STATUS_OK) {
+            jobs[i].status = get_list(jobs[i].tag_id, NULL, &controller->tags, &controller->programs, controller);
+        }
+
+        if(jobs[i].status != PLCTAG_STATUS_OK) {
+            fprintf(stderr, "Unable to list the tags of %s %s, got error %s!\n", controller->host, controller->path, plc_tag_decode_error(jobs[i].status));
+            controller->status = jobs[i].status;
+        }
     }
 
-    if(!argv[1] || strlen(argv[1]) == 0) {
-        printf("Hostname or IP address must not be zero length!\n");
-        usage();
+    destroy_jobs(jobs, num_jobs);
+}
+
+
+void list_programs(void)
+{
+    struct job_s *jobs = NULL;
+    int num_jobs = 0;
+
+    for(int c=0; c < num_controllers; c++) {
+        for(struct program_entry_s *program = controllers[c].programs; program && controllers[c].status == PLCTAG_STATUS_OK; program = program->next) {
+            struct job_s *job = add_job(&jobs, &num_jobs, &controllers[c]);
+            char name[TAG_STRING_SIZE];
+
+            snprintf(name, sizeof(name), "%s.@tags", program->program_name);
+
+            job->prefix = program->program_name;
+            set_tag_string(job, name, NULL);
+        }
     }
 
-    host = argv[1];
+    fprintf(stderr, "Getting tags for %d programs.\n", num_jobs);
 
-    if(!argv[2] || strlen(argv[2]) == 0) {
-        printf("PLC path must not be zero length!\n");
-        usage();
+    run_jobs(jobs, num_jobs);
+
+    for(int i=0; i < num_jobs; i++) {
+        struct controller_s *controller = jobs[i].controller;
+
+        if(jobs[i].status == PLCTAG_STATUS_OK) {
+            jobs[i].status = get_list(jobs[i].tag_id, jobs[i].prefix, &controller->tags, NULL, controller);
+        }
+
+        if(jobs[i].status != PLCTAG_STATUS_OK) {
+            fprintf(stderr, "Unable to list the tags of program %s on %s %s, got error %s!\n", jobs[i].prefix, controller->host, controller->path, plc_tag_decode_error(jobs[i].status));
+            controller->status = jobs[i].status;
+        }
     }
 
-    path = argv[2];
+    destroy_jobs(jobs, num_jobs);
+}
 
-    /* get the controller tags first. */
 
-    fprintf(stderr, "Getting controller tags.\n");
+/* reading one element of a tag of each UDT type makes the library read its templates. */
+void read_templates(void)
+{
+    struct job_s *jobs = NULL;
+    int num_jobs = 0;
+    static uint8_t seen[TAG_TEMPLATE_MASK + 1];
 
-    tag = setup_tag(host, path, NULL);
+    for(int c=0; c < num_controllers; c++) {
+        if(controllers[c].status != PLCTAG_STATUS_OK) {
+            continue;
+        }
 
-    get_list(tag, NULL, &tags, &programs);
+        memset(seen, 0, sizeof(seen));
 
-    while(programs) {
-        struct program_entry_s *program = programs;
+        for(struct tag_entry_s *tag = controllers[c].tags; tag; tag = tag->next) {
+            uint16_t template_id = (uint16_t)(tag->type & TAG_TEMPLATE_MASK);
+            char name[TAG_STRING_SIZE];
+            struct job_s *job = NULL;
 
-        fprintf(stderr, "Getting tags for program: %s.\n", program->program_name);
-        tag = setup_tag(argv[1], argv[2], program->program_name);
-        get_list(tag, program->program_name, &tags, NULL);
+            if(!(tag->type & TAG_IS_STRUCT) || seen[template_id]) {
+                continue;
+            }
 
-        /* go to the next one */
-        programs = programs->next;
+            seen[template_id] = 1;
 
-        /* now clean up */
-        free(program->program_name);
-        free(program);
+            switch(tag->num_dimensions) {
+                case 1:
+                    snprintf(name, sizeof(name), "%s[0]", tag->name);
+                    break;
+
+                case 2:
+                    snprintf(name, sizeof(name), "%s[0,0]", tag->name);
+                    break;
+
+                case 3:
+                    snprintf(name, sizeof(name), "%s[0,0,0]", tag->name);
+                    break;
+
+                default:
+                    snprintf(name, sizeof(name), "%s", tag->name);
+                    break;
+            }
+
+            job = add_job(&jobs, &num_jobs, &controllers[c]);
+            set_tag_string(job, name, "&elem_count=1&udt_templates=1");
+        }
     }
 
-    /* loop over the tags and output their connection strings. */
-    while(tags) {
-        struct tag_entry_s *tag = tags;
+    fprintf(stderr, "Getting templates for %d UDT types.\n", num_jobs);
+
+    run_jobs(jobs, num_jobs);
+
+    for(int i=0; i < num_jobs; i++) {
+        if(jobs[i].status == PLCTAG_STATUS_OK) {
+            jobs[i].controller->num_templates++;
+        } else {
+            /* a tag we cannot read does not stop the listing. */
+            fprintf(stderr, "Unable to read the UDT templates with %s, got error %s!\n", jobs[i].tag_string, plc_tag_decode_error(jobs[i].status));
+        }
+    }
+
+    destroy_jobs(jobs, num_jobs);
+}
+
+
+void print_tags(struct controller_s *controller)
+{
+    while(controller->tags) {
+        struct tag_entry_s *tag = controller->tags;
 
         printf("Tag \"%s", tag->name);
         switch(tag->num_dimensions) {
@@ -305,13 +599,84 @@ int main(int argc, char **argv)
                 break;
         }
 
-        printf("\" (%04x): protocol=ab-eip&gateway=%s&path=%s&plc=ControlLogix&elem_size=%u&elem_count=%u&name=%s\n", tag->type, host, path, tag->elem_size, tag->elem_count, tag->name);
+        printf("\" (%04x): protocol=ab-eip&gateway=%s&path=%s&plc=ControlLogix&elem_size=%u&elem_count=%u&name=%s\n", tag->type, controller->host, controller->path, tag->elem_size, tag->elem_count, tag->name);
 
-        tags = tag->next;
+        controller->tags = tag->next;
 
         free(tag->name);
         free(tag);
     }
 
-    return 0;
+    while(controller->programs) {
+        struct program_entry_s *program = controller->programs;
+
+        controller->programs = program->next;
+
+        free(program->program_name);
+        free(program);
+    }
+}
+
+
+int main(int argc, char **argv)
+{
+    int failed = 0;
+    int64_t start_time = 0;
+
+    /* check the library version. */
+    if(plc_tag_check_lib_version(REQUIRED_VERSION) != PLCTAG_STATUS_OK) {
+        fprintf(stderr, "Required compatible library version %d.%d.%d not available!", REQUIRED_VERSION);
+        exit(1);
+    }
+
+    for(int i=1; i < argc; i++) {
+        if(strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+            meta_file = argv[++i];
+        } else if(strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+            read_controller_file(argv[++i]);
+        } else if(argv[i][0] != '-' && i + 1 < argc) {
+            add_controller(argv[i], argv[i + 1]);
+            i++;
+        } else {
+            usage();
+        }
+    }
+
+    if(num_controllers == 0) {
+        usage();
+    }
+
+    start_time = util_time_ms();
+
+    list_controllers();
+    list_programs();
+    read_templates();
+
+    /* loop over the tags and output their connection strings. */
+    for(int c=0; c < num_controllers; c++) {
+        struct controller_s *controller = &controllers[c];
+
+        fprintf(stderr, "Controller %s %s: %d tags, %d programs, %d UDT types%s%s.\n", controller->host, controller->path,
+                controller->num_tags, controller->num_programs, controller->num_templates,
+                (controller->status == PLCTAG_STATUS_OK ? "" : ", error "),
+                (controller->status == PLCTAG_STATUS_OK ? "" : plc_tag_decode_error(controller->status)));
+
+        if(controller->status != PLCTAG_STATUS_OK) {
+            failed++;
+        }
+
+        print_tags(controller);
+
+        free(controller->host);
+        free(controller->path);
+    }
+
+    free(controllers);
+
+    fprintf(stderr, "Listed %d controllers in %dms.\n", num_controllers, (int)(util_time_ms() - start_time));
+
+    /* make sure the metadata cache is written out. */
+    plc_tag_shutdown();
+
+    return (failed ? 1 : 0);
 }
@@ -37,9 +37,13 @@
 #include <platform.h>
 #include <util/attr.h>
 #include <util/debug.h>
+#include <util/rc.h>
 #include <ab/ab.h>
+#include <ab/df1.h>
 #include <mb/modbus.h>
 #include <system/system.h>
+#include <shared/shared.h>
+#include <alias/alias.h>
 #include <lib/init.h>
 
 
@@ -62,8 +66,16 @@ struct {
     /* Allen-Bradley PLCs */
     {"ab-eip", NULL, NULL, NULL, ab_tag_create},
     {"ab_eip", NULL, NULL, NULL, ab_tag_create},
+    {"ab-df1", NULL, NULL, NULL, df1_tag_create},
+    {"ab_df1", NULL, NULL, NULL, df1_tag_create},
     {"modbus-tcp", NULL, NULL, NULL, mb_tag_create},
-    {"modbus_tcp", NULL, NULL, NULL, mb_tag_create}
+    {"modbus_tcp", NULL, NULL, NULL, mb_tag_create},
+    {"modbus-rtu", NULL, NULL, NULL, mb_tag_create},
+    {"modbus_rtu", NULL, NULL, NULL, mb_tag_create},
+    {"modbus-rtu-tcp", NULL, NULL, NULL, mb_tag_create},
+    {"modbus_rtu_tcp", NULL, NULL, NULL, mb_tag_create},
+    /* tags published to shared memory by another process */
+    {"shared", NULL, NULL, NULL, shared_tag_create}
 };
 
 static lock_t library_initialization_lock = LOCK_INIT;
@@ -92,6 +104,12 @@ tag_create_function find_tag_create_func(attr attributes)
     const char *model = attr_get_str(attributes, "model", NULL);
     int num_entries = (sizeof(tag_type_map)/sizeof(tag_type_map[0]));
 
+    /* alias tags are views on another tag, they have no protocol of their own. */
+    if(attr_get_int(attributes, "alias_of", 0) > 0) {
+        pdebug(DEBUG_INFO, "Matched alias_of.");
+        return alias_tag_create;
+    }
+
     /* if protocol is set, then use it to match. */
     if(protocol && str_length(protocol) > 0) {
         for(i=0; i < num_entries; i++) {
@@ -144,8 +162,14 @@ void destroy_modules(void)
 {
     ab_teardown();
 
+    df1_teardown();
+
     mb_teardown();
 
+    shared_teardown();
+
+    alias_teardown();
+
     lib_teardown();
 
     spin_block(&library_initialization_lock) {
@@ -158,6 +182,8 @@ void destroy_modules(void)
 
     plc_tag_unregister_logger();
 
+    rc_cache_flush();
+
     library_initialized = 0;
 }
 
@@ -212,11 +238,26 @@ int initialize_modules(void)
                     rc = ab_init();
                 }
 
+                pdebug(DEBUG_INFO,"Initializing DF1 module.");
+                if(rc == PLCTAG_STATUS_OK) {
+                    rc = df1_init();
+                }
+
                 pdebug(DEBUG_INFO,"Initializing Modbus module.");
                 if(rc == PLCTAG_STATUS_OK) {
                     rc = mb_init();
                 }
 
+                pdebug(DEBUG_INFO,"Initializing shared memory module.");
+                if(rc == PLCTAG_STATUS_OK) {
+                    rc = shared_init();
+                }
+
+                pdebug(DEBUG_INFO,"Initializing alias module.");
+                if(rc == PLCTAG_STATUS_OK) {
+                    rc = alias_init();
+                }
+
                 /* hook the destructor */
                 atexit(destroy_modules);
 
@@ -37,35 +37,443 @@
 #include <float.h>
 #include <inttypes.h>
 #include <limits.h>
+#include <stdio.h>
+#include <string.h>
 #include <lib/libplctag.h>
 #include <lib/tag.h>
 #include <lib/init.h>
 #include <lib/version.h>
 #include <platform.h>
+#include <util/arena.h>
 #include <util/attr.h>
 #include <util/debug.h>
 #include <util/hash.h>
 #include <util/hashtable.h>
+#include <util/metrics.h>
 #include <util/rc.h>
+#include <util/trace.h>
 #include <util/vector.h>
 #include <ab/ab.h>
 #include <mb/modbus.h>
+#include <shared/shared.h>
+#include <alias/alias.h>
 
 
-#define INITIAL_TAG_TABLE_SIZE (201)
-
 #define TAG_ID_MASK (0xFFFFFFF)
 
-#define MAX_TAG_MAP_ATTEMPTS (50)
+/*
+ * tag handle table.  The low bits of a tag ID are the slot index and the
+ * high bits are the generation of the slot.
+ */
+#define TAG_SLOT_BITS (18)
+#define TAG_SLOT_MASK ((1 << TAG_SLOT_BITS) - 1)
+#define TAG_SLOT_CHUNK_BITS (10)
+#define TAG_SLOT_CHUNK_SIZE (1 << TAG_SLOT_CHUNK_BITS)
+#define TAG_SLOT_MAX_CHUNKS (1 << (TAG_SLOT_BITS - TAG_SLOT_CHUNK_BITS))
+#define TAG_SLOT_MAX_GEN ((TAG_ID_MASK >> TAG_SLOT_BITS) - 1)
+#define TAG_SLOT_AT(index) (&tag_slot_chunks[(index) >> TAG_SLOT_CHUNK_BITS][(index) & (TAG_SLOT_CHUNK_SIZE - 1)])
+
+/* tickler scheduling. */
+#define TAG_SCHED_INITIAL_CAPACITY (200)
+#define TAG_SCHED_POLL_MS (1)
+#define TAG_SCHED_MAX_WAIT_MS (100)
+#define TAG_SCHED_BATCH_SIZE (64)
+#define TAG_SCHED_MAX_SHARDS (64)
+
+/* element types whose tag byte order matches host memory. */
+#define TAG_NATIVE_INT16 (0x01)
+#define TAG_NATIVE_INT32 (0x02)
+#define TAG_NATIVE_INT64 (0x04)
+#define TAG_NATIVE_FLOAT32 (0x08)
+#define TAG_NATIVE_FLOAT64 (0x10)
+
+/* value change detection. */
+#define TAG_CHANGE_MAX_RANGES (16)
+
+/* write dirty range tracking. */
+#define TAG_DIRTY_MAX_RANGES (16)
+
+/* upper limit for the history_depth attribute. */
+#define TAG_HISTORY_MAX_DEPTH (65536)
+#define TAG_DIRTY_MERGE_GAP (32)
+
+#define TAG_CHANGE_TYPE_BYTES (0)
+#define TAG_CHANGE_TYPE_INT8 (1)
+#define TAG_CHANGE_TYPE_UINT8 (2)
+#define TAG_CHANGE_TYPE_INT16 (3)
+#define TAG_CHANGE_TYPE_UINT16 (4)
+#define TAG_CHANGE_TYPE_INT32 (5)
+#define TAG_CHANGE_TYPE_UINT32 (6)
+#define TAG_CHANGE_TYPE_INT64 (7)
+#define TAG_CHANGE_TYPE_UINT64 (8)
+#define TAG_CHANGE_TYPE_FLOAT32 (9)
+#define TAG_CHANGE_TYPE_FLOAT64 (10)
+
+/* callback dispatch pool. */
+#define TAG_CALLBACK_MAX_THREADS (16)
+#define TAG_CALLBACK_QUEUE_SIZE (1024)
+#define TAG_CALLBACK_WAIT_MS (100)
+
+/* lock-free snapshot attempts before falling back to the API mutex. */
+#define TAG_SNAPSHOT_MAX_ATTEMPTS (100)
+
+/* lock-free attempts per value in plc_tag_get_values(). */
+#define TAG_VALUES_MAX_ATTEMPTS (10)
+
+/* longest time a blocking call waits between status checks. */
+#define TAG_WAIT_POLL_MS (10)
+
+/* bulk tag creation. */
+#define TAG_CREATE_MAX_THREADS (8)
+#define TAG_CREATE_MIN_BATCH (64)
 
 /* these are only internal to the file */
 
-static volatile int32_t next_tag_id = 10; /* MAGIC */
-static volatile hashtable_p tags = NULL;
+/*
+ * Tag handle table.
+ *
+ * Lookups only take the spin lock of the tag's slot so threads using
+ * different tags do not contend.  The lookup mutex serializes adding and
+ * removing tags.  Chunks of slots are only freed when the library shuts
+ * down so a slot is always safe to touch once its chunk exists.
+ */
+typedef struct {
+    lock_t lock;
+    int32_t tag_id;
+    plc_tag_p tag;
+    int32_t generation;
+    int32_t next_free;
+    int32_t live_index;
+} tag_slot_t;
+
+static tag_slot_t * volatile tag_slot_chunks[TAG_SLOT_MAX_CHUNKS] = { NULL };
+static int tag_slot_num_chunks = 0;
+static int32_t tag_slot_free_head = -1;
+static int32_t tag_slot_free_tail = -1;
 static mutex_p tag_lookup_mutex = NULL;
 
+/*
+ * Every live tag is also kept in a dense array so that walking all the
+ * tags does not visit empty slots.  Removal moves the last entry into the
+ * hole.  Protected by the lookup mutex.
+ */
+typedef struct {
+    plc_tag_p tag;
+    int32_t slot_index;
+} tag_live_entry_t;
+
+#define TAG_LIVE_MIN_CAPACITY (64)
+
+static tag_live_entry_t *tag_live = NULL;
+static int tag_live_count = 0;
+static int tag_live_capacity = 0;
+
 static volatile int library_terminating = 0;
-static thread_p tag_tickler_thread = NULL;
+
+/*
+ * Tickler schedule.
+ *
+ * The tickler thread does not scan the tag table.  Each tag that needs
+ * attention (an automatic read or write coming due or an operation in
+ * flight) has an entry in a min-heap ordered by the time at which the
+ * tickler must look at it next.  The tickler sleeps until the earliest
+ * deadline or until it is signalled that a tag's deadline moved earlier.
+ *
+ * Entries are never removed from the middle of the heap.  Each tag keeps
+ * the deadline of its live entry in sched_next_tick and any entry that
+ * does not match that when it comes off the heap is stale and is dropped.
+ */
+typedef struct {
+    int64_t deadline;
+    int32_t tag_id;
+} tag_sched_entry_t;
+
+/*
+ * The schedule is split into shards, each with its own heap and tickler
+ * thread.  Tags are assigned to a shard by their gateway and path so that
+ * all the tags of one PLC share a shard and a slow PLC only holds up the
+ * other PLCs in its shard.  A tag's sched_next_tick is protected by the
+ * mutex of its shard.  The number of shards is fixed while the library is
+ * initialized.
+ */
+typedef struct {
+    mutex_p mutex;
+    cond_p cond;
+    thread_p thread;
+    tag_sched_entry_t *heap;
+    int heap_size;
+    int heap_capacity;
+    metrics_block_p metrics;
+} tag_sched_shard_t;
+
+static int tag_sched_config_shards = 1;
+static tag_sched_shard_t *tag_sched_shards = NULL;
+static int tag_sched_num_shards = 0;
+
+/*
+ * Thread tuning.
+ *
+ * Set with the <class>_thread_cpus and <class>_thread_priority library
+ * attributes.  They apply to threads started after they are set, so set
+ * them before creating the first tag.  Zero is the platform default.
+ */
+static const char *tag_thread_class_names[PLCTAG_THREAD_NUM_CLASSES] = { "tickler", "session", "modbus", "callback" };
+static volatile int tag_thread_cpus[PLCTAG_THREAD_NUM_CLASSES] = { 0 };
+static volatile int tag_thread_priority[PLCTAG_THREAD_NUM_CLASSES] = { 0 };
+
+/*
+ * CPU accounting.
+ *
+ * With the cpu_accounting library attribute set, the time spent in each
+ * tag's tickle and in packing and unpacking its requests in the session
+ * threads is added up by tag ID.  Entries outlive their tags so tags that
+ * are created and destroyed over and over still show up.
+ */
+#define TAG_CPU_MAX_TAGS (4096)
+
+typedef struct {
+    int32_t tag_id;
+    int64_t tickler_ns;
+    int64_t session_ns;
+} tag_cpu_entry_t;
+
+typedef struct {
+    int32_t *ids;
+    int64_t *tickler_ns;
+    int64_t *session_ns;
+    int max_count;
+    int count;
+    tag_cpu_entry_t *top;
+} tag_cpu_top_t;
+
+volatile int tag_cpu_accounting = 0;
+static lock_t tag_cpu_lock = LOCK_INIT;
+static hashtable_p tag_cpu_table = NULL;
+
+/*
+ * Read groups.
+ *
+ * Groups live until the library shuts down.  Tags point directly at their
+ * group.  The group keeps the IDs of its members and whether each member
+ * has a read outstanding in the current group read cycle.
+ */
+typedef struct {
+    int32_t tag_id;
+    int read_pending;
+} tag_group_member_t;
+
+struct tag_group_t {
+    struct tag_group_t *next;
+    char *name;
+    void (*callback)(const char *group_name, int event, int status);
+    tag_group_member_t *members;
+    int num_members;
+    int member_capacity;
+    int reads_pending;
+    int read_status;
+};
+
+static mutex_p tag_group_mutex = NULL;
+static tag_group_p tag_groups = NULL;
+
+
+/*
+ * Scan classes.
+ *
+ * Tags read automatically at the same period, or that name the same
+ * scan_class, share one read schedule.  All their reads come due at the
+ * same instant, so the tickler queues them in one batch and the session
+ * packs them together.  Classes live until the library shuts down.
+ *
+ * Each PLC has its own classes.  So that the classes of a PLC do not all
+ * fire on the same whole second, each new one is offset within its period
+ * by the golden ratio from the one before, starting from a point picked
+ * from the PLC.  However many classes there are, their scans stay spread
+ * out, and different PLCs do not line up with each other either.
+ *
+ * Classes have a scan_priority.  When a PLC cannot keep up, the classes
+ * below its top priority are stretched to a multiple of their period so
+ * that the top priority ones stay on time.  The PLC is behind when reads
+ * come due more than a period late, or when the average read takes more
+ * than half the period of its fastest top priority class.  The stretch
+ * doubles each period that the PLC is behind, and halves each period once
+ * reads are back under a quarter of it.  Stretching by powers of two
+ * keeps the members of a class on the same scans.
+ */
+#define TAG_SCAN_PHASE_STEPS (1000)
+#define TAG_SCAN_PHASE_STEP (618)
+#define TAG_SCAN_MAX_STRETCH (16)
+
+typedef struct tag_scan_plc_t {
+    struct tag_scan_plc_t *next;
+    uint32_t plc_key;
+    int num_classes;
+    int top_priority;
+    int32_t budget_ms;
+    int64_t read_us_avg;
+    uint32_t overruns;
+} tag_scan_plc_t;
+
+struct tag_scan_class_t {
+    struct tag_scan_class_t *next;
+    char *name;
+    tag_scan_plc_t *plc;
+    int priority;
+    int32_t period_ms;
+    int64_t phase_ms;
+    int32_t stretch;
+    int64_t last_adjust_ms;
+    uint32_t last_overruns;
+};
+
+static mutex_p tag_scan_class_mutex = NULL;
+static tag_scan_class_p tag_scan_classes = NULL;
+static tag_scan_plc_t *tag_scan_plcs = NULL;
+
+
+/*
+ * Value change detection.
+ *
+ * The previous sample is kept in the same block as the rest of the state so
+ * that the protocol tag destructors can free it with mem_free().  Elements
+ * within the deadband keep their previous reference value so that slow
+ * drift is still reported once it exceeds the deadband.
+ */
+typedef struct {
+    int offset;
+    int length;
+} tag_change_range_t;
+
+struct tag_change_t {
+    int elem_type;
+    int elem_size;
+    double deadband;
+    int has_sample;
+    int sample_size;
+    int num_ranges;
+    tag_change_range_t ranges[TAG_CHANGE_MAX_RANGES];
+    uint8_t sample[];
+};
+
+
+/*
+ * Read history.
+ *
+ * A ring of the last reads of the tag.  Each record is the time stamp of
+ * the read from time_us() followed by the tag data.  The records are in
+ * the same block as the rest of the state so that the protocol tag
+ * destructors can free it with mem_free().
+ */
+struct tag_history_t {
+    int depth;
+    int data_size;
+    int first;          /* index of the oldest record. */
+    int count;
+    uint32_t dropped;   /* records overwritten before they were read. */
+    uint8_t records[];
+};
+
+#define TAG_HISTORY_RECORD_SIZE(data_size) (PLCTAG_HISTORY_TIMESTAMP_SIZE + (data_size))
+
+
+/*
+ * Write dirty range tracking.
+ *
+ * The setters record the bytes they change.  The ranges are kept sorted
+ * and spans closer than the merge gap are joined, since a request header
+ * costs more than a few unchanged bytes.  There is one spare slot so that
+ * a new range can be inserted before the closest pair is merged.
+ */
+struct tag_dirty_t {
+    int merge_gap;
+    int num_ranges;
+    tag_change_range_t ranges[TAG_DIRTY_MAX_RANGES + 1];
+};
+
+
+/*
+ * Callback dispatch pool.
+ *
+ * When the callback_threads library attribute is set, the tickler does not
+ * call tag and group callbacks itself.  It queues the events on a worker
+ * chosen by the tag's slot (or the group) so all the events of one tag are
+ * delivered in order by the same worker.  A slow callback then only delays
+ * the other tags sharing its worker instead of every PLC read.
+ *
+ * Each worker has a bounded ring of events.  When a ring is full the
+ * producer waits a little for space.  If there still is none, the event
+ * and all later ones for that worker go on an overflow list behind the
+ * ring, so events are never dropped or reordered and the tickler is not
+ * held up by a callback that waits on it.
+ */
+typedef struct {
+    int32_t tag_id;
+    tag_group_p group;
+    int event;
+    int status;
+} tag_callback_event_t;
+
+typedef struct tag_callback_overflow_t {
+    struct tag_callback_overflow_t *next;
+    tag_callback_event_t event;
+} tag_callback_overflow_t;
+
+typedef struct {
+    mutex_p mutex;
+    cond_p not_empty;
+    cond_p not_full;
+    thread_p thread;
+    int head;
+    int count;
+    int terminating;
+    tag_callback_overflow_t *overflow_head;
+    tag_callback_overflow_t *overflow_tail;
+    tag_callback_event_t events[TAG_CALLBACK_QUEUE_SIZE];
+} tag_callback_worker_t;
+
+typedef struct {
+    int num_workers;
+    tag_callback_worker_t workers[];
+} tag_callback_pool_t;
+
+typedef tag_callback_pool_t *tag_callback_pool_p;
+
+static mutex_p tag_callback_mutex = NULL;
+static tag_callback_pool_p tag_callback_pool = NULL;
+
+
+/*
+ * With the tag_lock_pool library attribute set, new tags take their API
+ * and external mutexes from two fixed pools instead of creating their
+ * own.  Tags are spread over the pools in creation order.  The pooled
+ * mutexes are recursive, so a thread holding two tags that share one is
+ * fine.
+ */
+
+#define TAG_LOCK_POOL_SIZE (256)
+
+static volatile int tag_lock_pool_enabled = 0;
+static lock_t tag_lock_pool_lock = LOCK_INIT;
+static uint32_t tag_lock_pool_next = 0;
+static mutex_p tag_lock_pool_api[TAG_LOCK_POOL_SIZE];
+static mutex_p tag_lock_pool_ext[TAG_LOCK_POOL_SIZE];
+
+
+/* the data plc_tag_write_fanout() copies into every tag. */
+typedef struct {
+    int offset;
+    const uint8_t *buffer;
+    int length;
+} tag_write_source_t;
+
+/* one slice of a plc_tag_create_many() call. */
+typedef struct {
+    const char **attrib_strs;
+    plc_tag_p *tags;
+    int *statuses;
+    int start;
+    int end;
+} tag_create_batch_t;
 
 //static mutex_p global_library_mutex = NULL;
 
@@ -74,12 +482,81 @@ static thread_p tag_tickler_thread = NULL;
 /* helper functions. */
 static plc_tag_p lookup_tag(int32_t id);
 static int add_tag_lookup(plc_tag_p tag);
-static int tag_id_inc(int id);
+static plc_tag_p remove_tag_lookup(int32_t tag_id);
+static tag_slot_t *tag_slot_get(int32_t tag_id);
+static int tag_slot_grow_unsafe(void);
+static int tag_live_reserve_unsafe(void);
 static THREAD_FUNC(tag_tickler_func);
+static void tag_tickle(plc_tag_p tag);
+static int tag_create_locks(plc_tag_p tag);
+static void tag_lock_pool_destroy(void);
+static int64_t tag_next_tick_unsafe(plc_tag_p tag, int64_t current_time);
+static void tag_schedule(plc_tag_p tag, int64_t deadline);
+static int tag_sched_push_unsafe(tag_sched_shard_t *shard, int64_t deadline, int32_t tag_id);
+static void tag_sched_pop_unsafe(tag_sched_shard_t *shard);
+static void tag_sched_assign_shard(plc_tag_p tag, attr attribs);
+static void tag_set_dirty_unsafe(plc_tag_p tag);
+static int tag_read_start_unsafe(plc_tag_p tag, int64_t deadline, int *is_done);
+static int tag_write_start_unsafe(plc_tag_p tag, int64_t deadline, int *is_done);
+static void tag_start_queued_write_unsafe(plc_tag_p tag);
+static int tag_op_check_unsafe(plc_tag_p tag, int is_read, int *is_done);
+static int tag_set_range_unsafe(plc_tag_p tag, int elem_offset, int elem_count);
+static int tag_read_ahead_unsafe(plc_tag_p tag, int elem_offset, int *elem_count);
+static int tag_read_common(int32_t id, int elem_offset, int elem_count, int timeout);
+static int tag_write_common(int32_t id, int elem_offset, int elem_count, int timeout);
+static int tag_op_many(int32_t *ids, int num_tags, int *statuses, int timeout, int is_read, const tag_write_source_t *source);
+static int tag_copy_source_unsafe(plc_tag_p tag, const tag_write_source_t *source);
+static tag_group_p tag_group_get(const char *name, int create);
+static int tag_group_add_member(tag_group_p group, int32_t tag_id);
+static void tag_group_remove_member(tag_group_p group, int32_t tag_id);
+static void tag_group_read_started(plc_tag_p tag);
+static void tag_group_read_done(plc_tag_p tag, int status);
+static void tag_group_destroy_all(void);
+static int tag_scan_class_join(plc_tag_p tag, const char *name, int priority);
+static tag_scan_plc_t *tag_scan_plc_get_unsafe(uint32_t plc_key);
+static int64_t tag_scan_class_phase(uint32_t plc_key, int class_index, int32_t period_ms);
+static int64_t tag_scan_class_next_read(tag_scan_class_p scan_class, int64_t current_time);
+static int64_t tag_scan_class_schedule(tag_scan_class_p scan_class, int64_t current_time, int overrun);
+static void tag_scan_class_read_done(tag_scan_class_p scan_class, int64_t read_us);
+static void tag_scan_class_destroy_all(void);
+static void tag_dispatch_event(plc_tag_p tag, tag_group_p group, int event, int status);
+static void tag_callback_deliver(tag_callback_event_t *event);
+static int tag_create_unmapped(const char *attrib_str, plc_tag_p *tag_out);
+static void tag_create_wait(plc_tag_p *tags, int *statuses, int count, int timeout);
+static int tag_create_publish(plc_tag_p tag);
+static void tag_create_batch(tag_create_batch_t *batch);
+static THREAD_FUNC(tag_create_batch_func);
+static THREAD_FUNC(tag_callback_worker_func);
+static int tag_callback_pool_start(int num_threads);
+static void tag_callback_pool_stop(void);
+static void tag_callback_pool_destroy(void *pool_arg);
+static volatile int *tag_thread_attrib(const char *attrib_name, int *is_priority);
+static void tag_stats_op_start(plc_tag_p tag);
+static int64_t tag_stats_op_done(plc_tag_p tag, int is_read, int status);
+static void tag_stats_hist_add(tag_latency_hist_t *hist, int64_t value_us);
+static int tag_stats_hist_percentile(tag_latency_hist_t *hist, int percent);
+static int tag_stats_get_attrib(plc_tag_p tag, const char *attrib_name, int *value);
+static int tag_change_setup(plc_tag_p tag, attr attribs);
+static int tag_detect_change_unsafe(plc_tag_p tag);
+static int tag_dirty_setup(plc_tag_p tag, attr attribs);
+static int tag_history_setup(plc_tag_p tag, attr attribs);
+static void tag_history_append_unsafe(plc_tag_p tag);
+static void tag_sample_done_unsafe(plc_tag_p tag);
+static int tag_cpu_reset(int enable);
+static int tag_cpu_top_entry(hashtable_p table, int64_t key, void *data, void *context);
+static int tag_cpu_free_entry(hashtable_p table, int64_t key, void *data, void *context);
+static void tag_add_dirty_range_unsafe(plc_tag_p tag, int offset, int length);
 static int set_tag_byte_order(plc_tag_p tag, attr attribs);
+static void tag_set_native_byte_order(plc_tag_p tag);
+static int tag_elem_shuffle(const int *order, int elem_size, int *shuffle);
+static int tag_value_copy(plc_tag_p tag, int offset, int elem_size, int is_float, uint8_t *host);
+static const int *tag_elem_byte_order(plc_tag_p tag, int elem_size, int is_float);
 static int check_byte_order_str(const char *byte_order, int length);
 // static int get_string_count_size_unsafe(plc_tag_p tag, int offset);
 static int get_string_length_unsafe(plc_tag_p tag, int offset);
+static int string_array_check(plc_tag_p tag, int offset, int count, const char *buffer);
+static int string_array_element_size(tag_byte_order_t *byte_order, int string_length);
+static void set_string_count_unsafe(plc_tag_p tag, int offset, int string_length);
 // static int get_string_capacity_unsafe(plc_tag_p tag, int offset);
 // static int get_string_padding_unsafe(plc_tag_p tag, int offset);
 // static int get_string_total_length_unsafe(plc_tag_p tag, int offset);
@@ -129,22 +606,94 @@ int lib_init(void)
 
     pdebug(DEBUG_INFO,"Setting up global library data.");
 
-    pdebug(DEBUG_INFO,"Creating tag hashtable.");
-    if((tags = hashtable_create(INITIAL_TAG_TABLE_SIZE)) == NULL) { /* MAGIC */
-        pdebug(DEBUG_ERROR, "Unable to create tag hashtable!");
-        return PLCTAG_ERR_NO_MEM;
+    plctag_trace_startup();
+
+    pdebug(DEBUG_INFO,"Starting the socket reactor.");
+    rc = socket_reactor_startup();
+    if(rc != PLCTAG_STATUS_OK) {
+        /* sockets fall back to polling without the reactor. */
+        pdebug(DEBUG_WARN, "Unable to start the socket reactor, error %s!", plc_tag_decode_error(rc));
+        rc = PLCTAG_STATUS_OK;
     }
 
-    pdebug(DEBUG_INFO,"Creating tag hashtable mutex.");
+    pdebug(DEBUG_INFO,"Creating tag lookup mutex.");
     rc = mutex_create((mutex_p *)&tag_lookup_mutex);
     if (rc != PLCTAG_STATUS_OK) {
-        pdebug(DEBUG_ERROR, "Unable to create tag hashtable mutex!");
+        pdebug(DEBUG_ERROR, "Unable to create tag lookup mutex!");
+        return rc;
+    }
+
+    pdebug(DEBUG_INFO,"Creating tag read group mutex.");
+    rc = mutex_create(&tag_group_mutex);
+    if (rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_ERROR, "Unable to create tag read group mutex!");
+        return rc;
+    }
+
+    pdebug(DEBUG_INFO,"Creating tag scan class mutex.");
+    rc = mutex_create(&tag_scan_class_mutex);
+    if (rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_ERROR, "Unable to create tag scan class mutex!");
+        return rc;
     }
 
-    pdebug(DEBUG_INFO,"Creating tag tickler thread.");
-    rc = thread_create(&tag_tickler_thread, tag_tickler_func, 32*1024, NULL);
+    pdebug(DEBUG_INFO,"Creating tag callback pool mutex.");
+    rc = mutex_create(&tag_callback_mutex);
     if (rc != PLCTAG_STATUS_OK) {
-        pdebug(DEBUG_ERROR, "Unable to create tag tickler thread!");
+        pdebug(DEBUG_ERROR, "Unable to create tag callback pool mutex!");
+        return rc;
+    }
+
+    pdebug(DEBUG_INFO,"Creating %d tag tickler schedule shards.", tag_sched_config_shards);
+    tag_sched_shards = (tag_sched_shard_t *)mem_alloc((int)(sizeof(tag_sched_shard_t) * (size_t)tag_sched_config_shards));
+    if(!tag_sched_shards) {
+        pdebug(DEBUG_ERROR, "Unable to allocate tag tickler schedule shards!");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    tag_sched_num_shards = tag_sched_config_shards;
+
+    for(int i=0; i < tag_sched_num_shards; i++) {
+        tag_sched_shard_t *shard = &tag_sched_shards[i];
+
+        rc = mutex_create(&shard->mutex);
+        if (rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_ERROR, "Unable to create tag tickler schedule mutex!");
+            return rc;
+        }
+
+        rc = cond_create(&shard->cond);
+        if (rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_ERROR, "Unable to create tag tickler schedule condition var!");
+            return rc;
+        }
+
+        shard->heap = (tag_sched_entry_t *)mem_alloc((int)(sizeof(tag_sched_entry_t) * TAG_SCHED_INITIAL_CAPACITY));
+        if(!shard->heap) {
+            pdebug(DEBUG_ERROR, "Unable to allocate tag tickler schedule!");
+            return PLCTAG_ERR_NO_MEM;
+        }
+
+        shard->heap_size = 0;
+        shard->heap_capacity = TAG_SCHED_INITIAL_CAPACITY;
+
+        {
+            char metrics_name[32];
+
+            snprintf(metrics_name, sizeof(metrics_name), "shard %d", i);
+
+            shard->metrics = metrics_register("tickler", metrics_name,
+                                              METRIC_BIT(METRIC_LOOPS) | METRIC_BIT(METRIC_LOOP_TIME_US)
+                                            | METRIC_BIT(METRIC_LOOP_TIME_MAX_US) | METRIC_BIT(METRIC_QUEUE_DEPTH_MAX));
+        }
+
+        rc = thread_create(&shard->thread, tag_tickler_func, 32*1024, shard);
+        if (rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_ERROR, "Unable to create tag tickler thread!");
+            return rc;
+        }
+
+        plc_tag_generic_tune_thread(shard->thread, PLCTAG_THREAD_TICKLER);
     }
 
     pdebug(DEBUG_INFO,"Done.");
@@ -161,25 +710,118 @@ void lib_teardown(void)
 
     library_terminating = 1;
 
-    if(tag_tickler_thread) {
-        pdebug(DEBUG_INFO,"Tearing down tag tickler thread.");
-        thread_join(tag_tickler_thread);
-        thread_destroy(&tag_tickler_thread);
-        tag_tickler_thread = NULL;
+    if(tag_sched_shards) {
+        pdebug(DEBUG_INFO,"Tearing down tag tickler threads.");
+
+        /* wake up the ticklers so that they see the termination flag. */
+        for(int i=0; i < tag_sched_num_shards; i++) {
+            if(tag_sched_shards[i].cond) {
+                cond_signal(tag_sched_shards[i].cond);
+            }
+        }
+
+        for(int i=0; i < tag_sched_num_shards; i++) {
+            if(tag_sched_shards[i].thread) {
+                thread_join(tag_sched_shards[i].thread);
+                thread_destroy(&tag_sched_shards[i].thread);
+            }
+        }
+    }
+
+    if(tag_callback_mutex) {
+        pdebug(DEBUG_INFO,"Tearing down tag callback pool.");
+        tag_callback_pool_stop();
+        mutex_destroy(&tag_callback_mutex);
+        tag_callback_mutex = NULL;
+    }
+
+    if(tag_group_mutex) {
+        pdebug(DEBUG_INFO,"Tearing down tag read groups.");
+        tag_group_destroy_all();
+        mutex_destroy(&tag_group_mutex);
+        tag_group_mutex = NULL;
+    }
+
+    if(tag_scan_class_mutex) {
+        pdebug(DEBUG_INFO,"Tearing down tag scan classes.");
+        tag_scan_class_destroy_all();
+        mutex_destroy(&tag_scan_class_mutex);
+        tag_scan_class_mutex = NULL;
+    }
+
+    if(tag_sched_shards) {
+        pdebug(DEBUG_INFO,"Freeing tag tickler schedule shards.");
+
+        for(int i=0; i < tag_sched_num_shards; i++) {
+            tag_sched_shard_t *shard = &tag_sched_shards[i];
+
+            if(shard->cond) {
+                cond_destroy(&shard->cond);
+            }
+
+            if(shard->mutex) {
+                mutex_destroy(&shard->mutex);
+            }
+
+            if(shard->heap) {
+                mem_free(shard->heap);
+            }
+
+            if(shard->metrics) {
+                metrics_unregister(shard->metrics);
+            }
+        }
+
+        mem_free(tag_sched_shards);
+        tag_sched_shards = NULL;
+        tag_sched_num_shards = 0;
     }
 
+    tag_cpu_reset(0);
+
+    tag_lock_pool_destroy();
+
     if(tag_lookup_mutex) {
         pdebug(DEBUG_INFO,"Tearing down tag lookup mutex.");
         mutex_destroy(&tag_lookup_mutex);
         tag_lookup_mutex = NULL;
     }
 
-    if(tags) {
-        pdebug(DEBUG_INFO, "Destroying tag hashtable.");
-        hashtable_destroy(tags);
-        tags = NULL;
+    if(tag_slot_num_chunks > 0) {
+        pdebug(DEBUG_INFO, "Destroying tag handle table.");
+
+        for(int i=0; i < tag_slot_num_chunks; i++) {
+            mem_free(tag_slot_chunks[i]);
+            tag_slot_chunks[i] = NULL;
+        }
+
+        tag_slot_num_chunks = 0;
+        tag_slot_free_head = -1;
+        tag_slot_free_tail = -1;
+    }
+
+    if(tag_live) {
+        if(tag_live_count > 0) {
+            pdebug(DEBUG_WARN, "%d tags were not destroyed before shutdown.", tag_live_count);
+        }
+
+        mem_free(tag_live);
+        tag_live = NULL;
+        tag_live_count = 0;
+        tag_live_capacity = 0;
     }
 
+    pdebug(DEBUG_INFO,"Stopping the socket reactor.");
+    socket_reactor_teardown();
+
+    pdebug(DEBUG_INFO,"Stopping the logger thread.");
+    debug_async_stop();
+
+    pdebug(DEBUG_INFO,"Freeing attribute parse cache.");
+    attr_cache_clear();
+
+    plctag_trace_teardown();
+
     library_terminating = 0;
 
     pdebug(DEBUG_INFO,"Done.");
@@ -190,202 +832,111 @@ void lib_teardown(void)
 
 THREAD_FUNC(tag_tickler_func)
 {
-    (void)arg;
+    tag_sched_shard_t *shard = (tag_sched_shard_t *)arg;
+
+    int holding = 0;
 
     debug_set_tag_id(0);
 
     pdebug(DEBUG_INFO, "Starting.");
 
     while(!library_terminating) {
-        int max_index = 0;
+        tag_sched_entry_t due[TAG_SCHED_BATCH_SIZE];
+        int num_due = 0;
+        int64_t current_time = time_ms();
+        int64_t wait_ms = TAG_SCHED_MAX_WAIT_MS;
+        int64_t loop_start_us = 0;
+
+        /* pull off everything that is due now. */
+        critical_block(shard->mutex) {
+            while(shard->heap_size > 0 && num_due < TAG_SCHED_BATCH_SIZE && shard->heap[0].deadline <= current_time) {
+                due[num_due] = shard->heap[0];
+                num_due++;
+                tag_sched_pop_unsafe(shard);
+            }
 
-        critical_block(tag_lookup_mutex) {
-            max_index = hashtable_capacity(tags);
+            if(num_due == 0 && shard->heap_size > 0) {
+                wait_ms = shard->heap[0].deadline - current_time;
+            }
+        }
+
+        /*
+         * queue all the due requests together so that they can be packed.  A
+         * scan class can be bigger than one batch, so keep holding until a
+         * batch comes up short.
+         */
+        if(num_due > 1 && !holding) {
+            ab_hold_requests();
+            holding = 1;
         }
 
-        for(int i=0; i < max_index; i++) {
-            plc_tag_p tag = NULL;
+        if(num_due > 0) {
+            loop_start_us = time_us();
+        }
 
-            critical_block(tag_lookup_mutex) {
-                /* look up the max index again. it may have changed. */
-                max_index = hashtable_capacity(tags);
+        for(int i=0; i < num_due && !library_terminating; i++) {
+            plc_tag_p tag = lookup_tag(due[i].tag_id);
+            int is_current = 0;
 
-                if(i < max_index) {
-                    tag = hashtable_get_index(tags, i);
+            if(!tag) {
+                /* the tag was destroyed after it was scheduled. */
+                continue;
+            }
 
-                    if(tag) {
-                        debug_set_tag_id(tag->tag_id);
-                        tag = rc_inc(tag);
-                    }
-                } else {
-                    debug_set_tag_id(0);
-                    tag = NULL;
+            /* is this still the tag's live schedule entry? */
+            critical_block(shard->mutex) {
+                if(tag->sched_next_tick == due[i].deadline) {
+                    tag->sched_next_tick = 0;
+                    is_current = 1;
                 }
             }
 
-            if(tag) {
-                int events[PLCTAG_EVENT_DESTROYED+1] =  {0};
-
+            if(is_current) {
                 debug_set_tag_id(tag->tag_id);
 
-                /* try to hold the tag API mutex while all this goes on. */
-                if(mutex_try_lock(tag->api_mutex) == PLCTAG_STATUS_OK) {
-                    /* if this tag has automatic writes, then there are many things we should check */
-                    if(tag->auto_sync_write_ms > 0) {
-                        /* has the tag been written to? */
-                        if(tag->tag_is_dirty) {
-                            /* abort any in flight read if the tag is dirty. */
-                            if(tag->read_in_flight) {
-                                if(tag->vtable->abort) {
-                                    tag->vtable->abort(tag);
-                                }
-
-                                pdebug(DEBUG_DETAIL, "Aborting in-flight automatic read!");
-
-                                tag->read_complete = 0;
-                                tag->read_in_flight = 0;
-
-                                /* FIXME - should we report an ABORT event here? */
-                                events[PLCTAG_EVENT_ABORTED] = 1;
-                            }
-
-                            /* have we already done something about it? */
-                            if(!tag->auto_sync_next_write) {
-                                /* we need to queue up a new write. */
-                                tag->auto_sync_next_write = time_ms() + tag->auto_sync_write_ms;
-
-                                pdebug(DEBUG_DETAIL, "Queueing up automatic write in %dms.", tag->auto_sync_write_ms);
-                            } else if(!tag->write_in_flight && tag->auto_sync_next_write <= time_ms()) {
-                                pdebug(DEBUG_DETAIL, "Triggering automatic write start.");
-
-                                /* clear out any outstanding reads. */
-                                if(tag->read_in_flight && tag->vtable->abort) {
-                                    tag->vtable->abort(tag);
-                                    tag->read_in_flight = 0;
-                                }
-
-                                tag->tag_is_dirty = 0;
-                                tag->write_in_flight = 1;
-                                tag->auto_sync_next_write = 0;
-
-                                if(tag->vtable->write) {
-                                    tag->status = (int8_t)tag->vtable->write(tag);
-                                }
-
-                                events[PLCTAG_EVENT_WRITE_STARTED] = 1;
-                            }
-                        }
-                    }
+                if(tag_cpu_accounting) {
+                    int64_t start_ns = time_ns();
 
-                    /* if this tag has automatic reads, we need to check that state too. */
-                    if(tag->auto_sync_read_ms > 0) {
-                        int64_t current_time = time_ms();
-
-                        /* do we need to read? */
-                        if(tag->auto_sync_next_read <= current_time) {
-                            /* make sure that we do not have an outstanding read or write. */
-                            if(!tag->read_in_flight && !tag->tag_is_dirty && !tag->write_in_flight) {
-                                int64_t periods = 0;
-
-                                pdebug(DEBUG_DETAIL, "Triggering automatic read start.");
-
-                                tag->read_in_flight = 1;
-
-                                if(tag->vtable->read) {
-                                    tag->status = (int8_t)tag->vtable->read(tag);
-                                }
-
-                                /*
-                                 * schedule the next read.
-                                 *
-                                 * Note that there will be some jitter.  In that case we want to skip
-                                 * to the next read time that is a whole multiple of the read period.
-                                 *
-                                 * This keeps the jitter from slowly moving the polling cycle.
-                                 */
-                                periods = (current_time - tag->auto_sync_next_read)/tag->auto_sync_read_ms;
-
-                                /* warn if we need to skip more than one period. */
-                                if(tag->auto_sync_next_read && periods > 0) {
-                                    pdebug(DEBUG_WARN, "Skipping multiple read periods due to long delay!");
-                                }
-
-                                tag->auto_sync_next_read += (periods + 1) * tag->auto_sync_read_ms;
-                                pdebug(DEBUG_WARN, "Scheduling next read at time %"PRId64".", tag->auto_sync_next_read);
-
-                                events[PLCTAG_EVENT_READ_STARTED] = 1;
-                            }
-                        }
-                    }
+                    tag_tickle(tag);
+
+                    plc_tag_generic_add_cpu(tag->tag_id, time_ns() - start_ns, 0);
+                } else {
+                    tag_tickle(tag);
+                }
 
-                    /* call the tickler function if we can. */
-                    if(tag->vtable->tickler) {
-                        /* call the tickler on the tag. */
-                        tag->vtable->tickler(tag);
+                debug_set_tag_id(0);
+            }
 
-                        if(tag->read_complete) {
-                            tag->read_complete = 0;
-                            tag->read_in_flight = 0;
+            rc_dec(tag);
+        }
 
-                            events[PLCTAG_EVENT_READ_COMPLETED] = 1;
-                        }
+        if(holding && num_due < TAG_SCHED_BATCH_SIZE) {
+            ab_release_requests();
+            holding = 0;
+        }
 
-                        if(tag->write_complete) {
-                            tag->write_complete = 0;
-                            tag->write_in_flight = 0;
-                            tag->auto_sync_next_write = 0;
+        if(num_due > 0) {
+            int64_t loop_time_us = time_us() - loop_start_us;
 
-                            events[PLCTAG_EVENT_WRITE_COMPLETED] = 1;
-                        }
-                    }
+            metrics_add(shard->metrics, METRIC_LOOPS, 1);
+            metrics_add(shard->metrics, METRIC_LOOP_TIME_US, loop_time_us);
+            metrics_max(shard->metrics, METRIC_LOOP_TIME_MAX_US, loop_time_us);
+        }
 
-                    /* we are done with the tag API mutex now. */
-                    mutex_unlock(tag->api_mutex);
-
-                    /* call the callback outside the API mutex. */
-                    if(tag->callback) {
-                        /* was there a read start? */
-                        if(events[PLCTAG_EVENT_READ_STARTED]) {
-                            pdebug(DEBUG_DETAIL, "Tag read started.");
-                            tag->callback(tag->tag_id, PLCTAG_EVENT_READ_STARTED, plc_tag_status(tag->tag_id));
-                        }
-
-                        /* was there a write start? */
-                        if(events[PLCTAG_EVENT_WRITE_STARTED]) {
-                            pdebug(DEBUG_DETAIL, "Tag write started.");
-                            tag->callback(tag->tag_id, PLCTAG_EVENT_WRITE_STARTED, plc_tag_status(tag->tag_id));
-                        }
-
-                        /* was there an abort? */
-                        if(events[PLCTAG_EVENT_ABORTED]) {
-                            pdebug(DEBUG_DETAIL, "Tag operation aborted.");
-                            tag->callback(tag->tag_id, PLCTAG_EVENT_ABORTED, plc_tag_status(tag->tag_id));
-                        }
-
-                        /* was there a read completion? */
-                        if(events[PLCTAG_EVENT_READ_COMPLETED]) {
-                            pdebug(DEBUG_DETAIL, "Tag read completed.");
-                            tag->callback(tag->tag_id, PLCTAG_EVENT_READ_COMPLETED, plc_tag_status(tag->tag_id));
-                        }
-
-                        /* was there a write completion? */
-                        if(events[PLCTAG_EVENT_WRITE_COMPLETED]) {
-                            pdebug(DEBUG_DETAIL, "Tag write completed.");
-                            tag->callback(tag->tag_id, PLCTAG_EVENT_WRITE_COMPLETED, plc_tag_status(tag->tag_id));
-                        }
-                    }
-                }
+        /* sleep until the next deadline or until something new is scheduled. */
+        if(num_due == 0 && !library_terminating) {
+            if(wait_ms > TAG_SCHED_MAX_WAIT_MS) {
+                wait_ms = TAG_SCHED_MAX_WAIT_MS;
             }
 
-            if(tag) {
-                debug_set_tag_id(0);
-                rc_dec(tag);
+            if(wait_ms > 0) {
+                cond_wait(shard->cond, (int)wait_ms);
             }
         }
+    }
 
-        if(!library_terminating) {
-            sleep_ms(1);
-        }
+    if(holding) {
+        ab_release_requests();
     }
 
     debug_set_tag_id(0);
@@ -396,687 +947,545 @@ THREAD_FUNC(tag_tickler_func)
 }
 
 
-/**************************************************************************
- ***************************  API Functions  ******************************
- **************************************************************************/
-
 
 /*
- * plc_tag_decode_error()
- *
- * This takes an integer error value and turns it into a printable string.
+ * tag_tickle
  *
- * FIXME - this should produce better errors than this!
+ * Run the automatic read/write logic and the protocol tickler for one tag
+ * and then put the tag back on the schedule for whenever it next needs
+ * attention.  Callbacks are called outside of the tag API mutex.
  */
 
+void tag_tickle(plc_tag_p tag)
+{
+    int events[PLCTAG_EVENT_CIRCUIT_BREAKER+1] =  {0};
+    int create_status = PLCTAG_STATUS_OK;
+    int breaker_status = PLCTAG_STATUS_OK;
+    int64_t next_tick = 0;
+    int64_t read_us = 0;
+
+    /* try to hold the tag API mutex while all this goes on. */
+    if(mutex_try_lock(tag->api_mutex) == PLCTAG_STATUS_OK) {
+        /* if this tag has automatic writes, then there are many things we should check */
+        if(tag->auto_sync_write_ms > 0) {
+            /* has the tag been written to? */
+            if(tag->tag_is_dirty) {
+                /* abort any in flight read if the tag is dirty. */
+                if(tag->read_in_flight) {
+                    if(tag->vtable->abort) {
+                        tag->vtable->abort(tag);
+                    }
 
+                    pdebug(DEBUG_DETAIL, "Aborting in-flight automatic read!");
 
-LIB_EXPORT const char *plc_tag_decode_error(int rc)
-{
-    switch(rc) {
-    case PLCTAG_STATUS_PENDING:
-        return "PLCTAG_STATUS_PENDING";
-    case PLCTAG_STATUS_OK:
-        return "PLCTAG_STATUS_OK";
-    case PLCTAG_ERR_ABORT:
-        return "PLCTAG_ERR_ABORT";
-    case PLCTAG_ERR_BAD_CONFIG:
-        return "PLCTAG_ERR_BAD_CONFIG";
-    case PLCTAG_ERR_BAD_CONNECTION:
-        return "PLCTAG_ERR_BAD_CONNECTION";
-    case PLCTAG_ERR_BAD_DATA:
-        return "PLCTAG_ERR_BAD_DATA";
-    case PLCTAG_ERR_BAD_DEVICE:
-        return "PLCTAG_ERR_BAD_DEVICE";
-    case PLCTAG_ERR_BAD_GATEWAY:
-        return "PLCTAG_ERR_BAD_GATEWAY";
-    case PLCTAG_ERR_BAD_PARAM:
-        return "PLCTAG_ERR_BAD_PARAM";
-    case PLCTAG_ERR_BAD_REPLY:
-        return "PLCTAG_ERR_BAD_REPLY";
-    case PLCTAG_ERR_BAD_STATUS:
-        return "PLCTAG_ERR_BAD_STATUS";
-    case PLCTAG_ERR_CLOSE:
-        return "PLCTAG_ERR_CLOSE";
-    case PLCTAG_ERR_CREATE:
-        return "PLCTAG_ERR_CREATE";
-    case PLCTAG_ERR_DUPLICATE:
-        return "PLCTAG_ERR_DUPLICATE";
-    case PLCTAG_ERR_ENCODE:
-        return "PLCTAG_ERR_ENCODE";
-    case PLCTAG_ERR_MUTEX_DESTROY:
-        return "PLCTAG_ERR_MUTEX_DESTROY";
-    case PLCTAG_ERR_MUTEX_INIT:
-        return "PLCTAG_ERR_MUTEX_INIT";
-    case PLCTAG_ERR_MUTEX_LOCK:
-        return "PLCTAG_ERR_MUTEX_LOCK";
-    case PLCTAG_ERR_MUTEX_UNLOCK:
-        return "PLCTAG_ERR_MUTEX_UNLOCK";
-    case PLCTAG_ERR_NOT_ALLOWED:
-        return "PLCTAG_ERR_NOT_ALLOWED";
-    case PLCTAG_ERR_NOT_FOUND:
-        return "PLCTAG_ERR_NOT_FOUND";
-    case PLCTAG_ERR_NOT_IMPLEMENTED:
-        return "PLCTAG_ERR_NOT_IMPLEMENTED";
-    case PLCTAG_ERR_NO_DATA:
-        return "PLCTAG_ERR_NO_DATA";
-    case PLCTAG_ERR_NO_MATCH:
-        return "PLCTAG_ERR_NO_MATCH";
-    case PLCTAG_ERR_NO_MEM:
-        return "PLCTAG_ERR_NO_MEM";
-    case PLCTAG_ERR_NO_RESOURCES:
-        return "PLCTAG_ERR_NO_RESOURCES";
-    case PLCTAG_ERR_NULL_PTR:
-        return "PLCTAG_ERR_NULL_PTR";
-    case PLCTAG_ERR_OPEN:
-        return "PLCTAG_ERR_OPEN";
-    case PLCTAG_ERR_OUT_OF_BOUNDS:
-        return "PLCTAG_ERR_OUT_OF_BOUNDS";
-    case PLCTAG_ERR_READ:
-        return "PLCTAG_ERR_READ";
-    case PLCTAG_ERR_REMOTE_ERR:
-        return "PLCTAG_ERR_REMOTE_ERR";
-    case PLCTAG_ERR_THREAD_CREATE:
-        return "PLCTAG_ERR_THREAD_CREATE";
-    case PLCTAG_ERR_THREAD_JOIN:
-        return "PLCTAG_ERR_THREAD_JOIN";
-    case PLCTAG_ERR_TIMEOUT:
-        return "PLCTAG_ERR_TIMEOUT";
-    case PLCTAG_ERR_TOO_LARGE:
-        return "PLCTAG_ERR_TOO_LARGE";
-    case PLCTAG_ERR_TOO_SMALL:
-        return "PLCTAG_ERR_TOO_SMALL";
-    case PLCTAG_ERR_UNSUPPORTED:
-        return "PLCTAG_ERR_UNSUPPORTED";
-    case PLCTAG_ERR_WINSOCK:
-        return "PLCTAG_ERR_WINSOCK";
-    case PLCTAG_ERR_WRITE:
-        return "PLCTAG_ERR_WRITE";
-    case PLCTAG_ERR_PARTIAL:
-        return "PLCTAG_ERR_PARTIAL";
-    case PLCTAG_ERR_BUSY:
-        return "PLCTAG_ERR_BUSY";
-
-    default:
-        return "Unknown error.";
-        break;
-    }
-
-    return "Unknown error.";
-}
-
+                    tag->read_complete = 0;
+                    tag->read_in_flight = 0;
 
+                    /* FIXME - should we report an ABORT event here? */
+                    events[PLCTAG_EVENT_ABORTED] = 1;
+                }
 
+                /* have we already done something about it? */
+                if(!tag->auto_sync_next_write) {
+                    /* we need to queue up a new write. */
+                    tag->auto_sync_next_write = time_ms() + tag->auto_sync_write_ms;
 
+                    pdebug(DEBUG_DETAIL, "Queueing up automatic write in %dms.", tag->auto_sync_write_ms);
+                } else if(!tag->write_in_flight && tag->auto_sync_next_write <= time_ms()) {
+                    pdebug(DEBUG_DETAIL, "Triggering automatic write start.");
 
-/*
- * Set the debug level.
- *
- * This function takes values from the defined debug levels.  It sets
- * the debug level to the passed value.  Higher numbers output increasing amounts
- * of information.   Input values not defined will be ignored.
- */
+                    /* clear out any outstanding reads. */
+                    if(tag->read_in_flight && tag->vtable->abort) {
+                        tag->vtable->abort(tag);
+                        tag->read_in_flight = 0;
+                    }
 
-LIB_EXPORT void plc_tag_set_debug_level(int debug_level)
-{
-	if (debug_level >= PLCTAG_DEBUG_NONE && debug_level <= PLCTAG_DEBUG_SPEW) {
-		set_debug_level(debug_level);
-	}
-}
+                    tag->tag_is_dirty = 0;
+                    tag->write_in_flight = 1;
+                    tag->auto_sync_next_write = 0;
+                    tag->op_deadline = 0;
 
+                    tag_stats_op_start(tag);
 
+                    if(tag->vtable->write) {
+                        tag->status = (int8_t)tag->vtable->write(tag);
+                    }
 
+                    events[PLCTAG_EVENT_WRITE_STARTED] = 1;
+                }
+            }
+        }
 
-/*
- * Check that the library supports the required API version.
- *
- * PLCTAG_STATUS_OK is returned if the version matches.  If it does not,
- * PLCTAG_ERR_UNSUPPORTED is returned.
- */
+        /* if this tag has automatic reads, we need to check that state too. */
+        if(tag->auto_sync_read_ms > 0) {
+            int64_t current_time = time_ms();
 
-LIB_EXPORT int plc_tag_check_lib_version(int req_major, int req_minor, int req_patch)
-{
-    /* encode these with 16-bits per version part. */
-    uint64_t lib_encoded_version = (((uint64_t)version_major) << 32u)
-                                 + (((uint64_t)version_minor) << 16u)
-                                   + (uint64_t)version_patch;
+            /* do we need to read? */
+            if(tag->auto_sync_next_read <= current_time) {
+                /* make sure that we do not have an outstanding read or write. */
+                if(!tag->read_in_flight && !tag->tag_is_dirty && !tag->write_in_flight) {
+                    int64_t periods = 0;
 
-    uint64_t req_encoded_version = (((uint64_t)req_major) << 32u)
-                                 + (((uint64_t)req_minor) << 16u)
-                                   + (uint64_t)req_patch;
+                    pdebug(DEBUG_DETAIL, "Triggering automatic read start.");
 
-    if(version_major == (uint64_t)req_major && lib_encoded_version >= req_encoded_version) {
-        return PLCTAG_STATUS_OK;
-    } else {
-        return PLCTAG_ERR_UNSUPPORTED;
-    }
-}
+                    tag->read_in_flight = 1;
+                    tag->op_deadline = 0;
 
+                    tag_stats_op_start(tag);
 
+                    if(tag->vtable->read) {
+                        tag->status = (int8_t)tag->vtable->read(tag);
+                    }
 
+                    /*
+                     * schedule the next read.
+                     *
+                     * Note that there will be some jitter.  In that case we want to skip
+                     * to the next read time that is a whole multiple of the read period.
+                     *
+                     * This keeps the jitter from slowly moving the polling cycle.
+                     */
+                    periods = (current_time - tag->auto_sync_next_read)/tag->auto_sync_read_ms;
+
+                    /* warn if we need to skip more than one period. */
+                    if(tag->auto_sync_next_read && periods > 0) {
+                        pdebug(DEBUG_WARN, "Skipping multiple read periods due to long delay!");
+                    }
 
+                    /* the scan class may stretch the period if the PLC is behind. */
+                    if(tag->scan_class) {
+                        tag->auto_sync_next_read = tag_scan_class_schedule(tag->scan_class, current_time, (periods > 0));
+                    } else {
+                        tag->auto_sync_next_read += (periods + 1) * tag->auto_sync_read_ms;
+                    }
+                    pdebug(DEBUG_WARN, "Scheduling next read at time %"PRId64".", tag->auto_sync_next_read);
 
+                    if(tag->read_group && tag->read_in_flight) {
+                        tag_group_read_started(tag);
+                    }
 
-/*
- * plc_tag_create()
- *
- * Just pass through to the plc_tag_create_sync() function.
- *
- * This is where the dispatch occurs to the protocol specific implementation.
- */
+                    events[PLCTAG_EVENT_READ_STARTED] = 1;
+                }
+            }
+        }
 
-LIB_EXPORT int32_t plc_tag_create(const char *attrib_str, int timeout)
-{
-    plc_tag_p tag = PLC_TAG_P_NULL;
-    int id = PLCTAG_ERR_OUT_OF_BOUNDS;
-    attr attribs = NULL;
-    int rc = PLCTAG_STATUS_OK;
-    int read_cache_ms = 0;
-    tag_create_function tag_constructor;
-	int debug_level = -1;
+        /* call the tickler function if we can. */
+        if(tag->vtable->tickler) {
+            /* call the tickler on the tag. */
+            tag->vtable->tickler(tag);
 
-    pdebug(DEBUG_INFO,"Starting");
+            if(tag->read_complete) {
+                tag->read_complete = 0;
+                tag->read_in_flight = 0;
 
-    if(timeout < 0) {
-        pdebug(DEBUG_WARN, "Timeout must not be negative!");
-        return PLCTAG_ERR_BAD_PARAM;
-    }
+                read_us = tag_stats_op_done(tag, 1, tag->status);
 
-    if((rc = initialize_modules()) != PLCTAG_STATUS_OK) {
-        pdebug(DEBUG_ERROR,"Unable to initialize the internal library state!");
-        return rc;
-    }
+                if(tag->scan_class && read_us > 0) {
+                    tag_scan_class_read_done(tag->scan_class, read_us);
+                }
 
-    if(!attrib_str || str_length(attrib_str) == 0) {
-        pdebug(DEBUG_WARN,"Tag attribute string is null or zero length!");
-        return PLCTAG_ERR_TOO_SMALL;
-    }
+                events[PLCTAG_EVENT_READ_COMPLETED] = 1;
 
-    attribs = attr_create_from_str(attrib_str);
-    if(!attribs) {
-        pdebug(DEBUG_WARN,"Unable to parse attribute string!");
-        return PLCTAG_ERR_BAD_DATA;
-    }
+                if(tag->status == PLCTAG_STATUS_OK) {
+                    events[PLCTAG_EVENT_VALUE_CHANGED] = tag_detect_change_unsafe(tag);
+                    tag_sample_done_unsafe(tag);
+                }
 
-    /* set debug level */
-	debug_level = attr_get_int(attribs, "debug", -1);
-	if (debug_level > DEBUG_NONE) {
-		set_debug_level(debug_level);
-	}
+                shared_publish_unsafe(tag, tag->status);
+                alias_parent_done_unsafe(tag, 1, tag->status);
+            }
 
-    /*
-     * create the tag, this is protocol specific.
-     *
-     * If this routine wants to keep the attributes around, it needs
-     * to clone them.
-     */
-    tag_constructor = find_tag_create_func(attribs);
+            if(tag->write_complete) {
+                tag->write_complete = 0;
+                tag->write_in_flight = 0;
+                tag->auto_sync_next_write = 0;
 
-    if(!tag_constructor) {
-        pdebug(DEBUG_WARN,"Tag creation failed, no tag constructor found for tag type!");
-        attr_destroy(attribs);
-        return PLCTAG_ERR_BAD_PARAM;
-    }
+                tag_stats_op_done(tag, 0, tag->status);
+                alias_parent_done_unsafe(tag, 0, tag->status);
 
-    tag = tag_constructor(attribs);
+                events[PLCTAG_EVENT_WRITE_COMPLETED] = 1;
 
-    if(!tag) {
-        pdebug(DEBUG_WARN, "Tag creation failed, skipping mutex creation and other generic setup.");
-        attr_destroy(attribs);
-        return PLCTAG_ERR_CREATE;
-    }
+                tag_start_queued_write_unsafe(tag);
+            }
 
-    /*
-     * FIXME - this really should be here???  Maybe not?  But, this is
-     * the only place it can be without making every protocol type do this automatically.
-     */
-    rc = mutex_create(&(tag->ext_mutex));
-    if(rc != PLCTAG_STATUS_OK) {
-        pdebug(DEBUG_WARN,"Unable to create tag external mutex!");
-        rc_dec(tag);
-        return PLCTAG_ERR_CREATE;
-    }
+            if(tag->breaker_event) {
+                tag->breaker_event = 0;
+                breaker_status = (tag->breaker_open ? PLCTAG_ERR_UNAVAILABLE : PLCTAG_STATUS_OK);
+                events[PLCTAG_EVENT_CIRCUIT_BREAKER] = 1;
+            }
+        }
 
-    rc = mutex_create(&(tag->api_mutex));
-    if(rc != PLCTAG_STATUS_OK) {
-        pdebug(DEBUG_WARN,"Unable to create tag API mutex!");
-        rc_dec(tag);
-        return PLCTAG_ERR_CREATE;
-    }
+        /* is an asynchronous creation finished? */
+        if(tag->create_pending) {
+            create_status = tag->vtable->status(tag);
 
-    /* set up the read cache config. */
-    read_cache_ms = attr_get_int(attribs,"read_cache_ms",0);
-    if(read_cache_ms < 0) {
-        pdebug(DEBUG_WARN, "read_cache_ms value must be positive, using zero.");
-        read_cache_ms = 0;
-    }
+            if(create_status != PLCTAG_STATUS_PENDING) {
+                tag->create_pending = 0;
+                events[PLCTAG_EVENT_CREATED] = 1;
+            }
+        }
 
-    tag->read_cache_expire = (int64_t)0;
-    tag->read_cache_ms = (int64_t)read_cache_ms;
+        /* figure out when we need to come back to this tag. */
+        next_tick = tag_next_tick_unsafe(tag, time_ms());
 
-    /* set up any automatic read/write */
-    tag->auto_sync_read_ms = attr_get_int(attribs, "auto_sync_read_ms", 0);
-    if(tag->auto_sync_read_ms < 0) {
-        pdebug(DEBUG_WARN, "auto_sync_read_ms value must be positive!");
-        rc_dec(tag);
-        return PLCTAG_ERR_BAD_PARAM;
-    } else if(tag->auto_sync_read_ms > 0) {
-        /* how many periods did we already pass? */
-        int64_t periods = (time_ms() / tag->auto_sync_read_ms);
-        tag->auto_sync_next_read = (periods + 1) * tag->auto_sync_read_ms;
-    }
+        /* keep track of group reads. */
+        if(tag->read_group && events[PLCTAG_EVENT_READ_COMPLETED]) {
+            tag_group_read_done(tag, tag->status);
+        }
 
-    tag->auto_sync_write_ms = attr_get_int(attribs, "auto_sync_write_ms", 0);
-    if(tag->auto_sync_write_ms < 0) {
-        pdebug(DEBUG_WARN, "auto_sync_write_ms value must be positive!");
-        rc_dec(tag);
-        return PLCTAG_ERR_BAD_PARAM;
-    } else {
-        tag->auto_sync_next_write = 0;
-    }
+        /* we are done with the tag API mutex now. */
+        mutex_unlock(tag->api_mutex);
 
-    /* set up the tag byte order if there are any overrides. */
-    rc = set_tag_byte_order(tag, attribs);
-    if(rc != PLCTAG_STATUS_OK) {
-        pdebug(DEBUG_WARN, "Unable to correctly set tag data byte order: %s!", plc_tag_decode_error(rc));
-        rc_dec(tag);
-        return rc;
-    }
+        /* call the callback outside the API mutex. */
+        if(tag->callback) {
+            /* did the tag finish its creation? */
+            if(events[PLCTAG_EVENT_CREATED]) {
+                pdebug(DEBUG_DETAIL, "Tag creation done.");
+                tag_dispatch_event(tag, NULL, PLCTAG_EVENT_CREATED, create_status);
+            }
 
-    /*
-     * Release memory for attributes
-     */
-    attr_destroy(attribs);
+            /* was there a read start? */
+            if(events[PLCTAG_EVENT_READ_STARTED]) {
+                pdebug(DEBUG_DETAIL, "Tag read started.");
+                tag_dispatch_event(tag, NULL, PLCTAG_EVENT_READ_STARTED, plc_tag_status(tag->tag_id));
+            }
 
-    /*
-    * if there is a timeout, then loop until we get
-    * an error or we timeout.
-    */
-    if(timeout) {
-        int64_t timeout_time = timeout + time_ms();
-        int64_t start_time = time_ms();
+            /* was there a write start? */
+            if(events[PLCTAG_EVENT_WRITE_STARTED]) {
+                pdebug(DEBUG_DETAIL, "Tag write started.");
+                tag_dispatch_event(tag, NULL, PLCTAG_EVENT_WRITE_STARTED, plc_tag_status(tag->tag_id));
+            }
 
-        /* get the tag status. */
-        rc = tag->vtable->status(tag);
+            /* was there an abort? */
+            if(events[PLCTAG_EVENT_ABORTED]) {
+                pdebug(DEBUG_DETAIL, "Tag operation aborted.");
+                tag_dispatch_event(tag, NULL, PLCTAG_EVENT_ABORTED, plc_tag_status(tag->tag_id));
+            }
 
-        while(rc == PLCTAG_STATUS_PENDING && timeout_time > time_ms()) {
-            /* give some time to the tickler function. */
-            if(tag->vtable->tickler) {
-                tag->vtable->tickler(tag);
+            /* was there a read completion? */
+            if(events[PLCTAG_EVENT_READ_COMPLETED]) {
+                pdebug(DEBUG_DETAIL, "Tag read completed.");
+                tag_dispatch_event(tag, NULL, PLCTAG_EVENT_READ_COMPLETED, plc_tag_status(tag->tag_id));
             }
 
-            rc = tag->vtable->status(tag);
+            /* did the value change? */
+            if(events[PLCTAG_EVENT_VALUE_CHANGED]) {
+                pdebug(DEBUG_DETAIL, "Tag value changed.");
+                tag_dispatch_event(tag, NULL, PLCTAG_EVENT_VALUE_CHANGED, PLCTAG_STATUS_OK);
+            }
 
-            /*
-             * terminate early and do not wait again if the
-             * IO is done.
-             */
-            if(rc != PLCTAG_STATUS_PENDING) {
-                break;
+            /* was there a write completion? */
+            if(events[PLCTAG_EVENT_WRITE_COMPLETED]) {
+                pdebug(DEBUG_DETAIL, "Tag write completed.");
+                tag_dispatch_event(tag, NULL, PLCTAG_EVENT_WRITE_COMPLETED, plc_tag_status(tag->tag_id));
             }
 
-            sleep_ms(1); /* MAGIC */
+            /* did the connection circuit breaker change? */
+            if(events[PLCTAG_EVENT_CIRCUIT_BREAKER]) {
+                pdebug(DEBUG_DETAIL, "Circuit breaker changed.");
+                tag_dispatch_event(tag, NULL, PLCTAG_EVENT_CIRCUIT_BREAKER, breaker_status);
+            }
         }
+    } else {
+        /* someone else is using the tag, come back shortly. */
+        next_tick = time_ms() + TAG_SCHED_POLL_MS;
+    }
 
-        /*
-         * if we dropped out of the while loop but the status is
-         * still pending, then we timed out.
-         *
-         * Abort the operation and set the status to show the timeout.
-         */
-        if(rc == PLCTAG_STATUS_PENDING) {
-            pdebug(DEBUG_WARN,"Timeout waiting for tag to be ready!");
-            tag->vtable->abort(tag);
-            rc = PLCTAG_ERR_TIMEOUT;
-        }
+    tag_schedule(tag, next_tick);
+}
 
-        /* check to see if there was an error during tag creation. */
-        if(rc != PLCTAG_STATUS_OK) {
-            pdebug(DEBUG_WARN, "Error %s while trying to create tag!", plc_tag_decode_error(rc));
-            rc_dec(tag);
-            return rc;
-        }
 
-        /* clear up any remaining flags.  This should be refactored. */
-        tag->read_in_flight = 0;
-        tag->write_in_flight = 0;
 
-        pdebug(DEBUG_INFO,"tag set up elapsed time %" PRId64 "ms",(time_ms()-start_time));
-    }
+/*
+ * tag_next_tick_unsafe
+ *
+ * Determine when the tickler needs to look at the tag next.  Zero means
+ * that the tag has no work pending and does not need to be scheduled.
+ *
+ * Must be called with the tag API mutex held.
+ */
 
-    /* map the tag to a tag ID */
-    id = add_tag_lookup(tag);
+int64_t tag_next_tick_unsafe(plc_tag_p tag, int64_t current_time)
+{
+    int64_t next_tick = 0;
 
-    /* if the mapping failed, then punt */
-    if(id < 0) {
-        pdebug(DEBUG_ERROR, "Unable to map tag %p to lookup table entry, rc=%s", tag, plc_tag_decode_error(id));
-        rc_dec(tag);
-        return id;
+    /* operations in flight are polled. */
+    if(tag->read_in_flight || tag->write_in_flight || tag->read_complete || tag->write_complete || tag->create_pending || tag->status == PLCTAG_STATUS_PENDING) {
+        return current_time + TAG_SCHED_POLL_MS;
     }
 
-    /* save this for later. */
-    tag->tag_id = id;
-
-    debug_set_tag_id(id);
+    if(tag->auto_sync_write_ms > 0 && tag->tag_is_dirty) {
+        next_tick = (tag->auto_sync_next_write ? tag->auto_sync_next_write : current_time);
+    }
 
-    pdebug(DEBUG_INFO, "Returning mapped tag ID %d", id);
+    if(tag->auto_sync_read_ms > 0) {
+        int64_t next_read = (tag->auto_sync_next_read ? tag->auto_sync_next_read : current_time);
 
-    pdebug(DEBUG_INFO,"Done.");
+        if(!next_tick || next_read < next_tick) {
+            next_tick = next_read;
+        }
+    }
 
-    return id;
+    return next_tick;
 }
 
 
 
-
 /*
- * plc_tag_shutdown
+ * tag_schedule
  *
- * Some systems may not be able to call atexit() handlers.  In those cases, wrappers should
- * call this function before unloading the library or terminating.   Most OSes will cleanly
- * recover all system resources when a process is terminated and this will not be necessary.
+ * Put the tag on the tickler schedule at the passed deadline.  If the tag is
+ * already scheduled at or before that time, nothing changes.  The tickler
+ * thread is woken if the new entry is now the earliest one.
  */
 
-LIB_EXPORT void plc_tag_shutdown(void)
+void tag_schedule(plc_tag_p tag, int64_t deadline)
 {
-    destroy_modules();
-}
+    tag_sched_shard_t *shard = NULL;
+    int need_wake = 0;
 
+    if(!tag || tag->tag_id <= 0 || deadline <= 0 || !tag_sched_shards) {
+        return;
+    }
 
-/*
- * plc_tag_register_callback
- *
- * This function registers the passed callback function with the tag.  Only one callback function
- * may be registered on a tag at a time!
- *
- * Once registered, any of the following operations on or in the tag will result in the callback
- * being called:
- *
- *      * starting a tag read operation.
- *      * a tag read operation ending.
- *      * a tag read being aborted.
- *      * starting a tag write operation.
- *      * a tag write operation ending.
- *      * a tag write being aborted.
- *      * a tag being destroyed
- *
- * The callback is called outside of the internal tag mutex so it can call any tag functions safely.   However,
- * the callback is called in the context of the internal tag helper thread and not the client library thread(s).
- * This means that YOU are responsible for making sure that all client application data structures the callback
- * function touches are safe to access by the callback!
- *
- * Do not do any operations in the callback that block for any significant time.   This will cause library
- * performance to be poor or even to start failing!
- *
- * When the callback is called with the PLCTAG_EVENT_DESTROY_STARTED, do not call any tag functions.  It is
- * not guaranteed that they will work and they will possibly hang or fail.
- *
- * Return values:
- *void (*tag_callback_func)(int32_t tag_id, uint32_t event, int status)
- * If there is already a callback registered, the function will return PLCTAG_ERR_DUPLICATE.   Only one callback
- * function may be registered at a time on each tag.
- *
- * If all is successful, the function will return PLCTAG_STATUS_OK.
- */
+    shard = &tag_sched_shards[tag->sched_shard];
 
-LIB_EXPORT int plc_tag_register_callback(int32_t tag_id, void (*tag_callback_func)(int32_t tag_id, int event, int status))
-{
-    int rc = PLCTAG_STATUS_OK;
-    plc_tag_p tag = lookup_tag(tag_id);
+    critical_block(shard->mutex) {
+        if(tag->sched_next_tick && tag->sched_next_tick <= deadline) {
+            /* already scheduled soon enough. */
+            break;
+        }
 
-    pdebug(DEBUG_INFO, "Starting.");
+        if(tag_sched_push_unsafe(shard, deadline, tag->tag_id) != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_ERROR, "Unable to schedule tag!");
+            break;
+        }
 
-    if(!tag) {
-        pdebug(DEBUG_WARN,"Tag not found.");
-        return PLCTAG_ERR_NOT_FOUND;
-    }
+        tag->sched_next_tick = deadline;
 
-    critical_block(tag->api_mutex) {
-        if(tag->callback) {
-            rc = PLCTAG_ERR_DUPLICATE;
-        } else {
-            rc = PLCTAG_STATUS_OK;
-            tag->callback = tag_callback_func;
+        metrics_max(shard->metrics, METRIC_QUEUE_DEPTH_MAX, shard->heap_size);
+
+        if(shard->heap[0].tag_id == tag->tag_id && shard->heap[0].deadline == deadline) {
+            need_wake = 1;
         }
     }
 
-    rc_dec(tag);
-
-    pdebug(DEBUG_INFO, "Done.");
-
-    return rc;
+    if(need_wake) {
+        cond_signal(shard->cond);
+    }
 }
 
 
 
-
 /*
- * plc_tag_unregister_callback
- *
- * This function removes the callback already registered on the tag.
- *
- * Return values:
+ * tag_sched_assign_shard
  *
- * The function returns PLCTAG_STATUS_OK if there was a registered callback and removing it went well.
- * An error of PLCTAG_ERR_NOT_FOUND is returned if there was no registered callback.
+ * Pick the tickler shard for a new tag from the PLC it talks to.  The
+ * hash of the PLC is kept for the scan classes.
  */
 
-LIB_EXPORT int plc_tag_unregister_callback(int32_t tag_id)
+void tag_sched_assign_shard(plc_tag_p tag, attr attribs)
 {
-    int rc = PLCTAG_STATUS_OK;
-    plc_tag_p tag = lookup_tag(tag_id);
+    const char *gateway = attr_get_str(attribs, "gateway", NULL);
+    const char *path = attr_get_str(attribs, "path", NULL);
+    uint32_t hash_val = 0;
 
-    pdebug(DEBUG_INFO, "Starting.");
+    if(gateway) {
+        hash_val = hash((uint8_t *)gateway, (size_t)(unsigned int)str_length(gateway), hash_val);
+    }
 
-    if(!tag) {
-        pdebug(DEBUG_WARN,"Tag not found.");
-        return PLCTAG_ERR_NOT_FOUND;
+    if(path) {
+        hash_val = hash((uint8_t *)path, (size_t)(unsigned int)str_length(path), hash_val);
     }
 
-    critical_block(tag->api_mutex) {
-        if(tag->callback) {
-            rc = PLCTAG_STATUS_OK;
-            tag->callback = NULL;
-        } else {
-            rc = PLCTAG_ERR_NOT_FOUND;
-        }
+    tag->plc_key = hash_val;
+
+    if(tag_sched_num_shards <= 1) {
+        tag->sched_shard = 0;
+        return;
     }
 
-    rc_dec(tag);
+    tag->sched_shard = (int32_t)(hash_val % (uint32_t)tag_sched_num_shards);
 
-    pdebug(DEBUG_INFO, "Done.");
+    pdebug(DEBUG_DETAIL, "Tag assigned to tickler shard %d.", tag->sched_shard);
+}
 
-    return rc;
+
+
+void plc_tag_tickler_wake(plc_tag_p tag)
+{
+    tag_schedule(tag, time_ms());
 }
 
 
+void plc_tag_tickler_wake_later(plc_tag_p tag, int delay_ms)
+{
+    tag_schedule(tag, time_ms() + delay_ms);
+}
+
 
 
 /*
- * plc_tag_register_logger
- *
- * This function registers the passed callback function with the library.  Only one callback function
- * may be registered with the library at a time!
- *
- * Once registered, the function will be called with any logging message that is normally printed due
- * to the current log level setting.
- *
- * WARNING: the callback will usually be called when the internal tag API mutex is held.   You cannot
- * call any tag functions within the callback!
- *
- * Return values:
- *
- * If there is already a callback registered, the function will return PLCTAG_ERR_DUPLICATE.   Only one callback
- * function may be registered at a time on each tag.
+ * plc_tag_generic_tune_thread
  *
- * If all is successful, the function will return PLCTAG_STATUS_OK.
+ * Give a library thread a name and the CPU affinity and priority
+ * configured for its class.  Failures are logged and the thread keeps
+ * running with the defaults.
  */
 
-LIB_EXPORT int plc_tag_register_logger(void (*log_callback_func)(int32_t tag_id, int debug_level, const char *message))
+void plc_tag_generic_tune_thread(thread_p thread, int thread_class)
 {
+    char name[16];
+    int cpus = 0;
+    int priority = 0;
     int rc = PLCTAG_STATUS_OK;
 
-    pdebug(DEBUG_DETAIL, "Starting.");
+    if(!thread || thread_class < 0 || thread_class >= PLCTAG_THREAD_NUM_CLASSES) {
+        return;
+    }
 
-    rc = debug_register_logger(log_callback_func);
+    cpus = tag_thread_cpus[thread_class];
+    priority = tag_thread_priority[thread_class];
 
-    pdebug(DEBUG_DETAIL, "Done.");
+    snprintf(name, sizeof(name), "plctag_%s", tag_thread_class_names[thread_class]);
+    thread_set_name(thread, name);
 
-    return rc;
-}
+    if(cpus) {
+        rc = thread_set_affinity(thread, (uint32_t)(unsigned int)cpus);
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Unable to set CPU affinity 0x%x for %s thread, error %s!", (unsigned int)cpus, name, plc_tag_decode_error(rc));
+        }
+    }
 
+    if(priority) {
+        rc = thread_set_priority(thread, priority);
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Unable to set priority %d for %s thread, error %s!", priority, name, plc_tag_decode_error(rc));
+        }
+    }
+}
 
 
 /*
- * plc_tag_unregister_logger
+ * tag_thread_attrib
  *
- * This function removes the logger callback already registered for the library.
- *
- * Return values:
- *
- * The function returns PLCTAG_STATUS_OK if there was a registered callback and removing it went well.
- * An error of PLCTAG_ERR_NOT_FOUND is returned if there was no registered callback.
+ * Map a <class>_thread_cpus or <class>_thread_priority library attribute
+ * to its setting.  Returns NULL if the name is not one of them.
  */
 
-LIB_EXPORT int plc_tag_unregister_logger(void)
+volatile int *tag_thread_attrib(const char *attrib_name, int *is_priority)
 {
-    int rc = PLCTAG_STATUS_OK;
+    for(int i=0; i < PLCTAG_THREAD_NUM_CLASSES; i++) {
+        int name_len = str_length(tag_thread_class_names[i]);
 
-    pdebug(DEBUG_DETAIL, "Starting");
+        if(str_cmp_i_n(attrib_name, tag_thread_class_names[i], name_len) != 0) {
+            continue;
+        }
 
-    rc = debug_unregister_logger();
+        if(str_cmp_i(attrib_name + name_len, "_thread_cpus") == 0) {
+            *is_priority = 0;
+            return &tag_thread_cpus[i];
+        }
 
-    pdebug(DEBUG_DETAIL, "Done.");
+        if(str_cmp_i(attrib_name + name_len, "_thread_priority") == 0) {
+            *is_priority = 1;
+            return &tag_thread_priority[i];
+        }
+    }
 
-    return rc;
+    return NULL;
 }
 
 
-
 /*
- * plc_tag_lock
+ * plc_tag_generic_wake_tag
  *
- * Lock the tag against use by other threads.  Because operations on a tag are
- * very much asynchronous, actions like getting and extracting the data from
- * a tag take more than one API call.  If more than one thread is using the same tag,
- * then the internal state of the tag will get broken and you will probably experience
- * a crash.
+ * Wake up any thread blocked in a synchronous read or write of the tag and
+ * have the tickler look at the tag.  This is called from the protocol
+ * threads when a response is received.
  *
- * This should be used to initially lock a tag when starting operations with it
- * followed by a call to plc_tag_unlock when you have everything you need from the tag.
+ * The tag is only used while the lookup mutex is held.  The caller may be
+ * a protocol thread that must not drop the last reference to a tag.
  */
 
-LIB_EXPORT int plc_tag_lock(int32_t id)
+void plc_tag_generic_wake_tag(int32_t id)
 {
-    int rc = PLCTAG_STATUS_OK;
-    plc_tag_p tag = lookup_tag(id);
-
-    pdebug(DEBUG_INFO, "Starting.");
-
-    if(!tag) {
-        pdebug(DEBUG_WARN,"Tag not found.");
-        return PLCTAG_ERR_NOT_FOUND;
-    }
+    tag_slot_t *slot = tag_slot_get(id);
 
-    critical_block(tag->api_mutex) {
-        rc = mutex_lock(tag->ext_mutex);
+    if(!slot) {
+        return;
     }
 
-    rc_dec(tag);
+    spin_block(&slot->lock) {
+        plc_tag_p tag = (slot->tag_id == id ? slot->tag : NULL);
 
-    pdebug(DEBUG_INFO, "Done.");
+        if(tag) {
+            if(tag->tag_cond_wait) {
+                cond_signal(tag->tag_cond_wait);
+            }
 
-    return rc;
+            tag_schedule(tag, time_ms());
+        }
+    }
 }
 
 
 
 
 /*
- * plc_tag_unlock
+ * plc_tag_generic_lookup_tag
  *
- * The opposite action of plc_tag_unlock.  This allows other threads to access the
- * tag.
+ * Find a tag by ID for a tag that is built on top of it.  Unlike
+ * lookup_tag() this does not change the tag ID used in debug output.
  */
 
-LIB_EXPORT int plc_tag_unlock(int32_t id)
+plc_tag_p plc_tag_generic_lookup_tag(int32_t id)
 {
-    int rc = PLCTAG_STATUS_OK;
-    plc_tag_p tag = lookup_tag(id);
-
-    pdebug(DEBUG_INFO, "Starting.");
-
-    if(!tag) {
-        pdebug(DEBUG_WARN,"Tag not found.");
-        return PLCTAG_ERR_NOT_FOUND;
-    }
+    plc_tag_p tag = NULL;
+    tag_slot_t *slot = tag_slot_get(id);
 
-    critical_block(tag->api_mutex) {
-        rc = mutex_unlock(tag->ext_mutex);
+    if(slot) {
+        spin_block(&slot->lock) {
+            if(slot->tag && slot->tag_id == id) {
+                tag = rc_inc(slot->tag);
+            }
+        }
     }
 
-    rc_dec(tag);
-
-    pdebug(DEBUG_INFO, "Done.");
-
-    return rc;
+    return tag;
 }
 
 
 
-
 /*
- * plc_tag_abort()
- *
- * This function calls through the vtable in the passed tag to call
- * the protocol-specific implementation.
+ * plc_tag_generic_start_read/write
  *
- * The implementation must do whatever is necessary to abort any
- * ongoing IO.
+ * Start an operation for a tag built on top of this one.  Nobody waits
+ * for it, the tickler drives it to completion.
  *
- * The status of the operation is returned.
+ * Must be called with the tag API mutex held.
  */
 
-LIB_EXPORT int plc_tag_abort(int32_t id)
+int plc_tag_generic_start_read(plc_tag_p tag, int *is_done)
 {
-    int rc = PLCTAG_STATUS_OK;
-    plc_tag_p tag = lookup_tag(id);
-
-    pdebug(DEBUG_INFO, "Starting.");
+    int rc = tag_read_start_unsafe(tag, 0, is_done);
 
-    if(!tag) {
-        pdebug(DEBUG_WARN,"Tag not found.");
-        return PLCTAG_ERR_NOT_FOUND;
+    if(!*is_done) {
+        plc_tag_tickler_wake(tag);
     }
 
-    critical_block(tag->api_mutex) {
-        /* who knows what state the tag data is in.  */
-        tag->read_cache_expire = (uint64_t)0;
-
-        if(!tag->vtable || !tag->vtable->abort) {
-            pdebug(DEBUG_WARN,"Tag does not have a abort function!");
-            rc = PLCTAG_ERR_NOT_IMPLEMENTED;
-            break;
-        }
+    return rc;
+}
 
-        /* this may be synchronous. */
-        rc = tag->vtable->abort(tag);
 
-        tag->read_in_flight = 0;
-        tag->read_complete = 0;
-        tag->write_in_flight = 0;
-        tag->write_complete = 0;
-    }
+int plc_tag_generic_start_write(plc_tag_p tag, int *is_done)
+{
+    int rc = tag_write_start_unsafe(tag, 0, is_done);
 
-    if(tag->callback) {
-        pdebug(DEBUG_DETAIL, "Calling callback with PLCTAG_EVENT_ABORTED.");
-        tag->callback(id, PLCTAG_EVENT_ABORTED, PLCTAG_STATUS_OK);
+    if(!*is_done) {
+        plc_tag_tickler_wake(tag);
     }
 
-    rc_dec(tag);
-
-    pdebug(DEBUG_INFO, "Done.");
-
     return rc;
 }
 
@@ -1084,271 +1493,5420 @@ LIB_EXPORT int plc_tag_abort(int32_t id)
 
 
 /*
- * plc_tag_destroy()
+ * Snapshot support.
  *
- * Remove all implementation specific details about a tag and clear its
- * memory.
+ * Each change to the tag data is bracketed by increments of the data
+ * sequence counter.  The count is odd while the data is changing.  Readers
+ * copy the data without the API mutex and retry if the count changed.
  */
 
+void plc_tag_generic_data_write_begin(plc_tag_p tag)
+{
+    tag->data_seq++;
+    mem_barrier();
+}
 
-LIB_EXPORT int plc_tag_destroy(int32_t tag_id)
+
+void plc_tag_generic_data_write_end(plc_tag_p tag)
 {
-    plc_tag_p tag = NULL;
+    mem_barrier();
+    tag->data_seq++;
+}
 
-    pdebug(DEBUG_INFO, "Starting.");
 
-    if(tag_id <= 0 || tag_id >= TAG_ID_MASK) {
-        pdebug(DEBUG_WARN, "Called with zero or invalid tag!");
-        return PLCTAG_ERR_NULL_PTR;
-    }
 
-    critical_block(tag_lookup_mutex) {
-        tag = hashtable_remove(tags, tag_id);
-    }
+/* a data buffer replaced while lock-free readers may still be copying from it. */
+struct tag_retired_t {
+    struct tag_retired_t *next;
+    uint8_t *data;
+    uint8_t *back_data;
+};
 
-    if(!tag) {
-        pdebug(DEBUG_WARN, "Called with non-existent tag!");
-        return PLCTAG_ERR_NOT_FOUND;
+
+void plc_tag_generic_free_retired_data(plc_tag_p tag)
+{
+    while(tag->retired_data) {
+        tag_retired_p retired = tag->retired_data;
+
+        tag->retired_data = retired->next;
+
+        if(retired->data) {
+            mem_free(retired->data);
+        }
+
+        if(retired->back_data) {
+            mem_free(retired->back_data);
+        }
+
+        mem_free(retired);
     }
+}
 
-    /* abort anything in flight */
-    pdebug(DEBUG_DETAIL, "Aborting any in-flight operations.");
 
-    critical_block(tag->api_mutex) {
-        if(!tag->vtable || !tag->vtable->abort) {
-            pdebug(DEBUG_WARN,"Tag does not have a abort function!");
+
+/*
+ * plc_tag_generic_resize_data
+ *
+ * Replace the data buffer with one of the new size.  Snapshot readers count
+ * themselves in data_readers before they look at the data pointer.  Old
+ * buffers are only freed when there are none, otherwise they are kept until
+ * a later resize finds no readers or the tag is destroyed.  The size and
+ * pointer are changed in an order that never lets a reader see a size
+ * larger than its buffer.
+ */
+
+int plc_tag_generic_resize_data(plc_tag_p tag, int new_size)
+{
+    uint8_t *new_data = NULL;
+    tag_retired_p retired = NULL;
+    int copy_size = 0;
+
+    if(new_size <= 0) {
+        pdebug(DEBUG_WARN, "New size must be greater than zero!");
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    /* an application buffer is used as long as the data fits. */
+    if(tag->is_bound) {
+        if(new_size <= tag->bound_size) {
+            plc_tag_generic_data_write_begin(tag);
+            tag->size = new_size;
+            plc_tag_generic_data_write_end(tag);
+
+            return PLCTAG_STATUS_OK;
         }
 
-        /* Force a clean up. */
-        tag->vtable->abort(tag);
+        pdebug(DEBUG_WARN, "Tag data no longer fits in the bound buffer, unbinding it!");
+        plc_tag_generic_unbind_buffer(tag);
     }
 
-    if(tag->callback) {
-        pdebug(DEBUG_DETAIL, "Calling callback with PLCTAG_EVENT_DESTROYED.");
-        tag->callback(tag_id, PLCTAG_EVENT_DESTROYED, PLCTAG_STATUS_OK);
+    copy_size = (tag->size < new_size ? tag->size : new_size);
+
+    new_data = (uint8_t *)mem_alloc(new_size);
+    if(!new_data) {
+        pdebug(DEBUG_WARN, "Unable to allocate new tag data buffer!");
+        return PLCTAG_ERR_NO_MEM;
     }
 
-    /* release the reference outside the mutex. */
-    rc_dec(tag);
+    /*
+     * a buffer inside the tag lasts as long as the tag, so it is not retired.
+     * The back buffer was the front one before the last swap, so it is.
+     */
+    if((tag->data && !tag->data_inline) || (tag->is_double_buffered && tag->back_data)) {
+        retired = (tag_retired_p)mem_alloc((int)sizeof(*retired));
+        if(!retired) {
+            pdebug(DEBUG_WARN, "Unable to allocate retired tag data entry!");
+            mem_free(new_data);
+            return PLCTAG_ERR_NO_MEM;
+        }
+    }
 
-    pdebug(DEBUG_INFO, "Done.");
+    plc_tag_generic_data_write_begin(tag);
 
-    debug_set_tag_id(0);
+    if(tag->data) {
+        mem_copy(new_data, tag->data, copy_size);
+    }
+
+    if(retired) {
+        retired->data = (tag->data_inline ? NULL : tag->data);
+        retired->back_data = (tag->is_double_buffered ? tag->back_data : NULL);
+        retired->next = tag->retired_data;
+        tag->retired_data = retired;
+    }
+
+    if(new_size > tag->size) {
+        tag->data = new_data;
+        mem_barrier();
+        tag->size = new_size;
+    } else {
+        tag->size = new_size;
+        mem_barrier();
+        tag->data = new_data;
+    }
+
+    tag->data_inline = 0;
+
+    if(tag->is_double_buffered) {
+        uint8_t *new_back_data = (uint8_t *)mem_alloc(new_size);
+
+        if(new_back_data) {
+            if(tag->back_data) {
+                mem_copy(new_back_data, tag->back_data, copy_size);
+            }
+        } else {
+            pdebug(DEBUG_WARN, "Unable to allocate new tag back buffer, falling back to a single buffer!");
+
+            tag->is_double_buffered = 0;
+        }
+
+        tag->back_data = new_back_data;
+    }
+
+    plc_tag_generic_data_write_end(tag);
+
+    /* readers that start after the new pointer is out never see the old ones. */
+    if(tag->retired_data && atomic_get(&tag->data_readers) == 0) {
+        plc_tag_generic_free_retired_data(tag);
+    }
 
     return PLCTAG_STATUS_OK;
 }
 
 
 
+/*
+ * plc_tag_generic_read_buffer
+ *
+ * Get the buffer that read responses should be copied into.  For double
+ * buffered tags this is the back buffer.
+ */
+
+uint8_t *plc_tag_generic_read_buffer(plc_tag_p tag)
+{
+    if(tag->is_double_buffered && tag->back_data) {
+        return tag->back_data;
+    }
+
+    return tag->data;
+}
+
 
 
 /*
- * plc_tag_read()
+ * plc_tag_generic_swap_data_buffers
  *
- * This function calls through the vtable in the passed tag to call
- * the protocol-specific implementation.  That starts the read operation.
- * If there is a timeout passed, then this routine waits for either
- * a timeout or an error.
+ * Make a completed read visible by swapping the back buffer into place.
+ * Nothing happens if the tag is not double buffered.  The tag API mutex
+ * must be held.
+ */
+
+void plc_tag_generic_swap_data_buffers(plc_tag_p tag)
+{
+    uint8_t *tmp = NULL;
+
+    if(!tag->is_double_buffered || !tag->back_data) {
+        return;
+    }
+
+    plc_tag_generic_data_write_begin(tag);
+
+    tmp = tag->data;
+    tag->data = tag->back_data;
+    tag->back_data = tmp;
+
+    plc_tag_generic_data_write_end(tag);
+}
+
+
+
+/*
+ * plc_tag_generic_update_byte_order
  *
- * The status of the operation is returned.
+ * For protocols that only learn the byte order of the data after the tag
+ * is created.
  */
 
-LIB_EXPORT int plc_tag_read(int32_t id, int timeout)
+void plc_tag_generic_update_byte_order(plc_tag_p tag)
 {
-    int rc = PLCTAG_STATUS_OK;
-    plc_tag_p tag = lookup_tag(id);
-    int is_done = 0;
+    tag_set_native_byte_order(tag);
+}
 
-    pdebug(DEBUG_INFO, "Starting.");
 
-    if(timeout < 0) {
-        pdebug(DEBUG_WARN, "Timeout must not be negative!");
-        rc_dec(tag);
-        return PLCTAG_ERR_BAD_PARAM;
+
+/*
+ * plc_tag_generic_unbind_buffer
+ *
+ * Switch the tag back to its own data buffer, copying in the current data.
+ * Only heap allocated buffers ever grow so the tag's buffer is replaced if
+ * the data grew while the application buffer was bound.
+ */
+
+void plc_tag_generic_unbind_buffer(plc_tag_p tag)
+{
+    uint8_t *data = tag->owned_data;
+
+    if(!tag->is_bound) {
+        return;
     }
 
-    if(!tag) {
-        pdebug(DEBUG_WARN,"Tag not found.");
-        return PLCTAG_ERR_NOT_FOUND;
+    if(tag->size > tag->owned_size) {
+        data = (uint8_t *)mem_alloc(tag->size);
+        if(!data) {
+            pdebug(DEBUG_ERROR, "Unable to allocate tag data buffer, data lost!");
+        } else if(tag->owned_data && !tag->data_inline) {
+            mem_free(tag->owned_data);
+        }
     }
 
-    if(tag->callback) {
-        pdebug(DEBUG_DETAIL, "Calling callback with PLCTAG_EVENT_READ_STARTED.");
-        tag->callback(id, PLCTAG_EVENT_READ_STARTED, PLCTAG_STATUS_OK);
+    if(data && tag->data) {
+        mem_copy(data, tag->data, tag->size);
     }
 
-    critical_block(tag->api_mutex) {
-        /* check read cache, if not expired, return existing data. */
-        if(tag->read_cache_expire > time_ms()) {
-            pdebug(DEBUG_INFO, "Returning cached data.");
-            rc = PLCTAG_STATUS_OK;
-            is_done = 1;
-            break;
+    plc_tag_generic_data_write_begin(tag);
+
+    if(data) {
+        if(data != tag->owned_data) {
+            tag->data_inline = 0;
         }
 
-        if(tag->read_in_flight || tag->write_in_flight) {
-            pdebug(DEBUG_WARN, "An operation is already in flight!");
-            rc = PLCTAG_ERR_BUSY;
-            is_done = 1;
-            break;
+        tag->data = data;
+    } else {
+        tag->data = tag->owned_data;
+        tag->size = tag->owned_size;
+    }
+
+    tag->owned_data = NULL;
+    tag->owned_size = 0;
+    tag->bound_size = 0;
+    tag->is_bound = 0;
+
+    plc_tag_generic_data_write_end(tag);
+}
+
+
+
+/*
+ * tag_sched_push_unsafe
+ *
+ * Add an entry to the schedule heap.  The shard mutex must be held.
+ */
+
+int tag_sched_push_unsafe(tag_sched_shard_t *shard, int64_t deadline, int32_t tag_id)
+{
+    int index = 0;
+
+    if(shard->heap_size >= shard->heap_capacity) {
+        int new_capacity = shard->heap_capacity * 2;
+        tag_sched_entry_t *new_heap = (tag_sched_entry_t *)mem_realloc(shard->heap, (int)(sizeof(tag_sched_entry_t) * (size_t)new_capacity));
+
+        if(!new_heap) {
+            pdebug(DEBUG_ERROR, "Unable to grow tag tickler schedule!");
+            return PLCTAG_ERR_NO_MEM;
         }
 
-        if(tag->tag_is_dirty) {
-            pdebug(DEBUG_WARN, "Tag has locally updated data that will be overwritten!");
-            rc = PLCTAG_ERR_BUSY;
-            is_done = 1;
+        shard->heap = new_heap;
+        shard->heap_capacity = new_capacity;
+    }
+
+    /* sift up. */
+    index = shard->heap_size;
+    shard->heap_size++;
+
+    while(index > 0) {
+        int parent = (index - 1)/2;
+
+        if(shard->heap[parent].deadline <= deadline) {
             break;
         }
 
-        tag->read_in_flight = 1;
-        tag->status = PLCTAG_STATUS_PENDING;
+        shard->heap[index] = shard->heap[parent];
+        index = parent;
+    }
+
+    shard->heap[index].deadline = deadline;
+    shard->heap[index].tag_id = tag_id;
 
-        /* the protocol implementation does not do the timeout. */
-        rc = tag->vtable->read(tag);
+    return PLCTAG_STATUS_OK;
+}
 
-        /* if not pending then check for success or error. */
-        if(rc != PLCTAG_STATUS_PENDING) {
-            if(rc != PLCTAG_STATUS_OK) {
-                /* not pending and not OK, so error. Abort and clean up. */
 
-                pdebug(DEBUG_WARN,"Response from read command returned error %s!", plc_tag_decode_error(rc));
 
-                if(tag->vtable->abort) {
-                    tag->vtable->abort(tag);
-                }
-            }
+/*
+ * tag_sched_pop_unsafe
+ *
+ * Remove the earliest entry from the schedule heap.  The shard mutex
+ * must be held.
+ */
 
-            tag->read_in_flight = 0;
-            is_done = 1;
+void tag_sched_pop_unsafe(tag_sched_shard_t *shard)
+{
+    tag_sched_entry_t last;
+    int index = 0;
+
+    if(shard->heap_size <= 0) {
+        return;
+    }
+
+    shard->heap_size--;
+
+    if(shard->heap_size == 0) {
+        return;
+    }
+
+    /* sift the last entry down from the top. */
+    last = shard->heap[shard->heap_size];
+
+    while(1) {
+        int child = (index * 2) + 1;
+
+        if(child >= shard->heap_size) {
             break;
         }
 
-        /*
-         * if there is a timeout, then loop until we get
-         * an error or we timeout.
-         */
-        if(timeout) {
-            int64_t timeout_time = timeout + time_ms();
-            int64_t start_time = time_ms();
+        if(child + 1 < shard->heap_size && shard->heap[child + 1].deadline < shard->heap[child].deadline) {
+            child++;
+        }
 
-            while(rc == PLCTAG_STATUS_PENDING && timeout_time > time_ms()) {
-                /* give some time to the tickler function. */
-                if(tag->vtable->tickler) {
-                    tag->vtable->tickler(tag);
-                }
+        if(last.deadline <= shard->heap[child].deadline) {
+            break;
+        }
 
-                rc = tag->vtable->status(tag);
+        shard->heap[index] = shard->heap[child];
+        index = child;
+    }
 
-                /*
-                 * terminate early and do not wait again if the
-                 * IO is done.
-                 */
-                if(rc != PLCTAG_STATUS_PENDING) {
-                    break;
-                }
+    shard->heap[index] = last;
+}
 
-                sleep_ms(1); /* MAGIC */
-            }
 
-            /*
-             * if we dropped out of the while loop but the status is
-             * still pending, then we timed out.
-             *
-             * Abort the operation and set the status to show the timeout.
-             */
-            if(rc != PLCTAG_STATUS_OK) {
-                /* abort the request. */
-                if(tag->vtable->abort) {
-                    tag->vtable->abort(tag);
-                }
 
-                /* translate error if we are still pending. */
-                if(rc == PLCTAG_STATUS_PENDING) {
-                    pdebug(DEBUG_WARN, "Read operation timed out.");
-                    rc = PLCTAG_ERR_TIMEOUT;
-                }
-            }
+/*
+ * tag_set_dirty_unsafe
+ *
+ * Mark a tag with automatic writes as changed and make sure the tickler
+ * will queue the write.  Must be called with the tag API mutex held.
+ */
 
-            /* we are done. */
-            tag->read_complete = 0;
-            tag->read_in_flight = 0;
-            is_done = 1;
+void tag_set_dirty_unsafe(plc_tag_p tag)
+{
+    if(!tag->tag_is_dirty) {
+        tag->tag_is_dirty = 1;
+        tag_schedule(tag, time_ms());
+    }
+}
 
-            pdebug(DEBUG_INFO,"elapsed time %" PRId64 "ms",(time_ms()-start_time));
+
+
+
+/*
+ * tag_read_start_unsafe
+ *
+ * Start a read on the tag.  If the read finished immediately, either from
+ * the cache, due to an error or because the protocol is synchronous, is_done
+ * is set.  The deadline is when the caller stops waiting, zero if it does
+ * not wait.  The protocol may drop the request after it.
+ *
+ * Must be called with the tag API mutex held.
+ */
+
+int tag_read_start_unsafe(plc_tag_p tag, int64_t deadline, int *is_done)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    *is_done = 0;
+
+    /* check read cache, if not expired, return existing data. */
+    if(tag->read_cache_expire > time_ms()) {
+        pdebug(DEBUG_INFO, "Returning cached data.");
+        *is_done = 1;
+        return PLCTAG_STATUS_OK;
+    }
+
+    if(tag->read_in_flight || tag->write_in_flight) {
+        pdebug(DEBUG_WARN, "An operation is already in flight!");
+        *is_done = 1;
+        return PLCTAG_ERR_BUSY;
+    }
+
+    if(tag->tag_is_dirty) {
+        pdebug(DEBUG_WARN, "Tag has locally updated data that will be overwritten!");
+        *is_done = 1;
+        return PLCTAG_ERR_BUSY;
+    }
+
+    tag->read_in_flight = 1;
+    tag->status = PLCTAG_STATUS_PENDING;
+    tag->op_deadline = deadline;
+
+    tag_stats_op_start(tag);
+
+    /* clear any stale completion signal. */
+    cond_clear(tag->tag_cond_wait);
+
+    /* the protocol implementation does not do the timeout. */
+    rc = tag->vtable->read(tag);
+
+    /* if not pending then check for success or error. */
+    if(rc != PLCTAG_STATUS_PENDING) {
+        if(rc != PLCTAG_STATUS_OK) {
+            /* not pending and not OK, so error. Abort and clean up. */
+
+            pdebug(DEBUG_WARN,"Response from read command returned error %s!", plc_tag_decode_error(rc));
+
+            if(tag->vtable->abort) {
+                tag->vtable->abort(tag);
+            }
         }
-    } /* end of api mutex block */
 
-    if(rc == PLCTAG_STATUS_OK) {
-        /* set up the cache time.  This works when read_cache_ms is zero as it is already expired. */
-        tag->read_cache_expire = time_ms() + tag->read_cache_ms;
-    }
+        tag->read_in_flight = 0;
+        *is_done = 1;
+
+        tag_stats_op_done(tag, 1, rc);
+    }
+
+    return rc;
+}
+
+
+
+/*
+ * tag_write_start_unsafe
+ *
+ * Start a write on the tag.  If the write finished immediately, is_done
+ * is set.
+ *
+ * Must be called with the tag API mutex held.
+ */
+
+int tag_write_start_unsafe(plc_tag_p tag, int64_t deadline, int *is_done)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    *is_done = 0;
+
+    if(tag->read_in_flight || tag->write_in_flight) {
+        pdebug(DEBUG_WARN, "Tag already has an operation in flight!");
+        *is_done = 1;
+        return PLCTAG_ERR_BUSY;
+    }
+
+    /* a write is now in flight. */
+    tag->write_in_flight = 1;
+    tag->read_ahead_end = 0;
+    tag->status = PLCTAG_STATUS_OK;
+    tag->op_deadline = deadline;
+
+    tag_stats_op_start(tag);
+
+    /* clear any stale completion signal. */
+    cond_clear(tag->tag_cond_wait);
+
+    /* the protocol implementation does not do the timeout. */
+    rc = tag->vtable->write(tag);
+
+    /* if not pending then check for success or error. */
+    if(rc != PLCTAG_STATUS_PENDING) {
+        if(rc != PLCTAG_STATUS_OK) {
+            /* not pending and not OK, so error. Abort and clean up. */
+
+            pdebug(DEBUG_WARN,"Response from write command returned error %s!", plc_tag_decode_error(rc));
+
+            if(tag->vtable->abort) {
+                tag->vtable->abort(tag);
+            }
+        }
+
+        tag->write_in_flight = 0;
+        *is_done = 1;
+
+        tag_stats_op_done(tag, 0, rc);
+    }
+
+    return rc;
+}
+
+
+
+/*
+ * tag_start_queued_write_unsafe
+ *
+ * Start the write that a coalescing plc_tag_write() queued while the last
+ * one was in flight.  It sends whatever is in the tag data now, so only
+ * the newest value goes out however many writes were queued.
+ *
+ * Must be called with the tag API mutex held.
+ */
+
+void tag_start_queued_write_unsafe(plc_tag_p tag)
+{
+    int is_done = 0;
+    int rc = PLCTAG_STATUS_OK;
+
+    if(!tag->write_queued) {
+        return;
+    }
+
+    tag->write_queued = 0;
+
+    pdebug(DEBUG_DETAIL, "Starting queued write.");
+
+    rc = tag_write_start_unsafe(tag, 0, &is_done);
+    if(is_done && rc != PLCTAG_STATUS_OK) {
+        tag->status = (int8_t)rc;
+    }
+}
+
+
+
+/*
+ * tag_set_range_unsafe
+ *
+ * Limit the next read or write to a span of elements.  The protocol
+ * drops the range when that operation is done.
+ *
+ * Must be called with the tag API mutex held.
+ */
+
+/*
+ * tag_create_locks
+ *
+ * Give the tag its API and external mutexes, either its own or a pair
+ * from the lock pool.  The pool mutexes are made the first time a slot
+ * is used.
+ */
+
+int tag_create_locks(plc_tag_p tag)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    if(tag_lock_pool_enabled) {
+        spin_block(&tag_lock_pool_lock) {
+            uint32_t slot = tag_lock_pool_next % TAG_LOCK_POOL_SIZE;
+
+            if(!tag_lock_pool_api[slot]) {
+                rc = mutex_create_pooled(&tag_lock_pool_api[slot]);
+            }
+
+            if(rc == PLCTAG_STATUS_OK && !tag_lock_pool_ext[slot]) {
+                rc = mutex_create_pooled(&tag_lock_pool_ext[slot]);
+            }
+
+            if(rc == PLCTAG_STATUS_OK) {
+                tag->api_mutex = tag_lock_pool_api[slot];
+                tag->ext_mutex = tag_lock_pool_ext[slot];
+                tag->locks_pooled = 1;
+                tag_lock_pool_next++;
+            }
+        }
+
+        /* fall back to mutexes of its own. */
+        if(rc == PLCTAG_STATUS_OK) {
+            return rc;
+        }
+
+        pdebug(DEBUG_WARN, "Unable to set up pooled mutexes, error %s!", plc_tag_decode_error(rc));
+    }
+
+    rc = mutex_create(&(tag->ext_mutex));
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN,"Unable to create tag external mutex!");
+        return rc;
+    }
+
+    rc = mutex_create(&(tag->api_mutex));
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN,"Unable to create tag API mutex!");
+        return rc;
+    }
+
+    return rc;
+}
+
+
+
+/*
+ * plc_tag_generic_release_locks
+ *
+ * Called by the tag destructors.  Pooled mutexes stay with the pool.
+ */
+
+void plc_tag_generic_release_locks(plc_tag_p tag)
+{
+    if(tag->locks_pooled) {
+        tag->ext_mutex = NULL;
+        tag->api_mutex = NULL;
+        tag->locks_pooled = 0;
+        return;
+    }
+
+    if(tag->ext_mutex) {
+        mutex_destroy(&(tag->ext_mutex));
+        tag->ext_mutex = NULL;
+    }
+
+    if(tag->api_mutex) {
+        mutex_destroy(&(tag->api_mutex));
+        tag->api_mutex = NULL;
+    }
+}
+
+
+
+/* all the tags are gone when the library is torn down. */
+void tag_lock_pool_destroy(void)
+{
+    for(int i=0; i < TAG_LOCK_POOL_SIZE; i++) {
+        if(tag_lock_pool_api[i]) {
+            mutex_destroy(&tag_lock_pool_api[i]);
+        }
+
+        if(tag_lock_pool_ext[i]) {
+            mutex_destroy(&tag_lock_pool_ext[i]);
+        }
+    }
+
+    tag_lock_pool_next = 0;
+}
+
+
+
+/*
+ * tag_read_ahead_unsafe
+ *
+ * Returns 1 if the range was fetched by an earlier widened read that
+ * finished without error.  Otherwise, when the range follows straight on
+ * from the last one asked for, elem_count is widened to also cover the
+ * next read_ahead ranges, clamped to the end of the tag.
+ *
+ * Must be called with the tag API mutex held.
+ */
+
+int tag_read_ahead_unsafe(plc_tag_p tag, int elem_offset, int *elem_count)
+{
+    int is_sequential = (elem_offset == tag->read_ahead_next);
+    int count = *elem_count;
+
+    tag->read_ahead_next = elem_offset + count;
+
+    if(tag->read_ahead_end > 0 && !tag->read_in_flight
+       && elem_offset >= tag->read_ahead_start && elem_offset + count <= tag->read_ahead_end
+       && tag->vtable->status(tag) == PLCTAG_STATUS_OK) {
+        return 1;
+    }
+
+    if(is_sequential && tag->vtable->get_int_attrib) {
+        int tag_elems = tag->vtable->get_int_attrib(tag, "elem_count", 0);
+        int64_t widened = (int64_t)count * (1 + tag->read_ahead);
+
+        if(elem_offset + widened > tag_elems) {
+            widened = tag_elems - elem_offset;
+        }
+
+        if(widened > count) {
+            count = (int)widened;
+        }
+    }
+
+    tag->read_ahead_start = elem_offset;
+    tag->read_ahead_end = elem_offset + count;
+    *elem_count = count;
+
+    return 0;
+}
+
+
+
+int tag_set_range_unsafe(plc_tag_p tag, int elem_offset, int elem_count)
+{
+    if(!tag->vtable->set_range) {
+        pdebug(DEBUG_WARN, "Tag type does not support element ranges!");
+        return PLCTAG_ERR_UNSUPPORTED;
+    }
+
+    /* do not change the range under an operation that is using it. */
+    if(tag->read_in_flight || tag->write_in_flight) {
+        pdebug(DEBUG_WARN, "An operation is already in flight!");
+        return PLCTAG_ERR_BUSY;
+    }
+
+    return tag->vtable->set_range(tag, elem_offset, elem_count);
+}
+
+
+
+/*
+ * tag_op_check_unsafe
+ *
+ * Check whether a read or write started with one of the functions above has
+ * finished.  If it finished here, the in flight flags are cleared and
+ * is_done is set.  If the tickler thread already finished the operation,
+ * is_done is not set since the tickler handled the completion.
+ *
+ * Must be called with the tag API mutex held.
+ */
+
+int tag_op_check_unsafe(plc_tag_p tag, int is_read, int *is_done)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    *is_done = 0;
+
+    if((is_read && !tag->read_in_flight) || (!is_read && !tag->write_in_flight)) {
+        /* the tickler finished the operation already. */
+        rc = tag->vtable->status(tag);
+
+        return rc;
+    }
+
+    /* give some time to the tickler function. */
+    if(tag->vtable->tickler) {
+        tag->vtable->tickler(tag);
+    }
+
+    rc = tag->vtable->status(tag);
+
+    if(rc != PLCTAG_STATUS_PENDING) {
+        if(rc != PLCTAG_STATUS_OK && tag->vtable->abort) {
+            tag->vtable->abort(tag);
+        }
+
+        if(is_read) {
+            tag->read_complete = 0;
+            tag->read_in_flight = 0;
+
+            if(rc == PLCTAG_STATUS_OK) {
+                tag->read_cache_expire = time_ms() + tag->read_cache_ms;
+            }
+        } else {
+            tag->write_complete = 0;
+            tag->write_in_flight = 0;
+        }
+
+        tag_stats_op_done(tag, is_read, rc);
+
+        *is_done = 1;
+
+        if(!is_read) {
+            tag_start_queued_write_unsafe(tag);
+        }
+    }
+
+    return rc;
+}
+
+
+
+/*
+ * tag_op_many
+ *
+ * Common code for plc_tag_read_many() and plc_tag_write_many().  With a
+ * source, the data is copied into each tag just before its write starts.
+ */
+
+int tag_op_many(int32_t *ids, int num_tags, int *statuses, int timeout, int is_read, const tag_write_source_t *source)
+{
+    int rc = PLCTAG_STATUS_OK;
+    plc_tag_p *tag_list = NULL;
+    int num_pending = 0;
+    int start_event = (is_read ? PLCTAG_EVENT_READ_STARTED : PLCTAG_EVENT_WRITE_STARTED);
+    int done_event = (is_read ? PLCTAG_EVENT_READ_COMPLETED : PLCTAG_EVENT_WRITE_COMPLETED);
+    int64_t deadline = 0;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(!ids || !statuses) {
+        pdebug(DEBUG_WARN, "Null tag ID or status array!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(num_tags <= 0) {
+        pdebug(DEBUG_WARN, "Number of tags must be greater than zero!");
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    if(timeout < 0) {
+        pdebug(DEBUG_WARN, "Timeout must not be negative!");
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    if(timeout > 0) {
+        deadline = time_ms() + timeout;
+    }
+
+    tag_list = (plc_tag_p *)mem_alloc((int)(sizeof(plc_tag_p) * (size_t)num_tags));
+    if(!tag_list) {
+        pdebug(DEBUG_ERROR, "Unable to allocate tag list!");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    for(int i=0; i < num_tags; i++) {
+        tag_list[i] = lookup_tag(ids[i]);
+
+        if(tag_list[i]) {
+            statuses[i] = PLCTAG_STATUS_PENDING;
+
+            if(tag_list[i]->callback) {
+                tag_list[i]->callback(ids[i], start_event, PLCTAG_STATUS_OK);
+            }
+        } else {
+            pdebug(DEBUG_WARN, "Tag %d not found.", ids[i]);
+            statuses[i] = PLCTAG_ERR_NOT_FOUND;
+        }
+    }
+
+    /* queue everything before the protocol threads start packing requests. */
+    ab_hold_requests();
+
+    for(int i=0; i < num_tags; i++) {
+        plc_tag_p tag = tag_list[i];
+        int is_done = 0;
+
+        if(!tag) {
+            continue;
+        }
+
+        critical_block(tag->api_mutex) {
+            if(is_read) {
+                statuses[i] = tag_read_start_unsafe(tag, deadline, &is_done);
+
+                if(tag->read_group && !is_done) {
+                    tag_group_read_started(tag);
+                }
+            } else if(source && (statuses[i] = tag_copy_source_unsafe(tag, source)) != PLCTAG_STATUS_OK) {
+                is_done = 1;
+            } else {
+                statuses[i] = tag_write_start_unsafe(tag, deadline, &is_done);
+            }
+        }
+
+        if(is_done) {
+            if(tag->callback) {
+                tag->callback(ids[i], done_event, statuses[i]);
+            }
+        } else {
+            num_pending++;
+        }
+    }
+
+    ab_release_requests();
+
+    if(timeout) {
+        int64_t start_time = time_ms();
+        int64_t timeout_time = timeout + start_time;
+
+        while(num_pending > 0) {
+            plc_tag_p wait_tag = NULL;
+            int64_t wait_ms = 0;
+
+            num_pending = 0;
+
+            for(int i=0; i < num_tags; i++) {
+                plc_tag_p tag = tag_list[i];
+                int is_done = 0;
+                int changed = 0;
+
+                if(!tag || statuses[i] != PLCTAG_STATUS_PENDING) {
+                    continue;
+                }
+
+                critical_block(tag->api_mutex) {
+                    statuses[i] = tag_op_check_unsafe(tag, is_read, &is_done);
+
+                    if(is_done && is_read && statuses[i] == PLCTAG_STATUS_OK) {
+                        changed = tag_detect_change_unsafe(tag);
+                        tag_sample_done_unsafe(tag);
+                    }
+
+                    if(is_done && is_read) {
+                        shared_publish_unsafe(tag, statuses[i]);
+                    }
+
+                    if(is_done) {
+                        alias_parent_done_unsafe(tag, is_read, statuses[i]);
+                    }
+                }
+
+                if(is_done && is_read && tag->read_group) {
+                    tag_group_read_done(tag, statuses[i]);
+                }
+
+                if(is_done && tag->callback) {
+                    tag->callback(ids[i], done_event, statuses[i]);
+
+                    if(changed) {
+                        tag->callback(ids[i], PLCTAG_EVENT_VALUE_CHANGED, PLCTAG_STATUS_OK);
+                    }
+                }
+
+                if(statuses[i] == PLCTAG_STATUS_PENDING) {
+                    num_pending++;
+
+                    if(!wait_tag) {
+                        wait_tag = tag;
+                    }
+                }
+            }
+
+            if(!num_pending) {
+                break;
+            }
+
+            wait_ms = timeout_time - time_ms();
+            if(wait_ms <= 0) {
+                break;
+            }
+
+            if(wait_ms > TAG_WAIT_POLL_MS) {
+                wait_ms = TAG_WAIT_POLL_MS;
+            }
+
+            /* wait for the first unfinished tag, the others are usually in the same packet. */
+            cond_wait(wait_tag->tag_cond_wait, (int)wait_ms);
+        }
+
+        /* abort anything that did not finish in time. */
+        for(int i=0; i < num_tags && num_pending > 0; i++) {
+            plc_tag_p tag = tag_list[i];
+
+            if(!tag || statuses[i] != PLCTAG_STATUS_PENDING) {
+                continue;
+            }
+
+            pdebug(DEBUG_WARN, "Operation on tag %d timed out.", ids[i]);
+
+            critical_block(tag->api_mutex) {
+                if(tag->vtable->abort) {
+                    tag->vtable->abort(tag);
+                }
+
+                tag->read_complete = 0;
+                tag->read_in_flight = 0;
+                tag->write_complete = 0;
+                tag->write_in_flight = 0;
+                tag->write_queued = 0;
+
+                tag_stats_op_done(tag, is_read, PLCTAG_ERR_TIMEOUT);
+                alias_parent_done_unsafe(tag, is_read, PLCTAG_ERR_TIMEOUT);
+            }
+
+            statuses[i] = PLCTAG_ERR_TIMEOUT;
+
+            if(is_read && tag->read_group) {
+                tag_group_read_done(tag, statuses[i]);
+            }
+
+            if(tag->callback) {
+                tag->callback(ids[i], done_event, statuses[i]);
+            }
+        }
+
+        pdebug(DEBUG_INFO,"elapsed time %" PRId64 "ms",(time_ms()-start_time));
+    } else {
+        /* the tickler drives the operations to completion. */
+        for(int i=0; i < num_tags; i++) {
+            if(tag_list[i] && statuses[i] == PLCTAG_STATUS_PENDING) {
+                plc_tag_tickler_wake(tag_list[i]);
+            }
+        }
+    }
+
+    /* collect the overall status and release the tags. */
+    for(int i=0; i < num_tags; i++) {
+        if(rc == PLCTAG_STATUS_OK && statuses[i] != PLCTAG_STATUS_OK) {
+            rc = statuses[i];
+        } else if(rc == PLCTAG_STATUS_PENDING && statuses[i] != PLCTAG_STATUS_OK && statuses[i] != PLCTAG_STATUS_PENDING) {
+            rc = statuses[i];
+        }
+
+        if(tag_list[i]) {
+            rc_dec(tag_list[i]);
+        }
+    }
+
+    mem_free(tag_list);
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return rc;
+}
+
+
+
+/*
+ * tag_group_get
+ *
+ * Find the named read group, creating it if requested.
+ */
+
+tag_group_p tag_group_get(const char *name, int create)
+{
+    tag_group_p group = NULL;
+
+    if(!name || str_length(name) == 0 || !tag_group_mutex) {
+        return NULL;
+    }
+
+    critical_block(tag_group_mutex) {
+        for(group = tag_groups; group; group = group->next) {
+            if(str_cmp(group->name, name) == 0) {
+                break;
+            }
+        }
+
+        if(!group && create) {
+            group = (tag_group_p)mem_alloc((int)sizeof(struct tag_group_t));
+            if(!group) {
+                pdebug(DEBUG_ERROR, "Unable to allocate read group!");
+                break;
+            }
+
+            group->name = str_dup(name);
+            if(!group->name) {
+                pdebug(DEBUG_ERROR, "Unable to copy read group name!");
+                mem_free(group);
+                group = NULL;
+                break;
+            }
+
+            group->read_status = PLCTAG_STATUS_OK;
+            group->next = tag_groups;
+            tag_groups = group;
+
+            pdebug(DEBUG_DETAIL, "Created read group %s.", name);
+        }
+    }
+
+    return group;
+}
+
+
+
+int tag_group_add_member(tag_group_p group, int32_t tag_id)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    critical_block(tag_group_mutex) {
+        if(group->num_members >= group->member_capacity) {
+            int new_capacity = (group->member_capacity ? group->member_capacity * 2 : 16); /* MAGIC */
+            tag_group_member_t *new_members = (tag_group_member_t *)mem_realloc(group->members, (int)(sizeof(tag_group_member_t) * (size_t)new_capacity));
+
+            if(!new_members) {
+                pdebug(DEBUG_ERROR, "Unable to grow read group member list!");
+                rc = PLCTAG_ERR_NO_MEM;
+                break;
+            }
+
+            group->members = new_members;
+            group->member_capacity = new_capacity;
+        }
+
+        group->members[group->num_members].tag_id = tag_id;
+        group->members[group->num_members].read_pending = 0;
+        group->num_members++;
+    }
+
+    return rc;
+}
+
+
+
+void tag_group_remove_member(tag_group_p group, int32_t tag_id)
+{
+    int fire_done = 0;
+    int status = PLCTAG_STATUS_OK;
+    void (*callback)(const char *group_name, int event, int status) = NULL;
+
+    critical_block(tag_group_mutex) {
+        for(int i=0; i < group->num_members; i++) {
+            if(group->members[i].tag_id == tag_id) {
+                /* a removed member no longer holds up the group read. */
+                if(group->members[i].read_pending) {
+                    group->reads_pending--;
+
+                    if(group->reads_pending == 0) {
+                        fire_done = 1;
+                        status = group->read_status;
+                        callback = group->callback;
+                    }
+                }
+
+                group->members[i] = group->members[group->num_members - 1];
+                group->num_members--;
+                break;
+            }
+        }
+    }
+
+    if(fire_done && callback) {
+        tag_dispatch_event(NULL, group, PLCTAG_EVENT_READ_COMPLETED, status);
+    }
+}
+
+
+
+/*
+ * tag_group_read_started
+ *
+ * Note that a read on a group member started.  The first read of a cycle
+ * fires the group read started event.
+ */
+
+void tag_group_read_started(plc_tag_p tag)
+{
+    tag_group_p group = tag->read_group;
+    void (*callback)(const char *group_name, int event, int status) = NULL;
+
+    critical_block(tag_group_mutex) {
+        for(int i=0; i < group->num_members; i++) {
+            if(group->members[i].tag_id == tag->tag_id) {
+                if(!group->members[i].read_pending) {
+                    group->members[i].read_pending = 1;
+
+                    if(group->reads_pending == 0) {
+                        group->read_status = PLCTAG_STATUS_OK;
+                        callback = group->callback;
+                    }
+
+                    group->reads_pending++;
+                }
+
+                break;
+            }
+        }
+    }
+
+    if(callback) {
+        tag_dispatch_event(NULL, group, PLCTAG_EVENT_READ_STARTED, PLCTAG_STATUS_OK);
+    }
+}
+
+
+
+/*
+ * tag_group_read_done
+ *
+ * Note that a read on a group member finished.  The last read of a cycle
+ * fires the group read completed event.
+ */
+
+void tag_group_read_done(plc_tag_p tag, int status)
+{
+    tag_group_p group = tag->read_group;
+    void (*callback)(const char *group_name, int event, int status) = NULL;
+    int group_status = PLCTAG_STATUS_OK;
+
+    critical_block(tag_group_mutex) {
+        for(int i=0; i < group->num_members; i++) {
+            if(group->members[i].tag_id == tag->tag_id) {
+                if(group->members[i].read_pending) {
+                    group->members[i].read_pending = 0;
+
+                    if(status != PLCTAG_STATUS_OK && group->read_status == PLCTAG_STATUS_OK) {
+                        group->read_status = status;
+                    }
+
+                    group->reads_pending--;
+
+                    if(group->reads_pending == 0) {
+                        callback = group->callback;
+                        group_status = group->read_status;
+                    }
+                }
+
+                break;
+            }
+        }
+    }
+
+    if(callback) {
+        tag_dispatch_event(NULL, group, PLCTAG_EVENT_READ_COMPLETED, group_status);
+    }
+}
+
+
+
+void tag_group_destroy_all(void)
+{
+    critical_block(tag_group_mutex) {
+        while(tag_groups) {
+            tag_group_p group = tag_groups;
+
+            tag_groups = group->next;
+
+            if(group->members) {
+                mem_free(group->members);
+            }
+
+            mem_free(group->name);
+            mem_free(group);
+        }
+    }
+}
+
+
+
+
+/*
+ * tag_scan_class_join
+ *
+ * Put the tag in its scan class and line up its next read with the rest
+ * of the class.  Without a name, the class is the one shared by all tags
+ * with the same period and priority.  A named class takes its period and
+ * priority from its first tag and later tags use those.  Classes are per
+ * PLC.
+ */
+
+int tag_scan_class_join(plc_tag_p tag, const char *name, int priority)
+{
+    char period_name[48];
+    tag_scan_class_p scan_class = NULL;
+    tag_scan_plc_t *plc = NULL;
+    int rc = PLCTAG_STATUS_OK;
+
+    if(!name || str_length(name) == 0) {
+        if(tag->auto_sync_read_ms <= 0) {
+            tag->scan_class = NULL;
+            tag->auto_sync_next_read = 0;
+            return PLCTAG_STATUS_OK;
+        }
+
+        snprintf(period_name, sizeof(period_name), "@%dms:%d", tag->auto_sync_read_ms, priority);
+        name = period_name;
+    }
+
+    critical_block(tag_scan_class_mutex) {
+        for(scan_class = tag_scan_classes; scan_class; scan_class = scan_class->next) {
+            if(scan_class->plc->plc_key == tag->plc_key && str_cmp(scan_class->name, name) == 0) {
+                break;
+            }
+        }
+
+        if(!scan_class) {
+            if(tag->auto_sync_read_ms <= 0) {
+                pdebug(DEBUG_WARN, "A new scan class needs auto_sync_read_ms to set its period!");
+                rc = PLCTAG_ERR_BAD_PARAM;
+                break;
+            }
+
+            plc = tag_scan_plc_get_unsafe(tag->plc_key);
+            if(!plc) {
+                rc = PLCTAG_ERR_NO_MEM;
+                break;
+            }
+
+            scan_class = (tag_scan_class_p)mem_alloc((int)sizeof(struct tag_scan_class_t));
+            if(!scan_class) {
+                pdebug(DEBUG_ERROR, "Unable to allocate scan class!");
+                rc = PLCTAG_ERR_NO_MEM;
+                break;
+            }
+
+            scan_class->name = str_dup(name);
+            if(!scan_class->name) {
+                pdebug(DEBUG_ERROR, "Unable to copy scan class name!");
+                mem_free(scan_class);
+                scan_class = NULL;
+                rc = PLCTAG_ERR_NO_MEM;
+                break;
+            }
+
+            scan_class->plc = plc;
+            scan_class->priority = priority;
+            scan_class->period_ms = tag->auto_sync_read_ms;
+            scan_class->phase_ms = tag_scan_class_phase(tag->plc_key, plc->num_classes, scan_class->period_ms);
+            scan_class->stretch = 1;
+            scan_class->next = tag_scan_classes;
+            tag_scan_classes = scan_class;
+
+            /* the read time budget comes from the fastest top priority class. */
+            if(plc->num_classes == 0 || priority > plc->top_priority) {
+                plc->top_priority = priority;
+                plc->budget_ms = scan_class->period_ms;
+            } else if(priority == plc->top_priority && scan_class->period_ms < plc->budget_ms) {
+                plc->budget_ms = scan_class->period_ms;
+            }
+
+            plc->num_classes++;
+
+            pdebug(DEBUG_DETAIL, "Created scan class %s with period %dms and phase %" PRId64 "ms.", name, scan_class->period_ms, scan_class->phase_ms);
+        } else if(tag->auto_sync_read_ms != scan_class->period_ms) {
+            if(tag->auto_sync_read_ms > 0) {
+                pdebug(DEBUG_WARN, "Scan class %s has period %dms, ignoring auto_sync_read_ms=%d.", name, scan_class->period_ms, tag->auto_sync_read_ms);
+            }
+
+            tag->auto_sync_read_ms = scan_class->period_ms;
+        }
+
+        tag->auto_sync_next_read = tag_scan_class_next_read(scan_class, time_ms());
+    }
+
+    if(rc != PLCTAG_STATUS_OK) {
+        return rc;
+    }
+
+    tag->scan_class = scan_class;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * tag_scan_plc_get_unsafe
+ *
+ * Find or make the scan state of a PLC.  The scan class mutex must be
+ * held.
+ */
+
+tag_scan_plc_t *tag_scan_plc_get_unsafe(uint32_t plc_key)
+{
+    tag_scan_plc_t *plc = NULL;
+
+    for(plc = tag_scan_plcs; plc; plc = plc->next) {
+        if(plc->plc_key == plc_key) {
+            return plc;
+        }
+    }
+
+    plc = (tag_scan_plc_t *)mem_alloc((int)sizeof(*plc));
+    if(!plc) {
+        pdebug(DEBUG_ERROR, "Unable to allocate scan class PLC state!");
+        return NULL;
+    }
+
+    plc->plc_key = plc_key;
+    plc->next = tag_scan_plcs;
+    tag_scan_plcs = plc;
+
+    return plc;
+}
+
+
+
+/*
+ * tag_scan_class_phase
+ *
+ * The offset within its period of the class_index'th class of a PLC.
+ */
+
+int64_t tag_scan_class_phase(uint32_t plc_key, int class_index, int32_t period_ms)
+{
+    int64_t step = ((int64_t)(plc_key % TAG_SCAN_PHASE_STEPS) + ((int64_t)class_index * TAG_SCAN_PHASE_STEP)) % TAG_SCAN_PHASE_STEPS;
+
+    return (step * period_ms) / TAG_SCAN_PHASE_STEPS;
+}
+
+
+
+/*
+ * tag_scan_class_next_read
+ *
+ * The first read time of the class after the passed time.  The scan class
+ * mutex must be held.
+ */
+
+int64_t tag_scan_class_next_read(tag_scan_class_p scan_class, int64_t current_time)
+{
+    int64_t effective_ms = (int64_t)scan_class->period_ms * scan_class->stretch;
+    int64_t periods = (current_time - scan_class->phase_ms) / effective_ms;
+
+    return scan_class->phase_ms + ((periods + 1) * effective_ms);
+}
+
+
+
+/*
+ * tag_scan_class_schedule
+ *
+ * Called when a member read starts.  Adjust the stretch of the class at
+ * most once per effective period and return when the member reads next.
+ */
+
+int64_t tag_scan_class_schedule(tag_scan_class_p scan_class, int64_t current_time, int overrun)
+{
+    int64_t next_read = 0;
+
+    critical_block(tag_scan_class_mutex) {
+        tag_scan_plc_t *plc = scan_class->plc;
+        int64_t budget_us = (int64_t)plc->budget_ms * 1000;
+
+        if(overrun) {
+            plc->overruns++;
+        }
+
+        if(scan_class->priority < plc->top_priority && current_time - scan_class->last_adjust_ms >= (int64_t)scan_class->period_ms * scan_class->stretch) {
+            int behind = (plc->overruns != scan_class->last_overruns || plc->read_us_avg > budget_us / 2);
+
+            if(behind && scan_class->stretch < TAG_SCAN_MAX_STRETCH) {
+                scan_class->stretch *= 2;
+                pdebug(DEBUG_INFO, "PLC is behind, stretching scan class %s to %dms.", scan_class->name, scan_class->period_ms * scan_class->stretch);
+            } else if(!behind && scan_class->stretch > 1 && plc->read_us_avg < budget_us / 4) {
+                scan_class->stretch /= 2;
+                pdebug(DEBUG_INFO, "PLC caught up, scan class %s back to %dms.", scan_class->name, scan_class->period_ms * scan_class->stretch);
+            }
+
+            scan_class->last_overruns = plc->overruns;
+            scan_class->last_adjust_ms = current_time;
+        }
+
+        next_read = tag_scan_class_next_read(scan_class, current_time);
+    }
+
+    return next_read;
+}
+
+
+
+/*
+ * tag_scan_class_read_done
+ *
+ * Fold the time a member read took into the average for its PLC.
+ */
+
+void tag_scan_class_read_done(tag_scan_class_p scan_class, int64_t read_us)
+{
+    critical_block(tag_scan_class_mutex) {
+        tag_scan_plc_t *plc = scan_class->plc;
+
+        plc->read_us_avg += (read_us - plc->read_us_avg) / 8;
+    }
+}
+
+
+
+void tag_scan_class_destroy_all(void)
+{
+    critical_block(tag_scan_class_mutex) {
+        while(tag_scan_classes) {
+            tag_scan_class_p scan_class = tag_scan_classes;
+
+            tag_scan_classes = scan_class->next;
+
+            mem_free(scan_class->name);
+            mem_free(scan_class);
+        }
+
+        while(tag_scan_plcs) {
+            tag_scan_plc_t *plc = tag_scan_plcs;
+
+            tag_scan_plcs = plc->next;
+
+            mem_free(plc);
+        }
+    }
+}
+
+
+
+
+/*
+ * tag_dispatch_event
+ *
+ * Deliver a tag (or group) event.  Without a callback pool the callback is
+ * called right away.  Otherwise the event is queued on the worker that owns
+ * the tag.  If the worker stays full for too long the event is delivered
+ * inline so that a callback that itself generates events cannot deadlock
+ * its own worker.
+ */
+
+void tag_dispatch_event(plc_tag_p tag, tag_group_p group, int event, int status)
+{
+    tag_callback_pool_p pool = NULL;
+    tag_callback_event_t callback_event;
+    tag_callback_worker_t *worker = NULL;
+    tag_callback_overflow_t *overflow = NULL;
+    int queued = 0;
+    int overflowing = 0;
+    int deliver_inline = 0;
+
+    callback_event.tag_id = (tag ? tag->tag_id : 0);
+    callback_event.group = group;
+    callback_event.event = event;
+    callback_event.status = status;
+
+    plctag_trace2(tag_callback_dispatch, callback_event.tag_id, event);
+
+    if(tag_callback_mutex) {
+        critical_block(tag_callback_mutex) {
+            if(tag_callback_pool) {
+                pool = (tag_callback_pool_p)rc_inc(tag_callback_pool);
+            }
+        }
+    }
+
+    if(!pool) {
+        if(tag) {
+            if(tag->callback) {
+                tag->callback(tag->tag_id, event, status);
+            }
+        } else {
+            tag_callback_deliver(&callback_event);
+        }
+
+        return;
+    }
+
+    if(tag) {
+        worker = &(pool->workers[(tag->tag_id & TAG_SLOT_MASK) % pool->num_workers]);
+    } else {
+        worker = &(pool->workers[(int)(((uintptr_t)group >> 4) % (uintptr_t)pool->num_workers)]);
+    }
+
+    for(int attempt = 0; attempt < 2 && !queued && !deliver_inline; attempt++) {
+        /* an event that still does not fit goes on the overflow list. */
+        if(attempt > 0 || overflowing) {
+            overflow = (tag_callback_overflow_t *)mem_alloc((int)sizeof(*overflow));
+        }
+
+        critical_block(worker->mutex) {
+            if(worker->terminating) {
+                deliver_inline = 1;
+            } else if(worker->count < TAG_CALLBACK_QUEUE_SIZE && !worker->overflow_head) {
+                worker->events[(worker->head + worker->count) % TAG_CALLBACK_QUEUE_SIZE] = callback_event;
+                worker->count++;
+                queued = 1;
+            } else if(overflow) {
+                overflow->event = callback_event;
+
+                if(worker->overflow_tail) {
+                    worker->overflow_tail->next = overflow;
+                } else {
+                    worker->overflow_head = overflow;
+                }
+
+                worker->overflow_tail = overflow;
+                overflow = NULL;
+                queued = 1;
+            } else if(worker->overflow_head) {
+                /* stay behind the overflow list without waiting for the ring. */
+                overflowing = 1;
+            }
+        }
+
+        if(queued) {
+            cond_signal(worker->not_empty);
+        } else if(!deliver_inline && !overflowing && attempt == 0) {
+            cond_wait(worker->not_full, TAG_CALLBACK_WAIT_MS);
+        }
+    }
+
+    if(overflow) {
+        mem_free(overflow);
+    }
+
+    /* only when stopping the pool or out of memory. */
+    if(!queued) {
+        if(!deliver_inline) {
+            pdebug(DEBUG_WARN, "Unable to queue callback event %d, delivering it inline!", event);
+        }
+
+        tag_callback_deliver(&callback_event);
+    }
+
+    rc_dec(pool);
+}
+
+
+
+
+/*
+ * tag_callback_deliver
+ *
+ * Call the callback for a queued event.  The tag may have been destroyed or
+ * its callback removed since the event was queued.
+ */
+
+void tag_callback_deliver(tag_callback_event_t *event)
+{
+    plctag_trace2(tag_callback_deliver, event->tag_id, event->event);
+
+    if(event->group) {
+        tag_group_p group = event->group;
+        void (*callback)(const char *group_name, int event, int status) = NULL;
+
+        critical_block(tag_group_mutex) {
+            callback = group->callback;
+        }
+
+        if(callback) {
+            callback(group->name, event->event, event->status);
+        }
+    } else {
+        plc_tag_p tag = lookup_tag(event->tag_id);
+
+        if(tag) {
+            if(tag->callback) {
+                tag->callback(event->tag_id, event->event, event->status);
+            }
+
+            rc_dec(tag);
+        }
+    }
+}
+
+
+
+THREAD_FUNC(tag_callback_worker_func)
+{
+    tag_callback_worker_t *worker = (tag_callback_worker_t *)arg;
+    int done = 0;
+
+    debug_set_tag_id(0);
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    while(!done) {
+        tag_callback_event_t event;
+        tag_callback_overflow_t *overflow = NULL;
+        int have_event = 0;
+
+        /* everything in the ring is older than anything on the overflow list. */
+        critical_block(worker->mutex) {
+            if(worker->count > 0) {
+                event = worker->events[worker->head];
+                worker->head = (worker->head + 1) % TAG_CALLBACK_QUEUE_SIZE;
+                worker->count--;
+                have_event = 1;
+            } else if(worker->overflow_head) {
+                overflow = worker->overflow_head;
+                worker->overflow_head = overflow->next;
+
+                if(!worker->overflow_head) {
+                    worker->overflow_tail = NULL;
+                }
+
+                event = overflow->event;
+                have_event = 1;
+            } else if(worker->terminating) {
+                done = 1;
+            }
+        }
+
+        if(overflow) {
+            mem_free(overflow);
+        }
+
+        if(have_event) {
+            cond_signal(worker->not_full);
+            tag_callback_deliver(&event);
+        } else if(!done) {
+            cond_wait(worker->not_empty, TAG_CALLBACK_WAIT_MS);
+        }
+    }
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    THREAD_RETURN(0);
+}
+
+
+
+/*
+ * tag_callback_pool_start
+ *
+ * Start a pool of callback worker threads.  Any existing pool must have
+ * been stopped first.
+ */
+
+int tag_callback_pool_start(int num_threads)
+{
+    int rc = PLCTAG_STATUS_OK;
+    tag_callback_pool_p pool = NULL;
+
+    pdebug(DEBUG_INFO, "Starting with %d threads.", num_threads);
+
+    pool = (tag_callback_pool_p)rc_alloc((int)(sizeof(tag_callback_pool_t) + ((size_t)num_threads * sizeof(tag_callback_worker_t))), tag_callback_pool_destroy);
+    if(!pool) {
+        pdebug(DEBUG_ERROR, "Unable to allocate callback pool!");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    for(int i=0; i < num_threads && rc == PLCTAG_STATUS_OK; i++) {
+        tag_callback_worker_t *worker = &(pool->workers[i]);
+
+        /* count the worker now so that the destructor cleans up a partial one. */
+        pool->num_workers++;
+
+        rc = mutex_create(&worker->mutex);
+        if(rc == PLCTAG_STATUS_OK) {
+            rc = cond_create(&worker->not_empty);
+        }
+
+        if(rc == PLCTAG_STATUS_OK) {
+            rc = cond_create(&worker->not_full);
+        }
+
+        if(rc == PLCTAG_STATUS_OK) {
+            rc = thread_create(&worker->thread, tag_callback_worker_func, 32*1024, worker);
+        }
+
+        if(rc == PLCTAG_STATUS_OK) {
+            plc_tag_generic_tune_thread(worker->thread, PLCTAG_THREAD_CALLBACK);
+        }
+    }
+
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_ERROR, "Unable to set up callback worker, error %s!", plc_tag_decode_error(rc));
+        rc_dec(pool);
+        return rc;
+    }
+
+    critical_block(tag_callback_mutex) {
+        tag_callback_pool = pool;
+    }
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return rc;
+}
+
+
+
+/*
+ * tag_callback_pool_stop
+ *
+ * Stop the callback pool after the workers have delivered everything
+ * already queued, including any overflow.  This must not be called from a callback.
+ */
+
+void tag_callback_pool_stop(void)
+{
+    tag_callback_pool_p pool = NULL;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    critical_block(tag_callback_mutex) {
+        pool = tag_callback_pool;
+        tag_callback_pool = NULL;
+    }
+
+    if(pool) {
+        rc_dec(pool);
+    }
+
+    pdebug(DEBUG_INFO, "Done.");
+}
+
+
+
+void tag_callback_pool_destroy(void *pool_arg)
+{
+    tag_callback_pool_p pool = (tag_callback_pool_p)pool_arg;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    /* a worker only exits once its queue is empty. */
+    for(int i=0; i < pool->num_workers; i++) {
+        tag_callback_worker_t *worker = &(pool->workers[i]);
+
+        if(worker->mutex) {
+            critical_block(worker->mutex) {
+                worker->terminating = 1;
+            }
+        }
+
+        if(worker->not_empty) {
+            cond_signal(worker->not_empty);
+        }
+
+        if(worker->not_full) {
+            cond_signal(worker->not_full);
+        }
+    }
+
+    for(int i=0; i < pool->num_workers; i++) {
+        tag_callback_worker_t *worker = &(pool->workers[i]);
+
+        if(worker->thread) {
+            thread_join(worker->thread);
+            thread_destroy(&worker->thread);
+        }
+
+        if(worker->not_full) {
+            cond_destroy(&worker->not_full);
+        }
+
+        if(worker->not_empty) {
+            cond_destroy(&worker->not_empty);
+        }
+
+        if(worker->mutex) {
+            mutex_destroy(&worker->mutex);
+        }
+    }
+
+    pdebug(DEBUG_INFO, "Done.");
+}
+
+
+
+
+
+/*
+ * tag_stats_op_start
+ *
+ * Note the start of a read or write.  The statistics block is allocated
+ * the first time.  The tag API mutex must be held.
+ */
+
+void tag_stats_op_start(plc_tag_p tag)
+{
+    if(!tag->stats) {
+        tag->stats = (tag_stats_p)mem_alloc((int)sizeof(tag_stats_t));
+        if(!tag->stats) {
+            pdebug(DEBUG_WARN, "Unable to allocate tag statistics!");
+            return;
+        }
+    }
+
+    tag->stats->op_start_us = time_us();
+}
+
+
+
+/*
+ * tag_stats_op_done
+ *
+ * Account for a finished read or write.  An operation is only counted once
+ * even if more than one path sees it finish.  The tag API mutex must be
+ * held.  Returns how long the operation took, or zero if it was already
+ * counted.
+ */
+
+int64_t tag_stats_op_done(plc_tag_p tag, int is_read, int status)
+{
+    int64_t elapsed_us = 0;
+
+    if(!tag->stats || !tag->stats->op_start_us) {
+        return 0;
+    }
+
+    elapsed_us = time_us() - tag->stats->op_start_us;
+    tag->stats->op_start_us = 0;
+
+    if(is_read) {
+        tag->stats->read_count++;
+        tag_stats_hist_add(&tag->stats->read_latency, elapsed_us);
+    } else {
+        tag->stats->write_count++;
+        tag_stats_hist_add(&tag->stats->write_latency, elapsed_us);
+    }
+
+    if(status == PLCTAG_ERR_TIMEOUT) {
+        tag->stats->timeout_count++;
+    } else if(status != PLCTAG_STATUS_OK && status != PLCTAG_STATUS_PENDING) {
+        tag->stats->error_count++;
+    }
+
+    return elapsed_us;
+}
+
+
+
+void plc_tag_generic_record_request(plc_tag_p tag, int64_t time_queued, int64_t time_sent, int64_t time_received)
+{
+    /* the last response of a read is when its data arrived. */
+    if(time_received) {
+        tag->last_response_us = time_received;
+    }
+
+    if(!tag->stats) {
+        return;
+    }
+
+    tag->stats->fragment_count++;
+
+    if(time_queued && time_sent && time_sent >= time_queued) {
+        tag_stats_hist_add(&tag->stats->queue_wait, time_sent - time_queued);
+    }
+
+    if(time_sent && time_received && time_received >= time_sent) {
+        tag_stats_hist_add(&tag->stats->wire_rtt, time_received - time_sent);
+    }
+}
+
+
+
+void tag_stats_hist_add(tag_latency_hist_t *hist, int64_t value_us)
+{
+    int bucket = 0;
+
+    if(value_us < 0) {
+        value_us = 0;
+    }
+
+    /* bucket N holds values from 2^N up to 2^(N+1)-1 microseconds. */
+    while(bucket < (TAG_STATS_BUCKETS - 1) && (value_us >> (bucket + 1)) > 0) {
+        bucket++;
+    }
+
+    hist->count++;
+    hist->buckets[bucket]++;
+    hist->total_us += value_us;
+
+    if(value_us > hist->max_us) {
+        hist->max_us = value_us;
+    }
+}
+
+
+
+/*
+ * tag_stats_hist_percentile
+ *
+ * Estimate a percentile as the top of the bucket that holds it, capped at
+ * the largest value seen.
+ */
+
+int tag_stats_hist_percentile(tag_latency_hist_t *hist, int percent)
+{
+    uint64_t target = 0;
+    uint64_t seen = 0;
+    int64_t res = 0;
+
+    if(hist->count == 0) {
+        return 0;
+    }
+
+    target = (((uint64_t)hist->count * (uint64_t)(unsigned int)percent) + 99) / 100;
+    if(target == 0) {
+        target = 1;
+    }
+
+    for(int bucket = 0; bucket < TAG_STATS_BUCKETS; bucket++) {
+        seen += hist->buckets[bucket];
+
+        if(seen >= target) {
+            res = ((int64_t)1 << (bucket + 1)) - 1;
+            break;
+        }
+    }
+
+    if(res > hist->max_us) {
+        res = hist->max_us;
+    }
+
+    return (res > INT_MAX ? INT_MAX : (int)res);
+}
+
+
+
+/*
+ * tag_stats_get_attrib
+ *
+ * Look up a statistics attribute.  The latency attributes are named
+ * <read_latency|write_latency|queue_wait|wire_rtt>_<avg|max|p50|p90|p99>_us
+ * and <name>_count for the number of samples.  Returns 1 if the attribute
+ * was found.  The tag API mutex must be held.
+ */
+
+int tag_stats_get_attrib(plc_tag_p tag, const char *attrib_name, int *value)
+{
+    static tag_stats_t no_stats;
+    tag_stats_p stats = (tag->stats ? tag->stats : &no_stats);
+    struct {
+        const char *name;
+        tag_latency_hist_t *hist;
+    } hists[] = {
+        { "read_latency_", &stats->read_latency },
+        { "write_latency_", &stats->write_latency },
+        { "queue_wait_", &stats->queue_wait },
+        { "wire_rtt_", &stats->wire_rtt }
+    };
+
+    if(str_cmp_i(attrib_name, "read_count") == 0) {
+        *value = (int)stats->read_count;
+        return 1;
+    } else if(str_cmp_i(attrib_name, "write_count") == 0) {
+        *value = (int)stats->write_count;
+        return 1;
+    } else if(str_cmp_i(attrib_name, "error_count") == 0) {
+        *value = (int)stats->error_count;
+        return 1;
+    } else if(str_cmp_i(attrib_name, "timeout_count") == 0) {
+        *value = (int)stats->timeout_count;
+        return 1;
+    } else if(str_cmp_i(attrib_name, "fragment_count") == 0) {
+        *value = (int)stats->fragment_count;
+        return 1;
+    }
+
+    for(size_t i=0; i < sizeof(hists)/sizeof(hists[0]); i++) {
+        int prefix_len = str_length(hists[i].name);
+        tag_latency_hist_t *hist = hists[i].hist;
+        const char *suffix = NULL;
+
+        if(str_cmp_i_n(attrib_name, hists[i].name, prefix_len) != 0) {
+            continue;
+        }
+
+        suffix = attrib_name + prefix_len;
+
+        if(str_cmp_i(suffix, "count") == 0) {
+            *value = (int)hist->count;
+        } else if(str_cmp_i(suffix, "avg_us") == 0) {
+            *value = (hist->count ? (int)(hist->total_us / (int64_t)hist->count) : 0);
+        } else if(str_cmp_i(suffix, "max_us") == 0) {
+            *value = (hist->max_us > INT_MAX ? INT_MAX : (int)hist->max_us);
+        } else if(str_cmp_i(suffix, "p50_us") == 0) {
+            *value = tag_stats_hist_percentile(hist, 50);
+        } else if(str_cmp_i(suffix, "p90_us") == 0) {
+            *value = tag_stats_hist_percentile(hist, 90);
+        } else if(str_cmp_i(suffix, "p99_us") == 0) {
+            *value = tag_stats_hist_percentile(hist, 99);
+        } else {
+            return 0;
+        }
+
+        return 1;
+    }
+
+    return 0;
+}
+
+
+
+/*
+ * tag_change_setup
+ *
+ * Set up value change detection if the tag has the change_detect or
+ * deadband attributes.
+ */
+
+int tag_change_setup(plc_tag_p tag, attr attribs)
+{
+    const char *type_str = attr_get_str(attribs, "deadband_type", NULL);
+    int elem_type = TAG_CHANGE_TYPE_BYTES;
+    int elem_size = 1;
+    double deadband = (double)attr_get_float(attribs, "deadband", 0.0f);
+    int enabled = attr_get_int(attribs, "change_detect", 0);
+
+    if(type_str) {
+        static const struct { const char *name; int type; int size; } types[] = {
+            { "int8", TAG_CHANGE_TYPE_INT8, 1 },
+            { "uint8", TAG_CHANGE_TYPE_UINT8, 1 },
+            { "int16", TAG_CHANGE_TYPE_INT16, 2 },
+            { "uint16", TAG_CHANGE_TYPE_UINT16, 2 },
+            { "int32", TAG_CHANGE_TYPE_INT32, 4 },
+            { "uint32", TAG_CHANGE_TYPE_UINT32, 4 },
+            { "int64", TAG_CHANGE_TYPE_INT64, 8 },
+            { "uint64", TAG_CHANGE_TYPE_UINT64, 8 },
+            { "float32", TAG_CHANGE_TYPE_FLOAT32, 4 },
+            { "float64", TAG_CHANGE_TYPE_FLOAT64, 8 }
+        };
+        int found = 0;
+
+        for(size_t i=0; i < sizeof(types)/sizeof(types[0]); i++) {
+            if(str_cmp_i(type_str, types[i].name) == 0) {
+                elem_type = types[i].type;
+                elem_size = types[i].size;
+                found = 1;
+                break;
+            }
+        }
+
+        if(!found) {
+            pdebug(DEBUG_WARN, "Unsupported deadband type %s!", type_str);
+            return PLCTAG_ERR_BAD_PARAM;
+        }
+
+        enabled = 1;
+    }
+
+    if(deadband < 0.0) {
+        pdebug(DEBUG_WARN, "Deadband must not be negative!");
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    if(deadband > 0.0) {
+        if(elem_type == TAG_CHANGE_TYPE_BYTES) {
+            pdebug(DEBUG_WARN, "A deadband needs a deadband_type!");
+            return PLCTAG_ERR_BAD_PARAM;
+        }
+
+        enabled = 1;
+    }
+
+    if(!enabled) {
+        return PLCTAG_STATUS_OK;
+    }
+
+    critical_block(tag->api_mutex) {
+        tag->change_detect = (tag_change_p)mem_alloc((int)sizeof(struct tag_change_t) + (tag->size > 0 ? tag->size : 1));
+        if(tag->change_detect) {
+            tag->change_detect->elem_type = elem_type;
+            tag->change_detect->elem_size = elem_size;
+            tag->change_detect->deadband = deadband;
+            tag->change_detect->sample_size = (tag->size > 0 ? tag->size : 1);
+        }
+    }
+
+    if(!tag->change_detect) {
+        pdebug(DEBUG_ERROR, "Unable to allocate value change detection state!");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    pdebug(DEBUG_DETAIL, "Value change detection enabled with deadband %f.", deadband);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/* get an element of the tag data as a double. */
+static double tag_change_value(plc_tag_p tag, const uint8_t *data, int elem_type, int elem_size)
+{
+    int shuffle[8];
+    uint8_t host[8];
+    int is_float = (elem_type == TAG_CHANGE_TYPE_FLOAT32 || elem_type == TAG_CHANGE_TYPE_FLOAT64);
+    union {
+        int16_t i16;
+        uint16_t u16;
+        int32_t i32;
+        uint32_t u32;
+        int64_t i64;
+        uint64_t u64;
+        float f32;
+        double f64;
+    } val;
+
+    if(elem_size == 1) {
+        host[0] = data[0];
+    } else {
+        tag_elem_shuffle(tag_elem_byte_order(tag, elem_size, is_float), elem_size, shuffle);
+
+        for(int b=0; b < elem_size; b++) {
+            host[b] = data[shuffle[b]];
+        }
+    }
+
+    switch(elem_type) {
+        case TAG_CHANGE_TYPE_INT8:
+            return (double)(int8_t)host[0];
+            break;
+
+        case TAG_CHANGE_TYPE_UINT8:
+            return (double)host[0];
+            break;
+
+        case TAG_CHANGE_TYPE_INT16:
+            mem_copy(&val.i16, host, 2);
+            return (double)val.i16;
+            break;
+
+        case TAG_CHANGE_TYPE_UINT16:
+            mem_copy(&val.u16, host, 2);
+            return (double)val.u16;
+            break;
+
+        case TAG_CHANGE_TYPE_INT32:
+            mem_copy(&val.i32, host, 4);
+            return (double)val.i32;
+            break;
+
+        case TAG_CHANGE_TYPE_UINT32:
+            mem_copy(&val.u32, host, 4);
+            return (double)val.u32;
+            break;
+
+        case TAG_CHANGE_TYPE_INT64:
+            mem_copy(&val.i64, host, 8);
+            return (double)val.i64;
+            break;
+
+        case TAG_CHANGE_TYPE_UINT64:
+            mem_copy(&val.u64, host, 8);
+            return (double)val.u64;
+            break;
+
+        case TAG_CHANGE_TYPE_FLOAT32:
+            mem_copy(&val.f32, host, 4);
+            return (double)val.f32;
+            break;
+
+        case TAG_CHANGE_TYPE_FLOAT64:
+            mem_copy(&val.f64, host, 8);
+            return val.f64;
+            break;
+
+        default:
+            return 0.0;
+            break;
+    }
+}
+
+
+
+/* add a changed span to the range list, merging with the last range if possible. */
+static void tag_change_add_range(tag_change_p change, int offset, int length)
+{
+    tag_change_range_t *last = (change->num_ranges > 0 ? &change->ranges[change->num_ranges - 1] : NULL);
+
+    if(last && last->offset + last->length == offset) {
+        last->length += length;
+    } else if(change->num_ranges < TAG_CHANGE_MAX_RANGES) {
+        change->ranges[change->num_ranges].offset = offset;
+        change->ranges[change->num_ranges].length = length;
+        change->num_ranges++;
+    } else {
+        /* out of ranges, stretch the last one. */
+        last->length = offset + length - last->offset;
+    }
+}
+
+
+
+/*
+ * tag_detect_change_unsafe
+ *
+ * Compare the tag data with the previous sample.  Returns non-zero if the
+ * value changed.  The first sample is always a change.  The tag API mutex
+ * must be held.
+ */
+
+int tag_detect_change_unsafe(plc_tag_p tag)
+{
+    tag_change_p change = tag->change_detect;
+    int elem_size = 0;
+
+    if(!change || !tag->data || tag->size <= 0) {
+        return 0;
+    }
+
+    /* the tag may have grown after the first read. */
+    if(change->sample_size != tag->size) {
+        tag_change_p new_change = (tag_change_p)mem_realloc(change, (int)sizeof(struct tag_change_t) + tag->size);
+
+        if(!new_change) {
+            pdebug(DEBUG_WARN, "Unable to resize value change sample!");
+            return 0;
+        }
+
+        change = tag->change_detect = new_change;
+        change->sample_size = tag->size;
+        change->has_sample = 0;
+    }
+
+    change->num_ranges = 0;
+
+    if(!change->has_sample) {
+        mem_copy(change->sample, tag->data, tag->size);
+        change->has_sample = 1;
+        tag_change_add_range(change, 0, tag->size);
+
+        return 1;
+    }
+
+    elem_size = change->elem_size;
+
+    for(int offset = 0; offset + elem_size <= tag->size; offset += elem_size) {
+        int changed = 0;
+
+        if(mem_cmp(&change->sample[offset], elem_size, &tag->data[offset], elem_size) == 0) {
+            continue;
+        }
+
+        if(change->elem_type == TAG_CHANGE_TYPE_BYTES) {
+            changed = 1;
+        } else {
+            double old_val = tag_change_value(tag, &change->sample[offset], change->elem_type, elem_size);
+            double new_val = tag_change_value(tag, &tag->data[offset], change->elem_type, elem_size);
+            double diff = (new_val > old_val ? new_val - old_val : old_val - new_val);
+
+            /* NaN never compares, treat any bit change as a change. */
+            changed = (diff > change->deadband || diff != diff);
+        }
+
+        if(changed) {
+            mem_copy(&change->sample[offset], &tag->data[offset], elem_size);
+            tag_change_add_range(change, offset, elem_size);
+        }
+    }
+
+    return (change->num_ranges > 0);
+}
+
+
+
+/*
+ * Set up write dirty range tracking if the tag has write_dirty_ranges set.
+ */
+
+int tag_dirty_setup(plc_tag_p tag, attr attribs)
+{
+    int merge_gap = attr_get_int(attribs, "write_merge_gap", TAG_DIRTY_MERGE_GAP);
+
+    if(!attr_get_int(attribs, "write_dirty_ranges", 0)) {
+        return PLCTAG_STATUS_OK;
+    }
+
+    if(merge_gap < 0) {
+        pdebug(DEBUG_WARN, "Write merge gap must not be negative!");
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    critical_block(tag->api_mutex) {
+        tag->dirty_ranges = (tag_dirty_p)mem_alloc((int)sizeof(struct tag_dirty_t));
+        if(tag->dirty_ranges) {
+            tag->dirty_ranges->merge_gap = merge_gap;
+        }
+    }
+
+    if(!tag->dirty_ranges) {
+        pdebug(DEBUG_ERROR, "Unable to allocate write dirty range state!");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    pdebug(DEBUG_DETAIL, "Write dirty range tracking enabled with merge gap %d.", merge_gap);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * Set up the read history if the tag has history_depth set.  The records
+ * are sized for the tag data when the first read lands.
+ */
+
+int tag_history_setup(plc_tag_p tag, attr attribs)
+{
+    int depth = attr_get_int(attribs, "history_depth", 0);
+
+    if(depth == 0) {
+        return PLCTAG_STATUS_OK;
+    }
+
+    if(depth < 0 || depth > TAG_HISTORY_MAX_DEPTH) {
+        pdebug(DEBUG_WARN, "History depth must be between 1 and %d!", TAG_HISTORY_MAX_DEPTH);
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    critical_block(tag->api_mutex) {
+        tag->history = (tag_history_p)mem_alloc((int)sizeof(struct tag_history_t));
+        if(tag->history) {
+            tag->history->depth = depth;
+        }
+    }
+
+    if(!tag->history) {
+        pdebug(DEBUG_ERROR, "Unable to allocate the read history!");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    pdebug(DEBUG_DETAIL, "Keeping the last %d reads.", depth);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * tag_sample_done_unsafe
+ *
+ * A read landed new data.  Stamp it with the time the response came in,
+ * or now if the protocol does not say, and count it.  The tag API mutex
+ * must be held.
+ */
+
+void tag_sample_done_unsafe(plc_tag_p tag)
+{
+    tag->sample_time_us = (tag->last_response_us ? tag->last_response_us : time_us());
+    tag->last_response_us = 0;
+    tag->sample_seq++;
+
+    tag_history_append_unsafe(tag);
+}
+
+
+
+/*
+ * tag_history_append_unsafe
+ *
+ * Add the tag data to the read history, overwriting the oldest record if
+ * the ring is full.  If the tag size changed, the old records are dropped.
+ * The tag API mutex must be held.
+ */
+
+void tag_history_append_unsafe(plc_tag_p tag)
+{
+    tag_history_p history = tag->history;
+    uint8_t *record = NULL;
+
+    if(!history || !tag->data || tag->size <= 0) {
+        return;
+    }
+
+    if(history->data_size != tag->size) {
+        int64_t total = (int64_t)sizeof(struct tag_history_t) + ((int64_t)history->depth * TAG_HISTORY_RECORD_SIZE(tag->size));
+        tag_history_p new_history = NULL;
+
+        if(total > INT_MAX) {
+            pdebug(DEBUG_WARN, "Read history of %d records of %d bytes is too large!", history->depth, tag->size);
+            return;
+        }
+
+        new_history = (tag_history_p)mem_realloc(history, (int)total);
+        if(!new_history) {
+            pdebug(DEBUG_WARN, "Unable to resize the read history!");
+            return;
+        }
+
+        history = tag->history = new_history;
+        history->dropped += (uint32_t)history->count;
+        history->data_size = tag->size;
+        history->first = 0;
+        history->count = 0;
+    }
+
+    if(history->count == history->depth) {
+        history->first = (history->first + 1) % history->depth;
+        history->count--;
+        history->dropped++;
+    }
+
+    record = history->records + ((history->first + history->count) % history->depth) * TAG_HISTORY_RECORD_SIZE(history->data_size);
+
+    mem_copy(record, &(tag->sample_time_us), PLCTAG_HISTORY_TIMESTAMP_SIZE);
+    mem_copy(record + PLCTAG_HISTORY_TIMESTAMP_SIZE, tag->data, history->data_size);
+
+    history->count++;
+}
+
+
+
+/*
+ * tag_add_dirty_range_unsafe
+ *
+ * Record that the setters changed length bytes at offset.  Does nothing
+ * unless the tag tracks dirty ranges.  The tag API mutex must be held.
+ */
+
+void tag_add_dirty_range_unsafe(plc_tag_p tag, int offset, int length)
+{
+    tag_dirty_p dirty = tag->dirty_ranges;
+    tag_change_range_t *ranges = NULL;
+    int start = offset;
+    int end = offset + length;
+    int first = 0;
+    int last = 0;
+
+    if(!dirty || length <= 0) {
+        return;
+    }
+
+    ranges = dirty->ranges;
+
+    /* skip the ranges that end well before the new span. */
+    while(first < dirty->num_ranges && ranges[first].offset + ranges[first].length + dirty->merge_gap < start) {
+        first++;
+    }
+
+    /* absorb the ranges that overlap or come close to it. */
+    for(last = first; last < dirty->num_ranges && ranges[last].offset <= end + dirty->merge_gap; last++) {
+        if(ranges[last].offset < start) {
+            start = ranges[last].offset;
+        }
+
+        if(ranges[last].offset + ranges[last].length > end) {
+            end = ranges[last].offset + ranges[last].length;
+        }
+    }
+
+    /* replace ranges first to last with the merged span. */
+    if(last != first + 1) {
+        mem_move(&ranges[first + 1], &ranges[last], (int)((size_t)(unsigned int)(dirty->num_ranges - last) * sizeof(*ranges)));
+        dirty->num_ranges += first + 1 - last;
+    }
+
+    ranges[first].offset = start;
+    ranges[first].length = end - start;
+
+    /* out of ranges, merge the closest pair. */
+    if(dirty->num_ranges > TAG_DIRTY_MAX_RANGES) {
+        int closest = 0;
+        int closest_gap = INT_MAX;
+
+        for(int i=0; i + 1 < dirty->num_ranges; i++) {
+            int gap = ranges[i + 1].offset - (ranges[i].offset + ranges[i].length);
+
+            if(gap < closest_gap) {
+                closest = i;
+                closest_gap = gap;
+            }
+        }
+
+        ranges[closest].length = ranges[closest + 1].offset + ranges[closest + 1].length - ranges[closest].offset;
+        mem_move(&ranges[closest + 1], &ranges[closest + 2], (int)((size_t)(unsigned int)(dirty->num_ranges - closest - 2) * sizeof(*ranges)));
+        dirty->num_ranges--;
+    }
+}
+
+
+
+/*
+ * plc_tag_generic_take_dirty_range
+ *
+ * Remove the first dirty range and return it.  Returns 0 if there is
+ * none.  The tag API mutex must be held.
+ */
+
+int plc_tag_generic_take_dirty_range(plc_tag_p tag, int *offset, int *length)
+{
+    tag_dirty_p dirty = tag->dirty_ranges;
+
+    if(!dirty || dirty->num_ranges <= 0) {
+        return 0;
+    }
+
+    *offset = dirty->ranges[0].offset;
+    *length = dirty->ranges[0].length;
+
+    dirty->num_ranges--;
+    mem_move(&dirty->ranges[0], &dirty->ranges[1], (int)((size_t)(unsigned int)dirty->num_ranges * sizeof(dirty->ranges[0])));
+
+    return 1;
+}
+
+
+
+/* put back a range that failed to write.  The tag API mutex must be held. */
+void plc_tag_generic_add_dirty_range(plc_tag_p tag, int offset, int length)
+{
+    tag_add_dirty_range_unsafe(tag, offset, length);
+}
+
+
+
+/* returns non-zero if there are dirty ranges left to write.  The tag API mutex must be held. */
+int plc_tag_generic_has_dirty_ranges(plc_tag_p tag)
+{
+    return (tag->dirty_ranges && tag->dirty_ranges->num_ranges > 0);
+}
+
+
+
+
+/**************************************************************************
+ ***************************  API Functions  ******************************
+ **************************************************************************/
+
+
+/*
+ * plc_tag_decode_error()
+ *
+ * This takes an integer error value and turns it into a printable string.
+ *
+ * FIXME - this should produce better errors than this!
+ */
+
+
+
+LIB_EXPORT const char *plc_tag_decode_error(int rc)
+{
+    switch(rc) {
+    case PLCTAG_STATUS_PENDING:
+        return "PLCTAG_STATUS_PENDING";
+    case PLCTAG_STATUS_OK:
+        return "PLCTAG_STATUS_OK";
+    case PLCTAG_ERR_ABORT:
+        return "PLCTAG_ERR_ABORT";
+    case PLCTAG_ERR_BAD_CONFIG:
+        return "PLCTAG_ERR_BAD_CONFIG";
+    case PLCTAG_ERR_BAD_CONNECTION:
+        return "PLCTAG_ERR_BAD_CONNECTION";
+    case PLCTAG_ERR_BAD_DATA:
+        return "PLCTAG_ERR_BAD_DATA";
+    case PLCTAG_ERR_BAD_DEVICE:
+        return "PLCTAG_ERR_BAD_DEVICE";
+    case PLCTAG_ERR_BAD_GATEWAY:
+        return "PLCTAG_ERR_BAD_GATEWAY";
+    case PLCTAG_ERR_BAD_PARAM:
+        return "PLCTAG_ERR_BAD_PARAM";
+    case PLCTAG_ERR_BAD_REPLY:
+        return "PLCTAG_ERR_BAD_REPLY";
+    case PLCTAG_ERR_BAD_STATUS:
+        return "PLCTAG_ERR_BAD_STATUS";
+    case PLCTAG_ERR_CLOSE:
+        return "PLCTAG_ERR_CLOSE";
+    case PLCTAG_ERR_CREATE:
+        return "PLCTAG_ERR_CREATE";
+    case PLCTAG_ERR_DUPLICATE:
+        return "PLCTAG_ERR_DUPLICATE";
+    case PLCTAG_ERR_ENCODE:
+        return "PLCTAG_ERR_ENCODE";
+    case PLCTAG_ERR_MUTEX_DESTROY:
+        return "PLCTAG_ERR_MUTEX_DESTROY";
+    case PLCTAG_ERR_MUTEX_INIT:
+        return "PLCTAG_ERR_MUTEX_INIT";
+    case PLCTAG_ERR_MUTEX_LOCK:
+        return "PLCTAG_ERR_MUTEX_LOCK";
+    case PLCTAG_ERR_MUTEX_UNLOCK:
+        return "PLCTAG_ERR_MUTEX_UNLOCK";
+    case PLCTAG_ERR_NOT_ALLOWED:
+        return "PLCTAG_ERR_NOT_ALLOWED";
+    case PLCTAG_ERR_NOT_FOUND:
+        return "PLCTAG_ERR_NOT_FOUND";
+    case PLCTAG_ERR_NOT_IMPLEMENTED:
+        return "PLCTAG_ERR_NOT_IMPLEMENTED";
+    case PLCTAG_ERR_NO_DATA:
+        return "PLCTAG_ERR_NO_DATA";
+    case PLCTAG_ERR_NO_MATCH:
+        return "PLCTAG_ERR_NO_MATCH";
+    case PLCTAG_ERR_NO_MEM:
+        return "PLCTAG_ERR_NO_MEM";
+    case PLCTAG_ERR_NO_RESOURCES:
+        return "PLCTAG_ERR_NO_RESOURCES";
+    case PLCTAG_ERR_NULL_PTR:
+        return "PLCTAG_ERR_NULL_PTR";
+    case PLCTAG_ERR_OPEN:
+        return "PLCTAG_ERR_OPEN";
+    case PLCTAG_ERR_OUT_OF_BOUNDS:
+        return "PLCTAG_ERR_OUT_OF_BOUNDS";
+    case PLCTAG_ERR_READ:
+        return "PLCTAG_ERR_READ";
+    case PLCTAG_ERR_REMOTE_ERR:
+        return "PLCTAG_ERR_REMOTE_ERR";
+    case PLCTAG_ERR_THREAD_CREATE:
+        return "PLCTAG_ERR_THREAD_CREATE";
+    case PLCTAG_ERR_THREAD_JOIN:
+        return "PLCTAG_ERR_THREAD_JOIN";
+    case PLCTAG_ERR_TIMEOUT:
+        return "PLCTAG_ERR_TIMEOUT";
+    case PLCTAG_ERR_TOO_LARGE:
+        return "PLCTAG_ERR_TOO_LARGE";
+    case PLCTAG_ERR_TOO_SMALL:
+        return "PLCTAG_ERR_TOO_SMALL";
+    case PLCTAG_ERR_UNSUPPORTED:
+        return "PLCTAG_ERR_UNSUPPORTED";
+    case PLCTAG_ERR_WINSOCK:
+        return "PLCTAG_ERR_WINSOCK";
+    case PLCTAG_ERR_WRITE:
+        return "PLCTAG_ERR_WRITE";
+    case PLCTAG_ERR_PARTIAL:
+        return "PLCTAG_ERR_PARTIAL";
+    case PLCTAG_ERR_BUSY:
+        return "PLCTAG_ERR_BUSY";
+    case PLCTAG_ERR_UNAVAILABLE:
+        return "PLCTAG_ERR_UNAVAILABLE";
+
+    default:
+        return "Unknown error.";
+        break;
+    }
+
+    return "Unknown error.";
+}
+
+
+
+
+
+/*
+ * Set the debug level.
+ *
+ * This function takes values from the defined debug levels.  It sets
+ * the debug level to the passed value.  Higher numbers output increasing amounts
+ * of information.   Input values not defined will be ignored.
+ */
+
+LIB_EXPORT void plc_tag_set_debug_level(int debug_level)
+{
+	if (debug_level >= PLCTAG_DEBUG_NONE && debug_level <= PLCTAG_DEBUG_SPEW) {
+		set_debug_level(debug_level);
+	}
+}
+
+
+
+
+/*
+ * Check that the library supports the required API version.
+ *
+ * PLCTAG_STATUS_OK is returned if the version matches.  If it does not,
+ * PLCTAG_ERR_UNSUPPORTED is returned.
+ */
+
+LIB_EXPORT int plc_tag_check_lib_version(int req_major, int req_minor, int req_patch)
+{
+    /* encode these with 16-bits per version part. */
+    uint64_t lib_encoded_version = (((uint64_t)version_major) << 32u)
+                                 + (((uint64_t)version_minor) << 16u)
+                                   + (uint64_t)version_patch;
+
+    uint64_t req_encoded_version = (((uint64_t)req_major) << 32u)
+                                 + (((uint64_t)req_minor) << 16u)
+                                   + (uint64_t)req_patch;
+
+    if(version_major == (uint64_t)req_major && lib_encoded_version >= req_encoded_version) {
+        return PLCTAG_STATUS_OK;
+    } else {
+        return PLCTAG_ERR_UNSUPPORTED;
+    }
+}
+
+
+
+
+/*
+ * plc_tag_set_allocator
+ *
+ * Hand all library allocations to the application's allocator.  This
+ * must happen before the library allocates anything.
+ */
+
+LIB_EXPORT int plc_tag_set_allocator(void *(*alloc_func)(size_t size), void *(*realloc_func)(void *mem, size_t size), void (*free_func)(void *mem))
+{
+    return mem_set_allocator(alloc_func, realloc_func, free_func);
+}
+
+
+
+
+
+
+/*
+ * plc_tag_create()
+ *
+ * Just pass through to the plc_tag_create_sync() function.
+ *
+ * This is where the dispatch occurs to the protocol specific implementation.
+ */
+
+LIB_EXPORT int32_t plc_tag_create(const char *attrib_str, int timeout)
+{
+    plc_tag_p tag = PLC_TAG_P_NULL;
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_INFO,"Starting");
+
+    if(timeout < 0) {
+        pdebug(DEBUG_WARN, "Timeout must not be negative!");
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    if((rc = initialize_modules()) != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_ERROR,"Unable to initialize the internal library state!");
+        return rc;
+    }
+
+    rc = tag_create_unmapped(attrib_str, &tag);
+    if(rc != PLCTAG_STATUS_OK) {
+        return rc;
+    }
+
+    /*
+    * if there is a timeout, then loop until we get
+    * an error or we timeout.
+    */
+    if(timeout) {
+        rc = PLCTAG_STATUS_PENDING;
+
+        tag_create_wait(&tag, &rc, 1, timeout);
+
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Error %s while trying to create tag!", plc_tag_decode_error(rc));
+            rc_dec(tag);
+            return rc;
+        }
+    }
+
+    rc = tag_create_publish(tag);
+
+    pdebug(DEBUG_INFO,"Done.");
+
+    return rc;
+}
+
+
+
+
+/*
+ * plc_tag_attach_shared()
+ *
+ * A shortcut for creating a shared memory reader tag.
+ */
+
+LIB_EXPORT int32_t plc_tag_attach_shared(const char *region, const char *key, int timeout)
+{
+    char attrib_str[256];
+    int len = 0;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(!region || !key || str_length(region) == 0 || str_length(key) == 0) {
+        pdebug(DEBUG_WARN, "The region and key must be set!");
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    /* these would change the meaning of the attribute string. */
+    if(strchr(region, '&') || strchr(key, '&')) {
+        pdebug(DEBUG_WARN, "The region and key cannot contain '&'!");
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    len = snprintf(attrib_str, sizeof(attrib_str), "protocol=shared&shared_region=%s&name=%s", region, key);
+    if(len < 0 || len >= (int)sizeof(attrib_str)) {
+        pdebug(DEBUG_WARN, "The region and key are too long!");
+        return PLCTAG_ERR_TOO_LARGE;
+    }
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return plc_tag_create(attrib_str, timeout);
+}
+
+
+
+
+/*
+ * plc_tag_create_ex()
+ *
+ * Create a tag with its callback registered.  With no timeout the tickler
+ * raises PLCTAG_EVENT_CREATED when the tag's status is no longer pending.
+ */
+
+LIB_EXPORT int32_t plc_tag_create_ex(const char *attrib_str, void (*tag_callback_func)(int32_t tag_id, int event, int status), int timeout)
+{
+    plc_tag_p tag = PLC_TAG_P_NULL;
+    int rc = PLCTAG_STATUS_OK;
+    int32_t id = PLCTAG_ERR_CREATE;
+
+    pdebug(DEBUG_INFO,"Starting");
+
+    if(timeout < 0) {
+        pdebug(DEBUG_WARN, "Timeout must not be negative!");
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    if(!tag_callback_func) {
+        pdebug(DEBUG_WARN, "Callback function must not be null!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if((rc = initialize_modules()) != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_ERROR,"Unable to initialize the internal library state!");
+        return rc;
+    }
+
+    rc = tag_create_unmapped(attrib_str, &tag);
+    if(rc != PLCTAG_STATUS_OK) {
+        return rc;
+    }
+
+    tag->callback = tag_callback_func;
+
+    if(timeout) {
+        rc = PLCTAG_STATUS_PENDING;
+
+        tag_create_wait(&tag, &rc, 1, timeout);
+
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Error %s while trying to create tag!", plc_tag_decode_error(rc));
+            rc_dec(tag);
+            return rc;
+        }
+    } else {
+        /* the tickler finishes the creation. */
+        tag->create_pending = 1;
+    }
+
+    id = tag_create_publish(tag);
+
+    if(id > 0 && timeout) {
+        tag = lookup_tag(id);
+
+        if(tag) {
+            tag_dispatch_event(tag, NULL, PLCTAG_EVENT_CREATED, PLCTAG_STATUS_OK);
+            rc_dec(tag);
+        }
+    }
+
+    pdebug(DEBUG_INFO,"Done.");
+
+    return id;
+}
+
+
+
+
+/*
+ * plc_tag_create_many()
+ *
+ * Create a batch of tags.  The attribute strings are parsed and the tags
+ * constructed on several threads.  Tags on the same gateway and path share
+ * a session as usual and each new session connects in its own handler
+ * thread, so connection set up to different PLCs overlaps.  All tags are
+ * then waited on with one deadline.
+ */
+
+LIB_EXPORT int plc_tag_create_many(const char **attrib_strs, int count, int32_t *ids_out, int timeout)
+{
+    int rc = PLCTAG_STATUS_OK;
+    plc_tag_p *tag_list = NULL;
+    int *statuses = NULL;
+    tag_create_batch_t batches[TAG_CREATE_MAX_THREADS];
+    thread_p threads[TAG_CREATE_MAX_THREADS] = { NULL };
+    int num_threads = 0;
+    int batch_size = 0;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(!attrib_strs || !ids_out) {
+        pdebug(DEBUG_WARN, "Null attribute string or tag ID array!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(count <= 0) {
+        pdebug(DEBUG_WARN, "Number of tags must be greater than zero!");
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    if(timeout < 0) {
+        pdebug(DEBUG_WARN, "Timeout must not be negative!");
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    if((rc = initialize_modules()) != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_ERROR,"Unable to initialize the internal library state!");
+        return rc;
+    }
+
+    tag_list = (plc_tag_p *)mem_alloc((int)(sizeof(plc_tag_p) * (size_t)count));
+    statuses = (int *)mem_alloc((int)(sizeof(int) * (size_t)count));
+    if(!tag_list || !statuses) {
+        pdebug(DEBUG_ERROR, "Unable to allocate tag creation state!");
+
+        if(tag_list) {
+            mem_free(tag_list);
+        }
+
+        if(statuses) {
+            mem_free(statuses);
+        }
+
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    /* split the attribute strings into batches, one per thread. */
+    num_threads = (count + TAG_CREATE_MIN_BATCH - 1) / TAG_CREATE_MIN_BATCH;
+    if(num_threads > TAG_CREATE_MAX_THREADS) {
+        num_threads = TAG_CREATE_MAX_THREADS;
+    }
+
+    batch_size = (count + num_threads - 1) / num_threads;
+
+    for(int i=0; i < num_threads; i++) {
+        batches[i].attrib_strs = attrib_strs;
+        batches[i].tags = tag_list;
+        batches[i].statuses = statuses;
+        batches[i].start = i * batch_size;
+        batches[i].end = ((i + 1) * batch_size < count ? (i + 1) * batch_size : count);
+    }
+
+    /* the calling thread takes the first batch. */
+    for(int i=1; i < num_threads; i++) {
+        if(thread_create(&threads[i], tag_create_batch_func, 32*1024, &batches[i]) != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Unable to create tag creation thread, creating batch inline.");
+            threads[i] = NULL;
+        }
+    }
+
+    tag_create_batch(&batches[0]);
+
+    for(int i=1; i < num_threads; i++) {
+        if(threads[i]) {
+            thread_join(threads[i]);
+            thread_destroy(&threads[i]);
+        } else {
+            tag_create_batch(&batches[i]);
+        }
+    }
+
+    if(timeout) {
+        tag_create_wait(tag_list, statuses, count, timeout);
+    }
+
+    rc = PLCTAG_STATUS_OK;
+
+    for(int i=0; i < count; i++) {
+        if(statuses[i] == PLCTAG_STATUS_OK || statuses[i] == PLCTAG_STATUS_PENDING) {
+            ids_out[i] = tag_create_publish(tag_list[i]);
+        } else {
+            pdebug(DEBUG_WARN, "Error %s while trying to create tag %d!", plc_tag_decode_error(statuses[i]), i);
+
+            if(tag_list[i]) {
+                rc_dec(tag_list[i]);
+            }
+
+            ids_out[i] = statuses[i];
+        }
+
+        if(ids_out[i] < 0 && rc == PLCTAG_STATUS_OK) {
+            rc = ids_out[i];
+        }
+    }
+
+    mem_free(statuses);
+    mem_free(tag_list);
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return rc;
+}
+
+
+
+
+/*
+ * tag_create_unmapped
+ *
+ * Parse the attribute string and construct the tag.  The tag is not yet
+ * in the handle table.
+ */
+
+int tag_create_unmapped(const char *attrib_str, plc_tag_p *tag_out)
+{
+    plc_tag_p tag = PLC_TAG_P_NULL;
+    attr attribs = NULL;
+    int rc = PLCTAG_STATUS_OK;
+    int read_cache_ms = 0;
+    tag_create_function tag_constructor;
+	int debug_level = -1;
+    const char *read_group_name = NULL;
+    const char *scan_class_name = NULL;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    *tag_out = PLC_TAG_P_NULL;
+
+    if(!attrib_str || str_length(attrib_str) == 0) {
+        pdebug(DEBUG_WARN,"Tag attribute string is null or zero length!");
+        return PLCTAG_ERR_TOO_SMALL;
+    }
+    attribs = attr_create_from_str(attrib_str);
+    if(!attribs) {
+        pdebug(DEBUG_WARN,"Unable to parse attribute string!");
+        return PLCTAG_ERR_BAD_DATA;
+    }
+
+    /* set debug level */
+	debug_level = attr_get_int(attribs, "debug", -1);
+	if (debug_level > DEBUG_NONE) {
+		set_debug_level(debug_level);
+	}
+
+    /*
+     * create the tag, this is protocol specific.
+     *
+     * If this routine wants to keep the attributes around, it needs
+     * to clone them.
+     */
+    tag_constructor = find_tag_create_func(attribs);
+
+    if(!tag_constructor) {
+        pdebug(DEBUG_WARN,"Tag creation failed, no tag constructor found for tag type!");
+        attr_destroy(attribs);
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    tag = tag_constructor(attribs);
+
+    if(!tag) {
+        pdebug(DEBUG_WARN, "Tag creation failed, skipping mutex creation and other generic setup.");
+        attr_destroy(attribs);
+        return PLCTAG_ERR_CREATE;
+    }
+
+    /*
+     * FIXME - this really should be here???  Maybe not?  But, this is
+     * the only place it can be without making every protocol type do this automatically.
+     */
+    rc = tag_create_locks(tag);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN,"Unable to create tag mutexes!");
+        rc_dec(tag);
+        return PLCTAG_ERR_CREATE;
+    }
+
+    rc = cond_create(&(tag->tag_cond_wait));
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN,"Unable to create tag condition var!");
+        rc_dec(tag);
+        return PLCTAG_ERR_CREATE;
+    }
+
+    /* set up the read cache config. */
+    read_cache_ms = attr_get_int(attribs,"read_cache_ms",0);
+    if(read_cache_ms < 0) {
+        pdebug(DEBUG_WARN, "read_cache_ms value must be positive, using zero.");
+        read_cache_ms = 0;
+    }
+
+    tag->read_cache_expire = (int64_t)0;
+    tag->read_cache_ms = (int64_t)read_cache_ms;
+
+    /* sequential plc_tag_read_range() calls fetch this many more ranges at once. */
+    tag->read_ahead = attr_get_int(attribs, "read_ahead", 0);
+    if(tag->read_ahead < 0) {
+        pdebug(DEBUG_WARN, "read_ahead must not be negative, turning it off.");
+        tag->read_ahead = 0;
+    }
+
+    /* set up any automatic read/write */
+    tag->auto_sync_read_ms = attr_get_int(attribs, "auto_sync_read_ms", 0);
+    if(tag->auto_sync_read_ms < 0) {
+        pdebug(DEBUG_WARN, "auto_sync_read_ms value must be positive!");
+        rc_dec(tag);
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    /* this also finds which PLC the tag is on for its scan class. */
+    tag_sched_assign_shard(tag, attribs);
+
+    /* automatic reads are scheduled by scan class. */
+    scan_class_name = attr_get_str(attribs, "scan_class", NULL);
+    rc = tag_scan_class_join(tag, scan_class_name, attr_get_int(attribs, "scan_priority", 0));
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to set up the scan class of the tag!");
+        rc_dec(tag);
+        return rc;
+    }
+
+    tag->auto_sync_write_ms = attr_get_int(attribs, "auto_sync_write_ms", 0);
+    if(tag->auto_sync_write_ms < 0) {
+        pdebug(DEBUG_WARN, "auto_sync_write_ms value must be positive!");
+        rc_dec(tag);
+        return PLCTAG_ERR_BAD_PARAM;
+    } else {
+        tag->auto_sync_next_write = 0;
+    }
+
+    /* queue writes that come in while one is in flight instead of failing them. */
+    tag->coalesce_writes = (attr_get_int(attribs, "coalesce_writes", 0) ? 1 : 0);
+
+    /* is this tag part of a read group? */
+    read_group_name = attr_get_str(attribs, "read_group", NULL);
+    if(read_group_name && str_length(read_group_name) > 0) {
+        tag->read_group = tag_group_get(read_group_name, 1);
+        if(!tag->read_group) {
+            pdebug(DEBUG_WARN, "Unable to set up read group %s!", read_group_name);
+            rc_dec(tag);
+            return PLCTAG_ERR_NO_MEM;
+        }
+    }
+
+    /* set up the tag byte order if there are any overrides. */
+    rc = set_tag_byte_order(tag, attribs);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to correctly set tag data byte order: %s!", plc_tag_decode_error(rc));
+        rc_dec(tag);
+        return rc;
+    }
+
+    tag_set_native_byte_order(tag);
+
+    /* set up value change detection if requested. */
+    rc = tag_change_setup(tag, attribs);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to set up value change detection: %s!", plc_tag_decode_error(rc));
+        rc_dec(tag);
+        return rc;
+    }
+
+    /* set up write dirty range tracking if requested. */
+    rc = tag_dirty_setup(tag, attribs);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to set up write dirty range tracking: %s!", plc_tag_decode_error(rc));
+        rc_dec(tag);
+        return rc;
+    }
+
+    /* keep the last reads if requested. */
+    rc = tag_history_setup(tag, attribs);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to set up the read history: %s!", plc_tag_decode_error(rc));
+        rc_dec(tag);
+        return rc;
+    }
+
+    /* publish the tag data to other processes if requested. */
+    rc = shared_publish_setup(tag, attribs);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to publish the tag to shared memory: %s!", plc_tag_decode_error(rc));
+
+        /* the protocol may have started the first read already. */
+        critical_block(tag->api_mutex) {
+            tag->vtable->abort(tag);
+        }
+
+        attr_destroy(attribs);
+        rc_dec(tag);
+        return rc;
+    }
+
+    /*
+     * Release memory for attributes
+     */
+    attr_destroy(attribs);
+
+    *tag_out = tag;
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+
+/*
+ * tag_create_batch
+ *
+ * Construct one slice of the tags for plc_tag_create_many().
+ */
+
+void tag_create_batch(tag_create_batch_t *batch)
+{
+    for(int i=batch->start; i < batch->end; i++) {
+        int rc = tag_create_unmapped(batch->attrib_strs[i], &(batch->tags[i]));
+
+        batch->statuses[i] = (rc == PLCTAG_STATUS_OK ? PLCTAG_STATUS_PENDING : rc);
+    }
+}
+
+
+THREAD_FUNC(tag_create_batch_func)
+{
+    tag_create_batch((tag_create_batch_t *)arg);
+
+    THREAD_RETURN(0);
+}
+
+
+
+
+/*
+ * tag_create_wait
+ *
+ * Wait until each pending tag is done with its creation process or the
+ * timeout passes.  Tags that time out are aborted.
+ */
+
+void tag_create_wait(plc_tag_p *tags, int *statuses, int count, int timeout)
+{
+    int64_t start_time = time_ms();
+    int64_t timeout_time = timeout + start_time;
+    int num_pending = 0;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    do {
+        num_pending = 0;
+
+        for(int i=0; i < count; i++) {
+            plc_tag_p tag = tags[i];
+
+            if(!tag || statuses[i] != PLCTAG_STATUS_PENDING) {
+                continue;
+            }
+
+            /* give some time to the tickler function. */
+            if(tag->vtable->tickler) {
+                tag->vtable->tickler(tag);
+            }
+
+            statuses[i] = tag->vtable->status(tag);
+
+            if(statuses[i] == PLCTAG_STATUS_PENDING) {
+                num_pending++;
+            } else if(statuses[i] == PLCTAG_STATUS_OK) {
+                /* clear up any remaining flags.  This should be refactored. */
+                tag->read_in_flight = 0;
+                tag->write_in_flight = 0;
+            }
+        }
+
+        if(num_pending > 0) {
+            sleep_ms(1); /* MAGIC */
+        }
+    } while(num_pending > 0 && timeout_time > time_ms());
+
+    /*
+     * anything still pending timed out.
+     *
+     * Abort the operation and set the status to show the timeout.
+     */
+    for(int i=0; i < count && num_pending > 0; i++) {
+        if(tags[i] && statuses[i] == PLCTAG_STATUS_PENDING) {
+            pdebug(DEBUG_WARN,"Timeout waiting for tag to be ready!");
+            tags[i]->vtable->abort(tags[i]);
+            statuses[i] = PLCTAG_ERR_TIMEOUT;
+        }
+    }
+
+    pdebug(DEBUG_INFO,"tag set up elapsed time %" PRId64 "ms",(time_ms()-start_time));
+}
+
+
+
+
+/*
+ * tag_create_publish
+ *
+ * Map a constructed tag to a tag ID and start its schedule.  On failure
+ * the tag is released.
+ */
+
+int tag_create_publish(plc_tag_p tag)
+{
+    int rc = PLCTAG_STATUS_OK;
+    int id = PLCTAG_ERR_OUT_OF_BOUNDS;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    /* map the tag to a tag ID */
+    id = add_tag_lookup(tag);
+
+    /* if the mapping failed, then punt */
+    if(id < 0) {
+        pdebug(DEBUG_ERROR, "Unable to map tag %p to lookup table entry, rc=%s", tag, plc_tag_decode_error(id));
+        rc_dec(tag);
+        return id;
+    }
+
+    /* save this for later. */
+    tag->tag_id = id;
+
+    debug_set_tag_id(id);
+
+    if(tag->read_group) {
+        rc = tag_group_add_member(tag->read_group, id);
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Unable to add tag to its read group!");
+            plc_tag_destroy(id);
+            return rc;
+        }
+    }
+
+    /* let the tickler look at the tag once to set up its schedule. */
+    plc_tag_tickler_wake(tag);
+
+    pdebug(DEBUG_INFO, "Returning mapped tag ID %d", id);
+
+    pdebug(DEBUG_INFO,"Done.");
+
+    return id;
+}
+
+
+
+
+/*
+ * plc_tag_shutdown
+ *
+ * Some systems may not be able to call atexit() handlers.  In those cases, wrappers should
+ * call this function before unloading the library or terminating.   Most OSes will cleanly
+ * recover all system resources when a process is terminated and this will not be necessary.
+ */
+
+LIB_EXPORT void plc_tag_shutdown(void)
+{
+    destroy_modules();
+}
+
+
+/*
+ * plc_tag_register_callback
+ *
+ * This function registers the passed callback function with the tag.  Only one callback function
+ * may be registered on a tag at a time!
+ *
+ * Once registered, any of the following operations on or in the tag will result in the callback
+ * being called:
+ *
+ *      * starting a tag read operation.
+ *      * a tag read operation ending.
+ *      * a tag read being aborted.
+ *      * starting a tag write operation.
+ *      * a tag write operation ending.
+ *      * a tag write being aborted.
+ *      * a tag being destroyed
+ *
+ * The callback is called outside of the internal tag mutex so it can call any tag functions safely.   However,
+ * the callback is called in the context of the internal tag helper thread and not the client library thread(s).
+ * This means that YOU are responsible for making sure that all client application data structures the callback
+ * function touches are safe to access by the callback!
+ *
+ * Do not do any operations in the callback that block for any significant time.   This will cause library
+ * performance to be poor or even to start failing!
+ *
+ * When the callback is called with the PLCTAG_EVENT_DESTROY_STARTED, do not call any tag functions.  It is
+ * not guaranteed that they will work and they will possibly hang or fail.
+ *
+ * Return values:
+ *void (*tag_callback_func)(int32_t tag_id, uint32_t event, int status)
+ * If there is already a callback registered, the function will return PLCTAG_ERR_DUPLICATE.   Only one callback
+ * function may be registered at a time on each tag.
+ *
+ * If all is successful, the function will return PLCTAG_STATUS_OK.
+ */
+
+LIB_EXPORT int plc_tag_register_callback(int32_t tag_id, void (*tag_callback_func)(int32_t tag_id, int event, int status))
+{
+    int rc = PLCTAG_STATUS_OK;
+    plc_tag_p tag = lookup_tag(tag_id);
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(!tag) {
+        pdebug(DEBUG_WARN,"Tag not found.");
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    critical_block(tag->api_mutex) {
+        if(tag->callback) {
+            rc = PLCTAG_ERR_DUPLICATE;
+        } else {
+            rc = PLCTAG_STATUS_OK;
+            tag->callback = tag_callback_func;
+        }
+    }
+
+    rc_dec(tag);
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return rc;
+}
+
+
+
+
+/*
+ * plc_tag_unregister_callback
+ *
+ * This function removes the callback already registered on the tag.
+ *
+ * Return values:
+ *
+ * The function returns PLCTAG_STATUS_OK if there was a registered callback and removing it went well.
+ * An error of PLCTAG_ERR_NOT_FOUND is returned if there was no registered callback.
+ */
+
+LIB_EXPORT int plc_tag_unregister_callback(int32_t tag_id)
+{
+    int rc = PLCTAG_STATUS_OK;
+    plc_tag_p tag = lookup_tag(tag_id);
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(!tag) {
+        pdebug(DEBUG_WARN,"Tag not found.");
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    critical_block(tag->api_mutex) {
+        if(tag->callback) {
+            rc = PLCTAG_STATUS_OK;
+            tag->callback = NULL;
+        } else {
+            rc = PLCTAG_ERR_NOT_FOUND;
+        }
+    }
+
+    rc_dec(tag);
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return rc;
+}
+
+
+
+/*
+ * plc_tag_get_changed_ranges
+ *
+ * Get the byte ranges that changed in the last sample that raised a
+ * PLCTAG_EVENT_VALUE_CHANGED event.  Returns the number of ranges copied.
+ */
+
+LIB_EXPORT int plc_tag_get_changed_ranges(int32_t id, int *offsets, int *lengths, int max_ranges)
+{
+    int rc = 0;
+    plc_tag_p tag = NULL;
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    if(!offsets || !lengths) {
+        pdebug(DEBUG_WARN, "Null range buffers!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(max_ranges <= 0) {
+        pdebug(DEBUG_WARN, "Range count must be greater than zero!");
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    tag = lookup_tag(id);
+    if(!tag) {
+        pdebug(DEBUG_WARN,"Tag not found.");
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    critical_block(tag->api_mutex) {
+        if(!tag->change_detect) {
+            pdebug(DEBUG_WARN, "Tag does not have value change detection enabled!");
+            rc = PLCTAG_ERR_UNSUPPORTED;
+            break;
+        }
+
+        for(rc = 0; rc < tag->change_detect->num_ranges && rc < max_ranges; rc++) {
+            offsets[rc] = tag->change_detect->ranges[rc].offset;
+            lengths[rc] = tag->change_detect->ranges[rc].length;
+        }
+    }
+
+    rc_dec(tag);
+
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return rc;
+}
+
+
+
+/*
+ * plc_tag_get_member_offset
+ *
+ * Find the byte offset of a structure member in the tag data.  The
+ * protocol has to know the layout, Logix tags get it from the UDT
+ * templates.
+ */
+
+LIB_EXPORT int plc_tag_get_member_offset(int32_t id, const char *member_path)
+{
+    int rc = PLCTAG_STATUS_OK;
+    plc_tag_p tag = NULL;
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    if(!member_path || !*member_path) {
+        pdebug(DEBUG_WARN, "Member path is null or empty!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    tag = lookup_tag(id);
+    if(!tag) {
+        pdebug(DEBUG_WARN,"Tag not found.");
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    critical_block(tag->api_mutex) {
+        if(!tag->vtable || !tag->vtable->get_member_offset) {
+            pdebug(DEBUG_WARN, "Tag type does not support member lookup!");
+            rc = PLCTAG_ERR_UNSUPPORTED;
+            break;
+        }
+
+        rc = tag->vtable->get_member_offset(tag, member_path);
+    }
+
+    rc_dec(tag);
+
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return rc;
+}
+
+
+
+
+/*
+ * plc_tag_register_logger
+ *
+ * This function registers the passed callback function with the library.  Only one callback function
+ * may be registered with the library at a time!
+ *
+ * Once registered, the function will be called with any logging message that is normally printed due
+ * to the current log level setting.
+ *
+ * WARNING: the callback will usually be called when the internal tag API mutex is held.   You cannot
+ * call any tag functions within the callback!
+ *
+ * Return values:
+ *
+ * If there is already a callback registered, the function will return PLCTAG_ERR_DUPLICATE.   Only one callback
+ * function may be registered at a time on each tag.
+ *
+ * If all is successful, the function will return PLCTAG_STATUS_OK.
+ */
+
+LIB_EXPORT int plc_tag_register_logger(void (*log_callback_func)(int32_t tag_id, int debug_level, const char *message))
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    rc = debug_register_logger(log_callback_func);
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return rc;
+}
+
+
+
+/*
+ * plc_tag_unregister_logger
+ *
+ * This function removes the logger callback already registered for the library.
+ *
+ * Return values:
+ *
+ * The function returns PLCTAG_STATUS_OK if there was a registered callback and removing it went well.
+ * An error of PLCTAG_ERR_NOT_FOUND is returned if there was no registered callback.
+ */
+
+LIB_EXPORT int plc_tag_unregister_logger(void)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_DETAIL, "Starting");
+
+    rc = debug_unregister_logger();
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return rc;
+}
+
+
+
+/*
+ * plc_tag_lock
+ *
+ * Lock the tag against use by other threads.  Because operations on a tag are
+ * very much asynchronous, actions like getting and extracting the data from
+ * a tag take more than one API call.  If more than one thread is using the same tag,
+ * then the internal state of the tag will get broken and you will probably experience
+ * a crash.
+ *
+ * This should be used to initially lock a tag when starting operations with it
+ * followed by a call to plc_tag_unlock when you have everything you need from the tag.
+ */
+
+LIB_EXPORT int plc_tag_lock(int32_t id)
+{
+    int rc = PLCTAG_STATUS_OK;
+    plc_tag_p tag = lookup_tag(id);
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(!tag) {
+        pdebug(DEBUG_WARN,"Tag not found.");
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    critical_block(tag->api_mutex) {
+        rc = mutex_lock(tag->ext_mutex);
+    }
+
+    rc_dec(tag);
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return rc;
+}
+
+
+
+
+/*
+ * plc_tag_unlock
+ *
+ * The opposite action of plc_tag_unlock.  This allows other threads to access the
+ * tag.
+ */
+
+LIB_EXPORT int plc_tag_unlock(int32_t id)
+{
+    int rc = PLCTAG_STATUS_OK;
+    plc_tag_p tag = lookup_tag(id);
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(!tag) {
+        pdebug(DEBUG_WARN,"Tag not found.");
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    critical_block(tag->api_mutex) {
+        rc = mutex_unlock(tag->ext_mutex);
+    }
+
+    rc_dec(tag);
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return rc;
+}
+
+
+
+
+/*
+ * plc_tag_abort()
+ *
+ * This function calls through the vtable in the passed tag to call
+ * the protocol-specific implementation.
+ *
+ * The implementation must do whatever is necessary to abort any
+ * ongoing IO.
+ *
+ * The status of the operation is returned.
+ */
+
+LIB_EXPORT int plc_tag_abort(int32_t id)
+{
+    int rc = PLCTAG_STATUS_OK;
+    plc_tag_p tag = lookup_tag(id);
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(!tag) {
+        pdebug(DEBUG_WARN,"Tag not found.");
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    critical_block(tag->api_mutex) {
+        /* who knows what state the tag data is in.  */
+        tag->read_cache_expire = (uint64_t)0;
+
+        if(!tag->vtable || !tag->vtable->abort) {
+            pdebug(DEBUG_WARN,"Tag does not have a abort function!");
+            rc = PLCTAG_ERR_NOT_IMPLEMENTED;
+            break;
+        }
+
+        /* this may be synchronous. */
+        rc = tag->vtable->abort(tag);
+
+        /* aliases waiting on the operation are done with it too. */
+        if(tag->read_in_flight || tag->write_in_flight) {
+            alias_parent_done_unsafe(tag, tag->read_in_flight, PLCTAG_ERR_ABORT);
+        }
+
+        tag->read_in_flight = 0;
+        tag->read_complete = 0;
+        tag->write_in_flight = 0;
+        tag->write_complete = 0;
+        tag->write_queued = 0;
+    }
+
+    if(tag->callback) {
+        pdebug(DEBUG_DETAIL, "Calling callback with PLCTAG_EVENT_ABORTED.");
+        tag->callback(id, PLCTAG_EVENT_ABORTED, PLCTAG_STATUS_OK);
+    }
+
+    rc_dec(tag);
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return rc;
+}
+
+
+
+
+/*
+ * plc_tag_destroy()
+ *
+ * Remove all implementation specific details about a tag and clear its
+ * memory.
+ */
+
+
+LIB_EXPORT int plc_tag_destroy(int32_t tag_id)
+{
+    plc_tag_p tag = NULL;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(tag_id <= 0 || tag_id >= TAG_ID_MASK) {
+        pdebug(DEBUG_WARN, "Called with zero or invalid tag!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    tag = remove_tag_lookup(tag_id);
+
+    if(!tag) {
+        pdebug(DEBUG_WARN, "Called with non-existent tag!");
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    if(tag->read_group) {
+        tag_group_remove_member(tag->read_group, tag_id);
+    }
+
+    /* abort anything in flight */
+    pdebug(DEBUG_DETAIL, "Aborting any in-flight operations.");
+
+    critical_block(tag->api_mutex) {
+        if(!tag->vtable || !tag->vtable->abort) {
+            pdebug(DEBUG_WARN,"Tag does not have a abort function!");
+        }
+
+        /* Force a clean up. */
+        tag->vtable->abort(tag);
+    }
+
+    if(tag->callback) {
+        pdebug(DEBUG_DETAIL, "Calling callback with PLCTAG_EVENT_DESTROYED.");
+        tag->callback(tag_id, PLCTAG_EVENT_DESTROYED, PLCTAG_STATUS_OK);
+    }
+
+    /* release the reference outside the mutex. */
+    rc_dec(tag);
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    debug_set_tag_id(0);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+
+
+/*
+ * plc_tag_read()
+ *
+ * This function calls through the vtable in the passed tag to call
+ * the protocol-specific implementation.  That starts the read operation.
+ * If there is a timeout passed, then this routine waits for either
+ * a timeout or an error.
+ *
+ * The status of the operation is returned.
+ */
+
+LIB_EXPORT int plc_tag_read(int32_t id, int timeout)
+{
+    return tag_read_common(id, 0, 0, timeout);
+}
+
+
+
+/*
+ * plc_tag_read_range()
+ *
+ * Read only elem_count elements starting at elem_offset.  The rest of
+ * the tag data is left as it was.
+ */
+
+LIB_EXPORT int plc_tag_read_range(int32_t id, int elem_offset, int elem_count, int timeout)
+{
+    if(elem_offset < 0 || elem_count <= 0) {
+        pdebug(DEBUG_WARN, "Element offset must not be negative and the count must be positive!");
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    return tag_read_common(id, elem_offset, elem_count, timeout);
+}
+
+
+
+/* a zero elem_count reads the whole tag. */
+int tag_read_common(int32_t id, int elem_offset, int elem_count, int timeout)
+{
+    int rc = PLCTAG_STATUS_OK;
+    plc_tag_p tag = lookup_tag(id);
+    int is_done = 0;
+    int changed = 0;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(timeout < 0) {
+        pdebug(DEBUG_WARN, "Timeout must not be negative!");
+        rc_dec(tag);
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    if(!tag) {
+        pdebug(DEBUG_WARN,"Tag not found.");
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    if(tag->callback) {
+        pdebug(DEBUG_DETAIL, "Calling callback with PLCTAG_EVENT_READ_STARTED.");
+        tag->callback(id, PLCTAG_EVENT_READ_STARTED, PLCTAG_STATUS_OK);
+    }
+
+    critical_block(tag->api_mutex) {
+        if(elem_count > 0 && tag->read_ahead > 0) {
+            if(tag_read_ahead_unsafe(tag, elem_offset, &elem_count)) {
+                pdebug(DEBUG_DETAIL, "Range already read ahead.");
+                rc = PLCTAG_STATUS_OK;
+                is_done = 1;
+                break;
+            }
+        } else if(elem_count == 0) {
+            tag->read_ahead_end = 0;
+        }
+
+        if(elem_count > 0) {
+            rc = tag_set_range_unsafe(tag, elem_offset, elem_count);
+            if(rc != PLCTAG_STATUS_OK) {
+                tag->read_ahead_end = 0;
+                is_done = 1;
+                break;
+            }
+        }
+
+        rc = tag_read_start_unsafe(tag, (timeout > 0 ? time_ms() + timeout : 0), &is_done);
+
+        /* the tickler or the wait below finishes the group read. */
+        if(tag->read_group && tag->read_in_flight) {
+            tag_group_read_started(tag);
+        }
+
+        if(is_done) {
+            /* the range only applies to this read, cached data does not use it. */
+            if(elem_count > 0) {
+                tag->vtable->set_range(tag, 0, 0);
+            }
+
+            break;
+        }
+
+        /*
+         * if there is a timeout, then loop until we get
+         * an error or we timeout.
+         */
+        if(timeout) {
+            int64_t timeout_time = timeout + time_ms();
+            int64_t start_time = time_ms();
+            int64_t wait_ms = 0;
+
+            while(rc == PLCTAG_STATUS_PENDING && timeout_time > time_ms()) {
+                /* give some time to the tickler function. */
+                if(tag->vtable->tickler) {
+                    tag->vtable->tickler(tag);
+                }
+
+                rc = tag->vtable->status(tag);
+
+                /*
+                 * terminate early and do not wait again if the
+                 * IO is done.
+                 */
+                if(rc != PLCTAG_STATUS_PENDING) {
+                    break;
+                }
+
+                /* wait for the protocol layer to signal completion. */
+                wait_ms = timeout_time - time_ms();
+                if(wait_ms > TAG_WAIT_POLL_MS) {
+                    wait_ms = TAG_WAIT_POLL_MS;
+                }
+
+                if(wait_ms > 0) {
+                    cond_wait(tag->tag_cond_wait, (int)wait_ms);
+                }
+            }
+
+            /*
+             * if we dropped out of the while loop but the status is
+             * still pending, then we timed out.
+             *
+             * Abort the operation and set the status to show the timeout.
+             */
+            if(rc != PLCTAG_STATUS_OK) {
+                /* abort the request. */
+                if(tag->vtable->abort) {
+                    tag->vtable->abort(tag);
+                }
+
+                /* translate error if we are still pending. */
+                if(rc == PLCTAG_STATUS_PENDING) {
+                    pdebug(DEBUG_WARN, "Read operation timed out.");
+                    rc = PLCTAG_ERR_TIMEOUT;
+                }
+            }
+
+            /* we are done. */
+            tag->read_complete = 0;
+            tag->read_in_flight = 0;
+            is_done = 1;
+
+            tag_stats_op_done(tag, 1, rc);
+
+            if(rc == PLCTAG_STATUS_OK) {
+                changed = tag_detect_change_unsafe(tag);
+                tag_sample_done_unsafe(tag);
+            }
+
+            shared_publish_unsafe(tag, rc);
+            alias_parent_done_unsafe(tag, 1, rc);
+
+            if(tag->read_group) {
+                tag_group_read_done(tag, rc);
+            }
+
+            pdebug(DEBUG_INFO,"elapsed time %" PRId64 "ms",(time_ms()-start_time));
+        }
+    } /* end of api mutex block */
+
+    /* the tickler needs to drive the read to completion. */
+    if(!is_done) {
+        plc_tag_tickler_wake(tag);
+    }
+
+    if(rc == PLCTAG_STATUS_OK) {
+        /* set up the cache time.  This works when read_cache_ms is zero as it is already expired. */
+        tag->read_cache_expire = time_ms() + tag->read_cache_ms;
+    }
+
+    if(tag->callback) {
+        if(is_done) {
+            pdebug(DEBUG_DETAIL, "Calling callback with PLCTAG_EVENT_READ_COMPLETED.");
+            tag->callback(id, PLCTAG_EVENT_READ_COMPLETED, rc);
+
+            if(changed) {
+                pdebug(DEBUG_DETAIL, "Calling callback with PLCTAG_EVENT_VALUE_CHANGED.");
+                tag->callback(id, PLCTAG_EVENT_VALUE_CHANGED, PLCTAG_STATUS_OK);
+            }
+        }
+    }
+
+    rc_dec(tag);
+
+    pdebug(DEBUG_INFO, "Done");
+
+    return rc;
+}
+
+
+
+
+
+
+/*
+ * plc_tag_status
+ *
+ * Return the current status of the tag.  This will be PLCTAG_STATUS_PENDING if there is
+ * an uncompleted IO operation.  It will be PLCTAG_STATUS_OK if everything is fine.  Other
+ * errors will be returned as appropriate.
+ *
+ * This is a function provided by the underlying protocol implementation.
+ */
+
+
+LIB_EXPORT int plc_tag_status(int32_t id)
+{
+    int rc = PLCTAG_STATUS_OK;
+    plc_tag_p tag = lookup_tag(id);
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    /* check the ID.  It might be an error status from creating the tag. */
+    if(!tag) {
+        if(id < 0) {
+            pdebug(DEBUG_WARN, "Called with an error status %s!", plc_tag_decode_error(id));
+            return id;
+        } else {
+            pdebug(DEBUG_WARN,"Tag not found.");
+            return PLCTAG_ERR_NOT_FOUND;
+        }
+    }
+
+    critical_block(tag->api_mutex) {
+        if(tag && tag->vtable->tickler) {
+            tag->vtable->tickler(tag);
+        }
+
+        rc = tag->vtable->status(tag);
+
+        if(rc == PLCTAG_STATUS_OK) {
+            if(tag->read_in_flight || tag->write_in_flight) {
+                rc = PLCTAG_STATUS_PENDING;
+            }
+        }
+    }
+
+    rc_dec(tag);
+
+    pdebug(DEBUG_SPEW, "Done with rc=%s.", plc_tag_decode_error(rc));
+
+    return rc;
+}
+
+
+
+
+
+/*
+ * plc_tag_write()
+ *
+ * This function calls through the vtable in the passed tag to call
+ * the protocol-specific implementation.  That starts the write operation.
+ * If there is a timeout passed, then this routine waits for either
+ * a timeout or an error.
+ *
+ * The status of the operation is returned.
+ */
+
+LIB_EXPORT int plc_tag_write(int32_t id, int timeout)
+{
+    return tag_write_common(id, 0, 0, timeout);
+}
+
+
+
+/*
+ * plc_tag_write_range()
+ *
+ * Write only elem_count elements starting at elem_offset from the tag
+ * data.  The rest of the tag in the PLC is not touched.
+ */
+
+LIB_EXPORT int plc_tag_write_range(int32_t id, int elem_offset, int elem_count, int timeout)
+{
+    if(elem_offset < 0 || elem_count <= 0) {
+        pdebug(DEBUG_WARN, "Element offset must not be negative and the count must be positive!");
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    return tag_write_common(id, elem_offset, elem_count, timeout);
+}
+
+
+
+/* a zero elem_count writes the whole tag. */
+int tag_write_common(int32_t id, int elem_offset, int elem_count, int timeout)
+{
+    int rc = PLCTAG_STATUS_OK;
+    plc_tag_p tag = lookup_tag(id);
+    int is_done = 0;
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    if(timeout < 0) {
+        pdebug(DEBUG_WARN, "Timeout must not be negative!");
+        rc_dec(tag);
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    if(!tag) {
+        pdebug(DEBUG_WARN,"Tag not found.");
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    if(tag->callback) {
+        pdebug(DEBUG_DETAIL, "Calling callback with PLCTAG_EVENT_WRITE_STARTED.");
+        tag->callback(id, PLCTAG_EVENT_WRITE_STARTED, PLCTAG_STATUS_OK);
+    }
+
+    critical_block(tag->api_mutex) {
+        /* a coalescing write that does not wait goes out after the one in flight. */
+        if(tag->coalesce_writes && tag->write_in_flight && !timeout && elem_count == 0) {
+            pdebug(DEBUG_DETAIL, "Queueing write behind the write in flight.");
+            tag->write_queued = 1;
+            rc = PLCTAG_STATUS_PENDING;
+            break;
+        }
+
+        if(elem_count > 0) {
+            rc = tag_set_range_unsafe(tag, elem_offset, elem_count);
+            if(rc != PLCTAG_STATUS_OK) {
+                is_done = 1;
+                break;
+            }
+        }
+
+        rc = tag_write_start_unsafe(tag, (timeout > 0 ? time_ms() + timeout : 0), &is_done);
+        if(is_done) {
+            if(elem_count > 0) {
+                tag->vtable->set_range(tag, 0, 0);
+            }
+
+            break;
+        }
+
+        /*
+         * if there is a timeout, then loop until we get
+         * an error or we timeout.
+         */
+        if(timeout) {
+            int64_t start_time = time_ms();
+            int64_t timeout_time = timeout + start_time;
+            int64_t wait_ms = 0;
+
+            while(rc == PLCTAG_STATUS_PENDING && timeout_time > time_ms()) {
+                /* give some time to the tickler function. */
+                if(tag->vtable->tickler) {
+                    tag->vtable->tickler(tag);
+                }
+
+                rc = tag->vtable->status(tag);
+
+                /*
+                 * terminate early and do not wait again if the
+                 * IO is done.
+                 */
+                if(rc != PLCTAG_STATUS_PENDING) {
+                    break;
+                }
+
+                /* wait for the protocol layer to signal completion. */
+                wait_ms = timeout_time - time_ms();
+                if(wait_ms > TAG_WAIT_POLL_MS) {
+                    wait_ms = TAG_WAIT_POLL_MS;
+                }
+
+                if(wait_ms > 0) {
+                    cond_wait(tag->tag_cond_wait, (int)wait_ms);
+                }
+            }
+
+            /*
+             * if we dropped out of the while loop but the status is
+             * still pending, then we timed out.
+             *
+             * Abort the operation and set the status to show the timeout.
+             */
+            if(rc != PLCTAG_STATUS_OK) {
+                /* abort the request. */
+                if(tag->vtable->abort) {
+                    tag->vtable->abort(tag);
+                }
+
+                /* translate error if we are still pending. */
+                if(rc == PLCTAG_STATUS_PENDING) {
+                    pdebug(DEBUG_WARN, "Write operation timed out.");
+                    rc = PLCTAG_ERR_TIMEOUT;
+                }
+            }
+
+            /* the write is not in flight anymore. */
+            tag->write_in_flight = 0;
+            tag->write_complete = 0;
+            is_done = 1;
+
+            tag_stats_op_done(tag, 0, rc);
+            alias_parent_done_unsafe(tag, 0, rc);
+
+            pdebug(DEBUG_INFO,"elapsed time %" PRId64 "ms",(time_ms()-start_time));
+        }
+    } /* end of api mutex block */
+
+    /* the tickler needs to drive the write to completion. */
+    if(!is_done) {
+        plc_tag_tickler_wake(tag);
+    }
+
+    if(tag->callback) {
+        if(is_done) {
+            pdebug(DEBUG_DETAIL, "Calling callback with PLCTAG_EVENT_WRITE_COMPLETED.");
+            tag->callback(id, PLCTAG_EVENT_WRITE_COMPLETED, rc);
+        }
+    }
+
+    rc_dec(tag);
+
+    pdebug(DEBUG_INFO, "Done");
+
+    return rc;
+}
+
+
+
+
+
+/*
+ * plc_tag_read_many()
+ * plc_tag_write_many()
+ *
+ * Start operations on a set of tags at once.  All the requests are queued
+ * before the protocol layer gets a chance to pack them.
+ */
+
+LIB_EXPORT int plc_tag_read_many(int32_t *tags, int num_tags, int *statuses, int timeout)
+{
+    return tag_op_many(tags, num_tags, statuses, timeout, 1, NULL);
+}
+
+
+
+LIB_EXPORT int plc_tag_write_many(int32_t *tags, int num_tags, int *statuses, int timeout)
+{
+    return tag_op_many(tags, num_tags, statuses, timeout, 0, NULL);
+}
+
+
+
+/*
+ * plc_tag_write_fanout()
+ *
+ * Write the same data to many tags, usually on different PLCs.  The writes
+ * are all started before any is waited on, so the sessions work in parallel.
+ */
+
+LIB_EXPORT int plc_tag_write_fanout(int32_t *tags, int num_tags, int offset, const uint8_t *buffer, int buffer_length, int *statuses, int timeout)
+{
+    tag_write_source_t source;
+
+    if(!buffer) {
+        pdebug(DEBUG_WARN, "Null source buffer!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(offset < 0 || buffer_length <= 0) {
+        pdebug(DEBUG_WARN, "Bad offset or buffer length!");
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    source.offset = offset;
+    source.buffer = buffer;
+    source.length = buffer_length;
+
+    return tag_op_many(tags, num_tags, statuses, timeout, 0, &source);
+}
+
+
+
+
+
+/*
+ * plc_tag_read_group()
+ *
+ * Read all the tags in a read group at once.
+ */
+
+LIB_EXPORT int plc_tag_read_group(const char *group_name, int timeout)
+{
+    int rc = PLCTAG_STATUS_OK;
+    tag_group_p group = NULL;
+    int32_t *ids = NULL;
+    int *statuses = NULL;
+    int num_tags = 0;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(!group_name) {
+        pdebug(DEBUG_WARN, "Null group name!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    group = tag_group_get(group_name, 0);
+    if(!group) {
+        pdebug(DEBUG_WARN, "Read group %s not found.", group_name);
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    /* take a copy of the member list. */
+    critical_block(tag_group_mutex) {
+        num_tags = group->num_members;
+
+        if(num_tags > 0) {
+            ids = (int32_t *)mem_alloc((int)(sizeof(int32_t) * (size_t)num_tags));
+            statuses = (int *)mem_alloc((int)(sizeof(int) * (size_t)num_tags));
+
+            if(ids && statuses) {
+                for(int i=0; i < num_tags; i++) {
+                    ids[i] = group->members[i].tag_id;
+                }
+            }
+        }
+    }
+
+    if(num_tags == 0) {
+        pdebug(DEBUG_WARN, "Read group %s has no tags.", group_name);
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    if(!ids || !statuses) {
+        pdebug(DEBUG_ERROR, "Unable to allocate memory for group read!");
+        if(ids) {
+            mem_free(ids);
+        }
+
+        if(statuses) {
+            mem_free(statuses);
+        }
+
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    rc = tag_op_many(ids, num_tags, statuses, timeout, 1, NULL);
+
+    mem_free(ids);
+    mem_free(statuses);
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return rc;
+}
+
+
+
+LIB_EXPORT int plc_tag_register_group_callback(const char *group_name, void (*group_callback_func)(const char *group_name, int event, int status))
+{
+    tag_group_p group = NULL;
+    int rc = initialize_modules();
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_ERROR,"Unable to initialize the internal library state!");
+        return rc;
+    }
+
+    if(!group_name) {
+        pdebug(DEBUG_WARN, "Null group name!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    /* create the group if needed so that the callback can be set before the tags are created. */
+    group = tag_group_get(group_name, 1);
+    if(!group) {
+        pdebug(DEBUG_WARN, "Unable to find or create read group %s!", group_name);
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    critical_block(tag_group_mutex) {
+        group->callback = group_callback_func;
+    }
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+
+
+/*
+ * Tag data accessors.
+ */
+
+
+
+
+LIB_EXPORT int plc_tag_get_int_attribute(int32_t id, const char *attrib_name, int default_value)
+{
+    int res = default_value;
+    plc_tag_p tag = NULL;
+    volatile int *thread_attrib = NULL;
+    int is_priority = 0;
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    /* FIXME - this should set the tag status if there is a tag. */
+    if(!attrib_name || str_length(attrib_name) == 0) {
+        pdebug(DEBUG_WARN, "Attribute name must not be null or zero-length!");
+        return default_value;
+    }
+
+    /* get library attributes */
+    if(id == 0) {
+        if(str_cmp_i(attrib_name, "version_major") == 0) {
+            res = (int)version_major;
+        } else if(str_cmp_i(attrib_name, "version_minor") == 0) {
+            res = (int)version_minor;
+        } else if(str_cmp_i(attrib_name, "version_patch") == 0) {
+            res = (int)version_patch;
+        } else if(str_cmp_i(attrib_name, "debug") == 0) {
+            res = (int)get_debug_level();
+        } else if(str_cmp_i(attrib_name, "debug_level") == 0) {
+            pdebug(DEBUG_WARN, "Deprecated attribute \"debug_level\" used, use \"debug\" instead.");
+            res = (int)get_debug_level();
+        } else if(str_cmp_i(attrib_name, "debug_async") == 0) {
+            res = debug_async_enabled();
+        } else if(str_cmp_i(attrib_name, "tickler_threads") == 0) {
+            res = (tag_sched_num_shards > 0 ? tag_sched_num_shards : tag_sched_config_shards);
+        } else if(str_cmp_i(attrib_name, "cpu_accounting") == 0) {
+            res = tag_cpu_accounting;
+        } else if(str_cmp_i(attrib_name, "tag_arena") == 0) {
+            res = arena_enabled();
+        } else if(str_cmp_i(attrib_name, "tag_lock_pool") == 0) {
+            res = tag_lock_pool_enabled;
+        } else if(str_cmp_i(attrib_name, "callback_threads") == 0) {
+            res = 0;
+
+            if(tag_callback_mutex) {
+                critical_block(tag_callback_mutex) {
+                    if(tag_callback_pool) {
+                        res = tag_callback_pool->num_workers;
+                    }
+                }
+            }
+        } else if((thread_attrib = tag_thread_attrib(attrib_name, &is_priority))) {
+            res = *thread_attrib;
+        } else {
+            pdebug(DEBUG_WARN, "Attribute \"%s\" is not supported at the library level!");
+            res = default_value;
+        }
+    } else {
+        tag = lookup_tag(id);
+
+        if(!tag) {
+            pdebug(DEBUG_WARN,"Tag not found.");
+            return default_value;
+        }
+
+        critical_block(tag->api_mutex) {
+            /* match the generic ones first. */
+            if(str_cmp_i(attrib_name, "size") == 0) {
+                tag->status = PLCTAG_STATUS_OK;
+                res = (int)tag->size;
+            } else if(str_cmp_i(attrib_name, "read_cache_ms") == 0) {
+                /* FIXME - what happens if this overflows? */
+                tag->status = PLCTAG_STATUS_OK;
+                res = (int)tag->read_cache_ms;
+            } else if(str_cmp_i(attrib_name, "auto_sync_read_ms") == 0) {
+                tag->status = PLCTAG_STATUS_OK;
+                res = (int)tag->auto_sync_read_ms;
+            } else if(str_cmp_i(attrib_name, "read_ahead") == 0) {
+                tag->status = PLCTAG_STATUS_OK;
+                res = (int)tag->read_ahead;
+            } else if(str_cmp_i(attrib_name, "coalesce_writes") == 0) {
+                tag->status = PLCTAG_STATUS_OK;
+                res = (int)tag->coalesce_writes;
+            } else if(str_cmp_i(attrib_name, "scan_phase_ms") == 0) {
+                tag->status = PLCTAG_STATUS_OK;
+                res = (tag->scan_class ? (int)tag->scan_class->phase_ms : 0);
+            } else if(str_cmp_i(attrib_name, "scan_effective_ms") == 0) {
+                tag->status = PLCTAG_STATUS_OK;
+
+                /* the period the tag is really read at after any stretching. */
+                critical_block(tag_scan_class_mutex) {
+                    res = (tag->scan_class ? tag->scan_class->period_ms * tag->scan_class->stretch : 0);
+                }
+            } else if(str_cmp_i(attrib_name, "auto_sync_write_ms") == 0) {
+                tag->status = PLCTAG_STATUS_OK;
+                res = (int)tag->auto_sync_write_ms;
+            } else if(str_cmp_i(attrib_name, "bit_num") == 0) {
+                tag->status = PLCTAG_STATUS_OK;
+                res = (int)(unsigned int)(tag->bit);
+            } else if(str_cmp_i(attrib_name, "sample_seq") == 0) {
+                tag->status = PLCTAG_STATUS_OK;
+                res = (int)tag->sample_seq;
+            } else if(str_cmp_i(attrib_name, "history_count") == 0) {
+                tag->status = PLCTAG_STATUS_OK;
+                res = (tag->history ? tag->history->count : 0);
+            } else if(str_cmp_i(attrib_name, "history_dropped") == 0) {
+                tag->status = PLCTAG_STATUS_OK;
+                res = (tag->history ? (int)tag->history->dropped : 0);
+            } else if(tag_stats_get_attrib(tag, attrib_name, &res)) {
+                tag->status = PLCTAG_STATUS_OK;
+            } else  {
+                if(tag->vtable->get_int_attrib) {
+                    res = tag->vtable->get_int_attrib(tag, attrib_name, default_value);
+                }
+            }
+        }
+
+        rc_dec(tag);
+    }
+
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return res;
+}
+
+
+
+LIB_EXPORT int plc_tag_set_int_attribute(int32_t id, const char *attrib_name, int new_value)
+{
+    int res = PLCTAG_ERR_NOT_FOUND;
+    plc_tag_p tag = NULL;
+    volatile int *thread_attrib = NULL;
+    int is_priority = 0;
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    if(!attrib_name || str_length(attrib_name) == 0) {
+        pdebug(DEBUG_WARN, "Attribute name must not be null or zero-length!");
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    /* get library attributes */
+    if(id == 0) {
+        if(str_cmp_i(attrib_name, "debug") == 0) {
+            if(new_value >= DEBUG_ERROR && new_value < DEBUG_SPEW) {
+                set_debug_level(new_value);
+                res = PLCTAG_STATUS_OK;
+            } else {
+                res = PLCTAG_ERR_OUT_OF_BOUNDS;
+            }
+        } else if(str_cmp_i(attrib_name, "debug_level") == 0) {
+            pdebug(DEBUG_WARN, "Deprecated attribute \"debug_level\" used, use \"debug\" instead.");
+            if(new_value >= DEBUG_ERROR && new_value < DEBUG_SPEW) {
+                set_debug_level(new_value);
+                res = PLCTAG_STATUS_OK;
+            } else {
+                res = PLCTAG_ERR_OUT_OF_BOUNDS;
+            }
+        } else if(str_cmp_i(attrib_name, "debug_async") == 0) {
+            /* format and write log messages on a background thread. */
+            if(new_value == 0) {
+                debug_async_stop();
+                res = PLCTAG_STATUS_OK;
+            } else if(new_value == 1) {
+                res = debug_async_start();
+            } else {
+                res = PLCTAG_ERR_OUT_OF_BOUNDS;
+            }
+        } else if(str_cmp_i(attrib_name, "tickler_threads") == 0) {
+            /* the schedule shards are created when the library starts up. */
+            if(new_value < 1 || new_value > TAG_SCHED_MAX_SHARDS) {
+                res = PLCTAG_ERR_OUT_OF_BOUNDS;
+            } else if(tag_sched_shards) {
+                pdebug(DEBUG_WARN, "The number of tickler threads must be set before the first tag is created!");
+                res = PLCTAG_ERR_BUSY;
+            } else {
+                tag_sched_config_shards = new_value;
+                res = PLCTAG_STATUS_OK;
+            }
+        } else if(str_cmp_i(attrib_name, "tag_lock_pool") == 0) {
+            /* only tags created from now on use the pool. */
+            if(new_value == 0 || new_value == 1) {
+                tag_lock_pool_enabled = new_value;
+                res = PLCTAG_STATUS_OK;
+            } else {
+                res = PLCTAG_ERR_OUT_OF_BOUNDS;
+            }
+        } else if(str_cmp_i(attrib_name, "tag_arena") == 0) {
+            /* only objects made from now on use the arenas. */
+            if(new_value == 0 || new_value == 1) {
+                arena_set_enabled(new_value);
+                res = PLCTAG_STATUS_OK;
+            } else {
+                res = PLCTAG_ERR_OUT_OF_BOUNDS;
+            }
+        } else if(str_cmp_i(attrib_name, "cpu_accounting") == 0) {
+            /* turning it on starts the totals from zero. */
+            if(new_value == 0 || new_value == 1) {
+                res = tag_cpu_reset(new_value);
+            } else {
+                res = PLCTAG_ERR_OUT_OF_BOUNDS;
+            }
+        } else if(str_cmp_i(attrib_name, "callback_threads") == 0) {
+            /* zero means that the tickler calls callbacks itself. */
+            if(new_value >= 0 && new_value <= TAG_CALLBACK_MAX_THREADS) {
+                res = initialize_modules();
+
+                if(res == PLCTAG_STATUS_OK) {
+                    tag_callback_pool_stop();
+
+                    if(new_value > 0) {
+                        res = tag_callback_pool_start(new_value);
+                    }
+                }
+            } else {
+                res = PLCTAG_ERR_OUT_OF_BOUNDS;
+            }
+        } else if((thread_attrib = tag_thread_attrib(attrib_name, &is_priority))) {
+            /* the CPU mask is any bit pattern, priorities are 0 to 99. */
+            if(is_priority && (new_value < 0 || new_value > 99)) {
+                res = PLCTAG_ERR_OUT_OF_BOUNDS;
+            } else {
+                *thread_attrib = new_value;
+                res = PLCTAG_STATUS_OK;
+            }
+        } else {
+            pdebug(DEBUG_WARN, "Attribute \"%s\" is not support at the library level!", attrib_name);
+            return PLCTAG_ERR_UNSUPPORTED;
+        }
+    } else {
+        tag = lookup_tag(id);
+
+        if(!tag) {
+            pdebug(DEBUG_WARN,"Tag not found.");
+            return PLCTAG_ERR_NOT_FOUND;
+        }
+
+        critical_block(tag->api_mutex) {
+            /* match the generic ones first. */
+            if(str_cmp_i(attrib_name, "read_cache_ms") == 0) {
+                if(new_value >= 0) {
+                    /* expire the cache. */
+                    tag->read_cache_expire = (int64_t)0;
+                    tag->read_cache_ms = (int64_t)new_value;
+                    tag->status = PLCTAG_STATUS_OK;
+                    res = PLCTAG_STATUS_OK;
+                } else {
+                    tag->status = PLCTAG_ERR_OUT_OF_BOUNDS;
+                    res = PLCTAG_ERR_OUT_OF_BOUNDS;
+                }
+            } else if(str_cmp_i(attrib_name, "auto_sync_read_ms") == 0) {
+                if(new_value >= 0) {
+                    tag->auto_sync_read_ms = new_value;
+
+                    /* a new period moves the tag to the scan class for that period. */
+                    res = tag_scan_class_join(tag, NULL, (tag->scan_class ? tag->scan_class->priority : 0));
+                    tag->status = (int8_t)res;
+
+                    /* the schedule for the tag changed. */
+                    plc_tag_tickler_wake(tag);
+                } else {
+                    pdebug(DEBUG_WARN, "auto_sync_read_ms must be greater than or equal to zero!");
+                    tag->status = PLCTAG_ERR_OUT_OF_BOUNDS;
+                    res = PLCTAG_ERR_OUT_OF_BOUNDS;
+                }
+            } else if(str_cmp_i(attrib_name, "read_ahead") == 0) {
+                if(new_value >= 0) {
+                    tag->read_ahead = new_value;
+                    tag->read_ahead_end = 0;
+                    tag->status = PLCTAG_STATUS_OK;
+                    res = PLCTAG_STATUS_OK;
+                } else {
+                    tag->status = PLCTAG_ERR_OUT_OF_BOUNDS;
+                    res = PLCTAG_ERR_OUT_OF_BOUNDS;
+                }
+            } else if(str_cmp_i(attrib_name, "coalesce_writes") == 0) {
+                tag->coalesce_writes = (new_value ? 1 : 0);
+                tag->status = PLCTAG_STATUS_OK;
+                res = PLCTAG_STATUS_OK;
+            } else if(str_cmp_i(attrib_name, "auto_sync_write_ms") == 0) {
+                if(new_value >= 0) {
+                    tag->auto_sync_write_ms = new_value;
+                    tag->status = PLCTAG_STATUS_OK;
+                    res = PLCTAG_STATUS_OK;
+
+                    /* the schedule for the tag changed. */
+                    plc_tag_tickler_wake(tag);
+                } else {
+                    pdebug(DEBUG_WARN, "auto_sync_write_ms must be greater than or equal to zero!");
+                    tag->status = PLCTAG_ERR_OUT_OF_BOUNDS;
+                    res = PLCTAG_ERR_OUT_OF_BOUNDS;
+                }
+            } else if(str_cmp_i(attrib_name, "stats_reset") == 0) {
+                /* keep the timing of any operation in flight. */
+                if(tag->stats) {
+                    int64_t op_start_us = tag->stats->op_start_us;
+
+                    mem_set(tag->stats, 0, (int)sizeof(*(tag->stats)));
+                    tag->stats->op_start_us = op_start_us;
+                }
+
+                tag->status = PLCTAG_STATUS_OK;
+                res = PLCTAG_STATUS_OK;
+            } else {
+                if(tag->vtable->set_int_attrib) {
+                    res = tag->vtable->set_int_attrib(tag, attrib_name, new_value);
+                    tag->status = (int8_t)res;
+                }
+            }
+        }
+    }
+
+    rc_dec(tag);
+
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return res;
+}
+
+
+
+
+LIB_EXPORT int plc_tag_get_size(int32_t id)
+{
+    int result = 0;
+    plc_tag_p tag = lookup_tag(id);
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    if(!tag) {
+        pdebug(DEBUG_WARN,"Tag not found.");
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    critical_block(tag->api_mutex) {
+        result = tag->size;
+        tag->status = PLCTAG_STATUS_OK;
+    }
+
+    rc_dec(tag);
+
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return result;
+}
+
+
+
+LIB_EXPORT int plc_tag_get_bit(int32_t id, int offset_bit)
+{
+    int res = PLCTAG_ERR_OUT_OF_BOUNDS;
+    int real_offset = offset_bit;
+    plc_tag_p tag = lookup_tag(id);
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    if(!tag) {
+        pdebug(DEBUG_WARN, "Tag not found.");
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    /* is there data? */
+    if(!tag->data) {
+        rc_dec(tag);
+        pdebug(DEBUG_WARN, "Tag has no data!");
+        tag->status = PLCTAG_ERR_NO_DATA;
+        return PLCTAG_ERR_NO_DATA;
+    }
+
+    /* if this is a single bit, then make sure the offset is the tag bit. */
+    if(tag->is_bit) {
+        real_offset = tag->bit;
+    } else {
+        real_offset = offset_bit;
+    }
+
+    pdebug(DEBUG_SPEW, "selecting bit %d with offset %d in byte %d (%x).", real_offset, (real_offset % 8), (real_offset / 8), tag->data[real_offset / 8]);
+
+    critical_block(tag->api_mutex) {
+        if((real_offset >= 0) && ((real_offset / 8) < tag->size)) {
+            res = !!(((1 << (real_offset % 8)) & 0xFF) & (tag->data[real_offset / 8]));
+            tag->status = PLCTAG_STATUS_OK;
+        } else {
+            pdebug(DEBUG_WARN, "Data offset out of bounds!");
+            res = PLCTAG_ERR_OUT_OF_BOUNDS;
+            tag->status = PLCTAG_ERR_OUT_OF_BOUNDS;
+        }
+    }
+
+    rc_dec(tag);
+
+    return res;
+}
+
+
+LIB_EXPORT int plc_tag_set_bit(int32_t id, int offset_bit, int val)
+{
+    int res = PLCTAG_STATUS_OK;
+    int real_offset = offset_bit;
+    plc_tag_p tag = lookup_tag(id);
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    if(!tag) {
+        pdebug(DEBUG_WARN, "Tag not found.");
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    /* is there data? */
+    if(!tag->data) {
+        rc_dec(tag);
+        pdebug(DEBUG_WARN, "Tag has no data!");
+        tag->status = PLCTAG_ERR_NO_DATA;
+        return PLCTAG_ERR_NO_DATA;
+    }
+
+    /* if this is a single bit, then make sure the offset is the tag bit. */
+    if(tag->is_bit) {
+        real_offset = tag->bit;
+    } else {
+        real_offset = offset_bit;
+    }
+
+    pdebug(DEBUG_SPEW, "Setting bit %d with offset %d in byte %d (%x).", real_offset, (real_offset % 8), (real_offset / 8), tag->data[real_offset / 8]);
+
+    critical_block(tag->api_mutex) {
+        if((real_offset >= 0) && ((real_offset / 8) < tag->size)) {
+            if(tag->auto_sync_write_ms > 0) {
+                tag_set_dirty_unsafe(tag);
+            }
+
+            tag_add_dirty_range_unsafe(tag, real_offset / 8, 1);
+
+            plc_tag_generic_data_write_begin(tag);
+
+            if(val) {
+                tag->data[real_offset / 8] |= (uint8_t)(1 << (real_offset % 8));
+            } else {
+                tag->data[real_offset / 8] &= (uint8_t)(~(1 << (real_offset % 8)));
+            }
+
+            plc_tag_generic_data_write_end(tag);
+
+            tag->status = PLCTAG_STATUS_OK;
+        } else {
+            pdebug(DEBUG_WARN, "Data offset out of bounds!");
+            tag->status = PLCTAG_ERR_OUT_OF_BOUNDS;
+            res = PLCTAG_ERR_OUT_OF_BOUNDS;
+        }
+    }
+
+    rc_dec(tag);
+
+    return res;
+}
+
+
+
+/*
+ * Byte order kernels for the scalar accessors, one load and one store per
+ * element type.  The order of each type is classified once per tag by
+ * tag_set_native_byte_order(): the same as the host copies directly, the
+ * exact reverse copies and swaps, anything else goes through the order
+ * table.  The caller holds the API mutex and has checked the bounds.
+ */
+
+static inline uint16_t tag_swap16(uint16_t v)
+{
+    return (uint16_t)((v >> 8) | (v << 8));
+}
+
+static inline uint32_t tag_swap32(uint32_t v)
+{
+    return ((v >> 24) & 0x000000FFu) | ((v >> 8) & 0x0000FF00u) | ((v << 8) & 0x00FF0000u) | ((v << 24) & 0xFF000000u);
+}
+
+static inline uint64_t tag_swap64(uint64_t v)
+{
+    return ((uint64_t)tag_swap32((uint32_t)(v & 0xFFFFFFFFu)) << 32) | (uint64_t)tag_swap32((uint32_t)(v >> 32));
+}
+
+#define TAG_ORDER_KERNELS(NAME, UTYPE, FLAG, ORDER, SWAP)                                      \
+static inline UTYPE tag_load_##NAME(plc_tag_p tag, int offset)                                 \
+{                                                                                              \
+    UTYPE val = 0;                                                                             \
+                                                                                               \
+    if(tag->native_byte_order & (FLAG)) {                                                      \
+        mem_copy(&val, &tag->data[offset], (int)sizeof(val));                                  \
+    } else if(tag->swapped_byte_order & (FLAG)) {                                              \
+        mem_copy(&val, &tag->data[offset], (int)sizeof(val));                                  \
+        val = SWAP(val);                                                                       \
+    } else {                                                                                   \
+        for(int i=0; i < (int)sizeof(val); i++) {                                              \
+            val = (UTYPE)(val | (UTYPE)((UTYPE)tag->data[offset + tag->byte_order->ORDER[i]] << (8*i))); \
+        }                                                                                      \
+    }                                                                                          \
+                                                                                               \
+    return val;                                                                                \
+}                                                                                              \
+                                                                                               \
+static inline void tag_store_##NAME(plc_tag_p tag, int offset, UTYPE val)                      \
+{                                                                                              \
+    if(tag->native_byte_order & (FLAG)) {                                                      \
+        mem_copy(&tag->data[offset], &val, (int)sizeof(val));                                  \
+    } else if(tag->swapped_byte_order & (FLAG)) {                                              \
+        val = SWAP(val);                                                                       \
+        mem_copy(&tag->data[offset], &val, (int)sizeof(val));                                  \
+    } else {                                                                                   \
+        for(int i=0; i < (int)sizeof(val); i++) {                                              \
+            tag->data[offset + tag->byte_order->ORDER[i]] = (uint8_t)((val >> (8*i)) & 0xFF);  \
+        }                                                                                      \
+    }                                                                                          \
+}
+
+TAG_ORDER_KERNELS(int16, uint16_t, TAG_NATIVE_INT16, int16_order, tag_swap16)
+TAG_ORDER_KERNELS(int32, uint32_t, TAG_NATIVE_INT32, int32_order, tag_swap32)
+TAG_ORDER_KERNELS(int64, uint64_t, TAG_NATIVE_INT64, int64_order, tag_swap64)
+TAG_ORDER_KERNELS(float32, uint32_t, TAG_NATIVE_FLOAT32, float32_order, tag_swap32)
+TAG_ORDER_KERNELS(float64, uint64_t, TAG_NATIVE_FLOAT64, float64_order, tag_swap64)
+
+
+
+LIB_EXPORT uint64_t plc_tag_get_uint64(int32_t id, int offset)
+{
+    uint64_t res = UINT64_MAX;
+    plc_tag_p tag = lookup_tag(id);
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    if(!tag) {
+        pdebug(DEBUG_WARN,"Tag not found.");
+        return res;
+    }
+
+    /* is there data? */
+    if(!tag->data) {
+        rc_dec(tag);
+        pdebug(DEBUG_WARN,"Tag has no data!");
+        tag->status = PLCTAG_ERR_NO_DATA;
+        return res;
+    }
+
+    if(!tag->is_bit) {
+        critical_block(tag->api_mutex) {
+            if((offset >= 0) && (offset + ((int)sizeof(uint64_t)) <= tag->size)) {
+                res = tag_load_int64(tag, offset);
+
+                tag->status = PLCTAG_STATUS_OK;
+            } else {
+                pdebug(DEBUG_WARN, "Data offset out of bounds!");
+                tag->status = PLCTAG_ERR_OUT_OF_BOUNDS;
+            }
+        }
+    } else {
+        int rc = plc_tag_get_bit(id, tag->bit);
+
+        /* make sure the response is good. */
+        if(rc >= 0) {
+            res = (unsigned int)rc;
+        }
+    }
+
+    rc_dec(tag);
+
+    return res;
+}
+
+
+
+LIB_EXPORT int plc_tag_set_uint64(int32_t id, int offset, uint64_t val)
+{
+    int rc = PLCTAG_STATUS_OK;
+    plc_tag_p tag = lookup_tag(id);
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    if(!tag) {
+        pdebug(DEBUG_WARN,"Tag not found.");
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    /* is there data? */
+    if(!tag->data) {
+        rc_dec(tag);
+        pdebug(DEBUG_WARN,"Tag has no data!");
+        tag->status = PLCTAG_ERR_NO_DATA;
+        return PLCTAG_ERR_NO_DATA;
+    }
+
+    if(!tag->is_bit) {
+        critical_block(tag->api_mutex) {
+            if((offset >= 0) && (offset + ((int)sizeof(uint64_t)) <= tag->size)) {
+                if(tag->auto_sync_write_ms > 0) {
+                    tag_set_dirty_unsafe(tag);
+                }
+
+                tag_add_dirty_range_unsafe(tag, offset, (int)sizeof(uint64_t));
+
+                plc_tag_generic_data_write_begin(tag);
+
+                tag_store_int64(tag, offset, val);
+
+                plc_tag_generic_data_write_end(tag);
+
+                tag->status = PLCTAG_STATUS_OK;
+            } else {
+                pdebug(DEBUG_WARN, "Data offset out of bounds!");
+                tag->status = PLCTAG_ERR_OUT_OF_BOUNDS;
+                rc = PLCTAG_ERR_OUT_OF_BOUNDS;
+            }
+        }
+    } else {
+        if(!val) {
+            rc = plc_tag_set_bit(id, 0, 0);
+        } else {
+            rc = plc_tag_set_bit(id, 0, 1);
+        }
+    }
+
+    rc_dec(tag);
+
+    return rc;
+}
+
+
+
+
+LIB_EXPORT int64_t plc_tag_get_int64(int32_t id, int offset)
+{
+    int64_t res = INT64_MIN;
+    plc_tag_p tag = lookup_tag(id);
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    if(!tag) {
+        pdebug(DEBUG_WARN,"Tag not found.");
+        return res;
+    }
+
+    /* is there data? */
+    if(!tag->data) {
+        rc_dec(tag);
+        pdebug(DEBUG_WARN,"Tag has no data!");
+        tag->status = PLCTAG_ERR_NO_DATA;
+        return res;
+    }
+
+    if(!tag->is_bit) {
+        critical_block(tag->api_mutex) {
+            if((offset >= 0) && (offset + ((int)sizeof(int64_t)) <= tag->size)) {
+                res = (int64_t)tag_load_int64(tag, offset);
+
+                tag->status = PLCTAG_STATUS_OK;
+            } else {
+                pdebug(DEBUG_WARN, "Data offset out of bounds!");
+                tag->status = PLCTAG_ERR_OUT_OF_BOUNDS;
+            }
+        }
+    } else {
+        int rc = plc_tag_get_bit(id, tag->bit);
+
+        /* make sure the response is good. */
+        if(rc >= 0) {
+            res = rc;
+        }
+    }
+
+    rc_dec(tag);
+
+    return res;
+}
+
+
+
+LIB_EXPORT int plc_tag_set_int64(int32_t id, int offset, int64_t ival)
+{
+    int rc = PLCTAG_STATUS_OK;
+    plc_tag_p tag = lookup_tag(id);
+    uint64_t val = (uint64_t)(ival);
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    if(!tag) {
+        pdebug(DEBUG_WARN,"Tag not found.");
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    /* is there data? */
+    if(!tag->data) {
+        rc_dec(tag);
+        pdebug(DEBUG_WARN,"Tag has no data!");
+        tag->status = PLCTAG_ERR_NO_DATA;
+        return PLCTAG_ERR_NO_DATA;
+    }
+
+    if(!tag->is_bit) {
+        critical_block(tag->api_mutex) {
+            if((offset >= 0) && (offset + ((int)sizeof(int64_t)) <= tag->size)) {
+                if(tag->auto_sync_write_ms > 0) {
+                    tag_set_dirty_unsafe(tag);
+                }
+
+                tag_add_dirty_range_unsafe(tag, offset, (int)sizeof(int64_t));
+
+                plc_tag_generic_data_write_begin(tag);
+
+                tag_store_int64(tag, offset, val);
+
+                plc_tag_generic_data_write_end(tag);
+
+                tag->status = PLCTAG_STATUS_OK;
+            } else {
+                pdebug(DEBUG_WARN, "Data offset out of bounds!");
+                tag->status = PLCTAG_ERR_OUT_OF_BOUNDS;
+                rc = PLCTAG_ERR_OUT_OF_BOUNDS;
+            }
+        }
+    } else {
+        if(!val) {
+            rc = plc_tag_set_bit(id, 0, 0);
+        } else {
+            rc = plc_tag_set_bit(id, 0, 1);
+        }
+    }
+
+    rc_dec(tag);
+
+    return rc;
+}
+
+LIB_EXPORT uint32_t plc_tag_get_uint32(int32_t id, int offset)
+{
+    uint32_t res = UINT32_MAX;
+    plc_tag_p tag = lookup_tag(id);
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    if(!tag) {
+        pdebug(DEBUG_WARN,"Tag not found.");
+        return res;
+    }
+
+    /* is there data? */
+    if(!tag->data) {
+        rc_dec(tag);
+        pdebug(DEBUG_WARN,"Tag has no data!");
+        tag->status = PLCTAG_ERR_NO_DATA;
+        return res;
+    }
+
+    if(!tag->is_bit) {
+        critical_block(tag->api_mutex) {
+            if((offset >= 0) && (offset + ((int)sizeof(uint32_t)) <= tag->size)) {
+                res = tag_load_int32(tag, offset);
+
+                tag->status = PLCTAG_STATUS_OK;
+            } else {
+                pdebug(DEBUG_WARN, "Data offset out of bounds!");
+                tag->status = PLCTAG_ERR_OUT_OF_BOUNDS;
+            }
+        }
+    } else {
+        int rc = plc_tag_get_bit(id, tag->bit);
+
+        /* make sure the response is good. */
+        if(rc >= 0) {
+            res = (unsigned int)rc;
+        }
+    }
+
+    rc_dec(tag);
+
+    return res;
+}
+
+
+
+LIB_EXPORT int plc_tag_set_uint32(int32_t id, int offset, uint32_t val)
+{
+    int rc = PLCTAG_STATUS_OK;
+    plc_tag_p tag = lookup_tag(id);
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    if(!tag) {
+        pdebug(DEBUG_WARN,"Tag not found.");
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    /* is there data? */
+    if(!tag->data) {
+        rc_dec(tag);
+        pdebug(DEBUG_WARN,"Tag has no data!");
+        tag->status = PLCTAG_ERR_NO_DATA;
+        return PLCTAG_ERR_NO_DATA;
+    }
+
+    if(!tag->is_bit) {
+        critical_block(tag->api_mutex) {
+            if((offset >= 0) && (offset + ((int)sizeof(uint32_t)) <= tag->size)) {
+                if(tag->auto_sync_write_ms > 0) {
+                    tag_set_dirty_unsafe(tag);
+                }
+
+                tag_add_dirty_range_unsafe(tag, offset, (int)sizeof(uint32_t));
+
+                plc_tag_generic_data_write_begin(tag);
+
+                tag_store_int32(tag, offset, val);
+
+                plc_tag_generic_data_write_end(tag);
 
-    if(tag->callback) {
-        if(is_done) {
-            pdebug(DEBUG_DETAIL, "Calling callback with PLCTAG_EVENT_READ_COMPLETED.");
-            tag->callback(id, PLCTAG_EVENT_READ_COMPLETED, rc);
+                tag->status = PLCTAG_STATUS_OK;
+            } else {
+                pdebug(DEBUG_WARN, "Data offset out of bounds!");
+                tag->status = PLCTAG_ERR_OUT_OF_BOUNDS;
+                rc = PLCTAG_ERR_OUT_OF_BOUNDS;
+            }
+        }
+    } else {
+        if(!val) {
+            rc = plc_tag_set_bit(id, 0, 0);
+        } else {
+            rc = plc_tag_set_bit(id, 0, 1);
         }
     }
 
     rc_dec(tag);
 
-    pdebug(DEBUG_INFO, "Done");
-
     return rc;
 }
 
 
 
 
+LIB_EXPORT int32_t  plc_tag_get_int32(int32_t id, int offset)
+{
+    int32_t res = INT32_MIN;
+    plc_tag_p tag = lookup_tag(id);
 
+    pdebug(DEBUG_SPEW, "Starting.");
 
-/*
- * plc_tag_status
- *
- * Return the current status of the tag.  This will be PLCTAG_STATUS_PENDING if there is
- * an uncompleted IO operation.  It will be PLCTAG_STATUS_OK if everything is fine.  Other
- * errors will be returned as appropriate.
- *
- * This is a function provided by the underlying protocol implementation.
- */
+    if(!tag) {
+        pdebug(DEBUG_WARN,"Tag not found.");
+        return res;
+    }
 
+    /* is there data? */
+    if(!tag->data) {
+        rc_dec(tag);
+        pdebug(DEBUG_WARN,"Tag has no data!");
+        tag->status = PLCTAG_ERR_NO_DATA;
+        return res;
+    }
 
-LIB_EXPORT int plc_tag_status(int32_t id)
+    if(!tag->is_bit) {
+        critical_block(tag->api_mutex) {
+            if((offset >= 0) && (offset + ((int)sizeof(int32_t)) <= tag->size)) {
+                res = (int32_t)tag_load_int32(tag, offset);
+
+                tag->status = PLCTAG_STATUS_OK;
+            }  else {
+                pdebug(DEBUG_WARN, "Data offset out of bounds!");
+                tag->status = PLCTAG_ERR_OUT_OF_BOUNDS;
+            }
+        }
+    } else {
+        int rc = plc_tag_get_bit(id, tag->bit);
+
+        /* make sure the response is good. */
+        if(rc >= 0) {
+            res = (int32_t)rc;
+        }
+    }
+
+    rc_dec(tag);
+
+    return res;
+}
+
+
+
+LIB_EXPORT int plc_tag_set_int32(int32_t id, int offset, int32_t ival)
 {
     int rc = PLCTAG_STATUS_OK;
     plc_tag_p tag = lookup_tag(id);
+    uint32_t val = (uint32_t)ival;
 
     pdebug(DEBUG_SPEW, "Starting.");
 
-    /* check the ID.  It might be an error status from creating the tag. */
     if(!tag) {
-        if(id < 0) {
-            pdebug(DEBUG_WARN, "Called with an error status %s!", plc_tag_decode_error(id));
-            return id;
-        } else {
-            pdebug(DEBUG_WARN,"Tag not found.");
-            return PLCTAG_ERR_NOT_FOUND;
-        }
+        pdebug(DEBUG_WARN,"Tag not found.");
+        return PLCTAG_ERR_NOT_FOUND;
     }
 
-    critical_block(tag->api_mutex) {
-        if(tag && tag->vtable->tickler) {
-            tag->vtable->tickler(tag);
-        }
+    /* is there data? */
+    if(!tag->data) {
+        rc_dec(tag);
+        pdebug(DEBUG_WARN,"Tag has no data!");
+        tag->status = PLCTAG_ERR_NO_DATA;
+        return PLCTAG_ERR_NO_DATA;
+    }
 
-        rc = tag->vtable->status(tag);
+    if(!tag->is_bit) {
+        critical_block(tag->api_mutex) {
+            if((offset >= 0) && (offset + ((int)sizeof(int32_t)) <= tag->size)) {
+                if(tag->auto_sync_write_ms > 0) {
+                    tag_set_dirty_unsafe(tag);
+                }
 
-        if(rc == PLCTAG_STATUS_OK) {
-            if(tag->read_in_flight || tag->write_in_flight) {
-                rc = PLCTAG_STATUS_PENDING;
+                tag_add_dirty_range_unsafe(tag, offset, (int)sizeof(int32_t));
+
+                plc_tag_generic_data_write_begin(tag);
+
+                tag_store_int32(tag, offset, val);
+
+                plc_tag_generic_data_write_end(tag);
+
+                tag->status = PLCTAG_STATUS_OK;
+            } else {
+                pdebug(DEBUG_WARN, "Data offset out of bounds!");
+                tag->status = PLCTAG_ERR_OUT_OF_BOUNDS;
+                rc = PLCTAG_ERR_OUT_OF_BOUNDS;
             }
         }
+    } else {
+        if(!val) {
+            rc = plc_tag_set_bit(id, 0, 0);
+        } else {
+            rc = plc_tag_set_bit(id, 0, 1);
+        }
     }
 
     rc_dec(tag);
 
-    pdebug(DEBUG_SPEW, "Done with rc=%s.", plc_tag_decode_error(rc));
-
     return rc;
 }
 
@@ -1356,139 +6914,108 @@ LIB_EXPORT int plc_tag_status(int32_t id)
 
 
 
-/*
- * plc_tag_write()
- *
- * This function calls through the vtable in the passed tag to call
- * the protocol-specific implementation.  That starts the write operation.
- * If there is a timeout passed, then this routine waits for either
- * a timeout or an error.
- *
- * The status of the operation is returned.
- */
 
-LIB_EXPORT int plc_tag_write(int32_t id, int timeout)
+
+LIB_EXPORT uint16_t plc_tag_get_uint16(int32_t id, int offset)
 {
-    int rc = PLCTAG_STATUS_OK;
+    uint16_t res = UINT16_MAX;
     plc_tag_p tag = lookup_tag(id);
-    int is_done = 0;
 
     pdebug(DEBUG_SPEW, "Starting.");
 
-    if(timeout < 0) {
-        pdebug(DEBUG_WARN, "Timeout must not be negative!");
-        rc_dec(tag);
-        return PLCTAG_ERR_BAD_PARAM;
-    }
-
     if(!tag) {
         pdebug(DEBUG_WARN,"Tag not found.");
-        return PLCTAG_ERR_NOT_FOUND;
+        return res;
     }
 
-    if(tag->callback) {
-        pdebug(DEBUG_DETAIL, "Calling callback with PLCTAG_EVENT_WRITE_STARTED.");
-        tag->callback(id, PLCTAG_EVENT_WRITE_STARTED, PLCTAG_STATUS_OK);
+    /* is there data? */
+    if(!tag->data) {
+        rc_dec(tag);
+        pdebug(DEBUG_WARN,"Tag has no data!");
+        tag->status = PLCTAG_ERR_NO_DATA;
+        return res;
     }
 
-    critical_block(tag->api_mutex) {
-        if(tag->read_in_flight || tag->write_in_flight) {
-            pdebug(DEBUG_WARN, "Tag already has an operation in flight!");
-            is_done = 1;
-            rc = PLCTAG_ERR_BUSY;
-            break;
+    if(!tag->is_bit) {
+        critical_block(tag->api_mutex) {
+            if((offset >= 0) && (offset + ((int)sizeof(uint16_t)) <= tag->size)) {
+                res = tag_load_int16(tag, offset);
+
+                tag->status = PLCTAG_STATUS_OK;
+            } else {
+                pdebug(DEBUG_WARN, "Data offset out of bounds!");
+                tag->status = PLCTAG_ERR_OUT_OF_BOUNDS;
+            }
         }
+    } else {
+        int rc = plc_tag_get_bit(id, tag->bit);
 
-        /* a write is now in flight. */
-        tag->write_in_flight = 1;
-        tag->status = PLCTAG_STATUS_OK;
+        /* make sure the response is good. */
+        if(rc >= 0) {
+            res = (uint16_t)(unsigned int)rc;
+        }
+    }
 
-        /* the protocol implementation does not do the timeout. */
-        rc = tag->vtable->write(tag);
+    rc_dec(tag);
 
-        /* if not pending then check for success or error. */
-        if(rc != PLCTAG_STATUS_PENDING) {
-            if(rc != PLCTAG_STATUS_OK) {
-                /* not pending and not OK, so error. Abort and clean up. */
+    return res;
+}
 
-                pdebug(DEBUG_WARN,"Response from write command returned error %s!", plc_tag_decode_error(rc));
 
-                if(tag->vtable->abort) {
-                    tag->vtable->abort(tag);
-                }
-            }
 
-            tag->write_in_flight = 0;
-            is_done = 1;
-            break;
-        }
 
-        /*
-         * if there is a timeout, then loop until we get
-         * an error or we timeout.
-         */
-        if(timeout) {
-            int64_t start_time = time_ms();
-            int64_t timeout_time = timeout + start_time;
+LIB_EXPORT int plc_tag_set_uint16(int32_t id, int offset, uint16_t val)
+{
+    int rc = PLCTAG_STATUS_OK;
+    plc_tag_p tag = lookup_tag(id);
 
-            while(rc == PLCTAG_STATUS_PENDING && timeout_time > time_ms()) {
-                /* give some time to the tickler function. */
-                if(tag->vtable->tickler) {
-                    tag->vtable->tickler(tag);
-                }
+    pdebug(DEBUG_SPEW, "Starting.");
 
-                rc = tag->vtable->status(tag);
+    if(!tag) {
+        pdebug(DEBUG_WARN,"Tag not found.");
+        return PLCTAG_ERR_NOT_FOUND;
+    }
 
-                /*
-                 * terminate early and do not wait again if the
-                 * IO is done.
-                 */
-                if(rc != PLCTAG_STATUS_PENDING) {
-                    break;
+    /* is there data? */
+    if(!tag->data) {
+        rc_dec(tag);
+        pdebug(DEBUG_WARN,"Tag has no data!");
+        tag->status = PLCTAG_ERR_NO_DATA;
+        return PLCTAG_ERR_NO_DATA;
+    }
+
+    if(!tag->is_bit) {
+        critical_block(tag->api_mutex) {
+            if((offset >= 0) && (offset + ((int)sizeof(uint16_t)) <= tag->size)) {
+                if(tag->auto_sync_write_ms > 0) {
+                    tag_set_dirty_unsafe(tag);
                 }
 
-                sleep_ms(1); /* MAGIC */
-            }
+                tag_add_dirty_range_unsafe(tag, offset, (int)sizeof(uint16_t));
 
-            /*
-             * if we dropped out of the while loop but the status is
-             * still pending, then we timed out.
-             *
-             * Abort the operation and set the status to show the timeout.
-             */
-            if(rc != PLCTAG_STATUS_OK) {
-                /* abort the request. */
-                if(tag->vtable->abort) {
-                    tag->vtable->abort(tag);
-                }
+                plc_tag_generic_data_write_begin(tag);
 
-                /* translate error if we are still pending. */
-                if(rc == PLCTAG_STATUS_PENDING) {
-                    pdebug(DEBUG_WARN, "Write operation timed out.");
-                    rc = PLCTAG_ERR_TIMEOUT;
-                }
-            }
+                tag_store_int16(tag, offset, val);
 
-            /* the write is not in flight anymore. */
-            tag->write_in_flight = 0;
-            tag->write_complete = 0;
-            is_done = 1;
+                plc_tag_generic_data_write_end(tag);
 
-            pdebug(DEBUG_INFO,"elapsed time %" PRId64 "ms",(time_ms()-start_time));
+                tag->status = PLCTAG_STATUS_OK;
+            } else {
+                pdebug(DEBUG_WARN, "Data offset out of bounds!");
+                tag->status = PLCTAG_ERR_OUT_OF_BOUNDS;
+                rc = PLCTAG_ERR_OUT_OF_BOUNDS;
+            }
         }
-    } /* end of api mutex block */
-
-    if(tag->callback) {
-        if(is_done) {
-            pdebug(DEBUG_DETAIL, "Calling callback with PLCTAG_EVENT_WRITE_COMPLETED.");
-            tag->callback(id, PLCTAG_EVENT_WRITE_COMPLETED, rc);
+    } else {
+        if(!val) {
+            rc = plc_tag_set_bit(id, 0, 0);
+        } else {
+            rc = plc_tag_set_bit(id, 0, 1);
         }
     }
 
     rc_dec(tag);
 
-    pdebug(DEBUG_INFO, "Done");
-
     return rc;
 }
 
@@ -1496,243 +7023,156 @@ LIB_EXPORT int plc_tag_write(int32_t id, int timeout)
 
 
 
-/*
- * Tag data accessors.
- */
 
 
 
 
-LIB_EXPORT int plc_tag_get_int_attribute(int32_t id, const char *attrib_name, int default_value)
+LIB_EXPORT int16_t  plc_tag_get_int16(int32_t id, int offset)
 {
-    int res = default_value;
-    plc_tag_p tag = NULL;
+    int16_t res = INT16_MIN;
+    plc_tag_p tag = lookup_tag(id);
 
     pdebug(DEBUG_SPEW, "Starting.");
 
-    /* FIXME - this should set the tag status if there is a tag. */
-    if(!attrib_name || str_length(attrib_name) == 0) {
-        pdebug(DEBUG_WARN, "Attribute name must not be null or zero-length!");
-        return default_value;
+    if(!tag) {
+        pdebug(DEBUG_WARN,"Tag not found.");
+        return res;
     }
 
-    /* get library attributes */
-    if(id == 0) {
-        if(str_cmp_i(attrib_name, "version_major") == 0) {
-            res = (int)version_major;
-        } else if(str_cmp_i(attrib_name, "version_minor") == 0) {
-            res = (int)version_minor;
-        } else if(str_cmp_i(attrib_name, "version_patch") == 0) {
-            res = (int)version_patch;
-        } else if(str_cmp_i(attrib_name, "debug") == 0) {
-            res = (int)get_debug_level();
-        } else if(str_cmp_i(attrib_name, "debug_level") == 0) {
-            pdebug(DEBUG_WARN, "Deprecated attribute \"debug_level\" used, use \"debug\" instead.");
-            res = (int)get_debug_level();
-        } else {
-            pdebug(DEBUG_WARN, "Attribute \"%s\" is not supported at the library level!");
-            res = default_value;
-        }
-    } else {
-        tag = lookup_tag(id);
-
-        if(!tag) {
-            pdebug(DEBUG_WARN,"Tag not found.");
-            return default_value;
-        }
+    /* is there data? */
+    if(!tag->data) {
+        rc_dec(tag);
+        pdebug(DEBUG_WARN,"Tag has no data!");
+        tag->status = PLCTAG_ERR_NO_DATA;
+        return res;
+    }
 
+    if(!tag->is_bit) {
         critical_block(tag->api_mutex) {
-            /* match the generic ones first. */
-            if(str_cmp_i(attrib_name, "size") == 0) {
-                tag->status = PLCTAG_STATUS_OK;
-                res = (int)tag->size;
-            } else if(str_cmp_i(attrib_name, "read_cache_ms") == 0) {
-                /* FIXME - what happens if this overflows? */
-                tag->status = PLCTAG_STATUS_OK;
-                res = (int)tag->read_cache_ms;
-            } else if(str_cmp_i(attrib_name, "auto_sync_read_ms") == 0) {
-                tag->status = PLCTAG_STATUS_OK;
-                res = (int)tag->auto_sync_read_ms;
-            } else if(str_cmp_i(attrib_name, "auto_sync_write_ms") == 0) {
-                tag->status = PLCTAG_STATUS_OK;
-                res = (int)tag->auto_sync_write_ms;
-            } else if(str_cmp_i(attrib_name, "bit_num") == 0) {
+            if((offset >= 0) && (offset + ((int)sizeof(int16_t)) <= tag->size)) {
+                res = (int16_t)tag_load_int16(tag, offset);
                 tag->status = PLCTAG_STATUS_OK;
-                res = (int)(unsigned int)(tag->bit);
-            } else  {
-                if(tag->vtable->get_int_attrib) {
-                    res = tag->vtable->get_int_attrib(tag, attrib_name, default_value);
-                }
+            } else {
+                pdebug(DEBUG_WARN, "Data offset out of bounds!");
+                tag->status = PLCTAG_ERR_OUT_OF_BOUNDS;
             }
         }
+    } else {
+        int rc = plc_tag_get_bit(id, tag->bit);
 
-        rc_dec(tag);
+        /* make sure the response is good. */
+        if(rc >= 0) {
+            res = (int16_t)(uint16_t)(unsigned int)rc;
+        }
     }
 
-    pdebug(DEBUG_SPEW, "Done.");
+    rc_dec(tag);
 
     return res;
 }
 
 
 
-LIB_EXPORT int plc_tag_set_int_attribute(int32_t id, const char *attrib_name, int new_value)
+
+LIB_EXPORT int plc_tag_set_int16(int32_t id, int offset, int16_t ival)
 {
-    int res = PLCTAG_ERR_NOT_FOUND;
-    plc_tag_p tag = NULL;
+    int rc = PLCTAG_STATUS_OK;
+    plc_tag_p tag = lookup_tag(id);
+    uint16_t val = (uint16_t)ival;
 
     pdebug(DEBUG_SPEW, "Starting.");
 
-    if(!attrib_name || str_length(attrib_name) == 0) {
-        pdebug(DEBUG_WARN, "Attribute name must not be null or zero-length!");
-        return PLCTAG_ERR_BAD_PARAM;
+    if(!tag) {
+        pdebug(DEBUG_WARN,"Tag not found.");
+        return PLCTAG_ERR_NOT_FOUND;
     }
 
-    /* get library attributes */
-    if(id == 0) {
-        if(str_cmp_i(attrib_name, "debug") == 0) {
-            if(new_value >= DEBUG_ERROR && new_value < DEBUG_SPEW) {
-                set_debug_level(new_value);
-                res = PLCTAG_STATUS_OK;
-            } else {
-                res = PLCTAG_ERR_OUT_OF_BOUNDS;
-            }
-        } else if(str_cmp_i(attrib_name, "debug_level") == 0) {
-            pdebug(DEBUG_WARN, "Deprecated attribute \"debug_level\" used, use \"debug\" instead.");
-            if(new_value >= DEBUG_ERROR && new_value < DEBUG_SPEW) {
-                set_debug_level(new_value);
-                res = PLCTAG_STATUS_OK;
-            } else {
-                res = PLCTAG_ERR_OUT_OF_BOUNDS;
-            }
-        } else {
-            pdebug(DEBUG_WARN, "Attribute \"%s\" is not support at the library level!", attrib_name);
-            return PLCTAG_ERR_UNSUPPORTED;
-        }
-    } else {
-        tag = lookup_tag(id);
-
-        if(!tag) {
-            pdebug(DEBUG_WARN,"Tag not found.");
-            return PLCTAG_ERR_NOT_FOUND;
-        }
+    /* is there data? */
+    if(!tag->data) {
+        rc_dec(tag);
+        pdebug(DEBUG_WARN,"Tag has no data!");
+        tag->status = PLCTAG_ERR_NO_DATA;
+        return PLCTAG_ERR_NO_DATA;
+    }
 
+    if(!tag->is_bit) {
         critical_block(tag->api_mutex) {
-            /* match the generic ones first. */
-            if(str_cmp_i(attrib_name, "read_cache_ms") == 0) {
-                if(new_value >= 0) {
-                    /* expire the cache. */
-                    tag->read_cache_expire = (int64_t)0;
-                    tag->read_cache_ms = (int64_t)new_value;
-                    tag->status = PLCTAG_STATUS_OK;
-                    res = PLCTAG_STATUS_OK;
-                } else {
-                    tag->status = PLCTAG_ERR_OUT_OF_BOUNDS;
-                    res = PLCTAG_ERR_OUT_OF_BOUNDS;
-                }
-            } else if(str_cmp_i(attrib_name, "auto_sync_read_ms") == 0) {
-                if(new_value >= 0) {
-                    tag->auto_sync_read_ms = new_value;
-                    tag->status = PLCTAG_STATUS_OK;
-                    res = PLCTAG_STATUS_OK;
-                } else {
-                    pdebug(DEBUG_WARN, "auto_sync_read_ms must be greater than or equal to zero!");
-                    tag->status = PLCTAG_ERR_OUT_OF_BOUNDS;
-                    res = PLCTAG_ERR_OUT_OF_BOUNDS;
-                }
-            } else if(str_cmp_i(attrib_name, "auto_sync_write_ms") == 0) {
-                if(new_value >= 0) {
-                    tag->auto_sync_write_ms = new_value;
-                    tag->status = PLCTAG_STATUS_OK;
-                    res = PLCTAG_STATUS_OK;
-                } else {
-                    pdebug(DEBUG_WARN, "auto_sync_write_ms must be greater than or equal to zero!");
-                    tag->status = PLCTAG_ERR_OUT_OF_BOUNDS;
-                    res = PLCTAG_ERR_OUT_OF_BOUNDS;
+            if((offset >= 0) && (offset + ((int)sizeof(int16_t)) <= tag->size)) {
+                if(tag->auto_sync_write_ms > 0) {
+                    tag_set_dirty_unsafe(tag);
                 }
+
+                tag_add_dirty_range_unsafe(tag, offset, (int)sizeof(int16_t));
+
+                plc_tag_generic_data_write_begin(tag);
+
+                tag_store_int16(tag, offset, val);
+
+                plc_tag_generic_data_write_end(tag);
+
+                tag->status = PLCTAG_STATUS_OK;
             } else {
-                if(tag->vtable->set_int_attrib) {
-                    res = tag->vtable->set_int_attrib(tag, attrib_name, new_value);
-                    tag->status = (int8_t)res;
-                }
+                pdebug(DEBUG_WARN, "Data offset out of bounds!");
+                tag->status = PLCTAG_ERR_OUT_OF_BOUNDS;
+                rc = PLCTAG_ERR_OUT_OF_BOUNDS;
             }
         }
+    } else {
+        if(!val) {
+            rc = plc_tag_set_bit(id, 0, 0);
+        } else {
+            rc = plc_tag_set_bit(id, 0, 1);
+        }
     }
 
     rc_dec(tag);
 
-    pdebug(DEBUG_SPEW, "Done.");
-
-    return res;
+    return rc;
 }
 
 
 
 
-LIB_EXPORT int plc_tag_get_size(int32_t id)
-{
-    int result = 0;
-    plc_tag_p tag = lookup_tag(id);
-
-    pdebug(DEBUG_SPEW, "Starting.");
-
-    if(!tag) {
-        pdebug(DEBUG_WARN,"Tag not found.");
-        return PLCTAG_ERR_NOT_FOUND;
-    }
-
-    critical_block(tag->api_mutex) {
-        result = tag->size;
-        tag->status = PLCTAG_STATUS_OK;
-    }
-
-    rc_dec(tag);
-
-    pdebug(DEBUG_SPEW, "Done.");
 
-    return result;
-}
 
 
 
-LIB_EXPORT int plc_tag_get_bit(int32_t id, int offset_bit)
+LIB_EXPORT uint8_t plc_tag_get_uint8(int32_t id, int offset)
 {
-    int res = PLCTAG_ERR_OUT_OF_BOUNDS;
-    int real_offset = offset_bit;
+    uint8_t res = UINT8_MAX;
     plc_tag_p tag = lookup_tag(id);
 
     pdebug(DEBUG_SPEW, "Starting.");
 
     if(!tag) {
-        pdebug(DEBUG_WARN, "Tag not found.");
-        return PLCTAG_ERR_NOT_FOUND;
+        pdebug(DEBUG_WARN,"Tag not found.");
+        return res;
     }
 
     /* is there data? */
     if(!tag->data) {
         rc_dec(tag);
-        pdebug(DEBUG_WARN, "Tag has no data!");
+        pdebug(DEBUG_WARN,"Tag has no data!");
         tag->status = PLCTAG_ERR_NO_DATA;
-        return PLCTAG_ERR_NO_DATA;
-    }
-
-    /* if this is a single bit, then make sure the offset is the tag bit. */
-    if(tag->is_bit) {
-        real_offset = tag->bit;
-    } else {
-        real_offset = offset_bit;
+        return res;
     }
 
-    pdebug(DEBUG_SPEW, "selecting bit %d with offset %d in byte %d (%x).", real_offset, (real_offset % 8), (real_offset / 8), tag->data[real_offset / 8]);
+    if(!tag->is_bit) {
+        critical_block(tag->api_mutex) {
+            if((offset >= 0) && (offset + ((int)sizeof(uint8_t)) <= tag->size)) {
+                res = tag->data[offset];
+                tag->status = PLCTAG_STATUS_OK;
+            } else {
+                pdebug(DEBUG_WARN, "Data offset out of bounds!");
+                tag->status = PLCTAG_ERR_OUT_OF_BOUNDS;
+            }
+        }
+    } else {
+        int rc = plc_tag_get_bit(id, tag->bit);
 
-    critical_block(tag->api_mutex) {
-        if((real_offset >= 0) && ((real_offset / 8) < tag->size)) {
-            res = !!(((1 << (real_offset % 8)) & 0xFF) & (tag->data[real_offset / 8]));
-            tag->status = PLCTAG_STATUS_OK;
-        } else {
-            pdebug(DEBUG_WARN, "Data offset out of bounds!");
-            res = PLCTAG_ERR_OUT_OF_BOUNDS;
-            tag->status = PLCTAG_ERR_OUT_OF_BOUNDS;
+        /* make sure the response is good. */
+        if(rc >= 0) {
+            res = (uint8_t)(unsigned int)rc;
         }
     }
 
@@ -1742,66 +7182,70 @@ LIB_EXPORT int plc_tag_get_bit(int32_t id, int offset_bit)
 }
 
 
-LIB_EXPORT int plc_tag_set_bit(int32_t id, int offset_bit, int val)
+
+
+LIB_EXPORT int plc_tag_set_uint8(int32_t id, int offset, uint8_t val)
 {
-    int res = PLCTAG_STATUS_OK;
-    int real_offset = offset_bit;
+    int rc = PLCTAG_STATUS_OK;
     plc_tag_p tag = lookup_tag(id);
 
     pdebug(DEBUG_SPEW, "Starting.");
 
     if(!tag) {
-        pdebug(DEBUG_WARN, "Tag not found.");
+        pdebug(DEBUG_WARN,"Tag not found.");
         return PLCTAG_ERR_NOT_FOUND;
     }
 
     /* is there data? */
     if(!tag->data) {
         rc_dec(tag);
-        pdebug(DEBUG_WARN, "Tag has no data!");
+        pdebug(DEBUG_WARN,"Tag has no data!");
         tag->status = PLCTAG_ERR_NO_DATA;
         return PLCTAG_ERR_NO_DATA;
     }
 
-    /* if this is a single bit, then make sure the offset is the tag bit. */
-    if(tag->is_bit) {
-        real_offset = tag->bit;
-    } else {
-        real_offset = offset_bit;
-    }
+    if(!tag->is_bit) {
+        critical_block(tag->api_mutex) {
+            if((offset >= 0) && (offset + ((int)sizeof(uint8_t)) <= tag->size)) {
+                if(tag->auto_sync_write_ms > 0) {
+                    tag_set_dirty_unsafe(tag);
+                }
 
-    pdebug(DEBUG_SPEW, "Setting bit %d with offset %d in byte %d (%x).", real_offset, (real_offset % 8), (real_offset / 8), tag->data[real_offset / 8]);
+                tag_add_dirty_range_unsafe(tag, offset, (int)sizeof(uint8_t));
 
-    critical_block(tag->api_mutex) {
-        if((real_offset >= 0) && ((real_offset / 8) < tag->size)) {
-            if(tag->auto_sync_write_ms > 0) {
-                tag->tag_is_dirty = 1;
-            }
+                plc_tag_generic_data_write_begin(tag);
 
-            if(val) {
-                tag->data[real_offset / 8] |= (uint8_t)(1 << (real_offset % 8));
+                tag->data[offset] = val;
+
+                plc_tag_generic_data_write_end(tag);
+
+                tag->status = PLCTAG_STATUS_OK;
             } else {
-                tag->data[real_offset / 8] &= (uint8_t)(~(1 << (real_offset % 8)));
+                pdebug(DEBUG_WARN, "Data offset out of bounds!");
+                tag->status = PLCTAG_ERR_OUT_OF_BOUNDS;
+                rc = PLCTAG_ERR_OUT_OF_BOUNDS;
             }
-
-            tag->status = PLCTAG_STATUS_OK;
+        }
+    } else {
+        if(!val) {
+            rc = plc_tag_set_bit(id, 0, 0);
         } else {
-            pdebug(DEBUG_WARN, "Data offset out of bounds!");
-            tag->status = PLCTAG_ERR_OUT_OF_BOUNDS;
-            res = PLCTAG_ERR_OUT_OF_BOUNDS;
+            rc = plc_tag_set_bit(id, 0, 1);
         }
     }
 
     rc_dec(tag);
 
-    return res;
+    return rc;
 }
 
 
 
-LIB_EXPORT uint64_t plc_tag_get_uint64(int32_t id, int offset)
+
+
+LIB_EXPORT int8_t plc_tag_get_int8(int32_t id, int offset)
 {
-    uint64_t res = UINT64_MAX;
+    int8_t res = INT8_MIN;
     plc_tag_p tag = lookup_tag(id);
 
     pdebug(DEBUG_SPEW, "Starting.");
@@ -1821,16 +7265,8 @@ LIB_EXPORT uint64_t plc_tag_get_uint64(int32_t id, int offset)
 
     if(!tag->is_bit) {
         critical_block(tag->api_mutex) {
-            if((offset >= 0) && (offset + ((int)sizeof(uint64_t)) <= tag->size)) {
-                res =   ((uint64_t)(tag->data[offset + tag->byte_order->int64_order[0]]) << 0 ) +
-                        ((uint64_t)(tag->data[offset + tag->byte_order->int64_order[1]]) << 8 ) +
-                        ((uint64_t)(tag->data[offset + tag->byte_order->int64_order[2]]) << 16) +
-                        ((uint64_t)(tag->data[offset + tag->byte_order->int64_order[3]]) << 24) +
-                        ((uint64_t)(tag->data[offset + tag->byte_order->int64_order[4]]) << 32) +
-                        ((uint64_t)(tag->data[offset + tag->byte_order->int64_order[5]]) << 40) +
-                        ((uint64_t)(tag->data[offset + tag->byte_order->int64_order[6]]) << 48) +
-                        ((uint64_t)(tag->data[offset + tag->byte_order->int64_order[7]]) << 56);
-
+            if((offset >= 0) && (offset + ((int)sizeof(uint8_t)) <= tag->size)) {
+                res =   (int8_t)tag->data[offset];
                 tag->status = PLCTAG_STATUS_OK;
             } else {
                 pdebug(DEBUG_WARN, "Data offset out of bounds!");
@@ -1842,7 +7278,7 @@ LIB_EXPORT uint64_t plc_tag_get_uint64(int32_t id, int offset)
 
         /* make sure the response is good. */
         if(rc >= 0) {
-            res = (unsigned int)rc;
+            res = (int8_t)(unsigned int)rc;
         }
     }
 
@@ -1853,10 +7289,12 @@ LIB_EXPORT uint64_t plc_tag_get_uint64(int32_t id, int offset)
 
 
 
-LIB_EXPORT int plc_tag_set_uint64(int32_t id, int offset, uint64_t val)
+
+LIB_EXPORT int plc_tag_set_int8(int32_t id, int offset, int8_t ival)
 {
     int rc = PLCTAG_STATUS_OK;
     plc_tag_p tag = lookup_tag(id);
+    uint8_t val = (uint8_t)ival;
 
     pdebug(DEBUG_SPEW, "Starting.");
 
@@ -1875,19 +7313,18 @@ LIB_EXPORT int plc_tag_set_uint64(int32_t id, int offset, uint64_t val)
 
     if(!tag->is_bit) {
         critical_block(tag->api_mutex) {
-            if((offset >= 0) && (offset + ((int)sizeof(uint64_t)) <= tag->size)) {
+            if((offset >= 0) && (offset + ((int)sizeof(int8_t)) <= tag->size)) {
                 if(tag->auto_sync_write_ms > 0) {
-                    tag->tag_is_dirty = 1;
+                    tag_set_dirty_unsafe(tag);
                 }
 
-                tag->data[offset + tag->byte_order->int64_order[0]] = (uint8_t)((val >> 0 ) & 0xFF);
-                tag->data[offset + tag->byte_order->int64_order[1]] = (uint8_t)((val >> 8 ) & 0xFF);
-                tag->data[offset + tag->byte_order->int64_order[2]] = (uint8_t)((val >> 16) & 0xFF);
-                tag->data[offset + tag->byte_order->int64_order[3]] = (uint8_t)((val >> 24) & 0xFF);
-                tag->data[offset + tag->byte_order->int64_order[4]] = (uint8_t)((val >> 32) & 0xFF);
-                tag->data[offset + tag->byte_order->int64_order[5]] = (uint8_t)((val >> 40) & 0xFF);
-                tag->data[offset + tag->byte_order->int64_order[6]] = (uint8_t)((val >> 48) & 0xFF);
-                tag->data[offset + tag->byte_order->int64_order[7]] = (uint8_t)((val >> 56) & 0xFF);
+                tag_add_dirty_range_unsafe(tag, offset, (int)sizeof(int8_t));
+
+                plc_tag_generic_data_write_begin(tag);
+
+                tag->data[offset] = val;
+
+                plc_tag_generic_data_write_end(tag);
 
                 tag->status = PLCTAG_STATUS_OK;
             } else {
@@ -1912,9 +7349,13 @@ LIB_EXPORT int plc_tag_set_uint64(int32_t id, int offset, uint64_t val)
 
 
 
-LIB_EXPORT int64_t plc_tag_get_int64(int32_t id, int offset)
+
+
+LIB_EXPORT double plc_tag_get_float64(int32_t id, int offset)
 {
-    int64_t res = INT64_MIN;
+    double res = DBL_MIN;
+    int rc = PLCTAG_STATUS_OK;
+    uint64_t ures = 0;
     plc_tag_p tag = lookup_tag(id);
 
     pdebug(DEBUG_SPEW, "Starting.");
@@ -1932,33 +7373,32 @@ LIB_EXPORT int64_t plc_tag_get_int64(int32_t id, int offset)
         return res;
     }
 
-    if(!tag->is_bit) {
-        critical_block(tag->api_mutex) {
-            if((offset >= 0) && (offset + ((int)sizeof(int64_t)) <= tag->size)) {
-                res = (int64_t)(((uint64_t)(tag->data[offset + tag->byte_order->int64_order[0]]) << 0 ) +
-                                ((uint64_t)(tag->data[offset + tag->byte_order->int64_order[1]]) << 8 ) +
-                                ((uint64_t)(tag->data[offset + tag->byte_order->int64_order[2]]) << 16) +
-                                ((uint64_t)(tag->data[offset + tag->byte_order->int64_order[3]]) << 24) +
-                                ((uint64_t)(tag->data[offset + tag->byte_order->int64_order[4]]) << 32) +
-                                ((uint64_t)(tag->data[offset + tag->byte_order->int64_order[5]]) << 40) +
-                                ((uint64_t)(tag->data[offset + tag->byte_order->int64_order[6]]) << 48) +
-                                ((uint64_t)(tag->data[offset + tag->byte_order->int64_order[7]]) << 56));
+    if(tag->is_bit) {
+        pdebug(DEBUG_WARN, "Getting float64 value is unsupported on a bit tag!");
+        tag->status = PLCTAG_ERR_UNSUPPORTED;
+        return res;
+    }
 
-                tag->status = PLCTAG_STATUS_OK;
-            } else {
-                pdebug(DEBUG_WARN, "Data offset out of bounds!");
-                tag->status = PLCTAG_ERR_OUT_OF_BOUNDS;
-            }
-        }
-    } else {
-        int rc = plc_tag_get_bit(id, tag->bit);
+    critical_block(tag->api_mutex) {
+        if((offset >= 0) && (offset + ((int)sizeof(double)) <= tag->size)) {
+            ures = tag_load_float64(tag, offset);
 
-        /* make sure the response is good. */
-        if(rc >= 0) {
-            res = rc;
+            tag->status = PLCTAG_STATUS_OK;
+            rc = PLCTAG_STATUS_OK;
+        } else {
+            pdebug(DEBUG_WARN, "Data offset out of bounds!");
+            tag->status = PLCTAG_ERR_OUT_OF_BOUNDS;
+            rc = PLCTAG_ERR_OUT_OF_BOUNDS;
         }
     }
 
+    if(rc == PLCTAG_STATUS_OK) {
+        /* copy the data */
+        mem_copy(&res,&ures,sizeof(res));
+    } else {
+        res = DBL_MIN;
+    }
+
     rc_dec(tag);
 
     return res;
@@ -1966,11 +7406,12 @@ LIB_EXPORT int64_t plc_tag_get_int64(int32_t id, int offset)
 
 
 
-LIB_EXPORT int plc_tag_set_int64(int32_t id, int offset, int64_t ival)
+
+LIB_EXPORT int plc_tag_set_float64(int32_t id, int offset, double fval)
 {
     int rc = PLCTAG_STATUS_OK;
     plc_tag_p tag = lookup_tag(id);
-    uint64_t val = (uint64_t)(ival);
+    uint64_t val = 0;
 
     pdebug(DEBUG_SPEW, "Starting.");
 
@@ -1987,34 +7428,34 @@ LIB_EXPORT int plc_tag_set_int64(int32_t id, int offset, int64_t ival)
         return PLCTAG_ERR_NO_DATA;
     }
 
-    if(!tag->is_bit) {
-        critical_block(tag->api_mutex) {
-            if((offset >= 0) && (offset + ((int)sizeof(int64_t)) <= tag->size)) {
-                if(tag->auto_sync_write_ms > 0) {
-                    tag->tag_is_dirty = 1;
-                }
+    if(tag->is_bit) {
+        pdebug(DEBUG_WARN, "Setting float64 value is unsupported on a bit tag!");
+        tag->status = PLCTAG_ERR_UNSUPPORTED;
+        return PLCTAG_ERR_UNSUPPORTED;
+    }
 
-                tag->data[offset + tag->byte_order->int64_order[0]] = (uint8_t)((val >> 0 ) & 0xFF);
-                tag->data[offset + tag->byte_order->int64_order[1]] = (uint8_t)((val >> 8 ) & 0xFF);
-                tag->data[offset + tag->byte_order->int64_order[2]] = (uint8_t)((val >> 16) & 0xFF);
-                tag->data[offset + tag->byte_order->int64_order[3]] = (uint8_t)((val >> 24) & 0xFF);
-                tag->data[offset + tag->byte_order->int64_order[4]] = (uint8_t)((val >> 32) & 0xFF);
-                tag->data[offset + tag->byte_order->int64_order[5]] = (uint8_t)((val >> 40) & 0xFF);
-                tag->data[offset + tag->byte_order->int64_order[6]] = (uint8_t)((val >> 48) & 0xFF);
-                tag->data[offset + tag->byte_order->int64_order[7]] = (uint8_t)((val >> 56) & 0xFF);
+    /* copy the data into the uint64 value */
+    mem_copy(&val, &fval, sizeof(val));
 
-                tag->status = PLCTAG_STATUS_OK;
-            } else {
-                pdebug(DEBUG_WARN, "Data offset out of bounds!");
-                tag->status = PLCTAG_ERR_OUT_OF_BOUNDS;
-                rc = PLCTAG_ERR_OUT_OF_BOUNDS;
+    critical_block(tag->api_mutex) {
+        if((offset >= 0) && (offset + ((int)sizeof(uint64_t)) <= tag->size)) {
+            if(tag->auto_sync_write_ms > 0) {
+                tag_set_dirty_unsafe(tag);
             }
-        }
-    } else {
-        if(!val) {
-            rc = plc_tag_set_bit(id, 0, 0);
+
+            tag_add_dirty_range_unsafe(tag, offset, (int)sizeof(uint64_t));
+
+            plc_tag_generic_data_write_begin(tag);
+
+            tag_store_float64(tag, offset, val);
+
+            plc_tag_generic_data_write_end(tag);
+
+            tag->status = PLCTAG_STATUS_OK;
         } else {
-            rc = plc_tag_set_bit(id, 0, 1);
+            pdebug(DEBUG_WARN, "Data offset out of bounds!");
+            tag->status = PLCTAG_ERR_OUT_OF_BOUNDS;
+            rc = PLCTAG_ERR_OUT_OF_BOUNDS;
         }
     }
 
@@ -2023,9 +7464,13 @@ LIB_EXPORT int plc_tag_set_int64(int32_t id, int offset, int64_t ival)
     return rc;
 }
 
-LIB_EXPORT uint32_t plc_tag_get_uint32(int32_t id, int offset)
+
+
+LIB_EXPORT float plc_tag_get_float32(int32_t id, int offset)
 {
-    uint32_t res = UINT32_MAX;
+    float res = FLT_MIN;
+    int rc = PLCTAG_STATUS_OK;
+    uint32_t ures = 0;
     plc_tag_p tag = lookup_tag(id);
 
     pdebug(DEBUG_SPEW, "Starting.");
@@ -2043,40 +7488,103 @@ LIB_EXPORT uint32_t plc_tag_get_uint32(int32_t id, int offset)
         return res;
     }
 
-    if(!tag->is_bit) {
-        critical_block(tag->api_mutex) {
-            if((offset >= 0) && (offset + ((int)sizeof(uint32_t)) <= tag->size)) {
-                res =   ((uint32_t)(tag->data[offset + tag->byte_order->int32_order[0]]) << 0 ) +
-                        ((uint32_t)(tag->data[offset + tag->byte_order->int32_order[1]]) << 8 ) +
-                        ((uint32_t)(tag->data[offset + tag->byte_order->int32_order[2]]) << 16) +
-                        ((uint32_t)(tag->data[offset + tag->byte_order->int32_order[3]]) << 24);
+    if(tag->is_bit) {
+        pdebug(DEBUG_WARN, "Getting float32 value is unsupported on a bit tag!");
+        tag->status = PLCTAG_ERR_UNSUPPORTED;
+        return res;
+    }
 
-                tag->status = PLCTAG_STATUS_OK;
-            } else {
-                pdebug(DEBUG_WARN, "Data offset out of bounds!");
-                tag->status = PLCTAG_ERR_OUT_OF_BOUNDS;
-            }
+    critical_block(tag->api_mutex) {
+        if((offset >= 0) && (offset + ((int)sizeof(float)) <= tag->size)) {
+            ures = tag_load_float32(tag, offset);
+
+            tag->status = PLCTAG_STATUS_OK;
+            rc = PLCTAG_STATUS_OK;
+        } else {
+            pdebug(DEBUG_WARN, "Data offset out of bounds!");
+            tag->status = PLCTAG_ERR_OUT_OF_BOUNDS;
+            rc = PLCTAG_ERR_OUT_OF_BOUNDS;
         }
+    }
+
+    if(rc == PLCTAG_STATUS_OK) {
+        /* copy the data */
+        mem_copy(&res,&ures,sizeof(res));
     } else {
-        int rc = plc_tag_get_bit(id, tag->bit);
+        res = FLT_MIN;
+    }
 
-        /* make sure the response is good. */
-        if(rc >= 0) {
-            res = (unsigned int)rc;
+    rc_dec(tag);
+
+    return res;
+}
+
+
+
+
+LIB_EXPORT int plc_tag_set_float32(int32_t id, int offset, float fval)
+{
+    int rc = PLCTAG_STATUS_OK;
+    plc_tag_p tag = lookup_tag(id);
+    uint32_t val = 0;
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    if(!tag) {
+        pdebug(DEBUG_WARN,"Tag not found.");
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    /* is there data? */
+    if(!tag->data) {
+        rc_dec(tag);
+        pdebug(DEBUG_WARN,"Tag has no data!");
+        tag->status = PLCTAG_ERR_NO_DATA;
+        return PLCTAG_ERR_NO_DATA;
+    }
+
+    if(tag->is_bit) {
+        pdebug(DEBUG_WARN, "Setting float32 value is unsupported on a bit tag!");
+        tag->status = PLCTAG_ERR_UNSUPPORTED;
+        return PLCTAG_ERR_UNSUPPORTED;
+    }
+
+    /* copy the data into the uint64 value */
+    mem_copy(&val, &fval, sizeof(val));
+
+    critical_block(tag->api_mutex) {
+        if((offset >= 0) && (offset + ((int)sizeof(float)) <= tag->size)) {
+            if(tag->auto_sync_write_ms > 0) {
+                tag_set_dirty_unsafe(tag);
+            }
+
+            tag_add_dirty_range_unsafe(tag, offset, (int)sizeof(float));
+
+            plc_tag_generic_data_write_begin(tag);
+
+            tag_store_float32(tag, offset, val);
+
+            plc_tag_generic_data_write_end(tag);
+
+            tag->status = PLCTAG_STATUS_OK;
+        } else {
+            pdebug(DEBUG_WARN, "Data offset out of bounds!");
+            tag->status = PLCTAG_ERR_OUT_OF_BOUNDS;
+            rc = PLCTAG_ERR_OUT_OF_BOUNDS;
         }
     }
 
     rc_dec(tag);
 
-    return res;
+    return rc;
 }
 
 
-
-LIB_EXPORT int plc_tag_set_uint32(int32_t id, int offset, uint32_t val)
+LIB_EXPORT int plc_tag_get_string(int32_t tag_id, int string_start_offset, char *buffer, int buffer_length)
 {
     int rc = PLCTAG_STATUS_OK;
-    plc_tag_p tag = lookup_tag(id);
+    plc_tag_p tag = lookup_tag(tag_id);
+    int max_len = 0;
 
     pdebug(DEBUG_SPEW, "Starting.");
 
@@ -2085,6 +7593,14 @@ LIB_EXPORT int plc_tag_set_uint32(int32_t id, int offset, uint32_t val)
         return PLCTAG_ERR_NOT_FOUND;
     }
 
+    /* are strings defined for this tag? */
+    if(!tag->byte_order || !tag->byte_order->str_is_defined) {
+        rc_dec(tag);
+        pdebug(DEBUG_WARN,"Tag has no definitions for strings!");
+        tag->status = PLCTAG_ERR_UNSUPPORTED;
+        return PLCTAG_ERR_UNSUPPORTED;
+    }
+
     /* is there data? */
     if(!tag->data) {
         rc_dec(tag);
@@ -2093,51 +7609,63 @@ LIB_EXPORT int plc_tag_set_uint32(int32_t id, int offset, uint32_t val)
         return PLCTAG_ERR_NO_DATA;
     }
 
-    if(!tag->is_bit) {
-        critical_block(tag->api_mutex) {
-            if((offset >= 0) && (offset + ((int)sizeof(uint32_t)) <= tag->size)) {
-                if(tag->auto_sync_write_ms > 0) {
-                    tag->tag_is_dirty = 1;
-                }
+    if(tag->is_bit) {
+        rc_dec(tag);
+        pdebug(DEBUG_WARN, "Getting a string value from a bit tag is not supported!");
+        return PLCTAG_ERR_UNSUPPORTED;
+    }
 
-                tag->data[offset + tag->byte_order->int32_order[0]] = (uint8_t)((val >> 0 ) & 0xFF);
-                tag->data[offset + tag->byte_order->int32_order[1]] = (uint8_t)((val >> 8 ) & 0xFF);
-                tag->data[offset + tag->byte_order->int32_order[2]] = (uint8_t)((val >> 16) & 0xFF);
-                tag->data[offset + tag->byte_order->int32_order[3]] = (uint8_t)((val >> 24) & 0xFF);
+    /* set all buffer bytes to zero. */
+    mem_set(buffer, 0, buffer_length);
 
-                tag->status = PLCTAG_STATUS_OK;
-            } else {
-                pdebug(DEBUG_WARN, "Data offset out of bounds!");
-                tag->status = PLCTAG_ERR_OUT_OF_BOUNDS;
-                rc = PLCTAG_ERR_OUT_OF_BOUNDS;
-            }
+    critical_block(tag->api_mutex) {
+        int string_length = get_string_length_unsafe(tag, string_start_offset);
+
+        /* determine the maximum number of characters/bytes to copy. */
+        if(buffer_length < string_length) {
+            pdebug(DEBUG_WARN, "Buffer length, %d, is less than the string length, %d!", buffer_length, string_length);
+            max_len = buffer_length;
+        } else {
+            max_len = string_length;
         }
-    } else {
-        if(!val) {
-            rc = plc_tag_set_bit(id, 0, 0);
+
+        /* check the amount of space. */
+        if(string_start_offset + (int)tag->byte_order->str_count_word_bytes + max_len <= tag->size) {
+            for(int i = 0; i < max_len; i++) {
+                size_t char_index = (((size_t)(unsigned int)i) ^ (tag->byte_order->str_is_byte_swapped)) /* byte swap if necessary */
+                                  + (size_t)(unsigned int)string_start_offset
+                                  + (size_t)(unsigned int)(tag->byte_order->str_count_word_bytes);
+                buffer[i] = (char)tag->data[char_index];
+            }
+
+            tag->status = PLCTAG_STATUS_OK;
+            rc = PLCTAG_STATUS_OK;
         } else {
-            rc = plc_tag_set_bit(id, 0, 1);
+            pdebug(DEBUG_WARN, "Data offset out of bounds!");
+            tag->status = PLCTAG_ERR_OUT_OF_BOUNDS;
+            rc = PLCTAG_ERR_OUT_OF_BOUNDS;
         }
     }
 
     rc_dec(tag);
 
+    pdebug(DEBUG_SPEW, "Done.");
+
     return rc;
 }
 
 
-
-
-LIB_EXPORT int32_t  plc_tag_get_int32(int32_t id, int offset)
+LIB_EXPORT int plc_tag_set_string(int32_t tag_id, int string_start_offset, const char *string_val)
 {
-    int32_t res = INT32_MIN;
-    plc_tag_p tag = lookup_tag(id);
+    int rc = PLCTAG_STATUS_OK;
+    plc_tag_p tag = lookup_tag(tag_id);
+    int string_length = 0;
 
     pdebug(DEBUG_SPEW, "Starting.");
 
     if(!tag) {
         pdebug(DEBUG_WARN,"Tag not found.");
-        return res;
+        return PLCTAG_ERR_NOT_FOUND;
     }
 
     /* is there data? */
@@ -2145,44 +7673,133 @@ LIB_EXPORT int32_t  plc_tag_get_int32(int32_t id, int offset)
         rc_dec(tag);
         pdebug(DEBUG_WARN,"Tag has no data!");
         tag->status = PLCTAG_ERR_NO_DATA;
-        return res;
+        return PLCTAG_ERR_NO_DATA;
     }
 
-    if(!tag->is_bit) {
-        critical_block(tag->api_mutex) {
-            if((offset >= 0) && (offset + ((int)sizeof(int32_t)) <= tag->size)) {
-                res = (int32_t)(((uint32_t)(tag->data[offset + tag->byte_order->int32_order[0]]) << 0 ) +
-                                ((uint32_t)(tag->data[offset + tag->byte_order->int32_order[1]]) << 8 ) +
-                                ((uint32_t)(tag->data[offset + tag->byte_order->int32_order[2]]) << 16) +
-                                ((uint32_t)(tag->data[offset + tag->byte_order->int32_order[3]]) << 24));
+    /* are strings defined for this tag? */
+    if(!tag->byte_order || !tag->byte_order->str_is_defined) {
+        rc_dec(tag);
+        pdebug(DEBUG_WARN,"Tag has no definitions for strings!");
+        tag->status = PLCTAG_ERR_UNSUPPORTED;
+        return PLCTAG_ERR_UNSUPPORTED;
+    }
 
-                tag->status = PLCTAG_STATUS_OK;
-            }  else {
-                pdebug(DEBUG_WARN, "Data offset out of bounds!");
-                tag->status = PLCTAG_ERR_OUT_OF_BOUNDS;
-            }
-        }
-    } else {
-        int rc = plc_tag_get_bit(id, tag->bit);
+    if(!string_val) {
+        rc_dec(tag);
+        pdebug(DEBUG_WARN, "New string value pointer is null!");
+        tag->status = PLCTAG_ERR_NULL_PTR;
+        return PLCTAG_ERR_NULL_PTR;
+    }
 
-        /* make sure the response is good. */
-        if(rc >= 0) {
-            res = (int32_t)rc;
+    /* note that passing a zero-length string is valid. */
+
+    if(tag->is_bit) {
+        rc_dec(tag);
+        pdebug(DEBUG_WARN, "Setting a string value on a bit tag is not supported!");
+        tag->status = PLCTAG_ERR_UNSUPPORTED;
+        return PLCTAG_ERR_UNSUPPORTED;
+    }
+
+    string_length = str_length(string_val);
+
+    critical_block(tag->api_mutex) {
+        int string_capacity = (tag->byte_order->str_max_capacity ? (int)(tag->byte_order->str_max_capacity) : get_string_length_unsafe(tag, string_start_offset));
+
+        /* determine the maximum number of characters/bytes to copy. */
+        if(string_capacity >= string_length) {
+            /* is there sufficient room in the tag? */
+            if(string_start_offset + (int)(tag->byte_order->str_count_word_bytes) + string_length + (tag->byte_order->str_is_zero_terminated ? 1 : 0) <= tag->size) {
+                /* set the status, we might change it below. */
+                rc = PLCTAG_STATUS_OK;
+                tag->status = (int8_t)rc;
+
+                plc_tag_generic_data_write_begin(tag);
+
+                /* copy the string data into the tag. */
+                for(int i = 0; i < string_length; i++) {
+                    size_t char_index = (((size_t)(unsigned int)i) ^ (tag->byte_order->str_is_byte_swapped)) /* byte swap if necessary */
+                                    + (size_t)(unsigned int)string_start_offset
+                                    + (size_t)(unsigned int)(tag->byte_order->str_count_word_bytes);
+                    tag->data[char_index] = (uint8_t)string_val[i];
+                }
+
+                /* zero pad the rest. */
+                for(int i = string_length; i < string_capacity; i++) {
+                    size_t char_index = (((size_t)(unsigned int)i) ^ (tag->byte_order->str_is_byte_swapped)) /* byte swap if necessary */
+                                    + (size_t)(unsigned int)string_start_offset
+                                    + (size_t)(unsigned int)(tag->byte_order->str_count_word_bytes);
+                    tag->data[char_index] = (uint8_t)0;
+                }
+
+                /* if the string is counted, set the length */
+                if(tag->byte_order->str_is_counted) {
+                    switch(tag->byte_order->str_count_word_bytes) {
+                        case 1:
+                            tag->data[string_start_offset] = (uint8_t)(unsigned int)string_length;
+                            break;
+
+                        case 2:
+                            tag->data[string_start_offset + tag->byte_order->int16_order[0]] = (uint8_t)((((unsigned int)string_length) >> 0 ) & 0xFF);
+                            tag->data[string_start_offset + tag->byte_order->int16_order[1]] = (uint8_t)((((unsigned int)string_length) >> 8 ) & 0xFF);
+                            break;
+
+                        case 4:
+                            tag->data[string_start_offset + tag->byte_order->int32_order[0]] = (uint8_t)((((unsigned int)string_length) >> 0 ) & 0xFF);
+                            tag->data[string_start_offset + tag->byte_order->int32_order[1]] = (uint8_t)((((unsigned int)string_length) >> 8 ) & 0xFF);
+                            tag->data[string_start_offset + tag->byte_order->int32_order[2]] = (uint8_t)((((unsigned int)string_length) >> 16) & 0xFF);
+                            tag->data[string_start_offset + tag->byte_order->int32_order[3]] = (uint8_t)((((unsigned int)string_length) >> 24) & 0xFF);
+                            break;
+
+                        default:
+                            pdebug(DEBUG_WARN, "Unsupported string count size, %d!", tag->byte_order->str_count_word_bytes);
+                            rc = PLCTAG_ERR_UNSUPPORTED;
+                            tag->status = (int8_t)rc;
+                            break;
+                    }
+                }
+
+                plc_tag_generic_data_write_end(tag);
+
+                if(rc == PLCTAG_STATUS_OK) {
+                    /* the padding may be byte swapped, so take one more byte. */
+                    int string_bytes = (int)(tag->byte_order->str_count_word_bytes) + string_capacity + 1;
+
+                    if(string_bytes > tag->size - string_start_offset) {
+                        string_bytes = tag->size - string_start_offset;
+                    }
+
+                    tag_add_dirty_range_unsafe(tag, string_start_offset, string_bytes);
+                }
+
+                if(rc == PLCTAG_STATUS_OK && tag->auto_sync_write_ms > 0) {
+                    tag_set_dirty_unsafe(tag);
+                }
+            } else {
+                pdebug(DEBUG_WARN, "Writing the full string would go out of bounds in the tag buffer!");
+                rc = PLCTAG_ERR_OUT_OF_BOUNDS;
+                tag->status = (int8_t)rc;
+            }
+        } else {
+            pdebug(DEBUG_WARN, "String capacity, %d, is less than the string length, %d!", string_capacity, string_length);
+            rc = PLCTAG_ERR_TOO_LARGE;
+            tag->status = (int8_t)rc;
         }
     }
 
     rc_dec(tag);
 
-    return res;
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return rc;
 }
 
 
 
-LIB_EXPORT int plc_tag_set_int32(int32_t id, int offset, int32_t ival)
+
+LIB_EXPORT int plc_tag_get_string_capacity(int32_t id, int string_start_offset)
 {
-    int rc = PLCTAG_STATUS_OK;
+    int string_capacity = 0;
     plc_tag_p tag = lookup_tag(id);
-    uint32_t val = (uint32_t)ival;
 
     pdebug(DEBUG_SPEW, "Starting.");
 
@@ -2191,6 +7808,14 @@ LIB_EXPORT int plc_tag_set_int32(int32_t id, int offset, int32_t ival)
         return PLCTAG_ERR_NOT_FOUND;
     }
 
+    /* are strings defined for this tag? */
+    if(!tag->byte_order || !tag->byte_order->str_is_defined) {
+        rc_dec(tag);
+        pdebug(DEBUG_WARN,"Tag has no definitions for strings!");
+        tag->status = PLCTAG_ERR_UNSUPPORTED;
+        return PLCTAG_ERR_UNSUPPORTED;
+    }
+
     /* is there data? */
     if(!tag->data) {
         rc_dec(tag);
@@ -2199,54 +7824,44 @@ LIB_EXPORT int plc_tag_set_int32(int32_t id, int offset, int32_t ival)
         return PLCTAG_ERR_NO_DATA;
     }
 
-    if(!tag->is_bit) {
-        critical_block(tag->api_mutex) {
-            if((offset >= 0) && (offset + ((int)sizeof(int32_t)) <= tag->size)) {
-                if(tag->auto_sync_write_ms > 0) {
-                    tag->tag_is_dirty = 1;
-                }
-
-                tag->data[offset + tag->byte_order->int32_order[0]] = (uint8_t)((val >> 0 ) & 0xFF);
-                tag->data[offset + tag->byte_order->int32_order[1]] = (uint8_t)((val >> 8 ) & 0xFF);
-                tag->data[offset + tag->byte_order->int32_order[2]] = (uint8_t)((val >> 16) & 0xFF);
-                tag->data[offset + tag->byte_order->int32_order[3]] = (uint8_t)((val >> 24) & 0xFF);
+    if(tag->is_bit) {
+        rc_dec(tag);
+        pdebug(DEBUG_WARN, "Getting string capacity from a bit tag is not supported!");
+        tag->status = PLCTAG_ERR_UNSUPPORTED;
+        return PLCTAG_ERR_UNSUPPORTED;
+    }
 
-                tag->status = PLCTAG_STATUS_OK;
-            } else {
-                pdebug(DEBUG_WARN, "Data offset out of bounds!");
-                tag->status = PLCTAG_ERR_OUT_OF_BOUNDS;
-                rc = PLCTAG_ERR_OUT_OF_BOUNDS;
-            }
-        }
-    } else {
-        if(!val) {
-            rc = plc_tag_set_bit(id, 0, 0);
-        } else {
-            rc = plc_tag_set_bit(id, 0, 1);
-        }
+    critical_block(tag->api_mutex) {
+        string_capacity = (tag->byte_order->str_max_capacity ? (int)(tag->byte_order->str_max_capacity) : get_string_length_unsafe(tag, string_start_offset));
     }
 
     rc_dec(tag);
 
-    return rc;
-}
-
-
-
+    pdebug(DEBUG_SPEW, "Done.");
 
+    return string_capacity;
+}
 
 
 
-LIB_EXPORT uint16_t plc_tag_get_uint16(int32_t id, int offset)
+LIB_EXPORT int plc_tag_get_string_length(int32_t id, int string_start_offset)
 {
-    uint16_t res = UINT16_MAX;
+    int string_length = 0;
     plc_tag_p tag = lookup_tag(id);
 
     pdebug(DEBUG_SPEW, "Starting.");
 
     if(!tag) {
         pdebug(DEBUG_WARN,"Tag not found.");
-        return res;
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    /* are strings defined for this tag? */
+    if(!tag->byte_order || !tag->byte_order->str_is_defined) {
+        rc_dec(tag);
+        pdebug(DEBUG_WARN,"Tag has no definitions for strings!");
+        tag->status = PLCTAG_ERR_UNSUPPORTED;
+        return PLCTAG_ERR_UNSUPPORTED;
     }
 
     /* is there data? */
@@ -2254,41 +7869,33 @@ LIB_EXPORT uint16_t plc_tag_get_uint16(int32_t id, int offset)
         rc_dec(tag);
         pdebug(DEBUG_WARN,"Tag has no data!");
         tag->status = PLCTAG_ERR_NO_DATA;
-        return res;
+        return PLCTAG_ERR_NO_DATA;
     }
 
-    if(!tag->is_bit) {
-        critical_block(tag->api_mutex) {
-            if((offset >= 0) && (offset + ((int)sizeof(uint16_t)) <= tag->size)) {
-                res =   (uint16_t)(((uint16_t)(tag->data[offset + tag->byte_order->int16_order[0]]) << 0 ) +
-                                   ((uint16_t)(tag->data[offset + tag->byte_order->int16_order[1]]) << 8 ));
-
-                tag->status = PLCTAG_STATUS_OK;
-            } else {
-                pdebug(DEBUG_WARN, "Data offset out of bounds!");
-                tag->status = PLCTAG_ERR_OUT_OF_BOUNDS;
-            }
-        }
-    } else {
-        int rc = plc_tag_get_bit(id, tag->bit);
+    if(tag->is_bit) {
+        rc_dec(tag);
+        pdebug(DEBUG_WARN, "Getting string length from a bit tag is not supported!");
+        tag->status = PLCTAG_ERR_UNSUPPORTED;
+        return PLCTAG_ERR_UNSUPPORTED;
+    }
 
-        /* make sure the response is good. */
-        if(rc >= 0) {
-            res = (uint16_t)(unsigned int)rc;
-        }
+    critical_block(tag->api_mutex) {
+        string_length = get_string_length_unsafe(tag, string_start_offset);
     }
 
     rc_dec(tag);
 
-    return res;
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return string_length;
 }
 
 
 
 
-LIB_EXPORT int plc_tag_set_uint16(int32_t id, int offset, uint16_t val)
+LIB_EXPORT int plc_tag_get_string_total_length(int32_t id, int string_start_offset)
 {
-    int rc = PLCTAG_STATUS_OK;
+    int total_length = 0;
     plc_tag_p tag = lookup_tag(id);
 
     pdebug(DEBUG_SPEW, "Starting.");
@@ -2298,6 +7905,14 @@ LIB_EXPORT int plc_tag_set_uint16(int32_t id, int offset, uint16_t val)
         return PLCTAG_ERR_NOT_FOUND;
     }
 
+    /* are strings defined for this tag? */
+    if(!tag->byte_order || !tag->byte_order->str_is_defined) {
+        rc_dec(tag);
+        pdebug(DEBUG_WARN,"Tag has no definitions for strings!");
+        tag->status = PLCTAG_ERR_UNSUPPORTED;
+        return PLCTAG_ERR_UNSUPPORTED;
+    }
+
     /* is there data? */
     if(!tag->data) {
         rc_dec(tag);
@@ -2306,97 +7921,149 @@ LIB_EXPORT int plc_tag_set_uint16(int32_t id, int offset, uint16_t val)
         return PLCTAG_ERR_NO_DATA;
     }
 
-    if(!tag->is_bit) {
-        critical_block(tag->api_mutex) {
-            if((offset >= 0) && (offset + ((int)sizeof(uint16_t)) <= tag->size)) {
-                if(tag->auto_sync_write_ms > 0) {
-                    tag->tag_is_dirty = 1;
-                }
-
-                tag->data[offset + tag->byte_order->int16_order[0]] = (uint8_t)((val >> 0 ) & 0xFF);
-                tag->data[offset + tag->byte_order->int16_order[1]] = (uint8_t)((val >> 8 ) & 0xFF);
+    if(tag->is_bit) {
+        rc_dec(tag);
+        pdebug(DEBUG_WARN, "Getting a string total length from a bit tag is not supported!");
+        tag->status = PLCTAG_ERR_UNSUPPORTED;
+        return PLCTAG_ERR_UNSUPPORTED;
+    }
 
-                tag->status = PLCTAG_STATUS_OK;
-            } else {
-                pdebug(DEBUG_WARN, "Data offset out of bounds!");
-                tag->status = PLCTAG_ERR_OUT_OF_BOUNDS;
-                rc = PLCTAG_ERR_OUT_OF_BOUNDS;
-            }
-        }
-    } else {
-        if(!val) {
-            rc = plc_tag_set_bit(id, 0, 0);
-        } else {
-            rc = plc_tag_set_bit(id, 0, 1);
-        }
+    critical_block(tag->api_mutex) {
+        total_length = (int)(tag->byte_order->str_count_word_bytes)
+                     + (tag->byte_order->str_is_fixed_length ? (int)(tag->byte_order->str_max_capacity) : get_string_length_unsafe(tag, string_start_offset))
+                     + (tag->byte_order->str_is_zero_terminated ? (int)1 : (int)0)
+                     + (int)(tag->byte_order->str_pad_bytes);
     }
 
     rc_dec(tag);
 
-    return rc;
-}
-
-
-
+    pdebug(DEBUG_SPEW, "Done.");
 
+    return total_length;
+}
 
 
 
 
+/*
+ * plc_tag_get_string_array
+ *
+ * Decode count strings that follow each other from the byte offset in one
+ * call.  Each string is copied into buffer with a terminating zero.  Its
+ * position in buffer goes in str_offsets and its length in str_lengths.
+ * Either table can be NULL.
+ */
 
-LIB_EXPORT int16_t  plc_tag_get_int16(int32_t id, int offset)
+LIB_EXPORT int plc_tag_get_string_array(int32_t id, int offset, int count, char *buffer, int buffer_length, int *str_offsets, int *str_lengths)
 {
-    int16_t res = INT16_MIN;
+    int rc = PLCTAG_STATUS_OK;
     plc_tag_p tag = lookup_tag(id);
 
     pdebug(DEBUG_SPEW, "Starting.");
 
     if(!tag) {
         pdebug(DEBUG_WARN,"Tag not found.");
-        return res;
+        return PLCTAG_ERR_NOT_FOUND;
     }
 
-    /* is there data? */
-    if(!tag->data) {
+    rc = string_array_check(tag, offset, count, buffer);
+    if(rc != PLCTAG_STATUS_OK) {
+        tag->status = (int8_t)rc;
         rc_dec(tag);
-        pdebug(DEBUG_WARN,"Tag has no data!");
-        tag->status = PLCTAG_ERR_NO_DATA;
-        return res;
+        return rc;
     }
 
-    if(!tag->is_bit) {
-        critical_block(tag->api_mutex) {
-            if((offset >= 0) && (offset + ((int)sizeof(int16_t)) <= tag->size)) {
-                res =   (int16_t)(uint16_t)(((uint16_t)(tag->data[offset + tag->byte_order->int16_order[0]]) << 0 ) +
-                                            ((uint16_t)(tag->data[offset + tag->byte_order->int16_order[1]]) << 8 ));
-                tag->status = PLCTAG_STATUS_OK;
+    critical_block(tag->api_mutex) {
+        tag_byte_order_t *byte_order = tag->byte_order;
+        int string_offset = offset;
+        int buffer_offset = 0;
+
+        for(int i=0; i < count; i++) {
+            int char_offset = string_offset + (int)byte_order->str_count_word_bytes;
+            int string_length = 0;
+            uint8_t *src = NULL;
+            char *dest = NULL;
+
+            if(char_offset > tag->size) {
+                pdebug(DEBUG_WARN, "String %d is past the end of the tag data!", i);
+                rc = PLCTAG_ERR_OUT_OF_BOUNDS;
+                break;
+            }
+
+            string_length = get_string_length_unsafe(tag, string_offset);
+
+            /* a swapped string with an odd length uses the byte after it. */
+            if(string_length < 0 || (byte_order->str_max_capacity && string_length > (int)byte_order->str_max_capacity) || char_offset + string_length + (byte_order->str_is_byte_swapped ? (string_length & 0x01) : 0) > tag->size) {
+                pdebug(DEBUG_WARN, "String %d has a bad length, %d!", i, string_length);
+                rc = PLCTAG_ERR_BAD_DATA;
+                break;
+            }
+
+            if(buffer_offset + string_length + 1 > buffer_length) {
+                pdebug(DEBUG_WARN, "Buffer of %d bytes is too small for the strings!", buffer_length);
+                rc = PLCTAG_ERR_TOO_SMALL;
+                break;
+            }
+
+            src = &tag->data[char_offset];
+            dest = &buffer[buffer_offset];
+
+            if(!byte_order->str_is_byte_swapped) {
+                /* Logix and most others. */
+                mem_copy(dest, src, string_length);
             } else {
-                pdebug(DEBUG_WARN, "Data offset out of bounds!");
-                tag->status = PLCTAG_ERR_OUT_OF_BOUNDS;
+                /* PCCC ST swaps each pair of characters. */
+                int j = 0;
+
+                for(j=0; j + 1 < string_length; j += 2) {
+                    dest[j] = (char)src[j + 1];
+                    dest[j + 1] = (char)src[j];
+                }
+
+                if(j < string_length) {
+                    dest[j] = (char)src[j + 1];
+                }
             }
-        }
-    } else {
-        int rc = plc_tag_get_bit(id, tag->bit);
 
-        /* make sure the response is good. */
-        if(rc >= 0) {
-            res = (int16_t)(uint16_t)(unsigned int)rc;
+            dest[string_length] = 0;
+
+            if(str_offsets) {
+                str_offsets[i] = buffer_offset;
+            }
+
+            if(str_lengths) {
+                str_lengths[i] = string_length;
+            }
+
+            buffer_offset += string_length + 1;
+            string_offset += string_array_element_size(byte_order, string_length);
         }
+
+        tag->status = (int8_t)rc;
     }
 
     rc_dec(tag);
 
-    return res;
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return rc;
 }
 
 
 
+/*
+ * plc_tag_set_string_array
+ *
+ * Encode count strings into the tag data from the byte offset in one
+ * call.  String i starts at buffer + str_offsets[i] and has str_lengths[i]
+ * characters.  With a NULL str_lengths the strings must be zero
+ * terminated.  Strings are checked before any data is changed.
+ */
 
-LIB_EXPORT int plc_tag_set_int16(int32_t id, int offset, int16_t ival)
+LIB_EXPORT int plc_tag_set_string_array(int32_t id, int offset, int count, const char *buffer, const int *str_offsets, const int *str_lengths)
 {
     int rc = PLCTAG_STATUS_OK;
     plc_tag_p tag = lookup_tag(id);
-    uint16_t val = (uint16_t)ival;
 
     pdebug(DEBUG_SPEW, "Starting.");
 
@@ -2405,99 +8072,176 @@ LIB_EXPORT int plc_tag_set_int16(int32_t id, int offset, int16_t ival)
         return PLCTAG_ERR_NOT_FOUND;
     }
 
-    /* is there data? */
-    if(!tag->data) {
+    rc = string_array_check(tag, offset, count, buffer);
+    if(rc == PLCTAG_STATUS_OK && !str_offsets) {
+        pdebug(DEBUG_WARN, "The string offset table is null!");
+        rc = PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(rc != PLCTAG_STATUS_OK) {
+        tag->status = (int8_t)rc;
         rc_dec(tag);
-        pdebug(DEBUG_WARN,"Tag has no data!");
-        tag->status = PLCTAG_ERR_NO_DATA;
-        return PLCTAG_ERR_NO_DATA;
+        return rc;
     }
 
-    if(!tag->is_bit) {
-        critical_block(tag->api_mutex) {
-            if((offset >= 0) && (offset + ((int)sizeof(int16_t)) <= tag->size)) {
-                if(tag->auto_sync_write_ms > 0) {
-                    tag->tag_is_dirty = 1;
-                }
+    critical_block(tag->api_mutex) {
+        tag_byte_order_t *byte_order = tag->byte_order;
+        int string_offset = offset;
 
-                tag->data[offset + tag->byte_order->int16_order[0]] = (uint8_t)((val >> 0 ) & 0xFF);
-                tag->data[offset + tag->byte_order->int16_order[1]] = (uint8_t)((val >> 8 ) & 0xFF);
+        /* only fixed size strings can be written in place. */
+        if(!byte_order->str_is_fixed_length || !byte_order->str_max_capacity) {
+            pdebug(DEBUG_WARN, "Only fixed length strings can be set as an array!");
+            rc = PLCTAG_ERR_UNSUPPORTED;
+            break;
+        }
 
-                tag->status = PLCTAG_STATUS_OK;
-            } else {
-                pdebug(DEBUG_WARN, "Data offset out of bounds!");
-                tag->status = PLCTAG_ERR_OUT_OF_BOUNDS;
-                rc = PLCTAG_ERR_OUT_OF_BOUNDS;
+        /* check everything first so that a bad string does not leave a partial update. */
+        for(int i=0; i < count; i++) {
+            int string_length = (str_lengths ? str_lengths[i] : str_length(buffer + str_offsets[i]));
+
+            if(string_length < 0 || string_length > (int)byte_order->str_max_capacity) {
+                pdebug(DEBUG_WARN, "String %d is %d characters, more than the capacity %d!", i, string_length, (int)byte_order->str_max_capacity);
+                rc = PLCTAG_ERR_TOO_LARGE;
+                break;
             }
         }
-    } else {
-        if(!val) {
-            rc = plc_tag_set_bit(id, 0, 0);
-        } else {
-            rc = plc_tag_set_bit(id, 0, 1);
+
+        if(rc == PLCTAG_STATUS_OK && offset + (count * string_array_element_size(byte_order, 0)) > tag->size) {
+            pdebug(DEBUG_WARN, "Writing the strings would go out of bounds in the tag buffer!");
+            rc = PLCTAG_ERR_OUT_OF_BOUNDS;
         }
-    }
 
-    rc_dec(tag);
+        if(rc != PLCTAG_STATUS_OK) {
+            tag->status = (int8_t)rc;
+            break;
+        }
 
-    return rc;
-}
+        plc_tag_generic_data_write_begin(tag);
 
+        for(int i=0; i < count; i++) {
+            const char *src = buffer + str_offsets[i];
+            int string_length = (str_lengths ? str_lengths[i] : str_length(src));
+            int capacity = (int)byte_order->str_max_capacity;
+            uint8_t *dest = &tag->data[string_offset + (int)byte_order->str_count_word_bytes];
 
+            if(!byte_order->str_is_byte_swapped) {
+                mem_copy(dest, (void *)src, string_length);
+                mem_set(dest + string_length, 0, capacity - string_length);
+            } else {
+                /* PCCC ST swaps each pair of characters. */
+                mem_set(dest, 0, capacity);
 
+                for(int j=0; j < string_length; j++) {
+                    dest[j ^ 0x01] = (uint8_t)src[j];
+                }
+            }
 
+            if(byte_order->str_is_counted) {
+                set_string_count_unsafe(tag, string_offset, string_length);
+            }
 
+            string_offset += string_array_element_size(byte_order, 0);
+        }
 
+        plc_tag_generic_data_write_end(tag);
 
+        tag_add_dirty_range_unsafe(tag, offset, string_offset - offset);
 
-LIB_EXPORT uint8_t plc_tag_get_uint8(int32_t id, int offset)
-{
-    uint8_t res = UINT8_MAX;
-    plc_tag_p tag = lookup_tag(id);
+        if(tag->auto_sync_write_ms > 0) {
+            tag_set_dirty_unsafe(tag);
+        }
 
-    pdebug(DEBUG_SPEW, "Starting.");
+        tag->status = PLCTAG_STATUS_OK;
+    }
 
-    if(!tag) {
-        pdebug(DEBUG_WARN,"Tag not found.");
-        return res;
+    rc_dec(tag);
+
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return rc;
+}
+
+
+
+/* the checks shared by the string array calls. */
+int string_array_check(plc_tag_p tag, int offset, int count, const char *buffer)
+{
+    if(!tag->byte_order || !tag->byte_order->str_is_defined) {
+        pdebug(DEBUG_WARN,"Tag has no definitions for strings!");
+        return PLCTAG_ERR_UNSUPPORTED;
     }
 
-    /* is there data? */
     if(!tag->data) {
-        rc_dec(tag);
         pdebug(DEBUG_WARN,"Tag has no data!");
-        tag->status = PLCTAG_ERR_NO_DATA;
-        return res;
+        return PLCTAG_ERR_NO_DATA;
     }
 
-    if(!tag->is_bit) {
-        critical_block(tag->api_mutex) {
-            if((offset >= 0) && (offset + ((int)sizeof(uint8_t)) <= tag->size)) {
-                res = tag->data[offset];
-                tag->status = PLCTAG_STATUS_OK;
-            } else {
-                pdebug(DEBUG_WARN, "Data offset out of bounds!");
-                tag->status = PLCTAG_ERR_OUT_OF_BOUNDS;
-            }
-        }
-    } else {
-        int rc = plc_tag_get_bit(id, tag->bit);
+    if(tag->is_bit) {
+        pdebug(DEBUG_WARN, "String arrays are not supported on bit tags!");
+        return PLCTAG_ERR_UNSUPPORTED;
+    }
 
-        /* make sure the response is good. */
-        if(rc >= 0) {
-            res = (uint8_t)(unsigned int)rc;
-        }
+    if(!buffer) {
+        pdebug(DEBUG_WARN, "The string buffer is null!");
+        return PLCTAG_ERR_NULL_PTR;
     }
 
-    rc_dec(tag);
+    if(offset < 0 || count < 0) {
+        pdebug(DEBUG_WARN, "The offset and count must not be negative!");
+        return PLCTAG_ERR_BAD_PARAM;
+    }
 
-    return res;
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/* the bytes one string takes in the tag data, as plc_tag_get_string_total_length() works it out. */
+int string_array_element_size(tag_byte_order_t *byte_order, int string_length)
+{
+    return (int)(byte_order->str_count_word_bytes)
+         + (byte_order->str_is_fixed_length ? (int)(byte_order->str_max_capacity) : string_length)
+         + (byte_order->str_is_zero_terminated ? (int)1 : (int)0)
+         + (int)(byte_order->str_pad_bytes);
 }
 
 
 
+/*
+ * set the count word of a counted string.
+ *
+ * This must be called with the tag API mutex held!
+ */
+
+void set_string_count_unsafe(plc_tag_p tag, int offset, int string_length)
+{
+    tag_byte_order_t *byte_order = tag->byte_order;
+
+    switch(byte_order->str_count_word_bytes) {
+        case 1:
+            tag->data[offset] = (uint8_t)(unsigned int)string_length;
+            break;
+
+        case 2:
+            tag->data[offset + byte_order->int16_order[0]] = (uint8_t)((((unsigned int)string_length) >> 0 ) & 0xFF);
+            tag->data[offset + byte_order->int16_order[1]] = (uint8_t)((((unsigned int)string_length) >> 8 ) & 0xFF);
+            break;
+
+        case 4:
+            tag->data[offset + byte_order->int32_order[0]] = (uint8_t)((((unsigned int)string_length) >> 0 ) & 0xFF);
+            tag->data[offset + byte_order->int32_order[1]] = (uint8_t)((((unsigned int)string_length) >> 8 ) & 0xFF);
+            tag->data[offset + byte_order->int32_order[2]] = (uint8_t)((((unsigned int)string_length) >> 16) & 0xFF);
+            tag->data[offset + byte_order->int32_order[3]] = (uint8_t)((((unsigned int)string_length) >> 24) & 0xFF);
+            break;
+
+        default:
+            pdebug(DEBUG_WARN, "Unsupported string count size, %d!", byte_order->str_count_word_bytes);
+            break;
+    }
+}
+
 
-LIB_EXPORT int plc_tag_set_uint8(int32_t id, int offset, uint8_t val)
+LIB_EXPORT int plc_tag_set_raw_bytes(int32_t id, int offset, uint8_t *buffer, int buffer_size)
 {
     int rc = PLCTAG_STATUS_OK;
     plc_tag_p tag = lookup_tag(id);
@@ -2517,91 +8261,57 @@ LIB_EXPORT int plc_tag_set_uint8(int32_t id, int offset, uint8_t val)
         return PLCTAG_ERR_NO_DATA;
     }
 
+    if(!buffer) {
+        pdebug(DEBUG_WARN,"Buffer is null!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(buffer_size <= 0) {
+        pdebug(DEBUG_WARN,"The buffer must have some capacity for data.");
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
     if(!tag->is_bit) {
         critical_block(tag->api_mutex) {
-            if((offset >= 0) && (offset + ((int)sizeof(uint8_t)) <= tag->size)) {
+            if((offset >= 0) && ((offset + buffer_size) <= tag->size)) {
                 if(tag->auto_sync_write_ms > 0) {
-                    tag->tag_is_dirty = 1;
+                    tag_set_dirty_unsafe(tag);
                 }
 
-                tag->data[offset] = val;
-
-                tag->status = PLCTAG_STATUS_OK;
-            } else {
-                pdebug(DEBUG_WARN, "Data offset out of bounds!");
-                tag->status = PLCTAG_ERR_OUT_OF_BOUNDS;
-                rc = PLCTAG_ERR_OUT_OF_BOUNDS;
-            }
-        }
-    } else {
-        if(!val) {
-            rc = plc_tag_set_bit(id, 0, 0);
-        } else {
-            rc = plc_tag_set_bit(id, 0, 1);
-        }
-    }
-
-    rc_dec(tag);
-
-    return rc;
-}
-
-
-
-
-
-LIB_EXPORT int8_t plc_tag_get_int8(int32_t id, int offset)
-{
-    int8_t res = INT8_MIN;
-    plc_tag_p tag = lookup_tag(id);
+                tag_add_dirty_range_unsafe(tag, offset, buffer_size);
 
-    pdebug(DEBUG_SPEW, "Starting.");
+                plc_tag_generic_data_write_begin(tag);
 
-    if(!tag) {
-        pdebug(DEBUG_WARN,"Tag not found.");
-        return res;
-    }
+                int i;
+                for (i=0;i<buffer_size;i++) {
+                    tag->data[offset + i] = buffer[i];
+                }
 
-    /* is there data? */
-    if(!tag->data) {
-        rc_dec(tag);
-        pdebug(DEBUG_WARN,"Tag has no data!");
-        tag->status = PLCTAG_ERR_NO_DATA;
-        return res;
-    }
+                plc_tag_generic_data_write_end(tag);
 
-    if(!tag->is_bit) {
-        critical_block(tag->api_mutex) {
-            if((offset >= 0) && (offset + ((int)sizeof(uint8_t)) <= tag->size)) {
-                res =   (int8_t)tag->data[offset];
                 tag->status = PLCTAG_STATUS_OK;
             } else {
                 pdebug(DEBUG_WARN, "Data offset out of bounds!");
                 tag->status = PLCTAG_ERR_OUT_OF_BOUNDS;
+                rc = PLCTAG_ERR_OUT_OF_BOUNDS;
             }
         }
     } else {
-        int rc = plc_tag_get_bit(id, tag->bit);
-
-        /* make sure the response is good. */
-        if(rc >= 0) {
-            res = (int8_t)(unsigned int)rc;
-        }
+        pdebug(DEBUG_WARN,"Trying to write a list of value on a Tag bit.");
+        tag->status = PLCTAG_ERR_UNSUPPORTED;
+        rc=PLCTAG_ERR_UNSUPPORTED;
     }
 
     rc_dec(tag);
 
-    return res;
+    return rc;
 }
 
 
-
-
-LIB_EXPORT int plc_tag_set_int8(int32_t id, int offset, int8_t ival)
+LIB_EXPORT int plc_tag_get_raw_bytes(int32_t id, int offset, uint8_t *buffer, int buffer_size)
 {
     int rc = PLCTAG_STATUS_OK;
     plc_tag_p tag = lookup_tag(id);
-    uint8_t val = (uint8_t)ival;
 
     pdebug(DEBUG_SPEW, "Starting.");
 
@@ -2618,15 +8328,24 @@ LIB_EXPORT int plc_tag_set_int8(int32_t id, int offset, int8_t ival)
         return PLCTAG_ERR_NO_DATA;
     }
 
+    if(!buffer) {
+        pdebug(DEBUG_WARN,"Buffer is null!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(buffer_size <= 0) {
+        pdebug(DEBUG_WARN,"The buffer must have some capacity for data.");
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
     if(!tag->is_bit) {
         critical_block(tag->api_mutex) {
-            if((offset >= 0) && (offset + ((int)sizeof(int8_t)) <= tag->size)) {
-                if(tag->auto_sync_write_ms > 0) {
-                    tag->tag_is_dirty = 1;
+            if((offset >= 0) && ((offset + buffer_size) <= tag->size)) {
+                int i;
+                for (i=0;i<buffer_size;i++) {
+                    buffer[i] = tag->data[offset + i];
                 }
 
-                tag->data[offset] = val;
-
                 tag->status = PLCTAG_STATUS_OK;
             } else {
                 pdebug(DEBUG_WARN, "Data offset out of bounds!");
@@ -2635,11 +8354,9 @@ LIB_EXPORT int plc_tag_set_int8(int32_t id, int offset, int8_t ival)
             }
         }
     } else {
-        if(!val) {
-            rc = plc_tag_set_bit(id, 0, 0);
-        } else {
-            rc = plc_tag_set_bit(id, 0, 1);
-        }
+        pdebug(DEBUG_WARN,"Trying to read a list of values from a Tag bit.");
+        tag->status = PLCTAG_ERR_UNSUPPORTED;
+        rc = PLCTAG_ERR_UNSUPPORTED;
     }
 
     rc_dec(tag);
@@ -2650,79 +8367,79 @@ LIB_EXPORT int plc_tag_set_int8(int32_t id, int offset, int8_t ival)
 
 
 
+/*
+ * Bulk array accessors.
+ *
+ * These take the tag API mutex once and convert a whole span of elements.
+ * The tag's byte order for the element type is combined with the host byte
+ * order into a single byte shuffle that is applied to every element.  When
+ * the shuffle is the identity, the data is copied directly.
+ */
 
-
-LIB_EXPORT double plc_tag_get_float64(int32_t id, int offset)
+static const int *tag_elem_byte_order(plc_tag_p tag, int elem_size, int is_float)
 {
-    double res = DBL_MIN;
-    int rc = PLCTAG_STATUS_OK;
-    uint64_t ures = 0;
-    plc_tag_p tag = lookup_tag(id);
+    switch(elem_size) {
+        case 2:
+            return tag->byte_order->int16_order;
+            break;
 
-    pdebug(DEBUG_SPEW, "Starting.");
+        case 4:
+            return (is_float ? tag->byte_order->float32_order : tag->byte_order->int32_order);
+            break;
 
-    if(!tag) {
-        pdebug(DEBUG_WARN,"Tag not found.");
-        return res;
-    }
+        case 8:
+            return (is_float ? tag->byte_order->float64_order : tag->byte_order->int64_order);
+            break;
 
-    /* is there data? */
-    if(!tag->data) {
-        rc_dec(tag);
-        pdebug(DEBUG_WARN,"Tag has no data!");
-        tag->status = PLCTAG_ERR_NO_DATA;
-        return res;
+        default:
+            return NULL;
+            break;
     }
+}
 
-    if(tag->is_bit) {
-        pdebug(DEBUG_WARN, "Getting float64 value is unsupported on a bit tag!");
-        tag->status = PLCTAG_ERR_UNSUPPORTED;
-        return res;
-    }
 
-    critical_block(tag->api_mutex) {
-        if((offset >= 0) && (offset + ((int)sizeof(double)) <= tag->size)) {
-            ures =  ((uint64_t)(tag->data[offset + tag->byte_order->float64_order[0]]) << 0 ) +
-                    ((uint64_t)(tag->data[offset + tag->byte_order->float64_order[1]]) << 8 ) +
-                    ((uint64_t)(tag->data[offset + tag->byte_order->float64_order[2]]) << 16) +
-                    ((uint64_t)(tag->data[offset + tag->byte_order->float64_order[3]]) << 24) +
-                    ((uint64_t)(tag->data[offset + tag->byte_order->float64_order[4]]) << 32) +
-                    ((uint64_t)(tag->data[offset + tag->byte_order->float64_order[5]]) << 40) +
-                    ((uint64_t)(tag->data[offset + tag->byte_order->float64_order[6]]) << 48) +
-                    ((uint64_t)(tag->data[offset + tag->byte_order->float64_order[7]]) << 56);
+/* build the tag data to host memory shuffle, return non-zero if it is the identity. */
+int tag_elem_shuffle(const int *order, int elem_size, int *shuffle)
+{
+    const uint16_t endian_test = 0x0102;
+    int host_is_little_endian = (*(const uint8_t *)&endian_test == 0x02);
+    int is_identity = 1;
 
-            tag->status = PLCTAG_STATUS_OK;
-            rc = PLCTAG_STATUS_OK;
-        } else {
-            pdebug(DEBUG_WARN, "Data offset out of bounds!");
-            tag->status = PLCTAG_ERR_OUT_OF_BOUNDS;
-            rc = PLCTAG_ERR_OUT_OF_BOUNDS;
-        }
-    }
+    for(int i=0; i < elem_size; i++) {
+        int host_pos = (host_is_little_endian ? i : (elem_size - 1 - i));
 
-    if(rc == PLCTAG_STATUS_OK) {
-        /* copy the data */
-        mem_copy(&res,&ures,sizeof(res));
-    } else {
-        res = DBL_MIN;
+        shuffle[host_pos] = order[i];
     }
 
-    rc_dec(tag);
+    for(int i=0; i < elem_size; i++) {
+        if(shuffle[i] != i) {
+            is_identity = 0;
+        }
+    }
 
-    return res;
+    return is_identity;
 }
 
 
-
-
-LIB_EXPORT int plc_tag_set_float64(int32_t id, int offset, double fval)
+static int tag_array_access(int32_t id, int offset, void *buffer, int count, int elem_size, int is_float, int is_set)
 {
     int rc = PLCTAG_STATUS_OK;
-    plc_tag_p tag = lookup_tag(id);
-    uint64_t val = 0;
+    plc_tag_p tag = NULL;
+    int shuffle[8];
 
     pdebug(DEBUG_SPEW, "Starting.");
 
+    if(!buffer) {
+        pdebug(DEBUG_WARN,"Buffer is null!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(count <= 0) {
+        pdebug(DEBUG_WARN,"The element count must be greater than zero.");
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    tag = lookup_tag(id);
     if(!tag) {
         pdebug(DEBUG_WARN,"Tag not found.");
         return PLCTAG_ERR_NOT_FOUND;
@@ -2730,356 +8447,414 @@ LIB_EXPORT int plc_tag_set_float64(int32_t id, int offset, double fval)
 
     /* is there data? */
     if(!tag->data) {
-        rc_dec(tag);
         pdebug(DEBUG_WARN,"Tag has no data!");
         tag->status = PLCTAG_ERR_NO_DATA;
+        rc_dec(tag);
         return PLCTAG_ERR_NO_DATA;
     }
 
     if(tag->is_bit) {
-        pdebug(DEBUG_WARN, "Setting float64 value is unsupported on a bit tag!");
+        pdebug(DEBUG_WARN,"Array access is unsupported on a bit tag!");
         tag->status = PLCTAG_ERR_UNSUPPORTED;
+        rc_dec(tag);
         return PLCTAG_ERR_UNSUPPORTED;
     }
 
-    /* copy the data into the uint64 value */
-    mem_copy(&val, &fval, sizeof(val));
-
     critical_block(tag->api_mutex) {
-        if((offset >= 0) && (offset + ((int)sizeof(uint64_t)) <= tag->size)) {
+        int is_identity = tag_elem_shuffle(tag_elem_byte_order(tag, elem_size, is_float), elem_size, shuffle);
+        uint8_t *host = (uint8_t *)buffer;
+        uint8_t *data = NULL;
+
+        if((offset < 0) || (count > (tag->size - offset) / elem_size)) {
+            pdebug(DEBUG_WARN, "Data offset out of bounds!");
+            tag->status = PLCTAG_ERR_OUT_OF_BOUNDS;
+            rc = PLCTAG_ERR_OUT_OF_BOUNDS;
+            break;
+        }
+
+        data = tag->data + offset;
+
+        if(is_set) {
             if(tag->auto_sync_write_ms > 0) {
-                tag->tag_is_dirty = 1;
+                tag_set_dirty_unsafe(tag);
             }
 
-            tag->data[offset + tag->byte_order->float64_order[0]] = (uint8_t)((val >> 0 ) & 0xFF);
-            tag->data[offset + tag->byte_order->float64_order[1]] = (uint8_t)((val >> 8 ) & 0xFF);
-            tag->data[offset + tag->byte_order->float64_order[2]] = (uint8_t)((val >> 16) & 0xFF);
-            tag->data[offset + tag->byte_order->float64_order[3]] = (uint8_t)((val >> 24) & 0xFF);
-            tag->data[offset + tag->byte_order->float64_order[4]] = (uint8_t)((val >> 32) & 0xFF);
-            tag->data[offset + tag->byte_order->float64_order[5]] = (uint8_t)((val >> 40) & 0xFF);
-            tag->data[offset + tag->byte_order->float64_order[6]] = (uint8_t)((val >> 48) & 0xFF);
-            tag->data[offset + tag->byte_order->float64_order[7]] = (uint8_t)((val >> 56) & 0xFF);
+            tag_add_dirty_range_unsafe(tag, offset, count * elem_size);
 
-            tag->status = PLCTAG_STATUS_OK;
+            plc_tag_generic_data_write_begin(tag);
+
+            if(is_identity) {
+                mem_copy(data, host, count * elem_size);
+            } else {
+                for(int i=0; i < count; i++, data += elem_size, host += elem_size) {
+                    for(int b=0; b < elem_size; b++) {
+                        data[shuffle[b]] = host[b];
+                    }
+                }
+            }
+
+            plc_tag_generic_data_write_end(tag);
         } else {
-            pdebug(DEBUG_WARN, "Data offset out of bounds!");
-            tag->status = PLCTAG_ERR_OUT_OF_BOUNDS;
-            rc = PLCTAG_ERR_OUT_OF_BOUNDS;
+            if(is_identity) {
+                mem_copy(host, data, count * elem_size);
+            } else {
+                for(int i=0; i < count; i++, data += elem_size, host += elem_size) {
+                    for(int b=0; b < elem_size; b++) {
+                        host[b] = data[shuffle[b]];
+                    }
+                }
+            }
         }
+
+        tag->status = PLCTAG_STATUS_OK;
     }
 
     rc_dec(tag);
 
+    pdebug(DEBUG_SPEW, "Done.");
+
     return rc;
 }
 
 
+LIB_EXPORT int plc_tag_get_int64_array(int32_t id, int offset, int64_t *buffer, int count)
+{
+    return tag_array_access(id, offset, buffer, count, (int)sizeof(int64_t), 0, 0);
+}
+
 
-LIB_EXPORT float plc_tag_get_float32(int32_t id, int offset)
+LIB_EXPORT int plc_tag_set_int64_array(int32_t id, int offset, const int64_t *buffer, int count)
 {
-    float res = FLT_MIN;
-    int rc = PLCTAG_STATUS_OK;
-    uint32_t ures = 0;
-    plc_tag_p tag = lookup_tag(id);
+    return tag_array_access(id, offset, (void *)buffer, count, (int)sizeof(int64_t), 0, 1);
+}
 
-    pdebug(DEBUG_SPEW, "Starting.");
 
-    if(!tag) {
-        pdebug(DEBUG_WARN,"Tag not found.");
-        return res;
-    }
+LIB_EXPORT int plc_tag_get_int32_array(int32_t id, int offset, int32_t *buffer, int count)
+{
+    return tag_array_access(id, offset, buffer, count, (int)sizeof(int32_t), 0, 0);
+}
 
-    /* is there data? */
-    if(!tag->data) {
-        rc_dec(tag);
-        pdebug(DEBUG_WARN,"Tag has no data!");
-        tag->status = PLCTAG_ERR_NO_DATA;
-        return res;
-    }
 
-    if(tag->is_bit) {
-        pdebug(DEBUG_WARN, "Getting float32 value is unsupported on a bit tag!");
-        tag->status = PLCTAG_ERR_UNSUPPORTED;
-        return res;
-    }
+LIB_EXPORT int plc_tag_set_int32_array(int32_t id, int offset, const int32_t *buffer, int count)
+{
+    return tag_array_access(id, offset, (void *)buffer, count, (int)sizeof(int32_t), 0, 1);
+}
 
-    critical_block(tag->api_mutex) {
-        if((offset >= 0) && (offset + ((int)sizeof(float)) <= tag->size)) {
-            ures =  (uint32_t)(((uint32_t)(tag->data[offset + tag->byte_order->float32_order[0]]) << 0 ) +
-                               ((uint32_t)(tag->data[offset + tag->byte_order->float32_order[1]]) << 8 ) +
-                               ((uint32_t)(tag->data[offset + tag->byte_order->float32_order[2]]) << 16) +
-                               ((uint32_t)(tag->data[offset + tag->byte_order->float32_order[3]]) << 24));
 
-            tag->status = PLCTAG_STATUS_OK;
-            rc = PLCTAG_STATUS_OK;
-        } else {
-            pdebug(DEBUG_WARN, "Data offset out of bounds!");
-            tag->status = PLCTAG_ERR_OUT_OF_BOUNDS;
-            rc = PLCTAG_ERR_OUT_OF_BOUNDS;
-        }
-    }
+LIB_EXPORT int plc_tag_get_int16_array(int32_t id, int offset, int16_t *buffer, int count)
+{
+    return tag_array_access(id, offset, buffer, count, (int)sizeof(int16_t), 0, 0);
+}
+
+
+LIB_EXPORT int plc_tag_set_int16_array(int32_t id, int offset, const int16_t *buffer, int count)
+{
+    return tag_array_access(id, offset, (void *)buffer, count, (int)sizeof(int16_t), 0, 1);
+}
+
+
+LIB_EXPORT int plc_tag_get_float64_array(int32_t id, int offset, double *buffer, int count)
+{
+    return tag_array_access(id, offset, buffer, count, (int)sizeof(double), 1, 0);
+}
+
+
+LIB_EXPORT int plc_tag_set_float64_array(int32_t id, int offset, const double *buffer, int count)
+{
+    return tag_array_access(id, offset, (void *)buffer, count, (int)sizeof(double), 1, 1);
+}
+
 
-    if(rc == PLCTAG_STATUS_OK) {
-        /* copy the data */
-        mem_copy(&res,&ures,sizeof(res));
-    } else {
-        res = FLT_MIN;
-    }
+LIB_EXPORT int plc_tag_get_float32_array(int32_t id, int offset, float *buffer, int count)
+{
+    return tag_array_access(id, offset, buffer, count, (int)sizeof(float), 1, 0);
+}
 
-    rc_dec(tag);
 
-    return res;
+LIB_EXPORT int plc_tag_set_float32_array(int32_t id, int offset, const float *buffer, int count)
+{
+    return tag_array_access(id, offset, (void *)buffer, count, (int)sizeof(float), 1, 1);
 }
 
 
 
+/*
+ * plc_tag_get_values
+ *
+ * Each value is copied while the handle table slot of its tag is locked,
+ * which keeps the tag alive without a reference.  The copy uses the data
+ * sequence count like plc_tag_get_snapshot().  Only a value whose data
+ * keeps changing falls back to the normal lookup and the tag API mutex.
+ */
 
-LIB_EXPORT int plc_tag_set_float32(int32_t id, int offset, float fval)
+LIB_EXPORT int plc_tag_get_values(const int32_t *ids, const int *offsets, int type, void *out, int *status, int count)
 {
+    static const struct { int size; int is_float; } types[] = {
+        { 0, 0 },
+        { 1, 0 }, { 1, 0 },
+        { 2, 0 }, { 2, 0 },
+        { 4, 0 }, { 4, 0 },
+        { 8, 0 }, { 8, 0 },
+        { 4, 1 }, { 8, 1 }
+    };
     int rc = PLCTAG_STATUS_OK;
-    plc_tag_p tag = lookup_tag(id);
-    uint32_t val = 0;
+    int elem_size = 0;
+    int is_float = 0;
 
     pdebug(DEBUG_SPEW, "Starting.");
 
-    if(!tag) {
-        pdebug(DEBUG_WARN,"Tag not found.");
-        return PLCTAG_ERR_NOT_FOUND;
+    if(!ids || !offsets || !out) {
+        pdebug(DEBUG_WARN, "Null tag ID, offset or output array!");
+        return PLCTAG_ERR_NULL_PTR;
     }
 
-    /* is there data? */
-    if(!tag->data) {
-        rc_dec(tag);
-        pdebug(DEBUG_WARN,"Tag has no data!");
-        tag->status = PLCTAG_ERR_NO_DATA;
-        return PLCTAG_ERR_NO_DATA;
+    if(type < PLCTAG_VALUE_INT8 || type > PLCTAG_VALUE_FLOAT64) {
+        pdebug(DEBUG_WARN, "Unsupported value type %d!", type);
+        return PLCTAG_ERR_UNSUPPORTED;
     }
 
-    if(tag->is_bit) {
-        pdebug(DEBUG_WARN, "Setting float32 value is unsupported on a bit tag!");
-        tag->status = PLCTAG_ERR_UNSUPPORTED;
-        return PLCTAG_ERR_UNSUPPORTED;
+    if(count <= 0) {
+        pdebug(DEBUG_WARN, "The value count must be greater than zero.");
+        return PLCTAG_ERR_BAD_PARAM;
     }
 
-    /* copy the data into the uint64 value */
-    mem_copy(&val, &fval, sizeof(val));
+    elem_size = types[type].size;
+    is_float = types[type].is_float;
 
-    critical_block(tag->api_mutex) {
-        if((offset >= 0) && (offset + ((int)sizeof(float)) <= tag->size)) {
-            if(tag->auto_sync_write_ms > 0) {
-                tag->tag_is_dirty = 1;
+    for(int i=0; i < count; i++) {
+        uint8_t *host = (uint8_t *)out + (i * elem_size);
+        tag_slot_t *slot = tag_slot_get(ids[i]);
+        int value_rc = PLCTAG_ERR_NOT_FOUND;
+
+        if(slot) {
+            spin_block(&slot->lock) {
+                if(slot->tag && slot->tag_id == ids[i]) {
+                    value_rc = tag_value_copy(slot->tag, offsets[i], elem_size, is_float, host);
+                }
             }
+        }
 
-            tag->data[offset + tag->byte_order->float32_order[0]] = (uint8_t)((val >> 0 ) & 0xFF);
-            tag->data[offset + tag->byte_order->float32_order[1]] = (uint8_t)((val >> 8 ) & 0xFF);
-            tag->data[offset + tag->byte_order->float32_order[2]] = (uint8_t)((val >> 16) & 0xFF);
-            tag->data[offset + tag->byte_order->float32_order[3]] = (uint8_t)((val >> 24) & 0xFF);
+        /* the data kept changing, wait for it. */
+        if(value_rc == PLCTAG_ERR_BUSY) {
+            plc_tag_p tag = lookup_tag(ids[i]);
 
-            tag->status = PLCTAG_STATUS_OK;
-        } else {
-            pdebug(DEBUG_WARN, "Data offset out of bounds!");
-            tag->status = PLCTAG_ERR_OUT_OF_BOUNDS;
-            rc = PLCTAG_ERR_OUT_OF_BOUNDS;
+            if(tag) {
+                critical_block(tag->api_mutex) {
+                    value_rc = tag_value_copy(tag, offsets[i], elem_size, is_float, host);
+                }
+
+                rc_dec(tag);
+            } else {
+                value_rc = PLCTAG_ERR_NOT_FOUND;
+            }
+        }
+
+        if(status) {
+            status[i] = value_rc;
+        }
+
+        if(value_rc != PLCTAG_STATUS_OK && rc == PLCTAG_STATUS_OK) {
+            rc = value_rc;
         }
     }
 
-    rc_dec(tag);
+    pdebug(DEBUG_SPEW, "Done.");
 
     return rc;
 }
 
 
-LIB_EXPORT int plc_tag_get_string(int32_t tag_id, int string_start_offset, char *buffer, int buffer_length)
-{
-    int rc = PLCTAG_STATUS_OK;
-    plc_tag_p tag = lookup_tag(tag_id);
-    int max_len = 0;
+/*
+ * Copy one value of the tag data to host order.  Returns PLCTAG_ERR_BUSY
+ * if the data changed during every attempt.  The data cannot change while
+ * the tag API mutex is held, so it succeeds the first time then.
+ */
 
-    pdebug(DEBUG_SPEW, "Starting.");
+int tag_value_copy(plc_tag_p tag, int offset, int elem_size, int is_float, uint8_t *host)
+{
+    int shuffle[8];
+    int is_identity = 1;
+    int result = PLCTAG_ERR_BUSY;
 
-    if(!tag) {
-        pdebug(DEBUG_WARN,"Tag not found.");
-        return PLCTAG_ERR_NOT_FOUND;
+    /* a bit tag gives its bit as a value of the type. */
+    if(tag->is_bit) {
+        offset = tag->bit / 8;
+    } else if(elem_size > 1) {
+        int native = (elem_size == 2 ? TAG_NATIVE_INT16 :
+                      elem_size == 4 ? (is_float ? TAG_NATIVE_FLOAT32 : TAG_NATIVE_INT32) :
+                                       (is_float ? TAG_NATIVE_FLOAT64 : TAG_NATIVE_INT64));
+
+        if(!(tag->native_byte_order & native)) {
+            is_identity = tag_elem_shuffle(tag_elem_byte_order(tag, elem_size, is_float), elem_size, shuffle);
+        }
     }
 
-    /* are strings defined for this tag? */
-    if(!tag->byte_order || !tag->byte_order->str_is_defined) {
-        rc_dec(tag);
-        pdebug(DEBUG_WARN,"Tag has no definitions for strings!");
-        tag->status = PLCTAG_ERR_UNSUPPORTED;
-        return PLCTAG_ERR_UNSUPPORTED;
-    }
+    /* keeps any buffer we see from being freed by a resize while we copy. */
+    atomic_add(&tag->data_readers, 1);
 
-    /* is there data? */
-    if(!tag->data) {
-        rc_dec(tag);
-        pdebug(DEBUG_WARN,"Tag has no data!");
-        tag->status = PLCTAG_ERR_NO_DATA;
-        return PLCTAG_ERR_NO_DATA;
-    }
+    for(int attempt = 0; attempt < TAG_VALUES_MAX_ATTEMPTS && result == PLCTAG_ERR_BUSY; attempt++) {
+        uint32_t start_seq = tag->data_seq;
+        uint8_t raw[8] = {0};
+        uint8_t *data = NULL;
+        int size = 0;
+        int rc = PLCTAG_STATUS_OK;
 
-    if(tag->is_bit) {
-        rc_dec(tag);
-        pdebug(DEBUG_WARN, "Getting a string value from a bit tag is not supported!");
-        return PLCTAG_ERR_UNSUPPORTED;
-    }
+        mem_barrier();
 
-    /* set all buffer bytes to zero. */
-    mem_set(buffer, 0, buffer_length);
+        if(start_seq & 1) {
+            continue;
+        }
 
-    critical_block(tag->api_mutex) {
-        int string_length = get_string_length_unsafe(tag, string_start_offset);
+        size = tag->size;
+        mem_barrier();
+        data = tag->data;
 
-        /* determine the maximum number of characters/bytes to copy. */
-        if(buffer_length < string_length) {
-            pdebug(DEBUG_WARN, "Buffer length, %d, is less than the string length, %d!", buffer_length, string_length);
-            max_len = buffer_length;
+        if(!data) {
+            rc = PLCTAG_ERR_NO_DATA;
+        } else if(offset < 0 || offset + (tag->is_bit ? 1 : elem_size) > size) {
+            rc = PLCTAG_ERR_OUT_OF_BOUNDS;
+        } else if(tag->is_bit) {
+            raw[0] = (uint8_t)((data[offset] >> (tag->bit % 8)) & 0x01);
+        } else if(is_identity) {
+            mem_copy(raw, data + offset, elem_size);
         } else {
-            max_len = string_length;
+            for(int b=0; b < elem_size; b++) {
+                raw[b] = data[offset + shuffle[b]];
+            }
         }
 
-        /* check the amount of space. */
-        if(string_start_offset + (int)tag->byte_order->str_count_word_bytes + max_len <= tag->size) {
-            for(int i = 0; i < max_len; i++) {
-                size_t char_index = (((size_t)(unsigned int)i) ^ (tag->byte_order->str_is_byte_swapped)) /* byte swap if necessary */
-                                  + (size_t)(unsigned int)string_start_offset
-                                  + (size_t)(unsigned int)(tag->byte_order->str_count_word_bytes);
-                buffer[i] = (char)tag->data[char_index];
-            }
+        mem_barrier();
 
-            tag->status = PLCTAG_STATUS_OK;
-            rc = PLCTAG_STATUS_OK;
+        if(tag->data_seq != start_seq) {
+            continue;
+        }
+
+        if(rc != PLCTAG_STATUS_OK) {
+            result = rc;
+            break;
+        }
+
+        if(!tag->is_bit) {
+            mem_copy(host, raw, elem_size);
         } else {
-            pdebug(DEBUG_WARN, "Data offset out of bounds!");
-            tag->status = PLCTAG_ERR_OUT_OF_BOUNDS;
-            rc = PLCTAG_ERR_OUT_OF_BOUNDS;
+            union { uint8_t u8; uint16_t u16; uint32_t u32; uint64_t u64; float f32; double f64; } val;
+
+            if(elem_size == 1) {
+                val.u8 = raw[0];
+            } else if(elem_size == 2) {
+                val.u16 = raw[0];
+            } else if(elem_size == 4 && is_float) {
+                val.f32 = (float)raw[0];
+            } else if(elem_size == 4) {
+                val.u32 = raw[0];
+            } else if(is_float) {
+                val.f64 = (double)raw[0];
+            } else {
+                val.u64 = raw[0];
+            }
+
+            mem_copy(host, &val, elem_size);
         }
-    }
 
-    rc_dec(tag);
+        result = PLCTAG_STATUS_OK;
+    }
 
-    pdebug(DEBUG_SPEW, "Done.");
+    atomic_add(&tag->data_readers, -1);
 
-    return rc;
+    return result;
 }
 
 
-LIB_EXPORT int plc_tag_set_string(int32_t tag_id, int string_start_offset, const char *string_val)
+
+/*
+ * plc_tag_get_snapshot
+ *
+ * Copy all of the tag data without taking the tag API mutex.  The copy is
+ * consistent with respect to a single update of the data.  The sequence
+ * count, which changes each time the data changes, is returned in *seq if
+ * it is not NULL.  Returns the number of bytes copied or an error.
+ */
+
+LIB_EXPORT int plc_tag_get_snapshot(int32_t id, uint8_t *buffer, int buffer_length, uint32_t *seq)
 {
     int rc = PLCTAG_STATUS_OK;
-    plc_tag_p tag = lookup_tag(tag_id);
-    int string_length = 0;
+    plc_tag_p tag = NULL;
+    uint32_t start_seq = 0;
+    int done = 0;
 
     pdebug(DEBUG_SPEW, "Starting.");
 
+    if(!buffer) {
+        pdebug(DEBUG_WARN,"Buffer is null!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    tag = lookup_tag(id);
     if(!tag) {
         pdebug(DEBUG_WARN,"Tag not found.");
         return PLCTAG_ERR_NOT_FOUND;
     }
 
-    /* is there data? */
-    if(!tag->data) {
-        rc_dec(tag);
-        pdebug(DEBUG_WARN,"Tag has no data!");
-        tag->status = PLCTAG_ERR_NO_DATA;
-        return PLCTAG_ERR_NO_DATA;
-    }
-
-    /* are strings defined for this tag? */
-    if(!tag->byte_order || !tag->byte_order->str_is_defined) {
-        rc_dec(tag);
-        pdebug(DEBUG_WARN,"Tag has no definitions for strings!");
-        tag->status = PLCTAG_ERR_UNSUPPORTED;
-        return PLCTAG_ERR_UNSUPPORTED;
-    }
-
-    if(!string_val) {
-        rc_dec(tag);
-        pdebug(DEBUG_WARN, "New string value pointer is null!");
-        tag->status = PLCTAG_ERR_NULL_PTR;
-        return PLCTAG_ERR_NULL_PTR;
-    }
-
-    /* note that passing a zero-length string is valid. */
+    /* keeps any buffer we see from being freed by a resize while we copy. */
+    atomic_add(&tag->data_readers, 1);
 
-    if(tag->is_bit) {
-        rc_dec(tag);
-        pdebug(DEBUG_WARN, "Setting a string value on a bit tag is not supported!");
-        tag->status = PLCTAG_ERR_UNSUPPORTED;
-        return PLCTAG_ERR_UNSUPPORTED;
-    }
+    for(int attempt = 0; attempt < TAG_SNAPSHOT_MAX_ATTEMPTS && !done; attempt++) {
+        int size = 0;
+        uint8_t *data = NULL;
 
-    string_length = str_length(string_val);
+        start_seq = tag->data_seq;
+        mem_barrier();
 
-    critical_block(tag->api_mutex) {
-        int string_capacity = (tag->byte_order->str_max_capacity ? (int)(tag->byte_order->str_max_capacity) : get_string_length_unsafe(tag, string_start_offset));
+        if(start_seq & 1) {
+            /* an update is in progress. */
+            continue;
+        }
 
-        /* determine the maximum number of characters/bytes to copy. */
-        if(string_capacity >= string_length) {
-            /* is there sufficient room in the tag? */
-            if(string_start_offset + (int)(tag->byte_order->str_count_word_bytes) + string_length + (tag->byte_order->str_is_zero_terminated ? 1 : 0) <= tag->size) {
-                /* set the status, we might change it below. */
-                rc = PLCTAG_STATUS_OK;
-                tag->status = (int8_t)rc;
+        size = tag->size;
+        mem_barrier();
+        data = tag->data;
 
-                /* copy the string data into the tag. */
-                for(int i = 0; i < string_length; i++) {
-                    size_t char_index = (((size_t)(unsigned int)i) ^ (tag->byte_order->str_is_byte_swapped)) /* byte swap if necessary */
-                                    + (size_t)(unsigned int)string_start_offset
-                                    + (size_t)(unsigned int)(tag->byte_order->str_count_word_bytes);
-                    tag->data[char_index] = (uint8_t)string_val[i];
-                }
+        if(!data) {
+            rc = PLCTAG_ERR_NO_DATA;
+            break;
+        }
 
-                /* zero pad the rest. */
-                for(int i = string_length; i < string_capacity; i++) {
-                    size_t char_index = (((size_t)(unsigned int)i) ^ (tag->byte_order->str_is_byte_swapped)) /* byte swap if necessary */
-                                    + (size_t)(unsigned int)string_start_offset
-                                    + (size_t)(unsigned int)(tag->byte_order->str_count_word_bytes);
-                    tag->data[char_index] = (uint8_t)0;
-                }
+        if(size > buffer_length) {
+            rc = PLCTAG_ERR_TOO_SMALL;
+            break;
+        }
 
-                /* if the string is counted, set the length */
-                if(tag->byte_order->str_is_counted) {
-                    switch(tag->byte_order->str_count_word_bytes) {
-                        case 1:
-                            tag->data[string_start_offset] = (uint8_t)(unsigned int)string_length;
-                            break;
+        mem_copy(buffer, data, size);
+        mem_barrier();
 
-                        case 2:
-                            tag->data[string_start_offset + tag->byte_order->int16_order[0]] = (uint8_t)((((unsigned int)string_length) >> 0 ) & 0xFF);
-                            tag->data[string_start_offset + tag->byte_order->int16_order[1]] = (uint8_t)((((unsigned int)string_length) >> 8 ) & 0xFF);
-                            break;
+        if(tag->data_seq == start_seq) {
+            rc = size;
+            done = 1;
+        }
+    }
 
-                        case 4:
-                            tag->data[string_start_offset + tag->byte_order->int32_order[0]] = (uint8_t)((((unsigned int)string_length) >> 0 ) & 0xFF);
-                            tag->data[string_start_offset + tag->byte_order->int32_order[1]] = (uint8_t)((((unsigned int)string_length) >> 8 ) & 0xFF);
-                            tag->data[string_start_offset + tag->byte_order->int32_order[2]] = (uint8_t)((((unsigned int)string_length) >> 16) & 0xFF);
-                            tag->data[string_start_offset + tag->byte_order->int32_order[3]] = (uint8_t)((((unsigned int)string_length) >> 24) & 0xFF);
-                            break;
+    atomic_add(&tag->data_readers, -1);
 
-                        default:
-                            pdebug(DEBUG_WARN, "Unsupported string count size, %d!", tag->byte_order->str_count_word_bytes);
-                            rc = PLCTAG_ERR_UNSUPPORTED;
-                            tag->status = (int8_t)rc;
-                            break;
-                    }
-                }
+    /* the data kept changing, take the slow path. */
+    if(!done && rc == PLCTAG_STATUS_OK) {
+        critical_block(tag->api_mutex) {
+            start_seq = tag->data_seq;
 
-                if(rc == PLCTAG_STATUS_OK && tag->auto_sync_write_ms > 0) {
-                    tag->tag_is_dirty = 1;
-                }
+            if(!tag->data) {
+                rc = PLCTAG_ERR_NO_DATA;
+            } else if(tag->size > buffer_length) {
+                rc = PLCTAG_ERR_TOO_SMALL;
             } else {
-                pdebug(DEBUG_WARN, "Writing the full string would go out of bounds in the tag buffer!");
-                rc = PLCTAG_ERR_OUT_OF_BOUNDS;
-                tag->status = (int8_t)rc;
+                mem_copy(buffer, tag->data, tag->size);
+                rc = tag->size;
             }
-        } else {
-            pdebug(DEBUG_WARN, "String capacity, %d, is less than the string length, %d!", string_capacity, string_length);
-            rc = PLCTAG_ERR_TOO_LARGE;
-            tag->status = (int8_t)rc;
         }
     }
 
+    if(seq) {
+        *seq = start_seq;
+    }
+
     rc_dec(tag);
 
     pdebug(DEBUG_SPEW, "Done.");
@@ -3090,268 +8865,272 @@ LIB_EXPORT int plc_tag_set_string(int32_t tag_id, int string_start_offset, const
 
 
 
-LIB_EXPORT int plc_tag_get_string_capacity(int32_t id, int string_start_offset)
+/*
+ * plc_tag_get_sample_info
+ *
+ * Get the time the data of the last successful read arrived, in the same
+ * microseconds as the history records, and the count of successful reads.
+ */
+
+LIB_EXPORT int plc_tag_get_sample_info(int32_t id, int64_t *time_us, uint32_t *seq)
 {
-    int string_capacity = 0;
-    plc_tag_p tag = lookup_tag(id);
+    plc_tag_p tag = NULL;
 
     pdebug(DEBUG_SPEW, "Starting.");
 
+    if(!time_us || !seq) {
+        pdebug(DEBUG_WARN,"Time or sequence pointer is null!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    tag = lookup_tag(id);
     if(!tag) {
         pdebug(DEBUG_WARN,"Tag not found.");
         return PLCTAG_ERR_NOT_FOUND;
     }
 
-    /* are strings defined for this tag? */
-    if(!tag->byte_order || !tag->byte_order->str_is_defined) {
-        rc_dec(tag);
-        pdebug(DEBUG_WARN,"Tag has no definitions for strings!");
-        tag->status = PLCTAG_ERR_UNSUPPORTED;
-        return PLCTAG_ERR_UNSUPPORTED;
-    }
-
-    /* is there data? */
-    if(!tag->data) {
-        rc_dec(tag);
-        pdebug(DEBUG_WARN,"Tag has no data!");
-        tag->status = PLCTAG_ERR_NO_DATA;
-        return PLCTAG_ERR_NO_DATA;
-    }
-
-    if(tag->is_bit) {
-        rc_dec(tag);
-        pdebug(DEBUG_WARN, "Getting string capacity from a bit tag is not supported!");
-        tag->status = PLCTAG_ERR_UNSUPPORTED;
-        return PLCTAG_ERR_UNSUPPORTED;
-    }
-
     critical_block(tag->api_mutex) {
-        string_capacity = (tag->byte_order->str_max_capacity ? (int)(tag->byte_order->str_max_capacity) : get_string_length_unsafe(tag, string_start_offset));
+        *time_us = tag->sample_time_us;
+        *seq = tag->sample_seq;
     }
 
     rc_dec(tag);
 
     pdebug(DEBUG_SPEW, "Done.");
 
-    return string_capacity;
+    return PLCTAG_STATUS_OK;
 }
 
 
 
-LIB_EXPORT int plc_tag_get_string_length(int32_t id, int string_start_offset)
+
+/*
+ * plc_tag_read_history
+ *
+ * Move the oldest records of the read history into the buffer, as many
+ * as fit.  Each record is a PLCTAG_HISTORY_TIMESTAMP_SIZE byte time stamp
+ * followed by the tag data.  The number of records is returned in *count.
+ * Returns the number of bytes copied or an error.
+ */
+
+LIB_EXPORT int plc_tag_read_history(int32_t id, uint8_t *buffer, int buffer_length, int *count)
 {
-    int string_length = 0;
-    plc_tag_p tag = lookup_tag(id);
+    int rc = PLCTAG_STATUS_OK;
+    plc_tag_p tag = NULL;
+    int num_records = 0;
 
     pdebug(DEBUG_SPEW, "Starting.");
 
+    if(!buffer || !count) {
+        pdebug(DEBUG_WARN,"Buffer or count pointer is null!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    *count = 0;
+
+    tag = lookup_tag(id);
     if(!tag) {
         pdebug(DEBUG_WARN,"Tag not found.");
         return PLCTAG_ERR_NOT_FOUND;
     }
 
-    /* are strings defined for this tag? */
-    if(!tag->byte_order || !tag->byte_order->str_is_defined) {
-        rc_dec(tag);
-        pdebug(DEBUG_WARN,"Tag has no definitions for strings!");
-        tag->status = PLCTAG_ERR_UNSUPPORTED;
-        return PLCTAG_ERR_UNSUPPORTED;
-    }
+    critical_block(tag->api_mutex) {
+        tag_history_p history = tag->history;
+        int record_size = 0;
 
-    /* is there data? */
-    if(!tag->data) {
-        rc_dec(tag);
-        pdebug(DEBUG_WARN,"Tag has no data!");
-        tag->status = PLCTAG_ERR_NO_DATA;
-        return PLCTAG_ERR_NO_DATA;
-    }
+        if(!history) {
+            pdebug(DEBUG_WARN, "Tag was not created with history_depth set!");
+            rc = PLCTAG_ERR_NOT_ALLOWED;
+            break;
+        }
 
-    if(tag->is_bit) {
-        rc_dec(tag);
-        pdebug(DEBUG_WARN, "Getting string length from a bit tag is not supported!");
-        tag->status = PLCTAG_ERR_UNSUPPORTED;
-        return PLCTAG_ERR_UNSUPPORTED;
-    }
+        record_size = TAG_HISTORY_RECORD_SIZE(history->data_size);
 
-    critical_block(tag->api_mutex) {
-        string_length = get_string_length_unsafe(tag, string_start_offset);
+        if(history->count > 0 && buffer_length < record_size) {
+            rc = PLCTAG_ERR_TOO_SMALL;
+            break;
+        }
+
+        while(history->count > 0 && (num_records + 1) * record_size <= buffer_length) {
+            mem_copy(buffer + (num_records * record_size), history->records + (history->first * record_size), record_size);
+
+            history->first = (history->first + 1) % history->depth;
+            history->count--;
+            num_records++;
+        }
+
+        rc = num_records * record_size;
     }
 
+    *count = num_records;
+
     rc_dec(tag);
 
     pdebug(DEBUG_SPEW, "Done.");
 
-    return string_length;
+    return rc;
 }
 
 
 
 
-LIB_EXPORT int plc_tag_get_string_total_length(int32_t id, int string_start_offset)
+/*
+ * plc_tag_get_cpu_top
+ *
+ * Copy out the tags with the most CPU time, most first.
+ */
+
+LIB_EXPORT int plc_tag_get_cpu_top(int32_t *ids, int64_t *tickler_ns, int64_t *session_ns, int max_count)
 {
-    int total_length = 0;
-    plc_tag_p tag = lookup_tag(id);
+    tag_cpu_top_t top;
 
-    pdebug(DEBUG_SPEW, "Starting.");
+    pdebug(DEBUG_DETAIL, "Starting.");
 
-    if(!tag) {
-        pdebug(DEBUG_WARN,"Tag not found.");
-        return PLCTAG_ERR_NOT_FOUND;
+    if(!ids || max_count <= 0) {
+        pdebug(DEBUG_WARN, "Null ID array or bad count!");
+        return PLCTAG_ERR_BAD_PARAM;
     }
 
-    /* are strings defined for this tag? */
-    if(!tag->byte_order || !tag->byte_order->str_is_defined) {
-        rc_dec(tag);
-        pdebug(DEBUG_WARN,"Tag has no definitions for strings!");
-        tag->status = PLCTAG_ERR_UNSUPPORTED;
-        return PLCTAG_ERR_UNSUPPORTED;
+    if(max_count > TAG_CPU_MAX_TAGS) {
+        max_count = TAG_CPU_MAX_TAGS;
     }
 
-    /* is there data? */
-    if(!tag->data) {
-        rc_dec(tag);
-        pdebug(DEBUG_WARN,"Tag has no data!");
-        tag->status = PLCTAG_ERR_NO_DATA;
-        return PLCTAG_ERR_NO_DATA;
+    top.ids = ids;
+    top.tickler_ns = tickler_ns;
+    top.session_ns = session_ns;
+    top.max_count = max_count;
+    top.count = 0;
+    top.top = (tag_cpu_entry_t *)mem_alloc((int)sizeof(tag_cpu_entry_t) * max_count);
+
+    if(!top.top) {
+        pdebug(DEBUG_WARN, "Unable to allocate memory for the report!");
+        return PLCTAG_ERR_NO_MEM;
     }
 
-    if(tag->is_bit) {
-        rc_dec(tag);
-        pdebug(DEBUG_WARN, "Getting a string total length from a bit tag is not supported!");
-        tag->status = PLCTAG_ERR_UNSUPPORTED;
-        return PLCTAG_ERR_UNSUPPORTED;
+    spin_block(&tag_cpu_lock) {
+        if(tag_cpu_table) {
+            hashtable_on_each(tag_cpu_table, tag_cpu_top_entry, &top);
+        }
     }
 
-    critical_block(tag->api_mutex) {
-        total_length = (int)(tag->byte_order->str_count_word_bytes)
-                     + (tag->byte_order->str_is_fixed_length ? (int)(tag->byte_order->str_max_capacity) : get_string_length_unsafe(tag, string_start_offset))
-                     + (tag->byte_order->str_is_zero_terminated ? (int)1 : (int)0)
-                     + (int)(tag->byte_order->str_pad_bytes);
+    for(int i=0; i < top.count; i++) {
+        ids[i] = top.top[i].tag_id;
+
+        if(tickler_ns) {
+            tickler_ns[i] = top.top[i].tickler_ns;
+        }
+
+        if(session_ns) {
+            session_ns[i] = top.top[i].session_ns;
+        }
     }
 
-    rc_dec(tag);
+    mem_free(top.top);
 
-    pdebug(DEBUG_SPEW, "Done.");
+    pdebug(DEBUG_DETAIL, "Done.");
 
-    return total_length;
+    return top.count;
 }
 
 
 
-LIB_EXPORT int plc_tag_set_raw_bytes(int32_t id, int offset, uint8_t *buffer, int buffer_size)
-{
-    int rc = PLCTAG_STATUS_OK;
-    plc_tag_p tag = lookup_tag(id);
+/*
+ * plc_tag_get_metrics
+ *
+ * Copy a text snapshot of the library metrics into the buffer.
+ */
 
-    pdebug(DEBUG_SPEW, "Starting.");
+LIB_EXPORT int plc_tag_get_metrics(char *buffer, int buffer_length)
+{
+    int needed = 0;
 
-    if(!tag) {
-        pdebug(DEBUG_WARN,"Tag not found.");
-        return PLCTAG_ERR_NOT_FOUND;
-    }
+    pdebug(DEBUG_DETAIL, "Starting.");
 
-    /* is there data? */
-    if(!tag->data) {
-        rc_dec(tag);
-        pdebug(DEBUG_WARN,"Tag has no data!");
-        tag->status = PLCTAG_ERR_NO_DATA;
-        return PLCTAG_ERR_NO_DATA;
-    }
+    needed = metrics_snapshot_text(buffer, buffer_length) + 1;
 
     if(!buffer) {
-        pdebug(DEBUG_WARN,"Buffer is null!");
-        return PLCTAG_ERR_NULL_PTR;
+        return needed;
     }
 
-    if(buffer_size <= 0) {
-        pdebug(DEBUG_WARN,"The buffer must have some capacity for data.");
-        return PLCTAG_ERR_BAD_PARAM;
+    if(needed > buffer_length) {
+        pdebug(DEBUG_WARN, "Metrics need %d bytes but the buffer is only %d bytes!", needed, buffer_length);
+        return PLCTAG_ERR_TOO_SMALL;
     }
 
-    if(!tag->is_bit) {
-        critical_block(tag->api_mutex) {
-            if((offset >= 0) && ((offset + buffer_size) <= tag->size)) {
-                if(tag->auto_sync_write_ms > 0) {
-                    tag->tag_is_dirty = 1;
-                }
+    pdebug(DEBUG_DETAIL, "Done.");
 
-                int i;
-                for (i=0;i<buffer_size;i++) {
-                    tag->data[offset + i] = buffer[i];
-                }
+    return needed - 1;
+}
 
-                tag->status = PLCTAG_STATUS_OK;
-            } else {
-                pdebug(DEBUG_WARN, "Data offset out of bounds!");
-                tag->status = PLCTAG_ERR_OUT_OF_BOUNDS;
-                rc = PLCTAG_ERR_OUT_OF_BOUNDS;
-            }
-        }
-    } else {
-        pdebug(DEBUG_WARN,"Trying to write a list of value on a Tag bit.");
-        tag->status = PLCTAG_ERR_UNSUPPORTED;
-        rc=PLCTAG_ERR_UNSUPPORTED;
-    }
 
-    rc_dec(tag);
 
-    return rc;
-}
 
+/*
+ * plc_tag_bind_buffer
+ *
+ * Have the tag keep its data in an application buffer.  The current data is
+ * copied in and from then on read responses are decoded straight into the
+ * buffer.  A NULL buffer gives the tag its own buffer back.
+ */
 
-LIB_EXPORT int plc_tag_get_raw_bytes(int32_t id, int offset, uint8_t *buffer, int buffer_size)
+LIB_EXPORT int plc_tag_bind_buffer(int32_t id, uint8_t *buffer, int buffer_length)
 {
     int rc = PLCTAG_STATUS_OK;
     plc_tag_p tag = lookup_tag(id);
 
-    pdebug(DEBUG_SPEW, "Starting.");
+    pdebug(DEBUG_INFO, "Starting.");
 
     if(!tag) {
         pdebug(DEBUG_WARN,"Tag not found.");
         return PLCTAG_ERR_NOT_FOUND;
     }
 
-    /* is there data? */
-    if(!tag->data) {
-        rc_dec(tag);
-        pdebug(DEBUG_WARN,"Tag has no data!");
-        tag->status = PLCTAG_ERR_NO_DATA;
-        return PLCTAG_ERR_NO_DATA;
-    }
+    critical_block(tag->api_mutex) {
+        if(!buffer) {
+            plc_tag_generic_unbind_buffer(tag);
+            break;
+        }
 
-    if(!buffer) {
-        pdebug(DEBUG_WARN,"Buffer is null!");
-        return PLCTAG_ERR_NULL_PTR;
-    }
+        if(buffer_length <= 0 || buffer_length < tag->size) {
+            pdebug(DEBUG_WARN, "Buffer of %d bytes is too small for %d bytes of tag data!", buffer_length, tag->size);
+            rc = PLCTAG_ERR_TOO_SMALL;
+            break;
+        }
 
-    if(buffer_size <= 0) {
-        pdebug(DEBUG_WARN,"The buffer must have some capacity for data.");
-        return PLCTAG_ERR_BAD_PARAM;
-    }
+        /* the double buffers are swapped on each read so they cannot be replaced. */
+        if(tag->is_double_buffered) {
+            pdebug(DEBUG_WARN, "Double buffered tags cannot use a bound buffer!");
+            rc = PLCTAG_ERR_UNSUPPORTED;
+            break;
+        }
 
-    if(!tag->is_bit) {
-        critical_block(tag->api_mutex) {
-            if((offset >= 0) && ((offset + buffer_size) <= tag->size)) {
-                int i;
-                for (i=0;i<buffer_size;i++) {
-                    buffer[i] = tag->data[offset + i];
-                }
+        if(tag->read_in_flight || tag->write_in_flight) {
+            pdebug(DEBUG_WARN, "Tag operation in flight, cannot change the data buffer!");
+            rc = PLCTAG_ERR_BUSY;
+            break;
+        }
 
-                tag->status = PLCTAG_STATUS_OK;
-            } else {
-                pdebug(DEBUG_WARN, "Data offset out of bounds!");
-                tag->status = PLCTAG_ERR_OUT_OF_BOUNDS;
-                rc = PLCTAG_ERR_OUT_OF_BOUNDS;
-            }
+        plc_tag_generic_unbind_buffer(tag);
+
+        if(tag->data) {
+            mem_copy(buffer, tag->data, tag->size);
         }
-    } else {
-        pdebug(DEBUG_WARN,"Trying to read a list of values from a Tag bit.");
-        tag->status = PLCTAG_ERR_UNSUPPORTED;
-        rc = PLCTAG_ERR_UNSUPPORTED;
+
+        plc_tag_generic_data_write_begin(tag);
+
+        tag->owned_data = tag->data;
+        tag->owned_size = tag->size;
+        tag->bound_size = buffer_length;
+        tag->data = buffer;
+        tag->is_bound = 1;
+
+        plc_tag_generic_data_write_end(tag);
     }
 
     rc_dec(tag);
 
+    pdebug(DEBUG_INFO, "Done.");
+
     return rc;
 }
 
@@ -3666,11 +9445,59 @@ int set_tag_byte_order(plc_tag_p tag, attr attribs)
         } else {
             pdebug(DEBUG_WARN, "Insufficient definitions found to support strings!");
         }
-    }
+    }
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * tag_set_native_byte_order
+ *
+ * Flag the element types whose byte order in the tag data is the same as
+ * in host memory, or exactly reversed.  The accessors copy those values
+ * directly or with a byte swap.
+ */
+
+void tag_set_native_byte_order(plc_tag_p tag)
+{
+    static const struct { int flag; int elem_size; int is_float; } types[] = {
+        { TAG_NATIVE_INT16, 2, 0 }, { TAG_NATIVE_INT32, 4, 0 }, { TAG_NATIVE_INT64, 8, 0 },
+        { TAG_NATIVE_FLOAT32, 4, 1 }, { TAG_NATIVE_FLOAT64, 8, 1 }
+    };
+    int shuffle[8];
+
+    tag->native_byte_order = 0;
+    tag->swapped_byte_order = 0;
+
+    if(!tag->byte_order) {
+        return;
+    }
+
+    for(size_t t=0; t < sizeof(types)/sizeof(types[0]); t++) {
+        int elem_size = types[t].elem_size;
+        int reversed = 1;
+
+        if(tag_elem_shuffle(tag_elem_byte_order(tag, elem_size, types[t].is_float), elem_size, shuffle)) {
+            tag->native_byte_order |= (uint8_t)types[t].flag;
+            continue;
+        }
+
+        for(int b=0; b < elem_size; b++) {
+            if(shuffle[b] != elem_size - 1 - b) {
+                reversed = 0;
+            }
+        }
 
-    pdebug(DEBUG_INFO, "Done.");
+        if(reversed) {
+            tag->swapped_byte_order |= (uint8_t)types[t].flag;
+        }
+    }
 
-    return PLCTAG_STATUS_OK;
+    pdebug(DEBUG_DETAIL, "Native byte order flags %x, swapped %x.", (unsigned int)tag->native_byte_order, (unsigned int)tag->swapped_byte_order);
 }
 
 int check_byte_order_str(const char *byte_order, int length)
@@ -3719,27 +9546,54 @@ int check_byte_order_str(const char *byte_order, int length)
 
 
 
+/*
+ * tag_slot_get
+ *
+ * Find the handle table slot for a tag ID.  This does not check that the
+ * slot currently holds that tag.
+ */
+
+tag_slot_t *tag_slot_get(int32_t tag_id)
+{
+    int32_t index = 0;
+    tag_slot_t *chunk = NULL;
+
+    if(tag_id <= 0 || tag_id >= TAG_ID_MASK) {
+        return NULL;
+    }
+
+    index = tag_id & TAG_SLOT_MASK;
+
+    chunk = tag_slot_chunks[index >> TAG_SLOT_CHUNK_BITS];
+    if(!chunk) {
+        return NULL;
+    }
+
+    return &chunk[index & (TAG_SLOT_CHUNK_SIZE - 1)];
+}
+
+
+
 plc_tag_p lookup_tag(int32_t tag_id)
 {
     plc_tag_p tag = NULL;
+    tag_slot_t *slot = tag_slot_get(tag_id);
 
-    critical_block(tag_lookup_mutex) {
-        tag = hashtable_get(tags, (int64_t)tag_id);
-
-        if(tag) {
-            debug_set_tag_id(tag->tag_id);
-        } else {
-            /* FIXME - remove this. */
-            pdebug(DEBUG_WARN, "Tag with ID %d not found.", tag_id);
+    if(slot) {
+        spin_block(&slot->lock) {
+            if(slot->tag && slot->tag_id == tag_id) {
+                tag = rc_inc(slot->tag);
+            }
         }
+    }
 
-        if(tag && tag->tag_id == tag_id) {
-            pdebug(DEBUG_SPEW, "Found tag %p with id %d.", tag, tag->tag_id);
-            tag = rc_inc(tag);
-        } else {
-            debug_set_tag_id(0);
-            tag = NULL;
-        }
+    if(tag) {
+        pdebug(DEBUG_SPEW, "Found tag %p with id %d.", tag, tag->tag_id);
+        debug_set_tag_id(tag->tag_id);
+    } else {
+        /* FIXME - remove this. */
+        pdebug(DEBUG_WARN, "Tag with ID %d not found.", tag_id);
+        debug_set_tag_id(0);
     }
 
     return tag;
@@ -3747,68 +9601,210 @@ plc_tag_p lookup_tag(int32_t tag_id)
 
 
 
-int tag_id_inc(int id)
+/*
+ * tag_slot_grow_unsafe
+ *
+ * Add a chunk of slots to the handle table and put them on the free list.
+ * The lookup mutex must be held.
+ */
+
+int tag_slot_grow_unsafe(void)
 {
-    if(id <= 0) {
-        pdebug(DEBUG_ERROR, "Incoming ID is not valid! Got %d",id);
-        /* try to correct. */
-        id = (TAG_ID_MASK/2);
+    tag_slot_t *chunk = NULL;
+    int32_t first_index = 0;
+
+    if(tag_slot_num_chunks >= TAG_SLOT_MAX_CHUNKS) {
+        pdebug(DEBUG_WARN, "Tag handle table is full!");
+        return PLCTAG_ERR_NO_RESOURCES;
     }
 
-    id = (id + 1) & TAG_ID_MASK;
+    chunk = (tag_slot_t *)mem_alloc((int)(sizeof(tag_slot_t) * TAG_SLOT_CHUNK_SIZE));
+    if(!chunk) {
+        pdebug(DEBUG_ERROR, "Unable to allocate tag handle table chunk!");
+        return PLCTAG_ERR_NO_MEM;
+    }
 
-    if(id == 0) {
-        id = 1; /* skip zero intentionally! Can't return an ID of zero because it looks like a NULL pointer */
+    first_index = tag_slot_num_chunks * TAG_SLOT_CHUNK_SIZE;
+
+    for(int i=0; i < TAG_SLOT_CHUNK_SIZE; i++) {
+        chunk[i].lock = LOCK_INIT;
+        chunk[i].generation = 0;
+        chunk[i].next_free = (i + 1 < TAG_SLOT_CHUNK_SIZE ? first_index + i + 1 : -1);
+        chunk[i].live_index = -1;
     }
 
-    return id;
+    /* publish the chunk. */
+    tag_slot_chunks[tag_slot_num_chunks] = chunk;
+    tag_slot_num_chunks++;
+
+    /* new slots go on the end of the free list. */
+    if(tag_slot_free_tail >= 0) {
+        TAG_SLOT_AT(tag_slot_free_tail)->next_free = first_index;
+    } else {
+        tag_slot_free_head = first_index;
+    }
+
+    tag_slot_free_tail = first_index + TAG_SLOT_CHUNK_SIZE - 1;
+
+    return PLCTAG_STATUS_OK;
 }
 
 
 
-int add_tag_lookup(plc_tag_p tag)
+/*
+ * tag_live_reserve_unsafe
+ *
+ * Make sure there is room for one more tag in the live array.  The
+ * lookup mutex must be held.
+ */
+
+int tag_live_reserve_unsafe(void)
+{
+    tag_live_entry_t *new_live = NULL;
+    int new_capacity = 0;
+
+    if(tag_live_count < tag_live_capacity) {
+        return PLCTAG_STATUS_OK;
+    }
+
+    new_capacity = (tag_live_capacity ? tag_live_capacity * 2 : TAG_LIVE_MIN_CAPACITY);
+
+    new_live = (tag_live_entry_t *)mem_realloc(tag_live, (int)sizeof(tag_live_entry_t) * new_capacity);
+    if(!new_live) {
+        pdebug(DEBUG_ERROR, "Unable to grow the live tag array!");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    tag_live = new_live;
+    tag_live_capacity = new_capacity;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * plc_tag_generic_for_each_tag
+ *
+ * Call the function on every live tag.  References to the tags are taken
+ * under the lookup mutex in one pass over the live array and the function
+ * is called with no library locks held, so it may use the tag API.  Stops
+ * at the first status other than PLCTAG_STATUS_OK and returns it.
+ */
+
+int plc_tag_generic_for_each_tag(int (*func)(plc_tag_p tag, void *context), void *context)
 {
-    int rc = PLCTAG_ERR_NOT_FOUND;
-    int new_id = 0;
+    plc_tag_p *tags = NULL;
+    int num_tags = 0;
+    int rc = PLCTAG_STATUS_OK;
 
     pdebug(DEBUG_DETAIL, "Starting.");
 
+    if(!func) {
+        pdebug(DEBUG_WARN, "Null function pointer!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
     critical_block(tag_lookup_mutex) {
-        int attempts = 0;
+        if(tag_live_count == 0) {
+            break;
+        }
 
-        /* only get this when we hold the mutex. */
-        new_id = next_tag_id;
+        tags = (plc_tag_p *)mem_alloc((int)sizeof(plc_tag_p) * tag_live_count);
+        if(!tags) {
+            rc = PLCTAG_ERR_NO_MEM;
+            break;
+        }
 
-        do {
-            new_id = tag_id_inc(new_id);
+        for(int i=0; i < tag_live_count; i++) {
+            plc_tag_p tag = rc_inc(tag_live[i].tag);
 
-            if(new_id <=0) {
-                pdebug(DEBUG_WARN,"ID %d is illegal!", new_id);
-                attempts = MAX_TAG_MAP_ATTEMPTS;
-                break;
+            if(tag) {
+                tags[num_tags++] = tag;
             }
+        }
+    }
+
+    for(int i=0; i < num_tags; i++) {
+        if(rc == PLCTAG_STATUS_OK) {
+            rc = func(tags[i], context);
+        }
+
+        rc_dec(tags[i]);
+    }
+
+    if(tags) {
+        mem_free(tags);
+    }
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return rc;
+}
+
+
+
+/*
+ * add_tag_lookup
+ *
+ * Put the tag into the handle table and return its new ID.  Slots are
+ * reused in FIFO order and the generation changes each time so that a
+ * stale ID does not find a new tag.
+ */
+
+int add_tag_lookup(plc_tag_p tag)
+{
+    int new_id = PLCTAG_ERR_NO_RESOURCES;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    critical_block(tag_lookup_mutex) {
+        int32_t index = 0;
+        tag_slot_t *slot = NULL;
+
+        int rc = tag_live_reserve_unsafe();
+
+        if(rc != PLCTAG_STATUS_OK) {
+            new_id = rc;
+            break;
+        }
 
-            pdebug(DEBUG_SPEW,"Trying new ID %d.", new_id);
+        if(tag_slot_free_head < 0) {
+            rc = tag_slot_grow_unsafe();
 
-            if(!hashtable_get(tags,(int64_t)new_id)) {
-                pdebug(DEBUG_DETAIL,"Found unused ID %d", new_id);
+            if(rc != PLCTAG_STATUS_OK) {
+                new_id = rc;
                 break;
             }
+        }
 
-            attempts++;
-        } while(attempts < MAX_TAG_MAP_ATTEMPTS);
+        index = tag_slot_free_head;
+        slot = TAG_SLOT_AT(index);
 
-        if(attempts < MAX_TAG_MAP_ATTEMPTS) {
-            rc = hashtable_put(tags, (int64_t)new_id, tag);
-        } else {
-            rc = PLCTAG_ERR_NO_RESOURCES;
+        tag_slot_free_head = slot->next_free;
+        if(tag_slot_free_head < 0) {
+            tag_slot_free_tail = -1;
         }
 
-        next_tag_id = new_id;
-    }
+        slot->next_free = -1;
+        slot->generation++;
+        if(slot->generation > TAG_SLOT_MAX_GEN) {
+            slot->generation = 1;
+        }
 
-    if(rc != PLCTAG_STATUS_OK) {
-        new_id = rc;
+        new_id = (int)((slot->generation << TAG_SLOT_BITS) | index);
+
+        spin_block(&slot->lock) {
+            slot->tag_id = new_id;
+            slot->tag = tag;
+        }
+
+        slot->live_index = tag_live_count;
+        tag_live[tag_live_count].tag = tag;
+        tag_live[tag_live_count].slot_index = index;
+        tag_live_count++;
+
+        pdebug(DEBUG_DETAIL,"Using ID %d", new_id);
     }
 
     pdebug(DEBUG_DETAIL, "Done.");
@@ -3818,6 +9814,62 @@ int add_tag_lookup(plc_tag_p tag)
 
 
 
+/*
+ * remove_tag_lookup
+ *
+ * Take the tag out of the handle table.  The table's reference to the
+ * tag is returned to the caller.
+ */
+
+plc_tag_p remove_tag_lookup(int32_t tag_id)
+{
+    plc_tag_p tag = NULL;
+    tag_slot_t *slot = tag_slot_get(tag_id);
+
+    if(!slot) {
+        return NULL;
+    }
+
+    critical_block(tag_lookup_mutex) {
+        spin_block(&slot->lock) {
+            if(slot->tag && slot->tag_id == tag_id) {
+                tag = slot->tag;
+                slot->tag = NULL;
+                slot->tag_id = 0;
+            }
+        }
+
+        if(tag) {
+            int32_t index = tag_id & TAG_SLOT_MASK;
+            int32_t live_index = slot->live_index;
+
+            /* fill the hole in the live array with the last entry. */
+            if(live_index >= 0 && live_index < tag_live_count) {
+                tag_live_count--;
+
+                if(live_index != tag_live_count) {
+                    tag_live[live_index] = tag_live[tag_live_count];
+                    TAG_SLOT_AT(tag_live[live_index].slot_index)->live_index = live_index;
+                }
+            }
+
+            slot->live_index = -1;
+
+            if(tag_slot_free_tail >= 0) {
+                TAG_SLOT_AT(tag_slot_free_tail)->next_free = index;
+            } else {
+                tag_slot_free_head = index;
+            }
+
+            tag_slot_free_tail = index;
+        }
+    }
+
+    return tag;
+}
+
+
+
 /*
  * get the string count length depending on the PLC string type.
  *
@@ -4103,3 +10155,177 @@ int get_string_length_unsafe(plc_tag_p tag, int offset)
 // }
 
 
+
+
+
+/*
+ * plc_tag_generic_add_cpu
+ *
+ * Called by the tickler and the session threads with the time they spent
+ * on a tag.  New tags are not counted once the table is full.
+ */
+
+void plc_tag_generic_add_cpu(int32_t tag_id, int64_t tickler_ns, int64_t session_ns)
+{
+    if(!tag_cpu_accounting || tag_id <= 0) {
+        return;
+    }
+
+    spin_block(&tag_cpu_lock) {
+        tag_cpu_entry_t *entry = NULL;
+
+        if(!tag_cpu_table) {
+            break;
+        }
+
+        entry = (tag_cpu_entry_t *)hashtable_get(tag_cpu_table, (int64_t)tag_id);
+
+        if(!entry && hashtable_entries(tag_cpu_table) < TAG_CPU_MAX_TAGS) {
+            entry = (tag_cpu_entry_t *)mem_alloc((int)sizeof(*entry));
+
+            if(entry) {
+                entry->tag_id = tag_id;
+
+                if(hashtable_put(tag_cpu_table, (int64_t)tag_id, entry) != PLCTAG_STATUS_OK) {
+                    mem_free(entry);
+                    entry = NULL;
+                }
+            }
+        }
+
+        if(entry) {
+            entry->tickler_ns += tickler_ns;
+            entry->session_ns += session_ns;
+        }
+    }
+}
+
+
+
+int tag_cpu_reset(int enable)
+{
+    hashtable_p old_table = NULL;
+    hashtable_p new_table = NULL;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(enable) {
+        new_table = hashtable_create(TAG_CPU_MAX_TAGS / 4);
+
+        if(!new_table) {
+            pdebug(DEBUG_WARN, "Unable to allocate CPU accounting table!");
+            return PLCTAG_ERR_NO_MEM;
+        }
+    }
+
+    spin_block(&tag_cpu_lock) {
+        old_table = tag_cpu_table;
+        tag_cpu_table = new_table;
+        tag_cpu_accounting = enable;
+    }
+
+    if(old_table) {
+        hashtable_on_each(old_table, tag_cpu_free_entry, NULL);
+        hashtable_destroy(old_table);
+    }
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/* keep the report sorted, most expensive first, by insertion. */
+int tag_cpu_top_entry(hashtable_p table, int64_t key, void *data, void *context)
+{
+    tag_cpu_top_t *top = (tag_cpu_top_t *)context;
+    tag_cpu_entry_t *entry = (tag_cpu_entry_t *)data;
+    int64_t total = entry->tickler_ns + entry->session_ns;
+    int pos = top->count;
+
+    (void)table;
+    (void)key;
+
+    while(pos > 0 && (top->top[pos - 1].tickler_ns + top->top[pos - 1].session_ns) < total) {
+        if(pos < top->max_count) {
+            top->top[pos] = top->top[pos - 1];
+        }
+
+        pos--;
+    }
+
+    if(pos < top->max_count) {
+        top->top[pos] = *entry;
+
+        if(top->count < top->max_count) {
+            top->count++;
+        }
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+int tag_cpu_free_entry(hashtable_p table, int64_t key, void *data, void *context)
+{
+    (void)table;
+    (void)key;
+    (void)context;
+
+    mem_free(data);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * Copy the fan-out data into the tag like plc_tag_set_raw_bytes() would.
+ * The write is started right after, so the tag is not marked for an
+ * automatic write.
+ */
+int tag_copy_source_unsafe(plc_tag_p tag, const tag_write_source_t *source)
+{
+    if(!tag->data) {
+        pdebug(DEBUG_WARN, "Tag has no data!");
+        return PLCTAG_ERR_NO_DATA;
+    }
+
+    if(tag->is_bit) {
+        pdebug(DEBUG_WARN, "Fan-out writes are not supported on bit tags.");
+        return PLCTAG_ERR_UNSUPPORTED;
+    }
+
+    if(source->offset + source->length > tag->size) {
+        pdebug(DEBUG_WARN, "Data offset out of bounds!");
+        return PLCTAG_ERR_OUT_OF_BOUNDS;
+    }
+
+    tag_add_dirty_range_unsafe(tag, source->offset, source->length);
+
+    plc_tag_generic_data_write_begin(tag);
+    mem_copy(tag->data + source->offset, (void *)source->buffer, source->length);
+    plc_tag_generic_data_write_end(tag);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * plc_tag_generic_read_latency_us
+ *
+ * For protocols that time their retries or hedges from what reads
+ * usually take.
+ */
+
+int plc_tag_generic_read_latency_us(plc_tag_p tag, int percent)
+{
+    if(!tag || !tag->stats) {
+        return 0;
+    }
+
+    return tag_stats_hist_percentile(&tag->stats->read_latency, percent);
+}
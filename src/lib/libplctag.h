@@ -33,6 +33,7 @@
 
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
 
 #ifdef __cplusplus
@@ -101,6 +102,7 @@ extern "C" {
 #define PLCTAG_ERR_WRITE            (-37)
 #define PLCTAG_ERR_PARTIAL          (-38)
 #define PLCTAG_ERR_BUSY             (-39)
+#define PLCTAG_ERR_UNAVAILABLE      (-40)
 
 
 
@@ -160,6 +162,36 @@ LIB_EXPORT int plc_tag_check_lib_version(int req_major, int req_minor, int req_p
 
 
 
+/*
+ * plc_tag_set_allocator
+ *
+ * Have the library allocate all of its memory with the passed functions
+ * instead of the C library malloc(), realloc() and free().  This is for
+ * applications that need a fixed memory budget or their own heap.
+ *
+ * All three functions must be passed, or all three NULL to go back to
+ * the C library.  The allocator must be set before anything else is done
+ * with the library.  Once the library has allocated memory this returns
+ * PLCTAG_ERR_BUSY.  The functions may be called from any library thread.
+ */
+
+LIB_EXPORT int plc_tag_set_allocator(void *(*alloc_func)(size_t size), void *(*realloc_func)(void *mem, size_t size), void (*free_func)(void *mem));
+
+/*
+ * For very large numbers of tags set the tag_arena library attribute (tag
+ * ID 0) to 1 before creating them.  Tag structures, their mutexes and
+ * condition vars and other small library objects are then cut from large
+ * chunks, so the parts of tags created together sit together and each
+ * costs no allocator overhead.  Freed objects are reused, the chunks are
+ * kept until the process exits.
+ *
+ * Setting the tag_lock_pool library attribute to 1 makes new tags share
+ * their API and external mutexes from two pools of 256 instead of each
+ * creating two.  Tags sharing a pool slot can briefly wait on each other.
+ */
+
+
+
 
 /*
  * tag functions
@@ -193,6 +225,59 @@ LIB_EXPORT int32_t plc_tag_create(const char *attrib_str, int timeout);
 
 
 
+/*
+ * plc_tag_create_many
+ *
+ * Create count tags, one for each attribute string.  The tags are set up in
+ * parallel and all of them are waited on for at most timeout milliseconds,
+ * so the total time is set by the slowest PLC rather than by the number of
+ * tags.
+ *
+ * The tag handle, or a PLCTAG_ERR_xyz error, for each attribute string is
+ * returned in the matching entry of ids_out.  The return value is the first
+ * error found or PLCTAG_STATUS_OK if all tags were created.  As with
+ * plc_tag_create(), a zero timeout returns handles to tags that may still be
+ * pending.
+ */
+
+LIB_EXPORT int plc_tag_create_many(const char **attrib_strs, int count, int32_t *ids_out, int timeout);
+
+
+
+/*
+ * plc_tag_create_ex
+ *
+ * Create a tag like plc_tag_create() with the callback already registered.
+ * The callback is called with PLCTAG_EVENT_CREATED when the creation process
+ * finishes, successfully or not.
+ *
+ * With a zero timeout the handle is returned immediately and the tag is
+ * finished in the background by the library's own threads, so there is no
+ * need to poll plc_tag_status().  With a non-zero timeout this waits like
+ * plc_tag_create() and the event is raised once the tag is ready.
+ */
+
+LIB_EXPORT int32_t plc_tag_create_ex(const char *attrib_str, void (*tag_callback_func)(int32_t tag_id, int event, int status), int timeout);
+
+
+
+/*
+ * plc_tag_attach_shared
+ *
+ * Create a read only tag on data that another process on this machine
+ * publishes with the shared_region=<region> attribute on its tags.  The
+ * key is the shared_key attribute of the publishing tag, or its name.
+ *
+ * Reads copy the latest published data out of shared memory and never go
+ * to the PLC, so any number of processes can follow the same tags.  The
+ * read status is the status of the publisher's last read.  The same tag
+ * can be created with "protocol=shared&shared_region=<region>&name=<key>".
+ */
+
+LIB_EXPORT int32_t plc_tag_attach_shared(const char *region, const char *key, int timeout);
+
+
+
 /*
  * plc_tag_shutdown
  *
@@ -229,6 +314,7 @@ LIB_EXPORT void plc_tag_shutdown(void);
  *      * a tag write operation ending.
  *      * a tag write being aborted.
  *      * a tag being destroyed
+ *      * a tag value changing after a read
  *
  * The callback is called outside of the internal tag mutex so it can call any tag functions safely.   However,
  * the callback is called in the context of the internal tag helper thread and not the client library thread(s).
@@ -259,6 +345,26 @@ LIB_EXPORT void plc_tag_shutdown(void);
 
 #define PLCTAG_EVENT_DESTROYED          (6)
 
+/*
+ * Only raised on tags created with change_detect=1 or a deadband.  The
+ * changed byte ranges can be fetched with plc_tag_get_changed_ranges().
+ */
+#define PLCTAG_EVENT_VALUE_CHANGED      (7)
+
+/*
+ * Only raised on tags created with plc_tag_create_ex().  The status is
+ * PLCTAG_STATUS_OK if the tag is ready or the PLCTAG_ERR_xyz error that
+ * stopped the creation.
+ */
+#define PLCTAG_EVENT_CREATED            (8)
+
+/*
+ * Raised when the circuit breaker of the tag's PLC connection opens, with
+ * PLCTAG_ERR_UNAVAILABLE, or closes again, with PLCTAG_STATUS_OK.  The
+ * event is raised the next time the library services the tag.
+ */
+#define PLCTAG_EVENT_CIRCUIT_BREAKER    (9)
+
 LIB_EXPORT int plc_tag_register_callback(int32_t tag_id, void (*tag_callback_func)(int32_t tag_id, int event, int status));
 
 
@@ -281,6 +387,69 @@ LIB_EXPORT int plc_tag_unregister_callback(int32_t tag_id);
 
 
 
+
+/*
+ * plc_tag_get_changed_ranges
+ *
+ * Tags created with change_detect=1 raise PLCTAG_EVENT_VALUE_CHANGED only
+ * when a read returns data that differs from the previous sample.  With
+ * deadband_type=<int8|uint8|int16|uint16|int32|uint32|int64|uint64|float32|float64>
+ * the data is compared element by element, and with deadband=<value> an
+ * element only counts as changed when it moves by more than the deadband.
+ *
+ * This function copies up to max_ranges byte offsets and lengths of the
+ * changed data from the most recent change.  It returns the number of
+ * ranges copied or an error.
+ */
+
+LIB_EXPORT int plc_tag_get_changed_ranges(int32_t tag_id, int *offsets, int *lengths, int max_ranges);
+
+
+
+
+/*
+ * plc_tag_get_member_offset
+ *
+ * Logix tags created with udt_templates=1 read the UDT templates of the
+ * tag data from the controller during the first read.  The templates are
+ * kept per PLC connection, so other tags of the same types do not read
+ * them again.
+ *
+ * This function returns the byte offset in the tag data of a member such
+ * as "Motor.Speed", "Data[3]" or, for an array of structures,
+ * "[2].Motor.Speed".  The path is resolved once and remembered.  Use the
+ * offset with the plc_tag_get_/plc_tag_set_ functions.  BOOL members are
+ * bits inside a hidden member and return PLCTAG_ERR_UNSUPPORTED.
+ */
+
+LIB_EXPORT int plc_tag_get_member_offset(int32_t tag_id, const char *member_path);
+
+
+
+
+/*
+ * Read groups
+ *
+ * Tags created with the attribute read_group=<name> belong to the named
+ * group.  Reads of group members that come due at the same time are queued
+ * together so that they are packed into as few requests as possible.
+ *
+ * plc_tag_read_group() reads all the tags in the group at once.  The timeout
+ * works the same way as for plc_tag_read().
+ *
+ * plc_tag_register_group_callback() registers a single callback for the
+ * group.  It is called with PLCTAG_EVENT_READ_STARTED when the first read of
+ * a group read cycle starts and with PLCTAG_EVENT_READ_COMPLETED when the last
+ * one finishes.  The status is the first error seen in the cycle or
+ * PLCTAG_STATUS_OK.  Automatic reads, plc_tag_read_group() and
+ * plc_tag_read() on a member all count.  Pass NULL to remove the callback.
+ */
+
+LIB_EXPORT int plc_tag_read_group(const char *group_name, int timeout);
+LIB_EXPORT int plc_tag_register_group_callback(const char *group_name, void (*group_callback_func)(const char *group_name, int event, int status));
+
+
+
 /*
  * plc_tag_register_logger
  *
@@ -397,6 +566,24 @@ LIB_EXPORT int plc_tag_read(int32_t tag, int timeout);
 
 
 
+/*
+ * plc_tag_read_range
+ *
+ * Like plc_tag_read, but only elem_count elements starting at element
+ * elem_offset are read.  Only that span is sent by the PLC, the rest of
+ * the tag data is left as it was.  The tag must have been read once so
+ * that the element size is known.  Returns PLCTAG_ERR_UNSUPPORTED for
+ * tag types that cannot read part of a tag.
+ *
+ * With the read_ahead=N attribute, a range that starts where the last one
+ * ended is read together with the next N ranges of the same size.  The
+ * following calls for those ranges complete at once from that data until
+ * the tag is written or fully read.
+ */
+LIB_EXPORT int plc_tag_read_range(int32_t tag, int elem_offset, int elem_count, int timeout);
+
+
+
 
 /*
  * plc_tag_status
@@ -427,6 +614,166 @@ LIB_EXPORT int plc_tag_status(int32_t tag);
  */
 LIB_EXPORT int plc_tag_write(int32_t tag, int timeout);
 
+/*
+ * Logix tags created with write_dirty_ranges=1 remember the bytes changed
+ * by the plc_tag_set_* functions and plc_tag_write only sends those,
+ * one partial write per range.  Ranges closer than write_merge_gap bytes
+ * (default 32) are sent together.  Changes made directly to a bound
+ * buffer are not tracked.  With nothing tracked the whole tag is written.
+ */
+
+/*
+ * Logix tags are normally read once when created to learn the data type
+ * that writes must carry.  Tags created with initial_read=0 skip that
+ * read when the type is known, either from elem_type or because another
+ * tag on the same PLC connection already listed the controller symbols
+ * (use_instance_id=1) and, for UDTs, read the template (udt_templates=1).
+ * The tag data starts zeroed.
+ */
+
+/*
+ * With metadata_cache_file=<path> the symbol instance IDs, UDT templates
+ * and the types found by first reads are also kept in that file, per
+ * gateway and path.  After a restart, tags with initial_read=0 that were
+ * read before are ready without a read.  Stale entries are dropped when
+ * the PLC disagrees with them.  The first tag that names a file sets it.
+ */
+
+/*
+ * AB tags created with circuit_breaker_failures=N stop waiting on a PLC
+ * that cannot be reached.  After N connection failures in a row, with no
+ * response in between, queued and new requests fail at once with
+ * PLCTAG_ERR_UNAVAILABLE.  The library keeps trying to reconnect, waiting
+ * twice as long each time up to 30 seconds, and the breaker closes when
+ * it gets through.  The int attribute circuit_breaker_open is 1 while it
+ * is open.  The first tag that sets a threshold sets it for the PLC.
+ */
+
+/*
+ * Logix class tags can name a redundant pair with gateway=<primary>,<standby>.
+ * Both sessions are kept open.  When the circuit breaker of the gateway in
+ * use opens (circuit_breaker_failures defaults to 3 here), the tag moves to
+ * the other one, and a read the breaker failed is sent again there.  With
+ * hedge_reads=1 a read that has not been answered after the read latency
+ * p99, or hedge_delay_ms if set, is also sent to the other gateway.  The
+ * first answer wins and the tag stays on the gateway that gave it.  Writes
+ * are never duplicated.  The int attribute failovers counts the moves.
+ */
+
+/*
+ * AB tags created with max_packets_per_sec=N and/or max_bytes_per_sec=N
+ * limit the traffic their session sends to the PLC.  Requests wait in
+ * their queue until the token bucket allows the next packet, bursts of up
+ * to a tenth of a second are sent at once.  The last quarter of each
+ * bucket is only used when high priority requests are waiting, so those
+ * still get through when normal and low traffic is held back.  The first
+ * tag that sets a limit sets it for the PLC.
+ */
+
+/*
+ * AB tags created with share_socket=1 share one TCP connection and EIP
+ * registration with the other share_socket=1 sessions to the same
+ * gateway, for example controllers in several slots behind one ENBT.
+ * Each path still gets its own CIP connection and packing.  The sessions
+ * take turns on the socket, one window of requests at a time.  Pooled
+ * sessions and share_session=0 always open their own socket.
+ */
+
+/*
+ * Tag listing tags (@tags) hold the raw listing entries.  Instead of walking
+ * them, the int attribute list_entry_count gives the number of entries and
+ * list_<field>.<index> decodes one field of one entry.  The fields are
+ * entry_offset, instance_id, symbol_type, elem_size, num_dims, dim0, dim1,
+ * dim2, name_offset and name_len, the offsets are into the tag data.  The
+ * entries are indexed on the first of these after each read.
+ */
+
+/*
+ * AB tags created with keepalive_ms=N keep their PLC connection open
+ * while idle instead of closing it after a few seconds.  When nothing has
+ * been sent for N ms, a connected session reads the Identity vendor ID
+ * over its connection and an unconnected one sends an encapsulation NOP.
+ * Pick N below the connection timeout of the PLC.  The shortest interval
+ * asked for by a tag on the PLC is used, the minimum is 100 ms.
+ */
+
+/*
+ * Logix tags created with io_rpi_ms=N use a CIP Class 1 implicit I/O
+ * connection instead of polling and the PLC sends the data every N ms over
+ * UDP, to io_udp_port (default 2222).  I/O assemblies are addressed with
+ * io_config_instance, io_output_instance and io_input_instance instead of
+ * a tag name.  Only the standard Forward Open is used, so the tag data can
+ * be at most 498 bytes.  Larger tags fail with PLCTAG_ERR_TOO_LARGE.
+ */
+
+/*
+ * Modbus connections close after idle_timeout_ms (default 5000) without
+ * traffic and reopen on the next request.  idle_timeout_ms=0 keeps the
+ * connection open.  With reconnect_ahead_ms=N a connection closed while
+ * idle is reopened N ms before the next auto_sync_read_ms read of a tag on
+ * the PLC, so that read does not wait for the TCP connect.  The tags on a
+ * PLC share the longest idle time and reconnect lead asked for.
+ */
+
+/*
+ * A tag created with alias_of=<tag id>&offset=<bytes>&size=<bytes> is a
+ * view on that range of another tag.  It sends no requests of its own.
+ * Each read of the parent updates the alias and raises its read completed
+ * event.  plc_tag_read() on the alias waits for the next parent read and
+ * starts one if the parent is idle.  plc_tag_write() copies the alias data
+ * into the parent and writes only that range, the parent must be created
+ * with write_dirty_ranges=1.  Without size the alias runs to the end of the
+ * parent.  Aliases use the byte order of the parent.
+ */
+
+/*
+ * Logix bit tags on the same element, like MyDint.3 and MyDint.5 on one
+ * PLC connection, share its reads.  A bit tag that starts a read while
+ * another one is reading the element waits for that read and takes its
+ * data instead of sending a request.  Create the tag with
+ * share_bit_read=0 to always read on its own.
+ */
+
+
+
+/*
+ * plc_tag_write_range
+ *
+ * Like plc_tag_write, but only elem_count elements starting at element
+ * elem_offset are written from the tag data.
+ */
+LIB_EXPORT int plc_tag_write_range(int32_t tag, int elem_offset, int elem_count, int timeout);
+
+
+
+
+/*
+ * plc_tag_read_many
+ * plc_tag_write_many
+ *
+ * Start a read or write on each of the num_tags tags in the tags array.  All
+ * of the requests are queued before any of them are sent so that they can be
+ * packed together.  If the timeout is not zero, wait until all operations are
+ * done or the timeout occurs, whichever is first.
+ *
+ * The status of each tag's operation is returned in the matching entry of the
+ * statuses array.  The return value is the first error found.  If there are
+ * no errors, it is PLCTAG_STATUS_PENDING if any operations are still in
+ * flight (timeout zero) or PLCTAG_STATUS_OK if all succeeded.
+ */
+LIB_EXPORT int plc_tag_read_many(int32_t *tags, int num_tags, int *statuses, int timeout);
+LIB_EXPORT int plc_tag_write_many(int32_t *tags, int num_tags, int *statuses, int timeout);
+
+/*
+ * plc_tag_write_fanout
+ *
+ * Like plc_tag_write_many, but first copies buffer_length bytes from buffer
+ * into each tag at offset.  For writing one value, a recipe or the time to
+ * the same tag on many PLCs.  A tag whose data is too small gets
+ * PLCTAG_ERR_OUT_OF_BOUNDS in its status and is not written.
+ */
+LIB_EXPORT int plc_tag_write_fanout(int32_t *tags, int num_tags, int offset, const uint8_t *buffer, int buffer_length, int *statuses, int timeout);
+
 
 
 
@@ -481,6 +828,122 @@ LIB_EXPORT int plc_tag_set_float32(int32_t tag, int offset, float val);
 LIB_EXPORT int plc_tag_set_raw_bytes(int32_t id, int offset, uint8_t *buffer, int buffer_length);
 LIB_EXPORT int plc_tag_get_raw_bytes(int32_t id, int offset, uint8_t *buffer, int buffer_length);
 
+/*
+ * typed array bulk access
+ *
+ * These get or set count elements starting at the byte offset in one call.
+ * The values are converted using the byte order of the tag.  They return
+ * PLCTAG_STATUS_OK or an error.
+ */
+LIB_EXPORT int plc_tag_get_int64_array(int32_t id, int offset, int64_t *buffer, int count);
+LIB_EXPORT int plc_tag_set_int64_array(int32_t id, int offset, const int64_t *buffer, int count);
+
+LIB_EXPORT int plc_tag_get_int32_array(int32_t id, int offset, int32_t *buffer, int count);
+LIB_EXPORT int plc_tag_set_int32_array(int32_t id, int offset, const int32_t *buffer, int count);
+
+LIB_EXPORT int plc_tag_get_int16_array(int32_t id, int offset, int16_t *buffer, int count);
+LIB_EXPORT int plc_tag_set_int16_array(int32_t id, int offset, const int16_t *buffer, int count);
+
+LIB_EXPORT int plc_tag_get_float64_array(int32_t id, int offset, double *buffer, int count);
+LIB_EXPORT int plc_tag_set_float64_array(int32_t id, int offset, const double *buffer, int count);
+
+LIB_EXPORT int plc_tag_get_float32_array(int32_t id, int offset, float *buffer, int count);
+LIB_EXPORT int plc_tag_set_float32_array(int32_t id, int offset, const float *buffer, int count);
+
+/*
+ * Copy all of the tag data without blocking the IO path.  Returns the number
+ * of bytes copied or an error.  The sequence count changes each time the tag
+ * data changes and is returned in seq if it is not NULL.
+ */
+LIB_EXPORT int plc_tag_get_snapshot(int32_t id, uint8_t *buffer, int buffer_length, uint32_t *seq);
+
+/*
+ * Get one value from each of count tags.  Value i is read at byte
+ * offsets[i] of tag ids[i] and stored as element i of out, an array of the
+ * C type named by type.  Bit tags give their bit.  The status of each
+ * value goes in status[i] if status is not NULL.  The tag API mutexes are
+ * not taken unless the data is being changed.  Returns PLCTAG_STATUS_OK or
+ * the first error.
+ */
+#define PLCTAG_VALUE_INT8       (1)
+#define PLCTAG_VALUE_UINT8      (2)
+#define PLCTAG_VALUE_INT16      (3)
+#define PLCTAG_VALUE_UINT16     (4)
+#define PLCTAG_VALUE_INT32      (5)
+#define PLCTAG_VALUE_UINT32     (6)
+#define PLCTAG_VALUE_INT64      (7)
+#define PLCTAG_VALUE_UINT64     (8)
+#define PLCTAG_VALUE_FLOAT32    (9)
+#define PLCTAG_VALUE_FLOAT64    (10)
+LIB_EXPORT int plc_tag_get_values(const int32_t *ids, const int *offsets, int type, void *out, int *status, int count);
+
+/*
+ * Get when the data of the last successful read arrived and how many
+ * successful reads the tag has had.  The time is in microseconds from a
+ * monotonic clock, taken when the response was received where the
+ * protocol reports it.  A jump of more than one in seq between two calls
+ * means reads were missed.  The seq count is also the sample_seq
+ * attribute.
+ */
+LIB_EXPORT int plc_tag_get_sample_info(int32_t id, int64_t *time_us, uint32_t *seq);
+
+/*
+ * Tags created with history_depth=N keep the data of their last N reads.
+ * Move the oldest ones into the buffer, as many as fit, and return the
+ * number of bytes copied or an error.  The number of records is returned
+ * in count.  Each record is a time stamp in microseconds, native int64_t,
+ * followed by plc_tag_get_size() bytes of data.  The time stamps are the
+ * ones plc_tag_get_sample_info() gives.  Records overwritten before they were read are counted
+ * by the history_dropped attribute.
+ */
+#define PLCTAG_HISTORY_TIMESTAMP_SIZE (8)
+LIB_EXPORT int plc_tag_read_history(int32_t id, uint8_t *buffer, int buffer_length, int *count);
+
+/*
+ * Keep the tag data in an application buffer so that reads land in it
+ * without a copy.  The buffer must stay valid until it is unbound by passing
+ * NULL or the tag is destroyed.  If the tag data grows past buffer_length
+ * the tag goes back to its own buffer.  Not supported with double_buffer=1.
+ */
+LIB_EXPORT int plc_tag_bind_buffer(int32_t id, uint8_t *buffer, int buffer_length);
+
+/*
+ * Find the tags that use the most CPU time.  Set the cpu_accounting library
+ * attribute (tag ID 0) to 1 first, that also clears the totals.  Fills in
+ * up to max_count tag IDs, most expensive first, with the nanoseconds spent
+ * in the tickler on each and in the session threads packing and unpacking
+ * its requests.  Either time array may be NULL.  Destroyed tags stay in the
+ * report.  Returns the number of tags filled in.
+ */
+LIB_EXPORT int plc_tag_get_cpu_top(int32_t *ids, int64_t *tickler_ns, int64_t *session_ns, int max_count);
+
+/*
+ * Library wide metrics as Prometheus text, one line per counter for each
+ * session, PLC connection and tickler thread.  The first line gives the
+ * format version.  Returns the number of characters copied, or with a NULL
+ * buffer the size of buffer needed including the terminating zero.
+ */
+LIB_EXPORT int plc_tag_get_metrics(char *buffer, int buffer_length);
+
+/*
+ * The same metrics can be read as system tags, make=system&family=library
+ * with name=stats/sessions for all sessions and PLC connections,
+ * name=stats/session/<gateway> for the ones to one host or name=stats/tickler
+ * for the tickler threads.  A leading @ on the name is allowed.  The data is
+ * little endian 64-bit integers, the rates are since the previous read of
+ * the same tag and are zero on the first read.
+ *
+ * sessions:  0 sessions, 1 packets sent, 2 packets received, 3 bytes sent,
+ *            4 bytes received, 5 requests sent, 6 requests in flight,
+ *            7 largest queue depth, 8 connects, 9 forward open failures,
+ *            10 requests expired, 11 packets/s, 12 bytes/s,
+ *            13 requests per packet x100, 14 packet fill percent.
+ * tickler:   0 threads, 1 loops, 2 loop time us, 3 longest loop us,
+ *            4 largest queue depth, 5 loops/s, 6 average loop us.
+ *
+ * The field number times 8 is the offset for plc_tag_get_int64().
+ */
+
 /* string accessors */
 
 LIB_EXPORT int plc_tag_get_string(int32_t tag_id, int string_start_offset, char *buffer, int buffer_length);
@@ -489,6 +952,19 @@ LIB_EXPORT int plc_tag_get_string_length(int32_t tag_id, int string_start_offset
 LIB_EXPORT int plc_tag_get_string_capacity(int32_t tag_id, int string_start_offset);
 LIB_EXPORT int plc_tag_get_string_total_length(int32_t tag_id, int string_start_offset);
 
+/*
+ * string array bulk access
+ *
+ * Get or set count strings that follow each other in the tag data from the
+ * byte offset, under one lock.  Get copies each string into buffer with a
+ * terminating zero and fills in where each one starts and how long it is.
+ * Set takes the strings from buffer at the given offsets, with the given
+ * lengths or zero terminated if str_lengths is NULL.  Set needs fixed length
+ * strings like the Logix STRING and PCCC ST types.
+ */
+LIB_EXPORT int plc_tag_get_string_array(int32_t tag_id, int string_start_offset, int count, char *buffer, int buffer_length, int *str_offsets, int *str_lengths);
+LIB_EXPORT int plc_tag_set_string_array(int32_t tag_id, int string_start_offset, int count, const char *buffer, const int *str_offsets, const int *str_lengths);
+
 #ifdef __cplusplus
 }
 #endif
@@ -37,6 +37,7 @@
 
 #include <lib/libplctag.h>
 #include <platform.h>
+#include <util/atomic_int.h>
 #include <util/attr.h>
 #include <util/debug.h>
 
@@ -47,6 +48,15 @@
 
 typedef struct plc_tag_t *plc_tag_p;
 
+typedef struct tag_group_t *tag_group_p;
+typedef struct tag_scan_class_t *tag_scan_class_p;
+typedef struct tag_change_t *tag_change_p;
+typedef struct tag_dirty_t *tag_dirty_p;
+typedef struct tag_shared_t *tag_shared_p;
+typedef struct tag_alias_t *tag_alias_p;
+typedef struct tag_history_t *tag_history_p;
+typedef struct tag_retired_t *tag_retired_p;
+
 
 typedef int (*tag_vtable_func)(plc_tag_p tag);
 
@@ -61,6 +71,12 @@ struct tag_vtable_t {
     /* attribute accessors. */
     int (*get_int_attrib)(plc_tag_p tag, const char *attrib_name, int default_value);
     int (*set_int_attrib)(plc_tag_p tag, const char *attrib_name, int new_value);
+
+    /* structure member lookup, NULL if the protocol does not know the layout. */
+    int (*get_member_offset)(plc_tag_p tag, const char *member_path);
+
+    /* limit the next operation to elem_count elements from elem_offset, zero elem_count clears it. */
+    int (*set_range)(plc_tag_p tag, int elem_offset, int elem_count);
 };
 
 typedef struct tag_vtable_t *tag_vtable_p;
@@ -96,6 +112,37 @@ struct tag_byte_order_s {
 typedef struct tag_byte_order_s tag_byte_order_t;
 
 
+/*
+ * Per tag statistics.  Latencies are kept in histograms with power of two
+ * microsecond buckets so that percentiles can be estimated cheaply.  The
+ * statistics are protected by the tag API mutex.
+ */
+
+#define TAG_STATS_BUCKETS (24)
+
+typedef struct {
+    uint32_t count;
+    uint32_t buckets[TAG_STATS_BUCKETS];
+    int64_t total_us;
+    int64_t max_us;
+} tag_latency_hist_t;
+
+typedef struct {
+    int64_t op_start_us;
+    uint32_t read_count;
+    uint32_t write_count;
+    uint32_t error_count;
+    uint32_t timeout_count;
+    uint32_t fragment_count;
+    tag_latency_hist_t read_latency;
+    tag_latency_hist_t write_latency;
+    tag_latency_hist_t queue_wait;
+    tag_latency_hist_t wire_rtt;
+} tag_stats_t;
+
+typedef tag_stats_t *tag_stats_p;
+
+
 
 
 /*
@@ -103,6 +150,13 @@ typedef struct tag_byte_order_s tag_byte_order_t;
  * by the protocol-specific implementations.
  *
  * The base type only has a vtable for operations.
+ *
+ * The fields used on every pass of the tickler and by the data accessors
+ * come first so that they share the first cache lines of the tag.  Set up
+ * fields follow.  The statistics are large and only touched when an
+ * operation finishes, so they are kept in their own block.  data_inline is
+ * set when the data buffer is part of the tag allocation, it must never be
+ * freed or swapped out.
  */
 
 #define TAG_BASE_STRUCT uint8_t is_bit:1; \
@@ -111,22 +165,60 @@ typedef struct tag_byte_order_s tag_byte_order_t;
                         uint8_t read_complete:1; \
                         uint8_t write_in_flight:1; \
                         uint8_t write_complete:1; \
+                        uint8_t is_double_buffered:1; \
+                        uint8_t is_bound:1; \
+                        uint8_t create_pending:1; \
+                        uint8_t coalesce_writes:1; \
+                        uint8_t write_queued:1; \
+                        uint8_t data_inline:1; \
+                        uint8_t breaker_event:1; \
+                        uint8_t breaker_open:1; \
+                        uint8_t locks_pooled:1; \
                         uint8_t bit; \
+                        uint8_t native_byte_order; \
+                        uint8_t swapped_byte_order; \
                         int8_t status; \
                         int32_t size; \
                         int32_t tag_id; \
-                        int32_t auto_sync_read_ms; \
-                        int32_t auto_sync_write_ms; \
+                        volatile uint32_t data_seq; \
+                        uint32_t sample_seq; \
+                        int64_t sample_time_us; \
+                        int64_t last_response_us; \
                         uint8_t *data; \
-                        tag_byte_order_t *byte_order; \
-                        mutex_p ext_mutex; \
-                        mutex_p api_mutex; \
                         tag_vtable_p vtable; \
-                        void (*callback)(int32_t tag_id, int event, int status); \
+                        mutex_p api_mutex; \
+                        tag_byte_order_t *byte_order; \
+                        int64_t sched_next_tick; \
+                        int64_t auto_sync_next_read; \
+                        int64_t auto_sync_next_write; \
                         int64_t read_cache_expire; \
+                        int64_t op_deadline; \
+                        int32_t auto_sync_read_ms; \
+                        int32_t auto_sync_write_ms; \
+                        int32_t sched_shard; \
+                        uint32_t plc_key; \
+                        void (*callback)(int32_t tag_id, int event, int status); \
+                        mutex_p ext_mutex; \
+                        cond_p tag_cond_wait; \
                         int64_t read_cache_ms; \
-                        int64_t auto_sync_next_read; \
-                        int64_t auto_sync_next_write
+                        int32_t read_ahead; \
+                        int32_t read_ahead_next; \
+                        int32_t read_ahead_start; \
+                        int32_t read_ahead_end; \
+                        tag_group_p read_group; \
+                        tag_scan_class_p scan_class; \
+                        tag_retired_p retired_data; \
+                        atomic_int data_readers; \
+                        uint8_t *back_data; \
+                        uint8_t *owned_data; \
+                        int32_t owned_size; \
+                        int32_t bound_size; \
+                        tag_change_p change_detect; \
+                        tag_dirty_p dirty_ranges; \
+                        tag_shared_p shared; \
+                        tag_alias_p aliases; \
+                        tag_history_p history; \
+                        tag_stats_p stats
 
 
 
@@ -143,3 +235,81 @@ extern void lib_teardown(void);
 extern int plc_tag_abort_mapped(plc_tag_p tag);
 extern int plc_tag_destroy_mapped(plc_tag_p tag);
 extern int plc_tag_status_mapped(plc_tag_p tag);
+
+/* ask the tickler thread to service the tag as soon as possible, or after delay_ms. */
+extern void plc_tag_tickler_wake(plc_tag_p tag);
+extern void plc_tag_tickler_wake_later(plc_tag_p tag, int delay_ms);
+
+/* called by protocol threads when IO for the tag completes. */
+extern void plc_tag_generic_wake_tag(int32_t id);
+
+/* free the data buffers replaced by plc_tag_generic_resize_data(), for the tag destructors. */
+extern void plc_tag_generic_free_retired_data(plc_tag_p tag);
+
+/* release the tag API and external mutexes, for the tag destructors. */
+extern void plc_tag_generic_release_locks(plc_tag_p tag);
+
+/* find a live tag by ID, the caller must rc_dec() it. */
+extern plc_tag_p plc_tag_generic_lookup_tag(int32_t id);
+
+/*
+ * start a read or write of another tag without waiting, for tags built on
+ * top of it.  is_done is set if it finished at once.  The API mutex of
+ * that tag must be held.
+ */
+extern int plc_tag_generic_start_read(plc_tag_p tag, int *is_done);
+extern int plc_tag_generic_start_write(plc_tag_p tag, int *is_done);
+
+/*
+ * bracket changes to the tag data so that snapshot readers can detect them.
+ * The tag API mutex must be held.
+ */
+extern void plc_tag_generic_data_write_begin(plc_tag_p tag);
+extern void plc_tag_generic_data_write_end(plc_tag_p tag);
+
+/* change the size of the tag data buffer.  Snapshot readers may still be using the old buffer. */
+extern int plc_tag_generic_resize_data(plc_tag_p tag, int new_size);
+
+/* double buffering.  Read responses land in the read buffer, which is swapped in when the read is done. */
+extern uint8_t *plc_tag_generic_read_buffer(plc_tag_p tag);
+extern void plc_tag_generic_swap_data_buffers(plc_tag_p tag);
+
+/* recompute the byte order fast paths after the protocol changed tag->byte_order. */
+extern void plc_tag_generic_update_byte_order(plc_tag_p tag);
+
+/* give the tag its own data buffer back if the application bound one.  Call before freeing the tag data. */
+extern void plc_tag_generic_unbind_buffer(plc_tag_p tag);
+
+/*
+ * byte ranges changed by the setters since they were last written, only
+ * tracked with write_dirty_ranges.  The tag API mutex must be held.
+ */
+extern int plc_tag_generic_take_dirty_range(plc_tag_p tag, int *offset, int *length);
+extern void plc_tag_generic_add_dirty_range(plc_tag_p tag, int offset, int length);
+extern int plc_tag_generic_has_dirty_ranges(plc_tag_p tag);
+
+/*
+ * name the thread and apply the CPU affinity and priority set with the
+ * <class>_thread_cpus and <class>_thread_priority library attributes.
+ * Call right after thread_create().
+ */
+#define PLCTAG_THREAD_TICKLER (0)
+#define PLCTAG_THREAD_SESSION (1)
+#define PLCTAG_THREAD_MODBUS (2)
+#define PLCTAG_THREAD_CALLBACK (3)
+#define PLCTAG_THREAD_NUM_CLASSES (4)
+
+extern void plc_tag_generic_tune_thread(thread_p thread, int thread_class);
+
+/* call func on every live tag, without library locks held.  Stops at the first status that is not OK. */
+extern int plc_tag_generic_for_each_tag(int (*func)(plc_tag_p tag, void *context), void *context);
+
+/* record the timing of one protocol request (fragment).  Times are from time_us(), zero if unknown. */
+extern void plc_tag_generic_record_request(plc_tag_p tag, int64_t time_queued, int64_t time_sent, int64_t time_received);
+
+/* a read latency percentile in microseconds, zero if there are no reads yet.  The tag API mutex must be held. */
+extern int plc_tag_generic_read_latency_us(plc_tag_p tag, int percent);
+
+/* CPU accounting, only call plc_tag_generic_add_cpu() when tag_cpu_accounting is set. */
+extern volatile int tag_cpu_accounting;
+extern void plc_tag_generic_add_cpu(int32_t tag_id, int64_t tickler_ns, int64_t session_ns);
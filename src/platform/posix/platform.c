@@ -32,6 +32,11 @@
  ***************************************************************************/
 
 
+/* thread names and CPU affinity are GNU extensions. */
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+    #define _GNU_SOURCE
+#endif
+
 #include <platform.h>
 #include <unistd.h>
 #include <stdlib.h>
@@ -42,17 +47,24 @@
 #include <strings.h>
 #include <sys/time.h>
 #include <pthread.h>
+#include <sched.h>
 #include <stdio.h>
 #include <errno.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <time.h>
+#include <termios.h>
 
 #include <lib/libplctag.h>
+#include <util/arena.h>
 #include <util/debug.h>
 
 
@@ -64,6 +76,27 @@
     #endif
 #endif
 
+#include <poll.h>
+
+#if defined(__linux__)
+    #include <sys/epoll.h>
+    #include <sys/eventfd.h>
+    #define REACTOR_USE_EPOLL
+
+    /* optional io_uring readiness backend, falls back to epoll at run time. */
+    #if defined(PLCTAG_USE_IO_URING)
+        #include <sys/syscall.h>
+        #include <linux/io_uring.h>
+
+        #if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+            #define REACTOR_USE_IO_URING
+        #endif
+    #endif
+#elif defined(BSD_OS_TYPE)
+    #include <sys/event.h>
+    #define REACTOR_USE_KQUEUE
+#endif
+
 
 /***************************************************************************
  ******************************* Memory ************************************
@@ -71,6 +104,43 @@
 
 
 
+/*
+ * Application supplied allocator.  All three must be set or none.  The
+ * allocator cannot change once the library has allocated anything,
+ * otherwise memory would be freed by the wrong allocator.
+ */
+static mem_alloc_func mem_hook_alloc = NULL;
+static mem_realloc_func mem_hook_realloc = NULL;
+static mem_free_func mem_hook_free = NULL;
+static volatile int mem_used = 0;
+
+
+/*
+ * mem_set_allocator
+ *
+ * Replace the memory allocator.  Passing all NULLs goes back to the C
+ * library allocator.
+ */
+extern int mem_set_allocator(mem_alloc_func alloc_func, mem_realloc_func realloc_func, mem_free_func free_func)
+{
+    if((alloc_func || realloc_func || free_func) && !(alloc_func && realloc_func && free_func)) {
+        pdebug(DEBUG_WARN, "All of the allocator functions must be set or none!");
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    if(mem_used) {
+        pdebug(DEBUG_WARN, "The allocator must be set before the library allocates any memory!");
+        return PLCTAG_ERR_BUSY;
+    }
+
+    mem_hook_alloc = alloc_func;
+    mem_hook_realloc = realloc_func;
+    mem_hook_free = free_func;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
 /*
  * mem_alloc
  *
@@ -81,12 +151,25 @@
  */
 extern void *mem_alloc(int size)
 {
+    void *res = NULL;
+
     if(size <= 0) {
         pdebug(DEBUG_WARN, "Allocation size must be greater than zero bytes!");
         return NULL;
     }
 
-    return calloc((size_t)(unsigned int)size, 1);
+    mem_used = 1;
+
+    if(!mem_hook_alloc) {
+        return calloc((size_t)(unsigned int)size, 1);
+    }
+
+    res = mem_hook_alloc((size_t)(unsigned int)size);
+    if(res) {
+        memset(res, 0, (size_t)(unsigned int)size);
+    }
+
+    return res;
 }
 
 
@@ -105,6 +188,12 @@ extern void *mem_realloc(void *orig, int size)
         return NULL;
     }
 
+    mem_used = 1;
+
+    if(mem_hook_realloc) {
+        return mem_hook_realloc(orig, (size_t)(unsigned int)size);
+    }
+
     return realloc(orig, (size_t)(ssize_t)size);
 }
 
@@ -119,7 +208,11 @@ extern void *mem_realloc(void *orig, int size)
 extern void mem_free(const void *mem)
 {
     if(mem) {
-        free((void *)mem);
+        if(mem_hook_free) {
+            mem_hook_free((void *)mem);
+        } else {
+            free((void *)mem);
+        }
     }
 }
 
@@ -423,11 +516,22 @@ extern int str_length(const char *str)
  */
 extern char *str_dup(const char *str)
 {
+    int size = 0;
+    char *res = NULL;
+
     if(!str) {
         return NULL;
     }
 
-    return strdup(str);
+    /* use mem_alloc() so that mem_free() matches, even with an application allocator. */
+    size = (int)(unsigned int)strlen(str) + 1;
+
+    res = (char *)mem_alloc(size);
+    if(res) {
+        memcpy(res, str, (size_t)(unsigned int)size);
+    }
+
+    return res;
 }
 
 
@@ -608,8 +712,52 @@ char *str_concat_impl(int num_args, ...)
 struct mutex_t {
     pthread_mutex_t p_mutex;
     int initialized;
+    arena_p arena;
 };
 
+/*
+ * With tag_arena set, the mutex and condition var structures come from
+ * arenas so that the ones made for a tag sit together.
+ */
+
+static arena_p mutex_arena = NULL;
+static arena_p cond_arena = NULL;
+static lock_t sync_arena_lock = LOCK_INIT;
+
+static void *sync_obj_alloc(arena_p *arena, int size, arena_p *from)
+{
+    void *obj = NULL;
+
+    *from = NULL;
+
+    if(arena_enabled()) {
+        spin_block(&sync_arena_lock) {
+            if(!*arena) {
+                *arena = arena_create(size, 0);
+            }
+        }
+
+        obj = arena_alloc(*arena);
+        if(obj) {
+            *from = *arena;
+            return obj;
+        }
+    }
+
+    return mem_alloc(size);
+}
+
+
+static void sync_obj_free(arena_p from, void *obj)
+{
+    if(from) {
+        arena_free(from, obj);
+    } else {
+        mem_free(obj);
+    }
+}
+
+
 int mutex_create(mutex_p *m)
 {
     pdebug(DEBUG_DETAIL, "Starting.");
@@ -618,7 +766,14 @@ int mutex_create(mutex_p *m)
         pdebug(DEBUG_WARN, "Called with non-NULL pointer!");
     }
 
-    *m = (struct mutex_t *)mem_alloc(sizeof(struct mutex_t));
+    {
+        arena_p from = NULL;
+
+        *m = (struct mutex_t *)sync_obj_alloc(&mutex_arena, (int)(unsigned int)sizeof(struct mutex_t), &from);
+        if(*m) {
+            (*m)->arena = from;
+        }
+    }
 
     if(! *m) {
         pdebug(DEBUG_ERROR,"null mutex pointer.");
@@ -626,7 +781,7 @@ int mutex_create(mutex_p *m)
     }
 
     if(pthread_mutex_init(&((*m)->p_mutex),NULL)) {
-        mem_free(*m);
+        sync_obj_free((*m)->arena, *m);
         *m = NULL;
         pdebug(DEBUG_ERROR,"Error initializing mutex.");
         return PLCTAG_ERR_MUTEX_INIT;
@@ -640,6 +795,59 @@ int mutex_create(mutex_p *m)
 }
 
 
+/*
+ * Pooled mutexes are shared by many tags, so one thread may end up
+ * taking the same one for two tags.  They are recursive, and sized so
+ * that two of them never share a cache line.
+ */
+
+#define MUTEX_POOLED_SIZE (128)
+
+int mutex_create_pooled(mutex_p *m)
+{
+    pthread_mutexattr_t attr;
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    if(*m) {
+        pdebug(DEBUG_WARN, "Called with non-NULL pointer!");
+    }
+
+    *m = (struct mutex_t *)mem_alloc(((int)(unsigned int)sizeof(struct mutex_t) > MUTEX_POOLED_SIZE ? (int)(unsigned int)sizeof(struct mutex_t) : MUTEX_POOLED_SIZE));
+    if(! *m) {
+        pdebug(DEBUG_ERROR,"null mutex pointer.");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(pthread_mutexattr_init(&attr)) {
+        mem_free(*m);
+        *m = NULL;
+        pdebug(DEBUG_ERROR,"Error initializing mutex attributes.");
+        return PLCTAG_ERR_MUTEX_INIT;
+    }
+
+    if(pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE) || pthread_mutex_init(&((*m)->p_mutex), &attr)) {
+        pdebug(DEBUG_ERROR,"Error initializing recursive mutex.");
+        rc = PLCTAG_ERR_MUTEX_INIT;
+    }
+
+    pthread_mutexattr_destroy(&attr);
+
+    if(rc != PLCTAG_STATUS_OK) {
+        mem_free(*m);
+        *m = NULL;
+        return rc;
+    }
+
+    (*m)->initialized = 1;
+
+    pdebug(DEBUG_DETAIL, "Done creating pooled mutex %p.", *m);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
 int mutex_lock_impl(const char *func, int line, mutex_p m)
 {
     pdebug(DEBUG_SPEW,"locking mutex %p, called from %s:%d.", m, func, line);
@@ -727,7 +935,7 @@ int mutex_destroy(mutex_p *m)
         return PLCTAG_ERR_MUTEX_DESTROY;
     }
 
-    mem_free(*m);
+    sync_obj_free((*m)->arena, *m);
 
     *m = NULL;
 
@@ -742,6 +950,210 @@ int mutex_destroy(mutex_p *m)
 
 
 
+/***************************************************************************
+ ************************* Condition Variables *****************************
+ **************************************************************************/
+
+struct cond_t {
+    pthread_mutex_t p_mutex;
+    pthread_cond_t p_cond;
+    int flag;
+    arena_p arena;
+};
+
+int cond_create(cond_p *c)
+{
+    int rc = PLCTAG_STATUS_OK;
+    cond_p tmp_cond = NULL;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    if(!c) {
+        pdebug(DEBUG_WARN, "Null pointer to condition var pointer!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(*c) {
+        pdebug(DEBUG_WARN, "Condition var pointer is not null, was it not deleted first?");
+    }
+
+    /* clear the output first. */
+    *c = NULL;
+
+    {
+        arena_p from = NULL;
+
+        tmp_cond = sync_obj_alloc(&cond_arena, (int)(unsigned int)sizeof(*tmp_cond), &from);
+        if(!tmp_cond) {
+            pdebug(DEBUG_WARN, "Unable to allocate new condition var!");
+            return PLCTAG_ERR_NO_MEM;
+        }
+
+        tmp_cond->arena = from;
+    }
+
+    if(pthread_mutex_init(&(tmp_cond->p_mutex), NULL)) {
+        pdebug(DEBUG_WARN, "Unable to initialize pthread mutex!");
+        sync_obj_free(tmp_cond->arena, tmp_cond);
+        return PLCTAG_ERR_CREATE;
+    }
+
+    if(pthread_cond_init(&(tmp_cond->p_cond), NULL)) {
+        pdebug(DEBUG_WARN, "Unable to initialize pthread condition var!");
+        pthread_mutex_destroy(&(tmp_cond->p_mutex));
+        sync_obj_free(tmp_cond->arena, tmp_cond);
+        return PLCTAG_ERR_CREATE;
+    }
+
+    tmp_cond->flag = 0;
+
+    *c = tmp_cond;
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return rc;
+}
+
+
+int cond_wait_impl(const char *func, int line_num, cond_p c, int timeout)
+{
+    int rc = PLCTAG_STATUS_OK;
+    int64_t start_time = time_ms();
+    struct timespec timeout_ts;
+
+    pdebug(DEBUG_SPEW, "Starting. Called from %s:%d.", func, line_num);
+
+    if(!c) {
+        pdebug(DEBUG_WARN, "Condition var pointer is null in call from %s:%d!", func, line_num);
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(timeout <= 0) {
+        pdebug(DEBUG_WARN, "Timeout must be a positive value but was %d in call from %s:%d!", timeout, func, line_num);
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    /* pthread_cond_timedwait() wants an absolute CLOCK_REALTIME deadline. */
+    clock_gettime(CLOCK_REALTIME, &timeout_ts);
+    timeout_ts.tv_sec += (time_t)(timeout / 1000);
+    timeout_ts.tv_nsec += (long)(timeout % 1000) * 1000000;
+    if(timeout_ts.tv_nsec >= 1000000000) {
+        timeout_ts.tv_sec++;
+        timeout_ts.tv_nsec -= 1000000000;
+    }
+
+    if(pthread_mutex_lock(&(c->p_mutex))) {
+        pdebug(DEBUG_WARN, "Unable to lock mutex!");
+        return PLCTAG_ERR_MUTEX_LOCK;
+    }
+
+    while(!c->flag) {
+        int wait_rc = pthread_cond_timedwait(&(c->p_cond), &(c->p_mutex), &timeout_ts);
+
+        if(wait_rc == ETIMEDOUT) {
+            pdebug(DEBUG_SPEW, "Timeout response from condition var wait.");
+            rc = PLCTAG_ERR_TIMEOUT;
+            break;
+        } else if(wait_rc != 0 && wait_rc != EINTR) {
+            pdebug(DEBUG_WARN, "Error %d waiting on condition variable!", wait_rc);
+            rc = PLCTAG_ERR_BAD_STATUS;
+            break;
+        }
+
+        /* spurious wake up or signal, loop and check the flag. */
+    }
+
+    if(c->flag) {
+        /* we consume the signal. */
+        c->flag = 0;
+        rc = PLCTAG_STATUS_OK;
+    }
+
+    pthread_mutex_unlock(&(c->p_mutex));
+
+    pdebug(DEBUG_SPEW, "Done for call from %s:%d in %dms with status %s.", func, line_num, (int)(time_ms() - start_time), plc_tag_decode_error(rc));
+
+    return rc;
+}
+
+
+int cond_signal_impl(const char *func, int line_num, cond_p c)
+{
+    pdebug(DEBUG_SPEW, "Starting.  Called from %s:%d.", func, line_num);
+
+    if(!c) {
+        pdebug(DEBUG_WARN, "Condition var pointer is null in call at %s:%d!", func, line_num);
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(pthread_mutex_lock(&(c->p_mutex))) {
+        pdebug(DEBUG_WARN, "Unable to lock mutex!");
+        return PLCTAG_ERR_MUTEX_LOCK;
+    }
+
+    c->flag = 1;
+
+    pthread_cond_signal(&(c->p_cond));
+
+    pthread_mutex_unlock(&(c->p_mutex));
+
+    pdebug(DEBUG_SPEW, "Done for call at %s:%d.", func, line_num);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+int cond_clear_impl(const char *func, int line_num, cond_p c)
+{
+    pdebug(DEBUG_SPEW, "Starting.  Called from %s:%d.", func, line_num);
+
+    if(!c) {
+        pdebug(DEBUG_WARN, "Condition var pointer is null in call at %s:%d!", func, line_num);
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(pthread_mutex_lock(&(c->p_mutex))) {
+        pdebug(DEBUG_WARN, "Unable to lock mutex!");
+        return PLCTAG_ERR_MUTEX_LOCK;
+    }
+
+    c->flag = 0;
+
+    pthread_mutex_unlock(&(c->p_mutex));
+
+    pdebug(DEBUG_SPEW, "Done for call at %s:%d.", func, line_num);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+int cond_destroy(cond_p *c)
+{
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    if(!c || ! *c) {
+        pdebug(DEBUG_WARN, "Condition var pointer is null!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    pthread_cond_destroy(&((*c)->p_cond));
+    pthread_mutex_destroy(&((*c)->p_mutex));
+
+    sync_obj_free((*c)->arena, *c);
+
+    *c = NULL;
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+
+
+
+
 /***************************************************************************
  ******************************* Threads ***********************************
  **************************************************************************/
@@ -863,42 +1275,159 @@ extern int thread_detach()
 
 
 /*
- * thread_destroy
+ * thread_set_name
  *
- * This gets rid of the resources of a thread struct.  The thread in
- * question must be dead first!
+ * Name the thread for debuggers, top and ps.  Linux truncates names to
+ * 15 characters.
  */
-extern int thread_destroy(thread_p *t)
+extern int thread_set_name(thread_p t, const char *name)
 {
-    pdebug(DEBUG_DETAIL, "Starting.");
-
-    if(!t || ! *t) {
-        pdebug(DEBUG_WARN, "null thread pointer.");
+    if(!t || !name) {
         return PLCTAG_ERR_NULL_PTR;
     }
 
-    mem_free(*t);
+#if defined(__linux__)
+    {
+        char short_name[16];
 
-    *t = NULL;
+        /* str_copy() does not terminate a name that fills the buffer. */
+        snprintf(short_name, sizeof(short_name), "%s", name);
 
-    pdebug(DEBUG_DETAIL, "Done.");
+        if(pthread_setname_np(t->p_thread, short_name)) {
+            pdebug(DEBUG_DETAIL, "Unable to set thread name %s.", short_name);
+            return PLCTAG_ERR_BAD_PARAM;
+        }
 
-    return PLCTAG_STATUS_OK;
+        return PLCTAG_STATUS_OK;
+    }
+#else
+    return PLCTAG_ERR_UNSUPPORTED;
+#endif
 }
 
 
+/*
+ * thread_set_affinity
+ *
+ * Limit the thread to the CPUs set in the mask, bit 0 is CPU 0.
+ */
+extern int thread_set_affinity(thread_p t, uint32_t cpu_mask)
+{
+    if(!t) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
 
+    if(!cpu_mask) {
+        return PLCTAG_ERR_BAD_PARAM;
+    }
 
+#if defined(__linux__)
+    {
+        cpu_set_t cpus;
+        int rc = 0;
 
+        CPU_ZERO(&cpus);
 
-/***************************************************************************
- ******************************* Atomic Ops ********************************
- **************************************************************************/
+        for(size_t cpu=0; cpu < 32; cpu++) {
+            if(cpu_mask & ((uint32_t)1 << cpu)) {
+                CPU_SET(cpu, &cpus);
+            }
+        }
 
-/*
- * lock_acquire
- *
- * Tries to write a non-zero value into the lock atomically.
+        rc = pthread_setaffinity_np(t->p_thread, sizeof(cpus), &cpus);
+        if(rc) {
+            pdebug(DEBUG_WARN, "Unable to set thread CPU affinity to 0x%x, error %d!", (unsigned int)cpu_mask, rc);
+            return (rc == EPERM ? PLCTAG_ERR_NOT_ALLOWED : PLCTAG_ERR_BAD_PARAM);
+        }
+
+        return PLCTAG_STATUS_OK;
+    }
+#else
+    return PLCTAG_ERR_UNSUPPORTED;
+#endif
+}
+
+
+/*
+ * thread_set_priority
+ *
+ * Zero puts the thread back on the normal time sharing scheduler.  1 to
+ * 99 runs it under SCHED_FIFO at that priority, clamped to what the system
+ * supports.  Real time scheduling usually needs CAP_SYS_NICE or an rtprio
+ * limit.
+ */
+extern int thread_set_priority(thread_p t, int priority)
+{
+    struct sched_param param;
+    int policy = SCHED_OTHER;
+    int rc = 0;
+
+    if(!t) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(priority < 0 || priority > 99) {
+        return PLCTAG_ERR_OUT_OF_BOUNDS;
+    }
+
+    mem_set(&param, 0, sizeof(param));
+
+    if(priority > 0) {
+        int min_priority = sched_get_priority_min(SCHED_FIFO);
+        int max_priority = sched_get_priority_max(SCHED_FIFO);
+
+        policy = SCHED_FIFO;
+        param.sched_priority = (priority < min_priority ? min_priority : (priority > max_priority ? max_priority : priority));
+    }
+
+    rc = pthread_setschedparam(t->p_thread, policy, &param);
+    if(rc) {
+        pdebug(DEBUG_WARN, "Unable to set thread priority to %d, error %d!", priority, rc);
+        return (rc == EPERM ? PLCTAG_ERR_NOT_ALLOWED : PLCTAG_ERR_BAD_PARAM);
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * thread_destroy
+ *
+ * This gets rid of the resources of a thread struct.  The thread in
+ * question must be dead first!
+ */
+extern int thread_destroy(thread_p *t)
+{
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    if(!t || ! *t) {
+        pdebug(DEBUG_WARN, "null thread pointer.");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    mem_free(*t);
+
+    *t = NULL;
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+
+
+
+/***************************************************************************
+ ******************************* Atomic Ops ********************************
+ **************************************************************************/
+
+/*
+ * lock_acquire
+ *
+ * Tries to write a non-zero value into the lock atomically.
  *
  * Returns non-zero on success.
  *
@@ -906,6 +1435,17 @@ extern int thread_destroy(thread_p *t)
  */
 
 #define ATOMIC_LOCK_VAL (1)
+#define LOCK_SPIN_LIMIT (100)
+#define LOCK_MAX_BACKOFF (64)
+
+/* tell the CPU we are spinning so it can back off the pipeline and give the other hyperthread a turn. */
+#if defined(__i386__) || defined(__x86_64__)
+    #define cpu_relax() __builtin_ia32_pause()
+#elif defined(__aarch64__) || (defined(__arm__) && defined(__ARM_ARCH) && __ARM_ARCH >= 7)
+    #define cpu_relax() __asm__ __volatile__("yield" ::: "memory")
+#else
+    #define cpu_relax() __asm__ __volatile__("" ::: "memory")
+#endif
 
 extern int lock_acquire_try(lock_t *lock)
 {
@@ -918,9 +1458,34 @@ extern int lock_acquire_try(lock_t *lock)
     }
 }
 
+/*
+ * Only try the exchange when the lock looks free so that waiters spin on
+ * their cached copy instead of bouncing the cache line between cores.  The
+ * pause between looks doubles each time.  If the holder is not done
+ * quickly it was probably preempted, so give up the CPU.
+ */
 int lock_acquire(lock_t *lock)
 {
-    while(!lock_acquire_try(lock)) ;
+    int backoff = 1;
+    int spins = 0;
+
+    while(!lock_acquire_try(lock)) {
+        while(__atomic_load_n((int*)lock, __ATOMIC_RELAXED) == ATOMIC_LOCK_VAL) {
+            if(spins < LOCK_SPIN_LIMIT) {
+                for(int i=0; i < backoff; i++) {
+                    cpu_relax();
+                }
+
+                if(backoff < LOCK_MAX_BACKOFF) {
+                    backoff *= 2;
+                }
+
+                spins++;
+            } else {
+                sched_yield();
+            }
+        }
+    }
 
     return 1;
 }
@@ -933,6 +1498,19 @@ extern void lock_release(lock_t *lock)
 }
 
 
+
+/*
+ * mem_barrier
+ *
+ * Full memory barrier.  No loads or stores move across it.
+ */
+
+extern void mem_barrier(void)
+{
+    __sync_synchronize();
+}
+
+
 /***************************************************************************
  ******************************* Sockets ***********************************
  **************************************************************************/
@@ -941,311 +1519,2264 @@ struct sock_t {
     int fd;
     int port;
     int is_open;
+
+    /* signalled by the reactor or socket_wake(). */
+    cond_p event_cond;
+    volatile int events_ready;
+
+    /* events with a poll outstanding in the io_uring and its user data. */
+    int uring_events;
+    uint64_t uring_tag;
+
+    socket_options_t opts;
 };
 
 
+/*
+ * Socket readiness reactor.
+ *
+ * A small, fixed pool of threads waits on epoll (Linux) or kqueue (*BSD and
+ * macOS) for all open sockets.  socket_wait_event() arms a socket one-shot
+ * and the reactor signals the socket's condition var when it is ready.
+ *
+ * Sockets are looked up by file descriptor under the reactor mutex so that
+ * a socket closed while an event is being dispatched is never touched.  A
+ * reused descriptor at worst causes a spurious wake up.
+ *
+ * Other POSIX systems, or a reactor that failed to start, fall back to
+ * poll() on the single socket.
+ *
+ * When built with PLCTAG_USE_IO_URING and the kernel allows it, Linux arms
+ * sockets with one-shot poll requests in an io_uring instead of epoll_ctl().
+ * With a kernel submission thread arming a socket is a store into shared
+ * memory and no system call.  A single reactor thread reaps completions.
+ */
+
+#define REACTOR_NUM_THREADS (2)
+#define REACTOR_MAX_EVENTS (64)
+#define REACTOR_ERR_DELAY (10)
+
+#if defined(REACTOR_USE_EPOLL) || defined(REACTOR_USE_KQUEUE)
+static int reactor_fd = -1;
+static int reactor_wake_fds[2] = { -1, -1 };
+static mutex_p reactor_mutex = NULL;
+static sock_p *reactor_socks = NULL;
+static int reactor_socks_size = 0;
+static thread_p reactor_threads[REACTOR_NUM_THREADS];
+static volatile int reactor_terminate = 0;
+
+#ifdef REACTOR_USE_IO_URING
+    #define REACTOR_URING_ENTRIES (256)
+    #define REACTOR_URING_SQ_IDLE_MS (100)
+    #define REACTOR_URING_SQ_MIN_CPUS (4)
+    #define REACTOR_URING_NO_FD (~(uint64_t)0)
+
+    typedef struct {
+        int fd;
+        int sq_poll;
+        unsigned int sq_pending;
+
+        void *sq_ring;
+        size_t sq_ring_size;
+        void *cq_ring;
+        size_t cq_ring_size;
+        struct io_uring_sqe *sqes;
+        size_t sqes_size;
+
+        unsigned int *sq_head;
+        unsigned int *sq_tail;
+        unsigned int *sq_mask;
+        unsigned int *sq_flags;
+        unsigned int *sq_array;
+
+        unsigned int *cq_head;
+        unsigned int *cq_tail;
+        unsigned int *cq_mask;
+        struct io_uring_cqe *cqes;
+    } reactor_uring_t;
+
+    static reactor_uring_t reactor_uring = { -1, 0, 0, NULL, 0, NULL, 0, NULL, 0, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL };
+    static int reactor_use_uring = 0;
+    static uint32_t reactor_uring_seq = 0;
+
+    static int uring_setup(void);
+    static void uring_teardown(void);
+    static int uring_add_unsafe(uint8_t opcode, int fd, uint32_t poll_events, uint64_t target);
+    static int uring_submit_unsafe(void);
+    static int uring_wait(uint64_t *tags, int *fds, int *ready, int max_events);
+#endif
+
+static int reactor_add_unsafe(sock_p s);
+static void reactor_remove_unsafe(sock_p s);
+static int reactor_arm_unsafe(sock_p s, int events);
+static THREAD_FUNC(reactor_thread_func);
+#endif
+
+static int socket_poll_event(sock_p s, int events, int timeout_ms);
+
+
 #define MAX_IPS (8)
 
-extern int socket_create(sock_p *s)
+extern int socket_create(sock_p *s)
+{
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    if(!s) {
+        pdebug(DEBUG_WARN, "null socket pointer.");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    *s = (sock_p)mem_alloc(sizeof(struct sock_t));
+
+    if(! *s) {
+        pdebug(DEBUG_ERROR, "Failed to allocate memory for socket.");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    (*s)->fd = -1;
+
+    socket_options_init(&((*s)->opts));
+
+    if(cond_create(&((*s)->event_cond)) != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to create socket event condition var, falling back to polling.");
+        (*s)->event_cond = NULL;
+    }
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+/*
+ * Host name resolutions are cached for DNS_CACHE_TTL_MS and shared by all
+ * sockets so that reconnects and many sessions to the same PLC do not
+ * each pay for a lookup.
+ */
+
+#define DNS_CACHE_SIZE (32)
+#define DNS_CACHE_TTL_MS (60000)
+#define DNS_MAX_HOST_NAME (255)
+
+typedef struct {
+    char host[DNS_MAX_HOST_NAME + 1];
+    struct in_addr ips[MAX_IPS];
+    int num_ips;
+    int64_t expire_time;
+} dns_cache_entry_t;
+
+static lock_t dns_cache_lock = LOCK_INIT;
+static dns_cache_entry_t dns_cache[DNS_CACHE_SIZE];
+
+
+static int socket_resolve_host(const char *host, struct in_addr *ips, int *num_ips)
+{
+    struct addrinfo hints;
+    struct addrinfo *res_head = NULL;
+    struct addrinfo *res=NULL;
+    int cacheable = (str_length(host) <= DNS_MAX_HOST_NAME);
+    int found = 0;
+    int rc = 0;
+
+    /* try a numeric IP address conversion first. */
+    if(inet_pton(AF_INET, host, ips) > 0) {
+        pdebug(DEBUG_DETAIL, "Found numeric IP address: %s", host);
+        *num_ips = 1;
+        return PLCTAG_STATUS_OK;
+    }
+
+    if(cacheable) {
+        int64_t now = time_ms();
+
+        spin_block(&dns_cache_lock) {
+            for(int i=0; i < DNS_CACHE_SIZE; i++) {
+                if(dns_cache[i].num_ips > 0 && dns_cache[i].expire_time > now && !str_cmp_i(dns_cache[i].host, host)) {
+                    mem_copy(ips, dns_cache[i].ips, (int)(sizeof(struct in_addr) * (size_t)dns_cache[i].num_ips));
+                    *num_ips = dns_cache[i].num_ips;
+                    found = 1;
+                    break;
+                }
+            }
+        }
+
+        if(found) {
+            pdebug(DEBUG_DETAIL, "Found %d cached IP addresses for %s.", *num_ips, host);
+            return PLCTAG_STATUS_OK;
+        }
+    }
+
+    mem_set(&hints, 0, sizeof(hints));
+
+    hints.ai_socktype = SOCK_STREAM; /* TCP */
+    hints.ai_family = AF_INET; /* IP V4 only */
+
+    if ((rc = getaddrinfo(host, NULL, &hints, &res_head)) != 0) {
+        pdebug(DEBUG_WARN,"Error looking up PLC IP address %s, error = %d\n", host, rc);
+
+        if(res_head) {
+            freeaddrinfo(res_head);
+        }
+
+        return PLCTAG_ERR_BAD_GATEWAY;
+    }
+
+    res = res_head;
+    for(*num_ips = 0; res && *num_ips < MAX_IPS; (*num_ips)++) {
+        ips[*num_ips].s_addr = ((struct sockaddr_in *)(res->ai_addr))->sin_addr.s_addr;
+        res = res->ai_next;
+    }
+
+    freeaddrinfo(res_head);
+
+    if(cacheable && *num_ips > 0) {
+        spin_block(&dns_cache_lock) {
+            int slot = 0;
+
+            /* replace the same host or else the entry that expires first. */
+            for(int i=0; i < DNS_CACHE_SIZE; i++) {
+                if(!str_cmp_i(dns_cache[i].host, host)) {
+                    slot = i;
+                    break;
+                }
+
+                if(dns_cache[i].expire_time < dns_cache[slot].expire_time) {
+                    slot = i;
+                }
+            }
+
+            str_copy(dns_cache[slot].host, (int)sizeof(dns_cache[slot].host), host);
+            mem_copy(dns_cache[slot].ips, ips, (int)(sizeof(struct in_addr) * (size_t)(*num_ips)));
+            dns_cache[slot].num_ips = *num_ips;
+            dns_cache[slot].expire_time = time_ms() + DNS_CACHE_TTL_MS;
+        }
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+void socket_options_init(socket_options_t *opts)
+{
+    mem_set(opts, 0, (int)sizeof(*opts));
+
+    opts->tcp_nodelay = 1;
+    opts->dscp = -1;
+    opts->priority = -1;
+}
+
+
+int socket_set_options(sock_p s, socket_options_t *opts)
+{
+    if(!s || !opts) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    s->opts = *opts;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+/*
+ * Apply the tuning options.  None of these are needed for the socket to
+ * work, so failures are only logged.
+ */
+static void socket_apply_options(int fd, socket_options_t *opts)
+{
+    int val = 0;
+
+    val = (opts->tcp_nodelay ? 1 : 0);
+    if(setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (char *)&val, sizeof(val))) {
+        pdebug(DEBUG_WARN, "Error setting TCP_NODELAY, errno: %d", errno);
+    }
+
+    if(opts->send_buffer_size > 0 && setsockopt(fd, SOL_SOCKET, SO_SNDBUF, (char *)&(opts->send_buffer_size), sizeof(int))) {
+        pdebug(DEBUG_WARN, "Error setting send buffer size, errno: %d", errno);
+    }
+
+    if(opts->recv_buffer_size > 0 && setsockopt(fd, SOL_SOCKET, SO_RCVBUF, (char *)&(opts->recv_buffer_size), sizeof(int))) {
+        pdebug(DEBUG_WARN, "Error setting receive buffer size, errno: %d", errno);
+    }
+
+    if(opts->keepalive_idle_s > 0) {
+        val = 1;
+        if(setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, (char *)&val, sizeof(val))) {
+            pdebug(DEBUG_WARN, "Error turning on keepalive, errno: %d", errno);
+        }
+
+#if defined(TCP_KEEPIDLE)
+        if(setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, (char *)&(opts->keepalive_idle_s), sizeof(int))) {
+            pdebug(DEBUG_WARN, "Error setting keepalive idle time, errno: %d", errno);
+        }
+#elif defined(TCP_KEEPALIVE)
+        /* macOS */
+        if(setsockopt(fd, IPPROTO_TCP, TCP_KEEPALIVE, (char *)&(opts->keepalive_idle_s), sizeof(int))) {
+            pdebug(DEBUG_WARN, "Error setting keepalive idle time, errno: %d", errno);
+        }
+#endif
+
+#if defined(TCP_KEEPINTVL)
+        if(opts->keepalive_interval_s > 0 && setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, (char *)&(opts->keepalive_interval_s), sizeof(int))) {
+            pdebug(DEBUG_WARN, "Error setting keepalive interval, errno: %d", errno);
+        }
+#endif
+
+#if defined(TCP_KEEPCNT)
+        if(opts->keepalive_count > 0 && setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, (char *)&(opts->keepalive_count), sizeof(int))) {
+            pdebug(DEBUG_WARN, "Error setting keepalive count, errno: %d", errno);
+        }
+#endif
+    }
+
+    if(opts->dscp >= 0) {
+        val = opts->dscp << 2;
+        if(setsockopt(fd, IPPROTO_IP, IP_TOS, (char *)&val, sizeof(val))) {
+            pdebug(DEBUG_WARN, "Error setting DSCP marking, errno: %d", errno);
+        }
+    }
+
+#if defined(SO_PRIORITY)
+    if(opts->priority >= 0 && setsockopt(fd, SOL_SOCKET, SO_PRIORITY, (char *)&(opts->priority), sizeof(int))) {
+        pdebug(DEBUG_WARN, "Error setting socket priority, errno: %d", errno);
+    }
+#endif
+
+#if defined(SO_BUSY_POLL)
+    if(opts->busy_poll_us > 0 && setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, (char *)&(opts->busy_poll_us), sizeof(int))) {
+        pdebug(DEBUG_WARN, "Error setting busy poll time, errno: %d", errno);
+    }
+#endif
+
+#if defined(TCP_QUICKACK)
+    if(opts->tcp_quickack) {
+        val = 1;
+        if(setsockopt(fd, IPPROTO_TCP, TCP_QUICKACK, (char *)&val, sizeof(val))) {
+            pdebug(DEBUG_WARN, "Error setting TCP_QUICKACK, errno: %d", errno);
+        }
+    }
+#endif
+}
+
+
+
+/* make a non-blocking TCP socket with our usual options. */
+static int socket_open_fd(socket_options_t *opts)
+{
+    int fd;
+    int flags;
+    int sock_opt = 1;
+    struct timeval timeout; /* used for timing out connections etc. */
+    struct linger so_linger; /* used to set up short/no lingering after connections are close()ed. */
+
+    /* Open a socket for communication with the gateway. */
+    fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+
+    /* check for errors */
+    if(fd < 0) {
+        pdebug(DEBUG_ERROR,"Socket creation failed, errno: %d",errno);
+        return -1;
+    }
+
+    /* set up our socket to allow reuse if we crash suddenly. */
+    sock_opt = 1;
+
+    if(setsockopt(fd,SOL_SOCKET,SO_REUSEADDR,(char*)&sock_opt,sizeof(sock_opt))) {
+        close(fd);
+        pdebug(DEBUG_ERROR, "Error setting socket reuse option, errno: %d",errno);
+        return -1;
+    }
+
+#ifdef BSD_OS_TYPE
+    /* The *BSD family has a different way to suppress SIGPIPE on sockets. */
+    if(setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, (char*)&sock_opt, sizeof(sock_opt))) {
+        close(fd);
+        pdebug(DEBUG_ERROR, "Error setting socket SIGPIPE suppression option, errno: %d", errno);
+        return -1;
+    }
+#endif
+
+    timeout.tv_sec = 10;
+    timeout.tv_usec = 0;
+
+    if(setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, (char*)&timeout, sizeof(timeout))) {
+        close(fd);
+        pdebug(DEBUG_ERROR,"Error setting socket receive timeout option, errno: %d",errno);
+        return -1;
+    }
+
+    if(setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, (char*)&timeout, sizeof(timeout))) {
+        close(fd);
+        pdebug(DEBUG_ERROR, "Error setting socket set timeout option, errno: %d",errno);
+        return -1;
+    }
+
+    /* abort the connection immediately upon close. */
+    so_linger.l_onoff = 1;
+    so_linger.l_linger = 0;
+
+    if(setsockopt(fd, SOL_SOCKET, SO_LINGER,(char*)&so_linger,sizeof(so_linger))) {
+        close(fd);
+        pdebug(DEBUG_ERROR,"Error setting socket close linger option, errno: %d",errno);
+        return -1;
+    }
+
+    /* non-blocking from the start so that connect() cannot hang. */
+    flags=fcntl(fd,F_GETFL,0);
+
+    if(flags<0) {
+        pdebug(DEBUG_ERROR, "Error getting socket options, errno: %d", errno);
+        close(fd);
+        return -1;
+    }
+
+    flags |= O_NONBLOCK;
+
+    if(fcntl(fd,F_SETFL,flags)<0) {
+        pdebug(DEBUG_ERROR, "Error setting socket to non-blocking, errno: %d", errno);
+        close(fd);
+        return -1;
+    }
+
+    socket_apply_options(fd, opts);
+
+    return fd;
+}
+
+
+
+extern int socket_connect_tcp(sock_p s, const char *host, int port, int timeout_ms)
+{
+    struct in_addr ips[MAX_IPS];
+    struct pollfd pfds[MAX_IPS];
+    int num_ips = 0;
+    int num_pending = 0;
+    struct sockaddr_in gw_addr;
+    int fd = -1;
+    int rc = PLCTAG_STATUS_OK;
+    int64_t timeout_time = 0;
+
+    pdebug(DEBUG_DETAIL,"Starting.");
+
+    if(timeout_ms <= 0) {
+        timeout_ms = 1;
+    }
+
+    timeout_time = time_ms() + timeout_ms;
+
+    /* figure out what address we are connecting to. */
+    mem_set(&ips, 0, sizeof(ips));
+
+    rc = socket_resolve_host(host, ips, &num_ips);
+    if(rc != PLCTAG_STATUS_OK) {
+        return rc;
+    }
+
+    /*
+     * start connecting to all the addresses at once and keep the first
+     * one that succeeds.
+     */
+
+    memset((void *)&gw_addr,0, sizeof(gw_addr));
+    gw_addr.sin_family = AF_INET ;
+    gw_addr.sin_port = htons((uint16_t)port);
+
+    for(int i=0; i < num_ips && fd < 0; i++) {
+        int candidate = socket_open_fd(&(s->opts));
+
+        pfds[i].fd = -1;
+        pfds[i].events = POLLOUT;
+        pfds[i].revents = 0;
+
+        if(candidate < 0) {
+            continue;
+        }
+
+        gw_addr.sin_addr.s_addr = ips[i].s_addr;
+
+        pdebug(DEBUG_DETAIL, "Attempting to connect to %s",inet_ntoa(*((struct in_addr *)&ips[i])));
+
+        if(connect(candidate,(struct sockaddr *)&gw_addr,sizeof(gw_addr)) == 0) {
+            pdebug(DEBUG_DETAIL, "Attempt to connect to %s succeeded.",inet_ntoa(*((struct in_addr *)&ips[i])));
+            fd = candidate;
+        } else if(errno == EINPROGRESS) {
+            pfds[i].fd = candidate;
+            num_pending++;
+        } else {
+            pdebug(DEBUG_DETAIL, "Attempt to connect to %s failed, errno: %d",inet_ntoa(*((struct in_addr *)&ips[i])),errno);
+            close(candidate);
+        }
+
+        num_ips = i + 1;
+    }
+
+    while(fd < 0 && num_pending > 0) {
+        int64_t remaining = timeout_time - time_ms();
+        int ready = 0;
+
+        if(remaining <= 0) {
+            break;
+        }
+
+        ready = poll(pfds, (nfds_t)num_ips, (int)remaining);
+        if(ready < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+
+            pdebug(DEBUG_WARN, "Error waiting for connections, errno: %d", errno);
+            break;
+        }
+
+        for(int i=0; i < num_ips && ready > 0; i++) {
+            int sock_err = 0;
+            socklen_t sock_err_len = (socklen_t)sizeof(sock_err);
+
+            if(pfds[i].fd < 0 || !pfds[i].revents) {
+                continue;
+            }
+
+            ready--;
+
+            if(getsockopt(pfds[i].fd, SOL_SOCKET, SO_ERROR, &sock_err, &sock_err_len) == 0 && sock_err == 0 && fd < 0) {
+                pdebug(DEBUG_DETAIL, "Attempt to connect to %s succeeded.",inet_ntoa(*((struct in_addr *)&ips[i])));
+                fd = pfds[i].fd;
+            } else {
+                pdebug(DEBUG_DETAIL, "Attempt to connect to %s failed, error: %d",inet_ntoa(*((struct in_addr *)&ips[i])), sock_err);
+                close(pfds[i].fd);
+            }
+
+            pfds[i].fd = -1;
+            num_pending--;
+        }
+    }
+
+    /* close the ones that lost the race. */
+    for(int i=0; i < num_ips; i++) {
+        if(pfds[i].fd >= 0 && pfds[i].fd != fd) {
+            close(pfds[i].fd);
+        }
+    }
+
+    if(fd < 0) {
+        if(num_pending > 0) {
+            pdebug(DEBUG_WARN, "Timed out connecting to %s after %dms!", host, timeout_ms);
+            return PLCTAG_ERR_TIMEOUT;
+        }
+
+        pdebug(DEBUG_ERROR, "Unable to connect to any gateway host IP address!");
+        return PLCTAG_ERR_OPEN;
+    }
+
+    /* save the values */
+    s->fd = fd;
+    s->port = port;
+    s->is_open = 1;
+
+#if defined(REACTOR_USE_EPOLL) || defined(REACTOR_USE_KQUEUE)
+    if(reactor_mutex && s->event_cond) {
+        critical_block(reactor_mutex) {
+            if(reactor_add_unsafe(s) != PLCTAG_STATUS_OK) {
+                pdebug(DEBUG_WARN, "Unable to add socket to the reactor, falling back to polling.");
+            }
+        }
+    }
+#endif
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+
+extern int socket_resolve_ipv4(const char *host, uint32_t *addr)
+{
+    struct in_addr ips[MAX_IPS];
+    int num_ips = 0;
+    int rc = PLCTAG_STATUS_OK;
+
+    if(!host || !addr) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    mem_set(&ips, 0, sizeof(ips));
+
+    rc = socket_resolve_host(host, ips, &num_ips);
+    if(rc != PLCTAG_STATUS_OK) {
+        return rc;
+    }
+
+    if(num_ips < 1) {
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    *addr = (uint32_t)ips[0].s_addr;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+extern int socket_udp_open(sock_p s, int port)
+{
+    struct sockaddr_in local_addr;
+    int fd = -1;
+    int flags = 0;
+    int sock_opt = 1;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    if(!s) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(s->is_open) {
+        pdebug(DEBUG_WARN, "Socket is already open!");
+        return PLCTAG_ERR_BAD_STATUS;
+    }
+
+    fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if(fd < 0) {
+        pdebug(DEBUG_ERROR, "UDP socket creation failed, errno: %d", errno);
+        return PLCTAG_ERR_OPEN;
+    }
+
+    if(setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (char*)&sock_opt, sizeof(sock_opt))) {
+        pdebug(DEBUG_ERROR, "Error setting socket reuse option, errno: %d", errno);
+        close(fd);
+        return PLCTAG_ERR_OPEN;
+    }
+
+    flags = fcntl(fd, F_GETFL, 0);
+    if(flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        pdebug(DEBUG_ERROR, "Error setting socket to non-blocking, errno: %d", errno);
+        close(fd);
+        return PLCTAG_ERR_OPEN;
+    }
+
+    mem_set(&local_addr, 0, sizeof(local_addr));
+    local_addr.sin_family = AF_INET;
+    local_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    local_addr.sin_port = htons((uint16_t)port);
+
+    if(bind(fd, (struct sockaddr *)&local_addr, sizeof(local_addr))) {
+        pdebug(DEBUG_ERROR, "Unable to bind UDP port %d, errno: %d", port, errno);
+        close(fd);
+        return PLCTAG_ERR_OPEN;
+    }
+
+    /* not added to the reactor, waits poll the socket. */
+    s->fd = fd;
+    s->port = port;
+    s->is_open = 1;
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+extern int socket_udp_recv(sock_p s, uint8_t *buf, int size, uint32_t *from_addr)
+{
+    struct sockaddr_in addr;
+    socklen_t addr_len = (socklen_t)sizeof(addr);
+    int rc;
+
+    if(!s || !buf) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(!s->is_open) {
+        pdebug(DEBUG_WARN, "Socket is not open!");
+        return PLCTAG_ERR_READ;
+    }
+
+    rc = (int)recvfrom(s->fd, buf, (size_t)size, 0, (struct sockaddr *)&addr, &addr_len);
+    if(rc < 0) {
+        if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+            return 0;
+        }
+
+        /* ICMP errors from earlier sends show up here, they are not fatal. */
+        if(errno == ECONNREFUSED) {
+            return 0;
+        }
+
+        pdebug(DEBUG_WARN, "UDP socket read error: rc=%d, errno=%d", rc, errno);
+        return PLCTAG_ERR_READ;
+    }
+
+    if(from_addr) {
+        *from_addr = (uint32_t)addr.sin_addr.s_addr;
+    }
+
+    return rc;
+}
+
+
+extern int socket_udp_send(sock_p s, uint8_t *buf, int size, uint32_t to_addr, int to_port)
+{
+    struct sockaddr_in addr;
+    int rc;
+
+    if(!s || !buf) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(!s->is_open) {
+        pdebug(DEBUG_WARN, "Socket is not open!");
+        return PLCTAG_ERR_WRITE;
+    }
+
+    mem_set(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = (in_addr_t)to_addr;
+    addr.sin_port = htons((uint16_t)to_port);
+
+    rc = (int)sendto(s->fd, buf, (size_t)size, 0, (struct sockaddr *)&addr, sizeof(addr));
+    if(rc < 0) {
+        if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+            return 0;
+        }
+
+        pdebug(DEBUG_WARN, "UDP socket write error: rc=%d, errno=%d", rc, errno);
+        return PLCTAG_ERR_WRITE;
+    }
+
+    return rc;
+}
+
+
+
+
+extern int socket_read(sock_p s, uint8_t *buf, int size)
+{
+    int rc;
+
+    if(!s || !buf) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(!s->is_open) {
+        pdebug(DEBUG_WARN, "Socket is not open!");
+        return PLCTAG_ERR_READ;
+    }
+
+    /* The socket is non-blocking. */
+    rc = (int)read(s->fd,buf,(size_t)size);
+
+    if(rc < 0) {
+        if(errno == EAGAIN || errno == EWOULDBLOCK) {
+            return 0;
+        } else {
+            pdebug(DEBUG_WARN,"Socket read error: rc=%d, errno=%d", rc, errno);
+            return PLCTAG_ERR_READ;
+        }
+    }
+
+#if defined(TCP_QUICKACK)
+    /* Linux turns quick ACKs back off as it goes, keep them on. */
+    if(s->opts.tcp_quickack && rc > 0) {
+        int val = 1;
+
+        setsockopt(s->fd, IPPROTO_TCP, TCP_QUICKACK, (char *)&val, sizeof(val));
+    }
+#endif
+
+    return rc;
+}
+
+
+extern int socket_write(sock_p s, uint8_t *buf, int size)
+{
+    int rc;
+
+    if(!s || !buf) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(!s->is_open) {
+        pdebug(DEBUG_WARN, "Socket is not open!");
+        return PLCTAG_ERR_WRITE;
+    }
+
+    /* The socket is non-blocking. */
+#ifdef BSD_OS_TYPE
+    /* On *BSD and macOS, the socket option is set to prevent SIGPIPE. */
+    rc = (int)write(s->fd, buf, (size_t)size);
+#else
+    /* on Linux, we use MSG_NOSIGNAL */
+    rc = (int)send(s->fd, buf, (size_t)size, MSG_NOSIGNAL);
+#endif
+
+    if(rc < 0) {
+        if(errno == EAGAIN || errno == EWOULDBLOCK) {
+            return PLCTAG_ERR_NO_DATA;
+        } else {
+            pdebug(DEBUG_WARN, "Socket write error: rc=%d, errno=%d", rc, errno);
+            return PLCTAG_ERR_WRITE;
+        }
+    }
+
+    return rc;
+}
+
+
+extern int socket_writev(sock_p s, socket_buf_t *bufs, int num_bufs)
+{
+    struct iovec iov[SOCKET_MAX_WRITEV];
+    struct msghdr msg;
+    int rc;
+
+    if(!s || !bufs) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(!s->is_open) {
+        pdebug(DEBUG_WARN, "Socket is not open!");
+        return PLCTAG_ERR_WRITE;
+    }
+
+    /* anything past the limit goes out on the next call. */
+    if(num_bufs > SOCKET_MAX_WRITEV) {
+        num_bufs = SOCKET_MAX_WRITEV;
+    }
+
+    for(int i=0; i < num_bufs; i++) {
+        iov[i].iov_base = bufs[i].data;
+        iov[i].iov_len = (size_t)bufs[i].size;
+    }
+
+    mem_set(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = (size_t)num_bufs;
+
+    /* The socket is non-blocking. */
+#ifdef BSD_OS_TYPE
+    /* On *BSD and macOS, the socket option is set to prevent SIGPIPE. */
+    rc = (int)sendmsg(s->fd, &msg, 0);
+#else
+    /* on Linux, we use MSG_NOSIGNAL */
+    rc = (int)sendmsg(s->fd, &msg, MSG_NOSIGNAL);
+#endif
+
+    if(rc < 0) {
+        if(errno == EAGAIN || errno == EWOULDBLOCK) {
+            return PLCTAG_ERR_NO_DATA;
+        } else {
+            pdebug(DEBUG_WARN, "Socket write error: rc=%d, errno=%d", rc, errno);
+            return PLCTAG_ERR_WRITE;
+        }
+    }
+
+    return rc;
+}
+
+
+
+extern int socket_close(sock_p s)
+{
+    if(!s) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(!s->is_open) {
+        return PLCTAG_STATUS_OK;
+    }
+
+    s->is_open = 0;
+
+#if defined(REACTOR_USE_EPOLL) || defined(REACTOR_USE_KQUEUE)
+    if(reactor_mutex) {
+        critical_block(reactor_mutex) {
+            reactor_remove_unsafe(s);
+        }
+    }
+#endif
+
+    if(close(s->fd)) {
+        return PLCTAG_ERR_CLOSE;
+    }
+
+    s->fd = -1;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+extern int socket_destroy(sock_p *s)
+{
+    if(!s || !*s)
+        return PLCTAG_ERR_NULL_PTR;
+
+    socket_close(*s);
+
+    if((*s)->event_cond) {
+        cond_destroy(&((*s)->event_cond));
+    }
+
+    mem_free(*s);
+
+    *s = 0;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+
+
+
+
+
+extern int socket_wait_event(sock_p s, int events, int timeout_ms)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    if(!s) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(!s->is_open) {
+        pdebug(DEBUG_WARN, "Socket is not open!");
+        return PLCTAG_ERR_READ;
+    }
+
+    if(!(events & (SOCKET_EVENT_READ | SOCKET_EVENT_WRITE)) || timeout_ms <= 0) {
+        pdebug(DEBUG_WARN, "Called with no events or a non-positive timeout!");
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+#if defined(REACTOR_USE_EPOLL) || defined(REACTOR_USE_KQUEUE)
+    if(reactor_mutex && s->event_cond) {
+        int armed = 0;
+
+        critical_block(reactor_mutex) {
+            if(s->fd < reactor_socks_size && reactor_socks[s->fd] == s) {
+                s->events_ready = 0;
+                armed = (reactor_arm_unsafe(s, events) == PLCTAG_STATUS_OK);
+            }
+        }
+
+        if(armed) {
+            rc = cond_wait(s->event_cond, timeout_ms);
+            if(rc == PLCTAG_STATUS_OK) {
+                rc = s->events_ready & events;
+            }
+
+            return rc;
+        }
+    }
+#endif
+
+    return socket_poll_event(s, events, timeout_ms);
+}
+
+
+extern int socket_wake(sock_p s)
+{
+    if(!s) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(!s->event_cond) {
+        return PLCTAG_ERR_UNSUPPORTED;
+    }
+
+    return cond_signal(s->event_cond);
+}
+
+
+
+int socket_poll_event(sock_p s, int events, int timeout_ms)
+{
+    struct pollfd pfd;
+    int rc = 0;
+
+    pfd.fd = s->fd;
+    pfd.events = (short)(((events & SOCKET_EVENT_READ) ? POLLIN : 0) | ((events & SOCKET_EVENT_WRITE) ? POLLOUT : 0));
+    pfd.revents = 0;
+
+    rc = poll(&pfd, 1, timeout_ms);
+    if(rc < 0) {
+        if(errno == EINTR) {
+            return 0;
+        }
+
+        pdebug(DEBUG_WARN, "Error polling socket, errno: %d", errno);
+        return PLCTAG_ERR_READ;
+    }
+
+    if(rc == 0) {
+        return PLCTAG_ERR_TIMEOUT;
+    }
+
+    /* errors and hang ups show up as ready so that the next read or write sees them. */
+    if(pfd.revents & (POLLERR | POLLHUP | POLLNVAL)) {
+        return events;
+    }
+
+    return ((pfd.revents & POLLIN) ? SOCKET_EVENT_READ : 0) | ((pfd.revents & POLLOUT) ? SOCKET_EVENT_WRITE : 0);
+}
+
+
+
+extern int socket_reactor_startup(void)
+{
+#if defined(REACTOR_USE_EPOLL) || defined(REACTOR_USE_KQUEUE)
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    reactor_terminate = 0;
+
+    rc = mutex_create(&reactor_mutex);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to create reactor mutex!");
+        reactor_mutex = NULL;
+        return rc;
+    }
+
+#ifdef REACTOR_USE_EPOLL
+    reactor_fd = epoll_create1(EPOLL_CLOEXEC);
+#else
+    reactor_fd = kqueue();
+#endif
+
+    if(reactor_fd < 0) {
+        pdebug(DEBUG_WARN, "Unable to create the reactor event queue, errno: %d", errno);
+        socket_reactor_teardown();
+        return PLCTAG_ERR_CREATE;
+    }
+
+    /*
+     * the wake descriptor stays readable once teardown writes to it, waking all threads.
+     * Linux has eventfd, one descriptor and no pipe buffer.  Elsewhere use a pipe.
+     */
+#ifdef REACTOR_USE_EPOLL
+    reactor_wake_fds[0] = reactor_wake_fds[1] = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if(reactor_wake_fds[0] < 0) {
+#else
+    if(pipe(reactor_wake_fds)) {
+#endif
+        pdebug(DEBUG_WARN, "Unable to create the reactor wake descriptor, errno: %d", errno);
+        reactor_wake_fds[0] = reactor_wake_fds[1] = -1;
+        socket_reactor_teardown();
+        return PLCTAG_ERR_CREATE;
+    }
+
+    {
+#ifdef REACTOR_USE_EPOLL
+        struct epoll_event ev;
+
+        mem_set(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.fd = reactor_wake_fds[0];
+
+        rc = epoll_ctl(reactor_fd, EPOLL_CTL_ADD, reactor_wake_fds[0], &ev);
+#else
+        struct kevent kev;
+
+        EV_SET(&kev, (uintptr_t)reactor_wake_fds[0], EVFILT_READ, EV_ADD, 0, 0, 0);
+
+        rc = kevent(reactor_fd, &kev, 1, NULL, 0, NULL);
+#endif
+
+        if(rc) {
+            pdebug(DEBUG_WARN, "Unable to add the wake descriptor to the reactor, errno: %d", errno);
+            socket_reactor_teardown();
+            return PLCTAG_ERR_CREATE;
+        }
+    }
+
+#ifdef REACTOR_USE_IO_URING
+    /* the completion queue has one reader, so io_uring runs a single reactor thread. */
+    if(uring_setup() == PLCTAG_STATUS_OK) {
+        if(uring_add_unsafe(IORING_OP_POLL_ADD, reactor_wake_fds[0], POLLIN, REACTOR_URING_NO_FD) == PLCTAG_STATUS_OK
+           && uring_submit_unsafe() == PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_INFO, "Using io_uring for socket readiness%s.", (reactor_uring.sq_poll ? " with a kernel submission thread" : ""));
+            reactor_use_uring = 1;
+        } else {
+            uring_teardown();
+        }
+    }
+#endif
+
+    for(int i=0; i < REACTOR_NUM_THREADS; i++) {
+#ifdef REACTOR_USE_IO_URING
+        if(reactor_use_uring && i > 0) {
+            break;
+        }
+#endif
+
+        rc = thread_create(&reactor_threads[i], reactor_thread_func, 32*1024, NULL);
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Unable to create reactor thread!");
+            reactor_threads[i] = NULL;
+            socket_reactor_teardown();
+            return rc;
+        }
+    }
+
+    pdebug(DEBUG_INFO, "Done.");
+#endif
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+extern void socket_reactor_teardown(void)
+{
+#if defined(REACTOR_USE_EPOLL) || defined(REACTOR_USE_KQUEUE)
+    pdebug(DEBUG_INFO, "Starting.");
+
+    reactor_terminate = 1;
+
+    if(reactor_wake_fds[1] >= 0) {
+#ifdef REACTOR_USE_EPOLL
+        uint64_t count = 1;
+#else
+        uint8_t count = 0;
+#endif
+
+        if(write(reactor_wake_fds[1], &count, sizeof(count)) != (ssize_t)sizeof(count)) {
+            pdebug(DEBUG_WARN, "Unable to write to the reactor wake descriptor, errno: %d", errno);
+        }
+    }
+
+    for(int i=0; i < REACTOR_NUM_THREADS; i++) {
+        if(reactor_threads[i]) {
+            thread_join(reactor_threads[i]);
+            thread_destroy(&reactor_threads[i]);
+            reactor_threads[i] = NULL;
+        }
+    }
+
+    /* any socket still open falls back to polling. */
+    if(reactor_mutex) {
+        mutex_destroy(&reactor_mutex);
+        reactor_mutex = NULL;
+    }
+
+    if(reactor_fd >= 0) {
+        close(reactor_fd);
+        reactor_fd = -1;
+    }
+
+#ifdef REACTOR_USE_IO_URING
+    uring_teardown();
+    reactor_use_uring = 0;
+#endif
+
+    /* an eventfd is both ends. */
+    if(reactor_wake_fds[1] >= 0 && reactor_wake_fds[1] != reactor_wake_fds[0]) {
+        close(reactor_wake_fds[1]);
+    }
+
+    if(reactor_wake_fds[0] >= 0) {
+        close(reactor_wake_fds[0]);
+    }
+
+    reactor_wake_fds[0] = reactor_wake_fds[1] = -1;
+
+    if(reactor_socks) {
+        mem_free(reactor_socks);
+        reactor_socks = NULL;
+        reactor_socks_size = 0;
+    }
+
+    pdebug(DEBUG_INFO, "Done.");
+#endif
+}
+
+
+
+#if defined(REACTOR_USE_EPOLL) || defined(REACTOR_USE_KQUEUE)
+
+int reactor_add_unsafe(sock_p s)
+{
+    if(s->fd >= reactor_socks_size) {
+        int new_size = (reactor_socks_size > 0 ? reactor_socks_size : 64);
+        sock_p *new_socks = NULL;
+
+        while(new_size <= s->fd) {
+            new_size *= 2;
+        }
+
+        new_socks = (sock_p *)mem_realloc(reactor_socks, (int)(sizeof(sock_p) * (size_t)new_size));
+        if(!new_socks) {
+            pdebug(DEBUG_WARN, "Unable to grow the reactor socket table!");
+            return PLCTAG_ERR_NO_MEM;
+        }
+
+        mem_set(new_socks + reactor_socks_size, 0, (int)(sizeof(sock_p) * (size_t)(new_size - reactor_socks_size)));
+
+        reactor_socks = new_socks;
+        reactor_socks_size = new_size;
+    }
+
+#ifdef REACTOR_USE_IO_URING
+    s->uring_events = 0;
+    s->uring_tag = 0;
+#endif
+
+#ifdef REACTOR_USE_EPOLL
+#ifdef REACTOR_USE_IO_URING
+    if(!reactor_use_uring)
+#endif
+    {
+        struct epoll_event ev;
+
+        /* added disarmed, socket_wait_event() arms it. */
+        mem_set(&ev, 0, sizeof(ev));
+        ev.events = EPOLLONESHOT;
+        ev.data.fd = s->fd;
+
+        if(epoll_ctl(reactor_fd, EPOLL_CTL_ADD, s->fd, &ev)) {
+            pdebug(DEBUG_WARN, "Unable to add socket to epoll, errno: %d", errno);
+            return PLCTAG_ERR_CREATE;
+        }
+    }
+#endif
+
+    reactor_socks[s->fd] = s;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+void reactor_remove_unsafe(sock_p s)
+{
+    if(s->fd < 0 || s->fd >= reactor_socks_size || reactor_socks[s->fd] != s) {
+        return;
+    }
+
+    reactor_socks[s->fd] = NULL;
+
+#ifdef REACTOR_USE_IO_URING
+    /* an outstanding poll holds a reference to the socket, so it would not really close. */
+    if(reactor_use_uring) {
+        if(s->uring_events) {
+            uring_add_unsafe(IORING_OP_POLL_REMOVE, -1, 0, s->uring_tag);
+            uring_submit_unsafe();
+
+            s->uring_events = 0;
+            s->uring_tag = 0;
+        }
+
+        return;
+    }
+#endif
+
+#ifdef REACTOR_USE_EPOLL
+    {
+        /* older kernels require a non-null event pointer. */
+        struct epoll_event ev;
+
+        mem_set(&ev, 0, sizeof(ev));
+
+        epoll_ctl(reactor_fd, EPOLL_CTL_DEL, s->fd, &ev);
+    }
+#endif
+
+    /* kqueue drops the filters when the descriptor is closed. */
+}
+
+
+int reactor_arm_unsafe(sock_p s, int events)
+{
+#ifdef REACTOR_USE_IO_URING
+    if(reactor_use_uring) {
+        uint64_t tag = 0;
+        int rc = PLCTAG_STATUS_OK;
+
+        /* a poll for these events is still outstanding from a wait that timed out. */
+        if((s->uring_events & events) == events) {
+            return PLCTAG_STATUS_OK;
+        }
+
+        if(s->uring_events) {
+            uring_add_unsafe(IORING_OP_POLL_REMOVE, -1, 0, s->uring_tag);
+            s->uring_events = 0;
+            s->uring_tag = 0;
+        }
+
+        /* the sequence number tells a stale completion from the current one. */
+        reactor_uring_seq++;
+        tag = ((uint64_t)reactor_uring_seq << 32) | (uint64_t)(uint32_t)s->fd;
+
+        rc = uring_add_unsafe(IORING_OP_POLL_ADD, s->fd, (uint32_t)(((events & SOCKET_EVENT_READ) ? POLLIN : 0) | ((events & SOCKET_EVENT_WRITE) ? POLLOUT : 0)), tag);
+        if(rc == PLCTAG_STATUS_OK) {
+            s->uring_events = events;
+            s->uring_tag = tag;
+        }
+
+        if(uring_submit_unsafe() != PLCTAG_STATUS_OK || rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Unable to arm socket in the io_uring!");
+            return PLCTAG_ERR_BAD_STATUS;
+        }
+
+        return PLCTAG_STATUS_OK;
+    }
+#endif
+
+#ifdef REACTOR_USE_EPOLL
+    struct epoll_event ev;
+
+    mem_set(&ev, 0, sizeof(ev));
+    ev.events = EPOLLONESHOT | ((events & SOCKET_EVENT_READ) ? EPOLLIN : 0) | ((events & SOCKET_EVENT_WRITE) ? EPOLLOUT : 0);
+    ev.data.fd = s->fd;
+
+    if(epoll_ctl(reactor_fd, EPOLL_CTL_MOD, s->fd, &ev)) {
+        pdebug(DEBUG_WARN, "Unable to arm socket in epoll, errno: %d", errno);
+        return PLCTAG_ERR_BAD_STATUS;
+    }
+#else
+    struct kevent kev[2];
+    int num_kev = 0;
+
+    if(events & SOCKET_EVENT_READ) {
+        EV_SET(&kev[num_kev], (uintptr_t)s->fd, EVFILT_READ, EV_ADD | EV_ONESHOT, 0, 0, 0);
+        num_kev++;
+    }
+
+    if(events & SOCKET_EVENT_WRITE) {
+        EV_SET(&kev[num_kev], (uintptr_t)s->fd, EVFILT_WRITE, EV_ADD | EV_ONESHOT, 0, 0, 0);
+        num_kev++;
+    }
+
+    if(kevent(reactor_fd, kev, num_kev, NULL, 0, NULL)) {
+        pdebug(DEBUG_WARN, "Unable to arm socket in kqueue, errno: %d", errno);
+        return PLCTAG_ERR_BAD_STATUS;
+    }
+#endif
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+#ifdef REACTOR_USE_IO_URING
+
+/*
+ * uring_setup
+ *
+ * Create the ring.  On machines with a few CPUs try for a kernel
+ * submission thread first so that arming sockets does not need a system
+ * call.  Kernels before 5.11 only allow that for registered files or
+ * privileged processes, so fall back to a plain ring.
+ */
+
+int uring_setup(void)
+{
+    struct io_uring_params params;
+    reactor_uring_t *ring = &reactor_uring;
+    int fd = -1;
+
+    mem_set(&params, 0, sizeof(params));
+
+#ifdef IORING_FEAT_SQPOLL_NONFIXED
+    /* the submission thread spins while busy, it only pays off with CPUs to spare. */
+    if(sysconf(_SC_NPROCESSORS_ONLN) >= REACTOR_URING_SQ_MIN_CPUS) {
+        params.flags = IORING_SETUP_SQPOLL;
+        params.sq_thread_idle = REACTOR_URING_SQ_IDLE_MS;
+
+        fd = (int)syscall(__NR_io_uring_setup, REACTOR_URING_ENTRIES, &params);
+        if(fd >= 0 && !(params.features & IORING_FEAT_SQPOLL_NONFIXED)) {
+            close(fd);
+            fd = -1;
+        }
+
+        ring->sq_poll = (fd >= 0);
+    }
+#endif
+
+    if(fd < 0) {
+        mem_set(&params, 0, sizeof(params));
+
+        fd = (int)syscall(__NR_io_uring_setup, REACTOR_URING_ENTRIES, &params);
+        if(fd < 0) {
+            pdebug(DEBUG_INFO, "io_uring is not available, errno: %d.  Using epoll.", errno);
+            return PLCTAG_ERR_UNSUPPORTED;
+        }
+
+        ring->sq_poll = 0;
+    }
+
+    ring->fd = fd;
+    ring->sq_pending = 0;
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+#ifdef IORING_FEAT_SINGLE_MMAP
+    if(params.features & IORING_FEAT_SINGLE_MMAP) {
+        if(ring->cq_ring_size > ring->sq_ring_size) {
+            ring->sq_ring_size = ring->cq_ring_size;
+        }
+
+        ring->cq_ring_size = 0;
+    }
+#endif
+
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, IORING_OFF_SQ_RING);
+    if(ring->sq_ring == MAP_FAILED) {
+        ring->sq_ring = NULL;
+        uring_teardown();
+        return PLCTAG_ERR_CREATE;
+    }
+
+    if(ring->cq_ring_size) {
+        ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, IORING_OFF_CQ_RING);
+        if(ring->cq_ring == MAP_FAILED) {
+            ring->cq_ring = NULL;
+            uring_teardown();
+            return PLCTAG_ERR_CREATE;
+        }
+    } else {
+        ring->cq_ring = ring->sq_ring;
+    }
+
+    ring->sqes = (struct io_uring_sqe *)mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, IORING_OFF_SQES);
+    if((void *)ring->sqes == MAP_FAILED) {
+        ring->sqes = NULL;
+        uring_teardown();
+        return PLCTAG_ERR_CREATE;
+    }
+
+    ring->sq_head = (unsigned int *)((uint8_t *)ring->sq_ring + params.sq_off.head);
+    ring->sq_tail = (unsigned int *)((uint8_t *)ring->sq_ring + params.sq_off.tail);
+    ring->sq_mask = (unsigned int *)((uint8_t *)ring->sq_ring + params.sq_off.ring_mask);
+    ring->sq_flags = (unsigned int *)((uint8_t *)ring->sq_ring + params.sq_off.flags);
+    ring->sq_array = (unsigned int *)((uint8_t *)ring->sq_ring + params.sq_off.array);
+
+    ring->cq_head = (unsigned int *)((uint8_t *)ring->cq_ring + params.cq_off.head);
+    ring->cq_tail = (unsigned int *)((uint8_t *)ring->cq_ring + params.cq_off.tail);
+    ring->cq_mask = (unsigned int *)((uint8_t *)ring->cq_ring + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(void *)((uint8_t *)ring->cq_ring + params.cq_off.cqes);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+void uring_teardown(void)
+{
+    reactor_uring_t *ring = &reactor_uring;
+
+    if(ring->sqes) {
+        munmap(ring->sqes, ring->sqes_size);
+        ring->sqes = NULL;
+    }
+
+    if(ring->cq_ring && ring->cq_ring != ring->sq_ring) {
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    }
+
+    ring->cq_ring = NULL;
+
+    if(ring->sq_ring) {
+        munmap(ring->sq_ring, ring->sq_ring_size);
+        ring->sq_ring = NULL;
+    }
+
+    if(ring->fd >= 0) {
+        close(ring->fd);
+        ring->fd = -1;
+    }
+}
+
+
+/*
+ * uring_add_unsafe
+ *
+ * Queue a poll add on the descriptor or a poll remove of the request
+ * with the target user data.  Nothing is submitted until
+ * uring_submit_unsafe().  Called with the reactor mutex held.
+ */
+
+int uring_add_unsafe(uint8_t opcode, int fd, uint32_t poll_events, uint64_t target)
+{
+    reactor_uring_t *ring = &reactor_uring;
+    unsigned int tail = *ring->sq_tail;
+    unsigned int index = 0;
+    struct io_uring_sqe *sqe = NULL;
+
+    /* make room by handing what is queued to the kernel. */
+    if(tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= REACTOR_URING_ENTRIES) {
+        uring_submit_unsafe();
+
+        if(tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= REACTOR_URING_ENTRIES) {
+            pdebug(DEBUG_WARN, "io_uring submission queue is full!");
+            return PLCTAG_ERR_NO_RESOURCES;
+        }
+    }
+
+    index = tail & *ring->sq_mask;
+    sqe = &ring->sqes[index];
+
+    mem_set(sqe, 0, (int)sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+
+    if(opcode == IORING_OP_POLL_ADD) {
+        sqe->poll_events = (uint16_t)poll_events;
+        sqe->user_data = target;
+    } else {
+        sqe->addr = target;
+        sqe->user_data = REACTOR_URING_NO_FD;
+    }
+
+    ring->sq_array[index] = index;
+
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    ring->sq_pending++;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+/*
+ * uring_submit_unsafe
+ *
+ * Hand the queued requests to the kernel.  Everything queued by any
+ * session goes in one call.  With a kernel submission thread there is
+ * only a call if the thread went to sleep.  Called with the reactor
+ * mutex held.
+ */
+
+int uring_submit_unsafe(void)
+{
+    reactor_uring_t *ring = &reactor_uring;
+
+    if(ring->sq_poll) {
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+        if(__atomic_load_n(ring->sq_flags, __ATOMIC_RELAXED) & IORING_SQ_NEED_WAKEUP) {
+            syscall(__NR_io_uring_enter, ring->fd, 0, 0, IORING_ENTER_SQ_WAKEUP, NULL, 0);
+        }
+
+        ring->sq_pending = 0;
+
+        return PLCTAG_STATUS_OK;
+    }
+
+    while(ring->sq_pending > 0) {
+        long rc = syscall(__NR_io_uring_enter, ring->fd, ring->sq_pending, 0, 0, NULL, 0);
+
+        if(rc < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+
+            pdebug(DEBUG_WARN, "Unable to submit to the io_uring, errno: %d", errno);
+            return PLCTAG_ERR_BAD_STATUS;
+        }
+
+        if(rc == 0) {
+            break;
+        }
+
+        ring->sq_pending -= (unsigned int)rc;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+/*
+ * uring_wait
+ *
+ * Wait for at least one completion and reap up to max_events of them.
+ * Completions that are not for a socket get a descriptor of -1.
+ */
+
+int uring_wait(uint64_t *tags, int *fds, int *ready, int max_events)
+{
+    reactor_uring_t *ring = &reactor_uring;
+    unsigned int head = 0;
+    unsigned int tail = 0;
+    int num_events = 0;
+
+    if(syscall(__NR_io_uring_enter, ring->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0) {
+        return -1;
+    }
+
+    head = *ring->cq_head;
+    tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+    while(head != tail && num_events < max_events) {
+        struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+        uint64_t tag = cqe->user_data;
+        int res = cqe->res;
+
+        tags[num_events] = tag;
+
+        if(tag == REACTOR_URING_NO_FD || res == -ECANCELED) {
+            fds[num_events] = -1;
+            ready[num_events] = 0;
+        } else {
+            fds[num_events] = (int)(tag & 0xFFFFFFFF);
+
+            /* errors and hang ups show up as ready so that the next read or write sees them. */
+            if(res < 0 || (res & (POLLERR | POLLHUP | POLLNVAL))) {
+                ready[num_events] = SOCKET_EVENT_READ | SOCKET_EVENT_WRITE;
+            } else {
+                ready[num_events] = ((res & POLLIN) ? SOCKET_EVENT_READ : 0) | ((res & POLLOUT) ? SOCKET_EVENT_WRITE : 0);
+            }
+        }
+
+        num_events++;
+        head++;
+    }
+
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+
+    return num_events;
+}
+
+#endif
+
+
+THREAD_FUNC(reactor_thread_func)
+{
+    (void)arg;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    while(!reactor_terminate) {
+        int fds[REACTOR_MAX_EVENTS];
+        int ready[REACTOR_MAX_EVENTS];
+        int num_events = 0;
+#ifdef REACTOR_USE_IO_URING
+        uint64_t tags[REACTOR_MAX_EVENTS];
+#endif
+
+#ifdef REACTOR_USE_EPOLL
+        struct epoll_event evs[REACTOR_MAX_EVENTS];
+
+#ifdef REACTOR_USE_IO_URING
+        if(reactor_use_uring) {
+            num_events = uring_wait(tags, fds, ready, REACTOR_MAX_EVENTS);
+        } else
+#endif
+        {
+            num_events = epoll_wait(reactor_fd, evs, REACTOR_MAX_EVENTS, -1);
+
+            for(int i=0; i < num_events; i++) {
+                fds[i] = evs[i].data.fd;
+
+                if(evs[i].events & (EPOLLERR | EPOLLHUP)) {
+                    ready[i] = SOCKET_EVENT_READ | SOCKET_EVENT_WRITE;
+                } else {
+                    ready[i] = ((evs[i].events & EPOLLIN) ? SOCKET_EVENT_READ : 0) | ((evs[i].events & EPOLLOUT) ? SOCKET_EVENT_WRITE : 0);
+                }
+            }
+        }
+#else
+        struct kevent evs[REACTOR_MAX_EVENTS];
+
+        num_events = kevent(reactor_fd, NULL, 0, evs, REACTOR_MAX_EVENTS, NULL);
+
+        for(int i=0; i < num_events; i++) {
+            fds[i] = (int)evs[i].ident;
+
+            if(evs[i].flags & (EV_ERROR | EV_EOF)) {
+                ready[i] = SOCKET_EVENT_READ | SOCKET_EVENT_WRITE;
+            } else {
+                ready[i] = (evs[i].filter == EVFILT_READ ? SOCKET_EVENT_READ : SOCKET_EVENT_WRITE);
+            }
+        }
+#endif
+
+        if(num_events < 0) {
+            if(errno != EINTR) {
+                pdebug(DEBUG_WARN, "Error waiting for reactor events, errno: %d", errno);
+                sleep_ms(REACTOR_ERR_DELAY);
+            }
+
+            continue;
+        }
+
+        if(reactor_terminate) {
+            break;
+        }
+
+        critical_block(reactor_mutex) {
+            for(int i=0; i < num_events; i++) {
+                if(fds[i] >= 0 && fds[i] < reactor_socks_size && reactor_socks[fds[i]]) {
+                    sock_p s = reactor_socks[fds[i]];
+
+#ifdef REACTOR_USE_IO_URING
+                    /* the one-shot poll is done, the next wait must add another. */
+                    if(reactor_use_uring && s->uring_tag == tags[i]) {
+                        s->uring_events = 0;
+                        s->uring_tag = 0;
+                    }
+#endif
+
+                    s->events_ready |= ready[i];
+                    cond_signal(s->event_cond);
+                }
+            }
+        }
+    }
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    THREAD_RETURN(0);
+}
+
+#endif
+
+
+
+/***************************************************************************
+ ****************************** Serial Port ********************************
+ **************************************************************************/
+
+/*
+ * Serial ports are opened raw and non-blocking.  Reads and writes return
+ * zero when the port is not ready rather than blocking the caller.  The
+ * wake pipe lets another thread break a wait on the port.
+ */
+
+struct serial_port_t {
+    int fd;
+    int wake_fds[2];
+    struct termios old_termios;
+
+    /* line activity for frame gaps. */
+    int64_t last_activity_us;
+    int tx_pending;
+};
+
+
+static int serial_baud_to_speed(int baud_rate, speed_t *speed)
+{
+    switch(baud_rate) {
+        case 110: *speed = B110; break;
+        case 300: *speed = B300; break;
+        case 600: *speed = B600; break;
+        case 1200: *speed = B1200; break;
+        case 2400: *speed = B2400; break;
+        case 4800: *speed = B4800; break;
+        case 9600: *speed = B9600; break;
+        case 19200: *speed = B19200; break;
+        case 38400: *speed = B38400; break;
+#ifdef B57600
+        case 57600: *speed = B57600; break;
+#endif
+#ifdef B115200
+        case 115200: *speed = B115200; break;
+#endif
+        default:
+            return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+serial_port_p plc_lib_open_serial_port(const char *path, int baud_rate, int data_bits, int stop_bits, int parity_type)
+{
+    serial_port_p serial_port = NULL;
+    struct termios tio;
+    speed_t speed = B0;
+    tcflag_t char_size = CS8;
+    int fd = -1;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    if(!path) {
+        pdebug(DEBUG_WARN, "Serial port path is missing!");
+        return NULL;
+    }
+
+    if(serial_baud_to_speed(baud_rate, &speed) != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unsupported baud rate %d!", baud_rate);
+        return NULL;
+    }
+
+    switch(data_bits) {
+        case 5: char_size = CS5; break;
+        case 6: char_size = CS6; break;
+        case 7: char_size = CS7; break;
+        case 8: char_size = CS8; break;
+        default:
+            pdebug(DEBUG_WARN, "Unsupported number of data bits %d, must be 5-8!", data_bits);
+            return NULL;
+    }
+
+    if(stop_bits != 1 && stop_bits != 2) {
+        pdebug(DEBUG_WARN, "Unsupported number of stop bits %d, must be 1 or 2!", stop_bits);
+        return NULL;
+    }
+
+    if(parity_type < 0 || parity_type > 2) {
+        pdebug(DEBUG_WARN, "Unsupported parity type %d, must be none (0), odd (1) or even (2)!", parity_type);
+        return NULL;
+    }
+
+    serial_port = mem_alloc((int)(unsigned int)sizeof(*serial_port));
+    if(!serial_port) {
+        pdebug(DEBUG_WARN, "Unable to allocate serial port struct!");
+        return NULL;
+    }
+
+    serial_port->fd = -1;
+    serial_port->wake_fds[0] = serial_port->wake_fds[1] = -1;
+    serial_port->last_activity_us = 0;
+    serial_port->tx_pending = 0;
+
+    fd = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if(fd < 0) {
+        pdebug(DEBUG_WARN, "Unable to open serial port %s, errno %d!", path, errno);
+        mem_free(serial_port);
+        return NULL;
+    }
+
+    if(tcgetattr(fd, &serial_port->old_termios)) {
+        pdebug(DEBUG_WARN, "Unable to get serial port %s settings, errno %d!", path, errno);
+        close(fd);
+        mem_free(serial_port);
+        return NULL;
+    }
+
+    /* raw mode, no echo, no flow control, no character translation. */
+    tio = serial_port->old_termios;
+    tio.c_iflag &= (tcflag_t)~(IGNBRK | BRKINT | PARMRK | ISTRIP | INLCR | IGNCR | ICRNL | IXON | IXOFF | IXANY | INPCK);
+    tio.c_oflag &= (tcflag_t)~OPOST;
+    tio.c_lflag &= (tcflag_t)~(ECHO | ECHONL | ICANON | ISIG | IEXTEN);
+    tio.c_cflag &= (tcflag_t)~(CSIZE | PARENB | PARODD | CSTOPB);
+    tio.c_cflag |= (tcflag_t)(char_size | CREAD | CLOCAL);
+
+    if(stop_bits == 2) {
+        tio.c_cflag |= CSTOPB;
+    }
+
+    if(parity_type) {
+        tio.c_cflag |= PARENB;
+        tio.c_iflag |= INPCK;
+
+        if(parity_type == 1) {
+            tio.c_cflag |= PARODD;
+        }
+    }
+
+    tio.c_cc[VMIN] = 0;
+    tio.c_cc[VTIME] = 0;
+
+    if(cfsetispeed(&tio, speed) || cfsetospeed(&tio, speed) || tcsetattr(fd, TCSANOW, &tio)) {
+        pdebug(DEBUG_WARN, "Unable to set serial port %s settings, errno %d!", path, errno);
+        close(fd);
+        mem_free(serial_port);
+        return NULL;
+    }
+
+    tcflush(fd, TCIOFLUSH);
+
+    if(pipe(serial_port->wake_fds)) {
+        pdebug(DEBUG_WARN, "Unable to create serial port wake pipe, errno %d!", errno);
+        tcsetattr(fd, TCSANOW, &serial_port->old_termios);
+        close(fd);
+        mem_free(serial_port);
+        return NULL;
+    }
+
+    fcntl(serial_port->wake_fds[0], F_SETFL, O_NONBLOCK);
+    fcntl(serial_port->wake_fds[1], F_SETFL, O_NONBLOCK);
+
+    serial_port->fd = fd;
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return serial_port;
+}
+
+
+
+int plc_lib_close_serial_port(serial_port_p serial_port)
+{
+    if(!serial_port) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(serial_port->fd >= 0) {
+        tcsetattr(serial_port->fd, TCSANOW, &serial_port->old_termios);
+        close(serial_port->fd);
+        serial_port->fd = -1;
+    }
+
+    for(int i=0; i < 2; i++) {
+        if(serial_port->wake_fds[i] >= 0) {
+            close(serial_port->wake_fds[i]);
+            serial_port->wake_fds[i] = -1;
+        }
+    }
+
+    mem_free(serial_port);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+int plc_lib_serial_port_read(serial_port_p serial_port, uint8_t *data, int size)
+{
+    ssize_t rc = 0;
+
+    if(!serial_port || serial_port->fd < 0) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    rc = read(serial_port->fd, data, (size_t)(unsigned int)size);
+    if(rc < 0) {
+        if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+            return 0;
+        }
+
+        pdebug(DEBUG_WARN, "Serial port read error, errno %d!", errno);
+        return PLCTAG_ERR_READ;
+    }
+
+    if(rc > 0) {
+        serial_port->last_activity_us = time_us();
+    }
+
+    return (int)rc;
+}
+
+
+
+int plc_lib_serial_port_write(serial_port_p serial_port, uint8_t *data, int size)
 {
-    pdebug(DEBUG_DETAIL, "Starting.");
+    ssize_t rc = 0;
 
-    if(!s) {
-        pdebug(DEBUG_WARN, "null socket pointer.");
+    if(!serial_port || serial_port->fd < 0) {
         return PLCTAG_ERR_NULL_PTR;
     }
 
-    *s = (sock_p)mem_alloc(sizeof(struct sock_t));
+    rc = write(serial_port->fd, data, (size_t)(unsigned int)size);
+    if(rc < 0) {
+        if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+            return 0;
+        }
 
-    if(! *s) {
-        pdebug(DEBUG_ERROR, "Failed to allocate memory for socket.");
-        return PLCTAG_ERR_NO_MEM;
+        pdebug(DEBUG_WARN, "Serial port write error, errno %d!", errno);
+        return PLCTAG_ERR_WRITE;
     }
 
-    pdebug(DEBUG_DETAIL, "Done.");
+    if(rc > 0) {
+        serial_port->tx_pending = 1;
+    }
 
-    return PLCTAG_STATUS_OK;
+    return (int)rc;
 }
 
 
-extern int socket_connect_tcp(sock_p s, const char *host, int port)
+
+int plc_lib_serial_port_wait_event(serial_port_p serial_port, int events, int timeout_ms)
 {
-    struct in_addr ips[MAX_IPS];
-    int num_ips = 0;
-    struct sockaddr_in gw_addr;
-    int sock_opt = 1;
-    int i = 0;
-    int done = 0;
-    int fd;
-    int flags;
-    struct timeval timeout; /* used for timing out connections etc. */
-    struct linger so_linger; /* used to set up short/no lingering after connections are close()ed. */
+    struct pollfd pfds[2];
+    int rc = 0;
+    int result = 0;
 
-    pdebug(DEBUG_DETAIL,"Starting.");
+    if(!serial_port || serial_port->fd < 0) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
 
-    /* Open a socket for communication with the gateway. */
-    fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    pfds[0].fd = serial_port->fd;
+    pfds[0].events = (short)(((events & SOCKET_EVENT_READ) ? POLLIN : 0) | ((events & SOCKET_EVENT_WRITE) ? POLLOUT : 0));
+    pfds[0].revents = 0;
 
-    /* check for errors */
-    if(fd < 0) {
-        pdebug(DEBUG_ERROR,"Socket creation failed, errno: %d",errno);
-        return PLCTAG_ERR_OPEN;
-    }
+    pfds[1].fd = serial_port->wake_fds[0];
+    pfds[1].events = POLLIN;
+    pfds[1].revents = 0;
 
-    /* set up our socket to allow reuse if we crash suddenly. */
-    sock_opt = 1;
+    rc = poll(pfds, 2, timeout_ms);
+    if(rc < 0) {
+        if(errno == EINTR) {
+            return 0;
+        }
 
-    if(setsockopt(fd,SOL_SOCKET,SO_REUSEADDR,(char*)&sock_opt,sizeof(sock_opt))) {
-        close(fd);
-        pdebug(DEBUG_ERROR, "Error setting socket reuse option, errno: %d",errno);
-        return PLCTAG_ERR_OPEN;
+        pdebug(DEBUG_WARN, "Error polling serial port, errno: %d", errno);
+        return PLCTAG_ERR_READ;
     }
 
-#ifdef BSD_OS_TYPE
-    /* The *BSD family has a different way to suppress SIGPIPE on sockets. */
-    if(setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, (char*)&sock_opt, sizeof(sock_opt))) {
-        close(fd);
-        pdebug(DEBUG_ERROR, "Error setting socket SIGPIPE suppression option, errno: %d", errno);
-        return PLCTAG_ERR_OPEN;
+    if(rc == 0) {
+        return PLCTAG_ERR_TIMEOUT;
     }
-#endif
 
-    timeout.tv_sec = 10;
-    timeout.tv_usec = 0;
+    /* drain the wake pipe. */
+    if(pfds[1].revents & POLLIN) {
+        uint8_t buf[32];
 
-    if(setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, (char*)&timeout, sizeof(timeout))) {
-        close(fd);
-        pdebug(DEBUG_ERROR,"Error setting socket receive timeout option, errno: %d",errno);
-        return PLCTAG_ERR_OPEN;
+        while(read(serial_port->wake_fds[0], buf, sizeof(buf)) > 0) { }
     }
 
-    if(setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, (char*)&timeout, sizeof(timeout))) {
-        close(fd);
-        pdebug(DEBUG_ERROR, "Error setting socket set timeout option, errno: %d",errno);
-        return PLCTAG_ERR_OPEN;
+    if(pfds[0].revents & (POLLIN | POLLERR | POLLHUP)) {
+        result |= SOCKET_EVENT_READ;
     }
 
-    /* abort the connection immediately upon close. */
-    so_linger.l_onoff = 1;
-    so_linger.l_linger = 0;
-
-    if(setsockopt(fd, SOL_SOCKET, SO_LINGER,(char*)&so_linger,sizeof(so_linger))) {
-        close(fd);
-        pdebug(DEBUG_ERROR,"Error setting socket close linger option, errno: %d",errno);
-        return PLCTAG_ERR_OPEN;
+    if(pfds[0].revents & POLLOUT) {
+        result |= SOCKET_EVENT_WRITE;
     }
 
-    /* figure out what address we are connecting to. */
+    return result & (events | SOCKET_EVENT_READ);
+}
 
-    /* try a numeric IP address conversion first. */
-    if(inet_pton(AF_INET,host,(struct in_addr *)ips) > 0) {
-        pdebug(DEBUG_DETAIL, "Found numeric IP address: %s",host);
-        num_ips = 1;
-    } else {
-        struct addrinfo hints;
-        struct addrinfo *res_head = NULL;
-        struct addrinfo *res=NULL;
-        int rc = 0;
 
-        mem_set(&ips, 0, sizeof(ips));
-        mem_set(&hints, 0, sizeof(hints));
 
-        hints.ai_socktype = SOCK_STREAM; /* TCP */
-        hints.ai_family = AF_INET; /* IP V4 only */
+int plc_lib_serial_port_wake(serial_port_p serial_port)
+{
+    uint8_t byte = 0;
 
-        if ((rc = getaddrinfo(host, NULL, &hints, &res_head)) != 0) {
-            pdebug(DEBUG_WARN,"Error looking up PLC IP address %s, error = %d\n", host, rc);
+    if(!serial_port || serial_port->wake_fds[1] < 0) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
 
-            if(res_head) {
-                freeaddrinfo(res_head);
-            }
+    /* a full pipe already has a wake up pending. */
+    if(write(serial_port->wake_fds[1], &byte, 1) != 1 && errno != EAGAIN) {
+        return PLCTAG_ERR_WRITE;
+    }
 
-            close(fd);
-            return PLCTAG_ERR_BAD_GATEWAY;
-        }
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+int plc_lib_serial_port_wait_gap(serial_port_p serial_port, int gap_us)
+{
+    int64_t remaining = 0;
 
-        res = res_head;
-        for(num_ips = 0; res && num_ips < MAX_IPS; num_ips++) {
-            ips[num_ips].s_addr = ((struct sockaddr_in *)(res->ai_addr))->sin_addr.s_addr;
-            res = res->ai_next;
+    if(!serial_port || serial_port->fd < 0) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    /* written data is only on the wire once the driver has drained it. */
+    if(serial_port->tx_pending) {
+        if(tcdrain(serial_port->fd) && errno != EINTR) {
+            pdebug(DEBUG_WARN, "Unable to drain serial port, errno %d!", errno);
+            return PLCTAG_ERR_WRITE;
         }
 
-        freeaddrinfo(res_head);
+        serial_port->tx_pending = 0;
+        serial_port->last_activity_us = time_us();
     }
 
+    remaining = serial_port->last_activity_us + gap_us - time_us();
 
-    /* now try to connect to the remote gateway.  We may need to
-     * try several of the IPs we have.
-     */
+    /* the clock could have been set back. */
+    if(remaining > gap_us) {
+        remaining = gap_us;
+    }
 
-    i = 0;
-    done = 0;
+    if(remaining > 0) {
+        struct timespec wait_time;
 
-    memset((void *)&gw_addr,0, sizeof(gw_addr));
-    gw_addr.sin_family = AF_INET ;
-    gw_addr.sin_port = htons((uint16_t)port);
+        wait_time.tv_sec = (time_t)(remaining / 1000000);
+        wait_time.tv_nsec = (long)((remaining % 1000000) * 1000);
 
-    do {
-        int rc;
-        /* try each IP until we run out or get a connection. */
-        gw_addr.sin_addr.s_addr = ips[i].s_addr;
+        while(nanosleep(&wait_time, &wait_time) && errno == EINTR) { }
+    }
 
-        pdebug(DEBUG_DETAIL, "Attempting to connect to %s",inet_ntoa(*((struct in_addr *)&ips[i])));
+    return PLCTAG_STATUS_OK;
+}
 
-        rc = connect(fd,(struct sockaddr *)&gw_addr,sizeof(gw_addr));
 
-        if( rc == 0) {
-            pdebug(DEBUG_DETAIL, "Attempt to connect to %s succeeded.",inet_ntoa(*((struct in_addr *)&ips[i])));
-            done = 1;
-        } else {
-            pdebug(DEBUG_DETAIL, "Attempt to connect to %s failed, errno: %d",inet_ntoa(*((struct in_addr *)&ips[i])),errno);
-            i++;
-        }
-    } while(!done && i < num_ips);
 
-    if(!done) {
-        close(fd);
-        pdebug(DEBUG_ERROR, "Unable to connect to any gateway host IP address!");
-        return PLCTAG_ERR_OPEN;
-    }
 
+/***************************************************************************
+ ***************************** Shared Memory *******************************
+ **************************************************************************/
 
-    /* FIXME
-     * connect() is a little easier to handle in blocking mode, for now
-     * we make the socket non-blocking here, after connect(). */
-    flags=fcntl(fd,F_GETFL,0);
 
-    if(flags<0) {
-        pdebug(DEBUG_ERROR, "Error getting socket options, errno: %d", errno);
-        close(fd);
-        return PLCTAG_ERR_OPEN;
-    }
+struct shm_t {
+    uint8_t *data;
+    int size;
+    int is_owner;
+    char name[NAME_MAX];
+};
 
-    flags |= O_NONBLOCK;
 
-    if(fcntl(fd,F_SETFL,flags)<0) {
-        pdebug(DEBUG_ERROR, "Error setting socket to non-blocking, errno: %d", errno);
-        close(fd);
-        return PLCTAG_ERR_OPEN;
+static int shm_make_name(const char *name, char *buf, int buf_size)
+{
+    /* POSIX names are one path component that starts with a slash. */
+    if(!name || str_length(name) < 1 || str_length(name) + 2 > buf_size || strchr(name, '/')) {
+        pdebug(DEBUG_WARN, "Shared memory name is empty, too long or has a slash!");
+        return PLCTAG_ERR_BAD_PARAM;
     }
 
-    /* save the values */
-    s->fd = fd;
-    s->port = port;
-    s->is_open = 1;
-
-    pdebug(DEBUG_DETAIL, "Done.");
+    snprintf(buf, (size_t)(unsigned int)buf_size, "/%s", name);
 
     return PLCTAG_STATUS_OK;
 }
 
 
-
-
-extern int socket_read(sock_p s, uint8_t *buf, int size)
+int shm_create(const char *name, int size, shm_p *shm)
 {
-    int rc;
+    struct shm_t *res = NULL;
+    int fd = -1;
+    void *data = NULL;
 
-    if(!s || !buf) {
-        return PLCTAG_ERR_NULL_PTR;
-    }
+    pdebug(DEBUG_INFO, "Starting.");
 
-    if(!s->is_open) {
-        pdebug(DEBUG_WARN, "Socket is not open!");
-        return PLCTAG_ERR_READ;
+    if(!shm || size <= 0) {
+        pdebug(DEBUG_WARN, "Null pointer or bad size!");
+        return PLCTAG_ERR_BAD_PARAM;
     }
 
-    /* The socket is non-blocking. */
-    rc = (int)read(s->fd,buf,(size_t)size);
+    *shm = NULL;
 
-    if(rc < 0) {
-        if(errno == EAGAIN || errno == EWOULDBLOCK) {
-            return 0;
-        } else {
-            pdebug(DEBUG_WARN,"Socket read error: rc=%d, errno=%d", rc, errno);
-            return PLCTAG_ERR_READ;
-        }
+    res = (struct shm_t *)mem_alloc((int)sizeof(*res));
+    if(!res) {
+        pdebug(DEBUG_ERROR, "Unable to allocate shared memory struct!");
+        return PLCTAG_ERR_NO_MEM;
     }
 
-    return rc;
-}
-
+    if(shm_make_name(name, res->name, (int)sizeof(res->name)) != PLCTAG_STATUS_OK) {
+        mem_free(res);
+        return PLCTAG_ERR_BAD_PARAM;
+    }
 
-extern int socket_write(sock_p s, uint8_t *buf, int size)
-{
-    int rc;
+    /* replace a region left by a process that died, readers of it keep the old one. */
+    shm_unlink(res->name);
 
-    if(!s || !buf) {
-        return PLCTAG_ERR_NULL_PTR;
+    fd = shm_open(res->name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if(fd < 0) {
+        pdebug(DEBUG_WARN, "Unable to create shared memory %s, errno %d!", res->name, errno);
+        mem_free(res);
+        return PLCTAG_ERR_OPEN;
     }
 
-    if(!s->is_open) {
-        pdebug(DEBUG_WARN, "Socket is not open!");
-        return PLCTAG_ERR_WRITE;
+    if(ftruncate(fd, (off_t)size) != 0) {
+        pdebug(DEBUG_WARN, "Unable to size shared memory %s, errno %d!", res->name, errno);
+        close(fd);
+        shm_unlink(res->name);
+        mem_free(res);
+        return PLCTAG_ERR_NO_RESOURCES;
     }
 
-    /* The socket is non-blocking. */
-#ifdef BSD_OS_TYPE
-    /* On *BSD and macOS, the socket option is set to prevent SIGPIPE. */
-    rc = (int)write(s->fd, buf, (size_t)size);
-#else
-    /* on Linux, we use MSG_NOSIGNAL */
-    rc = (int)send(s->fd, buf, (size_t)size, MSG_NOSIGNAL);
-#endif
+    data = mmap(NULL, (size_t)(unsigned int)size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
 
-    if(rc < 0) {
-        if(errno == EAGAIN || errno == EWOULDBLOCK) {
-            return PLCTAG_ERR_NO_DATA;
-        } else {
-            pdebug(DEBUG_WARN, "Socket write error: rc=%d, errno=%d", rc, errno);
-            return PLCTAG_ERR_WRITE;
-        }
+    if(data == MAP_FAILED) {
+        pdebug(DEBUG_WARN, "Unable to map shared memory %s, errno %d!", res->name, errno);
+        shm_unlink(res->name);
+        mem_free(res);
+        return PLCTAG_ERR_NO_RESOURCES;
     }
 
-    return rc;
-}
+    res->data = (uint8_t *)data;
+    res->size = size;
+    res->is_owner = 1;
 
+    *shm = res;
 
+    pdebug(DEBUG_INFO, "Done.");
 
-extern int socket_close(sock_p s)
+    return PLCTAG_STATUS_OK;
+}
+
+
+int shm_attach(const char *name, shm_p *shm)
 {
-    if(!s) {
+    struct shm_t *res = NULL;
+    struct stat st;
+    int fd = -1;
+    void *data = NULL;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(!shm) {
+        pdebug(DEBUG_WARN, "Null pointer!");
         return PLCTAG_ERR_NULL_PTR;
     }
 
-    if(!s->is_open) {
-        return PLCTAG_STATUS_OK;
+    *shm = NULL;
+
+    res = (struct shm_t *)mem_alloc((int)sizeof(*res));
+    if(!res) {
+        pdebug(DEBUG_ERROR, "Unable to allocate shared memory struct!");
+        return PLCTAG_ERR_NO_MEM;
     }
 
-    s->is_open = 0;
+    if(shm_make_name(name, res->name, (int)sizeof(res->name)) != PLCTAG_STATUS_OK) {
+        mem_free(res);
+        return PLCTAG_ERR_BAD_PARAM;
+    }
 
-    if(close(s->fd)) {
-        return PLCTAG_ERR_CLOSE;
+    fd = shm_open(res->name, O_RDONLY, 0);
+    if(fd < 0) {
+        pdebug(DEBUG_DETAIL, "Shared memory %s does not exist, errno %d.", res->name, errno);
+        mem_free(res);
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    if(fstat(fd, &st) != 0 || st.st_size <= 0 || st.st_size > INT_MAX) {
+        pdebug(DEBUG_WARN, "Shared memory %s is not usable yet.", res->name);
+        close(fd);
+        mem_free(res);
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if(data == MAP_FAILED) {
+        pdebug(DEBUG_WARN, "Unable to map shared memory %s, errno %d!", res->name, errno);
+        mem_free(res);
+        return PLCTAG_ERR_NO_RESOURCES;
     }
 
-    s->fd = 0;
+    res->data = (uint8_t *)data;
+    res->size = (int)st.st_size;
+    res->is_owner = 0;
+
+    *shm = res;
+
+    pdebug(DEBUG_INFO, "Done.");
 
     return PLCTAG_STATUS_OK;
 }
 
 
-extern int socket_destroy(sock_p *s)
+uint8_t *shm_data(shm_p shm)
 {
-    if(!s || !*s)
-        return PLCTAG_ERR_NULL_PTR;
+    return (shm ? shm->data : NULL);
+}
 
-    socket_close(*s);
 
-    mem_free(*s);
+int shm_size(shm_p shm)
+{
+    return (shm ? shm->size : 0);
+}
 
-    *s = 0;
 
-    return PLCTAG_STATUS_OK;
-}
+int shm_destroy(shm_p *shm)
+{
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(!shm || !*shm) {
+        pdebug(DEBUG_WARN, "Null pointer!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    munmap((*shm)->data, (size_t)(unsigned int)(*shm)->size);
 
+    if((*shm)->is_owner) {
+        shm_unlink((*shm)->name);
+    }
 
+    mem_free(*shm);
+    *shm = NULL;
 
+    pdebug(DEBUG_INFO, "Done.");
 
+    return PLCTAG_STATUS_OK;
+}
 
 
 
@@ -1314,12 +3845,54 @@ int sleep_ms(int ms)
 }
 
 
+/*
+ * time_ns
+ *
+ * Return the monotonic clock in nanoseconds.  The baseline is arbitrary,
+ * only differences mean anything.  The clock does not jump when the
+ * system time is set by NTP or by hand.
+ */
+int64_t time_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((int64_t)ts.tv_sec*1000000000) + (int64_t)ts.tv_nsec;
+}
+
+
 /*
  * time_ms
  *
- * Return the current epoch time in milliseconds.
+ * Return the monotonic clock in milliseconds.  Use this for timeouts
+ * and scheduling.
  */
 int64_t time_ms(void)
+{
+    return time_ns() / 1000000;
+}
+
+
+/*
+ * time_us
+ *
+ * Return the monotonic clock in microseconds on the same baseline
+ * as time_ms().
+ */
+int64_t time_us(void)
+{
+    return time_ns() / 1000;
+}
+
+
+/*
+ * time_epoch_ms
+ *
+ * Return the current wall clock time in milliseconds since the Unix
+ * epoch.  Only for showing to people, it can go backwards.
+ */
+int64_t time_epoch_ms(void)
 {
     struct timeval tv;
 
@@ -44,6 +44,7 @@
 #include <io.h>
 #include <Winsock2.h>
 #include <Ws2tcpip.h>
+#include <mstcpip.h>
 #include <string.h>
 #include <stdlib.h>
 #include <winnt.h>
@@ -54,7 +55,15 @@
 #include <stdio.h>
 
 #include <lib/libplctag.h>
+#include <util/arena.h>
 #include <util/debug.h>
+#include <util/trace.h>
+
+#if defined(PLCTAG_USE_ETW)
+/* {f7978f45-fa83-4fba-9248-820b3877062c} */
+TRACELOGGING_DEFINE_PROVIDER(plctag_trace_provider, "libplctag",
+    (0xf7978f45, 0xfa83, 0x4fba, 0x92, 0x48, 0x82, 0x0b, 0x38, 0x77, 0x06, 0x2c));
+#endif
 
 
 /*#ifdef __cplusplus
@@ -82,6 +91,43 @@ extern "C"
 
 
 
+/*
+ * Application supplied allocator.  All three must be set or none.  The
+ * allocator cannot change once the library has allocated anything,
+ * otherwise memory would be freed by the wrong allocator.
+ */
+static mem_alloc_func mem_hook_alloc = NULL;
+static mem_realloc_func mem_hook_realloc = NULL;
+static mem_free_func mem_hook_free = NULL;
+static volatile int mem_used = 0;
+
+
+/*
+ * mem_set_allocator
+ *
+ * Replace the memory allocator.  Passing all NULLs goes back to the C
+ * library allocator.
+ */
+extern int mem_set_allocator(mem_alloc_func alloc_func, mem_realloc_func realloc_func, mem_free_func free_func)
+{
+    if((alloc_func || realloc_func || free_func) && !(alloc_func && realloc_func && free_func)) {
+        pdebug(DEBUG_WARN, "All of the allocator functions must be set or none!");
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    if(mem_used) {
+        pdebug(DEBUG_WARN, "The allocator must be set before the library allocates any memory!");
+        return PLCTAG_ERR_BUSY;
+    }
+
+    mem_hook_alloc = alloc_func;
+    mem_hook_realloc = realloc_func;
+    mem_hook_free = free_func;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
 /*
  * mem_alloc
  *
@@ -92,12 +138,25 @@ extern "C"
  */
 extern void *mem_alloc(int size)
 {
+    void *res = NULL;
+
     if(size <= 0) {
         pdebug(DEBUG_WARN, "Allocation size must be greater than zero bytes!");
         return NULL;
     }
 
-    return calloc(size, 1);
+    mem_used = 1;
+
+    if(!mem_hook_alloc) {
+        return calloc(size, 1);
+    }
+
+    res = mem_hook_alloc((size_t)(unsigned int)size);
+    if(res) {
+        memset(res, 0, (size_t)(unsigned int)size);
+    }
+
+    return res;
 }
 
 
@@ -116,6 +175,12 @@ extern void *mem_realloc(void *orig, int size)
         return NULL;
     }
 
+    mem_used = 1;
+
+    if(mem_hook_realloc) {
+        return mem_hook_realloc(orig, (size_t)(unsigned int)size);
+    }
+
     return realloc(orig, (size_t)(ssize_t)size);
 }
 
@@ -132,7 +197,11 @@ extern void *mem_realloc(void *orig, int size)
 extern void mem_free(const void *mem)
 {
     if(mem) {
-        free((void *)mem);
+        if(mem_hook_free) {
+            mem_hook_free((void *)mem);
+        } else {
+            free((void *)mem);
+        }
     }
 }
 
@@ -440,11 +509,22 @@ extern int str_length(const char *str)
  */
 extern char *str_dup(const char *str)
 {
+    int size = 0;
+    char *res = NULL;
+
     if(!str) {
         return NULL;
     }
 
-    return _strdup(str);
+    /* use mem_alloc() so that mem_free() matches, even with an application allocator. */
+    size = (int)(unsigned int)strlen(str) + 1;
+
+    res = (char *)mem_alloc(size);
+    if(res) {
+        memcpy(res, str, (size_t)(unsigned int)size);
+    }
+
+    return res;
 }
 
 
@@ -625,8 +705,52 @@ char *str_concat_impl(int num_args, ...)
 struct mutex_t {
     HANDLE h_mutex;
     int initialized;
+    arena_p arena;
 };
 
+/*
+ * With tag_arena set, the mutex and condition var structures come from
+ * arenas so that the ones made for a tag sit together.
+ */
+
+static arena_p mutex_arena = NULL;
+static arena_p cond_arena = NULL;
+static lock_t sync_arena_lock = LOCK_INIT;
+
+static void *sync_obj_alloc(arena_p *arena, int size, arena_p *from)
+{
+    void *obj = NULL;
+
+    *from = NULL;
+
+    if(arena_enabled()) {
+        spin_block(&sync_arena_lock) {
+            if(!*arena) {
+                *arena = arena_create(size, 0);
+            }
+        }
+
+        obj = arena_alloc(*arena);
+        if(obj) {
+            *from = *arena;
+            return obj;
+        }
+    }
+
+    return mem_alloc(size);
+}
+
+
+static void sync_obj_free(arena_p from, void *obj)
+{
+    if(from) {
+        arena_free(from, obj);
+    } else {
+        mem_free(obj);
+    }
+}
+
+
 
 int mutex_create(mutex_p *m)
 {
@@ -636,7 +760,15 @@ int mutex_create(mutex_p *m)
         pdebug(DEBUG_WARN, "Called with non-NULL pointer!");
     }
 
-    *m = (struct mutex_t *)mem_alloc(sizeof(struct mutex_t));
+    {
+        arena_p from = NULL;
+
+        *m = (struct mutex_t *)sync_obj_alloc(&mutex_arena, (int)(unsigned int)sizeof(struct mutex_t), &from);
+        if(*m) {
+            (*m)->arena = from;
+        }
+    }
+
     if(! *m) {
         pdebug(DEBUG_WARN, "null mutex pointer!");
         return PLCTAG_ERR_NULL_PTR;
@@ -649,7 +781,7 @@ int mutex_create(mutex_p *m)
                         NULL);                  /* unnamed mutex                */
 
     if(!(*m)->h_mutex) {
-        mem_free(*m);
+        sync_obj_free((*m)->arena, *m);
         *m = NULL;
         pdebug(DEBUG_WARN, "Error initializing mutex!");
         return PLCTAG_ERR_MUTEX_INIT;
@@ -664,6 +796,44 @@ int mutex_create(mutex_p *m)
 
 
 
+/*
+ * Pooled mutexes are shared by many tags, so one thread may end up
+ * taking the same one for two tags.  Windows mutexes are recursive
+ * already, the block is sized so that two never share a cache line.
+ */
+
+#define MUTEX_POOLED_SIZE (128)
+
+int mutex_create_pooled(mutex_p *m)
+{
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    if(*m) {
+        pdebug(DEBUG_WARN, "Called with non-NULL pointer!");
+    }
+
+    *m = (struct mutex_t *)mem_alloc(((int)(unsigned int)sizeof(struct mutex_t) > MUTEX_POOLED_SIZE ? (int)(unsigned int)sizeof(struct mutex_t) : MUTEX_POOLED_SIZE));
+    if(! *m) {
+        pdebug(DEBUG_WARN, "null mutex pointer!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    (*m)->h_mutex = CreateMutex(NULL, FALSE, NULL);
+    if(!(*m)->h_mutex) {
+        mem_free(*m);
+        *m = NULL;
+        pdebug(DEBUG_WARN, "Error initializing mutex!");
+        return PLCTAG_ERR_MUTEX_INIT;
+    }
+
+    (*m)->initialized = 1;
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
 int mutex_lock_impl(const char *func, int line, mutex_p m)
 {
     DWORD dwWaitResult = 0;
@@ -754,7 +924,7 @@ int mutex_destroy(mutex_p *m)
 
     CloseHandle((*m)->h_mutex);
 
-    mem_free(*m);
+    sync_obj_free((*m)->arena, *m);
 
     *m = NULL;
 
@@ -767,6 +937,182 @@ int mutex_destroy(mutex_p *m)
 
 
 
+/***************************************************************************
+ ************************* Condition Variables *****************************
+ **************************************************************************/
+
+struct cond_t {
+    CRITICAL_SECTION cs;
+    CONDITION_VARIABLE cond;
+    int flag;
+    arena_p arena;
+};
+
+int cond_create(cond_p *c)
+{
+    int rc = PLCTAG_STATUS_OK;
+    cond_p tmp_cond = NULL;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    if(!c) {
+        pdebug(DEBUG_WARN, "Null pointer to condition var pointer!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(*c) {
+        pdebug(DEBUG_WARN, "Condition var pointer is not null, was it not deleted first?");
+    }
+
+    /* clear the output first. */
+    *c = NULL;
+
+    {
+        arena_p from = NULL;
+
+        tmp_cond = sync_obj_alloc(&cond_arena, (int)(unsigned int)sizeof(*tmp_cond), &from);
+        if(!tmp_cond) {
+            pdebug(DEBUG_WARN, "Unable to allocate new condition var!");
+            return PLCTAG_ERR_NO_MEM;
+        }
+
+        tmp_cond->arena = from;
+    }
+
+    InitializeCriticalSection(&(tmp_cond->cs));
+    InitializeConditionVariable(&(tmp_cond->cond));
+
+    tmp_cond->flag = 0;
+
+    *c = tmp_cond;
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return rc;
+}
+
+
+int cond_wait_impl(const char *func, int line_num, cond_p c, int timeout)
+{
+    int rc = PLCTAG_STATUS_OK;
+    int64_t start_time = time_ms();
+    int64_t end_time = start_time + timeout;
+
+    pdebug(DEBUG_SPEW, "Starting. Called from %s:%d.", func, line_num);
+
+    if(!c) {
+        pdebug(DEBUG_WARN, "Condition var pointer is null in call from %s:%d!", func, line_num);
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(timeout <= 0) {
+        pdebug(DEBUG_WARN, "Timeout must be a positive value but was %d in call from %s:%d!", timeout, func, line_num);
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    EnterCriticalSection(&(c->cs));
+
+    while(!c->flag) {
+        int64_t time_left = end_time - time_ms();
+
+        if(time_left <= 0) {
+            rc = PLCTAG_ERR_TIMEOUT;
+            break;
+        }
+
+        if(!SleepConditionVariableCS(&(c->cond), &(c->cs), (DWORD)time_left)) {
+            if(GetLastError() == ERROR_TIMEOUT) {
+                pdebug(DEBUG_SPEW, "Timeout response from condition var wait.");
+                rc = PLCTAG_ERR_TIMEOUT;
+                break;
+            } else {
+                pdebug(DEBUG_WARN, "Error waiting on condition variable!");
+                rc = PLCTAG_ERR_BAD_STATUS;
+                break;
+            }
+        }
+    }
+
+    if(c->flag) {
+        /* we consume the signal. */
+        c->flag = 0;
+        rc = PLCTAG_STATUS_OK;
+    }
+
+    LeaveCriticalSection(&(c->cs));
+
+    pdebug(DEBUG_SPEW, "Done for call from %s:%d in %dms with status %s.", func, line_num, (int)(time_ms() - start_time), plc_tag_decode_error(rc));
+
+    return rc;
+}
+
+
+int cond_signal_impl(const char *func, int line_num, cond_p c)
+{
+    pdebug(DEBUG_SPEW, "Starting.  Called from %s:%d.", func, line_num);
+
+    if(!c) {
+        pdebug(DEBUG_WARN, "Condition var pointer is null in call at %s:%d!", func, line_num);
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    EnterCriticalSection(&(c->cs));
+    c->flag = 1;
+    LeaveCriticalSection(&(c->cs));
+
+    WakeConditionVariable(&(c->cond));
+
+    pdebug(DEBUG_SPEW, "Done for call at %s:%d.", func, line_num);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+int cond_clear_impl(const char *func, int line_num, cond_p c)
+{
+    pdebug(DEBUG_SPEW, "Starting.  Called from %s:%d.", func, line_num);
+
+    if(!c) {
+        pdebug(DEBUG_WARN, "Condition var pointer is null in call at %s:%d!", func, line_num);
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    EnterCriticalSection(&(c->cs));
+    c->flag = 0;
+    LeaveCriticalSection(&(c->cs));
+
+    pdebug(DEBUG_SPEW, "Done for call at %s:%d.", func, line_num);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+int cond_destroy(cond_p *c)
+{
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    if(!c || ! *c) {
+        pdebug(DEBUG_WARN, "Condition var pointer is null!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    DeleteCriticalSection(&((*c)->cs));
+
+    sync_obj_free((*c)->arena, *c);
+
+    *c = NULL;
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+
+
+
+
 /***************************************************************************
  ******************************* Threads ***********************************
  **************************************************************************/
@@ -903,6 +1249,101 @@ extern int thread_detach()
 
 
 
+/*
+ * thread_set_name
+ *
+ * Name the thread for debuggers.  SetThreadDescription() only exists on
+ * Windows 10 1607 and later, so look it up at run time.
+ */
+typedef HRESULT (WINAPI *set_thread_description_func)(HANDLE thread, PCWSTR description);
+
+extern int thread_set_name(thread_p t, const char *name)
+{
+    set_thread_description_func set_description = NULL;
+    WCHAR wide_name[64];
+
+    if(!t || !name) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    set_description = (set_thread_description_func)(void *)GetProcAddress(GetModuleHandleA("kernel32.dll"), "SetThreadDescription");
+    if(!set_description) {
+        return PLCTAG_ERR_UNSUPPORTED;
+    }
+
+    if(!MultiByteToWideChar(CP_UTF8, 0, name, -1, wide_name, (int)(sizeof(wide_name)/sizeof(wide_name[0])))) {
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    if(FAILED(set_description(t->h_thread, wide_name))) {
+        pdebug(DEBUG_DETAIL, "Unable to set thread name %s.", name);
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+/*
+ * thread_set_affinity
+ *
+ * Limit the thread to the CPUs set in the mask, bit 0 is CPU 0.
+ */
+extern int thread_set_affinity(thread_p t, uint32_t cpu_mask)
+{
+    if(!t) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(!cpu_mask) {
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    if(!SetThreadAffinityMask(t->h_thread, (DWORD_PTR)cpu_mask)) {
+        pdebug(DEBUG_WARN, "Unable to set thread CPU affinity to 0x%x, error %d!", (unsigned int)cpu_mask, (int)GetLastError());
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+/*
+ * thread_set_priority
+ *
+ * Windows has no SCHED_FIFO.  Zero is normal priority, the 1-99 range is
+ * spread over the three priorities above normal.  The process priority
+ * class is left to the application.
+ */
+extern int thread_set_priority(thread_p t, int priority)
+{
+    int win_priority = THREAD_PRIORITY_NORMAL;
+
+    if(!t) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(priority < 0 || priority > 99) {
+        return PLCTAG_ERR_OUT_OF_BOUNDS;
+    }
+
+    if(priority >= 66) {
+        win_priority = THREAD_PRIORITY_TIME_CRITICAL;
+    } else if(priority >= 33) {
+        win_priority = THREAD_PRIORITY_HIGHEST;
+    } else if(priority > 0) {
+        win_priority = THREAD_PRIORITY_ABOVE_NORMAL;
+    }
+
+    if(!SetThreadPriority(t->h_thread, win_priority)) {
+        pdebug(DEBUG_WARN, "Unable to set thread priority to %d, error %d!", priority, (int)GetLastError());
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
 /*
  * thread_destroy
  *
@@ -947,6 +1388,8 @@ extern int thread_destroy(thread_p *t)
 
 #define ATOMIC_UNLOCK_VAL ((LONG)(0))
 #define ATOMIC_LOCK_VAL ((LONG)(1))
+#define LOCK_SPIN_LIMIT (100)
+#define LOCK_MAX_BACKOFF (64)
 
 extern int lock_acquire_try(lock_t *lock)
 {
@@ -960,9 +1403,34 @@ extern int lock_acquire_try(lock_t *lock)
 }
 
 
+/*
+ * Only try the exchange when the lock looks free so that waiters spin on
+ * their cached copy instead of bouncing the cache line between cores.  The
+ * pause between looks doubles each time.  If the holder is not done
+ * quickly it was probably preempted, so give up the CPU.
+ */
 extern int lock_acquire(lock_t *lock)
 {
-    while(!lock_acquire_try(lock)) ;
+    int backoff = 1;
+    int spins = 0;
+
+    while(!lock_acquire_try(lock)) {
+        while(*lock == ATOMIC_LOCK_VAL) {
+            if(spins < LOCK_SPIN_LIMIT) {
+                for(int i=0; i < backoff; i++) {
+                    YieldProcessor();
+                }
+
+                if(backoff < LOCK_MAX_BACKOFF) {
+                    backoff *= 2;
+                }
+
+                spins++;
+            } else {
+                SwitchToThread();
+            }
+        }
+    }
 
     return 1;
 }
@@ -975,13 +1443,26 @@ extern void lock_release(lock_t *lock)
 
 
 
+/*
+ * mem_barrier
+ *
+ * Full memory barrier.  No loads or stores move across it.
+ */
 
+extern void mem_barrier(void)
+{
+    MemoryBarrier();
+}
 
 
 
 
 
-/***************************************************************************
+
+
+
+
+/***************************************************************************
  ******************************** Sockets **********************************
  **************************************************************************/
 
@@ -990,6 +1471,16 @@ struct sock_t {
     SOCKET fd;
     int port;
     int is_open;
+
+    /*
+     * readiness waits use WSAEventSelect().  Network events that were
+     * reported but not asked for are kept until a later wait.
+     */
+    WSAEVENT net_event;
+    HANDLE wake_event;
+    int events_pending;
+
+    socket_options_t opts;
 };
 
 
@@ -1030,6 +1521,15 @@ extern int socket_create(sock_p *s)
         return PLCTAG_ERR_NO_MEM;
     }
 
+    (*s)->net_event = WSA_INVALID_EVENT;
+
+    socket_options_init(&((*s)->opts));
+
+    (*s)->wake_event = CreateEvent(NULL, FALSE, FALSE, NULL);
+    if(!(*s)->wake_event) {
+        pdebug(DEBUG_WARN, "Unable to create socket wake event, falling back to polling.");
+    }
+
     pdebug(DEBUG_DETAIL, "Done.");
 
     return PLCTAG_STATUS_OK;
@@ -1037,28 +1537,198 @@ extern int socket_create(sock_p *s)
 
 
 
-extern int socket_connect_tcp(sock_p s, const char *host, int port)
-{
+/*
+ * Host name resolutions are cached for DNS_CACHE_TTL_MS and shared by all
+ * sockets so that reconnects and many sessions to the same PLC do not
+ * each pay for a lookup.
+ */
+
+#define DNS_CACHE_SIZE (32)
+#define DNS_CACHE_TTL_MS (60000)
+#define DNS_MAX_HOST_NAME (255)
+
+typedef struct {
+    char host[DNS_MAX_HOST_NAME + 1];
     IN_ADDR ips[MAX_IPS];
-    int num_ips = 0;
-    struct sockaddr_in gw_addr;
+    int num_ips;
+    int64_t expire_time;
+} dns_cache_entry_t;
+
+static lock_t dns_cache_lock = LOCK_INIT;
+static dns_cache_entry_t dns_cache[DNS_CACHE_SIZE];
+
+
+static int socket_resolve_host(const char *host, IN_ADDR *ips, int *num_ips)
+{
+    struct addrinfo hints;
+    struct addrinfo* res_head = NULL;
+    struct addrinfo *res = NULL;
+    int cacheable = (str_length(host) <= DNS_MAX_HOST_NAME);
+    int found = 0;
+    int rc = 0;
+
+    /* try a numeric IP address conversion first. */
+    if(inet_pton(AF_INET,host,(struct in_addr *)ips) > 0) {
+        pdebug(DEBUG_DETAIL, "Found numeric IP address: %s", host);
+        *num_ips = 1;
+        return PLCTAG_STATUS_OK;
+    }
+
+    if(cacheable) {
+        int64_t now = time_ms();
+
+        spin_block(&dns_cache_lock) {
+            for(int i=0; i < DNS_CACHE_SIZE; i++) {
+                if(dns_cache[i].num_ips > 0 && dns_cache[i].expire_time > now && !str_cmp_i(dns_cache[i].host, host)) {
+                    mem_copy(ips, dns_cache[i].ips, (int)(sizeof(IN_ADDR) * (size_t)dns_cache[i].num_ips));
+                    *num_ips = dns_cache[i].num_ips;
+                    found = 1;
+                    break;
+                }
+            }
+        }
+
+        if(found) {
+            pdebug(DEBUG_DETAIL, "Found %d cached IP addresses for %s.", *num_ips, host);
+            return PLCTAG_STATUS_OK;
+        }
+    }
+
+    mem_set(&hints, 0, sizeof(hints));
+
+    hints.ai_socktype = SOCK_STREAM; /* TCP */
+    hints.ai_family = AF_INET; /* IP V4 only */
+
+    if ((rc = getaddrinfo(host, NULL, &hints, &res_head)) != 0) {
+        pdebug(DEBUG_WARN, "Error looking up PLC IP address %s, error = %d\n", host, rc);
+
+        if (res_head) {
+            freeaddrinfo(res_head);
+        }
+
+        return PLCTAG_ERR_BAD_GATEWAY;
+    }
+
+    res = res_head;
+    for (*num_ips = 0; res && *num_ips < MAX_IPS; (*num_ips)++) {
+        ips[*num_ips].s_addr = ((struct sockaddr_in *)(res->ai_addr))->sin_addr.s_addr;
+        res = res->ai_next;
+    }
+
+    freeaddrinfo(res_head);
+
+    if(cacheable && *num_ips > 0) {
+        spin_block(&dns_cache_lock) {
+            int slot = 0;
+
+            /* replace the same host or else the entry that expires first. */
+            for(int i=0; i < DNS_CACHE_SIZE; i++) {
+                if(!str_cmp_i(dns_cache[i].host, host)) {
+                    slot = i;
+                    break;
+                }
+
+                if(dns_cache[i].expire_time < dns_cache[slot].expire_time) {
+                    slot = i;
+                }
+            }
+
+            str_copy(dns_cache[slot].host, (int)sizeof(dns_cache[slot].host), host);
+            mem_copy(dns_cache[slot].ips, ips, (int)(sizeof(IN_ADDR) * (size_t)(*num_ips)));
+            dns_cache[slot].num_ips = *num_ips;
+            dns_cache[slot].expire_time = time_ms() + DNS_CACHE_TTL_MS;
+        }
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+void socket_options_init(socket_options_t *opts)
+{
+    mem_set(opts, 0, (int)sizeof(*opts));
+
+    opts->tcp_nodelay = 1;
+    opts->dscp = -1;
+    opts->priority = -1;
+}
+
+
+int socket_set_options(sock_p s, socket_options_t *opts)
+{
+    if(!s || !opts) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    s->opts = *opts;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+/*
+ * Apply the tuning options.  None of these are needed for the socket to
+ * work, so failures are only logged.  Quick ACK, busy polling and socket
+ * priority are Linux only.
+ */
+static void socket_apply_options(SOCKET fd, socket_options_t *opts)
+{
+    int val = 0;
+
+    val = (opts->tcp_nodelay ? 1 : 0);
+    if(setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (char *)&val, sizeof(val))) {
+        pdebug(DEBUG_WARN, "Error setting TCP_NODELAY, error: %d", WSAGetLastError());
+    }
+
+    if(opts->send_buffer_size > 0 && setsockopt(fd, SOL_SOCKET, SO_SNDBUF, (char *)&(opts->send_buffer_size), sizeof(int))) {
+        pdebug(DEBUG_WARN, "Error setting send buffer size, error: %d", WSAGetLastError());
+    }
+
+    if(opts->recv_buffer_size > 0 && setsockopt(fd, SOL_SOCKET, SO_RCVBUF, (char *)&(opts->recv_buffer_size), sizeof(int))) {
+        pdebug(DEBUG_WARN, "Error setting receive buffer size, error: %d", WSAGetLastError());
+    }
+
+    if(opts->keepalive_idle_s > 0) {
+        struct tcp_keepalive keepalive;
+        DWORD bytes_returned = 0;
+
+        /* Windows sets the probe count itself. */
+        keepalive.onoff = 1;
+        keepalive.keepalivetime = (ULONG)opts->keepalive_idle_s * 1000;
+        keepalive.keepaliveinterval = (ULONG)(opts->keepalive_interval_s > 0 ? opts->keepalive_interval_s : 1) * 1000;
+
+        if(WSAIoctl(fd, SIO_KEEPALIVE_VALS, &keepalive, sizeof(keepalive), NULL, 0, &bytes_returned, NULL, NULL)) {
+            pdebug(DEBUG_WARN, "Error setting keepalive, error: %d", WSAGetLastError());
+        }
+    }
+
+    if(opts->dscp >= 0) {
+        val = opts->dscp << 2;
+        if(setsockopt(fd, IPPROTO_IP, IP_TOS, (char *)&val, sizeof(val))) {
+            pdebug(DEBUG_WARN, "Error setting DSCP marking, error: %d", WSAGetLastError());
+        }
+    }
+}
+
+
+
+/* make a non-blocking TCP socket with our usual options. */
+static SOCKET socket_open_fd(socket_options_t *opts)
+{
+    SOCKET fd;
     int sock_opt = 1;
     u_long non_blocking=1;
-    int i = 0;
-    int done = 0;
-    SOCKET fd;
     struct timeval timeout; /* used for timing out connections etc. */
     struct linger so_linger;
 
-    pdebug(DEBUG_DETAIL, "Starting.");
-
     /* Open a socket for communication with the gateway. */
     fd = socket(AF_INET, SOCK_STREAM, 0/*IPPROTO_TCP*/);
 
     /* check for errors */
-    if(fd < 0) {
-        /*pdebug("Socket creation failed, errno: %d",errno);*/
-        return PLCTAG_ERR_OPEN;
+    if(fd == INVALID_SOCKET) {
+        pdebug(DEBUG_WARN, "Socket creation failed, error: %d", WSAGetLastError());
+        return INVALID_SOCKET;
     }
 
     /* set up our socket to allow reuse if we crash suddenly. */
@@ -1067,7 +1737,7 @@ extern int socket_connect_tcp(sock_p s, const char *host, int port)
     if(setsockopt(fd,SOL_SOCKET,SO_REUSEADDR,(char*)&sock_opt,sizeof(sock_opt))) {
         closesocket(fd);
         pdebug(DEBUG_WARN,"Error setting socket reuse option, errno: %d",errno);
-        return PLCTAG_ERR_OPEN;
+        return INVALID_SOCKET;
     }
 
     timeout.tv_sec = 10;
@@ -1076,13 +1746,13 @@ extern int socket_connect_tcp(sock_p s, const char *host, int port)
     if(setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, (char*)&timeout, sizeof(timeout))) {
         closesocket(fd);
         pdebug(DEBUG_WARN,"Error setting socket receive timeout option, errno: %d",errno);
-        return PLCTAG_ERR_OPEN;
+        return INVALID_SOCKET;
     }
 
     if(setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, (char*)&timeout, sizeof(timeout))) {
         closesocket(fd);
         pdebug(DEBUG_WARN,"Error setting socket send timeout option, errno: %d",errno);
-        return PLCTAG_ERR_OPEN;
+        return INVALID_SOCKET;
     }
 
     /* abort the connection on close. */
@@ -1092,101 +1762,256 @@ extern int socket_connect_tcp(sock_p s, const char *host, int port)
     if(setsockopt(fd, SOL_SOCKET, SO_LINGER,(char*)&so_linger,sizeof(so_linger))) {
         closesocket(fd);
         pdebug(DEBUG_ERROR,"Error setting socket close linger option, errno: %d",errno);
-        return PLCTAG_ERR_OPEN;
+        return INVALID_SOCKET;
     }
 
-    /* figure out what address we are connecting to. */
-
-    /* try a numeric IP address conversion first. */
-    if(inet_pton(AF_INET,host,(struct in_addr *)ips) > 0) {
-        pdebug(DEBUG_DETAIL, "Found numeric IP address: %s", host);
-        num_ips = 1;
-    } else {
-        struct addrinfo hints;
-        struct addrinfo* res_head = NULL;
-        struct addrinfo *res = NULL;
-        int rc = 0;
+    /* non-blocking from the start so that connect() cannot hang. */
+    if(ioctlsocket(fd,FIONBIO,&non_blocking)) {
+        pdebug(DEBUG_WARN, "Error setting socket to non-blocking, error: %d", WSAGetLastError());
+        closesocket(fd);
+        return INVALID_SOCKET;
+    }
 
-        mem_set(&ips, 0, sizeof(ips));
-        mem_set(&hints, 0, sizeof(hints));
+    socket_apply_options(fd, opts);
 
-        hints.ai_socktype = SOCK_STREAM; /* TCP */
-        hints.ai_family = AF_INET; /* IP V4 only */
+    return fd;
+}
 
-        if ((rc = getaddrinfo(host, NULL, &hints, &res_head)) != 0) {
-            pdebug(DEBUG_WARN, "Error looking up PLC IP address %s, error = %d\n", host, rc);
 
-            if (res_head) {
-                freeaddrinfo(res_head);
-            }
 
-            closesocket(fd);
-            return PLCTAG_ERR_BAD_GATEWAY;
-        }
+extern int socket_connect_tcp(sock_p s, const char *host, int port, int timeout_ms)
+{
+    IN_ADDR ips[MAX_IPS];
+    SOCKET pending[MAX_IPS];
+    int num_ips = 0;
+    int num_pending = 0;
+    struct sockaddr_in gw_addr;
+    SOCKET fd = INVALID_SOCKET;
+    int rc = PLCTAG_STATUS_OK;
+    int64_t timeout_time = 0;
 
-        res = res_head;
-        for (num_ips = 0; res && num_ips < MAX_IPS; num_ips++) {
-            ips[num_ips].s_addr = ((struct sockaddr_in *)(res->ai_addr))->sin_addr.s_addr;
-            res = res->ai_next;
-        }
+    pdebug(DEBUG_DETAIL, "Starting.");
 
-        freeaddrinfo(res_head);
+    if(timeout_ms <= 0) {
+        timeout_ms = 1;
     }
 
+    timeout_time = time_ms() + timeout_ms;
+
+    /* figure out what address we are connecting to. */
+    mem_set(&ips, 0, sizeof(ips));
+
+    rc = socket_resolve_host(host, ips, &num_ips);
+    if(rc != PLCTAG_STATUS_OK) {
+        return rc;
+    }
 
     /*
-     * now try to connect to the remote gateway.  We may need to
-     * try several of the IPs we have.
+     * start connecting to all the addresses at once and keep the first
+     * one that succeeds.
      */
 
-    i = 0;
-    done = 0;
-
     memset((void *)&gw_addr,0, sizeof(gw_addr));
     gw_addr.sin_family = AF_INET ;
-    gw_addr.sin_port = htons(port);
+    gw_addr.sin_port = htons((u_short)port);
 
-    do {
-        int rc;
-        /* try each IP until we run out or get a connection. */
-        gw_addr.sin_addr.s_addr = ips[i].s_addr;
+    for(int i=0; i < num_ips && fd == INVALID_SOCKET; i++) {
+        SOCKET candidate = socket_open_fd(&(s->opts));
+
+        pending[i] = INVALID_SOCKET;
 
-        /*pdebug(DEBUG_DETAIL,"Attempting to connect to %s",inet_ntoa(*((struct in_addr *)&ips[i])));*/
+        if(candidate == INVALID_SOCKET) {
+            continue;
+        }
 
-        rc = connect(fd,(struct sockaddr *)&gw_addr,sizeof(gw_addr));
+        gw_addr.sin_addr.s_addr = ips[i].s_addr;
 
-        if( rc == 0) {
-            /* Windows MSVC does not like inet_ntoa(), not safe.
-             * pdebug(DEBUG_DETAIL, "Attempt to connect to %s succeeded.",inet_ntoa(*((struct in_addr *)&ips[i])));
-             */
-            done = 1;
+        if(connect(candidate,(struct sockaddr *)&gw_addr,sizeof(gw_addr)) == 0) {
+            fd = candidate;
+        } else if(WSAGetLastError() == WSAEWOULDBLOCK) {
+            pending[i] = candidate;
+            num_pending++;
         } else {
-            /* MSVC does not like inet_ntoa(), not safe.
-             * pdebug(DEBUG_DETAIL, "Attempt to connect to %s failed, errno: %d",inet_ntoa(*((struct in_addr *)&ips[i])),errno);
-             */
-            i++;
+            pdebug(DEBUG_DETAIL, "Attempt to connect to address %d failed, error: %d", i, WSAGetLastError());
+            closesocket(candidate);
+        }
+
+        num_ips = i + 1;
+    }
+
+    while(fd == INVALID_SOCKET && num_pending > 0) {
+        int64_t remaining = timeout_time - time_ms();
+        fd_set write_fds;
+        fd_set error_fds;
+        struct timeval wait_time;
+        int ready = 0;
+
+        if(remaining <= 0) {
+            break;
+        }
+
+        FD_ZERO(&write_fds);
+        FD_ZERO(&error_fds);
+
+        for(int i=0; i < num_ips; i++) {
+            if(pending[i] != INVALID_SOCKET) {
+                FD_SET(pending[i], &write_fds);
+                FD_SET(pending[i], &error_fds);
+            }
+        }
+
+        wait_time.tv_sec = (long)(remaining / 1000);
+        wait_time.tv_usec = (long)((remaining % 1000) * 1000);
+
+        /* the first argument is ignored on Windows. */
+        ready = select(0, NULL, &write_fds, &error_fds, &wait_time);
+        if(ready == SOCKET_ERROR) {
+            pdebug(DEBUG_WARN, "Error waiting for connections, error: %d", WSAGetLastError());
+            break;
+        }
+
+        for(int i=0; i < num_ips; i++) {
+            if(pending[i] == INVALID_SOCKET) {
+                continue;
+            }
+
+            /* a failed connect shows up in the error set. */
+            if(FD_ISSET(pending[i], &error_fds)) {
+                pdebug(DEBUG_DETAIL, "Attempt to connect to address %d failed.", i);
+                closesocket(pending[i]);
+            } else if(FD_ISSET(pending[i], &write_fds) && fd == INVALID_SOCKET) {
+                fd = pending[i];
+            } else if(FD_ISSET(pending[i], &write_fds)) {
+                closesocket(pending[i]);
+            } else {
+                continue;
+            }
+
+            pending[i] = INVALID_SOCKET;
+            num_pending--;
+        }
+    }
+
+    /* close the ones that lost the race. */
+    for(int i=0; i < num_ips; i++) {
+        if(pending[i] != INVALID_SOCKET && pending[i] != fd) {
+            closesocket(pending[i]);
+        }
+    }
+
+    if(fd == INVALID_SOCKET) {
+        if(num_pending > 0) {
+            pdebug(DEBUG_WARN, "Timed out connecting to %s after %dms!", host, timeout_ms);
+            return PLCTAG_ERR_TIMEOUT;
         }
-    } while(!done && i < num_ips);
 
-    if(!done) {
-        closesocket(fd);
         pdebug(DEBUG_WARN,"Unable to connect to any gateway host IP address!");
         return PLCTAG_ERR_OPEN;
     }
 
+    /* save the values */
+    s->fd = fd;
+    s->port = port;
+    s->is_open = 1;
 
-    /* FIXME
-     * connect() is a little easier to handle in blocking mode, for now
-     * we make the socket non-blocking here, after connect().
-     */
+    /* this keeps the socket non-blocking. */
+    s->events_pending = 0;
+    s->net_event = WSACreateEvent();
+    if(s->net_event != WSA_INVALID_EVENT && WSAEventSelect(fd, s->net_event, FD_READ | FD_WRITE | FD_CLOSE) != 0) {
+        pdebug(DEBUG_WARN, "Unable to select socket events, error: %d, falling back to polling.", WSAGetLastError());
+        WSACloseEvent(s->net_event);
+        s->net_event = WSA_INVALID_EVENT;
+    }
 
-    if(ioctlsocket(fd,FIONBIO,&non_blocking)) {
-        /*pdebug("Error getting socket options, errno: %d", errno);*/
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+
+
+
+
+
+
+
+extern int socket_resolve_ipv4(const char *host, uint32_t *addr)
+{
+    IN_ADDR ips[MAX_IPS];
+    int num_ips = 0;
+    int rc = PLCTAG_STATUS_OK;
+
+    if(!host || !addr) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    mem_set(&ips, 0, sizeof(ips));
+
+    rc = socket_resolve_host(host, ips, &num_ips);
+    if(rc != PLCTAG_STATUS_OK) {
+        return rc;
+    }
+
+    if(num_ips < 1) {
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    *addr = (uint32_t)ips[0].s_addr;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+extern int socket_udp_open(sock_p s, int port)
+{
+    struct sockaddr_in local_addr;
+    SOCKET fd;
+    int sock_opt = 1;
+    u_long non_blocking = 1;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    if(!s) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(s->is_open) {
+        pdebug(DEBUG_WARN, "Socket is already open!");
+        return PLCTAG_ERR_BAD_STATUS;
+    }
+
+    fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if(fd == INVALID_SOCKET) {
+        pdebug(DEBUG_WARN, "UDP socket creation failed, error: %d", WSAGetLastError());
+        return PLCTAG_ERR_OPEN;
+    }
+
+    if(setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (char*)&sock_opt, sizeof(sock_opt))) {
+        pdebug(DEBUG_WARN, "Error setting socket reuse option, error: %d", WSAGetLastError());
         closesocket(fd);
         return PLCTAG_ERR_OPEN;
     }
 
-    /* save the values */
+    if(ioctlsocket(fd, FIONBIO, &non_blocking) != NO_ERROR) {
+        pdebug(DEBUG_WARN, "Error setting socket to non-blocking, error: %d", WSAGetLastError());
+        closesocket(fd);
+        return PLCTAG_ERR_OPEN;
+    }
+
+    mem_set(&local_addr, 0, sizeof(local_addr));
+    local_addr.sin_family = AF_INET;
+    local_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    local_addr.sin_port = htons((u_short)port);
+
+    if(bind(fd, (struct sockaddr *)&local_addr, (int)sizeof(local_addr))) {
+        pdebug(DEBUG_WARN, "Unable to bind UDP port %d, error: %d", port, WSAGetLastError());
+        closesocket(fd);
+        return PLCTAG_ERR_OPEN;
+    }
+
+    /* no network event, waits fall back to select(). */
     s->fd = fd;
     s->port = port;
     s->is_open = 1;
@@ -1197,10 +2022,75 @@ extern int socket_connect_tcp(sock_p s, const char *host, int port)
 }
 
 
+extern int socket_udp_recv(sock_p s, uint8_t *buf, int size, uint32_t *from_addr)
+{
+    struct sockaddr_in addr;
+    int addr_len = (int)sizeof(addr);
+    int rc;
+
+    if(!s || !buf) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(!s->is_open) {
+        pdebug(DEBUG_WARN, "Socket is not open!");
+        return PLCTAG_ERR_READ;
+    }
+
+    rc = recvfrom(s->fd, (char *)buf, size, 0, (struct sockaddr *)&addr, &addr_len);
+    if(rc == SOCKET_ERROR) {
+        int err = WSAGetLastError();
+
+        /* ICMP errors from earlier sends show up here, they are not fatal. */
+        if(err == WSAEWOULDBLOCK || err == WSAECONNRESET || err == WSAEMSGSIZE) {
+            return 0;
+        }
+
+        pdebug(DEBUG_WARN, "UDP socket read error, error: %d", err);
+        return PLCTAG_ERR_READ;
+    }
+
+    if(from_addr) {
+        *from_addr = (uint32_t)addr.sin_addr.s_addr;
+    }
+
+    return rc;
+}
+
+
+extern int socket_udp_send(sock_p s, uint8_t *buf, int size, uint32_t to_addr, int to_port)
+{
+    struct sockaddr_in addr;
+    int rc;
 
+    if(!s || !buf) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
 
+    if(!s->is_open) {
+        pdebug(DEBUG_WARN, "Socket is not open!");
+        return PLCTAG_ERR_WRITE;
+    }
 
+    mem_set(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = (ULONG)to_addr;
+    addr.sin_port = htons((u_short)to_port);
 
+    rc = sendto(s->fd, (const char *)buf, size, 0, (struct sockaddr *)&addr, (int)sizeof(addr));
+    if(rc == SOCKET_ERROR) {
+        int err = WSAGetLastError();
+
+        if(err == WSAEWOULDBLOCK) {
+            return 0;
+        }
+
+        pdebug(DEBUG_WARN, "UDP socket write error, error: %d", err);
+        return PLCTAG_ERR_WRITE;
+    }
+
+    return rc;
+}
 
 
 
@@ -1236,75 +2126,308 @@ extern int socket_read(sock_p s, uint8_t *buf, int size)
 }
 
 
-extern int socket_write(sock_p s, uint8_t *buf, int size)
+extern int socket_write(sock_p s, uint8_t *buf, int size)
+{
+    int rc;
+
+    if(!s || !buf) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(!s->is_open) {
+        pdebug(DEBUG_WARN, "Socket is not open!");
+        return PLCTAG_ERR_WRITE;
+    }
+
+    /* The socket is non-blocking. */
+    rc = send(s->fd, (char *)buf, size, MSG_NOSIGNAL);
+
+    if(rc < 0) {
+        int err = WSAGetLastError();
+
+        if(err == WSAEWOULDBLOCK) {
+            return PLCTAG_ERR_NO_DATA;
+        } else {
+            pdebug(DEBUG_WARN,"socket write error rc=%d, errno=%d", rc, err);
+            return PLCTAG_ERR_WRITE;
+        }
+    }
+
+    return rc;
+}
+
+
+extern int socket_writev(sock_p s, socket_buf_t *bufs, int num_bufs)
+{
+    WSABUF wsa_bufs[SOCKET_MAX_WRITEV];
+    DWORD bytes_sent = 0;
+    int rc;
+
+    if(!s || !bufs) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(!s->is_open) {
+        pdebug(DEBUG_WARN, "Socket is not open!");
+        return PLCTAG_ERR_WRITE;
+    }
+
+    /* anything past the limit goes out on the next call. */
+    if(num_bufs > SOCKET_MAX_WRITEV) {
+        num_bufs = SOCKET_MAX_WRITEV;
+    }
+
+    for(int i=0; i < num_bufs; i++) {
+        wsa_bufs[i].buf = (CHAR *)bufs[i].data;
+        wsa_bufs[i].len = (ULONG)bufs[i].size;
+    }
+
+    /* The socket is non-blocking. */
+    rc = WSASend(s->fd, wsa_bufs, (DWORD)num_bufs, &bytes_sent, 0, NULL, NULL);
+
+    if(rc == SOCKET_ERROR) {
+        int err = WSAGetLastError();
+
+        if(err == WSAEWOULDBLOCK) {
+            return PLCTAG_ERR_NO_DATA;
+        } else {
+            pdebug(DEBUG_WARN,"socket write error rc=%d, errno=%d", rc, err);
+            return PLCTAG_ERR_WRITE;
+        }
+    }
+
+    return (int)bytes_sent;
+}
+
+
+
+extern int socket_close(sock_p s)
+{
+    if(!s) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(!s->is_open) {
+        return PLCTAG_STATUS_OK;
+    }
+
+    s->is_open = 0;
+
+    if(s->net_event != WSA_INVALID_EVENT) {
+        WSAEventSelect(s->fd, NULL, 0);
+        WSACloseEvent(s->net_event);
+        s->net_event = WSA_INVALID_EVENT;
+    }
+
+    if(closesocket(s->fd)) {
+        return PLCTAG_ERR_CLOSE;
+    }
+
+    s->fd = 0;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+extern int socket_destroy(sock_p *s)
+{
+    if(!s || !*s)
+        return PLCTAG_ERR_NULL_PTR;
+
+    socket_close(*s);
+
+    if((*s)->wake_event) {
+        CloseHandle((*s)->wake_event);
+    }
+
+    mem_free(*s);
+
+    *s = 0;
+
+    if(WSACleanup() != NO_ERROR)
+        return PLCTAG_ERR_WINSOCK;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * Completion ports do not map onto a readiness wait, so Windows waits on the
+ * socket's own network event and wake event instead of a shared reactor.
+ */
+extern int socket_wait_event(sock_p s, int events, int timeout_ms)
+{
+    WSAEVENT handles[2];
+    DWORD wait_rc;
+    int rc = 0;
+
+    if(!s) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(!s->is_open) {
+        pdebug(DEBUG_WARN, "Socket is not open!");
+        return PLCTAG_ERR_READ;
+    }
+
+    if(!(events & (SOCKET_EVENT_READ | SOCKET_EVENT_WRITE)) || timeout_ms <= 0) {
+        pdebug(DEBUG_WARN, "Called with no events or a non-positive timeout!");
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    if(s->net_event == WSA_INVALID_EVENT || !s->wake_event) {
+        fd_set read_fds, write_fds;
+        struct timeval tv;
+
+        FD_ZERO(&read_fds);
+        FD_ZERO(&write_fds);
+
+        if(events & SOCKET_EVENT_READ) {
+            FD_SET(s->fd, &read_fds);
+        }
+
+        if(events & SOCKET_EVENT_WRITE) {
+            FD_SET(s->fd, &write_fds);
+        }
+
+        tv.tv_sec = timeout_ms / 1000;
+        tv.tv_usec = (timeout_ms % 1000) * 1000;
+
+        rc = select(0, &read_fds, &write_fds, NULL, &tv);
+        if(rc == SOCKET_ERROR) {
+            pdebug(DEBUG_WARN, "Error selecting socket, error: %d", WSAGetLastError());
+            return PLCTAG_ERR_READ;
+        }
+
+        if(rc == 0) {
+            return PLCTAG_ERR_TIMEOUT;
+        }
+
+        return (FD_ISSET(s->fd, &read_fds) ? SOCKET_EVENT_READ : 0) | (FD_ISSET(s->fd, &write_fds) ? SOCKET_EVENT_WRITE : 0);
+    }
+
+    /* FD_WRITE is only reported after a send would have blocked. */
+    if(events & SOCKET_EVENT_WRITE) {
+        fd_set write_fds;
+        struct timeval tv = { 0, 0 };
+
+        FD_ZERO(&write_fds);
+        FD_SET(s->fd, &write_fds);
+
+        if(select(0, NULL, &write_fds, NULL, &tv) > 0) {
+            s->events_pending |= SOCKET_EVENT_WRITE;
+        }
+    }
+
+    if(!(s->events_pending & events)) {
+        handles[0] = s->net_event;
+        handles[1] = s->wake_event;
+
+        wait_rc = WSAWaitForMultipleEvents(2, handles, FALSE, (DWORD)timeout_ms, FALSE);
+
+        if(wait_rc == WSA_WAIT_TIMEOUT) {
+            return PLCTAG_ERR_TIMEOUT;
+        }
+
+        if(wait_rc == WSA_WAIT_EVENT_0) {
+            WSANETWORKEVENTS net_events;
+
+            if(WSAEnumNetworkEvents(s->fd, s->net_event, &net_events) != 0) {
+                pdebug(DEBUG_WARN, "Error getting socket events, error: %d", WSAGetLastError());
+                return PLCTAG_ERR_READ;
+            }
+
+            /* a close shows up as ready so that the next read or write sees it. */
+            if(net_events.lNetworkEvents & FD_CLOSE) {
+                s->events_pending |= SOCKET_EVENT_READ | SOCKET_EVENT_WRITE;
+            }
+
+            if(net_events.lNetworkEvents & FD_READ) {
+                s->events_pending |= SOCKET_EVENT_READ;
+            }
+
+            if(net_events.lNetworkEvents & FD_WRITE) {
+                s->events_pending |= SOCKET_EVENT_WRITE;
+            }
+        } else if(wait_rc != WSA_WAIT_EVENT_0 + 1) {
+            pdebug(DEBUG_WARN, "Error waiting for socket events, error: %d", WSAGetLastError());
+            return PLCTAG_ERR_READ;
+        }
+    }
+
+    rc = s->events_pending & events;
+    s->events_pending &= ~rc;
+
+    return rc;
+}
+
+
+extern int socket_wake(sock_p s)
 {
-    int rc;
-
-    if(!s || !buf) {
+    if(!s) {
         return PLCTAG_ERR_NULL_PTR;
     }
 
-    if(!s->is_open) {
-        pdebug(DEBUG_WARN, "Socket is not open!");
-        return PLCTAG_ERR_WRITE;
+    if(!s->wake_event) {
+        return PLCTAG_ERR_UNSUPPORTED;
     }
 
-    /* The socket is non-blocking. */
-    rc = send(s->fd, (char *)buf, size, MSG_NOSIGNAL);
+    SetEvent(s->wake_event);
 
-    if(rc < 0) {
-        int err = WSAGetLastError();
+    return PLCTAG_STATUS_OK;
+}
 
-        if(err == WSAEWOULDBLOCK) {
-            return PLCTAG_ERR_NO_DATA;
-        } else {
-            pdebug(DEBUG_WARN,"socket write error rc=%d, errno=%d", rc, err);
-            return PLCTAG_ERR_WRITE;
-        }
-    }
 
-    return rc;
-}
+/*
+ * Windows has no shared reactor.  Each socket waits on its own network
+ * event and wake event, so responses are handled as soon as they arrive.
+ * What is left is the system timer.  By default it ticks every 15.6ms, so
+ * short timeouts and tickler deadlines are rounded up to that.  Ask for 1ms
+ * while the library is running.  winmm is loaded at run time so that
+ * applications do not have to link it.
+ */
 
+typedef UINT (WINAPI *time_period_func)(UINT period);
 
+static HMODULE winmm_module = NULL;
+static time_period_func time_end_period = NULL;
 
-extern int socket_close(sock_p s)
+extern int socket_reactor_startup(void)
 {
-    if(!s) {
-        return PLCTAG_ERR_NULL_PTR;
-    }
+    time_period_func time_begin_period = NULL;
 
-    if(!s->is_open) {
+    winmm_module = LoadLibraryA("winmm.dll");
+    if(!winmm_module) {
+        pdebug(DEBUG_INFO, "Unable to load winmm, using the default timer resolution.");
         return PLCTAG_STATUS_OK;
     }
 
-    s->is_open = 0;
+    time_begin_period = (time_period_func)(void *)GetProcAddress(winmm_module, "timeBeginPeriod");
+    time_end_period = (time_period_func)(void *)GetProcAddress(winmm_module, "timeEndPeriod");
 
-    if(closesocket(s->fd)) {
-        return PLCTAG_ERR_CLOSE;
+    if(!time_begin_period || !time_end_period || time_begin_period(1) != 0) {
+        pdebug(DEBUG_INFO, "Unable to set the timer resolution to 1ms.");
+        time_end_period = NULL;
+        FreeLibrary(winmm_module);
+        winmm_module = NULL;
     }
 
-    s->fd = 0;
-
     return PLCTAG_STATUS_OK;
 }
 
 
-extern int socket_destroy(sock_p *s)
+extern void socket_reactor_teardown(void)
 {
-    if(!s || !*s)
-        return PLCTAG_ERR_NULL_PTR;
-
-    socket_close(*s);
-
-    mem_free(*s);
-
-    *s = 0;
-
-    if(WSACleanup() != NO_ERROR)
-        return PLCTAG_ERR_WINSOCK;
+    if(time_end_period) {
+        time_end_period(1);
+        time_end_period = NULL;
+    }
 
-    return PLCTAG_STATUS_OK;
+    if(winmm_module) {
+        FreeLibrary(winmm_module);
+        winmm_module = NULL;
+    }
 }
 
 
@@ -1322,6 +2445,11 @@ struct serial_port_t {
     HANDLE hSerialPort;
     COMMCONFIG oldDCBSerialParams;
     COMMTIMEOUTS oldTimeouts;
+    volatile LONG wake;
+
+    /* line activity for frame gaps. */
+    int64_t last_activity_us;
+    int tx_pending;
 };
 
 
@@ -1342,6 +2470,12 @@ serial_port_p plc_lib_open_serial_port(/*plc_lib lib,*/ const char *path, int ba
      */
 
     switch (baud_rate) {
+    case 115200:
+        BAUD = CBR_115200;
+        break;
+    case 57600:
+        BAUD = CBR_57600;
+        break;
     case 38400:
         BAUD = CBR_38400;
         break;
@@ -1554,7 +2688,11 @@ int plc_lib_serial_port_read(serial_port_p serial_port, uint8_t *data, int size)
     rc = ReadFile(serial_port->hSerialPort,(LPVOID)data,(DWORD)size,&numBytesRead,NULL);
 
     if(rc != TRUE)
-        return -1;
+        return PLCTAG_ERR_READ;
+
+    if(numBytesRead > 0) {
+        serial_port->last_activity_us = time_us();
+    }
 
     return (int)numBytesRead;
 }
@@ -1567,10 +2705,280 @@ int plc_lib_serial_port_write(serial_port_p serial_port, uint8_t *data, int size
 
     rc = WriteFile(serial_port->hSerialPort,(LPVOID)data,(DWORD)size,&numBytesWritten,NULL);
 
+    if(rc != TRUE)
+        return PLCTAG_ERR_WRITE;
+
+    if(numBytesWritten > 0) {
+        serial_port->tx_pending = 1;
+    }
+
     return (int)numBytesWritten;
 }
 
 
+/*
+ * Writes complete synchronously, so the port is always writable.  Poll
+ * the input queue until there is data, a wake up or the timeout.
+ */
+int plc_lib_serial_port_wait_event(serial_port_p serial_port, int events, int timeout_ms)
+{
+    int64_t end_time = time_ms() + timeout_ms;
+
+    if(!serial_port || !serial_port->hSerialPort) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(events & SOCKET_EVENT_WRITE) {
+        return SOCKET_EVENT_WRITE;
+    }
+
+    do {
+        COMSTAT status;
+        DWORD errors = 0;
+
+        if(InterlockedExchange(&serial_port->wake, 0)) {
+            return 0;
+        }
+
+        if(!ClearCommError(serial_port->hSerialPort, &errors, &status)) {
+            return PLCTAG_ERR_READ;
+        }
+
+        if(status.cbInQue > 0) {
+            return SOCKET_EVENT_READ;
+        }
+
+        Sleep(1);
+    } while(time_ms() < end_time);
+
+    return PLCTAG_ERR_TIMEOUT;
+}
+
+
+int plc_lib_serial_port_wake(serial_port_p serial_port)
+{
+    if(!serial_port) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    InterlockedExchange(&serial_port->wake, 1);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/* Sleep() only has millisecond resolution, so gaps are rounded up. */
+int plc_lib_serial_port_wait_gap(serial_port_p serial_port, int gap_us)
+{
+    int64_t remaining = 0;
+
+    if(!serial_port || !serial_port->hSerialPort) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(serial_port->tx_pending) {
+        if(!FlushFileBuffers(serial_port->hSerialPort)) {
+            return PLCTAG_ERR_WRITE;
+        }
+
+        serial_port->tx_pending = 0;
+        serial_port->last_activity_us = time_us();
+    }
+
+    remaining = serial_port->last_activity_us + gap_us - time_us();
+
+    if(remaining > gap_us) {
+        remaining = gap_us;
+    }
+
+    if(remaining > 0) {
+        Sleep((DWORD)((remaining + 999) / 1000));
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+
+
+
+
+
+
+
+
+/***************************************************************************
+ ***************************** Shared Memory *******************************
+ **************************************************************************/
+
+
+struct shm_t {
+    HANDLE mapping;
+    uint8_t *data;
+    int size;
+};
+
+
+static int shm_make_name(const char *name, char *buf, int buf_size)
+{
+    if(!name || str_length(name) < 1 || str_length(name) + 7 > buf_size || strchr(name, '\\')) {
+        pdebug(DEBUG_WARN, "Shared memory name is empty, too long or has a backslash!");
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    snprintf_platform(buf, (size_t)(unsigned int)buf_size, "Local\\%s", name);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+int shm_create(const char *name, int size, shm_p *shm)
+{
+    struct shm_t *res = NULL;
+    char full_name[MAX_PATH];
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(!shm || size <= 0) {
+        pdebug(DEBUG_WARN, "Null pointer or bad size!");
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    *shm = NULL;
+
+    if(shm_make_name(name, full_name, (int)sizeof(full_name)) != PLCTAG_STATUS_OK) {
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    res = (struct shm_t *)mem_alloc((int)sizeof(*res));
+    if(!res) {
+        pdebug(DEBUG_ERROR, "Unable to allocate shared memory struct!");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    /* the mapping goes away with the last process using it, so nothing is left behind. */
+    res->mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, (DWORD)size, full_name);
+    if(!res->mapping) {
+        pdebug(DEBUG_WARN, "Unable to create shared memory %s, error %d!", full_name, (int)GetLastError());
+        mem_free(res);
+        return PLCTAG_ERR_OPEN;
+    }
+
+    if(GetLastError() == ERROR_ALREADY_EXISTS) {
+        pdebug(DEBUG_WARN, "Shared memory %s is already in use!", full_name);
+        CloseHandle(res->mapping);
+        mem_free(res);
+        return PLCTAG_ERR_DUPLICATE;
+    }
+
+    res->data = (uint8_t *)MapViewOfFile(res->mapping, FILE_MAP_WRITE, 0, 0, (SIZE_T)size);
+    if(!res->data) {
+        pdebug(DEBUG_WARN, "Unable to map shared memory %s, error %d!", full_name, (int)GetLastError());
+        CloseHandle(res->mapping);
+        mem_free(res);
+        return PLCTAG_ERR_NO_RESOURCES;
+    }
+
+    res->size = size;
+
+    *shm = res;
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+int shm_attach(const char *name, shm_p *shm)
+{
+    struct shm_t *res = NULL;
+    char full_name[MAX_PATH];
+    MEMORY_BASIC_INFORMATION info;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(!shm) {
+        pdebug(DEBUG_WARN, "Null pointer!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    *shm = NULL;
+
+    if(shm_make_name(name, full_name, (int)sizeof(full_name)) != PLCTAG_STATUS_OK) {
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    res = (struct shm_t *)mem_alloc((int)sizeof(*res));
+    if(!res) {
+        pdebug(DEBUG_ERROR, "Unable to allocate shared memory struct!");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    res->mapping = OpenFileMappingA(FILE_MAP_READ, FALSE, full_name);
+    if(!res->mapping) {
+        pdebug(DEBUG_DETAIL, "Shared memory %s does not exist, error %d.", full_name, (int)GetLastError());
+        mem_free(res);
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    res->data = (uint8_t *)MapViewOfFile(res->mapping, FILE_MAP_READ, 0, 0, 0);
+    if(!res->data || !VirtualQuery(res->data, &info, sizeof(info))) {
+        pdebug(DEBUG_WARN, "Unable to map shared memory %s, error %d!", full_name, (int)GetLastError());
+
+        if(res->data) {
+            UnmapViewOfFile(res->data);
+        }
+
+        CloseHandle(res->mapping);
+        mem_free(res);
+        return PLCTAG_ERR_NO_RESOURCES;
+    }
+
+    /* this is rounded up to whole pages, the region header has the real size. */
+    res->size = (info.RegionSize > (SIZE_T)0x7FFFFFFF ? 0x7FFFFFFF : (int)info.RegionSize);
+
+    *shm = res;
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+uint8_t *shm_data(shm_p shm)
+{
+    return (shm ? shm->data : NULL);
+}
+
+
+int shm_size(shm_p shm)
+{
+    return (shm ? shm->size : 0);
+}
+
+
+int shm_destroy(shm_p *shm)
+{
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(!shm || !*shm) {
+        pdebug(DEBUG_WARN, "Null pointer!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    UnmapViewOfFile((*shm)->data);
+    CloseHandle((*shm)->mapping);
+
+    mem_free(*shm);
+    *shm = NULL;
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
 
 
 
@@ -1589,22 +2997,111 @@ int plc_lib_serial_port_write(serial_port_p serial_port, uint8_t *data, int size
 
 
 
+/*
+ * sleep_ms
+ *
+ * Sleep() is rounded up to the system timer tick.  Windows 10 1803 and
+ * later have high resolution waitable timers that are not, use one if
+ * possible.
+ */
+
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+    #define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION (0x00000002)
+#endif
+
 int sleep_ms(int ms)
 {
-    Sleep(ms);
+    HANDLE timer = NULL;
+
+    if(ms > 0) {
+        timer = CreateWaitableTimerExW(NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+    }
+
+    if(timer) {
+        LARGE_INTEGER due_time;
+
+        /* negative is relative, in 100ns units. */
+        due_time.QuadPart = -((LONGLONG)ms * 10000);
+
+        if(SetWaitableTimer(timer, &due_time, 0, NULL, NULL, FALSE)) {
+            WaitForSingleObject(timer, INFINITE);
+            CloseHandle(timer);
+            return 1;
+        }
+
+        CloseHandle(timer);
+    }
+
+    Sleep((DWORD)ms);
     return 1;
 }
 
 
 
+/*
+ * time_ns
+ *
+ * Return the monotonic performance counter in nanoseconds.  The
+ * baseline is arbitrary, only differences mean anything.  The counter
+ * does not jump when the system time is set.
+ */
+
+int64_t time_ns(void)
+{
+    static volatile LONGLONG frequency = 0;
+    LARGE_INTEGER counter;
+    LONGLONG freq = frequency;
+
+    /* the frequency is fixed at boot, it is fine if several threads race to fill it in. */
+    if(!freq) {
+        LARGE_INTEGER f;
+
+        QueryPerformanceFrequency(&f);
+        freq = f.QuadPart;
+        frequency = freq;
+    }
+
+    QueryPerformanceCounter(&counter);
+
+    /* split the conversion so that the multiply does not overflow. */
+    return (int64_t)(((counter.QuadPart / freq) * 1000000000) + (((counter.QuadPart % freq) * 1000000000) / freq));
+}
+
+
 /*
  * time_ms
  *
- * Return current system time in millisecond units.  This is NOT an
- * Unix epoch time.  Windows uses a different epoch starting 1/1/1601.
+ * Return the monotonic clock in millisecond units.  Use this for
+ * timeouts and scheduling.
  */
 
 int64_t time_ms(void)
+{
+    return time_ns() / 1000000;
+}
+
+
+/*
+ * time_us
+ *
+ * Return the monotonic clock in microsecond units on the same baseline
+ * as time_ms().
+ */
+
+int64_t time_us(void)
+{
+    return time_ns() / 1000;
+}
+
+
+/*
+ * time_epoch_ms
+ *
+ * Return current wall clock time in milliseconds since the Unix epoch.
+ * Only for showing to people, it can go backwards.
+ */
+
+int64_t time_epoch_ms(void)
 {
     FILETIME ft;
     int64_t res;
@@ -138,6 +138,10 @@ typedef SSIZE_T ssize_t;
 
 
 /* memory functions/defs */
+typedef void *(*mem_alloc_func)(size_t size);
+typedef void *(*mem_realloc_func)(void *mem, size_t size);
+typedef void (*mem_free_func)(void *mem);
+extern int mem_set_allocator(mem_alloc_func alloc_func, mem_realloc_func realloc_func, mem_free_func free_func);
 extern void *mem_alloc(int size);
 extern void *mem_realloc(void *orig, int size);
 extern void mem_free(const void *mem);
@@ -162,6 +166,8 @@ extern char *str_concat_impl(int num_args, ...);
 /* mutex functions/defs */
 typedef struct mutex_t *mutex_p;
 extern int mutex_create(mutex_p *m);
+/* a recursive mutex on cache lines of its own, for lock pools. */
+extern int mutex_create_pooled(mutex_p *m);
 // extern int mutex_lock(mutex_p m);
 // extern int mutex_try_lock(mutex_p m);
 // extern int mutex_unlock(mutex_p m);
@@ -177,7 +183,7 @@ extern int mutex_unlock_impl(const char *func, int line_num, mutex_p m);
 #endif
 
 #define mutex_lock(m) mutex_lock_impl(__func__, __LINE__, m)
-#define mutex_try_lock(m) mutex_lock_impl(__func__, __LINE__, m)
+#define mutex_try_lock(m) mutex_try_lock_impl(__func__, __LINE__, m)
 #define mutex_unlock(m) mutex_unlock_impl(__func__, __LINE__, m)
 
 /* macros are evil */
@@ -207,6 +213,25 @@ extern int mutex_unlock_impl(const char *func, int line_num, mutex_p m);
 #define critical_block(lock) \
 for(int LINE_ID(__sync_flag_nargle_) = 1; LINE_ID(__sync_flag_nargle_); LINE_ID(__sync_flag_nargle_) = 0, mutex_unlock(lock))  for(int LINE_ID(__sync_rc_nargle_) = mutex_lock(lock); LINE_ID(__sync_rc_nargle_) == PLCTAG_STATUS_OK && LINE_ID(__sync_flag_nargle_) ; LINE_ID(__sync_flag_nargle_) = 0)
 
+/*
+ * condition variable functions/defs
+ *
+ * These are simple signalling conditions.  A signal sets a flag that stays
+ * set until a waiter consumes it.  cond_wait() returns PLCTAG_STATUS_OK when
+ * signalled and PLCTAG_ERR_TIMEOUT if the timeout (in milliseconds) expired
+ * first.
+ */
+typedef struct cond_t *cond_p;
+extern int cond_create(cond_p *c);
+extern int cond_wait_impl(const char *func, int line_num, cond_p c, int timeout);
+extern int cond_signal_impl(const char *func, int line_num, cond_p c);
+extern int cond_clear_impl(const char *func, int line_num, cond_p c);
+extern int cond_destroy(cond_p *c);
+
+#define cond_wait(c, t) cond_wait_impl(__func__, __LINE__, c, t)
+#define cond_signal(c) cond_signal_impl(__func__, __LINE__, c)
+#define cond_clear(c) cond_clear_impl(__func__, __LINE__, c)
+
 /* thread functions/defs */
 typedef struct thread_t *thread_p;
 //typedef PTHREAD_START_ROUTINE thread_func_t;
@@ -218,6 +243,15 @@ extern int thread_join(thread_p t);
 extern int thread_detach();
 extern int thread_destroy(thread_p *t);
 
+/*
+ * thread tuning.  The CPU mask has one bit per CPU.  A priority of zero is
+ * the normal scheduler, 1-99 is a real time priority.  Platforms that
+ * cannot do something return PLCTAG_ERR_UNSUPPORTED.
+ */
+extern int thread_set_name(thread_p t, const char *name);
+extern int thread_set_affinity(thread_p t, uint32_t cpu_mask);
+extern int thread_set_priority(thread_p t, int priority);
+
 #define THREAD_FUNC(func) DWORD __stdcall func(LPVOID arg)
 #define THREAD_RETURN(val) return (DWORD)val;
 
@@ -235,16 +269,80 @@ typedef volatile long int lock_t;
 extern int lock_acquire_try(lock_t *lock);
 extern int lock_acquire(lock_t *lock);
 extern void lock_release(lock_t *lock);
+extern void mem_barrier(void);
 
 /* socket functions */
 typedef struct sock_t *sock_p;
 extern int socket_create(sock_p *s);
-extern int socket_connect_tcp(sock_p s, const char *host, int port);
+/*
+ * socket_connect_tcp() resolves the host, caching the result for a while,
+ * and races connections to all its addresses.  It gives up with
+ * PLCTAG_ERR_TIMEOUT after timeout_ms milliseconds.
+ */
+extern int socket_connect_tcp(sock_p s, const char *host, int port, int timeout_ms);
+
+/*
+ * TCP tuning applied by socket_connect_tcp().  Zero or -1, as noted, leaves
+ * the OS default.  tcp_quickack, busy_poll_us and priority only apply on
+ * Linux.
+ */
+typedef struct {
+    int tcp_nodelay;            /* on by default. */
+    int send_buffer_size;       /* bytes, 0 for the default. */
+    int recv_buffer_size;       /* bytes, 0 for the default. */
+    int keepalive_idle_s;       /* turns on keepalive if > 0. */
+    int keepalive_interval_s;   /* 0 for the default. */
+    int keepalive_count;        /* 0 for the default. */
+    int tcp_quickack;
+    int busy_poll_us;           /* 0 for none. */
+    int dscp;                   /* 0-63, -1 for none. */
+    int priority;               /* 0-6, -1 for none. */
+} socket_options_t;
+
+extern void socket_options_init(socket_options_t *opts);
+extern int socket_set_options(sock_p s, socket_options_t *opts);
 extern int socket_read(sock_p s, uint8_t *buf, int size);
 extern int socket_write(sock_p s, uint8_t *buf, int size);
+
+/*
+ * One piece of a gathered write.  socket_writev() sends the pieces in
+ * order with one system call and returns the number of bytes taken,
+ * which may stop part way through a piece.
+ */
+typedef struct {
+    uint8_t *data;
+    int size;
+} socket_buf_t;
+
+#define SOCKET_MAX_WRITEV (256)
+
+extern int socket_writev(sock_p s, socket_buf_t *bufs, int num_bufs);
+/*
+ * UDP, used for CIP implicit I/O.  Addresses are IPv4 in network byte
+ * order.  socket_udp_open() binds to the port on all interfaces and the
+ * socket is non-blocking.  socket_udp_recv() returns 0 when there is
+ * nothing to read.
+ */
+extern int socket_resolve_ipv4(const char *host, uint32_t *addr);
+extern int socket_udp_open(sock_p s, int port);
+extern int socket_udp_recv(sock_p s, uint8_t *buf, int size, uint32_t *from_addr);
+extern int socket_udp_send(sock_p s, uint8_t *buf, int size, uint32_t to_addr, int to_port);
 extern int socket_close(sock_p s);
 extern int socket_destroy(sock_p *s);
 
+/*
+ * readiness waits.  socket_wait_event() blocks until the socket is ready
+ * for at least one of the requested events, socket_wake() is called or
+ * the timeout (in milliseconds) expires.  It returns the ready events,
+ * zero if woken without any ready events or PLCTAG_ERR_TIMEOUT.
+ */
+#define SOCKET_EVENT_READ (1)
+#define SOCKET_EVENT_WRITE (2)
+extern int socket_wait_event(sock_p s, int events, int timeout_ms);
+extern int socket_wake(sock_p s);
+extern int socket_reactor_startup(void);
+extern void socket_reactor_teardown(void);
+
 /* serial handling */
 typedef struct serial_port_t *serial_port_p;
 #define PLC_SERIAL_PORT_NULL ((plc_serial_port)NULL)
@@ -253,10 +351,43 @@ extern int plc_lib_close_serial_port(serial_port_p serial_port);
 extern int plc_lib_serial_port_read(serial_port_p serial_port, uint8_t *data, int size);
 extern int plc_lib_serial_port_write(serial_port_p serial_port, uint8_t *data, int size);
 
+/*
+ * serial reads and writes do not block, they return zero if the port is
+ * not ready.  plc_lib_serial_port_wait_event() takes the SOCKET_EVENT_*
+ * flags and returns like socket_wait_event().
+ */
+extern int plc_lib_serial_port_wait_event(serial_port_p serial_port, int events, int timeout_ms);
+extern int plc_lib_serial_port_wake(serial_port_p serial_port);
+
+/*
+ * wait until everything written is out of the port and the line has been
+ * quiet, in either direction, for at least gap_us.  Protocols that frame
+ * on silence, like Modbus RTU, call this before starting each frame.
+ */
+extern int plc_lib_serial_port_wait_gap(serial_port_p serial_port, int gap_us);
+
+
+/*
+ * named shared memory.  shm_create() makes a new read/write region.  On
+ * POSIX systems it replaces one of the same name, such as one left behind
+ * by a process that died.  shm_attach() maps an existing
+ * region read only.  The creator removes the name when it destroys the
+ * region, processes that have it mapped keep their mapping.
+ */
+typedef struct shm_t *shm_p;
+extern int shm_create(const char *name, int size, shm_p *shm);
+extern int shm_attach(const char *name, shm_p *shm);
+extern uint8_t *shm_data(shm_p shm);
+extern int shm_size(shm_p shm);
+extern int shm_destroy(shm_p *shm);
+
 
 /* time functions */
 extern int sleep_ms(int ms);
 extern int64_t time_ms(void);
+extern int64_t time_us(void);
+extern int64_t time_ns(void);
+extern int64_t time_epoch_ms(void);
 extern struct tm *localtime_r(const time_t *timep, struct tm *result);
 
 /* some functions can be simply replaced */
@@ -43,5 +43,9 @@ void ab_teardown(void);
 int ab_init();
 plc_tag_p ab_tag_create(attr attribs);
 
+/* keep the sessions from sending requests while a batch is queued. */
+void ab_hold_requests(void);
+void ab_release_requests(void);
+
 
 #endif
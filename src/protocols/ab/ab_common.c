@@ -43,13 +43,18 @@
 #include <ab/cip.h>
 #include <ab/defs.h>
 #include <ab/eip_cip.h>
+#include <ab/eip_cip_io.h>
+#include <ab/eip_cip_udt.h>
 #include <ab/eip_lgx_pccc.h>
 #include <ab/eip_plc5_pccc.h>
 #include <ab/eip_plc5_dhp.h>
 #include <ab/eip_slc_pccc.h>
 #include <ab/eip_slc_dhp.h>
+#include <ab/meta_cache.h>
 #include <ab/session.h>
 #include <ab/tag.h>
+#include <shared/shared.h>
+#include <alias/alias.h>
 #include <util/attr.h>
 #include <util/debug.h>
 #include <util/vector.h>
@@ -86,6 +91,9 @@ volatile int ab_protocol_terminating = 0;
 
 /* forward declarations*/
 static int get_tag_data_type(ab_tag_p tag, attr attribs);
+static int skip_first_read(ab_tag_p tag, attr attribs);
+static int alloc_tag_data(ab_tag_p tag, int allow_inline);
+static int open_sessions(ab_tag_p tag, attr attribs);
 
 static void ab_tag_destroy(ab_tag_p tag);
 static int default_abort(plc_tag_p tag);
@@ -105,7 +113,13 @@ struct tag_vtable_t default_vtable = {
 
     /* attribute accessors */
     ab_get_int_attrib,
-    ab_set_int_attrib
+    ab_set_int_attrib,
+
+    /* no structure member lookup */
+    NULL,
+
+    /* no element ranges */
+    NULL
 };
 
 
@@ -127,6 +141,16 @@ int ab_init(void)
         return rc;
     }
 
+    if((rc = eip_cip_io_init()) != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_ERROR, "Unable to initialize implicit I/O!");
+        return rc;
+    }
+
+    if((rc = meta_cache_startup()) != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_ERROR, "Unable to initialize the metadata cache!");
+        return rc;
+    }
+
     pdebug(DEBUG_INFO,"Finished initializing AB protocol library.");
 
     return rc;
@@ -151,10 +175,18 @@ void ab_teardown(void)
         pdebug(DEBUG_INFO, "IO thread already stopped.");
     }
 
+    pdebug(DEBUG_INFO,"Stopping implicit I/O.");
+
+    eip_cip_io_teardown();
+
     pdebug(DEBUG_INFO,"Freeing session information.");
 
     session_teardown();
 
+    pdebug(DEBUG_INFO,"Saving the metadata cache.");
+
+    meta_cache_teardown();
+
     ab_protocol_terminating = 0;
 
     pdebug(DEBUG_INFO,"Done.");
@@ -162,6 +194,25 @@ void ab_teardown(void)
 
 
 
+/*
+ * ab_hold_requests/ab_release_requests
+ *
+ * Used when queuing a batch of operations so that the session threads
+ * see all of the requests at once when packing.
+ */
+void ab_hold_requests(void)
+{
+    session_hold_requests();
+}
+
+
+void ab_release_requests(void)
+{
+    session_release_requests();
+}
+
+
+
 plc_tag_p ab_tag_create(attr attribs)
 {
     ab_tag_p tag = AB_TAG_NULL;
@@ -227,8 +278,14 @@ plc_tag_p ab_tag_create(attr attribs)
 
     case AB_PLC_LGX:
         /* default to requiring a connection and allowing packing. */
-        tag->use_connected_msg = attr_get_int(attribs,"use_connected_msg", 1);
-        tag->allow_packing = attr_get_int(attribs, "allow_packing", 1);
+        if(attr_get_int(attribs, "io_rpi_ms", 0) > 0) {
+            /* implicit I/O only needs unconnected messages to open its own connection. */
+            tag->use_connected_msg = attr_get_int(attribs,"use_connected_msg", 0);
+            tag->allow_packing = 0;
+        } else {
+            tag->use_connected_msg = attr_get_int(attribs,"use_connected_msg", 1);
+            tag->allow_packing = attr_get_int(attribs, "allow_packing", 1);
+        }
         break;
 
     case AB_PLC_MLGX800:
@@ -263,7 +320,7 @@ plc_tag_p ab_tag_create(attr attribs)
      *
      * All tags need sessions.  They are the TCP connection to the gateway PLC.
      */
-    if(session_find_or_create(&tag->session, attribs) != PLCTAG_STATUS_OK) {
+    if(open_sessions(tag, attribs) != PLCTAG_STATUS_OK) {
         pdebug(DEBUG_INFO,"Unable to create session!");
         tag->status = PLCTAG_ERR_BAD_GATEWAY;
         return (plc_tag_p)tag;
@@ -350,11 +407,35 @@ plc_tag_p ab_tag_create(attr attribs)
             tag->byte_order = &logix_tag_listing_byte_order;
         }
 
+        if(attr_get_int(attribs, "io_rpi_ms", 0) > 0) {
+            pdebug(DEBUG_DETAIL, "Using Class 1 implicit I/O.");
+            tag->vtable = &eip_cip_io_vtable;
+            break;
+        }
+
         /* default to requiring a connection. */
         tag->use_connected_msg = attr_get_int(attribs,"use_connected_msg", 1);
         tag->allow_packing = attr_get_int(attribs, "allow_packing", 1);
         tag->vtable = &eip_cip_vtable;
 
+        /* the instance ID is found by listing the controller tags, that needs a connection. */
+        if(!tag->tag_list && attr_get_int(attribs, "use_instance_id", 0)) {
+            if(tag->use_connected_msg) {
+                tag->use_instance_id = 1;
+            } else {
+                pdebug(DEBUG_WARN, "Symbol instance IDs need connected messaging, using the tag name.");
+            }
+        }
+
+        /* the templates are found from the tag listing too. */
+        if(!tag->tag_list && attr_get_int(attribs, "udt_templates", 0)) {
+            if(tag->use_connected_msg) {
+                tag->udt_templates = 1;
+            } else {
+                pdebug(DEBUG_WARN, "UDT templates need connected messaging, members cannot be found by name.");
+            }
+        }
+
         break;
 
     case AB_PLC_MLGX800:
@@ -396,6 +477,33 @@ plc_tag_p ab_tag_create(attr attribs)
     /* pass the connection requirement since it may be overridden above. */
     attr_set_int(attribs, "use_connected_msg", tag->use_connected_msg);
 
+    /* the priority class determines how soon the session sends this tag's requests. */
+    {
+        const char *priority = attr_get_str(attribs, "priority", "normal");
+
+        if(str_cmp_i(priority, "high") == 0) {
+            tag->priority = SESSION_PRIORITY_HIGH;
+        } else if(str_cmp_i(priority, "normal") == 0) {
+            tag->priority = SESSION_PRIORITY_NORMAL;
+        } else if(str_cmp_i(priority, "low") == 0) {
+            tag->priority = SESSION_PRIORITY_LOW;
+        } else {
+            pdebug(DEBUG_WARN, "Unsupported priority \"%s\", must be high, normal or low!", priority);
+            tag->status = PLCTAG_ERR_BAD_PARAM;
+            return (plc_tag_p)tag;
+        }
+    }
+
+    /* reads can be answered from what other handles to the same tag got recently. */
+    tag->shared_read_cache_ms = attr_get_int(attribs, "shared_read_cache_ms", 0);
+    if(tag->shared_read_cache_ms < 0) {
+        pdebug(DEBUG_WARN, "shared_read_cache_ms value must be positive, using zero.");
+        tag->shared_read_cache_ms = 0;
+    }
+
+    /* large reads can request all their fragments up front instead of one at a time. */
+    tag->concurrent_fragments = attr_get_int(attribs, "concurrent_fragments", 0) ? 1 : 0;
+
     /* get the element count, default to 1 if missing. */
     tag->elem_count = attr_get_int(attribs,"elem_count", 1);
 
@@ -411,12 +519,15 @@ plc_tag_p ab_tag_create(attr attribs)
         /* fall through */
     case AB_PLC_LGX:
     case AB_PLC_MLGX800:
-        /* fill this in when we read the tag. */
-        //tag->elem_size = 0;
-        tag->size = 0;
-        tag->data = NULL;
-        break;
+        /* fill this in when we read the tag.  Implicit I/O connections have a fixed size. */
+        if(tag->vtable != &eip_cip_io_vtable) {
+            //tag->elem_size = 0;
+            tag->size = 0;
+            tag->data = NULL;
+            break;
+        }
 
+        /* fall through */
     default:
         /* we still need size on non Logix-class PLCs */
         /* get the element size if it is not already set. */
@@ -434,9 +545,7 @@ plc_tag_p ab_tag_create(attr attribs)
         }
 
         /* this may be changed in the future if this is a tag list request. */
-        tag->data = (uint8_t*)mem_alloc(tag->size);
-
-        if(tag->data == NULL) {
+        if(alloc_tag_data(tag, !attr_get_int(attribs, "double_buffer", 0)) != PLCTAG_STATUS_OK) {
             pdebug(DEBUG_WARN,"Unable to allocate tag data!");
             tag->status = PLCTAG_ERR_NO_MEM;
             return (plc_tag_p)tag;
@@ -444,6 +553,23 @@ plc_tag_p ab_tag_create(attr attribs)
         break;
     }
 
+    /* Logix-class reads may take several packets, so those can land in a back buffer. */
+    if(tag->vtable == &eip_cip_vtable && !tag->tag_list && attr_get_int(attribs, "double_buffer", 0)) {
+        pdebug(DEBUG_DETAIL, "Using double buffered tag data.");
+
+        tag->is_double_buffered = 1;
+
+        if(tag->size > 0) {
+            tag->back_data = (uint8_t*)mem_alloc(tag->size);
+
+            if(tag->back_data == NULL) {
+                pdebug(DEBUG_WARN,"Unable to allocate tag back buffer!");
+                tag->status = PLCTAG_ERR_NO_MEM;
+                return (plc_tag_p)tag;
+            }
+        }
+    }
+
     /*
      * check the tag name, this is protocol specific.
      */
@@ -454,9 +580,66 @@ plc_tag_p ab_tag_create(attr attribs)
         return (plc_tag_p)tag;
     }
 
+    /* failover and hedged reads are only done by Logix class tags. */
+    if(tag->standby_session) {
+        if(tag->vtable != &eip_cip_vtable || tag->tag_list) {
+            pdebug(DEBUG_WARN, "A standby gateway is only supported for Logix class data tags!");
+            tag->status = PLCTAG_ERR_UNSUPPORTED;
+            return (plc_tag_p)tag;
+        }
+
+        /* the instance IDs come from one PLC, do not use them on the other. */
+        tag->use_instance_id = 0;
+
+        tag->hedge_reads = attr_get_int(attribs, "hedge_reads", 0) ? 1 : 0;
+        tag->hedge_delay_ms = attr_get_int(attribs, "hedge_delay_ms", 0);
+
+        if(tag->hedge_delay_ms < 0) {
+            pdebug(DEBUG_WARN, "hedge_delay_ms must not be negative, using the read latency.");
+            tag->hedge_delay_ms = 0;
+        }
+    }
+
+    /* bit tags on the same element read it once between them, within one session. */
+    if(tag->is_bit && tag->vtable == &eip_cip_vtable && !tag->standby_session && attr_get_int(attribs, "share_bit_read", 1)) {
+        tag->bit_word = session_bit_word_get(tag->session, tag->encoded_name, tag->encoded_name_size);
+    }
+
+    if(tag->tag_list) {
+        const char *prefix = attr_get_str(attribs, "list_prefix", NULL);
+
+        tag->list_paged = attr_get_int(attribs, "list_paged", 0) ? 1 : 0;
+        tag->list_index_count = -1;
+        tag->list_programs = attr_get_int(attribs, "list_programs", 1) ? 1 : 0;
+
+        if(prefix && str_length(prefix) > 0) {
+            tag->list_prefix = str_dup(prefix);
+            if(!tag->list_prefix) {
+                pdebug(DEBUG_WARN, "Unable to copy the tag listing name prefix!");
+                tag->status = PLCTAG_ERR_NO_MEM;
+                return (plc_tag_p)tag;
+            }
+        }
+    }
+
+    if(tag->vtable == &eip_cip_io_vtable) {
+        rc = eip_cip_io_tag_setup(tag, attribs);
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Unable to set up implicit I/O, error %s!", plc_tag_decode_error(rc));
+            tag->status = (int8_t)rc;
+            return (plc_tag_p)tag;
+        }
+    }
+
     /* trigger the first read. */
     tag->first_read = 1;
 
+    /* write-only tags do not need it if the type is already known. */
+    if(!attr_get_int(attribs, "initial_read", 1) && skip_first_read(tag, attribs) == PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_INFO, "Done.  Tag is ready without a read.");
+        return (plc_tag_p)tag;
+    }
+
     /* kick off a read to get the tag type and size. */
     if(tag->vtable->read) {
         tag->read_in_flight = 1;
@@ -469,10 +652,162 @@ plc_tag_p ab_tag_create(attr attribs)
 }
 
 
+/*
+ * skip_first_read
+ *
+ * Logix writes carry the CIP type of the data, which normally comes from
+ * the first read.  When the type is already known, set up the tag data
+ * without reading so the first write goes out at once.
+ */
+
+/*
+ * open_sessions
+ *
+ * With gateway=a,b the tag gets a session to each.  Both stay connected so
+ * that failing over does not wait for a connection.  Failover is driven by
+ * the circuit breaker, so it is turned on if it was not set.
+ */
+
+int open_sessions(ab_tag_p tag, attr attribs)
+{
+    const char *gateway = attr_get_str(attribs, "gateway", "");
+    char *primary = NULL;
+    char *standby = NULL;
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    for(int i=0; gateway[i]; i++) {
+        if(gateway[i] == ',') {
+            primary = str_dup(gateway);
+
+            if(!primary) {
+                pdebug(DEBUG_ERROR, "Unable to copy the gateway!");
+                return PLCTAG_ERR_NO_MEM;
+            }
+
+            primary[i] = 0;
+            standby = primary + i + 1;
+            break;
+        }
+    }
+
+    if(!primary) {
+        return session_find_or_create(&tag->session, attribs);
+    }
+
+    do {
+        if(str_length(primary) == 0 || str_length(standby) == 0) {
+            pdebug(DEBUG_WARN, "Two gateways must be given as gateway=<primary>,<standby>!");
+            rc = PLCTAG_ERR_BAD_GATEWAY;
+            break;
+        }
+
+        if(attr_get_int(attribs, "circuit_breaker_failures", 0) == 0) {
+            attr_set_int(attribs, "circuit_breaker_failures", AB_STANDBY_BREAKER_FAILURES);
+        }
+
+        attr_set_str(attribs, "gateway", standby);
+
+        rc = session_find_or_create(&tag->standby_session, attribs);
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Unable to create the standby session!");
+            break;
+        }
+
+        attr_set_str(attribs, "gateway", primary);
+
+        rc = session_find_or_create(&tag->session, attribs);
+    } while(0);
+
+    mem_free(primary);
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return rc;
+}
+
+
+
+int skip_first_read(ab_tag_p tag, attr attribs)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    if(tag->vtable != &eip_cip_vtable || tag->plc_type != AB_PLC_LGX || tag->tag_list) {
+        return PLCTAG_ERR_UNSUPPORTED;
+    }
+
+    rc = eip_cip_udt_known_type(tag, attribs);
+
+    /* tags that do not need templates can use the type from their last first read. */
+    if(rc != PLCTAG_STATUS_OK && !tag->is_bit && !tag->udt_templates) {
+        rc = meta_cache_find_tag_type(tag);
+    }
+
+    if(rc != PLCTAG_STATUS_OK || tag->elem_size <= 0) {
+        pdebug(DEBUG_INFO, "Tag type is not known yet, reading the tag first.");
+        tag->encoded_type_info_size = 0;
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    tag->size = tag->elem_count * tag->elem_size;
+
+    if(alloc_tag_data(tag, !tag->is_double_buffered) != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to allocate tag data!");
+        tag->status = PLCTAG_ERR_NO_MEM;
+        return PLCTAG_STATUS_OK;
+    }
+
+    if(tag->is_double_buffered) {
+        tag->back_data = (uint8_t*)mem_alloc(tag->size);
+        if(!tag->back_data) {
+            pdebug(DEBUG_WARN, "Unable to allocate tag back buffer!");
+            tag->status = PLCTAG_ERR_NO_MEM;
+            return PLCTAG_STATUS_OK;
+        }
+    }
+
+    tag->first_read = 0;
+
+    pdebug(DEBUG_DETAIL, "Tag has %d elements of %d bytes, skipping the first read.", tag->elem_count, tag->elem_size);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
 /*
  * determine the tag's data type and size.  Or at least guess it.
  */
 
+/*
+ * alloc_tag_data
+ *
+ * Small tags use the buffer inside the tag so that the data is next to the
+ * rest of the tag and there is one less allocation.  Double buffered tags
+ * swap their buffers, so they always get their own.
+ */
+
+int alloc_tag_data(ab_tag_p tag, int allow_inline)
+{
+    if(allow_inline && tag->size <= AB_TAG_INLINE_DATA_SIZE) {
+        tag->data = &tag->inline_data[0];
+        tag->data_inline = 1;
+
+        return PLCTAG_STATUS_OK;
+    }
+
+    tag->data = (uint8_t*)mem_alloc(tag->size);
+    if(!tag->data) {
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    tag->data_inline = 0;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
 int get_tag_data_type(ab_tag_p tag, attr attribs)
 {
     const char *elem_type = NULL;
@@ -745,14 +1080,55 @@ int ab_tag_abort(ab_tag_p tag)
         }
 
         tag->req = rc_dec(tag->req);
-    } else {
+    } else if(!tag->frag_reqs) {
         pdebug(DEBUG_DETAIL, "Called without a request in flight.");
     }
 
+    if(tag->frag_reqs) {
+        for(int i=0; i < tag->frag_count; i++) {
+            spin_block(&tag->frag_reqs[i]->lock) {
+                tag->frag_reqs[i]->abort_request = 1;
+            }
+
+            rc_dec(tag->frag_reqs[i]);
+        }
+
+        mem_free(tag->frag_reqs);
+        tag->frag_reqs = NULL;
+        tag->frag_count = 0;
+    }
+
+    if(tag->bit_word && (tag->bit_wait || tag->bit_lead)) {
+        session_bit_word_leave(tag->session, tag->bit_word, tag->tag_id);
+        tag->bit_wait = 0;
+        tag->bit_lead = 0;
+    }
+
+    if(tag->hedge_req) {
+        spin_block(&tag->hedge_req->lock) {
+            tag->hedge_req->abort_request = 1;
+        }
+
+        tag->hedge_req = rc_dec(tag->hedge_req);
+    }
+
+    tag->hedge_at_ms = 0;
+
     tag->read_in_progress = 0;
     tag->write_in_progress = 0;
+    tag->resolving_symbol = 0;
     tag->offset = 0;
 
+    /* an unfinished dirty range write goes out with the next write. */
+    if(tag->dirty_range_write) {
+        plc_tag_generic_add_dirty_range((plc_tag_p)tag, tag->range_start, tag->range_end - tag->range_start);
+        tag->dirty_range_write = 0;
+    }
+
+    tag->range_end = 0;
+
+    eip_cip_udt_abort(tag);
+
     pdebug(DEBUG_DETAIL, "Done.");
 
     return PLCTAG_STATUS_OK;
@@ -816,24 +1192,80 @@ void ab_tag_destroy(ab_tag_p tag)
 
     session = tag->session;
 
+    /* close any implicit I/O connection while we still have the session. */
+    eip_cip_io_tag_close(tag);
+
+    eip_cip_udt_tag_close(tag);
+
+    if(tag->bit_word) {
+        if(tag->bit_wait || tag->bit_lead) {
+            session_bit_word_leave(session, tag->bit_word, tag->tag_id);
+        }
+
+        session_bit_word_release(session, tag->bit_word);
+        tag->bit_word = NULL;
+    }
+
+    if(tag->standby_session) {
+        atomic_add(&(tag->standby_session->num_tags), -1);
+        tag->standby_session = rc_dec(tag->standby_session);
+    }
+
     /* tags should always have a session.  Release it. */
     pdebug(DEBUG_DETAIL,"Getting ready to release tag session %p",tag->session);
     if(session) {
         pdebug(DEBUG_DETAIL, "Removing tag from session.");
+        atomic_add(&(session->num_tags), -1);
         rc_dec(session);
         tag->session = NULL;
     } else {
         pdebug(DEBUG_WARN,"No session pointer!");
     }
 
-    if(tag->ext_mutex) {
-        mutex_destroy(&(tag->ext_mutex));
-        tag->ext_mutex = NULL;
+    plc_tag_generic_release_locks((plc_tag_p)tag);
+
+    if(tag->tag_cond_wait) {
+        cond_destroy(&(tag->tag_cond_wait));
+        tag->tag_cond_wait = NULL;
     }
 
-    if(tag->api_mutex) {
-        mutex_destroy(&(tag->api_mutex));
-        tag->api_mutex = NULL;
+    if(tag->change_detect) {
+        mem_free(tag->change_detect);
+        tag->change_detect = NULL;
+    }
+
+    if(tag->dirty_ranges) {
+        mem_free(tag->dirty_ranges);
+        tag->dirty_ranges = NULL;
+    }
+
+    if(tag->history) {
+        mem_free(tag->history);
+        tag->history = NULL;
+    }
+
+    if(tag->stats) {
+        mem_free(tag->stats);
+        tag->stats = NULL;
+    }
+
+    /* stop publishing before the data goes away. */
+    shared_publish_release((plc_tag_p)tag);
+    alias_parent_release((plc_tag_p)tag);
+
+    if(tag->symbolic_name) {
+        mem_free(tag->symbolic_name);
+        tag->symbolic_name = NULL;
+    }
+
+    if(tag->list_prefix) {
+        mem_free(tag->list_prefix);
+        tag->list_prefix = NULL;
+    }
+
+    if(tag->list_index) {
+        mem_free(tag->list_index);
+        tag->list_index = NULL;
     }
 
     if(tag->byte_order && tag->byte_order->is_allocated) {
@@ -841,11 +1273,24 @@ void ab_tag_destroy(ab_tag_p tag)
         tag->byte_order = NULL;
     }
 
+    /* the application owns any bound buffer. */
+    plc_tag_generic_unbind_buffer((plc_tag_p)tag);
+
     if (tag->data) {
-        mem_free(tag->data);
+        if(!tag->data_inline) {
+            mem_free(tag->data);
+        }
+
         tag->data = NULL;
     }
 
+    plc_tag_generic_free_retired_data((plc_tag_p)tag);
+
+    if(tag->back_data) {
+        mem_free(tag->back_data);
+        tag->back_data = NULL;
+    }
+
     pdebug(DEBUG_INFO,"Finished releasing all tag resources.");
 
     pdebug(DEBUG_INFO, "done");
@@ -867,6 +1312,17 @@ int ab_get_int_attrib(plc_tag_p raw_tag, const char *attrib_name, int default_va
         res = tag->elem_size;
     } else if(str_cmp_i(attrib_name, "elem_count") == 0) {
         res = tag->elem_count;
+    } else if(tag->tag_list && str_cmp_i(attrib_name, "list_complete") == 0) {
+        res = tag->list_complete;
+    } else if(tag->tag_list && tag_list_get_attrib(tag, attrib_name, &res)) {
+        /* tag_list_get_attrib() sets the status. */
+        if(tag->status != PLCTAG_STATUS_OK) {
+            res = default_value;
+        }
+    } else if(str_cmp_i(attrib_name, "circuit_breaker_open") == 0) {
+        res = (tag->session && SESSION_BREAKER_IS_OPEN(tag->session->breaker_state)) ? 1 : 0;
+    } else if(str_cmp_i(attrib_name, "failovers") == 0) {
+        res = tag->failovers;
     } else {
         pdebug(DEBUG_WARN, "Unsupported attribute name \"%s\"!", attrib_name);
         tag->status = PLCTAG_ERR_UNSUPPORTED;
@@ -876,6 +1332,36 @@ int ab_get_int_attrib(plc_tag_p raw_tag, const char *attrib_name, int default_va
 }
 
 
+/*
+ * ab_tag_check_breaker
+ *
+ * Raise the circuit breaker event on the tag if the session breaker
+ * changed since the tag last looked.  Called from the ticklers.
+ */
+
+void ab_tag_check_breaker(ab_tag_p tag)
+{
+    uint32_t state = 0;
+
+    if(!tag->session) {
+        return;
+    }
+
+    state = tag->session->breaker_state;
+
+    if(state != tag->breaker_seen) {
+        tag->breaker_seen = state;
+        tag->breaker_event = 1;
+
+        if(SESSION_BREAKER_IS_OPEN(state)) {
+            tag->breaker_open = 1;
+        } else {
+            tag->breaker_open = 0;
+        }
+    }
+}
+
+
 int ab_set_int_attrib(plc_tag_p raw_tag, const char *attrib_name, int new_value)
 {
     (void)attrib_name;
@@ -960,6 +1446,11 @@ int check_tag_name(ab_tag_p tag, const char* name)
             return rc;
         }
 
+        /* keep the parts of the address, reads of nearby elements can be combined. */
+        if ((rc = pccc_parse_address(name, &(tag->file_type), &(tag->file_num), &(tag->file_elem), &(tag->file_subelem))) != PLCTAG_STATUS_OK) {
+            return rc;
+        }
+
         break;
 
     case AB_PLC_SLC:
@@ -970,6 +1461,11 @@ int check_tag_name(ab_tag_p tag, const char* name)
             return rc;
         }
 
+        /* keep the parts of the address, reads of nearby elements can be combined. */
+        if ((rc = pccc_parse_address(name, &(tag->file_type), &(tag->file_num), &(tag->file_elem), &(tag->file_subelem))) != PLCTAG_STATUS_OK) {
+            return rc;
+        }
+
         break;
 
     case AB_PLC_MLGX800:
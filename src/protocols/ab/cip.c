@@ -49,6 +49,7 @@ static int skip_whitespace(const char *name, int *name_index);
 static int parse_bit_segment(ab_tag_p tag, const char *name, int *name_index);
 static int parse_symbolic_segment(ab_tag_p tag, const char *name, int *encoded_index, int *name_index);
 static int parse_numeric_segment(ab_tag_p tag, const char *name, int *encoded_index, int *name_index);
+static int name_prefix_length(const char *name, int name_len);
 
 static int match_numeric_segment(const char *path, size_t *path_index, uint8_t *conn_path, size_t *conn_path_index);
 static int match_ip_addr_segment(const char *path, size_t *path_index, uint8_t *conn_path, size_t *conn_path_index);
@@ -785,18 +786,34 @@ int cip_encode_tag_name(ab_tag_p tag, const char *name)
     int encoded_index = 0;
     int name_index = 0;
     int name_len = str_length(name);
+    int prefix_len = name_prefix_length(name, name_len);
+    int prefix_size = 0;
 
     /* zero out the CIP encoded name size. Byte zero in the encoded name. */
     tag->encoded_name[encoded_index] = 0;
     encoded_index++;
 
-    /* names must start with a symbolic segment. */
-    if(parse_symbolic_segment(tag, name, &encoded_index, &name_index) != PLCTAG_STATUS_OK) {
+    /* tags with the same program or structure prefix reuse its encoding. */
+    if(prefix_len > 0) {
+        prefix_size = session_find_name_prefix(tag->session, name, prefix_len, &tag->encoded_name[encoded_index], MAX_TAG_NAME - encoded_index);
+    }
+
+    if(prefix_size > 0) {
+        pdebug(DEBUG_DETAIL, "Using the encoding of prefix \"%.*s\".", prefix_len, name);
+        encoded_index += prefix_size;
+        name_index = prefix_len;
+    } else if(parse_symbolic_segment(tag, name, &encoded_index, &name_index) != PLCTAG_STATUS_OK) {
+        /* names must start with a symbolic segment. */
         pdebug(DEBUG_WARN,"Unable to parse initial symbolic segment in tag name %s!", name);
         return PLCTAG_ERR_BAD_PARAM;
     }
 
     while(name_index < name_len && encoded_index < MAX_TAG_NAME) {
+        if(name_index == prefix_len && prefix_size == 0) {
+            prefix_size = encoded_index - 1;
+            session_add_name_prefix(tag->session, name, prefix_len, &tag->encoded_name[1], prefix_size);
+        }
+
         /* try to parse the different parts of the name. */
         if(name[name_index] == '.') {
             name_index++;
@@ -851,6 +868,19 @@ int cip_encode_tag_name(ab_tag_p tag, const char *name)
     return PLCTAG_STATUS_OK;
 }
 
+/* the prefix is everything before the last member or index, zero if there is none. */
+int name_prefix_length(const char *name, int name_len)
+{
+    for(int i = name_len - 1; i > 0; i--) {
+        if(name[i] == '.' || name[i] == '[') {
+            return i;
+        }
+    }
+
+    return 0;
+}
+
+
 int skip_whitespace(const char *name, int *name_index)
 {
     while(name[*name_index] == ' ') {
@@ -62,6 +62,7 @@
 #define AB_EIP_DEFAULT_TIMEOUT 2000 /* in ms */
 
 /* AB Commands */
+#define AB_EIP_NOP                  ((uint16_t)0x0000)
 #define AB_EIP_REGISTER_SESSION     ((uint16_t)0x0065)
 #define AB_EIP_UNREGISTER_SESSION   ((uint16_t)0x0066)
 #define AB_EIP_UNCONNECTED_SEND     ((uint16_t)0x006F)
@@ -78,6 +79,8 @@
 #define AB_EIP_CMD_FORWARD_OPEN_EX      ((uint8_t)0x5B)
 
 /* CIP embedded packet commands */
+#define AB_EIP_CMD_CIP_GET_ATTR_LIST    ((uint8_t)0x03)
+#define AB_EIP_CMD_CIP_GET_ATTR_SINGLE  ((uint8_t)0x0E)
 #define AB_EIP_CMD_CIP_MULTI            ((uint8_t)0x0A)
 #define AB_EIP_CMD_CIP_READ             ((uint8_t)0x4C)
 #define AB_EIP_CMD_CIP_WRITE            ((uint8_t)0x4D)
@@ -92,6 +95,8 @@
 #define AB_CIP_STATUS_OK                ((uint8_t)0x00)
 #define AB_CIP_STATUS_FRAG              ((uint8_t)0x06)
 
+#define AB_CIP_ERR_PATH_SEGMENT         ((uint8_t)0x04)
+#define AB_CIP_ERR_PATH_DEST_UNKNOWN    ((uint8_t)0x05)
 #define AB_CIP_ERR_UNSUPPORTED_SERVICE  ((uint8_t)0x08)
 #define AB_CIP_ERR_PARTIAL_ERROR  ((uint8_t)0x1e)
 
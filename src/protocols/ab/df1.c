@@ -0,0 +1,1834 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <string.h>
+#include <platform.h>
+#include <lib/libplctag.h>
+#include <ab/ab_common.h>
+#include <ab/defs.h>
+#include <ab/df1.h>
+#include <ab/eip_plc5_pccc.h>
+#include <ab/eip_slc_pccc.h>
+#include <ab/pccc.h>
+#include <shared/shared.h>
+#include <alias/alias.h>
+#include <util/attr.h>
+#include <util/debug.h>
+#include <util/metrics.h>
+#include <util/rc.h>
+
+/*
+ * DF1 full-duplex carries PCCC commands over a serial link.  Each
+ * message is framed with DLE STX ... DLE ETX and a CRC or BCC, and any
+ * DLE in the message is doubled.  The receiver answers every frame
+ * with DLE ACK or DLE NAK as soon as the checksum has been checked, and
+ * those link responses are allowed in the middle of an outgoing frame.
+ *
+ * Only one frame waits for a link ACK at a time.  The PCCC replies come
+ * back as separate messages and are matched to the tags by transaction
+ * number, so the next command goes out as soon as the previous one is
+ * ACKed rather than when it is answered.
+ */
+
+#define DF1_DLE (0x10)
+#define DF1_STX (0x02)
+#define DF1_ETX (0x03)
+#define DF1_ACK (0x06)
+#define DF1_NAK (0x15)
+#define DF1_ENQ (0x05)
+
+#define DF1_HEADER_SIZE (6)     /* DST SRC CMD STS TNS(2) */
+#define DF1_MAX_MESSAGE (272)
+#define DF1_MAX_FRAME ((DF1_MAX_MESSAGE * 2) + 6)
+#define DF1_MAX_CONTROL (16)
+#define DF1_RX_CHUNK_SIZE (512)
+#define DF1_MAX_ENCODED_NAME (64)
+#define DF1_MAX_TAG_DATA (PCCC_MAX_READ_SPAN)
+#define DF1_DEFAULT_BAUD_RATE (19200)
+#define DF1_DEFAULT_DST_NODE (1)
+#define DF1_ACK_TIMEOUT (1000)
+#define DF1_REPLY_TIMEOUT (5000)
+#define DF1_MAX_NAKS (3)
+#define DF1_MAX_ENQS (3)
+#define DF1_MAX_REQUESTS_IN_FLIGHT (8)
+#define DF1_PORT_ERR_DELAY (5000)
+#define DF1_IDLE_WAIT_TIME (100)
+
+typedef enum { DF1_RX_IDLE, DF1_RX_IDLE_DLE, DF1_RX_DATA, DF1_RX_DATA_DLE, DF1_RX_CHECK } df1_rx_state_t;
+
+struct df1_plc_t {
+    struct df1_plc_t *next;
+
+    /* keep a list of tags using this link. */
+    struct df1_tag_t *tags;
+
+    /* serial port settings, the port name is the key. */
+    char *port_name;
+    int baud_rate;
+    int data_bits;
+    int stop_bits;
+    int parity;
+    int use_bcc;
+    uint8_t src_node;
+    int max_requests_in_flight;
+
+    /* port_lock guards the port pointer for wakers. */
+    serial_port_p port;
+    lock_t port_lock;
+
+    /* State */
+    struct {
+        unsigned int terminate:1;
+    } flags;
+
+    /* PCCC transaction numbers, never zero.  Guarded by the mutex. */
+    uint16_t tns;
+    int num_in_flight;
+
+    /* thread related state */
+    thread_p handler_thread;
+    mutex_p mutex;
+    cond_p wait_cond;
+
+    /* library wide metrics for this link. */
+    metrics_block_p metrics;
+
+    /* receive framing, the CRC is built up as the bytes come in. */
+    df1_rx_state_t rx_state;
+    int rx_len;
+    int rx_overflow;
+    uint16_t rx_crc;
+    int rx_check_len;
+    uint8_t rx_check[2];
+    uint8_t rx_msg[DF1_MAX_MESSAGE];
+
+    /* the sender repeats a message if our ACK was lost. */
+    int have_last_rx;
+    uint8_t last_rx_src;
+    uint8_t last_rx_cmd;
+    uint16_t last_rx_tns;
+
+    /* repeated when the other side sends ENQ. */
+    uint8_t last_link_response;
+
+    /* link responses and ENQs waiting to go out. */
+    int control_len;
+    int control_offset;
+    uint8_t control[DF1_MAX_CONTROL];
+
+    /* the outgoing frame and its link state. */
+    int frame_len;
+    int frame_sent;
+    int frame_check_start;
+    int frame_in_pair;
+    int frame_waiting_ack;
+    uint16_t frame_tns;
+    int frame_naks;
+    int frame_enqs;
+    int64_t frame_ack_deadline;
+    uint8_t frame[DF1_MAX_FRAME];
+};
+
+typedef struct df1_plc_t *df1_plc_p;
+
+
+struct df1_tag_t {
+    /* base tag parts. */
+    TAG_BASE_STRUCT;
+
+    /* next one in the list for this link */
+    struct df1_tag_t *next;
+
+    /* the link we are using */
+    df1_plc_p plc;
+
+    /* where the data lives. */
+    plc_type_t plc_type;
+    uint8_t dst_node;
+    pccc_file_t file_type;
+    int encoded_name_size;
+    uint8_t encoded_name[DF1_MAX_ENCODED_NAME];
+
+    /* actions and state */
+    struct {
+        unsigned int _abort:1;
+        unsigned int _read:1;
+        unsigned int _write:1;
+        unsigned int _busy:1;
+    } flags;
+    uint16_t tns;
+    int64_t reply_deadline;
+    lock_t tag_lock;
+
+    /* data for the tag. */
+    int elem_count;
+    int elem_size;
+};
+
+typedef struct df1_tag_t *df1_tag_p;
+
+
+/* DF1 module globals. */
+static mutex_p df1_mutex = NULL;
+static df1_plc_p df1_plcs = NULL;
+
+
+/* helper functions */
+static int create_tag_object(attr attribs, df1_tag_p *tag);
+static int default_elem_size(pccc_file_t file_type, int subelem_num);
+static int find_or_create_plc(attr attribs, df1_plc_p *plc);
+static int parse_parity(const char *parity_str, int *parity);
+static void df1_tag_destructor(void *tag_arg);
+static void df1_plc_destructor(void *plc_arg);
+static THREAD_FUNC(df1_plc_handler);
+static int open_port(df1_plc_p plc);
+static void close_port(df1_plc_p plc);
+static void wake_plc(df1_plc_p plc);
+static void wait_plc(df1_plc_p plc, int64_t err_delay);
+static int read_port(df1_plc_p plc);
+static int write_port(df1_plc_p plc);
+static void receive_bytes(df1_plc_p plc, uint8_t *data, int size);
+static void receive_data(df1_plc_p plc, uint8_t *data, int size);
+static void check_message(df1_plc_p plc);
+static void handle_message(df1_plc_p plc);
+static void link_ack(df1_plc_p plc);
+static void link_nak(df1_plc_p plc);
+static void check_ack_timeout(df1_plc_p plc);
+static void queue_control(df1_plc_p plc, uint8_t code);
+static void queue_link_response(df1_plc_p plc, uint8_t code);
+static int frame_at_safe_point(df1_plc_p plc);
+static void fail_frame(df1_plc_p plc, int rc);
+static void process_tags(df1_plc_p plc);
+static int send_command(df1_plc_p plc, df1_tag_p tag);
+static void complete_tag(df1_plc_p plc, df1_tag_p tag, uint8_t *msg, int msg_len);
+static void finish_tag(df1_tag_p tag, int rc);
+
+/* tag vtable functions. */
+
+/* control functions. */
+static int df1_abort(plc_tag_p p_tag);
+static int df1_read_start(plc_tag_p p_tag);
+static int df1_tag_status(plc_tag_p p_tag);
+static int df1_tickler(plc_tag_p p_tag);
+static int df1_write_start(plc_tag_p p_tag);
+
+/* data accessors */
+static int df1_get_int_attrib(plc_tag_p tag, const char *attrib_name, int default_value);
+static int df1_set_int_attrib(plc_tag_p tag, const char *attrib_name, int new_value);
+
+static struct tag_vtable_t df1_vtable = {
+    (tag_vtable_func)df1_abort,
+    (tag_vtable_func)df1_read_start,
+    (tag_vtable_func)df1_tag_status,
+    (tag_vtable_func)df1_tickler,
+    (tag_vtable_func)df1_write_start,
+
+    /* data accessors */
+    df1_get_int_attrib,
+    df1_set_int_attrib,
+
+    /* no structure member lookup */
+    NULL,
+
+    /* no element ranges */
+    NULL
+};
+
+
+/****** main entry point *******/
+
+plc_tag_p df1_tag_create(attr attribs)
+{
+    int rc = PLCTAG_STATUS_OK;
+    df1_tag_p tag = NULL;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    /* create the tag object. */
+    rc = create_tag_object(attribs, &tag);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to create new tag!  Error %s!", plc_tag_decode_error(rc));
+        return NULL;
+    }
+
+    /* find the link object. */
+    rc = find_or_create_plc(attribs, &(tag->plc));
+    if(rc == PLCTAG_STATUS_OK) {
+        /* put the tag on the link's list. */
+        critical_block(tag->plc->mutex) {
+            tag->next = tag->plc->tags;
+            tag->plc->tags = tag;
+        }
+
+        /* trigger a read to get the initial value of the tag. */
+        tag->read_in_flight = 1;
+        tag->flags._read = 1;
+
+        wake_plc(tag->plc);
+    } else {
+        pdebug(DEBUG_WARN, "Unable to create new tag!  Error %s!", plc_tag_decode_error(rc));
+        tag->status = (int8_t)rc;
+    }
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return (plc_tag_p)tag;
+}
+
+
+/***** helper functions *****/
+
+int create_tag_object(attr attribs, df1_tag_p *tag)
+{
+    int rc = PLCTAG_STATUS_OK;
+    const char *name = attr_get_str(attribs, "name", NULL);
+    plc_type_t plc_type = get_plc_type(attribs);
+    int dst_node = attr_get_int(attribs, "path", DF1_DEFAULT_DST_NODE);
+    int elem_count = attr_get_int(attribs, "elem_count", 1);
+    int elem_size = 0;
+    uint8_t encoded_name[DF1_MAX_ENCODED_NAME];
+    int encoded_name_size = 0;
+    pccc_file_t file_type = PCCC_FILE_UNKNOWN;
+    int file_num = 0;
+    int elem_num = 0;
+    int subelem_num = -1;
+    int data_size = 0;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    *tag = NULL;
+
+    if(!name) {
+        pdebug(DEBUG_WARN, "No tag name parameter found!");
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    if(dst_node < 0 || dst_node > 255) {
+        pdebug(DEBUG_WARN, "Destination node, %d, is out of bounds!", dst_node);
+        return PLCTAG_ERR_OUT_OF_BOUNDS;
+    }
+
+    if(elem_count <= 0) {
+        pdebug(DEBUG_WARN, "Element count must be positive!");
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    switch(plc_type) {
+        case AB_PLC_PLC5:
+            rc = plc5_encode_tag_name(encoded_name, &encoded_name_size, &file_type, name, DF1_MAX_ENCODED_NAME);
+            break;
+
+        case AB_PLC_SLC:
+            /* fall through */
+        case AB_PLC_MLGX:
+            rc = slc_encode_tag_name(encoded_name, &encoded_name_size, &file_type, name, DF1_MAX_ENCODED_NAME);
+            break;
+
+        default:
+            pdebug(DEBUG_WARN, "DF1 only supports PLC/5, SLC 500 and MicroLogix PLCs!");
+            return PLCTAG_ERR_BAD_DEVICE;
+            break;
+    }
+
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to encode tag name %s!", name);
+        return rc;
+    }
+
+    rc = pccc_parse_address(name, &file_type, &file_num, &elem_num, &subelem_num);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to parse tag name %s!", name);
+        return rc;
+    }
+
+    elem_size = attr_get_int(attribs, "elem_size", default_elem_size(file_type, subelem_num));
+    if(elem_size <= 0) {
+        pdebug(DEBUG_WARN, "Element size is unknown for tag %s, it must be set!", name);
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    data_size = elem_size * elem_count;
+
+    if(data_size > DF1_MAX_TAG_DATA) {
+        pdebug(DEBUG_WARN, "Tag data size, %d bytes, is larger than the %d bytes one DF1 transfer holds!", data_size, DF1_MAX_TAG_DATA);
+        return PLCTAG_ERR_TOO_LARGE;
+    }
+
+    if(plc_type == AB_PLC_PLC5 && (data_size & 0x01)) {
+        pdebug(DEBUG_WARN, "PLC/5 transfers are in words, the data size must be even!");
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    pdebug(DEBUG_DETAIL, "Tag data size is %d bytes.", data_size);
+
+    /* allocate the tag */
+    *tag = (df1_tag_p)rc_alloc((int)(unsigned int)sizeof(struct df1_tag_t) + data_size, df1_tag_destructor);
+    if(! *tag) {
+        pdebug(DEBUG_WARN, "Unable to allocate DF1 tag!");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    /* point the data just after the tag struct. */
+    (*tag)->data = (uint8_t *)((*tag) + 1);
+    (*tag)->data_inline = 1;
+
+    (*tag)->plc_type = plc_type;
+    (*tag)->dst_node = (uint8_t)(unsigned int)dst_node;
+    (*tag)->file_type = file_type;
+    mem_copy((*tag)->encoded_name, encoded_name, encoded_name_size);
+    (*tag)->encoded_name_size = encoded_name_size;
+    (*tag)->elem_count = elem_count;
+    (*tag)->elem_size = elem_size;
+    (*tag)->size = data_size;
+
+    /* set up the vtable */
+    (*tag)->vtable = &df1_vtable;
+
+    /* set the default byte order */
+    if(plc_type == AB_PLC_PLC5) {
+        (*tag)->byte_order = &plc5_tag_byte_order;
+    } else {
+        (*tag)->byte_order = &slc_tag_byte_order;
+    }
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/* element sizes of the data file types, zero if the caller must say. */
+int default_elem_size(pccc_file_t file_type, int subelem_num)
+{
+    /* timer, counter and control sub-elements are words. */
+    if(subelem_num >= 0) {
+        return 2;
+    }
+
+    switch(file_type) {
+        case PCCC_FILE_ASCII:
+        case PCCC_FILE_BIT:
+        case PCCC_FILE_BCD:
+        case PCCC_FILE_INPUT:
+        case PCCC_FILE_INT:
+        case PCCC_FILE_OUTPUT:
+        case PCCC_FILE_STATUS:
+            return 2;
+
+        case PCCC_FILE_FLOAT:
+        case PCCC_FILE_LONG_INT:
+            return 4;
+
+        case PCCC_FILE_COUNTER:
+        case PCCC_FILE_CONTROL:
+        case PCCC_FILE_TIMER:
+            return 6;
+
+        case PCCC_FILE_STRING:
+            return 84;
+
+        default:
+            return 0;
+    }
+}
+
+
+
+void df1_tag_destructor(void *tag_arg)
+{
+    df1_tag_p tag = (df1_tag_p)tag_arg;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(!tag) {
+        pdebug(DEBUG_WARN, "Destructor called with null pointer!");
+        return;
+    }
+
+    if(tag->plc) {
+        pdebug(DEBUG_DETAIL, "Unlinking from the link.");
+
+        /* unlink the tag from the link. */
+        critical_block(tag->plc->mutex) {
+            df1_tag_p *tag_walker = &(tag->plc->tags);
+
+            while(*tag_walker && *tag_walker != tag) {
+                tag_walker = &((*tag_walker)->next);
+            }
+
+            if(*tag_walker) {
+                *tag_walker = tag->next;
+            } else {
+                pdebug(DEBUG_WARN, "Tag not found on the link's list!");
+            }
+
+            /* a reply for this tag will be dropped. */
+            if(tag->flags._busy) {
+                tag->plc->num_in_flight--;
+                metrics_set(tag->plc->metrics, METRIC_IN_FLIGHT, tag->plc->num_in_flight);
+            }
+        }
+
+        pdebug(DEBUG_DETAIL, "Releasing the reference to the link.");
+        tag->plc = rc_dec(tag->plc);
+    }
+
+    if(tag->tag_cond_wait) {
+        cond_destroy(&(tag->tag_cond_wait));
+        tag->tag_cond_wait = NULL;
+    }
+
+    if(tag->change_detect) {
+        mem_free(tag->change_detect);
+        tag->change_detect = NULL;
+    }
+
+    if(tag->dirty_ranges) {
+        mem_free(tag->dirty_ranges);
+        tag->dirty_ranges = NULL;
+    }
+
+    if(tag->history) {
+        mem_free(tag->history);
+        tag->history = NULL;
+    }
+
+    if(tag->stats) {
+        mem_free(tag->stats);
+        tag->stats = NULL;
+    }
+
+    /* stop publishing before the data goes away. */
+    shared_publish_release((plc_tag_p)tag);
+    alias_parent_release((plc_tag_p)tag);
+
+    plc_tag_generic_release_locks((plc_tag_p)tag);
+
+    if(tag->byte_order && tag->byte_order->is_allocated) {
+        mem_free(tag->byte_order);
+        tag->byte_order = NULL;
+    }
+
+    pdebug(DEBUG_INFO, "Done.");
+}
+
+
+
+int find_or_create_plc(attr attribs, df1_plc_p *plc)
+{
+    const char *port_name = attr_get_str(attribs, "gateway", NULL);
+    int baud_rate = attr_get_int(attribs, "baud_rate", DF1_DEFAULT_BAUD_RATE);
+    int data_bits = attr_get_int(attribs, "data_bits", 8);
+    int stop_bits = attr_get_int(attribs, "stop_bits", 1);
+    int parity = 0;
+    const char *checksum = attr_get_str(attribs, "df1_checksum", "crc");
+    int src_node = attr_get_int(attribs, "df1_src_node", 0);
+    int max_requests_in_flight = attr_get_int(attribs, "max_requests_in_flight", 1);
+    int is_new = 0;
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(!port_name || str_length(port_name) == 0) {
+        pdebug(DEBUG_WARN, "The serial port must be given in the gateway attribute!");
+        return PLCTAG_ERR_BAD_GATEWAY;
+    }
+
+    rc = parse_parity(attr_get_str(attribs, "parity", "none"), &parity);
+    if(rc != PLCTAG_STATUS_OK) {
+        return rc;
+    }
+
+    if(str_cmp_i(checksum, "crc") != 0 && str_cmp_i(checksum, "bcc") != 0) {
+        pdebug(DEBUG_WARN, "Unsupported DF1 checksum \"%s\", must be crc or bcc!", checksum);
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    if(src_node < 0 || src_node > 255) {
+        pdebug(DEBUG_WARN, "Source node, %d, is out of bounds!", src_node);
+        return PLCTAG_ERR_OUT_OF_BOUNDS;
+    }
+
+    if(max_requests_in_flight < 1 || max_requests_in_flight > DF1_MAX_REQUESTS_IN_FLIGHT) {
+        pdebug(DEBUG_WARN, "max_requests_in_flight must be between 1 and %d!", DF1_MAX_REQUESTS_IN_FLIGHT);
+        return PLCTAG_ERR_OUT_OF_BOUNDS;
+    }
+
+    /* see if we can find a matching link. */
+    critical_block(df1_mutex) {
+        df1_plc_p *walker = &df1_plcs;
+
+        while(*walker && str_cmp((*walker)->port_name, port_name) != 0) {
+            walker = &((*walker)->next);
+        }
+
+        /* did we find one. */
+        if(*walker) {
+            *plc = rc_inc(*walker);
+            is_new = 0;
+        } else {
+            /* nope, make a new one.  Do as little as possible in the mutex. */
+            is_new = 1;
+
+            *plc = (df1_plc_p)rc_alloc((int)(unsigned int)sizeof(struct df1_plc_t), df1_plc_destructor);
+            if(*plc) {
+                /* copy the port name so that we can find this again. */
+                (*plc)->port_name = str_dup(port_name);
+                if(! ((*plc)->port_name)) {
+                    pdebug(DEBUG_WARN, "Unable to allocate DF1 port name string!");
+                    rc = PLCTAG_ERR_NO_MEM;
+                } else {
+                    /* link up the list. */
+                    (*plc)->next = df1_plcs;
+                    df1_plcs = *plc;
+                }
+            } else {
+                pdebug(DEBUG_WARN, "Unable to allocate DF1 link object!");
+                rc = PLCTAG_ERR_NO_MEM;
+            }
+        }
+    }
+
+    /* if everything went well and it is new, set up the new link. */
+    if(rc == PLCTAG_STATUS_OK && is_new) {
+        pdebug(DEBUG_INFO, "Creating new DF1 link on %s.", port_name);
+
+        /* the first tag on the port sets it up. */
+        (*plc)->baud_rate = baud_rate;
+        (*plc)->data_bits = data_bits;
+        (*plc)->stop_bits = stop_bits;
+        (*plc)->parity = parity;
+        (*plc)->use_bcc = (str_cmp_i(checksum, "bcc") == 0);
+        (*plc)->src_node = (uint8_t)(unsigned int)src_node;
+        (*plc)->max_requests_in_flight = max_requests_in_flight;
+        (*plc)->last_link_response = DF1_NAK;
+        (*plc)->port_lock = LOCK_INIT;
+
+        /* metrics are not critical, the link works without them. */
+        (*plc)->metrics = metrics_register("df1_plc", port_name,
+                                           METRIC_BIT(METRIC_PACKETS_SENT) | METRIC_BIT(METRIC_PACKETS_RECEIVED)
+                                         | METRIC_BIT(METRIC_BYTES_SENT) | METRIC_BIT(METRIC_BYTES_RECEIVED)
+                                         | METRIC_BIT(METRIC_CONNECTS) | METRIC_BIT(METRIC_IN_FLIGHT));
+
+        rc = mutex_create(&((*plc)->mutex));
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Unable to create new mutex, error %s!", plc_tag_decode_error(rc));
+        } else {
+            rc = cond_create(&((*plc)->wait_cond));
+            if(rc != PLCTAG_STATUS_OK) {
+                pdebug(DEBUG_WARN, "Unable to create new condition var, error %s!", plc_tag_decode_error(rc));
+            } else {
+                rc = thread_create(&((*plc)->handler_thread), df1_plc_handler, 32768, (void *)(*plc));
+                if(rc != PLCTAG_STATUS_OK) {
+                    pdebug(DEBUG_WARN, "Unable to create new handler thread, error %s!", plc_tag_decode_error(rc));
+                } else {
+                    plc_tag_generic_tune_thread((*plc)->handler_thread, PLCTAG_THREAD_SESSION);
+                }
+            }
+        }
+    }
+
+    if(rc != PLCTAG_STATUS_OK && *plc) {
+        pdebug(DEBUG_WARN, "DF1 link lookup and/or creation failed!");
+
+        /* clean up. */
+        *plc = rc_dec(*plc);
+    }
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return rc;
+}
+
+
+
+int parse_parity(const char *parity_str, int *parity)
+{
+    if(str_cmp_i(parity_str, "none") == 0) {
+        *parity = 0;
+    } else if(str_cmp_i(parity_str, "odd") == 0) {
+        *parity = 1;
+    } else if(str_cmp_i(parity_str, "even") == 0) {
+        *parity = 2;
+    } else {
+        pdebug(DEBUG_WARN, "Unsupported parity \"%s\", must be none, odd or even!", parity_str);
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+void df1_plc_destructor(void *plc_arg)
+{
+    df1_plc_p plc = (df1_plc_p)plc_arg;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(!plc) {
+        pdebug(DEBUG_WARN, "Destructor called with null pointer!");
+        return;
+    }
+
+    /* remove the link from the list. */
+    critical_block(df1_mutex) {
+        df1_plc_p *walker = &df1_plcs;
+
+        while(*walker && *walker != plc) {
+            walker = &((*walker)->next);
+        }
+
+        if(*walker) {
+            *walker = plc->next;
+            plc->next = NULL;
+        } else {
+            pdebug(DEBUG_WARN, "DF1 link not found in the list!");
+        }
+    }
+
+    /* shut down the thread. */
+    if(plc->handler_thread) {
+        plc->flags.terminate = 1;
+        wake_plc(plc);
+        thread_join(plc->handler_thread);
+        thread_destroy(&plc->handler_thread);
+        plc->handler_thread = NULL;
+    }
+
+    close_port(plc);
+
+    if(plc->mutex) {
+        mutex_destroy(&plc->mutex);
+        plc->mutex = NULL;
+    }
+
+    if(plc->wait_cond) {
+        cond_destroy(&plc->wait_cond);
+        plc->wait_cond = NULL;
+    }
+
+    if(plc->port_name) {
+        mem_free(plc->port_name);
+        plc->port_name = NULL;
+    }
+
+    if(plc->metrics) {
+        metrics_unregister(plc->metrics);
+        plc->metrics = NULL;
+    }
+
+    if(plc->tags) {
+        pdebug(DEBUG_WARN, "There are tags still remaining, memory leak possible!");
+    }
+
+    pdebug(DEBUG_INFO, "Done.");
+}
+
+
+
+THREAD_FUNC(df1_plc_handler)
+{
+    int rc = PLCTAG_STATUS_OK;
+    df1_plc_p plc = (df1_plc_p)arg;
+    int64_t err_delay = 0;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(!plc) {
+        pdebug(DEBUG_WARN, "Null DF1 link pointer passed!");
+        THREAD_RETURN(0);
+    }
+
+    while(! plc->flags.terminate) {
+        if(err_delay < time_ms()) {
+            do {
+                if(!plc->port) {
+                    rc = open_port(plc);
+                    if(rc != PLCTAG_STATUS_OK) {
+                        err_delay = time_ms() + DF1_PORT_ERR_DELAY;
+                        break;
+                    }
+                }
+
+                /* link responses for what came in are queued before anything else goes out. */
+                rc = read_port(plc);
+                if(rc != PLCTAG_STATUS_OK) {
+                    close_port(plc);
+                    err_delay = time_ms() + DF1_PORT_ERR_DELAY;
+                    break;
+                }
+
+                check_ack_timeout(plc);
+
+                /*
+                 * A tag that is destroyed while we run it could trigger the
+                 * link destructor, hold a reference so that cannot happen
+                 * while we hold the mutex.
+                 */
+                if(rc_inc(plc)) {
+                    process_tags(plc);
+                    rc_dec(plc);
+                }
+
+                rc = write_port(plc);
+                if(rc != PLCTAG_STATUS_OK) {
+                    close_port(plc);
+                    err_delay = time_ms() + DF1_PORT_ERR_DELAY;
+                    break;
+                }
+            } while(0);
+        }
+
+        wait_plc(plc, err_delay);
+    }
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    THREAD_RETURN(0);
+}
+
+
+
+int open_port(df1_plc_p plc)
+{
+    serial_port_p port = NULL;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    port = plc_lib_open_serial_port(plc->port_name, plc->baud_rate, plc->data_bits, plc->stop_bits, plc->parity);
+    if(!port) {
+        pdebug(DEBUG_WARN, "Unable to open serial port %s!", plc->port_name);
+        return PLCTAG_ERR_OPEN;
+    }
+
+    spin_block(&plc->port_lock) {
+        plc->port = port;
+    }
+
+    plc->rx_state = DF1_RX_IDLE;
+    plc->have_last_rx = 0;
+
+    metrics_add(plc->metrics, METRIC_CONNECTS, 1);
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/* drop the port and anything that was on the wire. */
+void close_port(df1_plc_p plc)
+{
+    serial_port_p port = NULL;
+
+    spin_block(&plc->port_lock) {
+        port = plc->port;
+        plc->port = NULL;
+    }
+
+    if(!port) {
+        return;
+    }
+
+    pdebug(DEBUG_DETAIL, "Closing serial port %s.", plc->port_name);
+
+    plc_lib_close_serial_port(port);
+
+    plc->control_len = 0;
+    plc->control_offset = 0;
+
+    if(plc->frame_waiting_ack) {
+        fail_frame(plc, PLCTAG_ERR_WRITE);
+    }
+
+    plc->frame_len = 0;
+    plc->frame_sent = 0;
+}
+
+
+
+/* wake the handler thread whether it is waiting on the port or not. */
+void wake_plc(df1_plc_p plc)
+{
+    if(!plc) {
+        return;
+    }
+
+    spin_block(&plc->port_lock) {
+        if(plc->port) {
+            plc_lib_serial_port_wake(plc->port);
+        }
+    }
+
+    if(plc->wait_cond) {
+        cond_signal(plc->wait_cond);
+    }
+}
+
+
+
+/* wait for the port, a wake up from a tag or the next link timeout. */
+void wait_plc(df1_plc_p plc, int64_t err_delay)
+{
+    int64_t now = time_ms();
+    int timeout_ms = DF1_IDLE_WAIT_TIME;
+
+    if(plc->frame_ack_deadline && plc->frame_ack_deadline - now < timeout_ms) {
+        timeout_ms = (int)(plc->frame_ack_deadline > now ? plc->frame_ack_deadline - now : 0);
+    }
+
+    if(plc->port && err_delay < now) {
+        int events = SOCKET_EVENT_READ;
+
+        if(plc->control_len > 0 || plc->frame_sent < plc->frame_len) {
+            events |= SOCKET_EVENT_WRITE;
+        }
+
+        plc_lib_serial_port_wait_event(plc->port, events, timeout_ms);
+    } else {
+        cond_wait(plc->wait_cond, DF1_IDLE_WAIT_TIME);
+    }
+}
+
+
+
+/* read everything that is waiting, the port is non-blocking. */
+int read_port(df1_plc_p plc)
+{
+    uint8_t buf[DF1_RX_CHUNK_SIZE];
+    int rc = 0;
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    do {
+        rc = plc_lib_serial_port_read(plc->port, buf, (int)(unsigned int)sizeof(buf));
+        if(rc < 0) {
+            pdebug(DEBUG_WARN, "Error %s reading serial port %s!", plc_tag_decode_error(rc), plc->port_name);
+            return rc;
+        }
+
+        if(rc > 0) {
+            pdebug(DEBUG_SPEW, "Got %d bytes.", rc);
+            pdebug_dump_bytes(DEBUG_SPEW, buf, rc);
+
+            receive_bytes(plc, buf, rc);
+        }
+    } while(rc == (int)(unsigned int)sizeof(buf));
+
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * Link responses go out first, but only between DLE pairs and never in
+ * the checksum of the frame being sent.
+ */
+int write_port(df1_plc_p plc)
+{
+    int rc = 0;
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    while(1) {
+        if(plc->control_len > 0 && (plc->control_offset > 0 || frame_at_safe_point(plc))) {
+            rc = plc_lib_serial_port_write(plc->port, &plc->control[plc->control_offset], plc->control_len - plc->control_offset);
+            if(rc < 0) {
+                pdebug(DEBUG_WARN, "Error %s writing serial port %s!", plc_tag_decode_error(rc), plc->port_name);
+                return rc;
+            }
+
+            if(rc == 0) {
+                break;
+            }
+
+            plc->control_offset += rc;
+            metrics_add(plc->metrics, METRIC_BYTES_SENT, rc);
+
+            if(plc->control_offset >= plc->control_len) {
+                plc->control_len = 0;
+                plc->control_offset = 0;
+            }
+        } else if(plc->frame_sent < plc->frame_len) {
+            int end = plc->frame_len;
+
+            /* stop between DLE pairs if there is a link response to splice in. */
+            if(plc->control_len > 0 && plc->frame_sent < plc->frame_check_start) {
+                end = plc->frame_sent + 1;
+            }
+
+            rc = plc_lib_serial_port_write(plc->port, &plc->frame[plc->frame_sent], end - plc->frame_sent);
+            if(rc < 0) {
+                pdebug(DEBUG_WARN, "Error %s writing serial port %s!", plc_tag_decode_error(rc), plc->port_name);
+                return rc;
+            }
+
+            if(rc == 0) {
+                break;
+            }
+
+            for(int i=plc->frame_sent; i < plc->frame_sent + rc; i++) {
+                if(plc->frame_in_pair) {
+                    plc->frame_in_pair = 0;
+                } else if(plc->frame[i] == DF1_DLE) {
+                    plc->frame_in_pair = 1;
+                }
+            }
+
+            plc->frame_sent += rc;
+            metrics_add(plc->metrics, METRIC_BYTES_SENT, rc);
+
+            /* the ACK timer starts once the frame is written. */
+            if(plc->frame_sent >= plc->frame_len) {
+                plc->frame_ack_deadline = time_ms() + DF1_ACK_TIMEOUT + ((int64_t)plc->frame_len * 10000) / plc->baud_rate;
+                metrics_add(plc->metrics, METRIC_PACKETS_SENT, 1);
+            }
+        } else {
+            break;
+        }
+    }
+
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+int frame_at_safe_point(df1_plc_p plc)
+{
+    if(plc->frame_sent == 0 || plc->frame_sent >= plc->frame_len) {
+        return 1;
+    }
+
+    return (plc->frame_sent < plc->frame_check_start && !plc->frame_in_pair);
+}
+
+
+
+/*
+ * Frame parser.  Runs of message bytes between DLEs are copied and
+ * checksummed in one go, only the DLE sequences are handled byte by byte.
+ */
+void receive_bytes(df1_plc_p plc, uint8_t *data, int size)
+{
+    int i = 0;
+
+    while(i < size) {
+        switch(plc->rx_state) {
+            case DF1_RX_IDLE: {
+                    uint8_t *dle = memchr(&data[i], DF1_DLE, (size_t)(unsigned int)(size - i));
+
+                    if(!dle) {
+                        /* line noise. */
+                        i = size;
+                    } else {
+                        i = (int)(dle - data) + 1;
+                        plc->rx_state = DF1_RX_IDLE_DLE;
+                    }
+                }
+                break;
+
+            case DF1_RX_IDLE_DLE:
+                plc->rx_state = DF1_RX_IDLE;
+
+                switch(data[i++]) {
+                    case DF1_STX:
+                        plc->rx_len = 0;
+                        plc->rx_overflow = 0;
+                        plc->rx_crc = 0;
+                        plc->rx_state = DF1_RX_DATA;
+                        break;
+
+                    case DF1_ACK:
+                        link_ack(plc);
+                        break;
+
+                    case DF1_NAK:
+                        link_nak(plc);
+                        break;
+
+                    case DF1_ENQ:
+                        queue_link_response(plc, plc->last_link_response);
+                        break;
+
+                    default:
+                        break;
+                }
+                break;
+
+            case DF1_RX_DATA: {
+                    uint8_t *dle = memchr(&data[i], DF1_DLE, (size_t)(unsigned int)(size - i));
+                    int run = (dle ? (int)(dle - &data[i]) : size - i);
+
+                    receive_data(plc, &data[i], run);
+                    i += run;
+
+                    if(dle) {
+                        i++;
+                        plc->rx_state = DF1_RX_DATA_DLE;
+                    }
+                }
+                break;
+
+            case DF1_RX_DATA_DLE: {
+                    uint8_t code = data[i++];
+
+                    plc->rx_state = DF1_RX_DATA;
+
+                    switch(code) {
+                        case DF1_DLE:
+                            receive_data(plc, &code, 1);
+                            break;
+
+                        case DF1_ETX:
+                            plc->rx_crc = pccc_update_crc16(plc->rx_crc, &code, 1);
+                            plc->rx_check_len = 0;
+                            plc->rx_state = DF1_RX_CHECK;
+                            break;
+
+                        /* link responses can be embedded in a message. */
+                        case DF1_ACK:
+                            link_ack(plc);
+                            break;
+
+                        case DF1_NAK:
+                            link_nak(plc);
+                            break;
+
+                        case DF1_ENQ:
+                            queue_link_response(plc, plc->last_link_response);
+                            break;
+
+                        case DF1_STX:
+                            pdebug(DEBUG_WARN, "New frame started inside a frame, dropping the first one.");
+                            plc->rx_len = 0;
+                            plc->rx_overflow = 0;
+                            plc->rx_crc = 0;
+                            break;
+
+                        default:
+                            pdebug(DEBUG_WARN, "Unexpected DLE sequence 0x%02x in frame!", (int)(unsigned int)code);
+                            queue_link_response(plc, DF1_NAK);
+                            plc->rx_state = DF1_RX_IDLE;
+                            break;
+                    }
+                }
+                break;
+
+            case DF1_RX_CHECK:
+                plc->rx_check[plc->rx_check_len++] = data[i++];
+
+                if(plc->rx_check_len >= (plc->use_bcc ? 1 : 2)) {
+                    plc->rx_state = DF1_RX_IDLE;
+                    check_message(plc);
+                }
+                break;
+
+            default:
+                plc->rx_state = DF1_RX_IDLE;
+                break;
+        }
+    }
+}
+
+
+
+void receive_data(df1_plc_p plc, uint8_t *data, int size)
+{
+    if(plc->rx_overflow || plc->rx_len + size > DF1_MAX_MESSAGE) {
+        plc->rx_overflow = 1;
+        return;
+    }
+
+    mem_copy(&plc->rx_msg[plc->rx_len], data, size);
+    plc->rx_len += size;
+
+    if(!plc->use_bcc) {
+        plc->rx_crc = pccc_update_crc16(plc->rx_crc, data, size);
+    }
+}
+
+
+
+/* answer the frame right away, then look at what is in it. */
+void check_message(df1_plc_p plc)
+{
+    int good = 0;
+
+    if(plc->rx_overflow) {
+        pdebug(DEBUG_WARN, "Frame is larger than %d bytes!", DF1_MAX_MESSAGE);
+    } else if(plc->use_bcc) {
+        good = (plc->rx_check[0] == pccc_calculate_bcc(plc->rx_msg, plc->rx_len));
+    } else {
+        good = (plc->rx_check[0] == (uint8_t)(plc->rx_crc & 0xFF) && plc->rx_check[1] == (uint8_t)(plc->rx_crc >> 8));
+    }
+
+    if(!good) {
+        pdebug(DEBUG_WARN, "Bad frame checksum, sending NAK.");
+        queue_link_response(plc, DF1_NAK);
+        return;
+    }
+
+    queue_link_response(plc, DF1_ACK);
+
+    metrics_add(plc->metrics, METRIC_PACKETS_RECEIVED, 1);
+    metrics_add(plc->metrics, METRIC_BYTES_RECEIVED, plc->rx_len);
+
+    handle_message(plc);
+}
+
+
+
+void handle_message(df1_plc_p plc)
+{
+    uint8_t *msg = plc->rx_msg;
+    uint8_t src = 0;
+    uint8_t cmd = 0;
+    uint16_t tns = 0;
+
+    if(plc->rx_len < DF1_HEADER_SIZE) {
+        pdebug(DEBUG_WARN, "Message of %d bytes is too short!", plc->rx_len);
+        return;
+    }
+
+    src = msg[1];
+    cmd = msg[2];
+    tns = (uint16_t)(msg[4] | (msg[5] << 8));
+
+    /* our ACK was lost and this is the same message again. */
+    if(plc->have_last_rx && plc->last_rx_src == src && plc->last_rx_cmd == cmd && plc->last_rx_tns == tns) {
+        pdebug(DEBUG_DETAIL, "Dropping duplicate message with TNS %u.", (unsigned int)tns);
+        return;
+    }
+
+    plc->have_last_rx = 1;
+    plc->last_rx_src = src;
+    plc->last_rx_cmd = cmd;
+    plc->last_rx_tns = tns;
+
+    if(!(cmd & 0x40)) {
+        pdebug(DEBUG_DETAIL, "Ignoring PCCC command 0x%02x from node %d.", (int)(unsigned int)cmd, (int)(unsigned int)src);
+        return;
+    }
+
+    /* a reply means the command got there even if the ACK did not. */
+    if(plc->frame_waiting_ack && plc->frame_tns == tns && plc->frame_sent >= plc->frame_len) {
+        plc->frame_waiting_ack = 0;
+        plc->frame_ack_deadline = 0;
+    }
+
+    critical_block(plc->mutex) {
+        df1_tag_p tag = plc->tags;
+
+        while(tag && !(tag->flags._busy && tag->tns == tns)) {
+            tag = tag->next;
+        }
+
+        if(tag) {
+            complete_tag(plc, tag, msg, plc->rx_len);
+        } else {
+            pdebug(DEBUG_DETAIL, "No tag waiting for the reply with TNS %u.", (unsigned int)tns);
+        }
+    }
+}
+
+
+
+void link_ack(df1_plc_p plc)
+{
+    if(!plc->frame_waiting_ack || plc->frame_sent < plc->frame_len) {
+        pdebug(DEBUG_DETAIL, "Unexpected ACK.");
+        return;
+    }
+
+    pdebug(DEBUG_SPEW, "Frame with TNS %u was ACKed.", (unsigned int)plc->frame_tns);
+
+    plc->frame_waiting_ack = 0;
+    plc->frame_ack_deadline = 0;
+}
+
+
+
+void link_nak(df1_plc_p plc)
+{
+    if(!plc->frame_waiting_ack || plc->frame_sent < plc->frame_len) {
+        pdebug(DEBUG_DETAIL, "Unexpected NAK.");
+        return;
+    }
+
+    plc->frame_naks++;
+
+    if(plc->frame_naks > DF1_MAX_NAKS) {
+        pdebug(DEBUG_WARN, "Frame with TNS %u was NAKed too many times!", (unsigned int)plc->frame_tns);
+        fail_frame(plc, PLCTAG_ERR_REMOTE_ERR);
+        return;
+    }
+
+    pdebug(DEBUG_DETAIL, "Frame with TNS %u was NAKed, sending it again.", (unsigned int)plc->frame_tns);
+
+    plc->frame_sent = 0;
+    plc->frame_in_pair = 0;
+    plc->frame_ack_deadline = 0;
+    plc->frame_enqs = 0;
+}
+
+
+
+/* no ACK or NAK, ask what happened to the frame. */
+void check_ack_timeout(df1_plc_p plc)
+{
+    if(!plc->frame_waiting_ack || !plc->frame_ack_deadline || plc->frame_ack_deadline > time_ms()) {
+        return;
+    }
+
+    plc->frame_enqs++;
+
+    if(plc->frame_enqs > DF1_MAX_ENQS) {
+        pdebug(DEBUG_WARN, "No link response for the frame with TNS %u!", (unsigned int)plc->frame_tns);
+        fail_frame(plc, PLCTAG_ERR_TIMEOUT);
+        return;
+    }
+
+    pdebug(DEBUG_DETAIL, "ACK timeout, sending ENQ.");
+
+    queue_control(plc, DF1_ENQ);
+
+    plc->frame_ack_deadline = time_ms() + DF1_ACK_TIMEOUT;
+}
+
+
+
+void queue_control(df1_plc_p plc, uint8_t code)
+{
+    if(plc->control_len + 2 > DF1_MAX_CONTROL) {
+        pdebug(DEBUG_WARN, "Too many link responses queued, dropping one.");
+        return;
+    }
+
+    plc->control[plc->control_len++] = DF1_DLE;
+    plc->control[plc->control_len++] = code;
+}
+
+
+
+void queue_link_response(df1_plc_p plc, uint8_t code)
+{
+    plc->last_link_response = code;
+
+    queue_control(plc, code);
+}
+
+
+
+/* the link gave up on the frame, fail the tag that sent it. */
+void fail_frame(df1_plc_p plc, int rc)
+{
+    uint16_t tns = plc->frame_tns;
+
+    plc->frame_waiting_ack = 0;
+    plc->frame_ack_deadline = 0;
+    plc->frame_len = 0;
+    plc->frame_sent = 0;
+
+    critical_block(plc->mutex) {
+        df1_tag_p tag = plc->tags;
+
+        while(tag && !(tag->flags._busy && tag->tns == tns)) {
+            tag = tag->next;
+        }
+
+        if(tag) {
+            plc->num_in_flight--;
+            metrics_set(plc->metrics, METRIC_IN_FLIGHT, plc->num_in_flight);
+
+            finish_tag(tag, rc);
+        }
+    }
+}
+
+
+
+/*
+ * Run the tags.  The tags cannot be destroyed under us while we hold
+ * the mutex, the destructor has to unlink them first.
+ */
+void process_tags(df1_plc_p plc)
+{
+    critical_block(plc->mutex) {
+        int64_t now = time_ms();
+
+        for(df1_tag_p tag = plc->tags; tag; tag = tag->next) {
+            int abort = 0;
+            int busy = 0;
+            int pending = 0;
+
+            debug_set_tag_id(tag->tag_id);
+
+            spin_block(&tag->tag_lock) {
+                abort = tag->flags._abort;
+                busy = tag->flags._busy;
+
+                if(abort) {
+                    tag->flags._read = 0;
+                    tag->flags._write = 0;
+                    tag->flags._busy = 0;
+                    tag->flags._abort = 0;
+                    tag->tns = 0;
+                }
+
+                pending = tag->flags._read || tag->flags._write;
+            }
+
+            if(abort) {
+                pdebug(DEBUG_DETAIL, "Aborting any in flight operations!");
+
+                if(busy) {
+                    plc->num_in_flight--;
+                    metrics_set(plc->metrics, METRIC_IN_FLIGHT, plc->num_in_flight);
+                }
+            } else if(busy) {
+                if(tag->reply_deadline < now) {
+                    pdebug(DEBUG_WARN, "Timed out waiting for the reply with TNS %u!", (unsigned int)tag->tns);
+
+                    plc->num_in_flight--;
+                    metrics_set(plc->metrics, METRIC_IN_FLIGHT, plc->num_in_flight);
+
+                    finish_tag(tag, PLCTAG_ERR_TIMEOUT);
+                }
+            } else if(pending && plc->port && !plc->frame_waiting_ack && plc->num_in_flight < plc->max_requests_in_flight) {
+                int rc = send_command(plc, tag);
+
+                if(rc != PLCTAG_STATUS_OK) {
+                    pdebug(DEBUG_WARN, "Error, %s, sending command for tag %d!", plc_tag_decode_error(rc), tag->tag_id);
+                    finish_tag(tag, rc);
+                }
+            }
+
+            debug_set_tag_id(0);
+        }
+    }
+}
+
+
+
+/*
+ * Build the typed read or write as one DF1 frame.
+ *
+ * PLC/5 word range  FNC(0x01/0x00) offset(2) total words(2) address [size] [data]
+ * SLC protected typed logical  FNC(0xA2/0xAA) size address [data]
+ */
+int send_command(df1_plc_p plc, df1_tag_p tag)
+{
+    uint8_t msg[DF1_MAX_MESSAGE];
+    int msg_len = 0;
+    int is_write = 0;
+    uint16_t tns = 0;
+    uint16_t crc = 0;
+    uint8_t etx = DF1_ETX;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    spin_block(&tag->tag_lock) {
+        is_write = tag->flags._write;
+    }
+
+    tns = (++(plc->tns) ? plc->tns : ++(plc->tns)); /* disallow zero */
+
+    msg[msg_len++] = tag->dst_node;
+    msg[msg_len++] = plc->src_node;
+    msg[msg_len++] = AB_EIP_PCCC_TYPED_CMD;
+    msg[msg_len++] = 0; /* STS 0 in request */
+    msg[msg_len++] = (uint8_t)(tns & 0xFF);
+    msg[msg_len++] = (uint8_t)(tns >> 8);
+
+    if(tag->plc_type == AB_PLC_PLC5) {
+        msg[msg_len++] = (is_write ? AB_EIP_PLC5_RANGE_WRITE_FUNC : AB_EIP_PLC5_RANGE_READ_FUNC);
+        msg[msg_len++] = 0; /* offset */
+        msg[msg_len++] = 0;
+        msg[msg_len++] = (uint8_t)((tag->size / 2) & 0xFF); /* size in 2-byte words */
+        msg[msg_len++] = (uint8_t)((tag->size / 2) >> 8);
+
+        mem_copy(&msg[msg_len], tag->encoded_name, tag->encoded_name_size);
+        msg_len += tag->encoded_name_size;
+
+        if(!is_write) {
+            msg[msg_len++] = (uint8_t)(tag->size); /* bytes for this transfer */
+        }
+    } else {
+        msg[msg_len++] = (is_write ? AB_EIP_SLC_RANGE_WRITE_FUNC : AB_EIP_SLC_RANGE_READ_FUNC);
+        msg[msg_len++] = (uint8_t)(tag->size);
+
+        mem_copy(&msg[msg_len], tag->encoded_name, tag->encoded_name_size);
+        msg_len += tag->encoded_name_size;
+    }
+
+    if(is_write) {
+        mem_copy(&msg[msg_len], tag->data, tag->size);
+        msg_len += tag->size;
+    }
+
+    /* frame it, doubling any DLE in the message. */
+    plc->frame_len = 0;
+    plc->frame[plc->frame_len++] = DF1_DLE;
+    plc->frame[plc->frame_len++] = DF1_STX;
+
+    for(int i=0; i < msg_len; i++) {
+        plc->frame[plc->frame_len++] = msg[i];
+
+        if(msg[i] == DF1_DLE) {
+            plc->frame[plc->frame_len++] = DF1_DLE;
+        }
+    }
+
+    plc->frame[plc->frame_len++] = DF1_DLE;
+    plc->frame[plc->frame_len++] = DF1_ETX;
+    plc->frame_check_start = plc->frame_len;
+
+    /* the checksum is not stuffed. */
+    if(plc->use_bcc) {
+        plc->frame[plc->frame_len++] = pccc_calculate_bcc(msg, msg_len);
+    } else {
+        crc = pccc_update_crc16(pccc_calculate_crc16(msg, msg_len), &etx, 1);
+        plc->frame[plc->frame_len++] = (uint8_t)(crc & 0xFF);
+        plc->frame[plc->frame_len++] = (uint8_t)(crc >> 8);
+    }
+
+    pdebug(DEBUG_DETAIL, "Sending %s with TNS %u in a %d byte frame.", (is_write ? "write" : "read"), (unsigned int)tns, plc->frame_len);
+    pdebug_dump_bytes(DEBUG_SPEW, plc->frame, plc->frame_len);
+
+    plc->frame_sent = 0;
+    plc->frame_in_pair = 0;
+    plc->frame_waiting_ack = 1;
+    plc->frame_tns = tns;
+    plc->frame_naks = 0;
+    plc->frame_enqs = 0;
+    plc->frame_ack_deadline = 0;
+
+    spin_block(&tag->tag_lock) {
+        tag->flags._busy = 1;
+        tag->tns = tns;
+    }
+
+    tag->reply_deadline = time_ms() + DF1_REPLY_TIMEOUT + ((int64_t)plc->frame_len * 10000) / plc->baud_rate;
+
+    plc->num_in_flight++;
+    metrics_set(plc->metrics, METRIC_IN_FLIGHT, plc->num_in_flight);
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/* DST SRC CMD STS TNS(2) [EXT STS] data */
+void complete_tag(df1_plc_p plc, df1_tag_p tag, uint8_t *msg, int msg_len)
+{
+    int rc = PLCTAG_STATUS_OK;
+    int is_read = 0;
+    uint8_t *data = msg + DF1_HEADER_SIZE;
+    int data_size = msg_len - DF1_HEADER_SIZE;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    plc->num_in_flight--;
+    metrics_set(plc->metrics, METRIC_IN_FLIGHT, plc->num_in_flight);
+
+    spin_block(&tag->tag_lock) {
+        is_read = tag->flags._read;
+    }
+
+    if(msg[3] != 0) {
+        if(msg[3] == 0xF0 && msg_len <= DF1_HEADER_SIZE) {
+            pdebug(DEBUG_WARN, "PCCC command failed with an extended status that is missing!");
+        } else {
+            pdebug(DEBUG_WARN, "PCCC command failed, response code: %d - %s", (int)(unsigned int)msg[3], pccc_decode_error(&msg[3]));
+        }
+
+        rc = PLCTAG_ERR_REMOTE_ERR;
+    } else if(is_read) {
+        if(data_size != tag->size) {
+            pdebug(DEBUG_WARN, "Expected %d bytes but got %d bytes!", tag->size, data_size);
+            rc = (data_size > tag->size ? PLCTAG_ERR_TOO_LARGE : PLCTAG_ERR_TOO_SMALL);
+        } else {
+            plc_tag_generic_data_write_begin((plc_tag_p)tag);
+            mem_copy(tag->data, data, data_size);
+            plc_tag_generic_data_write_end((plc_tag_p)tag);
+        }
+    }
+
+    finish_tag(tag, rc);
+
+    pdebug(DEBUG_DETAIL, "Done.");
+}
+
+
+
+void finish_tag(df1_tag_p tag, int rc)
+{
+    spin_block(&tag->tag_lock) {
+        if(tag->flags._read) {
+            tag->read_complete = 1;
+        } else if(tag->flags._write) {
+            tag->write_complete = 1;
+        }
+
+        tag->flags._read = 0;
+        tag->flags._write = 0;
+        tag->flags._busy = 0;
+        tag->tns = 0;
+        tag->status = (int8_t)rc;
+    }
+
+    /* wake up anything waiting on the operation. */
+    plc_tag_generic_wake_tag(tag->tag_id);
+}
+
+
+
+
+/****** Tag Control Functions ******/
+
+int df1_abort(plc_tag_p p_tag)
+{
+    df1_tag_p tag = (df1_tag_p)p_tag;
+
+    if(!tag) {
+        pdebug(DEBUG_WARN, "Null tag pointer!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    spin_block(&tag->tag_lock) {
+        tag->flags._abort = 1;
+    }
+
+    wake_plc(tag->plc);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+int df1_read_start(plc_tag_p p_tag)
+{
+    df1_tag_p tag = (df1_tag_p)p_tag;
+    int op_in_flight = 0;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    if(!tag) {
+        pdebug(DEBUG_WARN, "Null tag pointer!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    spin_block(&tag->tag_lock) {
+        if(tag->flags._abort || tag->flags._read || tag->flags._write) {
+            op_in_flight = 1;
+        } else {
+            tag->status = PLCTAG_STATUS_OK;
+            tag->flags._read = 1;
+        }
+    }
+
+    if(op_in_flight) {
+        pdebug(DEBUG_WARN, "Operation in progress!");
+        return PLCTAG_ERR_BUSY;
+    }
+
+    wake_plc(tag->plc);
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return PLCTAG_STATUS_PENDING;
+}
+
+
+
+int df1_tag_status(plc_tag_p p_tag)
+{
+    df1_tag_p tag = (df1_tag_p)p_tag;
+    int op_in_flight = 0;
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    if(!tag) {
+        pdebug(DEBUG_WARN, "Null tag pointer!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(tag->status != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_SPEW, "Status not OK, returning %s.", plc_tag_decode_error(tag->status));
+        return tag->status;
+    }
+
+    spin_block(&tag->tag_lock) {
+        op_in_flight = (tag->flags._abort || tag->flags._read || tag->flags._write);
+    }
+
+    if(op_in_flight) {
+        pdebug(DEBUG_SPEW, "Operation in progress, returning PLCTAG_STATUS_PENDING.");
+        return PLCTAG_STATUS_PENDING;
+    }
+
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+/* not used. */
+int df1_tickler(plc_tag_p p_tag)
+{
+    (void)p_tag;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+int df1_write_start(plc_tag_p p_tag)
+{
+    df1_tag_p tag = (df1_tag_p)p_tag;
+    int op_in_flight = 0;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    if(!tag) {
+        pdebug(DEBUG_WARN, "Null tag pointer!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    spin_block(&tag->tag_lock) {
+        if(tag->flags._abort || tag->flags._read || tag->flags._write) {
+            op_in_flight = 1;
+        } else {
+            tag->status = PLCTAG_STATUS_OK;
+            tag->flags._write = 1;
+        }
+    }
+
+    if(op_in_flight) {
+        pdebug(DEBUG_WARN, "Operation in progress!");
+        return PLCTAG_ERR_BUSY;
+    }
+
+    wake_plc(tag->plc);
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return PLCTAG_STATUS_PENDING;
+}
+
+
+/****** Data Accessor Functions ******/
+
+int df1_get_int_attrib(plc_tag_p raw_tag, const char *attrib_name, int default_value)
+{
+    int res = default_value;
+    df1_tag_p tag = (df1_tag_p)raw_tag;
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    tag->status = PLCTAG_STATUS_OK;
+
+    /* match the attribute. */
+    if(str_cmp_i(attrib_name, "elem_size") == 0) {
+        res = tag->elem_size;
+    } else if(str_cmp_i(attrib_name, "elem_count") == 0) {
+        res = tag->elem_count;
+    } else {
+        pdebug(DEBUG_WARN, "Attribute \"%s\" is not supported.", attrib_name);
+        tag->status = PLCTAG_ERR_UNSUPPORTED;
+    }
+
+    return res;
+}
+
+
+int df1_set_int_attrib(plc_tag_p raw_tag, const char *attrib_name, int new_value)
+{
+    (void)new_value;
+
+    pdebug(DEBUG_WARN, "Attribute \"%s\" is unsupported!", attrib_name);
+
+    raw_tag->status = PLCTAG_ERR_UNSUPPORTED;
+
+    return PLCTAG_ERR_UNSUPPORTED;
+}
+
+
+
+
+
+/****** Library level functions. *******/
+
+void df1_teardown(void)
+{
+    pdebug(DEBUG_INFO, "Starting.");
+
+    pdebug(DEBUG_DETAIL, "Destroying DF1 mutex.");
+    if(df1_mutex) {
+        mutex_destroy(&df1_mutex);
+        df1_mutex = NULL;
+    }
+
+    pdebug(DEBUG_INFO, "Done.");
+}
+
+
+
+int df1_init(void)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    pdebug(DEBUG_DETAIL, "Setting up mutex.");
+    if(!df1_mutex) {
+        rc = mutex_create(&df1_mutex);
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Error %s creating mutex!", plc_tag_decode_error(rc));
+            return rc;
+        }
+    }
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return rc;
+}
@@ -41,12 +41,18 @@
 #include <ab/tag.h>
 #include <ab/session.h>
 #include <ab/eip_cip.h>
+#include <ab/eip_cip_udt.h>
 #include <ab/error_codes.h>
+#include <ab/meta_cache.h>
 #include <util/attr.h>
 #include <util/debug.h>
 #include <util/vector.h>
 
 
+/* smallest write fragment worth fitting into the room left in a packet. */
+#define WRITE_MIN_PACK_FRAGMENT (256)
+
+
 /* tag listing packet format is as follows for controller tags:
 
 CIP Tag Info command
@@ -129,14 +135,26 @@ START_PACK typedef struct {
 
 
 static int build_read_request_connected(ab_tag_p tag, int byte_offset);
+static int build_read_fragments_connected(ab_tag_p tag);
 static int build_tag_list_request_connected(ab_tag_p tag);
+static int resolve_symbol(ab_tag_p tag);
+static int use_symbol_instance_id(ab_tag_p tag, uint32_t instance_id);
+static void drop_symbol_instance_id(ab_tag_p tag);
+static int symbol_name_matches(const uint8_t *name, int name_len, const uint8_t *other, int other_len);
+static void take_type_info(ab_tag_p tag, uint8_t *data, int type_length);
+static void drop_cached_type(ab_tag_p tag);
 static int build_read_request_unconnected(ab_tag_p tag, int byte_offset);
 static int build_write_request_connected(ab_tag_p tag, int byte_offset);
 static int build_write_request_unconnected(ab_tag_p tag, int byte_offset);
 static int build_write_bit_request_connected(ab_tag_p tag);
 static int build_write_bit_request_unconnected(ab_tag_p tag);
 static int check_read_status_connected(ab_tag_p tag);
+static int check_read_fragments_status_connected(ab_tag_p tag);
 static int check_read_tag_list_status_connected(ab_tag_p tag);
+static int tag_list_entry_wanted(ab_tag_p tag, tag_list_entry *entry);
+static int tag_list_build_index(ab_tag_p tag);
+static int check_symbol_list_status_connected(ab_tag_p tag);
+static int check_udt_template_status_connected(ab_tag_p tag);
 static int check_read_status_unconnected(ab_tag_p tag);
 static int check_write_status_connected(ab_tag_p tag);
 static int check_write_status_unconnected(ab_tag_p tag);
@@ -145,6 +163,17 @@ static int calculate_write_data_per_packet(ab_tag_p tag);
 static int tag_read_start(ab_tag_p tag);
 static int tag_tickler(ab_tag_p tag);
 static int tag_write_start(ab_tag_p tag);
+static int tag_set_range(plc_tag_p p_tag, int elem_offset, int elem_count);
+static uint16_t request_elem_count(ab_tag_p tag);
+static void take_dirty_range(ab_tag_p tag);
+static void restore_dirty_range(ab_tag_p tag);
+static int write_next_dirty_range(ab_tag_p tag);
+static int pack_write_fragment_size(ab_tag_p tag, int write_size);
+static void abandon_bit_word_read(ab_tag_p tag);
+static int check_failover(ab_tag_p tag);
+static void swap_sessions(ab_tag_p tag);
+static void arm_hedge(ab_tag_p tag);
+static void check_hedge(ab_tag_p tag);
 
 /* define the exported vtable for this tag type. */
 struct tag_vtable_t eip_cip_vtable = {
@@ -156,7 +185,13 @@ struct tag_vtable_t eip_cip_vtable = {
 
     /* attribute accessors */
     ab_get_int_attrib,
-    ab_set_int_attrib
+    ab_set_int_attrib,
+
+    /* UDT member lookup */
+    eip_cip_udt_get_member_offset,
+
+    /* element ranges */
+    tag_set_range
 };
 
 /* default string types used for ControlLogix-class PLCs. */
@@ -215,10 +250,51 @@ int tag_tickler(ab_tag_p tag)
 
     pdebug(DEBUG_SPEW,"Starting.");
 
+    ab_tag_check_breaker(tag);
+
+    if(tag->bit_wait) {
+        plc_tag_generic_data_write_begin((plc_tag_p)tag);
+        rc = session_bit_word_check(tag->session, tag->bit_word, tag->bit_word_seq, tag->data, tag->size);
+        plc_tag_generic_data_write_end((plc_tag_p)tag);
+
+        if(rc == PLCTAG_STATUS_PENDING) {
+            pdebug(DEBUG_SPEW, "Done.  Waiting on the element read of another bit tag.");
+            return rc;
+        }
+
+        tag->bit_wait = 0;
+        tag->read_in_progress = 0;
+
+        /* the read we waited on went away, do our own. */
+        if(rc == PLCTAG_ERR_NOT_FOUND) {
+            rc = tag_read_start(tag);
+            if(rc == PLCTAG_STATUS_PENDING) {
+                return rc;
+            }
+        }
+
+        tag->status = (int8_t)rc;
+        tag->read_complete = 1;
+
+        pdebug(DEBUG_SPEW, "Done.  Got the element from another bit tag.");
+
+        return rc;
+    }
+
     if (tag->read_in_progress) {
+        if(tag->standby_session && tag->hedge_reads) {
+            check_hedge(tag);
+        }
+
         if(tag->use_connected_msg) {
             if(tag->tag_list) {
                 rc = check_read_tag_list_status_connected(tag);
+            } else if(tag->resolving_symbol) {
+                rc = check_symbol_list_status_connected(tag);
+            } else if(tag->udt_fetch) {
+                rc = check_udt_template_status_connected(tag);
+            } else if(tag->frag_reqs) {
+                rc = check_read_fragments_status_connected(tag);
             } else {
                 rc = check_read_status_connected(tag);
             }
@@ -226,11 +302,21 @@ int tag_tickler(ab_tag_p tag)
             rc = check_read_status_unconnected(tag);
         }
 
+        /* the breaker failed the read, it never got to a PLC so try the standby. */
+        if(rc == PLCTAG_ERR_UNAVAILABLE && !tag->read_in_progress && !tag->bit_lead && check_failover(tag)) {
+            rc = tag_read_start(tag);
+        }
+
         tag->status = (int8_t)rc;
 
         /* if the operation completed, make a note so that the callback will be called. */
         if(!tag->read_in_progress) {
             tag->read_complete = 1;
+
+            if(tag->bit_lead) {
+                session_bit_word_done(tag->session, tag->bit_word, tag->tag_id, rc, tag->data, tag->size);
+                tag->bit_lead = 0;
+            }
         }
 
         pdebug(DEBUG_SPEW,"Done.  Read in progress.");
@@ -286,13 +372,56 @@ int tag_read_start(ab_tag_p tag)
         return PLCTAG_ERR_BUSY;
     }
 
+    /* the remaining pieces of a read come from the same PLC. */
+    if(tag->offset == 0) {
+        check_failover(tag);
+    }
+
     /* mark the tag read in progress */
     tag->read_in_progress = 1;
 
+    /* another bit tag on the element may already be reading it. */
+    if(tag->bit_word && !tag->first_read && !tag->range_end) {
+        if(session_bit_word_join(tag->session, tag->bit_word, tag->tag_id, &tag->bit_word_seq) == PLCTAG_STATUS_PENDING) {
+            tag->bit_wait = 1;
+            pdebug(DEBUG_INFO, "Done.  Waiting on the read of another bit tag.");
+            return PLCTAG_STATUS_PENDING;
+        }
+
+        tag->bit_lead = 1;
+    }
+
+    /* look up the symbol instance ID and the UDT templates before the first request that needs them. */
+    if((tag->use_instance_id && !tag->symbolic_name) || (tag->udt_templates && !tag->udt_resolved)) {
+        rc = resolve_symbol(tag);
+        if(rc == PLCTAG_STATUS_PENDING) {
+            pdebug(DEBUG_INFO, "Done.  Looking up the symbol before the read.");
+            return rc;
+        }
+
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Unable to look up the symbol!");
+            tag->read_in_progress = 0;
+            abandon_bit_word_read(tag);
+            return rc;
+        }
+    }
+
+    /* a ranged read starts at its first element and keeps the rest of the data. */
+    if(tag->range_end && tag->offset == 0) {
+        tag->offset = tag->range_start;
+
+        if(tag->is_double_buffered && tag->back_data) {
+            mem_copy(tag->back_data, tag->data, tag->size);
+        }
+    }
+
     /* i is the index of the first new request */
     if(tag->use_connected_msg) {
         if(tag->tag_list) {
             rc = build_tag_list_request_connected(tag);
+        } else if(tag->concurrent_fragments && !tag->first_read && tag->offset == 0 && !tag->range_end && tag->plc_type != AB_PLC_OMRON_NJNX) {
+            rc = build_read_fragments_connected(tag);
         } else {
             rc = build_read_request_connected(tag, tag->offset);
         }
@@ -304,16 +433,180 @@ int tag_read_start(ab_tag_p tag)
         pdebug(DEBUG_WARN,"Unable to build read request!");
 
         tag->read_in_progress = 0;
+        abandon_bit_word_read(tag);
 
         return rc;
     }
 
+    if(tag->standby_session && tag->hedge_reads) {
+        arm_hedge(tag);
+    }
+
     pdebug(DEBUG_INFO, "Done.");
 
     return PLCTAG_STATUS_PENDING;
 }
 
 
+/*
+ * check_failover
+ *
+ * Between operations, move to the standby session if the breaker of the
+ * one in use is open and the standby's is not.
+ */
+
+int check_failover(ab_tag_p tag)
+{
+    if(!tag->standby_session) {
+        return 0;
+    }
+
+    if(SESSION_BREAKER_IS_OPEN(tag->session->breaker_state) && !SESSION_BREAKER_IS_OPEN(tag->standby_session->breaker_state)) {
+        pdebug(DEBUG_WARN, "Circuit breaker open on the gateway in use, failing over to the standby.");
+        swap_sessions(tag);
+        tag->failovers++;
+        return 1;
+    }
+
+    return 0;
+}
+
+
+
+void swap_sessions(ab_tag_p tag)
+{
+    ab_session_p session = tag->session;
+
+    tag->session = tag->standby_session;
+    tag->standby_session = session;
+}
+
+
+
+/*
+ * arm_hedge
+ *
+ * A plain read that takes longer than reads usually do gets a duplicate on
+ * the standby.  The usual time is the read latency p99 unless the delay is
+ * set with hedge_delay_ms.
+ */
+
+void arm_hedge(ab_tag_p tag)
+{
+    int delay_ms = tag->hedge_delay_ms;
+
+    tag->hedge_at_ms = 0;
+
+    /* fragments, listings and symbol lookups are not hedged. */
+    if(!tag->req || tag->frag_reqs || tag->resolving_symbol || tag->udt_fetch || tag->pre_write_read) {
+        return;
+    }
+
+    if(delay_ms == 0) {
+        int p99_us = plc_tag_generic_read_latency_us((plc_tag_p)tag, 99);
+
+        delay_ms = (p99_us > 0 ? (p99_us + 999) / 1000 : AB_HEDGE_DEFAULT_DELAY_MS);
+
+        if(delay_ms < AB_HEDGE_MIN_DELAY_MS) {
+            delay_ms = AB_HEDGE_MIN_DELAY_MS;
+        }
+    }
+
+    tag->hedge_at_ms = time_ms() + delay_ms;
+
+    plc_tag_tickler_wake_later((plc_tag_p)tag, delay_ms);
+}
+
+
+
+/*
+ * check_hedge
+ *
+ * Send the duplicate read when its time comes and, once one is out, keep
+ * whichever answers first.  If the standby wins, the tag fails over to it
+ * so that the rest of the read goes there too.
+ */
+
+void check_hedge(ab_tag_p tag)
+{
+    int primary_done = 0;
+    int hedge_done = 0;
+
+    if(!tag->req) {
+        return;
+    }
+
+    spin_block(&tag->req->lock) {
+        primary_done = tag->req->resp_received;
+    }
+
+    if(!tag->hedge_req) {
+        ab_request_p primary = tag->req;
+        int rc = PLCTAG_STATUS_OK;
+
+        if(primary_done || !tag->hedge_at_ms || time_ms() < tag->hedge_at_ms || SESSION_BREAKER_IS_OPEN(tag->standby_session->breaker_state)) {
+            return;
+        }
+
+        tag->hedge_at_ms = 0;
+
+        pdebug(DEBUG_DETAIL, "Read is slow, sending a duplicate to the standby gateway.");
+
+        /* build the same read on the standby session. */
+        tag->req = NULL;
+        swap_sessions(tag);
+
+        if(tag->use_connected_msg) {
+            rc = build_read_request_connected(tag, tag->offset);
+        } else {
+            rc = build_read_request_unconnected(tag, tag->offset);
+        }
+
+        tag->hedge_req = (rc == PLCTAG_STATUS_OK ? tag->req : NULL);
+        tag->req = primary;
+        swap_sessions(tag);
+
+        return;
+    }
+
+    spin_block(&tag->hedge_req->lock) {
+        hedge_done = tag->hedge_req->resp_received;
+    }
+
+    if(primary_done) {
+        spin_block(&tag->hedge_req->lock) {
+            tag->hedge_req->abort_request = 1;
+        }
+
+        tag->hedge_req = rc_dec(tag->hedge_req);
+    } else if(hedge_done) {
+        pdebug(DEBUG_DETAIL, "The standby gateway answered first, failing over to it.");
+
+        spin_block(&tag->req->lock) {
+            tag->req->abort_request = 1;
+        }
+
+        rc_dec(tag->req);
+        tag->req = tag->hedge_req;
+        tag->hedge_req = NULL;
+
+        swap_sessions(tag);
+        tag->failovers++;
+    }
+}
+
+
+
+/* our read of a shared element did not start, the waiting bit tags must read on their own. */
+void abandon_bit_word_read(ab_tag_p tag)
+{
+    if(tag->bit_lead) {
+        session_bit_word_leave(tag->session, tag->bit_word, tag->tag_id);
+        tag->bit_lead = 0;
+    }
+}
+
+
 
 
 /*
@@ -343,6 +636,10 @@ int tag_write_start(ab_tag_p tag)
         return PLCTAG_ERR_BUSY;
     }
 
+    if(tag->offset == 0) {
+        check_failover(tag);
+    }
+
     /* the write is now in flight */
     tag->write_in_progress = 1;
 
@@ -369,6 +666,15 @@ int tag_write_start(ab_tag_p tag)
         return rc;
     }
 
+    /* only send the bytes the setters changed. */
+    if(!tag->range_end && tag->offset == 0) {
+        take_dirty_range(tag);
+    }
+
+    if(tag->range_end && tag->offset == 0) {
+        tag->offset = tag->range_start;
+    }
+
     if(tag->use_connected_msg) {
         rc = build_write_request_connected(tag, tag->offset);
     } else {
@@ -378,6 +684,8 @@ int tag_write_start(ab_tag_p tag)
     if (rc != PLCTAG_STATUS_OK) {
         pdebug(DEBUG_WARN,"Unable to build write request!");
         tag->write_in_progress = 0;
+        restore_dirty_range(tag);
+        tag->range_end = 0;
 
         return rc;
     }
@@ -389,6 +697,170 @@ int tag_write_start(ab_tag_p tag)
 
 
 
+/*
+ * tag_set_range
+ *
+ * Limit the next read or write to elem_count elements starting at
+ * elem_offset.  The fragmented services give the element count and byte
+ * offset, so the request counts elements from the start of the tag and
+ * begins at the byte offset of the range.  The PLC only sends or takes
+ * the span between the two.
+ */
+
+int tag_set_range(plc_tag_p p_tag, int elem_offset, int elem_count)
+{
+    ab_tag_p tag = (ab_tag_p)p_tag;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    if(elem_count == 0) {
+        tag->range_end = 0;
+        pdebug(DEBUG_DETAIL, "Done.  Range cleared.");
+        return PLCTAG_STATUS_OK;
+    }
+
+    if(tag->tag_list || tag->is_bit || tag->plc_type == AB_PLC_OMRON_NJNX) {
+        pdebug(DEBUG_WARN, "Element ranges are not supported for this tag!");
+        return PLCTAG_ERR_UNSUPPORTED;
+    }
+
+    if(tag->first_read || tag->elem_size <= 0) {
+        pdebug(DEBUG_WARN, "The tag must be read once before using element ranges!");
+        return PLCTAG_ERR_NOT_ALLOWED;
+    }
+
+    if(elem_offset < 0 || elem_count < 0 || elem_offset > tag->elem_count - elem_count) {
+        pdebug(DEBUG_WARN, "Element range %d to %d is outside the tag!", elem_offset, elem_offset + elem_count - 1);
+        return PLCTAG_ERR_OUT_OF_BOUNDS;
+    }
+
+    tag->range_start = elem_offset * tag->elem_size;
+    tag->range_end = (elem_offset + elem_count) * tag->elem_size;
+    tag->range_elem_count = elem_offset + elem_count;
+
+    pdebug(DEBUG_DETAIL, "Done.  Next operation covers bytes %d to %d.", tag->range_start, tag->range_end);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/* the element count in read and write requests. */
+uint16_t request_elem_count(ab_tag_p tag)
+{
+    return (uint16_t)(tag->range_end ? tag->range_elem_count : tag->elem_count);
+}
+
+
+
+/*
+ * take_dirty_range
+ *
+ * Turn the next dirty range of the tag into the write range.  Atomic
+ * elements are written whole, structures on 32-bit boundaries.  With no
+ * dirty ranges the whole tag is written as before.
+ */
+
+void take_dirty_range(ab_tag_p tag)
+{
+    int offset = 0;
+    int length = 0;
+    int align = 0;
+
+    if(tag->is_bit || tag->plc_type == AB_PLC_OMRON_NJNX || tag->elem_size <= 0) {
+        return;
+    }
+
+    if(!plc_tag_generic_take_dirty_range((plc_tag_p)tag, &offset, &length)) {
+        return;
+    }
+
+    align = (tag->elem_size <= 8 ? tag->elem_size : 4);
+
+    tag->range_start = (offset / align) * align;
+    tag->range_end = ((offset + length + align - 1) / align) * align;
+
+    if(tag->range_end > tag->size) {
+        tag->range_end = tag->size;
+    }
+
+    tag->range_elem_count = (tag->range_end + tag->elem_size - 1) / tag->elem_size;
+    tag->dirty_range_write = 1;
+
+    pdebug(DEBUG_DETAIL, "Writing dirty bytes %d to %d.", tag->range_start, tag->range_end);
+}
+
+
+
+/*
+ * pack_write_fragment_size
+ *
+ * A full size write fragment always goes out in a packet of its own.  If
+ * the requests already queued leave room at the end of their last packet,
+ * make this fragment just fit there so it goes out with them.  The rest
+ * of the data follows in the next fragments.
+ */
+
+int pack_write_fragment_size(ab_tag_p tag, int write_size)
+{
+    int room = 0;
+
+    if(!tag->allow_packing) {
+        return write_size;
+    }
+
+    room = session_get_pack_room(tag->session)
+           - (session_get_max_payload(tag->session) - tag->write_data_per_packet)  /* request overhead */
+           - 2;                                                                    /* offset in the packet */
+
+    if(room < WRITE_MIN_PACK_FRAGMENT) {
+        return write_size;
+    }
+
+    /* keep the fragments a multiple of 8 bytes, like full ones. */
+    room &= 0xFFFFF8;
+
+    if(room < write_size) {
+        pdebug(DEBUG_DETAIL, "Writing %d bytes to fill a partly full packet.", room);
+        return room;
+    }
+
+    return write_size;
+}
+
+
+
+/* a failed dirty range write goes out with the next write. */
+void restore_dirty_range(ab_tag_p tag)
+{
+    if(tag->dirty_range_write) {
+        plc_tag_generic_add_dirty_range((plc_tag_p)tag, tag->range_start, tag->range_end - tag->range_start);
+        tag->dirty_range_write = 0;
+    }
+}
+
+
+
+/* start writing the next dirty range if there is one. */
+int write_next_dirty_range(ab_tag_p tag)
+{
+    if(!tag->dirty_range_write) {
+        return PLCTAG_STATUS_OK;
+    }
+
+    tag->dirty_range_write = 0;
+
+    if(!plc_tag_generic_has_dirty_ranges((plc_tag_p)tag)) {
+        return PLCTAG_STATUS_OK;
+    }
+
+    pdebug(DEBUG_DETAIL, "Writing the next dirty range.");
+
+    return tag_write_start(tag);
+}
+
+
+
 int build_read_request_connected(ab_tag_p tag, int byte_offset)
 {
     eip_cip_co_req* cip = NULL;
@@ -400,7 +872,7 @@ int build_read_request_connected(ab_tag_p tag, int byte_offset)
     pdebug(DEBUG_INFO, "Starting.");
 
     /* get a request buffer */
-    rc = session_create_request(tag->session, tag->tag_id, &req);
+    rc = session_create_request(tag->session, tag->tag_id, tag->priority, tag->op_deadline, &req);
     if (rc != PLCTAG_STATUS_OK) {
         pdebug(DEBUG_ERROR, "Unable to get new request.  rc=%d", rc);
         return rc;
@@ -438,7 +910,7 @@ int build_read_request_connected(ab_tag_p tag, int byte_offset)
     data += tag->encoded_name_size;
 
     /* add the count of elements to read. */
-    *((uint16_le*)data) = h2le16((uint16_t)(tag->elem_count));
+    *((uint16_le*)data) = h2le16(request_elem_count(tag));
     data += sizeof(uint16_le);
 
     if (read_cmd == AB_EIP_CMD_CIP_READ_FRAG) {
@@ -470,6 +942,13 @@ int build_read_request_connected(ab_tag_p tag, int byte_offset)
 
     req->allow_packing = tag->allow_packing;
 
+    /* decode_read_response_connected() can read packed replies in place. */
+    req->accept_slice = 1;
+
+    /* identical reads from other tags can share this one. */
+    req->allow_merge = 1;
+    req->cache_ms = tag->shared_read_cache_ms;
+
     /* add the request to the session's list. */
     rc = session_add_request(tag->session, req);
 
@@ -488,6 +967,82 @@ int build_read_request_connected(ab_tag_p tag, int byte_offset)
 }
 
 
+/*
+ * build_read_fragments_connected
+ *
+ * Once the tag size is known, queue a fragmented read for every piece of
+ * the tag at once.  The session can then pack and pipeline them instead
+ * of waiting for each reply before asking for the next piece.
+ */
+
+int build_read_fragments_connected(ab_tag_p tag)
+{
+    int rc = PLCTAG_STATUS_OK;
+    int frag_size = 0;
+    int frag_count = 0;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(tag->frag_size > 0) {
+        /* use what the PLC sent back in a previous partial reply. */
+        frag_size = tag->frag_size;
+    } else {
+        /* leave room for the reply header, the type info and some slop. */
+        frag_size = session_get_max_payload(tag->session)
+                    - 4                                 /* reply service, reserved, status and extended status size */
+                    - tag->encoded_type_info_size       /* type info in front of the data */
+                    - 8;                                /* MAGIC fudge factor */
+
+        /* keep the fragment boundaries on element boundaries. */
+        if(tag->elem_size > 0 && tag->elem_size <= frag_size) {
+            frag_size -= frag_size % tag->elem_size;
+        } else {
+            frag_size &= 0xFFFFF8;
+        }
+    }
+
+    if(frag_size <= 0 || tag->size <= frag_size) {
+        pdebug(DEBUG_INFO, "Done.  Tag fits in one fragment.");
+        return build_read_request_connected(tag, tag->offset);
+    }
+
+    frag_count = (tag->size + frag_size - 1) / frag_size;
+
+    tag->frag_reqs = mem_alloc(frag_count * (int)sizeof(ab_request_p));
+    if(!tag->frag_reqs) {
+        pdebug(DEBUG_ERROR, "Unable to allocate fragment request array!");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    tag->frag_size = frag_size;
+
+    /* queue them all before the session thread looks so that they can be packed. */
+    session_hold_requests();
+
+    for(tag->frag_count = 0; tag->frag_count < frag_count; tag->frag_count++) {
+        rc = build_read_request_connected(tag, tag->frag_count * frag_size);
+        if(rc != PLCTAG_STATUS_OK) {
+            break;
+        }
+
+        tag->frag_reqs[tag->frag_count] = tag->req;
+        tag->req = NULL;
+    }
+
+    session_release_requests();
+
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to queue fragment %d of %d!", tag->frag_count, frag_count);
+        ab_tag_abort(tag);
+        return rc;
+    }
+
+    pdebug(DEBUG_INFO, "Done.  Queued %d fragments of %d bytes.", frag_count, frag_size);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
 int build_tag_list_request_connected(ab_tag_p tag)
 {
     eip_cip_co_req* cip = NULL;
@@ -497,11 +1052,12 @@ int build_tag_list_request_connected(ab_tag_p tag)
     uint8_t *data_start = NULL;
     uint8_t *data = NULL;
     uint16_le tmp_u16 = UINT16_LE_INIT(0);
+    int prefix_size = 0;
 
     pdebug(DEBUG_INFO, "Starting.");
 
     /* get a request buffer */
-    rc = session_create_request(tag->session, tag->tag_id, &req);
+    rc = session_create_request(tag->session, tag->tag_id, tag->priority, tag->op_deadline, &req);
     if (rc != PLCTAG_STATUS_OK) {
         pdebug(DEBUG_ERROR, "Unable to get new request.  rc=%d", rc);
         return rc;
@@ -534,14 +1090,17 @@ int build_tag_list_request_connected(ab_tag_p tag)
     *data = AB_EIP_CMD_CIP_LIST_TAGS;
     data++;
 
+    /* a tag looking up its instance ID lists the controller tags, the name is not a program prefix. */
+    prefix_size = (tag->tag_list ? tag->encoded_name_size - 1 : 0);
+
     /* request path size, in 16-bit words */
-    *data = (uint8_t)(3 + ((tag->encoded_name_size-1)/2)); /* size in words of routing header + routing and instance ID. */
+    *data = (uint8_t)(3 + (prefix_size/2)); /* size in words of routing header + routing and instance ID. */
     data++;
 
     /* add in the encoded name, but without the leading word count byte! */
-    if(tag->encoded_name_size > 1) {
-        mem_copy(data, &tag->encoded_name[1], (tag->encoded_name_size-1));
-        data += (tag->encoded_name_size-1);
+    if(prefix_size > 0) {
+        mem_copy(data, &tag->encoded_name[1], prefix_size);
+        data += prefix_size;
     }
 
     /* add in the routing header . */
@@ -624,6 +1183,256 @@ int build_tag_list_request_connected(ab_tag_p tag)
 
 
 
+/*
+ * resolve_symbol
+ *
+ * Controller scope tags can be addressed with the symbol (0x6B) class
+ * and the instance ID instead of the symbolic name.  The request is
+ * shorter and the PLC does not have to look the name up every time.
+ * The IDs come from listing the controller tags and the session keeps
+ * them, so only the first tag looking for an ID pays for the listing.
+ * The listing also gives the symbol type, which is where the UDT
+ * template lookup starts.
+ *
+ * Returns PLCTAG_STATUS_PENDING if a listing or template request was
+ * queued.  Tags that cannot be found fall back to the name and do not
+ * get member lookup.
+ */
+
+int resolve_symbol(ab_tag_p tag)
+{
+    int rc = PLCTAG_STATUS_OK;
+    uint8_t *encoded_name = (tag->symbolic_name ? tag->symbolic_name : tag->encoded_name);
+    int encoded_name_size = (tag->symbolic_name ? tag->symbolic_name_size : tag->encoded_name_size);
+    uint8_t *name = NULL;
+    int name_len = 0;
+    uint32_t instance_id = 0;
+    uint16_t symbol_type = 0;
+    uint32_t next_id = 0;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    /* only a leading plain symbolic segment can be replaced, program tags are not in the controller list. */
+    if(encoded_name_size < 3 || encoded_name[1] != 0x91) {
+        pdebug(DEBUG_DETAIL, "Done.  Tag name does not start with a symbol.");
+        tag->use_instance_id = 0;
+        tag->udt_templates = 0;
+        return PLCTAG_STATUS_OK;
+    }
+
+    name_len = encoded_name[2];
+    name = &encoded_name[3];
+
+    if(name_len >= 8 && symbol_name_matches(name, 8, (const uint8_t *)"Program:", 8)) {
+        pdebug(DEBUG_DETAIL, "Done.  Program tags are addressed by name.");
+        tag->use_instance_id = 0;
+        tag->udt_templates = 0;
+        return PLCTAG_STATUS_OK;
+    }
+
+    rc = session_find_symbol_id(tag->session, name, name_len, &instance_id, &symbol_type, &next_id);
+    if(rc == PLCTAG_STATUS_PENDING) {
+        tag->resolving_symbol = 1;
+        tag->next_id = next_id;
+
+        rc = build_tag_list_request_connected(tag);
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Unable to build tag listing request, error %s!", plc_tag_decode_error(rc));
+            tag->resolving_symbol = 0;
+            tag->next_id = 0;
+            return rc;
+        }
+
+        pdebug(DEBUG_DETAIL, "Done.  Listing controller tags from instance %u.", next_id);
+
+        return PLCTAG_STATUS_PENDING;
+    }
+
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Tag is not in the controller tag listing, using the tag name.");
+        tag->use_instance_id = 0;
+        tag->udt_templates = 0;
+        return PLCTAG_STATUS_OK;
+    }
+
+    if(tag->use_instance_id && !tag->symbolic_name && use_symbol_instance_id(tag, instance_id) != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "No instance ID for the tag, using the tag name.");
+        tag->use_instance_id = 0;
+    }
+
+    tag->symbol_type = symbol_type;
+
+    if(tag->udt_templates && !tag->udt_resolved) {
+        rc = eip_cip_udt_resolve(tag);
+    }
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return rc;
+}
+
+
+/*
+ * use_symbol_instance_id
+ *
+ * Replace the leading symbolic segment of the encoded name with a
+ * logical segment for the symbol instance.  The member and element
+ * segments that follow are unchanged.  The old name is kept in case
+ * the ID goes stale.
+ */
+
+int use_symbol_instance_id(ab_tag_p tag, uint32_t instance_id)
+{
+    uint8_t new_name[MAX_TAG_NAME];
+    int new_size = 1;
+    int name_len = tag->encoded_name[2];
+    int segment_size = 2 + name_len + (name_len & 0x01);
+    int rest_size = tag->encoded_name_size - 1 - segment_size;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    new_name[new_size++] = 0x20;    /* class segment */
+    new_name[new_size++] = 0x6B;    /* symbol class */
+
+    if(instance_id <= 0xFF) {
+        new_name[new_size++] = 0x24;    /* 8-bit instance */
+        new_name[new_size++] = (uint8_t)instance_id;
+    } else if(instance_id <= 0xFFFF) {
+        new_name[new_size++] = 0x25;    /* 16-bit instance */
+        new_name[new_size++] = 0x00;    /* padding */
+        new_name[new_size++] = (uint8_t)(instance_id & 0xFF);
+        new_name[new_size++] = (uint8_t)((instance_id >> 8) & 0xFF);
+    } else {
+        new_name[new_size++] = 0x26;    /* 32-bit instance */
+        new_name[new_size++] = 0x00;    /* padding */
+        new_name[new_size++] = (uint8_t)(instance_id & 0xFF);
+        new_name[new_size++] = (uint8_t)((instance_id >> 8) & 0xFF);
+        new_name[new_size++] = (uint8_t)((instance_id >> 16) & 0xFF);
+        new_name[new_size++] = (uint8_t)((instance_id >> 24) & 0xFF);
+    }
+
+    if(rest_size < 0 || new_size + rest_size > MAX_TAG_NAME) {
+        pdebug(DEBUG_WARN, "Encoded name does not fit with the instance ID!");
+        return PLCTAG_ERR_TOO_LARGE;
+    }
+
+    tag->symbolic_name = mem_alloc(tag->encoded_name_size);
+    if(!tag->symbolic_name) {
+        pdebug(DEBUG_WARN, "Unable to allocate copy of the encoded name!");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    mem_copy(tag->symbolic_name, tag->encoded_name, tag->encoded_name_size);
+    tag->symbolic_name_size = tag->encoded_name_size;
+
+    mem_copy(&new_name[new_size], &tag->encoded_name[1 + segment_size], rest_size);
+    new_size += rest_size;
+
+    /* set the word count. */
+    new_name[0] = (uint8_t)((new_size - 1)/2);
+
+    mem_copy(tag->encoded_name, new_name, new_size);
+    tag->encoded_name_size = new_size;
+
+    pdebug(DEBUG_DETAIL, "Done.  Using symbol instance %u.", instance_id);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+/*
+ * drop_symbol_instance_id
+ *
+ * The PLC did not know the instance, probably because the program
+ * was downloaded again.  Go back to the name and look up the ID again on
+ * the next read.
+ */
+
+void drop_symbol_instance_id(ab_tag_p tag)
+{
+    if(!tag->symbolic_name) {
+        return;
+    }
+
+    pdebug(DEBUG_INFO, "Symbol instance ID is stale, going back to the tag name.");
+
+    mem_copy(tag->encoded_name, tag->symbolic_name, tag->symbolic_name_size);
+    tag->encoded_name_size = tag->symbolic_name_size;
+
+    mem_free(tag->symbolic_name);
+    tag->symbolic_name = NULL;
+    tag->symbolic_name_size = 0;
+
+    session_clear_symbol_ids(tag->session);
+    meta_cache_clear_symbols(tag->session);
+}
+
+
+/*
+ * take_type_info
+ *
+ * Keep the type from the first read for the writes.  A type that came
+ * from the metadata cache is checked against the first response.
+ */
+
+void take_type_info(ab_tag_p tag, uint8_t *data, int type_length)
+{
+    if(tag->type_from_cache) {
+        if(mem_cmp(tag->encoded_type_info, tag->encoded_type_info_size, data, type_length) != 0) {
+            pdebug(DEBUG_INFO, "Cached tag type is stale, using the type from the read.");
+            meta_cache_forget_tag_type(tag);
+            tag->encoded_type_info_size = 0;
+        }
+
+        tag->type_from_cache = 0;
+    }
+
+    if(tag->encoded_type_info_size == 0) {
+        tag->encoded_type_info_size = type_length;
+        mem_copy(tag->encoded_type_info, data, type_length);
+    }
+}
+
+
+/*
+ * drop_cached_type
+ *
+ * The PLC refused a write with a type from the metadata cache.  Read the
+ * tag again before the next write.
+ */
+
+void drop_cached_type(ab_tag_p tag)
+{
+    if(!tag->type_from_cache) {
+        return;
+    }
+
+    pdebug(DEBUG_INFO, "Write with the cached tag type failed, reading the type again.");
+
+    meta_cache_forget_tag_type(tag);
+    tag->encoded_type_info_size = 0;
+    tag->first_read = 1;
+}
+
+
+/* Logix symbol names are not case sensitive. */
+int symbol_name_matches(const uint8_t *name, int name_len, const uint8_t *other, int other_len)
+{
+    if(name_len != other_len) {
+        return 0;
+    }
+
+    for(int i=0; i < name_len; i++) {
+        if(tolower(name[i]) != tolower(other[i])) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+
+
 int build_read_request_unconnected(ab_tag_p tag, int byte_offset)
 {
     eip_cip_uc_req* cip;
@@ -636,7 +1445,7 @@ int build_read_request_unconnected(ab_tag_p tag, int byte_offset)
     pdebug(DEBUG_INFO, "Starting.");
 
     /* get a request buffer */
-    rc = session_create_request(tag->session, tag->tag_id, &req);
+    rc = session_create_request(tag->session, tag->tag_id, tag->priority, tag->op_deadline, &req);
 
     if (rc != PLCTAG_STATUS_OK) {
         pdebug(DEBUG_ERROR, "Unable to get new request.  rc=%d", rc);
@@ -676,7 +1485,7 @@ int build_read_request_unconnected(ab_tag_p tag, int byte_offset)
 
     /* add the count of elements to read. */
     /* FIXME BUG - this may not work on some processors! */
-    *((uint16_le*)data) = h2le16((uint16_t)(tag->elem_count));
+    *((uint16_le*)data) = h2le16(request_elem_count(tag));
     data += sizeof(uint16_le);
 
     /* add the byte offset for this request */
@@ -741,6 +1550,10 @@ int build_read_request_unconnected(ab_tag_p tag, int byte_offset)
     /* allow packing if the tag allows it. */
     req->allow_packing = tag->allow_packing;
 
+    /* identical reads from other tags can share this one. */
+    req->allow_merge = 1;
+    req->cache_ms = tag->shared_read_cache_ms;
+
     /* add the request to the session's list. */
     rc = session_add_request(tag->session, req);
 
@@ -770,7 +1583,7 @@ int build_write_bit_request_connected(ab_tag_p tag)
     pdebug(DEBUG_INFO, "Starting.");
 
     /* get a request buffer */
-    rc = session_create_request(tag->session, tag->tag_id, &req);
+    rc = session_create_request(tag->session, tag->tag_id, tag->priority, tag->op_deadline, &req);
     if (rc != PLCTAG_STATUS_OK) {
         pdebug(DEBUG_ERROR, "Unable to get new request.  rc=%d", rc);
         return rc;
@@ -817,6 +1630,10 @@ int build_write_bit_request_connected(ab_tag_p tag)
     *data = (uint8_t)(tag->elem_size & 0xFF); data++;
     *data = (uint8_t)((tag->elem_size >> 8) & 0xFF); data++;
 
+    /* the session can fold other bit writes to this element into the masks. */
+    req->rmw_mask_offset = (int)(data - req->data);
+    req->rmw_mask_size = tag->elem_size;
+
     /* write the OR mask */
     for(i=0; i < tag->elem_size; i++) {
         if((tag->bit/8) == i) {
@@ -891,6 +1708,9 @@ int build_write_bit_request_connected(ab_tag_p tag)
     /* allow packing if the tag allows it. */
     req->allow_packing = tag->allow_packing;
 
+    /* reads cached before this are stale. */
+    req->flush_read_cache = 1;
+
     /* add the request to the session's list. */
     rc = session_add_request(tag->session, req);
 
@@ -924,7 +1744,7 @@ int build_write_bit_request_unconnected(ab_tag_p tag)
     pdebug(DEBUG_INFO, "Starting.");
 
     /* get a request buffer */
-    rc = session_create_request(tag->session, tag->tag_id, &req);
+    rc = session_create_request(tag->session, tag->tag_id, tag->priority, tag->op_deadline, &req);
     if (rc != PLCTAG_STATUS_OK) {
         pdebug(DEBUG_ERROR, "Unable to get new request.  rc=%d", rc);
         return rc;
@@ -973,6 +1793,10 @@ int build_write_bit_request_unconnected(ab_tag_p tag)
     *data = (uint8_t)(tag->elem_size & 0xFF); data++;
     *data = (uint8_t)((tag->elem_size >> 8) & 0xFF); data++;
 
+    /* the session can fold other bit writes to this element into the masks. */
+    req->rmw_mask_offset = (int)(data - req->data);
+    req->rmw_mask_size = tag->elem_size;
+
     /* write the OR mask */
     for(i=0; i < tag->elem_size; i++) {
         if((tag->bit/8) == i) {
@@ -1079,6 +1903,9 @@ int build_write_bit_request_unconnected(ab_tag_p tag)
     /* allow packing if the tag allows it. */
     req->allow_packing = tag->allow_packing;
 
+    /* reads cached before this are stale. */
+    req->flush_read_cache = 1;
+
     /* add the request to the session's list. */
     rc = session_add_request(tag->session, req);
 
@@ -1118,7 +1945,7 @@ int build_write_request_connected(ab_tag_p tag, int byte_offset)
     }
 
     /* get a request buffer */
-    rc = session_create_request(tag->session, tag->tag_id, &req);
+    rc = session_create_request(tag->session, tag->tag_id, tag->priority, tag->op_deadline, &req);
     if (rc != PLCTAG_STATUS_OK) {
         pdebug(DEBUG_ERROR, "Unable to get new request.  rc=%d", rc);
         return rc;
@@ -1130,7 +1957,8 @@ int build_write_request_connected(ab_tag_p tag, int byte_offset)
         return rc;
     }
 
-    if(tag->write_data_per_packet < tag->size) {
+    /* a range is written with the fragmented service so that it can give the byte offset. */
+    if(tag->write_data_per_packet < tag->size || tag->range_end) {
         multiple_requests = 1;
     }
 
@@ -1179,7 +2007,7 @@ int build_write_request_connected(ab_tag_p tag, int byte_offset)
     }
 
     /* copy the item count, little endian */
-    *((uint16_le*)data) = h2le16((uint16_t)(tag->elem_count));
+    *((uint16_le*)data) = h2le16(request_elem_count(tag));
     data += sizeof(uint16_le);
 
     if (multiple_requests) {
@@ -1189,10 +2017,10 @@ int build_write_request_connected(ab_tag_p tag, int byte_offset)
     }
 
     /* how much data to write? */
-    write_size = tag->size - tag->offset;
+    write_size = (tag->range_end ? tag->range_end : tag->size) - tag->offset;
 
     if(write_size > tag->write_data_per_packet) {
-        write_size = tag->write_data_per_packet;
+        write_size = pack_write_fragment_size(tag, tag->write_data_per_packet);
     }
 
     /* now copy the data to write */
@@ -1227,6 +2055,9 @@ int build_write_request_connected(ab_tag_p tag, int byte_offset)
     /* allow packing if the tag allows it. */
     req->allow_packing = tag->allow_packing;
 
+    /* reads cached before this are stale. */
+    req->flush_read_cache = 1;
+
     /* add the request to the session's list. */
     rc = session_add_request(tag->session, req);
 
@@ -1265,7 +2096,7 @@ int build_write_request_unconnected(ab_tag_p tag, int byte_offset)
     }
 
     /* get a request buffer */
-    rc = session_create_request(tag->session, tag->tag_id, &req);
+    rc = session_create_request(tag->session, tag->tag_id, tag->priority, tag->op_deadline, &req);
     if (rc != PLCTAG_STATUS_OK) {
         pdebug(DEBUG_ERROR, "Unable to get new request.  rc=%d", rc);
         return rc;
@@ -1277,7 +2108,8 @@ int build_write_request_unconnected(ab_tag_p tag, int byte_offset)
         return rc;
     }
 
-    if(tag->write_data_per_packet < tag->size) {
+    /* a range is written with the fragmented service so that it can give the byte offset. */
+    if(tag->write_data_per_packet < tag->size || tag->range_end) {
         multiple_requests = 1;
     }
 
@@ -1328,7 +2160,7 @@ int build_write_request_unconnected(ab_tag_p tag, int byte_offset)
     }
 
     /* copy the item count, little endian */
-    *((uint16_le*)data) = h2le16((uint16_t)(tag->elem_count));
+    *((uint16_le*)data) = h2le16(request_elem_count(tag));
     data += sizeof(uint16_le);
 
     if (multiple_requests) {
@@ -1338,7 +2170,7 @@ int build_write_request_unconnected(ab_tag_p tag, int byte_offset)
     }
 
     /* how much data to write? */
-    write_size = tag->size - tag->offset;
+    write_size = (tag->range_end ? tag->range_end : tag->size) - tag->offset;
 
     if(write_size > tag->write_data_per_packet) {
         write_size = tag->write_data_per_packet;
@@ -1408,6 +2240,9 @@ int build_write_request_unconnected(ab_tag_p tag, int byte_offset)
     /* allow packing if the tag allows it. */
     req->allow_packing = tag->allow_packing;
 
+    /* reads cached before this are stale. */
+    req->flush_read_cache = 1;
+
     /* add the request to the session's list. */
     rc = session_add_request(tag->session, req);
 
@@ -1429,6 +2264,168 @@ int build_write_request_unconnected(ab_tag_p tag, int byte_offset)
 
 
 
+/*
+ * decode_read_response_connected
+ *
+ * Check a connected read response and copy its data into the tag at
+ * byte_offset.  At most max_bytes are copied unless max_bytes is zero.
+ */
+
+static int decode_read_response_connected(ab_tag_p tag, ab_request_p req, int byte_offset, int max_bytes, int *partial_data, int *bytes_copied)
+{
+    int rc = PLCTAG_STATUS_OK;
+    eip_cip_co_resp* cip_resp;
+    uint8_t* data;
+    uint8_t* data_end;
+
+    *partial_data = 0;
+    *bytes_copied = 0;
+
+    /* the CIP header is always in the request buffer. */
+    cip_resp = (eip_cip_co_resp*)(req->data);
+
+    /* the data may still be in the session receive buffer. */
+    session_request_payload(req, &data, &data_end);
+
+    /* check the status */
+    do {
+        ptrdiff_t payload_size = (data_end - data);
+
+        if (le2h16(cip_resp->encap_command) != AB_EIP_CONNECTED_SEND) {
+            pdebug(DEBUG_WARN, "Unexpected EIP packet type received: %d!", cip_resp->encap_command);
+            rc = PLCTAG_ERR_BAD_DATA;
+            break;
+        }
+
+        if (le2h32(cip_resp->encap_status) != AB_EIP_OK) {
+            pdebug(DEBUG_WARN, "EIP command failed, response code: %d", le2h32(cip_resp->encap_status));
+            rc = PLCTAG_ERR_REMOTE_ERR;
+            break;
+        }
+
+        /*
+         * FIXME
+         *
+         * It probably should not be necessary to check for both as setting the type to anything other
+         * than fragmented is error-prone.
+         */
+
+        if (cip_resp->reply_service != (AB_EIP_CMD_CIP_READ_FRAG | AB_EIP_CMD_CIP_OK)
+            && cip_resp->reply_service != (AB_EIP_CMD_CIP_READ | AB_EIP_CMD_CIP_OK) ) {
+            pdebug(DEBUG_WARN, "CIP response reply service unexpected: %d", cip_resp->reply_service);
+            rc = PLCTAG_ERR_BAD_DATA;
+            break;
+        }
+
+        if (cip_resp->status != AB_CIP_STATUS_OK && cip_resp->status != AB_CIP_STATUS_FRAG) {
+            pdebug(DEBUG_WARN, "CIP read failed with status: 0x%x %s", cip_resp->status, decode_cip_error_short((uint8_t *)&cip_resp->status));
+            pdebug(DEBUG_INFO, decode_cip_error_long((uint8_t *)&cip_resp->status));
+
+            rc = decode_cip_error_code((uint8_t *)&cip_resp->status);
+
+            if(cip_resp->status == AB_CIP_ERR_PATH_SEGMENT || cip_resp->status == AB_CIP_ERR_PATH_DEST_UNKNOWN) {
+                drop_symbol_instance_id(tag);
+            }
+
+            break;
+        }
+
+        /* check to see if this is a partial response. */
+        *partial_data = (cip_resp->status == AB_CIP_STATUS_FRAG);
+
+        /*
+         * check to see if there is any data to process.  If this is a packed
+         * response, there might not be.
+         */
+        payload_size = (data_end - data);
+        if(payload_size > 0) {
+            /* the first byte of the response is a type byte. */
+            pdebug(DEBUG_DETAIL, "type byte = %d (%x)", (int)*data, (int)*data);
+
+            /* handle the data type part.  This can be long. */
+
+            /* check for a simple/base type */
+            if ((*data) >= AB_CIP_DATA_BIT && (*data) <= AB_CIP_DATA_STRINGI) {
+                /* copy the type info for later. */
+                take_type_info(tag, data, 2);
+
+                /* skip the type byte and zero length byte */
+                data += 2;
+            } else if ((*data) == AB_CIP_DATA_ABREV_STRUCT || (*data) == AB_CIP_DATA_ABREV_ARRAY ||
+                       (*data) == AB_CIP_DATA_FULL_STRUCT || (*data) == AB_CIP_DATA_FULL_ARRAY) {
+                /* this is an aggregate type of some sort, the type info is variable length */
+                int type_length = *(data + 1) + 2;  /*
+                                                       * MAGIC
+                                                       * add 2 to get the total length including
+                                                       * the type byte and the length byte.
+                                                       */
+
+                /* check for extra long types */
+                if (type_length > MAX_TAG_TYPE_INFO) {
+                    pdebug(DEBUG_WARN, "Read data type info is too long (%d)!", type_length);
+                    rc = PLCTAG_ERR_TOO_LARGE;
+                    break;
+                }
+
+                /* copy the type info for later. */
+                take_type_info(tag, data, type_length);
+
+                data += type_length;
+            } else {
+                pdebug(DEBUG_WARN, "Unsupported data type returned, type byte=%d", *data);
+                rc = PLCTAG_ERR_UNSUPPORTED;
+                break;
+            }
+
+            /* check payload size now that we have bumped past the data type info. */
+            payload_size = (data_end - data);
+
+            /* a fragment read all at once only fills in its own part. */
+            if(max_bytes > 0 && payload_size > max_bytes) {
+                payload_size = max_bytes;
+            }
+
+            /* copy the data into the tag and realloc if we need more space. */
+            if(payload_size + byte_offset > tag->size) {
+                pdebug(DEBUG_DETAIL, "Increasing tag buffer size to %d bytes.", (int)payload_size + byte_offset);
+
+                rc = plc_tag_generic_resize_data((plc_tag_p)tag, (int)payload_size + byte_offset);
+                if(rc != PLCTAG_STATUS_OK) {
+                    pdebug(DEBUG_WARN, "Unable to reallocate tag data memory!");
+                    break;
+                }
+
+                tag->elem_size = tag->size / tag->elem_count;
+            }
+
+            pdebug(DEBUG_INFO, "Got %d bytes of data", (int)payload_size);
+
+            /*
+             * copy the data, but only if this is not
+             * a pre-read for a subsequent write!  We do not
+             * want to overwrite the data the upstream has
+             * put into the tag's data buffer.
+             */
+            if (!tag->pre_write_read) {
+                plc_tag_generic_data_write_begin((plc_tag_p)tag);
+                mem_copy(plc_tag_generic_read_buffer((plc_tag_p)tag) + byte_offset, data, (int)(payload_size));
+                plc_tag_generic_data_write_end((plc_tag_p)tag);
+            }
+
+            *bytes_copied = (int)payload_size;
+        } else {
+            pdebug(DEBUG_DETAIL, "Response returned no data and no error.");
+        }
+
+        /* set the return code */
+        rc = PLCTAG_STATUS_OK;
+    } while(0);
+
+    return rc;
+}
+
+
+
 /*
  * check_read_status_connected
  *
@@ -1441,10 +2438,8 @@ int build_write_request_unconnected(ab_tag_p tag, int byte_offset)
 static int check_read_status_connected(ab_tag_p tag)
 {
     int rc = PLCTAG_STATUS_OK;
-    eip_cip_co_resp* cip_resp;
-    uint8_t* data;
-    uint8_t* data_end;
     int partial_data = 0;
+    int bytes_copied = 0;
 
     pdebug(DEBUG_SPEW, "Starting.");
 
@@ -1456,6 +2451,7 @@ static int check_read_status_connected(ab_tag_p tag)
     if (!tag->req) {
         tag->read_in_progress = 0;
         tag->offset = 0;
+        tag->range_end = 0;
 
         pdebug(DEBUG_WARN,"Read in progress, but no request in flight!");
 
@@ -1469,6 +2465,8 @@ static int check_read_status_connected(ab_tag_p tag)
             break;
         }
 
+        plc_tag_generic_record_request((plc_tag_p)tag, tag->req->time_queued, tag->req->time_sent, tag->req->time_received);
+
         /* check to see if it was an abort on the session side. */
         if(tag->req->status != PLCTAG_STATUS_OK) {
             rc = tag->req->status;
@@ -1478,6 +2476,7 @@ static int check_read_status_connected(ab_tag_p tag)
 
             tag->read_in_progress = 0;
             tag->offset = 0;
+            tag->range_end = 0;
             tag->size = tag->elem_count * tag->elem_size;
 
             break;
@@ -1489,6 +2488,7 @@ static int check_read_status_connected(ab_tag_p tag)
             /* the request is dead, from session side. */
             tag->read_in_progress = 0;
             tag->offset = 0;
+            tag->range_end = 0;
 
             tag->req = rc_dec(tag->req);
         }
@@ -1496,6 +2496,252 @@ static int check_read_status_connected(ab_tag_p tag)
         return rc;
     }
 
+    /* the request is ours exclusively. */
+    rc = decode_read_response_connected(tag, tag->req, tag->offset, 0, &partial_data, &bytes_copied);
+
+    /* bump the byte offset */
+    tag->offset += bytes_copied;
+
+    /* remember how much the PLC sends per fragment for concurrent reads. */
+    if(rc == PLCTAG_STATUS_OK && partial_data && bytes_copied > 0 && (tag->frag_size == 0 || bytes_copied < tag->frag_size)) {
+        tag->frag_size = bytes_copied;
+    }
+
+    /* clean up the request */
+    tag->req->abort_request = 1;
+    tag->req = rc_dec(tag->req);
+
+    /* are we actually done? */
+    if (rc == PLCTAG_STATUS_OK) {
+        /* this particular read is done. */
+        tag->read_in_progress = 0;
+
+        /* skip if we are doing a pre-write read. */
+        if (!tag->pre_write_read && partial_data) {
+            /* call read start again to get the next piece */
+            pdebug(DEBUG_DETAIL, "calling tag_read_start() to get the next chunk.");
+            rc = tag_read_start(tag);
+        } else {
+            /* done! */
+            if(tag->first_read) {
+                meta_cache_add_tag_type(tag);
+            }
+
+            tag->first_read = 0;
+            tag->offset = 0;
+            tag->range_end = 0;
+
+            /* if this is a pre-read for a write, then pass off to the write routine */
+            if (tag->pre_write_read) {
+                pdebug(DEBUG_DETAIL, "Restarting write call now.");
+                tag->pre_write_read = 0;
+                rc = tag_write_start(tag);
+            } else {
+                /* make the new data visible. */
+                plc_tag_generic_swap_data_buffers((plc_tag_p)tag);
+            }
+        }
+    }
+
+    /* this is not an else clause because the above if could result in bad rc. */
+    if(rc != PLCTAG_STATUS_OK && rc != PLCTAG_STATUS_PENDING) {
+        /* error ! */
+        pdebug(DEBUG_WARN, "Error received!");
+
+        /* clean up everything. */
+        ab_tag_abort(tag);
+    }
+
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return rc;
+}
+
+
+
+/*
+ * check_read_fragments_status_connected
+ *
+ * Wait for all the fragments of a concurrent read and then copy them in.
+ * If the PLC sent back less than a fragment's worth, the rest of the tag
+ * is read the normal way, one fragment at a time, from the first gap.
+ */
+
+static int check_read_fragments_status_connected(ab_tag_p tag)
+{
+    int rc = PLCTAG_STATUS_OK;
+    int gap_offset = -1;
+    int next_frag_size = 0;
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    for(int i=0; i < tag->frag_count && rc == PLCTAG_STATUS_OK; i++) {
+        ab_request_p req = tag->frag_reqs[i];
+
+        spin_block(&req->lock) {
+            if(!req->resp_received) {
+                rc = PLCTAG_STATUS_PENDING;
+                break;
+            }
+
+            if(req->status != PLCTAG_STATUS_OK) {
+                rc = req->status;
+                pdebug(DEBUG_WARN,"Session reported failure of fragment %d: %s.", i, plc_tag_decode_error(rc));
+            }
+        }
+    }
+
+    if(rc == PLCTAG_STATUS_PENDING) {
+        pdebug(DEBUG_SPEW, "Done.  Fragments still in flight.");
+        return rc;
+    }
+
+    /* all the requests are ours exclusively. */
+    for(int i=0; i < tag->frag_count && rc == PLCTAG_STATUS_OK; i++) {
+        ab_request_p req = tag->frag_reqs[i];
+        int byte_offset = i * tag->frag_size;
+        int last = (i == tag->frag_count - 1);
+        int partial_data = 0;
+        int bytes_copied = 0;
+
+        plc_tag_generic_record_request((plc_tag_p)tag, req->time_queued, req->time_sent, req->time_received);
+
+        rc = decode_read_response_connected(tag, req, byte_offset, (last ? 0 : tag->frag_size), &partial_data, &bytes_copied);
+
+        if(rc == PLCTAG_STATUS_OK && gap_offset < 0 && ((!last && bytes_copied < tag->frag_size) || (last && partial_data))) {
+            gap_offset = byte_offset + bytes_copied;
+
+            /* the PLC sends less per reply than we thought, use that next time. */
+            if(!last && bytes_copied > 0) {
+                next_frag_size = bytes_copied;
+            }
+        }
+    }
+
+    if(next_frag_size > 0) {
+        tag->frag_size = next_frag_size;
+    }
+
+    /* clean up the requests. */
+    for(int i=0; i < tag->frag_count; i++) {
+        tag->frag_reqs[i]->abort_request = 1;
+        rc_dec(tag->frag_reqs[i]);
+    }
+
+    mem_free(tag->frag_reqs);
+    tag->frag_reqs = NULL;
+    tag->frag_count = 0;
+
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Error received!");
+        ab_tag_abort(tag);
+        return rc;
+    }
+
+    if(gap_offset >= 0) {
+        pdebug(DEBUG_DETAIL, "Short fragment, reading the rest from offset %d.", gap_offset);
+
+        tag->offset = gap_offset;
+
+        rc = build_read_request_connected(tag, tag->offset);
+        if(rc != PLCTAG_STATUS_OK) {
+            ab_tag_abort(tag);
+            return rc;
+        }
+
+        return PLCTAG_STATUS_PENDING;
+    }
+
+    /* done! */
+    tag->read_in_progress = 0;
+    tag->offset = 0;
+
+    /* make the new data visible. */
+    plc_tag_generic_swap_data_buffers((plc_tag_p)tag);
+
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return rc;
+}
+
+
+
+/*
+ * check_read_tag_list_status_connected
+ *
+ * This routine checks for any outstanding tag list requests.  It will
+ * terminate when there is no data in the response and the error is not "more data".
+ *
+ * This is not thread-safe!  It should be called with the tag mutex
+ * locked!
+ */
+
+static int check_read_tag_list_status_connected(ab_tag_p tag)
+{
+    int rc = PLCTAG_STATUS_OK;
+    eip_cip_co_resp* cip_resp;
+    uint8_t* data;
+    uint8_t* data_end;
+    int partial_data = 0;
+    int controller_scope = 0;
+    uint32_t last_id = 0;
+
+    static int symbol_index=0;
+
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    if(!tag) {
+        pdebug(DEBUG_ERROR,"Null tag pointer passed!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if (!tag->req) {
+        tag->read_in_progress = 0;
+        tag->offset = 0;
+
+        pdebug(DEBUG_WARN,"Read in progress, but no request in flight!");
+
+        return PLCTAG_ERR_READ;
+    }
+
+    /* program listings carry the program name, controller listings have no name. */
+    controller_scope = (tag->encoded_name_size <= 1);
+
+    /* request can be used by two threads at once. */
+    spin_block(&tag->req->lock) {
+        if(!tag->req->resp_received) {
+            rc = PLCTAG_STATUS_PENDING;
+            break;
+        }
+
+        plc_tag_generic_record_request((plc_tag_p)tag, tag->req->time_queued, tag->req->time_sent, tag->req->time_received);
+
+        /* check to see if it was an abort on the session side. */
+        if(tag->req->status != PLCTAG_STATUS_OK) {
+            rc = tag->req->status;
+            tag->req->abort_request = 1;
+
+            pdebug(DEBUG_WARN,"Session reported failure of request: %s.", plc_tag_decode_error(rc));
+
+            tag->read_in_progress = 0;
+            tag->offset = 0;
+            tag->next_id = 0;
+            tag->size = tag->elem_count * tag->elem_size;
+
+            break;
+        }
+    }
+
+    if(rc != PLCTAG_STATUS_OK) {
+        if(rc_is_error(rc)) {
+            /* the request is dead, from session side. */
+            tag->req = rc_dec(tag->req);
+        }
+
+        return rc;
+    }
+
     /* the request is ours exclusively. */
 
     /* point to the data */
@@ -1523,15 +2769,7 @@ static int check_read_status_connected(ab_tag_p tag)
             break;
         }
 
-        /*
-         * FIXME
-         *
-         * It probably should not be necessary to check for both as setting the type to anything other
-         * than fragmented is error-prone.
-         */
-
-        if (cip_resp->reply_service != (AB_EIP_CMD_CIP_READ_FRAG | AB_EIP_CMD_CIP_OK)
-            && cip_resp->reply_service != (AB_EIP_CMD_CIP_READ | AB_EIP_CMD_CIP_OK) ) {
+        if (cip_resp->reply_service != (AB_EIP_CMD_CIP_LIST_TAGS | AB_EIP_CMD_CIP_OK) ) {
             pdebug(DEBUG_WARN, "CIP response reply service unexpected: %d", cip_resp->reply_service);
             rc = PLCTAG_ERR_BAD_DATA;
             break;
@@ -1540,9 +2778,7 @@ static int check_read_status_connected(ab_tag_p tag)
         if (cip_resp->status != AB_CIP_STATUS_OK && cip_resp->status != AB_CIP_STATUS_FRAG) {
             pdebug(DEBUG_WARN, "CIP read failed with status: 0x%x %s", cip_resp->status, decode_cip_error_short((uint8_t *)&cip_resp->status));
             pdebug(DEBUG_INFO, decode_cip_error_long((uint8_t *)&cip_resp->status));
-
             rc = decode_cip_error_code((uint8_t *)&cip_resp->status);
-
             break;
         }
 
@@ -1553,84 +2789,84 @@ static int check_read_status_connected(ab_tag_p tag)
          * check to see if there is any data to process.  If this is a packed
          * response, there might not be.
          */
-        payload_size = (data_end - data);
         if(payload_size > 0) {
-            /* the first byte of the response is a type byte. */
-            pdebug(DEBUG_DETAIL, "type byte = %d (%x)", (int)*data, (int)*data);
+            uint8_t *current_entry_data = data;
+            int keep_all = (!tag->list_prefix && tag->list_programs);
+            int start_offset = tag->offset;
 
-            /* handle the data type part.  This can be long. */
+            /* make room for the whole response, filtered entries take less. */
 
-            /* check for a simple/base type */
-            if ((*data) >= AB_CIP_DATA_BIT && (*data) <= AB_CIP_DATA_STRINGI) {
-                /* copy the type info for later. */
-                if (tag->encoded_type_info_size == 0) {
-                    tag->encoded_type_info_size = 2;
-                    mem_copy(tag->encoded_type_info, data, tag->encoded_type_info_size);
+            if(payload_size + tag->offset > tag->size) {
+                pdebug(DEBUG_DETAIL, "Increasing tag buffer size to %d bytes.", (int)payload_size + tag->offset);
+
+                rc = plc_tag_generic_resize_data((plc_tag_p)tag, (int)payload_size + tag->offset);
+                if(rc != PLCTAG_STATUS_OK) {
+                    pdebug(DEBUG_WARN, "Unable to reallocate tag data memory!");
+                    break;
                 }
 
-                /* skip the type byte and zero length byte */
-                data += 2;
-            } else if ((*data) == AB_CIP_DATA_ABREV_STRUCT || (*data) == AB_CIP_DATA_ABREV_ARRAY ||
-                       (*data) == AB_CIP_DATA_FULL_STRUCT || (*data) == AB_CIP_DATA_FULL_ARRAY) {
-                /* this is an aggregate type of some sort, the type info is variable length */
-                int type_length = *(data + 1) + 2;  /*
-                                                       * MAGIC
-                                                       * add 2 to get the total length including
-                                                       * the type byte and the length byte.
-                                                       */
+                tag->elem_count = tag->size;
+            }
 
-                /* check for extra long types */
-                if (type_length > MAX_TAG_TYPE_INFO) {
-                    pdebug(DEBUG_WARN, "Read data type info is too long (%d)!", type_length);
-                    rc = PLCTAG_ERR_TOO_LARGE;
-                    break;
+            /* scan through the data to get the next ID to use and copy the entries we want. */
+            plc_tag_generic_data_write_begin((plc_tag_p)tag);
+
+            while((data_end - current_entry_data) > 0) {
+                tag_list_entry *current_entry = (tag_list_entry*)current_entry_data;
+                int entry_size = (int)sizeof(*current_entry);
+
+                if((data_end - current_entry_data) >= entry_size) {
+                    entry_size += le2h16(current_entry->string_len);
                 }
 
-                /* copy the type info for later. */
-                if (tag->encoded_type_info_size == 0) {
-                    tag->encoded_type_info_size = type_length;
-                    mem_copy(tag->encoded_type_info, data, tag->encoded_type_info_size);
+                if((data_end - current_entry_data) < entry_size) {
+                    pdebug(DEBUG_WARN, "Tag listing entry runs past the end of the response!");
+                    rc = PLCTAG_ERR_BAD_DATA;
+                    break;
                 }
 
-                data += type_length;
-            } else {
-                pdebug(DEBUG_WARN, "Unsupported data type returned, type byte=%d", *data);
-                rc = PLCTAG_ERR_UNSUPPORTED;
-                break;
-            }
+                /* first element is the symbol instance ID */
+                last_id = le2h32(current_entry->instance_id);
+                tag->next_id = (uint16_t)(last_id + 1);
 
-            /* check payload size now that we have bumped past the data type info. */
-            payload_size = (data_end - data);
+                pdebug(DEBUG_DETAIL, "Next ID: %d", tag->next_id);
 
-            /* copy the data into the tag and realloc if we need more space. */
-            if(payload_size + tag->offset > tag->size) {
-                tag->size = (int)payload_size + tag->offset;
-                tag->elem_size = tag->size / tag->elem_count;
+                /* a controller listing gives the instance IDs for free, keep them like a lookup would. */
+                if(controller_scope) {
+                    const uint8_t *entry_name = current_entry_data + sizeof(*current_entry);
+                    int entry_name_len = le2h16(current_entry->string_len);
 
-                pdebug(DEBUG_DETAIL, "Increasing tag buffer size to %d bytes.", tag->size);
+                    session_add_symbol_id(tag->session, entry_name, entry_name_len, last_id, le2h16(current_entry->symbol_type));
+                    meta_cache_add_symbol(tag->session, entry_name, entry_name_len, last_id, le2h16(current_entry->symbol_type));
+                }
 
-                tag->data = (uint8_t*)mem_realloc(tag->data, tag->size);
-                if(!tag->data) {
-                    pdebug(DEBUG_WARN, "Unable to reallocate tag data memory!");
-                    rc = PLCTAG_ERR_NO_MEM;
-                    break;
+                /* without filters the whole payload is copied at once below. */
+                if(!keep_all && tag_list_entry_wanted(tag, current_entry)) {
+                    mem_copy(tag->data + tag->offset, current_entry_data, entry_size);
+                    tag->offset += entry_size;
                 }
-            }
 
-            pdebug(DEBUG_INFO, "Got %d bytes of data", (int)payload_size);
+                /* skip past to the next instance. */
+                current_entry_data += entry_size;
 
-            /*
-             * copy the data, but only if this is not
-             * a pre-read for a subsequent write!  We do not
-             * want to overwrite the data the upstream has
-             * put into the tag's data buffer.
-             */
-            if (!tag->pre_write_read) {
-                mem_copy(tag->data + tag->offset, data, (int)(payload_size));
+                symbol_index++;
+            }
+
+            if(keep_all && rc == PLCTAG_STATUS_OK) {
+                mem_copy(tag->data + start_offset, data, (int)payload_size);
+                tag->offset = start_offset + (int)payload_size;
             }
 
-            /* bump the byte offset */
-            tag->offset += (int)(payload_size);
+            /* the entries are found again if someone asks for them. */
+            tag->list_index_count = -1;
+
+            plc_tag_generic_data_write_end((plc_tag_p)tag);
+
+            pdebug(DEBUG_DETAIL, "current offset %d", tag->offset);
+
+            if(rc != PLCTAG_STATUS_OK) {
+                break;
+            }
         } else {
             pdebug(DEBUG_DETAIL, "Response returned no data and no error.");
         }
@@ -1645,24 +2881,39 @@ static int check_read_status_connected(ab_tag_p tag)
 
     /* are we actually done? */
     if (rc == PLCTAG_STATUS_OK) {
-        /* this particular read is done. */
+        /* this read is done. */
         tag->read_in_progress = 0;
 
-        /* skip if we are doing a pre-write read. */
-        if (!tag->pre_write_read && partial_data) {
+        if(controller_scope && last_id > 0) {
+            session_set_symbol_progress(tag->session, last_id + 1, !partial_data);
+            meta_cache_set_symbol_progress(tag->session, last_id + 1, !partial_data);
+        }
+
+        /* keep going if we are not done yet, a paged listing hands each page back first. */
+        if (partial_data && !tag->list_paged) {
             /* call read start again to get the next piece */
             pdebug(DEBUG_DETAIL, "calling tag_read_start() to get the next chunk.");
             rc = tag_read_start(tag);
         } else {
             /* done! */
+            pdebug(DEBUG_DETAIL, "Done reading tag list %s!", (partial_data ? "page" : "data"));
+
+            pdebug(DEBUG_DETAIL, "total symbols: %d", symbol_index);
+
+            /* filtered out entries or a smaller page leave space at the end. */
+            if(tag->offset > 0 && tag->offset != tag->size) {
+                rc = plc_tag_generic_resize_data((plc_tag_p)tag, tag->offset);
+            }
+
+            tag->elem_count = tag->offset;
+
             tag->first_read = 0;
             tag->offset = 0;
 
-            /* if this is a pre-read for a write, then pass off to the write routine */
-            if (tag->pre_write_read) {
-                pdebug(DEBUG_DETAIL, "Restarting write call now.");
-                tag->pre_write_read = 0;
-                rc = tag_write_start(tag);
+            /* the next read of a paged listing picks up where this one stopped. */
+            tag->list_complete = !partial_data;
+            if(tag->list_complete) {
+                tag->next_id = 0;
             }
         }
     }
@@ -1670,7 +2921,10 @@ static int check_read_status_connected(ab_tag_p tag)
     /* this is not an else clause because the above if could result in bad rc. */
     if(rc != PLCTAG_STATUS_OK && rc != PLCTAG_STATUS_PENDING) {
         /* error ! */
-        pdebug(DEBUG_WARN, "Error received!");
+        pdebug(DEBUG_WARN, "Error received: %s!", plc_tag_decode_error(rc));
+
+        tag->offset = 0;
+        tag->next_id = 0;
 
         /* clean up everything. */
         ab_tag_abort(tag);
@@ -1683,37 +2937,175 @@ static int check_read_status_connected(ab_tag_p tag)
 
 
 
+/* apply the list_programs and list_prefix filters to a tag listing entry. */
+int tag_list_entry_wanted(ab_tag_p tag, tag_list_entry *entry)
+{
+    const uint8_t *name = (const uint8_t *)(entry + 1);
+    int name_len = le2h16(entry->string_len);
+    int prefix_len = str_length(tag->list_prefix);
+
+    if(!tag->list_programs && name_len >= 8 && symbol_name_matches(name, 8, (const uint8_t *)"Program:", 8)) {
+        return 0;
+    }
+
+    if(prefix_len > 0 && (name_len < prefix_len || !symbol_name_matches(name, prefix_len, (const uint8_t *)tag->list_prefix, prefix_len))) {
+        return 0;
+    }
+
+    return 1;
+}
+
+
+
 /*
- * check_read_tag_list_status_connected
+ * tag_list_build_index
  *
- * This routine checks for any outstanding tag list requests.  It will
- * terminate when there is no data in the response and the error is not "more data".
+ * Find where each entry of the listing in the tag buffer starts.  Done
+ * once per listing read, and only when an entry is asked for.
+ */
+
+int tag_list_build_index(ab_tag_p tag)
+{
+    int offset = 0;
+    int count = 0;
+
+    while(offset + (int)sizeof(tag_list_entry) <= tag->size) {
+        tag_list_entry *entry = (tag_list_entry *)(tag->data + offset);
+        int entry_size = (int)sizeof(tag_list_entry) + le2h16(entry->string_len);
+
+        if(offset + entry_size > tag->size) {
+            break;
+        }
+
+        if(count >= tag->list_index_capacity) {
+            int new_capacity = (tag->list_index_capacity > 0 ? tag->list_index_capacity * 2 : 64);
+            int32_t *new_index = (int32_t *)mem_realloc(tag->list_index, new_capacity * (int)sizeof(int32_t));
+
+            if(!new_index) {
+                pdebug(DEBUG_WARN, "Unable to grow the tag listing index!");
+                return PLCTAG_ERR_NO_MEM;
+            }
+
+            tag->list_index = new_index;
+            tag->list_index_capacity = new_capacity;
+        }
+
+        tag->list_index[count++] = offset;
+        offset += entry_size;
+    }
+
+    tag->list_index_count = count;
+
+    pdebug(DEBUG_DETAIL, "Indexed %d tag listing entries.", count);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * tag_list_get_attrib
  *
- * This is not thread-safe!  It should be called with the tag mutex
- * locked!
+ * Decode one field of one listing entry, asked for as list_<field>.<index>,
+ * or get the number of entries with list_entry_count.  Returns non-zero if
+ * the attribute is one of these.  The tag status is set on bad indexes.
  */
 
-static int check_read_tag_list_status_connected(ab_tag_p tag)
+int tag_list_get_attrib(ab_tag_p tag, const char *attrib_name, int *value)
+{
+    static const char *fields[] = { "list_entry_offset.", "list_instance_id.", "list_symbol_type.", "list_elem_size.",
+                                    "list_num_dims.", "list_dim0.", "list_dim1.", "list_dim2.", "list_name_offset.", "list_name_len." };
+    int field = -1;
+    int index = 0;
+    int rc = PLCTAG_STATUS_OK;
+    tag_list_entry *entry = NULL;
+
+    if(str_cmp_i(attrib_name, "list_entry_count") != 0) {
+        for(int i=0; i < (int)(sizeof(fields)/sizeof(fields[0])); i++) {
+            int prefix_len = str_length(fields[i]);
+
+            if(str_cmp_i_n(attrib_name, fields[i], prefix_len) == 0) {
+                field = i;
+
+                if(str_to_int(attrib_name + prefix_len, &index) != 0) {
+                    tag->status = PLCTAG_ERR_BAD_PARAM;
+                    return 1;
+                }
+
+                break;
+            }
+        }
+
+        if(field < 0) {
+            return 0;
+        }
+    }
+
+    if(tag->list_index_count < 0 || !tag->list_index) {
+        if((rc = tag_list_build_index(tag)) != PLCTAG_STATUS_OK) {
+            tag->status = (int8_t)rc;
+            return 1;
+        }
+    }
+
+    tag->status = PLCTAG_STATUS_OK;
+
+    if(field < 0) {
+        *value = tag->list_index_count;
+        return 1;
+    }
+
+    if(index < 0 || index >= tag->list_index_count) {
+        tag->status = PLCTAG_ERR_OUT_OF_BOUNDS;
+        return 1;
+    }
+
+    entry = (tag_list_entry *)(tag->data + tag->list_index[index]);
+
+    switch(field) {
+        case 0: *value = tag->list_index[index]; break;
+        case 1: *value = (int)le2h32(entry->instance_id); break;
+        case 2: *value = le2h16(entry->symbol_type); break;
+        case 3: *value = le2h16(entry->element_length); break;
+        case 4: *value = (le2h16(entry->symbol_type) >> 13) & 0x03; break;
+        case 5: *value = (int)le2h32(entry->array_dims[0]); break;
+        case 6: *value = (int)le2h32(entry->array_dims[1]); break;
+        case 7: *value = (int)le2h32(entry->array_dims[2]); break;
+        case 8: *value = tag->list_index[index] + (int)sizeof(tag_list_entry); break;
+        default: *value = le2h16(entry->string_len); break;
+    }
+
+    return 1;
+}
+
+
+
+/*
+ * check_symbol_list_status_connected
+ *
+ * Scan a batch of the controller tag listing for the tag's symbol and
+ * hand every ID in it to the session.  Once the ID is found, or all
+ * the tags have been listed, the real read starts.  If the PLC refuses
+ * to list tags, the tag just uses its name.
+ */
+
+static int check_symbol_list_status_connected(ab_tag_p tag)
 {
     int rc = PLCTAG_STATUS_OK;
     eip_cip_co_resp* cip_resp;
     uint8_t* data;
     uint8_t* data_end;
     int partial_data = 0;
-
-    static int symbol_index=0;
-
+    int found = 0;
+    uint8_t *encoded_name = (tag->symbolic_name ? tag->symbolic_name : tag->encoded_name);
+    uint8_t *name = &encoded_name[3];
+    int name_len = encoded_name[2];
 
     pdebug(DEBUG_SPEW, "Starting.");
 
-    if(!tag) {
-        pdebug(DEBUG_ERROR,"Null tag pointer passed!");
-        return PLCTAG_ERR_NULL_PTR;
-    }
-
     if (!tag->req) {
         tag->read_in_progress = 0;
-        tag->offset = 0;
+        tag->resolving_symbol = 0;
 
         pdebug(DEBUG_WARN,"Read in progress, but no request in flight!");
 
@@ -1727,6 +3119,8 @@ static int check_read_tag_list_status_connected(ab_tag_p tag)
             break;
         }
 
+        plc_tag_generic_record_request((plc_tag_p)tag, tag->req->time_queued, tag->req->time_sent, tag->req->time_received);
+
         /* check to see if it was an abort on the session side. */
         if(tag->req->status != PLCTAG_STATUS_OK) {
             rc = tag->req->status;
@@ -1734,11 +3128,6 @@ static int check_read_tag_list_status_connected(ab_tag_p tag)
 
             pdebug(DEBUG_WARN,"Session reported failure of request: %s.", plc_tag_decode_error(rc));
 
-            tag->read_in_progress = 0;
-            tag->offset = 0;
-            tag->next_id = 0;
-            tag->size = tag->elem_count * tag->elem_size;
-
             break;
         }
     }
@@ -1747,6 +3136,9 @@ static int check_read_tag_list_status_connected(ab_tag_p tag)
         if(rc_is_error(rc)) {
             /* the request is dead, from session side. */
             tag->req = rc_dec(tag->req);
+            tag->read_in_progress = 0;
+            tag->resolving_symbol = 0;
+            tag->next_id = 0;
         }
 
         return rc;
@@ -1765,8 +3157,6 @@ static int check_read_tag_list_status_connected(ab_tag_p tag)
 
     /* check the status */
     do {
-        ptrdiff_t payload_size = (data_end - data);
-
         if (le2h16(cip_resp->encap_command) != AB_EIP_CONNECTED_SEND) {
             pdebug(DEBUG_WARN, "Unexpected EIP packet type received: %d!", cip_resp->encap_command);
             rc = PLCTAG_ERR_BAD_DATA;
@@ -1786,8 +3176,7 @@ static int check_read_tag_list_status_connected(ab_tag_p tag)
         }
 
         if (cip_resp->status != AB_CIP_STATUS_OK && cip_resp->status != AB_CIP_STATUS_FRAG) {
-            pdebug(DEBUG_WARN, "CIP read failed with status: 0x%x %s", cip_resp->status, decode_cip_error_short((uint8_t *)&cip_resp->status));
-            pdebug(DEBUG_INFO, decode_cip_error_long((uint8_t *)&cip_resp->status));
+            pdebug(DEBUG_WARN, "CIP tag listing failed with status: 0x%x %s", cip_resp->status, decode_cip_error_short((uint8_t *)&cip_resp->status));
             rc = decode_cip_error_code((uint8_t *)&cip_resp->status);
             break;
         }
@@ -1795,94 +3184,105 @@ static int check_read_tag_list_status_connected(ab_tag_p tag)
         /* check to see if this is a partial response. */
         partial_data = (cip_resp->status == AB_CIP_STATUS_FRAG);
 
-        /*
-         * check to see if there is any data to process.  If this is a packed
-         * response, there might not be.
-         */
-        if(payload_size > 0) {
-            uint8_t *current_entry_data = data;
-
-            /* copy the data into the tag and realloc if we need more space. */
+        /* each entry is the fixed part and then the name. */
+        while((data_end - data) >= (ptrdiff_t)sizeof(tag_list_entry)) {
+            tag_list_entry *entry = (tag_list_entry*)data;
+            uint8_t *entry_name = data + sizeof(*entry);
+            int entry_name_len = le2h16(entry->string_len);
+            uint32_t entry_id = le2h32(entry->instance_id);
 
-            if(payload_size + tag->offset > tag->size) {
-                tag->elem_count = tag->size = (int)payload_size + tag->offset;
+            if((data_end - entry_name) < entry_name_len) {
+                pdebug(DEBUG_WARN, "Tag listing entry name runs past the end of the response!");
+                rc = PLCTAG_ERR_BAD_DATA;
+                break;
+            }
 
-                pdebug(DEBUG_DETAIL, "Increasing tag buffer size to %d bytes.", tag->size);
+            session_add_symbol_id(tag->session, entry_name, entry_name_len, entry_id, le2h16(entry->symbol_type));
+            meta_cache_add_symbol(tag->session, entry_name, entry_name_len, entry_id, le2h16(entry->symbol_type));
 
-                tag->data = (uint8_t*)mem_realloc(tag->data, tag->size);
-                if(!tag->data) {
-                    pdebug(DEBUG_WARN, "Unable to reallocate tag data memory!");
-                    rc = PLCTAG_ERR_NO_MEM;
-                    break;
-                }
+            if(!found && symbol_name_matches(entry_name, entry_name_len, name, name_len)) {
+                found = 1;
             }
 
-            /* copy the data into the tag's data buffer. */
-            mem_copy(tag->data + tag->offset, data, (int)payload_size);
+            tag->next_id = entry_id + 1;
 
-            tag->offset += (int)payload_size;
+            data = entry_name + entry_name_len;
+        }
+    } while(0);
 
-            pdebug(DEBUG_DETAIL, "current offset %d", tag->offset);
+    /* clean up the request */
+    tag->req->abort_request = 1;
+    tag->req = rc_dec(tag->req);
 
-            /* scan through the data to get the next ID to use. */
-            while((data_end - current_entry_data) > 0) {
-                tag_list_entry *current_entry = (tag_list_entry*)current_entry_data;
+    if(rc == PLCTAG_STATUS_OK) {
+        session_set_symbol_progress(tag->session, tag->next_id, !partial_data);
+        meta_cache_set_symbol_progress(tag->session, tag->next_id, !partial_data);
 
-                /* first element is the symbol instance ID */
-                tag->next_id = (uint16_t)(le2h32(current_entry->instance_id) + 1);
+        /* keep listing until we find it or run out of tags. */
+        if(!found && partial_data) {
+            rc = build_tag_list_request_connected(tag);
+            if(rc == PLCTAG_STATUS_OK) {
+                pdebug(DEBUG_SPEW, "Done.  Listing more controller tags.");
+                return PLCTAG_STATUS_PENDING;
+            }
+        }
+    }
 
-                pdebug(DEBUG_DETAIL, "Next ID: %d", tag->next_id);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to list the controller tags, using the tag name.");
+        tag->use_instance_id = 0;
+        tag->udt_templates = 0;
+    }
 
-                /* skip past to the next instance. */
-                current_entry_data += (sizeof(*current_entry) + le2h16(current_entry->string_len));
+    tag->resolving_symbol = 0;
+    tag->next_id = 0;
 
-                symbol_index++;
-            }
-        } else {
-            pdebug(DEBUG_DETAIL, "Response returned no data and no error.");
-        }
+    /* now do the read we came for, the symbol is picked up from the session. */
+    tag->read_in_progress = 0;
+    rc = tag_read_start(tag);
 
-        /* set the return code */
-        rc = PLCTAG_STATUS_OK;
-    } while(0);
+    if(rc != PLCTAG_STATUS_OK && rc != PLCTAG_STATUS_PENDING) {
+        pdebug(DEBUG_WARN, "Error received: %s!", plc_tag_decode_error(rc));
+        ab_tag_abort(tag);
+    }
 
-    /* clean up the request */
-    tag->req->abort_request = 1;
-    tag->req = rc_dec(tag->req);
+    pdebug(DEBUG_SPEW, "Done.");
 
-    /* are we actually done? */
-    if (rc == PLCTAG_STATUS_OK) {
-        /* this read is done. */
-        tag->read_in_progress = 0;
+    return rc;
+}
 
-        /* keep going if we are not done yet. */
-        if (partial_data) {
-            /* call read start again to get the next piece */
-            pdebug(DEBUG_DETAIL, "calling tag_read_start() to get the next chunk.");
-            rc = tag_read_start(tag);
-        } else {
-            /* done! */
-            pdebug(DEBUG_DETAIL, "Done reading tag list data!");
 
-            pdebug(DEBUG_DETAIL, "total symbols: %d", symbol_index);
+/*
+ * check_udt_template_status_connected
+ *
+ * Wait for the UDT template requests.  When the template is in the
+ * session the real read starts.
+ */
 
-            tag->elem_count = tag->offset;
+static int check_udt_template_status_connected(ab_tag_p tag)
+{
+    int rc = PLCTAG_STATUS_OK;
 
-            tag->first_read = 0;
-            tag->offset = 0;
-            tag->next_id = 0;
-        }
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    rc = eip_cip_udt_check_status(tag);
+    if(rc == PLCTAG_STATUS_PENDING) {
+        pdebug(DEBUG_SPEW, "Done.  Template read in progress.");
+        return rc;
     }
 
-    /* this is not an else clause because the above if could result in bad rc. */
-    if(rc != PLCTAG_STATUS_OK && rc != PLCTAG_STATUS_PENDING) {
-        /* error ! */
-        pdebug(DEBUG_WARN, "Error received: %s!", plc_tag_decode_error(rc));
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to read UDT template, error %s!", plc_tag_decode_error(rc));
+        tag->read_in_progress = 0;
+        return rc;
+    }
 
-        tag->offset = 0;
-        tag->next_id = 0;
+    /* look for the next missing template or do the read we came for. */
+    tag->read_in_progress = 0;
+    rc = tag_read_start(tag);
 
-        /* clean up everything. */
+    if(rc != PLCTAG_STATUS_OK && rc != PLCTAG_STATUS_PENDING) {
+        pdebug(DEBUG_WARN, "Error received: %s!", plc_tag_decode_error(rc));
         ab_tag_abort(tag);
     }
 
@@ -1894,7 +3294,6 @@ static int check_read_tag_list_status_connected(ab_tag_p tag)
 
 
 
-
 static int check_read_status_unconnected(ab_tag_p tag)
 {
     int rc = PLCTAG_STATUS_OK;
@@ -1913,6 +3312,7 @@ static int check_read_status_unconnected(ab_tag_p tag)
     if (!tag->req) {
         tag->read_in_progress = 0;
         tag->offset = 0;
+        tag->range_end = 0;
 
         pdebug(DEBUG_WARN,"Read in progress, but no request in flight!");
 
@@ -1926,6 +3326,8 @@ static int check_read_status_unconnected(ab_tag_p tag)
             break;
         }
 
+        plc_tag_generic_record_request((plc_tag_p)tag, tag->req->time_queued, tag->req->time_sent, tag->req->time_received);
+
         /* check to see if it was an abort on the session side. */
         if(tag->req->status != PLCTAG_STATUS_OK) {
             rc = tag->req->status;
@@ -1935,6 +3337,7 @@ static int check_read_status_unconnected(ab_tag_p tag)
 
             tag->read_in_progress = 0;
             tag->offset = 0;
+            tag->range_end = 0;
             tag->size = tag->elem_count * tag->elem_size;
 
             break;
@@ -2012,10 +3415,7 @@ static int check_read_status_unconnected(ab_tag_p tag)
 
         if ((*data) >= AB_CIP_DATA_BIT && (*data) <= AB_CIP_DATA_STRINGI) {
             /* copy the type info for later. */
-            if (tag->encoded_type_info_size == 0) {
-                tag->encoded_type_info_size = 2;
-                mem_copy(tag->encoded_type_info, data, tag->encoded_type_info_size);
-            }
+            take_type_info(tag, data, 2);
 
             /* skip the type byte and zero length byte */
             data += 2;
@@ -2037,10 +3437,7 @@ static int check_read_status_unconnected(ab_tag_p tag)
             }
 
             /* copy the type info for later. */
-            if (tag->encoded_type_info_size == 0) {
-                tag->encoded_type_info_size = type_length;
-                mem_copy(tag->encoded_type_info, data, tag->encoded_type_info_size);
-            }
+            take_type_info(tag, data, type_length);
 
             data += type_length;
         } else {
@@ -2054,17 +3451,15 @@ static int check_read_status_unconnected(ab_tag_p tag)
 
         /* copy the data into the tag and realloc if we need more space. */
         if(payload_size + tag->offset > tag->size) {
-            tag->size = (int)payload_size + tag->offset;
-            tag->elem_size = tag->size / tag->elem_count;
+            pdebug(DEBUG_DETAIL, "Increasing tag buffer size to %d bytes.", (int)payload_size + tag->offset);
 
-            pdebug(DEBUG_DETAIL, "Increasing tag buffer size to %d bytes.", tag->size);
-
-            tag->data = (uint8_t*)mem_realloc(tag->data, tag->size);
-            if(!tag->data) {
+            rc = plc_tag_generic_resize_data((plc_tag_p)tag, (int)payload_size + tag->offset);
+            if(rc != PLCTAG_STATUS_OK) {
                 pdebug(DEBUG_WARN, "Unable to reallocate tag data memory!");
-                rc = PLCTAG_ERR_NO_MEM;
                 break;
             }
+
+            tag->elem_size = tag->size / tag->elem_count;
         }
 
         pdebug(DEBUG_INFO, "Got %d bytes of data", (int)payload_size);
@@ -2077,7 +3472,9 @@ static int check_read_status_unconnected(ab_tag_p tag)
          * put into the tag's data buffer.
          */
         if (!tag->pre_write_read) {
-            mem_copy(tag->data + tag->offset, data, (int)payload_size);
+            plc_tag_generic_data_write_begin((plc_tag_p)tag);
+            mem_copy(plc_tag_generic_read_buffer((plc_tag_p)tag) + tag->offset, data, (int)payload_size);
+            plc_tag_generic_data_write_end((plc_tag_p)tag);
         }
 
         /* bump the byte offset */
@@ -2104,8 +3501,13 @@ static int check_read_status_unconnected(ab_tag_p tag)
             rc = tag_read_start(tag);
         } else {
             /* done! */
+            if(tag->first_read) {
+                meta_cache_add_tag_type(tag);
+            }
+
             tag->first_read = 0;
             tag->offset = 0;
+            tag->range_end = 0;
 
             /* if this is a pre-read for a write, then pass off to the write routine */
             if (tag->pre_write_read) {
@@ -2113,6 +3515,9 @@ static int check_read_status_unconnected(ab_tag_p tag)
 
                 tag->pre_write_read = 0;
                 rc = tag_write_start(tag);
+            } else {
+                /* make the new data visible. */
+                plc_tag_generic_swap_data_buffers((plc_tag_p)tag);
             }
         }
     }
@@ -2155,6 +3560,8 @@ static int check_write_status_connected(ab_tag_p tag)
     if (!tag->req) {
         tag->write_in_progress = 0;
         tag->offset = 0;
+        restore_dirty_range(tag);
+        tag->range_end = 0;
 
         pdebug(DEBUG_WARN,"Write in progress, but no request in flight!");
 
@@ -2168,6 +3575,8 @@ static int check_write_status_connected(ab_tag_p tag)
             break;
         }
 
+        plc_tag_generic_record_request((plc_tag_p)tag, tag->req->time_queued, tag->req->time_sent, tag->req->time_received);
+
         /* check to see if it was an abort on the session side. */
         if(tag->req->status != PLCTAG_STATUS_OK) {
             rc = tag->req->status;
@@ -2177,6 +3586,8 @@ static int check_write_status_connected(ab_tag_p tag)
 
             tag->write_in_progress = 0;
             tag->offset = 0;
+            restore_dirty_range(tag);
+            tag->range_end = 0;
 
             break;
         }
@@ -2221,6 +3632,13 @@ static int check_write_status_connected(ab_tag_p tag)
             pdebug(DEBUG_WARN, "CIP read failed with status: 0x%x %s", cip_resp->status, decode_cip_error_short((uint8_t *)&cip_resp->status));
             pdebug(DEBUG_INFO, decode_cip_error_long((uint8_t *)&cip_resp->status));
             rc = decode_cip_error_code((uint8_t *)&cip_resp->status);
+
+            if(cip_resp->status == AB_CIP_ERR_PATH_SEGMENT || cip_resp->status == AB_CIP_ERR_PATH_DEST_UNKNOWN) {
+                drop_symbol_instance_id(tag);
+            }
+
+            drop_cached_type(tag);
+
             break;
         }
     } while(0);
@@ -2233,18 +3651,23 @@ static int check_write_status_connected(ab_tag_p tag)
     tag->write_in_progress = 0;
 
     if(rc == PLCTAG_STATUS_OK) {
-        if(tag->offset < tag->size) {
+        if(tag->offset < (tag->range_end ? tag->range_end : tag->size)) {
 
             pdebug(DEBUG_DETAIL, "Write not complete, triggering next round.");
             rc = tag_write_start(tag);
         } else {
             /* only clear this if we are done. */
             tag->offset = 0;
+            tag->range_end = 0;
+
+            rc = write_next_dirty_range(tag);
         }
     } else {
         pdebug(DEBUG_WARN,"Write failed!");
+        restore_dirty_range(tag);
 
         tag->offset = 0;
+        tag->range_end = 0;
     }
 
     pdebug(DEBUG_SPEW, "Done.");
@@ -2271,6 +3694,8 @@ static int check_write_status_unconnected(ab_tag_p tag)
     if (!tag->req) {
         tag->write_in_progress = 0;
         tag->offset = 0;
+        restore_dirty_range(tag);
+        tag->range_end = 0;
 
         pdebug(DEBUG_WARN,"Write in progress, but no request in flight!");
 
@@ -2284,6 +3709,8 @@ static int check_write_status_unconnected(ab_tag_p tag)
             break;
         }
 
+        plc_tag_generic_record_request((plc_tag_p)tag, tag->req->time_queued, tag->req->time_sent, tag->req->time_received);
+
         /* check to see if it was an abort on the session side. */
         if(tag->req->status != PLCTAG_STATUS_OK) {
             rc = tag->req->status;
@@ -2293,6 +3720,8 @@ static int check_write_status_unconnected(ab_tag_p tag)
 
             tag->write_in_progress = 0;
             tag->offset = 0;
+            restore_dirty_range(tag);
+            tag->range_end = 0;
 
             break;
         }
@@ -2338,6 +3767,7 @@ static int check_write_status_unconnected(ab_tag_p tag)
             pdebug(DEBUG_WARN, "CIP read failed with status: 0x%x %s", cip_resp->status, decode_cip_error_short((uint8_t *)&cip_resp->status));
             pdebug(DEBUG_INFO, decode_cip_error_long((uint8_t *)&cip_resp->status));
             rc = decode_cip_error_code((uint8_t *)&cip_resp->status);
+            drop_cached_type(tag);
             break;
         }
     } while(0);
@@ -2350,17 +3780,22 @@ static int check_write_status_unconnected(ab_tag_p tag)
     tag->write_in_progress = 0;
 
     if(rc == PLCTAG_STATUS_OK) {
-        if(tag->offset < tag->size) {
+        if(tag->offset < (tag->range_end ? tag->range_end : tag->size)) {
 
             pdebug(DEBUG_DETAIL, "Write not complete, triggering next round.");
             rc = tag_write_start(tag);
         } else {
             /* only clear this if we are done. */
             tag->offset = 0;
+            tag->range_end = 0;
+
+            rc = write_next_dirty_range(tag);
         }
     } else {
         pdebug(DEBUG_WARN,"Write failed!");
+        restore_dirty_range(tag);
         tag->offset = 0;
+        tag->range_end = 0;
     }
 
     pdebug(DEBUG_SPEW, "Done.");
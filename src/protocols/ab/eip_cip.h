@@ -42,6 +42,7 @@ extern tag_byte_order_t logix_tag_listing_byte_order;
 
 /* tag listing helpers */
 extern int setup_tag_listing(ab_tag_p tag, const char *name);
+extern int tag_list_get_attrib(ab_tag_p tag, const char *attrib_name, int *value);
 
 
 #endif
@@ -0,0 +1,1326 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <stdlib.h>
+#include <platform.h>
+#include <lib/libplctag.h>
+#include <lib/tag.h>
+#include <ab/defs.h>
+#include <ab/ab_common.h>
+#include <ab/cip.h>
+#include <ab/tag.h>
+#include <ab/session.h>
+#include <ab/eip_cip_io.h>
+#include <ab/error_codes.h>
+#include <util/attr.h>
+#include <util/debug.h>
+#include <util/rc.h>
+
+
+/*
+ * CIP Class 1 implicit I/O.
+ *
+ * The tag sends a Forward Open over the session asking the target to
+ * produce the data cyclically over UDP.  Frames for all connections arrive
+ * on one UDP socket and are demultiplexed by connection ID in a library
+ * thread, which copies the latest frame into the connection and wakes the
+ * tag.  The tickler moves the frame into the tag data and reports the
+ * read completion and value change events.
+ *
+ * Only consuming is supported.  The originator to target direction only
+ * carries the heartbeat, so assembly connections should use the target's
+ * input-only or listen-only output instance.
+ */
+
+#define EIP_CIP_IO_DEFAULT_PORT (2222)
+#define EIP_CIP_IO_ITEM_SOCKADDR_O_T ((uint16_t)0x8000)
+#define EIP_CIP_IO_ITEM_SOCKADDR_T_O ((uint16_t)0x8001)
+#define EIP_CIP_IO_ITEM_SEQ_ADDR ((uint16_t)0x8002)
+#define EIP_CIP_IO_TRANSPORT_CLASS_1 ((uint8_t)0x01) /* client, cyclic, class 1 */
+#define EIP_CIP_IO_CONN_PARAM ((uint16_t)0x4800) /* point to point, scheduled priority, fixed size */
+#define EIP_CIP_IO_HEARTBEAT_SIZE (2) /* just the sequence count */
+#define EIP_CIP_IO_MAX_CONN_SIZE (500) /* the Forward Open size field is 9 bits */
+#define EIP_CIP_IO_RETRY_MS (1000)
+#define EIP_CIP_IO_MAX_WAIT_MS (10)
+#define EIP_CIP_IO_MAX_FRAME (1500)
+#define EIP_CIP_IO_MAX_WAKE (64)
+#define EIP_CIP_IO_MAX_PATH (MAX_CONN_PATH + MAX_TAG_NAME)
+
+
+START_PACK typedef struct {
+    uint16_le item_count;           /* ALWAYS 2 */
+    uint16_le sai_item_type;        /* ALWAYS 0x8002 Sequenced Address Item */
+    uint16_le sai_item_length;      /* ALWAYS 8 */
+    uint32_le conn_id;              /* connection ID of the producer */
+    uint32_le encap_seq_num;        /* increments with every frame */
+    uint16_le cdi_item_type;        /* ALWAYS 0x00B1 Connected Data Item */
+    uint16_le cdi_item_length;      /* sequence count and data */
+    uint16_le seq_count;            /* increments when the data is new */
+} END_PACK eip_cip_io_frame;
+
+
+START_PACK typedef struct {
+    uint16_le item_type;            /* 0x8000 or 0x8001 */
+    uint16_le item_length;          /* ALWAYS 16 */
+    uint8_t sin_family[2];          /* big endian from here on */
+    uint8_t sin_port[2];
+    uint8_t sin_addr[4];
+    uint8_t sin_zero[8];
+} END_PACK eip_cip_io_sockaddr_item;
+
+
+typedef enum { IO_CONN_CLOSED, IO_CONN_OPENING, IO_CONN_OPEN } io_conn_state_t;
+
+typedef struct eip_cip_io_conn_t *eip_cip_io_conn_p;
+
+struct eip_cip_io_conn_t {
+    /* in the receiver's list. */
+    eip_cip_io_conn_p next;
+
+    /* only changed by the tag with the API mutex held. */
+    io_conn_state_t state;
+    uint32_t rpi_us;
+    uint32_t gateway_addr;
+    uint8_t conn_path[EIP_CIP_IO_MAX_PATH];
+    int conn_path_size;
+    uint16_t conn_serial;
+
+    /* the rest is shared with the receiver thread and protected by the lock. */
+    lock_t lock;
+
+    int32_t tag_id;
+    int active;
+    int timed_out;
+    int64_t retry_time;
+
+    uint32_t o_t_conn_id;
+    uint32_t t_o_conn_id;
+    uint32_t o_t_addr;
+    int o_t_port;
+    int64_t heartbeat_ms;
+    int64_t timeout_ms;
+    int64_t next_heartbeat;
+    int64_t last_recv_time;
+    uint32_t o_t_seq;
+    uint32_t t_o_seq;
+    uint16_t t_o_seq_count;
+    int have_t_o_seq;
+
+    int new_data;
+    int data_size;
+    int data_capacity;
+    uint8_t *data;
+};
+
+
+static mutex_p io_mutex = NULL;
+static eip_cip_io_conn_p io_conns = NULL;
+static sock_p io_sock = NULL;
+static int io_port = EIP_CIP_IO_DEFAULT_PORT;
+static thread_p io_thread = NULL;
+static volatile int io_terminate = 0;
+static lock_t io_serial_lock = LOCK_INIT;
+static uint16_t io_conn_serial = 0;
+
+
+static int tag_abort(ab_tag_p tag);
+static int tag_read_start(ab_tag_p tag);
+static int tag_status(ab_tag_p tag);
+static int tag_tickler(ab_tag_p tag);
+static int tag_write_start(ab_tag_p tag);
+
+struct tag_vtable_t eip_cip_io_vtable = {
+    (tag_vtable_func)tag_abort,
+    (tag_vtable_func)tag_read_start,
+    (tag_vtable_func)tag_status,
+    (tag_vtable_func)tag_tickler,
+    (tag_vtable_func)tag_write_start,
+
+    /* data accessors */
+    ab_get_int_attrib,
+    ab_set_int_attrib,
+
+    /* no structure member lookup */
+    NULL,
+
+    /* no element ranges */
+    NULL
+};
+
+
+static void conn_destroy(void *conn_arg);
+static int build_conn_path(ab_tag_p tag, eip_cip_io_conn_p conn, attr attribs);
+static int start_receiver_unsafe(int port);
+static THREAD_FUNC(io_handler);
+static int service_conns(void);
+static void handle_frame(uint8_t *frame, int size);
+static int send_forward_open(ab_tag_p tag);
+static int check_forward_open(ab_tag_p tag);
+static int send_forward_close(ab_tag_p tag);
+static void open_failed(ab_tag_p tag, int rc);
+
+
+static inline uint16_t get_u16(uint8_t *p)
+{
+    return (uint16_t)((uint16_t)p[0] | (uint16_t)((uint16_t)p[1] << 8));
+}
+
+static inline uint32_t get_u32(uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+
+
+int eip_cip_io_init(void)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    io_terminate = 0;
+
+    if(!io_mutex) {
+        rc = mutex_create(&io_mutex);
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_ERROR, "Unable to create implicit I/O mutex!");
+            return rc;
+        }
+    }
+
+    spin_block(&io_serial_lock) {
+        io_conn_serial = (uint16_t)rand();
+    }
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return rc;
+}
+
+
+void eip_cip_io_teardown(void)
+{
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(io_thread) {
+        pdebug(DEBUG_INFO, "Terminating implicit I/O thread.");
+
+        io_terminate = 1;
+
+        thread_join(io_thread);
+        thread_destroy(&io_thread);
+        io_thread = NULL;
+    }
+
+    if(io_sock) {
+        socket_close(io_sock);
+        socket_destroy(&io_sock);
+        io_sock = NULL;
+    }
+
+    /* tags should be gone, but release anything left over. */
+    while(io_conns) {
+        eip_cip_io_conn_p conn = io_conns;
+
+        io_conns = conn->next;
+        conn->next = NULL;
+        rc_dec(conn);
+    }
+
+    if(io_mutex) {
+        mutex_destroy(&io_mutex);
+        io_mutex = NULL;
+    }
+
+    io_terminate = 0;
+
+    pdebug(DEBUG_INFO, "Done.");
+}
+
+
+
+/*
+ * eip_cip_io_tag_setup
+ *
+ * Called when the tag is created.  The tag data size must already be
+ * known.  The connection is opened by the first read.
+ */
+
+int eip_cip_io_tag_setup(ab_tag_p tag, attr attribs)
+{
+    eip_cip_io_conn_p conn = NULL;
+    int rpi_ms = attr_get_int(attribs, "io_rpi_ms", 0);
+    int port = attr_get_int(attribs, "io_udp_port", EIP_CIP_IO_DEFAULT_PORT);
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(rpi_ms <= 0) {
+        pdebug(DEBUG_WARN, "The io_rpi_ms attribute must be greater than zero!");
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    if(port <= 0 || port > 65535) {
+        pdebug(DEBUG_WARN, "The io_udp_port attribute must be between 1 and 65535!");
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    if(tag->tag_list) {
+        pdebug(DEBUG_WARN, "Tag listing is not supported over implicit I/O!");
+        return PLCTAG_ERR_UNSUPPORTED;
+    }
+
+    if(tag->size <= 0) {
+        pdebug(DEBUG_WARN, "Implicit I/O tags need elem_size or elem_type to set the tag size!");
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    /* the connection also carries the two byte sequence count. */
+    if(tag->size + 2 > EIP_CIP_IO_MAX_CONN_SIZE) {
+        pdebug(DEBUG_WARN, "Tag size %d is too large for an implicit I/O connection!", tag->size);
+        return PLCTAG_ERR_TOO_LARGE;
+    }
+
+    if(!io_mutex) {
+        pdebug(DEBUG_WARN, "Implicit I/O is not initialized!");
+        return PLCTAG_ERR_NOT_ALLOWED;
+    }
+
+    conn = (eip_cip_io_conn_p)rc_alloc((int)sizeof(struct eip_cip_io_conn_t), conn_destroy);
+    if(!conn) {
+        pdebug(DEBUG_ERROR, "Unable to allocate implicit I/O connection!");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    conn->state = IO_CONN_CLOSED;
+    conn->rpi_us = (uint32_t)rpi_ms * 1000;
+    conn->lock = LOCK_INIT;
+
+    conn->data_capacity = tag->size;
+    conn->data = (uint8_t *)mem_alloc(conn->data_capacity);
+    if(!conn->data) {
+        pdebug(DEBUG_ERROR, "Unable to allocate implicit I/O buffer!");
+        rc_dec(conn);
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    rc = build_conn_path(tag, conn, attribs);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to build the connection path, error %s!", plc_tag_decode_error(rc));
+        rc_dec(conn);
+        return rc;
+    }
+
+    /* the target sends to the gateway's address unless the Forward Open says otherwise. */
+    rc = socket_resolve_ipv4(attr_get_str(attribs, "gateway", ""), &conn->gateway_addr);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to resolve the gateway address, error %s!", plc_tag_decode_error(rc));
+        rc_dec(conn);
+        return rc;
+    }
+
+    critical_block(io_mutex) {
+        if(!io_sock) {
+            rc = start_receiver_unsafe(port);
+            if(rc != PLCTAG_STATUS_OK) {
+                break;
+            }
+        } else if(port != io_port) {
+            pdebug(DEBUG_WARN, "Implicit I/O is already using UDP port %d, ignoring port %d.", io_port, port);
+        }
+
+        conn->next = io_conns;
+        io_conns = rc_inc(conn);
+    }
+
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to start the implicit I/O receiver, error %s!", plc_tag_decode_error(rc));
+        rc_dec(conn);
+        return rc;
+    }
+
+    tag->io_conn = conn;
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+/*
+ * eip_cip_io_tag_close
+ *
+ * Called when the tag is destroyed, before the session is released.  The
+ * Forward Close is not waited for.  If the session goes away with the
+ * tag, the target times the connection out.
+ */
+
+void eip_cip_io_tag_close(ab_tag_p tag)
+{
+    eip_cip_io_conn_p conn = tag->io_conn;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(!conn) {
+        pdebug(DEBUG_DETAIL, "No connection to close.");
+        return;
+    }
+
+    if(tag->req) {
+        spin_block(&tag->req->lock) {
+            tag->req->abort_request = 1;
+        }
+
+        tag->req = rc_dec(tag->req);
+    }
+
+    if(io_mutex) {
+        int found = 0;
+
+        critical_block(io_mutex) {
+            eip_cip_io_conn_p *walker = &io_conns;
+
+            while(*walker && *walker != conn) {
+                walker = &((*walker)->next);
+            }
+
+            if(*walker) {
+                *walker = conn->next;
+                conn->next = NULL;
+                found = 1;
+            }
+        }
+
+        if(found) {
+            rc_dec(conn);
+        }
+    }
+
+    if(conn->state == IO_CONN_OPEN && tag->session) {
+        send_forward_close(tag);
+    }
+
+    tag->io_conn = rc_dec(conn);
+
+    pdebug(DEBUG_INFO, "Done.");
+}
+
+
+
+/*
+ * tag_abort
+ *
+ * Stops waiting for the next frame.  The connection stays open.
+ */
+
+int tag_abort(ab_tag_p tag)
+{
+    tag->read_in_progress = 0;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+/*
+ * tag_read_start
+ *
+ * The target pushes the data, so a read waits for the next new frame.
+ */
+
+int tag_read_start(ab_tag_p tag)
+{
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    if(!tag->io_conn) {
+        pdebug(DEBUG_WARN, "Tag has no implicit I/O connection!");
+        return PLCTAG_ERR_BAD_CONFIG;
+    }
+
+    tag->read_in_progress = 1;
+
+    tag_tickler(tag);
+
+    if(tag->read_in_progress) {
+        return PLCTAG_STATUS_PENDING;
+    }
+
+    return tag->status;
+}
+
+
+int tag_status(ab_tag_p tag)
+{
+    if(!tag->session) {
+        /* this is not OK.  This is fatal! */
+        return PLCTAG_ERR_CREATE;
+    }
+
+    if(tag->read_in_progress) {
+        return PLCTAG_STATUS_PENDING;
+    }
+
+    return tag->status;
+}
+
+
+int tag_write_start(ab_tag_p tag)
+{
+    pdebug(DEBUG_WARN, "Implicit I/O tags only consume data, writing is not supported!");
+
+    tag->write_in_progress = 0;
+
+    return PLCTAG_ERR_UNSUPPORTED;
+}
+
+
+
+/*
+ * tag_tickler
+ *
+ * Drives the connection state and moves new frames into the tag data.
+ * Called with the tag API mutex held.
+ */
+
+int tag_tickler(ab_tag_p tag)
+{
+    eip_cip_io_conn_p conn = tag->io_conn;
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    if(!conn) {
+        return tag->status;
+    }
+
+    /* the tag ID is not known until the tag is created. */
+    if(conn->tag_id != tag->tag_id) {
+        spin_block(&conn->lock) {
+            conn->tag_id = tag->tag_id;
+        }
+    }
+
+    switch(conn->state) {
+    case IO_CONN_CLOSED: {
+            int retry_due = 0;
+
+            spin_block(&conn->lock) {
+                retry_due = (conn->retry_time == 0);
+            }
+
+            if(!retry_due) {
+                break;
+            }
+
+            rc = send_forward_open(tag);
+            if(rc == PLCTAG_STATUS_PENDING) {
+                conn->state = IO_CONN_OPENING;
+                tag->status = PLCTAG_STATUS_PENDING;
+            } else {
+                open_failed(tag, rc);
+            }
+        }
+
+        break;
+
+    case IO_CONN_OPENING:
+        rc = check_forward_open(tag);
+        if(rc == PLCTAG_STATUS_PENDING) {
+            break;
+        }
+
+        if(rc != PLCTAG_STATUS_OK) {
+            open_failed(tag, rc);
+            break;
+        }
+
+        conn->state = IO_CONN_OPEN;
+
+        /* the data is not valid until the first frame. */
+        break;
+
+    case IO_CONN_OPEN: {
+            int timed_out = 0;
+            int new_data = 0;
+
+            spin_block(&conn->lock) {
+                if(conn->timed_out) {
+                    conn->timed_out = 0;
+                    conn->retry_time = time_ms() + EIP_CIP_IO_RETRY_MS;
+                    timed_out = 1;
+                } else {
+                    new_data = conn->new_data;
+                }
+            }
+
+            if(timed_out) {
+                pdebug(DEBUG_WARN, "Implicit I/O connection timed out, retrying in %dms.", EIP_CIP_IO_RETRY_MS);
+
+                conn->state = IO_CONN_CLOSED;
+                tag->status = PLCTAG_ERR_TIMEOUT;
+
+                if(tag->read_in_progress) {
+                    tag->read_in_progress = 0;
+                    tag->read_complete = 1;
+                }
+
+                break;
+            }
+
+            if(!new_data) {
+                break;
+            }
+
+            plc_tag_generic_data_write_begin((plc_tag_p)tag);
+
+            spin_block(&conn->lock) {
+                int size = (conn->data_size < tag->size ? conn->data_size : tag->size);
+
+                mem_copy(tag->data, conn->data, size);
+                conn->new_data = 0;
+            }
+
+            plc_tag_generic_data_write_end((plc_tag_p)tag);
+
+            tag->status = PLCTAG_STATUS_OK;
+            tag->read_in_progress = 0;
+            tag->read_complete = 1;
+        }
+
+        break;
+    }
+
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return tag->status;
+}
+
+
+
+void open_failed(ab_tag_p tag, int rc)
+{
+    eip_cip_io_conn_p conn = tag->io_conn;
+
+    pdebug(DEBUG_WARN, "Unable to open implicit I/O connection, error %s, retrying in %dms.", plc_tag_decode_error(rc), EIP_CIP_IO_RETRY_MS);
+
+    conn->state = IO_CONN_CLOSED;
+
+    spin_block(&conn->lock) {
+        conn->retry_time = time_ms() + EIP_CIP_IO_RETRY_MS;
+    }
+
+    tag->status = (int8_t)rc;
+
+    /* report the failure to anyone waiting. */
+    if(tag->read_in_progress) {
+        tag->read_in_progress = 0;
+        tag->read_complete = 1;
+    }
+}
+
+
+
+void conn_destroy(void *conn_arg)
+{
+    eip_cip_io_conn_p conn = (eip_cip_io_conn_p)conn_arg;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    if(conn->data) {
+        mem_free(conn->data);
+        conn->data = NULL;
+    }
+
+    pdebug(DEBUG_DETAIL, "Done.");
+}
+
+
+
+/*
+ * build_conn_path
+ *
+ * The route to the target followed by the application path.  Assemblies
+ * use the configuration, output and input connection points.  Anything
+ * else is a produced tag, addressed by name.
+ */
+
+int build_conn_path(ab_tag_p tag, eip_cip_io_conn_p conn, attr attribs)
+{
+    int needs_connection = 0;
+    uint8_t *route = NULL;
+    uint8_t route_size = 0;
+    uint16_t dhp_dest = 0;
+    int input_instance = attr_get_int(attribs, "io_input_instance", 0);
+    int output_instance = attr_get_int(attribs, "io_output_instance", 0);
+    int config_instance = attr_get_int(attribs, "io_config_instance", 0);
+    uint8_t *data = conn->conn_path;
+    int rc = PLCTAG_STATUS_OK;
+
+    rc = cip_encode_path(attr_get_str(attribs, "path", NULL), &needs_connection, tag->plc_type, &route, &route_size, &dhp_dest);
+    if(rc != PLCTAG_STATUS_OK) {
+        return rc;
+    }
+
+    if(route) {
+        mem_copy(data, route, route_size);
+        data += route_size;
+        mem_free(route);
+    }
+
+    if(input_instance || output_instance || config_instance) {
+        if(input_instance <= 0 || input_instance > 255 || output_instance <= 0 || output_instance > 255 || config_instance <= 0 || config_instance > 255) {
+            pdebug(DEBUG_WARN, "The io_input_instance, io_output_instance and io_config_instance attributes must all be between 1 and 255!");
+            return PLCTAG_ERR_BAD_PARAM;
+        }
+
+        *data++ = 0x20;     /* class */
+        *data++ = 0x04;     /* assembly */
+        *data++ = 0x24;     /* instance */
+        *data++ = (uint8_t)config_instance;
+        *data++ = 0x2C;     /* connection point */
+        *data++ = (uint8_t)output_instance;
+        *data++ = 0x2C;     /* connection point */
+        *data++ = (uint8_t)input_instance;
+    } else {
+        /* skip the word count at the start of the encoded name. */
+        if(tag->encoded_name_size < 2) {
+            pdebug(DEBUG_WARN, "A produced tag name or the assembly instances are required!");
+            return PLCTAG_ERR_BAD_PARAM;
+        }
+
+        mem_copy(data, &tag->encoded_name[1], tag->encoded_name_size - 1);
+        data += tag->encoded_name_size - 1;
+    }
+
+    conn->conn_path_size = (int)(data - conn->conn_path);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * Forward Open with UDP transport.  We pick the target to originator
+ * connection ID since that direction is point to point.
+ */
+
+int send_forward_open(ab_tag_p tag)
+{
+    eip_cip_io_conn_p conn = tag->io_conn;
+    eip_forward_open_request_t *fo = NULL;
+    ab_request_p req = NULL;
+    uint8_t *data = NULL;
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    rc = session_create_request(tag->session, tag->tag_id, tag->priority, tag->op_deadline, &req);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to get new request.  rc=%d", rc);
+        return rc;
+    }
+
+    if((int)(sizeof(*fo) + sizeof(eip_cip_io_sockaddr_item)) + conn->conn_path_size > req->request_capacity) {
+        pdebug(DEBUG_WARN, "Forward Open request is too large for the request buffer!");
+        rc_dec(req);
+        return PLCTAG_ERR_TOO_LARGE;
+    }
+
+    spin_block(&io_serial_lock) {
+        conn->conn_serial = ++io_conn_serial;
+    }
+
+    spin_block(&conn->lock) {
+        conn->t_o_conn_id = ((uint32_t)(rand() & 0xFFFF) << 16) | (uint32_t)conn->conn_serial;
+    }
+
+    mem_set(req->data, 0, (int)sizeof(*fo));
+
+    fo = (eip_forward_open_request_t *)(req->data);
+
+    /* point to the end of the struct */
+    data = (req->data) + sizeof(eip_forward_open_request_t);
+
+    /* set up the path information. */
+    mem_copy(data, conn->conn_path, conn->conn_path_size);
+    data += conn->conn_path_size;
+
+    /* encap header parts */
+    fo->encap_command = h2le16(AB_EIP_UNCONNECTED_SEND); /* 0x006F EIP Send RR Data command */
+    fo->router_timeout = h2le16(1);                       /* one second is enough ? */
+
+    /* CPF parts */
+    fo->cpf_item_count = h2le16(2);                  /* 3 if we send a socket address */
+    fo->cpf_nai_item_type = h2le16(AB_EIP_ITEM_NAI); /* null address item type */
+    fo->cpf_nai_item_length = h2le16(0);             /* no data, zero length */
+    fo->cpf_udi_item_type = h2le16(AB_EIP_ITEM_UDI); /* unconnected data item, 0x00B2 */
+    fo->cpf_udi_item_length = h2le16((uint16_t)(data - (uint8_t *)(&fo->cm_service_code))); /* length of remaining data in UC data item */
+
+    /* Connection Manager parts */
+    fo->cm_service_code = AB_EIP_CMD_FORWARD_OPEN; /* 0x54 Forward Open Request */
+    fo->cm_req_path_size = 2;                      /* size of path in 16-bit words */
+    fo->cm_req_path[0] = 0x20;                     /* class */
+    fo->cm_req_path[1] = 0x06;                     /* CM class */
+    fo->cm_req_path[2] = 0x24;                     /* instance */
+    fo->cm_req_path[3] = 0x01;                     /* instance 1 */
+
+    /* Forward Open Params */
+    fo->secs_per_tick = AB_EIP_SECS_PER_TICK;
+    fo->timeout_ticks = AB_EIP_TIMEOUT_TICKS;
+    fo->orig_to_targ_conn_id = h2le32(0);               /* the target picks this one. */
+    fo->targ_to_orig_conn_id = h2le32(conn->t_o_conn_id);
+    fo->conn_serial_number = h2le16(conn->conn_serial);
+    fo->orig_vendor_id = h2le16(AB_EIP_VENDOR_ID);
+    fo->orig_serial_number = h2le32(AB_EIP_VENDOR_SN);
+    fo->conn_timeout_multiplier = AB_EIP_TIMEOUT_MULTIPLIER;   /* timeout = (4 << mult) * RPI */
+    fo->orig_to_targ_rpi = h2le32(conn->rpi_us);
+    fo->orig_to_targ_conn_params = h2le16((uint16_t)(EIP_CIP_IO_CONN_PARAM | EIP_CIP_IO_HEARTBEAT_SIZE));
+    fo->targ_to_orig_rpi = h2le32(conn->rpi_us);
+    fo->targ_to_orig_conn_params = h2le16((uint16_t)(EIP_CIP_IO_CONN_PARAM | (conn->data_capacity + 2)));
+    fo->transport_class = EIP_CIP_IO_TRANSPORT_CLASS_1;
+    fo->path_size = (uint8_t)(conn->conn_path_size/2); /* size in 16-bit words */
+
+    /* tell the target where to send if we are not on the standard port. */
+    if(io_port != EIP_CIP_IO_DEFAULT_PORT) {
+        eip_cip_io_sockaddr_item *sa = (eip_cip_io_sockaddr_item *)data;
+
+        mem_set(sa, 0, (int)sizeof(*sa));
+        sa->item_type = h2le16(EIP_CIP_IO_ITEM_SOCKADDR_T_O);
+        sa->item_length = h2le16(16);
+        sa->sin_family[1] = 2;  /* AF_INET */
+        sa->sin_port[0] = (uint8_t)((io_port >> 8) & 0xFF);
+        sa->sin_port[1] = (uint8_t)(io_port & 0xFF);
+
+        data += sizeof(*sa);
+        fo->cpf_item_count = h2le16(3);
+    }
+
+    /* set the size of the request */
+    req->request_size = (int)(data - (req->data));
+    req->allow_packing = 0;
+
+    rc = session_add_request(tag->session, req);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_ERROR, "Unable to add request to session! rc=%d", rc);
+        rc_dec(req);
+        return rc;
+    }
+
+    tag->req = req;
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return PLCTAG_STATUS_PENDING;
+}
+
+
+
+int check_forward_open(ab_tag_p tag)
+{
+    eip_cip_io_conn_p conn = tag->io_conn;
+    eip_forward_open_response_t *fo_resp = NULL;
+    ab_request_p req = tag->req;
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    if(!req) {
+        pdebug(DEBUG_WARN, "Opening, but no request in flight!");
+        return PLCTAG_ERR_OPEN;
+    }
+
+    /* request can be used by two threads at once. */
+    spin_block(&req->lock) {
+        if(!req->resp_received) {
+            rc = PLCTAG_STATUS_PENDING;
+            break;
+        }
+
+        if(req->status != PLCTAG_STATUS_OK) {
+            rc = req->status;
+            req->abort_request = 1;
+
+            pdebug(DEBUG_WARN, "Session reported failure of request: %s.", plc_tag_decode_error(rc));
+        }
+    }
+
+    if(rc == PLCTAG_STATUS_PENDING) {
+        return rc;
+    }
+
+    if(rc != PLCTAG_STATUS_OK) {
+        tag->req = rc_dec(req);
+        return rc;
+    }
+
+    /* the request is ours exclusively. */
+    fo_resp = (eip_forward_open_response_t *)(req->data);
+
+    do {
+        uint32_t o_t_api_us = 0;
+        uint32_t t_o_api_us = 0;
+        uint32_t o_t_addr = conn->gateway_addr;
+        int o_t_port = EIP_CIP_IO_DEFAULT_PORT;
+        uint8_t *item = NULL;
+        uint8_t *data_end = req->data + req->request_size;
+        int num_items = 0;
+
+        if(req->request_size < (int)sizeof(*fo_resp)) {
+            pdebug(DEBUG_WARN, "Forward Open response is too short!");
+            rc = PLCTAG_ERR_BAD_DATA;
+            break;
+        }
+
+        if(le2h16(fo_resp->encap_command) != AB_EIP_UNCONNECTED_SEND) {
+            pdebug(DEBUG_WARN, "Unexpected EIP packet type received: %d!", le2h16(fo_resp->encap_command));
+            rc = PLCTAG_ERR_BAD_DATA;
+            break;
+        }
+
+        if(le2h32(fo_resp->encap_status) != AB_EIP_OK) {
+            pdebug(DEBUG_WARN, "EIP command failed, response code: %d", le2h32(fo_resp->encap_status));
+            rc = PLCTAG_ERR_REMOTE_ERR;
+            break;
+        }
+
+        if(fo_resp->general_status != AB_EIP_OK) {
+            pdebug(DEBUG_WARN, "Forward Open command failed, response code: %s (%s)", decode_cip_error_short(&fo_resp->general_status), decode_cip_error_long(&fo_resp->general_status));
+            rc = decode_cip_error_code(&fo_resp->general_status);
+            break;
+        }
+
+        o_t_api_us = le2h32(fo_resp->orig_to_targ_api);
+        t_o_api_us = le2h32(fo_resp->targ_to_orig_api);
+
+        /* look for the target's socket address in any extra CPF items. */
+        item = (uint8_t *)(&fo_resp->resp_service_code) + le2h16(fo_resp->cpf_udi_item_length);
+        num_items = (int)le2h16(fo_resp->cpf_item_count) - 2;
+
+        while(num_items > 0 && item + 4 <= data_end) {
+            uint16_t item_type = get_u16(item);
+            int item_length = (int)get_u16(item + 2);
+
+            item += 4;
+
+            if(item + item_length > data_end) {
+                break;
+            }
+
+            if(item_type == EIP_CIP_IO_ITEM_SOCKADDR_O_T && item_length >= 8) {
+                uint32_t addr = 0;
+
+                o_t_port = (int)(((int)item[2] << 8) | (int)item[3]);
+                mem_copy(&addr, item + 4, 4);
+
+                if(addr) {
+                    o_t_addr = addr;
+                }
+            }
+
+            item += item_length;
+            num_items--;
+        }
+
+        spin_block(&conn->lock) {
+            conn->o_t_conn_id = le2h32(fo_resp->orig_to_targ_conn_id);
+            conn->t_o_conn_id = le2h32(fo_resp->targ_to_orig_conn_id);
+            conn->o_t_addr = o_t_addr;
+            conn->o_t_port = o_t_port;
+            conn->heartbeat_ms = (o_t_api_us >= 1000 ? (int64_t)o_t_api_us / 1000 : 1);
+            conn->timeout_ms = ((int64_t)(t_o_api_us ? t_o_api_us : conn->rpi_us) * (4 << AB_EIP_TIMEOUT_MULTIPLIER)) / 1000 + 1;
+            conn->last_recv_time = time_ms();
+            conn->next_heartbeat = conn->last_recv_time;
+            conn->have_t_o_seq = 0;
+            conn->new_data = 0;
+            conn->timed_out = 0;
+            conn->retry_time = 0;
+            conn->active = 1;
+        }
+
+        pdebug(DEBUG_INFO, "Implicit I/O connection open, T->O ID %x at %uus, O->T ID %x at %uus.", conn->t_o_conn_id, t_o_api_us, conn->o_t_conn_id, o_t_api_us);
+
+        rc = PLCTAG_STATUS_OK;
+    } while(0);
+
+    tag->req = rc_dec(req);
+
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return rc;
+}
+
+
+
+int send_forward_close(ab_tag_p tag)
+{
+    eip_cip_io_conn_p conn = tag->io_conn;
+    eip_forward_close_req_t *fc = NULL;
+    ab_request_p req = NULL;
+    uint8_t *data = NULL;
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    rc = session_create_request(tag->session, tag->tag_id, tag->priority, tag->op_deadline, &req);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to get new request.  rc=%d", rc);
+        return rc;
+    }
+
+    if((int)sizeof(*fc) + conn->conn_path_size > req->request_capacity) {
+        pdebug(DEBUG_WARN, "Forward Close request is too large for the request buffer!");
+        rc_dec(req);
+        return PLCTAG_ERR_TOO_LARGE;
+    }
+
+    mem_set(req->data, 0, (int)sizeof(*fc));
+
+    fc = (eip_forward_close_req_t *)(req->data);
+
+    /* point to the end of the struct */
+    data = (req->data) + sizeof(*fc);
+
+    /* set up the path information. */
+    mem_copy(data, conn->conn_path, conn->conn_path_size);
+    data += conn->conn_path_size;
+
+    fc->encap_command = h2le16(AB_EIP_UNCONNECTED_SEND);
+    fc->router_timeout = h2le16(1);
+
+    fc->cpf_item_count = h2le16(2);
+    fc->cpf_nai_item_type = h2le16(AB_EIP_ITEM_NAI);
+    fc->cpf_nai_item_length = h2le16(0);
+    fc->cpf_udi_item_type = h2le16(AB_EIP_ITEM_UDI);
+    fc->cpf_udi_item_length = h2le16((uint16_t)(data - (uint8_t *)(&fc->cm_service_code)));
+
+    fc->cm_service_code = AB_EIP_CMD_FORWARD_CLOSE;
+    fc->cm_req_path_size = 2;
+    fc->cm_req_path[0] = 0x20;
+    fc->cm_req_path[1] = 0x06;
+    fc->cm_req_path[2] = 0x24;
+    fc->cm_req_path[3] = 0x01;
+
+    fc->secs_per_tick = AB_EIP_SECS_PER_TICK;
+    fc->timeout_ticks = AB_EIP_TIMEOUT_TICKS;
+    fc->conn_serial_number = h2le16(conn->conn_serial);
+    fc->orig_vendor_id = h2le16(AB_EIP_VENDOR_ID);
+    fc->orig_serial_number = h2le32(AB_EIP_VENDOR_SN);
+    fc->path_size = (uint8_t)(conn->conn_path_size/2);
+
+    req->request_size = (int)(data - (req->data));
+    req->allow_packing = 0;
+
+    rc = session_add_request(tag->session, req);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to add request to session! rc=%d", rc);
+    }
+
+    /* nobody waits for the response. */
+    rc_dec(req);
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return rc;
+}
+
+
+
+/*
+ * The receiver.  Must be called with the I/O mutex held.
+ */
+
+int start_receiver_unsafe(int port)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    rc = socket_create(&io_sock);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to create UDP socket!");
+        io_sock = NULL;
+        return rc;
+    }
+
+    rc = socket_udp_open(io_sock, port);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to open UDP port %d!", port);
+        socket_destroy(&io_sock);
+        io_sock = NULL;
+        return rc;
+    }
+
+    io_port = port;
+    io_terminate = 0;
+
+    rc = thread_create(&io_thread, io_handler, 32*1024, NULL);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to create implicit I/O thread!");
+        io_thread = NULL;
+        socket_close(io_sock);
+        socket_destroy(&io_sock);
+        io_sock = NULL;
+        return rc;
+    }
+
+    plc_tag_generic_tune_thread(io_thread, PLCTAG_THREAD_SESSION);
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return rc;
+}
+
+
+THREAD_FUNC(io_handler)
+{
+    uint8_t frame[EIP_CIP_IO_MAX_FRAME];
+
+    (void)arg;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    while(!io_terminate) {
+        int wait_ms = service_conns();
+        int rc = socket_wait_event(io_sock, SOCKET_EVENT_READ, wait_ms);
+
+        if(rc > 0 && (rc & SOCKET_EVENT_READ)) {
+            int size = 0;
+
+            while(!io_terminate && (size = socket_udp_recv(io_sock, frame, (int)sizeof(frame), NULL)) > 0) {
+                handle_frame(frame, size);
+            }
+
+            if(size < 0) {
+                sleep_ms(EIP_CIP_IO_MAX_WAIT_MS);
+            }
+        } else if(rc < 0 && rc != PLCTAG_ERR_TIMEOUT) {
+            pdebug(DEBUG_WARN, "Error %s waiting for UDP frames!", plc_tag_decode_error(rc));
+            sleep_ms(EIP_CIP_IO_MAX_WAIT_MS);
+        }
+    }
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    THREAD_RETURN(0);
+}
+
+
+/*
+ * service_conns
+ *
+ * Send heartbeats that are due, notice connections that timed out and
+ * wake tags that can retry.  Returns how long the thread can wait.
+ */
+
+int service_conns(void)
+{
+    int32_t wake_ids[EIP_CIP_IO_MAX_WAKE];
+    int num_wake = 0;
+    int64_t now = time_ms();
+    int64_t wait_ms = EIP_CIP_IO_MAX_WAIT_MS;
+
+    critical_block(io_mutex) {
+        for(eip_cip_io_conn_p conn = io_conns; conn; conn = conn->next) {
+            eip_cip_io_frame hb;
+            int send_heartbeat = 0;
+            int32_t wake_id = 0;
+
+            /* come back for the rest. */
+            if(num_wake >= EIP_CIP_IO_MAX_WAKE) {
+                wait_ms = 1;
+                break;
+            }
+
+            spin_block(&conn->lock) {
+                if(conn->active) {
+                    if(now - conn->last_recv_time > conn->timeout_ms) {
+                        conn->active = 0;
+                        conn->timed_out = 1;
+                        wake_id = conn->tag_id;
+                        break;
+                    }
+
+                    if(now >= conn->next_heartbeat) {
+                        hb.item_count = h2le16(2);
+                        hb.sai_item_type = h2le16(EIP_CIP_IO_ITEM_SEQ_ADDR);
+                        hb.sai_item_length = h2le16(8);
+                        hb.conn_id = h2le32(conn->o_t_conn_id);
+                        hb.encap_seq_num = h2le32(++(conn->o_t_seq));
+                        hb.cdi_item_type = h2le16(AB_EIP_ITEM_CDI);
+                        hb.cdi_item_length = h2le16(EIP_CIP_IO_HEARTBEAT_SIZE);
+                        hb.seq_count = h2le16(0);  /* no data, so it never changes. */
+
+                        send_heartbeat = 1;
+
+                        conn->next_heartbeat += conn->heartbeat_ms;
+                        if(conn->next_heartbeat <= now) {
+                            conn->next_heartbeat = now + conn->heartbeat_ms;
+                        }
+                    }
+
+                    if(conn->next_heartbeat - now < wait_ms) {
+                        wait_ms = conn->next_heartbeat - now;
+                    }
+                } else if(conn->retry_time && now >= conn->retry_time && conn->tag_id) {
+                    conn->retry_time = 0;
+                    wake_id = conn->tag_id;
+                }
+            }
+
+            if(send_heartbeat) {
+                socket_udp_send(io_sock, (uint8_t *)&hb, (int)sizeof(hb), conn->o_t_addr, conn->o_t_port);
+            }
+
+            if(wake_id) {
+                wake_ids[num_wake] = wake_id;
+                num_wake++;
+            }
+        }
+    }
+
+    /* outside the mutex, waking takes other locks. */
+    for(int i=0; i < num_wake; i++) {
+        plc_tag_generic_wake_tag(wake_ids[i]);
+    }
+
+    return (wait_ms > 0 ? (int)wait_ms : 1);
+}
+
+
+
+/*
+ * handle_frame
+ *
+ * Frames carry a sequenced address item with the connection ID and a
+ * connected data item with the sequence count followed by the data.
+ */
+
+void handle_frame(uint8_t *frame, int size)
+{
+    uint8_t *item = frame + 2;
+    uint8_t *frame_end = frame + size;
+    uint8_t *cdi = NULL;
+    int cdi_length = 0;
+    uint32_t conn_id = 0;
+    uint32_t seq_num = 0;
+    int have_addr = 0;
+    int num_items = 0;
+    int32_t wake_id = 0;
+
+    if(size < 2) {
+        return;
+    }
+
+    num_items = (int)get_u16(frame);
+
+    while(num_items > 0 && item + 4 <= frame_end) {
+        uint16_t item_type = get_u16(item);
+        int item_length = (int)get_u16(item + 2);
+
+        item += 4;
+
+        if(item + item_length > frame_end) {
+            pdebug(DEBUG_DETAIL, "Truncated implicit I/O frame.");
+            return;
+        }
+
+        if(item_type == EIP_CIP_IO_ITEM_SEQ_ADDR && item_length >= 8) {
+            conn_id = get_u32(item);
+            seq_num = get_u32(item + 4);
+            have_addr = 1;
+        } else if(item_type == AB_EIP_ITEM_CDI) {
+            cdi = item;
+            cdi_length = item_length;
+        }
+
+        item += item_length;
+        num_items--;
+    }
+
+    if(!have_addr || !cdi || cdi_length < 2) {
+        pdebug(DEBUG_DETAIL, "Ignoring UDP frame that is not for a class 1 connection.");
+        return;
+    }
+
+    critical_block(io_mutex) {
+        for(eip_cip_io_conn_p conn = io_conns; conn; conn = conn->next) {
+            int found = 0;
+
+            spin_block(&conn->lock) {
+                uint16_t seq_count = 0;
+                int data_size = 0;
+
+                if(!conn->active || conn->t_o_conn_id != conn_id) {
+                    break;
+                }
+
+                found = 1;
+
+                /* drop late frames. */
+                if(conn->have_t_o_seq && (int32_t)(seq_num - conn->t_o_seq) <= 0) {
+                    break;
+                }
+
+                seq_count = get_u16(cdi);
+                conn->last_recv_time = time_ms();
+
+                /* the same sequence count means the data did not change. */
+                if(conn->have_t_o_seq && seq_count == conn->t_o_seq_count) {
+                    conn->t_o_seq = seq_num;
+                    break;
+                }
+
+                data_size = cdi_length - 2;
+                if(data_size > conn->data_capacity) {
+                    data_size = conn->data_capacity;
+                }
+
+                mem_copy(conn->data, cdi + 2, data_size);
+                conn->data_size = data_size;
+                conn->t_o_seq = seq_num;
+                conn->t_o_seq_count = seq_count;
+                conn->have_t_o_seq = 1;
+                conn->new_data = 1;
+
+                wake_id = conn->tag_id;
+            }
+
+            if(found) {
+                break;
+            }
+        }
+    }
+
+    if(wake_id) {
+        plc_tag_generic_wake_tag(wake_id);
+    }
+}
@@ -0,0 +1,54 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#ifndef __LIBPLCTAG_AB_EIP_CIP_IO_H__
+#define __LIBPLCTAG_AB_EIP_CIP_IO_H__
+
+#include <ab/ab_common.h>
+#include <util/attr.h>
+
+/*
+ * CIP Class 1 implicit I/O.  A tag with io_rpi_ms set opens a Forward Open
+ * with UDP transport and the target produces the data at the RPI.  Frames
+ * from all connections land on one UDP socket serviced by a library thread.
+ */
+
+extern struct tag_vtable_t eip_cip_io_vtable;
+
+extern int eip_cip_io_init(void);
+extern void eip_cip_io_teardown(void);
+
+extern int eip_cip_io_tag_setup(ab_tag_p tag, attr attribs);
+extern void eip_cip_io_tag_close(ab_tag_p tag);
+
+#endif
@@ -0,0 +1,1205 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <ctype.h>
+#include <stddef.h>
+#include <platform.h>
+#include <lib/libplctag.h>
+#include <lib/tag.h>
+#include <ab/defs.h>
+#include <ab/ab_common.h>
+#include <ab/cip.h>
+#include <ab/tag.h>
+#include <ab/session.h>
+#include <ab/eip_cip_udt.h>
+#include <ab/error_codes.h>
+#include <ab/meta_cache.h>
+#include <util/attr.h>
+#include <util/debug.h>
+#include <util/rc.h>
+
+
+/*
+ * Logix UDT templates.
+ *
+ * The controller tag listing gives the symbol type of each tag.  For a
+ * structure that holds the template instance ID.  The template is read
+ * in two steps: Get Attribute List on the Template object for the sizes
+ * and member count, then Read Template for the member definitions.  The
+ * definitions are followed by the template name and then the member
+ * names, all zero terminated.
+ *
+ * The templates needed by a tag are read during its first read.  That is
+ * the template of the symbol, those of any members named in the tag name
+ * and those of all nested structures.  Each template is read once per
+ * session, the other tags on the session find it there.
+ */
+
+/* how deep structures can nest before we stop looking for templates. */
+#define MAX_UDT_NESTING (16)
+
+/* the Read Template reply is this much shorter than the definition size says. */
+#define UDT_DEFINITION_OVERHEAD (23)
+
+/* each member definition is the info word, the type word and the offset. */
+#define UDT_MEMBER_DEFINITION_SIZE (8)
+
+struct ab_udt_fetch_t {
+    uint16_t template_id;
+    int reading_definition;
+
+    /* from the template attributes. */
+    uint32_t definition_words;
+    uint32_t struct_size;
+    uint16_t member_count;
+    uint16_t handle;
+
+    /* the member definitions and names. */
+    uint8_t *definition;
+    int definition_size;
+    int definition_read;
+};
+
+/* a member path already turned into an offset. */
+struct ab_udt_offset_t {
+    struct ab_udt_offset_t *next;
+    int offset;
+    char path[];
+};
+
+
+static int find_missing_template(ab_tag_p tag, uint16_t *missing_id, uint16_t *udt_id);
+static int find_missing_nested_template(ab_tag_p tag, uint16_t template_id, int depth, uint16_t *missing_id);
+static ab_udt_member_t *find_member(ab_udt_p udt, const char *name, int name_len);
+static int build_template_request(ab_tag_p tag);
+static int decode_template_attributes(struct ab_udt_fetch_t *fetch, uint8_t *data, uint8_t *data_end);
+static int decode_template_definition(struct ab_udt_fetch_t *fetch, ab_udt_p *udt);
+static int resolve_member_path(ab_tag_p tag, const char *member_path);
+static int parse_index(const char **path, uint32_t *index);
+static int atomic_type_size(uint16_t type);
+static int name_is_plain_symbol(ab_tag_p tag);
+static void give_up_on_templates(ab_tag_p tag);
+
+
+
+/*
+ * eip_cip_udt_resolve
+ *
+ * Called once the symbol type of the tag is known.  Queue a request for
+ * the first template the tag needs that the session does not have yet.
+ * When all are there, note the template of the tag data.
+ *
+ * Returns PLCTAG_STATUS_PENDING if a template request was queued.  If
+ * the tag name does not match the templates, member lookup is turned off
+ * and the tag reads as normal.
+ */
+
+int eip_cip_udt_resolve(ab_tag_p tag)
+{
+    int rc = PLCTAG_STATUS_OK;
+    uint16_t missing_id = 0;
+    uint16_t udt_id = 0;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    rc = find_missing_template(tag, &missing_id, &udt_id);
+    if(rc == PLCTAG_STATUS_OK) {
+        tag->udt_id = udt_id;
+        tag->udt_resolved = 1;
+
+        pdebug(DEBUG_DETAIL, "Done.  Tag data uses template %u.", (unsigned int)udt_id);
+
+        return PLCTAG_STATUS_OK;
+    }
+
+    if(rc != PLCTAG_STATUS_PENDING) {
+        pdebug(DEBUG_WARN, "Tag name does not match the UDT templates, error %s!", plc_tag_decode_error(rc));
+        tag->udt_templates = 0;
+        return PLCTAG_STATUS_OK;
+    }
+
+    tag->udt_fetch = mem_alloc((int)sizeof(*(tag->udt_fetch)));
+    if(!tag->udt_fetch) {
+        pdebug(DEBUG_WARN, "Unable to allocate template read state!");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    tag->udt_fetch->template_id = missing_id;
+
+    rc = build_template_request(tag);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to build template request, error %s!", plc_tag_decode_error(rc));
+        eip_cip_udt_abort(tag);
+        return rc;
+    }
+
+    pdebug(DEBUG_DETAIL, "Done.  Reading template %u.", (unsigned int)missing_id);
+
+    return PLCTAG_STATUS_PENDING;
+}
+
+
+
+/*
+ * eip_cip_udt_check_status
+ *
+ * Process a template response.  Returns PLCTAG_STATUS_PENDING while
+ * more requests are needed and PLCTAG_STATUS_OK when the template is in
+ * the session or the PLC refused to give it.  In the latter case member
+ * lookup is turned off for the tag.
+ */
+
+int eip_cip_udt_check_status(ab_tag_p tag)
+{
+    int rc = PLCTAG_STATUS_OK;
+    struct ab_udt_fetch_t *fetch = tag->udt_fetch;
+    eip_cip_co_resp* cip_resp;
+    uint8_t* data;
+    uint8_t* data_end;
+    uint8_t expected_service = 0;
+    int partial_data = 0;
+    int refused = 0;
+    ab_udt_p udt = NULL;
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    if (!tag->req) {
+        pdebug(DEBUG_WARN,"Template read in progress, but no request in flight!");
+        eip_cip_udt_abort(tag);
+        return PLCTAG_ERR_READ;
+    }
+
+    /* request can be used by two threads at once. */
+    spin_block(&tag->req->lock) {
+        if(!tag->req->resp_received) {
+            rc = PLCTAG_STATUS_PENDING;
+            break;
+        }
+
+        /* check to see if it was an abort on the session side. */
+        if(tag->req->status != PLCTAG_STATUS_OK) {
+            rc = tag->req->status;
+            tag->req->abort_request = 1;
+
+            pdebug(DEBUG_WARN,"Session reported failure of request: %s.", plc_tag_decode_error(rc));
+
+            break;
+        }
+    }
+
+    if(rc != PLCTAG_STATUS_OK) {
+        if(rc_is_error(rc)) {
+            /* the request is dead, from session side. */
+            tag->req = rc_dec(tag->req);
+            eip_cip_udt_abort(tag);
+        }
+
+        return rc;
+    }
+
+    /* the request is ours exclusively. */
+
+    cip_resp = (eip_cip_co_resp*)(tag->req->data);
+    data_end = (tag->req->data + le2h16(cip_resp->encap_length) + sizeof(eip_encap));
+    data = (tag->req->data) + sizeof(eip_cip_co_resp) + (cip_resp->num_status_words * 2);
+
+    expected_service = (uint8_t)((fetch->reading_definition ? AB_EIP_CMD_CIP_READ : AB_EIP_CMD_CIP_GET_ATTR_LIST) | AB_EIP_CMD_CIP_OK);
+
+    do {
+        if (le2h16(cip_resp->encap_command) != AB_EIP_CONNECTED_SEND) {
+            pdebug(DEBUG_WARN, "Unexpected EIP packet type received: %d!", cip_resp->encap_command);
+            rc = PLCTAG_ERR_BAD_DATA;
+            break;
+        }
+
+        if (le2h32(cip_resp->encap_status) != AB_EIP_OK) {
+            pdebug(DEBUG_WARN, "EIP command failed, response code: %d", le2h32(cip_resp->encap_status));
+            rc = PLCTAG_ERR_REMOTE_ERR;
+            break;
+        }
+
+        if (cip_resp->reply_service != expected_service) {
+            pdebug(DEBUG_WARN, "CIP response reply service unexpected: %d", cip_resp->reply_service);
+            rc = PLCTAG_ERR_BAD_DATA;
+            break;
+        }
+
+        if (cip_resp->status != AB_CIP_STATUS_OK && cip_resp->status != AB_CIP_STATUS_FRAG) {
+            pdebug(DEBUG_WARN, "CIP template read failed with status: 0x%x %s", cip_resp->status, decode_cip_error_short((uint8_t *)&cip_resp->status));
+            refused = 1;
+            break;
+        }
+
+        if(data > data_end) {
+            pdebug(DEBUG_WARN, "Template response is too short!");
+            rc = PLCTAG_ERR_BAD_DATA;
+            break;
+        }
+
+        partial_data = (cip_resp->status == AB_CIP_STATUS_FRAG);
+
+        if(!fetch->reading_definition) {
+            rc = decode_template_attributes(fetch, data, data_end);
+            if(rc != PLCTAG_STATUS_OK) {
+                refused = 1;
+                rc = PLCTAG_STATUS_OK;
+            }
+
+            break;
+        }
+
+        /* copy the next part of the definition. */
+        {
+            int amount = (int)(data_end - data);
+
+            if(amount > fetch->definition_size - fetch->definition_read) {
+                amount = fetch->definition_size - fetch->definition_read;
+            }
+
+            mem_copy(fetch->definition + fetch->definition_read, data, amount);
+            fetch->definition_read += amount;
+
+            /* a short reply without the partial flag means that was all of it. */
+            if(amount <= 0) {
+                partial_data = 0;
+            }
+        }
+    } while(0);
+
+    /* clean up the request */
+    tag->req->abort_request = 1;
+    tag->req = rc_dec(tag->req);
+
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Error received: %s!", plc_tag_decode_error(rc));
+        eip_cip_udt_abort(tag);
+        return rc;
+    }
+
+    if(refused) {
+        give_up_on_templates(tag);
+        return PLCTAG_STATUS_OK;
+    }
+
+    /* after the attributes, or part of the definition, ask for the rest. */
+    if(!fetch->reading_definition || (partial_data && fetch->definition_read < fetch->definition_size)) {
+        fetch->reading_definition = 1;
+
+        rc = build_template_request(tag);
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Unable to build template request, error %s!", plc_tag_decode_error(rc));
+            eip_cip_udt_abort(tag);
+            return rc;
+        }
+
+        pdebug(DEBUG_SPEW, "Done.  Reading more of the template.");
+
+        return PLCTAG_STATUS_PENDING;
+    }
+
+    rc = decode_template_definition(fetch, &udt);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to decode template %u, error %s!", (unsigned int)fetch->template_id, plc_tag_decode_error(rc));
+        give_up_on_templates(tag);
+        return PLCTAG_STATUS_OK;
+    }
+
+    pdebug(DEBUG_INFO, "Read template %u, %s, with %d members.", (unsigned int)udt->template_id, udt->name, udt->member_count);
+
+    meta_cache_add_template(tag->session, fetch->template_id, fetch->handle, fetch->struct_size, fetch->member_count, fetch->definition, fetch->definition_read);
+
+    rc = session_add_udt(tag->session, fetch->template_id, udt);
+
+    eip_cip_udt_abort(tag);
+
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return rc;
+}
+
+
+
+/*
+ * eip_cip_udt_get_member_offset
+ *
+ * Turn a member path such as "Motor.Speed" or "[2].Data[3]" into a byte
+ * offset in the tag data.  The result is kept so that the next call with
+ * the same path is just a lookup.
+ */
+
+int eip_cip_udt_get_member_offset(plc_tag_p p_tag, const char *member_path)
+{
+    ab_tag_p tag = (ab_tag_p)p_tag;
+    struct ab_udt_offset_t *entry = NULL;
+    int path_len = 0;
+    int offset = 0;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    if(!tag->udt_templates) {
+        pdebug(DEBUG_WARN, "Tag does not have UDT templates!");
+        return PLCTAG_ERR_UNSUPPORTED;
+    }
+
+    if(!tag->udt_resolved) {
+        pdebug(DEBUG_WARN, "UDT templates are not read yet!");
+        return PLCTAG_ERR_BUSY;
+    }
+
+    for(entry = tag->udt_offsets; entry; entry = entry->next) {
+        if(str_cmp_i(entry->path, member_path) == 0) {
+            pdebug(DEBUG_DETAIL, "Done.  Found %s at offset %d.", member_path, entry->offset);
+            return entry->offset;
+        }
+    }
+
+    offset = resolve_member_path(tag, member_path);
+    if(offset < 0) {
+        pdebug(DEBUG_WARN, "Unable to find member %s, error %s!", member_path, plc_tag_decode_error(offset));
+        return offset;
+    }
+
+    path_len = str_length(member_path);
+
+    entry = mem_alloc((int)sizeof(*entry) + path_len + 1);
+    if(entry) {
+        entry->offset = offset;
+        mem_copy(entry->path, (void *)member_path, path_len);
+        entry->next = tag->udt_offsets;
+        tag->udt_offsets = entry;
+    }
+
+    pdebug(DEBUG_DETAIL, "Done.  Member %s is at offset %d.", member_path, offset);
+
+    return offset;
+}
+
+
+
+/* drop the template read state, the request itself is the tag's. */
+void eip_cip_udt_abort(ab_tag_p tag)
+{
+    if(tag->udt_fetch) {
+        if(tag->udt_fetch->definition) {
+            mem_free(tag->udt_fetch->definition);
+        }
+
+        mem_free(tag->udt_fetch);
+        tag->udt_fetch = NULL;
+    }
+}
+
+
+
+void eip_cip_udt_tag_close(ab_tag_p tag)
+{
+    eip_cip_udt_abort(tag);
+
+    while(tag->udt_offsets) {
+        struct ab_udt_offset_t *entry = tag->udt_offsets;
+
+        tag->udt_offsets = entry->next;
+        mem_free(entry);
+    }
+}
+
+
+
+/*
+ * eip_cip_udt_known_type
+ *
+ * Fill in the CIP type and element size of the tag without reading it.
+ * The type comes from elem_type if the application gave one, otherwise
+ * from the symbol type in the session tag listing and, for structures,
+ * the session template cache.  Returns PLCTAG_ERR_NOT_FOUND if the type
+ * is not known yet and the tag has to be read first.
+ */
+
+int eip_cip_udt_known_type(ab_tag_p tag, attr attribs)
+{
+    static const struct { const char *name; uint8_t type; } types[] = {
+        { "bool", 0xC1 }, { "sint", 0xC2 }, { "int", 0xC3 }, { "dint", 0xC4 },
+        { "lint", 0xC5 }, { "usint", 0xC6 }, { "uint", 0xC7 }, { "udint", 0xC8 },
+        { "ulint", 0xC9 }, { "real", 0xCA }, { "lreal", 0xCB }, { "bool array", 0xD3 }
+    };
+    const char *elem_type = attr_get_str(attribs, "elem_type", NULL);
+    uint32_t instance_id = 0;
+    uint32_t next_id = 0;
+    uint16_t symbol_type = 0;
+    ab_udt_p udt = NULL;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    if(tag->is_bit) {
+        pdebug(DEBUG_DETAIL, "Done.  Bit tags need the data read first.");
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    if(elem_type) {
+        for(size_t i=0; i < sizeof(types)/sizeof(types[0]); i++) {
+            if(str_cmp_i(elem_type, types[i].name) == 0) {
+                tag->encoded_type_info[0] = types[i].type;
+                tag->encoded_type_info[1] = 0;
+                tag->encoded_type_info_size = 2;
+                tag->elem_size = atomic_type_size(types[i].type);
+
+                pdebug(DEBUG_DETAIL, "Done.  Type 0x%x from elem_type.", (unsigned int)types[i].type);
+
+                return PLCTAG_STATUS_OK;
+            }
+        }
+
+        pdebug(DEBUG_DETAIL, "Done.  No CIP type for elem_type %s.", elem_type);
+
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    /* the symbol type only describes the data of the whole symbol or one element of it. */
+    if(!name_is_plain_symbol(tag)) {
+        pdebug(DEBUG_DETAIL, "Done.  Tag name has more than a symbol and indexes.");
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    if(session_find_symbol_id(tag->session, &tag->encoded_name[3], tag->encoded_name[2], &instance_id, &symbol_type, &next_id) != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_DETAIL, "Done.  Symbol not in the session tag listing.");
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    if(symbol_type & AB_UDT_TYPE_STRUCT) {
+        udt = session_find_udt(tag->session, (uint16_t)(symbol_type & AB_UDT_TYPE_ID_MASK));
+        if(!udt) {
+            pdebug(DEBUG_DETAIL, "Done.  Template 0x%x not in the session cache.", (unsigned int)(symbol_type & AB_UDT_TYPE_ID_MASK));
+            return PLCTAG_ERR_NOT_FOUND;
+        }
+
+        tag->encoded_type_info[0] = 0xA0;     /* structure */
+        tag->encoded_type_info[1] = 0x02;     /* handle length */
+        tag->encoded_type_info[2] = (uint8_t)(udt->handle & 0xFF);
+        tag->encoded_type_info[3] = (uint8_t)((udt->handle >> 8) & 0xFF);
+        tag->encoded_type_info_size = 4;
+        tag->elem_size = (int)udt->struct_size;
+    } else {
+        /* BOOL arrays are packed in DWORDs, let the read sort those out. */
+        if((symbol_type & 0xFF) == 0xC1 || atomic_type_size(symbol_type) <= 0) {
+            pdebug(DEBUG_DETAIL, "Done.  Symbol type 0x%x needs a read.", (unsigned int)symbol_type);
+            return PLCTAG_ERR_NOT_FOUND;
+        }
+
+        tag->encoded_type_info[0] = (uint8_t)(symbol_type & 0xFF);
+        tag->encoded_type_info[1] = 0;
+        tag->encoded_type_info_size = 2;
+        tag->elem_size = atomic_type_size(symbol_type);
+    }
+
+    pdebug(DEBUG_DETAIL, "Done.  Type 0x%x from the session caches.", (unsigned int)symbol_type);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+
+/*
+ * eip_cip_udt_from_definition
+ *
+ * Build a template from a definition read earlier, for the metadata
+ * cache.  The definition is copied.
+ */
+
+int eip_cip_udt_from_definition(uint16_t template_id, uint16_t handle, uint32_t struct_size, uint16_t member_count, const uint8_t *definition, int definition_size, ab_udt_p *udt)
+{
+    struct ab_udt_fetch_t fetch;
+
+    mem_set(&fetch, 0, (int)sizeof(fetch));
+
+    fetch.template_id = template_id;
+    fetch.handle = handle;
+    fetch.struct_size = struct_size;
+    fetch.member_count = member_count;
+    fetch.definition = (uint8_t *)definition;
+    fetch.definition_size = definition_size;
+    fetch.definition_read = definition_size;
+
+    return decode_template_definition(&fetch, udt);
+}
+
+
+
+/*************************************************************************
+ **************************** Helper Functions ***************************
+ ************************************************************************/
+
+
+/*
+ * find_missing_template
+ *
+ * Follow the tag name from the symbol type through any member segments
+ * to the type of the tag data.  Returns PLCTAG_STATUS_PENDING with the
+ * ID of the first template needed that the session does not have.
+ */
+
+int find_missing_template(ab_tag_p tag, uint16_t *missing_id, uint16_t *udt_id)
+{
+    uint8_t *encoded_name = (tag->symbolic_name ? tag->symbolic_name : tag->encoded_name);
+    int encoded_name_size = (tag->symbolic_name ? tag->symbolic_name_size : tag->encoded_name_size);
+    uint8_t *segment = &encoded_name[1];
+    uint8_t *name_end = encoded_name + encoded_name_size;
+    uint16_t type = tag->symbol_type;
+
+    /* skip the symbol itself. */
+    segment += 2 + segment[1] + (segment[1] & 0x01);
+
+    while(segment < name_end) {
+        if(segment[0] == 0x91) {
+            ab_udt_p udt = NULL;
+            ab_udt_member_t *member = NULL;
+
+            if(!(type & AB_UDT_TYPE_STRUCT)) {
+                pdebug(DEBUG_WARN, "Tag name has a member of something that is not a structure!");
+                return PLCTAG_ERR_NOT_FOUND;
+            }
+
+            udt = session_find_udt(tag->session, (uint16_t)(type & AB_UDT_TYPE_ID_MASK));
+            if(!udt) {
+                *missing_id = (uint16_t)(type & AB_UDT_TYPE_ID_MASK);
+                return PLCTAG_STATUS_PENDING;
+            }
+
+            member = find_member(udt, (const char *)&segment[2], segment[1]);
+            if(!member) {
+                pdebug(DEBUG_WARN, "Member is not in template %s!", udt->name);
+                return PLCTAG_ERR_NOT_FOUND;
+            }
+
+            type = member->type;
+            segment += 2 + segment[1] + (segment[1] & 0x01);
+        } else if(segment[0] == 0x28) {
+            segment += 2;
+        } else if(segment[0] == 0x29) {
+            segment += 4;
+        } else if(segment[0] == 0x2A) {
+            segment += 6;
+        } else {
+            pdebug(DEBUG_WARN, "Unsupported segment type 0x%x in tag name!", segment[0]);
+            return PLCTAG_ERR_UNSUPPORTED;
+        }
+    }
+
+    if(!(type & AB_UDT_TYPE_STRUCT)) {
+        *udt_id = 0;
+        return PLCTAG_STATUS_OK;
+    }
+
+    *udt_id = (uint16_t)(type & AB_UDT_TYPE_ID_MASK);
+
+    return find_missing_nested_template(tag, *udt_id, 0, missing_id);
+}
+
+
+
+int find_missing_nested_template(ab_tag_p tag, uint16_t template_id, int depth, uint16_t *missing_id)
+{
+    ab_udt_p udt = session_find_udt(tag->session, template_id);
+
+    if(!udt) {
+        *missing_id = template_id;
+        return PLCTAG_STATUS_PENDING;
+    }
+
+    if(depth >= MAX_UDT_NESTING) {
+        pdebug(DEBUG_WARN, "Structures nest too deeply, not looking further.");
+        return PLCTAG_STATUS_OK;
+    }
+
+    for(int i=0; i < udt->member_count; i++) {
+        if(udt->members[i].type & AB_UDT_TYPE_STRUCT) {
+            int rc = find_missing_nested_template(tag, (uint16_t)(udt->members[i].type & AB_UDT_TYPE_ID_MASK), depth + 1, missing_id);
+
+            if(rc != PLCTAG_STATUS_OK) {
+                return rc;
+            }
+        }
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/* Logix member names are not case sensitive. */
+ab_udt_member_t *find_member(ab_udt_p udt, const char *name, int name_len)
+{
+    for(int i=0; i < udt->member_count; i++) {
+        const char *member_name = udt->members[i].name;
+        int j = 0;
+
+        for(j=0; j < name_len && member_name[j]; j++) {
+            if(tolower((unsigned char)member_name[j]) != tolower((unsigned char)name[j])) {
+                break;
+            }
+        }
+
+        if(j == name_len && !member_name[j]) {
+            return &(udt->members[i]);
+        }
+    }
+
+    return NULL;
+}
+
+
+
+/*
+ * build_template_request
+ *
+ * Queue either the Get Attribute List request for the template sizes or
+ * a Read Template request for the next part of the definition.
+ */
+
+int build_template_request(ab_tag_p tag)
+{
+    struct ab_udt_fetch_t *fetch = tag->udt_fetch;
+    eip_cip_co_req* cip = NULL;
+    ab_request_p req = NULL;
+    int rc = PLCTAG_STATUS_OK;
+    uint8_t *data_start = NULL;
+    uint8_t *data = NULL;
+    uint16_le tmp_u16 = UINT16_LE_INIT(0);
+    uint32_le tmp_u32 = UINT32LE_INIT(0);
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    rc = session_create_request(tag->session, tag->tag_id, tag->priority, tag->op_deadline, &req);
+    if (rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_ERROR, "Unable to get new request.  rc=%d", rc);
+        return rc;
+    }
+
+    cip = (eip_cip_co_req*)(req->data);
+    data_start = data = (uint8_t*)(cip + 1);
+
+    *data = (fetch->reading_definition ? AB_EIP_CMD_CIP_READ : AB_EIP_CMD_CIP_GET_ATTR_LIST);
+    data++;
+
+    /* the template instance. */
+    *data = 3;      /* path size in words */
+    data++;
+
+    data[0] = 0x20; /* class type */
+    data[1] = 0x6C; /* template class */
+    data[2] = 0x25; /* 16-bit instance ID type */
+    data[3] = 0x00; /* padding */
+    data[4] = (uint8_t)(fetch->template_id & 0xFF);
+    data[5] = (uint8_t)((fetch->template_id >> 8) & 0xFF);
+    data += 6;
+
+    if(!fetch->reading_definition) {
+        /* definition size in words, structure size in bytes, member count and structure handle. */
+        const uint16_t attributes[] = { 4, 5, 2, 1 };
+
+        tmp_u16 = h2le16((uint16_t)(sizeof(attributes)/sizeof(attributes[0])));
+        mem_copy(data, &tmp_u16, (int)sizeof(tmp_u16));
+        data += (int)sizeof(tmp_u16);
+
+        for(size_t i=0; i < sizeof(attributes)/sizeof(attributes[0]); i++) {
+            tmp_u16 = h2le16(attributes[i]);
+            mem_copy(data, &tmp_u16, (int)sizeof(tmp_u16));
+            data += (int)sizeof(tmp_u16);
+        }
+    } else {
+        int remaining = fetch->definition_size - fetch->definition_read;
+
+        /* the PLC sends as much as fits and flags the rest as partial. */
+        if(remaining > 0xFFFF) {
+            remaining = 0xFFFF;
+        }
+
+        tmp_u32 = h2le32((uint32_t)fetch->definition_read);
+        mem_copy(data, &tmp_u32, (int)sizeof(tmp_u32));
+        data += (int)sizeof(tmp_u32);
+
+        tmp_u16 = h2le16((uint16_t)remaining);
+        mem_copy(data, &tmp_u16, (int)sizeof(tmp_u16));
+        data += (int)sizeof(tmp_u16);
+    }
+
+    /* now we go back and fill in the fields of the static part */
+
+    /* encap fields */
+    cip->encap_command = h2le16(AB_EIP_CONNECTED_SEND); /* ALWAYS 0x0070 Connected Send*/
+
+    /* router timeout */
+    cip->router_timeout = h2le16(1); /* one second timeout, enough? */
+
+    /* Common Packet Format fields for unconnected send. */
+    cip->cpf_item_count = h2le16(2);                 /* ALWAYS 2 */
+    cip->cpf_cai_item_type = h2le16(AB_EIP_ITEM_CAI);/* ALWAYS 0x00A1 connected address item */
+    cip->cpf_cai_item_length = h2le16(4);            /* ALWAYS 4, size of connection ID*/
+    cip->cpf_cdi_item_type = h2le16(AB_EIP_ITEM_CDI);/* ALWAYS 0x00B1 - connected Data Item */
+    cip->cpf_cdi_item_length = h2le16((uint16_t)((int)(data - data_start) + (int)sizeof(cip->cpf_conn_seq_num)));
+
+    /* set the size of the request */
+    req->request_size = (int)((int)sizeof(*cip) + (int)(data - data_start));
+
+    req->allow_packing = tag->allow_packing;
+
+    rc = session_add_request(tag->session, req);
+    if (rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_ERROR, "Unable to add request to session! rc=%d", rc);
+        rc_dec(req);
+        return rc;
+    }
+
+    tag->req = req;
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * decode_template_attributes
+ *
+ * The Get Attribute List reply is the attribute count and then, for
+ * each attribute, its ID, a status word and the value.
+ */
+
+int decode_template_attributes(struct ab_udt_fetch_t *fetch, uint8_t *data, uint8_t *data_end)
+{
+    uint16_le tmp_u16 = UINT16_LE_INIT(0);
+    uint32_le tmp_u32 = UINT32LE_INIT(0);
+    int count = 0;
+    int found = 0;
+
+    if(data_end - data < (ptrdiff_t)sizeof(tmp_u16)) {
+        pdebug(DEBUG_WARN, "Template attribute reply is too short!");
+        return PLCTAG_ERR_BAD_DATA;
+    }
+
+    mem_copy(&tmp_u16, data, (int)sizeof(tmp_u16));
+    count = le2h16(tmp_u16);
+    data += sizeof(tmp_u16);
+
+    for(int i=0; i < count; i++) {
+        uint16_t attribute = 0;
+        uint16_t status = 0;
+
+        if(data_end - data < (ptrdiff_t)(2 * sizeof(tmp_u16))) {
+            pdebug(DEBUG_WARN, "Template attribute reply is too short!");
+            return PLCTAG_ERR_BAD_DATA;
+        }
+
+        mem_copy(&tmp_u16, data, (int)sizeof(tmp_u16));
+        attribute = le2h16(tmp_u16);
+        data += sizeof(tmp_u16);
+
+        mem_copy(&tmp_u16, data, (int)sizeof(tmp_u16));
+        status = le2h16(tmp_u16);
+        data += sizeof(tmp_u16);
+
+        if(status != 0) {
+            pdebug(DEBUG_WARN, "Template attribute %u failed with status 0x%x!", (unsigned int)attribute, (unsigned int)status);
+            return PLCTAG_ERR_REMOTE_ERR;
+        }
+
+        if(attribute == 4 || attribute == 5) {
+            if(data_end - data < (ptrdiff_t)sizeof(tmp_u32)) {
+                pdebug(DEBUG_WARN, "Template attribute reply is too short!");
+                return PLCTAG_ERR_BAD_DATA;
+            }
+
+            mem_copy(&tmp_u32, data, (int)sizeof(tmp_u32));
+            data += sizeof(tmp_u32);
+
+            if(attribute == 4) {
+                fetch->definition_words = le2h32(tmp_u32);
+            } else {
+                fetch->struct_size = le2h32(tmp_u32);
+            }
+        } else if(attribute == 1 || attribute == 2) {
+            if(data_end - data < (ptrdiff_t)sizeof(tmp_u16)) {
+                pdebug(DEBUG_WARN, "Template attribute reply is too short!");
+                return PLCTAG_ERR_BAD_DATA;
+            }
+
+            mem_copy(&tmp_u16, data, (int)sizeof(tmp_u16));
+            data += sizeof(tmp_u16);
+
+            if(attribute == 2) {
+                fetch->member_count = le2h16(tmp_u16);
+            } else {
+                fetch->handle = le2h16(tmp_u16);
+            }
+        } else {
+            pdebug(DEBUG_WARN, "Unexpected template attribute %u!", (unsigned int)attribute);
+            return PLCTAG_ERR_BAD_DATA;
+        }
+
+        found++;
+    }
+
+    if(found != 4) {
+        pdebug(DEBUG_WARN, "Template attribute reply is missing attributes!");
+        return PLCTAG_ERR_BAD_DATA;
+    }
+
+    if(fetch->definition_words > (uint32_t)(INT32_MAX / 4) || (int)(fetch->definition_words * 4) - UDT_DEFINITION_OVERHEAD < (int)fetch->member_count * UDT_MEMBER_DEFINITION_SIZE) {
+        pdebug(DEBUG_WARN, "Template definition size %u is not valid!", (unsigned int)fetch->definition_words);
+        return PLCTAG_ERR_BAD_DATA;
+    }
+
+    fetch->definition_size = (int)(fetch->definition_words * 4) - UDT_DEFINITION_OVERHEAD;
+    fetch->definition = mem_alloc(fetch->definition_size);
+    if(!fetch->definition) {
+        pdebug(DEBUG_WARN, "Unable to allocate template definition buffer!");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * decode_template_definition
+ *
+ * Build the session copy of the template.  The names area is copied as
+ * is and then split at the terminators.  The template name ends at the
+ * first semicolon.
+ */
+
+int decode_template_definition(struct ab_udt_fetch_t *fetch, ab_udt_p *result)
+{
+    ab_udt_p udt = NULL;
+    int member_count = fetch->member_count;
+    int members_size = member_count * UDT_MEMBER_DEFINITION_SIZE;
+    int names_size = fetch->definition_read - members_size;
+    char *names = NULL;
+    char *names_end = NULL;
+    char *name = NULL;
+
+    if(names_size <= 0) {
+        pdebug(DEBUG_WARN, "Template definition is too short!");
+        return PLCTAG_ERR_BAD_DATA;
+    }
+
+    udt = mem_alloc((int)sizeof(*udt) + (member_count * (int)sizeof(ab_udt_member_t)) + names_size + 1);
+    if(!udt) {
+        pdebug(DEBUG_WARN, "Unable to allocate template!");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    udt->template_id = fetch->template_id;
+    udt->handle = fetch->handle;
+    udt->struct_size = fetch->struct_size;
+    udt->member_count = member_count;
+
+    /* the names go after the members, mem_alloc zeroed the terminator. */
+    names = (char *)&(udt->members[member_count]);
+    names_end = names + names_size;
+    mem_copy(names, fetch->definition + members_size, names_size);
+
+    for(int i=0; i < member_count; i++) {
+        uint8_t *def = fetch->definition + (i * UDT_MEMBER_DEFINITION_SIZE);
+
+        udt->members[i].info = (uint16_t)(def[0] | (def[1] << 8));
+        udt->members[i].type = (uint16_t)(def[2] | (def[3] << 8));
+        udt->members[i].offset = (uint32_t)def[4] | ((uint32_t)def[5] << 8) | ((uint32_t)def[6] << 16) | ((uint32_t)def[7] << 24);
+    }
+
+    /* template name, then a zero terminated name for each member. */
+    udt->name = name = names;
+    while(name < names_end && *name && *name != ';') {
+        name++;
+    }
+
+    while(name < names_end && *name) {
+        *name = 0;
+        name++;
+    }
+
+    for(int i=0; i < member_count; i++) {
+        name++;
+
+        if(name >= names_end) {
+            pdebug(DEBUG_WARN, "Template definition is missing member names!");
+            mem_free(udt);
+            return PLCTAG_ERR_BAD_DATA;
+        }
+
+        udt->members[i].name = name;
+
+        while(name < names_end && *name) {
+            name++;
+        }
+    }
+
+    *result = udt;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * resolve_member_path
+ *
+ * Walk the templates along the member path.  An optional leading index
+ * picks the tag array element, member names are separated by dots and
+ * array members can be indexed.
+ */
+
+int resolve_member_path(ab_tag_p tag, const char *member_path)
+{
+    ab_udt_p udt = NULL;
+    const char *path = member_path;
+    uint32_t index = 0;
+    int64_t offset = 0;
+
+    if(!tag->udt_id) {
+        pdebug(DEBUG_WARN, "Tag data is not a structure!");
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    udt = session_find_udt(tag->session, tag->udt_id);
+    if(!udt) {
+        pdebug(DEBUG_WARN, "Template %u is not in the session!", (unsigned int)tag->udt_id);
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    if(!path || !*path) {
+        pdebug(DEBUG_WARN, "Member path is empty!");
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    /* the element of the tag array. */
+    if(*path == '[') {
+        if(parse_index(&path, &index) != PLCTAG_STATUS_OK) {
+            return PLCTAG_ERR_BAD_PARAM;
+        }
+
+        if(index >= (uint32_t)tag->elem_count) {
+            pdebug(DEBUG_WARN, "Element index %u is out of bounds!", (unsigned int)index);
+            return PLCTAG_ERR_OUT_OF_BOUNDS;
+        }
+
+        offset += (int64_t)index * udt->struct_size;
+
+        if(*path == '.') {
+            path++;
+        }
+    }
+
+    while(*path) {
+        ab_udt_member_t *member = NULL;
+        ab_udt_p member_udt = NULL;
+        int name_len = 0;
+        int elem_size = 0;
+
+        if(!udt) {
+            pdebug(DEBUG_WARN, "Member path goes past a member that is not a structure!");
+            return PLCTAG_ERR_NOT_FOUND;
+        }
+
+        while(path[name_len] && path[name_len] != '.' && path[name_len] != '[') {
+            name_len++;
+        }
+
+        member = find_member(udt, path, name_len);
+        if(!member) {
+            pdebug(DEBUG_WARN, "Member is not in template %s!", udt->name);
+            return PLCTAG_ERR_NOT_FOUND;
+        }
+
+        path += name_len;
+        offset += member->offset;
+
+        if(member->type & AB_UDT_TYPE_STRUCT) {
+            member_udt = session_find_udt(tag->session, (uint16_t)(member->type & AB_UDT_TYPE_ID_MASK));
+            if(!member_udt) {
+                pdebug(DEBUG_WARN, "Template of member is not in the session!");
+                return PLCTAG_ERR_NOT_FOUND;
+            }
+
+            elem_size = (int)member_udt->struct_size;
+        } else {
+            elem_size = atomic_type_size(member->type);
+        }
+
+        if(*path == '[') {
+            if(parse_index(&path, &index) != PLCTAG_STATUS_OK) {
+                return PLCTAG_ERR_BAD_PARAM;
+            }
+
+            /* BOOL arrays are packed 32 to a word. */
+            if(elem_size <= 0 || (member->type & 0xFF) == 0xD3) {
+                pdebug(DEBUG_WARN, "Member array elements have no byte offset!");
+                return PLCTAG_ERR_UNSUPPORTED;
+            }
+
+            if(member->info > 0 && index >= member->info) {
+                pdebug(DEBUG_WARN, "Member index %u is out of bounds!", (unsigned int)index);
+                return PLCTAG_ERR_OUT_OF_BOUNDS;
+            }
+
+            offset += (int64_t)index * elem_size;
+        } else if(!(member->type & AB_UDT_TYPE_STRUCT) && (member->type & 0xFF) == 0xC1) {
+            /* BOOL members are bits in a hidden host member. */
+            pdebug(DEBUG_WARN, "BOOL members have no byte offset of their own!");
+            return PLCTAG_ERR_UNSUPPORTED;
+        }
+
+        udt = member_udt;
+
+        if(*path == '.') {
+            path++;
+
+            if(!*path) {
+                pdebug(DEBUG_WARN, "Member path ends with a dot!");
+                return PLCTAG_ERR_BAD_PARAM;
+            }
+        } else if(*path) {
+            pdebug(DEBUG_WARN, "Unexpected character in member path!");
+            return PLCTAG_ERR_BAD_PARAM;
+        }
+    }
+
+    if(offset > INT32_MAX) {
+        return PLCTAG_ERR_OUT_OF_BOUNDS;
+    }
+
+    return (int)offset;
+}
+
+
+
+int parse_index(const char **path, uint32_t *index)
+{
+    const char *p = *path + 1;
+    uint32_t val = 0;
+
+    if(!isdigit((unsigned char)*p)) {
+        pdebug(DEBUG_WARN, "Member index must be a number!");
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    while(isdigit((unsigned char)*p)) {
+        if(val > 100000000) {
+            pdebug(DEBUG_WARN, "Member index is too large!");
+            return PLCTAG_ERR_BAD_PARAM;
+        }
+
+        val = (val * 10) + (uint32_t)(*p - '0');
+        p++;
+    }
+
+    if(*p != ']') {
+        pdebug(DEBUG_WARN, "Only one dimension can be indexed!");
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    *index = val;
+    *path = p + 1;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+int atomic_type_size(uint16_t type)
+{
+    switch(type & 0xFF) {
+        case 0xC1: /* BOOL */
+        case 0xC2: /* SINT */
+        case 0xC6: /* USINT */
+        case 0xD1: /* BYTE */
+            return 1;
+
+        case 0xC3: /* INT */
+        case 0xC7: /* UINT */
+        case 0xD2: /* WORD */
+            return 2;
+
+        case 0xC4: /* DINT */
+        case 0xC8: /* UDINT */
+        case 0xCA: /* REAL */
+        case 0xD3: /* DWORD */
+            return 4;
+
+        case 0xC5: /* LINT */
+        case 0xC9: /* ULINT */
+        case 0xCB: /* LREAL */
+        case 0xD4: /* LWORD */
+            return 8;
+
+        default:
+            return 0;
+    }
+}
+
+
+
+/* a single symbolic segment followed only by element segments. */
+int name_is_plain_symbol(ab_tag_p tag)
+{
+    int offset = 0;
+
+    if(tag->encoded_name_size < 3 || tag->encoded_name[1] != 0x91) {
+        return 0;
+    }
+
+    offset = 3 + tag->encoded_name[2] + (tag->encoded_name[2] & 0x01);
+
+    while(offset < tag->encoded_name_size) {
+        switch(tag->encoded_name[offset]) {
+            case 0x28: offset += 2; break;
+            case 0x29: offset += 4; break;
+            case 0x2A: offset += 6; break;
+            default: return 0;
+        }
+    }
+
+    return (offset == tag->encoded_name_size);
+}
+
+
+
+void give_up_on_templates(ab_tag_p tag)
+{
+    pdebug(DEBUG_WARN, "PLC did not give UDT template %u, members cannot be found by name.", (unsigned int)tag->udt_fetch->template_id);
+
+    eip_cip_udt_abort(tag);
+    tag->udt_templates = 0;
+}
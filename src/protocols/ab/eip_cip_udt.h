@@ -0,0 +1,77 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#ifndef __LIBPLCTAG_AB_EIP_CIP_UDT_H__
+#define __LIBPLCTAG_AB_EIP_CIP_UDT_H__
+
+#include <ab/ab_common.h>
+#include <util/attr.h>
+
+/*
+ * Logix UDT templates.  The Template object (class 0x6C) describes each
+ * structure type: its size and, for each member, the name, type and byte
+ * offset.  Templates are read once per session and shared by all tags on
+ * it so that member names can be turned into offsets in the tag data.
+ */
+
+/* symbol and member type bits. */
+#define AB_UDT_TYPE_STRUCT      ((uint16_t)0x8000)
+#define AB_UDT_TYPE_SYSTEM      ((uint16_t)0x1000)
+#define AB_UDT_TYPE_ID_MASK     ((uint16_t)0x0FFF)
+
+typedef struct {
+    const char *name;
+    uint16_t type;
+    uint16_t info;          /* array size, or the bit number of a BOOL. */
+    uint32_t offset;
+} ab_udt_member_t;
+
+/* one allocation, the names are stored after the members. */
+struct ab_udt_t {
+    uint16_t template_id;
+    uint16_t handle;
+    uint32_t struct_size;
+    int member_count;
+    const char *name;
+    ab_udt_member_t members[];
+};
+
+extern int eip_cip_udt_resolve(ab_tag_p tag);
+extern int eip_cip_udt_check_status(ab_tag_p tag);
+extern int eip_cip_udt_get_member_offset(plc_tag_p tag, const char *member_path);
+extern void eip_cip_udt_abort(ab_tag_p tag);
+extern void eip_cip_udt_tag_close(ab_tag_p tag);
+extern int eip_cip_udt_known_type(ab_tag_p tag, attr attribs);
+extern int eip_cip_udt_from_definition(uint16_t template_id, uint16_t handle, uint32_t struct_size, uint16_t member_count, const uint8_t *definition, int definition_size, ab_udt_p *udt);
+
+#endif
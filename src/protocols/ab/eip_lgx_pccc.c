@@ -81,7 +81,13 @@ struct tag_vtable_t lgx_pccc_vtable = {
 
     /* data accessors */
     ab_get_int_attrib,
-    ab_set_int_attrib
+    ab_set_int_attrib,
+
+    /* no structure member lookup */
+    NULL,
+
+    /* no element ranges */
+    NULL
 };
 
 static int check_read_status(ab_tag_p tag);
@@ -119,6 +125,8 @@ int tag_tickler(ab_tag_p tag)
 
     pdebug(DEBUG_SPEW, "Starting.");
 
+    ab_tag_check_breaker(tag);
+
     if(tag->read_in_progress) {
         pdebug(DEBUG_SPEW, "Read in progress.");
         rc = check_read_status(tag);
@@ -216,7 +224,7 @@ int tag_read_start(ab_tag_p tag)
     }
 
     /* get a request buffer */
-    rc = session_create_request(tag->session, tag->tag_id, &req);
+    rc = session_create_request(tag->session, tag->tag_id, tag->priority, tag->op_deadline, &req);
 
     if(rc != PLCTAG_STATUS_OK) {
         tag->read_in_progress = 0;
@@ -378,6 +386,8 @@ static int check_read_status(ab_tag_p tag)
             break;
         }
 
+        plc_tag_generic_record_request((plc_tag_p)tag, tag->req->time_queued, tag->req->time_sent, tag->req->time_received);
+
         /* check to see if it was an abort on the session side. */
         if(tag->req->status != PLCTAG_STATUS_OK) {
             rc = tag->req->status;
@@ -482,7 +492,9 @@ static int check_read_status(ab_tag_p tag)
          * the user has set, possibly.
          */
         if(!tag->pre_write_read) {
+            plc_tag_generic_data_write_begin((plc_tag_p)tag);
             mem_copy(tag->data, data, (int)(data_end - data));
+            plc_tag_generic_data_write_end((plc_tag_p)tag);
         }
 
         /* copy type data into tag. */
@@ -584,7 +596,7 @@ int tag_write_start(ab_tag_p tag)
     }
 
     /* get a request buffer */
-    rc = session_create_request(tag->session, tag->tag_id, &req);
+    rc = session_create_request(tag->session, tag->tag_id, tag->priority, tag->op_deadline, &req);
 
     if(rc != PLCTAG_STATUS_OK) {
         tag->write_in_progress = 0;
@@ -737,6 +749,8 @@ static int check_write_status(ab_tag_p tag)
             break;
         }
 
+        plc_tag_generic_record_request((plc_tag_p)tag, tag->req->time_queued, tag->req->time_sent, tag->req->time_received);
+
         /* check to see if it was an abort on the session side. */
         if(tag->req->status != PLCTAG_STATUS_OK) {
             rc = tag->req->status;
@@ -62,7 +62,13 @@ struct tag_vtable_t eip_slc_dhp_vtable = {
 
     /* data accessors */
     ab_get_int_attrib,
-    ab_set_int_attrib
+    ab_set_int_attrib,
+
+    /* no structure member lookup */
+    NULL,
+
+    /* no element ranges */
+    NULL
 };
 
 
@@ -191,6 +197,8 @@ int tag_tickler(ab_tag_p tag)
 
     pdebug(DEBUG_SPEW, "Starting.");
 
+    ab_tag_check_breaker(tag);
+
     if(tag->read_in_progress) {
         pdebug(DEBUG_SPEW, "Read in progress.");
         rc = check_read_status(tag);
@@ -267,7 +275,7 @@ int tag_read_start(ab_tag_p tag)
     }
 
     /* get a request buffer */
-    rc = session_create_request(tag->session, tag->tag_id, &req);
+    rc = session_create_request(tag->session, tag->tag_id, tag->priority, tag->op_deadline, &req);
     if(rc != PLCTAG_STATUS_OK) {
         tag->read_in_progress = 0;
         pdebug(DEBUG_ERROR, "Unable to get new request.  rc=%d", rc);
@@ -311,7 +319,6 @@ int tag_read_start(ab_tag_p tag)
     // /* PCCC Command */
     // pccc->pccc_command = AB_EIP_PCCC_TYPED_CMD;
     // pccc->pccc_status = 0;  /* STS 0 in request */
-    // pccc->pccc_seq_num = /*h2le16(conn_seq_id)*/ h2le16((uint16_t)(intptr_t)(tag->session));
     // pccc->pccc_function = AB_EIP_PLC5_RANGE_READ_FUNC;
     // pccc->pccc_transfer_offset = h2le16((uint16_t)0);
     // pccc->pccc_transfer_size = h2le16((uint16_t)((tag->size)/2));  /* size in 2-byte words */
@@ -320,6 +327,7 @@ int tag_read_start(ab_tag_p tag)
     pccc->pccc_command = AB_EIP_PCCC_TYPED_CMD;
     pccc->pccc_status = 0;  /* STS 0 in request */
     pccc->pccc_seq_num = h2le16(conn_seq_id);
+    tag->tns = conn_seq_id;
     pccc->pccc_function = AB_EIP_SLC_RANGE_READ_FUNC;
     pccc->pccc_transfer_size = (uint8_t)(tag->elem_size * tag->elem_count); /* size to read/write in bytes. */
 
@@ -400,7 +408,7 @@ int tag_write_start(ab_tag_p tag)
     }
 
     /* get a request buffer */
-    rc = session_create_request(tag->session, tag->tag_id, &req);
+    rc = session_create_request(tag->session, tag->tag_id, tag->priority, tag->op_deadline, &req);
 
     if(rc != PLCTAG_STATUS_OK) {
         tag->write_in_progress = 0;
@@ -446,14 +454,14 @@ int tag_write_start(ab_tag_p tag)
     // /* PCCC Command */
     // pccc->pccc_command = AB_EIP_PCCC_TYPED_CMD;
     // pccc->pccc_status = 0;  /* STS 0 in request */
-    // pccc->pccc_seq_num = h2le16(conn_seq_id); /* FIXME - get sequence ID from session? */
     // pccc->pccc_function = AB_EIP_PLC5_RANGE_WRITE_FUNC;
     // pccc->pccc_transfer_offset = h2le16((uint16_t)0);
     // pccc->pccc_transfer_size = h2le16((uint16_t)((tag->size)/2));  /* size in 2-byte words */
 
     pccc->pccc_command = AB_EIP_PCCC_TYPED_CMD;
     pccc->pccc_status = 0;  /* STS 0 in request */
-    pccc->pccc_seq_num = h2le16(conn_seq_id); /* FIXME - get sequence ID from session? */
+    pccc->pccc_seq_num = h2le16(conn_seq_id);
+    tag->tns = conn_seq_id;
     pccc->pccc_function = AB_EIP_SLC_RANGE_WRITE_FUNC;
     pccc->pccc_transfer_size = (uint8_t)(tag->size);
 
@@ -512,6 +520,8 @@ static int check_read_status(ab_tag_p tag)
             break;
         }
 
+        plc_tag_generic_record_request((plc_tag_p)tag, tag->req->time_queued, tag->req->time_sent, tag->req->time_received);
+
         /* check to see if it was an abort on the session side. */
         if(tag->req->status != PLCTAG_STATUS_OK) {
             rc = tag->req->status;
@@ -561,6 +571,10 @@ static int check_read_status(ab_tag_p tag)
             break;
         }
 
+        if((rc = pccc_check_tns(le2h16(resp->pccc_seq_num), tag->tns)) != PLCTAG_STATUS_OK) {
+            break;
+        }
+
         if(resp->pccc_status != AB_EIP_OK) {
             pdebug(DEBUG_WARN, "PCCC command failed, response code: %d - %s", resp->pccc_status, pccc_decode_error(&resp->pccc_status));
             rc = PLCTAG_ERR_REMOTE_ERR;
@@ -580,7 +594,9 @@ static int check_read_status(ab_tag_p tag)
         }
 
         /* copy data into the tag. */
+        plc_tag_generic_data_write_begin((plc_tag_p)tag);
         mem_copy(tag->data, data, (int)(data_end - data));
+        plc_tag_generic_data_write_end((plc_tag_p)tag);
 
         rc = PLCTAG_STATUS_OK;
     } while(0);
@@ -622,6 +638,8 @@ static int check_write_status(ab_tag_p tag)
             break;
         }
 
+        plc_tag_generic_record_request((plc_tag_p)tag, tag->req->time_queued, tag->req->time_sent, tag->req->time_received);
+
         /* check to see if it was an abort on the session side. */
         if(tag->req->status != PLCTAG_STATUS_OK) {
             rc = tag->req->status;
@@ -670,6 +688,10 @@ static int check_write_status(ab_tag_p tag)
             break;
         }
 
+        if((rc = pccc_check_tns(le2h16(pccc_resp->pccc_seq_num), tag->tns)) != PLCTAG_STATUS_OK) {
+            break;
+        }
+
         if(pccc_resp->pccc_status != AB_EIP_OK) {
             pdebug(DEBUG_WARN, "PCCC command failed, response code: %d - %s", pccc_resp->pccc_status, pccc_decode_error(&pccc_resp->pccc_status));
             rc = PLCTAG_ERR_REMOTE_ERR;
@@ -56,7 +56,13 @@ struct tag_vtable_t slc_vtable = {
 
     /* data accessors */
     ab_get_int_attrib,
-    ab_set_int_attrib
+    ab_set_int_attrib,
+
+    /* no structure member lookup */
+    NULL,
+
+    /* no element ranges */
+    NULL
 };
 
 
@@ -87,6 +93,8 @@ tag_byte_order_t slc_tag_byte_order = {
 
 static int check_read_status(ab_tag_p tag);
 static int check_write_status(ab_tag_p tag);
+static void set_read_span(ab_tag_p tag, ab_request_p req, int data_per_packet);
+static int encode_read_span(ab_request_p req);
 
 
 
@@ -166,6 +174,8 @@ int tag_tickler(ab_tag_p tag)
 
     pdebug(DEBUG_SPEW, "Starting.");
 
+    ab_tag_check_breaker(tag);
+
     if(tag->read_in_progress) {
         pdebug(DEBUG_SPEW, "Read in progress.");
         rc = check_read_status(tag);
@@ -248,7 +258,7 @@ int tag_read_start(ab_tag_p tag)
     }
 
     /* get a request buffer */
-    rc = session_create_request(tag->session, tag->tag_id, &req);
+    rc = session_create_request(tag->session, tag->tag_id, tag->priority, tag->op_deadline, &req);
     if(rc != PLCTAG_STATUS_OK) {
         pdebug(DEBUG_WARN,"Unable to get new request.  rc=%d",rc);
         tag->read_in_progress = 0;
@@ -309,6 +319,9 @@ int tag_read_start(ab_tag_p tag)
     /* set the size of the request */
     req->request_size = (int)(data - (req->data));
 
+    /* reads of nearby elements can go out as one read. */
+    set_read_span(tag, req, data_per_packet);
+
     /* mark it as ready to send */
     //req->send_request = 1;
 
@@ -337,6 +350,73 @@ int tag_read_start(ab_tag_p tag)
 
 
 
+/*
+ * set_read_span
+ *
+ * Reads of whole elements can be combined by the session with reads of
+ * nearby elements of the same data file that are queued at the same
+ * time.  Bit and sub-element reads are left alone.
+ */
+
+static void set_read_span(ab_tag_p tag, ab_request_p req, int data_per_packet)
+{
+    int max_size = (data_per_packet < PCCC_MAX_READ_SPAN ? data_per_packet : PCCC_MAX_READ_SPAN);
+
+    if(tag->is_bit || tag->file_subelem >= 0 || tag->elem_size <= 0) {
+        return;
+    }
+
+    max_size -= max_size % tag->elem_size;
+
+    if(tag->size >= max_size) {
+        return;
+    }
+
+    req->span.key = ((int64_t)tag->plc_type << 48) | ((int64_t)tag->file_type << 40) | ((int64_t)tag->file_num << 16) | (int64_t)tag->elem_size;
+    req->span.start = tag->file_elem * tag->elem_size;
+    req->span.size = tag->size;
+    req->span.read_start = req->span.start;
+    req->span.read_size = req->span.size;
+    req->span.max_size = max_size;
+    req->span.data_offset = (int)sizeof(pccc_resp);
+    req->span.file_type = (int)tag->file_type;
+    req->span.file_num = tag->file_num;
+    req->span.elem_size = tag->elem_size;
+    req->span.encode = encode_read_span;
+}
+
+
+/*
+ * encode_read_span
+ *
+ * Rewrite the address and size of a read to cover the span.
+ */
+
+static int encode_read_span(ab_request_p req)
+{
+    int rc = PLCTAG_STATUS_OK;
+    pccc_req *pccc = (pccc_req *)(req->data);
+    uint8_t *embed_start = (uint8_t *)(&pccc->service_code);
+    uint8_t *data = ((uint8_t *)pccc) + sizeof(pccc_req);
+    int name_size = 0;
+
+    rc = slc_encode_element_address(data, &name_size, (pccc_file_t)req->span.file_type, req->span.file_num, req->span.read_start / req->span.elem_size);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to encode span address, error %s!", plc_tag_decode_error(rc));
+        return rc;
+    }
+
+    data += name_size;
+
+    pccc->pccc_transfer_size = (uint8_t)(req->span.read_size);
+    pccc->cpf_udi_item_length = h2le16((uint16_t)(data - embed_start));
+
+    req->request_size = (int)(data - (req->data));
+
+    return PLCTAG_STATUS_OK;
+}
+
+
 /*
  * check_read_status
  *
@@ -371,6 +451,8 @@ static int check_read_status(ab_tag_p tag)
             break;
         }
 
+        plc_tag_generic_record_request((plc_tag_p)tag, tag->req->time_queued, tag->req->time_sent, tag->req->time_received);
+
         /* check to see if it was an abort on the session side. */
         if(tag->req->status != PLCTAG_STATUS_OK) {
             rc = tag->req->status;
@@ -442,7 +524,9 @@ static int check_read_status(ab_tag_p tag)
         }
 
         /* copy data into the tag. */
+        plc_tag_generic_data_write_begin((plc_tag_p)tag);
         mem_copy(tag->data, data, (int)(data_end - data));
+        plc_tag_generic_data_write_end((plc_tag_p)tag);
 
         rc = PLCTAG_STATUS_OK;
     } while(0);
@@ -506,7 +590,7 @@ int tag_write_start(ab_tag_p tag)
     }
 
     /* get a request buffer */
-    rc = session_create_request(tag->session, tag->tag_id, &req);
+    rc = session_create_request(tag->session, tag->tag_id, tag->priority, tag->op_deadline, &req);
     if(rc != PLCTAG_STATUS_OK) {
         pdebug(DEBUG_WARN,"Unable to get new request.  rc=%d",rc);
         tag->write_in_progress =0;
@@ -627,6 +711,8 @@ static int check_write_status(ab_tag_p tag)
             break;
         }
 
+        plc_tag_generic_record_request((plc_tag_p)tag, tag->req->time_queued, tag->req->time_sent, tag->req->time_received);
+
         /* check to see if it was an abort on the session side. */
         if(tag->req->status != PLCTAG_STATUS_OK) {
             rc = tag->req->status;
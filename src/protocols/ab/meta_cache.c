@@ -0,0 +1,1040 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <platform.h>
+#include <ab/ab_common.h>
+#include <ab/eip_cip_udt.h>
+#include <ab/meta_cache.h>
+#include <ab/session.h>
+#include <ab/tag.h>
+#include <util/debug.h>
+#include <util/hash.h>
+#include <util/hashtable.h>
+#include <util/vector.h>
+#include <ctype.h>
+#include <stdio.h>
+
+
+/* write the file back at most this often while entries come in. */
+#define META_CACHE_SAVE_INTERVAL_MS (1000)
+
+/* initial table sizes, they grow as needed. */
+#define META_CACHE_SYMBOL_TABLE_SIZE (64)
+#define META_CACHE_TYPE_TABLE_SIZE (32)
+
+/* longest symbol name kept, the same as the session table. */
+#define META_CACHE_MAX_NAME (255)
+
+typedef struct {
+    uint32_t instance_id;
+    uint16_t symbol_type;
+    int name_len;
+    uint8_t name[];         /* lower case. */
+} meta_symbol_t;
+
+typedef struct {
+    uint16_t template_id;
+    uint16_t handle;
+    uint32_t struct_size;
+    uint16_t member_count;
+    int definition_size;
+    uint8_t definition[];
+} meta_template_t;
+
+typedef struct {
+    int elem_size;
+    int type_info_size;
+    uint8_t type_info[MAX_TAG_TYPE_INFO];
+    int name_len;
+    uint8_t name[];         /* the encoded tag name. */
+} meta_tag_type_t;
+
+/* everything known about one gateway and path. */
+typedef struct {
+    char *host;
+    char *path;
+    uint32_t symbol_next_id;
+    int symbols_complete;
+    hashtable_p symbols;
+    hashtable_p tag_types;
+    vector_p templates;
+} meta_plc_t;
+
+
+static meta_plc_t *find_plc_unsafe(const char *host, const char *path, int create);
+static meta_plc_t *session_plc_unsafe(ab_session_p session, int create);
+static void free_plc(meta_plc_t *plc);
+static void clear_symbols_unsafe(meta_plc_t *plc);
+static int apply_symbol(hashtable_p table, int64_t key, void *data, void *context);
+static int free_entry(hashtable_p table, int64_t key, void *data, void *context);
+static int64_t name_key(const uint8_t *name, int name_len, int fold_case);
+static int put_symbol_unsafe(meta_plc_t *plc, const uint8_t *name, int name_len, uint32_t instance_id, uint16_t symbol_type);
+static int put_template_unsafe(meta_plc_t *plc, uint16_t template_id, uint16_t handle, uint32_t struct_size, uint16_t member_count, const uint8_t *definition, int definition_size);
+static int put_tag_type_unsafe(meta_plc_t *plc, const uint8_t *name, int name_len, const uint8_t *type_info, int type_info_size, int elem_size);
+static meta_tag_type_t *find_tag_type_unsafe(meta_plc_t *plc, const uint8_t *name, int name_len);
+static const uint8_t *tag_cache_name(ab_tag_p tag, int *name_len);
+static void load_unsafe(const char *file_name);
+static void save_unsafe(void);
+static void maybe_save_unsafe(int now);
+static int write_record(FILE *file, uint8_t kind, const uint8_t *head, int head_len, const uint8_t *tail, int tail_len);
+static int write_symbol(hashtable_p table, int64_t key, void *data, void *context);
+static int write_tag_type(hashtable_p table, int64_t key, void *data, void *context);
+static uint16_t get_u16(const uint8_t *data);
+static uint32_t get_u32(const uint8_t *data);
+static void put_u16(uint8_t *data, uint16_t val);
+static void put_u32(uint8_t *data, uint32_t val);
+
+
+static mutex_p meta_mutex = NULL;
+static vector_p meta_plcs = NULL;
+static char *meta_file = NULL;
+static int meta_dirty = 0;
+static int64_t meta_last_save_ms = 0;
+
+
+
+int meta_cache_startup(void)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    if((rc = mutex_create(&meta_mutex)) != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_ERROR, "Unable to create metadata cache mutex %s!", plc_tag_decode_error(rc));
+        return rc;
+    }
+
+    if((meta_plcs = vector_create(10, 5)) == NULL) {
+        pdebug(DEBUG_ERROR, "Unable to create metadata cache vector!");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    return rc;
+}
+
+
+void meta_cache_teardown(void)
+{
+    meta_cache_flush();
+
+    if(meta_plcs) {
+        for(int i=0; i < vector_length(meta_plcs); i++) {
+            free_plc(vector_get(meta_plcs, i));
+        }
+
+        vector_destroy(meta_plcs);
+        meta_plcs = NULL;
+    }
+
+    if(meta_file) {
+        mem_free(meta_file);
+        meta_file = NULL;
+    }
+
+    meta_dirty = 0;
+    meta_last_save_ms = 0;
+
+    if(meta_mutex) {
+        mutex_destroy(&meta_mutex);
+        meta_mutex = NULL;
+    }
+}
+
+
+
+/*
+ * meta_cache_open
+ *
+ * The first tag that names a cache file sets it for the library, later
+ * names are ignored.
+ */
+
+void meta_cache_open(const char *file_name)
+{
+    if(!meta_mutex || !str_length(file_name)) {
+        return;
+    }
+
+    critical_block(meta_mutex) {
+        if(meta_file) {
+            break;
+        }
+
+        meta_file = str_dup(file_name);
+        if(!meta_file) {
+            pdebug(DEBUG_WARN, "Unable to copy metadata cache file name!");
+            break;
+        }
+
+        load_unsafe(meta_file);
+    }
+}
+
+
+
+/*
+ * meta_cache_apply
+ *
+ * Give a new session what is cached for its PLC.  This uses the session
+ * calls directly so nothing comes back into the cache.
+ */
+
+void meta_cache_apply(ab_session_p session)
+{
+    int num_symbols = 0;
+    int num_templates = 0;
+
+    if(!meta_mutex) {
+        return;
+    }
+
+    critical_block(meta_mutex) {
+        meta_plc_t *plc = session_plc_unsafe(session, 0);
+
+        if(!plc) {
+            break;
+        }
+
+        hashtable_on_each(plc->symbols, apply_symbol, session);
+        num_symbols = hashtable_entries(plc->symbols);
+
+        session_set_symbol_progress(session, plc->symbol_next_id, plc->symbols_complete);
+
+        for(int i=0; i < vector_length(plc->templates); i++) {
+            meta_template_t *tmpl = vector_get(plc->templates, i);
+            ab_udt_p udt = NULL;
+
+            if(eip_cip_udt_from_definition(tmpl->template_id, tmpl->handle, tmpl->struct_size, tmpl->member_count, tmpl->definition, tmpl->definition_size, &udt) == PLCTAG_STATUS_OK
+               && session_add_udt(session, tmpl->template_id, udt) == PLCTAG_STATUS_OK) {
+                num_templates++;
+            }
+        }
+    }
+
+    if(num_symbols || num_templates) {
+        pdebug(DEBUG_INFO, "Session starts with %d cached symbols and %d cached templates.", num_symbols, num_templates);
+    }
+}
+
+
+void meta_cache_flush(void)
+{
+    if(!meta_mutex) {
+        return;
+    }
+
+    critical_block(meta_mutex) {
+        maybe_save_unsafe(1);
+    }
+}
+
+
+
+void meta_cache_add_symbol(ab_session_p session, const uint8_t *name, int name_len, uint32_t instance_id, uint16_t symbol_type)
+{
+    if(!meta_mutex || name_len <= 0 || name_len > META_CACHE_MAX_NAME) {
+        return;
+    }
+
+    critical_block(meta_mutex) {
+        meta_plc_t *plc = session_plc_unsafe(session, 1);
+
+        if(plc && put_symbol_unsafe(plc, name, name_len, instance_id, symbol_type) == PLCTAG_STATUS_OK) {
+            meta_dirty = 1;
+            maybe_save_unsafe(0);
+        }
+    }
+}
+
+
+void meta_cache_set_symbol_progress(ab_session_p session, uint32_t next_id, int complete)
+{
+    if(!meta_mutex) {
+        return;
+    }
+
+    critical_block(meta_mutex) {
+        meta_plc_t *plc = session_plc_unsafe(session, 1);
+
+        if(!plc) {
+            break;
+        }
+
+        if(next_id > plc->symbol_next_id) {
+            plc->symbol_next_id = next_id;
+            meta_dirty = 1;
+        }
+
+        if(complete && !plc->symbols_complete) {
+            plc->symbols_complete = 1;
+            meta_dirty = 1;
+        }
+
+        /* the end of a listing is worth writing out at once. */
+        maybe_save_unsafe(complete);
+    }
+}
+
+
+void meta_cache_clear_symbols(ab_session_p session)
+{
+    if(!meta_mutex) {
+        return;
+    }
+
+    critical_block(meta_mutex) {
+        meta_plc_t *plc = session_plc_unsafe(session, 0);
+
+        if(plc) {
+            clear_symbols_unsafe(plc);
+            meta_dirty = 1;
+        }
+    }
+}
+
+
+void meta_cache_add_template(ab_session_p session, uint16_t template_id, uint16_t handle, uint32_t struct_size, uint16_t member_count, const uint8_t *definition, int definition_size)
+{
+    if(!meta_mutex || !definition || definition_size <= 0) {
+        return;
+    }
+
+    critical_block(meta_mutex) {
+        meta_plc_t *plc = session_plc_unsafe(session, 1);
+
+        if(plc && put_template_unsafe(plc, template_id, handle, struct_size, member_count, definition, definition_size) == PLCTAG_STATUS_OK) {
+            meta_dirty = 1;
+            maybe_save_unsafe(0);
+        }
+    }
+}
+
+
+
+/*
+ * meta_cache_add_tag_type
+ *
+ * Called when the first read of a tag is done and its type and element
+ * size are known.
+ */
+
+void meta_cache_add_tag_type(ab_tag_p tag)
+{
+    const uint8_t *name = NULL;
+    int name_len = 0;
+
+    if(!meta_mutex || tag->encoded_type_info_size <= 0 || tag->elem_size <= 0) {
+        return;
+    }
+
+    /* only the tags that skip_first_read() can set up from it. */
+    if(tag->plc_type != AB_PLC_LGX || tag->tag_list || tag->is_bit || tag->udt_templates) {
+        return;
+    }
+
+    name = tag_cache_name(tag, &name_len);
+
+    critical_block(meta_mutex) {
+        meta_plc_t *plc = session_plc_unsafe(tag->session, 1);
+
+        if(plc && put_tag_type_unsafe(plc, name, name_len, tag->encoded_type_info, tag->encoded_type_info_size, tag->elem_size) == PLCTAG_STATUS_OK) {
+            meta_dirty = 1;
+            maybe_save_unsafe(0);
+        }
+    }
+}
+
+
+
+/*
+ * meta_cache_find_tag_type
+ *
+ * Fill in the type and element size of the tag from the cache.  Returns
+ * PLCTAG_ERR_NOT_FOUND if the tag has not been read before.
+ */
+
+int meta_cache_find_tag_type(ab_tag_p tag)
+{
+    int rc = PLCTAG_ERR_NOT_FOUND;
+    const uint8_t *name = NULL;
+    int name_len = 0;
+
+    if(!meta_mutex) {
+        return rc;
+    }
+
+    name = tag_cache_name(tag, &name_len);
+
+    critical_block(meta_mutex) {
+        meta_plc_t *plc = session_plc_unsafe(tag->session, 0);
+        meta_tag_type_t *entry = (plc ? find_tag_type_unsafe(plc, name, name_len) : NULL);
+
+        if(entry) {
+            mem_copy(tag->encoded_type_info, entry->type_info, entry->type_info_size);
+            tag->encoded_type_info_size = entry->type_info_size;
+            tag->elem_size = entry->elem_size;
+            tag->type_from_cache = 1;
+            rc = PLCTAG_STATUS_OK;
+        }
+    }
+
+    return rc;
+}
+
+
+void meta_cache_forget_tag_type(ab_tag_p tag)
+{
+    const uint8_t *name = NULL;
+    int name_len = 0;
+
+    tag->type_from_cache = 0;
+
+    if(!meta_mutex) {
+        return;
+    }
+
+    name = tag_cache_name(tag, &name_len);
+
+    critical_block(meta_mutex) {
+        meta_plc_t *plc = session_plc_unsafe(tag->session, 0);
+        meta_tag_type_t *entry = (plc ? find_tag_type_unsafe(plc, name, name_len) : NULL);
+
+        if(entry) {
+            hashtable_remove(plc->tag_types, name_key(name, name_len, 0));
+            mem_free(entry);
+            meta_dirty = 1;
+        }
+    }
+}
+
+
+
+
+/*************************************************************************
+ **************************** Helper Functions ***************************
+ ************************************************************************/
+
+
+meta_plc_t *find_plc_unsafe(const char *host, const char *path, int create)
+{
+    meta_plc_t *plc = NULL;
+
+    for(int i=0; i < vector_length(meta_plcs); i++) {
+        plc = vector_get(meta_plcs, i);
+
+        if(plc && str_cmp_i(plc->host, host) == 0 && str_cmp_i(plc->path, path) == 0) {
+            return plc;
+        }
+    }
+
+    if(!create) {
+        return NULL;
+    }
+
+    plc = mem_alloc((int)sizeof(*plc));
+    if(!plc) {
+        pdebug(DEBUG_WARN, "Unable to allocate metadata cache entry!");
+        return NULL;
+    }
+
+    plc->host = str_dup(host);
+    plc->path = str_dup(path);
+    plc->symbols = hashtable_create(META_CACHE_SYMBOL_TABLE_SIZE);
+    plc->tag_types = hashtable_create(META_CACHE_TYPE_TABLE_SIZE);
+    plc->templates = vector_create(10, 10);
+
+    if(!plc->host || !plc->path || !plc->symbols || !plc->tag_types || !plc->templates
+       || vector_push_back(meta_plcs, plc) != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to set up metadata cache entry!");
+        free_plc(plc);
+        return NULL;
+    }
+
+    return plc;
+}
+
+
+/* only sessions when a cache file is set have an entry. */
+meta_plc_t *session_plc_unsafe(ab_session_p session, int create)
+{
+    if(!meta_file || !session || !session->host) {
+        return NULL;
+    }
+
+    return find_plc_unsafe(session->host, (session->path ? session->path : ""), create);
+}
+
+
+void free_plc(meta_plc_t *plc)
+{
+    if(!plc) {
+        return;
+    }
+
+    if(plc->symbols) {
+        hashtable_on_each(plc->symbols, free_entry, NULL);
+        hashtable_destroy(plc->symbols);
+    }
+
+    if(plc->tag_types) {
+        hashtable_on_each(plc->tag_types, free_entry, NULL);
+        hashtable_destroy(plc->tag_types);
+    }
+
+    if(plc->templates) {
+        for(int i=0; i < vector_length(plc->templates); i++) {
+            mem_free(vector_get(plc->templates, i));
+        }
+
+        vector_destroy(plc->templates);
+    }
+
+    mem_free(plc->host);
+    mem_free(plc->path);
+    mem_free(plc);
+}
+
+
+void clear_symbols_unsafe(meta_plc_t *plc)
+{
+    hashtable_p symbols = hashtable_create(META_CACHE_SYMBOL_TABLE_SIZE);
+
+    if(!symbols) {
+        pdebug(DEBUG_WARN, "Unable to allocate a new symbol table!");
+        return;
+    }
+
+    hashtable_on_each(plc->symbols, free_entry, NULL);
+    hashtable_destroy(plc->symbols);
+
+    plc->symbols = symbols;
+    plc->symbol_next_id = 0;
+    plc->symbols_complete = 0;
+}
+
+
+int apply_symbol(hashtable_p table, int64_t key, void *data, void *context)
+{
+    meta_symbol_t *sym = data;
+
+    (void)table;
+    (void)key;
+
+    /* a name the session cannot take is looked up again, keep going. */
+    session_add_symbol_id((ab_session_p)context, sym->name, sym->name_len, sym->instance_id, sym->symbol_type);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+int free_entry(hashtable_p table, int64_t key, void *data, void *context)
+{
+    (void)table;
+    (void)key;
+    (void)context;
+
+    if(data) {
+        mem_free(data);
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+/* symbol names are not case sensitive, encoded tag names are kept as they are. */
+int64_t name_key(const uint8_t *name, int name_len, int fold_case)
+{
+    uint8_t buf[MAX_TAG_NAME];
+
+    if(name_len > (int)sizeof(buf)) {
+        name_len = (int)sizeof(buf);
+    }
+
+    for(int i=0; i < name_len; i++) {
+        buf[i] = (fold_case ? (uint8_t)tolower(name[i]) : name[i]);
+    }
+
+    return ((int64_t)name_len << 32) | (int64_t)hash(buf, (size_t)name_len, 0);
+}
+
+
+int put_symbol_unsafe(meta_plc_t *plc, const uint8_t *name, int name_len, uint32_t instance_id, uint16_t symbol_type)
+{
+    int64_t key = name_key(name, name_len, 1);
+    meta_symbol_t *sym = hashtable_get(plc->symbols, key);
+    int rc = PLCTAG_STATUS_OK;
+
+    /* names that hash the same are rare, the first one wins. */
+    if(sym) {
+        if(sym->instance_id == instance_id && sym->symbol_type == symbol_type) {
+            return PLCTAG_ERR_DUPLICATE;
+        }
+
+        sym->instance_id = instance_id;
+        sym->symbol_type = symbol_type;
+
+        return PLCTAG_STATUS_OK;
+    }
+
+    sym = mem_alloc((int)sizeof(*sym) + name_len);
+    if(!sym) {
+        pdebug(DEBUG_WARN, "Unable to allocate cached symbol!");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    sym->instance_id = instance_id;
+    sym->symbol_type = symbol_type;
+    sym->name_len = name_len;
+
+    for(int i=0; i < name_len; i++) {
+        sym->name[i] = (uint8_t)tolower(name[i]);
+    }
+
+    rc = hashtable_put(plc->symbols, key, sym);
+    if(rc != PLCTAG_STATUS_OK) {
+        mem_free(sym);
+    }
+
+    return rc;
+}
+
+
+int put_template_unsafe(meta_plc_t *plc, uint16_t template_id, uint16_t handle, uint32_t struct_size, uint16_t member_count, const uint8_t *definition, int definition_size)
+{
+    meta_template_t *tmpl = NULL;
+    int rc = PLCTAG_STATUS_OK;
+
+    for(int i=0; i < vector_length(plc->templates); i++) {
+        tmpl = vector_get(plc->templates, i);
+
+        if(tmpl->template_id == template_id) {
+            if(tmpl->handle == handle && tmpl->struct_size == struct_size && mem_cmp(tmpl->definition, tmpl->definition_size, (void *)definition, definition_size) == 0) {
+                return PLCTAG_ERR_DUPLICATE;
+            }
+
+            /* the template changed, replace it. */
+            vector_remove(plc->templates, i);
+            mem_free(tmpl);
+            break;
+        }
+    }
+
+    tmpl = mem_alloc((int)sizeof(*tmpl) + definition_size);
+    if(!tmpl) {
+        pdebug(DEBUG_WARN, "Unable to allocate cached template!");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    tmpl->template_id = template_id;
+    tmpl->handle = handle;
+    tmpl->struct_size = struct_size;
+    tmpl->member_count = member_count;
+    tmpl->definition_size = definition_size;
+    mem_copy(tmpl->definition, (void *)definition, definition_size);
+
+    rc = vector_push_back(plc->templates, tmpl);
+    if(rc != PLCTAG_STATUS_OK) {
+        mem_free(tmpl);
+    }
+
+    return rc;
+}
+
+
+int put_tag_type_unsafe(meta_plc_t *plc, const uint8_t *name, int name_len, const uint8_t *type_info, int type_info_size, int elem_size)
+{
+    int64_t key = 0;
+    meta_tag_type_t *entry = NULL;
+    int rc = PLCTAG_STATUS_OK;
+
+    if(name_len <= 0 || name_len > MAX_TAG_NAME || type_info_size <= 0 || type_info_size > MAX_TAG_TYPE_INFO) {
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    key = name_key(name, name_len, 0);
+    entry = hashtable_get(plc->tag_types, key);
+
+    if(entry) {
+        if(mem_cmp(entry->name, entry->name_len, (void *)name, name_len) != 0) {
+            return PLCTAG_ERR_DUPLICATE;
+        }
+
+        if(entry->elem_size == elem_size && mem_cmp(entry->type_info, entry->type_info_size, (void *)type_info, type_info_size) == 0) {
+            return PLCTAG_ERR_DUPLICATE;
+        }
+
+        entry->elem_size = elem_size;
+        entry->type_info_size = type_info_size;
+        mem_copy(entry->type_info, (void *)type_info, type_info_size);
+
+        return PLCTAG_STATUS_OK;
+    }
+
+    entry = mem_alloc((int)sizeof(*entry) + name_len);
+    if(!entry) {
+        pdebug(DEBUG_WARN, "Unable to allocate cached tag type!");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    entry->elem_size = elem_size;
+    entry->type_info_size = type_info_size;
+    mem_copy(entry->type_info, (void *)type_info, type_info_size);
+    entry->name_len = name_len;
+    mem_copy(entry->name, (void *)name, name_len);
+
+    rc = hashtable_put(plc->tag_types, key, entry);
+    if(rc != PLCTAG_STATUS_OK) {
+        mem_free(entry);
+    }
+
+    return rc;
+}
+
+
+meta_tag_type_t *find_tag_type_unsafe(meta_plc_t *plc, const uint8_t *name, int name_len)
+{
+    meta_tag_type_t *entry = hashtable_get(plc->tag_types, name_key(name, name_len, 0));
+
+    if(entry && mem_cmp(entry->name, entry->name_len, (void *)name, name_len) == 0) {
+        return entry;
+    }
+
+    return NULL;
+}
+
+
+/* the name the tag was created with, even after an instance ID replaced it. */
+const uint8_t *tag_cache_name(ab_tag_p tag, int *name_len)
+{
+    if(tag->symbolic_name) {
+        *name_len = tag->symbolic_name_size;
+        return tag->symbolic_name;
+    }
+
+    *name_len = tag->encoded_name_size;
+    return tag->encoded_name;
+}
+
+
+void load_unsafe(const char *file_name)
+{
+    FILE *file = fopen(file_name, "rb");
+    uint8_t *buf = NULL;
+    uint8_t *data = NULL;
+    uint8_t *end = NULL;
+    meta_plc_t *plc = NULL;
+    long file_size = 0;
+    int num_records = 0;
+
+    if(!file) {
+        pdebug(DEBUG_INFO, "No metadata cache file %s yet.", file_name);
+        return;
+    }
+
+    if(fseek(file, 0, SEEK_END) != 0 || (file_size = ftell(file)) < META_CACHE_HEADER_SIZE || fseek(file, 0, SEEK_SET) != 0 || file_size > INT32_MAX) {
+        pdebug(DEBUG_WARN, "Metadata cache file %s is too short or unreadable!", file_name);
+        fclose(file);
+        return;
+    }
+
+    buf = mem_alloc((int)file_size);
+    if(!buf) {
+        pdebug(DEBUG_WARN, "Unable to allocate %ld bytes for the metadata cache!", file_size);
+        fclose(file);
+        return;
+    }
+
+    if(fread(buf, 1, (size_t)file_size, file) != (size_t)file_size) {
+        pdebug(DEBUG_WARN, "Unable to read metadata cache file %s!", file_name);
+        fclose(file);
+        mem_free(buf);
+        return;
+    }
+
+    fclose(file);
+
+    if(mem_cmp(buf, 7, META_CACHE_MAGIC, 7) != 0 || buf[7] != META_CACHE_VERSION) {
+        pdebug(DEBUG_WARN, "File %s is not a version %d metadata cache, ignoring it.", file_name, META_CACHE_VERSION);
+        mem_free(buf);
+        return;
+    }
+
+    data = buf + META_CACHE_HEADER_SIZE;
+    end = buf + file_size;
+
+    while(end - data >= META_CACHE_RECORD_HEADER_SIZE) {
+        uint8_t kind = data[0];
+        uint32_t len = get_u32(data + 1);
+        uint8_t *payload = data + META_CACHE_RECORD_HEADER_SIZE;
+
+        if(len > (uint32_t)(end - payload)) {
+            pdebug(DEBUG_WARN, "Metadata cache file %s is truncated!", file_name);
+            break;
+        }
+
+        data = payload + len;
+
+        if(kind == META_CACHE_REC_PLC) {
+            char host[256] = {0};
+            char path[256] = {0};
+            uint16_t host_len = (len >= 2 ? get_u16(payload) : 0xFFFF);
+            uint16_t path_len = 0xFFFF;
+
+            if(host_len < sizeof(host) && len >= (uint32_t)host_len + 4) {
+                path_len = get_u16(payload + 2 + host_len);
+            }
+
+            if(path_len >= sizeof(path) || len != (uint32_t)host_len + path_len + 4) {
+                pdebug(DEBUG_WARN, "Bad PLC record in metadata cache, skipping its entries.");
+                plc = NULL;
+                continue;
+            }
+
+            mem_copy(host, payload + 2, host_len);
+            mem_copy(path, payload + 4 + host_len, path_len);
+
+            plc = find_plc_unsafe(host, path, 1);
+            continue;
+        }
+
+        if(!plc) {
+            continue;
+        }
+
+        switch(kind) {
+        case META_CACHE_REC_SYMBOL_PROGRESS:
+            if(len >= 5) {
+                plc->symbol_next_id = get_u32(payload);
+                plc->symbols_complete = (payload[4] ? 1 : 0);
+            }
+            break;
+
+        case META_CACHE_REC_SYMBOL:
+            if(len > 6 && len - 6 <= META_CACHE_MAX_NAME) {
+                put_symbol_unsafe(plc, payload + 6, (int)(len - 6), get_u32(payload), get_u16(payload + 4));
+            }
+            break;
+
+        case META_CACHE_REC_TEMPLATE:
+            if(len > 10) {
+                put_template_unsafe(plc, get_u16(payload), get_u16(payload + 2), get_u32(payload + 4), get_u16(payload + 8), payload + 10, (int)(len - 10));
+            }
+            break;
+
+        case META_CACHE_REC_TAG_TYPE:
+            if(len > 5 && (uint32_t)payload[4] + 5 < len) {
+                int type_len = payload[4];
+
+                put_tag_type_unsafe(plc, payload + 5 + type_len, (int)len - 5 - type_len, payload + 5, type_len, (int)(int32_t)get_u32(payload));
+            }
+            break;
+
+        default:
+            /* from a newer version, skip it. */
+            break;
+        }
+
+        num_records++;
+    }
+
+    mem_free(buf);
+
+    pdebug(DEBUG_INFO, "Loaded %d records for %d PLCs from metadata cache file %s.", num_records, vector_length(meta_plcs), file_name);
+}
+
+
+void save_unsafe(void)
+{
+    FILE *file = fopen(meta_file, "wb");
+    uint8_t header[META_CACHE_HEADER_SIZE];
+    int rc = PLCTAG_STATUS_OK;
+
+    if(!file) {
+        pdebug(DEBUG_WARN, "Unable to write metadata cache file %s!", meta_file);
+        return;
+    }
+
+    mem_copy(header, META_CACHE_MAGIC, 7);
+    header[7] = META_CACHE_VERSION;
+
+    if(fwrite(header, 1, sizeof(header), file) != sizeof(header)) {
+        rc = PLCTAG_ERR_WRITE;
+    }
+
+    for(int i=0; rc == PLCTAG_STATUS_OK && i < vector_length(meta_plcs); i++) {
+        meta_plc_t *plc = vector_get(meta_plcs, i);
+        uint8_t buf[4 + 2 * 256];
+        int host_len = str_length(plc->host);
+        int path_len = str_length(plc->path);
+
+        if(host_len > 255 || path_len > 255) {
+            continue;
+        }
+
+        put_u16(buf, (uint16_t)host_len);
+        mem_copy(buf + 2, plc->host, host_len);
+        put_u16(buf + 2 + host_len, (uint16_t)path_len);
+        mem_copy(buf + 4 + host_len, plc->path, path_len);
+
+        rc = write_record(file, META_CACHE_REC_PLC, buf, 4 + host_len + path_len, NULL, 0);
+
+        if(rc == PLCTAG_STATUS_OK) {
+            put_u32(buf, plc->symbol_next_id);
+            buf[4] = (uint8_t)plc->symbols_complete;
+
+            rc = write_record(file, META_CACHE_REC_SYMBOL_PROGRESS, buf, 5, NULL, 0);
+        }
+
+        if(rc == PLCTAG_STATUS_OK) {
+            rc = hashtable_on_each(plc->symbols, write_symbol, file);
+        }
+
+        for(int t=0; rc == PLCTAG_STATUS_OK && t < vector_length(plc->templates); t++) {
+            meta_template_t *tmpl = vector_get(plc->templates, t);
+
+            put_u16(buf, tmpl->template_id);
+            put_u16(buf + 2, tmpl->handle);
+            put_u32(buf + 4, tmpl->struct_size);
+            put_u16(buf + 8, tmpl->member_count);
+
+            rc = write_record(file, META_CACHE_REC_TEMPLATE, buf, 10, tmpl->definition, tmpl->definition_size);
+        }
+
+        if(rc == PLCTAG_STATUS_OK) {
+            rc = hashtable_on_each(plc->tag_types, write_tag_type, file);
+        }
+    }
+
+    if(fclose(file) != 0) {
+        rc = PLCTAG_ERR_WRITE;
+    }
+
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Error %s writing metadata cache file %s!", plc_tag_decode_error(rc), meta_file);
+    }
+}
+
+
+void maybe_save_unsafe(int now)
+{
+    int64_t now_ms = 0;
+
+    if(!meta_file || !meta_dirty) {
+        return;
+    }
+
+    now_ms = time_ms();
+
+    if(!now && now_ms - meta_last_save_ms < META_CACHE_SAVE_INTERVAL_MS) {
+        return;
+    }
+
+    save_unsafe();
+
+    meta_dirty = 0;
+    meta_last_save_ms = now_ms;
+}
+
+
+int write_record(FILE *file, uint8_t kind, const uint8_t *head, int head_len, const uint8_t *tail, int tail_len)
+{
+    uint8_t rec_header[META_CACHE_RECORD_HEADER_SIZE];
+
+    rec_header[0] = kind;
+    put_u32(rec_header + 1, (uint32_t)(head_len + tail_len));
+
+    if(fwrite(rec_header, 1, sizeof(rec_header), file) != sizeof(rec_header)
+       || fwrite(head, 1, (size_t)head_len, file) != (size_t)head_len
+       || (tail_len > 0 && fwrite(tail, 1, (size_t)tail_len, file) != (size_t)tail_len)) {
+        return PLCTAG_ERR_WRITE;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+int write_symbol(hashtable_p table, int64_t key, void *data, void *context)
+{
+    meta_symbol_t *sym = data;
+    uint8_t buf[6];
+
+    (void)table;
+    (void)key;
+
+    put_u32(buf, sym->instance_id);
+    put_u16(buf + 4, sym->symbol_type);
+
+    return write_record((FILE *)context, META_CACHE_REC_SYMBOL, buf, 6, sym->name, sym->name_len);
+}
+
+
+int write_tag_type(hashtable_p table, int64_t key, void *data, void *context)
+{
+    meta_tag_type_t *entry = data;
+    uint8_t buf[5 + MAX_TAG_TYPE_INFO];
+
+    (void)table;
+    (void)key;
+
+    put_u32(buf, (uint32_t)entry->elem_size);
+    buf[4] = (uint8_t)entry->type_info_size;
+    mem_copy(buf + 5, entry->type_info, entry->type_info_size);
+
+    return write_record((FILE *)context, META_CACHE_REC_TAG_TYPE, buf, 5 + entry->type_info_size, entry->name, entry->name_len);
+}
+
+
+uint16_t get_u16(const uint8_t *data)
+{
+    return (uint16_t)(data[0] | (data[1] << 8));
+}
+
+
+uint32_t get_u32(const uint8_t *data)
+{
+    return (uint32_t)data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+
+void put_u16(uint8_t *data, uint16_t val)
+{
+    data[0] = (uint8_t)(val & 0xFF);
+    data[1] = (uint8_t)((val >> 8) & 0xFF);
+}
+
+
+void put_u32(uint8_t *data, uint32_t val)
+{
+    data[0] = (uint8_t)(val & 0xFF);
+    data[1] = (uint8_t)((val >> 8) & 0xFF);
+    data[2] = (uint8_t)((val >> 16) & 0xFF);
+    data[3] = (uint8_t)((val >> 24) & 0xFF);
+}
@@ -0,0 +1,100 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#ifndef __PLCTAG_AB_META_CACHE_H__
+#define __PLCTAG_AB_META_CACHE_H__ 1
+
+#include <ab/ab_common.h>
+#include <ab/session.h>
+#include <ab/tag.h>
+
+/*
+ * Tag metadata cache.
+ *
+ * With the metadata_cache_file attribute, what the library learns about
+ * each PLC is kept in a file: the symbol instance IDs and types from the
+ * tag listing, the UDT templates and the type and element size found by
+ * the first read of each tag.  After a restart a new session starts with
+ * all of that, so tags with initial_read=0 are ready at once and tags
+ * using instance IDs do not list the controller again.
+ *
+ * The entries are checked lazily.  A stale instance ID drops all the IDs
+ * of the PLC, and a read that returns a different type or a write the
+ * PLC refuses drops the cached type of the tag.
+ *
+ * The file is read in one go when it is first named and written back a
+ * few times a second at most, when a session closes and at shutdown.
+ * It starts with an 8 byte header:
+ *
+ *     "PLCMETA"  magic
+ *     uint8      format version, 1
+ *
+ * followed by records:
+ *
+ *     uint8      kind, META_CACHE_REC_*
+ *     uint32     payload length
+ *     ...        the payload
+ *
+ * A META_CACHE_REC_PLC record, the gateway and path as two uint16 length
+ * prefixed strings, starts the entries of each PLC.  Unknown kinds are
+ * skipped.  All the integers are little endian.
+ */
+
+#define META_CACHE_MAGIC "PLCMETA"
+#define META_CACHE_VERSION (1)
+#define META_CACHE_HEADER_SIZE (8)
+#define META_CACHE_RECORD_HEADER_SIZE (5)
+
+#define META_CACHE_REC_PLC (1)              /* gateway, path */
+#define META_CACHE_REC_SYMBOL_PROGRESS (2)  /* uint32 next ID, uint8 complete */
+#define META_CACHE_REC_SYMBOL (3)           /* uint32 instance ID, uint16 type, name */
+#define META_CACHE_REC_TEMPLATE (4)         /* uint16 ID, uint16 handle, uint32 size, uint16 members, definition */
+#define META_CACHE_REC_TAG_TYPE (5)         /* int32 element size, uint8 type length, type, encoded name */
+
+extern int meta_cache_startup(void);
+extern void meta_cache_teardown(void);
+
+extern void meta_cache_open(const char *file_name);
+extern void meta_cache_apply(ab_session_p session);
+extern void meta_cache_flush(void);
+
+extern void meta_cache_add_symbol(ab_session_p session, const uint8_t *name, int name_len, uint32_t instance_id, uint16_t symbol_type);
+extern void meta_cache_set_symbol_progress(ab_session_p session, uint32_t next_id, int complete);
+extern void meta_cache_clear_symbols(ab_session_p session);
+extern void meta_cache_add_template(ab_session_p session, uint16_t template_id, uint16_t handle, uint32_t struct_size, uint16_t member_count, const uint8_t *definition, int definition_size);
+
+extern void meta_cache_add_tag_type(ab_tag_p tag);
+extern int meta_cache_find_tag_type(ab_tag_p tag);
+extern void meta_cache_forget_tag_type(ab_tag_p tag);
+
+#endif
@@ -285,6 +285,80 @@ int slc_encode_tag_name(uint8_t *data, int *size, pccc_file_t *file_type, const
 
 
 
+/*
+ * Split a data-table address into its file and element.  The
+ * sub-element is -1 if the address does not have one.
+ */
+
+int pccc_parse_address(const char *name, pccc_file_t *file_type, int *file_num, int *elem_num, int *subelem_num)
+{
+    if(!name || !file_type || !file_num || !elem_num || !subelem_num) {
+        pdebug(DEBUG_WARN, "Called with null pointer!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    return parse_pccc_logical_address(name, file_type, file_num, elem_num, subelem_num);
+}
+
+
+
+/*
+ * Encode the address of a whole element as levels, as in
+ * plc5_encode_tag_name().  Used to move a read to another element
+ * of the same file.
+ */
+
+int plc5_encode_element_address(uint8_t *data, int *size, int file_num, int elem_num)
+{
+    if(!data || !size) {
+        pdebug(DEBUG_WARN, "Called with null data or size!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    /* level one and two */
+    data[0] = 0x06;
+    *size = 1;
+
+    encode_data(data, size, file_num);
+    encode_data(data, size, elem_num);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * Encode the address of a whole element as file/type/element/subelement,
+ * as in slc_encode_tag_name().
+ */
+
+int slc_encode_element_address(uint8_t *data, int *size, pccc_file_t file_type, int file_num, int elem_num)
+{
+    int encoded_file_type = encode_file_type(file_type);
+
+    if(!data || !size) {
+        pdebug(DEBUG_WARN, "Called with null data or size!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(encoded_file_type == 0) {
+        pdebug(DEBUG_WARN,"SLC file type %d cannot be encoded!", file_type);
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    *size = 0;
+
+    encode_data(data, size, file_num);
+    encode_data(data, size, encoded_file_type);
+    encode_data(data, size, elem_num);
+    encode_data(data, size, 0);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+
 uint8_t pccc_calculate_bcc(uint8_t *data,int size)
 {
     int bcc = 0;
@@ -348,7 +422,18 @@ uint16_t CRC16Bytes[] = {
 
 uint16_t pccc_calculate_crc16(uint8_t *data, int size)
 {
-    uint16_t running_crc = 0;
+    return pccc_update_crc16(0, data, size);
+}
+
+
+/*
+ * Continue a CRC over more data.  Framed protocols like DF1 checksum the
+ * message after byte stuffing is removed, so the CRC is built up one run
+ * of bytes at a time as they come off the wire.
+ */
+uint16_t pccc_update_crc16(uint16_t crc, uint8_t *data, int size)
+{
+    uint16_t running_crc = crc;
     int i;
 
     /* for each byte in the data... */
@@ -376,6 +461,21 @@ uint16_t pccc_calculate_crc16(uint8_t *data, int size)
 
 
 
+/*
+ * Several transactions can be outstanding through a DH+ bridge, so check
+ * that a reply belongs to our request.  Both TNS values are in host order.
+ */
+int pccc_check_tns(uint16_t reply_tns, uint16_t request_tns)
+{
+    if(reply_tns != request_tns) {
+        pdebug(DEBUG_WARN, "PCCC reply has TNS %u but the request had TNS %u!", (unsigned int)reply_tns, (unsigned int)request_tns);
+        return PLCTAG_ERR_BAD_REPLY;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
 
 
 const char *pccc_decode_error(uint8_t *error_ptr)
@@ -46,11 +46,19 @@ typedef enum { PCCC_FILE_UNKNOWN, PCCC_FILE_ASCII, PCCC_FILE_BIT, PCCC_FILE_BLOC
                PCCC_FILE_PID, PCCC_FILE_CONTROL, PCCC_FILE_STATUS, PCCC_FILE_SFC, PCCC_FILE_STRING, PCCC_FILE_TIMER
              } pccc_file_t;
 
+/* largest typed read of a data file range that the processors answer. */
+#define PCCC_MAX_READ_SPAN (236)
+
+extern int pccc_parse_address(const char *name, pccc_file_t *file_type, int *file_num, int *elem_num, int *subelem_num);
+extern int plc5_encode_element_address(uint8_t *data, int *size, int file_num, int elem_num);
+extern int slc_encode_element_address(uint8_t *data, int *size, pccc_file_t file_type, int file_num, int elem_num);
 extern int plc5_encode_tag_name(uint8_t *data, int *size, pccc_file_t *file_type, const char *name, int max_tag_name_size);
 extern int slc_encode_tag_name(uint8_t *data, int *size, pccc_file_t *file_type, const char *name, int max_tag_name_size);
 extern uint8_t pccc_calculate_bcc(uint8_t *data,int size);
 extern uint16_t pccc_calculate_crc16(uint8_t *data, int size);
+extern uint16_t pccc_update_crc16(uint16_t crc, uint8_t *data, int size);
 extern const char *pccc_decode_error(uint8_t *error_ptr);
+extern int pccc_check_tns(uint16_t reply_tns, uint16_t request_tns);
 extern uint8_t *pccc_decode_dt_byte(uint8_t *data,int data_size, int *pccc_res_type, int *pccc_res_length);
 extern int pccc_encode_dt_byte(uint8_t *data,int buf_size, uint32_t data_type, uint32_t data_size);
 
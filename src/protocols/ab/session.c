@@ -36,15 +36,81 @@
 #include <ab/cip.h>
 #include <ab/defs.h>
 #include <ab/error_codes.h>
+#include <ab/meta_cache.h>
 #include <ab/session.h>
+#include <util/atomic_int.h>
 #include <util/debug.h>
+#include <util/hash.h>
+#include <util/socket_opts.h>
+#include <util/trace.h>
+#include <ctype.h>
 #include <inttypes.h>
 #include <limits.h>
+#include <stddef.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
 
 #define MAX_REQUESTS (200)
 
+/* most queued requests the planner looks past when filling one packet. */
+#define SESSION_MAX_PACK_SCAN (64)
+
+/* most released requests a session keeps for reuse. */
+#define SESSION_REQUEST_POOL_MAX (256)
+
+/* most receive buffers kept for reuse once the tags are done with them. */
+#define SESSION_RX_BUF_POOL_MAX (16)
+
+/* starting size of the table of queued reads, it grows as needed. */
+#define SESSION_MERGE_TABLE_SIZE (64)
+
+/* initial size of the table of symbol instance IDs, it grows as needed. */
+#define SESSION_SYMBOL_TABLE_SIZE (64)
+
+/* initial size of the table of UDT templates. */
+#define SESSION_UDT_TABLE_SIZE (32)
+
+/* name prefixes kept per session, new prefixes are not kept past this. */
+#define SESSION_NAME_PREFIX_TABLE_SIZE (64)
+#define SESSION_MAX_NAME_PREFIXES (1024)
+
+/* longest symbol name kept, Logix names are at most 40 characters. */
+#define SESSION_MAX_SYMBOL_NAME (255)
+
+/* most distinct reads the shared read cache remembers per session. */
+#define SESSION_READ_CACHE_MAX (256)
+
+/* negotiated connection capabilities, remembered per gateway and path. */
+typedef struct {
+    char *host;
+    char *path;
+    int only_use_old_forward_open;
+    uint16_t max_payload_size;
+} conn_cache_entry_t;
+
+/* how long closing the sessions at shutdown may take, the Forward Close is skipped after that. */
+#define SESSION_TEARDOWN_TIMEOUT (2000)
+
+/* longest line in the connection cache file. */
+#define CONN_CACHE_LINE_SIZE (512)
+
+struct ab_request_pool_t {
+    lock_t lock;
+    int closed;
+    int num_free;
+    ab_request_p free_head;
+};
+
+/* a packet that has been sent and is waiting for its response. */
+struct ab_in_flight_t {
+    uint64_t seq_id;
+    int is_connected;
+    int64_t time_sent;
+    int num_requests;
+    ab_request_p requests[MAX_REQUESTS];
+};
+
 #define EIP_CIP_PREFIX_SIZE (44) /* bytes of encap header and CFP connected header */
 
 /* WARNING: this must fit within 9 bits! */
@@ -67,6 +133,75 @@
 
 #define SESSION_DISCONNECT_TIMEOUT (5000)
 
+/* how long the session thread sleeps when there is nothing to do. */
+#define SESSION_IDLE_WAIT_TIME (100)
+
+/* shortest keepalive_ms allowed. */
+#define SESSION_MIN_KEEPALIVE_MS (100)
+
+/*
+ * The rate limit buckets hold a tenth of a second of traffic, and at least
+ * one packet.  Only high priority requests may use the last quarter so
+ * that they still get through when bulk traffic is being held back.
+ */
+#define SESSION_RATE_UNIT (1000000)
+#define SESSION_RATE_BURST_DIVISOR (10)
+#define SESSION_RATE_RESERVE_PCT (25)
+
+/* a queued request gains one priority class each time this passes so low priority work cannot starve. */
+#define SESSION_PRIORITY_AGING_US (250000)
+
+/* longest single socket wait, this bounds how long termination takes to notice. */
+#define SESSION_SOCKET_WAIT_TIME (20)
+
+
+
+/* a response to a read, kept so that other handles to the same tag can use it. */
+typedef struct {
+    uint32_t generation;
+    int64_t time_filled;
+    int request_size;
+    int response_size;
+    int response_capacity;
+    uint8_t *response;
+    uint8_t request[];
+} read_cache_entry_t;
+
+
+/* an element with bit tags on it.  The name is the encoded name of the element. */
+#define SESSION_BIT_WORD_MAX_SIZE (16)
+
+struct ab_bit_word_t {
+    int64_t key;
+    int num_tags;
+    int32_t leader_id;          /* the bit tag whose read is in flight, zero if none. */
+    uint32_t read_seq;          /* bumped when the leader's read finishes. */
+    int read_status;
+    int data_size;
+    uint8_t data[SESSION_BIT_WORD_MAX_SIZE];
+    int num_waiters;
+    int max_waiters;
+    int32_t *waiters;
+    int name_size;
+    uint8_t name[];
+};
+
+
+/* the CIP encoding of a tag name prefix.  The data is the name text then the encoding. */
+typedef struct {
+    int name_len;
+    int encoded_size;
+    uint8_t data[];
+} ab_name_prefix_t;
+
+
+/* a symbol instance ID from a tag listing.  The name is kept in lower case. */
+typedef struct {
+    uint32_t instance_id;
+    uint16_t symbol_type;
+    int name_len;
+    uint8_t name[];
+} symbol_id_entry_t;
 
 
 static ab_session_p session_create_unsafe(const char *host, const char *path, plc_type_t plc_type, int *use_connected_msg);
@@ -75,7 +210,20 @@ static int session_init(ab_session_p session);
 static int add_session_unsafe(ab_session_p n);
 static int remove_session_unsafe(ab_session_p n);
 static ab_session_p find_session_by_host_unsafe(const char *gateway, const char *path);
+static ab_session_p find_pooled_session_unsafe(const char *gateway, const char *path, int pool_size);
+static conn_cache_entry_t *conn_cache_find_unsafe(const char *host, const char *path);
+static void conn_cache_apply_unsafe(ab_session_p session);
+static void conn_cache_update(ab_session_p session);
+static void conn_cache_load_unsafe(const char *file_name);
+static void conn_cache_save_unsafe(void);
 static int session_match_valid(const char *host, const char *path, ab_session_p session);
+static ab_transport_p transport_find_or_create_unsafe(const char *host);
+static void transport_release_unsafe(ab_transport_p transport);
+static int transport_attach(ab_session_p session);
+static int transport_lock(ab_session_p session);
+static void transport_unlock(ab_session_p session, int last_rc);
+static void transport_detach(ab_session_p session);
+static void transport_close_socket_unsafe(ab_transport_p transport);
 static int session_add_request_unsafe(ab_session_p sess, ab_request_p req);
 static int session_open_socket(ab_session_p session);
 static void session_destroy(void *session);
@@ -83,14 +231,53 @@ static int session_register(ab_session_p session);
 static int session_close_socket(ab_session_p session);
 static int session_unregister(ab_session_p session);
 static THREAD_FUNC(session_handler);
+static THREAD_FUNC(session_close_handler);
 static int purge_aborted_requests_unsafe(ab_session_p session);
+static void request_queue_push(ab_request_queue_t *queue, ab_request_p req);
+static void request_queue_unlink(ab_request_queue_t *queue, ab_request_p req);
+static void request_queue_replace(ab_request_queue_t *queue, ab_request_p old_req, ab_request_p new_req);
+static void dequeue_request_unsafe(ab_session_p session, ab_request_p req);
+static int64_t request_merge_key(ab_request_p req);
+static int merge_request_unsafe(ab_session_p session, ab_request_p req);
+static int coalesce_rmw_request_unsafe(ab_session_p session, ab_request_p req);
+static read_cache_entry_t *read_cache_find_unsafe(ab_session_p session, ab_request_p req);
+static int read_cache_serve_unsafe(ab_session_p session, ab_request_p req);
+static read_cache_entry_t *read_cache_claim(ab_session_p session, ab_request_p req, uint32_t *generation);
+static void read_cache_fill(ab_session_p session, read_cache_entry_t *entry, uint32_t generation, ab_request_p req, int resp_size);
+static int read_cache_free_entry(hashtable_p table, int64_t key, void *data, void *context);
+static int64_t symbol_id_key(const uint8_t *name, int name_len, uint8_t *lower_name);
+static int symbol_id_free_entry(hashtable_p table, int64_t key, void *data, void *context);
+static int bit_word_free_entry(hashtable_p table, int64_t key, void *data, void *context);
+static void bit_word_wake_waiters_unsafe(ab_bit_word_p word);
+static void complete_merged_requests(ab_request_p request, int status, int resp_size);
+static int coalesce_span_request_unsafe(ab_session_p session, ab_request_p req);
+static int complete_span_requests(ab_request_p request, int resp_size);
+static void discard_aborted_request_unsafe(ab_session_p session, ab_request_p request);
 static int process_requests(ab_session_p session);
+static int send_next_bundle(ab_session_p session, int *sent);
+static int plan_next_bundle_unsafe(ab_session_p session, ab_in_flight_t *slot);
+static int default_requests_in_flight(ab_session_p session);
+static int send_keepalive(ab_session_p session);
+static int rate_limit_allows(ab_session_p session);
+static int64_t rate_refill(int64_t tokens, int64_t elapsed_us, int rate, int64_t base, int64_t *reserve);
+static void rate_limit_charge(ab_session_p session, int packet_bytes);
+static int receive_next_response(ab_session_p session);
+static void fail_in_flight_requests(ab_session_p session, int status);
+static void fail_queued_requests_unsafe(ab_session_p session, int status);
+static void fail_queued_request_unsafe(ab_session_p session, ab_request_p req, int status);
+static int expire_in_flight_requests(ab_session_p session);
+static void request_extend_deadline(ab_request_p primary, ab_request_p rider);
+static int drop_dead_request_unsafe(ab_session_p session, ab_request_p req, int64_t now_ms);
+static void breaker_failure(ab_session_p session);
+static void breaker_close(ab_session_p session);
+static int breaker_retry_wait(ab_session_p session);
 //static int check_packing(ab_session_p session, ab_request_p request);
 static int get_payload_size(ab_request_p request);
 static int pack_requests(ab_session_p session, ab_request_p *requests, int num_requests);
 static int prepare_request(ab_session_p session);
 static int send_eip_request(ab_session_p session, int timeout);
-static int recv_eip_response(ab_session_p session, int timeout);
+static int recv_eip_response(ab_session_p session, int timeout, int check_deadlines);
+static void session_wait_socket(ab_session_p session, int events, int64_t timeout_time);
 static int unpack_response(ab_session_p session, ab_request_p request, int sub_packet);
 // static int perform_forward_open(ab_session_p session);
 static int perform_forward_close(ab_session_p session);
@@ -106,12 +293,57 @@ static int send_old_forward_open_request(ab_session_p session);
 static int send_extended_forward_open_request(ab_session_p session);
 static int receive_forward_open_response(ab_session_p session);
 static void request_destroy(void *req_arg);
+static int request_recycle(void *req_arg);
+static ab_request_pool_p request_pool_create(void);
+static void request_pool_close(ab_request_pool_p pool);
+static void request_pool_destroy(void *pool_arg);
 static int session_request_increase_buffer(ab_request_p request, int new_capacity);
+static uint8_t *rx_buf_get(void);
+static int rx_buf_recycle(void *buf);
+static void rx_buf_destroy(void *buf);
+static void rx_buf_pool_flush(void);
+static void session_release_lent_data(ab_session_p session);
+static uint32_t session_take_extra_data(ab_session_p session);
 
 
 static volatile mutex_p session_mutex = NULL;
 static volatile vector_p sessions = NULL;
 
+/* receive buffers given back by the tags, see unpack_response(). */
+static lock_t rx_buf_pool_lock = LOCK_INIT;
+static int rx_buf_pool_closed = 0;
+static int rx_buf_pool_count = 0;
+static uint8_t *rx_buf_pool[SESSION_RX_BUF_POOL_MAX];
+
+/*
+ * One TCP connection and EIP registration used by all the sessions with
+ * share_socket=1 to a gateway.  Each session keeps its own CIP connection,
+ * queues and packing, and holds the mutex for each exchange on the socket,
+ * which ends with nothing of that session in flight.  The list and
+ * num_sessions are protected by session_mutex, the rest by the mutex.
+ */
+struct ab_transport_t {
+    char *host;
+    int num_sessions;
+    mutex_p mutex;
+    sock_p sock;
+    uint32_t session_handle;
+    uint32_t generation;    /* bumped each time the socket is closed. */
+    int num_attached;       /* sessions with a CIP connection over the current socket. */
+};
+
+static vector_p transports = NULL;
+
+/* while this is non-zero, the session threads do not pick up new requests. */
+static atomic_int session_request_hold = { LOCK_INIT, 0 };
+
+/* connection capabilities by gateway and path, and the optional file backing them.  Protected by session_mutex. */
+static vector_p conn_cache = NULL;
+static char *conn_cache_file = NULL;
+
+/* set while the library shuts down, polite closes are skipped after it. */
+static volatile int64_t session_teardown_deadline = 0;
+
 
 
 
@@ -124,29 +356,175 @@ int session_startup()
         return rc;
     }
 
+    spin_block(&rx_buf_pool_lock) {
+        rx_buf_pool_closed = 0;
+    }
+
     if((sessions = vector_create(25, 5)) == NULL) {
         pdebug(DEBUG_ERROR, "Unable to create session vector!");
         return PLCTAG_ERR_NO_MEM;
     }
 
+    if((conn_cache = vector_create(10, 5)) == NULL) {
+        pdebug(DEBUG_ERROR, "Unable to create connection cache vector!");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    if((transports = vector_create(5, 5)) == NULL) {
+        pdebug(DEBUG_ERROR, "Unable to create shared socket vector!");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
     return rc;
 }
 
 
+/*
+ * session_hold_requests/session_release_requests
+ *
+ * Hold off all session threads from picking up queued requests.  This is
+ * used when a batch of requests is being queued so that they can all be
+ * packed together.  Holds nest.
+ */
+
+void session_hold_requests(void)
+{
+    atomic_add(&session_request_hold, 1);
+}
+
+
+void session_release_requests(void)
+{
+    /* atomic_add() returns the old value. */
+    if(atomic_add(&session_request_hold, -1) <= 1 && session_mutex) {
+        /* wake up all the session threads to look at their queues. */
+        critical_block(session_mutex) {
+            for(int i=0; sessions && i < vector_length(sessions); i++) {
+                ab_session_p session = vector_get(sessions, i);
+
+                if(session && session->wait_cond) {
+                    cond_signal(session->wait_cond);
+                }
+            }
+        }
+    }
+}
+
+
+
+/*
+ * session_teardown
+ *
+ * The sessions are closed in parallel.  All the handler threads are told
+ * to stop first, then each session is destroyed on its own thread so that
+ * PLCs that are offline do not hold up the others.
+ */
+
 void session_teardown()
 {
     if(sessions) {
-        for(int i=0; i < vector_length(sessions); i++) {
-            ab_session_p session = vector_get(sessions, i);
-            if(session) {
-                rc_dec(session);
+        ab_session_p *closing = NULL;
+        thread_p *closers = NULL;
+        int num_closing = 0;
+
+        session_teardown_deadline = time_ms() + SESSION_TEARDOWN_TIMEOUT;
+
+        critical_block(session_mutex) {
+            num_closing = vector_length(sessions);
+
+            if(num_closing > 0) {
+                closing = mem_alloc(num_closing * (int)sizeof(*closing));
+                closers = mem_alloc(num_closing * (int)sizeof(*closers));
+            }
+
+            for(int i=0; i < num_closing; i++) {
+                ab_session_p session = vector_get(sessions, i);
+
+                if(closing) {
+                    closing[i] = session;
+                }
+
+                if(session) {
+                    session->terminating = 1;
+
+                    if(session->wait_cond) {
+                        cond_signal(session->wait_cond);
+                    }
+                }
+            }
+        }
+
+        if(num_closing > 0 && (!closing || !closers)) {
+            pdebug(DEBUG_WARN, "Unable to allocate session close list, closing the sessions one at a time.");
+
+            while(vector_length(sessions) > 0) {
+                rc_dec(vector_pop_back(sessions));
+            }
+        }
+
+        for(int i=0; closing && closers && i < num_closing; i++) {
+            if(closing[i] && thread_create(&closers[i], session_close_handler, 32*1024, closing[i]) != PLCTAG_STATUS_OK) {
+                pdebug(DEBUG_WARN, "Unable to create session close thread, closing the session here.");
+                closers[i] = NULL;
+                rc_dec(closing[i]);
             }
         }
 
+        for(int i=0; closing && closers && i < num_closing; i++) {
+            if(closers[i]) {
+                thread_join(closers[i]);
+                thread_destroy(&closers[i]);
+            }
+        }
+
+        if(closing) {
+            mem_free(closing);
+        }
+
+        if(closers) {
+            mem_free(closers);
+        }
+
         vector_destroy(sessions);
         sessions = NULL;
     }
 
+    /* the sessions released theirs, anything left was never used. */
+    if(transports) {
+        while(vector_length(transports) > 0) {
+            ab_transport_p transport = vector_get(transports, 0);
+
+            transport->num_sessions = 1;
+            transport_release_unsafe(transport);
+        }
+
+        vector_destroy(transports);
+        transports = NULL;
+
+        session_teardown_deadline = 0;
+    }
+
+    if(conn_cache) {
+        for(int i=0; i < vector_length(conn_cache); i++) {
+            conn_cache_entry_t *entry = vector_get(conn_cache, i);
+
+            if(entry) {
+                mem_free(entry->host);
+                mem_free(entry->path);
+                mem_free(entry);
+            }
+        }
+
+        vector_destroy(conn_cache);
+        conn_cache = NULL;
+    }
+
+    if(conn_cache_file) {
+        mem_free(conn_cache_file);
+        conn_cache_file = NULL;
+    }
+
+    rx_buf_pool_flush();
 
     if(session_mutex) {
         mutex_destroy((mutex_p *)&session_mutex);
@@ -212,1224 +590,4073 @@ int session_get_max_payload(ab_session_p session)
     return result;
 }
 
-int session_find_or_create(ab_session_p *tag_session, attr attribs)
-{
-    /*int debug = attr_get_int(attribs,"debug",0);*/
-    const char *session_gw = attr_get_str(attribs, "gateway", "");
-    const char *session_path = attr_get_str(attribs, "path", "");
-    int use_connected_msg = attr_get_int(attribs, "use_connected_msg", 0);
-    //int session_gw_port = attr_get_int(attribs, "gateway_port", AB_EIP_DEFAULT_PORT);
-    plc_type_t plc_type = get_plc_type(attribs);
-    ab_session_p session = AB_SESSION_NULL;
-    int new_session = 0;
-    int shared_session = attr_get_int(attribs, "share_session", 1); /* share the session by default. */
-    int rc = PLCTAG_STATUS_OK;
-    int auto_disconnect_enabled = 0;
-    int auto_disconnect_timeout_ms = INT_MAX;
 
-    pdebug(DEBUG_DETAIL, "Starting");
 
-    auto_disconnect_timeout_ms = attr_get_int(attribs, "auto_disconnect_ms", INT_MAX);
-    if(auto_disconnect_timeout_ms != INT_MAX) {
-        pdebug(DEBUG_DETAIL, "Setting auto-disconnect after %dms.", auto_disconnect_timeout_ms);
-        auto_disconnect_enabled = 1;
+/*
+ * session_get_pack_room
+ *
+ * The queued packable requests fill packets in order, so the last of
+ * those packets usually has room left.  Returns roughly how many payload
+ * bytes are free in it, zero if nothing is queued.  A large write can
+ * size its next fragment to fill that space instead of going out alone.
+ */
+
+int session_get_pack_room(ab_session_p session)
+{
+    int result = 0;
+
+    if(!session) {
+        pdebug(DEBUG_WARN, "Called with null session pointer!");
+        return 0;
     }
 
-    // if(plc_type == AB_PLC_PLC5 && str_length(session_path) > 0) {
-    //     /* this means it is DH+ */
-    //     use_connected_msg = 1;
-    //     attr_set_int(attribs, "use_connected_msg", 1);
-    // }
+    critical_block(session->mutex) {
+        int space = session->max_payload_size - (int)sizeof(cip_multi_req_header);
 
-    critical_block(session_mutex) {
-        /* if we are to share sessions, then look for an existing one. */
-        if (shared_session) {
-            session = find_session_by_host_unsafe(session_gw, session_path);
-        } else {
-            /* no sharing, create a new one */
-            session = AB_SESSION_NULL;
+        if(space > 0 && session->queued_pack_bytes > 0) {
+            result = space - (session->queued_pack_bytes % space);
         }
+    }
 
-        if (session == AB_SESSION_NULL) {
-            pdebug(DEBUG_DETAIL, "Creating new session.");
-            session = session_create_unsafe(session_gw, session_path, plc_type, &use_connected_msg);
-
-            if (session == AB_SESSION_NULL) {
-                pdebug(DEBUG_WARN, "unable to create or find a session!");
-                rc = PLCTAG_ERR_BAD_GATEWAY;
-            } else {
-                session->auto_disconnect_enabled = auto_disconnect_enabled;
-                session->auto_disconnect_timeout_ms = auto_disconnect_timeout_ms;
+    return result;
+}
 
-                new_session = 1;
-            }
-        } else {
-            /* turn on auto disconnect if we need to. */
-            if(!session->auto_disconnect_enabled && auto_disconnect_enabled) {
-                session->auto_disconnect_enabled = auto_disconnect_enabled;
-            }
+/*
+ * session_find_symbol_id
+ *
+ * Look up the instance ID of a controller scope symbol.  Returns
+ * PLCTAG_STATUS_PENDING if the name has not been seen yet but more of the
+ * controller's tags can be listed, starting at next_id.  Returns
+ * PLCTAG_ERR_NOT_FOUND if all the tags have been listed.
+ */
 
-            /* disconnect period always goes down. */
-            if(session->auto_disconnect_enabled && session->auto_disconnect_timeout_ms > auto_disconnect_timeout_ms) {
-                session->auto_disconnect_timeout_ms = auto_disconnect_timeout_ms;
-            }
+int session_find_symbol_id(ab_session_p session, const uint8_t *name, int name_len, uint32_t *instance_id, uint16_t *symbol_type, uint32_t *next_id)
+{
+    int rc = PLCTAG_STATUS_OK;
+    uint8_t lower_name[SESSION_MAX_SYMBOL_NAME];
+    int64_t key = 0;
 
-            pdebug(DEBUG_DETAIL, "Reusing existing session.");
-        }
+    if(!session || name_len <= 0 || name_len > SESSION_MAX_SYMBOL_NAME) {
+        return PLCTAG_ERR_BAD_PARAM;
     }
 
-    /*
-     * do this OUTSIDE the mutex in order to let other threads not block if
-     * the session creation process blocks.
-     */
+    key = symbol_id_key(name, name_len, lower_name);
 
-    if(new_session) {
-        rc = session_init(session);
-        if(rc != PLCTAG_STATUS_OK) {
-            rc_dec(session);
-            session = AB_SESSION_NULL;
+    critical_block(session->mutex) {
+        symbol_id_entry_t *entry = (symbol_id_entry_t *)hashtable_get(session->symbol_ids, key);
+
+        if(entry && mem_cmp(entry->name, entry->name_len, lower_name, name_len) == 0) {
+            *instance_id = entry->instance_id;
+            *symbol_type = entry->symbol_type;
+            rc = PLCTAG_STATUS_OK;
+        } else if(session->symbols_complete) {
+            rc = PLCTAG_ERR_NOT_FOUND;
         } else {
-            /* save the status */
-            //session->status = rc;
+            *next_id = session->symbol_next_id;
+            rc = PLCTAG_STATUS_PENDING;
         }
     }
 
-    /* store it into the tag */
-    *tag_session = session;
-
-    pdebug(DEBUG_DETAIL, "Done");
-
     return rc;
 }
 
 
-
-
-int add_session_unsafe(ab_session_p session)
+int session_add_symbol_id(ab_session_p session, const uint8_t *name, int name_len, uint32_t instance_id, uint16_t symbol_type)
 {
-    pdebug(DEBUG_DETAIL, "Starting");
+    int rc = PLCTAG_STATUS_OK;
+    symbol_id_entry_t *entry = NULL;
+    int64_t key = 0;
 
-    if (!session) {
-        return PLCTAG_ERR_NULL_PTR;
+    if(!session || name_len <= 0 || name_len > SESSION_MAX_SYMBOL_NAME) {
+        return PLCTAG_ERR_BAD_PARAM;
     }
 
-    vector_put(sessions, vector_length(sessions), session);
-
-    session->on_list = 1;
-
-    pdebug(DEBUG_DETAIL, "Done");
-
-    return PLCTAG_STATUS_OK;
-}
+    entry = mem_alloc((int)sizeof(*entry) + name_len);
+    if(!entry) {
+        pdebug(DEBUG_WARN, "Unable to allocate symbol ID entry!");
+        return PLCTAG_ERR_NO_MEM;
+    }
 
+    entry->instance_id = instance_id;
+    entry->symbol_type = symbol_type;
+    entry->name_len = name_len;
+    key = symbol_id_key(name, name_len, entry->name);
 
+    critical_block(session->mutex) {
+        symbol_id_entry_t *old_entry = (symbol_id_entry_t *)hashtable_get(session->symbol_ids, key);
 
-int add_session(ab_session_p s)
-{
-    int rc = PLCTAG_STATUS_OK;
+        /* names that hash the same are rare, the first one wins. */
+        if(old_entry) {
+            if(mem_cmp(old_entry->name, old_entry->name_len, entry->name, name_len) == 0) {
+                old_entry->instance_id = instance_id;
+                old_entry->symbol_type = symbol_type;
+            }
 
-    pdebug(DEBUG_DETAIL, "Starting.");
+            break;
+        }
 
-    critical_block(session_mutex) {
-        rc = add_session_unsafe(s);
+        rc = hashtable_put(session->symbol_ids, key, entry);
+        if(rc == PLCTAG_STATUS_OK) {
+            entry = NULL;
+        }
     }
 
-    pdebug(DEBUG_DETAIL, "Done.");
+    if(entry) {
+        mem_free(entry);
+    }
 
     return rc;
 }
 
 
-
-
-int remove_session_unsafe(ab_session_p session)
+void session_set_symbol_progress(ab_session_p session, uint32_t next_id, int complete)
 {
-    pdebug(DEBUG_DETAIL, "Starting");
-
-    if (!session || !sessions) {
-        return 0;
+    if(!session) {
+        return;
     }
 
-    for(int i=0; i < vector_length(sessions); i++) {
-        ab_session_p tmp = vector_get(sessions, i);
+    critical_block(session->mutex) {
+        if(next_id > session->symbol_next_id) {
+            session->symbol_next_id = next_id;
+        }
 
-        if(tmp == session) {
-            vector_remove(sessions, i);
-            break;
+        if(complete) {
+            session->symbols_complete = 1;
         }
     }
-
-    pdebug(DEBUG_DETAIL, "Done");
-
-    return PLCTAG_STATUS_OK;
 }
 
-int remove_session(ab_session_p s)
-{
-    int rc = PLCTAG_STATUS_OK;
 
-    pdebug(DEBUG_DETAIL, "Starting.");
+/*
+ * session_clear_symbol_ids
+ *
+ * Forget all the instance IDs.  A download to the controller renumbers
+ * the symbols, so one stale ID means they all are.
+ */
 
-    if(s->on_list) {
-        critical_block(session_mutex) {
-            rc = remove_session_unsafe(s);
-        }
+void session_clear_symbol_ids(ab_session_p session)
+{
+    if(!session) {
+        return;
     }
 
-    pdebug(DEBUG_DETAIL, "Done.");
+    critical_block(session->mutex) {
+        if(session->symbol_ids) {
+            hashtable_on_each(session->symbol_ids, symbol_id_free_entry, NULL);
+            hashtable_destroy(session->symbol_ids);
+        }
 
-    return rc;
+        session->symbol_ids = hashtable_create(SESSION_SYMBOL_TABLE_SIZE);
+        session->symbol_next_id = 0;
+        session->symbols_complete = 0;
+    }
 }
 
 
-int session_match_valid(const char *host, const char *path, ab_session_p session)
+/*
+ * session_find_udt
+ *
+ * Look up a UDT template already read from the controller.  Templates
+ * are never removed while the session lives, so the caller can use the
+ * pointer for as long as it holds a reference to the session.
+ */
+
+ab_udt_p session_find_udt(ab_session_p session, uint16_t template_id)
 {
+    ab_udt_p udt = NULL;
+
     if(!session) {
-        return 0;
+        return NULL;
     }
 
-    /* don't use sessions that failed immediately. */
-    if(session->failed) {
-        return 0;
+    critical_block(session->mutex) {
+        udt = (ab_udt_p)hashtable_get(session->udt_templates, (int64_t)template_id);
     }
 
-    if(!str_length(host)) {
-        pdebug(DEBUG_WARN, "New session host is NULL or zero length!");
-        return 0;
-    }
+    return udt;
+}
 
-    if(!str_length(session->host)) {
-        pdebug(DEBUG_WARN, "Session host is NULL or zero length!");
-        return 0;
+
+/*
+ * session_add_udt
+ *
+ * Give a template to the session.  If another tag got there first the
+ * new copy is freed and the old one kept.
+ */
+
+int session_add_udt(ab_session_p session, uint16_t template_id, ab_udt_p udt)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    if(!session || !udt) {
+        return PLCTAG_ERR_NULL_PTR;
     }
 
-    if(str_cmp_i(host, session->host)) {
-        return 0;
+    critical_block(session->mutex) {
+        if(hashtable_get(session->udt_templates, (int64_t)template_id)) {
+            break;
+        }
+
+        rc = hashtable_put(session->udt_templates, (int64_t)template_id, udt);
+        if(rc == PLCTAG_STATUS_OK) {
+            udt = NULL;
+        }
     }
 
-    if(str_cmp_i(path, session->path)) {
-        return 0;
+    if(udt) {
+        mem_free(udt);
     }
 
-    return 1;
+    return rc;
 }
 
 
-ab_session_p find_session_by_host_unsafe(const char *host, const char *path)
+/*
+ * session_bit_word_get
+ *
+ * Find or add the shared state of the element a bit tag is on.  Returns
+ * NULL if the element cannot be shared, the tag then reads on its own.
+ * Each tag that gets the word must release it.
+ */
+ab_bit_word_p session_bit_word_get(ab_session_p session, const uint8_t *encoded_name, int name_size)
 {
-    for(int i=0; i < vector_length(sessions); i++) {
-        ab_session_p session = vector_get(sessions, i);
+    ab_bit_word_p word = NULL;
+    int64_t key = 0;
 
-        /* is this session in the process of destruction? */
-        session = rc_inc(session);
-        if(session) {
-            if(session_match_valid(host, path, session)) {
-                return session;
+    if(!session || !session->bit_words || name_size <= 0) {
+        return NULL;
+    }
+
+    key = ((int64_t)name_size << 32) | (int64_t)hash((uint8_t *)encoded_name, (size_t)(unsigned int)name_size, 0);
+
+    critical_block(session->mutex) {
+        word = (ab_bit_word_p)hashtable_get(session->bit_words, key);
+
+        if(word) {
+            /* another element with the same key, this one is not shared. */
+            if(word->name_size != name_size || mem_cmp(word->name, word->name_size, (void *)encoded_name, name_size) != 0) {
+                word = NULL;
+                break;
             }
 
-            rc_dec(session);
+            word->num_tags++;
+            break;
+        }
+
+        word = (ab_bit_word_p)mem_alloc((int)sizeof(struct ab_bit_word_t) + name_size);
+        if(!word) {
+            break;
+        }
+
+        word->key = key;
+        word->num_tags = 1;
+        word->name_size = name_size;
+        mem_copy(word->name, (void *)encoded_name, name_size);
+
+        if(hashtable_put(session->bit_words, key, word) != PLCTAG_STATUS_OK) {
+            mem_free(word);
+            word = NULL;
         }
     }
 
-    return NULL;
+    return word;
 }
 
 
-
-ab_session_p session_create_unsafe(const char *host, const char *path, plc_type_t plc_type, int *use_connected_msg)
+void session_bit_word_release(ab_session_p session, ab_bit_word_p word)
 {
-    static volatile uint32_t connection_id = 0;
+    int is_last = 0;
+
+    if(!session || !word) {
+        return;
+    }
+
+    critical_block(session->mutex) {
+        word->num_tags--;
+
+        if(word->num_tags <= 0) {
+            hashtable_remove(session->bit_words, word->key);
+            is_last = 1;
+        }
+    }
+
+    if(is_last) {
+        bit_word_free_entry(NULL, 0, word, NULL);
+    }
+}
+
 
+/*
+ * session_bit_word_join
+ *
+ * Called when a bit tag starts a read.  If another bit tag on the element
+ * has a read in flight, the tag waits for it and PLCTAG_STATUS_PENDING is
+ * returned with the sequence to wait past.  Otherwise the tag becomes the
+ * leader and must send the read itself.
+ */
+int session_bit_word_join(ab_session_p session, ab_bit_word_p word, int32_t tag_id, uint32_t *seq)
+{
     int rc = PLCTAG_STATUS_OK;
-    ab_session_p session = AB_SESSION_NULL;
 
-    pdebug(DEBUG_INFO, "Starting");
+    critical_block(session->mutex) {
+        if(!word->leader_id || word->leader_id == tag_id) {
+            word->leader_id = tag_id;
+            break;
+        }
 
-    if(*use_connected_msg) {
-        pdebug(DEBUG_DETAIL, "Session should use connected messaging.");
+        if(word->num_waiters >= word->max_waiters) {
+            int new_max = (word->max_waiters ? word->max_waiters * 2 : 8);
+            int32_t *new_waiters = (int32_t *)mem_realloc(word->waiters, new_max * (int)sizeof(int32_t));
+
+            /* just read on our own. */
+            if(!new_waiters) {
+                break;
+            }
+
+            word->waiters = new_waiters;
+            word->max_waiters = new_max;
+        }
+
+        word->waiters[word->num_waiters] = tag_id;
+        word->num_waiters++;
+
+        *seq = word->read_seq;
+        rc = PLCTAG_STATUS_PENDING;
+    }
+
+    if(rc == PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_DETAIL, "Bit tag %d is reading the element for the others.", tag_id);
     } else {
-        pdebug(DEBUG_DETAIL, "Session should not use connected messaging.");
+        pdebug(DEBUG_DETAIL, "Bit tag %d is waiting on the read of tag %d.", tag_id, word->leader_id);
     }
 
-    session = (ab_session_p)rc_alloc(sizeof(struct ab_session_t), session_destroy);
-    if (!session) {
-        pdebug(DEBUG_WARN, "Error allocating new session.");
-        return AB_SESSION_NULL;
+    return rc;
+}
+
+
+/*
+ * session_bit_word_check
+ *
+ * See if the read a bit tag waits on is done.  The element data is copied
+ * out and the read status returned.  PLCTAG_ERR_NOT_FOUND means that the
+ * read went away without data, the tag has to read on its own.
+ */
+int session_bit_word_check(ab_session_p session, ab_bit_word_p word, uint32_t seq, uint8_t *data, int size)
+{
+    int rc = PLCTAG_STATUS_PENDING;
+
+    critical_block(session->mutex) {
+        if(word->read_seq == seq) {
+            if(!word->leader_id) {
+                rc = PLCTAG_ERR_NOT_FOUND;
+            }
+
+            break;
+        }
+
+        rc = word->read_status;
+
+        if(rc == PLCTAG_STATUS_OK) {
+            if(word->data_size != size) {
+                rc = PLCTAG_ERR_NOT_FOUND;
+            } else {
+                mem_copy(data, word->data, size);
+            }
+        }
     }
 
-    session->host = str_dup(host);
-    if(!session->host) {
-        pdebug(DEBUG_WARN, "Unable to duplicate host string!");
-        rc_dec(session);
-        return NULL;
+    return rc;
+}
+
+
+/* the leader's read is done, hand the data to the waiting tags. */
+void session_bit_word_done(ab_session_p session, ab_bit_word_p word, int32_t tag_id, int status, const uint8_t *data, int size)
+{
+    critical_block(session->mutex) {
+        if(word->leader_id != tag_id) {
+            break;
+        }
+
+        if(status == PLCTAG_STATUS_OK && (size <= 0 || size > SESSION_BIT_WORD_MAX_SIZE)) {
+            status = PLCTAG_ERR_TOO_LARGE;
+        }
+
+        if(status == PLCTAG_STATUS_OK) {
+            mem_copy(word->data, (void *)data, size);
+            word->data_size = size;
+        }
+
+        word->read_status = status;
+        word->read_seq++;
+        word->leader_id = 0;
+
+        bit_word_wake_waiters_unsafe(word);
     }
+}
 
-    rc = cip_encode_path(path, use_connected_msg, plc_type, &session->conn_path, &session->conn_path_size, &session->dhp_dest);
-    if(rc != PLCTAG_STATUS_OK) {
-        pdebug(DEBUG_INFO, "Unable to convert path links strings to binary path!");
-        rc_dec(session);
-        return NULL;
+
+/* a bit tag aborted its read.  If it was the leader, the waiting tags read on their own. */
+void session_bit_word_leave(ab_session_p session, ab_bit_word_p word, int32_t tag_id)
+{
+    critical_block(session->mutex) {
+        if(word->leader_id == tag_id) {
+            word->leader_id = 0;
+            bit_word_wake_waiters_unsafe(word);
+            break;
+        }
+
+        for(int i=0; i < word->num_waiters; i++) {
+            if(word->waiters[i] == tag_id) {
+                word->num_waiters--;
+                word->waiters[i] = word->waiters[word->num_waiters];
+                break;
+            }
+        }
     }
+}
 
-    if(path && str_length(path)) {
-        session->path = str_dup(path);
-        if(path && str_length(path) && !session->path) {
-            pdebug(DEBUG_WARN, "Unable to duplicate path string!");
-            rc_dec(session);
-            return NULL;
+
+void bit_word_wake_waiters_unsafe(ab_bit_word_p word)
+{
+    for(int i=0; i < word->num_waiters; i++) {
+        plc_tag_generic_wake_tag(word->waiters[i]);
+    }
+
+    word->num_waiters = 0;
+}
+
+
+int bit_word_free_entry(hashtable_p table, int64_t key, void *data, void *context)
+{
+    ab_bit_word_p word = (ab_bit_word_p)data;
+
+    (void)table;
+    (void)key;
+    (void)context;
+
+    if(word) {
+        if(word->waiters) {
+            mem_free(word->waiters);
         }
+
+        mem_free(word);
     }
 
-    session->requests = vector_create(SESSION_MIN_REQUESTS, SESSION_INC_REQUESTS);
-    if(!session->requests) {
-        pdebug(DEBUG_WARN, "Unable to allocate vector for requests!");
-        rc_dec(session);
-        return NULL;
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * session_find_name_prefix
+ *
+ * Copy the encoding of the first name_len characters of a tag name.
+ * Returns the encoded size, or zero if no tag on the session encoded
+ * that prefix yet.
+ */
+int session_find_name_prefix(ab_session_p session, const char *name, int name_len, uint8_t *encoded, int encoded_max)
+{
+    int64_t key = ((int64_t)name_len << 32) | (int64_t)hash((uint8_t *)name, (size_t)(unsigned int)name_len, 0);
+    int size = 0;
+
+    if(!session || !session->name_prefixes) {
+        return 0;
     }
 
-    /* check for ID set up. This does not need to be thread safe since we just need a random value. */
-    if(connection_id == 0) {
-        connection_id = (uint32_t)rand();
+    critical_block(session->mutex) {
+        ab_name_prefix_t *prefix = (ab_name_prefix_t *)hashtable_get(session->name_prefixes, key);
+
+        if(!prefix || prefix->name_len != name_len || mem_cmp(prefix->data, name_len, (void *)name, name_len) != 0) {
+            break;
+        }
+
+        if(prefix->encoded_size <= encoded_max) {
+            mem_copy(encoded, prefix->data + name_len, prefix->encoded_size);
+            size = prefix->encoded_size;
+        }
     }
 
-    session->plc_type = plc_type;
-    session->data_capacity = MAX_PACKET_SIZE_EX;
-    session->use_connected_msg = *use_connected_msg;
-    session->failed = 0;
-    session->conn_serial_number = (uint16_t)(uintptr_t)(intptr_t)rand();
+    return size;
+}
 
-    session->session_seq_id = (uint64_t)rand();
 
-    /* guess the max CIP payload size. */
-    switch(plc_type) {
-    case AB_PLC_SLC:
-        session->max_payload_size = MAX_CIP_SLC_MSG_SIZE;
-        break;
+void session_add_name_prefix(ab_session_p session, const char *name, int name_len, const uint8_t *encoded, int encoded_size)
+{
+    int64_t key = ((int64_t)name_len << 32) | (int64_t)hash((uint8_t *)name, (size_t)(unsigned int)name_len, 0);
+    ab_name_prefix_t *prefix = NULL;
 
-    case AB_PLC_MLGX:
-        session->max_payload_size = MAX_CIP_MLGX_MSG_SIZE;
-        break;
+    if(!session || !session->name_prefixes || name_len <= 0 || encoded_size <= 0) {
+        return;
+    }
 
-    case AB_PLC_PLC5:
-    case AB_PLC_LGX_PCCC:
-        session->max_payload_size = MAX_CIP_PLC5_MSG_SIZE;
-        break;
+    prefix = (ab_name_prefix_t *)mem_alloc((int)sizeof(ab_name_prefix_t) + name_len + encoded_size);
+    if(!prefix) {
+        return;
+    }
 
-    case AB_PLC_LGX:
-        session->max_payload_size = MAX_CIP_MSG_SIZE;
-        break;
+    prefix->name_len = name_len;
+    prefix->encoded_size = encoded_size;
+    mem_copy(prefix->data, (void *)name, name_len);
+    mem_copy(prefix->data + name_len, (void *)encoded, encoded_size);
 
-    case AB_PLC_MLGX800:
-        session->max_payload_size = MAX_CIP_MSG_SIZE;
-        break;
+    critical_block(session->mutex) {
+        /* another tag got there first, or there is a different prefix with the same key. */
+        if(session->num_name_prefixes >= SESSION_MAX_NAME_PREFIXES || hashtable_get(session->name_prefixes, key)) {
+            break;
+        }
 
-    case AB_PLC_OMRON_NJNX:
-        session->max_payload_size = MAX_CIP_MSG_SIZE;
-        break;
+        if(hashtable_put(session->name_prefixes, key, prefix) == PLCTAG_STATUS_OK) {
+            session->num_name_prefixes++;
+            prefix = NULL;
+        }
+    }
 
-    default:
-        pdebug(DEBUG_WARN, "Unknown protocol/cpu type!");
-        rc_dec(session);
-        return NULL;
-        break;
+    if(prefix) {
+        mem_free(prefix);
     }
+}
 
 
-    /*
-     * Why is connection_id global?  Because it looks like the PLC might
-     * be treating it globally.  I am seeing ForwardOpen errors that seem
-     * to be because of duplicate connection IDs even though the session
-     * was closed.
-     *
-     * So, this is more or less unique across all invocations of the library.
-     * FIXME - this could collide.  The probability is low, but it could happen
-     * as there are only 32 bits.
-     */
-    session->orig_connection_id = ++connection_id;
 
-    /* add the new session to the list. */
-    add_session_unsafe(session);
+int64_t symbol_id_key(const uint8_t *name, int name_len, uint8_t *lower_name)
+{
+    for(int i=0; i < name_len; i++) {
+        lower_name[i] = (uint8_t)tolower(name[i]);
+    }
+
+    return ((int64_t)name_len << 32) | (int64_t)hash(lower_name, (size_t)name_len, 0);
+}
+
+
+int symbol_id_free_entry(hashtable_p table, int64_t key, void *data, void *context)
+{
+    (void)table;
+    (void)key;
+    (void)context;
+
+    if(data) {
+        mem_free(data);
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+int session_find_or_create(ab_session_p *tag_session, attr attribs)
+{
+    /*int debug = attr_get_int(attribs,"debug",0);*/
+    const char *session_gw = attr_get_str(attribs, "gateway", "");
+    const char *session_path = attr_get_str(attribs, "path", "");
+    int use_connected_msg = attr_get_int(attribs, "use_connected_msg", 0);
+    //int session_gw_port = attr_get_int(attribs, "gateway_port", AB_EIP_DEFAULT_PORT);
+    plc_type_t plc_type = get_plc_type(attribs);
+    ab_session_p session = AB_SESSION_NULL;
+    int new_session = 0;
+    int shared_session = attr_get_int(attribs, "share_session", 1); /* share the session by default. */
+    int rc = PLCTAG_STATUS_OK;
+    int auto_disconnect_enabled = 0;
+    int auto_disconnect_timeout_ms = INT_MAX;
+    int max_requests_in_flight = attr_get_int(attribs, "max_requests_in_flight", 0);
+    int pool_size = attr_get_int(attribs, "connection_pool_size", 1);
+    const char *cache_file = attr_get_str(attribs, "connection_cache_file", NULL);
+    const char *meta_file = attr_get_str(attribs, "metadata_cache_file", NULL);
+    const char *capture_file = attr_get_str(attribs, "capture_file", NULL);
+    int connect_timeout_ms = attr_get_int(attribs, "connect_timeout_ms", SESSION_DEFAULT_CONNECT_TIMEOUT);
+    int breaker_threshold = attr_get_int(attribs, "circuit_breaker_failures", 0);
+    int max_packets_per_sec = attr_get_int(attribs, "max_packets_per_sec", 0);
+    int max_bytes_per_sec = attr_get_int(attribs, "max_bytes_per_sec", 0);
+    int share_socket = attr_get_int(attribs, "share_socket", 0);
+    int keepalive_ms = attr_get_int(attribs, "keepalive_ms", 0);
+    socket_options_t sock_opts;
+
+    pdebug(DEBUG_DETAIL, "Starting");
+
+    socket_options_from_attr(attribs, &sock_opts);
+
+    /* zero means not set, the session picks the default. */
+    if(max_requests_in_flight < 0 || max_requests_in_flight > SESSION_MAX_REQUESTS_IN_FLIGHT) {
+        pdebug(DEBUG_WARN, "max_requests_in_flight must be between 0 (the default) and %d, using 1.", SESSION_MAX_REQUESTS_IN_FLIGHT);
+        max_requests_in_flight = 1;
+    }
+
+    if(pool_size < 1 || pool_size > SESSION_MAX_POOL_SIZE) {
+        pdebug(DEBUG_WARN, "connection_pool_size must be between 1 and %d, using 1.", SESSION_MAX_POOL_SIZE);
+        pool_size = 1;
+    }
+
+    if(connect_timeout_ms <= 0) {
+        pdebug(DEBUG_WARN, "connect_timeout_ms must be positive, using %d.", SESSION_DEFAULT_CONNECT_TIMEOUT);
+        connect_timeout_ms = SESSION_DEFAULT_CONNECT_TIMEOUT;
+    }
+
+    if(max_packets_per_sec < 0 || max_bytes_per_sec < 0) {
+        pdebug(DEBUG_WARN, "max_packets_per_sec and max_bytes_per_sec must not be negative, not limiting the rate.");
+        max_packets_per_sec = 0;
+        max_bytes_per_sec = 0;
+    }
+
+    if(keepalive_ms < 0) {
+        pdebug(DEBUG_WARN, "keepalive_ms must not be negative, turning keepalive off.");
+        keepalive_ms = 0;
+    } else if(keepalive_ms > 0 && keepalive_ms < SESSION_MIN_KEEPALIVE_MS) {
+        pdebug(DEBUG_WARN, "keepalive_ms must be at least %d, using that.", SESSION_MIN_KEEPALIVE_MS);
+        keepalive_ms = SESSION_MIN_KEEPALIVE_MS;
+    }
+
+    if(breaker_threshold < 0) {
+        pdebug(DEBUG_WARN, "circuit_breaker_failures must not be negative, turning the breaker off.");
+        breaker_threshold = 0;
+    }
+
+    auto_disconnect_timeout_ms = attr_get_int(attribs, "auto_disconnect_ms", INT_MAX);
+    if(auto_disconnect_timeout_ms != INT_MAX) {
+        pdebug(DEBUG_DETAIL, "Setting auto-disconnect after %dms.", auto_disconnect_timeout_ms);
+        auto_disconnect_enabled = 1;
+    }
+
+    // if(plc_type == AB_PLC_PLC5 && str_length(session_path) > 0) {
+    //     /* this means it is DH+ */
+    //     use_connected_msg = 1;
+    //     attr_set_int(attribs, "use_connected_msg", 1);
+    // }
+
+    critical_block(session_mutex) {
+        /* the first tag that names a cache file sets it for the library. */
+        if(str_length(cache_file) && !conn_cache_file) {
+            conn_cache_file = str_dup(cache_file);
+            conn_cache_load_unsafe(conn_cache_file);
+        }
+
+        if(str_length(meta_file)) {
+            meta_cache_open(meta_file);
+        }
+
+        /* if we are to share sessions, then look for an existing one. */
+        if (shared_session && pool_size > 1) {
+            session = find_pooled_session_unsafe(session_gw, session_path, pool_size);
+        } else if (shared_session) {
+            session = find_session_by_host_unsafe(session_gw, session_path);
+        } else {
+            /* no sharing, create a new one */
+            session = AB_SESSION_NULL;
+        }
+
+        if (session == AB_SESSION_NULL) {
+            pdebug(DEBUG_DETAIL, "Creating new session.");
+            session = session_create_unsafe(session_gw, session_path, plc_type, &use_connected_msg);
+
+            if (session == AB_SESSION_NULL) {
+                pdebug(DEBUG_WARN, "unable to create or find a session!");
+                rc = PLCTAG_ERR_BAD_GATEWAY;
+            } else {
+                session->auto_disconnect_enabled = auto_disconnect_enabled;
+                session->auto_disconnect_timeout_ms = auto_disconnect_timeout_ms;
+                if(max_requests_in_flight > 0) {
+                    session->max_requests_in_flight = max_requests_in_flight;
+                } else {
+                    session->max_requests_in_flight = default_requests_in_flight(session);
+                }
+
+                session->pool_size = (shared_session ? pool_size : 1);
+                session->connect_timeout_ms = connect_timeout_ms;
+                session->breaker_threshold = breaker_threshold;
+                session->rate_packets_per_sec = max_packets_per_sec;
+                session->rate_bytes_per_sec = max_bytes_per_sec;
+                session->keepalive_ms = keepalive_ms;
+                session->sock_opts = sock_opts;
+
+                /* only the session this tag creates is captured. */
+                if(str_length(capture_file)) {
+                    session->capture = capture_open(capture_file, CAPTURE_PROTOCOL_EIP);
+                }
+
+                /* pooled and private sessions want their own socket. */
+                if(share_socket && shared_session && pool_size == 1) {
+                    session->transport = transport_find_or_create_unsafe(session_gw);
+                    if(!session->transport) {
+                        pdebug(DEBUG_WARN, "Unable to share a socket to %s, the session uses its own.", session_gw);
+                    }
+                }
+
+                new_session = 1;
+            }
+        } else {
+            /* turn on auto disconnect if we need to. */
+            if(!session->auto_disconnect_enabled && auto_disconnect_enabled) {
+                session->auto_disconnect_enabled = auto_disconnect_enabled;
+            }
+
+            /* the first tag that turns on the breaker sets it for the session. */
+            if(!session->breaker_threshold && breaker_threshold > 0) {
+                session->breaker_threshold = breaker_threshold;
+            }
+
+            /* the same for the rate limit. */
+            if(!session->rate_packets_per_sec && !session->rate_bytes_per_sec && (max_packets_per_sec > 0 || max_bytes_per_sec > 0)) {
+                session->rate_packets_per_sec = max_packets_per_sec;
+                session->rate_bytes_per_sec = max_bytes_per_sec;
+            }
+
+            /* the shortest keepalive interval wins. */
+            if(keepalive_ms > 0 && (!session->keepalive_ms || keepalive_ms < session->keepalive_ms)) {
+                session->keepalive_ms = keepalive_ms;
+            }
+
+            /* the in flight window only grows. */
+            if(session->max_requests_in_flight < max_requests_in_flight) {
+                session->max_requests_in_flight = max_requests_in_flight;
+            }
+
+            /* disconnect period always goes down. */
+            if(session->auto_disconnect_enabled && session->auto_disconnect_timeout_ms > auto_disconnect_timeout_ms) {
+                session->auto_disconnect_timeout_ms = auto_disconnect_timeout_ms;
+            }
+
+            pdebug(DEBUG_DETAIL, "Reusing existing session.");
+        }
+    }
+
+    /*
+     * do this OUTSIDE the mutex in order to let other threads not block if
+     * the session creation process blocks.
+     */
+
+    if(new_session) {
+        rc = session_init(session);
+        if(rc != PLCTAG_STATUS_OK) {
+            rc_dec(session);
+            session = AB_SESSION_NULL;
+        } else {
+            /* save the status */
+            //session->status = rc;
+        }
+    }
+
+    if(session) {
+        atomic_add(&(session->num_tags), 1);
+    }
+
+    /* store it into the tag */
+    *tag_session = session;
+
+    pdebug(DEBUG_DETAIL, "Done");
+
+    return rc;
+}
+
+
+
+
+int add_session_unsafe(ab_session_p session)
+{
+    pdebug(DEBUG_DETAIL, "Starting");
+
+    if (!session) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    vector_push_back(sessions, session);
+
+    session->on_list = 1;
+
+    pdebug(DEBUG_DETAIL, "Done");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+int add_session(ab_session_p s)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    critical_block(session_mutex) {
+        rc = add_session_unsafe(s);
+    }
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return rc;
+}
+
+
+
+
+int remove_session_unsafe(ab_session_p session)
+{
+    pdebug(DEBUG_DETAIL, "Starting");
+
+    if (!session || !sessions) {
+        return 0;
+    }
+
+    for(int i=0; i < vector_length(sessions); i++) {
+        ab_session_p tmp = vector_get(sessions, i);
+
+        if(tmp == session) {
+            vector_remove(sessions, i);
+            break;
+        }
+    }
+
+    pdebug(DEBUG_DETAIL, "Done");
+
+    return PLCTAG_STATUS_OK;
+}
+
+int remove_session(ab_session_p s)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    if(s->on_list) {
+        critical_block(session_mutex) {
+            rc = remove_session_unsafe(s);
+        }
+    }
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return rc;
+}
+
+
+int session_match_valid(const char *host, const char *path, ab_session_p session)
+{
+    if(!session) {
+        return 0;
+    }
+
+    /* don't use sessions that failed immediately. */
+    if(session->failed) {
+        return 0;
+    }
+
+    if(!str_length(host)) {
+        pdebug(DEBUG_WARN, "New session host is NULL or zero length!");
+        return 0;
+    }
+
+    if(!str_length(session->host)) {
+        pdebug(DEBUG_WARN, "Session host is NULL or zero length!");
+        return 0;
+    }
+
+    if(str_cmp_i(host, session->host)) {
+        return 0;
+    }
+
+    if(str_cmp_i(path, session->path)) {
+        return 0;
+    }
+
+    return 1;
+}
+
+
+ab_session_p find_session_by_host_unsafe(const char *host, const char *path)
+{
+    for(int i=0; i < vector_length(sessions); i++) {
+        ab_session_p session = vector_get(sessions, i);
+
+        /* is this session in the process of destruction? */
+        session = rc_inc(session);
+        if(session) {
+            if(session_match_valid(host, path, session)) {
+                return session;
+            }
+
+            rc_dec(session);
+        }
+    }
+
+    return NULL;
+}
+
+
+
+/*
+ * Find a session in the pool for this host and path.  Until the pool
+ * has pool_size sessions, return NULL so that a new one is made.  After
+ * that, pick the least loaded one: fewest requests queued and in flight
+ * first, then fewest tags.
+ */
+
+ab_session_p find_pooled_session_unsafe(const char *host, const char *path, int pool_size)
+{
+    ab_session_p best = NULL;
+    int best_load = INT_MAX;
+    int best_tags = INT_MAX;
+    int num_pooled = 0;
+
+    for(int i=0; i < vector_length(sessions); i++) {
+        ab_session_p session = vector_get(sessions, i);
+        int load = 0;
+        int num_tags = 0;
+
+        if(!session || session->pool_size < 2 || !session_match_valid(host, path, session)) {
+            continue;
+        }
+
+        num_pooled++;
+
+        load = session->num_requests + session->num_requests_in_flight;
+        num_tags = atomic_get(&(session->num_tags));
+
+        if(load < best_load || (load == best_load && num_tags < best_tags)) {
+            best = session;
+            best_load = load;
+            best_tags = num_tags;
+        }
+    }
+
+    if(num_pooled < pool_size || !best) {
+        pdebug(DEBUG_DETAIL, "Pool has %d of %d sessions, making another.", num_pooled, pool_size);
+        return NULL;
+    }
+
+    /* is this session in the process of destruction? */
+    return rc_inc(best);
+}
+
+
+
+/*
+ * The connection cache keeps what the Forward Open negotiation found for
+ * each gateway and path: whether the large Forward Open works and the
+ * payload size that was accepted.  New sessions and reconnects start from
+ * that instead of probing again.  If a tag sets connection_cache_file, the
+ * cache is also loaded from and saved to that file so that it survives
+ * restarts.  The file has one line per connection:
+ *
+ *    <only old forward open 0/1> <max payload> <gateway> [<path>]
+ */
+
+conn_cache_entry_t *conn_cache_find_unsafe(const char *host, const char *path)
+{
+    for(int i=0; i < vector_length(conn_cache); i++) {
+        conn_cache_entry_t *entry = vector_get(conn_cache, i);
+
+        if(entry && !str_cmp_i(entry->host, host) && !str_cmp_i(entry->path, path)) {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+
+void conn_cache_apply_unsafe(ab_session_p session)
+{
+    conn_cache_entry_t *entry = conn_cache_find_unsafe(session->host, (session->path ? session->path : ""));
+
+    if(!entry) {
+        return;
+    }
+
+    pdebug(DEBUG_DETAIL, "Using cached connection parameters, %s Forward Open with payload size %u.", (entry->only_use_old_forward_open ? "old" : "large"), (unsigned int)entry->max_payload_size);
+
+    session->only_use_old_forward_open = entry->only_use_old_forward_open;
+    session->max_payload_guess = entry->max_payload_size;
+}
+
+
+void conn_cache_update(ab_session_p session)
+{
+    const char *path = (session->path ? session->path : "");
+
+    critical_block(session_mutex) {
+        conn_cache_entry_t *entry = conn_cache_find_unsafe(session->host, path);
+
+        if(!entry) {
+            entry = mem_alloc((int)sizeof(*entry));
+            if(!entry) {
+                pdebug(DEBUG_WARN, "Unable to allocate connection cache entry!");
+                break;
+            }
+
+            entry->host = str_dup(session->host);
+            entry->path = str_dup(path);
+
+            if(!entry->host || !entry->path) {
+                pdebug(DEBUG_WARN, "Unable to allocate connection cache entry strings!");
+                mem_free(entry->host);
+                mem_free(entry->path);
+                mem_free(entry);
+                break;
+            }
+
+            vector_push_back(conn_cache, entry);
+        } else if(entry->only_use_old_forward_open == session->only_use_old_forward_open && entry->max_payload_size == session->max_payload_size) {
+            /* nothing changed. */
+            break;
+        }
+
+        entry->only_use_old_forward_open = session->only_use_old_forward_open;
+        entry->max_payload_size = session->max_payload_size;
+
+        if(conn_cache_file) {
+            conn_cache_save_unsafe();
+        }
+    }
+}
+
+
+void conn_cache_load_unsafe(const char *file_name)
+{
+    FILE *cache_file = fopen(file_name, "r");
+    char line[CONN_CACHE_LINE_SIZE];
+
+    if(!cache_file) {
+        pdebug(DEBUG_DETAIL, "No connection cache file %s yet.", file_name);
+        return;
+    }
+
+    while(fgets(line, (int)sizeof(line), cache_file)) {
+        char **fields = NULL;
+        int only_old = 0;
+        int payload_size = 0;
+        conn_cache_entry_t *entry = NULL;
+
+        for(char *c = line; *c; c++) {
+            if(*c == '\r' || *c == '\n') {
+                *c = 0;
+                break;
+            }
+        }
+
+        fields = str_split(line, " ");
+        if(!fields) {
+            continue;
+        }
+
+        if(!fields[0] || !fields[1] || !fields[2]
+           || str_to_int(fields[0], &only_old) || str_to_int(fields[1], &payload_size)
+           || payload_size <= 0 || payload_size > MAX_CIP_MSG_SIZE_EX
+           || conn_cache_find_unsafe(fields[2], (fields[3] ? fields[3] : ""))) {
+            pdebug(DEBUG_WARN, "Skipping bad or duplicate connection cache line \"%s\".", line);
+            mem_free(fields);
+            continue;
+        }
+
+        entry = mem_alloc((int)sizeof(*entry));
+        if(entry) {
+            entry->host = str_dup(fields[2]);
+            entry->path = str_dup(fields[3] ? fields[3] : "");
+            entry->only_use_old_forward_open = (only_old ? 1 : 0);
+            entry->max_payload_size = (uint16_t)payload_size;
+
+            if(entry->host && entry->path) {
+                vector_push_back(conn_cache, entry);
+            } else {
+                mem_free(entry->host);
+                mem_free(entry->path);
+                mem_free(entry);
+            }
+        }
+
+        mem_free(fields);
+    }
+
+    fclose(cache_file);
+
+    pdebug(DEBUG_INFO, "Loaded %d entries from connection cache file %s.", vector_length(conn_cache), file_name);
+}
+
+
+void conn_cache_save_unsafe(void)
+{
+    FILE *cache_file = fopen(conn_cache_file, "w");
+
+    if(!cache_file) {
+        pdebug(DEBUG_WARN, "Unable to write connection cache file %s!", conn_cache_file);
+        return;
+    }
+
+    for(int i=0; i < vector_length(conn_cache); i++) {
+        conn_cache_entry_t *entry = vector_get(conn_cache, i);
+
+        fprintf(cache_file, "%d %u %s %s\n", entry->only_use_old_forward_open, (unsigned int)entry->max_payload_size, entry->host, entry->path);
+    }
+
+    fclose(cache_file);
+}
+
+
+
+ab_session_p session_create_unsafe(const char *host, const char *path, plc_type_t plc_type, int *use_connected_msg)
+{
+    static volatile uint32_t connection_id = 0;
+
+    int rc = PLCTAG_STATUS_OK;
+    ab_session_p session = AB_SESSION_NULL;
+
+    pdebug(DEBUG_INFO, "Starting");
+
+    if(*use_connected_msg) {
+        pdebug(DEBUG_DETAIL, "Session should use connected messaging.");
+    } else {
+        pdebug(DEBUG_DETAIL, "Session should not use connected messaging.");
+    }
+
+    session = (ab_session_p)rc_alloc(sizeof(struct ab_session_t), session_destroy);
+    if (!session) {
+        pdebug(DEBUG_WARN, "Error allocating new session.");
+        return AB_SESSION_NULL;
+    }
+
+    session->host = str_dup(host);
+    if(!session->host) {
+        pdebug(DEBUG_WARN, "Unable to duplicate host string!");
+        rc_dec(session);
+        return NULL;
+    }
+
+    session->data = rx_buf_get();
+    session->rx_extra = (uint8_t *)mem_alloc(MAX_PACKET_SIZE_EX);
+    if(!session->data || !session->rx_extra) {
+        pdebug(DEBUG_WARN, "Unable to allocate session receive buffers!");
+        rc_dec(session);
+        return NULL;
+    }
+
+    rc = cip_encode_path(path, use_connected_msg, plc_type, &session->conn_path, &session->conn_path_size, &session->dhp_dest);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_INFO, "Unable to convert path links strings to binary path!");
+        rc_dec(session);
+        return NULL;
+    }
+
+    if(path && str_length(path)) {
+        session->path = str_dup(path);
+        if(path && str_length(path) && !session->path) {
+            pdebug(DEBUG_WARN, "Unable to duplicate path string!");
+            rc_dec(session);
+            return NULL;
+        }
+    }
+
+    session->queued_reads = hashtable_create(SESSION_MERGE_TABLE_SIZE);
+    if(!session->queued_reads) {
+        pdebug(DEBUG_WARN, "Unable to allocate table of queued reads!");
+        rc_dec(session);
+        return NULL;
+    }
+
+    session->read_cache = hashtable_create(SESSION_MERGE_TABLE_SIZE);
+    if(!session->read_cache) {
+        pdebug(DEBUG_WARN, "Unable to allocate the read cache!");
+        rc_dec(session);
+        return NULL;
+    }
+
+    session->symbol_ids = hashtable_create(SESSION_SYMBOL_TABLE_SIZE);
+    if(!session->symbol_ids) {
+        pdebug(DEBUG_WARN, "Unable to allocate the symbol ID table!");
+        rc_dec(session);
+        return NULL;
+    }
+
+    session->bit_words = hashtable_create(SESSION_MERGE_TABLE_SIZE);
+    if(!session->bit_words) {
+        pdebug(DEBUG_WARN, "Unable to allocate the bit word table!");
+        rc_dec(session);
+        return NULL;
+    }
+
+    session->name_prefixes = hashtable_create(SESSION_NAME_PREFIX_TABLE_SIZE);
+    if(!session->name_prefixes) {
+        pdebug(DEBUG_WARN, "Unable to allocate the name prefix table!");
+        rc_dec(session);
+        return NULL;
+    }
+
+    session->udt_templates = hashtable_create(SESSION_UDT_TABLE_SIZE);
+    if(!session->udt_templates) {
+        pdebug(DEBUG_WARN, "Unable to allocate the UDT template table!");
+        rc_dec(session);
+        return NULL;
+    }
+
+    session->request_pool = request_pool_create();
+    if(!session->request_pool) {
+        pdebug(DEBUG_WARN, "Unable to allocate request pool!");
+        rc_dec(session);
+        return NULL;
+    }
+
+    session->in_flight = (ab_in_flight_t *)mem_alloc((int)(sizeof(ab_in_flight_t) * SESSION_MAX_REQUESTS_IN_FLIGHT));
+    if(!session->in_flight) {
+        pdebug(DEBUG_WARN, "Unable to allocate table for requests in flight!");
+        rc_dec(session);
+        return NULL;
+    }
+
+    /* one for the headers and one for each packed request. */
+    session->send_bufs = (socket_buf_t *)mem_alloc((int)(sizeof(socket_buf_t) * (MAX_REQUESTS + 1)));
+    if(!session->send_bufs) {
+        pdebug(DEBUG_WARN, "Unable to allocate send buffer list!");
+        rc_dec(session);
+        return NULL;
+    }
+
+    session->max_requests_in_flight = 1;
+
+    /* metrics are not critical, the session works without them. */
+    {
+        char metrics_name[256];
+
+        snprintf(metrics_name, sizeof(metrics_name), "%s/%s", host, (path ? path : ""));
+
+        session->metrics = metrics_register("ab_session", metrics_name,
+                                            METRIC_BIT(METRIC_PACKETS_SENT) | METRIC_BIT(METRIC_PACKETS_RECEIVED)
+                                          | METRIC_BIT(METRIC_BYTES_SENT) | METRIC_BIT(METRIC_BYTES_RECEIVED)
+                                          | METRIC_BIT(METRIC_REQUESTS_SENT) | METRIC_BIT(METRIC_QUEUE_DEPTH_MAX)
+                                          | METRIC_BIT(METRIC_CONNECTS) | METRIC_BIT(METRIC_FORWARD_OPEN_FAILURES)
+                                          | METRIC_BIT(METRIC_IN_FLIGHT) | METRIC_BIT(METRIC_PACKED_BYTES)
+                                          | METRIC_BIT(METRIC_PACKET_CAPACITY_BYTES) | METRIC_BIT(METRIC_READS_MERGED)
+                                          | METRIC_BIT(METRIC_READS_CACHED) | METRIC_BIT(METRIC_BIT_WRITES_COALESCED)
+                                          | METRIC_BIT(METRIC_READS_COALESCED) | METRIC_BIT(METRIC_REQUESTS_EXPIRED)
+                                          | METRIC_BIT(METRIC_CPU_US));
+    }
+
+    /* check for ID set up. This does not need to be thread safe since we just need a random value. */
+    if(connection_id == 0) {
+        connection_id = (uint32_t)rand();
+    }
+
+    session->plc_type = plc_type;
+    session->data_capacity = MAX_PACKET_SIZE_EX;
+    session->use_connected_msg = *use_connected_msg;
+    session->failed = 0;
+    session->conn_serial_number = (uint16_t)(uintptr_t)(intptr_t)rand();
+
+    session->session_seq_id = (uint64_t)rand();
+
+    /* guess the max CIP payload size. */
+    switch(plc_type) {
+    case AB_PLC_SLC:
+        session->max_payload_size = MAX_CIP_SLC_MSG_SIZE;
+        break;
+
+    case AB_PLC_MLGX:
+        session->max_payload_size = MAX_CIP_MLGX_MSG_SIZE;
+        break;
+
+    case AB_PLC_PLC5:
+    case AB_PLC_LGX_PCCC:
+        session->max_payload_size = MAX_CIP_PLC5_MSG_SIZE;
+        break;
+
+    case AB_PLC_LGX:
+        session->max_payload_size = MAX_CIP_MSG_SIZE;
+        break;
+
+    case AB_PLC_MLGX800:
+        session->max_payload_size = MAX_CIP_MSG_SIZE;
+        break;
+
+    case AB_PLC_OMRON_NJNX:
+        session->max_payload_size = MAX_CIP_MSG_SIZE;
+        break;
+
+    default:
+        pdebug(DEBUG_WARN, "Unknown protocol/cpu type!");
+        rc_dec(session);
+        return NULL;
+        break;
+    }
+
+    /* start from what was negotiated last time, if anything. */
+    if(session->use_connected_msg) {
+        conn_cache_apply_unsafe(session);
+    }
+
+
+    /*
+     * Why is connection_id global?  Because it looks like the PLC might
+     * be treating it globally.  I am seeing ForwardOpen errors that seem
+     * to be because of duplicate connection IDs even though the session
+     * was closed.
+     *
+     * So, this is more or less unique across all invocations of the library.
+     * FIXME - this could collide.  The probability is low, but it could happen
+     * as there are only 32 bits.
+     */
+    session->orig_connection_id = ++connection_id;
+
+    /* add the new session to the list. */
+    add_session_unsafe(session);
+
+    pdebug(DEBUG_INFO, "Done");
+
+    return session;
+}
+
+
+/*
+ * session_init
+ *
+ * This calls several blocking methods and so must not keep the main mutex
+ * locked during them.
+ */
+int session_init(ab_session_p session)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    /* create the session mutex. */
+    if((rc = mutex_create(&(session->mutex))) != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to create session mutex!");
+        session->failed = 1;
+        return rc;
+    }
+
+    /* create the session condition var used to wake up the handler thread. */
+    if((rc = cond_create(&(session->wait_cond))) != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to create session condition var!");
+        session->failed = 1;
+        return rc;
+    }
+
+    /* start with the symbols and templates seen last time. */
+    meta_cache_apply(session);
+
+    if((rc = thread_create((thread_p *)&(session->handler_thread), session_handler, 32*1024, session)) != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to create session thread!");
+        session->failed = 1;
+        return rc;
+    }
+
+    plc_tag_generic_tune_thread(session->handler_thread, PLCTAG_THREAD_SESSION);
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return rc;
+}
+
+
+/*
+ * session_open_socket()
+ *
+ * Connect to the host/port passed via TCP.
+ */
+
+int session_open_socket(ab_session_p session)
+{
+    int rc = PLCTAG_STATUS_OK;
+    char **server_port = NULL;
+    int port = 0;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    /* nothing read from an old socket is kept. */
+    session->rx_extra_start = 0;
+    session->rx_extra_size = 0;
+
+    /* Open a socket for communication with the gateway. */
+    rc = socket_create(&(session->sock));
+
+    if (rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to create socket for session!");
+        return rc;
+    }
+
+    socket_set_options(session->sock, &(session->sock_opts));
+
+    server_port = str_split(session->host, ":");
+    if(!server_port) {
+        pdebug(DEBUG_WARN, "Unable to split server and port string!");
+        return PLCTAG_ERR_BAD_CONFIG;
+    }
+
+    if(server_port[0] == NULL) {
+        pdebug(DEBUG_WARN, "Server string is malformed or empty!");
+        mem_free(server_port);
+        return PLCTAG_ERR_BAD_CONFIG;
+    }
+
+    if(server_port[1] != NULL) {
+        rc = str_to_int(server_port[1], &port);
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Unable to extract port number from server string \"%s\"!", session->host);
+            mem_free(server_port);
+            return PLCTAG_ERR_BAD_CONFIG;
+        }
+
+        pdebug(DEBUG_DETAIL, "Using special port %d.", port);
+    } else {
+        port = AB_EIP_DEFAULT_PORT;
+
+        pdebug(DEBUG_DETAIL, "Using default port %d.", port);
+    }
+
+    rc = socket_connect_tcp(session->sock, server_port[0], port, session->connect_timeout_ms);
+
+    if (rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to connect socket for session!");
+        mem_free(server_port);
+        return rc;
+    }
+
+    if(server_port) {
+        mem_free(server_port);
+    }
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return rc;
+}
+
+
+
+int session_register(ab_session_p session)
+{
+    eip_session_reg_req *req;
+    eip_encap *resp;
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    /*
+     * clear the session data.
+     *
+     * We use the receiving buffer because we do not have a request and nothing can
+     * be coming in (we hope) on the socket yet.
+     */
+    mem_set(session->data, 0, sizeof(eip_session_reg_req));
+
+    req = (eip_session_reg_req *)(session->data);
+
+    /* fill in the fields of the request */
+    req->encap_command = h2le16(AB_EIP_REGISTER_SESSION);
+    req->encap_length = h2le16(sizeof(eip_session_reg_req) - sizeof(eip_encap));
+    /* a reconnect must not send the handle of the old connection. */
+    session->session_handle = 0;
+    req->encap_session_handle = h2le32(session->session_handle);
+    req->encap_status = h2le32(0);
+    req->encap_sender_context = h2le64((uint64_t)0);
+    req->encap_options = h2le32(0);
+
+    req->eip_version = h2le16(AB_EIP_VERSION);
+    req->option_flags = h2le16(0);
+
+    /*
+     * socket ops here are _ASYNCHRONOUS_!
+     *
+     * This is done this way because we do not have everything
+     * set up for a request to be handled by the thread.  I think.
+     */
+
+    /* send registration to the gateway */
+    session->data_size = sizeof(eip_session_reg_req);
+    session->data_offset = 0;
+
+    rc = send_eip_request(session, SESSION_DEFAULT_TIMEOUT);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Error sending session registration request %s!", plc_tag_decode_error(rc));
+        return rc;
+    }
+
+    /* get the response from the gateway */
+    rc = recv_eip_response(session, SESSION_DEFAULT_TIMEOUT, 0);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Error receiving session registration response %s!", plc_tag_decode_error(rc));
+        return rc;
+    }
+
+    /* encap header is at the start of the buffer */
+    resp = (eip_encap *)(session->data);
+
+    /* check the response status */
+    if (le2h16(resp->encap_command) != AB_EIP_REGISTER_SESSION) {
+        pdebug(DEBUG_WARN, "EIP unexpected response packet type: %d!", resp->encap_command);
+        return PLCTAG_ERR_BAD_DATA;
+    }
+
+    if (le2h32(resp->encap_status) != AB_EIP_OK) {
+        pdebug(DEBUG_WARN, "EIP command failed, response code: %d", le2h32(resp->encap_status));
+        return PLCTAG_ERR_REMOTE_ERR;
+    }
+
+    /*
+     * after all that, save the session handle, we will
+     * use it in future packets.
+     */
+    session->session_handle = le2h32(resp->encap_session_handle);
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+int session_unregister(ab_session_p session)
+{
+    (void)session;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    /* nothing to do, perhaps. */
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+int session_close_socket(ab_session_p session)
+{
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if (session->sock) {
+        socket_close(session->sock);
+        socket_destroy(&(session->sock));
+        session->sock = NULL;
+    }
+
+    session->rx_extra_start = 0;
+    session->rx_extra_size = 0;
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * transport_find_or_create_unsafe
+ *
+ * Find the shared socket for the gateway or make one.  The socket is
+ * opened by the first session that needs it.  Must be called with
+ * session_mutex held.
+ */
+
+ab_transport_p transport_find_or_create_unsafe(const char *host)
+{
+    ab_transport_p transport = NULL;
+
+    for(int i=0; i < vector_length(transports); i++) {
+        transport = vector_get(transports, i);
+
+        if(transport && str_cmp_i(transport->host, host) == 0) {
+            transport->num_sessions++;
+            return transport;
+        }
+    }
+
+    transport = mem_alloc((int)sizeof(*transport));
+    if(!transport) {
+        pdebug(DEBUG_WARN, "Unable to allocate shared socket!");
+        return NULL;
+    }
+
+    transport->host = str_dup(host);
+    if(!transport->host || mutex_create(&(transport->mutex)) != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to set up shared socket!");
+        mem_free(transport->host);
+        mem_free(transport);
+        return NULL;
+    }
+
+    transport->num_sessions = 1;
+    vector_push_back(transports, transport);
+
+    pdebug(DEBUG_DETAIL, "Created shared socket for %s.", host);
+
+    return transport;
+}
+
+
+
+/* must be called with session_mutex held. */
+void transport_release_unsafe(ab_transport_p transport)
+{
+    if(--transport->num_sessions > 0) {
+        return;
+    }
+
+    for(int i=0; i < vector_length(transports); i++) {
+        if(vector_get(transports, i) == transport) {
+            vector_remove(transports, i);
+            break;
+        }
+    }
+
+    pdebug(DEBUG_DETAIL, "Freeing shared socket for %s.", transport->host);
+
+    transport_close_socket_unsafe(transport);
+    mutex_destroy(&(transport->mutex));
+    mem_free(transport->host);
+    mem_free(transport);
+}
+
+
+
+/*
+ * transport_attach
+ *
+ * Start using the shared socket, connecting and registering it if no
+ * other session has.  The session then uses the socket and session
+ * handle as if they were its own, but only while it holds the lock.
+ */
+
+int transport_attach(ab_session_p session)
+{
+    ab_transport_p transport = session->transport;
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    critical_block(transport->mutex) {
+        if(!transport->sock) {
+            if((rc = session_open_socket(session)) == PLCTAG_STATUS_OK) {
+                rc = session_register(session);
+            }
+
+            if(rc != PLCTAG_STATUS_OK) {
+                session_close_socket(session);
+                break;
+            }
+
+            metrics_add(session->metrics, METRIC_CONNECTS, 1);
+
+            transport->sock = session->sock;
+            transport->session_handle = session->session_handle;
+            transport->num_attached = 0;
+        }
+
+        session->sock = transport->sock;
+        session->session_handle = transport->session_handle;
+        session->transport_generation = transport->generation;
+        session->transport_attached = 1;
+        transport->num_attached++;
+    }
+
+    pdebug(DEBUG_INFO, "Done with %s.", plc_tag_decode_error(rc));
+
+    return rc;
+}
+
+
+
+/*
+ * transport_lock
+ *
+ * Take the shared socket for an exchange.  Fails if the socket this
+ * session connected over has been closed since, the session must
+ * reconnect.
+ */
+
+int transport_lock(ab_session_p session)
+{
+    ab_transport_p transport = session->transport;
+
+    if(!session->transport_attached) {
+        return PLCTAG_ERR_BAD_CONNECTION;
+    }
+
+    mutex_lock(transport->mutex);
+
+    if(!transport->sock || transport->generation != session->transport_generation) {
+        mutex_unlock(transport->mutex);
+
+        session->sock = NULL;
+        session->transport_attached = 0;
+
+        return PLCTAG_ERR_BAD_CONNECTION;
+    }
+
+    session->transport_locked = 1;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * transport_unlock
+ *
+ * Give the socket back.  If the exchange failed on the socket itself, the
+ * stream cannot be trusted, so it is closed and every session using it
+ * reconnects.  Errors from the PLC only affect this session.
+ */
+
+void transport_unlock(ab_session_p session, int last_rc)
+{
+    ab_transport_p transport = session->transport;
+
+    if(!session->transport_locked) {
+        return;
+    }
+
+    if(last_rc == PLCTAG_ERR_READ || last_rc == PLCTAG_ERR_WRITE || last_rc == PLCTAG_ERR_BAD_REPLY || last_rc == PLCTAG_ERR_TOO_LARGE) {
+        pdebug(DEBUG_WARN, "Closing the shared socket to %s after %s.", transport->host, plc_tag_decode_error(last_rc));
+
+        transport_close_socket_unsafe(transport);
+
+        session->sock = NULL;
+        session->transport_attached = 0;
+    }
+
+    session->transport_locked = 0;
+
+    mutex_unlock(transport->mutex);
+}
+
+
+
+/* stop using the shared socket, the last session to stop closes it. */
+void transport_detach(ab_session_p session)
+{
+    ab_transport_p transport = session->transport;
+
+    critical_block(transport->mutex) {
+        if(session->transport_attached && transport->generation == session->transport_generation) {
+            transport->num_attached--;
+
+            if(transport->num_attached <= 0) {
+                pdebug(DEBUG_DETAIL, "Last session left, closing the shared socket to %s.", transport->host);
+                transport_close_socket_unsafe(transport);
+            }
+        }
+    }
+
+    session->sock = NULL;
+    session->session_handle = 0;
+    session->transport_attached = 0;
+}
+
+
+
+/* the transport mutex must be held, or the transport not in use. */
+void transport_close_socket_unsafe(ab_transport_p transport)
+{
+    if(transport->sock) {
+        socket_close(transport->sock);
+        socket_destroy(&(transport->sock));
+        transport->sock = NULL;
+    }
+
+    transport->session_handle = 0;
+    transport->num_attached = 0;
+    transport->generation++;
+}
+
+
+
+void session_destroy(void *session_arg)
+{
+    ab_session_p session = session_arg;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if (!session) {
+        pdebug(DEBUG_WARN, "Session ptr is null!");
+
+        return;
+    }
+
+    /* so remove the session from the list so no one else can reference it. */
+    remove_session(session);
+
+    pdebug(DEBUG_INFO, "Session sent %" PRId64 " packets.", session->packet_count);
+
+    /* terminate the session thread first. */
+    session->terminating = 1;
+
+    /* wake the handler thread so that it sees the flag. */
+    if(session->wait_cond) {
+        cond_signal(session->wait_cond);
+    }
+
+    /* get rid of the handler thread. */
+    pdebug(DEBUG_DETAIL, "Destroying session thread.");
+    if (session->handler_thread) {
+        /* this cannot be guarded by the mutex since the session thread also locks it. */
+        thread_join(session->handler_thread);
+
+        /* FIXME - is this critical block needed? */
+        critical_block(session->mutex) {
+            thread_destroy(&(session->handler_thread));
+            session->handler_thread = NULL;
+        }
+    }
+
+
+    /* this needs to be handled in the mutex to prevent double frees due to queued requests. */
+    critical_block(session->mutex) {
+        /* close off the connection if is one. This helps the PLC clean up. */
+        if (session->targ_connection_id && session_teardown_deadline && time_ms() >= session_teardown_deadline) {
+            pdebug(DEBUG_INFO, "Shutdown deadline passed, skipping the Forward Close.");
+        } else if (session->targ_connection_id && session->transport) {
+            /* the shared socket may be gone already. */
+            if(transport_lock(session) == PLCTAG_STATUS_OK) {
+                session->terminating = 0;
+                transport_unlock(session, perform_forward_close(session));
+                session->terminating = 1;
+            }
+        } else if (session->targ_connection_id) {
+            /*
+             * we do not want the internal loop to immediately
+             * return, so set the flag like we are not terminating.
+             * There is still a timeout that applies.
+             */
+            session->terminating = 0;
+            perform_forward_close(session);
+            session->terminating = 1;
+        }
+
+        /* the other sessions may still be using the socket. */
+        if(session->transport) {
+            transport_detach(session);
+        }
+
+        /* try to be nice and un-register the session */
+        if (session->session_handle) {
+            session_unregister(session);
+        }
+
+        if (session->sock) {
+            session_close_socket(session);
+        }
+
+        /* release all the requests that are in the queues. */
+        for(int p=0; p < SESSION_NUM_PRIORITIES; p++) {
+            while(session->requests[p].head) {
+                ab_request_p req = session->requests[p].head;
+
+                dequeue_request_unsafe(session, req);
+                complete_merged_requests(req, PLCTAG_ERR_ABORT, 0);
+                rc_dec(req);
+            }
+        }
+
+        session->num_requests = 0;
+
+        /* free the pooled requests, any still in use are freed when released. */
+        if(session->request_pool) {
+            request_pool_close(session->request_pool);
+            session->request_pool = rc_dec(session->request_pool);
+        }
+    }
+
+    if(session->transport) {
+        critical_block(session_mutex) {
+            transport_release_unsafe(session->transport);
+        }
+
+        session->transport = NULL;
+    }
+
+    /* we are done with the mutex, finally destroy it. */
+    pdebug(DEBUG_DETAIL, "Destroying session mutex.");
+    if(session->mutex) {
+        mutex_destroy(&(session->mutex));
+        session->mutex = NULL;
+    }
+
+    if(session->wait_cond) {
+        cond_destroy(&(session->wait_cond));
+        session->wait_cond = NULL;
+    }
+
+    /* write out what this session learned. */
+    meta_cache_flush();
+
+    pdebug(DEBUG_DETAIL, "Cleaning up allocated memory for paths and host name.");
+    if(session->conn_path) {
+        mem_free(session->conn_path);
+        session->conn_path = NULL;
+    }
+
+    if(session->path) {
+        mem_free(session->path);
+        session->path = NULL;
+    }
+
+    if(session->host) {
+        mem_free(session->host);
+        session->host = NULL;
+    }
+
+    if(session->metrics) {
+        metrics_unregister(session->metrics);
+        session->metrics = NULL;
+    }
+
+    if(session->capture) {
+        capture_close(session->capture);
+        session->capture = NULL;
+    }
+
+    if(session->in_flight) {
+        mem_free(session->in_flight);
+        session->in_flight = NULL;
+    }
+
+    if(session->send_bufs) {
+        mem_free(session->send_bufs);
+        session->send_bufs = NULL;
+    }
+
+    if(session->data) {
+        session->data = rc_dec(session->data);
+    }
+
+    if(session->data_next) {
+        session->data_next = rc_dec(session->data_next);
+    }
+
+    if(session->rx_extra) {
+        mem_free(session->rx_extra);
+        session->rx_extra = NULL;
+    }
+
+    if(session->queued_reads) {
+        hashtable_destroy(session->queued_reads);
+        session->queued_reads = NULL;
+    }
+
+    if(session->read_cache) {
+        hashtable_on_each(session->read_cache, read_cache_free_entry, NULL);
+        hashtable_destroy(session->read_cache);
+        session->read_cache = NULL;
+    }
+
+    if(session->symbol_ids) {
+        hashtable_on_each(session->symbol_ids, symbol_id_free_entry, NULL);
+        hashtable_destroy(session->symbol_ids);
+        session->symbol_ids = NULL;
+    }
+
+    if(session->bit_words) {
+        hashtable_on_each(session->bit_words, bit_word_free_entry, NULL);
+        hashtable_destroy(session->bit_words);
+        session->bit_words = NULL;
+    }
+
+    if(session->name_prefixes) {
+        hashtable_on_each(session->name_prefixes, symbol_id_free_entry, NULL);
+        hashtable_destroy(session->name_prefixes);
+        session->name_prefixes = NULL;
+    }
+
+    /* templates are single allocations, the symbol ID free function works for them too. */
+    if(session->udt_templates) {
+        hashtable_on_each(session->udt_templates, symbol_id_free_entry, NULL);
+        hashtable_destroy(session->udt_templates);
+        session->udt_templates = NULL;
+    }
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return;
+}
+
+
+
+
+/*
+ * session_add_request_unsafe
+ *
+ * You must hold the mutex before calling this!
+ */
+int session_add_request_unsafe(ab_session_p session, ab_request_p req)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    if(!session) {
+        pdebug(DEBUG_WARN, "Session is null!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    /* the PLC is not reachable, do not make the caller wait to find out. */
+    if(SESSION_BREAKER_IS_OPEN(session->breaker_state)) {
+        pdebug(DEBUG_DETAIL, "Circuit breaker is open, rejecting the request.");
+        return PLCTAG_ERR_UNAVAILABLE;
+    }
+
+    req = rc_inc(req);
+
+    if(!req) {
+        pdebug(DEBUG_WARN, "Request is either null or in the process of being deleted.");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    /* make sure the request points to the session */
+
+    req->time_queued = time_us();
+
+    if(req->priority < SESSION_PRIORITY_LOW || req->priority >= SESSION_NUM_PRIORITIES) {
+        req->priority = SESSION_PRIORITY_NORMAL;
+    }
+
+    /* cached reads are stale once a write goes out after them. */
+    if(req->flush_read_cache && session->read_cache_entries > 0) {
+        session->read_cache_generation++;
+    }
+
+    if(req->allow_merge) {
+        req->merge_key = request_merge_key(req);
+
+        /* another handle read this recently enough. */
+        if(req->cache_ms > 0 && read_cache_serve_unsafe(session, req)) {
+            pdebug(DEBUG_DETAIL, "Answered request from the shared read cache.");
+            metrics_add(session->metrics, METRIC_READS_CACHED, 1);
+            rc_dec(req);
+            return rc;
+        }
+
+        /* an identical read is already waiting to go, use its response. */
+        if(merge_request_unsafe(session, req)) {
+            pdebug(DEBUG_DETAIL, "Merged request into an identical queued read.");
+            metrics_add(session->metrics, METRIC_READS_MERGED, 1);
+            return rc;
+        }
+    }
+
+    /* fold bit writes into the last queued write if it sets bits in the same element. */
+    if(req->rmw_mask_size > 0 && coalesce_rmw_request_unsafe(session, req)) {
+        pdebug(DEBUG_DETAIL, "Coalesced bit write into a queued Read-Modify-Write.");
+        metrics_add(session->metrics, METRIC_BIT_WRITES_COALESCED, 1);
+        return rc;
+    }
+
+    /* fold reads of nearby data into a queued read of the same file. */
+    if(req->span.key && coalesce_span_request_unsafe(session, req)) {
+        pdebug(DEBUG_DETAIL, "Coalesced read into a queued read of the same data file.");
+        metrics_add(session->metrics, METRIC_READS_COALESCED, 1);
+        return rc;
+    }
+
+    /* insert into the queue for its priority class */
+    request_queue_push(&(session->requests[req->priority]), req);
+    session->num_requests++;
+
+    req->queued_pack_bytes = 0;
+
+    if(req->allow_packing && le2h16(((eip_encap *)(req->data))->encap_command) == AB_EIP_CONNECTED_SEND) {
+        req->queued_pack_bytes = get_payload_size(req);
+        session->queued_pack_bytes += req->queued_pack_bytes;
+    }
+
+    metrics_max(session->metrics, METRIC_QUEUE_DEPTH_MAX, session->num_requests);
+
+    plctag_trace2(session_add_request, req->tag_id, session->num_requests);
+
+    pdebug(DEBUG_DETAIL, "Total requests in the queues: %d", session->num_requests);
+
+    /* wake up the handler thread. */
+    cond_signal(session->wait_cond);
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return rc;
+}
+
+/*
+ * session_add_request
+ *
+ * This is a thread-safe version of the above routine.
+ */
+int session_add_request(ab_session_p sess, ab_request_p req)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_INFO, "Starting. sess=%p, req=%p", sess, req);
+
+    critical_block(sess->mutex) {
+        rc = session_add_request_unsafe(sess, req);
+    }
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return rc;
+}
+
+
+/*
+ * session_remove_request_unsafe
+ *
+ * You must hold the mutex before calling this!
+ */
+int session_remove_request_unsafe(ab_session_p session, ab_request_p req)
+{
+    int rc = PLCTAG_STATUS_OK;
+//    ab_request_p cur, prev;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(session == NULL || req == NULL) {
+        return rc;
+    }
+
+    if(req->queued) {
+        dequeue_request_unsafe(session, req);
+    }
+
+    /* release the request refcount */
+    rc_dec(req);
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return rc;
+}
+
+
+
+/*****************************************************************
+ **************** Session handling functions *********************
+ ****************************************************************/
+
+
+typedef enum { SESSION_OPEN_SOCKET, SESSION_REGISTER, SESSION_SEND_FORWARD_OPEN,
+               SESSION_RECEIVE_FORWARD_OPEN, SESSION_IDLE, SESSION_DISCONNECT,
+               SESSION_UNREGISTER, SESSION_CLOSE_SOCKET, SESSION_START_RETRY,
+               SESSION_WAIT_RETRY, SESSION_WAIT_RECONNECT
+             } session_state_t;
+
+
+/* drop the teardown reference to one session, used so the sessions close in parallel. */
+THREAD_FUNC(session_close_handler)
+{
+    ab_session_p session = arg;
+
+    rc_dec(session);
+
+    THREAD_RETURN(0);
+}
+
+
+
+THREAD_FUNC(session_handler)
+{
+    ab_session_p session = arg;
+    int rc = PLCTAG_STATUS_OK;
+    session_state_t state = SESSION_OPEN_SOCKET;
+    int64_t timeout_time = 0;
+    int64_t auto_disconnect_time = time_ms() + SESSION_DISCONNECT_TIMEOUT;
+    int auto_disconnect = 0;
+
+
+    pdebug(DEBUG_INFO, "Starting thread for session %p", session);
+
+    while(!session->terminating) {
+        int idle = 0;
+
+        /*
+         * While the session is not able to send, get rid of all the
+         * aborted requests queued.  This keeps the overall memory usage
+         * lower.  When idle, the planner drops them as it reaches them.
+         */
+
+        if(state != SESSION_IDLE) {
+            pdebug(DEBUG_SPEW,"Critical block.");
+            critical_block(session->mutex) {
+                purge_aborted_requests_unsafe(session);
+            }
+        }
+
+        switch(state) {
+        case SESSION_OPEN_SOCKET:
+            pdebug(DEBUG_DETAIL, "in SESSION_OPEN_SOCKET state.");
+
+            /* we must connect to the gateway*/
+            if(session->transport) {
+                /* connects and registers the shared socket if no other session has. */
+                if((rc = transport_attach(session)) != PLCTAG_STATUS_OK) {
+                    pdebug(DEBUG_WARN, "Shared session connect failed %s!", plc_tag_decode_error(rc));
+                    state = SESSION_CLOSE_SOCKET;
+                } else {
+                    auto_disconnect_time = time_ms() + SESSION_DISCONNECT_TIMEOUT;
+                    state = (session->use_connected_msg ? SESSION_SEND_FORWARD_OPEN : SESSION_IDLE);
+                }
+            } else if ((rc = session_open_socket(session)) != PLCTAG_STATUS_OK) {
+                pdebug(DEBUG_WARN, "session connect failed %s!", plc_tag_decode_error(rc));
+                state = SESSION_CLOSE_SOCKET;
+            } else {
+                metrics_add(session->metrics, METRIC_CONNECTS, 1);
+
+                /* set the timeout for disconnect. */
+                //if(session->auto_disconnect_enabled) {
+                auto_disconnect_time = time_ms() + SESSION_DISCONNECT_TIMEOUT;
+                //}
+
+                state = SESSION_REGISTER;
+            }
+            break;
+
+        case SESSION_REGISTER:
+            pdebug(DEBUG_DETAIL, "in SESSION_REGISTER state.");
+
+            if ((rc = session_register(session)) != PLCTAG_STATUS_OK) {
+                pdebug(DEBUG_WARN, "session registration failed %s!", plc_tag_decode_error(rc));
+                state = SESSION_CLOSE_SOCKET;
+            } else {
+                if(session->use_connected_msg) {
+                    state = SESSION_SEND_FORWARD_OPEN;
+                } else {
+                    state = SESSION_IDLE;
+                }
+            }
+            break;
+
+        case SESSION_SEND_FORWARD_OPEN:
+            pdebug(DEBUG_DETAIL, "in SESSION_SEND_FORWARD_OPEN state.");
+
+            if(session->transport && !session->transport_locked && (rc = transport_lock(session)) != PLCTAG_STATUS_OK) {
+                pdebug(DEBUG_DETAIL, "Shared socket closed, reconnecting.");
+                state = SESSION_OPEN_SOCKET;
+            } else if((rc = send_forward_open_request(session)) != PLCTAG_STATUS_OK) {
+                pdebug(DEBUG_WARN, "Send Forward Open failed %s!", plc_tag_decode_error(rc));
+                metrics_add(session->metrics, METRIC_FORWARD_OPEN_FAILURES, 1);
+                state = SESSION_UNREGISTER;
+            } else {
+                pdebug(DEBUG_DETAIL, "Send Forward Open succeeded, going to SESSION_RECEIVE_FORWARD_OPEN state.");
+                state = SESSION_RECEIVE_FORWARD_OPEN;
+            }
+            break;
+
+        case SESSION_RECEIVE_FORWARD_OPEN:
+            pdebug(DEBUG_DETAIL, "in SESSION_RECEIVE_FORWARD_OPEN state.");
+
+            if((rc = receive_forward_open_response(session)) != PLCTAG_STATUS_OK) {
+                metrics_add(session->metrics, METRIC_FORWARD_OPEN_FAILURES, 1);
+
+                if(rc == PLCTAG_ERR_DUPLICATE) {
+                    pdebug(DEBUG_DETAIL, "Duplicate connection error received, trying again with different connection ID.");
+                    state = SESSION_SEND_FORWARD_OPEN;
+                } else if(rc == PLCTAG_ERR_TOO_LARGE) {
+                    pdebug(DEBUG_DETAIL, "Requested packet size too large, retrying with smaller size.");
+                    state = SESSION_SEND_FORWARD_OPEN;
+                } else if(rc == PLCTAG_ERR_UNSUPPORTED && !session->only_use_old_forward_open) {
+                    /* if we got an unsupported error and we are trying with ForwardOpenEx, then try the old command. */
+                    pdebug(DEBUG_DETAIL, "PLC does not support ForwardOpenEx, trying old ForwardOpen.");
+                    session->only_use_old_forward_open = 1;
+                    state = SESSION_SEND_FORWARD_OPEN;
+                } else {
+                    pdebug(DEBUG_WARN, "Receive Forward Open failed %s!", plc_tag_decode_error(rc));
+                    state = SESSION_UNREGISTER;
+                }
+            } else {
+                pdebug(DEBUG_DETAIL, "Send Forward Open succeeded, going to SESSION_IDLE state.");
+                conn_cache_update(session);
+                state = SESSION_IDLE;
+            }
+            break;
+
+        case SESSION_IDLE:
+            pdebug(DEBUG_SPEW, "in SESSION_IDLE state.");
+
+            idle = 1;
+
+            /* the probe got through. */
+            if(SESSION_BREAKER_IS_OPEN(session->breaker_state)) {
+                breaker_close(session);
+            }
+
+            /* if there is work to do, make sure we do not disconnect. */
+            pdebug(DEBUG_SPEW,"Critical block.");
+            critical_block(session->mutex) {
+                if(session->num_requests > 0) {
+                    auto_disconnect_time = time_ms() + SESSION_DISCONNECT_TIMEOUT;
+                }
+            }
+
+            /* another session closed the shared socket, the connection went with it. */
+            if(session->transport && (rc = transport_lock(session)) != PLCTAG_STATUS_OK) {
+                pdebug(DEBUG_DETAIL, "Shared socket closed, reconnecting.");
+                idle = 0;
+                state = SESSION_OPEN_SOCKET;
+            } else if((rc = send_keepalive(session)) != PLCTAG_STATUS_OK) {
+                pdebug(DEBUG_WARN, "Error sending keepalive %s!", plc_tag_decode_error(rc));
+                idle = 0;
+                state = (session->use_connected_msg ? SESSION_DISCONNECT : SESSION_UNREGISTER);
+            } else if((rc = process_requests(session)) != PLCTAG_STATUS_OK) {
+                pdebug(DEBUG_WARN, "Error while processing requests %s!", plc_tag_decode_error(rc));
+                idle = 0;
+                if(session->use_connected_msg) {
+                    state = SESSION_DISCONNECT;
+                } else {
+                    state = SESSION_UNREGISTER;
+                }
+            }
+
+            /* do not wait if there are more requests ready to go, unless the rate limit holds them. */
+            if(idle && atomic_get(&session_request_hold) == 0 && session->rate_wait_ms == 0) {
+                critical_block(session->mutex) {
+                    if(session->num_requests > 0) {
+                        idle = 0;
+                    }
+                }
+            }
+
+            /* check if we should disconnect */
+            //if(session->auto_disconnect_enabled) {
+            if(state != SESSION_OPEN_SOCKET && !session->keepalive_ms && auto_disconnect_time < time_ms()) {
+                pdebug(DEBUG_DETAIL, "Disconnecting due to inactivity.");
+
+                auto_disconnect = 1;
+                idle = 0;
+
+                if(session->use_connected_msg) {
+                    state = SESSION_DISCONNECT;
+                } else {
+                    state = SESSION_UNREGISTER;
+                }
+            }
+            //}
+
+            break;
+
+        case SESSION_DISCONNECT:
+            pdebug(DEBUG_DETAIL, "in SESSION_DISCONNECT state.");
+
+            if(session->transport && transport_lock(session) != PLCTAG_STATUS_OK) {
+                pdebug(DEBUG_DETAIL, "Shared socket closed, skipping the Forward Close.");
+            } else if((rc = perform_forward_close(session)) != PLCTAG_STATUS_OK) {
+                pdebug(DEBUG_WARN, "Forward close failed %s!", plc_tag_decode_error(rc));
+            }
+
+            state = SESSION_UNREGISTER;
+            break;
+
+        case SESSION_UNREGISTER:
+            pdebug(DEBUG_DETAIL, "in SESSION_UNREGISTER state.");
+
+            if((rc = session_unregister(session)) != PLCTAG_STATUS_OK) {
+                pdebug(DEBUG_WARN, "Unregistering session failed %s!", plc_tag_decode_error(rc));
+            }
+
+            state = SESSION_CLOSE_SOCKET;
+            break;
+
+        case SESSION_CLOSE_SOCKET:
+            pdebug(DEBUG_DETAIL, "in SESSION_CLOSE_SOCKET state.");
+
+            if(session->transport) {
+                transport_detach(session);
+            } else if((rc = session_close_socket(session)) != PLCTAG_STATUS_OK) {
+                pdebug(DEBUG_WARN, "Closing session socket failed %s!", plc_tag_decode_error(rc));
+            }
+
+            if(auto_disconnect) {
+                state = SESSION_WAIT_RECONNECT;
+            } else {
+                breaker_failure(session);
+                state = SESSION_START_RETRY;
+            }
+
+            break;
+
+        case SESSION_START_RETRY:
+            pdebug(DEBUG_DETAIL, "in SESSION_START_RETRY state.");
+
+            /* set up timer for retry. */
+            idle = 0;
+
+            /* FIXME - make this a tag attribute. */
+            timeout_time = time_ms() + breaker_retry_wait(session);
+
+            /* start waiting. */
+            state = SESSION_WAIT_RETRY;
+
+            break;
+
+        case SESSION_WAIT_RETRY:
+            pdebug(DEBUG_SPEW, "in SESSION_WAIT_RETRY state.");
+
+            /* make us sleep on each iteration. */
+            idle = 1;
+
+            if(timeout_time < time_ms()) {
+                pdebug(DEBUG_DETAIL, "Transitioning to SESSION_OPEN_SOCKET.");
+                state = SESSION_OPEN_SOCKET;
+            }
+
+            break;
+
+        case SESSION_WAIT_RECONNECT:
+            /* wait for at least one request to queue before reconnecting. */
+            pdebug(DEBUG_SPEW, "in SESSION_WAIT_RECONNECT state.");
+
+            idle = 1;
+            auto_disconnect = 0;
+
+            /* if there is work to do, reconnect.. */
+            pdebug(DEBUG_SPEW,"Critical block.");
+            critical_block(session->mutex) {
+                if(session->num_requests > 0) {
+                    pdebug(DEBUG_DETAIL, "There are requests waiting, reopening connection to PLC.");
+
+                    idle = 0;
+                    state = SESSION_OPEN_SOCKET;
+                }
+            }
+
+            break;
+
+
+        default:
+            pdebug(DEBUG_ERROR, "Unknown state %d!", state);
+
+            /* FIXME - this logic is not complete.  We might be here without
+             * a connected session or a registered session. */
+            if(session->use_connected_msg) {
+                state = SESSION_DISCONNECT;
+            } else {
+                state = SESSION_UNREGISTER;
+            }
+
+            break;
+        }
+
+        /* the shared socket is only held for one exchange, a Forward Open spans two states. */
+        if(session->transport_locked && state != SESSION_RECEIVE_FORWARD_OPEN) {
+            transport_unlock(session, rc);
+        }
+
+        /*
+         * give up the CPU a bit, but only if we are not
+         * doing some linked states.
+         */
+        if(idle && !session->terminating) {
+            /* wait until a new request comes in or the rate limit lets the next one go. */
+            if(session->rate_wait_ms > 0 && session->rate_wait_ms < SESSION_IDLE_WAIT_TIME) {
+                cond_wait(session->wait_cond, session->rate_wait_ms);
+            } else {
+                cond_wait(session->wait_cond, SESSION_IDLE_WAIT_TIME);
+            }
+        }
+    }
+
+    if(session->transport_locked) {
+        transport_unlock(session, rc);
+    }
+
+    /*
+     * One last time before we exit.
+     */
+    pdebug(DEBUG_SPEW,"Critical block.");
+    critical_block(session->mutex) {
+        purge_aborted_requests_unsafe(session);
+    }
+
+    THREAD_RETURN(0);
+}
+
+
+
+/*
+ * This must be called with the session mutex held!
+ */
+int purge_aborted_requests_unsafe(ab_session_p session)
+{
+    int purge_count = 0;
+    ab_request_p request = NULL;
+    int64_t now = time_ms();
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    /* remove the aborted and expired requests. */
+    for(int p=0; p < SESSION_NUM_PRIORITIES; p++) {
+        request = session->requests[p].head;
+
+        while(request) {
+            ab_request_p next = request->queue_next;
+
+            if(drop_dead_request_unsafe(session, request, now)) {
+                purge_count++;
+            }
+
+            request = next;
+        }
+    }
+
+    if(purge_count > 0) {
+        pdebug(DEBUG_DETAIL, "Removed %d aborted requests.", purge_count);
+    }
+
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return purge_count;
+}
+
+
+
+/*
+ * The request queues are intrusive doubly linked lists so that adding,
+ * taking the head and removing any request, aborted or packed from the
+ * middle, are all constant time no matter how deep the queue gets.
+ */
+
+void request_queue_push(ab_request_queue_t *queue, ab_request_p req)
+{
+    req->queue_next = NULL;
+    req->queue_prev = queue->tail;
+
+    if(queue->tail) {
+        queue->tail->queue_next = req;
+    } else {
+        queue->head = req;
+    }
+
+    queue->tail = req;
+    queue->count++;
+    req->queued = 1;
+}
+
+
+void request_queue_unlink(ab_request_queue_t *queue, ab_request_p req)
+{
+    if(req->queue_prev) {
+        req->queue_prev->queue_next = req->queue_next;
+    } else {
+        queue->head = req->queue_next;
+    }
+
+    if(req->queue_next) {
+        req->queue_next->queue_prev = req->queue_prev;
+    } else {
+        queue->tail = req->queue_prev;
+    }
+
+    req->queue_next = NULL;
+    req->queue_prev = NULL;
+    req->queued = 0;
+    queue->count--;
+}
+
+
+void request_queue_replace(ab_request_queue_t *queue, ab_request_p old_req, ab_request_p new_req)
+{
+    new_req->queue_prev = old_req->queue_prev;
+    new_req->queue_next = old_req->queue_next;
+
+    if(old_req->queue_prev) {
+        old_req->queue_prev->queue_next = new_req;
+    } else {
+        queue->head = new_req;
+    }
+
+    if(old_req->queue_next) {
+        old_req->queue_next->queue_prev = new_req;
+    } else {
+        queue->tail = new_req;
+    }
+
+    new_req->queued = 1;
+
+    old_req->queue_next = NULL;
+    old_req->queue_prev = NULL;
+    old_req->queued = 0;
+}
+
+
+/*
+ * Take a request out of its queue.  Once it is out, nothing else can
+ * merge into it.  Must be called with the session mutex held.
+ */
+void dequeue_request_unsafe(ab_session_p session, ab_request_p req)
+{
+    request_queue_unlink(&(session->requests[req->priority]), req);
+    session->num_requests--;
+
+    session->queued_pack_bytes -= req->queued_pack_bytes;
+    req->queued_pack_bytes = 0;
+
+    if(req->merge_listed) {
+        hashtable_remove(session->queued_reads, req->merge_key);
+        req->merge_listed = 0;
+    }
+}
+
+
+/*
+ * merge_request_unsafe
+ *
+ * Reads whose request bytes are the same as a read still in the queue
+ * ride along with that read instead of going out on the wire again.
+ * Only reads that have not been sent yet are merged into, so the data
+ * returned is always read after the request was made.  A read is not
+ * merged into one of lower priority.
+ *
+ * Returns non-zero if the request was merged, otherwise it becomes a
+ * candidate for later reads to merge into.  Must be called with the
+ * session mutex held.
+ */
+int merge_request_unsafe(ab_session_p session, ab_request_p req)
+{
+    ab_request_p primary = (ab_request_p)hashtable_get(session->queued_reads, req->merge_key);
+
+    if(primary) {
+        if(!primary->abort_request
+           && primary->priority >= req->priority
+           && primary->request_size == req->request_size
+           && mem_cmp(primary->data, primary->request_size, req->data, req->request_size) == 0) {
+            req->merged_next = primary->merged_head;
+            primary->merged_head = req;
+            request_extend_deadline(primary, req);
+
+            /* the response goes in the cache if anyone riding on it wants that. */
+            if(primary->cache_ms < req->cache_ms) {
+                primary->cache_ms = req->cache_ms;
+            }
+
+            return 1;
+        }
+
+        /* another read has this key already, do not track this one. */
+        return 0;
+    }
+
+    if(hashtable_put(session->queued_reads, req->merge_key, req) == PLCTAG_STATUS_OK) {
+        req->merge_listed = 1;
+    }
+
+    return 0;
+}
+
+
+/*
+ * coalesce_rmw_request_unsafe
+ *
+ * A Read-Modify-Write sets the element to (old & AND) | OR.  Bit writes
+ * to the same element can be combined into the most recent queued write
+ * if that is a Read-Modify-Write of the same element.  Any other write
+ * in between stops the search so that writes still happen in order.
+ * Only requests of the same priority class are combined.
+ *
+ * The combined masks apply the earlier write first:
+ *
+ *     AND = AND1 & AND2
+ *     OR  = (OR1 & AND2) | OR2
+ *
+ * The request rides on the queued one and gets a copy of its response.
+ * Returns non-zero if the request was combined.  Must be called with the
+ * session mutex held.
+ */
+int coalesce_rmw_request_unsafe(ab_session_p session, ab_request_p req)
+{
+    ab_request_p primary = session->requests[req->priority].tail;
+    int mask_offset = req->rmw_mask_offset;
+    int mask_size = req->rmw_mask_size;
+    int tail_offset = mask_offset + (2 * mask_size);
+
+    /* reads do not change the element, look past them. */
+    while(primary && !primary->flush_read_cache) {
+        primary = primary->queue_prev;
+    }
+
+    if(!primary || primary->abort_request || primary->rmw_mask_size != mask_size || primary->rmw_mask_offset != mask_offset) {
+        return 0;
+    }
+
+    if(primary->request_size != req->request_size || tail_offset > req->request_size) {
+        return 0;
+    }
+
+    /* everything but the masks has to match. */
+    if(mem_cmp(primary->data, mask_offset, req->data, mask_offset) != 0
+       || mem_cmp(primary->data + tail_offset, req->request_size - tail_offset, req->data + tail_offset, req->request_size - tail_offset) != 0) {
+        return 0;
+    }
+
+    for(int i=0; i < mask_size; i++) {
+        uint8_t *or_mask = primary->data + mask_offset;
+        uint8_t *and_mask = or_mask + mask_size;
+        uint8_t new_or = req->data[mask_offset + i];
+        uint8_t new_and = req->data[mask_offset + mask_size + i];
+
+        or_mask[i] = (uint8_t)((or_mask[i] & new_and) | new_or);
+        and_mask[i] = (uint8_t)(and_mask[i] & new_and);
+    }
+
+    req->merged_next = primary->merged_head;
+    primary->merged_head = req;
+    request_extend_deadline(primary, req);
+
+    return 1;
+}
+
+
+/*
+ * coalesce_span_request_unsafe
+ *
+ * PLCs without packed requests answer one read per round trip.  Reads of
+ * the same data file that are queued at the same time can be combined
+ * into one read covering all of them as long as that fits in a reply.
+ * The queued read is rewritten to cover the new span and the request
+ * rides along on it.  Only reads of the same priority class are combined.
+ *
+ * Returns non-zero if the request was combined.  Must be called with the
+ * session mutex held.
+ */
+int coalesce_span_request_unsafe(ab_session_p session, ab_request_p req)
+{
+    ab_request_p primary = session->requests[req->priority].head;
+    int num_scanned = 0;
+
+    for(; primary && num_scanned < SESSION_MAX_PACK_SCAN; primary = primary->queue_next, num_scanned++) {
+        int new_start = 0;
+        int new_end = 0;
+        int old_start = 0;
+        int old_size = 0;
+
+        if(primary->abort_request || primary->span.key != req->span.key || !primary->span.encode) {
+            continue;
+        }
+
+        old_start = primary->span.read_start;
+        old_size = primary->span.read_size;
+
+        new_start = (req->span.start < old_start ? req->span.start : old_start);
+        new_end = (req->span.start + req->span.size > old_start + old_size ? req->span.start + req->span.size : old_start + old_size);
+
+        if(new_end - new_start > primary->span.max_size) {
+            continue;
+        }
+
+        primary->span.read_start = new_start;
+        primary->span.read_size = new_end - new_start;
+
+        if(primary->span.encode(primary) != PLCTAG_STATUS_OK) {
+            primary->span.read_start = old_start;
+            primary->span.read_size = old_size;
+            continue;
+        }
+
+        req->merged_next = primary->merged_head;
+        primary->merged_head = req;
+        request_extend_deadline(primary, req);
+
+        return 1;
+    }
+
+    return 0;
+}
+
+
+/*
+ * The key for merging and caching reads is the request length and a
+ * hash of the request bytes.  It is never zero.  The bytes are compared
+ * as well, so collisions only cost a missed match.
+ */
+int64_t request_merge_key(ab_request_p req)
+{
+    return ((int64_t)req->request_size << 32) | (int64_t)hash(req->data, (size_t)req->request_size, 0);
+}
+
+
+/*
+ * read_cache_find_unsafe
+ *
+ * Find the cache entry for the request bytes, if any.  Must be called
+ * with the session mutex held.
+ */
+read_cache_entry_t *read_cache_find_unsafe(ab_session_p session, ab_request_p req)
+{
+    read_cache_entry_t *entry = (read_cache_entry_t *)hashtable_get(session->read_cache, req->merge_key);
+
+    if(entry && entry->request_size == req->request_size
+             && mem_cmp(entry->request, entry->request_size, req->data, req->request_size) == 0) {
+        return entry;
+    }
+
+    return NULL;
+}
+
+
+/*
+ * read_cache_serve_unsafe
+ *
+ * The shared read cache lets handles to the same tag use a response
+ * one of them got recently, up to the request's cache_ms old, instead
+ * of asking the PLC again.  Entries are keyed on the request bytes so
+ * the tag name, element count and offset all have to match.
+ *
+ * Returns non-zero if the request was answered.  Must be called with
+ * the session mutex held.
+ */
+int read_cache_serve_unsafe(ab_session_p session, ab_request_p req)
+{
+    read_cache_entry_t *entry = read_cache_find_unsafe(session, req);
+    int64_t now = time_ms();
+
+    if(!entry || entry->generation != session->read_cache_generation || entry->time_filled + req->cache_ms < now) {
+        return 0;
+    }
+
+    if(entry->response_size > req->request_capacity) {
+        if(session_request_increase_buffer(req, entry->response_size) != PLCTAG_STATUS_OK) {
+            return 0;
+        }
+    }
+
+    mem_copy(req->data, entry->response, entry->response_size);
+
+    spin_block(&req->lock) {
+        req->time_sent = req->time_queued;
+        req->time_received = req->time_queued;
+        req->status = PLCTAG_STATUS_OK;
+        req->request_size = entry->response_size;
+        req->resp_received = 1;
+    }
+
+    plc_tag_generic_wake_tag(req->tag_id);
+
+    return 1;
+}
+
+
+/*
+ * read_cache_claim
+ *
+ * Get the cache entry a response to the request will be stored in,
+ * making a new one if there is room.  This must be done while the
+ * request bytes are still in the buffer.  The generation is saved so
+ * that a write sent while the read was out keeps the response from
+ * being cached.
+ */
+read_cache_entry_t *read_cache_claim(ab_session_p session, ab_request_p req, uint32_t *generation)
+{
+    read_cache_entry_t *entry = NULL;
+
+    critical_block(session->mutex) {
+        *generation = session->read_cache_generation;
+
+        entry = read_cache_find_unsafe(session, req);
+        if(entry) {
+            break;
+        }
+
+        /* another read has the key or the cache is full. */
+        if(hashtable_get(session->read_cache, req->merge_key) || session->read_cache_entries >= SESSION_READ_CACHE_MAX) {
+            break;
+        }
+
+        entry = (read_cache_entry_t *)mem_alloc((int)sizeof(read_cache_entry_t) + req->request_size);
+        if(!entry) {
+            pdebug(DEBUG_WARN, "Unable to allocate read cache entry!");
+            break;
+        }
+
+        entry->request_size = req->request_size;
+        mem_copy(entry->request, req->data, req->request_size);
+
+        if(hashtable_put(session->read_cache, req->merge_key, entry) != PLCTAG_STATUS_OK) {
+            mem_free(entry);
+            entry = NULL;
+            break;
+        }
+
+        session->read_cache_entries++;
+    }
+
+    return entry;
+}
+
+
+void read_cache_fill(ab_session_p session, read_cache_entry_t *entry, uint32_t generation, ab_request_p req, int resp_size)
+{
+    critical_block(session->mutex) {
+        if(generation != session->read_cache_generation) {
+            pdebug(DEBUG_DETAIL, "A write went out during the read, not caching it.");
+            break;
+        }
+
+        if(resp_size > entry->response_capacity) {
+            uint8_t *new_response = (uint8_t *)mem_alloc(resp_size);
+
+            if(!new_response) {
+                pdebug(DEBUG_WARN, "Unable to allocate read cache response buffer!");
+                break;
+            }
+
+            if(entry->response) {
+                mem_free(entry->response);
+            }
+
+            entry->response = new_response;
+            entry->response_capacity = resp_size;
+        }
+
+        mem_copy(entry->response, req->data, resp_size);
+        entry->response_size = resp_size;
+        entry->time_filled = time_ms();
+        entry->generation = generation;
+    }
+}
 
-    pdebug(DEBUG_INFO, "Done");
 
-    return session;
+int read_cache_free_entry(hashtable_p table, int64_t key, void *data, void *context)
+{
+    read_cache_entry_t *entry = (read_cache_entry_t *)data;
+
+    (void)table;
+    (void)key;
+    (void)context;
+
+    if(entry) {
+        if(entry->response) {
+            mem_free(entry->response);
+        }
+
+        mem_free(entry);
+    }
+
+    return PLCTAG_STATUS_OK;
 }
 
 
 /*
- * session_init
+ * complete_merged_requests
  *
- * This calls several blocking methods and so must not keep the main mutex
- * locked during them.
+ * Hand the result of a request to the reads merged into it and release
+ * them.  On success the response in the request's buffer is copied.
+ * This must be done before the request itself is marked done as its
+ * tag may reuse the buffer right away.  The merged list is only changed
+ * while the request is queued so no lock is needed.
  */
-int session_init(ab_session_p session)
+void complete_merged_requests(ab_request_p request, int status, int resp_size)
 {
-    int rc = PLCTAG_STATUS_OK;
+    while(request->merged_head) {
+        ab_request_p dup = request->merged_head;
+        int rc = status;
 
-    pdebug(DEBUG_INFO, "Starting.");
+        request->merged_head = dup->merged_next;
+        dup->merged_next = NULL;
 
-    /* create the session mutex. */
-    if((rc = mutex_create(&(session->mutex))) != PLCTAG_STATUS_OK) {
-        pdebug(DEBUG_WARN, "Unable to create session mutex!");
-        session->failed = 1;
-        return rc;
-    }
+        if(rc == PLCTAG_STATUS_OK && dup->abort_request) {
+            rc = PLCTAG_ERR_ABORT;
+        }
 
-    if((rc = thread_create((thread_p *)&(session->handler_thread), session_handler, 32*1024, session)) != PLCTAG_STATUS_OK) {
-        pdebug(DEBUG_WARN, "Unable to create session thread!");
-        session->failed = 1;
-        return rc;
-    }
+        if(rc == PLCTAG_STATUS_OK && resp_size > dup->request_capacity) {
+            rc = session_request_increase_buffer(dup, request->request_capacity);
+        }
 
-    pdebug(DEBUG_INFO, "Done.");
+        if(rc == PLCTAG_STATUS_OK) {
+            mem_copy(dup->data, request->data, resp_size);
+        }
 
-    return rc;
+        spin_block(&dup->lock) {
+            dup->time_sent = request->time_sent;
+            dup->time_received = request->time_received;
+            dup->status = rc;
+            dup->request_size = (rc == PLCTAG_STATUS_OK ? resp_size : 0);
+            dup->resp_received = 1;
+        }
+
+        plc_tag_generic_wake_tag(dup->tag_id);
+
+        rc_dec(dup);
+    }
 }
 
 
 /*
- * session_open_socket()
+ * complete_span_requests
  *
- * Connect to the host/port passed via TCP.
+ * Give each read riding on a combined read its part of the data, then cut
+ * the response of the request down to the part its own tag wants.  Error
+ * responses are copied whole.  Returns the new size of the response.
  */
-
-int session_open_socket(ab_session_p session)
+int complete_span_requests(ab_request_p request, int resp_size)
 {
-    int rc = PLCTAG_STATUS_OK;
-    char **server_port = NULL;
-    int port = 0;
+    int data_offset = request->span.data_offset;
+    int data_size = resp_size - data_offset;
 
-    pdebug(DEBUG_INFO, "Starting.");
+    while(request->merged_head) {
+        ab_request_p dup = request->merged_head;
+        int rc = PLCTAG_STATUS_OK;
+        int slice = dup->span.start - request->span.read_start;
+        int dup_size = resp_size;
 
-    /* Open a socket for communication with the gateway. */
-    rc = socket_create(&(session->sock));
+        request->merged_head = dup->merged_next;
+        dup->merged_next = NULL;
 
-    if (rc != PLCTAG_STATUS_OK) {
-        pdebug(DEBUG_WARN, "Unable to create socket for session!");
-        return rc;
-    }
+        if(dup->abort_request) {
+            rc = PLCTAG_ERR_ABORT;
+        }
 
-    server_port = str_split(session->host, ":");
-    if(!server_port) {
-        pdebug(DEBUG_WARN, "Unable to split server and port string!");
-        return PLCTAG_ERR_BAD_CONFIG;
-    }
+        if(rc == PLCTAG_STATUS_OK && resp_size > dup->request_capacity) {
+            rc = session_request_increase_buffer(dup, request->request_capacity);
+        }
 
-    if(server_port[0] == NULL) {
-        pdebug(DEBUG_WARN, "Server string is malformed or empty!");
-        mem_free(server_port);
-        return PLCTAG_ERR_BAD_CONFIG;
-    }
+        if(rc == PLCTAG_STATUS_OK) {
+            if(data_size == request->span.read_size && slice >= 0 && slice + dup->span.size <= data_size) {
+                mem_copy(dup->data, request->data, data_offset);
+                mem_copy(dup->data + data_offset, request->data + data_offset + slice, dup->span.size);
+                dup_size = data_offset + dup->span.size;
+                ((eip_encap *)(dup->data))->encap_length = h2le16((uint16_t)(dup_size - (int)sizeof(eip_encap)));
+            } else {
+                mem_copy(dup->data, request->data, resp_size);
+            }
+        }
 
-    if(server_port[1] != NULL) {
-        rc = str_to_int(server_port[1], &port);
-        if(rc != PLCTAG_STATUS_OK) {
-            pdebug(DEBUG_WARN, "Unable to extract port number from server string \"%s\"!", session->host);
-            mem_free(server_port);
-            return PLCTAG_ERR_BAD_CONFIG;
+        spin_block(&dup->lock) {
+            dup->time_sent = request->time_sent;
+            dup->time_received = request->time_received;
+            dup->status = rc;
+            dup->request_size = (rc == PLCTAG_STATUS_OK ? dup_size : 0);
+            dup->resp_received = 1;
         }
 
-        pdebug(DEBUG_DETAIL, "Using special port %d.", port);
-    } else {
-        port = AB_EIP_DEFAULT_PORT;
+        plc_tag_generic_wake_tag(dup->tag_id);
 
-        pdebug(DEBUG_DETAIL, "Using default port %d.", port);
+        rc_dec(dup);
     }
 
-    rc = socket_connect_tcp(session->sock, server_port[0], port);
-
-    if (rc != PLCTAG_STATUS_OK) {
-        pdebug(DEBUG_WARN, "Unable to connect socket for session!");
-        mem_free(server_port);
-        return rc;
-    }
+    /* now our own part. */
+    if(data_size == request->span.read_size && request->span.read_size != request->span.size) {
+        int slice = request->span.start - request->span.read_start;
 
-    if(server_port) {
-        mem_free(server_port);
+        mem_move(request->data + data_offset, request->data + data_offset + slice, request->span.size);
+        resp_size = data_offset + request->span.size;
+        ((eip_encap *)(request->data))->encap_length = h2le16((uint16_t)(resp_size - (int)sizeof(eip_encap)));
     }
 
-    pdebug(DEBUG_INFO, "Done.");
-
-    return rc;
+    return resp_size;
 }
 
 
-
-int session_register(ab_session_p session)
+/*
+ * Take an aborted request out of its queue and release the session's
+ * reference to it.  If reads were merged into it, the first one still
+ * wanted takes over its place in the queue.  Must be called with the
+ * session mutex held.
+ */
+void discard_aborted_request_unsafe(ab_session_p session, ab_request_p request)
 {
-    eip_session_reg_req *req;
-    eip_encap *resp;
-    int rc = PLCTAG_STATUS_OK;
+    ab_request_p heir = NULL;
 
-    pdebug(DEBUG_INFO, "Starting.");
+    while(request->merged_head && !heir) {
+        ab_request_p dup = request->merged_head;
 
-    /*
-     * clear the session data.
-     *
-     * We use the receiving buffer because we do not have a request and nothing can
-     * be coming in (we hope) on the socket yet.
-     */
-    mem_set(session->data, 0, sizeof(eip_session_reg_req));
+        request->merged_head = dup->merged_next;
+        dup->merged_next = NULL;
 
-    req = (eip_session_reg_req *)(session->data);
+        if(!dup->abort_request) {
+            heir = dup;
+        } else {
+            spin_block(&dup->lock) {
+                dup->status = PLCTAG_ERR_ABORT;
+                dup->request_size = 0;
+                dup->resp_received = 1;
+            }
 
-    /* fill in the fields of the request */
-    req->encap_command = h2le16(AB_EIP_REGISTER_SESSION);
-    req->encap_length = h2le16(sizeof(eip_session_reg_req) - sizeof(eip_encap));
-    req->encap_session_handle = h2le32(session->session_handle);
-    req->encap_status = h2le32(0);
-    req->encap_sender_context = h2le64((uint64_t)0);
-    req->encap_options = h2le32(0);
+            rc_dec(dup);
+        }
+    }
 
-    req->eip_version = h2le16(AB_EIP_VERSION);
-    req->option_flags = h2le16(0);
+    if(heir) {
+        heir->merged_head = request->merged_head;
+        request->merged_head = NULL;
+        heir->deadline = request->deadline;
 
-    /*
-     * socket ops here are _ASYNCHRONOUS_!
-     *
-     * This is done this way because we do not have everything
-     * set up for a request to be handled by the thread.  I think.
-     */
+        /* a coalesced write carries the masks of everything riding on it. */
+        if(request->rmw_mask_size > 0 && request->request_size <= heir->request_capacity) {
+            mem_copy(heir->data, request->data, request->request_size);
+            heir->request_size = request->request_size;
+        }
 
-    /* send registration to the gateway */
-    session->data_size = sizeof(eip_session_reg_req);
-    session->data_offset = 0;
+        /* so does a combined read, it reads the data for all of them. */
+        if(request->span.key && heir->merged_head) {
+            heir->span.read_start = request->span.read_start;
+            heir->span.read_size = request->span.read_size;
 
-    rc = send_eip_request(session, SESSION_DEFAULT_TIMEOUT);
-    if(rc != PLCTAG_STATUS_OK) {
-        pdebug(DEBUG_WARN, "Error sending session registration request %s!", plc_tag_decode_error(rc));
-        return rc;
-    }
+            if(heir->span.encode(heir) != PLCTAG_STATUS_OK && request->request_size <= heir->request_capacity) {
+                mem_copy(heir->data, request->data, request->request_size);
+                heir->request_size = request->request_size;
+            }
+        }
 
-    /* get the response from the gateway */
-    rc = recv_eip_response(session, SESSION_DEFAULT_TIMEOUT);
-    if(rc != PLCTAG_STATUS_OK) {
-        pdebug(DEBUG_WARN, "Error receiving session registration response %s!", plc_tag_decode_error(rc));
-        return rc;
-    }
+        heir->queued_pack_bytes = request->queued_pack_bytes;
+        request->queued_pack_bytes = 0;
 
-    /* encap header is at the start of the buffer */
-    resp = (eip_encap *)(session->data);
+        /* the heir may have been merged from a lower class. */
+        heir->priority = request->priority;
+        heir->time_queued = request->time_queued;
 
-    /* check the response status */
-    if (le2h16(resp->encap_command) != AB_EIP_REGISTER_SESSION) {
-        pdebug(DEBUG_WARN, "EIP unexpected response packet type: %d!", resp->encap_command);
-        return PLCTAG_ERR_BAD_DATA;
-    }
+        request_queue_replace(&(session->requests[request->priority]), request, heir);
 
-    if (le2h32(resp->encap_status) != AB_EIP_OK) {
-        pdebug(DEBUG_WARN, "EIP command failed, response code: %d", le2h32(resp->encap_status));
-        return PLCTAG_ERR_REMOTE_ERR;
+        if(request->merge_listed) {
+            hashtable_remove(session->queued_reads, request->merge_key);
+            request->merge_listed = 0;
+
+            if(hashtable_put(session->queued_reads, request->merge_key, heir) == PLCTAG_STATUS_OK) {
+                heir->merge_key = request->merge_key;
+                heir->merge_listed = 1;
+            }
+        }
+    } else {
+        dequeue_request_unsafe(session, request);
     }
 
-    /*
-     * after all that, save the session handle, we will
-     * use it in future packets.
-     */
-    session->session_handle = le2h32(resp->encap_session_handle);
+    /* set the debug tag to the owning tag. */
+    debug_set_tag_id(request->tag_id);
 
-    pdebug(DEBUG_INFO, "Done.");
+    pdebug(DEBUG_DETAIL, "Session thread releasing aborted request %p.", request);
 
-    return PLCTAG_STATUS_OK;
+    request->status = PLCTAG_ERR_ABORT;
+    request->request_size = 0;
+    request->resp_received = 1;
+
+    /* release our hold on it. */
+    rc_dec(request);
 }
 
 
-int session_unregister(ab_session_p session)
+int process_requests(ab_session_p session)
 {
-    (void)session;
+    int rc = PLCTAG_STATUS_OK;
+    int may_send = 1;
 
-    pdebug(DEBUG_INFO, "Starting.");
+    debug_set_tag_id(0);
 
-    /* nothing to do, perhaps. */
+    pdebug(DEBUG_SPEW, "Starting.");
 
-    pdebug(DEBUG_INFO, "Done.");
+    if(!session) {
+        pdebug(DEBUG_WARN, "Null session pointer!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
 
-    return PLCTAG_STATUS_OK;
-}
+    pdebug(DEBUG_SPEW, "Checking for requests to process.");
 
+    /*
+     * Keep up to max_requests_in_flight packets outstanding.  Each response
+     * is matched back to its packet by the sender context (unconnected) or
+     * the connection sequence number (connected).  Nothing is left in
+     * flight when this returns.
+     */
+    do {
+        while(may_send && session->num_in_flight < session->max_requests_in_flight && !session->terminating) {
+            int sent = 0;
 
+            if(!rate_limit_allows(session)) {
+                break;
+            }
 
-int session_close_socket(ab_session_p session)
-{
-    pdebug(DEBUG_INFO, "Starting.");
+            rc = send_next_bundle(session, &sent);
+            if(rc != PLCTAG_STATUS_OK || !sent) {
+                break;
+            }
+        }
 
-    if (session->sock) {
-        socket_close(session->sock);
-        socket_destroy(&(session->sock));
-        session->sock = NULL;
-    }
+        /* one window at a time on a shared socket so that the other sessions get a turn. */
+        if(session->transport) {
+            may_send = 0;
+        }
 
-    pdebug(DEBUG_INFO, "Done.");
+        if(rc != PLCTAG_STATUS_OK || session->num_in_flight == 0 || session->terminating) {
+            break;
+        }
 
-    return PLCTAG_STATUS_OK;
-}
+        rc = receive_next_response(session);
 
+        /* the PLC answered, start counting failures again. */
+        if(rc == PLCTAG_STATUS_OK) {
+            session->breaker_failures = 0;
+            session->breaker_backoff_ms = 0;
+        }
+    } while(rc == PLCTAG_STATUS_OK);
 
+    /* problem? clean up the pending requests and dump everything. */
+    if(session->num_in_flight > 0) {
+        fail_in_flight_requests(session, (rc != PLCTAG_STATUS_OK ? rc : PLCTAG_ERR_ABORT));
+    }
 
-void session_destroy(void *session_arg)
-{
-    ab_session_p session = session_arg;
+    debug_set_tag_id(0);
 
-    pdebug(DEBUG_INFO, "Starting.");
+    pdebug(DEBUG_SPEW, "Done.");
 
-    if (!session) {
-        pdebug(DEBUG_WARN, "Session ptr is null!");
+    return rc;
+}
 
-        return;
-    }
 
-    /* so remove the session from the list so no one else can reference it. */
-    remove_session(session);
 
-    pdebug(DEBUG_INFO, "Session sent %" PRId64 " packets.", session->packet_count);
+/*
+ * rate_limit_allows
+ *
+ * Refill the token buckets and see if a packet may be sent now.  The
+ * byte bucket may go into debt by one packet, the next packet waits until
+ * it is paid off.  Sets rate_wait_ms to how long the session thread should
+ * wait when it may not.
+ */
 
-    /* terminate the session thread first. */
-    session->terminating = 1;
+int rate_limit_allows(ab_session_p session)
+{
+    int64_t now_us = 0;
+    int64_t elapsed_us = 0;
+    int64_t packet_reserve = 0;
+    int64_t byte_reserve = 0;
+    int64_t wait_us = 0;
+    int high_waiting = 0;
+
+    if(!session->rate_packets_per_sec && !session->rate_bytes_per_sec) {
+        return 1;
+    }
 
-    /* get rid of the handler thread. */
-    pdebug(DEBUG_DETAIL, "Destroying session thread.");
-    if (session->handler_thread) {
-        /* this cannot be guarded by the mutex since the session thread also locks it. */
-        thread_join(session->handler_thread);
+    now_us = time_us();
 
-        /* FIXME - is this critical block needed? */
-        critical_block(session->mutex) {
-            thread_destroy(&(session->handler_thread));
-            session->handler_thread = NULL;
-        }
-    }
+    /* start with full buckets. */
+    elapsed_us = (session->rate_refill_us ? now_us - session->rate_refill_us : INT64_MAX / 2);
+    session->rate_refill_us = now_us;
 
+    session->rate_packet_tokens = rate_refill(session->rate_packet_tokens, elapsed_us, session->rate_packets_per_sec, 1, &packet_reserve);
+    session->rate_byte_tokens = rate_refill(session->rate_byte_tokens, elapsed_us, session->rate_bytes_per_sec, session->max_payload_size, &byte_reserve);
 
-    /* this needs to be handled in the mutex to prevent double frees due to queued requests. */
+    /* high priority requests may use the reserve. */
     critical_block(session->mutex) {
-        /* close off the connection if is one. This helps the PLC clean up. */
-        if (session->targ_connection_id) {
-            /*
-             * we do not want the internal loop to immediately
-             * return, so set the flag like we are not terminating.
-             * There is still a timeout that applies.
-             */
-            session->terminating = 0;
-            perform_forward_close(session);
-            session->terminating = 1;
-        }
-
-        /* try to be nice and un-register the session */
-        if (session->session_handle) {
-            session_unregister(session);
-        }
+        high_waiting = (session->requests[SESSION_PRIORITY_HIGH].head != NULL);
+    }
 
-        if (session->sock) {
-            session_close_socket(session);
-        }
+    if(high_waiting) {
+        packet_reserve = 0;
+        byte_reserve = 0;
+    }
 
-        /* release all the requests that are in the queue. */
-        if (session->requests) {
-            for (int i = 0; i < vector_length(session->requests); i++) {
-                rc_dec(vector_get(session->requests, i));
-            }
+    if(session->rate_packets_per_sec > 0 && session->rate_packet_tokens < SESSION_RATE_UNIT + packet_reserve) {
+        wait_us = (SESSION_RATE_UNIT + packet_reserve - session->rate_packet_tokens) / session->rate_packets_per_sec;
+    }
+
+    if(session->rate_bytes_per_sec > 0 && session->rate_byte_tokens < byte_reserve) {
+        int64_t byte_wait_us = (byte_reserve - session->rate_byte_tokens) / session->rate_bytes_per_sec;
 
-            vector_destroy(session->requests);
-            session->requests = NULL;
+        if(byte_wait_us > wait_us) {
+            wait_us = byte_wait_us;
         }
     }
 
-    /* we are done with the mutex, finally destroy it. */
-    pdebug(DEBUG_DETAIL, "Destroying session mutex.");
-    if(session->mutex) {
-        mutex_destroy(&(session->mutex));
-        session->mutex = NULL;
+    if(wait_us <= 0 && (session->rate_packets_per_sec == 0 || session->rate_packet_tokens >= SESSION_RATE_UNIT + packet_reserve)
+                    && (session->rate_bytes_per_sec == 0 || session->rate_byte_tokens >= byte_reserve)) {
+        session->rate_wait_ms = 0;
+        return 1;
     }
 
-    pdebug(DEBUG_DETAIL, "Cleaning up allocated memory for paths and host name.");
-    if(session->conn_path) {
-        mem_free(session->conn_path);
-        session->conn_path = NULL;
+    session->rate_wait_ms = (int)((wait_us + 999) / 1000);
+    if(session->rate_wait_ms < 1) {
+        session->rate_wait_ms = 1;
     }
 
-    if(session->path) {
-        mem_free(session->path);
-        session->path = NULL;
+    pdebug(DEBUG_SPEW, "Rate limit holds the next packet for %dms.", session->rate_wait_ms);
+
+    return 0;
+}
+
+
+
+/* the bucket holds base units or a tenth of a second of the rate, plus the reserve. */
+int64_t rate_refill(int64_t tokens, int64_t elapsed_us, int rate, int64_t base, int64_t *reserve)
+{
+    int64_t capacity = 0;
+
+    if(rate <= 0) {
+        return 0;
     }
 
-    if(session->host) {
-        mem_free(session->host);
-        session->host = NULL;
+    capacity = rate / SESSION_RATE_BURST_DIVISOR;
+    if(capacity < base) {
+        capacity = base;
     }
 
-    pdebug(DEBUG_INFO, "Done.");
+    capacity *= SESSION_RATE_UNIT;
+    *reserve = (capacity * SESSION_RATE_RESERVE_PCT) / 100;
+    capacity += *reserve;
 
-    return;
+    /* a long idle period fills the bucket, do not overflow getting there. */
+    if(elapsed_us >= capacity / rate) {
+        return capacity;
+    }
+
+    tokens += elapsed_us * rate;
+
+    return (tokens > capacity ? capacity : tokens);
 }
 
 
 
+void rate_limit_charge(ab_session_p session, int packet_bytes)
+{
+    if(session->rate_packets_per_sec > 0) {
+        session->rate_packet_tokens -= SESSION_RATE_UNIT;
+    }
+
+    if(session->rate_bytes_per_sec > 0) {
+        session->rate_byte_tokens -= (int64_t)packet_bytes * SESSION_RATE_UNIT;
+    }
+}
+
+
 
 /*
- * session_add_request_unsafe
+ * send_keepalive
  *
- * You must hold the mutex before calling this!
+ * Keep an idle connection from being dropped by the PLC.  A connected
+ * session queues a read of the Identity vendor ID over the connection,
+ * which restarts the connection timer in the PLC.  The answer, or error,
+ * is thrown away.  An unconnected session only has the TCP connection to
+ * keep, an encapsulation NOP does that and gets no reply.
  */
-int session_add_request_unsafe(ab_session_p session, ab_request_p req)
+
+int send_keepalive(ab_session_p session)
 {
     int rc = PLCTAG_STATUS_OK;
+    int64_t now_ms = 0;
+    int queued = 0;
 
-    pdebug(DEBUG_DETAIL, "Starting.");
+    if(!session->keepalive_ms) {
+        return PLCTAG_STATUS_OK;
+    }
 
-    if(!session) {
-        pdebug(DEBUG_WARN, "Session is null!");
-        return PLCTAG_ERR_NULL_PTR;
+    now_ms = time_ms();
+
+    if(now_ms - session->last_send_ms < session->keepalive_ms) {
+        return PLCTAG_STATUS_OK;
     }
 
-    req = rc_inc(req);
+    critical_block(session->mutex) {
+        queued = session->num_requests;
+    }
 
-    if(!req) {
-        pdebug(DEBUG_WARN, "Request is either null or in the process of being deleted.");
-        return PLCTAG_ERR_NULL_PTR;
+    /* real traffic is about to go out. */
+    if(queued > 0) {
+        return PLCTAG_STATUS_OK;
     }
 
-    /* make sure the request points to the session */
+    pdebug(DEBUG_DETAIL, "Connection idle for %" PRId64 "ms, sending keepalive.", now_ms - session->last_send_ms);
+
+    if(session->use_connected_msg) {
+        ab_request_p req = NULL;
+        eip_cip_co_req *cip = NULL;
+        uint8_t *data = NULL;
+        static uint8_t identity_vendor_id[] = { AB_EIP_CMD_CIP_GET_ATTR_SINGLE, 0x03, 0x20, 0x01, 0x24, 0x01, 0x30, 0x01 };
 
-    /* insert into the requests vector */
-    vector_put(session->requests, vector_length(session->requests), req);
+        rc = session_create_request(session, 0, SESSION_PRIORITY_LOW, now_ms + session->keepalive_ms, &req);
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Unable to get a keepalive request %s!", plc_tag_decode_error(rc));
+            return PLCTAG_STATUS_OK;
+        }
 
-    pdebug(DEBUG_DETAIL, "Total requests in the queue: %d", vector_length(session->requests));
+        cip = (eip_cip_co_req *)(req->data);
+        data = req->data + sizeof(eip_cip_co_req);
 
-    pdebug(DEBUG_DETAIL, "Done.");
+        mem_copy(data, identity_vendor_id, (int)sizeof(identity_vendor_id));
+        data += sizeof(identity_vendor_id);
+
+        cip->encap_command = h2le16(AB_EIP_CONNECTED_SEND);
+        cip->router_timeout = h2le16(1);
+        cip->cpf_item_count = h2le16(2);
+        cip->cpf_cai_item_type = h2le16(AB_EIP_ITEM_CAI);
+        cip->cpf_cai_item_length = h2le16(4);
+        cip->cpf_cdi_item_type = h2le16(AB_EIP_ITEM_CDI);
+        cip->cpf_cdi_item_length = h2le16((uint16_t)(data - (uint8_t *)(&cip->cpf_conn_seq_num)));
+
+        req->request_size = (int)(data - req->data);
+        req->allow_packing = 1;
+
+        /* the session holds the request until it is answered or expires. */
+        rc = session_add_request(session, req);
+        rc_dec(req);
+
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Unable to queue keepalive request %s!", plc_tag_decode_error(rc));
+            rc = PLCTAG_STATUS_OK;
+        }
+
+        /* do not queue another while this one is out. */
+        session->last_send_ms = now_ms;
+    } else {
+        eip_encap *nop = (eip_encap *)(session->data);
+
+        mem_set(session->data, 0, (int)sizeof(eip_encap));
+
+        nop->encap_command = h2le16(AB_EIP_NOP);
+        nop->encap_length = h2le16(0);
+        nop->encap_session_handle = h2le32(session->session_handle);
+
+        session->data_size = (uint32_t)sizeof(eip_encap);
+        session->data_offset = 0;
+
+        rc = send_eip_request(session, SESSION_DEFAULT_TIMEOUT);
+    }
 
     return rc;
 }
 
+
+
 /*
- * session_add_request
+ * default_requests_in_flight
  *
- * This is a thread-safe version of the above routine.
+ * The window used when no tag sets max_requests_in_flight.  Logix packs
+ * requests into one packet and only needs one outstanding.  PLCs that
+ * cannot pack would get one request per round trip, so they keep several
+ * packets outstanding instead.
  */
-int session_add_request(ab_session_p sess, ab_request_p req)
-{
-    int rc = PLCTAG_STATUS_OK;
 
-    pdebug(DEBUG_INFO, "Starting. sess=%p, req=%p", sess, req);
-
-    critical_block(sess->mutex) {
-        rc = session_add_request_unsafe(sess, req);
+int default_requests_in_flight(ab_session_p session)
+{
+    /* DH+ is slow, keep several PCCC transactions going through the bridge. */
+    if(session->dhp_dest != 0) {
+        return SESSION_DHP_REQUESTS_IN_FLIGHT;
     }
 
-    pdebug(DEBUG_INFO, "Done.");
+    switch(session->plc_type) {
+        case AB_PLC_MLGX800:
+            return SESSION_MICRO800_REQUESTS_IN_FLIGHT;
 
-    return rc;
+        case AB_PLC_PLC5:
+        case AB_PLC_SLC:
+        case AB_PLC_MLGX:
+        case AB_PLC_LGX_PCCC:
+            return SESSION_PCCC_REQUESTS_IN_FLIGHT;
+
+        default:
+            return 1;
+    }
 }
 
 
+
 /*
- * session_remove_request_unsafe
+ * send_next_bundle
  *
- * You must hold the mutex before calling this!
+ * Pull as many requests off the queue as fit in one packet and send it.
+ * The packet is then tracked in the session's in flight table.
  */
-int session_remove_request_unsafe(ab_session_p session, ab_request_p req)
+
+int send_next_bundle(ab_session_p session, int *sent)
 {
     int rc = PLCTAG_STATUS_OK;
-//    ab_request_p cur, prev;
+    ab_in_flight_t *slot = &(session->in_flight[session->num_in_flight]);
+    int payload_used = 0;
 
-    pdebug(DEBUG_INFO, "Starting.");
+    *sent = 0;
 
-    if(session == NULL || req == NULL) {
-        return rc;
+    session->data_size = 0;
+    session->data_offset = 0;
+
+    slot->num_requests = 0;
+
+    /* is someone in the middle of queuing a batch? */
+    if(atomic_get(&session_request_hold) > 0) {
+        pdebug(DEBUG_SPEW, "Requests are on hold.");
+        return PLCTAG_STATUS_OK;
     }
 
-    for(int i=0; i < vector_length(session->requests); i++) {
-        if(vector_get(session->requests, i) == req) {
-            vector_remove(session->requests, i);
-            break;
+    /* grab a request off the front of the list. */
+    critical_block(session->mutex) {
+        /* is there anything to do? */
+        if(session->num_requests) {
+            payload_used = plan_next_bundle_unsafe(session, slot);
+
+            if(slot->num_requests == 0) {
+                pdebug(DEBUG_DETAIL, "All requests in queue were aborted, nothing to do.");
+            }
         }
     }
 
-    /* release the request refcount */
-    rc_dec(req);
+    /* output debug display as no particular tag. */
+    debug_set_tag_id(0);
 
-    pdebug(DEBUG_INFO, "Done.");
+    if(slot->num_requests == 0) {
+        return PLCTAG_STATUS_OK;
+    }
 
-    return rc;
-}
+    pdebug(DEBUG_INFO, "%d requests to process.", slot->num_requests);
+
+    do {
+        int64_t pack_start_ns = (tag_cpu_accounting ? time_ns() : 0);
+
+        /* copy and pack the requests into the session buffer. */
+        rc = pack_requests(session, slot->requests, slot->num_requests);
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Error while packing requests, %s!", plc_tag_decode_error(rc));
+            break;
+        }
 
+        /* fill in all the necessary parts to the request. */
+        if((rc = prepare_request(session)) != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Unable to prepare request, %s!", plc_tag_decode_error(rc));
+            break;
+        }
 
+        /* the packet is shared, so each request gets an equal part of the cost. */
+        if(pack_start_ns) {
+            int64_t pack_ns = time_ns() - pack_start_ns;
 
-/*****************************************************************
- **************** Session handling functions *********************
- ****************************************************************/
+            metrics_add(session->metrics, METRIC_CPU_US, pack_ns / 1000);
 
+            for(int i=0; i < slot->num_requests; i++) {
+                plc_tag_generic_add_cpu(slot->requests[i]->tag_id, 0, pack_ns / slot->num_requests);
+            }
+        }
 
-typedef enum { SESSION_OPEN_SOCKET, SESSION_REGISTER, SESSION_SEND_FORWARD_OPEN,
-               SESSION_RECEIVE_FORWARD_OPEN, SESSION_IDLE, SESSION_DISCONNECT,
-               SESSION_UNREGISTER, SESSION_CLOSE_SOCKET, SESSION_START_RETRY,
-               SESSION_WAIT_RETRY, SESSION_WAIT_RECONNECT
-             } session_state_t;
+        /* remember how the response will be labelled. */
+        if(le2h16(((eip_encap *)(session->data))->encap_command) == AB_EIP_UNCONNECTED_SEND) {
+            slot->is_connected = 0;
+            slot->seq_id = session->session_seq_id;
+        } else {
+            slot->is_connected = 1;
+            slot->seq_id = session->conn_seq_num;
+        }
 
+        /* send the request */
+        if((rc = send_eip_request(session, SESSION_DEFAULT_TIMEOUT)) != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Error sending packet %s!", plc_tag_decode_error(rc));
+            break;
+        }
+    } while(0);
 
-THREAD_FUNC(session_handler)
-{
-    ab_session_p session = arg;
-    int rc = PLCTAG_STATUS_OK;
-    session_state_t state = SESSION_OPEN_SOCKET;
-    int64_t timeout_time = 0;
-    int64_t auto_disconnect_time = time_ms() + SESSION_DISCONNECT_TIMEOUT;
-    int auto_disconnect = 0;
+    /* do not leave a half built packet behind for the next send. */
+    session->num_send_bufs = 0;
 
+    if(rc != PLCTAG_STATUS_OK) {
+        /* take the whole table down with it. */
+        session->num_in_flight++;
+        return rc;
+    }
 
-    pdebug(DEBUG_INFO, "Starting thread for session %p", session);
+    slot->time_sent = time_us();
 
-    while(!session->terminating) {
-        int idle = 0;
+    rate_limit_charge(session, (int)session->data_size);
 
-        /*
-         * Do this on every cycle.   This keeps the queue clean(ish).
-         *
-         * Make sure we get rid of all the aborted requests queued.
-         * This keeps the overall memory usage lower.
-         */
+    session->num_in_flight++;
+    session->num_requests_in_flight += slot->num_requests;
 
-        pdebug(DEBUG_SPEW,"Critical block.");
-        critical_block(session->mutex) {
-            purge_aborted_requests_unsafe(session);
-        }
+    metrics_add(session->metrics, METRIC_REQUESTS_SENT, slot->num_requests);
+    metrics_add(session->metrics, METRIC_PACKED_BYTES, payload_used);
+    metrics_add(session->metrics, METRIC_PACKET_CAPACITY_BYTES, session->max_payload_size);
+    metrics_set(session->metrics, METRIC_IN_FLIGHT, session->num_requests_in_flight);
 
-        switch(state) {
-        case SESSION_OPEN_SOCKET:
-            pdebug(DEBUG_DETAIL, "in SESSION_OPEN_SOCKET state.");
+    *sent = 1;
 
-            /* we must connect to the gateway*/
-            if ((rc = session_open_socket(session)) != PLCTAG_STATUS_OK) {
-                pdebug(DEBUG_WARN, "session connect failed %s!", plc_tag_decode_error(rc));
-                state = SESSION_CLOSE_SOCKET;
-            } else {
-                /* set the timeout for disconnect. */
-                //if(session->auto_disconnect_enabled) {
-                auto_disconnect_time = time_ms() + SESSION_DISCONNECT_TIMEOUT;
-                //}
+    return PLCTAG_STATUS_OK;
+}
 
-                state = SESSION_REGISTER;
-            }
-            break;
 
-        case SESSION_REGISTER:
-            pdebug(DEBUG_DETAIL, "in SESSION_REGISTER state.");
 
-            if ((rc = session_register(session)) != PLCTAG_STATUS_OK) {
-                pdebug(DEBUG_WARN, "session registration failed %s!", plc_tag_decode_error(rc));
-                state = SESSION_CLOSE_SOCKET;
-            } else {
-                if(session->use_connected_msg) {
-                    state = SESSION_SEND_FORWARD_OPEN;
-                } else {
-                    state = SESSION_IDLE;
-                }
-            }
-            break;
+/*
+ * plan_next_bundle_unsafe
+ *
+ * Pick the requests for the next packet.  Each priority class has its own
+ * FIFO.  A request's effective priority is its class plus one for every
+ * SESSION_PRIORITY_AGING_US it has been queued, so old low priority work
+ * eventually goes ahead of new high priority work.  The queues are
+ * visited in order of the effective priority of their oldest request.
+ *
+ * The first request of the best queue always goes first so that nothing
+ * starves.  If it can be packed, the queues are scanned first-fit for
+ * packable requests that still fit.  Requests that do not fit stay
+ * queued, in order, for the next packet, so a deep queue goes out as
+ * back to back full packets.  At most SESSION_MAX_PACK_SCAN requests
+ * that do not fit are looked past, so planning stays cheap with a very
+ * deep queue.  Aborted and expired requests met along the way are dropped.
+ *
+ * Returns the number of payload bytes used.  Must be called with the
+ * session mutex held.
+ */
 
-        case SESSION_SEND_FORWARD_OPEN:
-            pdebug(DEBUG_DETAIL, "in SESSION_SEND_FORWARD_OPEN state.");
+int plan_next_bundle_unsafe(ab_session_p session, ab_in_flight_t *slot)
+{
+    int remaining_space = session->max_payload_size - (int)sizeof(cip_multi_req_header);
+    int64_t now = time_us();
+    int order[SESSION_NUM_PRIORITIES];
+    int64_t effective[SESSION_NUM_PRIORITIES];
+    int num_queues = 0;
+    int num_skipped = 0;
+    ab_request_p request = NULL;
 
-            if((rc = send_forward_open_request(session)) != PLCTAG_STATUS_OK) {
-                pdebug(DEBUG_WARN, "Send Forward Open failed %s!", plc_tag_decode_error(rc));
-                state = SESSION_UNREGISTER;
-            } else {
-                pdebug(DEBUG_DETAIL, "Send Forward Open succeeded, going to SESSION_RECEIVE_FORWARD_OPEN state.");
-                state = SESSION_RECEIVE_FORWARD_OPEN;
-            }
-            break;
+    /* order the non-empty queues, highest effective priority first, ties to the higher class. */
+    for(int p = SESSION_NUM_PRIORITIES - 1; p >= 0; p--) {
+        int64_t eff = 0;
+        int pos = num_queues;
 
-        case SESSION_RECEIVE_FORWARD_OPEN:
-            pdebug(DEBUG_DETAIL, "in SESSION_RECEIVE_FORWARD_OPEN state.");
+        while(session->requests[p].head && drop_dead_request_unsafe(session, session->requests[p].head, now / 1000)) {
+            /* nothing */
+        }
 
-            if((rc = receive_forward_open_response(session)) != PLCTAG_STATUS_OK) {
-                if(rc == PLCTAG_ERR_DUPLICATE) {
-                    pdebug(DEBUG_DETAIL, "Duplicate connection error received, trying again with different connection ID.");
-                    state = SESSION_SEND_FORWARD_OPEN;
-                } else if(rc == PLCTAG_ERR_TOO_LARGE) {
-                    pdebug(DEBUG_DETAIL, "Requested packet size too large, retrying with smaller size.");
-                    state = SESSION_SEND_FORWARD_OPEN;
-                } else if(rc == PLCTAG_ERR_UNSUPPORTED && !session->only_use_old_forward_open) {
-                    /* if we got an unsupported error and we are trying with ForwardOpenEx, then try the old command. */
-                    pdebug(DEBUG_DETAIL, "PLC does not support ForwardOpenEx, trying old ForwardOpen.");
-                    session->only_use_old_forward_open = 1;
-                    state = SESSION_SEND_FORWARD_OPEN;
-                } else {
-                    pdebug(DEBUG_WARN, "Receive Forward Open failed %s!", plc_tag_decode_error(rc));
-                    state = SESSION_UNREGISTER;
-                }
-            } else {
-                pdebug(DEBUG_DETAIL, "Send Forward Open succeeded, going to SESSION_IDLE state.");
-                state = SESSION_IDLE;
-            }
-            break;
+        request = session->requests[p].head;
+        if(!request) {
+            continue;
+        }
 
-        case SESSION_IDLE:
-            pdebug(DEBUG_SPEW, "in SESSION_IDLE state.");
+        eff = p + ((now - request->time_queued) / SESSION_PRIORITY_AGING_US);
 
-            idle = 1;
+        while(pos > 0 && effective[pos - 1] < eff) {
+            order[pos] = order[pos - 1];
+            effective[pos] = effective[pos - 1];
+            pos--;
+        }
 
-            /* if there is work to do, make sure we do not disconnect. */
-            pdebug(DEBUG_SPEW,"Critical block.");
-            critical_block(session->mutex) {
-                if(vector_length(session->requests) > 0) {
-                    auto_disconnect_time = time_ms() + SESSION_DISCONNECT_TIMEOUT;
-                }
-            }
+        order[pos] = p;
+        effective[pos] = eff;
+        num_queues++;
+    }
 
-            if((rc = process_requests(session)) != PLCTAG_STATUS_OK) {
-                pdebug(DEBUG_WARN, "Error while processing requests %s!", plc_tag_decode_error(rc));
-                idle = 0;
-                if(session->use_connected_msg) {
-                    state = SESSION_DISCONNECT;
-                } else {
-                    state = SESSION_UNREGISTER;
-                }
-            }
+    if(num_queues == 0) {
+        return 0;
+    }
 
-            /* check if we should disconnect */
-            //if(session->auto_disconnect_enabled) {
-            if(auto_disconnect_time < time_ms()) {
-                pdebug(DEBUG_DETAIL, "Disconnecting due to inactivity.");
+    request = session->requests[order[0]].head;
+    dequeue_request_unsafe(session, request);
 
-                auto_disconnect = 1;
-                idle = 0;
+    slot->requests[0] = request;
+    slot->num_requests = 1;
 
-                if(session->use_connected_msg) {
-                    state = SESSION_DISCONNECT;
-                } else {
-                    state = SESSION_UNREGISTER;
-                }
-            }
-            //}
+    remaining_space -= get_payload_size(request);
 
-            break;
+    if(request->allow_packing) {
+        for(int q = 0; q < num_queues && slot->num_requests < MAX_REQUESTS && remaining_space > 0 && num_skipped < SESSION_MAX_PACK_SCAN; q++) {
+            ab_request_queue_t *queue = &(session->requests[order[q]]);
 
-        case SESSION_DISCONNECT:
-            pdebug(DEBUG_DETAIL, "in SESSION_DISCONNECT state.");
+            request = queue->head;
 
-            if((rc = perform_forward_close(session)) != PLCTAG_STATUS_OK) {
-                pdebug(DEBUG_WARN, "Forward close failed %s!", plc_tag_decode_error(rc));
-            }
+            while(request && slot->num_requests < MAX_REQUESTS && remaining_space > 0 && num_skipped < SESSION_MAX_PACK_SCAN) {
+                ab_request_p next = request->queue_next;
+                int payload_size = 0;
 
-            state = SESSION_UNREGISTER;
-            break;
+                if(drop_dead_request_unsafe(session, request, now / 1000)) {
+                    request = next;
+                    continue;
+                }
 
-        case SESSION_UNREGISTER:
-            pdebug(DEBUG_DETAIL, "in SESSION_UNREGISTER state.");
+                payload_size = get_payload_size(request);
 
-            if((rc = session_unregister(session)) != PLCTAG_STATUS_OK) {
-                pdebug(DEBUG_WARN, "Unregistering session failed %s!", plc_tag_decode_error(rc));
-            }
+                if(request->allow_packing && payload_size < remaining_space) {
+                    slot->requests[slot->num_requests] = request;
+                    slot->num_requests++;
 
-            state = SESSION_CLOSE_SOCKET;
-            break;
+                    remaining_space -= payload_size;
 
-        case SESSION_CLOSE_SOCKET:
-            pdebug(DEBUG_DETAIL, "in SESSION_CLOSE_SOCKET state.");
+                    dequeue_request_unsafe(session, request);
+                } else {
+                    num_skipped++;
+                }
 
-            if((rc = session_close_socket(session)) != PLCTAG_STATUS_OK) {
-                pdebug(DEBUG_WARN, "Closing session socket failed %s!", plc_tag_decode_error(rc));
+                request = next;
             }
+        }
+    }
 
-            if(auto_disconnect) {
-                state = SESSION_WAIT_RECONNECT;
-            } else {
-                state = SESSION_START_RETRY;
-            }
+    pdebug(DEBUG_DETAIL, "Planned %d requests with %d bytes of space left.", slot->num_requests, remaining_space);
 
-            break;
+    if(remaining_space < 0) {
+        return session->max_payload_size;
+    }
 
-        case SESSION_START_RETRY:
-            pdebug(DEBUG_DETAIL, "in SESSION_START_RETRY state.");
+    return session->max_payload_size - remaining_space;
+}
 
-            /* set up timer for retry. */
-            idle = 0;
 
-            /* FIXME - make this a tag attribute. */
-            timeout_time = time_ms() + RETRY_WAIT_MS;
 
-            /* start waiting. */
-            state = SESSION_WAIT_RETRY;
+/*
+ * receive_next_response
+ *
+ * Wait for the next response, find the packet it answers and hand the
+ * results back to the requests in that packet.
+ */
 
-            break;
+int receive_next_response(ab_session_p session)
+{
+    int rc = PLCTAG_STATUS_OK;
+    ab_in_flight_t *slot = NULL;
+    uint64_t seq_id = 0;
+    int is_connected = 0;
+    int64_t time_received = 0;
 
-        case SESSION_WAIT_RETRY:
-            pdebug(DEBUG_SPEW, "in SESSION_WAIT_RETRY state.");
+    /* wait for the response */
+    rc = recv_eip_response(session, SESSION_DEFAULT_TIMEOUT, 1);
 
-            /* make us sleep on each iteration. */
-            idle = 1;
+    /* everything in flight expired, stop waiting. */
+    if(rc == PLCTAG_STATUS_PENDING) {
+        return PLCTAG_STATUS_OK;
+    }
 
-            if(timeout_time < time_ms()) {
-                pdebug(DEBUG_DETAIL, "Transitioning to SESSION_OPEN_SOCKET.");
-                state = SESSION_OPEN_SOCKET;
-            }
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Error receiving packet response %s!", plc_tag_decode_error(rc));
+        return rc;
+    }
 
-            break;
+    time_received = time_us();
 
-        case SESSION_WAIT_RECONNECT:
-            /* wait for at least one request to queue before reconnecting. */
-            pdebug(DEBUG_SPEW, "in SESSION_WAIT_RECONNECT state.");
+    if(le2h16(((eip_encap *)(session->data))->encap_command) == AB_EIP_CONNECTED_SEND) {
+        is_connected = 1;
+        seq_id = le2h16(((eip_cip_co_resp *)(session->data))->cpf_conn_seq_num);
 
-            idle = 1;
-            auto_disconnect = 0;
+        /* a late response on a shared socket can be for another session's connection. */
+        if(session->transport && le2h32(((eip_cip_co_resp *)(session->data))->cpf_orig_conn_id) != session->orig_connection_id) {
+            pdebug(DEBUG_WARN, "Response for connection %x is not for this session, dropping it.", le2h32(((eip_cip_co_resp *)(session->data))->cpf_orig_conn_id));
+            return PLCTAG_STATUS_OK;
+        }
+    } else {
+        seq_id = session->resp_seq_id;
+    }
 
-            /* if there is work to do, reconnect.. */
-            pdebug(DEBUG_SPEW,"Critical block.");
-            critical_block(session->mutex) {
-                if(vector_length(session->requests) > 0) {
-                    pdebug(DEBUG_DETAIL, "There are requests waiting, reopening connection to PLC.");
+    for(int i=0; i < session->num_in_flight; i++) {
+        if(session->in_flight[i].is_connected == is_connected && session->in_flight[i].seq_id == seq_id) {
+            slot = &(session->in_flight[i]);
+            break;
+        }
+    }
 
-                    idle = 0;
-                    state = SESSION_OPEN_SOCKET;
+    if(!slot) {
+        pdebug(DEBUG_WARN, "Response with sequence ID %" PRIu64 " does not match any request in flight, dropping it.", seq_id);
+        return PLCTAG_STATUS_OK;
+    }
+
+    for(int i=0; i < slot->num_requests; i++) {
+        if(slot->requests[i]) {
+            slot->requests[i]->time_sent = slot->time_sent;
+            slot->requests[i]->time_received = time_received;
+        }
+    }
+
+    do {
+        /*
+         * check the CIP status, but only if this is a bundled
+         * response.   If it is a singleton, then we pass the
+         * status back to the tag.
+         */
+        if(slot->num_requests > 1) {
+            if(le2h16(((eip_encap *)(session->data))->encap_command) == AB_EIP_UNCONNECTED_SEND) {
+                eip_cip_uc_resp *resp = (eip_cip_uc_resp *)(session->data);
+                pdebug(DEBUG_INFO, "Received unconnected packet with session sequence ID %llx", resp->encap_sender_context);
+
+                /* punt if we got an overall error or it is not a partial/bundled error. */
+                if(resp->status != AB_EIP_OK && resp->status != AB_CIP_ERR_PARTIAL_ERROR) {
+                    rc = decode_cip_error_code(&(resp->status));
+                    pdebug(DEBUG_WARN, "Command failed! (%d/%d) %s", resp->status, rc, plc_tag_decode_error(rc));
+                    break;
+                }
+            } else if(le2h16(((eip_encap *)(session->data))->encap_command) == AB_EIP_CONNECTED_SEND) {
+                eip_cip_co_resp *resp = (eip_cip_co_resp *)(session->data);
+                pdebug(DEBUG_INFO, "Received connected packet with connection ID %x and sequence ID %u(%x)", le2h32(resp->cpf_orig_conn_id), le2h16(resp->cpf_conn_seq_num), le2h16(resp->cpf_conn_seq_num));
+
+                /* punt if we got an overall error or it is not a partial/bundled error. */
+                if(resp->status != AB_EIP_OK && resp->status != AB_CIP_ERR_PARTIAL_ERROR) {
+                    rc = decode_cip_error_code(&(resp->status));
+                    pdebug(DEBUG_WARN, "Command failed! (%d/%d) %s", resp->status, rc, plc_tag_decode_error(rc));
+                    break;
                 }
             }
+        }
 
-            break;
+        /* copy the results back out. Every request gets a copy. */
+        for(int i=0; i < slot->num_requests; i++) {
+            /* expired while waiting, the caller has the timeout already. */
+            if(!slot->requests[i]) {
+                continue;
+            }
 
+            debug_set_tag_id(slot->requests[i]->tag_id);
 
-        default:
-            pdebug(DEBUG_ERROR, "Unknown state %d!", state);
+            plctag_trace2(unpack_response, slot->requests[i]->tag_id, i);
 
-            /* FIXME - this logic is not complete.  We might be here without
-             * a connected session or a registered session. */
-            if(session->use_connected_msg) {
-                state = SESSION_DISCONNECT;
+            if(tag_cpu_accounting) {
+                int64_t unpack_start_ns = time_ns();
+                int64_t unpack_ns = 0;
+
+                rc = unpack_response(session, slot->requests[i], i);
+
+                unpack_ns = time_ns() - unpack_start_ns;
+
+                metrics_add(session->metrics, METRIC_CPU_US, unpack_ns / 1000);
+                plc_tag_generic_add_cpu(slot->requests[i]->tag_id, 0, unpack_ns);
             } else {
-                state = SESSION_UNREGISTER;
+                rc = unpack_response(session, slot->requests[i], i);
             }
 
-            break;
-        }
+            if(rc != PLCTAG_STATUS_OK) {
+                pdebug(DEBUG_WARN, "Unable to unpack response!");
+                break;
+            }
 
-        /*
-         * give up the CPU a bit, but only if we are not
-         * doing some linked states.
-         */
-        if(idle && !session->terminating) {
-            sleep_ms(1);
+            /* tell the tag that the response is in. */
+            plc_tag_generic_wake_tag(slot->requests[i]->tag_id);
+
+            /* release our reference */
+            slot->requests[i] = rc_dec(slot->requests[i]);
         }
+    } while(0);
+
+    debug_set_tag_id(0);
+
+    /* the tags now own the parts of the buffer they were given. */
+    session_release_lent_data(session);
+
+    if(rc != PLCTAG_STATUS_OK) {
+        /* the remaining requests are failed with the rest of the table. */
+        return rc;
     }
 
-    /*
-     * One last time before we exit.
-     */
-    pdebug(DEBUG_SPEW,"Critical block.");
-    critical_block(session->mutex) {
-        purge_aborted_requests_unsafe(session);
+    /* free the slot by moving the last one into it. */
+    session->num_requests_in_flight -= slot->num_requests;
+    session->num_in_flight--;
+
+    if(slot != &(session->in_flight[session->num_in_flight])) {
+        *slot = session->in_flight[session->num_in_flight];
     }
 
-    THREAD_RETURN(0);
+    metrics_set(session->metrics, METRIC_IN_FLIGHT, session->num_requests_in_flight);
+
+    return PLCTAG_STATUS_OK;
 }
 
 
 
 /*
- * This must be called with the session mutex held!
+ * fail_in_flight_requests
+ *
+ * Give every request that is still waiting for a response the passed
+ * error status.
  */
-int purge_aborted_requests_unsafe(ab_session_p session)
+
+void fail_in_flight_requests(ab_session_p session, int status)
 {
-    int purge_count = 0;
-    ab_request_p request = NULL;
+    for(int i=0; i < session->num_in_flight; i++) {
+        ab_in_flight_t *slot = &(session->in_flight[i]);
 
-    pdebug(DEBUG_SPEW, "Starting.");
+        for(int j=0; j < slot->num_requests; j++) {
+            if(slot->requests[j]) {
+                complete_merged_requests(slot->requests[j], status, 0);
+
+                slot->requests[j]->status = status;
+                slot->requests[j]->request_size = 0;
+                slot->requests[j]->resp_received = 1;
+
+                plc_tag_generic_wake_tag(slot->requests[j]->tag_id);
 
-    /* remove the aborted requests. */
-    for(int i=0; i < vector_length(session->requests); i++) {
-        request = vector_get(session->requests, i);
+                slot->requests[j] = rc_dec(slot->requests[j]);
+            }
+        }
 
-        /* filter out the aborts. */
-        if(request && request->abort_request) {
-            purge_count++;
+        slot->num_requests = 0;
+    }
 
-            /* remove it from the queue. */
-            vector_remove(session->requests, i);
+    session->num_in_flight = 0;
+    session->num_requests_in_flight = 0;
 
-            /* set the debug tag to the owning tag. */
-            debug_set_tag_id(request->tag_id);
+    metrics_set(session->metrics, METRIC_IN_FLIGHT, 0);
+}
 
-            pdebug(DEBUG_DETAIL, "Session thread releasing aborted request %p.", request);
 
-            request->status = PLCTAG_ERR_ABORT;
-            request->request_size = 0;
-            request->resp_received = 1;
 
-            /* release our hold on it. */
-            request = rc_dec(request);
+/*
+ * fail_queued_requests_unsafe
+ *
+ * Give every request waiting to be sent the passed error status.  The
+ * session mutex must be held.
+ */
 
-            /* vector size has changed, back up one. */
-            i--;
+void fail_queued_requests_unsafe(ab_session_p session, int status)
+{
+    for(int p=0; p < SESSION_NUM_PRIORITIES; p++) {
+        while(session->requests[p].head) {
+            fail_queued_request_unsafe(session, session->requests[p].head, status);
         }
     }
+}
 
-    if(purge_count > 0) {
-        pdebug(DEBUG_DETAIL, "Removed %d aborted requests.", purge_count);
+
+
+void fail_queued_request_unsafe(ab_session_p session, ab_request_p req, int status)
+{
+    dequeue_request_unsafe(session, req);
+    complete_merged_requests(req, status, 0);
+
+    spin_block(&req->lock) {
+        req->status = status;
+        req->request_size = 0;
+        req->resp_received = 1;
     }
 
-    pdebug(DEBUG_SPEW, "Done.");
+    plc_tag_generic_wake_tag(req->tag_id);
 
-    return purge_count;
+    rc_dec(req);
 }
 
 
-int process_requests(ab_session_p session)
+
+/*
+ * expire_in_flight_requests
+ *
+ * Time out the requests in flight whose deadline has passed.  Their
+ * packets stay in flight while anything else is waiting on them, a late
+ * response for a packet no one waits on is dropped.  Returns the number
+ * of packets still in flight.
+ */
+
+int expire_in_flight_requests(ab_session_p session)
 {
-    int rc = PLCTAG_STATUS_OK;
-    ab_request_p request = NULL;
-    ab_request_p bundled_requests[MAX_REQUESTS] = {NULL};
-    int num_bundled_requests = 0;
-    int remaining_space = 0;
+    int64_t now = time_ms();
+    int i = 0;
 
-    debug_set_tag_id(0);
+    while(i < session->num_in_flight) {
+        ab_in_flight_t *slot = &(session->in_flight[i]);
+        int live = 0;
 
-    pdebug(DEBUG_SPEW, "Starting.");
+        for(int j=0; j < slot->num_requests; j++) {
+            ab_request_p req = slot->requests[j];
 
-    if(!session) {
-        pdebug(DEBUG_WARN, "Null session pointer!");
-        return PLCTAG_ERR_NULL_PTR;
+            if(!req) {
+                continue;
+            }
+
+            if(req->deadline && req->deadline <= now && !req->abort_request) {
+                metrics_add(session->metrics, METRIC_REQUESTS_EXPIRED, 1);
+                complete_merged_requests(req, PLCTAG_ERR_TIMEOUT, 0);
+
+                spin_block(&req->lock) {
+                    req->status = PLCTAG_ERR_TIMEOUT;
+                    req->request_size = 0;
+                    req->resp_received = 1;
+                }
+
+                plc_tag_generic_wake_tag(req->tag_id);
+
+                slot->requests[j] = rc_dec(req);
+            } else if(!req->abort_request) {
+                live++;
+            }
+        }
+
+        if(live > 0) {
+            i++;
+            continue;
+        }
+
+        /* no one is waiting, give the slot up. */
+        for(int j=0; j < slot->num_requests; j++) {
+            if(slot->requests[j]) {
+                slot->requests[j] = rc_dec(slot->requests[j]);
+            }
+        }
+
+        session->num_requests_in_flight -= slot->num_requests;
+        session->num_in_flight--;
+
+        if(slot != &(session->in_flight[session->num_in_flight])) {
+            *slot = session->in_flight[session->num_in_flight];
+        }
+
+        metrics_set(session->metrics, METRIC_IN_FLIGHT, session->num_requests_in_flight);
     }
 
-    pdebug(DEBUG_SPEW, "Checking for requests to process.");
+    return session->num_in_flight;
+}
 
-    rc = PLCTAG_STATUS_OK;
-    request = NULL;
-    session->data_size = 0;
-    session->data_offset = 0;
 
-    /* grab a request off the front of the list. */
-    critical_block(session->mutex) {
-        /* is there anything to do? */
-        if(vector_length(session->requests)) {
-            /* get rid of all aborted requests. */
-            purge_aborted_requests_unsafe(session);
 
-            /* if there are still requests after purging all the aborted requests, process them. */
+/*
+ * drop_dead_request_unsafe
+ *
+ * Take a queued request out if it was aborted or its deadline passed.
+ * Returns 1 if it was dropped.
+ */
 
-            /* how much space do we have to work with. */
-            remaining_space = session->max_payload_size - (int)sizeof(cip_multi_req_header);
+int drop_dead_request_unsafe(ab_session_p session, ab_request_p req, int64_t now_ms)
+{
+    if(req->abort_request) {
+        discard_aborted_request_unsafe(session, req);
+        return 1;
+    }
 
-            if(vector_length(session->requests)) {
-                do {
-                    request = vector_get(session->requests, 0);
+    if(req->deadline && req->deadline <= now_ms) {
+        pdebug(DEBUG_DETAIL, "Dropping request for tag %d, its deadline passed.", req->tag_id);
+        metrics_add(session->metrics, METRIC_REQUESTS_EXPIRED, 1);
+        fail_queued_request_unsafe(session, req, PLCTAG_ERR_TIMEOUT);
+        return 1;
+    }
 
-                    remaining_space = remaining_space - get_payload_size(request);
+    return 0;
+}
 
-                    /*
-                     * If we have a non-packable request, only queue it if it is the first one.
-                     * If the request is packable, keep queuing as long as there is space.
-                     */
 
-                    if(num_bundled_requests == 0 || (request->allow_packing && remaining_space > 0)) {
-                        //pdebug(DEBUG_DETAIL, "packed %d requests with remaining space %d", num_bundled_requests+1, remaining_space);
-                        bundled_requests[num_bundled_requests] = request;
-                        num_bundled_requests++;
 
-                        /* remove it from the queue. */
-                        vector_remove(session->requests, 0);
-                    }
-                } while(vector_length(session->requests) && remaining_space > 0 && num_bundled_requests < MAX_REQUESTS && request->allow_packing);
-            } else {
-                pdebug(DEBUG_DETAIL, "All requests in queue were aborted, nothing to do.");
-            }
-        }
+/* a request carrying riders must last as long as the latest of them. */
+void request_extend_deadline(ab_request_p primary, ab_request_p rider)
+{
+    if(primary->deadline && (!rider->deadline || rider->deadline > primary->deadline)) {
+        primary->deadline = rider->deadline;
     }
+}
 
-    /* output debug display as no particular tag. */
-    debug_set_tag_id(0);
 
-    if(num_bundled_requests > 0) {
 
-        pdebug(DEBUG_INFO, "%d requests to process.", num_bundled_requests);
+/*
+ * breaker_failure
+ *
+ * Count a failed attempt to reach the PLC.  Once the threshold is hit the
+ * breaker opens and everything queued fails right away.
+ */
 
-        do {
-            /* copy and pack the requests into the session buffer. */
-            rc = pack_requests(session, bundled_requests, num_bundled_requests);
-            if(rc != PLCTAG_STATUS_OK) {
-                pdebug(DEBUG_WARN, "Error while packing requests, %s!", plc_tag_decode_error(rc));
-                break;
-            }
+void breaker_failure(ab_session_p session)
+{
+    if(session->breaker_threshold <= 0 || SESSION_BREAKER_IS_OPEN(session->breaker_state)) {
+        return;
+    }
 
-            /* fill in all the necessary parts to the request. */
-            if((rc = prepare_request(session)) != PLCTAG_STATUS_OK) {
-                pdebug(DEBUG_WARN, "Unable to prepare request, %s!", plc_tag_decode_error(rc));
-                break;
-            }
+    session->breaker_failures++;
 
-            /* send the request */
-            if((rc = send_eip_request(session, SESSION_DEFAULT_TIMEOUT)) != PLCTAG_STATUS_OK) {
-                pdebug(DEBUG_WARN, "Error sending packet %s!", plc_tag_decode_error(rc));
-                break;
-            }
+    if(session->breaker_failures < session->breaker_threshold) {
+        return;
+    }
 
-            /* wait for the response */
-            if((rc = recv_eip_response(session, SESSION_DEFAULT_TIMEOUT)) != PLCTAG_STATUS_OK) {
-                pdebug(DEBUG_WARN, "Error receiving packet response %s!", plc_tag_decode_error(rc));
-                break;
-            }
+    pdebug(DEBUG_WARN, "Session %p failed %d times in a row, opening the circuit breaker.", session, session->breaker_failures);
 
-            /*
-             * check the CIP status, but only if this is a bundled
-             * response.   If it is a singleton, then we pass the
-             * status back to the tag.
-             */
-            if(num_bundled_requests > 1) {
-                if(le2h16(((eip_encap *)(session->data))->encap_command) == AB_EIP_UNCONNECTED_SEND) {
-                    eip_cip_uc_resp *resp = (eip_cip_uc_resp *)(session->data);
-                    pdebug(DEBUG_INFO, "Received unconnected packet with session sequence ID %llx", resp->encap_sender_context);
-
-                    /* punt if we got an overall error or it is not a partial/bundled error. */
-                    if(resp->status != AB_EIP_OK && resp->status != AB_CIP_ERR_PARTIAL_ERROR) {
-                        rc = decode_cip_error_code(&(resp->status));
-                        pdebug(DEBUG_WARN, "Command failed! (%d/%d) %s", resp->status, rc, plc_tag_decode_error(rc));
-                        break;
-                    }
-                } else if(le2h16(((eip_encap *)(session->data))->encap_command) == AB_EIP_CONNECTED_SEND) {
-                    eip_cip_co_resp *resp = (eip_cip_co_resp *)(session->data);
-                    pdebug(DEBUG_INFO, "Received connected packet with connection ID %x and sequence ID %u(%x)", le2h32(resp->cpf_orig_conn_id), le2h16(resp->cpf_conn_seq_num), le2h16(resp->cpf_conn_seq_num));
-
-                    /* punt if we got an overall error or it is not a partial/bundled error. */
-                    if(resp->status != AB_EIP_OK && resp->status != AB_CIP_ERR_PARTIAL_ERROR) {
-                        rc = decode_cip_error_code(&(resp->status));
-                        pdebug(DEBUG_WARN, "Command failed! (%d/%d) %s", resp->status, rc, plc_tag_decode_error(rc));
-                        break;
-                    }
-                }
-            }
+    critical_block(session->mutex) {
+        session->breaker_state++;
+        fail_queued_requests_unsafe(session, PLCTAG_ERR_UNAVAILABLE);
+    }
+}
+
+
+
+void breaker_close(ab_session_p session)
+{
+    pdebug(DEBUG_INFO, "Session %p reached the PLC, closing the circuit breaker.", session);
+
+    critical_block(session->mutex) {
+        session->breaker_state++;
+    }
+}
 
-            /* copy the results back out. Every request gets a copy. */
-            for(int i=0; i < num_bundled_requests; i++) {
-                debug_set_tag_id(bundled_requests[i]->tag_id);
 
-                rc = unpack_response(session, bundled_requests[i], i);
-                if(rc != PLCTAG_STATUS_OK) {
-                    pdebug(DEBUG_WARN, "Unable to unpack response!");
-                    break;
-                }
 
-                /* release our reference */
-                bundled_requests[i] = rc_dec(bundled_requests[i]);
-            }
+/*
+ * breaker_retry_wait
+ *
+ * While the breaker is open each probe waits twice as long as the last,
+ * up to SESSION_BREAKER_MAX_BACKOFF_MS.
+ */
 
-            rc = PLCTAG_STATUS_OK;
-        } while(0);
+int breaker_retry_wait(ab_session_p session)
+{
+    int wait_ms = RETRY_WAIT_MS;
 
-        /* problem? clean up the pending requests and dump everything. */
-        if(rc != PLCTAG_STATUS_OK) {
-            for(int i=0; i < num_bundled_requests; i++) {
-                if(bundled_requests[i]) {
-                    bundled_requests[i]->status = rc;
-                    bundled_requests[i]->request_size = 0;
-                    bundled_requests[i]->resp_received = 1;
-                    bundled_requests[i] = rc_dec(bundled_requests[i]);
-                }
-            }
-        }
+    if(!SESSION_BREAKER_IS_OPEN(session->breaker_state)) {
+        return wait_ms;
     }
 
-    debug_set_tag_id(0);
+    if(session->breaker_backoff_ms > 0) {
+        wait_ms = session->breaker_backoff_ms;
+    }
 
-    pdebug(DEBUG_SPEW, "Done.");
+    session->breaker_backoff_ms = (wait_ms > SESSION_BREAKER_MAX_BACKOFF_MS / 2 ? SESSION_BREAKER_MAX_BACKOFF_MS : wait_ms * 2);
 
-    return rc;
+    return wait_ms;
 }
 
 
@@ -1441,9 +4668,16 @@ int unpack_response(ab_session_p session, ab_request_p request, int sub_packet)
     uint8_t *pkt_start = NULL;
     uint8_t *pkt_end = NULL;
     int new_eip_len = 0;
+    read_cache_entry_t *cache_entry = NULL;
+    uint32_t cache_generation = 0;
 
     pdebug(DEBUG_INFO, "Starting.");
 
+    /* find where to keep the response while the request bytes are still here. */
+    if(request->allow_merge && request->cache_ms > 0) {
+        cache_entry = read_cache_claim(session, request, &cache_generation);
+    }
+
     /* clear out the request data. */
     mem_set(request->data, 0, request->request_capacity);
 
@@ -1498,6 +4732,42 @@ int unpack_response(ab_session_p session, ab_request_p request, int sub_packet)
 
         pkt_len = (int)(pkt_end - pkt_start);
 
+        /* the reply stays where it is, the tag decodes it from there. */
+        if(request->accept_slice && !cache_entry && !request->span.key && !request->merged_head) {
+            if(!session->data_next) {
+                session->data_next = rx_buf_get();
+            }
+
+            if(session->data_next) {
+                int reply_header_size = (int)(sizeof(eip_cip_co_resp) - offsetof(eip_cip_co_resp, reply_service));
+
+                unpacked_resp = (eip_cip_co_resp *)(request->data);
+
+                mem_copy(request->data, session->data, (int)sizeof(eip_cip_co_resp));
+                mem_copy(&unpacked_resp->reply_service, pkt_start, (pkt_len < reply_header_size ? pkt_len : reply_header_size));
+
+                unpacked_resp->cpf_cdi_item_length = h2le16((uint16_t)(pkt_len + (int)sizeof(uint16_le)));
+                unpacked_resp->encap_length = h2le16((uint16_t)((int)offsetof(eip_cip_co_resp, reply_service) + pkt_len - (int)sizeof(eip_encap)));
+
+                request->resp_buf = rc_inc(session->data);
+                request->resp_data = pkt_start;
+                request->resp_size = pkt_len;
+                session->data_lent = 1;
+
+                pdebug(DEBUG_INFO, "Left %d byte reply in the receive buffer.", pkt_len);
+
+                spin_block(&request->lock) {
+                    request->status = PLCTAG_STATUS_OK;
+                    request->request_size = (int)sizeof(eip_cip_co_resp);
+                    request->resp_received = 1;
+                }
+
+                pdebug(DEBUG_DETAIL, "Done.");
+
+                return PLCTAG_STATUS_OK;
+            }
+        }
+
         /* replace the request buffer if it is not big enough. */
         new_eip_len = pkt_len + (int)sizeof(eip_cip_co_generic_response);
         if(new_eip_len > request->request_capacity) {
@@ -1543,6 +4813,18 @@ int unpack_response(ab_session_p session, ab_request_p request, int sub_packet)
     pdebug(DEBUG_INFO, "Unpacked packet:");
     pdebug_dump_bytes(DEBUG_INFO, request->data, new_eip_len);
 
+    if(cache_entry) {
+        read_cache_fill(session, cache_entry, cache_generation, request, new_eip_len);
+    }
+
+    /* combined reads each get their part of the response. */
+    if(request->span.key) {
+        new_eip_len = complete_span_requests(request, new_eip_len);
+    }
+
+    /* identical reads merged into this one get the same response. */
+    complete_merged_requests(request, PLCTAG_STATUS_OK, new_eip_len);
+
     /* notify the reading thread that the request is ready */
     spin_block(&request->lock) {
         request->status = PLCTAG_STATUS_OK;
@@ -1585,29 +4867,52 @@ int get_payload_size(ab_request_p request)
 
 
 
+/*
+ * pack_requests
+ *
+ * Set up the packet for the passed requests without copying their
+ * payloads.  The encapsulation and CPF headers, and the Multiple Service
+ * header if there is more than one request, are built in the session
+ * buffer.  The payloads are sent from the request buffers by
+ * send_eip_request() as a gathered write.
+ */
+
 int pack_requests(ab_session_p session, ab_request_p *requests, int num_requests)
 {
     eip_cip_co_req *new_req = NULL;
     eip_cip_co_req *packed_req = NULL;
-    /* FIXME - is this the right way to check? */
     int header_size = 0;
     cip_multi_req_header *multi_header = NULL;
     int current_offset = 0;
     uint8_t *pkt_start = NULL;
     int pkt_len = 0;
-    uint8_t *first_pkt_data = NULL;
-    uint8_t *next_pkt_data = NULL;
+    int total_size = 0;
 
     pdebug(DEBUG_INFO, "Starting.");
 
-    debug_set_tag_id(requests[0]->tag_id);
+    plctag_trace2(pack_requests, requests[0]->tag_id, num_requests);
 
-    /* get the header info from the first request. Just copy the whole thing. */
-    mem_copy(session->data, requests[0]->data, requests[0]->request_size);
-    session->data_size = (uint32_t)requests[0]->request_size;
+    debug_set_tag_id(requests[0]->tag_id);
 
     /* special case the case where there is just one request. */
     if(num_requests == 1) {
+        /* only the headers prepare_request() fills in need to be copied. */
+        if(le2h16(((eip_encap *)(requests[0]->data))->encap_command) == AB_EIP_CONNECTED_SEND) {
+            header_size = (int)sizeof(eip_cip_co_req);
+        } else {
+            header_size = (int)sizeof(eip_encap);
+        }
+
+        mem_copy(session->data, requests[0]->data, header_size);
+
+        session->send_bufs[0].data = session->data;
+        session->send_bufs[0].size = header_size;
+        session->send_bufs[1].data = requests[0]->data + header_size;
+        session->send_bufs[1].size = requests[0]->request_size - header_size;
+        session->num_send_bufs = 2;
+
+        session->data_size = (uint32_t)requests[0]->request_size;
+
         pdebug(DEBUG_INFO, "Only one request, so done.");
 
         debug_set_tag_id(0);
@@ -1615,29 +4920,18 @@ int pack_requests(ab_session_p session, ab_request_p *requests, int num_requests
         return PLCTAG_STATUS_OK;
     }
 
-    /* set up multi-packet header. */
+    /* get the header info from the first request. */
+    mem_copy(session->data, requests[0]->data, (int)sizeof(eip_cip_co_req));
 
+    packed_req = (eip_cip_co_req *)(session->data);
+
+    /* set up multi-packet header. */
     header_size = (int)(sizeof(cip_multi_req_header)
                         + (sizeof(uint16_le) * (size_t)num_requests)); /* offsets for each request. */
 
     pdebug(DEBUG_INFO, "header size %d", header_size);
 
-    packed_req = (eip_cip_co_req *)(session->data);
-
-    /* make room in the request packet in the session for the header. */
-    pkt_start = (uint8_t *)(&packed_req->cpf_conn_seq_num) + sizeof(packed_req->cpf_conn_seq_num);
-    pkt_len = (int)le2h16(packed_req->cpf_cdi_item_length) - (int)sizeof(packed_req->cpf_conn_seq_num);
-
-    pdebug(DEBUG_INFO, "packet 0 is of length %d.", pkt_len);
-
-    /* point to where we want the current packet to start. */
-    first_pkt_data = pkt_start + header_size;
-
-    /* move the data over to make room */
-    mem_move(first_pkt_data, pkt_start, pkt_len);
-
-    /* now fill in the header. Use pkt_start as it is pointing to the right location. */
-    multi_header = (cip_multi_req_header *)pkt_start;
+    multi_header = (cip_multi_req_header *)(session->data + sizeof(eip_cip_co_req));
     multi_header->service_code = AB_EIP_CMD_CIP_MULTI;
     multi_header->req_path_size = 0x02; /* length of path in words */
     multi_header->req_path[0] = 0x20; /* Class */
@@ -1646,15 +4940,16 @@ int pack_requests(ab_session_p session, ab_request_p *requests, int num_requests
     multi_header->req_path[3] = 0x01; /* #1 */
     multi_header->request_count = h2le16((uint16_t)num_requests);
 
-    /* set up the offset for the first request. */
-    current_offset = (int)(sizeof(uint16_le) + (sizeof(uint16_le) * (size_t)num_requests));
-    multi_header->request_offsets[0] = h2le16((uint16_t)current_offset);
+    session->send_bufs[0].data = session->data;
+    session->send_bufs[0].size = (int)sizeof(eip_cip_co_req) + header_size;
+    session->num_send_bufs = 1;
 
-    next_pkt_data = first_pkt_data + pkt_len;
-    current_offset = current_offset + pkt_len;
+    total_size = session->send_bufs[0].size;
+
+    /* the offsets are from the request count. */
+    current_offset = (int)(sizeof(uint16_le) + (sizeof(uint16_le) * (size_t)num_requests));
 
-    /* now process the rest of the requests. */
-    for(int i=1; i<num_requests; i++) {
+    for(int i=0; i<num_requests; i++) {
         debug_set_tag_id(requests[i]->tag_id);
 
         /* set up the offset */
@@ -1669,22 +4964,23 @@ int pack_requests(ab_session_p session, ab_request_p *requests, int num_requests
 
         pdebug(DEBUG_INFO, "packet %d is of length %d.", i, pkt_len);
 
-        /* copy the request into the session buffer. */
-        mem_copy(next_pkt_data, pkt_start, pkt_len);
+        /* send the payload straight from the request. */
+        session->send_bufs[session->num_send_bufs].data = pkt_start;
+        session->send_bufs[session->num_send_bufs].size = pkt_len;
+        session->num_send_bufs++;
 
-        /* calculate the next packet info. */
-        next_pkt_data += pkt_len;
         current_offset += pkt_len;
+        total_size += pkt_len;
     }
 
     /* stitch up the CPF packet length */
-    packed_req->cpf_cdi_item_length = h2le16((uint16_t)(next_pkt_data - (uint8_t *)(&packed_req->cpf_conn_seq_num)));
+    packed_req->cpf_cdi_item_length = h2le16((uint16_t)((size_t)total_size - offsetof(eip_cip_co_req, cpf_conn_seq_num)));
 
     /* stick up the EIP packet length */
-    packed_req->encap_length = h2le16((uint16_t)((size_t)(next_pkt_data - session->data) - sizeof(eip_encap)));
+    packed_req->encap_length = h2le16((uint16_t)((size_t)total_size - sizeof(eip_encap)));
 
     /* set the total data size */
-    session->data_size = (uint32_t)(next_pkt_data - session->data);
+    session->data_size = (uint32_t)total_size;
 
     debug_set_tag_id(0);
 
@@ -1743,9 +5039,7 @@ int prepare_request(ab_session_p session)
         return PLCTAG_ERR_UNSUPPORTED;
     }
 
-    /* display the data */
     pdebug(DEBUG_INFO, "Prepared packet of size %d", session->data_size);
-    pdebug_dump_bytes(DEBUG_INFO, session->data, (int)session->data_size);
 
     pdebug(DEBUG_INFO, "Done.");
 
@@ -1759,6 +5053,7 @@ int send_eip_request(ab_session_p session, int timeout)
 {
     int rc = PLCTAG_STATUS_OK;
     int64_t timeout_time = 0;
+    int sent_bufs = 0;
 
     pdebug(DEBUG_INFO, "Starting.");
 
@@ -1773,26 +5068,59 @@ int send_eip_request(ab_session_p session, int timeout)
         timeout_time = INT64_MAX;
     }
 
+    /* packets built in place in the session buffer go out as one piece. */
+    if(session->num_send_bufs == 0) {
+        session->send_bufs[0].data = session->data;
+        session->send_bufs[0].size = (int)session->data_size;
+        session->num_send_bufs = 1;
+    }
+
     pdebug(DEBUG_INFO, "Sending packet of size %d", session->data_size);
-    pdebug_dump_bytes(DEBUG_INFO, session->data, (int)(session->data_size));
+    for(int i=0; i < session->num_send_bufs; i++) {
+        pdebug_dump_bytes(DEBUG_INFO, session->send_bufs[i].data, session->send_bufs[i].size);
+    }
 
     session->data_offset = 0;
     session->packet_count++;
+    session->last_send_ms = time_ms();
+
+    capture_frame(session->capture, CAPTURE_DIR_SENT, session->send_bufs, session->num_send_bufs);
+
+    plctag_trace2(send_eip_request, session->session_seq_id, session->data_size);
 
     /* send the packet */
     do {
-        rc = socket_write(session->sock, session->data + session->data_offset, (int)session->data_size - (int)session->data_offset);
+        rc = socket_writev(session->sock, session->send_bufs + sent_bufs, session->num_send_bufs - sent_bufs);
 
         if(rc >= 0) {
+            int amount = rc;
+
             session->data_offset += (uint32_t)rc;
+
+            /* step past whatever was taken. */
+            while(amount > 0 && sent_bufs < session->num_send_bufs) {
+                socket_buf_t *buf = &(session->send_bufs[sent_bufs]);
+
+                if(amount >= buf->size) {
+                    amount -= buf->size;
+                    sent_bufs++;
+                } else {
+                    buf->data += amount;
+                    buf->size -= amount;
+                    amount = 0;
+                }
+            }
         }
 
-        /* give up the CPU if we still are looping */
+        /* wait until the socket can take more if we still are looping */
         if(!session->terminating && rc >= 0 && session->data_offset < session->data_size) {
-            sleep_ms(1);
+            session_wait_socket(session, SOCKET_EVENT_WRITE, timeout_time);
         }
     } while(!session->terminating && rc >= 0 && session->data_offset < session->data_size && timeout_time > time_ms());
 
+    /* the next packet starts from scratch. */
+    session->num_send_bufs = 0;
+
     if(session->terminating) {
         pdebug(DEBUG_WARN, "Session is terminating.");
         return PLCTAG_ERR_ABORT;
@@ -1808,6 +5136,11 @@ int send_eip_request(ab_session_p session, int timeout)
         return PLCTAG_ERR_TIMEOUT;
     }
 
+    metrics_add(session->metrics, METRIC_PACKETS_SENT, 1);
+    metrics_add(session->metrics, METRIC_BYTES_SENT, session->data_size);
+
+    plctag_trace2(send_eip_request_done, session->session_seq_id, session->data_size);
+
     pdebug(DEBUG_INFO, "Done.");
 
     return PLCTAG_STATUS_OK;
@@ -1821,12 +5154,18 @@ int send_eip_request(ab_session_p session, int timeout)
  * Look at the passed session and read any data we can
  * to fill in a packet.  If we already have a full packet,
  * punt.
+ *
+ * Each read takes as much as the buffer has room for, so that replies
+ * already waiting in the kernel come in with one call.  Whatever follows
+ * the frame is kept in rx_extra for the next call.  Sessions sharing a
+ * socket read exactly one frame at a time.
  */
-int recv_eip_response(ab_session_p session, int timeout)
+int recv_eip_response(ab_session_p session, int timeout, int check_deadlines)
 {
     uint32_t data_needed = 0;
     int rc = PLCTAG_STATUS_OK;
     int64_t timeout_time = 0;
+    int batch = 0;
 
     pdebug(DEBUG_INFO, "Starting.");
 
@@ -1845,10 +5184,27 @@ int recv_eip_response(ab_session_p session, int timeout)
     session->data_offset = 0;
     session->data_size = 0;
     data_needed = sizeof(eip_encap);
+    batch = !session->transport;
 
-    do {
+    plctag_trace1(recv_eip_response, session->session_seq_id);
+
+    /* start with what came in after the last frame. */
+    if(session->rx_extra_size > 0) {
+        session->data_offset = session_take_extra_data(session);
+
+        if(session->data_offset >= sizeof(eip_encap)) {
+            data_needed = (uint32_t)(sizeof(eip_encap) + le2h16(((eip_encap *)(session->data))->encap_length));
+
+            if(data_needed > session->data_capacity) {
+                pdebug(DEBUG_WARN, "Packet response (%d) is larger than possible buffer size (%d)!", data_needed, session->data_capacity);
+                return PLCTAG_ERR_TOO_LARGE;
+            }
+        }
+    }
+
+    while(!session->terminating && session->data_offset < data_needed && timeout_time > time_ms()) {
         rc = socket_read(session->sock, session->data + session->data_offset,
-                         (int)(data_needed - session->data_offset));
+                         (int)((batch ? session->data_capacity : data_needed) - session->data_offset));
 
         if (rc < 0) {
             /* error! */
@@ -1872,24 +5228,49 @@ int recv_eip_response(ab_session_p session, int timeout)
 
         /* did we get all the data? */
         if(!session->terminating && session->data_offset < data_needed) {
-            /* do not hog the CPU */
-            sleep_ms(1);
+            /* wait for more data instead of hogging the CPU */
+            session_wait_socket(session, SOCKET_EVENT_READ, timeout_time);
+
+            /* nothing is lost by giving up before a response starts. */
+            if(check_deadlines && session->data_offset == 0 && expire_in_flight_requests(session) == 0) {
+                pdebug(DEBUG_DETAIL, "All requests in flight expired.");
+                return PLCTAG_STATUS_PENDING;
+            }
         }
-    } while(!session->terminating && session->data_offset < data_needed && timeout_time > time_ms());
+    }
 
     if(session->terminating) {
         pdebug(DEBUG_INFO, "Session is terminating, returning...");
         return PLCTAG_ERR_ABORT;
     }
 
-    if(timeout_time <= time_ms()) {
+    if(session->data_offset < data_needed) {
         pdebug(DEBUG_WARN, "Timed out waiting for data to read!");
         return PLCTAG_ERR_TIMEOUT;
     }
 
+    /* keep the start of the next frames, rx_extra is always empty after a read. */
+    if(session->data_offset > data_needed) {
+        session->rx_extra_start = 0;
+        session->rx_extra_size = session->data_offset - data_needed;
+        mem_copy(session->rx_extra, session->data + data_needed, (int)session->rx_extra_size);
+        session->data_offset = data_needed;
+
+        pdebug(DEBUG_DETAIL, "Kept %u bytes read past the frame.", session->rx_extra_size);
+    }
+
     session->resp_seq_id = le2h64(((eip_encap *)(session->data))->encap_sender_context);
     session->data_size = data_needed;
 
+    if(session->capture) {
+        socket_buf_t frame = { session->data, (int)data_needed };
+
+        capture_frame(session->capture, CAPTURE_DIR_RECEIVED, &frame, 1);
+    }
+
+    metrics_add(session->metrics, METRIC_PACKETS_RECEIVED, 1);
+    metrics_add(session->metrics, METRIC_BYTES_RECEIVED, data_needed);
+
     rc = PLCTAG_STATUS_OK;
 
     pdebug(DEBUG_INFO, "request received all needed data (%d bytes of %d).", session->data_offset, data_needed);
@@ -1901,6 +5282,8 @@ int recv_eip_response(ab_session_p session, int timeout)
         rc = PLCTAG_ERR_BAD_STATUS;
     }
 
+    plctag_trace3(recv_eip_response_done, session->resp_seq_id, data_needed, rc);
+
     pdebug(DEBUG_INFO, "Done.");
 
     return rc;
@@ -1908,6 +5291,27 @@ int recv_eip_response(ab_session_p session, int timeout)
 
 
 
+/*
+ * Wait for the socket to be ready, but not past the passed timeout or
+ * for so long that a terminating session is not noticed.
+ */
+void session_wait_socket(ab_session_p session, int events, int64_t timeout_time)
+{
+    int64_t wait_ms = timeout_time - time_ms();
+
+    if(wait_ms > SESSION_SOCKET_WAIT_TIME) {
+        wait_ms = SESSION_SOCKET_WAIT_TIME;
+    }
+
+    if(wait_ms < 1) {
+        wait_ms = 1;
+    }
+
+    socket_wait_event(session->sock, events, (int)wait_ms);
+}
+
+
+
 int perform_forward_close(ab_session_p session)
 {
     int rc = PLCTAG_STATUS_OK;
@@ -2139,7 +5543,7 @@ int receive_forward_open_response(ab_session_p session)
 
     pdebug(DEBUG_INFO, "Starting");
 
-    rc = recv_eip_response(session, 0);
+    rc = recv_eip_response(session, 0, 0);
     if(rc != PLCTAG_STATUS_OK) {
         pdebug(DEBUG_WARN, "Unable to receive Forward Open response.");
         return rc;
@@ -2281,7 +5685,7 @@ int recv_forward_close_resp(ab_session_p session)
 
     pdebug(DEBUG_INFO, "Starting");
 
-    rc = recv_eip_response(session, 150);
+    rc = recv_eip_response(session, 150, 0);
     if(rc != PLCTAG_STATUS_OK) {
         pdebug(DEBUG_WARN, "Unable to receive Forward Close response, %s!", plc_tag_decode_error(rc));
         return rc;
@@ -2320,10 +5724,11 @@ int recv_forward_close_resp(ab_session_p session)
 
 
 
-int session_create_request(ab_session_p session, int tag_id, ab_request_p *req)
+int session_create_request(ab_session_p session, int tag_id, int priority, int64_t deadline, ab_request_p *req)
 {
     int rc = PLCTAG_STATUS_OK;
-    ab_request_p res;
+    ab_request_p res = NULL;
+    ab_request_pool_p pool = session->request_pool;
     size_t request_capacity = 0;
     uint8_t *buffer = NULL;
 
@@ -2333,27 +5738,55 @@ int session_create_request(ab_session_p session, int tag_id, ab_request_p *req)
 
     pdebug(DEBUG_DETAIL, "Starting.");
 
-    buffer = (uint8_t *)mem_alloc((int)request_capacity);
-    if(!buffer) {
-        pdebug(DEBUG_WARN, "Unable to allocate request buffer!");
-        *req = NULL;
-        return PLCTAG_ERR_NO_MEM;
+    /* reuse a released request if there is one. */
+    spin_block(&pool->lock) {
+        if(pool->free_head) {
+            res = pool->free_head;
+            pool->free_head = res->pool_next;
+            pool->num_free--;
+            res->pool_next = NULL;
+        }
     }
 
-    res = (ab_request_p)rc_alloc((int)sizeof(struct ab_request_t), request_destroy);
-    if (!res) {
-        mem_free(buffer);
-        *req = NULL;
-        rc = PLCTAG_ERR_NO_MEM;
+    if(res) {
+        /* the payload size may have grown since the request was released. */
+        if(res->request_capacity < (int)request_capacity) {
+            rc = session_request_increase_buffer(res, (int)request_capacity);
+            if(rc != PLCTAG_STATUS_OK) {
+                rc_dec(res);
+                *req = NULL;
+                return rc;
+            }
+        }
     } else {
+        buffer = (uint8_t *)mem_alloc((int)request_capacity);
+        if(!buffer) {
+            pdebug(DEBUG_WARN, "Unable to allocate request buffer!");
+            *req = NULL;
+            return PLCTAG_ERR_NO_MEM;
+        }
+
+        res = (ab_request_p)rc_alloc((int)sizeof(struct ab_request_t), request_destroy);
+        if (!res) {
+            mem_free(buffer);
+            *req = NULL;
+            return PLCTAG_ERR_NO_MEM;
+        }
+
         res->data = buffer;
-        res->tag_id = tag_id;
         res->request_capacity = (int)request_capacity;
         res->lock = LOCK_INIT;
+        res->pool = rc_inc(pool);
 
-        *req = res;
+        rc_set_recycler(res, request_recycle);
     }
 
+    res->tag_id = tag_id;
+    res->priority = priority;
+    res->deadline = deadline;
+
+    *req = res;
+
     pdebug(DEBUG_DETAIL, "Done.");
 
     return rc;
@@ -2377,15 +5810,283 @@ void request_destroy(void *req_arg)
 
     req->abort_request = 1;
 
+    if(req->resp_buf) {
+        req->resp_buf = rc_dec(req->resp_buf);
+    }
+
     if(req->data) {
         mem_free(req->data);
         req->data = NULL;
     }
 
+    if(req->pool) {
+        req->pool = rc_dec(req->pool);
+    }
+
     pdebug(DEBUG_DETAIL, "Done.");
 }
 
 
+
+/*
+ * request_recycle
+ *
+ * Called when the last reference to a request is released.  Keep the
+ * request and its buffer in the session's pool unless the session is
+ * gone or the pool is full, in which case it is destroyed normally.
+ */
+
+int request_recycle(void *req_arg)
+{
+    ab_request_p req = req_arg;
+    ab_request_pool_p pool = req->pool;
+    int recycled = 0;
+
+    if(!pool) {
+        return 0;
+    }
+
+    /* give the receive buffer back before the request is reused. */
+    if(req->resp_buf) {
+        req->resp_buf = rc_dec(req->resp_buf);
+    }
+
+    spin_block(&pool->lock) {
+        if(!pool->closed && pool->num_free < SESSION_REQUEST_POOL_MAX) {
+            uint8_t *data = req->data;
+            int request_capacity = req->request_capacity;
+
+            /* new requests start out zeroed. */
+            mem_set(data, 0, request_capacity);
+
+            mem_set(req, 0, (int)sizeof(*req));
+
+            req->lock = LOCK_INIT;
+            req->data = data;
+            req->request_capacity = request_capacity;
+            req->pool = pool;
+
+            req->pool_next = pool->free_head;
+            pool->free_head = req;
+            pool->num_free++;
+
+            recycled = 1;
+        }
+    }
+
+    return recycled;
+}
+
+
+
+/*
+ * session_request_payload
+ *
+ * Find the CIP data of a reply, after the reply service and status bytes,
+ * whether it was copied into the request or left in the receive buffer.
+ */
+
+void session_request_payload(ab_request_p req, uint8_t **data, uint8_t **data_end)
+{
+    if(req->resp_buf) {
+        int reply_header_size = (int)(sizeof(eip_cip_co_resp) - offsetof(eip_cip_co_resp, reply_service));
+
+        *data = req->resp_data + reply_header_size;
+        *data_end = req->resp_data + req->resp_size;
+
+        /* a reply too short for its header has no data. */
+        if(*data > *data_end) {
+            *data = *data_end;
+        }
+    } else {
+        eip_cip_co_resp *cip_resp = (eip_cip_co_resp *)(req->data);
+
+        *data = req->data + sizeof(eip_cip_co_resp);
+        *data_end = req->data + le2h16(cip_resp->encap_length) + sizeof(eip_encap);
+    }
+}
+
+
+
+/*
+ * rx_buf_get
+ *
+ * Get a session receive buffer.  Buffers that parts of replies were lent
+ * from come back here through rx_buf_recycle() when the last tag using
+ * them is done.
+ */
+
+uint8_t *rx_buf_get(void)
+{
+    uint8_t *buf = NULL;
+
+    spin_block(&rx_buf_pool_lock) {
+        if(rx_buf_pool_count > 0) {
+            rx_buf_pool_count--;
+            buf = rx_buf_pool[rx_buf_pool_count];
+            rx_buf_pool[rx_buf_pool_count] = NULL;
+        }
+    }
+
+    if(!buf) {
+        buf = (uint8_t *)rc_alloc(MAX_PACKET_SIZE_EX, rx_buf_destroy);
+        if(buf) {
+            rc_set_recycler(buf, rx_buf_recycle);
+        }
+    }
+
+    return buf;
+}
+
+
+int rx_buf_recycle(void *buf)
+{
+    int recycled = 0;
+
+    spin_block(&rx_buf_pool_lock) {
+        if(!rx_buf_pool_closed && rx_buf_pool_count < SESSION_RX_BUF_POOL_MAX) {
+            rx_buf_pool[rx_buf_pool_count] = (uint8_t *)buf;
+            rx_buf_pool_count++;
+            recycled = 1;
+        }
+    }
+
+    return recycled;
+}
+
+
+void rx_buf_destroy(void *buf)
+{
+    /* nothing inside the buffer to free. */
+    (void)buf;
+}
+
+
+void rx_buf_pool_flush(void)
+{
+    uint8_t *bufs[SESSION_RX_BUF_POOL_MAX];
+    int num_bufs = 0;
+
+    spin_block(&rx_buf_pool_lock) {
+        rx_buf_pool_closed = 1;
+
+        for(int i=0; i < rx_buf_pool_count; i++) {
+            bufs[i] = rx_buf_pool[i];
+            rx_buf_pool[i] = NULL;
+        }
+
+        num_bufs = rx_buf_pool_count;
+        rx_buf_pool_count = 0;
+    }
+
+    /* the pool is closed so these are really freed. */
+    for(int i=0; i < num_bufs; i++) {
+        rc_dec(bufs[i]);
+    }
+}
+
+
+/*
+ * session_take_extra_data
+ *
+ * Move the next frame, or all of it if the frame is not complete, from
+ * rx_extra to the start of the receive buffer.  Returns the bytes moved.
+ */
+
+uint32_t session_take_extra_data(ab_session_p session)
+{
+    uint32_t take = session->rx_extra_size;
+    uint8_t *extra = session->rx_extra + session->rx_extra_start;
+
+    if(take >= sizeof(eip_encap)) {
+        uint32_t frame_size = (uint32_t)(sizeof(eip_encap) + le2h16(((eip_encap *)extra)->encap_length));
+
+        if(frame_size < take) {
+            take = frame_size;
+        }
+    }
+
+    mem_copy(session->data, extra, (int)take);
+
+    session->rx_extra_start += take;
+    session->rx_extra_size -= take;
+
+    if(session->rx_extra_size == 0) {
+        session->rx_extra_start = 0;
+    }
+
+    return take;
+}
+
+
+
+/*
+ * session_release_lent_data
+ *
+ * Once parts of the receive buffer have been handed to requests it is
+ * theirs, switch to the buffer set aside by unpack_response().
+ */
+
+void session_release_lent_data(ab_session_p session)
+{
+    if(!session->data_lent) {
+        return;
+    }
+
+    rc_dec(session->data);
+    session->data = session->data_next;
+    session->data_next = NULL;
+    session->data_lent = 0;
+}
+
+
+
+ab_request_pool_p request_pool_create(void)
+{
+    ab_request_pool_p pool = (ab_request_pool_p)rc_alloc((int)sizeof(struct ab_request_pool_t), request_pool_destroy);
+
+    if(pool) {
+        pool->lock = LOCK_INIT;
+    }
+
+    return pool;
+}
+
+
+/*
+ * Stop taking requests back and free the ones held.  The pool itself
+ * goes away when the last request that came from it is released.
+ */
+void request_pool_close(ab_request_pool_p pool)
+{
+    ab_request_p free_list = NULL;
+
+    spin_block(&pool->lock) {
+        pool->closed = 1;
+        free_list = pool->free_head;
+        pool->free_head = NULL;
+        pool->num_free = 0;
+    }
+
+    while(free_list) {
+        ab_request_p next = free_list->pool_next;
+
+        free_list->pool_next = NULL;
+        rc_dec(free_list);
+
+        free_list = next;
+    }
+}
+
+
+void request_pool_destroy(void *pool_arg)
+{
+    (void)pool_arg;
+
+    pdebug(DEBUG_DETAIL, "Request pool destroyed.");
+}
+
+
 int session_request_increase_buffer(ab_request_p request, int new_capacity)
 {
     uint8_t *old_buffer = NULL;
@@ -36,17 +36,54 @@
 
 #include <ab/ab_common.h>
 #include <ab/defs.h>
+#include <util/atomic_int.h>
+#include <util/capture.h>
+#include <util/hashtable.h>
 #include <util/rc.h>
+#include <util/metrics.h>
 #include <util/vector.h>
 
 /* #define MAX_SESSION_HOST    (128) */
 
 #define SESSION_DEFAULT_TIMEOUT (2000)
+#define SESSION_DEFAULT_CONNECT_TIMEOUT (5000)
 
 #define MAX_PACKET_SIZE_EX  (44 + 4002)
 
-#define SESSION_MIN_REQUESTS    (10)
-#define SESSION_INC_REQUESTS    (10)
+/* request priority classes, higher classes are sent first. */
+#define SESSION_PRIORITY_LOW    (0)
+#define SESSION_PRIORITY_NORMAL (1)
+#define SESSION_PRIORITY_HIGH   (2)
+#define SESSION_NUM_PRIORITIES  (3)
+
+/* upper limit for the max_requests_in_flight attribute. */
+#define SESSION_MAX_REQUESTS_IN_FLIGHT (16)
+
+/* PCCC transactions kept outstanding through a DH+ bridge unless max_requests_in_flight is set. */
+#define SESSION_DHP_REQUESTS_IN_FLIGHT (4)
+
+/* PLCs that cannot pack requests get a window instead, unless max_requests_in_flight is set. */
+#define SESSION_MICRO800_REQUESTS_IN_FLIGHT (4)
+#define SESSION_PCCC_REQUESTS_IN_FLIGHT (2)
+
+/* upper limit for the connection_pool_size attribute. */
+#define SESSION_MAX_POOL_SIZE (16)
+
+/* longest wait between reconnect probes while the circuit breaker is open. */
+#define SESSION_BREAKER_MAX_BACKOFF_MS (30000)
+
+#define SESSION_BREAKER_IS_OPEN(state) (((state) & 1) != 0)
+
+typedef struct ab_in_flight_t ab_in_flight_t;
+typedef struct ab_request_pool_t *ab_request_pool_p;
+typedef struct ab_transport_t *ab_transport_p;
+
+/* a FIFO of requests, linked through the requests themselves. */
+typedef struct {
+    ab_request_p head;
+    ab_request_p tail;
+    int count;
+} ab_request_queue_t;
 
 
 struct ab_session_t {
@@ -59,6 +96,8 @@ struct ab_session_t {
     int port;
     char *path;
     sock_p sock;
+    int connect_timeout_ms;
+    socket_options_t sock_opts;
 
     /* connection variables. */
     int use_connected_msg;
@@ -82,27 +121,125 @@ struct ab_session_t {
     /* Sequence ID for requests. */
     uint64_t session_seq_id;
 
-    /* list of outstanding requests for this session */
-    vector_p requests;
+    /* outstanding requests for this session, one FIFO per priority class. */
+    ab_request_queue_t requests[SESSION_NUM_PRIORITIES];
+    int num_requests;
+    int queued_pack_bytes;      /* payload of the queued requests that can be packed. */
+
+    /* queued reads that identical later reads can merge into, keyed on the request bytes. */
+    hashtable_p queued_reads;
+
+    /* recent read responses, keyed the same way.  Writes bump the generation to invalidate them. */
+    hashtable_p read_cache;
+    int read_cache_entries;
+    uint32_t read_cache_generation;
+
+    /* symbol instance IDs found by listing the controller tags, keyed on the name. */
+    hashtable_p symbol_ids;
+    uint32_t symbol_next_id;    /* where the next listing picks up. */
+    int symbols_complete;       /* all the controller tags have been listed. */
+
+    /* UDT templates read from the controller, keyed on the template ID.  Kept until the session goes. */
+    hashtable_p udt_templates;
+
+    /* elements with bit tags on them, keyed on the encoded name.  See session_bit_word_get(). */
+    hashtable_p bit_words;
+
+    /* encoded tag name prefixes, keyed on the name text.  Kept until the session goes. */
+    hashtable_p name_prefixes;
+    int num_name_prefixes;
+
+    /* released requests, with their buffers, kept for reuse. */
+    ab_request_pool_p request_pool;
+
+    /* packets sent and waiting for a response. */
+    ab_in_flight_t *in_flight;
+    int num_in_flight;
+    int num_requests_in_flight;
+    volatile int max_requests_in_flight;
+
+    /* sessions in a pool share a gateway and path, tags are spread over them. */
+    int pool_size;
+    atomic_int num_tags;
 
     /* data for receiving messages */
     uint64_t resp_seq_id;
     uint32_t data_offset;
     uint32_t data_capacity;
     uint32_t data_size;
-    uint8_t data[MAX_PACKET_SIZE_EX];
+    uint8_t *data;          /* rc buffer, tags may keep a reference to the parts of a packed reply. */
+    uint8_t *data_next;     /* replaces data once parts of it have been lent out. */
+    int data_lent;
+
+    /* frames read from the socket along with the last one, not handled yet. */
+    uint8_t *rx_extra;
+    uint32_t rx_extra_start;
+    uint32_t rx_extra_size;
+
+    /* packet being sent: headers in data, payloads left in the requests. */
+    socket_buf_t *send_bufs;
+    int num_send_bufs;
 
     uint64_t packet_count;
 
+    /* library wide metrics for this session. */
+    metrics_block_p metrics;
+
+    /* raw traffic capture, usually NULL. */
+    capture_p capture;
+
     thread_p handler_thread;
     volatile int terminating;
     mutex_p mutex;
+    cond_p wait_cond;
 
     /* disconnect handling */
     int auto_disconnect_enabled;
     int auto_disconnect_timeout_ms;
+
+    /* circuit breaker, off while the threshold is zero. */
+    volatile int breaker_threshold;
+    int breaker_failures;           /* connection failures since the last response. */
+    int breaker_backoff_ms;         /* wait before the next probe while open. */
+    volatile uint32_t breaker_state;    /* bumped on every change, odd while open. */
+
+    /* token bucket rate limit, off while both rates are zero.  Tokens are millionths of a packet or byte. */
+    int rate_packets_per_sec;
+    int rate_bytes_per_sec;
+    int64_t rate_packet_tokens;
+    int64_t rate_byte_tokens;
+    int64_t rate_refill_us;
+    int rate_wait_ms;               /* until the next packet may be sent, zero if it may now. */
+
+    /* socket shared with the sessions to other paths on the gateway, NULL if the session has its own. */
+    ab_transport_p transport;
+    uint32_t transport_generation;  /* of the socket the session is using. */
+    int transport_attached;
+    int transport_locked;
+
+    /* idle connections are probed this often instead of closed, zero if off. */
+    int keepalive_ms;
+    int64_t last_send_ms;
 };
 
+/*
+ * A read of part of a data file that can be widened to cover other reads
+ * of the same file.  The riders get their part of the response.
+ */
+typedef struct {
+    int64_t key;            /* the data file, zero if the read cannot be combined. */
+    int start;              /* bytes of the file wanted by the tag. */
+    int size;
+    int read_start;         /* bytes of the file the request reads, covering the riders. */
+    int read_size;
+    int max_size;           /* largest read that fits in one reply. */
+    int data_offset;        /* where the data starts in the response. */
+    int file_type;          /* the data file and element size, for encode. */
+    int file_num;
+    int elem_size;
+    int (*encode)(struct ab_request_t *req);    /* rewrite the request to read read_start to read_size. */
+} ab_request_span_t;
+
 struct ab_request_t {
     /* used to force interlocks with other threads. */
     lock_t lock;
@@ -120,8 +257,52 @@ struct ab_request_t {
     int allow_packing;
     int packing_num;
 
-    /* time stamp for debugging output */
+    /* one of the SESSION_PRIORITY_* classes. */
+    int priority;
+
+    /* time in ms after which nobody waits for the response, zero for never. */
+    int64_t deadline;
+
+    /* reads with the same bytes queued together share one response. */
+    int allow_merge;
+    int cache_ms;           /* answer from the session read cache if this fresh. */
+    int flush_read_cache;   /* writes make the cached reads stale. */
+    int merge_listed;
+    int64_t merge_key;
+    struct ab_request_t *merged_head;   /* duplicates riding on this request. */
+    struct ab_request_t *merged_next;   /* next duplicate riding on the same request. */
+
+    /* bit writes to the same element queued together go out as one Read-Modify-Write. */
+    int rmw_mask_offset;    /* where the OR mask starts, the AND mask follows. */
+    int rmw_mask_size;      /* zero if this is not a Read-Modify-Write. */
+
+    /* reads of nearby data in the same file queued together go out as one read. */
+    ab_request_span_t span;
+
+    /* links in the session queue for the priority class, if queued. */
+    int queued;
+    int queued_pack_bytes;  /* what this request added to the session count. */
+    struct ab_request_t *queue_next;
+    struct ab_request_t *queue_prev;
+
+    /* the pool this request goes back to when released. */
+    ab_request_pool_p pool;
+    struct ab_request_t *pool_next;
+
+    /* time stamps for debugging output and statistics, from time_us(). */
+    int64_t time_queued;
     int64_t time_sent;
+    int64_t time_received;
+
+    /*
+     * packed replies to requests that accept slices are left in the session
+     * receive buffer.  Only the CIP header is copied to data, the reply
+     * starting at reply_service is resp_size bytes at resp_data.
+     */
+    int accept_slice;
+    uint8_t *resp_buf;      /* rc reference to the receive buffer, or NULL. */
+    uint8_t *resp_data;
+    int resp_size;
 
     /* used by the background thread for incrementally getting data */
     int request_size; /* total bytes, not just data */
@@ -139,7 +320,34 @@ extern void session_teardown();
 
 extern int session_find_or_create(ab_session_p *session, attr attribs);
 extern int session_get_max_payload(ab_session_p session);
-extern int session_create_request(ab_session_p session, int tag_id, ab_request_p *request);
+extern int session_get_pack_room(ab_session_p session);
+extern int session_create_request(ab_session_p session, int tag_id, int priority, int64_t deadline, ab_request_p *request);
 extern int session_add_request(ab_session_p sess, ab_request_p req);
+extern void session_request_payload(ab_request_p req, uint8_t **data, uint8_t **data_end);
+extern void session_hold_requests(void);
+extern void session_release_requests(void);
+extern int session_find_symbol_id(ab_session_p session, const uint8_t *name, int name_len, uint32_t *instance_id, uint16_t *symbol_type, uint32_t *next_id);
+extern int session_add_symbol_id(ab_session_p session, const uint8_t *name, int name_len, uint32_t instance_id, uint16_t symbol_type);
+extern void session_set_symbol_progress(ab_session_p session, uint32_t next_id, int complete);
+extern void session_clear_symbol_ids(ab_session_p session);
+extern ab_udt_p session_find_udt(ab_session_p session, uint16_t template_id);
+extern int session_add_udt(ab_session_p session, uint16_t template_id, ab_udt_p udt);
+
+/*
+ * Bit tags on the same element share one read of it.  The first bit tag
+ * to start a read sends it, the others wait for its data.
+ */
+typedef struct ab_bit_word_t *ab_bit_word_p;
+
+extern ab_bit_word_p session_bit_word_get(ab_session_p session, const uint8_t *encoded_name, int name_size);
+extern void session_bit_word_release(ab_session_p session, ab_bit_word_p word);
+extern int session_bit_word_join(ab_session_p session, ab_bit_word_p word, int32_t tag_id, uint32_t *seq);
+extern int session_bit_word_check(ab_session_p session, ab_bit_word_p word, uint32_t seq, uint8_t *data, int size);
+extern void session_bit_word_done(ab_session_p session, ab_bit_word_p word, int32_t tag_id, int status, const uint8_t *data, int size);
+extern void session_bit_word_leave(ab_session_p session, ab_bit_word_p word, int32_t tag_id);
+
+/* CIP encodings of tag name prefixes, like Program:Main.MyUdt, shared by the tags on the session. */
+extern int session_find_name_prefix(ab_session_p session, const char *name, int name_len, uint8_t *encoded, int encoded_max);
+extern void session_add_name_prefix(ab_session_p session, const char *name, int name_len, const uint8_t *encoded, int encoded_size);
 
 #endif
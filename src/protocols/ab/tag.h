@@ -38,6 +38,10 @@
 #define MAX_TAG_NAME        (260)
 #define MAX_TAG_TYPE_INFO   (64)
 #define MAX_CONN_PATH       (260)   /* 256 plus padding. */
+#define AB_TAG_INLINE_DATA_SIZE (16)    /* up to an LREAL or LINT, or a DINT[4]. */
+#define AB_STANDBY_BREAKER_FAILURES (3) /* breaker default with a standby gateway. */
+#define AB_HEDGE_DEFAULT_DELAY_MS (50)  /* until there is a read latency to go by. */
+#define AB_HEDGE_MIN_DELAY_MS (5)
 
 /* they are used in some of these includes */
 #include <lib/libplctag.h>
@@ -68,51 +72,126 @@ struct ab_tag_t {
     /*struct plc_tag_t p_tag;*/
     TAG_BASE_STRUCT;
 
+    /*
+     * The fields used for every request come first, the set up fields
+     * and the large encoded name and type buffers are at the end.
+     */
+
     /* how do we talk to this device? */
     plc_type_t plc_type;
 
     /* pointers back to session */
     ab_session_p session;
     int use_connected_msg;
+    uint32_t breaker_seen;      /* last session circuit breaker state reported. */
 
-    /* this contains the encoded name */
-    uint8_t encoded_name[MAX_TAG_NAME];
-    int encoded_name_size;
+    /* gateway=a,b, the session not in use.  The two swap on failover. */
+    ab_session_p standby_session;
+    int failovers;
+    int hedge_reads;
+    int hedge_delay_ms;         /* zero to use the read latency p99. */
+    int64_t hedge_at_ms;        /* when to send the duplicate, zero if not armed. */
+    ab_request_p hedge_req;     /* the duplicate read on the standby. */
 
-//    const char *read_group;
+    /* requests */
+    ab_request_p req;
+    int offset;
+    int pre_write_read;
+    int first_read;
 
-    /* storage for the encoded type. */
-    uint8_t encoded_type_info[MAX_TAG_TYPE_INFO];
-    int encoded_type_info_size;
+    /* flags for operations */
+    int read_in_progress;
+    int write_in_progress;
+    /*int connect_in_progress;*/
+
+    /* number of elements and size of each in the tag. */
+    int elem_count;
+    int elem_size;
+
+    /* byte span of a ranged read or write, range_end is zero for the whole tag. */
+    int range_start;
+    int range_end;
+    int range_elem_count;       /* elements in the request, counted from the first one. */
+    int dirty_range_write;      /* the range came from the tag dirty ranges. */
 
     /* how much data can we send per packet? */
     int write_data_per_packet;
 
-    /* number of elements and size of each in the tag. */
-    pccc_file_t file_type;
+    int allow_packing;
+
+    /* request priority class for the session queue. */
+    int priority;
+
+    /* PCCC transaction number of the request in flight, the reply must match. */
+    uint16_t tns;
+
+    /* fragments of a large read that are all in flight at once. */
+    int concurrent_fragments;
+    int frag_count;
+    int frag_size;
+    ab_request_p *frag_reqs;
+
+    /* small tag data lives here instead of in its own allocation. */
+    uint8_t inline_data[AB_TAG_INLINE_DATA_SIZE];
+
+    /* how old a read through another handle on the session can be and still be used. */
+    int shared_read_cache_ms;
+
+    /* the Class 1 connection, if this is an implicit I/O tag. */
+    struct eip_cip_io_conn_t *io_conn;
+
     elem_type_t elem_type;
 
-    int elem_count;
-    int elem_size;
+    pccc_file_t file_type;
+    int file_num;
+    int file_elem;
+    int file_subelem;     /* -1 if the address is a whole element. */
 
     int tag_list;
     uint32_t next_id;
 
+    /* tag listing options: one page per read and which entries to keep. */
+    int list_paged;
+    int list_complete;
+    int list_programs;
+    char *list_prefix;
+
+    /* offsets of the entries in the listing, built when first asked for. */
+    int32_t *list_index;
+    int list_index_count;   /* -1 when the data changed since it was built. */
+    int list_index_capacity;
+
+    /* address the tag by its symbol instance ID once that has been looked up. */
+    int use_instance_id;
+    int resolving_symbol;
+    uint8_t *symbolic_name;     /* the encoded name before the ID replaced the symbol. */
+    int symbolic_name_size;
+
+    /* read the UDT templates so that members can be found by name. */
+    int udt_templates;
+    int udt_resolved;           /* the template of the tag data, if any, is known. */
+    uint16_t symbol_type;       /* from the controller tag listing. */
+    uint16_t udt_id;            /* template of the tag data, zero if it is not a structure. */
+    struct ab_udt_fetch_t *udt_fetch;
+    struct ab_udt_offset_t *udt_offsets;
+
     //int is_bit;
     //uint8_t bit;
 
-    /* requests */
-    int pre_write_read;
-    int first_read;
-    ab_request_p req;
-    int offset;
+    /* bit tags on the same element share its read, see session_bit_word_get(). */
+    ab_bit_word_p bit_word;
+    uint32_t bit_word_seq;
+    int bit_wait;               /* waiting on the read of another bit tag. */
+    int bit_lead;               /* our read is the one the others wait on. */
 
-    int allow_packing;
+    /* this contains the encoded name */
+    int encoded_name_size;
+    uint8_t encoded_name[MAX_TAG_NAME];
 
-    /* flags for operations */
-    int read_in_progress;
-    int write_in_progress;
-    /*int connect_in_progress;*/
+    /* storage for the encoded type. */
+    int type_from_cache;        /* from the metadata cache, not checked against a read yet. */
+    int encoded_type_info_size;
+    uint8_t encoded_type_info[MAX_TAG_TYPE_INFO];
 };
 
 
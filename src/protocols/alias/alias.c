@@ -0,0 +1,782 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <platform.h>
+#include <lib/libplctag.h>
+#include <lib/tag.h>
+#include <alias/alias.h>
+#include <util/attr.h>
+#include <util/debug.h>
+#include <util/rc.h>
+
+
+#define ALIAS_RETRY_MS  (5)
+
+#define ALIAS_OP_NONE   (0)
+#define ALIAS_OP_READ   (1)
+#define ALIAS_OP_WRITE  (2)
+
+
+/*
+ * The aliases of a parent tag.  The aliases hold a reference on the parent,
+ * the parent holds none on them.  An alias takes itself off the list before
+ * it is freed.  The sequence counts change each time an operation on the
+ * parent finishes.  The list is protected by alias_mutex, the counts by the
+ * parent API mutex.
+ */
+
+struct tag_alias_t {
+    int num_tags;
+    int max_tags;
+    plc_tag_p *tags;
+
+    uint32_t read_seq;
+    int read_status;
+    uint32_t write_seq;
+    int write_status;
+};
+
+
+struct alias_tag_t {
+    /*struct plc_tag_t p_tag;*/
+    TAG_BASE_STRUCT;
+
+    plc_tag_p parent;
+    int32_t parent_id;
+    int alias_offset;
+    int is_ready;
+
+    /* the operation the application asked for. */
+    int op;
+    int op_started;
+    uint32_t wait_seq;
+
+    uint32_t read_seen;
+
+    tag_byte_order_t alias_byte_order;
+};
+
+typedef struct alias_tag_t *alias_tag_p;
+
+
+static mutex_p alias_mutex = NULL;
+
+
+static int alias_register_unsafe(plc_tag_p parent, plc_tag_p tag);
+static void alias_unregister_unsafe(plc_tag_p parent, plc_tag_p tag);
+static int alias_tag_setup(alias_tag_p tag, plc_tag_p parent);
+static void alias_tag_update(alias_tag_p tag, plc_tag_p parent);
+static void alias_tag_start_op(alias_tag_p tag, plc_tag_p parent);
+static int alias_tag_copy_in(alias_tag_p tag, plc_tag_p parent);
+static void alias_tag_finish_op(alias_tag_p tag, int status);
+
+static void alias_tag_destroy(alias_tag_p tag);
+static int alias_tag_abort(plc_tag_p tag);
+static int alias_tag_read(plc_tag_p tag);
+static int alias_tag_status(plc_tag_p tag);
+static int alias_tag_tickler(plc_tag_p tag);
+static int alias_tag_write(plc_tag_p tag);
+static int alias_tag_get_int_attrib(plc_tag_p tag, const char *attrib_name, int default_value);
+static int alias_tag_set_int_attrib(plc_tag_p tag, const char *attrib_name, int new_value);
+
+struct tag_vtable_t alias_tag_vtable = {
+    /* abort */     alias_tag_abort,
+    /* read */      alias_tag_read,
+    /* status */    alias_tag_status,
+    /* tickler */   alias_tag_tickler,
+    /* write */     alias_tag_write,
+
+    /* data accessors */
+
+    /* get_int_attrib */ alias_tag_get_int_attrib,
+    /* set_int_attrib */ alias_tag_set_int_attrib,
+    /* get_member_offset */ NULL,
+    /* set_range */ NULL
+};
+
+
+
+int alias_init(void)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    rc = mutex_create(&alias_mutex);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_ERROR, "Unable to create alias mutex %s!", plc_tag_decode_error(rc));
+        return rc;
+    }
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return rc;
+}
+
+
+void alias_teardown(void)
+{
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(alias_mutex) {
+        mutex_destroy(&alias_mutex);
+        alias_mutex = NULL;
+    }
+
+    pdebug(DEBUG_INFO, "Done.");
+}
+
+
+
+
+/***************************************************************************
+ ******************************* Parent Side *******************************
+ **************************************************************************/
+
+
+/*
+ * alias_parent_done_unsafe
+ *
+ * Called when a read or write of a tag finishes.  Nothing is done unless
+ * the tag has aliases.  The aliases are woken and pick up the change from
+ * their tickler.
+ */
+
+void alias_parent_done_unsafe(plc_tag_p tag, int is_read, int status)
+{
+    struct tag_alias_t *aliases = tag->aliases;
+
+    if(!aliases) {
+        return;
+    }
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    if(is_read) {
+        aliases->read_status = status;
+        aliases->read_seq++;
+    } else {
+        aliases->write_status = status;
+        aliases->write_seq++;
+    }
+
+    critical_block(alias_mutex) {
+        for(int i=0; i < aliases->num_tags; i++) {
+            plc_tag_generic_wake_tag(aliases->tags[i]->tag_id);
+        }
+    }
+
+    pdebug(DEBUG_DETAIL, "Done.");
+}
+
+
+
+/*
+ * alias_parent_release
+ *
+ * Free the alias list of a tag.  The aliases hold references on the
+ * parent, so they are all gone by now.
+ */
+
+void alias_parent_release(plc_tag_p tag)
+{
+    struct tag_alias_t *aliases = tag->aliases;
+
+    if(!aliases) {
+        return;
+    }
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    critical_block(alias_mutex) {
+        tag->aliases = NULL;
+    }
+
+    if(aliases->tags) {
+        mem_free(aliases->tags);
+    }
+
+    mem_free(aliases);
+
+    pdebug(DEBUG_INFO, "Done.");
+}
+
+
+
+int alias_register_unsafe(plc_tag_p parent, plc_tag_p tag)
+{
+    struct tag_alias_t *aliases = parent->aliases;
+
+    if(!aliases) {
+        aliases = (struct tag_alias_t *)mem_alloc((int)sizeof(*aliases));
+        if(!aliases) {
+            pdebug(DEBUG_ERROR, "Unable to allocate the alias list!");
+            return PLCTAG_ERR_NO_MEM;
+        }
+
+        parent->aliases = aliases;
+    }
+
+    if(aliases->num_tags >= aliases->max_tags) {
+        int new_max = (aliases->max_tags ? aliases->max_tags * 2 : 8);
+        plc_tag_p *new_tags = (plc_tag_p *)mem_realloc(aliases->tags, new_max * (int)sizeof(plc_tag_p));
+
+        if(!new_tags) {
+            pdebug(DEBUG_ERROR, "Unable to grow the alias list!");
+            return PLCTAG_ERR_NO_MEM;
+        }
+
+        aliases->tags = new_tags;
+        aliases->max_tags = new_max;
+    }
+
+    aliases->tags[aliases->num_tags] = tag;
+    aliases->num_tags++;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+void alias_unregister_unsafe(plc_tag_p parent, plc_tag_p tag)
+{
+    struct tag_alias_t *aliases = parent->aliases;
+
+    if(!aliases) {
+        return;
+    }
+
+    for(int i=0; i < aliases->num_tags; i++) {
+        if(aliases->tags[i] == tag) {
+            aliases->num_tags--;
+            aliases->tags[i] = aliases->tags[aliases->num_tags];
+            break;
+        }
+    }
+}
+
+
+
+
+/***************************************************************************
+ ******************************* Alias Tags ********************************
+ **************************************************************************/
+
+
+plc_tag_p alias_tag_create(attr attribs)
+{
+    alias_tag_p tag = NULL;
+    plc_tag_p parent = NULL;
+    int32_t parent_id = attr_get_int(attribs, "alias_of", 0);
+    int offset = attr_get_int(attribs, "offset", 0);
+    int size = attr_get_int(attribs, "size", 0);
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(offset < 0 || size < 0) {
+        pdebug(DEBUG_WARN, "The alias offset and size must not be negative!");
+        return PLC_TAG_P_NULL;
+    }
+
+    tag = (alias_tag_p)rc_alloc((int)sizeof(struct alias_tag_t), (rc_cleanup_func)alias_tag_destroy);
+    if(!tag) {
+        pdebug(DEBUG_ERROR, "Unable to allocate memory for alias tag!");
+        return PLC_TAG_P_NULL;
+    }
+
+    tag->vtable = &alias_tag_vtable;
+    tag->parent_id = parent_id;
+    tag->alias_offset = offset;
+    tag->size = size;
+
+    /* the real byte order is copied from the parent when it is ready. */
+    tag->byte_order = &tag->alias_byte_order;
+
+    parent = plc_tag_generic_lookup_tag(parent_id);
+    if(!parent) {
+        pdebug(DEBUG_WARN, "Parent tag %d not found!", parent_id);
+        tag->status = PLCTAG_ERR_NOT_FOUND;
+        return (plc_tag_p)tag;
+    }
+
+    if(parent->vtable == &alias_tag_vtable) {
+        pdebug(DEBUG_WARN, "An alias cannot be the parent of another alias!");
+        tag->status = PLCTAG_ERR_BAD_PARAM;
+        rc_dec(parent);
+        return (plc_tag_p)tag;
+    }
+
+    /* the parent may still be being created, the tickler finishes the setup. */
+    tag->parent = parent;
+    tag->status = PLCTAG_STATUS_PENDING;
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return (plc_tag_p)tag;
+}
+
+
+
+void alias_tag_destroy(alias_tag_p tag)
+{
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(tag->parent) {
+        critical_block(alias_mutex) {
+            alias_unregister_unsafe(tag->parent, (plc_tag_p)tag);
+        }
+
+        /* this may be the last reference, release it outside the alias mutex. */
+        tag->parent = rc_dec(tag->parent);
+    }
+
+    plc_tag_generic_release_locks((plc_tag_p)tag);
+
+    if(tag->tag_cond_wait) {
+        cond_destroy(&(tag->tag_cond_wait));
+        tag->tag_cond_wait = NULL;
+    }
+
+    if(tag->change_detect) {
+        mem_free(tag->change_detect);
+        tag->change_detect = NULL;
+    }
+
+    if(tag->dirty_ranges) {
+        mem_free(tag->dirty_ranges);
+        tag->dirty_ranges = NULL;
+    }
+
+    if(tag->history) {
+        mem_free(tag->history);
+        tag->history = NULL;
+    }
+
+    if(tag->stats) {
+        mem_free(tag->stats);
+        tag->stats = NULL;
+    }
+
+    if(tag->byte_order && tag->byte_order->is_allocated) {
+        mem_free(tag->byte_order);
+        tag->byte_order = NULL;
+    }
+
+    /* the application owns any bound buffer. */
+    plc_tag_generic_unbind_buffer((plc_tag_p)tag);
+
+    if(tag->data) {
+        mem_free(tag->data);
+        tag->data = NULL;
+    }
+
+    plc_tag_generic_free_retired_data((plc_tag_p)tag);
+
+    pdebug(DEBUG_INFO, "Done.");
+}
+
+
+
+int alias_tag_abort(plc_tag_p ptag)
+{
+    alias_tag_p tag = (alias_tag_p)ptag;
+
+    tag->op = ALIAS_OP_NONE;
+    tag->op_started = 0;
+
+    if(tag->is_ready) {
+        tag->status = PLCTAG_STATUS_OK;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * alias_tag_read
+ *
+ * The read is done by the tickler when the parent is not busy, it may
+ * share a parent read already in flight.
+ */
+
+int alias_tag_read(plc_tag_p ptag)
+{
+    alias_tag_p tag = (alias_tag_p)ptag;
+
+    if(!tag->is_ready) {
+        return PLCTAG_ERR_BUSY;
+    }
+
+    tag->op = ALIAS_OP_READ;
+    tag->op_started = 0;
+    tag->status = PLCTAG_STATUS_PENDING;
+
+    return PLCTAG_STATUS_PENDING;
+}
+
+
+
+int alias_tag_status(plc_tag_p tag)
+{
+    return tag->status;
+}
+
+
+
+/*
+ * alias_tag_tickler
+ *
+ * Everything that touches the parent is done here.  The parent API mutex
+ * is only tried, a synchronous read of the parent holds it until the read
+ * is done and this runs with the API mutex of the alias held.
+ */
+
+int alias_tag_tickler(plc_tag_p ptag)
+{
+    alias_tag_p tag = (alias_tag_p)ptag;
+    plc_tag_p parent = NULL;
+    int rc = PLCTAG_STATUS_OK;
+
+    if(!tag->is_ready && tag->status != PLCTAG_STATUS_PENDING) {
+        return PLCTAG_STATUS_OK;
+    }
+
+    parent = plc_tag_generic_lookup_tag(tag->parent_id);
+    if(!parent) {
+        if(tag->status == PLCTAG_STATUS_PENDING) {
+            pdebug(DEBUG_WARN, "Parent tag %d is gone!", tag->parent_id);
+
+            if(tag->is_ready) {
+                alias_tag_finish_op(tag, PLCTAG_ERR_NOT_FOUND);
+            } else {
+                tag->status = PLCTAG_ERR_NOT_FOUND;
+            }
+        }
+
+        return PLCTAG_STATUS_OK;
+    }
+
+    if(mutex_try_lock(parent->api_mutex) != PLCTAG_STATUS_OK) {
+        /* a parent update may be waiting, come back soon. */
+        plc_tag_tickler_wake_later(ptag, ALIAS_RETRY_MS);
+        rc_dec(parent);
+        return PLCTAG_STATUS_PENDING;
+    }
+
+    do {
+        if(!tag->is_ready) {
+            rc = alias_tag_setup(tag, parent);
+            if(rc != PLCTAG_STATUS_OK) {
+                tag->status = (int8_t)rc;
+            }
+
+            if(!tag->is_ready) {
+                break;
+            }
+        }
+
+        alias_tag_update(tag, parent);
+
+        if(tag->op != ALIAS_OP_NONE && !tag->op_started) {
+            alias_tag_start_op(tag, parent);
+        }
+    } while(0);
+
+    mutex_unlock(parent->api_mutex);
+
+    rc_dec(parent);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * alias_tag_write
+ *
+ * The data is copied into the parent by the tickler.  Only the alias
+ * range is marked dirty, so the parent must track dirty ranges.
+ */
+
+int alias_tag_write(plc_tag_p ptag)
+{
+    alias_tag_p tag = (alias_tag_p)ptag;
+    plc_tag_p parent = NULL;
+    int tracks_ranges = 0;
+
+    if(!tag->is_ready) {
+        return PLCTAG_ERR_BUSY;
+    }
+
+    parent = plc_tag_generic_lookup_tag(tag->parent_id);
+    if(!parent) {
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    /* this is set when the parent is created and does not change. */
+    tracks_ranges = (parent->dirty_ranges != NULL);
+
+    rc_dec(parent);
+
+    if(!tracks_ranges) {
+        pdebug(DEBUG_WARN, "The parent tag needs write_dirty_ranges=1 for alias writes!");
+        return PLCTAG_ERR_NOT_ALLOWED;
+    }
+
+    tag->op = ALIAS_OP_WRITE;
+    tag->op_started = 0;
+    tag->status = PLCTAG_STATUS_PENDING;
+
+    return PLCTAG_STATUS_PENDING;
+}
+
+
+
+int alias_tag_get_int_attrib(plc_tag_p ptag, const char *attrib_name, int default_value)
+{
+    alias_tag_p tag = (alias_tag_p)ptag;
+
+    if(str_cmp_i(attrib_name, "alias_of") == 0) {
+        return (int)tag->parent_id;
+    } else if(str_cmp_i(attrib_name, "offset") == 0) {
+        return tag->alias_offset;
+    }
+
+    return default_value;
+}
+
+
+
+int alias_tag_set_int_attrib(plc_tag_p tag, const char *attrib_name, int new_value)
+{
+    (void)tag;
+    (void)attrib_name;
+    (void)new_value;
+
+    return PLCTAG_ERR_UNSUPPORTED;
+}
+
+
+
+/*
+ * alias_tag_setup
+ *
+ * Finish the alias once the parent is created.  Both API mutexes are held.
+ */
+
+int alias_tag_setup(alias_tag_p tag, plc_tag_p parent)
+{
+    int rc = PLCTAG_STATUS_OK;
+    int parent_status = parent->vtable->status(parent);
+
+    if(parent_status == PLCTAG_STATUS_PENDING && parent->size == 0) {
+        /* still being created. */
+        return PLCTAG_STATUS_OK;
+    }
+
+    if(parent->size == 0) {
+        pdebug(DEBUG_WARN, "Parent tag %d has no data, error %s!", tag->parent_id, plc_tag_decode_error(parent_status));
+        return (parent_status < 0 ? parent_status : PLCTAG_ERR_NO_DATA);
+    }
+
+    /* the alias runs to the end of the parent if no size is given. */
+    if(tag->size == 0) {
+        tag->size = parent->size - tag->alias_offset;
+    }
+
+    if(tag->size <= 0 || tag->alias_offset + tag->size > parent->size) {
+        pdebug(DEBUG_WARN, "Alias range %d+%d is outside the %d bytes of tag %d!", tag->alias_offset, tag->size, parent->size, tag->parent_id);
+        return PLCTAG_ERR_OUT_OF_BOUNDS;
+    }
+
+    tag->data = (uint8_t *)mem_alloc(tag->size);
+    if(!tag->data) {
+        pdebug(DEBUG_ERROR, "Unable to allocate alias data!");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    critical_block(alias_mutex) {
+        rc = alias_register_unsafe(parent, (plc_tag_p)tag);
+    }
+
+    if(rc != PLCTAG_STATUS_OK) {
+        return rc;
+    }
+
+    /* the alias data is laid out like the parent data. */
+    if(tag->byte_order && tag->byte_order->is_allocated) {
+        mem_free(tag->byte_order);
+    }
+
+    tag->alias_byte_order = *(parent->byte_order);
+    tag->alias_byte_order.is_allocated = 0;
+    tag->byte_order = &tag->alias_byte_order;
+    plc_tag_generic_update_byte_order((plc_tag_p)tag);
+
+    mem_copy(tag->data, parent->data + tag->alias_offset, tag->size);
+
+    tag->read_seen = parent->aliases->read_seq;
+    tag->is_ready = 1;
+    tag->status = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_INFO, "Alias of tag %d bytes %d to %d is ready.", tag->parent_id, tag->alias_offset, tag->alias_offset + tag->size - 1);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * alias_tag_update
+ *
+ * Copy the alias range out of the parent if a parent read finished and
+ * finish any operation waiting on the parent.  Reads the alias did not ask
+ * for raise a read completion too, that is how callbacks see the updates.
+ */
+
+void alias_tag_update(alias_tag_p tag, plc_tag_p parent)
+{
+    struct tag_alias_t *aliases = parent->aliases;
+
+    /* a write waiting for the parent must not lose its data. */
+    if(aliases->read_seq != tag->read_seen && tag->op != ALIAS_OP_WRITE) {
+        int status = aliases->read_status;
+
+        tag->read_seen = aliases->read_seq;
+
+        if(status == PLCTAG_STATUS_OK) {
+            status = alias_tag_copy_in(tag, parent);
+        }
+
+        if(tag->op == ALIAS_OP_NONE) {
+            tag->status = (int8_t)status;
+            tag->read_complete = 1;
+        } else if(tag->op == ALIAS_OP_READ && tag->op_started) {
+            alias_tag_finish_op(tag, status);
+        }
+    }
+
+    if(tag->op == ALIAS_OP_WRITE && tag->op_started && aliases->write_seq != tag->wait_seq) {
+        alias_tag_finish_op(tag, aliases->write_status);
+    }
+}
+
+
+
+/*
+ * alias_tag_start_op
+ *
+ * Start the parent operation the alias needs.  A read joins one that is
+ * already in flight.  Anything else waits until the parent is free.
+ */
+
+void alias_tag_start_op(alias_tag_p tag, plc_tag_p parent)
+{
+    int rc = PLCTAG_STATUS_OK;
+    int is_done = 0;
+
+    if(tag->op == ALIAS_OP_READ && parent->read_in_flight) {
+        tag->op_started = 1;
+        return;
+    }
+
+    if(parent->read_in_flight || parent->write_in_flight) {
+        plc_tag_tickler_wake_later((plc_tag_p)tag, ALIAS_RETRY_MS);
+        return;
+    }
+
+    if(tag->op == ALIAS_OP_READ) {
+        rc = plc_tag_generic_start_read(parent, &is_done);
+
+        /* from the cache or an error, the other aliases do not see it. */
+        if(is_done) {
+            if(rc == PLCTAG_STATUS_OK) {
+                rc = alias_tag_copy_in(tag, parent);
+            }
+
+            alias_tag_finish_op(tag, rc);
+            return;
+        }
+    } else {
+        plc_tag_generic_data_write_begin(parent);
+        mem_copy(parent->data + tag->alias_offset, tag->data, tag->size);
+        plc_tag_generic_data_write_end(parent);
+
+        plc_tag_generic_add_dirty_range(parent, tag->alias_offset, tag->size);
+
+        /* reads skipped while the write waited are covered by the data just copied. */
+        tag->read_seen = parent->aliases->read_seq;
+        tag->wait_seq = parent->aliases->write_seq;
+
+        rc = plc_tag_generic_start_write(parent, &is_done);
+        if(is_done) {
+            alias_tag_finish_op(tag, rc);
+            return;
+        }
+    }
+
+    tag->op_started = 1;
+}
+
+
+
+int alias_tag_copy_in(alias_tag_p tag, plc_tag_p parent)
+{
+    /* the parent data may have been resized. */
+    if(tag->alias_offset + tag->size > parent->size) {
+        pdebug(DEBUG_WARN, "Alias range is outside the %d bytes of tag %d now!", parent->size, tag->parent_id);
+        return PLCTAG_ERR_OUT_OF_BOUNDS;
+    }
+
+    plc_tag_generic_data_write_begin((plc_tag_p)tag);
+    mem_copy(tag->data, parent->data + tag->alias_offset, tag->size);
+    plc_tag_generic_data_write_end((plc_tag_p)tag);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+void alias_tag_finish_op(alias_tag_p tag, int status)
+{
+    if(tag->op == ALIAS_OP_WRITE) {
+        tag->write_complete = 1;
+    } else {
+        tag->read_complete = 1;
+    }
+
+    tag->op = ALIAS_OP_NONE;
+    tag->op_started = 0;
+    tag->status = (int8_t)status;
+}
@@ -0,0 +1,66 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#ifndef __PROTOCOL_ALIAS_H__
+#define __PROTOCOL_ALIAS_H__ 1
+
+#include <util/attr.h>
+#include <util/debug.h>
+#include <platform.h>
+#include <lib/tag.h>
+
+/*
+ * Alias tags.
+ *
+ * A tag created with alias_of=<tag id>&offset=<bytes>&size=<bytes> is a view
+ * on a range of the data of another tag, the parent.  It has no network
+ * requests of its own.  Each time a read of the parent finishes the alias
+ * copies its range and raises its own read completion, so hundreds of small
+ * tags can be fed by one read of a large array or UDT.  Reading an alias
+ * waits for the next parent read, starting one if the parent is idle.
+ * Writing an alias copies its data into the parent, marks only that range
+ * dirty and writes the parent.  This needs write_dirty_ranges=1 on the
+ * parent, otherwise the whole parent, with possibly stale data, would be
+ * sent.
+ */
+
+extern int alias_init(void);
+extern void alias_teardown(void);
+
+extern plc_tag_p alias_tag_create(attr attribs);
+
+/* parent side, these are called by the generic tag code. */
+extern void alias_parent_done_unsafe(plc_tag_p tag, int is_read, int status);   /* tag API mutex held. */
+extern void alias_parent_release(plc_tag_p tag);                                /* from the tag destructor. */
+
+#endif
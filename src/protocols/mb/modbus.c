@@ -34,12 +34,19 @@
 #include <ctype.h>
 #include <limits.h>
 #include <float.h>
+#include <inttypes.h>
 #include <platform.h>
 #include <lib/libplctag.h>
 #include <mb/modbus.h>
+#include <shared/shared.h>
+#include <alias/alias.h>
 #include <util/attr.h>
 #include <util/debug.h>
+#include <util/capture.h>
+#include <util/metrics.h>
 #include <util/rc.h>
+#include <util/socket_opts.h>
+#include <util/trace.h>
 
 /* data definitions */
 
@@ -52,40 +59,124 @@
 #define MAX_MODBUS_RESPONSE_PAYLOAD (250)
 #define MAX_MODBUS_PDU_PAYLOAD (253)  /* everything after the server address */
 #define MODBUS_INACTIVITY_TIMEOUT (5000)
+#define MODBUS_IDLE_WAIT_TIME (100)
+
+/* the caller stopped waiting for the tag's operation. */
+#define MB_TAG_EXPIRED(tag, now) ((tag)->op_deadline && (tag)->op_deadline <= (now))
+#define MODBUS_DEFAULT_CONNECT_TIMEOUT (5000)
+#define MODBUS_MAX_REQUESTS_IN_FLIGHT (16)
+#define MODBUS_MAX_FC23_WRITE_REGISTERS (121)
+#define MODBUS_RTU_DEFAULT_BAUD_RATE (19200)
+#define MODBUS_RTU_DEFAULT_RESPONSE_TIMEOUT (1000)
+#define MODBUS_RTU_MAX_FRAME_SIZE (MAX_MODBUS_PDU_PAYLOAD + 7)  /* address, function, count, CRC and some slop */
+
+typedef enum { MB_TRANSPORT_TCP, MB_TRANSPORT_RTU, MB_TRANSPORT_RTU_TCP } modbus_transport_t;
 
 struct modbus_plc_t {
     struct modbus_plc_t *next;
+    struct modbus_plc_t *teardown_next;     /* PLCs being stopped by mb_teardown(). */
 
     /* keep a list of tags for this PLC. */
     struct modbus_tag_t *tags;
 
-    /* hostname/ip and possibly port of the server. */
+    /*
+     * only tags with something to do are processed.  Tags are put on the
+     * ready list by the API side, under ready_lock, and moved to the active
+     * list by the handler thread, under the mutex.
+     */
+    struct modbus_tag_t *ready_tags;
+    struct modbus_tag_t *active_tags;
+    lock_t ready_lock;
+
+    /* hostname/ip and possibly port of the server, or the serial port for RTU. */
     char *server;
     sock_p sock;
     uint8_t server_id;
 
+    /* RTU framing goes over a serial port or a TCP socket. */
+    modbus_transport_t transport;
+    serial_port_p port;
+    int baud_rate;
+    int data_bits;
+    int stop_bits;
+    int parity;
+    int frame_gap_us;
+    int response_timeout_ms;
+
+    /*
+     * RTU frames have no transaction ID so only one request is on the wire
+     * at a time.  The response gets the request's ID so that tags match it
+     * as if it came over Modbus TCP.
+     */
+    int rtu_waiting;
+    uint16_t rtu_seq_id;
+    uint8_t rtu_server_id;
+    uint8_t rtu_function;
+    int64_t rtu_response_deadline;
+    int rtu_frame_len;
+    int rtu_frame_offset;
+    uint8_t rtu_frame[MODBUS_RTU_MAX_FRAME_SIZE];
+    int rtu_rx_len;
+    uint8_t rtu_rx[MODBUS_RTU_MAX_FRAME_SIZE];
+
     /* State */
     struct {
         unsigned int terminate:1;
         unsigned int response_ready:1;
         unsigned int request_ready:1;
-        unsigned int request_in_flight:1;
     } flags;
     uint16_t seq_id;
 
+    /* requests sent or queued without a matching response, guarded by the mutex. */
+    int num_in_flight;
+    int max_requests_in_flight;
+
+    /*
+     * all the units behind a gateway share its connection and window.  Each
+     * unit with work waiting gets an even share of the window per pass.
+     */
+    uint16_t unit_in_flight[256];
+    int unit_share;
+
+    /* unused registers allowed between tags combined into one read, negative turns it off. */
+    int coalesce_gap;
+
+    /* fold a waiting holding register read into a write with FC23. */
+    int read_write_multiple;
+
     /* thread related state */
     thread_p handler_thread;
     mutex_p mutex;
 
-    /* comms timeout/disconnect. */
+    /* wakes the handler thread, sock_lock guards the socket pointer for wakers. */
+    cond_p wait_cond;
+    lock_t sock_lock;
+
+    /* comms timeout/disconnect.  An idle_timeout_ms of zero keeps the connection open. */
     int64_t inactivity_timeout_ms;
+    int idle_timeout_ms;
+    int reconnect_ahead_ms;
+    int connect_timeout_ms;
+    socket_options_t sock_opts;
+
+    /* earliest operation deadline of the active tags, handler thread only. */
+    int64_t next_op_deadline;
+
+    /* library wide metrics for this PLC. */
+    metrics_block_p metrics;
+
+    /* raw traffic capture, usually NULL. */
+    capture_p capture;
 
     /* data */
     int read_data_len;
     uint8_t read_data[PLC_READ_DATA_LEN];
     int write_data_len;
     int write_data_offset;
-    uint8_t write_data[PLC_WRITE_DATA_LEN];
+    int write_data_count;
+
+    /* requests queue up back to back, the transaction ID matches the responses. */
+    uint8_t write_data[PLC_WRITE_DATA_LEN * MODBUS_MAX_REQUESTS_IN_FLIGHT];
 };
 
 typedef struct modbus_plc_t *modbus_plc_p;
@@ -99,7 +190,8 @@ typedef enum { MB_CMD_READ_COIL_MULTI = 0x01,
                MB_CMD_WRITE_COIL_SINGLE = 0x05,
                MB_CMD_WRITE_HOLDING_REGISTER_SINGLE = 0x06,
                MB_CMD_WRITE_COIL_MULTI = 0x0F,
-               MB_CMD_WRITE_HOLDING_REGISTER_MULTI = 0x10
+               MB_CMD_WRITE_HOLDING_REGISTER_MULTI = 0x10,
+               MB_CMD_READ_WRITE_HOLDING_REGISTER_MULTI = 0x17
              } modbug_cmd_t;
 
 struct modbus_tag_t {
@@ -109,10 +201,16 @@ struct modbus_tag_t {
     /* next one in the list for this PLC */
     struct modbus_tag_t *next;
 
+    /* next one in the PLC's ready or active list. */
+    struct modbus_tag_t *next_active;
+
     /* register type. */
     modbus_reg_type_t reg_type;
     uint16_t reg_base;
 
+    /* unit on the bus, RTU slaves share their PLC's port. */
+    uint8_t server_id;
+
     /* the PLC we are using */
     modbus_plc_p plc;
 
@@ -122,9 +220,14 @@ struct modbus_tag_t {
         unsigned int _read:1;
         unsigned int _write:1;
         unsigned int _busy:1;
+        unsigned int _grouped:1;
+        unsigned int _scheduled:1;
     } flags;
     uint16_t request_num;
     uint16_t seq_id;
+
+    /* first register of the combined read this tag is part of. */
+    uint16_t read_base;
     lock_t tag_lock;
 
     /* data for the tag. */
@@ -176,10 +279,36 @@ static void modbus_tag_destructor(void *tag_arg);
 static void modbus_plc_destructor(void *plc_arg);
 static THREAD_FUNC(modbus_plc_handler);
 static int connect_plc(modbus_plc_p plc);
+static void check_reconnect_ahead(modbus_plc_p plc);
+static int plc_is_connected(modbus_plc_p plc);
+static void close_plc(modbus_plc_p plc);
+static int parse_parity(const char *parity_str, int *parity);
+static void wake_plc(modbus_plc_p plc);
+static void wait_plc(modbus_plc_p plc, int64_t err_delay);
 static int read_packet(modbus_plc_p plc);
 static int write_packet(modbus_plc_p plc);
+static int read_bytes(modbus_plc_p plc, uint8_t *data, int size);
+static int write_bytes(modbus_plc_p plc, uint8_t *data, int size);
+static int rtu_frame_size(const uint8_t *frame, int len);
+static int read_rtu_packet(modbus_plc_p plc);
+static int write_rtu_packet(modbus_plc_p plc);
+static uint16_t modbus_crc16(const uint8_t *data, int size);
 static int process_tag(modbus_tag_p tag, modbus_plc_p plc);
+static int tag_is_expired(modbus_tag_p tag);
+static void expire_tag(modbus_tag_p tag, modbus_plc_p plc);
+static void schedule_tag(modbus_tag_p tag);
+static void take_ready_tags(modbus_plc_p plc);
+static void unlink_scheduled_tag(modbus_plc_p plc, modbus_tag_p tag);
+static int can_queue_request(modbus_plc_p plc, modbus_tag_p tag);
+static void take_request_slot(modbus_plc_p plc, modbus_tag_p tag);
+static void release_request_slot(modbus_plc_p plc, modbus_tag_p tag);
+static void update_unit_share(modbus_plc_p plc);
+static int is_request_shared(modbus_plc_p plc, modbus_tag_p tag);
 static int check_read_response(modbus_plc_p plc, modbus_tag_p tag);
+static int check_group_response(modbus_plc_p plc, uint16_t seq_id);
+static int plan_read_group(modbus_plc_p plc, modbus_tag_p tag, int *base_register, int *register_count);
+static int plan_write_group(modbus_plc_p plc, modbus_tag_p tag, int *base_register, int *register_count);
+static int plan_read_write_group(modbus_plc_p plc, modbus_tag_p tag, int write_count, int *read_base_register, int *read_register_count);
 static int create_read_request(modbus_plc_p plc, modbus_tag_p tag);
 static int check_write_response(modbus_plc_p plc, modbus_tag_p tag);
 static int create_write_request(modbus_plc_p plc, modbus_tag_p tag);
@@ -220,7 +349,13 @@ struct tag_vtable_t modbus_vtable = {
 
     /* data accessors */
     mb_get_int_attrib,
-    mb_set_int_attrib
+    mb_set_int_attrib,
+
+    /* no structure member lookup */
+    NULL,
+
+    /* no element ranges */
+    NULL
 };
 
 
@@ -243,6 +378,8 @@ plc_tag_p mb_tag_create(attr attribs)
     /* find the PLC object. */
     rc = find_or_create_plc(attribs, &(tag->plc));
     if(rc == PLCTAG_STATUS_OK) {
+        tag->server_id = (uint8_t)(unsigned int)attr_get_int(attribs, "path", 0);
+
         /* put the tag on the PLC's list. */
         critical_block(tag->plc->mutex) {
             tag->next = tag->plc->tags;
@@ -252,6 +389,7 @@ plc_tag_p mb_tag_create(attr attribs)
         /* trigger a read to get the initial value of the tag. */
         tag->read_in_flight = 1;
         tag->flags._read = 1;
+        schedule_tag(tag);
     } else {
         pdebug(DEBUG_WARN, "Unable to create new tag!  Error %s!", plc_tag_decode_error(rc));
         tag->status = (int8_t)rc;
@@ -326,6 +464,7 @@ int create_tag_object(attr attribs, modbus_tag_p *tag)
 
     /* point the data just after the tag struct. */
     (*tag)->data = (uint8_t *)((*tag) + 1);
+    (*tag)->data_inline = 1;
 
     /* set the various size/element fields. */
     (*tag)->reg_base = (uint16_t)(unsigned int)reg_base;
@@ -375,22 +514,50 @@ void modbus_tag_destructor(void *tag_arg)
             } else {
                 pdebug(DEBUG_WARN, "Tag not found on PLC list!");
             }
+
+            unlink_scheduled_tag(tag->plc, tag);
+
+            /* a response for this tag will be dropped. */
+            if(tag->flags._busy && !is_request_shared(tag->plc, tag)) {
+                release_request_slot(tag->plc, tag);
+            }
         }
 
         pdebug(DEBUG_DETAIL, "Releasing the reference to the PLC.");
         tag->plc = rc_dec(tag->plc);
     }
 
-    if(tag->api_mutex) {
-        mutex_destroy(&(tag->api_mutex));
-        tag->api_mutex = NULL;
+    if(tag->tag_cond_wait) {
+        cond_destroy(&(tag->tag_cond_wait));
+        tag->tag_cond_wait = NULL;
+    }
+
+    if(tag->change_detect) {
+        mem_free(tag->change_detect);
+        tag->change_detect = NULL;
+    }
+
+    if(tag->dirty_ranges) {
+        mem_free(tag->dirty_ranges);
+        tag->dirty_ranges = NULL;
+    }
+
+    if(tag->history) {
+        mem_free(tag->history);
+        tag->history = NULL;
     }
 
-    if(tag->ext_mutex) {
-        mutex_destroy(&(tag->ext_mutex));
-        tag->ext_mutex = NULL;
+    if(tag->stats) {
+        mem_free(tag->stats);
+        tag->stats = NULL;
     }
 
+    /* stop publishing before the data goes away. */
+    shared_publish_release((plc_tag_p)tag);
+    alias_parent_release((plc_tag_p)tag);
+
+    plc_tag_generic_release_locks((plc_tag_p)tag);
+
     if(tag->byte_order && tag->byte_order->is_allocated) {
         mem_free(tag->byte_order);
         tag->byte_order = NULL;
@@ -406,6 +573,20 @@ int find_or_create_plc(attr attribs, modbus_plc_p *plc)
 {
     const char *server = attr_get_str(attribs, "gateway", NULL);
     int server_id = attr_get_int(attribs, "path", -1);
+    int connect_timeout_ms = attr_get_int(attribs, "connect_timeout_ms", MODBUS_DEFAULT_CONNECT_TIMEOUT);
+    int idle_timeout_ms = attr_get_int(attribs, "idle_timeout_ms", MODBUS_INACTIVITY_TIMEOUT);
+    int reconnect_ahead_ms = attr_get_int(attribs, "reconnect_ahead_ms", 0);
+    int max_requests_in_flight = attr_get_int(attribs, "max_requests_in_flight", 1);
+    int coalesce_gap = attr_get_int(attribs, "coalesce_gap", -1);
+    int read_write_multiple = attr_get_int(attribs, "read_write_multiple", 0);
+    const char *protocol = attr_get_str(attribs, "protocol", "modbus-tcp");
+    const char *capture_file = attr_get_str(attribs, "capture_file", NULL);
+    modbus_transport_t transport = MB_TRANSPORT_TCP;
+    int baud_rate = attr_get_int(attribs, "baud_rate", MODBUS_RTU_DEFAULT_BAUD_RATE);
+    int data_bits = attr_get_int(attribs, "data_bits", 8);
+    int stop_bits = attr_get_int(attribs, "stop_bits", 1);
+    int parity = 0;
+    int response_timeout_ms = attr_get_int(attribs, "response_timeout_ms", MODBUS_RTU_DEFAULT_RESPONSE_TIMEOUT);
     int is_new = 0;
     int rc = PLCTAG_STATUS_OK;
 
@@ -416,11 +597,57 @@ int find_or_create_plc(attr attribs, modbus_plc_p *plc)
         return PLCTAG_ERR_OUT_OF_BOUNDS;
     }
 
+    if(str_cmp_i(protocol, "modbus-rtu") == 0 || str_cmp_i(protocol, "modbus_rtu") == 0) {
+        transport = MB_TRANSPORT_RTU;
+    } else if(str_cmp_i(protocol, "modbus-rtu-tcp") == 0 || str_cmp_i(protocol, "modbus_rtu_tcp") == 0) {
+        transport = MB_TRANSPORT_RTU_TCP;
+    }
+
+    if(transport != MB_TRANSPORT_TCP) {
+        /* RTU cannot address the broadcast unit and still get a response. */
+        if(server_id < 1 || server_id > 247) {
+            pdebug(DEBUG_WARN, "RTU slave address, %d, must be between 1 and 247!", server_id);
+            return PLCTAG_ERR_OUT_OF_BOUNDS;
+        }
+
+        if(response_timeout_ms <= 0) {
+            pdebug(DEBUG_WARN, "response_timeout_ms must be positive!");
+            return PLCTAG_ERR_OUT_OF_BOUNDS;
+        }
+    }
+
+    /* the spec default for RTU is even parity. */
+    rc = parse_parity(attr_get_str(attribs, "parity", (transport == MB_TRANSPORT_RTU ? "even" : "none")), &parity);
+    if(rc != PLCTAG_STATUS_OK) {
+        return rc;
+    }
+
+    if(connect_timeout_ms <= 0) {
+        pdebug(DEBUG_WARN, "connect_timeout_ms must be positive, using %d.", MODBUS_DEFAULT_CONNECT_TIMEOUT);
+        connect_timeout_ms = MODBUS_DEFAULT_CONNECT_TIMEOUT;
+    }
+
+    if(idle_timeout_ms < 0) {
+        pdebug(DEBUG_WARN, "idle_timeout_ms must not be negative, using %d.", MODBUS_INACTIVITY_TIMEOUT);
+        idle_timeout_ms = MODBUS_INACTIVITY_TIMEOUT;
+    }
+
+    if(reconnect_ahead_ms < 0) {
+        pdebug(DEBUG_WARN, "reconnect_ahead_ms must not be negative, turning it off.");
+        reconnect_ahead_ms = 0;
+    }
+
+    if(max_requests_in_flight < 1 || max_requests_in_flight > MODBUS_MAX_REQUESTS_IN_FLIGHT) {
+        pdebug(DEBUG_WARN, "max_requests_in_flight must be between 1 and %d!", MODBUS_MAX_REQUESTS_IN_FLIGHT);
+        return PLCTAG_ERR_OUT_OF_BOUNDS;
+    }
+
     /* see if we can find a matching server. */
     critical_block(mb_mutex) {
         modbus_plc_p *walker = &plcs;
 
-        while(*walker && (*walker)->server_id == (uint8_t)(unsigned int)server_id && str_cmp_i(server, (*walker)->server) != 0) {
+        /* all the units behind a gateway or on an RTU line share it. */
+        while(*walker && ((*walker)->transport != transport || str_cmp_i(server, (*walker)->server) != 0)) {
             walker = &((*walker)->next);
         }
 
@@ -428,6 +655,17 @@ int find_or_create_plc(attr attribs, modbus_plc_p *plc)
         if(*walker) {
             *plc = rc_inc(*walker);
             is_new = 0;
+
+            /* the tag asking for the longest lived connection wins. */
+            if(*plc) {
+                if(!idle_timeout_ms || ((*plc)->idle_timeout_ms && idle_timeout_ms > (*plc)->idle_timeout_ms)) {
+                    (*plc)->idle_timeout_ms = idle_timeout_ms;
+                }
+
+                if(reconnect_ahead_ms > (*plc)->reconnect_ahead_ms) {
+                    (*plc)->reconnect_ahead_ms = reconnect_ahead_ms;
+                }
+            }
         } else {
             /* nope, make a new one.  Do as little as possible in the mutex. */
             is_new = 1;
@@ -442,6 +680,7 @@ int find_or_create_plc(attr attribs, modbus_plc_p *plc)
                 } else {
                     /* link up the list. */
                     (*plc)->server_id = (uint8_t)(unsigned int)server_id;
+                    (*plc)->transport = transport;
                     (*plc)->next = plcs;
                     plcs = *plc;
                 }
@@ -458,9 +697,58 @@ int find_or_create_plc(attr attribs, modbus_plc_p *plc)
             pdebug(DEBUG_INFO, "Creating new PLC.");
 
             /* we want to stay connected initially */
-            (*plc)->inactivity_timeout_ms = MODBUS_INACTIVITY_TIMEOUT + time_ms();
+            (*plc)->idle_timeout_ms = idle_timeout_ms;
+            (*plc)->reconnect_ahead_ms = reconnect_ahead_ms;
+            (*plc)->inactivity_timeout_ms = idle_timeout_ms + time_ms();
+            (*plc)->connect_timeout_ms = connect_timeout_ms;
+            (*plc)->max_requests_in_flight = max_requests_in_flight;
+            (*plc)->coalesce_gap = coalesce_gap;
+            (*plc)->read_write_multiple = (read_write_multiple ? 1 : 0);
+            (*plc)->baud_rate = baud_rate;
+            (*plc)->data_bits = data_bits;
+            (*plc)->stop_bits = stop_bits;
+            (*plc)->parity = parity;
+            (*plc)->response_timeout_ms = response_timeout_ms;
+
+            /*
+             * RTU frames end after 3.5 character times of silence, fixed at
+             * 1750us above 19200 baud.  A character is a start bit, the data,
+             * parity and stop bits.
+             */
+            if(baud_rate > 19200) {
+                (*plc)->frame_gap_us = 1750;
+            } else if(baud_rate > 0) {
+                int char_bits = 1 + data_bits + (parity ? 1 : 0) + stop_bits;
+
+                (*plc)->frame_gap_us = (int)(((int64_t)char_bits * 3500000) / baud_rate);
+            }
+            socket_options_from_attr(attribs, &((*plc)->sock_opts));
+
+            /* RTU frames have no length field, only Modbus TCP is captured. */
+            if(str_length(capture_file) && transport == MB_TRANSPORT_TCP) {
+                (*plc)->capture = capture_open(capture_file, CAPTURE_PROTOCOL_MODBUS_TCP);
+            }
+
+            /* metrics are not critical, the PLC works without them. */
+            (*plc)->metrics = metrics_register("modbus_plc", server,
+                                               METRIC_BIT(METRIC_PACKETS_SENT) | METRIC_BIT(METRIC_PACKETS_RECEIVED)
+                                             | METRIC_BIT(METRIC_BYTES_SENT) | METRIC_BIT(METRIC_BYTES_RECEIVED)
+                                             | METRIC_BIT(METRIC_CONNECTS) | METRIC_BIT(METRIC_IN_FLIGHT)
+                                             | METRIC_BIT(METRIC_REQUESTS_EXPIRED));
+
+            (*plc)->sock_lock = LOCK_INIT;
+            (*plc)->ready_lock = LOCK_INIT;
+
+            rc = cond_create(&((*plc)->wait_cond));
+            if(rc != PLCTAG_STATUS_OK) {
+                pdebug(DEBUG_WARN, "Unable to create new condition var, error %s!", plc_tag_decode_error(rc));
+            } else {
+                rc = thread_create(&((*plc)->handler_thread), modbus_plc_handler, 32768, (void *)(*plc));
+                if(rc == PLCTAG_STATUS_OK) {
+                    plc_tag_generic_tune_thread((*plc)->handler_thread, PLCTAG_THREAD_MODBUS);
+                }
+            }
 
-            rc = thread_create(&((*plc)->handler_thread), modbus_plc_handler, 32768, (void *)(*plc));
             if(rc != PLCTAG_STATUS_OK) {
                 pdebug(DEBUG_WARN, "Unable to create new handler thread, error %s!", plc_tag_decode_error(rc));
             } else {
@@ -517,6 +805,7 @@ void modbus_plc_destructor(void *plc_arg)
     /* shut down the thread. */
     if(plc->handler_thread) {
         plc->flags.terminate = 1;
+        wake_plc(plc);
         thread_join(plc->handler_thread);
         thread_destroy(&plc->handler_thread);
         plc->handler_thread = NULL;
@@ -527,16 +816,36 @@ void modbus_plc_destructor(void *plc_arg)
         plc->mutex = NULL;
     }
 
+    if(plc->wait_cond) {
+        cond_destroy(&plc->wait_cond);
+        plc->wait_cond = NULL;
+    }
+
     if(plc->sock) {
         socket_destroy(&plc->sock);
         plc->sock = NULL;
     }
 
+    if(plc->port) {
+        plc_lib_close_serial_port(plc->port);
+        plc->port = NULL;
+    }
+
     if(plc->server) {
         mem_free(plc->server);
         plc->server = NULL;
     }
 
+    if(plc->metrics) {
+        metrics_unregister(plc->metrics);
+        plc->metrics = NULL;
+    }
+
+    if(plc->capture) {
+        capture_close(plc->capture);
+        plc->capture = NULL;
+    }
+
     if(plc->tags) {
         pdebug(DEBUG_WARN, "There are tags still remaining, memory leak possible!");
     }
@@ -562,10 +871,17 @@ THREAD_FUNC(modbus_plc_handler)
     while(! plc->flags.terminate) {
         int keep_going = 0;
 
+        plc->next_op_deadline = 0;
+
         if(err_delay < time_ms()) {
             do {
+                /* reopen a connection closed while idle ahead of the next automatic read. */
+                if(!plc_is_connected(plc) && plc->idle_timeout_ms && plc->reconnect_ahead_ms && plc->inactivity_timeout_ms <= time_ms()) {
+                    check_reconnect_ahead(plc);
+                }
+
                 /* connect if we are still active and the socket is not there. */
-                if(!plc->sock && plc->inactivity_timeout_ms > time_ms()) {
+                if(!plc_is_connected(plc) && (!plc->idle_timeout_ms || plc->inactivity_timeout_ms > time_ms())) {
                     /* socket must not be open! */
                     rc = connect_plc(plc);
                     if(rc != PLCTAG_STATUS_OK) {
@@ -575,7 +891,7 @@ THREAD_FUNC(modbus_plc_handler)
                 }
 
                 /* read packet */
-                rc = read_packet(plc);
+                rc = (plc->transport == MB_TRANSPORT_TCP ? read_packet(plc) : read_rtu_packet(plc));
                 if(rc != PLCTAG_STATUS_OK) {
                     /* problem, punt! */
                     err_delay = time_ms() + PLC_SOCKET_ERR_DELAY;
@@ -587,7 +903,7 @@ THREAD_FUNC(modbus_plc_handler)
                 }
 
                 /* write packet */
-                rc = write_packet(plc);
+                rc = (plc->transport == MB_TRANSPORT_TCP ? write_packet(plc) : write_rtu_packet(plc));
                 if(rc != PLCTAG_STATUS_OK) {
                     /* oops! */
                     err_delay = time_ms() + PLC_SOCKET_ERR_DELAY;
@@ -595,24 +911,27 @@ THREAD_FUNC(modbus_plc_handler)
                 }
 
                 /* check the inactivity timeout. */
-                if(plc->inactivity_timeout_ms <= time_ms() && plc->sock) {
+                if(plc->idle_timeout_ms && plc->inactivity_timeout_ms <= time_ms() && plc_is_connected(plc)) {
                     pdebug(DEBUG_DETAIL, "Shutting down socket due to inactivity.");
-                    /* shut down the socket. */
-                    socket_close(plc->sock);
-                    socket_destroy(&plc->sock);
-                    plc->sock = NULL;
+
+                    close_plc(plc);
 
                     /*
-                     * if we had a request that was sent, but there was no response yet,
-                     * then we need to clean up the state.   We are never going to get that
-                     * response.
+                     * if we had requests that were sent, but there was no response yet,
+                     * then we need to clean up the state.   We are never going to get those
+                     * responses.
                      *
-                     * If there is a request ready to send, then keep it in the buffer until
+                     * If there are requests ready to send, then keep them in the buffer until
                      * we reconnect.
                      */
 
-                    if(plc->flags.request_in_flight && !plc->flags.request_ready) {
-                        plc->flags.request_in_flight = 0;
+                    if(plc->num_in_flight && !plc->flags.request_ready) {
+                        critical_block(plc->mutex) {
+                            plc->num_in_flight = 0;
+                            mem_set(plc->unit_in_flight, 0, (int)(unsigned int)sizeof(plc->unit_in_flight));
+                        }
+
+                        metrics_set(plc->metrics, METRIC_IN_FLIGHT, 0);
                     }
 
                     /* we do not want to break here as the tags might have aborts to process. */
@@ -631,29 +950,56 @@ THREAD_FUNC(modbus_plc_handler)
 
                 if(rc_inc(plc)) {
                     critical_block(plc->mutex) {
-                        modbus_tag_p *tag_walker = &(plc->tags);
+                        modbus_tag_p *tag_walker = NULL;
+
+                        take_ready_tags(plc);
+                        update_unit_share(plc);
+
+                        tag_walker = &(plc->active_tags);
 
                         while(*tag_walker) {
                             modbus_tag_p tag = rc_inc(*tag_walker);
+                            int idle = 0;
 
                             /* the tag might be in the destructor. */
-                            if(tag) {
-                                debug_set_tag_id(tag->tag_id);
+                            if(!tag) {
+                                tag_walker = &((*tag_walker)->next_active);
+                                continue;
+                            }
 
-                                pdebug(DEBUG_SPEW, "Processing tag %d.", tag->tag_id);
+                            debug_set_tag_id(tag->tag_id);
 
-                                rc = process_tag(tag, plc);
-                                if(rc != PLCTAG_STATUS_OK) {
-                                    pdebug(DEBUG_WARN,  "Error, %s, processing tag %d!", plc_tag_decode_error(rc), tag->tag_id);
-                                }
+                            pdebug(DEBUG_SPEW, "Processing tag %d.", tag->tag_id);
+
+                            rc = process_tag(tag, plc);
+                            if(rc != PLCTAG_STATUS_OK) {
+                                pdebug(DEBUG_WARN,  "Error, %s, processing tag %d!", plc_tag_decode_error(rc), tag->tag_id);
+                            }
+
+                            debug_set_tag_id(0);
 
-                                debug_set_tag_id(0);
+                            /* tags with nothing left to do or wait for leave the active list. */
+                            spin_block(&tag->tag_lock) {
+                                if(!tag->flags._abort && !tag->flags._read && !tag->flags._write && !tag->flags._busy) {
+                                    tag->flags._scheduled = 0;
+                                    idle = 1;
+                                }
+                            }
 
-                                /* release reference. */
-                                tag = rc_dec(tag);
+                            if(idle) {
+                                *tag_walker = tag->next_active;
+                                tag->next_active = NULL;
+                            } else if(tag->op_deadline && (!plc->next_op_deadline || tag->op_deadline < plc->next_op_deadline)) {
+                                plc->next_op_deadline = tag->op_deadline;
                             }
 
-                            tag_walker = &((*tag_walker)->next);
+                            /* release reference. */
+                            rc_dec(tag);
+
+                            /* the destructor unlinks the tag itself. */
+                            if(!idle && *tag_walker == tag) {
+                                tag_walker = &((*tag_walker)->next_active);
+                            }
                         }
                     }
 
@@ -673,7 +1019,7 @@ THREAD_FUNC(modbus_plc_handler)
         }
 
         if(!keep_going) {
-            sleep_ms(1);
+            wait_plc(plc, err_delay);
         }
     }
 
@@ -684,15 +1030,72 @@ THREAD_FUNC(modbus_plc_handler)
 
 
 
+/*
+ * Look for the next automatic read of the PLC's tags.  If it is due within
+ * reconnect_ahead_ms the connection is reopened now, otherwise the handler
+ * wakes up in time to do it.  The read times belong to the tickler, they
+ * are only a hint here.
+ */
+void check_reconnect_ahead(modbus_plc_p plc)
+{
+    int64_t now = time_ms();
+    int64_t next_read = 0;
+
+    critical_block(plc->mutex) {
+        for(modbus_tag_p tag = plc->tags; tag; tag = tag->next) {
+            int64_t tag_next_read = tag->auto_sync_next_read;
+
+            if(tag->auto_sync_read_ms > 0 && tag_next_read && (!next_read || tag_next_read < next_read)) {
+                next_read = tag_next_read;
+            }
+        }
+    }
+
+    if(!next_read) {
+        return;
+    }
+
+    if(next_read - plc->reconnect_ahead_ms <= now) {
+        pdebug(DEBUG_DETAIL, "Reconnecting ahead of a read due in %"PRId64"ms.", next_read - now);
+        plc->inactivity_timeout_ms = plc->idle_timeout_ms + now;
+    } else if(!plc->next_op_deadline || next_read - plc->reconnect_ahead_ms < plc->next_op_deadline) {
+        plc->next_op_deadline = next_read - plc->reconnect_ahead_ms;
+    }
+}
+
+
+
 int connect_plc(modbus_plc_p plc)
 {
     int rc = PLCTAG_STATUS_OK;
     char **server_port = NULL;
     char *server = NULL;
     int port = MODBUS_DEFAULT_PORT;
+    sock_p sock = NULL;
 
     pdebug(DEBUG_DETAIL, "Starting.");
 
+    if(plc->transport == MB_TRANSPORT_RTU) {
+        serial_port_p serial_port = plc_lib_open_serial_port(plc->server, plc->baud_rate, plc->data_bits, plc->stop_bits, plc->parity);
+
+        if(!serial_port) {
+            pdebug(DEBUG_WARN, "Unable to open serial port %s!", plc->server);
+            return PLCTAG_ERR_OPEN;
+        }
+
+        spin_block(&plc->sock_lock) {
+            plc->port = serial_port;
+        }
+
+        plc->inactivity_timeout_ms = plc->idle_timeout_ms + time_ms();
+
+        metrics_add(plc->metrics, METRIC_CONNECTS, 1);
+
+        pdebug(DEBUG_DETAIL, "Done.");
+
+        return PLCTAG_STATUS_OK;
+    }
+
     server_port = str_split(plc->server, ":");
     if(!server_port) {
         pdebug(DEBUG_WARN, "Unable to split server and port string!");
@@ -721,7 +1124,7 @@ int connect_plc(modbus_plc_p plc)
 
     pdebug(DEBUG_DETAIL, "Using server \"%s\" and port %d.", server, port);
 
-    rc = socket_create(&(plc->sock));
+    rc = socket_create(&sock);
     if(rc != PLCTAG_STATUS_OK) {
         /* done with the split string. */
         mem_free(server_port);
@@ -731,18 +1134,24 @@ int connect_plc(modbus_plc_p plc)
         return rc;
     }
 
+    socket_set_options(sock, &(plc->sock_opts));
+
     /* connect to the socket */
     pdebug(DEBUG_DETAIL, "Connecting to %s on port %d...", server, port);
-    rc = socket_connect_tcp(plc->sock, server, port);
+    rc = socket_connect_tcp(sock, server, port, plc->connect_timeout_ms);
     if(rc != PLCTAG_STATUS_OK) {
         /* done with the split string. */
         mem_free(server_port);
 
         pdebug(DEBUG_WARN, "Unable to connect to the server \"%s\", got error %s!", plc->server, plc_tag_decode_error(rc));
-        socket_destroy(&(plc->sock));
+        socket_destroy(&sock);
         return rc;
     }
 
+    spin_block(&plc->sock_lock) {
+        plc->sock = sock;
+    }
+
     /* done with the split string. */
     if(server_port) {
         mem_free(server_port);
@@ -750,7 +1159,9 @@ int connect_plc(modbus_plc_p plc)
     }
 
     /* we just connected, keep the connection open for a few seconds. */
-    plc->inactivity_timeout_ms = MODBUS_INACTIVITY_TIMEOUT + time_ms();
+    plc->inactivity_timeout_ms = plc->idle_timeout_ms + time_ms();
+
+    metrics_add(plc->metrics, METRIC_CONNECTS, 1);
 
     pdebug(DEBUG_DETAIL, "Done.");
 
@@ -759,6 +1170,114 @@ int connect_plc(modbus_plc_p plc)
 
 
 
+int plc_is_connected(modbus_plc_p plc)
+{
+    return (plc->sock || plc->port);
+}
+
+
+
+/* drop the connection and anything that was on the wire. */
+void close_plc(modbus_plc_p plc)
+{
+    sock_p sock = NULL;
+    serial_port_p serial_port = NULL;
+
+    spin_block(&plc->sock_lock) {
+        sock = plc->sock;
+        plc->sock = NULL;
+
+        serial_port = plc->port;
+        plc->port = NULL;
+    }
+
+    if(sock) {
+        socket_close(sock);
+        socket_destroy(&sock);
+    }
+
+    if(serial_port) {
+        plc_lib_close_serial_port(serial_port);
+    }
+
+    plc->rtu_waiting = 0;
+    plc->rtu_frame_len = 0;
+    plc->rtu_frame_offset = 0;
+    plc->rtu_rx_len = 0;
+}
+
+
+
+/* wake the handler thread whether it is waiting on the socket or not. */
+void wake_plc(modbus_plc_p plc)
+{
+    if(!plc) {
+        return;
+    }
+
+    spin_block(&plc->sock_lock) {
+        if(plc->sock) {
+            socket_wake(plc->sock);
+        }
+
+        if(plc->port) {
+            plc_lib_serial_port_wake(plc->port);
+        }
+    }
+
+    if(plc->wait_cond) {
+        cond_signal(plc->wait_cond);
+    }
+}
+
+
+
+/*
+ * Wait for socket activity or a wake up from a tag.  Without a
+ * usable socket there is nothing to wait on but tags.  The wait ends in
+ * time for the next deadline: an RTU response, a tag operation timing out
+ * or the end of the reconnect delay.
+ */
+void wait_plc(modbus_plc_p plc, int64_t err_delay)
+{
+    int64_t now = time_ms();
+    int timeout_ms = MODBUS_IDLE_WAIT_TIME;
+
+    /* do not sleep through an RTU response timeout. */
+    if(plc->rtu_waiting && plc->rtu_response_deadline - now < timeout_ms) {
+        timeout_ms = (int)(plc->rtu_response_deadline > now ? plc->rtu_response_deadline - now : 0);
+    }
+
+    if(plc->next_op_deadline && plc->next_op_deadline - now < timeout_ms) {
+        /* a tag past its deadline that cannot finish yet must not make this spin. */
+        timeout_ms = (int)(plc->next_op_deadline > now ? plc->next_op_deadline - now : 1);
+    }
+
+    if(err_delay > now && err_delay - now < timeout_ms) {
+        timeout_ms = (int)(err_delay - now);
+    }
+
+    if(plc_is_connected(plc) && err_delay < now) {
+        int events = SOCKET_EVENT_READ;
+
+        /* an RTU line does not take another request until this one is answered. */
+        if(plc->flags.request_ready && !plc->rtu_waiting) {
+            events |= SOCKET_EVENT_WRITE;
+        }
+
+        if(plc->port) {
+            plc_lib_serial_port_wait_event(plc->port, events, timeout_ms);
+        } else {
+            socket_wait_event(plc->sock, events, timeout_ms);
+        }
+    } else {
+        /* cond_wait() needs a positive timeout. */
+        cond_wait(plc->wait_cond, (timeout_ms > 0 ? timeout_ms : 1));
+    }
+}
+
+
+
 int read_packet(modbus_plc_p plc)
 {
     int rc = 1;
@@ -807,8 +1326,16 @@ int read_packet(modbus_plc_p plc)
             pdebug_dump_bytes(DEBUG_DETAIL, plc->read_data, plc->read_data_len);
             plc->flags.response_ready = 1;
 
-            /* regardless of what request this is, there is nothing in flight. */
-            plc->flags.request_in_flight = 0;
+            if(plc->capture) {
+                socket_buf_t frame = { plc->read_data, plc->read_data_len };
+
+                capture_frame(plc->capture, CAPTURE_DIR_RECEIVED, &frame, 1);
+            }
+
+            metrics_add(plc->metrics, METRIC_PACKETS_RECEIVED, 1);
+            metrics_add(plc->metrics, METRIC_BYTES_RECEIVED, plc->read_data_len);
+
+            plctag_trace2(modbus_read_packet, ((int)plc->read_data[0] << 8) + (int)plc->read_data[1], plc->read_data_len);
         }
 
         rc = PLCTAG_STATUS_OK;
@@ -816,12 +1343,7 @@ int read_packet(modbus_plc_p plc)
 
     /* if we have some data in the buffer, keep the connection open. */
     if(plc->read_data_len > 0) {
-        plc->inactivity_timeout_ms = MODBUS_INACTIVITY_TIMEOUT + time_ms();
-    }
-
-    /* if we have some data in the buffer, keep the connection open. */
-    if(plc->read_data_len > 0) {
-        plc->inactivity_timeout_ms = MODBUS_INACTIVITY_TIMEOUT + time_ms();
+        plc->inactivity_timeout_ms = plc->idle_timeout_ms + time_ms();
     }
 
     pdebug(DEBUG_SPEW, "Done.");
@@ -840,7 +1362,7 @@ int write_packet(modbus_plc_p plc)
 
     /* if we have some data in the buffer, keep the connection open. */
     if(plc->write_data_len > 0) {
-        plc->inactivity_timeout_ms = MODBUS_INACTIVITY_TIMEOUT + time_ms();
+        plc->inactivity_timeout_ms = plc->idle_timeout_ms + time_ms();
     }
 
     /* check socket, could be closed due to inactivity. */
@@ -872,9 +1394,21 @@ int write_packet(modbus_plc_p plc)
             pdebug(DEBUG_DETAIL, "Full packet written.");
             pdebug_dump_bytes(DEBUG_DETAIL, plc->write_data, plc->write_data_len);
 
+            if(plc->capture) {
+                socket_buf_t frame = { plc->write_data, plc->write_data_len };
+
+                capture_frame(plc->capture, CAPTURE_DIR_SENT, &frame, 1);
+            }
+
+            metrics_add(plc->metrics, METRIC_PACKETS_SENT, plc->write_data_count);
+            metrics_add(plc->metrics, METRIC_BYTES_SENT, plc->write_data_len);
+
+            plctag_trace2(modbus_write_packet, ((int)plc->write_data[0] << 8) + (int)plc->write_data[1], plc->write_data_len);
+
             plc->flags.request_ready = 0;
             plc->write_data_len = 0;
             plc->write_data_offset = 0;
+            plc->write_data_count = 0;
         }
 
         rc = PLCTAG_STATUS_OK;
@@ -885,65 +1419,420 @@ int write_packet(modbus_plc_p plc)
     return rc;
 }
 
-/*
- * This is called in the context of the PLC thread.
- *
- * The process cannot lock the tag's API mutex.   If the tag user side is
- * blocked in plc_tag_read, plc_tag_write or any other possibly blocking
- * API call, then the API mutex will be held.
- *
- * However, we can ensure that the tag will not be deleted out from underneath
- * us because this function is called under the PLC's mutex.   plc_tag_delete()
- * will first call the destructor and try to remove the tag from the PLC's list
- * and that requires the PLC's mutex to be held.   So as long as we are
- * under the PLC's mutex, we cannot have the tag disappear out from underneath
- * us or out of the list.
- *
- * To help ensure that, we take a reference to the tag as well.  If the tag was
- * in the process of being destroyed, the reference returned will be null.
- *
- * So if we are here, we are not going to have the tag disappear nor are we going to
- * have the PLC's tag list mutated.
- */
+/* RTU over TCP uses the socket, plain RTU the serial port. */
+int read_bytes(modbus_plc_p plc, uint8_t *data, int size)
+{
+    if(plc->port) {
+        return plc_lib_serial_port_read(plc->port, data, size);
+    }
 
-int process_tag(modbus_tag_p tag, modbus_plc_p plc)
+    return socket_read(plc->sock, data, size);
+}
+
+
+
+int write_bytes(modbus_plc_p plc, uint8_t *data, int size)
 {
-    int rc = PLCTAG_STATUS_OK;
+    if(plc->port) {
+        return plc_lib_serial_port_write(plc->port, data, size);
+    }
 
-    pdebug(DEBUG_SPEW, "Starting.");
+    return socket_write(plc->sock, data, size);
+}
 
-    if(tag_get_abort_flag(tag)) {
-        pdebug(DEBUG_DETAIL, "Aborting any in flight operations!");
 
-        /* do this as one block to prevent half-changed state. */
-        spin_block(&tag->tag_lock) {
-            tag->flags._read = 0;
-            tag->flags._write = 0;
-            tag->flags._busy = 0;
-            tag->flags._abort = 0;
-        }
 
-        tag->seq_id = 0;
+/*
+ * RTU frames have no length field so the size comes from the function
+ * code.  Returns the whole frame size, including the CRC, or the number
+ * of bytes needed to find it out.
+ */
+int rtu_frame_size(const uint8_t *frame, int len)
+{
+    if(len < 2) {
+        return 2;
     }
 
-    if(tag_get_write_flag(tag)) {
-        if(tag_get_busy_flag(tag)) {
-            if(plc->flags.response_ready) {
-                /* we have an outstanding write request. */
-                rc = check_write_response(plc, tag);
-                if(rc == PLCTAG_STATUS_OK) {
-                    pdebug(DEBUG_SPEW, "Either not our response or we got a response!");
-                } else {
-                    pdebug(DEBUG_SPEW, "We got an error on our write response check, %s!", plc_tag_decode_error(rc));
-                }
+    /* exception responses are the address, function, code and CRC. */
+    if(frame[1] & 0x80) {
+        return 5;
+    }
 
-                tag->status = (int8_t)rc;
+    switch(frame[1]) {
+        case MB_CMD_READ_COIL_MULTI:
+        case MB_CMD_READ_DISCRETE_INPUT_MULTI:
+        case MB_CMD_READ_HOLDING_REGISTER_MULTI:
+        case MB_CMD_READ_INPUT_REGISTER_MULTI:
+        case MB_CMD_READ_WRITE_HOLDING_REGISTER_MULTI:
+            if(len < 3) {
+                return 3;
+            }
+
+            return 5 + frame[2];
+            break;
+
+        case MB_CMD_WRITE_COIL_SINGLE:
+        case MB_CMD_WRITE_HOLDING_REGISTER_SINGLE:
+        case MB_CMD_WRITE_COIL_MULTI:
+        case MB_CMD_WRITE_HOLDING_REGISTER_MULTI:
+            return 8;
+            break;
+
+        default:
+            pdebug(DEBUG_WARN, "Unsupported RTU function code 0x%x!", (unsigned int)frame[1]);
+            return PLCTAG_ERR_BAD_REPLY;
+            break;
+    }
+}
+
+
+
+/*
+ * Read the response to the request on the wire and turn it into a
+ * Modbus TCP response in read_data.  If the slave does not answer in time,
+ * the request fails as if a gateway reported that the target did not
+ * respond.
+ */
+int read_rtu_packet(modbus_plc_p plc)
+{
+    int rc = 1;
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    if(!plc_is_connected(plc)) {
+        pdebug(DEBUG_SPEW, "Port or socket is closed.");
+        return PLCTAG_STATUS_OK;
+    }
+
+    /* the last response has not been picked up yet. */
+    if(plc->flags.response_ready) {
+        return PLCTAG_STATUS_OK;
+    }
+
+    /* nothing was asked for, so anything on the line is noise. */
+    if(!plc->rtu_waiting) {
+        while((rc = read_bytes(plc, plc->rtu_rx, (int)(unsigned int)sizeof(plc->rtu_rx))) > 0) {
+            pdebug(DEBUG_DETAIL, "Dropping %d unexpected bytes.", rc);
+        }
+
+        return (rc < 0 ? rc : PLCTAG_STATUS_OK);
+    }
+
+    while(rc > 0) {
+        int frame_size = rtu_frame_size(plc->rtu_rx, plc->rtu_rx_len);
+
+        if(frame_size < 0 || frame_size > (int)(unsigned int)sizeof(plc->rtu_rx)) {
+            /* garbage, start over and let the timeout catch a lost response. */
+            plc->rtu_rx_len = 0;
+            break;
+        }
+
+        if(plc->rtu_rx_len >= frame_size) {
+            int pdu_size = frame_size - 2;
+
+            pdebug_dump_bytes(DEBUG_DETAIL, plc->rtu_rx, frame_size);
+
+            if(modbus_crc16(plc->rtu_rx, frame_size) != 0) {
+                pdebug(DEBUG_WARN, "Dropping RTU frame with a bad CRC!");
+                plc->rtu_rx_len = 0;
+                break;
+            }
+
+            if(plc->rtu_rx[0] != plc->rtu_server_id || (plc->rtu_rx[1] & 0x7F) != plc->rtu_function) {
+                pdebug(DEBUG_WARN, "Dropping RTU frame from unit %u for function 0x%x, expected unit %u!", (unsigned int)plc->rtu_rx[0], (unsigned int)plc->rtu_rx[1], (unsigned int)plc->rtu_server_id);
+                plc->rtu_rx_len = 0;
+                break;
+            }
+
+            /* dress the response up with an MBAP header. */
+            plc->read_data[0] = (uint8_t)((plc->rtu_seq_id >> 8) & 0xFF);
+            plc->read_data[1] = (uint8_t)(plc->rtu_seq_id & 0xFF);
+            plc->read_data[2] = 0;
+            plc->read_data[3] = 0;
+            plc->read_data[4] = (uint8_t)((pdu_size >> 8) & 0xFF);
+            plc->read_data[5] = (uint8_t)(pdu_size & 0xFF);
+            mem_copy(&plc->read_data[MODBUS_MBAP_SIZE], plc->rtu_rx, pdu_size);
+            plc->read_data_len = MODBUS_MBAP_SIZE + pdu_size;
+
+            plc->rtu_rx_len = 0;
+            plc->rtu_waiting = 0;
+            plc->flags.response_ready = 1;
+
+            metrics_add(plc->metrics, METRIC_PACKETS_RECEIVED, 1);
+            metrics_add(plc->metrics, METRIC_BYTES_RECEIVED, frame_size);
+
+            plctag_trace2(modbus_read_packet, (int)plc->rtu_seq_id, plc->read_data_len);
+
+            plc->inactivity_timeout_ms = plc->idle_timeout_ms + time_ms();
+
+            pdebug(DEBUG_DETAIL, "Received full RTU frame.");
+
+            return PLCTAG_STATUS_OK;
+        }
+
+        rc = read_bytes(plc, plc->rtu_rx + plc->rtu_rx_len, frame_size - plc->rtu_rx_len);
+        if(rc < 0) {
+            pdebug(DEBUG_WARN, "Error, %s, reading RTU response!", plc_tag_decode_error(rc));
+            return rc;
+        }
+
+        plc->rtu_rx_len += rc;
+    }
+
+    if(plc->rtu_waiting && time_ms() > plc->rtu_response_deadline) {
+        pdebug(DEBUG_WARN, "Unit %u did not respond to request %u in time!", (unsigned int)plc->rtu_server_id, (unsigned int)plc->rtu_seq_id);
+
+        plc->read_data[0] = (uint8_t)((plc->rtu_seq_id >> 8) & 0xFF);
+        plc->read_data[1] = (uint8_t)(plc->rtu_seq_id & 0xFF);
+        plc->read_data[2] = 0;
+        plc->read_data[3] = 0;
+        plc->read_data[4] = 0;
+        plc->read_data[5] = 3;
+        plc->read_data[6] = plc->rtu_server_id;
+        plc->read_data[7] = (uint8_t)(plc->rtu_function | 0x80);
+        plc->read_data[8] = 0x0B;   /* gateway target device failed to respond. */
+        plc->read_data_len = MODBUS_MBAP_SIZE + 3;
+
+        plc->rtu_rx_len = 0;
+        plc->rtu_waiting = 0;
+        plc->flags.response_ready = 1;
+    }
+
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * Send the next queued request as an RTU frame.  Requests are queued in
+ * Modbus TCP form, the MBAP header is swapped for the CRC here.  The
+ * next one goes out as soon as the line is free, whichever slave it is
+ * for.
+ */
+int write_rtu_packet(modbus_plc_p plc)
+{
+    int rc = 1;
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    /* if we have some data in the buffer, keep the connection open. */
+    if(plc->write_data_len > 0) {
+        plc->inactivity_timeout_ms = plc->idle_timeout_ms + time_ms();
+    }
+
+    if(!plc_is_connected(plc) || plc->rtu_waiting || !plc->flags.request_ready) {
+        pdebug(DEBUG_SPEW, "Done. Nothing to do.");
+        return PLCTAG_STATUS_OK;
+    }
+
+    if(plc->rtu_frame_len == 0) {
+        uint8_t *adu = plc->write_data + plc->write_data_offset;
+        int pdu_size = ((int)adu[4] << 8) + (int)adu[5];
+        uint16_t crc = 0;
+
+        if(pdu_size < 2 || pdu_size + 2 > (int)(unsigned int)sizeof(plc->rtu_frame)) {
+            pdebug(DEBUG_WARN, "Queued request is too large for an RTU frame!");
+            return PLCTAG_ERR_TOO_LARGE;
+        }
+
+        mem_copy(plc->rtu_frame, adu + MODBUS_MBAP_SIZE, pdu_size);
+
+        crc = modbus_crc16(plc->rtu_frame, pdu_size);
+        plc->rtu_frame[pdu_size] = (uint8_t)(crc & 0xFF);
+        plc->rtu_frame[pdu_size + 1] = (uint8_t)((crc >> 8) & 0xFF);
+
+        plc->rtu_frame_len = pdu_size + 2;
+        plc->rtu_frame_offset = 0;
+        plc->rtu_seq_id = (uint16_t)(((unsigned int)adu[0] << 8) + (unsigned int)adu[1]);
+        plc->rtu_server_id = plc->rtu_frame[0];
+        plc->rtu_function = plc->rtu_frame[1];
+
+        plc->write_data_offset += MODBUS_MBAP_SIZE + pdu_size;
+
+        /* frames are told apart by the silence between them. */
+        if(plc->port) {
+            rc = plc_lib_serial_port_wait_gap(plc->port, plc->frame_gap_us);
+            if(rc != PLCTAG_STATUS_OK) {
+                pdebug(DEBUG_WARN, "Error, %s, waiting for the line to go quiet!", plc_tag_decode_error(rc));
+                return rc;
+            }
+
+            rc = 1;
+        }
+    }
+
+    while(rc > 0 && plc->rtu_frame_offset < plc->rtu_frame_len) {
+        rc = write_bytes(plc, plc->rtu_frame + plc->rtu_frame_offset, plc->rtu_frame_len - plc->rtu_frame_offset);
+        if(rc < 0) {
+            pdebug(DEBUG_WARN, "Error, %s, writing RTU request!", plc_tag_decode_error(rc));
+            return rc;
+        }
+
+        plc->rtu_frame_offset += rc;
+    }
+
+    if(plc->rtu_frame_offset >= plc->rtu_frame_len) {
+        pdebug(DEBUG_DETAIL, "Full RTU frame written.");
+        pdebug_dump_bytes(DEBUG_DETAIL, plc->rtu_frame, plc->rtu_frame_len);
+
+        metrics_add(plc->metrics, METRIC_PACKETS_SENT, 1);
+        metrics_add(plc->metrics, METRIC_BYTES_SENT, plc->rtu_frame_len);
+
+        plctag_trace2(modbus_write_packet, (int)plc->rtu_seq_id, plc->rtu_frame_len);
+
+        /* the clock starts once the request is on the line. */
+        plc->rtu_response_deadline = time_ms() + plc->response_timeout_ms;
+        if(plc->port && plc->baud_rate > 0) {
+            plc->rtu_response_deadline += ((int64_t)plc->rtu_frame_len * 11000) / plc->baud_rate;
+        }
+
+        plc->rtu_waiting = 1;
+        plc->rtu_rx_len = 0;
+        plc->rtu_frame_len = 0;
+        plc->rtu_frame_offset = 0;
+
+        if(plc->write_data_offset >= plc->write_data_len) {
+            plc->flags.request_ready = 0;
+            plc->write_data_len = 0;
+            plc->write_data_offset = 0;
+            plc->write_data_count = 0;
+        }
+    }
+
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/* Modbus RTU CRC, polynomial 0xA001 reflected, starting at 0xFFFF. */
+static const uint16_t modbus_crc_table[256] = {
+    0x0000, 0xC0C1, 0xC181, 0x0140, 0xC301, 0x03C0, 0x0280, 0xC241,
+    0xC601, 0x06C0, 0x0780, 0xC741, 0x0500, 0xC5C1, 0xC481, 0x0440,
+    0xCC01, 0x0CC0, 0x0D80, 0xCD41, 0x0F00, 0xCFC1, 0xCE81, 0x0E40,
+    0x0A00, 0xCAC1, 0xCB81, 0x0B40, 0xC901, 0x09C0, 0x0880, 0xC841,
+    0xD801, 0x18C0, 0x1980, 0xD941, 0x1B00, 0xDBC1, 0xDA81, 0x1A40,
+    0x1E00, 0xDEC1, 0xDF81, 0x1F40, 0xDD01, 0x1DC0, 0x1C80, 0xDC41,
+    0x1400, 0xD4C1, 0xD581, 0x1540, 0xD701, 0x17C0, 0x1680, 0xD641,
+    0xD201, 0x12C0, 0x1380, 0xD341, 0x1100, 0xD1C1, 0xD081, 0x1040,
+    0xF001, 0x30C0, 0x3180, 0xF141, 0x3300, 0xF3C1, 0xF281, 0x3240,
+    0x3600, 0xF6C1, 0xF781, 0x3740, 0xF501, 0x35C0, 0x3480, 0xF441,
+    0x3C00, 0xFCC1, 0xFD81, 0x3D40, 0xFF01, 0x3FC0, 0x3E80, 0xFE41,
+    0xFA01, 0x3AC0, 0x3B80, 0xFB41, 0x3900, 0xF9C1, 0xF881, 0x3840,
+    0x2800, 0xE8C1, 0xE981, 0x2940, 0xEB01, 0x2BC0, 0x2A80, 0xEA41,
+    0xEE01, 0x2EC0, 0x2F80, 0xEF41, 0x2D00, 0xEDC1, 0xEC81, 0x2C40,
+    0xE401, 0x24C0, 0x2580, 0xE541, 0x2700, 0xE7C1, 0xE681, 0x2640,
+    0x2200, 0xE2C1, 0xE381, 0x2340, 0xE101, 0x21C0, 0x2080, 0xE041,
+    0xA001, 0x60C0, 0x6180, 0xA141, 0x6300, 0xA3C1, 0xA281, 0x6240,
+    0x6600, 0xA6C1, 0xA781, 0x6740, 0xA501, 0x65C0, 0x6480, 0xA441,
+    0x6C00, 0xACC1, 0xAD81, 0x6D40, 0xAF01, 0x6FC0, 0x6E80, 0xAE41,
+    0xAA01, 0x6AC0, 0x6B80, 0xAB41, 0x6900, 0xA9C1, 0xA881, 0x6840,
+    0x7800, 0xB8C1, 0xB981, 0x7940, 0xBB01, 0x7BC0, 0x7A80, 0xBA41,
+    0xBE01, 0x7EC0, 0x7F80, 0xBF41, 0x7D00, 0xBDC1, 0xBC81, 0x7C40,
+    0xB401, 0x74C0, 0x7580, 0xB541, 0x7700, 0xB7C1, 0xB681, 0x7640,
+    0x7200, 0xB2C1, 0xB381, 0x7340, 0xB101, 0x71C0, 0x7080, 0xB041,
+    0x5000, 0x90C1, 0x9181, 0x5140, 0x9301, 0x53C0, 0x5280, 0x9241,
+    0x9601, 0x56C0, 0x5780, 0x9741, 0x5500, 0x95C1, 0x9481, 0x5440,
+    0x9C01, 0x5CC0, 0x5D80, 0x9D41, 0x5F00, 0x9FC1, 0x9E81, 0x5E40,
+    0x5A00, 0x9AC1, 0x9B81, 0x5B40, 0x9901, 0x59C0, 0x5880, 0x9841,
+    0x8801, 0x48C0, 0x4980, 0x8941, 0x4B00, 0x8BC1, 0x8A81, 0x4A40,
+    0x4E00, 0x8EC1, 0x8F81, 0x4F40, 0x8D01, 0x4DC0, 0x4C80, 0x8C41,
+    0x4400, 0x84C1, 0x8581, 0x4540, 0x8701, 0x47C0, 0x4680, 0x8641,
+    0x8201, 0x42C0, 0x4380, 0x8341, 0x4100, 0x81C1, 0x8081, 0x4040
+};
+
+uint16_t modbus_crc16(const uint8_t *data, int size)
+{
+    uint16_t crc = 0xFFFF;
+
+    for(int i=0; i < size; i++) {
+        crc = (uint16_t)((crc >> 8) ^ modbus_crc_table[(crc ^ data[i]) & 0xFF]);
+    }
+
+    return crc;
+}
+
+
+
+/*
+ * This is called in the context of the PLC thread.
+ *
+ * The process cannot lock the tag's API mutex.   If the tag user side is
+ * blocked in plc_tag_read, plc_tag_write or any other possibly blocking
+ * API call, then the API mutex will be held.
+ *
+ * However, we can ensure that the tag will not be deleted out from underneath
+ * us because this function is called under the PLC's mutex.   plc_tag_delete()
+ * will first call the destructor and try to remove the tag from the PLC's list
+ * and that requires the PLC's mutex to be held.   So as long as we are
+ * under the PLC's mutex, we cannot have the tag disappear out from underneath
+ * us or out of the list.
+ *
+ * To help ensure that, we take a reference to the tag as well.  If the tag was
+ * in the process of being destroyed, the reference returned will be null.
+ *
+ * So if we are here, we are not going to have the tag disappear nor are we going to
+ * have the PLC's tag list mutated.
+ */
+
+int process_tag(modbus_tag_p tag, modbus_plc_p plc)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    if(tag_get_abort_flag(tag)) {
+        pdebug(DEBUG_DETAIL, "Aborting any in flight operations!");
+
+        int shared = is_request_shared(plc, tag);
+        int release = 0;
+
+        /* do this as one block to prevent half-changed state. */
+        spin_block(&tag->tag_lock) {
+            /* a response to the aborted request will not match. */
+            release = (tag->flags._busy && !shared);
+
+            tag->flags._read = 0;
+            tag->flags._write = 0;
+            tag->flags._busy = 0;
+            tag->flags._grouped = 0;
+            tag->flags._abort = 0;
+        }
+
+        if(release) {
+            release_request_slot(plc, tag);
+        }
+
+        tag->seq_id = 0;
+    }
+
+    /* the caller gave up, do not send it or wait for it any longer. */
+    if(tag_is_expired(tag)) {
+        expire_tag(tag, plc);
+        return PLCTAG_ERR_TIMEOUT;
+    }
+
+    if(tag_get_write_flag(tag)) {
+        if(tag_get_busy_flag(tag)) {
+            if(plc->flags.response_ready) {
+                /* we have an outstanding write request. */
+                rc = check_write_response(plc, tag);
+                if(rc == PLCTAG_STATUS_OK) {
+                    pdebug(DEBUG_SPEW, "Either not our response or we got a response!");
+                } else {
+                    pdebug(DEBUG_SPEW, "We got an error on our write response check, %s!", plc_tag_decode_error(rc));
+                }
+
+                tag->status = (int8_t)rc;
             } else {
                 pdebug(DEBUG_SPEW, "No response yet.");
             }
         } else {
-            /* we have a write request to do and nothing is in flight. */
-            if(! plc->flags.request_ready && !plc->flags.request_in_flight) {
+            /* we have a write request to do and there is room in the window. */
+            if(can_queue_request(plc, tag)) {
                 rc = create_write_request(plc, tag);
             } else {
                 pdebug(DEBUG_SPEW, "No buffer space for a response.");
@@ -970,23 +1859,264 @@ int process_tag(modbus_tag_p tag, modbus_plc_p plc)
                 pdebug(DEBUG_SPEW, "No response yet.");
             }
         } else {
-            /* we have a write request to do an nothing is in flight. */
-            if(!plc->flags.request_ready && !plc->flags.request_in_flight) {
+            /* we have a read request to do and there is room in the window. */
+            if(can_queue_request(plc, tag)) {
                 rc = create_read_request(plc, tag);
             } else {
                 pdebug(DEBUG_SPEW, "No buffer space for a response.");
             }
 
-            tag->status = (int8_t)rc;
+            tag->status = (int8_t)rc;
+        }
+    }
+
+
+    /* does this tag need to do anything? */
+
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return rc;
+}
+
+
+/* is there an operation whose caller stopped waiting for it? */
+int tag_is_expired(modbus_tag_p tag)
+{
+    if(!MB_TAG_EXPIRED(tag, time_ms())) {
+        return 0;
+    }
+
+    return (tag_get_read_flag(tag) || tag_get_write_flag(tag));
+}
+
+
+/*
+ * expire_tag
+ *
+ * Finish the tag's operation with a timeout.  A request already sent is
+ * forgotten like an aborted one, its response will not match.
+ */
+void expire_tag(modbus_tag_p tag, modbus_plc_p plc)
+{
+    int shared = is_request_shared(plc, tag);
+    int release = 0;
+    int was_read = 0;
+
+    pdebug(DEBUG_DETAIL, "Tag %d operation passed its deadline.", tag->tag_id);
+
+    metrics_add(plc->metrics, METRIC_REQUESTS_EXPIRED, 1);
+
+    spin_block(&tag->tag_lock) {
+        release = (tag->flags._busy && !shared);
+        was_read = tag->flags._read;
+
+        tag->flags._read = 0;
+        tag->flags._write = 0;
+        tag->flags._busy = 0;
+        tag->flags._grouped = 0;
+        tag->seq_id = 0;
+        tag->request_num = 0;
+        tag->status = PLCTAG_ERR_TIMEOUT;
+
+        if(was_read) {
+            tag->read_complete = 1;
+        } else {
+            tag->write_complete = 1;
+        }
+    }
+
+    if(release) {
+        release_request_slot(plc, tag);
+    }
+
+    plc_tag_generic_wake_tag(tag->tag_id);
+}
+
+
+/*
+ * Put the tag on its PLC's ready list if it is not already waiting
+ * there or on the active list.
+ */
+void schedule_tag(modbus_tag_p tag)
+{
+    int need_queue = 0;
+
+    if(!tag->plc) {
+        return;
+    }
+
+    spin_block(&tag->tag_lock) {
+        if(!tag->flags._scheduled) {
+            tag->flags._scheduled = 1;
+            need_queue = 1;
+        }
+    }
+
+    if(need_queue) {
+        spin_block(&tag->plc->ready_lock) {
+            tag->next_active = tag->plc->ready_tags;
+            tag->plc->ready_tags = tag;
+        }
+    }
+}
+
+
+/*
+ * Move the ready tags to the end of the active list, oldest first.
+ * Called from the handler thread with the PLC mutex held.
+ */
+void take_ready_tags(modbus_plc_p plc)
+{
+    modbus_tag_p ready = NULL;
+    modbus_tag_p *tail = &(plc->active_tags);
+
+    spin_block(&plc->ready_lock) {
+        ready = plc->ready_tags;
+        plc->ready_tags = NULL;
+    }
+
+    while(*tail) {
+        tail = &((*tail)->next_active);
+    }
+
+    /* the ready list is pushed at the head, so reverse it. */
+    while(ready) {
+        modbus_tag_p tag = ready;
+
+        ready = tag->next_active;
+        tag->next_active = *tail;
+        *tail = tag;
+    }
+}
+
+
+/* Called with the PLC mutex held. */
+void unlink_scheduled_tag(modbus_plc_p plc, modbus_tag_p tag)
+{
+    modbus_tag_p *walker = &(plc->active_tags);
+
+    while(*walker && *walker != tag) {
+        walker = &((*walker)->next_active);
+    }
+
+    if(*walker) {
+        *walker = tag->next_active;
+        return;
+    }
+
+    spin_block(&plc->ready_lock) {
+        walker = &(plc->ready_tags);
+
+        while(*walker && *walker != tag) {
+            walker = &((*walker)->next_active);
+        }
+
+        if(*walker) {
+            *walker = tag->next_active;
+        }
+    }
+}
+
+
+/*
+ * Requests go out back to back up to the in flight window.  Each one
+ * needs room for its whole ADU in the write buffer.  A unit cannot take
+ * more than its share of the window while other units are waiting.
+ */
+int can_queue_request(modbus_plc_p plc, modbus_tag_p tag)
+{
+    if(plc->num_in_flight >= plc->max_requests_in_flight) {
+        return 0;
+    }
+
+    if(plc->unit_in_flight[tag->server_id] >= plc->unit_share) {
+        return 0;
+    }
+
+    return (plc->write_data_len + PLC_WRITE_DATA_LEN <= (int)(unsigned int)sizeof(plc->write_data));
+}
+
+
+
+void take_request_slot(modbus_plc_p plc, modbus_tag_p tag)
+{
+    plc->num_in_flight++;
+    plc->unit_in_flight[tag->server_id]++;
+
+    metrics_set(plc->metrics, METRIC_IN_FLIGHT, plc->num_in_flight);
+}
+
+
+
+void release_request_slot(modbus_plc_p plc, modbus_tag_p tag)
+{
+    if(plc->num_in_flight > 0) {
+        plc->num_in_flight--;
+    }
+
+    if(plc->unit_in_flight[tag->server_id] > 0) {
+        plc->unit_in_flight[tag->server_id]--;
+    }
+
+    metrics_set(plc->metrics, METRIC_IN_FLIGHT, plc->num_in_flight);
+}
+
+
+
+/*
+ * Split the window evenly between the units that have tags waiting to
+ * send, rounding up so that none of it sits idle.  Tags that did not
+ * get a slot stay at the front of the active list for the next pass.
+ *
+ * Called from the handler thread with the PLC mutex held.
+ */
+void update_unit_share(modbus_plc_p plc)
+{
+    uint32_t units_seen[256 / 32] = {0};
+    int units_waiting = 0;
+
+    for(modbus_tag_p tag = plc->active_tags; tag; tag = tag->next_active) {
+        uint32_t mask = (uint32_t)1 << (tag->server_id % 32);
+
+        if(tag->flags._busy || !(tag->flags._read || tag->flags._write)) {
+            continue;
+        }
+
+        if(!(units_seen[tag->server_id / 32] & mask)) {
+            units_seen[tag->server_id / 32] |= mask;
+            units_waiting++;
         }
     }
 
+    if(units_waiting <= 1) {
+        plc->unit_share = plc->max_requests_in_flight;
+    } else {
+        plc->unit_share = (plc->max_requests_in_flight + units_waiting - 1) / units_waiting;
+    }
+}
 
-    /* does this tag need to do anything? */
 
-    pdebug(DEBUG_SPEW, "Done.");
+/*
+ * A combined read holds one slot in the window for all the tags in it.
+ * The slot is only given back when the last of them stops waiting.
+ *
+ * Called with the PLC mutex held.
+ */
+int is_request_shared(modbus_plc_p plc, modbus_tag_p tag)
+{
+    int shared = 0;
 
-    return rc;
+    if(!tag->flags._grouped || !tag->seq_id) {
+        return 0;
+    }
+
+    for(modbus_tag_p walker = plc->active_tags; walker && !shared; walker = walker->next_active) {
+        if(walker != tag && walker->flags._grouped && walker->flags._busy && walker->seq_id == tag->seq_id) {
+            shared = 1;
+        }
+    }
+
+    return shared;
 }
 
 
@@ -1016,6 +2146,19 @@ int check_read_response(modbus_plc_p plc, modbus_tag_p tag)
     if(seq_id == tag->seq_id) {
         uint8_t has_error = plc->read_data[7] & (uint8_t)0x80;
 
+        release_request_slot(plc, tag);
+
+        if(tag->flags._grouped) {
+            rc = check_group_response(plc, seq_id);
+
+            plc->read_data_len = 0;
+            plc->flags.response_ready = 0;
+
+            pdebug(DEBUG_DETAIL, "Done.");
+
+            return rc;
+        }
+
         if(has_error) {
             rc = translate_modbus_error(plc->read_data[8]);
 
@@ -1034,7 +2177,9 @@ int check_read_response(modbus_plc_p plc, modbus_tag_p tag)
             pdebug(DEBUG_DETAIL, "byte_offset = %d", byte_offset);
             pdebug(DEBUG_DETAIL, "copy_size = %d", copy_size);
 
+            plc_tag_generic_data_write_begin((plc_tag_p)tag);
             mem_copy(tag->data + byte_offset, &plc->read_data[9], copy_size);
+            plc_tag_generic_data_write_end((plc_tag_p)tag);
 
             /* are we done? */
             if(tag->size > (byte_offset + copy_size)) {
@@ -1064,6 +2209,9 @@ int check_read_response(modbus_plc_p plc, modbus_tag_p tag)
                 tag->status = (int8_t)rc;
                 tag->request_num = 0;
             }
+
+            /* wake up anything waiting on the read. */
+            plc_tag_generic_wake_tag(tag->tag_id);
         } else {
             /*
              * keep doing a read, but clear the busy flag so that we
@@ -1088,6 +2236,186 @@ int check_read_response(modbus_plc_p plc, modbus_tag_p tag)
 }
 
 
+/*
+ * check_group_response
+ *
+ * Finish every tag in a combined request.  Writers are done, readers
+ * get their part of the response.  Coils and discrete inputs are packed
+ * bits, so those are shifted into place.  An exception response fails
+ * all the tags.
+ */
+
+int check_group_response(modbus_plc_p plc, uint16_t seq_id)
+{
+    int rc = PLCTAG_STATUS_OK;
+    uint8_t payload_size = plc->read_data[8];
+    int has_data = (plc->read_data[7] != MB_CMD_WRITE_HOLDING_REGISTER_MULTI);
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    if(plc->read_data[7] & (uint8_t)0x80) {
+        rc = translate_modbus_error(plc->read_data[8]);
+        pdebug(DEBUG_WARN, "Got combined response %u with error %s.", (unsigned int)seq_id, plc_tag_decode_error(rc));
+    } else if(has_data && 9 + (int)payload_size > plc->read_data_len) {
+        pdebug(DEBUG_WARN, "Combined response %u is truncated!", (unsigned int)seq_id);
+        rc = PLCTAG_ERR_BAD_REPLY;
+    }
+
+    for(modbus_tag_p member = plc->active_tags; member; member = member->next_active) {
+        int tag_rc = rc;
+
+        if(!member->flags._grouped || !member->flags._busy || member->seq_id != seq_id) {
+            continue;
+        }
+
+        if(member->flags._write) {
+            pdebug(DEBUG_DETAIL, "Tag %d got %s from combined write %u.", member->tag_id, plc_tag_decode_error(tag_rc), (unsigned int)seq_id);
+
+            spin_block(&member->tag_lock) {
+                member->flags._write = 0;
+                member->flags._busy = 0;
+                member->flags._grouped = 0;
+                member->seq_id = 0;
+                member->request_num = 0;
+                member->write_complete = 1;
+                member->status = (int8_t)tag_rc;
+            }
+
+            plc_tag_generic_wake_tag(member->tag_id);
+
+            continue;
+        }
+
+        if(tag_rc == PLCTAG_STATUS_OK && !has_data) {
+            tag_rc = PLCTAG_ERR_BAD_REPLY;
+        }
+
+        if(tag_rc == PLCTAG_STATUS_OK) {
+            int offset = member->reg_base - member->read_base;
+
+            plc_tag_generic_data_write_begin((plc_tag_p)member);
+
+            if(member->elem_size == 1) {
+                if((offset + member->elem_count + 7) / 8 > payload_size) {
+                    tag_rc = PLCTAG_ERR_TOO_SMALL;
+                } else {
+                    mem_set(member->data, 0, member->size);
+
+                    for(int bit = 0; bit < member->elem_count; bit++) {
+                        int src_bit = offset + bit;
+
+                        if(plc->read_data[9 + (src_bit / 8)] & (1 << (src_bit % 8))) {
+                            member->data[bit / 8] = (uint8_t)(member->data[bit / 8] | (1 << (bit % 8)));
+                        }
+                    }
+                }
+            } else {
+                int byte_offset = (offset * member->elem_size) / 8;
+
+                if(byte_offset + member->size > payload_size) {
+                    tag_rc = PLCTAG_ERR_TOO_SMALL;
+                } else {
+                    mem_copy(member->data, &plc->read_data[9 + byte_offset], member->size);
+                }
+            }
+
+            plc_tag_generic_data_write_end((plc_tag_p)member);
+        }
+
+        pdebug(DEBUG_DETAIL, "Tag %d got %s from combined read %u.", member->tag_id, plc_tag_decode_error(tag_rc), (unsigned int)seq_id);
+
+        spin_block(&member->tag_lock) {
+            member->flags._read = 0;
+            member->flags._busy = 0;
+            member->flags._grouped = 0;
+            member->seq_id = 0;
+            member->read_complete = 1;
+            member->status = (int8_t)tag_rc;
+            member->request_num = 0;
+        }
+
+        plc_tag_generic_wake_tag(member->tag_id);
+    }
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return rc;
+}
+
+
+/*
+ * plan_read_group
+ *
+ * Dashboards tend to have many small tags on neighbouring registers.
+ * Pull other tags waiting to read the same register type into this
+ * tag's request as long as the span fits in one response and the holes
+ * between them are no bigger than the PLC's coalesce gap.  The other
+ * tags wait on this request's transaction ID.
+ *
+ * Returns the number of other tags pulled in.  Called with the PLC
+ * mutex held.
+ */
+
+int plan_read_group(modbus_plc_p plc, modbus_tag_p tag, int *base_register, int *register_count)
+{
+    int max_registers = (MAX_MODBUS_RESPONSE_PAYLOAD * 8) / tag->elem_size;
+    int low = tag->reg_base;
+    int high = tag->reg_base + tag->elem_count;
+    int members = 0;
+    int added = 1;
+    int64_t now = time_ms();
+
+    if(plc->coalesce_gap < 0 || tag->request_num != 0 || tag->elem_count > max_registers) {
+        return 0;
+    }
+
+    /* tags can bridge the gap to ones already passed, so go around until nothing changes. */
+    while(added) {
+        added = 0;
+
+        for(modbus_tag_p other = plc->active_tags; other; other = other->next_active) {
+            int other_low = other->reg_base;
+            int other_high = other->reg_base + other->elem_count;
+            int new_low = (other_low < low ? other_low : low);
+            int new_high = (other_high > high ? other_high : high);
+            int joined = 0;
+
+            if(other == tag || other->reg_type != tag->reg_type || other->server_id != tag->server_id || other->request_num != 0 || MB_TAG_EXPIRED(other, now)) {
+                continue;
+            }
+
+            if(other_low > high + plc->coalesce_gap || other_high + plc->coalesce_gap < low || (new_high - new_low) > max_registers) {
+                continue;
+            }
+
+            spin_block(&other->tag_lock) {
+                if(other->flags._read && !other->flags._busy && !other->flags._write && !other->flags._abort) {
+                    other->flags._busy = 1;
+                    other->flags._grouped = 1;
+                    joined = 1;
+                }
+            }
+
+            if(joined) {
+                low = new_low;
+                high = new_high;
+                members++;
+                added = 1;
+            }
+        }
+    }
+
+    if(members) {
+        pdebug(DEBUG_DETAIL, "Combining %d tags into a read of %d registers from %d.", members + 1, high - low, low);
+
+        *base_register = low;
+        *register_count = high - low;
+    }
+
+    return members;
+}
+
+
 int create_read_request(modbus_plc_p plc, modbus_tag_p tag)
 {
     int rc = PLCTAG_STATUS_OK;
@@ -1095,6 +2423,8 @@ int create_read_request(modbus_plc_p plc, modbus_tag_p tag)
     int registers_per_request = (MAX_MODBUS_RESPONSE_PAYLOAD * 8) / tag->elem_size;
     int base_register = tag->reg_base + (tag->request_num * registers_per_request);
     int register_count = tag->elem_count - (tag->request_num * registers_per_request);
+    int request_start = 0;
+    int grouped = 0;
 
     pdebug(DEBUG_INFO, "Starting.");
 
@@ -1108,7 +2438,6 @@ int create_read_request(modbus_plc_p plc, modbus_tag_p tag)
         register_count = registers_per_request;
     }
 
-    pdebug(DEBUG_INFO, "preparing read request for %d registers (of %d total) from base register %d.", register_count, tag->elem_count, base_register);
 
     /* build the read request.
      *    Byte  Meaning
@@ -1126,7 +2455,8 @@ int create_read_request(modbus_plc_p plc, modbus_tag_p tag)
      *     11    Low byte of the register count.
      */
 
-    plc->write_data_len = 0;
+    /* the request goes after any already queued. */
+    request_start = plc->write_data_len;
 
     /* build the request sequence ID */
     plc->write_data[plc->write_data_len] = (uint8_t)((seq_id >> 8) & 0xFF); plc->write_data_len++;
@@ -1141,32 +2471,38 @@ int create_read_request(modbus_plc_p plc, modbus_tag_p tag)
     plc->write_data[plc->write_data_len] = 6; plc->write_data_len++;
 
     /* device address */
-    plc->write_data[plc->write_data_len] = plc->server_id; plc->write_data_len++;
+    plc->write_data[plc->write_data_len] = tag->server_id; plc->write_data_len++;
 
     /* function code depends on the register type. */
     switch(tag->reg_type) {
         case MB_REG_COIL:
-            plc->write_data[7] = MB_CMD_READ_COIL_MULTI; plc->write_data_len++;
+            plc->write_data[plc->write_data_len] = MB_CMD_READ_COIL_MULTI; plc->write_data_len++;
             break;
 
         case MB_REG_DISCRETE_INPUT:
-            plc->write_data[7] = MB_CMD_READ_DISCRETE_INPUT_MULTI; plc->write_data_len++;
+            plc->write_data[plc->write_data_len] = MB_CMD_READ_DISCRETE_INPUT_MULTI; plc->write_data_len++;
             break;
 
         case MB_REG_HOLDING_REGISTER:
-            plc->write_data[7] = MB_CMD_READ_HOLDING_REGISTER_MULTI; plc->write_data_len++;
+            plc->write_data[plc->write_data_len] = MB_CMD_READ_HOLDING_REGISTER_MULTI; plc->write_data_len++;
             break;
 
         case MB_REG_INPUT_REGISTER:
-            plc->write_data[7] = MB_CMD_READ_INPUT_REGISTER_MULTI; plc->write_data_len++;
+            plc->write_data[plc->write_data_len] = MB_CMD_READ_INPUT_REGISTER_MULTI; plc->write_data_len++;
             break;
 
         default:
             pdebug(DEBUG_WARN, "Unsupported register type %d!", tag->reg_type);
+            plc->write_data_len = request_start;
             return PLCTAG_ERR_UNSUPPORTED;
             break;
     }
 
+    /* see if other tags can share this request. */
+    grouped = (plan_read_group(plc, tag, &base_register, &register_count) > 0);
+
+    pdebug(DEBUG_INFO, "preparing read request for %d registers (of %d total) from base register %d.", register_count, tag->elem_count, base_register);
+
     /* register base. */
     plc->write_data[plc->write_data_len] = (uint8_t)((base_register >> 8) & 0xFF); plc->write_data_len++;
     plc->write_data[plc->write_data_len] = (uint8_t)((base_register >> 0) & 0xFF); plc->write_data_len++;
@@ -1178,12 +2514,27 @@ int create_read_request(modbus_plc_p plc, modbus_tag_p tag)
     /* ready to go! */
     spin_block(&tag->tag_lock) {
         tag->flags._busy = 1;
+        tag->flags._grouped = (grouped ? 1 : 0);
         tag->seq_id = seq_id;
+        tag->read_base = (uint16_t)(unsigned int)base_register;
+    }
+
+    /* the tags sharing the request wait for the same transaction. */
+    if(grouped) {
+        for(modbus_tag_p member = plc->active_tags; member; member = member->next_active) {
+            if(member != tag && member->flags._grouped && member->flags._busy && !member->seq_id) {
+                spin_block(&member->tag_lock) {
+                    member->seq_id = seq_id;
+                    member->read_base = (uint16_t)(unsigned int)base_register;
+                }
+            }
+        }
     }
 
     /* FIXME - could this ever be hoisted above the barrier above? */
     plc->flags.request_ready = 1;
-    plc->flags.request_in_flight = 1;
+    plc->write_data_count++;
+    take_request_slot(plc, tag);
 
     pdebug(DEBUG_DETAIL, "Done.");
 
@@ -1220,6 +2571,19 @@ int check_write_response(modbus_plc_p plc, modbus_tag_p tag)
     if(seq_id == tag->seq_id) {
         uint8_t has_error = plc->read_data[7] & (uint8_t)0x80;
 
+        release_request_slot(plc, tag);
+
+        if(tag->flags._grouped) {
+            rc = check_group_response(plc, seq_id);
+
+            plc->read_data_len = 0;
+            plc->flags.response_ready = 0;
+
+            pdebug(DEBUG_SPEW, "Done.");
+
+            return rc;
+        }
+
         if(has_error) {
             rc = translate_modbus_error(plc->read_data[8]);
 
@@ -1261,6 +2625,9 @@ int check_write_response(modbus_plc_p plc, modbus_tag_p tag)
                 tag->write_complete = 1;
                 tag->status = (int8_t)rc;
             }
+
+            /* wake up anything waiting on the write. */
+            plc_tag_generic_wake_tag(tag->tag_id);
         } else {
             /*
              * keep doing a write, but clear the busy flag so that we
@@ -1284,6 +2651,123 @@ int check_write_response(modbus_plc_p plc, modbus_tag_p tag)
 }
 
 
+/*
+ * plan_write_group
+ *
+ * Recipe downloads write many small holding register tags.  Pull other
+ * waiting writes that butt up against this one into the same FC16
+ * request.  Only exact neighbours join, holes would have to be written
+ * with something.  The other tags wait on this request's transaction ID.
+ *
+ * Returns the number of other tags pulled in.  Called with the PLC
+ * mutex held.
+ */
+
+int plan_write_group(modbus_plc_p plc, modbus_tag_p tag, int *base_register, int *register_count)
+{
+    int max_registers = (plc->read_write_multiple ? MODBUS_MAX_FC23_WRITE_REGISTERS : (MAX_MODBUS_REQUEST_PAYLOAD * 8) / tag->elem_size);
+    int low = tag->reg_base;
+    int high = tag->reg_base + tag->elem_count;
+    int members = 0;
+    int added = 1;
+    int64_t now = time_ms();
+
+    if(plc->coalesce_gap < 0 || tag->elem_count > max_registers) {
+        return 0;
+    }
+
+    while(added) {
+        added = 0;
+
+        for(modbus_tag_p other = plc->active_tags; other; other = other->next_active) {
+            int other_low = other->reg_base;
+            int other_high = other->reg_base + other->elem_count;
+            int joined = 0;
+
+            if(other == tag || other->reg_type != MB_REG_HOLDING_REGISTER || other->server_id != tag->server_id || other->request_num != 0 || MB_TAG_EXPIRED(other, now)) {
+                continue;
+            }
+
+            if((other_low != high && other_high != low) || (high - low) + other->elem_count > max_registers) {
+                continue;
+            }
+
+            spin_block(&other->tag_lock) {
+                if(other->flags._write && !other->flags._busy && !other->flags._abort) {
+                    other->flags._busy = 1;
+                    other->flags._grouped = 1;
+                    joined = 1;
+                }
+            }
+
+            if(joined) {
+                low = (other_low < low ? other_low : low);
+                high = (other_high > high ? other_high : high);
+                members++;
+                added = 1;
+            }
+        }
+    }
+
+    if(members) {
+        pdebug(DEBUG_DETAIL, "Combining %d tags into a write of %d registers from %d.", members + 1, high - low, low);
+
+        *base_register = low;
+        *register_count = high - low;
+    }
+
+    return members;
+}
+
+
+/*
+ * plan_read_write_group
+ *
+ * FC23 writes and then reads holding registers in one transaction.  If
+ * the PLC allows it, find a waiting holding register read on the same
+ * unit, plus any reads that combine with it, to ride along with the
+ * write.
+ *
+ * Returns the number of reading tags pulled in.  Called with the PLC
+ * mutex held.
+ */
+
+int plan_read_write_group(modbus_plc_p plc, modbus_tag_p tag, int write_count, int *read_base_register, int *read_register_count)
+{
+    int max_registers = (MAX_MODBUS_RESPONSE_PAYLOAD * 8) / tag->elem_size;
+    int64_t now = time_ms();
+
+    if(!plc->read_write_multiple || write_count > MODBUS_MAX_FC23_WRITE_REGISTERS) {
+        return 0;
+    }
+
+    for(modbus_tag_p other = plc->active_tags; other; other = other->next_active) {
+        int joined = 0;
+
+        if(other == tag || other->reg_type != MB_REG_HOLDING_REGISTER || other->server_id != tag->server_id || other->request_num != 0 || other->elem_count > max_registers || MB_TAG_EXPIRED(other, now)) {
+            continue;
+        }
+
+        spin_block(&other->tag_lock) {
+            if(other->flags._read && !other->flags._busy && !other->flags._write && !other->flags._abort) {
+                other->flags._busy = 1;
+                other->flags._grouped = 1;
+                joined = 1;
+            }
+        }
+
+        if(joined) {
+            *read_base_register = other->reg_base;
+            *read_register_count = other->elem_count;
+
+            return 1 + plan_read_group(plc, other, read_base_register, read_register_count);
+        }
+    }
+
+    return 0;
+}
+
+
 /* build the write request.
  *    Byte  Meaning
  *      0    High byte of request sequence ID.
@@ -1300,6 +2784,9 @@ int check_write_response(modbus_plc_p plc, modbus_tag_p tag)
  *     11    Low byte of the register count.
  *     12    Number of bytes of data to write.
  *     13... Data bytes.
+ *
+ * FC23 puts the address and count of the registers to read in front of
+ * the ones to write.
  */
 
 int create_write_request(modbus_plc_p plc, modbus_tag_p tag)
@@ -1312,6 +2799,12 @@ int create_write_request(modbus_plc_p plc, modbus_tag_p tag)
     int register_offset = (tag->request_num * registers_per_request);
     int byte_offset = (register_offset * tag->elem_size) / 8;
     int request_payload_size = 0;
+    int read_base_register = 0;
+    int read_register_count = 0;
+    int write_members = 0;
+    int read_members = 0;
+    int pdu_size = 0;
+    uint8_t function = 0;
 
     pdebug(DEBUG_INFO, "Starting.");
 
@@ -1327,33 +2820,10 @@ int create_write_request(modbus_plc_p plc, modbus_tag_p tag)
         register_count = registers_per_request;
     }
 
-    /* how many bytes, rounded up to the nearest byte. */
-    request_payload_size = ((register_count * tag->elem_size) + 7) / 8;
-
-    pdebug(DEBUG_INFO, "preparing write request for %d registers (of %d total) from base register %d of payload size %d in bytes.", register_count, tag->elem_count, base_register, request_payload_size);
-
-    /* FIXME - remove this when we figure out how to push multiple requests. */
-    plc->write_data_len = 0;
-
-    /* build the request sequence ID */
-    plc->write_data[plc->write_data_len] = (uint8_t)((seq_id >> 8) & 0xFF); plc->write_data_len++;
-    plc->write_data[plc->write_data_len] = (uint8_t)((seq_id >> 0) & 0xFF); plc->write_data_len++;
-
-    /* protocol version is always zero */
-    plc->write_data[plc->write_data_len] = 0; plc->write_data_len++;
-    plc->write_data[plc->write_data_len] = 0; plc->write_data_len++;
-
-    /* request packet length */
-    plc->write_data[plc->write_data_len] = (uint8_t)(((request_payload_size + 7) >> 8) & 0xFF); plc->write_data_len++;
-    plc->write_data[plc->write_data_len] = (uint8_t)(((request_payload_size + 7) >> 0) & 0xFF); plc->write_data_len++;
-
-    /* device address */
-    plc->write_data[plc->write_data_len] = plc->server_id; plc->write_data_len++;
-
     /* function code depends on the register type. */
     switch(tag->reg_type) {
         case MB_REG_COIL:
-            plc->write_data[7] = MB_CMD_WRITE_COIL_MULTI; plc->write_data_len++;
+            function = MB_CMD_WRITE_COIL_MULTI;
             break;
 
         case MB_REG_DISCRETE_INPUT:
@@ -1362,7 +2832,7 @@ int create_write_request(modbus_plc_p plc, modbus_tag_p tag)
             break;
 
         case MB_REG_HOLDING_REGISTER:
-            plc->write_data[7] = MB_CMD_WRITE_HOLDING_REGISTER_MULTI; plc->write_data_len++;
+            function = MB_CMD_WRITE_HOLDING_REGISTER_MULTI;
             break;
 
         case MB_REG_INPUT_REGISTER:
@@ -1376,30 +2846,98 @@ int create_write_request(modbus_plc_p plc, modbus_tag_p tag)
             break;
     }
 
+    /* only whole holding register writes are combined. */
+    if(function == MB_CMD_WRITE_HOLDING_REGISTER_MULTI && tag->request_num == 0 && register_count == tag->elem_count) {
+        write_members = plan_write_group(plc, tag, &base_register, &register_count);
+        read_members = plan_read_write_group(plc, tag, register_count, &read_base_register, &read_register_count);
+
+        if(read_members) {
+            function = MB_CMD_READ_WRITE_HOLDING_REGISTER_MULTI;
+        }
+    }
+
+    /* how many bytes, rounded up to the nearest byte. */
+    request_payload_size = ((register_count * tag->elem_size) + 7) / 8;
+
+    /* device address, function, addresses and counts, byte count and the data. */
+    pdu_size = request_payload_size + (function == MB_CMD_READ_WRITE_HOLDING_REGISTER_MULTI ? 11 : 7);
+
+    pdebug(DEBUG_INFO, "preparing write request for %d registers (of %d total) from base register %d of payload size %d in bytes.", register_count, tag->elem_count, base_register, request_payload_size);
+
+    /* build the request sequence ID */
+    plc->write_data[plc->write_data_len] = (uint8_t)((seq_id >> 8) & 0xFF); plc->write_data_len++;
+    plc->write_data[plc->write_data_len] = (uint8_t)((seq_id >> 0) & 0xFF); plc->write_data_len++;
+
+    /* protocol version is always zero */
+    plc->write_data[plc->write_data_len] = 0; plc->write_data_len++;
+    plc->write_data[plc->write_data_len] = 0; plc->write_data_len++;
+
+    /* request packet length */
+    plc->write_data[plc->write_data_len] = (uint8_t)((pdu_size >> 8) & 0xFF); plc->write_data_len++;
+    plc->write_data[plc->write_data_len] = (uint8_t)((pdu_size >> 0) & 0xFF); plc->write_data_len++;
+
+    /* device address */
+    plc->write_data[plc->write_data_len] = tag->server_id; plc->write_data_len++;
+
+    plc->write_data[plc->write_data_len] = function; plc->write_data_len++;
+
+    if(function == MB_CMD_READ_WRITE_HOLDING_REGISTER_MULTI) {
+        plc->write_data[plc->write_data_len] = (uint8_t)((read_base_register >> 8) & 0xFF); plc->write_data_len++;
+        plc->write_data[plc->write_data_len] = (uint8_t)((read_base_register >> 0) & 0xFF); plc->write_data_len++;
+
+        plc->write_data[plc->write_data_len] = (uint8_t)((read_register_count >> 8) & 0xFF); plc->write_data_len++;
+        plc->write_data[plc->write_data_len] = (uint8_t)((read_register_count >> 0) & 0xFF); plc->write_data_len++;
+    }
+
     /* register base. */
     plc->write_data[plc->write_data_len] = (uint8_t)((base_register >> 8) & 0xFF); plc->write_data_len++;
     plc->write_data[plc->write_data_len] = (uint8_t)((base_register >> 0) & 0xFF); plc->write_data_len++;
 
-    /* number of elements to read. */
+    /* number of elements to write. */
     plc->write_data[plc->write_data_len] = (uint8_t)((register_count >> 8) & 0xFF); plc->write_data_len++;
     plc->write_data[plc->write_data_len] = (uint8_t)((register_count >> 0) & 0xFF); plc->write_data_len++;
 
     /* number of bytes of data to write. */
     plc->write_data[plc->write_data_len] = (uint8_t)(unsigned int)(request_payload_size); plc->write_data_len++;
 
-    /* copy the tag data. */
-    mem_copy(&plc->write_data[plc->write_data_len], &tag->data[byte_offset], request_payload_size);
+    /* copy the tag data, each combined tag goes where its registers are. */
+    if(write_members) {
+        for(modbus_tag_p member = plc->active_tags; member; member = member->next_active) {
+            if(member == tag || (member->flags._grouped && member->flags._busy && member->flags._write && !member->seq_id)) {
+                int member_offset = ((member->reg_base - base_register) * member->elem_size) / 8;
+
+                mem_copy(&plc->write_data[plc->write_data_len + member_offset], member->data, member->size);
+            }
+        }
+    } else {
+        mem_copy(&plc->write_data[plc->write_data_len], &tag->data[byte_offset], request_payload_size);
+    }
+
     plc->write_data_len += request_payload_size;
 
     /* ready to go. */
     spin_block(&tag->tag_lock) {
         tag->flags._busy = 1;
+        tag->flags._grouped = ((write_members || read_members) ? 1 : 0);
         tag->seq_id = (uint16_t)(unsigned int)seq_id;
         tag->request_num++;
     }
 
+    /* the tags sharing the request wait for the same transaction. */
+    if(write_members || read_members) {
+        for(modbus_tag_p member = plc->active_tags; member; member = member->next_active) {
+            if(member != tag && member->flags._grouped && member->flags._busy && !member->seq_id) {
+                spin_block(&member->tag_lock) {
+                    member->seq_id = seq_id;
+                    member->read_base = (uint16_t)(unsigned int)read_base_register;
+                }
+            }
+        }
+    }
+
     plc->flags.request_ready = 1;
-    plc->flags.request_in_flight = 1;
+    plc->write_data_count++;
+    take_request_slot(plc, tag);
 
     pdebug(DEBUG_DETAIL, "Done.");
 
@@ -1453,6 +2991,16 @@ int translate_modbus_error(uint8_t err_code)
             rc = PLCTAG_ERR_REMOTE_ERR;
             break;
 
+        case 0x0A:
+            pdebug(DEBUG_WARN, "The gateway has no path to the target device!");
+            rc = PLCTAG_ERR_REMOTE_ERR;
+            break;
+
+        case 0x0B:
+            pdebug(DEBUG_WARN, "The target device failed to respond!");
+            rc = PLCTAG_ERR_TIMEOUT;
+            break;
+
         default:
             pdebug(DEBUG_WARN, "Unknown error response %u received!", (int)(unsigned int)(err_code));
             rc = PLCTAG_ERR_UNSUPPORTED;
@@ -1465,6 +3013,24 @@ int translate_modbus_error(uint8_t err_code)
 
 
 
+int parse_parity(const char *parity_str, int *parity)
+{
+    if(str_cmp_i(parity_str, "none") == 0) {
+        *parity = 0;
+    } else if(str_cmp_i(parity_str, "odd") == 0) {
+        *parity = 1;
+    } else if(str_cmp_i(parity_str, "even") == 0) {
+        *parity = 2;
+    } else {
+        pdebug(DEBUG_WARN, "Unsupported parity \"%s\", must be none, odd or even!", parity_str);
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
 int parse_register_name(attr attribs, modbus_reg_type_t *reg_type, int *reg_base)
 {
     int rc = PLCTAG_STATUS_OK;
@@ -1625,6 +3191,9 @@ int mb_abort(plc_tag_p p_tag)
     }
 
     tag_set_abort_flag(tag, 1);
+    schedule_tag(tag);
+
+    wake_plc(tag->plc);
 
     return PLCTAG_STATUS_OK;
 }
@@ -1658,6 +3227,9 @@ int mb_read_start(plc_tag_p p_tag)
 
     tag->status = PLCTAG_STATUS_OK;
     tag_set_read_flag(tag, 1);
+    schedule_tag(tag);
+
+    wake_plc(tag->plc);
 
     pdebug(DEBUG_DETAIL, "Done.");
 
@@ -1739,6 +3311,9 @@ int mb_write_start(plc_tag_p p_tag)
 
     tag_set_write_flag(tag, 1);
     tag->status = PLCTAG_STATUS_OK;
+    schedule_tag(tag);
+
+    wake_plc(tag->plc);
 
     pdebug(DEBUG_DETAIL, "Done.");
 
@@ -1795,6 +3370,41 @@ void mb_teardown(void)
 
     library_terminating = 1;
 
+    /*
+     * PLCs still held by tags are stopped here.  Tell all the handler
+     * threads to stop before waiting for any, so they wind down together.
+     * The threads can end up in the PLC destructor, so wait outside the
+     * mutex and hold a reference to each PLC.
+     */
+    if(mb_mutex) {
+        modbus_plc_p stopping = NULL;
+
+        critical_block(mb_mutex) {
+            for(modbus_plc_p plc = plcs; plc; plc = plc->next) {
+                if(plc->handler_thread && rc_inc(plc)) {
+                    plc->flags.terminate = 1;
+                    wake_plc(plc);
+
+                    plc->teardown_next = stopping;
+                    stopping = plc;
+                }
+            }
+        }
+
+        while(stopping) {
+            modbus_plc_p plc = stopping;
+
+            stopping = plc->teardown_next;
+            plc->teardown_next = NULL;
+
+            thread_join(plc->handler_thread);
+            thread_destroy(&plc->handler_thread);
+            plc->handler_thread = NULL;
+
+            rc_dec(plc);
+        }
+    }
+
     pdebug(DEBUG_DETAIL, "Destroying Modbus mutex.");
     if(mb_mutex) {
         mutex_destroy(&mb_mutex);
@@ -0,0 +1,1021 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <platform.h>
+#include <lib/libplctag.h>
+#include <lib/tag.h>
+#include <shared/shared.h>
+#include <alias/alias.h>
+#include <util/attr.h>
+#include <util/debug.h>
+#include <util/rc.h>
+
+
+/*
+ * The region starts with a header and the directory of slots, the tag
+ * data follows.  Slot data space is handed out in order and kept by the
+ * slot when its tag goes away so the next tag in the slot can use it.
+ *
+ * The layout is only shared between processes using the same build of the
+ * library, the header records the structure sizes so a mismatch is found.
+ */
+
+#define SHARED_MAGIC                (0x48535450)    /* "PTSH" */
+#define SHARED_VERSION              (1)
+#define SHARED_KEY_SIZE             (128)
+#define SHARED_DEFAULT_SLOTS        (256)
+#define SHARED_MAX_SLOTS            (65536)
+#define SHARED_DEFAULT_DATA_SIZE    (1024 * 1024)
+#define SHARED_MIN_DATA_SIZE        (1024)
+#define SHARED_MAX_DATA_SIZE        (256 * 1024 * 1024)
+#define SHARED_READ_TRIES           (1000)
+
+typedef struct {
+    volatile uint32_t magic;        /* set last, when the region is ready. */
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t slot_size;
+    uint32_t num_slots;
+    uint32_t data_start;
+    uint32_t data_size;
+    volatile uint32_t data_used;
+    volatile uint32_t closed;       /* the publisher is gone. */
+    uint32_t pad;
+} shared_header_t;
+
+typedef struct {
+    volatile uint32_t seq;          /* odd while the slot is being changed. */
+    uint32_t generation;            /* changes each time the slot gets a new tag. */
+    uint32_t in_use;
+    int32_t status;
+    uint32_t data_offset;           /* from the start of the region. */
+    uint32_t data_capacity;
+    uint32_t data_size;
+    uint32_t update_count;
+    int32_t elem_size;
+    int32_t elem_count;
+    int64_t update_time_ms;         /* wall clock. */
+    tag_byte_order_t byte_order;
+    char key[SHARED_KEY_SIZE];
+} shared_slot_t;
+
+
+/* a region this process publishes to. */
+typedef struct shared_region_t *shared_region_p;
+
+struct shared_region_t {
+    struct shared_region_t *next;
+    char *name;
+    int num_tags;
+    shm_p shm;
+    shared_header_t *header;
+    shared_slot_t *slots;
+};
+
+/* the slot of a publishing tag. */
+struct tag_shared_t {
+    shared_region_p region;
+    shared_slot_t *slot;
+    int published_size;
+};
+
+/* a region this process reads from, shared by all reader tags on it. */
+typedef struct shared_view_t *shared_view_p;
+
+struct shared_view_t {
+    struct shared_view_t *next;
+    char *name;
+    int num_tags;
+    shm_p shm;
+    const shared_header_t *header;
+    const shared_slot_t *slots;
+};
+
+struct shared_tag_t {
+    /*struct plc_tag_t p_tag;*/
+    TAG_BASE_STRUCT;
+
+    char *region_name;
+    char key[SHARED_KEY_SIZE];
+
+    shared_view_p view;
+    int slot_index;
+    uint32_t generation;
+    uint32_t update_count;
+    int elem_size;
+    int elem_count;
+
+    int read_status;
+    int read_done;
+
+    tag_byte_order_t slot_byte_order;
+};
+
+typedef struct shared_tag_t *shared_tag_p;
+
+
+static mutex_p shared_mutex = NULL;
+static shared_region_p regions = NULL;
+static shared_view_p views = NULL;
+
+
+static shared_region_p shared_region_get_unsafe(const char *name, attr attribs);
+static void shared_region_release_unsafe(shared_region_p region);
+static void shared_slot_begin(shared_slot_t *slot);
+static void shared_slot_end(shared_slot_t *slot);
+static shared_view_p shared_view_get_unsafe(const char *name);
+static void shared_view_release_unsafe(shared_view_p view);
+static int shared_view_is_stale(shared_view_p view);
+static int shared_tag_find_slot(shared_tag_p tag);
+static int shared_tag_copy_slot(shared_tag_p tag);
+
+static void shared_tag_destroy(shared_tag_p tag);
+static int shared_tag_abort(plc_tag_p tag);
+static int shared_tag_read(plc_tag_p tag);
+static int shared_tag_status(plc_tag_p tag);
+static int shared_tag_tickler(plc_tag_p tag);
+static int shared_tag_write(plc_tag_p tag);
+static int shared_tag_get_int_attrib(plc_tag_p tag, const char *attrib_name, int default_value);
+static int shared_tag_set_int_attrib(plc_tag_p tag, const char *attrib_name, int new_value);
+
+struct tag_vtable_t shared_tag_vtable = {
+    /* abort */     shared_tag_abort,
+    /* read */      shared_tag_read,
+    /* status */    shared_tag_status,
+    /* tickler */   shared_tag_tickler,
+    /* write */     shared_tag_write,
+
+    /* data accessors */
+
+    /* get_int_attrib */ shared_tag_get_int_attrib,
+    /* set_int_attrib */ shared_tag_set_int_attrib,
+    /* get_member_offset */ NULL,
+    /* set_range */ NULL
+};
+
+
+
+int shared_init(void)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    rc = mutex_create(&shared_mutex);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_ERROR, "Unable to create shared memory mutex %s!", plc_tag_decode_error(rc));
+        return rc;
+    }
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return rc;
+}
+
+
+void shared_teardown(void)
+{
+    pdebug(DEBUG_INFO, "Starting.");
+
+    /* the tags are all gone by now, so are their regions. */
+    if(shared_mutex) {
+        mutex_destroy(&shared_mutex);
+        shared_mutex = NULL;
+    }
+
+    pdebug(DEBUG_INFO, "Done.");
+}
+
+
+
+
+/***************************************************************************
+ ******************************* Publishing ********************************
+ **************************************************************************/
+
+
+/*
+ * shared_publish_setup
+ *
+ * Called when the tag is created.  Nothing is done unless the tag has the
+ * shared_region attribute.  The region is created by the first tag that
+ * uses it, shared_slots and shared_data_size on that tag set its size.
+ */
+
+int shared_publish_setup(plc_tag_p tag, attr attribs)
+{
+    const char *region_name = attr_get_str(attribs, "shared_region", NULL);
+    const char *key = attr_get_str(attribs, "shared_key", attr_get_str(attribs, "name", NULL));
+    struct tag_shared_t *shared = NULL;
+    int rc = PLCTAG_STATUS_OK;
+
+    /* reader tags use the same attribute to find the region. */
+    if(!region_name || str_length(region_name) == 0 || tag->vtable == &shared_tag_vtable) {
+        return PLCTAG_STATUS_OK;
+    }
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(!key || str_length(key) == 0 || str_length(key) >= SHARED_KEY_SIZE) {
+        pdebug(DEBUG_WARN, "The shared key must be set and shorter than %d characters!", SHARED_KEY_SIZE);
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    shared = (struct tag_shared_t *)mem_alloc((int)sizeof(*shared));
+    if(!shared) {
+        pdebug(DEBUG_ERROR, "Unable to allocate shared memory slot info!");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    critical_block(shared_mutex) {
+        shared_region_p region = shared_region_get_unsafe(region_name, attribs);
+        shared_slot_t *free_slot = NULL;
+
+        if(!region) {
+            rc = PLCTAG_ERR_NO_RESOURCES;
+            break;
+        }
+
+        for(uint32_t i=0; i < region->header->num_slots; i++) {
+            shared_slot_t *slot = &region->slots[i];
+
+            if(slot->in_use) {
+                if(str_cmp(slot->key, key) == 0) {
+                    pdebug(DEBUG_WARN, "Key %s is already published in region %s!", key, region_name);
+                    rc = PLCTAG_ERR_DUPLICATE;
+                    break;
+                }
+            } else if(!free_slot) {
+                free_slot = slot;
+            }
+        }
+
+        if(rc == PLCTAG_STATUS_OK && !free_slot) {
+            pdebug(DEBUG_WARN, "All %u slots in region %s are in use!", (unsigned int)region->header->num_slots, region_name);
+            rc = PLCTAG_ERR_NO_RESOURCES;
+        }
+
+        if(rc != PLCTAG_STATUS_OK) {
+            shared_region_release_unsafe(region);
+            break;
+        }
+
+        shared_slot_begin(free_slot);
+        free_slot->generation++;
+        free_slot->in_use = 1;
+        free_slot->status = PLCTAG_ERR_NO_DATA;
+        free_slot->data_size = 0;
+        free_slot->update_count = 0;
+        free_slot->update_time_ms = 0;
+        str_copy(free_slot->key, SHARED_KEY_SIZE, key);
+        shared_slot_end(free_slot);
+
+        shared->region = region;
+        shared->slot = free_slot;
+    }
+
+    if(rc != PLCTAG_STATUS_OK) {
+        mem_free(shared);
+        return rc;
+    }
+
+    tag->shared = shared;
+
+    pdebug(DEBUG_INFO, "Done publishing %s in region %s.", key, region_name);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * shared_publish_unsafe
+ *
+ * Copy the tag data into its slot after a read.  If the read failed only
+ * the status is changed.  The tag API mutex must be held.
+ */
+
+void shared_publish_unsafe(plc_tag_p tag, int status)
+{
+    struct tag_shared_t *shared = tag->shared;
+    shared_slot_t *slot = NULL;
+
+    if(!shared) {
+        return;
+    }
+
+    slot = shared->slot;
+
+    /* get more space for the data if the tag grew. */
+    if(status == PLCTAG_STATUS_OK && (uint32_t)tag->size > slot->data_capacity) {
+        critical_block(shared_mutex) {
+            shared_header_t *header = shared->region->header;
+            uint32_t needed = ((uint32_t)tag->size + 7u) & ~7u;
+
+            if(header->data_size - header->data_used < needed) {
+                pdebug(DEBUG_WARN, "Region %s is out of data space for %s!", shared->region->name, slot->key);
+                status = PLCTAG_ERR_TOO_LARGE;
+                break;
+            }
+
+            shared_slot_begin(slot);
+            slot->data_offset = header->data_start + header->data_used;
+            slot->data_capacity = needed;
+            slot->data_size = 0;
+            shared_slot_end(slot);
+
+            header->data_used += needed;
+        }
+    }
+
+    /* the element information can only change with the size. */
+    if(status == PLCTAG_STATUS_OK && tag->size != shared->published_size && tag->vtable->get_int_attrib) {
+        slot->elem_size = tag->vtable->get_int_attrib(tag, "elem_size", 0);
+        slot->elem_count = tag->vtable->get_int_attrib(tag, "elem_count", 0);
+        shared->published_size = tag->size;
+    }
+
+    shared_slot_begin(slot);
+
+    slot->status = status;
+
+    if(status == PLCTAG_STATUS_OK) {
+        if(tag->data && tag->size > 0) {
+            mem_copy(shm_data(shared->region->shm) + slot->data_offset, tag->data, tag->size);
+        }
+
+        slot->data_size = (uint32_t)tag->size;
+
+        if(tag->byte_order) {
+            slot->byte_order = *(tag->byte_order);
+            slot->byte_order.is_allocated = 0;
+        }
+
+        slot->update_count++;
+        slot->update_time_ms = time_epoch_ms();
+    }
+
+    shared_slot_end(slot);
+}
+
+
+
+/*
+ * shared_publish_release
+ *
+ * Give up the slot of the tag.  Readers see the key disappear.  Called
+ * from the tag destructor.
+ */
+
+void shared_publish_release(plc_tag_p tag)
+{
+    struct tag_shared_t *shared = tag->shared;
+
+    if(!shared) {
+        return;
+    }
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    critical_block(shared_mutex) {
+        shared_slot_t *slot = shared->slot;
+
+        shared_slot_begin(slot);
+        slot->in_use = 0;
+        slot->generation++;
+        slot->status = PLCTAG_ERR_NOT_FOUND;
+        slot->key[0] = 0;
+        shared_slot_end(slot);
+
+        shared_region_release_unsafe(shared->region);
+    }
+
+    mem_free(shared);
+    tag->shared = NULL;
+
+    pdebug(DEBUG_INFO, "Done.");
+}
+
+
+
+shared_region_p shared_region_get_unsafe(const char *name, attr attribs)
+{
+    shared_region_p region = regions;
+    int num_slots = 0;
+    int data_size = 0;
+    uint32_t data_start = 0;
+    int rc = PLCTAG_STATUS_OK;
+
+    while(region && str_cmp(region->name, name) != 0) {
+        region = region->next;
+    }
+
+    if(region) {
+        region->num_tags++;
+        return region;
+    }
+
+    num_slots = attr_get_int(attribs, "shared_slots", SHARED_DEFAULT_SLOTS);
+    data_size = attr_get_int(attribs, "shared_data_size", SHARED_DEFAULT_DATA_SIZE);
+
+    if(num_slots < 1 || num_slots > SHARED_MAX_SLOTS || data_size < SHARED_MIN_DATA_SIZE || data_size > SHARED_MAX_DATA_SIZE) {
+        pdebug(DEBUG_WARN, "shared_slots must be 1 to %d and shared_data_size %d to %d!", SHARED_MAX_SLOTS, SHARED_MIN_DATA_SIZE, SHARED_MAX_DATA_SIZE);
+        return NULL;
+    }
+
+    region = (shared_region_p)mem_alloc((int)sizeof(*region));
+    if(!region) {
+        pdebug(DEBUG_ERROR, "Unable to allocate shared memory region!");
+        return NULL;
+    }
+
+    region->name = str_dup(name);
+    if(!region->name) {
+        pdebug(DEBUG_ERROR, "Unable to copy the region name!");
+        mem_free(region);
+        return NULL;
+    }
+
+    data_start = ((uint32_t)sizeof(shared_header_t) + (uint32_t)sizeof(shared_slot_t) * (uint32_t)num_slots + 63u) & ~63u;
+
+    rc = shm_create(name, (int)data_start + data_size, &region->shm);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to create shared memory region %s, error %s!", name, plc_tag_decode_error(rc));
+        mem_free(region->name);
+        mem_free(region);
+        return NULL;
+    }
+
+    /* new shared memory is zero filled. */
+    region->header = (shared_header_t *)shm_data(region->shm);
+    region->slots = (shared_slot_t *)(region->header + 1);
+
+    region->header->version = SHARED_VERSION;
+    region->header->header_size = (uint32_t)sizeof(shared_header_t);
+    region->header->slot_size = (uint32_t)sizeof(shared_slot_t);
+    region->header->num_slots = (uint32_t)num_slots;
+    region->header->data_start = data_start;
+    region->header->data_size = (uint32_t)data_size;
+    region->header->data_used = 0;
+
+    mem_barrier();
+    region->header->magic = SHARED_MAGIC;
+
+    region->num_tags = 1;
+    region->next = regions;
+    regions = region;
+
+    pdebug(DEBUG_INFO, "Created shared memory region %s with %d slots and %d bytes of data.", name, num_slots, data_size);
+
+    return region;
+}
+
+
+
+void shared_region_release_unsafe(shared_region_p region)
+{
+    shared_region_p *walker = &regions;
+
+    region->num_tags--;
+
+    if(region->num_tags > 0) {
+        return;
+    }
+
+    while(*walker && *walker != region) {
+        walker = &((*walker)->next);
+    }
+
+    if(*walker) {
+        *walker = region->next;
+    }
+
+    /* readers that still have it mapped see that it is dead. */
+    region->header->closed = 1;
+    mem_barrier();
+
+    shm_destroy(&region->shm);
+    mem_free(region->name);
+    mem_free(region);
+}
+
+
+
+void shared_slot_begin(shared_slot_t *slot)
+{
+    slot->seq++;
+    mem_barrier();
+}
+
+
+void shared_slot_end(shared_slot_t *slot)
+{
+    mem_barrier();
+    slot->seq++;
+}
+
+
+
+
+/***************************************************************************
+ ******************************* Reader Tags *******************************
+ **************************************************************************/
+
+
+plc_tag_p shared_tag_create(attr attribs)
+{
+    shared_tag_p tag = NULL;
+    const char *region_name = attr_get_str(attribs, "shared_region", NULL);
+    const char *key = attr_get_str(attribs, "name", NULL);
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(!region_name || str_length(region_name) == 0) {
+        pdebug(DEBUG_WARN, "Shared tags need the shared_region attribute!");
+        return PLC_TAG_P_NULL;
+    }
+
+    if(!key || str_length(key) == 0 || str_length(key) >= SHARED_KEY_SIZE) {
+        pdebug(DEBUG_WARN, "The tag name must be set and shorter than %d characters!", SHARED_KEY_SIZE);
+        return PLC_TAG_P_NULL;
+    }
+
+    tag = (shared_tag_p)rc_alloc((int)sizeof(struct shared_tag_t), (rc_cleanup_func)shared_tag_destroy);
+    if(!tag) {
+        pdebug(DEBUG_ERROR, "Unable to allocate memory for shared tag!");
+        return PLC_TAG_P_NULL;
+    }
+
+    tag->vtable = &shared_tag_vtable;
+    tag->slot_index = -1;
+
+    /* the real byte order comes from the publisher with the data. */
+    tag->slot_byte_order.int16_order[1] = 1;
+    for(int i=0; i < 4; i++) {
+        tag->slot_byte_order.int32_order[i] = i;
+        tag->slot_byte_order.float32_order[i] = i;
+    }
+    for(int i=0; i < 8; i++) {
+        tag->slot_byte_order.int64_order[i] = i;
+        tag->slot_byte_order.float64_order[i] = i;
+    }
+    tag->byte_order = &tag->slot_byte_order;
+
+    str_copy(tag->key, SHARED_KEY_SIZE, key);
+
+    tag->region_name = str_dup(region_name);
+    if(!tag->region_name) {
+        pdebug(DEBUG_ERROR, "Unable to copy the region name!");
+        tag->status = PLCTAG_ERR_NO_MEM;
+        return (plc_tag_p)tag;
+    }
+
+    /* the publisher may not be running yet, the region is looked for again on each read. */
+    critical_block(shared_mutex) {
+        tag->view = shared_view_get_unsafe(region_name);
+    }
+
+    tag->status = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return (plc_tag_p)tag;
+}
+
+
+
+void shared_tag_destroy(shared_tag_p tag)
+{
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(tag->view) {
+        critical_block(shared_mutex) {
+            shared_view_release_unsafe(tag->view);
+        }
+
+        tag->view = NULL;
+    }
+
+    alias_parent_release((plc_tag_p)tag);
+
+    plc_tag_generic_release_locks((plc_tag_p)tag);
+
+    if(tag->tag_cond_wait) {
+        cond_destroy(&(tag->tag_cond_wait));
+        tag->tag_cond_wait = NULL;
+    }
+
+    if(tag->change_detect) {
+        mem_free(tag->change_detect);
+        tag->change_detect = NULL;
+    }
+
+    if(tag->dirty_ranges) {
+        mem_free(tag->dirty_ranges);
+        tag->dirty_ranges = NULL;
+    }
+
+    if(tag->history) {
+        mem_free(tag->history);
+        tag->history = NULL;
+    }
+
+    if(tag->stats) {
+        mem_free(tag->stats);
+        tag->stats = NULL;
+    }
+
+    if(tag->byte_order && tag->byte_order->is_allocated) {
+        mem_free(tag->byte_order);
+        tag->byte_order = NULL;
+    }
+
+    /* the application owns any bound buffer. */
+    plc_tag_generic_unbind_buffer((plc_tag_p)tag);
+
+    if(tag->data) {
+        mem_free(tag->data);
+        tag->data = NULL;
+    }
+
+    plc_tag_generic_free_retired_data((plc_tag_p)tag);
+
+    if(tag->region_name) {
+        mem_free(tag->region_name);
+        tag->region_name = NULL;
+    }
+
+    pdebug(DEBUG_INFO, "Done.");
+}
+
+
+
+int shared_tag_abort(plc_tag_p ptag)
+{
+    shared_tag_p tag = (shared_tag_p)ptag;
+
+    tag->read_done = 0;
+    tag->status = PLCTAG_STATUS_OK;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * shared_tag_read
+ *
+ * Copy the data out of the region.  The copy is finished here, but the
+ * result is handed over by the tickler like the network protocols do so
+ * that the generic read completion runs.
+ */
+
+int shared_tag_read(plc_tag_p ptag)
+{
+    shared_tag_p tag = (shared_tag_p)ptag;
+    int rc = PLCTAG_STATUS_OK;
+
+    if(!tag->view || shared_view_is_stale(tag->view)) {
+        critical_block(shared_mutex) {
+            if(tag->view) {
+                shared_view_release_unsafe(tag->view);
+            }
+
+            tag->view = shared_view_get_unsafe(tag->region_name);
+        }
+
+        tag->slot_index = -1;
+
+        if(!tag->view) {
+            pdebug(DEBUG_DETAIL, "Shared memory region %s is not available.", tag->region_name);
+            return PLCTAG_ERR_NOT_FOUND;
+        }
+    }
+
+    rc = shared_tag_copy_slot(tag);
+
+    /* the slot may have been given to another key, look again once. */
+    if(rc == PLCTAG_ERR_NOT_FOUND && tag->slot_index >= 0) {
+        tag->slot_index = -1;
+        rc = shared_tag_copy_slot(tag);
+    }
+
+    if(rc == PLCTAG_ERR_NOT_FOUND || rc == PLCTAG_ERR_BUSY || rc == PLCTAG_ERR_NO_MEM) {
+        return rc;
+    }
+
+    tag->read_status = rc;
+    tag->read_done = 1;
+
+    return PLCTAG_STATUS_PENDING;
+}
+
+
+
+int shared_tag_status(plc_tag_p tag)
+{
+    return tag->status;
+}
+
+
+
+int shared_tag_tickler(plc_tag_p ptag)
+{
+    shared_tag_p tag = (shared_tag_p)ptag;
+
+    if(tag->read_done) {
+        tag->read_done = 0;
+        tag->status = (int8_t)tag->read_status;
+        tag->read_complete = 1;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+int shared_tag_write(plc_tag_p tag)
+{
+    (void)tag;
+
+    pdebug(DEBUG_WARN, "Shared tags are read only!");
+
+    return PLCTAG_ERR_NOT_ALLOWED;
+}
+
+
+
+int shared_tag_get_int_attrib(plc_tag_p ptag, const char *attrib_name, int default_value)
+{
+    shared_tag_p tag = (shared_tag_p)ptag;
+
+    if(str_cmp_i(attrib_name, "elem_size") == 0) {
+        return tag->elem_size;
+    } else if(str_cmp_i(attrib_name, "elem_count") == 0) {
+        return tag->elem_count;
+    } else if(str_cmp_i(attrib_name, "shared_update_count") == 0) {
+        return (int)tag->update_count;
+    }
+
+    return default_value;
+}
+
+
+
+int shared_tag_set_int_attrib(plc_tag_p tag, const char *attrib_name, int new_value)
+{
+    (void)tag;
+    (void)attrib_name;
+    (void)new_value;
+
+    return PLCTAG_ERR_UNSUPPORTED;
+}
+
+
+
+/*
+ * shared_tag_find_slot
+ *
+ * Look through the directory for the key.  The slot is checked again when
+ * it is copied, so a racy look here is fine.
+ */
+
+int shared_tag_find_slot(shared_tag_p tag)
+{
+    const shared_header_t *header = tag->view->header;
+
+    for(uint32_t i=0; i < header->num_slots; i++) {
+        const shared_slot_t *slot = &tag->view->slots[i];
+        uint32_t seq = slot->seq;
+
+        mem_barrier();
+
+        if(!(seq & 1u) && slot->in_use && str_cmp(slot->key, tag->key) == 0) {
+            tag->generation = slot->generation;
+
+            mem_barrier();
+
+            if(slot->seq == seq) {
+                tag->slot_index = (int)i;
+                return PLCTAG_STATUS_OK;
+            }
+        }
+    }
+
+    return PLCTAG_ERR_NOT_FOUND;
+}
+
+
+
+/*
+ * shared_tag_copy_slot
+ *
+ * Copy the slot into the tag, trying again if the publisher changed it
+ * while we copied.  Returns the status the publisher set, or an error if
+ * the slot could not be read.
+ */
+
+int shared_tag_copy_slot(shared_tag_p tag)
+{
+    const uint8_t *base = shm_data(tag->view->shm);
+    int region_size = shm_size(tag->view->shm);
+
+    if(tag->slot_index < 0 && shared_tag_find_slot(tag) != PLCTAG_STATUS_OK) {
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    for(int tries = 0; tries < SHARED_READ_TRIES; tries++) {
+        const shared_slot_t *slot = &tag->view->slots[tag->slot_index];
+        uint32_t seq = slot->seq;
+        int status = 0;
+        int size = 0;
+        uint32_t offset = 0;
+
+        if(seq & 1u) {
+            continue;
+        }
+
+        mem_barrier();
+
+        if(!slot->in_use || slot->generation != tag->generation) {
+            return PLCTAG_ERR_NOT_FOUND;
+        }
+
+        status = slot->status;
+        size = (int)slot->data_size;
+        offset = slot->data_offset;
+
+        if(status == PLCTAG_STATUS_OK) {
+            if(size < 0 || (int64_t)offset + size > region_size) {
+                continue;
+            }
+
+            if(size != tag->size) {
+                mem_barrier();
+
+                if(slot->seq != seq) {
+                    continue;
+                }
+
+                if(plc_tag_generic_resize_data((plc_tag_p)tag, size) != PLCTAG_STATUS_OK) {
+                    return PLCTAG_ERR_NO_MEM;
+                }
+            }
+
+            plc_tag_generic_data_write_begin((plc_tag_p)tag);
+            mem_copy(tag->data, (void *)(base + offset), size);
+            plc_tag_generic_data_write_end((plc_tag_p)tag);
+        }
+
+        mem_barrier();
+
+        if(slot->seq != seq) {
+            continue;
+        }
+
+        /* these only change with the data, so they are right if the copy was. */
+        if(status == PLCTAG_STATUS_OK) {
+            tag->update_count = slot->update_count;
+            tag->elem_size = slot->elem_size;
+            tag->elem_count = slot->elem_count;
+
+            if(mem_cmp(&tag->slot_byte_order, (int)sizeof(tag_byte_order_t), (void *)&slot->byte_order, (int)sizeof(tag_byte_order_t))) {
+                tag->slot_byte_order = slot->byte_order;
+                plc_tag_generic_update_byte_order((plc_tag_p)tag);
+            }
+        }
+
+        return status;
+    }
+
+    pdebug(DEBUG_WARN, "Slot for %s kept changing while it was read!", tag->key);
+
+    return PLCTAG_ERR_BUSY;
+}
+
+
+
+shared_view_p shared_view_get_unsafe(const char *name)
+{
+    shared_view_p view = views;
+    const shared_header_t *header = NULL;
+    int rc = PLCTAG_STATUS_OK;
+
+    while(view && (str_cmp(view->name, name) != 0 || shared_view_is_stale(view))) {
+        view = view->next;
+    }
+
+    if(view) {
+        view->num_tags++;
+        return view;
+    }
+
+    view = (shared_view_p)mem_alloc((int)sizeof(*view));
+    if(!view) {
+        pdebug(DEBUG_ERROR, "Unable to allocate shared memory view!");
+        return NULL;
+    }
+
+    view->name = str_dup(name);
+    if(!view->name) {
+        pdebug(DEBUG_ERROR, "Unable to copy the region name!");
+        mem_free(view);
+        return NULL;
+    }
+
+    rc = shm_attach(name, &view->shm);
+    if(rc != PLCTAG_STATUS_OK) {
+        mem_free(view->name);
+        mem_free(view);
+        return NULL;
+    }
+
+    header = (const shared_header_t *)shm_data(view->shm);
+
+    if(shm_size(view->shm) < (int)sizeof(shared_header_t)
+       || header->magic != SHARED_MAGIC
+       || header->version != SHARED_VERSION
+       || header->header_size != (uint32_t)sizeof(shared_header_t)
+       || header->slot_size != (uint32_t)sizeof(shared_slot_t)
+       || (int64_t)header->data_start + header->data_size > shm_size(view->shm)) {
+        pdebug(DEBUG_WARN, "Shared memory region %s is not ready or is from a different library build!", name);
+        shm_destroy(&view->shm);
+        mem_free(view->name);
+        mem_free(view);
+        return NULL;
+    }
+
+    mem_barrier();
+
+    view->header = header;
+    view->slots = (const shared_slot_t *)(header + 1);
+    view->num_tags = 1;
+    view->next = views;
+    views = view;
+
+    pdebug(DEBUG_INFO, "Attached to shared memory region %s.", name);
+
+    return view;
+}
+
+
+
+void shared_view_release_unsafe(shared_view_p view)
+{
+    shared_view_p *walker = &views;
+
+    view->num_tags--;
+
+    if(view->num_tags > 0) {
+        return;
+    }
+
+    while(*walker && *walker != view) {
+        walker = &((*walker)->next);
+    }
+
+    if(*walker) {
+        *walker = view->next;
+    }
+
+    shm_destroy(&view->shm);
+    mem_free(view->name);
+    mem_free(view);
+}
+
+
+
+int shared_view_is_stale(shared_view_p view)
+{
+    return (view->header->closed != 0);
+}
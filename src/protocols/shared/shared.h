@@ -0,0 +1,67 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#ifndef __PROTOCOL_SHARED_H__
+#define __PROTOCOL_SHARED_H__ 1
+
+#include <util/attr.h>
+#include <util/debug.h>
+#include <platform.h>
+#include <lib/tag.h>
+
+/*
+ * Shared memory publication.
+ *
+ * A tag created with shared_region=<name> copies its data into a named
+ * shared memory region each time a read finishes.  Other processes on the
+ * same machine create tags with protocol=shared&shared_region=<name>&name=<key>
+ * and read the data from the region without going to the PLC.  The key
+ * is the shared_key attribute of the publishing tag, or its name.
+ *
+ * Each slot in the region is guarded by a sequence count that is odd while
+ * the publisher changes it.  Readers copy the slot and try again if the
+ * count changed under them.
+ */
+
+extern int shared_init(void);
+extern void shared_teardown(void);
+
+/* reader tags */
+extern plc_tag_p shared_tag_create(attr attribs);
+
+/* publishing, these are called by the generic tag code. */
+extern int shared_publish_setup(plc_tag_p tag, attr attribs);
+extern void shared_publish_unsafe(plc_tag_p tag, int status);  /* tag API mutex held. */
+extern void shared_publish_release(plc_tag_p tag);             /* from the tag destructor. */
+
+#endif
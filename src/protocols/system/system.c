@@ -38,8 +38,11 @@
 #include <lib/libplctag.h>
 #include <lib/version.h>
 #include <system/tag.h>
+#include <shared/shared.h>
+#include <alias/alias.h>
 #include <lib/init.h>
 #include <util/rc.h>
+#include <util/metrics.h>
 
 
 
@@ -50,6 +53,11 @@ static int system_tag_abort(plc_tag_p tag);
 static int system_tag_read(plc_tag_p tag);
 static int system_tag_status(plc_tag_p tag);
 static int system_tag_write(plc_tag_p tag);
+static const char *stats_tag_name(const char *name);
+static int stats_read_sessions(system_tag_p tag, const char *gateway);
+static int stats_read_tickler(system_tag_p tag);
+static int64_t stats_rate(system_tag_p tag, int index, int64_t count, int64_t now_us);
+static void stats_put_fields(system_tag_p tag, const int64_t *fields, int num_fields);
 
 struct tag_vtable_t system_tag_vtable = {
     /* abort */     system_tag_abort,
@@ -61,8 +69,9 @@ struct tag_vtable_t system_tag_vtable = {
     /* data accessors */
 
     /* get_int_attrib */ NULL,
-    /* set_int_attrib */ NULL
-
+    /* set_int_attrib */ NULL,
+    /* get_member_offset */ NULL,
+    /* set_range */ NULL
 };
 
 tag_byte_order_t system_tag_byte_order = {
@@ -129,7 +138,20 @@ plc_tag_p system_tag_create(attr attribs)
 
     /* point data at the backing store. */
     tag->data = &tag->backing_data[0];
-    tag->size = (int)sizeof(tag->backing_data);
+    tag->data_inline = 1;
+    tag->size = MAX_SYSTEM_TAG_SIZE;
+
+    {
+        const char *stats_name = stats_tag_name(tag->name);
+
+        if(stats_name) {
+            if(str_cmp_i(stats_name, "tickler") == 0) {
+                tag->size = SYSTEM_STATS_TICKLER_FIELDS * 8;
+            } else if(str_cmp_i(stats_name, "sessions") == 0 || str_cmp_i_n(stats_name, "session/", 8) == 0) {
+                tag->size = SYSTEM_STATS_SESSION_FIELDS * 8;
+            }
+        }
+    }
 
     pdebug(DEBUG_INFO,"Done");
 
@@ -154,14 +176,31 @@ static void system_tag_destroy(plc_tag_p ptag)
         return;
     }
 
-    if(ptag->ext_mutex) {
-        mutex_destroy(&ptag->ext_mutex);
+    plc_tag_generic_release_locks(ptag);
+
+    if(ptag->tag_cond_wait) {
+        cond_destroy(&ptag->tag_cond_wait);
+    }
+
+    if(ptag->change_detect) {
+        mem_free(ptag->change_detect);
     }
 
-    if(ptag->api_mutex) {
-        mutex_destroy(&ptag->api_mutex);
+    if(ptag->dirty_ranges) {
+        mem_free(ptag->dirty_ranges);
     }
 
+    if(ptag->history) {
+        mem_free(ptag->history);
+    }
+
+    if(ptag->stats) {
+        mem_free(ptag->stats);
+    }
+
+    shared_publish_release(ptag);
+    alias_parent_release(ptag);
+
     if(tag->byte_order && tag->byte_order->is_allocated) {
         mem_free(tag->byte_order);
         tag->byte_order = NULL;
@@ -183,20 +222,42 @@ static int system_tag_read(plc_tag_p ptag)
 
     if(str_cmp_i(&tag->name[0],"version") == 0) {
         pdebug(DEBUG_DETAIL,"Version is %s",VERSION);
+        plc_tag_generic_data_write_begin((plc_tag_p)tag);
         str_copy((char *)(&tag->data[0]), MAX_SYSTEM_TAG_SIZE , VERSION);
         tag->data[str_length(VERSION)] = 0;
+        plc_tag_generic_data_write_end((plc_tag_p)tag);
         return PLCTAG_STATUS_OK;
     }
 
     if(str_cmp_i(&tag->name[0],"debug") == 0) {
         int debug_level = get_debug_level();
+        plc_tag_generic_data_write_begin((plc_tag_p)tag);
         tag->data[0] = (uint8_t)(debug_level & 0xFF);
         tag->data[1] = (uint8_t)((debug_level >> 8) & 0xFF);
         tag->data[2] = (uint8_t)((debug_level >> 16) & 0xFF);
         tag->data[3] = (uint8_t)((debug_level >> 24) & 0xFF);
+        plc_tag_generic_data_write_end((plc_tag_p)tag);
         return PLCTAG_STATUS_OK;
     }
 
+    {
+        const char *stats_name = stats_tag_name(tag->name);
+
+        if(stats_name) {
+            if(str_cmp_i(stats_name, "sessions") == 0) {
+                return stats_read_sessions(tag, NULL);
+            }
+
+            if(str_cmp_i_n(stats_name, "session/", 8) == 0 && str_length(stats_name + 8) > 0) {
+                return stats_read_sessions(tag, stats_name + 8);
+            }
+
+            if(str_cmp_i(stats_name, "tickler") == 0) {
+                return stats_read_tickler(tag);
+            }
+        }
+    }
+
     pdebug(DEBUG_WARN,"Unknown system tag %s", tag->name);
     return PLCTAG_ERR_UNSUPPORTED;
 }
@@ -236,3 +297,137 @@ static int system_tag_write(plc_tag_p ptag)
     return PLCTAG_ERR_NOT_IMPLEMENTED;
 }
 
+
+
+
+/*
+ * The stats tags are named stats/... with an optional leading @.  Returns
+ * the part after the stats/ or NULL if this is not a stats tag.
+ */
+const char *stats_tag_name(const char *name)
+{
+    if(name[0] == '@') {
+        name++;
+    }
+
+    if(str_cmp_i_n(name, "stats/", 6) != 0) {
+        return NULL;
+    }
+
+    return name + 6;
+}
+
+
+
+/*
+ * Sessions are the EIP sessions and the Modbus and DF1 connections.  With a
+ * gateway only the ones to that host count.  The field order is documented
+ * with the stats tags in libplctag.h.
+ */
+int stats_read_sessions(system_tag_p tag, const char *gateway)
+{
+    static const char *kinds[] = { "ab_session", "modbus_plc", "df1_plc" };
+    int64_t values[METRIC_NUM_METRICS] = {0};
+    int64_t fields[SYSTEM_STATS_SESSION_FIELDS] = {0};
+    int64_t now_us = time_us();
+    int num_sessions = 0;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    for(int i=0; i < (int)(sizeof(kinds)/sizeof(kinds[0])); i++) {
+        num_sessions += metrics_snapshot_values(kinds[i], gateway, values);
+    }
+
+    fields[0] = num_sessions;
+    fields[1] = values[METRIC_PACKETS_SENT];
+    fields[2] = values[METRIC_PACKETS_RECEIVED];
+    fields[3] = values[METRIC_BYTES_SENT];
+    fields[4] = values[METRIC_BYTES_RECEIVED];
+    fields[5] = values[METRIC_REQUESTS_SENT];
+    fields[6] = values[METRIC_IN_FLIGHT];
+    fields[7] = values[METRIC_QUEUE_DEPTH_MAX];
+    fields[8] = values[METRIC_CONNECTS];
+    fields[9] = values[METRIC_FORWARD_OPEN_FAILURES];
+    fields[10] = values[METRIC_REQUESTS_EXPIRED];
+    fields[11] = stats_rate(tag, 0, values[METRIC_PACKETS_SENT] + values[METRIC_PACKETS_RECEIVED], now_us);
+    fields[12] = stats_rate(tag, 1, values[METRIC_BYTES_SENT] + values[METRIC_BYTES_RECEIVED], now_us);
+
+    if(values[METRIC_PACKETS_SENT] > 0) {
+        fields[13] = (values[METRIC_REQUESTS_SENT] * 100) / values[METRIC_PACKETS_SENT];
+    }
+
+    if(values[METRIC_PACKET_CAPACITY_BYTES] > 0) {
+        fields[14] = (values[METRIC_PACKED_BYTES] * 100) / values[METRIC_PACKET_CAPACITY_BYTES];
+    }
+
+    tag->stats_prev_time_us = now_us;
+
+    stats_put_fields(tag, fields, SYSTEM_STATS_SESSION_FIELDS);
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+int stats_read_tickler(system_tag_p tag)
+{
+    int64_t values[METRIC_NUM_METRICS] = {0};
+    int64_t fields[SYSTEM_STATS_TICKLER_FIELDS] = {0};
+    int64_t now_us = time_us();
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    fields[0] = metrics_snapshot_values("tickler", NULL, values);
+    fields[1] = values[METRIC_LOOPS];
+    fields[2] = values[METRIC_LOOP_TIME_US];
+    fields[3] = values[METRIC_LOOP_TIME_MAX_US];
+    fields[4] = values[METRIC_QUEUE_DEPTH_MAX];
+    fields[5] = stats_rate(tag, 0, values[METRIC_LOOPS], now_us);
+
+    if(values[METRIC_LOOPS] > 0) {
+        fields[6] = values[METRIC_LOOP_TIME_US] / values[METRIC_LOOPS];
+    }
+
+    tag->stats_prev_time_us = now_us;
+
+    stats_put_fields(tag, fields, SYSTEM_STATS_TICKLER_FIELDS);
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/* per second since the previous read of the tag, zero on the first read. */
+int64_t stats_rate(system_tag_p tag, int index, int64_t count, int64_t now_us)
+{
+    int64_t rate = 0;
+
+    if(tag->stats_prev_time_us > 0 && now_us > tag->stats_prev_time_us && count >= tag->stats_prev_count[index]) {
+        rate = ((count - tag->stats_prev_count[index]) * 1000000) / (now_us - tag->stats_prev_time_us);
+    }
+
+    tag->stats_prev_count[index] = count;
+
+    return rate;
+}
+
+
+
+void stats_put_fields(system_tag_p tag, const int64_t *fields, int num_fields)
+{
+    plc_tag_generic_data_write_begin((plc_tag_p)tag);
+
+    for(int i=0; i < num_fields; i++) {
+        uint64_t val = (uint64_t)fields[i];
+
+        for(int j=0; j < 8; j++) {
+            tag->data[(i * 8) + j] = (uint8_t)((val >> (j * 8)) & 0xFF);
+        }
+    }
+
+    plc_tag_generic_data_write_end((plc_tag_p)tag);
+}
@@ -38,15 +38,24 @@
 #include <platform.h>
 #include <lib/tag.h>
 
-#define MAX_SYSTEM_TAG_NAME (20)
+#define MAX_SYSTEM_TAG_NAME (128)
 #define MAX_SYSTEM_TAG_SIZE (30)
 
+/* the stats tags are records of little endian 64-bit fields. */
+#define SYSTEM_STATS_SESSION_FIELDS (15)
+#define SYSTEM_STATS_TICKLER_FIELDS (7)
+#define SYSTEM_STATS_MAX_SIZE (SYSTEM_STATS_SESSION_FIELDS * 8)
+
 struct system_tag_t {
     /*struct plc_tag_t p_tag;*/
     TAG_BASE_STRUCT;
 
     char name[MAX_SYSTEM_TAG_NAME];
-    uint8_t backing_data[MAX_SYSTEM_TAG_SIZE];
+    uint8_t backing_data[SYSTEM_STATS_MAX_SIZE];
+
+    /* counters at the previous read of a stats tag, for the rates. */
+    int64_t stats_prev_time_us;
+    int64_t stats_prev_count[2];
 };
 
 typedef struct system_tag_t *system_tag_p;
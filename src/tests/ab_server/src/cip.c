@@ -34,6 +34,7 @@
 #include <inttypes.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include "cip.h"
 #include "eip.h"
 #include "pccc.h"
@@ -58,6 +59,7 @@ const uint8_t CIP_FORWARD_CLOSE[] = { 0x4E, 0x02, 0x20, 0x06, 0x24, 0x01 };
 const uint8_t CIP_FORWARD_OPEN[] = { 0x54, 0x02, 0x20, 0x06, 0x24, 0x01 };
 const uint8_t CIP_LIST_TAGS[] = { 0x55, 0x02, 0x20, 0x02, 0x24, 0x01 };
 const uint8_t CIP_FORWARD_OPEN_EX[] = { 0x5B, 0x02, 0x20, 0x06, 0x24, 0x01 };
+const uint8_t CIP_GET_INSTANCE_ATTRIB_LIST[] = { 0x55 };
 
 /* path to match. */
 // uint8_t LOGIX_CONN_PATH[] = { 0x03, 0x00, 0x00, 0x20, 0x02, 0x24, 0x01 };
@@ -71,6 +73,7 @@ const uint8_t CIP_FORWARD_OPEN_EX[] = { 0x5B, 0x02, 0x20, 0x06, 0x24, 0x01 };
 
 #define CIP_OK                  ((uint8_t)0x00)
 #define CIP_ERR_0x01            ((uint8_t)0x01)
+#define CIP_ERR_NO_RESOURCE     ((uint8_t)0x02)
 #define CIP_ERR_FRAG            ((uint8_t)0x06)
 #define CIP_ERR_UNSUPPORTED     ((uint8_t)0x08)
 #define CIP_ERR_EXTENDED        ((uint8_t)0xff)
@@ -83,20 +86,20 @@ typedef struct {
     slice_s path;           /* store this in a slice to avoid copying */
 } cip_header_s;
 
+static slice_s handle_multi_request(slice_s input, slice_s output, plc_s *plc);
 static slice_s handle_forward_open(slice_s input, slice_s output, plc_s *plc);
 static slice_s handle_forward_close(slice_s input, slice_s output, plc_s *plc);
 static slice_s handle_read_request(slice_s input, slice_s output, plc_s *plc);
 static slice_s handle_write_request(slice_s input, slice_s output, plc_s *plc);
+static slice_s handle_list_tags(slice_s input, slice_s output, plc_s *plc);
 
 static bool process_tag_segment(plc_s *plc, slice_s input, tag_def_s **tag, size_t *start_read_offset);
+static void fetch_multi_request_tags(slice_s requests, size_t count_offset, uint16_t num_requests, plc_s *plc);
 static slice_s make_cip_error(slice_s output, uint8_t cip_cmd, uint8_t cip_err, bool extend, uint16_t extended_error);
 static bool match_path(slice_s input, bool need_pad, uint8_t *path, uint8_t path_len);
 
 slice_s cip_dispatch_request(slice_s input, slice_s output, plc_s *plc)
 {
-    info("Got packet:");
-    slice_dump(input);
-
     /* match the prefix and dispatch. */
     if(slice_match_bytes(input, CIP_READ, sizeof(CIP_READ))) {
         return handle_read_request(input, output, plc);
@@ -106,6 +109,8 @@ slice_s cip_dispatch_request(slice_s input, slice_s output, plc_s *plc)
         return handle_write_request(input, output, plc);
     } else if(slice_match_bytes(input, CIP_WRITE_FRAG, sizeof(CIP_WRITE_FRAG))) {
         return handle_write_request(input, output, plc);
+    } else if(slice_match_bytes(input, CIP_MULTI, sizeof(CIP_MULTI))) {
+        return handle_multi_request(input, output, plc);
     } else if(slice_match_bytes(input, CIP_FORWARD_OPEN, sizeof(CIP_FORWARD_OPEN))) {
         return handle_forward_open(input, output, plc);
     } else if(slice_match_bytes(input, CIP_FORWARD_OPEN_EX, sizeof(CIP_FORWARD_OPEN_EX))) {
@@ -114,8 +119,182 @@ slice_s cip_dispatch_request(slice_s input, slice_s output, plc_s *plc)
         return handle_forward_close(input, output, plc);
     } else if(slice_match_bytes(input, CIP_PCCC_EXECUTE, sizeof(CIP_PCCC_EXECUTE))) {
         return dispatch_pccc_request(input, output, plc);
+    } else if(slice_match_bytes(input, CIP_GET_INSTANCE_ATTRIB_LIST, sizeof(CIP_GET_INSTANCE_ATTRIB_LIST))) {
+        return handle_list_tags(input, output, plc);
     } else {
-            return make_cip_error(output, (uint8_t)(slice_get_uint8(input, 0) | (uint8_t)CIP_DONE), (uint8_t)CIP_ERR_UNSUPPORTED, false, (uint16_t)0);
+        info("Unsupported packet:");
+        slice_dump(input);
+
+        return make_cip_error(output, (uint8_t)(slice_get_uint8(input, 0) | (uint8_t)CIP_DONE), (uint8_t)CIP_ERR_UNSUPPORTED, false, (uint16_t)0);
+    }
+}
+
+
+
+/*
+ * A Multiple Service Packet holds several requests.  After the service
+ * and path comes a count, then the offset of each request from the count,
+ * then the requests.  The response has the same layout.  Each request is
+ * handled as if it came on its own.
+ *
+ * The responses are written over the buffer the requests are in, so the
+ * requests are copied out first.
+ */
+
+#define CIP_MULTI_MAX_SIZE (4200)
+#define CIP_MULTI_RESPONSE_RESERVE (16)
+#define CIP_ERR_EMBEDDED ((uint8_t)0x1E)
+
+slice_s handle_multi_request(slice_s input, slice_s output, plc_s *plc)
+{
+    uint8_t request_data[CIP_MULTI_MAX_SIZE];
+    slice_s requests;
+    size_t count_offset = sizeof(CIP_MULTI);
+    size_t resp_count_offset = 4;
+    uint16_t num_requests = 0;
+    size_t resp_offset = 0;
+    uint8_t general_status = CIP_OK;
+
+    if(slice_len(input) < count_offset + 2 || slice_len(input) > sizeof(request_data)) {
+        info("Multiple service request is an unusable size, %zu bytes!", slice_len(input));
+        return make_cip_error(output, CIP_MULTI[0] | CIP_DONE, CIP_ERR_UNSUPPORTED, false, 0);
+    }
+
+    memcpy(request_data, input.data, slice_len(input));
+    requests = slice_make(request_data, input.len);
+
+    num_requests = slice_get_uint16_le(requests, count_offset);
+
+    if(num_requests == 0 || count_offset + 2 + ((size_t)num_requests * 2) > slice_len(requests)) {
+        info("Multiple service request has a bad request count, %d!", num_requests);
+        return make_cip_error(output, CIP_MULTI[0] | CIP_DONE, CIP_ERR_UNSUPPORTED, false, 0);
+    }
+
+    /* the response header, count and offsets. */
+    resp_offset = resp_count_offset + 2 + ((size_t)num_requests * 2);
+
+    if(plc->tag_fetch) {
+        fetch_multi_request_tags(requests, count_offset, num_requests, plc);
+    }
+
+    if(resp_offset > slice_len(output)) {
+        return make_cip_error(output, CIP_MULTI[0] | CIP_DONE, CIP_ERR_EXTENDED, true, CIP_ERR_EX_TOO_LONG);
+    }
+
+    for(uint16_t i=0; i < num_requests; i++) {
+        size_t start = count_offset + slice_get_uint16_le(requests, count_offset + 2 + ((size_t)i * 2));
+        size_t end = (i + 1 < num_requests ? count_offset + slice_get_uint16_le(requests, count_offset + 2 + ((size_t)(i + 1) * 2)) : slice_len(requests));
+        slice_s sub_request;
+        slice_s sub_response;
+        size_t reserve = (size_t)(num_requests - i - 1) * CIP_MULTI_RESPONSE_RESERVE;
+        size_t space = 0;
+
+        if(start >= end || end > slice_len(requests)) {
+            info("Multiple service request %d has bad bounds %zu to %zu!", i, start, end);
+            return make_cip_error(output, CIP_MULTI[0] | CIP_DONE, CIP_ERR_UNSUPPORTED, false, 0);
+        }
+
+        sub_request = slice_from_slice(requests, start, end - start);
+
+        /*
+         * leave some room for the responses still to come.   Otherwise one
+         * large read fills the packet and the rest are cut off.
+         */
+        space = slice_len(output) - resp_offset;
+        if(space > reserve + CIP_MULTI_RESPONSE_RESERVE) {
+            space -= reserve;
+        }
+
+        /* no nesting. */
+        if(slice_get_uint8(sub_request, 0) == CIP_MULTI[0]) {
+            sub_response = make_cip_error(slice_from_slice(output, resp_offset, space), CIP_MULTI[0] | CIP_DONE, CIP_ERR_UNSUPPORTED, false, 0);
+        } else {
+            sub_response = cip_dispatch_request(sub_request, slice_from_slice(output, resp_offset, space), plc);
+        }
+
+        if(slice_has_err(sub_response)) {
+            info("Unable to process request %d in multiple service request!", i);
+            plc->tags_fetched = false;
+            return sub_response;
+        }
+
+        /* any failed request marks the whole response. */
+        if(slice_len(sub_response) >= 3 && slice_get_uint8(sub_response, 2) != CIP_OK) {
+            general_status = CIP_ERR_EMBEDDED;
+        }
+
+        slice_set_uint16_le(output, resp_count_offset + 2 + ((size_t)i * 2), (uint16_t)(resp_offset - resp_count_offset));
+
+        resp_offset += slice_len(sub_response);
+    }
+
+    plc->tags_fetched = false;
+
+    slice_set_uint8(output, 0, CIP_MULTI[0] | CIP_DONE);
+    slice_set_uint8(output, 1, 0); /* padding/reserved. */
+    slice_set_uint8(output, 2, general_status);
+    slice_set_uint8(output, 3, 0); /* no extra error fields. */
+    slice_set_uint16_le(output, resp_count_offset, num_requests);
+
+    return slice_from_slice(output, 0, resp_offset);
+}
+
+
+/*
+ * Fetch the tags of all the reads in a Multiple Service Packet at once, so
+ * that the hook can get them together.  Requests that do not parse are
+ * skipped here, they get their errors when they are handled.  If the fetch
+ * fails, each read tries again on its own.
+ */
+
+#define CIP_MULTI_MAX_FETCH (200)
+
+void fetch_multi_request_tags(slice_s requests, size_t count_offset, uint16_t num_requests, plc_s *plc)
+{
+    tag_def_s *tags[CIP_MULTI_MAX_FETCH];
+    size_t num_tags = 0;
+
+    for(uint16_t i=0; i < num_requests && num_tags < CIP_MULTI_MAX_FETCH; i++) {
+        size_t start = count_offset + slice_get_uint16_le(requests, count_offset + 2 + ((size_t)i * 2));
+        size_t end = (i + 1 < num_requests ? count_offset + slice_get_uint16_le(requests, count_offset + 2 + ((size_t)(i + 1) * 2)) : slice_len(requests));
+        slice_s sub_request;
+        uint8_t cmd = 0;
+        size_t segment_size = 0;
+        tag_def_s *tag = NULL;
+        size_t start_offset = 0;
+        bool found = false;
+
+        if(start + 2 > end || end > slice_len(requests)) {
+            continue;
+        }
+
+        sub_request = slice_from_slice(requests, start, end - start);
+        cmd = slice_get_uint8(sub_request, 0);
+        segment_size = (size_t)slice_get_uint8(sub_request, 1) * 2;
+
+        if((cmd != CIP_READ[0] && cmd != CIP_READ_FRAG[0]) || 2 + segment_size > slice_len(sub_request)) {
+            continue;
+        }
+
+        if(!process_tag_segment(plc, slice_from_slice(sub_request, 2, segment_size), &tag, &start_offset)) {
+            continue;
+        }
+
+        for(size_t j=0; j < num_tags; j++) {
+            if(tags[j] == tag) {
+                found = true;
+                break;
+            }
+        }
+
+        if(!found) {
+            tags[num_tags] = tag;
+            num_tags++;
+        }
+    }
+
+    if(num_tags > 0 && plc->tag_fetch(plc->hook_context, tags, num_tags) == 0) {
+        plc->tags_fetched = true;
     }
 }
 
@@ -149,6 +328,7 @@ slice_s handle_forward_open(slice_s input, slice_s output, plc_s *plc)
     size_t offset = 0;
     uint8_t fo_cmd = slice_get_uint8(input, 0);
     forward_open_s fo_req = {0};
+    int conn_index = 0;
 
     info("Checking Forward Open request:");
     slice_dump(input);
@@ -227,6 +407,22 @@ slice_s handle_forward_open(slice_s input, slice_s output, plc_s *plc)
     plc->server_connection_id = (uint32_t)rand();
     plc->server_connection_seq = (uint16_t)rand();
 
+    /* a reopened connection replaces the old one, otherwise the oldest goes when the table is full. */
+    while(conn_index < plc->num_connections && plc->connections[conn_index].serial_number != fo_req.conn_serial_number) {
+        conn_index++;
+    }
+
+    if(conn_index == PLC_MAX_CONNECTIONS) {
+        memmove(&plc->connections[0], &plc->connections[1], sizeof(plc->connections[0]) * (PLC_MAX_CONNECTIONS - 1));
+        conn_index = PLC_MAX_CONNECTIONS - 1;
+    } else if(conn_index == plc->num_connections) {
+        plc->num_connections++;
+    }
+
+    plc->connections[conn_index].server_id = plc->server_connection_id;
+    plc->connections[conn_index].client_id = plc->client_connection_id;
+    plc->connections[conn_index].serial_number = plc->client_connection_serial_number;
+
     /* store the allowed packet sizes. */
     plc->client_to_server_max_packet = fo_req.client_to_server_conn_params &
                                ((fo_cmd == CIP_FORWARD_OPEN[0]) ? 0x1FF : 0x0FFF);
@@ -277,6 +473,7 @@ slice_s handle_forward_close(slice_s input, slice_s output, plc_s *plc)
     slice_s conn_path;
     size_t offset = 0;
     forward_close_s fc_req = {0};
+    int conn_index = 0;
 
     info("Checking Forward Close request:");
     slice_dump(input);
@@ -317,9 +514,15 @@ slice_s handle_forward_close(slice_s input, slice_s output, plc_s *plc)
     }
 
     /* Check the values we got. */
-    if(plc->client_connection_serial_number != fc_req.client_connection_serial_number) {
+    for(conn_index = 0; conn_index < plc->num_connections; conn_index++) {
+        if(plc->connections[conn_index].serial_number == fc_req.client_connection_serial_number) {
+            break;
+        }
+    }
+
+    if(conn_index == plc->num_connections) {
         /* FIXME - send back the right error. */
-        info("Forward close connection serial number, %x, did not match the connection serial number originally passed, %x!", fc_req.client_connection_serial_number, plc->client_connection_serial_number);
+        info("Forward close connection serial number, %x, did not match the serial number of any open connection!", fc_req.client_connection_serial_number);
         return make_cip_error(output, slice_get_uint8(input, 0) | CIP_DONE, CIP_ERR_UNSUPPORTED, false, 0);
     }
     if(plc->client_vendor_id != fc_req.client_vendor_id) {
@@ -340,10 +543,14 @@ slice_s handle_forward_close(slice_s input, slice_s output, plc_s *plc)
     slice_set_uint8(output, offset, 0); offset++; /* no error. */
     slice_set_uint8(output, offset, 0); offset++; /* no extra error fields. */
 
-    slice_set_uint16_le(output, offset, plc->client_connection_serial_number); offset += 2;
+    slice_set_uint16_le(output, offset, fc_req.client_connection_serial_number); offset += 2;
     slice_set_uint16_le(output, offset, plc->client_vendor_id); offset += 2;
     slice_set_uint32_le(output, offset, plc->client_serial_number); offset += 4;
 
+    /* the connection is gone. */
+    plc->num_connections--;
+    memmove(&plc->connections[conn_index], &plc->connections[conn_index + 1], sizeof(plc->connections[0]) * (size_t)(plc->num_connections - conn_index));
+
     /* not sure what these do... */
     slice_set_uint8(output, offset, 0); offset++;
     slice_set_uint8(output, offset, 0); offset++;
@@ -448,7 +655,14 @@ slice_s handle_read_request(slice_s input, slice_s output, plc_s *plc)
 
     /* do we need to fragment the result? */
     remaining_size = total_request_size - byte_offset;
-    packet_capacity = slice_len(output) - 6; /* MAGIC - CIP header plus data type bytes is 6 bytes. */
+
+    /* MAGIC - CIP header plus data type bytes is 6 bytes, and at least a little data. */
+    if(slice_len(output) < 6 + 4) {
+        info("No room in the response for any data!");
+        return make_cip_error(output, read_cmd | CIP_DONE, CIP_ERR_EXTENDED, true, CIP_ERR_EX_TOO_LONG);
+    }
+
+    packet_capacity = slice_len(output) - 6;
 
     info("packet_capacity = %d", packet_capacity);
 
@@ -460,6 +674,14 @@ slice_s handle_read_request(slice_s input, slice_s output, plc_s *plc)
 
     info("need_frag = %s", need_frag ? "true" : "false");
 
+    /* later fragments use the data the first one got. */
+    if(plc->tag_fetch && !plc->tags_fetched && byte_offset == 0) {
+        if(plc->tag_fetch(plc->hook_context, &tag, 1) != 0) {
+            info("Unable to fetch the data for tag %s!", tag->name);
+            return make_cip_error(output, read_cmd | CIP_DONE, CIP_ERR_NO_RESOURCE, false, 0);
+        }
+    }
+
     /* start making the response. */
     offset = 0;
     slice_set_uint8(output, offset, read_cmd | CIP_DONE); offset++;
@@ -483,7 +705,7 @@ slice_s handle_read_request(slice_s input, slice_s output, plc_s *plc)
 
     /* FIXME - use memcpy */
     for(size_t i=0; i < amount_to_copy; i++) {
-        slice_set_uint8(output, offset + i, tag->data[byte_offset + i]);
+        slice_set_uint8(output, offset + i, tag->data[read_start_offset + byte_offset + i]);
     }
 
     offset += amount_to_copy;
@@ -494,6 +716,97 @@ slice_s handle_read_request(slice_s input, slice_s output, plc_s *plc)
 
 
 
+/*
+ * Tag listing, Get Instance Attribute List on the symbol class.  The
+ * symbol instance ID of a tag is its position in the tag list plus one.
+ * There are no program tags, so program listings come back empty.  Each
+ * entry is the instance ID, symbol type, element size, three dimensions
+ * and the name.
+ */
+
+#define CIP_SYMBOL_CLASS ((uint8_t)0x6B)
+#define CIP_LIST_ENTRY_SIZE (22)
+
+slice_s handle_list_tags(slice_s input, slice_s output, plc_s *plc)
+{
+    uint8_t cmd = slice_get_uint8(input, 0);
+    size_t path_size = (size_t)slice_get_uint8(input, 1) * 2;
+    slice_s path = slice_from_slice(input, 2, path_size);
+    uint32_t start_id = 0;
+    uint32_t id = 0;
+    size_t offset = 0;
+    bool need_frag = false;
+
+    if(slice_len(path) != path_size || path_size < 4) {
+        info("Tag listing request path is too short!");
+        return make_cip_error(output, cmd | CIP_DONE, CIP_ERR_UNSUPPORTED, false, 0);
+    }
+
+    if(slice_get_uint8(path, 0) == CIP_SYMBOLIC_SEGMENT_MARKER) {
+        info("No program tags to list.");
+        return make_cip_error(output, cmd | CIP_DONE, CIP_OK, false, 0);
+    }
+
+    if(slice_get_uint8(path, 0) != 0x20 || slice_get_uint8(path, 1) != CIP_SYMBOL_CLASS) {
+        info("Tag listing request is not for the symbol class!");
+        return make_cip_error(output, cmd | CIP_DONE, CIP_ERR_UNSUPPORTED, false, 0);
+    }
+
+    if(slice_get_uint8(path, 2) == 0x25 && path_size >= 6) {
+        start_id = slice_get_uint16_le(path, 4);
+    } else if(slice_get_uint8(path, 2) == 0x24) {
+        start_id = slice_get_uint8(path, 3);
+    } else {
+        info("Unsupported tag listing instance segment!");
+        return make_cip_error(output, cmd | CIP_DONE, CIP_ERR_UNSUPPORTED, false, 0);
+    }
+
+    /* the response goes over the request. */
+    slice_set_uint8(output, offset, cmd | CIP_DONE); offset++;
+    slice_set_uint8(output, offset, 0); offset++;
+    slice_set_uint8(output, offset, CIP_OK); offset++;
+    slice_set_uint8(output, offset, 0); offset++;
+
+    for(tag_def_s *tag = plc->tags; tag; tag = tag->next_tag) {
+        size_t name_len = strlen(tag->name);
+        size_t entry_size = CIP_LIST_ENTRY_SIZE + name_len;
+
+        id++;
+
+        if(id < start_id) {
+            continue;
+        }
+
+        if(offset + entry_size > slice_len(output)) {
+            need_frag = true;
+            break;
+        }
+
+        slice_set_uint32_le(output, offset, id); offset += 4;
+        slice_set_uint16_le(output, offset, (uint16_t)(tag->tag_type | (uint16_t)(tag->num_dimensions << 13))); offset += 2;
+        slice_set_uint16_le(output, offset, (uint16_t)tag->elem_size); offset += 2;
+
+        for(size_t i=0; i < 3; i++) {
+            slice_set_uint32_le(output, offset, (uint32_t)(i < tag->num_dimensions ? tag->dimensions[i] : 0)); offset += 4;
+        }
+
+        slice_set_uint16_le(output, offset, (uint16_t)name_len); offset += 2;
+
+        for(size_t i=0; i < name_len; i++) {
+            slice_set_uint8(output, offset, (uint8_t)tag->name[i]); offset++;
+        }
+    }
+
+    if(need_frag) {
+        slice_set_uint8(output, 2, CIP_ERR_FRAG);
+    }
+
+    return slice_from_slice(output, 0, offset);
+}
+
+
+
+
 #define CIP_WRITE_MIN_SIZE (6)
 #define CIP_WRITE_FRAG_MIN_SIZE (10)
 
@@ -567,7 +880,7 @@ slice_s handle_write_request(slice_s input, slice_s output, plc_s *plc)
     info("total_request_size = %d", total_request_size);
 
     /* check the amount */
-    if(byte_offset + total_request_size > tag_data_length) {
+    if(write_start_offset + byte_offset + total_request_size > tag_data_length) {
         info("request tries to write too much data!");
         return make_cip_error(output, write_cmd | CIP_DONE, CIP_ERR_EXTENDED, true, CIP_ERR_EX_TOO_LONG);
     }
@@ -576,7 +889,12 @@ slice_s handle_write_request(slice_s input, slice_s output, plc_s *plc)
     info("byte_offset = %d", byte_offset);
     info("offset = %d", offset);
     info("total_request_size = %d", total_request_size);
-    memcpy(&tag->data[byte_offset], slice_get_bytes(input, offset), total_request_size);
+    memcpy(&tag->data[write_start_offset + byte_offset], slice_get_bytes(input, offset), total_request_size);
+
+    if(plc->tag_store && plc->tag_store(plc->hook_context, tag, write_start_offset + byte_offset, total_request_size) != 0) {
+        info("Unable to store the data for tag %s!", tag->name);
+        return make_cip_error(output, write_cmd | CIP_DONE, CIP_ERR_NO_RESOURCE, false, 0);
+    }
 
     /* start making the response. */
     offset = 0;
@@ -153,6 +153,7 @@ slice_s handle_cpf_connected(slice_s input, slice_s output, plc_s *plc)
 {
     slice_s result;
     cpf_co_header_s header;
+    int conn_index = 0;
 
     /* we must have some sort of payload. */
     if(slice_len(input) <= CPF_UCONN_HEADER_SIZE) {
@@ -189,8 +190,14 @@ slice_s handle_cpf_connected(slice_s input, slice_s output, plc_s *plc)
         return slice_make_err(EIP_ERR_BAD_REQUEST);
     }
 
-    if(header.conn_id != plc->server_connection_id) {
-        info("Expected connection ID %x but found connection ID %x!", plc->server_connection_id, header.conn_id);
+    for(conn_index = 0; conn_index < plc->num_connections; conn_index++) {
+        if(plc->connections[conn_index].server_id == header.conn_id) {
+            break;
+        }
+    }
+
+    if(conn_index == plc->num_connections) {
+        info("Connection ID %x does not match any open connection!", header.conn_id);
         return slice_make_err(EIP_ERR_BAD_REQUEST);
     }
 
@@ -214,13 +221,15 @@ slice_s handle_cpf_connected(slice_s input, slice_s output, plc_s *plc)
 
     if(!slice_has_err(result)) {
         /* build outbound header. */
-        slice_set_uint16_le(output, 0, 2); /* two items. */
-        slice_set_uint16_le(output, 2, CPF_ITEM_CAI); /* connected address type. */
-        slice_set_uint16_le(output, 4, 4); /* connection ID is 4 bytes. */
-        slice_set_uint32_le(output, 6, plc->client_connection_id);
-        slice_set_uint16_le(output, 10, CPF_ITEM_CDI); /* connected data type */
-        slice_set_uint16_le(output, 12, (uint16_t)(slice_len(result) + 2)); /* result from CIP processing downstream.  Plus 2 bytes for sequence number. */
-        slice_set_uint16_le(output, 14, plc->client_connection_seq);
+        slice_set_uint32_le(output, 0, header.interface_handle);
+        slice_set_uint16_le(output, 4, header.router_timeout);
+        slice_set_uint16_le(output, 6, 2); /* two items. */
+        slice_set_uint16_le(output, 8, CPF_ITEM_CAI); /* connected address type. */
+        slice_set_uint16_le(output, 10, 4); /* connection ID is 4 bytes. */
+        slice_set_uint32_le(output, 12, plc->connections[conn_index].client_id);
+        slice_set_uint16_le(output, 16, CPF_ITEM_CDI); /* connected data type */
+        slice_set_uint16_le(output, 18, (uint16_t)(slice_len(result) + 2)); /* result from CIP processing downstream.  Plus 2 bytes for sequence number. */
+        slice_set_uint16_le(output, 20, header.conn_seq); /* the response carries the sequence number of the request. */
 
         /* create a new slice with the CPF header and the response packet in it. */
         result = slice_from_slice(output, (size_t)0, (size_t)(slice_len(result) + CPF_CONN_HEADER_SIZE));
@@ -38,6 +38,7 @@
 #include "tcp_server.h"
 #include "utils.h"
 
+#define EIP_NOP                  ((uint16_t)0x0000)
 #define EIP_REGISTER_SESSION     ((uint16_t)0x0065)
    #define EIP_REGISTER_SESSION_SIZE (4) /* 4 bytes, 2 16-bit words */
 
@@ -90,6 +91,10 @@ slice_s eip_dispatch_request(slice_s input, slice_s raw_output, plc_s *plc)
 
     /* dispatch the request */
     switch(header.command) {
+        case EIP_NOP:
+            /* keeps the connection alive, there is no reply. */
+            return slice_make_err(TCP_SERVER_PROCESSED);
+
         case EIP_REGISTER_SESSION:
             response = register_session(slice_from_slice(input, EIP_HEADER_SIZE, EIP_REGISTER_SESSION_SIZE), response, plc, &header);
             break;
@@ -121,7 +126,7 @@ slice_s eip_dispatch_request(slice_s input, slice_s raw_output, plc_s *plc)
         slice_set_uint16_le(output, 2, (uint16_t)slice_len(response));
         slice_set_uint32_le(output, 4, plc->session_handle);
         slice_set_uint32_le(output, 8, (uint32_t)0); /* status == 0 -> no error */
-        slice_set_uin64_le(output, 12, plc->sender_context);
+        slice_set_uin64_le(output, 12, header.sender_context);
         slice_set_uint32_le(output, 20, header.options);
 
         /* The payload is already in place. */
@@ -137,7 +142,7 @@ slice_s eip_dispatch_request(slice_s input, slice_s raw_output, plc_s *plc)
         slice_set_uint16_le(output, 2, (uint16_t)0);  /* no payload. */
         slice_set_uint32_le(output, 4, plc->session_handle);
         slice_set_uint32_le(output, 8, (uint32_t)(int32_t)slice_get_err(response)); /* status */
-        slice_set_uin64_le(output, 12, plc->sender_context);
+        slice_set_uin64_le(output, 12, header.sender_context);
         slice_set_uint32_le(output, 20, header.options);
 
         return slice_from_slice(output, 0, EIP_HEADER_SIZE);
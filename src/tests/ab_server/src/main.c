@@ -55,7 +55,7 @@
 #include "utils.h"
 
 static void usage(void);
-static void process_args(int argc, const char **argv, plc_s *plc);
+static void process_args(int argc, const char **argv, plc_s *plc, tcp_server_emulation_s *emu);
 static void parse_path(const char *path, plc_s *plc);
 static void parse_pccc_tag(const char *tag, plc_s *plc);
 static void parse_cip_tag(const char *tag, plc_s *plc);
@@ -149,6 +149,7 @@ int main(int argc, const char **argv)
     uint8_t buf[4200];  /* CIP only allows 4002 for the CIP request, but there is overhead. */
     slice_s server_buf = slice_make(buf, sizeof(buf));
     plc_s plc;
+    tcp_server_emulation_s emu;
 
     /* set up handler for ^C etc. */
     setup_break_handler();
@@ -157,14 +158,17 @@ int main(int argc, const char **argv)
 
     /* clear out context to make sure we do not get gremlins */
     memset(&plc, 0, sizeof(plc));
+    memset(&emu, 0, sizeof(emu));
 
     /* set the random seed. */
     srand((unsigned int)time(NULL));
 
-    process_args(argc, argv, &plc);
+    process_args(argc, argv, &plc, &emu);
 
     /* open a server connection and listen on the right port. */
-    server = tcp_server_create("0.0.0.0", "44818", server_buf, request_handler, &plc);
+    server = tcp_server_create("0.0.0.0", "44818", server_buf, request_handler, &plc, sizeof(plc));
+
+    tcp_server_set_emulation(server, &emu);
 
     tcp_server_start(server, &done);
 
@@ -203,13 +207,15 @@ void usage(void)
                     "\n"
                     "        <sizes>> field is one or more (up to 3) numbers separated by commas.\n"
                     "\n"
+                    TCP_SERVER_EMULATION_USAGE
+                    "\n"
                     "Example: ab_server --plc=ControlLogix --path=1,0 --tag=MyTag:DINT[10,10]\n");
 
     exit(1);
 }
 
 
-void process_args(int argc, const char **argv, plc_s *plc)
+void process_args(int argc, const char **argv, plc_s *plc, tcp_server_emulation_s *emu)
 {
     bool has_path = false;
     bool needs_path = false;
@@ -366,6 +372,11 @@ void process_args(int argc, const char **argv, plc_s *plc)
                 plc->reject_fo_count = atoi(&argv[i][12]);
             }
         }
+
+        /* load emulation. */
+        if(tcp_server_parse_emulation_arg(argv[i], emu) < 0) {
+            usage();
+        }
     }
 
     if(needs_path && !has_path) {
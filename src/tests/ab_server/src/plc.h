@@ -33,6 +33,7 @@
 
 #pragma once
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
@@ -68,6 +69,7 @@ struct tag_def_s {
     size_t num_dimensions;
     size_t dimensions[3];
     uint8_t *data;
+    void *hook_data;    /* for the tag hooks below. */
 };
 
 typedef struct tag_def_s tag_def_s;
@@ -81,6 +83,15 @@ typedef enum {
     PLC_MICROLOGIX
 } plc_type_t;
 
+/* a client can open several CIP connections over one TCP connection. */
+#define PLC_MAX_CONNECTIONS (8)
+
+typedef struct {
+    uint32_t server_id;
+    uint32_t client_id;
+    uint16_t serial_number;
+} plc_connection_s;
+
 /* Define the context that is passed around. */
 typedef struct {
     plc_type_t plc_type;
@@ -103,6 +114,10 @@ typedef struct {
     uint32_t client_to_server_max_packet;
     uint32_t server_to_client_max_packet;
 
+    /* all the open connections, the fields above are for the last one opened. */
+    plc_connection_s connections[PLC_MAX_CONNECTIONS];
+    int num_connections;
+
     /* PCCC info */
     uint16_t pccc_seq_id;
 
@@ -111,5 +126,16 @@ typedef struct {
 
     /* list of tags served by this "PLC" */
     struct tag_def_s *tags;
+
+    /*
+     * Optional hooks for tags whose data lives somewhere else, as in the
+     * proxy.  tag_fetch brings the data of the tags up to date before they
+     * are read.  tag_store is called after part of a tag was written.  Both
+     * return zero on success.
+     */
+    int (*tag_fetch)(void *hook_context, tag_def_s **tags, size_t num_tags);
+    int (*tag_store)(void *hook_context, tag_def_s *tag, size_t offset, size_t length);
+    void *hook_context;
+    bool tags_fetched;  /* set while a Multiple Service Packet is handled. */
 } plc_s;
 
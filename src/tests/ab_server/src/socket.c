@@ -41,6 +41,7 @@
     #include <errno.h>
     #include <netdb.h>
     #include <netinet/in.h>
+    #include <netinet/tcp.h>
     #include <sys/socket.h>
     #include <sys/time.h>
     #include <sys/types.h>
@@ -65,7 +66,7 @@
 
 #define LISTEN_QUEUE (10)
 
-int socket_open(const char *host, const char *port)
+int server_socket_open(const char *host, const char *port)
 {
 	//int status;
 	struct addrinfo addr_hints;
@@ -137,7 +138,7 @@ int socket_open(const char *host, const char *port)
 
     /* if this is going to be a server socket, bind it. */
     if(strcmp(host,"0.0.0.0") == 0) {
-        info("socket_open() setting up server socket.   Binding to address 0.0.0.0.");
+        info("server_socket_open() setting up server socket.   Binding to address 0.0.0.0.");
 
         rc = bind(sock, addr_info->ai_addr, (socklen_t)(unsigned int)addr_info->ai_addrlen);
         if (rc < 0)	{
@@ -155,7 +156,7 @@ int socket_open(const char *host, const char *port)
         sock_opt = 1;
         rc = setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (char*)&sock_opt, sizeof(sock_opt));
         if(rc) {
-            socket_close(sock);
+            server_socket_close(sock);
             info("ERROR: Setting SO_REUSEADDR on socket failed: %s\n", gai_strerror(rc));
             return SOCKET_ERR_SETOPT;
         }
@@ -167,7 +168,7 @@ int socket_open(const char *host, const char *port)
         /* On *BSD and macOS, set the socket option to prevent SIGPIPE. */
         rc = setsockopt(sock, SOL_SOCKET, SO_NOSIGPIPE, (char*)&sock_opt, sizeof(sock_opt));
         if(rc) {
-            socket_close(sock);
+            server_socket_close(sock);
             info ("ERROR: Setting SO_REUSEADDR on socket failed: %s\n", gai_strerror(rc));
             return SOCKET_ERR_SETOPT;
         }
@@ -178,14 +179,14 @@ int socket_open(const char *host, const char *port)
 
         rc = setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, (char*)&timeout, sizeof(timeout));
         if(rc) {
-            socket_close(sock);
+            server_socket_close(sock);
             info("ERROR: Setting SO_RCVTIMEO on socket failed: %s\n", gai_strerror(rc));
             return SOCKET_ERR_SETOPT;
         }
 
         rc = setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, (char*)&timeout, sizeof(timeout));
         if(rc) {
-            socket_close(sock);
+            server_socket_close(sock);
             info("ERROR: Setting SO_SNDTIMEO on socket failed: %s\n", gai_strerror(rc));
             return SOCKET_ERR_SETOPT;
         }
@@ -196,7 +197,7 @@ int socket_open(const char *host, const char *port)
 
         rc = setsockopt(sock, SOL_SOCKET, SO_LINGER,(char*)&so_linger,sizeof(so_linger));
         if(rc) {
-            socket_close(sock);
+            server_socket_close(sock);
             info("ERROR: Setting SO_LINGER on socket failed: %s\n", gai_strerror(rc));
             return SOCKET_ERR_SETOPT;
         }
@@ -210,7 +211,7 @@ int socket_open(const char *host, const char *port)
 
 
 
-void socket_close(int sock)
+void server_socket_close(int sock)
 {
     if(sock >= 0) {
 #ifdef IS_WINDOWS
@@ -222,7 +223,27 @@ void socket_close(int sock)
 }
 
 
-int socket_accept(int sock)
+/* close with a reset instead of the normal shutdown. */
+void server_socket_reset(int sock)
+{
+    struct linger so_linger;
+
+    if(sock < 0) {
+        return;
+    }
+
+    so_linger.l_onoff = 1;
+    so_linger.l_linger = 0;
+
+    if(setsockopt(sock, SOL_SOCKET, SO_LINGER, (char*)&so_linger, sizeof(so_linger))) {
+        info("WARN: Setting SO_LINGER on socket failed!");
+    }
+
+    server_socket_close(sock);
+}
+
+
+int server_socket_accept(int sock)
 {
     fd_set accept_fd_set;
     TIMEVAL timeout; 
@@ -243,7 +264,15 @@ int socket_accept(int sock)
     if (num_accept_ready > 0) {
         info("Ready to accept on %d sockets.", num_accept_ready);
         if (FD_ISSET(sock, &accept_fd_set)) {
-            return (int)accept(sock, NULL, NULL);
+            int client_sock = (int)accept(sock, NULL, NULL);
+            int sock_opt = 1;
+
+            /* responses to pipelined requests must not wait on delayed ACKs. */
+            if(client_sock >= 0 && setsockopt(client_sock, IPPROTO_TCP, TCP_NODELAY, (char*)&sock_opt, sizeof(sock_opt))) {
+                info("WARN: Setting TCP_NODELAY on client socket failed!");
+            }
+
+            return client_sock;
         }
     } else if (num_accept_ready < 0) {
         info("Error selecting the listen socket!");
@@ -254,7 +283,7 @@ int socket_accept(int sock)
 }
 
 
-slice_s socket_read(int sock, slice_s in_buf)
+slice_s server_socket_read(int sock, slice_s in_buf)
 {
 #ifdef IS_WINDOWS
     int rc = (int)recv(sock, (char *)in_buf.data, (int)in_buf.len, 0);
@@ -282,13 +311,13 @@ slice_s socket_read(int sock, slice_s in_buf)
 
 
 /* this blocks until all the data is written or there is an error. */
-int socket_write(int sock, slice_s out_buf)
+int server_socket_write(int sock, slice_s out_buf)
 {
     size_t total_bytes_written = 0;
     int rc = 0;
     slice_s tmp_out_buf = out_buf;
 
-    info("socket_write(): writing packet:");
+    info("server_socket_write(): writing packet:");
     slice_dump(out_buf);
 
     do {
@@ -323,3 +352,55 @@ int socket_write(int sock, slice_s out_buf)
     return (int)(unsigned int)total_bytes_written;
 }
 
+
+
+/*
+ * Wait until at least one of the sockets has data to read, or one of them
+ * is closed, or the timeout passes.  ready[i] is set to 1 for each socket
+ * that can be read without blocking.  Returns the number of ready sockets.
+ */
+int server_socket_wait_read(const int *socks, int num_socks, int *ready, int timeout_us)
+{
+    fd_set read_fd_set;
+    TIMEVAL timeout;
+    int max_sock = 0;
+    int num_ready = 0;
+
+    if(num_socks > FD_SETSIZE) {
+        info("ERROR: too many sockets to wait on!");
+        return SOCKET_ERR_SELECT;
+    }
+
+    timeout.tv_sec = timeout_us / 1000000;
+    timeout.tv_usec = timeout_us % 1000000;
+
+    FD_ZERO(&read_fd_set);
+
+    for(int i=0; i < num_socks; i++) {
+        FD_SET(socks[i], &read_fd_set);
+
+        if(socks[i] > max_sock) {
+            max_sock = socks[i];
+        }
+    }
+
+    num_ready = select(max_sock+1, &read_fd_set, NULL, NULL, &timeout);
+    if(num_ready < 0) {
+#ifndef IS_WINDOWS
+        /* a signal came in, let the caller check for termination. */
+        if(errno == EINTR) {
+            num_ready = 0;
+        } else
+#endif
+        {
+            info("Error selecting the sockets!");
+            return SOCKET_ERR_SELECT;
+        }
+    }
+
+    for(int i=0; i < num_socks; i++) {
+        ready[i] = (num_ready > 0 && FD_ISSET(socks[i], &read_fd_set)) ? 1 : 0;
+    }
+
+    return num_ready;
+}
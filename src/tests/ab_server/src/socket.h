@@ -49,9 +49,11 @@ typedef enum {
     SOCKET_ERR_ACCEPT   = -11
 } socket_err_t;
 
-extern int socket_open(const char *host, const char *port);
-extern void socket_close(int sock);
-extern int socket_accept(int sock);
-extern slice_s socket_read(int sock, slice_s in_buf);
-extern int socket_write(int sock, slice_s out_buf);
+extern int server_socket_open(const char *host, const char *port);
+extern void server_socket_close(int sock);
+extern int server_socket_accept(int sock);
+extern slice_s server_socket_read(int sock, slice_s in_buf);
+extern int server_socket_write(int sock, slice_s out_buf);
+extern void server_socket_reset(int sock);
+extern int server_socket_wait_read(const int *socks, int num_socks, int *ready, int timeout_us);
 
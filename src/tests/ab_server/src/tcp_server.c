@@ -34,26 +34,90 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <limits.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "slice.h"
 #include "socket.h"
 #include "tcp_server.h"
 #include "utils.h"
 
+
+/* EIP encapsulation header, the payload length is at offset 2. */
+#define EIP_HEADER_SIZE (24)
+
+/* how many clients can be connected at once. */
+#define MAX_CLIENTS (64)
+
+/* how long to wait for data before checking for termination. */
+#define WAIT_TIMEOUT_US (100000)
+
+/*
+ * Each client connection has its own packet buffer and its own copy of
+ * the context, so the session and Forward Open state of one connection
+ * does not leak into another.  Anything the context points to, like the
+ * tag list, is shared.
+ */
+typedef struct {
+    int sock_fd;
+    uint32_t id;
+    size_t have;
+    uint8_t *data;
+    void *context;
+
+    /* responses to one client go out in order. */
+    int64_t last_due_us;
+} tcp_client_s;
+
+/* a response held back to emulate a slow network or PLC. */
+typedef struct delayed_response_s {
+    struct delayed_response_s *next;
+    uint32_t client_id;
+    int64_t due_us;
+    size_t len;
+    uint8_t data[];
+} delayed_response_s;
+
 struct tcp_server {
     int sock_fd;
     slice_s buffer;
     slice_s (*handler)(slice_s input, slice_s output, void *context);
     void *context;
+    size_t context_size;
+
+    /* how to find the end of a packet. */
+    size_t header_size;
+    size_t (*packet_size)(slice_s header);
+
+    int num_clients;
+    uint32_t next_client_id;
+    tcp_client_s clients[MAX_CLIENTS];
+
+    /* load emulation. */
+    tcp_server_emulation_s emu;
+    int64_t (*delay_func)(void *context);
+    bool emu_active;
+    int64_t plc_busy_until_us;
+    int num_delayed;
+    delayed_response_s *delayed;
 };
 
 
-tcp_server_p tcp_server_create(const char *host, const char *port, slice_s buffer, slice_s (*handler)(slice_s input, slice_s output, void *context), void *context)
+static void add_client(tcp_server_p server, int client_fd);
+static void remove_client(tcp_server_p server, int index);
+static int process_client(tcp_server_p server, tcp_client_s *client);
+static int delay_response(tcp_server_p server, tcp_client_s *client, size_t request_len, slice_s output);
+static int64_t send_delayed_responses(tcp_server_p server);
+static bool chance(int percent);
+static size_t eip_packet_size(slice_s header);
+
+
+tcp_server_p tcp_server_create(const char *host, const char *port, slice_s buffer, slice_s (*handler)(slice_s input, slice_s output, void *context), void *context, size_t context_size)
 {
     tcp_server_p server = calloc(1, sizeof(*server));
 
     if(server) {
-        server->sock_fd = socket_open(host, port);
+        server->sock_fd = server_socket_open(host, port);
 
         if(server->sock_fd < 0) {
             error("ERROR: Unable to open TCP socket, error code %d!", server->sock_fd);
@@ -62,94 +126,174 @@ tcp_server_p tcp_server_create(const char *host, const char *port, slice_s buffe
         server->buffer = buffer;
         server->handler = handler;
         server->context = context;
+        server->context_size = context_size;
+        server->header_size = EIP_HEADER_SIZE;
+        server->packet_size = eip_packet_size;
     }
 
     return server;
 }
 
+
+/*
+ * The default framing is EIP.  packet_size is called with the first
+ * header_size bytes and returns the size of the whole packet.
+ */
+void tcp_server_set_framing(tcp_server_p server, size_t header_size, size_t (*packet_size)(slice_s header))
+{
+    server->header_size = header_size;
+    server->packet_size = packet_size;
+}
+
+
+/*
+ * Parse one of the emulation options in TCP_SERVER_EMULATION_USAGE.
+ * Returns 1 if the argument was used, 0 if it is not an emulation option
+ * and -1 if the value is bad.
+ */
+int tcp_server_parse_emulation_arg(const char *arg, tcp_server_emulation_s *emu)
+{
+    if(strncmp(arg, "--delay=", 8) == 0) {
+        if(str_scanf(&arg[8], "%d,%d", &emu->delay_min_ms, &emu->delay_max_ms) < 1) {
+            fprintf(stderr, "Unable to parse delay %s!\n", &arg[8]);
+            return -1;
+        }
+    } else if(strncmp(arg, "--plc_cost=", 11) == 0) {
+        if(str_scanf(&arg[11], "%d,%d", &emu->cost_us, &emu->cost_ns_per_byte) < 1) {
+            fprintf(stderr, "Unable to parse PLC cost %s!\n", &arg[11]);
+            return -1;
+        }
+    } else if(strncmp(arg, "--max_in_flight=", 16) == 0) {
+        emu->max_in_flight = atoi(&arg[16]);
+    } else if(strncmp(arg, "--drop=", 7) == 0) {
+        emu->drop_percent = atoi(&arg[7]);
+    } else if(strncmp(arg, "--reset=", 8) == 0) {
+        emu->reset_percent = atoi(&arg[8]);
+    } else if(strncmp(arg, "--max_conn=", 11) == 0) {
+        emu->max_clients = atoi(&arg[11]);
+    } else {
+        return 0;
+    }
+
+    return 1;
+}
+
+
+
+/*
+ * Ask the handler for the delay of each response instead of picking it
+ * from the emulation settings.  delay_func gets the client's context
+ * after the request was handled and returns microseconds.
+ */
+void tcp_server_set_delay_func(tcp_server_p server, int64_t (*delay_func)(void *context))
+{
+    server->delay_func = delay_func;
+
+    if(delay_func) {
+        server->emu_active = true;
+    }
+}
+
+
+
+void tcp_server_set_emulation(tcp_server_p server, const tcp_server_emulation_s *emu)
+{
+    server->emu = *emu;
+
+    if(server->emu.delay_max_ms < server->emu.delay_min_ms) {
+        server->emu.delay_max_ms = server->emu.delay_min_ms;
+    }
+
+    /* the client limit is checked on accept, the rest on each response. */
+    server->emu_active = (server->delay_func || server->emu.delay_max_ms > 0 || server->emu.cost_us > 0 || server->emu.cost_ns_per_byte > 0 || server->emu.drop_percent > 0 || server->emu.reset_percent > 0);
+}
+
+
+/*
+ * Serve all the clients from one thread.  Every pass waits for any of the
+ * sockets to have data, accepts new clients and handles at most one packet
+ * per ready client so that a busy client does not starve the others.
+ * Delayed responses are sent when they come due.
+ */
 void tcp_server_start(tcp_server_p server, volatile sig_atomic_t *terminate)
 {
-    int client_fd;
+    int socks[MAX_CLIENTS + 1];
+    int ready[MAX_CLIENTS + 1];
     bool done = false;
 
-    info("Waiting for new client connection.");
+    info("Waiting for new client connections.");
 
     do {
-        client_fd = socket_accept(server->sock_fd);
-
-        if(client_fd >= 0) {
-            slice_s tmp_input = server->buffer;
-            slice_s tmp_output;
-            int rc;
-
-            info("Got new client connection, going into processing loop.");
-
-            do {
-                rc = TCP_SERVER_PROCESSED;
-
-                /* get an incoming packet or a partial packet. */
-                tmp_input = socket_read(client_fd, tmp_input);
-
-                if((rc = slice_has_err(tmp_input))) {
-                    info("WARN: error response reading socket! error %d", rc);
-                    rc = TCP_SERVER_DONE;
-                    break;
-                }
-
-                /* try to process the packet. */
-                tmp_output = server->handler(tmp_input, server->buffer, server->context);
-
-                /* check the response. */
-                if(!slice_has_err(tmp_output)) {
-                    /* FIXME - this should be in a loop to make sure all data is pushed. */
-                    rc = socket_write(client_fd, tmp_output);
-
-                    /* error writing? */
-                    if(rc < 0) {
-                        info("ERROR: error writing output packet! Error: %d", rc);
-                        rc = TCP_SERVER_DONE;
-                        break;
-                    } else {
-                        /* all good. Reset the buffers etc. */
-                        tmp_input = server->buffer;
-                        rc = TCP_SERVER_PROCESSED;
-                    }
-                } else {
-                    /* there was some sort of error or exceptional condition. */
-                    switch((rc = slice_get_err(tmp_input))) {
-                        case TCP_SERVER_DONE:
-                            done = true;
-                            break;
-
-                        case TCP_SERVER_INCOMPLETE:
-                            tmp_input = slice_from_slice(server->buffer, slice_len(tmp_input), slice_len(server->buffer) - slice_len(tmp_input));
-                            break;
-
-                        case TCP_SERVER_PROCESSED:
-                            break;
-
-                        case TCP_SERVER_UNSUPPORTED:
-                            info("WARN: Unsupported packet!");
-                            slice_dump(tmp_input);
-                            break;
-
-                        default:
-                            info("WARN: Unsupported return code %d!", rc);
-                            break;
-                    }
-                }
-            } while(rc == TCP_SERVER_INCOMPLETE || rc == TCP_SERVER_PROCESSED);
-
-            /* done with the socket */
-            socket_close(client_fd);
-        } else if (client_fd != SOCKET_STATUS_OK) {
-            /* There was an error either opening or accepting! */
-            info("WARN: error while trying to open/accept the client socket.");
-        }
-
-        /* wait a bit to give back the CPU. */
-        util_sleep_ms(1);
+        int num_socks = 0;
+        int64_t wait_us = send_delayed_responses(server);
+        bool reading = true;
+        int rc;
+
+        /* with too many requests in flight, leave new ones in the sockets. */
+        if(server->emu.max_in_flight > 0 && server->num_delayed >= server->emu.max_in_flight) {
+            reading = false;
+        }
+
+        socks[num_socks++] = server->sock_fd;
+
+        if(reading) {
+            for(int i=0; i < server->num_clients; i++) {
+                socks[num_socks++] = server->clients[i].sock_fd;
+            }
+        }
+
+        rc = server_socket_wait_read(socks, num_socks, ready, (int)(wait_us < WAIT_TIMEOUT_US ? wait_us : WAIT_TIMEOUT_US));
+        if(rc < 0) {
+            info("WARN: error %d waiting for socket data.", rc);
+            util_sleep_ms(1);
+            continue;
+        }
+
+        if(rc == 0) {
+            continue;
+        }
+
+        /* go backward so removing a client does not move the ones not yet checked. */
+        for(int i=(reading ? server->num_clients : 0) - 1; i >= 0; i--) {
+            if(!ready[i + 1]) {
+                continue;
+            }
+
+            rc = process_client(server, &server->clients[i]);
+
+            if(rc == TCP_SERVER_DONE) {
+                done = true;
+            }
+
+            if(rc != TCP_SERVER_PROCESSED && rc != TCP_SERVER_INCOMPLETE) {
+                remove_client(server, i);
+            }
+        }
+
+        if(ready[0]) {
+            int client_fd = server_socket_accept(server->sock_fd);
+
+            if(client_fd >= 0) {
+                add_client(server, client_fd);
+            } else if (client_fd != SOCKET_STATUS_OK) {
+                /* There was an error either opening or accepting! */
+                info("WARN: error while trying to open/accept the client socket.");
+            }
+        }
     } while(!done && !*terminate);
+
+    while(server->num_clients > 0) {
+        remove_client(server, server->num_clients - 1);
+    }
+
+    while(server->delayed) {
+        delayed_response_s *entry = server->delayed;
+
+        server->delayed = entry->next;
+        free(entry);
+    }
+
+    server->num_delayed = 0;
 }
 
 
@@ -158,9 +302,284 @@ void tcp_server_destroy(tcp_server_p server)
 {
     if(server) {
         if(server->sock_fd >= 0) {
-            socket_close(server->sock_fd);
+            server_socket_close(server->sock_fd);
             server->sock_fd = INT_MIN;
         }
         free(server);
     }
 }
+
+
+
+void add_client(tcp_server_p server, int client_fd)
+{
+    tcp_client_s *client = NULL;
+    int max_clients = ((server->emu.max_clients > 0 && server->emu.max_clients < MAX_CLIENTS) ? server->emu.max_clients : MAX_CLIENTS);
+
+    if(server->num_clients >= max_clients) {
+        info("WARN: all %d connection slots are in use, dropping the new connection.", max_clients);
+        server_socket_close(client_fd);
+        return;
+    }
+
+    client = &server->clients[server->num_clients];
+    memset(client, 0, sizeof(*client));
+
+    client->data = calloc(1, slice_len(server->buffer));
+    client->context = calloc(1, server->context_size);
+
+    if(!client->data || !client->context) {
+        info("ERROR: unable to allocate client state!");
+        free(client->data);
+        free(client->context);
+        server_socket_close(client_fd);
+        return;
+    }
+
+    /* start from the shared context, the connection state in it is still clear. */
+    memcpy(client->context, server->context, server->context_size);
+
+    client->sock_fd = client_fd;
+    client->id = ++server->next_client_id;
+    server->num_clients++;
+
+    info("Got new client connection, %d clients connected.", server->num_clients);
+}
+
+
+
+void remove_client(tcp_server_p server, int index)
+{
+    tcp_client_s *client = &server->clients[index];
+
+    server_socket_close(client->sock_fd);
+    free(client->data);
+    free(client->context);
+
+    server->num_clients--;
+
+    /* keep the in-use clients together. */
+    if(index != server->num_clients) {
+        server->clients[index] = server->clients[server->num_clients];
+    }
+
+    info("Client connection closed, %d clients connected.", server->num_clients);
+}
+
+
+
+/*
+ * Read what the client has sent, up to the end of the packet in
+ * progress, and handle the packet if it is complete.  Anything after the
+ * packet stays in the socket so that pipelined requests are handled one
+ * at a time.
+ */
+int process_client(tcp_server_p server, tcp_client_s *client)
+{
+    slice_s buffer = slice_make(client->data, server->buffer.len);
+    slice_s chunk;
+    slice_s output;
+    size_t need = server->header_size;
+    int rc;
+
+    if(client->have >= server->header_size) {
+        need = server->packet_size(slice_from_slice(buffer, 0, server->header_size));
+    }
+
+    if(need > slice_len(buffer)) {
+        info("WARN: packet of %zu bytes is too large!", need);
+        return TCP_SERVER_BAD_REQUEST;
+    }
+
+    chunk = server_socket_read(client->sock_fd, slice_from_slice(buffer, client->have, need - client->have));
+
+    if((rc = slice_has_err(chunk))) {
+        info("WARN: error response reading socket! error %d", rc);
+        return TCP_SERVER_DONE_CLIENT;
+    }
+
+    /* readable with no data means the client closed the connection. */
+    if(slice_len(chunk) == 0) {
+        return TCP_SERVER_DONE_CLIENT;
+    }
+
+    client->have += slice_len(chunk);
+
+    if(client->have == server->header_size) {
+        need = server->packet_size(slice_from_slice(buffer, 0, server->header_size));
+    }
+
+    if(client->have < need) {
+        return TCP_SERVER_INCOMPLETE;
+    }
+
+    /* a whole packet, handle it. */
+    client->have = 0;
+
+    output = server->handler(slice_from_slice(buffer, 0, need), buffer, client->context);
+
+    if(!slice_has_err(output)) {
+        if(server->emu_active) {
+            return delay_response(server, client, need, output);
+        }
+
+        rc = server_socket_write(client->sock_fd, output);
+
+        /* error writing? */
+        if(rc < 0) {
+            info("ERROR: error writing output packet! Error: %d", rc);
+            return TCP_SERVER_DONE_CLIENT;
+        }
+
+        return TCP_SERVER_PROCESSED;
+    }
+
+    /* there was some sort of error or exceptional condition. */
+    switch((rc = slice_get_err(output))) {
+        case TCP_SERVER_DONE:
+        case TCP_SERVER_PROCESSED:
+            break;
+
+        case TCP_SERVER_UNSUPPORTED:
+            info("WARN: Unsupported packet!");
+            slice_dump(slice_from_slice(buffer, 0, need));
+            break;
+
+        default:
+            info("WARN: Unsupported return code %d!", rc);
+            break;
+    }
+
+    return rc;
+}
+
+
+
+/*
+ * Queue a response to be sent later.  The PLC works on one request at a
+ * time, so the processing cost of each request starts when the one
+ * before it is done.  The network delay is added on top of that.
+ */
+int delay_response(tcp_server_p server, tcp_client_s *client, size_t request_len, slice_s output)
+{
+    tcp_server_emulation_s *emu = &server->emu;
+    delayed_response_s *entry = NULL;
+    int64_t now_us = util_time_us();
+    int64_t done_us = (server->plc_busy_until_us > now_us ? server->plc_busy_until_us : now_us);
+    int64_t delay_us = (int64_t)emu->delay_min_ms * 1000;
+
+    if(chance(emu->reset_percent)) {
+        info("Resetting the connection instead of responding.");
+        server_socket_reset(client->sock_fd);
+        client->sock_fd = INT_MIN;
+        return TCP_SERVER_DONE_CLIENT;
+    }
+
+    if(chance(emu->drop_percent)) {
+        info("Dropping the response.");
+        return TCP_SERVER_PROCESSED;
+    }
+
+    done_us += emu->cost_us + (((int64_t)emu->cost_ns_per_byte * (int64_t)(request_len + slice_len(output))) / 1000);
+    server->plc_busy_until_us = done_us;
+
+    if(server->delay_func) {
+        delay_us = server->delay_func(client->context);
+    } else if(emu->delay_max_ms > emu->delay_min_ms) {
+        delay_us += (int64_t)(rand() % (emu->delay_max_ms - emu->delay_min_ms + 1)) * 1000;
+    }
+
+    entry = malloc(sizeof(*entry) + slice_len(output));
+    if(!entry) {
+        info("ERROR: unable to allocate delayed response!");
+        return TCP_SERVER_DONE_CLIENT;
+    }
+
+    entry->next = NULL;
+    entry->client_id = client->id;
+    entry->due_us = done_us + delay_us;
+    entry->len = slice_len(output);
+    memcpy(entry->data, output.data, entry->len);
+
+    /* a short delay must not pass an earlier long one. */
+    if(entry->due_us < client->last_due_us) {
+        entry->due_us = client->last_due_us;
+    }
+
+    client->last_due_us = entry->due_us;
+
+    /* keep them in the order they came in. */
+    if(!server->delayed) {
+        server->delayed = entry;
+    } else {
+        delayed_response_s *last = server->delayed;
+
+        while(last->next) {
+            last = last->next;
+        }
+
+        last->next = entry;
+    }
+
+    server->num_delayed++;
+
+    return TCP_SERVER_PROCESSED;
+}
+
+
+
+/* send what is due.  Returns how long until the next response is due. */
+int64_t send_delayed_responses(tcp_server_p server)
+{
+    int64_t now_us = util_time_us();
+    int64_t wait_us = WAIT_TIMEOUT_US;
+    delayed_response_s **walker = &server->delayed;
+
+    while(*walker) {
+        delayed_response_s *entry = *walker;
+        int index = -1;
+
+        if(entry->due_us > now_us) {
+            if(entry->due_us - now_us < wait_us) {
+                wait_us = entry->due_us - now_us;
+            }
+
+            walker = &entry->next;
+            continue;
+        }
+
+        *walker = entry->next;
+        server->num_delayed--;
+
+        for(int i=0; i < server->num_clients; i++) {
+            if(server->clients[i].id == entry->client_id) {
+                index = i;
+                break;
+            }
+        }
+
+        /* the client may be gone. */
+        if(index >= 0 && server_socket_write(server->clients[index].sock_fd, slice_make(entry->data, (ssize_t)entry->len)) < 0) {
+            info("ERROR: error writing delayed output packet!");
+            remove_client(server, index);
+        }
+
+        free(entry);
+    }
+
+    return wait_us;
+}
+
+
+
+bool chance(int percent)
+{
+    return (percent > 0 && (rand() % 100) < percent);
+}
+
+
+
+size_t eip_packet_size(slice_s header)
+{
+    return EIP_HEADER_SIZE + (size_t)slice_get_uint8(header, 2) + ((size_t)slice_get_uint8(header, 3) << 8);
+}
@@ -34,7 +34,9 @@
 #pragma once
 
 #include <signal.h>
+#include <stddef.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include "slice.h"
 
 typedef enum {
@@ -42,12 +44,39 @@ typedef enum {
     TCP_SERVER_PROCESSED = 100002,
     TCP_SERVER_DONE = 100003,
     TCP_SERVER_BAD_REQUEST = 100004,
-    TCP_SERVER_UNSUPPORTED = 100005
+    TCP_SERVER_UNSUPPORTED = 100005,
+    TCP_SERVER_DONE_CLIENT = 100006
 } tcp_server_status_t;
 
 typedef struct tcp_server *tcp_server_p;
 
-extern tcp_server_p tcp_server_create(const char *host, const char *port, slice_s buffer, slice_s (*handler)(slice_s input, slice_s output, void *context), void *context);
+/* load emulation, all off when zero. */
+typedef struct {
+    int delay_min_ms;       /* network delay, picked evenly from min to max. */
+    int delay_max_ms;
+    int cost_us;            /* PLC time to process each request. */
+    int cost_ns_per_byte;   /* plus this much for each request and response byte. */
+    int max_in_flight;      /* stop reading requests when this many responses are waiting. */
+    int drop_percent;       /* chance of not sending a response. */
+    int reset_percent;      /* chance of resetting the connection instead of responding. */
+    int max_clients;        /* connection slots. */
+} tcp_server_emulation_s;
+
+#define TCP_SERVER_EMULATION_USAGE \
+    "   Load emulation, all optional:\n" \
+    "        --delay=<min>[,<max>]      response delay in ms, evenly spread from min to max.\n" \
+    "        --plc_cost=<us>[,<ns>]     PLC time per request in us, plus ns per byte.\n" \
+    "                                   Requests are processed one at a time.\n" \
+    "        --max_in_flight=<n>        stop reading requests while n responses wait.\n" \
+    "        --drop=<percent>           chance a response is never sent.\n" \
+    "        --reset=<percent>          chance the connection is reset instead.\n" \
+    "        --max_conn=<n>             connection slots, more connections are closed.\n"
+
+extern tcp_server_p tcp_server_create(const char *host, const char *port, slice_s buffer, slice_s (*handler)(slice_s input, slice_s output, void *context), void *context, size_t context_size);
+extern void tcp_server_set_framing(tcp_server_p server, size_t header_size, size_t (*packet_size)(slice_s header));
+extern int tcp_server_parse_emulation_arg(const char *arg, tcp_server_emulation_s *emu);
+extern void tcp_server_set_delay_func(tcp_server_p server, int64_t (*delay_func)(void *context));
+extern void tcp_server_set_emulation(tcp_server_p server, const tcp_server_emulation_s *emu);
 extern void tcp_server_start(tcp_server_p server, volatile sig_atomic_t *terminate);
 extern void tcp_server_destroy(tcp_server_p server);
 
@@ -89,9 +89,9 @@ int util_sleep_ms(int ms)
 
 
 /*
- * time_ms
+ * time_ms, time_us
  *
- * Return the current epoch time in milliseconds.
+ * Return the current epoch time in milliseconds or microseconds.
  */
 
 #ifdef IS_WINDOWS
@@ -112,6 +112,19 @@ int64_t util_time_ms(void)
     return  res;
 }
 
+int64_t util_time_us(void)
+{
+    FILETIME ft;
+    int64_t res;
+
+    GetSystemTimeAsFileTime(&ft);
+
+    /* calculate time as 100ns increments since Jan 1, 1601. */
+    res = (int64_t)(ft.dwLowDateTime) + ((int64_t)(ft.dwHighDateTime) << 32);
+
+    return res / 10;
+}
+
 #else
 
 
@@ -124,6 +137,16 @@ int64_t util_time_ms(void)
     return  ((int64_t)tv.tv_sec*1000)+ ((int64_t)tv.tv_usec/1000);
 }
 
+
+int64_t util_time_us(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv,NULL);
+
+    return  ((int64_t)tv.tv_sec*1000000)+ (int64_t)tv.tv_usec;
+}
+
 #endif 
 
 
@@ -141,7 +164,7 @@ int match_chars(const char* source, int start_index, const char* chars)
  * Logging routines.
  */
 
-static bool debug_is_on = false;
+bool debug_is_on = false;
 
 
 void debug_on(void)
@@ -191,7 +214,7 @@ void info_impl(const char *func, int line, const char *templ, ...)
 
 #define COLUMNS (size_t)(10)
 
-void slice_dump(slice_s s)
+void slice_dump_impl(slice_s s)
 {
     size_t max_row, row, column;
     char row_buf[300]; /* MAGIC */
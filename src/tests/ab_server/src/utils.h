@@ -33,12 +33,14 @@
 
 #pragma once
 
+#include <stdbool.h>
 #include <stdint.h>
 #include "compat.h"
 #include "slice.h"
 
 extern int util_sleep_ms(int ms);
 extern int64_t util_time_ms(void);
+extern int64_t util_time_us(void);
 
 /* string helpers */
 extern int match_chars(const char* source, int start_index, const char *chars);
@@ -48,6 +50,10 @@ void debug_on(void);
 void debug_off(void);
 #define error(...) error_impl(__func__, __LINE__, __VA_ARGS__)
 extern void error_impl(const char *func, int line, const char *templ, ...);
-#define info(...) info_impl(__func__, __LINE__, __VA_ARGS__)
+
+/* checked before the call so that logging costs nothing when it is off. */
+extern bool debug_is_on;
+#define info(...) do { if(debug_is_on) { info_impl(__func__, __LINE__, __VA_ARGS__); } } while(0)
 extern void info_impl(const char *func, int line, const char *templ, ...);
-extern void slice_dump(slice_s s);
+#define slice_dump(s) do { if(debug_is_on) { slice_dump_impl(s); } } while(0)
+extern void slice_dump_impl(slice_s s);
@@ -0,0 +1,367 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <lib/libplctag.h>
+#include <platform.h>
+#include <util/attr.h>
+#include <util/debug.h>
+#include <util/hashtable.h>
+#include <util/rc.h>
+#include <ab/cip.h>
+#include <ab/pccc.h>
+#include <ab/tag.h>
+
+/*
+ * Microbenchmarks for the utility code on the hot paths.  Each one runs
+ * alone and then in several threads at once on shared state, and reports
+ * the time and the library allocations per operation.
+ *
+ *   plctag_microbench [iterations] [threads]
+ */
+
+#define DEFAULT_ITERATIONS (1000000)
+#define DEFAULT_THREADS (4)
+#define MAX_THREADS (64)
+#define TABLE_ENTRIES (1000)
+
+#define ATTR_STRING "protocol=ab-eip&gateway=10.1.2.3&path=1,0&plc=ControlLogix&elem_size=4&elem_count=10&name=Program:MainProgram.MyArray[5]"
+#define CIP_TAG_NAME "Program:MainProgram.MyUDT[10,2].Field.Sub"
+#define PCCC_ADDRESS "N7:10/3"
+
+typedef struct {
+    const char *name;
+    void *(*setup)(void);
+    void (*run)(void *state, int iterations);
+    void (*teardown)(void *state);
+} bench_s;
+
+typedef struct {
+    bench_s *bench;
+    void *state;
+    int iterations;
+    int64_t elapsed_ns;
+    int64_t allocations;
+} worker_s;
+
+
+/* allocations are counted per thread so counting does not add contention. */
+static THREAD_LOCAL int64_t thread_allocations = 0;
+
+/* keeps the compiler from dropping the work. */
+static volatile intptr_t sink = 0;
+
+
+static void *counting_alloc(size_t size)
+{
+    thread_allocations++;
+    return malloc(size);
+}
+
+static void *counting_realloc(void *mem, size_t size)
+{
+    thread_allocations++;
+    return realloc(mem, size);
+}
+
+static void counting_free(void *mem)
+{
+    free(mem);
+}
+
+
+
+/* hashtable_get */
+
+static void *hashtable_setup(void)
+{
+    hashtable_p table = hashtable_create(TABLE_ENTRIES);
+
+    for(int i=1; i <= TABLE_ENTRIES; i++) {
+        hashtable_put(table, i, (void*)(intptr_t)i);
+    }
+
+    return table;
+}
+
+static void hashtable_run(void *state, int iterations)
+{
+    intptr_t total = 0;
+
+    for(int i=0; i < iterations; i++) {
+        total += (intptr_t)hashtable_get((hashtable_p)state, (i % TABLE_ENTRIES) + 1);
+    }
+
+    sink = total;
+}
+
+static void hashtable_teardown(void *state)
+{
+    hashtable_destroy((hashtable_p)state);
+}
+
+
+
+/* attr_create_from_str */
+
+static void attr_run(void *state, int iterations)
+{
+    (void)state;
+
+    for(int i=0; i < iterations; i++) {
+        attr attribs = attr_create_from_str(ATTR_STRING);
+
+        sink = (intptr_t)attr_get_int(attribs, "elem_count", 0);
+        attr_destroy(attribs);
+    }
+}
+
+
+
+/* rc_inc and rc_dec, all the threads share one reference. */
+
+static void rc_cleanup(void *data)
+{
+    (void)data;
+}
+
+static void *rc_setup(void)
+{
+    return rc_alloc(64, rc_cleanup);
+}
+
+static void rc_run(void *state, int iterations)
+{
+    for(int i=0; i < iterations; i++) {
+        rc_inc(state);
+        rc_dec(state);
+    }
+}
+
+static void rc_teardown(void *state)
+{
+    rc_dec(state);
+}
+
+
+
+/* plc_tag_get_int32, all the threads share one tag. */
+
+static void *get_int32_setup(void)
+{
+    int32_t tag = plc_tag_create("make=system&family=library&name=version", 1000);
+
+    if(tag < 0) {
+        fprintf(stderr, "Unable to create the system tag, error %s!\n", plc_tag_decode_error(tag));
+        exit(1);
+    }
+
+    return (void*)(intptr_t)tag;
+}
+
+static void get_int32_run(void *state, int iterations)
+{
+    int32_t tag = (int32_t)(intptr_t)state;
+    intptr_t total = 0;
+
+    for(int i=0; i < iterations; i++) {
+        total += plc_tag_get_int32(tag, 0);
+    }
+
+    sink = total;
+}
+
+static void get_int32_teardown(void *state)
+{
+    plc_tag_destroy((int32_t)(intptr_t)state);
+}
+
+
+
+/* cip_encode_tag_name, each thread encodes into its own tag. */
+
+static void cip_encode_run(void *state, int iterations)
+{
+    ab_tag_p tag = calloc(1, sizeof(*tag));
+
+    (void)state;
+
+    if(!tag) {
+        return;
+    }
+
+    for(int i=0; i < iterations; i++) {
+        cip_encode_tag_name(tag, CIP_TAG_NAME);
+    }
+
+    sink = tag->encoded_name_size;
+
+    free(tag);
+}
+
+
+
+/* pccc_parse_address, the data table address parser used by the PCCC encoders. */
+
+static void pccc_parse_run(void *state, int iterations)
+{
+    pccc_file_t file_type = PCCC_FILE_UNKNOWN;
+    int file_num = 0;
+    int elem_num = 0;
+    int subelem_num = 0;
+
+    (void)state;
+
+    for(int i=0; i < iterations; i++) {
+        pccc_parse_address(PCCC_ADDRESS, &file_type, &file_num, &elem_num, &subelem_num);
+    }
+
+    sink = file_num + elem_num + subelem_num;
+}
+
+
+
+static bench_s benches[] = {
+    { "hashtable_get", hashtable_setup, hashtable_run, hashtable_teardown },
+    { "attr_create_from_str", NULL, attr_run, NULL },
+    { "rc_inc/rc_dec", rc_setup, rc_run, rc_teardown },
+    { "plc_tag_get_int32", get_int32_setup, get_int32_run, get_int32_teardown },
+    { "cip_encode_tag_name", NULL, cip_encode_run, NULL },
+    { "pccc_parse_address", NULL, pccc_parse_run, NULL }
+};
+
+#define NUM_BENCHES ((int)(sizeof(benches)/sizeof(benches[0])))
+
+
+
+static THREAD_FUNC(worker_thread)
+{
+    worker_s *worker = (worker_s *)arg;
+    int64_t start_allocations = thread_allocations;
+    int64_t start_ns = time_ns();
+
+    worker->bench->run(worker->state, worker->iterations);
+
+    worker->elapsed_ns = time_ns() - start_ns;
+    worker->allocations = thread_allocations - start_allocations;
+
+    THREAD_RETURN(0);
+}
+
+
+static void run_bench(bench_s *bench, int num_threads, int iterations)
+{
+    thread_p threads[MAX_THREADS];
+    worker_s workers[MAX_THREADS];
+    void *state = NULL;
+    int64_t total_ns = 0;
+    int64_t total_allocations = 0;
+    double ops = (double)iterations * (double)num_threads;
+
+    if(bench->setup) {
+        state = bench->setup();
+    }
+
+    /* warm up the caches. */
+    bench->run(state, iterations / 10);
+
+    for(int i=0; i < num_threads; i++) {
+        workers[i].bench = bench;
+        workers[i].state = state;
+        workers[i].iterations = iterations;
+        workers[i].elapsed_ns = 0;
+        workers[i].allocations = 0;
+
+        if(thread_create(&threads[i], worker_thread, 32*1024, &workers[i]) != PLCTAG_STATUS_OK) {
+            fprintf(stderr, "Unable to create thread %d!\n", i);
+            exit(1);
+        }
+    }
+
+    for(int i=0; i < num_threads; i++) {
+        thread_join(threads[i]);
+        thread_destroy(&threads[i]);
+
+        total_ns += workers[i].elapsed_ns;
+        total_allocations += workers[i].allocations;
+    }
+
+    if(bench->teardown) {
+        bench->teardown(state);
+    }
+
+    printf("%-24s %3d thread(s) %10.1f ns/op %8.2f allocs/op\n", bench->name, num_threads, (double)total_ns / ops, (double)total_allocations / ops);
+}
+
+
+int main(int argc, const char **argv)
+{
+    int iterations = DEFAULT_ITERATIONS;
+    int num_threads = DEFAULT_THREADS;
+
+    if(argc > 1) {
+        iterations = atoi(argv[1]);
+    }
+
+    if(argc > 2) {
+        num_threads = atoi(argv[2]);
+    }
+
+    if(iterations <= 0 || num_threads <= 0 || num_threads > MAX_THREADS) {
+        fprintf(stderr, "Usage: plctag_microbench [iterations] [threads, 1-%d]\n", MAX_THREADS);
+        return 1;
+    }
+
+    /* this must come before anything else in the library. */
+    plc_tag_set_allocator(counting_alloc, counting_realloc, counting_free);
+
+    pdebug(DEBUG_INFO, "Starting microbenchmarks.");
+
+    printf("%d iterations per thread.\n", iterations);
+
+    for(int i=0; i < NUM_BENCHES; i++) {
+        run_bench(&benches[i], 1, iterations);
+
+        if(num_threads > 1) {
+            run_bench(&benches[i], num_threads, iterations);
+        }
+    }
+
+    plc_tag_shutdown();
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return 0;
+}
@@ -0,0 +1,884 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/*
+ * plctag_bench - standard throughput and latency scenarios.
+ *
+ * Runs each scenario against ab_server for a fixed time and prints the
+ * results as one JSON document on stdout.  Progress goes to stderr.
+ *
+ *   plctag_bench [--spawn=<path to ab_server>] [--gateway=<ip>] [--path=<path>]
+ *                [--duration_ms=<ms>] [--scenario=<name>] [--server_opt=<opt>]...
+ *                [--baseline=<json file>] [--tolerance=<percent>]
+ *                [--latency_tolerance=<percent>]
+ *
+ * With --spawn the simulator is started with the tags the scenarios need
+ * and stopped at the end.  --server_opt passes options like --delay=5 to
+ * it.  Without --spawn the tags must already exist on the gateway:
+ *
+ *   BenchDINT:DINT[100] and BenchBig:DINT[10000]
+ *
+ * For each scenario the output has the tag operations per second, the
+ * latency percentiles of each call in microseconds, the packets sent per
+ * second and per tag operation from the library metrics, the library
+ * memory allocations per tag operation and the CPU time of this process
+ * per tag operation.
+ *
+ * With --baseline the results are also checked against the output of an
+ * earlier run.  A scenario fails if its tags per second dropped, or its
+ * packets or allocations per tag operation grew, by more than --tolerance
+ * percent (default 10), or if its p50 or p99 latency grew by more than
+ * --latency_tolerance percent (default 25).  A report for each scenario
+ * goes to stderr and the exit code is 2 if any failed.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "../../lib/libplctag.h"
+
+
+#define MAX_SERVER_OPTS (16)
+#define MAX_BENCH_TAGS (128)
+#define DATA_TIMEOUT (5000)
+#define ATTR_SIZE (400)
+#define DEFAULT_TOLERANCE (10.0)
+#define DEFAULT_LATENCY_TOLERANCE (25.0)
+
+#define SMALL_TAG "BenchDINT"
+#define SMALL_TAG_DEF "BenchDINT:DINT[100]"
+#define SMALL_TAG_ELEMS (100)
+#define BIG_TAG "BenchBig"
+#define BIG_TAG_DEF "BenchBig:DINT[10000]"
+#define BIG_TAG_ELEMS (10000)
+
+
+typedef struct {
+    int64_t *samples;
+    size_t count;
+    size_t capacity;
+} latency_s;
+
+typedef struct {
+    const char *name;
+    int num_tags;
+    int64_t ops;
+    int64_t errors;
+    int64_t elapsed_us;
+    int64_t cpu_us;
+    int64_t packets;
+    int64_t allocs;
+    latency_s latency;
+} result_s;
+
+typedef struct {
+    const char *name;
+    void (*run)(result_s *result);
+} scenario_s;
+
+
+static const char *gateway = "127.0.0.1";
+static const char *plc_path = "1,0";
+static int duration_ms = 2000;
+
+/* library allocations, counted if the allocator could be set. */
+static volatile int64_t alloc_count = 0;
+static int counting_allocs = 0;
+
+/* shared with the tag callback in the auto sync scenario. */
+static pthread_mutex_t cb_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int32_t cb_ids[MAX_BENCH_TAGS];
+static int64_t cb_start_us[MAX_BENCH_TAGS];
+static int cb_num_tags = 0;
+static result_s *cb_result = NULL;
+
+
+static int64_t now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((int64_t)ts.tv_sec * 1000000) + ((int64_t)ts.tv_nsec / 1000);
+}
+
+
+static void sleep_ms(int ms)
+{
+    struct timespec ts;
+
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (long)(ms % 1000) * 1000000;
+
+    while(nanosleep(&ts, &ts) == -1 && errno == EINTR) { }
+}
+
+
+static int64_t cpu_us(void)
+{
+    struct rusage usage;
+
+    getrusage(RUSAGE_SELF, &usage);
+
+    return ((int64_t)usage.ru_utime.tv_sec * 1000000) + (int64_t)usage.ru_utime.tv_usec
+         + ((int64_t)usage.ru_stime.tv_sec * 1000000) + (int64_t)usage.ru_stime.tv_usec;
+}
+
+
+static void *count_alloc(size_t size)
+{
+    __sync_fetch_and_add(&alloc_count, 1);
+
+    return malloc(size);
+}
+
+
+static void *count_realloc(void *mem, size_t size)
+{
+    __sync_fetch_and_add(&alloc_count, 1);
+
+    return realloc(mem, size);
+}
+
+
+static void latency_add(latency_s *lat, int64_t sample)
+{
+    if(lat->count >= lat->capacity) {
+        size_t new_capacity = (lat->capacity ? lat->capacity * 2 : 4096);
+        int64_t *new_samples = realloc(lat->samples, new_capacity * sizeof(*new_samples));
+
+        if(!new_samples) {
+            return;
+        }
+
+        lat->samples = new_samples;
+        lat->capacity = new_capacity;
+    }
+
+    lat->samples[lat->count++] = sample;
+}
+
+
+static int compare_int64(const void *a, const void *b)
+{
+    int64_t left = *(const int64_t *)a;
+    int64_t right = *(const int64_t *)b;
+
+    return (left > right) - (left < right);
+}
+
+
+/* the samples must be sorted. */
+static int64_t latency_percentile(latency_s *lat, double percentile)
+{
+    size_t index = 0;
+
+    if(lat->count == 0) {
+        return 0;
+    }
+
+    index = (size_t)(percentile * (double)(lat->count - 1));
+
+    return lat->samples[index];
+}
+
+
+/* total packets sent over all the sessions, from the library metrics. */
+static int64_t packets_sent(void)
+{
+    static const char *name = "plctag_packets_sent_total{";
+    int64_t total = 0;
+    int size = plc_tag_get_metrics(NULL, 0);
+    char *buf = NULL;
+    char *line = NULL;
+
+    if(size <= 0 || !(buf = malloc((size_t)size))) {
+        return 0;
+    }
+
+    plc_tag_get_metrics(buf, size);
+
+    for(line = buf; line && *line; line = strchr(line, '\n'), line = (line ? line + 1 : NULL)) {
+        if(strncmp(line, name, strlen(name)) == 0) {
+            char *value = strchr(line, '}');
+
+            if(value) {
+                total += strtoll(value + 1, NULL, 10);
+            }
+        }
+    }
+
+    free(buf);
+
+    return total;
+}
+
+
+static int create_tags(int32_t *ids, int num_tags, const char *name, int elem_count, int spread, const char *extra)
+{
+    char attrs[ATTR_SIZE];
+
+    for(int i=0; i < num_tags; i++) {
+        if(spread) {
+            snprintf(attrs, sizeof(attrs), "protocol=ab-eip&gateway=%s&path=%s&plc=ControlLogix&name=%s[%d]&elem_count=%d%s", gateway, plc_path, name, i % SMALL_TAG_ELEMS, elem_count, extra);
+        } else {
+            snprintf(attrs, sizeof(attrs), "protocol=ab-eip&gateway=%s&path=%s&plc=ControlLogix&name=%s&elem_count=%d%s", gateway, plc_path, name, elem_count, extra);
+        }
+
+        ids[i] = plc_tag_create(attrs, DATA_TIMEOUT);
+
+        if(ids[i] < 0) {
+            fprintf(stderr, "Unable to create tag %s, error %s!\n", attrs, plc_tag_decode_error(ids[i]));
+
+            for(int j=0; j < i; j++) {
+                plc_tag_destroy(ids[j]);
+            }
+
+            return ids[i];
+        }
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+static void destroy_tags(int32_t *ids, int num_tags)
+{
+    for(int i=0; i < num_tags; i++) {
+        plc_tag_destroy(ids[i]);
+    }
+}
+
+
+/* measure from here to result_end(), after the tags exist. */
+static void result_start(result_s *result, int num_tags)
+{
+    result->num_tags = num_tags;
+    result->packets = packets_sent();
+    result->allocs = __sync_fetch_and_add(&alloc_count, 0);
+    result->cpu_us = cpu_us();
+    result->elapsed_us = now_us();
+}
+
+
+static void result_end(result_s *result)
+{
+    result->elapsed_us = now_us() - result->elapsed_us;
+    result->cpu_us = cpu_us() - result->cpu_us;
+    result->packets = packets_sent() - result->packets;
+    result->allocs = __sync_fetch_and_add(&alloc_count, 0) - result->allocs;
+}
+
+
+
+/*
+ * scenarios
+ */
+
+/* one tag, blocking reads one after another. */
+static void run_sync_read(result_s *result)
+{
+    int32_t id = 0;
+    int64_t end_us = 0;
+
+    if(create_tags(&id, 1, SMALL_TAG, 1, 1, "") != PLCTAG_STATUS_OK) {
+        result->errors++;
+        return;
+    }
+
+    result_start(result, 1);
+    end_us = result->elapsed_us + ((int64_t)duration_ms * 1000);
+
+    while(now_us() < end_us) {
+        int64_t start_us = now_us();
+        int rc = plc_tag_read(id, DATA_TIMEOUT);
+
+        latency_add(&result->latency, now_us() - start_us);
+
+        if(rc == PLCTAG_STATUS_OK) {
+            result->ops++;
+        } else {
+            result->errors++;
+        }
+    }
+
+    result_end(result);
+
+    destroy_tags(&id, 1);
+}
+
+
+/* many tags or one batch, read or written together with the _many calls. */
+static void run_batch(result_s *result, int num_tags, const char *extra, int write_every)
+{
+    int32_t ids[MAX_BENCH_TAGS];
+    int statuses[MAX_BENCH_TAGS];
+    int64_t end_us = 0;
+    int round = 0;
+
+    if(create_tags(ids, num_tags, SMALL_TAG, 1, 1, extra) != PLCTAG_STATUS_OK) {
+        result->errors++;
+        return;
+    }
+
+    result_start(result, num_tags);
+    end_us = result->elapsed_us + ((int64_t)duration_ms * 1000);
+
+    while(now_us() < end_us) {
+        int64_t start_us = now_us();
+        int rc;
+
+        if(write_every && (round % write_every) == 0) {
+            for(int i=0; i < num_tags; i++) {
+                plc_tag_set_int32(ids[i], 0, round);
+            }
+
+            rc = plc_tag_write_many(ids, num_tags, statuses, DATA_TIMEOUT);
+        } else {
+            rc = plc_tag_read_many(ids, num_tags, statuses, DATA_TIMEOUT);
+        }
+
+        latency_add(&result->latency, now_us() - start_us);
+
+        for(int i=0; i < num_tags; i++) {
+            if(statuses[i] == PLCTAG_STATUS_OK) {
+                result->ops++;
+            } else {
+                result->errors++;
+            }
+        }
+
+        if(rc != PLCTAG_STATUS_OK && rc != PLCTAG_ERR_PARTIAL) {
+            fprintf(stderr, "Batch failed with %s.\n", plc_tag_decode_error(rc));
+        }
+
+        round++;
+    }
+
+    result_end(result);
+
+    destroy_tags(ids, num_tags);
+}
+
+
+static void run_packed(result_s *result)
+{
+    run_batch(result, 50, "&allow_packing=1", 0);
+}
+
+
+static void run_unpacked(result_s *result)
+{
+    run_batch(result, 50, "&allow_packing=0", 0);
+}
+
+
+static void run_mixed(result_s *result)
+{
+    run_batch(result, 50, "", 2);
+}
+
+
+/* one session for each tag. */
+static void run_fan_out(result_s *result)
+{
+    run_batch(result, 32, "&share_session=0", 0);
+}
+
+
+/* a large array that needs fragmented reads. */
+static void run_large_array(result_s *result)
+{
+    int32_t id = 0;
+    int64_t end_us = 0;
+
+    if(create_tags(&id, 1, BIG_TAG, BIG_TAG_ELEMS, 0, "") != PLCTAG_STATUS_OK) {
+        result->errors++;
+        return;
+    }
+
+    result_start(result, 1);
+    end_us = result->elapsed_us + ((int64_t)duration_ms * 1000);
+
+    while(now_us() < end_us) {
+        int64_t start_us = now_us();
+        int rc = plc_tag_read(id, DATA_TIMEOUT);
+
+        latency_add(&result->latency, now_us() - start_us);
+
+        if(rc == PLCTAG_STATUS_OK) {
+            result->ops++;
+        } else {
+            result->errors++;
+        }
+    }
+
+    result_end(result);
+
+    destroy_tags(&id, 1);
+}
+
+
+static void auto_sync_callback(int32_t tag_id, int event, int status)
+{
+    int64_t now = now_us();
+
+    pthread_mutex_lock(&cb_mutex);
+
+    for(int i=0; i < cb_num_tags && cb_result; i++) {
+        if(cb_ids[i] != tag_id) {
+            continue;
+        }
+
+        if(event == PLCTAG_EVENT_READ_STARTED) {
+            cb_start_us[i] = now;
+        } else if(event == PLCTAG_EVENT_READ_COMPLETED) {
+            if(status == PLCTAG_STATUS_OK) {
+                cb_result->ops++;
+            } else {
+                cb_result->errors++;
+            }
+
+            if(cb_start_us[i]) {
+                latency_add(&cb_result->latency, now - cb_start_us[i]);
+                cb_start_us[i] = 0;
+            }
+        }
+
+        break;
+    }
+
+    pthread_mutex_unlock(&cb_mutex);
+}
+
+
+/* the library reads the tags in the background, count the completions. */
+static void run_auto_sync(result_s *result)
+{
+    int32_t ids[MAX_BENCH_TAGS];
+    int num_tags = 100;
+
+    if(create_tags(ids, num_tags, SMALL_TAG, 1, 1, "&auto_sync_read_ms=10") != PLCTAG_STATUS_OK) {
+        result->errors++;
+        return;
+    }
+
+    pthread_mutex_lock(&cb_mutex);
+    memcpy(cb_ids, ids, sizeof(ids[0]) * (size_t)num_tags);
+    memset(cb_start_us, 0, sizeof(cb_start_us));
+    cb_num_tags = num_tags;
+    cb_result = result;
+    pthread_mutex_unlock(&cb_mutex);
+
+    result_start(result, num_tags);
+
+    for(int i=0; i < num_tags; i++) {
+        plc_tag_register_callback(ids[i], auto_sync_callback);
+    }
+
+    sleep_ms(duration_ms);
+
+    pthread_mutex_lock(&cb_mutex);
+    cb_result = NULL;
+    cb_num_tags = 0;
+    pthread_mutex_unlock(&cb_mutex);
+
+    result_end(result);
+
+    destroy_tags(ids, num_tags);
+}
+
+
+static const scenario_s scenarios[] = {
+    { "sync_read", run_sync_read },
+    { "auto_sync_100", run_auto_sync },
+    { "packed_50", run_packed },
+    { "unpacked_50", run_unpacked },
+    { "large_array", run_large_array },
+    { "mixed_read_write_50", run_mixed },
+    { "fan_out_32_sessions", run_fan_out }
+};
+
+#define NUM_SCENARIOS ((int)(sizeof(scenarios)/sizeof(scenarios[0])))
+
+
+
+static void print_result(result_s *result, int last)
+{
+    double secs = (double)result->elapsed_us / 1000000.0;
+
+    qsort(result->latency.samples, result->latency.count, sizeof(int64_t), compare_int64);
+
+    printf("    {\n");
+    printf("      \"name\": \"%s\",\n", result->name);
+    printf("      \"tags\": %d,\n", result->num_tags);
+    printf("      \"ops\": %" PRId64 ",\n", result->ops);
+    printf("      \"errors\": %" PRId64 ",\n", result->errors);
+    printf("      \"duration_ms\": %" PRId64 ",\n", result->elapsed_us / 1000);
+    printf("      \"tags_per_sec\": %.1f,\n", (secs > 0 ? (double)result->ops / secs : 0.0));
+    printf("      \"calls\": %zu,\n", result->latency.count);
+    printf("      \"latency_us\": { \"p50\": %" PRId64 ", \"p99\": %" PRId64 ", \"p999\": %" PRId64 ", \"max\": %" PRId64 " },\n",
+           latency_percentile(&result->latency, 0.50),
+           latency_percentile(&result->latency, 0.99),
+           latency_percentile(&result->latency, 0.999),
+           latency_percentile(&result->latency, 1.0));
+    printf("      \"packets_per_sec\": %.1f,\n", (secs > 0 ? (double)result->packets / secs : 0.0));
+    printf("      \"packets_per_tag\": %.4f,\n", (result->ops > 0 ? (double)result->packets / (double)result->ops : 0.0));
+
+    if(counting_allocs) {
+        printf("      \"allocs_per_op\": %.4f,\n", (result->ops > 0 ? (double)result->allocs / (double)result->ops : 0.0));
+    }
+
+    printf("      \"cpu_us_per_tag\": %.2f\n", (result->ops > 0 ? (double)result->cpu_us / (double)result->ops : 0.0));
+    printf("    }%s\n", (last ? "" : ","));
+}
+
+
+/*
+ * baseline checks
+ *
+ * The baseline is the JSON this program prints, so it is only scanned for
+ * the values by key, within the object of each scenario.
+ */
+
+static char *read_file(const char *file_name)
+{
+    FILE *f = fopen(file_name, "rb");
+    char *buf = NULL;
+    long size = 0;
+
+    if(!f) {
+        return NULL;
+    }
+
+    if(fseek(f, 0, SEEK_END) == 0 && (size = ftell(f)) >= 0 && fseek(f, 0, SEEK_SET) == 0) {
+        buf = malloc((size_t)size + 1);
+
+        if(buf && fread(buf, 1, (size_t)size, f) != (size_t)size) {
+            free(buf);
+            buf = NULL;
+        }
+
+        if(buf) {
+            buf[size] = 0;
+        }
+    }
+
+    fclose(f);
+
+    return buf;
+}
+
+
+/* find the part of the baseline for the scenario, up to the next scenario. */
+static const char *baseline_scenario(const char *baseline, const char *name, const char **end)
+{
+    char key[128];
+    const char *start = NULL;
+
+    snprintf(key, sizeof(key), "\"name\": \"%s\"", name);
+
+    if(!(start = strstr(baseline, key))) {
+        return NULL;
+    }
+
+    if(!(*end = strstr(start + 1, "\"name\":"))) {
+        *end = start + strlen(start);
+    }
+
+    return start;
+}
+
+
+static int baseline_value(const char *start, const char *end, const char *key, double *value)
+{
+    char quoted[64];
+    const char *found = NULL;
+    char *num_end = NULL;
+
+    snprintf(quoted, sizeof(quoted), "\"%s\":", key);
+
+    found = strstr(start, quoted);
+    if(!found || found >= end) {
+        return 0;
+    }
+
+    *value = strtod(found + strlen(quoted), &num_end);
+
+    return num_end != found + strlen(quoted);
+}
+
+
+/*
+ * higher_is_better says which way is a regression, returns 1 if it is within
+ * the tolerance.  Small absolute changes of values near zero are not counted.
+ */
+static int check_value(const char *name, const char *key, double base, double current, double tolerance, double slack, int higher_is_better)
+{
+    double limit = (higher_is_better ? base * (1.0 - tolerance / 100.0) : base * (1.0 + tolerance / 100.0));
+    int ok = (higher_is_better ? current >= limit : (current <= limit || current - base <= slack));
+    double change = (base != 0.0 ? ((current - base) * 100.0) / base : 0.0);
+
+    fprintf(stderr, "  %-6s %-20s %-16s baseline %12.2f  now %12.2f  (%+.1f%%)\n",
+            (ok ? "ok" : "FAIL"), name, key, base, current, change);
+
+    return ok;
+}
+
+
+static int check_result(const char *baseline, result_s *result, double tolerance, double latency_tolerance)
+{
+    const char *end = NULL;
+    const char *start = baseline_scenario(baseline, result->name, &end);
+    double secs = (double)result->elapsed_us / 1000000.0;
+    double ops = (double)result->ops;
+    double base = 0.0;
+    int ok = 1;
+
+    if(!start) {
+        fprintf(stderr, "  %-6s %-20s not in the baseline\n", "skip", result->name);
+        return 1;
+    }
+
+    /* a scenario that failed outright fails the check. */
+    if(result->ops == 0) {
+        fprintf(stderr, "  %-6s %-20s no tag operations completed\n", "FAIL", result->name);
+        return 0;
+    }
+
+    /* print_result() has sorted the samples. */
+    if(baseline_value(start, end, "tags_per_sec", &base)) {
+        ok &= check_value(result->name, "tags_per_sec", base, (secs > 0 ? ops / secs : 0.0), tolerance, 0.0, 1);
+    }
+
+    if(baseline_value(start, end, "p50", &base)) {
+        ok &= check_value(result->name, "latency_p50_us", base, (double)latency_percentile(&result->latency, 0.50), latency_tolerance, 5.0, 0);
+    }
+
+    if(baseline_value(start, end, "p99", &base)) {
+        ok &= check_value(result->name, "latency_p99_us", base, (double)latency_percentile(&result->latency, 0.99), latency_tolerance, 5.0, 0);
+    }
+
+    if(baseline_value(start, end, "packets_per_tag", &base)) {
+        ok &= check_value(result->name, "packets_per_tag", base, (double)result->packets / ops, tolerance, 0.01, 0);
+    }
+
+    if(counting_allocs && baseline_value(start, end, "allocs_per_op", &base)) {
+        ok &= check_value(result->name, "allocs_per_op", base, (double)result->allocs / ops, tolerance, 0.05, 0);
+    }
+
+    return ok;
+}
+
+
+static pid_t spawn_server(const char *server_path, const char **server_opts, int num_server_opts)
+{
+    const char *argv[MAX_SERVER_OPTS + 8];
+    int argc = 0;
+    char path_arg[64];
+    pid_t pid;
+
+    snprintf(path_arg, sizeof(path_arg), "--path=%s", plc_path);
+
+    argv[argc++] = server_path;
+    argv[argc++] = "--plc=ControlLogix";
+    argv[argc++] = path_arg;
+    argv[argc++] = "--tag=" SMALL_TAG_DEF;
+    argv[argc++] = "--tag=" BIG_TAG_DEF;
+
+    for(int i=0; i < num_server_opts; i++) {
+        argv[argc++] = server_opts[i];
+    }
+
+    argv[argc] = NULL;
+
+    pid = fork();
+
+    if(pid == 0) {
+        /* keep the simulator quiet. */
+        if(!freopen("/dev/null", "w", stderr)) {
+            _exit(1);
+        }
+
+        execv(server_path, (char * const *)argv);
+        _exit(1);
+    }
+
+    /* give it time to start listening. */
+    sleep_ms(500);
+
+    return pid;
+}
+
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: plctag_bench [--spawn=<ab_server>] [--gateway=<ip>] [--path=<path>] [--duration_ms=<ms>] [--scenario=<name>] [--server_opt=<opt>]...\n");
+    fprintf(stderr, "                    [--baseline=<json file>] [--tolerance=<percent>] [--latency_tolerance=<percent>]\n");
+    fprintf(stderr, "Scenarios:");
+
+    for(int i=0; i < NUM_SCENARIOS; i++) {
+        fprintf(stderr, " %s", scenarios[i].name);
+    }
+
+    fprintf(stderr, "\n");
+
+    exit(1);
+}
+
+
+int main(int argc, char **argv)
+{
+    const char *server_path = NULL;
+    const char *server_opts[MAX_SERVER_OPTS];
+    int num_server_opts = 0;
+    const char *only = NULL;
+    result_s results[NUM_SCENARIOS];
+    int num_results = 0;
+    pid_t server_pid = 0;
+    const char *baseline_file = NULL;
+    char *baseline = NULL;
+    double tolerance = DEFAULT_TOLERANCE;
+    double latency_tolerance = DEFAULT_LATENCY_TOLERANCE;
+    int failed = 0;
+
+    /* this has to come before anything else in the library. */
+    counting_allocs = (plc_tag_set_allocator(count_alloc, count_realloc, free) == PLCTAG_STATUS_OK);
+
+    for(int i=1; i < argc; i++) {
+        if(strncmp(argv[i], "--spawn=", 8) == 0) {
+            server_path = &argv[i][8];
+        } else if(strncmp(argv[i], "--gateway=", 10) == 0) {
+            gateway = &argv[i][10];
+        } else if(strncmp(argv[i], "--path=", 7) == 0) {
+            plc_path = &argv[i][7];
+        } else if(strncmp(argv[i], "--duration_ms=", 14) == 0) {
+            duration_ms = atoi(&argv[i][14]);
+        } else if(strncmp(argv[i], "--scenario=", 11) == 0) {
+            only = &argv[i][11];
+        } else if(strncmp(argv[i], "--server_opt=", 13) == 0 && num_server_opts < MAX_SERVER_OPTS) {
+            server_opts[num_server_opts++] = &argv[i][13];
+        } else if(strncmp(argv[i], "--baseline=", 11) == 0) {
+            baseline_file = &argv[i][11];
+        } else if(strncmp(argv[i], "--tolerance=", 12) == 0) {
+            tolerance = atof(&argv[i][12]);
+        } else if(strncmp(argv[i], "--latency_tolerance=", 20) == 0) {
+            latency_tolerance = atof(&argv[i][20]);
+        } else {
+            usage();
+        }
+    }
+
+    if(plc_tag_check_lib_version(2, 1, 0) != PLCTAG_STATUS_OK) {
+        fprintf(stderr, "Required compatible library version 2.1.0 not available!\n");
+        return 1;
+    }
+
+    if(baseline_file && !(baseline = read_file(baseline_file))) {
+        fprintf(stderr, "Unable to read the baseline %s!\n", baseline_file);
+        return 1;
+    }
+
+    if(server_path) {
+        server_pid = spawn_server(server_path, server_opts, num_server_opts);
+
+        if(server_pid < 0) {
+            fprintf(stderr, "Unable to start %s!\n", server_path);
+            return 1;
+        }
+    }
+
+    memset(results, 0, sizeof(results));
+
+    for(int i=0; i < NUM_SCENARIOS; i++) {
+        if(only && strcmp(only, scenarios[i].name) != 0) {
+            continue;
+        }
+
+        fprintf(stderr, "Running %s.\n", scenarios[i].name);
+
+        results[num_results].name = scenarios[i].name;
+        scenarios[i].run(&results[num_results]);
+        num_results++;
+    }
+
+    printf("{\n");
+    printf("  \"version\": 1,\n");
+    printf("  \"gateway\": \"%s\",\n", gateway);
+    printf("  \"duration_ms\": %d,\n", duration_ms);
+    printf("  \"scenarios\": [\n");
+
+    for(int i=0; i < num_results; i++) {
+        print_result(&results[i], i == num_results - 1);
+    }
+
+    printf("  ]\n");
+    printf("}\n");
+
+    if(baseline) {
+        fprintf(stderr, "Comparing with %s, tolerance %.1f%%, latency tolerance %.1f%%:\n", baseline_file, tolerance, latency_tolerance);
+
+        for(int i=0; i < num_results; i++) {
+            if(!check_result(baseline, &results[i], tolerance, latency_tolerance)) {
+                failed++;
+            }
+        }
+
+        fprintf(stderr, "%s: %d of %d scenarios regressed.\n", (failed ? "FAIL" : "PASS"), failed, num_results);
+
+        free(baseline);
+    }
+
+    for(int i=0; i < num_results; i++) {
+        free(results[i].latency.samples);
+    }
+
+    if(server_pid > 0) {
+        kill(server_pid, SIGTERM);
+        waitpid(server_pid, NULL, 0);
+    }
+
+    plc_tag_shutdown();
+
+    return (failed ? 2 : 0);
+}
@@ -0,0 +1,326 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/*
+ * A Modbus TCP server for testing and benchmarking the Modbus tag code
+ * without hardware.  It shares the TCP server and the load emulation with
+ * ab_server.
+ */
+
+#include "../../ab_server/src/compat.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(IS_WINDOWS)
+#include <Windows.h>
+#else
+ /* assume it is POSIX of some sort... */
+#include <signal.h>
+#include <strings.h>
+#endif
+
+#include "modbus.h"
+#include "../../ab_server/src/slice.h"
+#include "../../ab_server/src/tcp_server.h"
+#include "../../ab_server/src/utils.h"
+
+#define DEFAULT_PORT "502"
+
+static void usage(void);
+static void process_args(int argc, const char **argv, mb_server_s *server, const char **port, tcp_server_emulation_s *emu);
+static int parse_size(const char *arg, const char *name);
+static void add_unit(mb_server_s *server, int unit_id);
+static void allocate_units(mb_server_s *server);
+static slice_s request_handler(slice_s input, slice_s output, void *server);
+
+
+#ifdef IS_WINDOWS
+
+typedef volatile int sig_flag_t;
+
+sig_flag_t done = 0;
+
+int WINAPI CtrlHandler(DWORD fdwCtrlType)
+{
+    switch (fdwCtrlType)
+    {
+    case CTRL_C_EVENT:
+    case CTRL_CLOSE_EVENT:
+    case CTRL_BREAK_EVENT:
+    case CTRL_LOGOFF_EVENT:
+    case CTRL_SHUTDOWN_EVENT:
+        info("Got event %d, shutting down.", fdwCtrlType);
+        done = 1;
+        return TRUE;
+
+    default:
+        info("Default Event: %d", fdwCtrlType);
+        return FALSE;
+    }
+}
+
+
+void setup_break_handler(void)
+{
+    if (!SetConsoleCtrlHandler(CtrlHandler, TRUE))
+    {
+        printf("\nERROR: Could not set control handler!\n");
+        usage();
+    }
+}
+
+#else
+
+typedef volatile sig_atomic_t sig_flag_t;
+
+sig_flag_t done = 0;
+
+void SIGINT_handler(int not_used)
+{
+    (void)not_used;
+
+    done = 1;
+}
+
+void setup_break_handler(void)
+{
+    struct sigaction act;
+
+    /* set up signal handler. */
+    memset(&act, 0, sizeof(act));
+    act.sa_handler = SIGINT_handler;
+    sigaction(SIGINT, &act, NULL);
+    sigaction(SIGTERM, &act, NULL);
+}
+
+#endif
+
+
+int main(int argc, const char **argv)
+{
+    tcp_server_p tcp_server = NULL;
+    uint8_t buf[512];  /* a Modbus TCP ADU is at most 260 bytes. */
+    slice_s server_buf = slice_make(buf, sizeof(buf));
+    mb_server_s server;
+    const char *port = DEFAULT_PORT;
+    tcp_server_emulation_s emu;
+
+    /* set up handler for ^C etc. */
+    setup_break_handler();
+
+    debug_off();
+
+    memset(&server, 0, sizeof(server));
+    memset(&emu, 0, sizeof(emu));
+
+    server.num_coils = MB_MAX_ADDRESSES;
+    server.num_discrete_inputs = MB_MAX_ADDRESSES;
+    server.num_holding_registers = MB_MAX_ADDRESSES;
+    server.num_input_registers = MB_MAX_ADDRESSES;
+
+    /* set the random seed. */
+    srand((unsigned int)time(NULL));
+
+    process_args(argc, argv, &server, &port, &emu);
+
+    allocate_units(&server);
+
+    tcp_server = tcp_server_create("0.0.0.0", port, server_buf, request_handler, &server, sizeof(server));
+
+    tcp_server_set_framing(tcp_server, MBAP_HEADER_SIZE, mb_packet_size);
+    tcp_server_set_emulation(tcp_server, &emu);
+
+    fprintf(stderr, "Serving %d unit(s) on port %s.\n", server.num_units, port);
+
+    tcp_server_start(tcp_server, &done);
+
+    tcp_server_destroy(tcp_server);
+
+    for(int i=0; i < server.num_units; i++) {
+        free(server.units[i].coils);
+        free(server.units[i].discrete_inputs);
+        free(server.units[i].holding_registers);
+        free(server.units[i].input_registers);
+    }
+
+    return 0;
+}
+
+
+void usage(void)
+{
+    fprintf(stderr, "Usage: modbus_server [--port=<port>] [--unit=<id>[,<id>...]] [<sizes>] [<load emulation>] [--debug]\n"
+                    "   <port> = the TCP port to listen on, default 502.\n"
+                    "\n"
+                    "   <id> = a unit ID from 0 to 255 to answer for.  Can be given more than once.\n"
+                    "          Each unit has its own data.  The default is unit 1.  Requests for\n"
+                    "          other units get exception 0x0B, gateway target failed to respond.\n"
+                    "\n"
+                    "   Sizes of the data spaces in each unit, all default to 65536:\n"
+                    "        --coils=<n>\n"
+                    "        --discrete_inputs=<n>\n"
+                    "        --holding_registers=<n>\n"
+                    "        --input_registers=<n>\n"
+                    "   Reads and writes past the end get exception 0x02.  Coils and holding\n"
+                    "   registers start as zero.  Discrete inputs alternate 0 and 1, and each\n"
+                    "   input register holds its own address.\n"
+                    "\n"
+                    "   Function codes 1 to 6, 15, 16 and 23 are supported.\n"
+                    "\n"
+                    TCP_SERVER_EMULATION_USAGE
+                    "   --max_in_flight limits the transactions in progress across all clients.\n"
+                    "\n"
+                    "Example: modbus_server --port=5020 --unit=1,2 --holding_registers=1000 --delay=5\n");
+
+    exit(1);
+}
+
+
+void process_args(int argc, const char **argv, mb_server_s *server, const char **port, tcp_server_emulation_s *emu)
+{
+    for(int i=1; i < argc; i++) {
+        int rc = tcp_server_parse_emulation_arg(argv[i], emu);
+
+        if(rc < 0) {
+            usage();
+        } else if(rc > 0) {
+            continue;
+        }
+
+        if(strncmp(argv[i], "--port=", 7) == 0) {
+            *port = &argv[i][7];
+        } else if(strncmp(argv[i], "--unit=", 7) == 0) {
+            const char *ids = &argv[i][7];
+
+            while(*ids) {
+                char *end = NULL;
+                long unit_id = strtol(ids, &end, 10);
+
+                if(end == ids || unit_id < 0 || unit_id > 255) {
+                    fprintf(stderr, "Unable to parse unit IDs in \"%s\"!\n", argv[i]);
+                    usage();
+                }
+
+                add_unit(server, (int)unit_id);
+
+                ids = (*end == ',' ? end + 1 : end);
+            }
+        } else if(strncmp(argv[i], "--coils=", 8) == 0) {
+            server->num_coils = parse_size(&argv[i][8], "coils");
+        } else if(strncmp(argv[i], "--discrete_inputs=", 18) == 0) {
+            server->num_discrete_inputs = parse_size(&argv[i][18], "discrete inputs");
+        } else if(strncmp(argv[i], "--holding_registers=", 20) == 0) {
+            server->num_holding_registers = parse_size(&argv[i][20], "holding registers");
+        } else if(strncmp(argv[i], "--input_registers=", 18) == 0) {
+            server->num_input_registers = parse_size(&argv[i][18], "input registers");
+        } else if(strcmp(argv[i], "--debug") == 0) {
+            debug_on();
+        } else {
+            fprintf(stderr, "Unknown argument \"%s\"!\n", argv[i]);
+            usage();
+        }
+    }
+
+    if(server->num_units == 0) {
+        add_unit(server, 1);
+    }
+}
+
+
+int parse_size(const char *arg, const char *name)
+{
+    int size = atoi(arg);
+
+    if(size < 0 || size > MB_MAX_ADDRESSES) {
+        fprintf(stderr, "The number of %s must be from 0 to %d!\n", name, MB_MAX_ADDRESSES);
+        usage();
+    }
+
+    return size;
+}
+
+
+void add_unit(mb_server_s *server, int unit_id)
+{
+    for(int i=0; i < server->num_units; i++) {
+        if(server->units[i].unit_id == (uint8_t)unit_id) {
+            return;
+        }
+    }
+
+    if(server->num_units >= MB_MAX_UNITS) {
+        fprintf(stderr, "No more than %d units are supported!\n", MB_MAX_UNITS);
+        usage();
+    }
+
+    server->units[server->num_units].unit_id = (uint8_t)unit_id;
+    server->num_units++;
+}
+
+
+void allocate_units(mb_server_s *server)
+{
+    for(int i=0; i < server->num_units; i++) {
+        mb_unit_s *unit = &server->units[i];
+
+        /* one extra so that a zero size is still a valid allocation. */
+        unit->coils = calloc((size_t)server->num_coils + 1, sizeof(*unit->coils));
+        unit->discrete_inputs = calloc((size_t)server->num_discrete_inputs + 1, sizeof(*unit->discrete_inputs));
+        unit->holding_registers = calloc((size_t)server->num_holding_registers + 1, sizeof(*unit->holding_registers));
+        unit->input_registers = calloc((size_t)server->num_input_registers + 1, sizeof(*unit->input_registers));
+
+        if(!unit->coils || !unit->discrete_inputs || !unit->holding_registers || !unit->input_registers) {
+            error("Unable to allocate data for unit %u!", (unsigned int)unit->unit_id);
+        }
+
+        /* known values to check reads against. */
+        for(int j=0; j < server->num_discrete_inputs; j++) {
+            unit->discrete_inputs[j] = (uint8_t)(j & 0x01);
+        }
+
+        for(int j=0; j < server->num_input_registers; j++) {
+            unit->input_registers[j] = (uint16_t)j;
+        }
+    }
+}
+
+
+slice_s request_handler(slice_s input, slice_s output, void *server)
+{
+    return mb_dispatch_request(input, output, (mb_server_s *)server);
+}
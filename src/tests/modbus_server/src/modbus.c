@@ -0,0 +1,485 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "modbus.h"
+#include "../../ab_server/src/slice.h"
+#include "../../ab_server/src/tcp_server.h"
+#include "../../ab_server/src/utils.h"
+
+
+/* function codes. */
+#define MB_READ_COILS (0x01)
+#define MB_READ_DISCRETE_INPUTS (0x02)
+#define MB_READ_HOLDING_REGISTERS (0x03)
+#define MB_READ_INPUT_REGISTERS (0x04)
+#define MB_WRITE_SINGLE_COIL (0x05)
+#define MB_WRITE_SINGLE_REGISTER (0x06)
+#define MB_WRITE_MULTIPLE_COILS (0x0F)
+#define MB_WRITE_MULTIPLE_REGISTERS (0x10)
+#define MB_READ_WRITE_MULTIPLE_REGISTERS (0x17)
+
+/* exception codes. */
+#define MB_OK (0x00)
+#define MB_EX_ILLEGAL_FUNCTION (0x01)
+#define MB_EX_ILLEGAL_DATA_ADDRESS (0x02)
+#define MB_EX_ILLEGAL_DATA_VALUE (0x03)
+#define MB_EX_GATEWAY_TARGET_FAILED (0x0B)
+
+/* quantity limits from the specification, they keep the PDU under 253 bytes. */
+#define MB_MAX_READ_BITS (2000)
+#define MB_MAX_READ_REGISTERS (125)
+#define MB_MAX_WRITE_BITS (1968)
+#define MB_MAX_WRITE_REGISTERS (123)
+#define MB_MAX_RW_WRITE_REGISTERS (121)
+
+
+static mb_unit_s *find_unit(mb_server_s *server, uint8_t unit_id);
+static int read_bits(slice_s pdu, slice_s response, const uint8_t *bits, int num_bits, size_t *response_len);
+static int read_registers(slice_s pdu, slice_s response, const uint16_t *registers, int num_registers, size_t *response_len);
+static int write_single_coil(slice_s pdu, mb_unit_s *unit, int num_coils, size_t *response_len);
+static int write_single_register(slice_s pdu, mb_unit_s *unit, int num_registers, size_t *response_len);
+static int write_coils(slice_s pdu, mb_unit_s *unit, int num_coils, size_t *response_len);
+static int write_registers(slice_s pdu, mb_unit_s *unit, int num_registers, size_t *response_len);
+static int read_write_registers(slice_s pdu, slice_s response, mb_unit_s *unit, int num_registers, size_t *response_len);
+static bool check_range(int address, int quantity, int max_quantity, int limit, int *rc);
+
+
+/* Modbus is big endian. */
+static inline uint16_t get_uint16_be(slice_s s, size_t index) { return (uint16_t)(((unsigned int)slice_get_uint8(s, index) << 8) | (unsigned int)slice_get_uint8(s, index + 1)); }
+static inline void set_uint16_be(slice_s s, size_t index, uint16_t val) { slice_set_uint8(s, index, (uint8_t)(val >> 8)); slice_set_uint8(s, index + 1, (uint8_t)(val & 0xFF)); }
+
+
+
+/*
+ * The MBAP length field counts the unit ID and the PDU.  A length too
+ * short to hold a function code can not be framed and drops the client.
+ */
+size_t mb_packet_size(slice_s header)
+{
+    size_t length = get_uint16_be(header, 4);
+
+    if(length < 2) {
+        return SIZE_MAX;
+    }
+
+    return (MBAP_HEADER_SIZE - 1) + length;
+}
+
+
+
+/*
+ * Handle one request.  The response is built in the same buffer, over the
+ * request, so each handler picks up the request fields it needs before it
+ * writes anything.
+ */
+slice_s mb_dispatch_request(slice_s input, slice_s output, mb_server_s *server)
+{
+    uint16_t protocol_id = 0;
+    uint8_t unit_id = 0;
+    uint8_t function = 0;
+    slice_s pdu;
+    slice_s response;
+    size_t response_len = 0;
+    mb_unit_s *unit = NULL;
+    int rc = MB_OK;
+
+    info("Starting.");
+
+    if(slice_len(input) < MBAP_HEADER_SIZE + 1) {
+        info("WARN: request is too short!");
+        return slice_make_err(TCP_SERVER_BAD_REQUEST);
+    }
+
+    protocol_id = get_uint16_be(input, 2);
+    unit_id = slice_get_uint8(input, 6);
+    function = slice_get_uint8(input, 7);
+
+    if(protocol_id != 0) {
+        info("WARN: unsupported protocol ID %u!", (unsigned int)protocol_id);
+        return slice_make_err(TCP_SERVER_BAD_REQUEST);
+    }
+
+    pdu = slice_from_slice(input, MBAP_HEADER_SIZE, slice_len(input) - MBAP_HEADER_SIZE);
+    response = slice_from_slice(output, MBAP_HEADER_SIZE, slice_len(output) - MBAP_HEADER_SIZE);
+
+    info("Unit %u function 0x%02x with %zu bytes of PDU.", (unsigned int)unit_id, (unsigned int)function, slice_len(pdu));
+
+    unit = find_unit(server, unit_id);
+    if(!unit) {
+        info("WARN: no unit %u!", (unsigned int)unit_id);
+        rc = MB_EX_GATEWAY_TARGET_FAILED;
+    } else {
+        switch(function) {
+            case MB_READ_COILS:
+                rc = read_bits(pdu, response, unit->coils, server->num_coils, &response_len);
+                break;
+
+            case MB_READ_DISCRETE_INPUTS:
+                rc = read_bits(pdu, response, unit->discrete_inputs, server->num_discrete_inputs, &response_len);
+                break;
+
+            case MB_READ_HOLDING_REGISTERS:
+                rc = read_registers(pdu, response, unit->holding_registers, server->num_holding_registers, &response_len);
+                break;
+
+            case MB_READ_INPUT_REGISTERS:
+                rc = read_registers(pdu, response, unit->input_registers, server->num_input_registers, &response_len);
+                break;
+
+            case MB_WRITE_SINGLE_COIL:
+                rc = write_single_coil(pdu, unit, server->num_coils, &response_len);
+                break;
+
+            case MB_WRITE_SINGLE_REGISTER:
+                rc = write_single_register(pdu, unit, server->num_holding_registers, &response_len);
+                break;
+
+            case MB_WRITE_MULTIPLE_COILS:
+                rc = write_coils(pdu, unit, server->num_coils, &response_len);
+                break;
+
+            case MB_WRITE_MULTIPLE_REGISTERS:
+                rc = write_registers(pdu, unit, server->num_holding_registers, &response_len);
+                break;
+
+            case MB_READ_WRITE_MULTIPLE_REGISTERS:
+                rc = read_write_registers(pdu, response, unit, server->num_holding_registers, &response_len);
+                break;
+
+            default:
+                info("WARN: unsupported function 0x%02x!", (unsigned int)function);
+                rc = MB_EX_ILLEGAL_FUNCTION;
+                break;
+        }
+    }
+
+    if(rc != MB_OK) {
+        info("Sending exception 0x%02x.", (unsigned int)rc);
+        slice_set_uint8(response, 0, (uint8_t)(function | 0x80));
+        slice_set_uint8(response, 1, (uint8_t)rc);
+        response_len = 2;
+    }
+
+    /* the transaction, protocol and unit IDs are echoed. */
+    if(output.data != input.data) {
+        memcpy(output.data, input.data, MBAP_HEADER_SIZE);
+    }
+
+    set_uint16_be(output, 4, (uint16_t)(response_len + 1));
+
+    info("Done.");
+
+    return slice_from_slice(output, 0, MBAP_HEADER_SIZE + response_len);
+}
+
+
+
+mb_unit_s *find_unit(mb_server_s *server, uint8_t unit_id)
+{
+    for(int i=0; i < server->num_units; i++) {
+        if(server->units[i].unit_id == unit_id) {
+            return &server->units[i];
+        }
+    }
+
+    return NULL;
+}
+
+
+
+bool check_range(int address, int quantity, int max_quantity, int limit, int *rc)
+{
+    if(quantity < 1 || quantity > max_quantity) {
+        *rc = MB_EX_ILLEGAL_DATA_VALUE;
+        return false;
+    }
+
+    if(address + quantity > limit) {
+        *rc = MB_EX_ILLEGAL_DATA_ADDRESS;
+        return false;
+    }
+
+    return true;
+}
+
+
+
+/* FC01 and FC02, the bits are packed LSB first. */
+int read_bits(slice_s pdu, slice_s response, const uint8_t *bits, int num_bits, size_t *response_len)
+{
+    int address = 0;
+    int quantity = 0;
+    int byte_count = 0;
+    int rc = MB_OK;
+
+    if(slice_len(pdu) != 5) {
+        return MB_EX_ILLEGAL_DATA_VALUE;
+    }
+
+    address = get_uint16_be(pdu, 1);
+    quantity = get_uint16_be(pdu, 3);
+
+    if(!check_range(address, quantity, MB_MAX_READ_BITS, num_bits, &rc)) {
+        return rc;
+    }
+
+    byte_count = (quantity + 7) / 8;
+
+    slice_set_uint8(response, 1, (uint8_t)byte_count);
+
+    for(int i=0; i < byte_count; i++) {
+        uint8_t packed = 0;
+
+        for(int bit=0; bit < 8 && (i * 8) + bit < quantity; bit++) {
+            if(bits[address + (i * 8) + bit]) {
+                packed |= (uint8_t)(1 << bit);
+            }
+        }
+
+        slice_set_uint8(response, (size_t)(2 + i), packed);
+    }
+
+    *response_len = (size_t)(2 + byte_count);
+
+    return MB_OK;
+}
+
+
+
+/* FC03 and FC04. */
+int read_registers(slice_s pdu, slice_s response, const uint16_t *registers, int num_registers, size_t *response_len)
+{
+    int address = 0;
+    int quantity = 0;
+    int rc = MB_OK;
+
+    if(slice_len(pdu) != 5) {
+        return MB_EX_ILLEGAL_DATA_VALUE;
+    }
+
+    address = get_uint16_be(pdu, 1);
+    quantity = get_uint16_be(pdu, 3);
+
+    if(!check_range(address, quantity, MB_MAX_READ_REGISTERS, num_registers, &rc)) {
+        return rc;
+    }
+
+    slice_set_uint8(response, 1, (uint8_t)(quantity * 2));
+
+    for(int i=0; i < quantity; i++) {
+        set_uint16_be(response, (size_t)(2 + (i * 2)), registers[address + i]);
+    }
+
+    *response_len = (size_t)(2 + (quantity * 2));
+
+    return MB_OK;
+}
+
+
+
+/* FC05, the response is the request. */
+int write_single_coil(slice_s pdu, mb_unit_s *unit, int num_coils, size_t *response_len)
+{
+    int address = 0;
+    uint16_t value = 0;
+
+    if(slice_len(pdu) != 5) {
+        return MB_EX_ILLEGAL_DATA_VALUE;
+    }
+
+    address = get_uint16_be(pdu, 1);
+    value = get_uint16_be(pdu, 3);
+
+    if(value != 0xFF00 && value != 0x0000) {
+        return MB_EX_ILLEGAL_DATA_VALUE;
+    }
+
+    if(address >= num_coils) {
+        return MB_EX_ILLEGAL_DATA_ADDRESS;
+    }
+
+    unit->coils[address] = (value ? 1 : 0);
+
+    *response_len = 5;
+
+    return MB_OK;
+}
+
+
+
+/* FC06, the response is the request. */
+int write_single_register(slice_s pdu, mb_unit_s *unit, int num_registers, size_t *response_len)
+{
+    int address = 0;
+
+    if(slice_len(pdu) != 5) {
+        return MB_EX_ILLEGAL_DATA_VALUE;
+    }
+
+    address = get_uint16_be(pdu, 1);
+
+    if(address >= num_registers) {
+        return MB_EX_ILLEGAL_DATA_ADDRESS;
+    }
+
+    unit->holding_registers[address] = get_uint16_be(pdu, 3);
+
+    *response_len = 5;
+
+    return MB_OK;
+}
+
+
+
+/* FC15, the response is the address and quantity from the request. */
+int write_coils(slice_s pdu, mb_unit_s *unit, int num_coils, size_t *response_len)
+{
+    int address = 0;
+    int quantity = 0;
+    int byte_count = 0;
+    int rc = MB_OK;
+
+    if(slice_len(pdu) < 6) {
+        return MB_EX_ILLEGAL_DATA_VALUE;
+    }
+
+    address = get_uint16_be(pdu, 1);
+    quantity = get_uint16_be(pdu, 3);
+    byte_count = slice_get_uint8(pdu, 5);
+
+    if(byte_count != (quantity + 7) / 8 || slice_len(pdu) != (size_t)(6 + byte_count)) {
+        return MB_EX_ILLEGAL_DATA_VALUE;
+    }
+
+    if(!check_range(address, quantity, MB_MAX_WRITE_BITS, num_coils, &rc)) {
+        return rc;
+    }
+
+    for(int i=0; i < quantity; i++) {
+        uint8_t packed = slice_get_uint8(pdu, (size_t)(6 + (i / 8)));
+
+        unit->coils[address + i] = (uint8_t)((packed >> (i % 8)) & 0x01);
+    }
+
+    *response_len = 5;
+
+    return MB_OK;
+}
+
+
+
+/* FC16, the response is the address and quantity from the request. */
+int write_registers(slice_s pdu, mb_unit_s *unit, int num_registers, size_t *response_len)
+{
+    int address = 0;
+    int quantity = 0;
+    int byte_count = 0;
+    int rc = MB_OK;
+
+    if(slice_len(pdu) < 6) {
+        return MB_EX_ILLEGAL_DATA_VALUE;
+    }
+
+    address = get_uint16_be(pdu, 1);
+    quantity = get_uint16_be(pdu, 3);
+    byte_count = slice_get_uint8(pdu, 5);
+
+    if(byte_count != quantity * 2 || slice_len(pdu) != (size_t)(6 + byte_count)) {
+        return MB_EX_ILLEGAL_DATA_VALUE;
+    }
+
+    if(!check_range(address, quantity, MB_MAX_WRITE_REGISTERS, num_registers, &rc)) {
+        return rc;
+    }
+
+    for(int i=0; i < quantity; i++) {
+        unit->holding_registers[address + i] = get_uint16_be(pdu, (size_t)(6 + (i * 2)));
+    }
+
+    *response_len = 5;
+
+    return MB_OK;
+}
+
+
+
+/* FC23, the write is done before the read. */
+int read_write_registers(slice_s pdu, slice_s response, mb_unit_s *unit, int num_registers, size_t *response_len)
+{
+    int read_address = 0;
+    int read_quantity = 0;
+    int write_address = 0;
+    int write_quantity = 0;
+    int byte_count = 0;
+    int rc = MB_OK;
+
+    if(slice_len(pdu) < 10) {
+        return MB_EX_ILLEGAL_DATA_VALUE;
+    }
+
+    read_address = get_uint16_be(pdu, 1);
+    read_quantity = get_uint16_be(pdu, 3);
+    write_address = get_uint16_be(pdu, 5);
+    write_quantity = get_uint16_be(pdu, 7);
+    byte_count = slice_get_uint8(pdu, 9);
+
+    if(byte_count != write_quantity * 2 || slice_len(pdu) != (size_t)(10 + byte_count)) {
+        return MB_EX_ILLEGAL_DATA_VALUE;
+    }
+
+    if(!check_range(read_address, read_quantity, MB_MAX_READ_REGISTERS, num_registers, &rc)) {
+        return rc;
+    }
+
+    if(!check_range(write_address, write_quantity, MB_MAX_RW_WRITE_REGISTERS, num_registers, &rc)) {
+        return rc;
+    }
+
+    for(int i=0; i < write_quantity; i++) {
+        unit->holding_registers[write_address + i] = get_uint16_be(pdu, (size_t)(10 + (i * 2)));
+    }
+
+    slice_set_uint8(response, 1, (uint8_t)(read_quantity * 2));
+
+    for(int i=0; i < read_quantity; i++) {
+        set_uint16_be(response, (size_t)(2 + (i * 2)), unit->holding_registers[read_address + i]);
+    }
+
+    *response_len = (size_t)(2 + (read_quantity * 2));
+
+    return MB_OK;
+}
@@ -0,0 +1,66 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include "../../ab_server/src/slice.h"
+
+#define MB_MAX_UNITS (32)
+#define MB_MAX_ADDRESSES (65536)
+
+/* transaction ID, protocol ID, length and unit ID. */
+#define MBAP_HEADER_SIZE (7)
+
+/* one unit ID and its data. */
+typedef struct {
+    uint8_t unit_id;
+    uint8_t *coils;             /* one byte per bit. */
+    uint8_t *discrete_inputs;
+    uint16_t *holding_registers;
+    uint16_t *input_registers;
+} mb_unit_s;
+
+/* the data is allocated once and shared by all the client connections. */
+typedef struct {
+    int num_coils;
+    int num_discrete_inputs;
+    int num_holding_registers;
+    int num_input_registers;
+
+    int num_units;
+    mb_unit_s units[MB_MAX_UNITS];
+} mb_server_s;
+
+extern size_t mb_packet_size(slice_s header);
+extern slice_s mb_dispatch_request(slice_s input, slice_s output, mb_server_s *server);
@@ -0,0 +1,418 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/*
+ * An EtherNet/IP proxy.  It looks like a ControlLogix to its clients and
+ * serves the tags it is told about from one libplctag connection to the
+ * real PLC.  Many clients can then share a PLC that has few connection
+ * slots, and clients reading the same tags share the PLC reads.  See
+ * proxy.c for how reads and writes are passed on.
+ *
+ * The client side is the ab_server code.
+ */
+
+#include "../../ab_server/src/compat.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(IS_WINDOWS)
+#include <Windows.h>
+#else
+ /* assume it is POSIX of some sort... */
+#include <signal.h>
+#include <strings.h>
+#endif
+
+#include "../../../lib/libplctag.h"
+#include "proxy.h"
+#include "../../ab_server/src/eip.h"
+#include "../../ab_server/src/plc.h"
+#include "../../ab_server/src/slice.h"
+#include "../../ab_server/src/tcp_server.h"
+#include "../../ab_server/src/utils.h"
+
+#define DEFAULT_PORT "44818"
+#define DEFAULT_PATH "1,0"
+#define DEFAULT_CACHE_MS (100)
+#define DEFAULT_TIMEOUT_MS (5000)
+
+static void usage(void);
+static void process_args(int argc, const char **argv, plc_s *plc, proxy_s *proxy, const char **port, tcp_server_emulation_s *emu);
+static void parse_path(const char *path_str, plc_s *plc);
+static void parse_tag(const char *tag_str, plc_s *plc);
+static slice_s request_handler(slice_s input, slice_s output, void *plc);
+
+
+#ifdef IS_WINDOWS
+
+typedef volatile int sig_flag_t;
+
+sig_flag_t done = 0;
+
+int WINAPI CtrlHandler(DWORD fdwCtrlType)
+{
+    switch (fdwCtrlType)
+    {
+    case CTRL_C_EVENT:
+    case CTRL_CLOSE_EVENT:
+    case CTRL_BREAK_EVENT:
+    case CTRL_LOGOFF_EVENT:
+    case CTRL_SHUTDOWN_EVENT:
+        info("Got event %d, shutting down.", fdwCtrlType);
+        done = 1;
+        return TRUE;
+
+    default:
+        info("Default Event: %d", fdwCtrlType);
+        return FALSE;
+    }
+}
+
+
+void setup_break_handler(void)
+{
+    if (!SetConsoleCtrlHandler(CtrlHandler, TRUE))
+    {
+        printf("\nERROR: Could not set control handler!\n");
+        usage();
+    }
+}
+
+#else
+
+typedef volatile sig_atomic_t sig_flag_t;
+
+sig_flag_t done = 0;
+
+void SIGINT_handler(int not_used)
+{
+    (void)not_used;
+
+    done = 1;
+}
+
+void setup_break_handler(void)
+{
+    struct sigaction act;
+
+    /* set up signal handler. */
+    memset(&act, 0, sizeof(act));
+    act.sa_handler = SIGINT_handler;
+    sigaction(SIGINT, &act, NULL);
+    sigaction(SIGTERM, &act, NULL);
+}
+
+#endif
+
+
+int main(int argc, const char **argv)
+{
+    tcp_server_p server = NULL;
+    uint8_t buf[4200];  /* CIP only allows 4002 for the CIP request, but there is overhead. */
+    slice_s server_buf = slice_make(buf, sizeof(buf));
+    plc_s plc;
+    proxy_s proxy;
+    const char *port = DEFAULT_PORT;
+    tcp_server_emulation_s emu;
+
+    /* set up handler for ^C etc. */
+    setup_break_handler();
+
+    debug_off();
+
+    memset(&plc, 0, sizeof(plc));
+    memset(&proxy, 0, sizeof(proxy));
+    memset(&emu, 0, sizeof(emu));
+
+    /* the clients see a ControlLogix. */
+    plc.plc_type = PLC_CONTROL_LOGIX;
+    plc.path[2] = (uint8_t)0x20;
+    plc.path[3] = (uint8_t)0x02;
+    plc.path[4] = (uint8_t)0x24;
+    plc.path[5] = (uint8_t)0x01;
+    plc.path_len = 6;
+    plc.client_to_server_max_packet = 508;
+    plc.server_to_client_max_packet = 508;
+    parse_path(DEFAULT_PATH, &plc);
+
+    proxy.path = DEFAULT_PATH;
+    proxy.plc = "ControlLogix";
+    proxy.cache_ms = DEFAULT_CACHE_MS;
+    proxy.timeout_ms = DEFAULT_TIMEOUT_MS;
+
+    /* set the random seed. */
+    srand((unsigned int)time(NULL));
+
+    process_args(argc, argv, &plc, &proxy, &port, &emu);
+
+    proxy_connect(&proxy, plc.tags);
+
+    plc.tag_fetch = proxy_tag_fetch;
+    plc.tag_store = proxy_tag_store;
+    plc.hook_context = &proxy;
+
+    server = tcp_server_create("0.0.0.0", port, server_buf, request_handler, &plc, sizeof(plc));
+
+    tcp_server_set_emulation(server, &emu);
+
+    fprintf(stderr, "Proxying for %s on port %s.\n", proxy.gateway, port);
+
+    tcp_server_start(server, &done);
+
+    tcp_server_destroy(server);
+
+    fprintf(stderr, "Client reads: %llu, from the cache: %llu, PLC reads: %llu in %llu batches, PLC writes: %llu.\n",
+            (unsigned long long)proxy.client_reads, (unsigned long long)proxy.cache_hits,
+            (unsigned long long)proxy.upstream_reads, (unsigned long long)proxy.upstream_batches,
+            (unsigned long long)proxy.upstream_writes);
+
+    proxy_disconnect(&proxy, plc.tags);
+
+    plc_tag_shutdown();
+
+    while(plc.tags) {
+        tag_def_s *tag = plc.tags;
+
+        plc.tags = tag->next_tag;
+
+        free(tag->name);
+        free(tag->data);
+        free(tag);
+    }
+
+    return 0;
+}
+
+
+void usage(void)
+{
+    fprintf(stderr, "Usage: plc_proxy --upstream=<gateway> [--upstream_path=<path>] [--upstream_plc=<plc type>]\n"
+                    "                 [--port=<port>] [--path=<path>] [--cache_ms=<ms>] [--timeout=<ms>]\n"
+                    "                 --tag=<tag> [<load emulation>] [--debug]\n"
+                    "   <gateway> = the host name or IP address of the PLC, with \":<port>\" if it is not 44818.\n"
+                    "   --upstream_path = the path to the PLC CPU, default \"" DEFAULT_PATH "\".\n"
+                    "   --upstream_plc = the libplctag PLC type, default \"ControlLogix\".\n"
+                    "\n"
+                    "   The clients see a ControlLogix:\n"
+                    "   --port = the TCP port to listen on, default " DEFAULT_PORT ".\n"
+                    "   --path = the path the clients use, two numbers, default \"" DEFAULT_PATH "\".\n"
+                    "\n"
+                    "   --cache_ms = how long data read from the PLC is served to the clients, default 100.\n"
+                    "                Zero reads the PLC for every client read.\n"
+                    "   --timeout = how long to wait for the PLC, default 5000.\n"
+                    "\n"
+                    "   Only the tags given are served.  They are in the format: <name>:<type>[<sizes>] where:\n"
+                    "        <name> is the tag name on the PLC.\n"
+                    "        <type> is one of SINT, INT, DINT, LINT, REAL, LREAL or STRING.\n"
+                    "        <sizes> field is one or more (up to 3) numbers separated by commas.\n"
+                    "\n"
+                    TCP_SERVER_EMULATION_USAGE
+                    "\n"
+                    "Example: plc_proxy --upstream=10.1.2.3 --port=44819 --tag=MyTag:DINT[10,10]\n");
+
+    exit(1);
+}
+
+
+void process_args(int argc, const char **argv, plc_s *plc, proxy_s *proxy, const char **port, tcp_server_emulation_s *emu)
+{
+    for(int i=1; i < argc; i++) {
+        int rc = tcp_server_parse_emulation_arg(argv[i], emu);
+
+        if(rc < 0) {
+            usage();
+        } else if(rc > 0) {
+            continue;
+        }
+
+        if(strncmp(argv[i], "--upstream=", 11) == 0) {
+            proxy->gateway = &argv[i][11];
+        } else if(strncmp(argv[i], "--upstream_path=", 16) == 0) {
+            proxy->path = (argv[i][16] ? &argv[i][16] : NULL);
+        } else if(strncmp(argv[i], "--upstream_plc=", 15) == 0) {
+            proxy->plc = &argv[i][15];
+        } else if(strncmp(argv[i], "--port=", 7) == 0) {
+            *port = &argv[i][7];
+        } else if(strncmp(argv[i], "--path=", 7) == 0) {
+            parse_path(&argv[i][7], plc);
+        } else if(strncmp(argv[i], "--cache_ms=", 11) == 0) {
+            proxy->cache_ms = atoi(&argv[i][11]);
+        } else if(strncmp(argv[i], "--timeout=", 10) == 0) {
+            proxy->timeout_ms = atoi(&argv[i][10]);
+        } else if(strncmp(argv[i], "--tag=", 6) == 0) {
+            parse_tag(&argv[i][6], plc);
+        } else if(strcmp(argv[i], "--debug") == 0) {
+            debug_on();
+        } else {
+            fprintf(stderr, "Unknown argument \"%s\"!\n", argv[i]);
+            usage();
+        }
+    }
+
+    if(!proxy->gateway) {
+        fprintf(stderr, "You must pass an --upstream= argument!\n");
+        usage();
+    }
+
+    if(proxy->cache_ms < 0 || proxy->timeout_ms <= 0) {
+        fprintf(stderr, "The cache time must not be negative and the timeout must be positive!\n");
+        usage();
+    }
+
+    if(!plc->tags) {
+        fprintf(stderr, "You must define at least one tag.\n");
+        usage();
+    }
+}
+
+
+void parse_path(const char *path_str, plc_s *plc)
+{
+    int tmp_path[2];
+
+    if (str_scanf(path_str, "%d,%d", &tmp_path[0], &tmp_path[1]) == 2) {
+        plc->path[0] = (uint8_t)tmp_path[0];
+        plc->path[1] = (uint8_t)tmp_path[1];
+    } else {
+        fprintf(stderr, "Error processing path \"%s\"!  Path must be two numbers separated by a comma.\n", path_str);
+        usage();
+    }
+}
+
+
+void parse_tag(const char *tag_str, plc_s *plc)
+{
+    static const struct {
+        const char *name;
+        tag_type_t tag_type;
+        size_t elem_size;
+    } types[] = {
+        { "SINT", TAG_CIP_TYPE_SINT, 1 },
+        { "INT", TAG_CIP_TYPE_INT, 2 },
+        { "DINT", TAG_CIP_TYPE_DINT, 4 },
+        { "LINT", TAG_CIP_TYPE_LINT, 8 },
+        { "REAL", TAG_CIP_TYPE_REAL, 4 },
+        { "LREAL", TAG_CIP_TYPE_LREAL, 8 },
+        { "STRING", TAG_CIP_TYPE_STRING, 88 }
+    };
+    tag_def_s *tag = calloc(1, sizeof(*tag));
+    const char *colon = strrchr(tag_str, ':');
+    char type_str[20] = { 0 };
+    size_t type_len = 0;
+    int num_dims = 0;
+
+    if(!tag) {
+        error("Unable to allocate memory for new tag!");
+    }
+
+    /* the last colon, program tags have one in the name. */
+    if(!colon || colon == tag_str) {
+        fprintf(stderr, "Unable to parse tag definition string, cannot find the name and type in \"%s\"!\n", tag_str);
+        usage();
+    }
+
+    type_len = strspn(colon + 1, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ");
+    if(!type_len || type_len >= sizeof(type_str) || colon[1 + type_len] != '[') {
+        fprintf(stderr, "Unable to parse tag definition string, cannot match the type in \"%s\"!\n", tag_str);
+        usage();
+    }
+
+    memcpy(type_str, colon + 1, type_len);
+
+    for(size_t i=0; i < sizeof(types)/sizeof(types[0]); i++) {
+        if(str_cmp_i(type_str, types[i].name) == 0) {
+            tag->tag_type = types[i].tag_type;
+            tag->elem_size = types[i].elem_size;
+        }
+    }
+
+    if(!tag->elem_size) {
+        fprintf(stderr, "Unsupported tag type \"%s\"!\n", type_str);
+        usage();
+    }
+
+    num_dims = str_scanf(colon + 1 + type_len, "[%zu,%zu,%zu]", &tag->dimensions[0], &tag->dimensions[1], &tag->dimensions[2]);
+    if(num_dims < 1 || num_dims > 3 || tag->dimensions[0] == 0 || (num_dims > 1 && tag->dimensions[1] == 0) || (num_dims > 2 && tag->dimensions[2] == 0)) {
+        fprintf(stderr, "Tag dimensions must be one to three numbers that are not zero in \"%s\"!\n", tag_str);
+        usage();
+    }
+
+    tag->num_dimensions = (size_t)num_dims;
+    tag->elem_count = tag->dimensions[0];
+
+    for(int i=1; i < 3; i++) {
+        if(i < num_dims) {
+            tag->elem_count *= tag->dimensions[i];
+        } else {
+            tag->dimensions[i] = 1;
+        }
+    }
+
+    tag->name = calloc(1, (size_t)(colon - tag_str) + 1);
+    tag->data = calloc(tag->elem_count, tag->elem_size);
+    if(!tag->name || !tag->data) {
+        error("Unable to allocate memory for tag \"%s\"!", tag_str);
+    }
+
+    memcpy(tag->name, tag_str, (size_t)(colon - tag_str));
+
+    /* add the tag to the list. */
+    tag->next_tag = plc->tags;
+    plc->tags = tag;
+}
+
+
+/*
+ * Process each request.  Dispatch to the correct
+ * request type handler.
+ */
+
+slice_s request_handler(slice_s input, slice_s output, void *plc)
+{
+    /* check to see if we have a full packet. */
+    if(slice_len(input) >= EIP_HEADER_SIZE) {
+        uint16_t eip_len = slice_get_uint16_le(input, 2);
+
+        if(slice_len(input) >= (size_t)(EIP_HEADER_SIZE + eip_len)) {
+            return eip_dispatch_request(input, output, (plc_s *)plc);
+        }
+    }
+
+    /* we do not have a complete packet, get more data. */
+    return slice_make_err(TCP_SERVER_INCOMPLETE);
+}
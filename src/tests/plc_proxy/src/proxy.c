@@ -0,0 +1,286 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/*
+ * The upstream side of the proxy.  Each tag served to the clients has one
+ * libplctag tag on the real PLC.  All of them share one session and one
+ * CIP connection, so the PLC sees a single client no matter how many
+ * connect to the proxy.
+ *
+ * Reads are served from the last data that came from the PLC while it is
+ * younger than the cache time.  Clients asking for the same tag within
+ * that time share one PLC read.  The reads in a Multiple Service Packet
+ * are fetched together with plc_tag_read_many(), so the library packs them
+ * into as few requests as it can.
+ *
+ * Writes go through to the PLC before the client gets its response.  Only
+ * the bytes the client wrote are sent, so elements changed on the PLC in
+ * the meantime are not overwritten with old data.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../../../lib/libplctag.h"
+#include "proxy.h"
+#include "../../ab_server/src/utils.h"
+
+/* the most tags read from the PLC at once. */
+#define PROXY_MAX_BATCH (200)
+
+typedef struct {
+    int32_t tag_id;
+    int64_t fresh_until_ms;
+} upstream_tag_s;
+
+static int fetch_batch(proxy_s *proxy, tag_def_s **tags, size_t num_tags);
+static void copy_tag_data(tag_def_s *tag, upstream_tag_s *upstream);
+
+
+/*
+ * Create the upstream tags.  They are all created at once and then waited
+ * for, so startup takes about one round trip no matter how many there are.
+ * A tag that cannot be created stops the proxy.
+ */
+
+void proxy_connect(proxy_s *proxy, tag_def_s *tags)
+{
+    char attribs[512];
+    int64_t timeout_time = 0;
+    bool pending = true;
+
+    for(tag_def_s *tag = tags; tag; tag = tag->next_tag) {
+        upstream_tag_s *upstream = calloc(1, sizeof(*upstream));
+
+        if(!upstream) {
+            error("Unable to allocate memory for the upstream tag of %s!", tag->name);
+        }
+
+        snprintf(attribs, sizeof(attribs), "protocol=ab-eip&gateway=%s&plc=%s%s%s&name=%s&elem_count=%zu&write_dirty_ranges=1&write_merge_gap=0",
+                 proxy->gateway, proxy->plc, (proxy->path ? "&path=" : ""), (proxy->path ? proxy->path : ""), tag->name, tag->elem_count);
+
+        info("Creating upstream tag with \"%s\".", attribs);
+
+        upstream->tag_id = plc_tag_create(attribs, 0);
+        if(upstream->tag_id < 0) {
+            error("Unable to create the upstream tag for %s, got error %s!", tag->name, plc_tag_decode_error(upstream->tag_id));
+        }
+
+        tag->hook_data = upstream;
+    }
+
+    timeout_time = util_time_ms() + proxy->timeout_ms;
+
+    while(pending && util_time_ms() < timeout_time) {
+        pending = false;
+
+        for(tag_def_s *tag = tags; tag; tag = tag->next_tag) {
+            upstream_tag_s *upstream = (upstream_tag_s *)tag->hook_data;
+            int rc = plc_tag_status(upstream->tag_id);
+
+            if(rc == PLCTAG_STATUS_PENDING) {
+                pending = true;
+            } else if(rc != PLCTAG_STATUS_OK) {
+                error("Unable to create the upstream tag for %s, got error %s!", tag->name, plc_tag_decode_error(rc));
+            }
+        }
+
+        if(pending) {
+            util_sleep_ms(1);
+        }
+    }
+
+    if(pending) {
+        error("Timed out creating the upstream tags!");
+    }
+
+    /* the tags were read when they were created. */
+    for(tag_def_s *tag = tags; tag; tag = tag->next_tag) {
+        upstream_tag_s *upstream = (upstream_tag_s *)tag->hook_data;
+
+        copy_tag_data(tag, upstream);
+        upstream->fresh_until_ms = util_time_ms() + proxy->cache_ms;
+    }
+}
+
+
+void proxy_disconnect(proxy_s *proxy, tag_def_s *tags)
+{
+    (void)proxy;
+
+    for(tag_def_s *tag = tags; tag; tag = tag->next_tag) {
+        upstream_tag_s *upstream = (upstream_tag_s *)tag->hook_data;
+
+        if(upstream) {
+            plc_tag_destroy(upstream->tag_id);
+            free(upstream);
+            tag->hook_data = NULL;
+        }
+    }
+}
+
+
+
+/*
+ * Bring the data of the tags up to date.  Tags read within the cache time
+ * are left alone, the rest are read from the PLC together.
+ */
+
+int proxy_tag_fetch(void *context, tag_def_s **tags, size_t num_tags)
+{
+    proxy_s *proxy = (proxy_s *)context;
+    tag_def_s *stale[PROXY_MAX_BATCH];
+    size_t num_stale = 0;
+    int64_t now = util_time_ms();
+    int result = 0;
+
+    for(size_t i=0; i < num_tags; i++) {
+        upstream_tag_s *upstream = (upstream_tag_s *)tags[i]->hook_data;
+
+        proxy->client_reads++;
+
+        if(now < upstream->fresh_until_ms) {
+            proxy->cache_hits++;
+            continue;
+        }
+
+        stale[num_stale] = tags[i];
+        num_stale++;
+
+        if(num_stale == PROXY_MAX_BATCH) {
+            if(fetch_batch(proxy, stale, num_stale) != 0) {
+                result = -1;
+            }
+
+            num_stale = 0;
+        }
+    }
+
+    if(num_stale > 0 && fetch_batch(proxy, stale, num_stale) != 0) {
+        result = -1;
+    }
+
+    return result;
+}
+
+
+
+/*
+ * Send the bytes a client wrote to the PLC.  The local copy already has
+ * them, so it stays fresh when the write works.
+ */
+
+int proxy_tag_store(void *context, tag_def_s *tag, size_t offset, size_t length)
+{
+    proxy_s *proxy = (proxy_s *)context;
+    upstream_tag_s *upstream = (upstream_tag_s *)tag->hook_data;
+    int rc = PLCTAG_STATUS_OK;
+
+    rc = plc_tag_set_raw_bytes(upstream->tag_id, (int)offset, &tag->data[offset], (int)length);
+    if(rc != PLCTAG_STATUS_OK) {
+        info("Unable to copy the written data to the upstream tag %s, got error %s!", tag->name, plc_tag_decode_error(rc));
+        return -1;
+    }
+
+    proxy->upstream_writes++;
+
+    rc = plc_tag_write(upstream->tag_id, proxy->timeout_ms);
+    if(rc != PLCTAG_STATUS_OK) {
+        info("Unable to write tag %s to the PLC, got error %s!", tag->name, plc_tag_decode_error(rc));
+
+        /* the local copy no longer matches the PLC. */
+        upstream->fresh_until_ms = 0;
+
+        return -1;
+    }
+
+    return 0;
+}
+
+
+
+int fetch_batch(proxy_s *proxy, tag_def_s **tags, size_t num_tags)
+{
+    int32_t ids[PROXY_MAX_BATCH];
+    int statuses[PROXY_MAX_BATCH];
+    int64_t fresh_until_ms = 0;
+    int result = 0;
+
+    for(size_t i=0; i < num_tags; i++) {
+        ids[i] = ((upstream_tag_s *)tags[i]->hook_data)->tag_id;
+    }
+
+    proxy->upstream_reads += num_tags;
+    proxy->upstream_batches++;
+
+    plc_tag_read_many(ids, (int)num_tags, statuses, proxy->timeout_ms);
+
+    fresh_until_ms = util_time_ms() + proxy->cache_ms;
+
+    for(size_t i=0; i < num_tags; i++) {
+        upstream_tag_s *upstream = (upstream_tag_s *)tags[i]->hook_data;
+
+        if(statuses[i] == PLCTAG_STATUS_OK) {
+            copy_tag_data(tags[i], upstream);
+            upstream->fresh_until_ms = fresh_until_ms;
+        } else {
+            info("Unable to read tag %s from the PLC, got error %s!", tags[i]->name, plc_tag_decode_error(statuses[i]));
+            result = -1;
+        }
+    }
+
+    return result;
+}
+
+
+
+void copy_tag_data(tag_def_s *tag, upstream_tag_s *upstream)
+{
+    size_t tag_size = tag->elem_count * tag->elem_size;
+    int upstream_size = plc_tag_get_size(upstream->tag_id);
+
+    if(upstream_size < 0 || (size_t)upstream_size != tag_size) {
+        info("Tag %s is %d bytes on the PLC but %zu bytes here!", tag->name, upstream_size, tag_size);
+
+        if(upstream_size < 0) {
+            return;
+        }
+
+        if((size_t)upstream_size < tag_size) {
+            tag_size = (size_t)upstream_size;
+        }
+    }
+
+    plc_tag_get_raw_bytes(upstream->tag_id, 0, tag->data, (int)tag_size);
+}
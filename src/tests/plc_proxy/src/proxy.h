@@ -0,0 +1,59 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "../../ab_server/src/plc.h"
+
+/* where the tags really are and how long their data may be served from the cache. */
+typedef struct {
+    const char *gateway;
+    const char *path;
+    const char *plc;
+    int cache_ms;
+    int timeout_ms;
+
+    /* counters, printed on shutdown. */
+    uint64_t client_reads;
+    uint64_t cache_hits;
+    uint64_t upstream_reads;
+    uint64_t upstream_batches;
+    uint64_t upstream_writes;
+} proxy_s;
+
+extern void proxy_connect(proxy_s *proxy, tag_def_s *tags);
+extern void proxy_disconnect(proxy_s *proxy, tag_def_s *tags);
+extern int proxy_tag_fetch(void *proxy, tag_def_s **tags, size_t num_tags);
+extern int proxy_tag_store(void *proxy, tag_def_s *tag, size_t offset, size_t length);
@@ -0,0 +1,253 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/*
+ * Serve the responses recorded with the capture_file attribute back to a
+ * client, with the same delays the PLC had.  This gives benchmarks and bug
+ * reports the same PLC behavior on every run.
+ */
+
+#include "../../ab_server/src/compat.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(IS_WINDOWS)
+#include <Windows.h>
+#else
+ /* assume it is POSIX of some sort... */
+#include <signal.h>
+#include <strings.h>
+#endif
+
+#include "replay.h"
+#include "../../ab_server/src/slice.h"
+#include "../../ab_server/src/tcp_server.h"
+#include "../../ab_server/src/utils.h"
+
+#define MIN_BUFFER_SIZE (4200)
+
+static void usage(void);
+static void process_args(int argc, const char **argv, const char **file_name, const char **port, int *time_scale_percent);
+static slice_s request_handler(slice_s input, slice_s output, void *client);
+
+
+#ifdef IS_WINDOWS
+
+typedef volatile int sig_flag_t;
+
+sig_flag_t done = 0;
+
+int WINAPI CtrlHandler(DWORD fdwCtrlType)
+{
+    switch (fdwCtrlType)
+    {
+    case CTRL_C_EVENT:
+    case CTRL_CLOSE_EVENT:
+    case CTRL_BREAK_EVENT:
+    case CTRL_LOGOFF_EVENT:
+    case CTRL_SHUTDOWN_EVENT:
+        info("Got event %d, shutting down.", fdwCtrlType);
+        done = 1;
+        return TRUE;
+
+    default:
+        info("Default Event: %d", fdwCtrlType);
+        return FALSE;
+    }
+}
+
+
+void setup_break_handler(void)
+{
+    if (!SetConsoleCtrlHandler(CtrlHandler, TRUE))
+    {
+        printf("\nERROR: Could not set control handler!\n");
+        usage();
+    }
+}
+
+#else
+
+typedef volatile sig_atomic_t sig_flag_t;
+
+sig_flag_t done = 0;
+
+void SIGINT_handler(int not_used)
+{
+    (void)not_used;
+
+    done = 1;
+}
+
+void setup_break_handler(void)
+{
+    struct sigaction act;
+
+    /* set up signal handler. */
+    memset(&act, 0, sizeof(act));
+    act.sa_handler = SIGINT_handler;
+    sigaction(SIGINT, &act, NULL);
+    sigaction(SIGTERM, &act, NULL);
+}
+
+#endif
+
+
+int main(int argc, const char **argv)
+{
+    tcp_server_p tcp_server = NULL;
+    replay_capture_s *capture = NULL;
+    replay_client_s client;
+    const char *file_name = NULL;
+    const char *port = NULL;
+    int time_scale_percent = 100;
+    size_t buf_size = MIN_BUFFER_SIZE;
+    uint8_t *buf = NULL;
+
+    /* set up handler for ^C etc. */
+    setup_break_handler();
+
+    debug_off();
+
+    process_args(argc, argv, &file_name, &port, &time_scale_percent);
+
+    capture = replay_load(file_name);
+    if(!capture) {
+        usage();
+    }
+
+    if(!port) {
+        port = (capture->protocol == CAPTURE_PROTOCOL_EIP ? "44818" : "502");
+    }
+
+    if(capture->max_frame_size > buf_size) {
+        buf_size = capture->max_frame_size;
+    }
+
+    buf = malloc(buf_size);
+    if(!buf) {
+        error("Unable to allocate the buffer!");
+    }
+
+    /* every client gets its own copy of this. */
+    memset(&client, 0, sizeof(client));
+    client.capture = capture;
+    client.time_scale_percent = time_scale_percent;
+
+    tcp_server = tcp_server_create("0.0.0.0", port, slice_make(buf, (ssize_t)buf_size), request_handler, &client, sizeof(client));
+
+    if(capture->protocol == CAPTURE_PROTOCOL_EIP) {
+        tcp_server_set_framing(tcp_server, EIP_HEADER_SIZE, replay_packet_size_eip);
+    } else {
+        tcp_server_set_framing(tcp_server, MBAP_HEADER_SIZE, replay_packet_size_modbus);
+    }
+
+    tcp_server_set_delay_func(tcp_server, replay_response_delay);
+
+    fprintf(stderr, "Replaying %zu %s responses from %s on port %s.\n", capture->num_exchanges, (capture->protocol == CAPTURE_PROTOCOL_EIP ? "EIP" : "Modbus TCP"), file_name, port);
+
+    tcp_server_start(tcp_server, &done);
+
+    tcp_server_destroy(tcp_server);
+
+    for(size_t i=0; i < capture->num_exchanges; i++) {
+        free(capture->exchanges[i].response);
+    }
+
+    free(capture->exchanges);
+    free(capture);
+    free(buf);
+
+    return 0;
+}
+
+
+void usage(void)
+{
+    fprintf(stderr, "Usage: replay_server --file=<capture> [--port=<port>] [--time_scale=<percent>] [--debug]\n"
+                    "   <capture> = a file written by a tag with the capture_file attribute.\n"
+                    "\n"
+                    "   <port> = the TCP port to listen on.  The default is 44818 for EIP\n"
+                    "            captures and 502 for Modbus TCP captures.\n"
+                    "\n"
+                    "   <percent> = scales the recorded response delays, 0 answers at once\n"
+                    "               and 200 is twice as slow.  The default is 100.\n"
+                    "\n"
+                    "   Each client connection gets the responses from the start of the\n"
+                    "   capture, in order, and is closed when they run out.  The client\n"
+                    "   must send the same requests in the same order as when the capture\n"
+                    "   was made.  Requests that do not match are logged with --debug.\n"
+                    "\n"
+                    "Example: replay_server --file=run1.cap --port=44818\n");
+
+    exit(1);
+}
+
+
+void process_args(int argc, const char **argv, const char **file_name, const char **port, int *time_scale_percent)
+{
+    for(int i=1; i < argc; i++) {
+        if(strncmp(argv[i], "--file=", 7) == 0) {
+            *file_name = &argv[i][7];
+        } else if(strncmp(argv[i], "--port=", 7) == 0) {
+            *port = &argv[i][7];
+        } else if(strncmp(argv[i], "--time_scale=", 13) == 0) {
+            *time_scale_percent = atoi(&argv[i][13]);
+
+            if(*time_scale_percent < 0) {
+                fprintf(stderr, "The time scale must be zero or more!\n");
+                usage();
+            }
+        } else if(strcmp(argv[i], "--debug") == 0) {
+            debug_on();
+        } else {
+            fprintf(stderr, "Unknown argument \"%s\"!\n", argv[i]);
+            usage();
+        }
+    }
+
+    if(!*file_name) {
+        fprintf(stderr, "A capture file is required!\n");
+        usage();
+    }
+}
+
+
+slice_s request_handler(slice_s input, slice_s output, void *client)
+{
+    return replay_handle_request(input, output, (replay_client_s *)client);
+}
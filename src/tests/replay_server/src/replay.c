@@ -0,0 +1,512 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "replay.h"
+#include "../../ab_server/src/slice.h"
+#include "../../ab_server/src/tcp_server.h"
+#include "../../ab_server/src/utils.h"
+
+/*
+ * Requests are matched to responses by position: the Nth request a client
+ * sends gets the Nth response of the capture.  Both EIP and Modbus TCP
+ * answer in order on a connection, so this holds as long as the client
+ * runs the same workload it did when the capture was made.
+ *
+ * The IDs the client picks fresh on every run are copied from the live
+ * request into the recorded response: the EIP session handle, sender
+ * context, connection ID and connection sequence number and the Modbus
+ * transaction ID.
+ */
+
+#define EIP_SEND_RR_DATA (0x6F)
+#define EIP_SEND_UNIT_DATA (0x70)
+#define CPF_CONNECTED_ADDRESS (0xA1)
+#define CPF_CONNECTED_DATA (0xB1)
+#define CPF_UNCONNECTED_DATA (0xB2)
+#define CIP_FORWARD_OPEN (0x54)
+#define CIP_FORWARD_OPEN_EX (0x5B)
+#define CIP_RESPONSE_FLAG (0x80)
+
+/* where the interesting parts of an EIP packet are. */
+typedef struct {
+    bool has_conn_id;
+    size_t conn_id_offset;
+    bool has_conn_seq;
+    size_t conn_seq_offset;
+    bool has_cip;
+    size_t cip_offset;
+    size_t cip_len;
+} eip_parts_s;
+
+
+static size_t frame_size(int protocol, const uint8_t *data, size_t len);
+static uint32_t request_kind(int protocol, slice_s frame);
+static bool add_request(size_t **pending, size_t *num_pending, size_t *capacity, size_t index);
+static void find_eip_parts(slice_s packet, eip_parts_s *parts);
+static size_t forward_open_request_conn_id_offset(slice_s packet, eip_parts_s *parts);
+static size_t forward_open_response_conn_id_offset(slice_s packet, eip_parts_s *parts);
+static void patch_eip_response(slice_s request, slice_s response, replay_client_s *client);
+
+static inline uint32_t get_uint32_le(const uint8_t *data) { return (uint32_t)data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24); }
+
+
+
+/*
+ * Read a capture file and pair up its requests and responses.  Frames
+ * sent together, like coalesced Modbus requests, are split apart.
+ */
+replay_capture_s *replay_load(const char *file_name)
+{
+    FILE *file = fopen(file_name, "rb");
+    replay_capture_s *capture = NULL;
+    uint8_t *data = NULL;
+    long file_size = 0;
+    size_t offset = CAPTURE_HEADER_SIZE;
+    int64_t now_us = 0;
+    size_t *pending = NULL;
+    size_t num_pending = 0;
+    size_t pending_capacity = 0;
+    size_t first_pending = 0;
+    size_t num_requests = 0;
+    int64_t *request_times = NULL;
+    uint32_t *request_kinds = NULL;
+
+    if(!file) {
+        fprintf(stderr, "Unable to open capture file %s!\n", file_name);
+        return NULL;
+    }
+
+    fseek(file, 0, SEEK_END);
+    file_size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    if(file_size < CAPTURE_HEADER_SIZE || !(data = malloc((size_t)file_size)) || fread(data, 1, (size_t)file_size, file) != (size_t)file_size) {
+        fprintf(stderr, "Unable to read capture file %s!\n", file_name);
+        fclose(file);
+        free(data);
+        return NULL;
+    }
+
+    fclose(file);
+
+    if(memcmp(data, CAPTURE_MAGIC, 6) != 0 || data[6] != CAPTURE_VERSION) {
+        fprintf(stderr, "%s is not a version %d capture file!\n", file_name, CAPTURE_VERSION);
+        free(data);
+        return NULL;
+    }
+
+    capture = calloc(1, sizeof(*capture));
+    if(!capture) {
+        error("Unable to allocate capture!");
+    }
+
+    capture->protocol = data[7];
+
+    if(capture->protocol != CAPTURE_PROTOCOL_EIP && capture->protocol != CAPTURE_PROTOCOL_MODBUS_TCP) {
+        fprintf(stderr, "Unsupported protocol %d in %s!\n", capture->protocol, file_name);
+        free(data);
+        free(capture);
+        return NULL;
+    }
+
+    /* the most exchanges possible is one per record. */
+    capture->exchanges = calloc((size_t)file_size / CAPTURE_RECORD_HEADER_SIZE + 1, sizeof(*capture->exchanges));
+    request_times = calloc((size_t)file_size / CAPTURE_RECORD_HEADER_SIZE + 1, sizeof(*request_times));
+    request_kinds = calloc((size_t)file_size / CAPTURE_RECORD_HEADER_SIZE + 1, sizeof(*request_kinds));
+
+    if(!capture->exchanges || !request_times || !request_kinds) {
+        error("Unable to allocate capture exchanges!");
+    }
+
+    while(offset + CAPTURE_RECORD_HEADER_SIZE <= (size_t)file_size) {
+        int direction = data[offset];
+        uint32_t delta_us = get_uint32_le(&data[offset + 1]);
+        size_t len = get_uint32_le(&data[offset + 5]);
+        uint8_t *frame = &data[offset + CAPTURE_RECORD_HEADER_SIZE];
+
+        offset += CAPTURE_RECORD_HEADER_SIZE;
+
+        if(offset + len > (size_t)file_size) {
+            fprintf(stderr, "WARN: the capture is truncated, using what is there.\n");
+            break;
+        }
+
+        offset += len;
+        now_us += delta_us;
+
+        if(len > capture->max_frame_size) {
+            capture->max_frame_size = len;
+        }
+
+        if(direction == CAPTURE_DIR_SENT) {
+            size_t used = 0;
+
+            while(used < len) {
+                size_t size = frame_size(capture->protocol, frame + used, len - used);
+
+                if(size == 0 || used + size > len) {
+                    fprintf(stderr, "WARN: skipping a malformed request in the capture.\n");
+                    break;
+                }
+
+                request_times[num_requests] = now_us;
+                request_kinds[num_requests] = request_kind(capture->protocol, slice_make(frame + used, (ssize_t)size));
+
+                if(!add_request(&pending, &num_pending, &pending_capacity, num_requests)) {
+                    error("Unable to allocate pending requests!");
+                }
+
+                num_requests++;
+                used += size;
+            }
+        } else {
+            replay_exchange_s *exchange = NULL;
+            size_t request_index;
+
+            if(first_pending >= num_pending) {
+                info("WARN: response with no request in the capture, skipping it.");
+                continue;
+            }
+
+            request_index = pending[first_pending++];
+            exchange = &capture->exchanges[capture->num_exchanges++];
+
+            exchange->request_kind = request_kinds[request_index];
+            exchange->request_us = request_times[request_index];
+            exchange->response_us = now_us;
+            exchange->response_len = len;
+            exchange->response = malloc(len);
+
+            if(!exchange->response) {
+                error("Unable to allocate the response!");
+            }
+
+            memcpy(exchange->response, frame, len);
+        }
+    }
+
+    free(pending);
+    free(request_times);
+    free(request_kinds);
+    free(data);
+
+    return capture;
+}
+
+
+
+size_t replay_packet_size_eip(slice_s header)
+{
+    return EIP_HEADER_SIZE + (size_t)slice_get_uint16_le(header, 2);
+}
+
+
+
+size_t replay_packet_size_modbus(slice_s header)
+{
+    size_t length = ((size_t)slice_get_uint8(header, 4) << 8) | (size_t)slice_get_uint8(header, 5);
+
+    /* too short to have a function code, drop the client. */
+    if(length < 2) {
+        return SIZE_MAX;
+    }
+
+    return (MBAP_HEADER_SIZE - 1) + length;
+}
+
+
+
+/*
+ * Answer with the next response in the capture.  The response is copied
+ * over the request, so the IDs are taken from the request first.
+ */
+slice_s replay_handle_request(slice_s input, slice_s output, replay_client_s *client)
+{
+    replay_capture_s *capture = client->capture;
+    replay_exchange_s *exchange = NULL;
+    uint8_t request_copy[64];
+    slice_s request;
+    slice_s response;
+    int64_t delay_us = 0;
+
+    if(client->next_exchange >= capture->num_exchanges) {
+        info("The capture has no more responses, closing the connection.");
+        return slice_make_err(TCP_SERVER_DONE_CLIENT);
+    }
+
+    exchange = &capture->exchanges[client->next_exchange++];
+
+    if(request_kind(capture->protocol, input) != exchange->request_kind) {
+        info("WARN: request %zu is 0x%x, the capture has 0x%x.  The responses may not match the requests.", client->next_exchange, request_kind(capture->protocol, input), exchange->request_kind);
+    }
+
+    if(exchange->response_len > slice_len(output)) {
+        info("WARN: the response is larger than the buffer!");
+        return slice_make_err(TCP_SERVER_DONE_CLIENT);
+    }
+
+    /* keep the start of the request, the IDs are all in it. */
+    memcpy(request_copy, input.data, (slice_len(input) < sizeof(request_copy) ? slice_len(input) : sizeof(request_copy)));
+    request = slice_make(request_copy, (ssize_t)(slice_len(input) < sizeof(request_copy) ? slice_len(input) : sizeof(request_copy)));
+
+    memcpy(output.data, exchange->response, exchange->response_len);
+    response = slice_from_slice(output, 0, exchange->response_len);
+
+    if(capture->protocol == CAPTURE_PROTOCOL_MODBUS_TCP) {
+        /* the transaction ID. */
+        slice_set_uint8(response, 0, slice_get_uint8(request, 0));
+        slice_set_uint8(response, 1, slice_get_uint8(request, 1));
+    } else {
+        patch_eip_response(request, response, client);
+    }
+
+    delay_us = exchange->response_us - exchange->request_us;
+    if(delay_us < 0) {
+        delay_us = 0;
+    }
+
+    client->delay_us = (delay_us * client->time_scale_percent) / 100;
+
+    info("Replaying response %zu of %zu after %" PRId64 "us.", client->next_exchange, capture->num_exchanges, client->delay_us);
+
+    return response;
+}
+
+
+
+int64_t replay_response_delay(void *client)
+{
+    return ((replay_client_s *)client)->delay_us;
+}
+
+
+
+size_t frame_size(int protocol, const uint8_t *data, size_t len)
+{
+    slice_s header = slice_make((uint8_t *)data, (ssize_t)len);
+
+    if(protocol == CAPTURE_PROTOCOL_MODBUS_TCP) {
+        return (len < MBAP_HEADER_SIZE ? 0 : replay_packet_size_modbus(header));
+    }
+
+    return (len < EIP_HEADER_SIZE ? 0 : replay_packet_size_eip(header));
+}
+
+
+
+/* something to check that the live client is asking for the same things. */
+uint32_t request_kind(int protocol, slice_s frame)
+{
+    eip_parts_s parts;
+
+    if(protocol == CAPTURE_PROTOCOL_MODBUS_TCP) {
+        return slice_get_uint8(frame, 7);
+    }
+
+    find_eip_parts(frame, &parts);
+
+    if(parts.has_cip) {
+        return ((uint32_t)slice_get_uint16_le(frame, 0) << 8) | (uint32_t)slice_get_uint8(frame, parts.cip_offset);
+    }
+
+    return (uint32_t)slice_get_uint16_le(frame, 0) << 8;
+}
+
+
+
+bool add_request(size_t **pending, size_t *num_pending, size_t *capacity, size_t index)
+{
+    if(*num_pending >= *capacity) {
+        size_t new_capacity = (*capacity ? *capacity * 2 : 256);
+        size_t *new_pending = realloc(*pending, new_capacity * sizeof(**pending));
+
+        if(!new_pending) {
+            return false;
+        }
+
+        *pending = new_pending;
+        *capacity = new_capacity;
+    }
+
+    (*pending)[(*num_pending)++] = index;
+
+    return true;
+}
+
+
+
+/*
+ * Find the connection ID, the connection sequence number and the CIP
+ * message in a SendRRData or SendUnitData packet.  The common packet
+ * format starts after the interface handle and timeout.
+ */
+void find_eip_parts(slice_s packet, eip_parts_s *parts)
+{
+    uint16_t command = slice_get_uint16_le(packet, 0);
+    size_t offset = EIP_HEADER_SIZE + 6;
+    uint16_t item_count = 0;
+
+    memset(parts, 0, sizeof(*parts));
+
+    if(command != EIP_SEND_RR_DATA && command != EIP_SEND_UNIT_DATA) {
+        return;
+    }
+
+    item_count = slice_get_uint16_le(packet, offset);
+    offset += 2;
+
+    for(uint16_t i=0; i < item_count && offset + 4 <= slice_len(packet); i++) {
+        uint16_t item_type = slice_get_uint16_le(packet, offset);
+        size_t item_len = slice_get_uint16_le(packet, offset + 2);
+
+        offset += 4;
+
+        if(item_type == CPF_CONNECTED_ADDRESS && item_len == 4) {
+            parts->has_conn_id = true;
+            parts->conn_id_offset = offset;
+        } else if(item_type == CPF_CONNECTED_DATA && item_len >= 2) {
+            parts->has_conn_seq = true;
+            parts->conn_seq_offset = offset;
+            parts->has_cip = true;
+            parts->cip_offset = offset + 2;
+            parts->cip_len = item_len - 2;
+        } else if(item_type == CPF_UNCONNECTED_DATA && item_len >= 1) {
+            parts->has_cip = true;
+            parts->cip_offset = offset;
+            parts->cip_len = item_len;
+        }
+
+        offset += item_len;
+    }
+}
+
+
+
+/* where the client's connection ID is in a Forward Open request, or zero. */
+size_t forward_open_request_conn_id_offset(slice_s packet, eip_parts_s *parts)
+{
+    uint8_t service = 0;
+    size_t path_words = 0;
+
+    if(!parts->has_cip || parts->has_conn_seq) {
+        return 0;
+    }
+
+    service = slice_get_uint8(packet, parts->cip_offset);
+    if(service != CIP_FORWARD_OPEN && service != CIP_FORWARD_OPEN_EX) {
+        return 0;
+    }
+
+    /* service, path size, path, priority and ticks, then the two connection IDs. */
+    path_words = slice_get_uint8(packet, parts->cip_offset + 1);
+
+    return parts->cip_offset + 2 + (path_words * 2) + 2 + 4;
+}
+
+
+
+/* where the client's connection ID is in a Forward Open response, or zero. */
+size_t forward_open_response_conn_id_offset(slice_s packet, eip_parts_s *parts)
+{
+    uint8_t service = 0;
+    size_t ext_status_words = 0;
+
+    if(!parts->has_cip || parts->has_conn_seq) {
+        return 0;
+    }
+
+    service = slice_get_uint8(packet, parts->cip_offset);
+    if(service != (CIP_FORWARD_OPEN | CIP_RESPONSE_FLAG) && service != (CIP_FORWARD_OPEN_EX | CIP_RESPONSE_FLAG)) {
+        return 0;
+    }
+
+    /* only a successful reply has the connection IDs. */
+    if(slice_get_uint8(packet, parts->cip_offset + 2) != 0) {
+        return 0;
+    }
+
+    /* service, reserved, status, extended status size, then the two connection IDs. */
+    ext_status_words = slice_get_uint8(packet, parts->cip_offset + 3);
+
+    return parts->cip_offset + 4 + (ext_status_words * 2) + 4;
+}
+
+
+
+void patch_eip_response(slice_s request, slice_s response, replay_client_s *client)
+{
+    eip_parts_s request_parts;
+    eip_parts_s response_parts;
+    size_t request_id_offset = 0;
+    size_t response_id_offset = 0;
+    uint32_t session_handle = slice_get_uint32_le(request, 4);
+
+    /* the session handle, once the client has one, and the sender context. */
+    if(session_handle) {
+        slice_set_uint32_le(response, 4, session_handle);
+    }
+
+    for(size_t i=12; i < 20; i++) {
+        slice_set_uint8(response, i, slice_get_uint8(request, i));
+    }
+
+    find_eip_parts(request, &request_parts);
+    find_eip_parts(response, &response_parts);
+
+    /* the client picks its side of the connection ID in the Forward Open. */
+    request_id_offset = forward_open_request_conn_id_offset(request, &request_parts);
+    response_id_offset = forward_open_response_conn_id_offset(response, &response_parts);
+
+    if(request_id_offset && request_id_offset + 4 <= slice_len(request)) {
+        client->targ_to_orig_conn_id = slice_get_uint32_le(request, request_id_offset);
+    }
+
+    if(response_id_offset) {
+        slice_set_uint32_le(response, response_id_offset, client->targ_to_orig_conn_id);
+    }
+
+    /* connected responses carry the client's connection ID and echo the sequence number. */
+    if(response_parts.has_conn_id) {
+        slice_set_uint32_le(response, response_parts.conn_id_offset, client->targ_to_orig_conn_id);
+    }
+
+    if(response_parts.has_conn_seq && request_parts.has_conn_seq) {
+        slice_set_uint16_le(response, response_parts.conn_seq_offset, slice_get_uint16_le(request, request_parts.conn_seq_offset));
+    }
+}
@@ -0,0 +1,82 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "../../ab_server/src/slice.h"
+
+/* these match src/util/capture.h in the library. */
+#define CAPTURE_MAGIC "PLCCAP"
+#define CAPTURE_VERSION (1)
+#define CAPTURE_HEADER_SIZE (16)
+#define CAPTURE_RECORD_HEADER_SIZE (9)
+#define CAPTURE_PROTOCOL_EIP (1)
+#define CAPTURE_PROTOCOL_MODBUS_TCP (2)
+#define CAPTURE_DIR_SENT (0)
+#define CAPTURE_DIR_RECEIVED (1)
+
+#define EIP_HEADER_SIZE (24)
+#define MBAP_HEADER_SIZE (7)
+
+/* one request from the capture and the response the PLC sent to it. */
+typedef struct {
+    uint32_t request_kind;
+    int64_t request_us;
+    int64_t response_us;
+    size_t response_len;
+    uint8_t *response;
+} replay_exchange_s;
+
+typedef struct {
+    int protocol;
+    size_t max_frame_size;
+    size_t num_exchanges;
+    replay_exchange_s *exchanges;
+} replay_capture_s;
+
+/* the state of one client connection, each starts at the beginning of the capture. */
+typedef struct {
+    replay_capture_s *capture;
+    int time_scale_percent;
+    size_t next_exchange;
+    uint32_t targ_to_orig_conn_id;
+    int64_t delay_us;
+} replay_client_s;
+
+extern replay_capture_s *replay_load(const char *file_name);
+extern size_t replay_packet_size_eip(slice_s header);
+extern size_t replay_packet_size_modbus(slice_s header);
+extern slice_s replay_handle_request(slice_s input, slice_s output, replay_client_s *client);
+extern int64_t replay_response_delay(void *client);
@@ -0,0 +1,220 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <lib/libplctag.h>
+#include <platform.h>
+#include <util/arena.h>
+#include <util/debug.h>
+
+
+#define ARENA_CHUNK_SIZE (65536)
+#define ARENA_MIN_BLOCKS_PER_CHUNK (16)
+
+typedef struct arena_chunk_t *arena_chunk_p;
+
+struct arena_chunk_t {
+    arena_chunk_p next;
+
+    /* keep the blocks aligned like a malloc() result. */
+    union {
+        uint64_t dummy_u64;
+        double dummy_double;
+        void *dummy_ptr;
+    } blocks[];
+};
+
+typedef struct arena_block_t *arena_block_p;
+
+struct arena_block_t {
+    arena_block_p next;
+};
+
+struct arena_t {
+    lock_t lock;
+    int block_size;
+    int blocks_per_chunk;
+    arena_chunk_p chunks;
+    arena_block_p free_list;
+};
+
+
+static volatile int arena_is_enabled = 0;
+
+static int arena_add_chunk_unsafe(arena_p arena);
+
+
+
+arena_p arena_create(int block_size, int blocks_per_chunk)
+{
+    arena_p arena = NULL;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(block_size <= 0) {
+        pdebug(DEBUG_WARN, "Block size must be positive!");
+        return NULL;
+    }
+
+    arena = (arena_p)mem_alloc((int)(unsigned int)sizeof(*arena));
+    if(!arena) {
+        pdebug(DEBUG_WARN, "Unable to allocate arena!");
+        return NULL;
+    }
+
+    /* round up so that every block stays aligned. */
+    block_size = (block_size + 7) & ~7;
+
+    if(blocks_per_chunk <= 0) {
+        blocks_per_chunk = ARENA_CHUNK_SIZE / block_size;
+    }
+
+    if(blocks_per_chunk < ARENA_MIN_BLOCKS_PER_CHUNK) {
+        blocks_per_chunk = ARENA_MIN_BLOCKS_PER_CHUNK;
+    }
+
+    arena->lock = LOCK_INIT;
+    arena->block_size = block_size;
+    arena->blocks_per_chunk = blocks_per_chunk;
+
+    pdebug(DEBUG_INFO, "Done with %d byte blocks, %d per chunk.", block_size, blocks_per_chunk);
+
+    return arena;
+}
+
+
+
+/* every block must have been freed or be abandoned. */
+void arena_destroy(arena_p arena)
+{
+    arena_chunk_p chunk = NULL;
+
+    if(!arena) {
+        return;
+    }
+
+    chunk = arena->chunks;
+
+    while(chunk) {
+        arena_chunk_p next = chunk->next;
+
+        mem_free(chunk);
+
+        chunk = next;
+    }
+
+    mem_free(arena);
+}
+
+
+
+void *arena_alloc(arena_p arena)
+{
+    arena_block_p block = NULL;
+
+    if(!arena) {
+        return NULL;
+    }
+
+    spin_block(&arena->lock) {
+        if(!arena->free_list && arena_add_chunk_unsafe(arena) != PLCTAG_STATUS_OK) {
+            break;
+        }
+
+        block = arena->free_list;
+        arena->free_list = block->next;
+    }
+
+    if(block) {
+        mem_set(block, 0, arena->block_size);
+    }
+
+    return block;
+}
+
+
+
+void arena_free(arena_p arena, void *block_arg)
+{
+    arena_block_p block = (arena_block_p)block_arg;
+
+    if(!arena || !block) {
+        return;
+    }
+
+    spin_block(&arena->lock) {
+        block->next = arena->free_list;
+        arena->free_list = block;
+    }
+}
+
+
+
+void arena_set_enabled(int enabled)
+{
+    arena_is_enabled = (enabled ? 1 : 0);
+}
+
+
+int arena_enabled(void)
+{
+    return arena_is_enabled;
+}
+
+
+
+/* cut a new chunk into blocks on the free list, in address order. */
+int arena_add_chunk_unsafe(arena_p arena)
+{
+    arena_chunk_p chunk = NULL;
+    uint8_t *blocks = NULL;
+
+    chunk = (arena_chunk_p)mem_alloc((int)(unsigned int)sizeof(*chunk) + (arena->block_size * arena->blocks_per_chunk));
+    if(!chunk) {
+        pdebug(DEBUG_WARN, "Unable to allocate arena chunk!");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    chunk->next = arena->chunks;
+    arena->chunks = chunk;
+
+    blocks = (uint8_t *)chunk->blocks;
+
+    for(int i = arena->blocks_per_chunk - 1; i >= 0; i--) {
+        arena_block_p block = (arena_block_p)(void *)(blocks + (i * arena->block_size));
+
+        block->next = arena->free_list;
+        arena->free_list = block;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
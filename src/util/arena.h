@@ -0,0 +1,58 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#pragma once
+
+/*
+ * Fixed size block arenas.  Blocks are cut from large chunks so that many
+ * small objects of one kind sit next to each other in memory and each
+ * costs no allocator overhead.  Freed blocks go on the arena's free list
+ * for reuse, chunks are only returned by arena_destroy().
+ */
+
+typedef struct arena_t *arena_p;
+
+/* zero blocks_per_chunk picks a chunk of about 64kB. */
+extern arena_p arena_create(int block_size, int blocks_per_chunk);
+extern void arena_destroy(arena_p arena);
+
+/* returns a zeroed block or NULL. */
+extern void *arena_alloc(arena_p arena);
+extern void arena_free(arena_p arena, void *block);
+
+/*
+ * Library wide switch for the tag_arena attribute.  Objects remember
+ * where they came from, so it can be changed at any time.
+ */
+extern void arena_set_enabled(int enabled);
+extern int arena_enabled(void);
@@ -34,6 +34,15 @@
 #include <util/atomic_int.h>
 #include <util/debug.h>
 
+#if defined(_MSC_VER)
+    #include <intrin.h>
+#endif
+
+
+/*
+ * The value is changed with the compiler's atomic operations where we have
+ * them.  The lock is only used with compilers that have none.
+ */
 
 void atomic_init(atomic_int *a, int new_val)
 {
@@ -47,13 +56,15 @@ int atomic_get(atomic_int *a)
 {
     int val = 0;
 
-    pdebug(DEBUG_SPEW, "Starting.");
-
+#if defined(__GNUC__) || defined(__clang__)
+    val = __atomic_load_n(&a->val, __ATOMIC_SEQ_CST);
+#elif defined(_MSC_VER)
+    val = (int)_InterlockedCompareExchange((volatile long *)&a->val, 0, 0);
+#else
     spin_block(&a->lock) {
         val = a->val;
     }
-
-    pdebug(DEBUG_SPEW, "Done.");
+#endif
 
     return val;
 }
@@ -64,14 +75,16 @@ int atomic_set(atomic_int *a, int new_val)
 {
     int old_val = 0;
 
-    pdebug(DEBUG_SPEW, "Starting.");
-
+#if defined(__GNUC__) || defined(__clang__)
+    old_val = __atomic_exchange_n(&a->val, new_val, __ATOMIC_SEQ_CST);
+#elif defined(_MSC_VER)
+    old_val = (int)_InterlockedExchange((volatile long *)&a->val, (long)new_val);
+#else
     spin_block(&a->lock) {
         old_val = a->val;
         a->val = new_val;
     }
-
-    pdebug(DEBUG_SPEW, "Done.");
+#endif
 
     return old_val;
 }
@@ -82,14 +95,39 @@ int atomic_add(atomic_int *a, int other)
 {
     int old_val = 0;
 
-    pdebug(DEBUG_SPEW, "Starting.");
-
+#if defined(__GNUC__) || defined(__clang__)
+    old_val = __atomic_fetch_add(&a->val, other, __ATOMIC_SEQ_CST);
+#elif defined(_MSC_VER)
+    old_val = (int)_InterlockedExchangeAdd((volatile long *)&a->val, (long)other);
+#else
     spin_block(&a->lock) {
         old_val = a->val;
         a->val += other;
     }
-
-    pdebug(DEBUG_SPEW, "Done.");
+#endif
 
     return old_val;
 }
+
+
+
+int atomic_cas(atomic_int *a, int old_val, int new_val)
+{
+    int val = old_val;
+
+#if defined(__GNUC__) || defined(__clang__)
+    __atomic_compare_exchange_n(&a->val, &val, new_val, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+#elif defined(_MSC_VER)
+    val = (int)_InterlockedCompareExchange((volatile long *)&a->val, (long)new_val, (long)old_val);
+#else
+    spin_block(&a->lock) {
+        val = a->val;
+
+        if(val == old_val) {
+            a->val = new_val;
+        }
+    }
+#endif
+
+    return val;
+}
@@ -41,3 +41,6 @@ extern void atomic_init(atomic_int *a, int new_val);
 extern int atomic_get(atomic_int *a);
 extern int atomic_set(atomic_int *a, int new_val);
 extern int atomic_add(atomic_int *a, int other);
+
+/* set the value to new_val only if it is old_val.  Returns the value it had. */
+extern int atomic_cas(atomic_int *a, int old_val, int new_val);
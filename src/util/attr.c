@@ -44,20 +44,88 @@
 #include <util/debug.h>
 
 
+/*
+ * Attributes are kept in an array sorted by name so that lookups are a
+ * binary search.  Names and values are offsets into a single string pool.
+ * When parsing, the pool starts as a copy of the attribute string with the
+ * '=' and '&' separators replaced by terminators.
+ */
 
+#define ATTR_MIN_ENTRIES (8)
+#define ATTR_MIN_POOL (64)
+
+/* recently parsed attribute strings, used to skip parsing shared prefixes. */
+#define ATTR_CACHE_SIZE (4)
 
 struct attr_entry_t {
-    attr_entry next;
-    char *name;
-    char *val;
+    int name;
+    int val;
+    int segment;
 };
 
 struct attr_t {
-    attr_entry head;
+    struct attr_entry_t *entries;
+    int num_entries;
+    int max_entries;
+    char *pool;
+    int pool_size;
+    int pool_capacity;
+    int cacheable;
 };
 
+typedef struct {
+    char *str;
+    int len;
+    attr attrs;
+} attr_cache_entry_t;
+
+static lock_t attr_cache_lock = LOCK_INIT;
+static attr_cache_entry_t attr_cache[ATTR_CACHE_SIZE];
+static int attr_cache_next = 0;
 
 
+static int find_index(attr a, const char *name, int *found);
+static int pool_reserve(attr a, int size);
+static int pool_add(attr a, const char *str);
+static int entries_reserve(attr a, int num);
+static int attr_put(attr a, int name, int val, int segment);
+static int attr_cache_load_prefix(attr a, const char *attr_str, int *segment);
+static void attr_cache_store(const char *attr_str, int len, attr a);
+static attr attr_clone(attr a, int len, int num_segments);
+
+
+
+/*
+ * find_index
+ *
+ * Binary search for the passed name.  Returns the index of the entry if
+ * found, otherwise the index at which it would be inserted.
+ */
+
+int find_index(attr a, const char *name, int *found)
+{
+    int low = 0;
+    int high = a->num_entries - 1;
+
+    *found = 0;
+
+    while(low <= high) {
+        int mid = low + (high - low)/2;
+        int cmp = str_cmp(a->pool + a->entries[mid].name, name);
+
+        if(cmp == 0) {
+            *found = 1;
+            return mid;
+        } else if(cmp < 0) {
+            low = mid + 1;
+        } else {
+            high = mid - 1;
+        }
+    }
+
+    return low;
+}
+
 
 
 /*
@@ -69,28 +137,131 @@ struct attr_t {
 
 attr_entry find_entry(attr a, const char *name)
 {
-    attr_entry e;
+    int found = 0;
+    int index = 0;
 
-    if(!a)
+    if(!a || !name)
         return NULL;
 
-    e = a->head;
+    index = find_index(a, name, &found);
+
+    return (found ? &(a->entries[index]) : NULL);
+}
+
+
+
+int pool_reserve(attr a, int size)
+{
+    if(a->pool_size + size > a->pool_capacity) {
+        int new_capacity = (a->pool_capacity ? a->pool_capacity : ATTR_MIN_POOL);
+        char *new_pool = NULL;
+
+        while(new_capacity < a->pool_size + size) {
+            new_capacity *= 2;
+        }
+
+        new_pool = (char *)mem_realloc(a->pool, new_capacity);
+        if(!new_pool) {
+            return 1;
+        }
+
+        a->pool = new_pool;
+        a->pool_capacity = new_capacity;
+    }
+
+    return 0;
+}
+
+
+
+/* copy a string into the pool and return its offset or -1 on failure. */
+int pool_add(attr a, const char *str)
+{
+    int len = str_length(str) + 1;
+    int offset = a->pool_size;
+    int src_offset = -1;
+
+    /* the string may be a value already in this pool, which can move. */
+    if(a->pool && str >= a->pool && str < a->pool + a->pool_size) {
+        src_offset = (int)(str - a->pool);
+    }
+
+    if(pool_reserve(a, len)) {
+        return -1;
+    }
+
+    if(src_offset >= 0) {
+        str = a->pool + src_offset;
+    }
+
+    mem_copy(a->pool + offset, (void *)str, len);
+    a->pool_size += len;
+
+    return offset;
+}
 
-    if(!e)
-        return NULL;
 
-    while(e) {
-        if(str_cmp(e->name, name) == 0) {
-            return e;
+
+int entries_reserve(attr a, int num)
+{
+    if(num > a->max_entries) {
+        int new_max = (a->max_entries ? a->max_entries : ATTR_MIN_ENTRIES);
+        struct attr_entry_t *new_entries = NULL;
+
+        while(new_max < num) {
+            new_max *= 2;
         }
 
-        e = e->next;
+        new_entries = (struct attr_entry_t *)mem_realloc(a->entries, (int)(sizeof(struct attr_entry_t) * (size_t)new_max));
+        if(!new_entries) {
+            return 1;
+        }
+
+        a->entries = new_entries;
+        a->max_entries = new_max;
     }
 
-    return NULL;
+    return 0;
 }
 
 
+
+/*
+ * attr_put
+ *
+ * Insert or replace the entry for the name at the passed pool offset.
+ */
+
+int attr_put(attr a, int name, int val, int segment)
+{
+    int found = 0;
+    int index = find_index(a, a->pool + name, &found);
+
+    if(found) {
+        /* later values win, but the segment map is no longer valid. */
+        a->entries[index].val = val;
+        a->cacheable = 0;
+        return 0;
+    }
+
+    if(entries_reserve(a, a->num_entries + 1)) {
+        return 1;
+    }
+
+    if(index < a->num_entries) {
+        mem_move(&(a->entries[index + 1]), &(a->entries[index]), (int)(sizeof(struct attr_entry_t) * (size_t)(a->num_entries - index)));
+    }
+
+    a->entries[index].name = name;
+    a->entries[index].val = val;
+    a->entries[index].segment = segment;
+    a->num_entries++;
+
+    return 0;
+}
+
+
+
 /*
  * attr_create
  *
@@ -119,35 +290,51 @@ extern attr attr_create()
  * foo=bar&blah=humbug&blorg=42&test=one
  * You cannot, currently, have an "=" or "&" character in the value for an
  * attribute.
+ *
+ * The longest run of leading name/value pairs shared with a recently parsed
+ * string is copied from the cache instead of being parsed again.
  */
 extern attr attr_create_from_str(const char *attr_str)
 {
-    char *tmp;
+    int len = 0;
+    int offset = 0;
+    int segment = 0;
     char *cur;
     attr res = NULL;
 
-    if(!str_length(attr_str)) {
+    len = str_length(attr_str);
+    if(!len) {
         return NULL;
     }
 
-    /* make a copy for a destructive read. */
-    tmp = str_dup(attr_str);
-    if(!tmp) {
+    res = attr_create();
+    if(!res) {
         return NULL;
     }
 
-    res = attr_create();
+    res->cacheable = 1;
 
-    if(!res) {
-        mem_free(tmp);
+    /* pick up any prefix that has already been parsed. */
+    offset = attr_cache_load_prefix(res, attr_str, &segment);
+    if(offset < 0) {
+        attr_destroy(res);
         return NULL;
     }
 
+    /* make a copy of the rest for a destructive read. */
+    if(pool_reserve(res, len + 1 - offset)) {
+        attr_destroy(res);
+        return NULL;
+    }
+
+    mem_copy(res->pool + offset, (void *)(attr_str + offset), len + 1 - offset);
+    res->pool_size = len + 1;
+
     /*
-     * walk the pointer along the input and copy the
+     * walk the pointer along the input and record the
      * names and values along the way.
      */
-    cur = tmp;
+    cur = res->pool + offset;
     while(*cur) {
         /* read the name */
         char *name = cur;
@@ -166,8 +353,7 @@ extern attr attr_create_from_str(const char *attr_str)
          * is malformed.   But the test below will not catch it.
          */
         if(*cur == 0) {
-            if(res) attr_destroy(res);
-            mem_free(tmp);
+            attr_destroy(res);
             return NULL;
         }
 
@@ -189,17 +375,20 @@ extern attr attr_create_from_str(const char *attr_str)
 
         /* only set the value if it is not a zero-length string. */
         if(str_length(val)) {
-            if(attr_set_str(res, name, val)) {
-                if(res) attr_destroy(res);
-                mem_free(tmp);
+            if(attr_put(res, (int)(name - res->pool), (int)(val - res->pool), segment)) {
+                attr_destroy(res);
                 return NULL;
             }
         } else {
             pdebug(DEBUG_WARN, "Malformed attribute string, attribute \"%s\" has no value.", name);
         }
+
+        segment++;
     }
 
-    mem_free(tmp);
+    if(res->cacheable) {
+        attr_cache_store(attr_str, len, res);
+    }
 
     return res;
 }
@@ -215,62 +404,38 @@ extern attr attr_create_from_str(const char *attr_str)
  */
 extern int attr_set_str(attr attrs, const char *name, const char *val)
 {
-    attr_entry e;
+    int name_offset = 0;
+    int val_offset = 0;
+    int found = 0;
+    int index = 0;
 
-    if(!attrs) {
+    if(!attrs || !name || !val) {
         return 1;
     }
 
-    /* does the entry exist? */
-    e = find_entry(attrs, name);
-
-    /* if we had a match, then delete the existing value and add in the
-     * new one.
-     *
-     * If we had no match, then e is NULL and we need to create a new one.
-     */
-    if(e) {
-        /* we had a match, free any existing value */
-        if(e->val) {
-            mem_free(e->val);
-        }
+    /* values that are set later are not part of any parsed string. */
+    attrs->cacheable = 0;
 
-        /* set up the new value */
-        e->val = str_dup(val);
-        if(!e->val) {
-            /* oops! */
-            return 1;
-        }
-    } else {
-        /* no match, need a new entry */
-        e = (attr_entry)mem_alloc(sizeof(struct attr_entry_t));
-
-        if(e) {
-            e->name = str_dup(name);
-
-            if(!e->name) {
-                mem_free(e);
-                return 1;
-            }
-
-            e->val = str_dup(val);
+    val_offset = pool_add(attrs, val);
+    if(val_offset < 0) {
+        return 1;
+    }
 
-            if(!e->val) {
-                mem_free(e->name);
-                mem_free(e);
-                return 1;
-            }
+    /* does the entry exist? */
+    index = find_index(attrs, name, &found);
+    if(found) {
+        /* the old value is left in the pool. */
+        attrs->entries[index].val = val_offset;
+        return 0;
+    }
 
-            /* link it in the list */
-            e->next = attrs->head;
-            attrs->head = e;
-        } else {
-            /* allocation failed */
-            return 1;
-        }
+    /* no match, need a new entry */
+    name_offset = pool_add(attrs, name);
+    if(name_offset < 0) {
+        return 1;
     }
 
-    return 0;
+    return attr_put(attrs, name_offset, val_offset, -1);
 }
 
 
@@ -302,7 +467,7 @@ extern int attr_set_float(attr attrs, const char *name, float val)
 /*
  * attr_get
  *
- * Walk the list of attrs and return the value found with the passed name.
+ * Look up the passed name and return its value.
  * If the name is not found, return the passed default value.
  */
 extern const char *attr_get_str(attr attrs, const char *name, const char *def)
@@ -317,7 +482,7 @@ extern const char *attr_get_str(attr attrs, const char *name, const char *def)
 
     /* only return a value if there is one. */
     if(e) {
-        return e->val;
+        return attrs->pool + e->val;
     } else {
         return def;
     }
@@ -370,81 +535,216 @@ extern float attr_get_float(attr attrs, const char *name, float def)
 
 extern int attr_remove(attr attrs, const char *name)
 {
-    attr_entry e, p;
+    int found = 0;
+    int index = 0;
 
-    if(!attrs)
+    if(!attrs || !name)
         return 0;
 
-    e = attrs->head;
+    index = find_index(attrs, name, &found);
 
-    /* no such entry, return */
-    if(!e)
-        return 0;
+    if(found) {
+        attrs->num_entries--;
 
-    /* loop to find the entry */
-    p = NULL;
+        if(index < attrs->num_entries) {
+            mem_move(&(attrs->entries[index]), &(attrs->entries[index + 1]), (int)(sizeof(struct attr_entry_t) * (size_t)(attrs->num_entries - index)));
+        }
 
-    while(e) {
-        if(str_cmp(e->name, name) == 0) {
-            break;
+        attrs->cacheable = 0;
+    } /* else not found */
+
+    return 0;
+}
+
+
+/*
+ * attr_delete
+ *
+ * Destroy and free all memory for an attribute list.
+ */
+extern void attr_destroy(attr a)
+{
+    if(!a)
+        return;
+
+    if(a->entries) {
+        mem_free(a->entries);
+    }
+
+    if(a->pool) {
+        mem_free(a->pool);
+    }
+
+    mem_free(a);
+}
+
+
+
+/*
+ * attr_cache_clear
+ *
+ * Free the cache of parsed attribute strings.
+ */
+extern void attr_cache_clear(void)
+{
+    spin_block(&attr_cache_lock) {
+        for(int i=0; i < ATTR_CACHE_SIZE; i++) {
+            if(attr_cache[i].str) {
+                mem_free(attr_cache[i].str);
+                attr_destroy(attr_cache[i].attrs);
+            }
+
+            attr_cache[i].str = NULL;
+            attr_cache[i].len = 0;
+            attr_cache[i].attrs = NULL;
         }
 
-        p = e;
-        e = e->next;
+        attr_cache_next = 0;
     }
+}
 
-    if(e) {
-        /* unlink the node */
-        if(!p) {
-            attrs->head = e->next;
-        } else {
-            p->next = e->next;
+
+
+
+/*
+ * attr_cache_load_prefix
+ *
+ * Find the cached string with the longest run of whole name/value pairs
+ * in common with attr_str and copy the entries for those pairs into a.
+ * Returns the number of characters covered or -1 on error.
+ */
+
+int attr_cache_load_prefix(attr a, const char *attr_str, int *segment)
+{
+    int rc = 0;
+
+    *segment = 0;
+
+    spin_block(&attr_cache_lock) {
+        attr_cache_entry_t *best = NULL;
+        int best_len = 0;
+        int best_segments = 0;
+
+        for(int i=0; i < ATTR_CACHE_SIZE; i++) {
+            attr_cache_entry_t *entry = &attr_cache[i];
+            int prefix_len = 0;
+            int num_segments = 0;
+
+            if(!entry->str) {
+                continue;
+            }
+
+            /* the prefix must end just after a '&' in both strings. */
+            for(int j=0; j < entry->len && entry->str[j] == attr_str[j]; j++) {
+                if(entry->str[j] == '&') {
+                    prefix_len = j + 1;
+                    num_segments++;
+                }
+            }
+
+            if(prefix_len > best_len) {
+                best = entry;
+                best_len = prefix_len;
+                best_segments = num_segments;
+            }
         }
 
-        if(e->name) {
-            mem_free(e->name);
+        if(!best) {
+            break;
         }
 
-        if(e->val) {
-            mem_free(e->val);
+        if(pool_reserve(a, best_len) || entries_reserve(a, best->attrs->num_entries)) {
+            rc = -1;
+            break;
         }
 
-        mem_free(e);
-    } /* else not found */
+        /* the pool layout follows the string, so offsets carry over. */
+        mem_copy(a->pool, best->attrs->pool, best_len);
+        a->pool_size = best_len;
 
-    return 0;
+        for(int i=0; i < best->attrs->num_entries; i++) {
+            if(best->attrs->entries[i].segment < best_segments) {
+                a->entries[a->num_entries] = best->attrs->entries[i];
+                a->num_entries++;
+            }
+        }
+
+        *segment = best_segments;
+        rc = best_len;
+    }
+
+    return rc;
 }
 
 
+
 /*
- * attr_delete
+ * attr_cache_store
  *
- * Destroy and free all memory for an attribute list.
+ * Keep a copy of a freshly parsed attribute set.  The oldest entry is
+ * replaced.
  */
-extern void attr_destroy(attr a)
+
+void attr_cache_store(const char *attr_str, int len, attr a)
 {
-    attr_entry e, p;
+    char *str_copy = str_dup(attr_str);
+    attr attrs_copy = attr_clone(a, len + 1, a->num_entries);
+    char *old_str = NULL;
+    attr old_attrs = NULL;
+
+    if(!str_copy || !attrs_copy) {
+        if(str_copy) {
+            mem_free(str_copy);
+        }
+
+        attr_destroy(attrs_copy);
 
-    if(!a)
         return;
+    }
 
-    e = a->head;
+    spin_block(&attr_cache_lock) {
+        attr_cache_entry_t *entry = &attr_cache[attr_cache_next];
 
-    /* walk down the entry list and free as we go. */
-    while(e) {
-        if(e->name) {
-            mem_free(e->name);
-        }
+        old_str = entry->str;
+        old_attrs = entry->attrs;
 
-        if(e->val) {
-            mem_free(e->val);
-        }
+        entry->str = str_copy;
+        entry->len = len;
+        entry->attrs = attrs_copy;
 
-        p = e;
-        e = e->next;
+        attr_cache_next = (attr_cache_next + 1) % ATTR_CACHE_SIZE;
+    }
 
-        mem_free(p);
+    if(old_str) {
+        mem_free(old_str);
     }
 
-    mem_free(a);
+    attr_destroy(old_attrs);
+}
+
+
+
+/* copy the first len bytes of the pool and num entries. */
+attr attr_clone(attr a, int len, int num)
+{
+    attr res = attr_create();
+
+    if(!res) {
+        return NULL;
+    }
+
+    if(pool_reserve(res, len) || entries_reserve(res, num)) {
+        attr_destroy(res);
+        return NULL;
+    }
+
+    mem_copy(res->pool, a->pool, len);
+    res->pool_size = len;
+
+    mem_copy(res->entries, a->entries, (int)(sizeof(struct attr_entry_t) * (size_t)num));
+    res->num_entries = num;
+
+    res->cacheable = a->cacheable;
+
+    return res;
 }
@@ -48,5 +48,6 @@ extern int attr_get_int(attr attrs, const char *name, int def);
 extern float attr_get_float(attr attrs, const char *name, float def);
 extern int attr_remove(attr attrs, const char *name);
 extern void attr_destroy(attr attrs);
+extern void attr_cache_clear(void);
 
 
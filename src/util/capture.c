@@ -0,0 +1,167 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <stdio.h>
+#include <platform.h>
+#include <lib/libplctag.h>
+#include <util/capture.h>
+#include <util/debug.h>
+
+struct capture_t {
+    FILE *file;
+    mutex_p mutex;
+    int64_t last_us;
+};
+
+
+static void encode_uint32_le(uint8_t *data, uint32_t val);
+
+
+/*
+ * Open a capture file and write its header.  Returns NULL if the file
+ * can not be created, the caller runs without a capture then.
+ */
+capture_p capture_open(const char *file_name, int protocol)
+{
+    capture_p cap = NULL;
+    uint8_t header[CAPTURE_HEADER_SIZE];
+    int64_t now_us = time_us();
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(!file_name || !str_length(file_name)) {
+        pdebug(DEBUG_WARN, "Capture file name is missing!");
+        return NULL;
+    }
+
+    cap = (capture_p)mem_alloc((int)(unsigned int)sizeof(*cap));
+    if(!cap) {
+        pdebug(DEBUG_WARN, "Unable to allocate capture state!");
+        return NULL;
+    }
+
+    if(mutex_create(&(cap->mutex)) != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to create capture mutex!");
+        mem_free(cap);
+        return NULL;
+    }
+
+    cap->file = fopen(file_name, "wb");
+    if(!cap->file) {
+        pdebug(DEBUG_WARN, "Unable to open capture file %s!", file_name);
+        mutex_destroy(&(cap->mutex));
+        mem_free(cap);
+        return NULL;
+    }
+
+    mem_copy(header, CAPTURE_MAGIC, 6);
+    header[6] = (uint8_t)CAPTURE_VERSION;
+    header[7] = (uint8_t)protocol;
+    encode_uint32_le(&header[8], (uint32_t)((uint64_t)now_us & 0xFFFFFFFF));
+    encode_uint32_le(&header[12], (uint32_t)((uint64_t)now_us >> 32));
+
+    fwrite(header, 1, sizeof(header), cap->file);
+
+    cap->last_us = now_us;
+
+    pdebug(DEBUG_INFO, "Capturing traffic to %s.", file_name);
+
+    return cap;
+}
+
+
+
+/* record one frame, given in one or more pieces. */
+void capture_frame(capture_p cap, int direction, const socket_buf_t *bufs, int num_bufs)
+{
+    uint8_t record[CAPTURE_RECORD_HEADER_SIZE];
+    uint32_t length = 0;
+
+    if(!cap) {
+        return;
+    }
+
+    for(int i=0; i < num_bufs; i++) {
+        length += (uint32_t)bufs[i].size;
+    }
+
+    critical_block(cap->mutex) {
+        int64_t now_us = time_us();
+        int64_t delta_us = now_us - cap->last_us;
+
+        if(delta_us < 0) {
+            delta_us = 0;
+        } else if(delta_us > UINT32_MAX) {
+            delta_us = UINT32_MAX;
+        }
+
+        cap->last_us = now_us;
+
+        record[0] = (uint8_t)direction;
+        encode_uint32_le(&record[1], (uint32_t)delta_us);
+        encode_uint32_le(&record[5], length);
+
+        fwrite(record, 1, sizeof(record), cap->file);
+
+        for(int i=0; i < num_bufs; i++) {
+            fwrite(bufs[i].data, 1, (size_t)(unsigned int)bufs[i].size, cap->file);
+        }
+    }
+}
+
+
+
+void capture_close(capture_p cap)
+{
+    if(!cap) {
+        return;
+    }
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    fclose(cap->file);
+    mutex_destroy(&(cap->mutex));
+    mem_free(cap);
+
+    pdebug(DEBUG_INFO, "Done.");
+}
+
+
+
+void encode_uint32_le(uint8_t *data, uint32_t val)
+{
+    data[0] = (uint8_t)(val & 0xFF);
+    data[1] = (uint8_t)((val >> 8) & 0xFF);
+    data[2] = (uint8_t)((val >> 16) & 0xFF);
+    data[3] = (uint8_t)((val >> 24) & 0xFF);
+}
@@ -0,0 +1,79 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <platform.h>
+
+/*
+ * Raw traffic capture.
+ *
+ * A session or PLC connection with a capture file records every frame it
+ * sends or receives, with the time since the previous frame.  The
+ * replay_server test program serves the recorded responses back with the
+ * same timing.
+ *
+ * The file starts with a 16 byte header:
+ *
+ *     "PLCCAP"   magic
+ *     uint8      format version, 1
+ *     uint8      protocol, CAPTURE_PROTOCOL_*
+ *     uint64     start time, microseconds since the epoch
+ *
+ * followed by one record per frame:
+ *
+ *     uint8      direction, CAPTURE_DIR_*
+ *     uint32     microseconds since the previous record or the start
+ *     uint32     frame length
+ *     ...        the frame bytes
+ *
+ * All the integers are little endian.
+ */
+
+#define CAPTURE_MAGIC "PLCCAP"
+#define CAPTURE_VERSION (1)
+#define CAPTURE_HEADER_SIZE (16)
+#define CAPTURE_RECORD_HEADER_SIZE (9)
+
+#define CAPTURE_PROTOCOL_EIP (1)
+#define CAPTURE_PROTOCOL_MODBUS_TCP (2)
+
+#define CAPTURE_DIR_SENT (0)        /* to the PLC. */
+#define CAPTURE_DIR_RECEIVED (1)    /* from the PLC. */
+
+typedef struct capture_t *capture_p;
+
+extern capture_p capture_open(const char *file_name, int protocol);
+extern void capture_frame(capture_p cap, int direction, const socket_buf_t *bufs, int num_bufs);
+extern void capture_close(capture_p cap);
@@ -32,6 +32,7 @@
  ***************************************************************************/
 
 #include <stdarg.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -49,13 +50,87 @@
  */
 
 
-static int global_debug_level = DEBUG_NONE;
+int debug_current_level = DEBUG_NONE;
 static lock_t thread_num_lock = LOCK_INIT;
 static volatile uint32_t thread_num = 1;
 static lock_t logger_callback_lock = LOCK_INIT;
 static void (* volatile log_callback_func)(int32_t tag_id, int debug_level, const char *message);
 
 
+/*
+ * Asynchronous logging.
+ *
+ * Each thread that logs gets its own single producer, single consumer ring
+ * of records.  A record holds the template pointer and copies of the raw
+ * arguments.  The logger thread merges the rings by time, formats each
+ * record and writes it out or hands it to the logger callback.  If a ring
+ * is full, the message cannot be captured or there are no rings left, the
+ * message is formatted and written on the calling thread as before.
+ */
+
+#define LOG_MAX_RINGS (64)
+#define LOG_RING_SIZE (128)
+#define LOG_MAX_ARGS (12)
+#define LOG_STR_SPACE (256)
+#define LOG_WAIT_MS (20)
+
+#define LOG_ARG_INT (0)
+#define LOG_ARG_UINT (1)
+#define LOG_ARG_DOUBLE (2)
+#define LOG_ARG_STR (3)
+#define LOG_ARG_PTR (4)
+
+typedef struct {
+    uint8_t type;
+    union {
+        int64_t i;
+        uint64_t u;
+        double d;
+        int str_offset;
+        void *p;
+    } val;
+} log_arg_t;
+
+typedef struct {
+    int64_t epoch_ms;
+    const char *func;
+    const char *templ;
+    uint32_t thread_id;
+    int tag_id;
+    int line_num;
+    int debug_level;
+    int num_args;
+    int str_used;
+    log_arg_t args[LOG_MAX_ARGS];
+    char str_space[LOG_STR_SPACE];
+} log_record_t;
+
+typedef struct {
+    volatile uint32_t head;
+    volatile uint32_t tail;
+    log_record_t records[LOG_RING_SIZE];
+} log_ring_t;
+
+static lock_t log_ring_lock = LOCK_INIT;
+static log_ring_t * volatile log_rings[LOG_MAX_RINGS] = { NULL };
+static volatile int log_num_rings = 0;
+static volatile int log_async_enabled = 0;
+static volatile int log_async_terminating = 0;
+static thread_p log_thread = NULL;
+static cond_p log_cond = NULL;
+
+static THREAD_LOCAL log_ring_t *this_thread_ring = NULL;
+static THREAD_LOCAL int this_thread_no_ring = 0;
+static THREAD_LOCAL int this_thread_signaling = 0;
+
+static int log_capture(log_record_t *rec, const char *templ, va_list va);
+static int log_format_record(log_record_t *rec, char *output, int output_size);
+static void log_emit(int64_t epoch_ms, uint32_t thread_id, int t_id, int debug_level, const char *func, int line_num, const char *message);
+static log_ring_t *log_get_ring(void);
+static int log_drain(void);
+static THREAD_FUNC(log_thread_func);
+
+
 /*
  * Keep the thread ID and the tag ID thread local.
  */
@@ -71,9 +146,9 @@ static THREAD_LOCAL int tag_id = 0;
 
 int set_debug_level(int level)
 {
-    int old_level = global_debug_level;
+    int old_level = debug_current_level;
 
-    global_debug_level = level;
+    debug_current_level = level;
 
     return old_level;
 }
@@ -81,7 +156,7 @@ int set_debug_level(int level)
 
 int get_debug_level(void)
 {
-    return global_debug_level;
+    return debug_current_level;
 }
 
 
@@ -148,69 +223,577 @@ static const char *debug_level_name[DEBUG_END] = {"NONE", "ERROR", "WARN", "INFO
 extern void pdebug_impl(const char *func, int line_num, int debug_level, const char *templ, ...)
 {
     va_list va;
+    char output[1000];
+
+    /* try to hand the message off to the logger thread. */
+    if(log_async_enabled) {
+        log_ring_t *ring = (this_thread_ring ? this_thread_ring : log_get_ring());
+
+        if(ring && (ring->tail - ring->head) < LOG_RING_SIZE) {
+            log_record_t *rec = &(ring->records[ring->tail % LOG_RING_SIZE]);
+            int captured = 0;
+
+            rec->epoch_ms = time_epoch_ms();
+            rec->func = func;
+            rec->templ = templ;
+            rec->thread_id = get_thread_id();
+            rec->tag_id = tag_id;
+            rec->line_num = line_num;
+            rec->debug_level = debug_level;
+
+            va_start(va, templ);
+            captured = log_capture(rec, templ, va);
+            va_end(va);
+
+            if(captured) {
+                /* make sure the record is visible before the new tail. */
+                mem_barrier();
+                ring->tail++;
+
+                /* cond_signal() can log too, do not wake the logger from inside itself. */
+                if((ring->tail - ring->head) > LOG_RING_SIZE/2 && !this_thread_signaling) {
+                    this_thread_signaling = 1;
+                    cond_signal(log_cond);
+                    this_thread_signaling = 0;
+                }
+
+                return;
+            }
+        }
+    }
+
+    /* format the message on this thread. */
+    va_start(va,templ);
+
+    /* FIXME - check the output size */
+    vsnprintf(output, sizeof(output), templ, va);
+
+    va_end(va);
+
+    /* make sure it is zero terminated */
+    output[sizeof(output)-1] = 0;
+
+    log_emit(time_epoch_ms(), get_thread_id(), tag_id, debug_level, func, line_num, output);
+}
+
+
+
+/*
+ * log_emit
+ *
+ * Add the prefix to the message and write it out.
+ */
+
+void log_emit(int64_t epoch_ms, uint32_t thread_id, int t_id, int debug_level, const char *func, int line_num, const char *message)
+{
     struct tm t;
     time_t epoch;
-    int64_t epoch_ms;
     int remainder_ms;
-    char prefix[1000]; /* MAGIC */
-    int prefix_size = 0;
-    char output[1000];
-    //int output_size = 0;
-
-    /* build the prefix */
-    // prefix_size = make_prefix(prefix,(int)sizeof(prefix));  /* don't exceed a size that int can express! */
-    // if(prefix_size <= 0) {
-    //     return;
-    // }
+    char output[1200]; /* MAGIC */
 
     /* get the time parts */
-    epoch_ms = time_ms();
     epoch = (time_t)(epoch_ms/1000);
     remainder_ms = (int)(epoch_ms % 1000);
 
     /* FIXME - should capture error return! */
     localtime_r(&epoch,&t);
 
-    /* print only once */
-    /* FIXME - this may not be safe. */
-    // if(!printed_version && debug_level >= DEBUG_INFO) {
-    //     if(lock_acquire_try((lock_t*)&printed_version)) {
-    //         /* create the output string template */
-    //         fprintf(stderr,"%s INFO libplctag version %s, debug level %d.\n",prefix, VERSION, get_debug_level());
-    //     }
-    // }
-
-    /* build the output string template */
-    prefix_size += snprintf(prefix, sizeof(prefix),"%04d-%02d-%02d %02d:%02d:%02d.%03d thread(%u) tag(%d) %s %s:%d %s\n",
-                                                    t.tm_year+1900,
-                                                    t.tm_mon + 1, /* month is 0-11? */
-                                                    t.tm_mday,
-                                                    t.tm_hour,
-                                                    t.tm_min,
-                                                    t.tm_sec,
-                                                    remainder_ms, 
-                                                    get_thread_id(), 
-                                                    tag_id, 
-                                                    debug_level_name[debug_level], 
-                                                    func, 
-                                                    line_num, 
-                                                    templ);
+    /* build the output string */
+    snprintf(output, sizeof(output),"%04d-%02d-%02d %02d:%02d:%02d.%03d thread(%u) tag(%d) %s %s:%d %s\n",
+                                    t.tm_year+1900,
+                                    t.tm_mon + 1, /* month is 0-11? */
+                                    t.tm_mday,
+                                    t.tm_hour,
+                                    t.tm_min,
+                                    t.tm_sec,
+                                    remainder_ms,
+                                    thread_id,
+                                    t_id,
+                                    debug_level_name[debug_level],
+                                    func,
+                                    line_num,
+                                    message);
 
     /* make sure it is zero terminated */
-    prefix[sizeof(prefix)-1] = 0;
-
-    /* print it out. */
-    va_start(va,templ);
+    output[sizeof(output)-1] = 0;
 
-    /* FIXME - check the output size */
-    /*output_size = */vsnprintf(output, sizeof(output), prefix, va);
     if(log_callback_func) {
-        log_callback_func(tag_id, debug_level, output);
+        log_callback_func(t_id, debug_level, output);
     } else {
         fputs(output, stderr);
     }
+}
 
-    va_end(va);
+
+
+/*
+ * log_capture
+ *
+ * Walk the template and copy out each argument according to its conversion.
+ * Strings are copied into the record.  Returns zero if the message cannot be
+ * captured and must be formatted right away.
+ */
+
+int log_capture(log_record_t *rec, const char *templ, va_list va)
+{
+    const char *p = templ;
+
+    rec->num_args = 0;
+    rec->str_used = 0;
+
+    while(*p) {
+        int is_long = 0;
+        int is_long_long = 0;
+        int is_size = 0;
+
+        if(*p != '%') {
+            p++;
+            continue;
+        }
+
+        p++;
+
+        if(*p == '%') {
+            p++;
+            continue;
+        }
+
+        /* flags */
+        while(*p == '-' || *p == '+' || *p == ' ' || *p == '#' || *p == '0') {
+            p++;
+        }
+
+        /* width and precision, '*' takes an int argument. */
+        for(int part = 0; part < 2; part++) {
+            if(part == 1) {
+                if(*p != '.') {
+                    break;
+                }
+
+                p++;
+            }
+
+            if(*p == '*') {
+                if(rec->num_args >= LOG_MAX_ARGS) {
+                    return 0;
+                }
+
+                rec->args[rec->num_args].type = LOG_ARG_INT;
+                rec->args[rec->num_args].val.i = va_arg(va, int);
+                rec->num_args++;
+                p++;
+            } else {
+                while(*p >= '0' && *p <= '9') {
+                    p++;
+                }
+            }
+        }
+
+        /* length modifiers */
+        for(;;) {
+            if(*p == 'h') {
+                p++;
+            } else if(*p == 'l') {
+                if(is_long) {
+                    is_long_long = 1;
+                }
+                is_long = 1;
+                p++;
+            } else if(*p == 'q' || *p == 'j' || *p == 'L') {
+                is_long_long = 1;
+                p++;
+            } else if(*p == 'z' || *p == 't') {
+                is_size = 1;
+                p++;
+            } else if(p[0] == 'I' && p[1] == '6' && p[2] == '4') {
+                is_long_long = 1;
+                p += 3;
+            } else if(p[0] == 'I' && p[1] == '3' && p[2] == '2') {
+                p += 3;
+            } else {
+                break;
+            }
+        }
+
+        if(!*p) {
+            break;
+        }
+
+        if(rec->num_args >= LOG_MAX_ARGS) {
+            return 0;
+        }
+
+        switch(*p) {
+            case 'd':
+            case 'i':
+            case 'c':
+                rec->args[rec->num_args].type = LOG_ARG_INT;
+
+                if(is_long_long) {
+                    rec->args[rec->num_args].val.i = (int64_t)va_arg(va, long long);
+                } else if(is_size) {
+                    rec->args[rec->num_args].val.i = (int64_t)va_arg(va, ptrdiff_t);
+                } else if(is_long) {
+                    rec->args[rec->num_args].val.i = (int64_t)va_arg(va, long);
+                } else {
+                    rec->args[rec->num_args].val.i = (int64_t)va_arg(va, int);
+                }
+                break;
+
+            case 'u':
+            case 'x':
+            case 'X':
+            case 'o':
+                rec->args[rec->num_args].type = LOG_ARG_UINT;
+
+                if(is_long_long) {
+                    rec->args[rec->num_args].val.u = (uint64_t)va_arg(va, unsigned long long);
+                } else if(is_size) {
+                    rec->args[rec->num_args].val.u = (uint64_t)va_arg(va, size_t);
+                } else if(is_long) {
+                    rec->args[rec->num_args].val.u = (uint64_t)va_arg(va, unsigned long);
+                } else {
+                    rec->args[rec->num_args].val.u = (uint64_t)va_arg(va, unsigned int);
+                }
+                break;
+
+            case 'f':
+            case 'F':
+            case 'e':
+            case 'E':
+            case 'g':
+            case 'G':
+                rec->args[rec->num_args].type = LOG_ARG_DOUBLE;
+                rec->args[rec->num_args].val.d = va_arg(va, double);
+                break;
+
+            case 's':
+                {
+                    const char *str = va_arg(va, const char *);
+                    int len = 0;
+
+                    if(!str) {
+                        str = "(null)";
+                    }
+
+                    len = (int)strlen(str);
+
+                    if(len >= LOG_STR_SPACE - rec->str_used) {
+                        return 0;
+                    }
+
+                    memcpy(&(rec->str_space[rec->str_used]), str, (size_t)len + 1);
+                    rec->args[rec->num_args].type = LOG_ARG_STR;
+                    rec->args[rec->num_args].val.str_offset = rec->str_used;
+                    rec->str_used += len + 1;
+                }
+                break;
+
+            case 'p':
+                rec->args[rec->num_args].type = LOG_ARG_PTR;
+                rec->args[rec->num_args].val.p = va_arg(va, void *);
+                break;
+
+            default:
+                /* not something we know how to capture. */
+                return 0;
+        }
+
+        rec->num_args++;
+        p++;
+    }
+
+    return 1;
+}
+
+
+
+/*
+ * log_format_record
+ *
+ * Format a captured message.  Each conversion is formatted on its own with
+ * the length modifiers replaced to match how the argument was stored.
+ */
+
+int log_format_record(log_record_t *rec, char *output, int output_size)
+{
+    const char *p = rec->templ;
+    int out = 0;
+    int arg = 0;
+
+    while(*p && out < output_size - 1) {
+        char spec[32];
+        int spec_len = 0;
+        int rc = 0;
+        log_arg_t *a = NULL;
+
+        if(*p != '%') {
+            output[out++] = *p++;
+            continue;
+        }
+
+        if(p[1] == '%') {
+            output[out++] = '%';
+            p += 2;
+            continue;
+        }
+
+        /* copy flags, width and precision, expanding any '*'. */
+        spec[spec_len++] = *p++;
+
+        while(*p && spec_len < (int)sizeof(spec) - 24 && strchr("-+ #0123456789.*", *p)) {
+            if(*p == '*') {
+                spec_len += snprintf(&spec[spec_len], sizeof(spec) - (size_t)spec_len, "%d", (int)rec->args[arg++].val.i);
+            } else {
+                spec[spec_len++] = *p;
+            }
+
+            p++;
+        }
+
+        /* drop the length modifiers. */
+        while(*p && strchr("hlqjLzt", *p)) {
+            p++;
+        }
+
+        if(p[0] == 'I' && (p[1] == '6' || p[1] == '3')) {
+            p += 3;
+        }
+
+        if(!*p || arg >= rec->num_args) {
+            break;
+        }
+
+        a = &(rec->args[arg++]);
+
+        switch(a->type) {
+            case LOG_ARG_INT:
+                if(*p == 'c') {
+                    spec[spec_len++] = 'c';
+                    spec[spec_len] = 0;
+                    rc = snprintf(&output[out], (size_t)(output_size - out), spec, (int)a->val.i);
+                } else {
+                    spec[spec_len++] = 'l';
+                    spec[spec_len++] = 'l';
+                    spec[spec_len++] = 'd';
+                    spec[spec_len] = 0;
+                    rc = snprintf(&output[out], (size_t)(output_size - out), spec, (long long)a->val.i);
+                }
+                break;
+
+            case LOG_ARG_UINT:
+                spec[spec_len++] = 'l';
+                spec[spec_len++] = 'l';
+                spec[spec_len++] = *p;
+                spec[spec_len] = 0;
+                rc = snprintf(&output[out], (size_t)(output_size - out), spec, (unsigned long long)a->val.u);
+                break;
+
+            case LOG_ARG_DOUBLE:
+                spec[spec_len++] = *p;
+                spec[spec_len] = 0;
+                rc = snprintf(&output[out], (size_t)(output_size - out), spec, a->val.d);
+                break;
+
+            case LOG_ARG_STR:
+                spec[spec_len++] = 's';
+                spec[spec_len] = 0;
+                rc = snprintf(&output[out], (size_t)(output_size - out), spec, &(rec->str_space[a->val.str_offset]));
+                break;
+
+            case LOG_ARG_PTR:
+                spec[spec_len++] = 'p';
+                spec[spec_len] = 0;
+                rc = snprintf(&output[out], (size_t)(output_size - out), spec, a->val.p);
+                break;
+
+            default:
+                break;
+        }
+
+        if(rc > 0) {
+            out += rc;
+        }
+
+        p++;
+    }
+
+    if(out > output_size - 1) {
+        out = output_size - 1;
+    }
+
+    output[out] = 0;
+
+    return out;
+}
+
+
+
+/*
+ * log_get_ring
+ *
+ * Set up the ring for the calling thread.  Rings are never freed, so the
+ * number of them is capped.  Threads past the cap log synchronously.
+ */
+
+log_ring_t *log_get_ring(void)
+{
+    log_ring_t *ring = NULL;
+
+    if(this_thread_no_ring) {
+        return NULL;
+    }
+
+    spin_block(&log_ring_lock) {
+        if(log_num_rings < LOG_MAX_RINGS) {
+            ring = (log_ring_t *)mem_alloc((int)sizeof(log_ring_t));
+
+            if(ring) {
+                log_rings[log_num_rings] = ring;
+                log_num_rings++;
+            }
+        }
+    }
+
+    if(ring) {
+        this_thread_ring = ring;
+    } else {
+        this_thread_no_ring = 1;
+    }
+
+    return ring;
+}
+
+
+
+/*
+ * log_drain
+ *
+ * Write out everything in the rings, oldest first.  Returns the number of
+ * records written.
+ */
+
+int log_drain(void)
+{
+    char message[1000];
+    int count = 0;
+
+    for(;;) {
+        log_ring_t *oldest = NULL;
+        log_record_t *rec = NULL;
+
+        for(int i=0; i < log_num_rings; i++) {
+            log_ring_t *ring = log_rings[i];
+
+            if(ring && ring->head != ring->tail) {
+                mem_barrier();
+
+                if(!oldest || ring->records[ring->head % LOG_RING_SIZE].epoch_ms < oldest->records[oldest->head % LOG_RING_SIZE].epoch_ms) {
+                    oldest = ring;
+                }
+            }
+        }
+
+        if(!oldest) {
+            break;
+        }
+
+        rec = &(oldest->records[oldest->head % LOG_RING_SIZE]);
+
+        log_format_record(rec, message, (int)sizeof(message));
+        log_emit(rec->epoch_ms, rec->thread_id, rec->tag_id, rec->debug_level, rec->func, rec->line_num, message);
+
+        /* done with the record before the producer can reuse it. */
+        mem_barrier();
+        oldest->head++;
+
+        count++;
+    }
+
+    return count;
+}
+
+
+
+THREAD_FUNC(log_thread_func)
+{
+    (void)arg;
+
+    while(!log_async_terminating) {
+        if(!log_drain()) {
+            cond_wait(log_cond, LOG_WAIT_MS);
+        }
+    }
+
+    /* catch anything that came in while stopping. */
+    log_drain();
+
+    THREAD_RETURN(0);
+}
+
+
+
+/*
+ * debug_async_start
+ * debug_async_stop
+ *
+ * Start and stop the logger thread.  Stopping writes out anything still
+ * queued.
+ */
+
+int debug_async_start(void)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    if(log_thread) {
+        return PLCTAG_STATUS_OK;
+    }
+
+    if(!log_cond) {
+        rc = cond_create(&log_cond);
+        if(rc != PLCTAG_STATUS_OK) {
+            return rc;
+        }
+    }
+
+    log_async_terminating = 0;
+
+    rc = thread_create(&log_thread, log_thread_func, 32*1024, NULL);
+    if(rc != PLCTAG_STATUS_OK) {
+        log_thread = NULL;
+        return rc;
+    }
+
+    log_async_enabled = 1;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+void debug_async_stop(void)
+{
+    log_async_enabled = 0;
+
+    if(log_thread) {
+        log_async_terminating = 1;
+        cond_signal(log_cond);
+
+        thread_join(log_thread);
+        thread_destroy(&log_thread);
+        log_thread = NULL;
+    }
+
+    /*
+     * producers that were part way through a message.  The condition
+     * variable is kept since they may still signal it.
+     */
+    log_drain();
+}
+
+
+int debug_async_enabled(void)
+{
+    return log_async_enabled;
 }
 
 
@@ -252,7 +835,7 @@ extern void pdebug_dump_bytes_impl(const char *func, int line_num, int debug_lev
 
         /* output it, finally */
         //fprintf(stderr,"%s\n",row_buf);
-        pdebug_impl(func, line_num, debug_level, row_buf);
+        pdebug_impl(func, line_num, debug_level, "%s", row_buf);
     }
 
 
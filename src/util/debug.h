@@ -48,8 +48,19 @@
 #define DEBUG_SPEW      (5)
 #define DEBUG_END       (6)
 
+/*
+ * Messages above PLCTAG_MAX_DEBUG_LEVEL are compiled out.  Set it with the
+ * MAX_DEBUG_LEVEL CMake option, the default keeps every level.
+ */
+#ifndef PLCTAG_MAX_DEBUG_LEVEL
+    #define PLCTAG_MAX_DEBUG_LEVEL DEBUG_SPEW
+#endif
+
 extern int set_debug_level(int debug_level);
 extern int get_debug_level(void);
+
+/* what get_debug_level() returns, read directly by the logging macros. */
+extern int debug_current_level;
 extern void debug_set_tag_id(int tag_id);
 
 extern void pdebug_impl(const char *func, int line_num, int debug_level, const char *templ, ...);
@@ -61,10 +72,15 @@ extern void pdebug_impl(const char *func, int line_num, int debug_level, const c
 
 
 #define pdebug(dbg,...)                                                \
-   do { if((dbg) != DEBUG_NONE && (dbg) <= get_debug_level()) pdebug_impl(__func__, __LINE__, dbg, __VA_ARGS__); } while(0)
+   do { if((dbg) != DEBUG_NONE && (dbg) <= PLCTAG_MAX_DEBUG_LEVEL && (dbg) <= debug_current_level) pdebug_impl(__func__, __LINE__, dbg, __VA_ARGS__); } while(0)
 
 extern void pdebug_dump_bytes_impl(const char *func, int line_num, int debug_level, uint8_t *data,int count);
-#define pdebug_dump_bytes(dbg, d,c)  do { if((dbg) != DEBUG_NONE && (dbg) <= get_debug_level()) pdebug_dump_bytes_impl(__func__, __LINE__,dbg,d,c); } while(0)
+#define pdebug_dump_bytes(dbg, d,c)  do { if((dbg) != DEBUG_NONE && (dbg) <= PLCTAG_MAX_DEBUG_LEVEL && (dbg) <= debug_current_level) pdebug_dump_bytes_impl(__func__, __LINE__,dbg,d,c); } while(0)
 
 extern int debug_register_logger(void (*log_callback_func)(int32_t tag_id, int debug_level, const char *message));
 extern int debug_unregister_logger(void);
+
+/* format and write log messages on a background thread. */
+extern int debug_async_start(void);
+extern void debug_async_stop(void);
+extern int debug_async_enabled(void);
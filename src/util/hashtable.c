@@ -39,38 +39,50 @@
 #include <util/vector.h>
 
 /*
- * This implements a simple linear probing hash table.
+ * This implements a Robin Hood open addressing hash table.
  *
- * Note that it will readjust its size if enough entries are made.
+ * Each entry is kept as close to its home slot as possible.  On insert an
+ * entry that is further from home takes the slot of one that is closer to
+ * home, so the probe distances stay short and even.  That lets a search
+ * stop as soon as it hits an empty slot or an entry that is closer to home
+ * than the key would be.  Removal shifts the following entries back so
+ * there are no tombstones.
+ *
+ * The table size is a power of two and it doubles when it gets more than
+ * three quarters full.
  */
 
-#define MAX_ITERATIONS  (10)
-#define MAX_INCREMENT (10000)
+#define MIN_CAPACITY (8)
+#define MAX_LOAD_NUM (3)
+#define MAX_LOAD_DEN (4)
 
 struct hashtable_entry_t {
     void *data;
     int64_t key;
+    uint32_t hash;
 };
 
 struct hashtable_t {
     int total_entries;
     int used_entries;
     uint32_t hash_salt;
+    uint32_t mask;
     struct hashtable_entry_t *entries;
 };
 
 
 typedef struct hashtable_entry_t *hashtable_entry_p;
 
-//static int next_highest_prime(int x);
+static uint32_t key_hash(hashtable_p table, int64_t key);
 static int find_key(hashtable_p table, int64_t key);
-static int find_empty(hashtable_p table, int64_t key);
+static void insert_entry(hashtable_p table, struct hashtable_entry_t entry);
 static int expand_table(hashtable_p table);
 
 
 hashtable_p hashtable_create(int initial_capacity)
 {
     hashtable_p tab = NULL;
+    int total_entries = MIN_CAPACITY;
 
     pdebug(DEBUG_INFO,"Starting");
 
@@ -79,17 +91,22 @@ hashtable_p hashtable_create(int initial_capacity)
         return NULL;
     }
 
+    while(total_entries < initial_capacity && total_entries < (INT32_MAX / 2)) {
+        total_entries *= 2;
+    }
+
     tab = mem_alloc(sizeof(struct hashtable_t));
     if(!tab) {
         pdebug(DEBUG_ERROR,"Unable to allocate memory for hash table!");
         return NULL;
     }
 
-    tab->total_entries = initial_capacity;
+    tab->total_entries = total_entries;
     tab->used_entries = 0;
+    tab->mask = (uint32_t)(total_entries - 1);
     tab->hash_salt = (uint32_t)(time_ms()) + (uint32_t)(intptr_t)(tab);
 
-    tab->entries = mem_alloc(initial_capacity * (int)sizeof(struct hashtable_entry_t));
+    tab->entries = mem_alloc(total_entries * (int)sizeof(struct hashtable_entry_t));
     if(!tab->entries) {
         pdebug(DEBUG_ERROR,"Unable to allocate entry array!");
         hashtable_destroy(tab);
@@ -131,7 +148,7 @@ void *hashtable_get(hashtable_p table, int64_t key)
 int hashtable_put(hashtable_p table, int64_t key, void  *data)
 {
     int rc = PLCTAG_STATUS_OK;
-    int index = 0;
+    struct hashtable_entry_t entry;
 
     pdebug(DEBUG_SPEW,"Starting");
 
@@ -140,22 +157,25 @@ int hashtable_put(hashtable_p table, int64_t key, void  *data)
         return PLCTAG_ERR_NULL_PTR;
     }
 
-    /* try to find a slot to put the new entry */
-    index = find_empty(table, key);
-    while(index == PLCTAG_ERR_NOT_FOUND) {
+    if(!data) {
+        pdebug(DEBUG_WARN,"Null data pointer, empty entries are marked by null data!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    /* keep the load factor down so that probes stay short. */
+    if((table->used_entries + 1) * MAX_LOAD_DEN > table->total_entries * MAX_LOAD_NUM) {
         rc = expand_table(table);
         if(rc != PLCTAG_STATUS_OK) {
-            pdebug(DEBUG_WARN, "Unable to expand table to make entry unique!");
+            pdebug(DEBUG_WARN, "Unable to expand table!");
             return rc;
         }
-
-        index = find_empty(table, key);
     }
 
-    pdebug(DEBUG_SPEW, "Putting value at index %d", index);
+    entry.data = data;
+    entry.key = key;
+    entry.hash = key_hash(table, key);
 
-    table->entries[index].key = key;
-    table->entries[index].data = data;
+    insert_entry(table, entry);
     table->used_entries++;
 
     pdebug(DEBUG_SPEW, "Done.");
@@ -211,6 +231,7 @@ int hashtable_on_each(hashtable_p table, int (*callback_func)(hashtable_p table,
 
     if(!table) {
         pdebug(DEBUG_WARN,"Hashtable pointer null or invalid");
+        return PLCTAG_ERR_NULL_PTR;
     }
 
     for(int i=0; i < table->total_entries && rc == PLCTAG_STATUS_OK; i++) {
@@ -227,6 +248,8 @@ int hashtable_on_each(hashtable_p table, int (*callback_func)(hashtable_p table,
 void *hashtable_remove(hashtable_p table, int64_t key)
 {
     int index = 0;
+    uint32_t hole = 0;
+    uint32_t next = 0;
     void *result = NULL;
 
     pdebug(DEBUG_DETAIL,"Starting");
@@ -243,8 +266,20 @@ void *hashtable_remove(hashtable_p table, int64_t key)
     }
 
     result = table->entries[index].data;
-    table->entries[index].key = 0;
-    table->entries[index].data = NULL;
+
+    /* shift the following entries back toward home until one is already home or the run ends. */
+    hole = (uint32_t)index;
+    next = (hole + 1) & table->mask;
+
+    while(table->entries[next].data && (next & table->mask) != (table->entries[next].hash & table->mask)) {
+        table->entries[hole] = table->entries[next];
+        hole = next;
+        next = (next + 1) & table->mask;
+    }
+
+    table->entries[hole].data = NULL;
+    table->entries[hole].key = 0;
+    table->entries[hole].hash = 0;
     table->used_entries--;
 
     pdebug(DEBUG_DETAIL,"Done");
@@ -283,74 +318,76 @@ int hashtable_destroy(hashtable_p table)
  **********************************************************************/
 
 
-#define KEY_TO_INDEX(t, k) (uint32_t)((hash((uint8_t*)&k, sizeof(k), t->hash_salt)) % (uint32_t)(t->total_entries))
+/* how far the entry in the slot is from its home slot. */
+#define PROBE_DISTANCE(t, slot, h) (((slot) - ((h) & (t)->mask)) & (t)->mask)
+
+
+uint32_t key_hash(hashtable_p table, int64_t key)
+{
+    return hash((uint8_t*)&key, sizeof(key), table->hash_salt);
+}
+
 
 
 int find_key(hashtable_p table, int64_t key)
 {
-    uint32_t initial_index = KEY_TO_INDEX(table, key);
-    int index = 0;
-    int iteration = 0;
+    uint32_t key_hash_val = key_hash(table, key);
+    uint32_t index = key_hash_val & table->mask;
+    uint32_t distance = 0;
 
     pdebug(DEBUG_SPEW, "Starting.");
 
     /*
-     * search for the hash value.
-     *
-     * Note: do NOT stop if we find a NULL entry.  That might be the result
-     * of a removed entry and there could still be entries past that point
-     * that are for the initial slot.
+     * An empty slot, or an entry closer to its home than the key would
+     * be, means the key is not in the table.
      */
-    for(iteration=0; iteration < MAX_ITERATIONS; iteration++) {
-        index = ((int)initial_index + iteration) % table->total_entries;
-
-        if(table->entries[index].key == key) {
-            break;
+    while(table->entries[index].data && PROBE_DISTANCE(table, index, table->entries[index].hash) >= distance) {
+        if(table->entries[index].hash == key_hash_val && table->entries[index].key == key) {
+            pdebug(DEBUG_SPEW, "Done.");
+            return (int)index;
         }
-    }
 
-    if(iteration >= MAX_ITERATIONS) {
-        /* FIXME - does not work on Windows. */
-        //pdebug(DEBUG_SPEW, "Key %ld not found.", key);
-        return PLCTAG_ERR_NOT_FOUND;
-    } else {
-        //pdebug(DEBUG_SPEW, "Key %d found at index %d.", (int)table->entries[index].key, index);
+        index = (index + 1) & table->mask;
+        distance++;
     }
 
-    pdebug(DEBUG_SPEW, "Done.");
+    pdebug(DEBUG_SPEW, "Done.  Key not found.");
 
-    return index;
+    return PLCTAG_ERR_NOT_FOUND;
 }
 
 
 
 
-int find_empty(hashtable_p table, int64_t key)
+/*
+ * insert_entry
+ *
+ * Walk from the home slot and swap the entry being placed with any entry
+ * that is closer to its own home.  The entry that was taken out is then
+ * placed the same way.  There must be a free slot.
+ */
+
+void insert_entry(hashtable_p table, struct hashtable_entry_t entry)
 {
-    uint32_t initial_index = KEY_TO_INDEX(table, key);
-    int index = 0;
-    int iteration = 0;
+    uint32_t index = entry.hash & table->mask;
+    uint32_t distance = 0;
 
-    pdebug(DEBUG_SPEW, "Starting.");
+    while(table->entries[index].data) {
+        uint32_t other_distance = PROBE_DISTANCE(table, index, table->entries[index].hash);
 
-    /* search for the hash value. */
-    for(iteration=0; iteration < MAX_ITERATIONS; iteration++) {
-        index = ((int)initial_index + iteration) % table->total_entries;
+        if(other_distance < distance) {
+            struct hashtable_entry_t tmp = table->entries[index];
 
-        pdebug(DEBUG_SPEW, "Trying index %d for key %ld.", index, key);
-        if(table->entries[index].data == NULL) {
-            break;
+            table->entries[index] = entry;
+            entry = tmp;
+            distance = other_distance;
         }
-    }
 
-    if(iteration >= MAX_ITERATIONS) {
-        pdebug(DEBUG_SPEW,"No empty entry found in %d iterations!", MAX_ITERATIONS);
-        return PLCTAG_ERR_NOT_FOUND;
+        index = (index + 1) & table->mask;
+        distance++;
     }
 
-    pdebug(DEBUG_SPEW, "Done.");
-
-    return index;
+    table->entries[index] = entry;
 }
 
 
@@ -358,53 +395,39 @@ int find_empty(hashtable_p table, int64_t key)
 
 int expand_table(hashtable_p table)
 {
-    struct hashtable_t new_table;
-    int total_entries = table->total_entries;
-    int index = PLCTAG_ERR_NOT_FOUND;
+    struct hashtable_entry_t *old_entries = table->entries;
+    int old_total_entries = table->total_entries;
+    int total_entries = 0;
 
     pdebug(DEBUG_SPEW, "Starting.");
 
     pdebug(DEBUG_SPEW, "Table using %d entries of %d.", table->used_entries, table->total_entries);
 
-    do {
-        /* double entries unless already at max doubling, then increment. */
-        total_entries += (total_entries < MAX_INCREMENT ? total_entries : MAX_INCREMENT);
+    if(old_total_entries > (INT32_MAX / 2)) {
+        pdebug(DEBUG_ERROR, "Table cannot grow past %d entries!", old_total_entries);
+        return PLCTAG_ERR_TOO_LARGE;
+    }
 
-        new_table.total_entries = total_entries;
-        new_table.used_entries = 0;
-        new_table.hash_salt = table->hash_salt;
+    total_entries = old_total_entries * 2;
 
-        pdebug(DEBUG_SPEW, "trying new size = %d", total_entries);
+    table->entries = mem_alloc(total_entries * (int)sizeof(struct hashtable_entry_t));
+    if(!table->entries) {
+        pdebug(DEBUG_ERROR, "Unable to allocate new entry array!");
+        table->entries = old_entries;
+        return PLCTAG_ERR_NO_MEM;
+    }
 
-        new_table.entries = mem_alloc(total_entries * (int)sizeof(struct hashtable_entry_t));
-        if(!new_table.entries) {
-            pdebug(DEBUG_ERROR, "Unable to allocate new entry array!");
-            return PLCTAG_ERR_NO_MEM;
-        }
+    table->total_entries = total_entries;
+    table->mask = (uint32_t)(total_entries - 1);
 
-        /* copy the old entries.  Only copy ones that are used. */
-        for(int i=0; i < table->total_entries; i++) {
-            if(table->entries[i].data) {
-                index = find_empty(&new_table, table->entries[i].key);
-                if(index == PLCTAG_ERR_NOT_FOUND) {
-                    /* oops, still cannot insert all the entries! Try again. */
-                    pdebug(DEBUG_WARN, "Unable to insert existing entry into expanded table!");
-                    mem_free(new_table.entries);
-                    break;
-                } else {
-                    /* store the entry into the new table. */
-                    new_table.entries[index] = table->entries[i];
-                    new_table.used_entries++;
-                }
-            }
+    /* the hashes are kept so the entries just need to be placed again. */
+    for(int i=0; i < old_total_entries; i++) {
+        if(old_entries[i].data) {
+            insert_entry(table, old_entries[i]);
         }
-    } while(index == PLCTAG_ERR_NOT_FOUND);
+    }
 
-    /* success! */
-    mem_free(table->entries);
-    table->entries = new_table.entries;
-    table->total_entries = new_table.total_entries;
-    table->used_entries = new_table.used_entries;
+    mem_free(old_entries);
 
     pdebug(DEBUG_SPEW, "Done.");
 
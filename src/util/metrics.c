@@ -0,0 +1,323 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <platform.h>
+#include <lib/libplctag.h>
+#include <util/debug.h>
+#include <util/metrics.h>
+
+#define METRICS_MAX_KINDS (8)
+
+typedef struct {
+    const char *kind;
+    uint32_t used;
+    int64_t values[METRIC_NUM_METRICS];
+} metrics_retired_t;
+
+static lock_t metrics_lock = LOCK_INIT;
+static metrics_block_p metrics_blocks = NULL;
+static metrics_retired_t metrics_retired[METRICS_MAX_KINDS];
+static int metrics_num_retired = 0;
+
+static const struct {
+    const char *name;
+    int is_gauge;
+} metric_info[METRIC_NUM_METRICS] = {
+    { "plctag_packets_sent_total", 0 },
+    { "plctag_packets_received_total", 0 },
+    { "plctag_bytes_sent_total", 0 },
+    { "plctag_bytes_received_total", 0 },
+    { "plctag_requests_sent_total", 0 },
+    { "plctag_queue_depth_max", 1 },
+    { "plctag_connects_total", 0 },
+    { "plctag_forward_open_failures_total", 0 },
+    { "plctag_in_flight", 1 },
+    { "plctag_loops_total", 0 },
+    { "plctag_loop_time_us_total", 0 },
+    { "plctag_loop_time_max_us", 1 },
+    { "plctag_packed_payload_bytes_total", 0 },
+    { "plctag_packet_capacity_bytes_total", 0 },
+    { "plctag_reads_merged_total", 0 },
+    { "plctag_reads_cached_total", 0 },
+    { "plctag_bit_writes_coalesced_total", 0 },
+    { "plctag_reads_coalesced_total", 0 },
+    { "plctag_requests_expired_total", 0 },
+    { "plctag_cpu_us_total", 0 }
+};
+
+static int metrics_write_block(char *buffer, int buffer_length, int offset, const char *kind, const char *name, uint32_t used, volatile int64_t *values);
+static void metrics_sum_values(int64_t *values, volatile int64_t *block_values);
+
+
+
+metrics_block_p metrics_register(const char *kind, const char *name, uint32_t used)
+{
+    metrics_block_p block = NULL;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    block = (metrics_block_p)mem_alloc((int)sizeof(*block));
+    if(!block) {
+        pdebug(DEBUG_WARN, "Unable to allocate metrics block!");
+        return NULL;
+    }
+
+    block->name = str_dup(name ? name : "");
+    if(!block->name) {
+        pdebug(DEBUG_WARN, "Unable to allocate metrics block name!");
+        mem_free(block);
+        return NULL;
+    }
+
+    block->kind = kind;
+    block->used = used;
+
+    spin_block(&metrics_lock) {
+        block->next = metrics_blocks;
+        metrics_blocks = block;
+    }
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return block;
+}
+
+
+
+void metrics_unregister(metrics_block_p block)
+{
+    if(!block) {
+        return;
+    }
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    spin_block(&metrics_lock) {
+        metrics_block_p *walker = &metrics_blocks;
+        metrics_retired_t *retired = NULL;
+
+        while(*walker && *walker != block) {
+            walker = &((*walker)->next);
+        }
+
+        if(*walker) {
+            *walker = block->next;
+        }
+
+        /* keep the counters, gauges go away with the block. */
+        for(int i=0; i < metrics_num_retired; i++) {
+            if(metrics_retired[i].kind == block->kind) {
+                retired = &metrics_retired[i];
+                break;
+            }
+        }
+
+        if(!retired && metrics_num_retired < METRICS_MAX_KINDS) {
+            retired = &metrics_retired[metrics_num_retired];
+            retired->kind = block->kind;
+            metrics_num_retired++;
+        }
+
+        if(retired) {
+            for(int i=0; i < METRIC_NUM_METRICS; i++) {
+                if((block->used & METRIC_BIT(i)) && !metric_info[i].is_gauge) {
+                    retired->used |= METRIC_BIT(i);
+                    retired->values[i] += block->values[i];
+                }
+            }
+        }
+    }
+
+    mem_free(block->name);
+    mem_free(block);
+
+    pdebug(DEBUG_DETAIL, "Done.");
+}
+
+
+
+void metrics_add(metrics_block_p block, metric_id_t id, int64_t amount)
+{
+    if(block) {
+        block->values[id] += amount;
+    }
+}
+
+
+void metrics_set(metrics_block_p block, metric_id_t id, int64_t value)
+{
+    if(block) {
+        block->values[id] = value;
+    }
+}
+
+
+void metrics_max(metrics_block_p block, metric_id_t id, int64_t value)
+{
+    if(block && block->values[id] < value) {
+        block->values[id] = value;
+    }
+}
+
+
+
+/*
+ * metrics_snapshot_text
+ *
+ * Output stops being written once the buffer is full, but the full length
+ * is still returned so the caller can retry with a bigger buffer.
+ */
+
+int metrics_snapshot_text(char *buffer, int buffer_length)
+{
+    int offset = 0;
+
+    if(!buffer || buffer_length < 0) {
+        buffer_length = 0;
+    }
+
+    offset += snprintf((buffer_length > 0 ? buffer : NULL), (size_t)(unsigned int)buffer_length, "# libplctag metrics version 1\n");
+
+    spin_block(&metrics_lock) {
+        for(metrics_block_p block = metrics_blocks; block; block = block->next) {
+            offset = metrics_write_block(buffer, buffer_length, offset, block->kind, block->name, block->used, block->values);
+        }
+
+        for(int i=0; i < metrics_num_retired; i++) {
+            offset = metrics_write_block(buffer, buffer_length, offset, metrics_retired[i].kind, "closed", metrics_retired[i].used, metrics_retired[i].values);
+        }
+    }
+
+    return offset;
+}
+
+
+
+int metrics_snapshot_values(const char *kind, const char *name_prefix, int64_t *values)
+{
+    int num_blocks = 0;
+    int prefix_len = (name_prefix ? str_length(name_prefix) : 0);
+
+    if(!kind || !values) {
+        return 0;
+    }
+
+    spin_block(&metrics_lock) {
+        for(metrics_block_p block = metrics_blocks; block; block = block->next) {
+            if(str_cmp(block->kind, kind) != 0) {
+                continue;
+            }
+
+            /* the prefix is a whole host, 10.1.1.1 must not match 10.1.1.10. */
+            if(prefix_len > 0) {
+                char next = 0;
+
+                if(!block->name || str_length(block->name) < prefix_len || str_cmp_i_n(block->name, name_prefix, prefix_len) != 0) {
+                    continue;
+                }
+
+                next = block->name[prefix_len];
+
+                if(next != 0 && next != '/' && next != ':') {
+                    continue;
+                }
+            }
+
+            metrics_sum_values(values, block->values);
+            num_blocks++;
+        }
+
+        if(prefix_len == 0) {
+            for(int i=0; i < metrics_num_retired; i++) {
+                if(str_cmp(metrics_retired[i].kind, kind) == 0) {
+                    metrics_sum_values(values, metrics_retired[i].values);
+                }
+            }
+        }
+    }
+
+    return num_blocks;
+}
+
+
+
+void metrics_sum_values(int64_t *values, volatile int64_t *block_values)
+{
+    for(int i=0; i < METRIC_NUM_METRICS; i++) {
+        if(i == METRIC_QUEUE_DEPTH_MAX || i == METRIC_LOOP_TIME_MAX_US) {
+            if(block_values[i] > values[i]) {
+                values[i] = block_values[i];
+            }
+        } else {
+            values[i] += block_values[i];
+        }
+    }
+}
+
+
+
+int metrics_write_block(char *buffer, int buffer_length, int offset, const char *kind, const char *name, uint32_t used, volatile int64_t *values)
+{
+    for(int i=0; i < METRIC_NUM_METRICS; i++) {
+        char *out = NULL;
+        size_t out_size = 0;
+
+        if(!(used & METRIC_BIT(i))) {
+            continue;
+        }
+
+        if(offset < buffer_length) {
+            out = buffer + offset;
+            out_size = (size_t)(unsigned int)(buffer_length - offset);
+        }
+
+        offset += snprintf(out, out_size, "%s{kind=\"%s\",name=\"%s\"} %" PRId64 "\n", metric_info[i].name, kind, name, values[i]);
+    }
+
+    /* requests per packet shows how well packing works. */
+    if((used & METRIC_BIT(METRIC_REQUESTS_SENT)) && (used & METRIC_BIT(METRIC_PACKETS_SENT)) && values[METRIC_PACKETS_SENT] > 0) {
+        char *out = NULL;
+        size_t out_size = 0;
+
+        if(offset < buffer_length) {
+            out = buffer + offset;
+            out_size = (size_t)(unsigned int)(buffer_length - offset);
+        }
+
+        offset += snprintf(out, out_size, "plctag_packing_ratio{kind=\"%s\",name=\"%s\"} %.2f\n", kind, name, (double)values[METRIC_REQUESTS_SENT] / (double)values[METRIC_PACKETS_SENT]);
+    }
+
+    return offset;
+}
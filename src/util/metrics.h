@@ -0,0 +1,103 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <platform.h>
+
+/*
+ * Library wide metrics.
+ *
+ * Each session, PLC connection or tickler thread registers a block of
+ * counters.  A block is only updated by its owner (its thread or under
+ * its lock) so updates are plain memory writes.  Readers sum whatever is
+ * registered when a snapshot is taken.  The counters of unregistered
+ * blocks are folded into a per-kind total so counters never go backwards.
+ */
+
+typedef enum {
+    METRIC_PACKETS_SENT = 0,
+    METRIC_PACKETS_RECEIVED,
+    METRIC_BYTES_SENT,
+    METRIC_BYTES_RECEIVED,
+    METRIC_REQUESTS_SENT,
+    METRIC_QUEUE_DEPTH_MAX,
+    METRIC_CONNECTS,
+    METRIC_FORWARD_OPEN_FAILURES,
+    METRIC_IN_FLIGHT,
+    METRIC_LOOPS,
+    METRIC_LOOP_TIME_US,
+    METRIC_LOOP_TIME_MAX_US,
+    METRIC_PACKED_BYTES,            /* divide by capacity for packing efficiency. */
+    METRIC_PACKET_CAPACITY_BYTES,
+    METRIC_READS_MERGED,
+    METRIC_READS_CACHED,
+    METRIC_BIT_WRITES_COALESCED,
+    METRIC_READS_COALESCED,
+    METRIC_REQUESTS_EXPIRED,        /* dropped because the caller stopped waiting. */
+    METRIC_CPU_US,                  /* only counted with the cpu_accounting library attribute. */
+    METRIC_NUM_METRICS
+} metric_id_t;
+
+#define METRIC_BIT(id) (1u << (id))
+
+typedef struct metrics_block_t *metrics_block_p;
+
+struct metrics_block_t {
+    struct metrics_block_t *next;
+    const char *kind;
+    char *name;
+    uint32_t used;
+    volatile int64_t values[METRIC_NUM_METRICS];
+};
+
+extern metrics_block_p metrics_register(const char *kind, const char *name, uint32_t used);
+extern void metrics_unregister(metrics_block_p block);
+
+/* these do nothing if the block is NULL. */
+extern void metrics_add(metrics_block_p block, metric_id_t id, int64_t amount);
+extern void metrics_set(metrics_block_p block, metric_id_t id, int64_t value);
+extern void metrics_max(metrics_block_p block, metric_id_t id, int64_t value);
+
+/* write all the metrics as Prometheus text.  Returns the length needed. */
+extern int metrics_snapshot_text(char *buffer, int buffer_length);
+
+/*
+ * add up the blocks of one kind into values[METRIC_NUM_METRICS].  With a
+ * name prefix only the blocks whose name starts with it, up to a / or :,
+ * count, without one
+ * the closed blocks count too.  The maximum gauges are the largest value.
+ * Returns the number of live blocks matched.
+ */
+extern int metrics_snapshot_values(const char *kind, const char *name_prefix, int64_t *values);
@@ -33,6 +33,8 @@
 
 #include <lib/libplctag.h>
 #include <platform.h>
+#include <util/arena.h>
+#include <util/atomic_int.h>
 #include <util/rc.h>
 #include <util/debug.h>
 
@@ -68,11 +70,14 @@
 
 struct refcount_t {
     lock_t lock;
-    int count;
+    atomic_int count;
     const char *function_name;
     int line_num;
     //cleanup_p cleaners;
     rc_cleanup_func cleanup_func;
+    rc_recycle_func recycle_func;
+    int cache_class;
+    arena_p arena;
 
     /* FIXME - needed for alignment, this is a hack! */
     union {
@@ -89,7 +94,50 @@ struct refcount_t {
 
 typedef struct refcount_t *refcount_p;
 
+
+/*
+ * Small blocks are kept in size class free lists when they are released.
+ * Requests, tags, attribute lists and the like come and go in a few
+ * sizes, so a released block is usually reused soon without going to
+ * the allocator.  The lists are short so the cache cannot grow without
+ * bound.
+ */
+
+#define RC_CACHE_CLASS_SIZE (64)
+#define RC_CACHE_NUM_CLASSES (8)
+#define RC_CACHE_MAX_FREE (64)
+
+typedef struct rc_cache_block_t *rc_cache_block_p;
+
+struct rc_cache_block_t {
+    rc_cache_block_p next;
+};
+
+typedef struct {
+    lock_t lock;
+    int num_free;
+    rc_cache_block_p head;
+} rc_cache_t;
+
+static rc_cache_t rc_cache[RC_CACHE_NUM_CLASSES];
+
+
+/*
+ * With tag_arena set, blocks up to 8kB come from arenas of 16 byte size
+ * classes instead, so that tags and their parts created together sit
+ * together.  The arenas are made the first time a class is used.
+ */
+
+#define RC_ARENA_CLASS_SIZE (16)
+#define RC_ARENA_NUM_CLASSES (512)
+
+static arena_p rc_arenas[RC_ARENA_NUM_CLASSES];
+static lock_t rc_arena_lock = LOCK_INIT;
+
 static void refcount_cleanup(refcount_p rc);
+static refcount_p rc_cache_take(int cache_class);
+static int rc_cache_give(refcount_p rc);
+static refcount_p rc_arena_take(int block_size);
 //static cleanup_p cleanup_entry_create(const char *func, int line_num, rc_cleanup_func cleaner, int extra_arg_count, va_list extra_args);
 //static void cleanup_entry_destroy(cleanup_p entry);
 
@@ -112,13 +160,32 @@ void *rc_alloc_impl(const char *func, int line_num, int data_size, rc_cleanup_fu
 
     pdebug(DEBUG_SPEW,"Allocating %d-byte refcount struct",(int)sizeof(struct refcount_t));
 
-    rc = mem_alloc((int)sizeof(struct refcount_t) + data_size);
-    if(!rc) {
-        pdebug(DEBUG_WARN,"Unable to allocate refcount struct!");
-        return NULL;
+    {
+        int block_size = (int)sizeof(struct refcount_t) + data_size;
+        int cache_class = (block_size - 1) / RC_CACHE_CLASS_SIZE;
+
+        if(arena_enabled() && (rc = rc_arena_take(block_size))) {
+            cache_class = -1;
+        } else if(cache_class < RC_CACHE_NUM_CLASSES) {
+            rc = rc_cache_take(cache_class);
+
+            if(!rc) {
+                rc = mem_alloc((cache_class + 1) * RC_CACHE_CLASS_SIZE);
+            }
+        } else {
+            cache_class = -1;
+            rc = mem_alloc(block_size);
+        }
+
+        if(!rc) {
+            pdebug(DEBUG_WARN,"Unable to allocate refcount struct!");
+            return NULL;
+        }
+
+        rc->cache_class = cache_class;
     }
 
-    rc->count = 1;  /* start with a reference count. */
+    atomic_init(&rc->count, 1);  /* start with a reference count. */
     rc->lock = LOCK_INIT;
 
     rc->cleanup_func = cleaner_func;
@@ -160,33 +227,42 @@ void *rc_inc_impl(const char *func, int line_num, void *data)
     refcount_p rc = NULL;
     char *result = NULL;
 
+#if RC_TRACK_CALLERS
     pdebug(DEBUG_SPEW,"Starting, called from %s:%d for %p",func, line_num, data);
+#else
+    (void)func;
+    (void)line_num;
+#endif
 
     if(!data) {
-        pdebug(DEBUG_SPEW,"Invalid pointer passed from %s:%d!", func, line_num);
         return result;
     }
 
     /* get the refcount structure. */
     rc = ((refcount_p)data) - 1;
 
-    /* spin until we have ownership */
-    spin_block(&rc->lock) {
-        if(rc->count > 0) {
-            rc->count++;
-            count = rc->count;
+    /* only take a reference while the count is live, a dying object cannot be revived. */
+    count = atomic_get(&rc->count);
+
+    while(count > 0) {
+        int old_count = atomic_cas(&rc->count, count, count + 1);
+
+        if(old_count == count) {
+            count++;
             result = data;
-        } else {
-            count = rc->count;
-            result = NULL;
+            break;
         }
+
+        count = old_count;
     }
 
+#if RC_TRACK_CALLERS
     if(!result) {
         pdebug(DEBUG_SPEW,"Invalid ref count (%d) from call at %s line %d!  Unable to take strong reference.", count, func, line_num);
     } else {
         pdebug(DEBUG_SPEW,"Ref count is %d for %p.", count, data);
     }
+#endif
 
     /* return the result pointer. */
     return result;
@@ -211,31 +287,35 @@ void *rc_dec_impl(const char *func, int line_num, void *data)
     int invalid = 0;
     refcount_p rc = NULL;
 
+#if RC_TRACK_CALLERS
     pdebug(DEBUG_SPEW,"Starting, called from %s:%d for %p",func, line_num, data);
+#endif
 
     if(!data) {
-        pdebug(DEBUG_SPEW,"Null reference passed from %s:%d!", func, line_num);
         return NULL;
     }
 
     /* get the refcount structure. */
     rc = ((refcount_p)data) - 1;
 
-    /* do this sorta atomically */
-    spin_block(&rc->lock) {
-        if(rc->count > 0) {
-            rc->count--;
-            count = rc->count;
-        } else {
-            count = rc->count;
-            invalid = 1;
-        }
+    /*
+     * Only the caller that takes the count from one to zero cleans up.  The
+     * count never goes back up from zero, so nobody else can see the object
+     * again.
+     */
+    count = atomic_add(&rc->count, -1) - 1;
+
+    if(count < 0) {
+        atomic_add(&rc->count, 1);
+        invalid = 1;
     }
 
     if(invalid) {
-        pdebug(DEBUG_WARN,"Reference has invalid count %d!", count);
+        pdebug(DEBUG_WARN,"Reference has invalid count %d!", count + 1);
     } else {
+#if RC_TRACK_CALLERS
         pdebug(DEBUG_SPEW,"Ref count is %d for %p.", count, data);
+#endif
 
         /* clean up only if count is zero. */
         if(rc && count <= 0) {
@@ -251,6 +331,25 @@ void *rc_dec_impl(const char *func, int line_num, void *data)
 
 
 
+void rc_set_recycler(void *data, rc_recycle_func recycler)
+{
+    refcount_p rc = NULL;
+
+    if(!data) {
+        pdebug(DEBUG_WARN, "Null reference passed!");
+        return;
+    }
+
+    rc = ((refcount_p)data) - 1;
+
+    spin_block(&rc->lock) {
+        rc->recycle_func = recycler;
+    }
+}
+
+
+
+
 void refcount_cleanup(refcount_p rc)
 {
     pdebug(DEBUG_INFO,"Starting");
@@ -259,11 +358,157 @@ void refcount_cleanup(refcount_p rc)
         return;
     }
 
+    /* give the recycler the reference back first.  Once it keeps it, do not touch it again. */
+    if(rc->recycle_func) {
+        atomic_set(&rc->count, 1);
+
+        if(rc->recycle_func((void *)(rc+1))) {
+            pdebug(DEBUG_INFO, "Done, recycled.");
+            return;
+        }
+
+        atomic_set(&rc->count, 0);
+    }
+
     /* call the clean up function */
     rc->cleanup_func((void *)(rc+1));
 
     /* finally done. */
-    mem_free(rc);
+    if(rc->arena) {
+        arena_free(rc->arena, rc);
+    } else if(!rc_cache_give(rc)) {
+        mem_free(rc);
+    }
 
     pdebug(DEBUG_INFO,"Done.");
 }
+
+
+
+/*
+ * rc_arena_take
+ *
+ * Get a zeroed block from the arena for the size class or NULL if the
+ * block is too big for the arenas.
+ */
+
+refcount_p rc_arena_take(int block_size)
+{
+    int arena_class = (block_size - 1) / RC_ARENA_CLASS_SIZE;
+    arena_p arena = NULL;
+    refcount_p rc = NULL;
+
+    if(arena_class >= RC_ARENA_NUM_CLASSES) {
+        return NULL;
+    }
+
+    spin_block(&rc_arena_lock) {
+        if(!rc_arenas[arena_class]) {
+            rc_arenas[arena_class] = arena_create((arena_class + 1) * RC_ARENA_CLASS_SIZE, 0);
+        }
+
+        arena = rc_arenas[arena_class];
+    }
+
+    rc = (refcount_p)arena_alloc(arena);
+    if(rc) {
+        rc->arena = arena;
+    }
+
+    return rc;
+}
+
+
+
+/*
+ * rc_cache_take
+ *
+ * Get a zeroed block of the size class from the cache or NULL if the
+ * class is empty.
+ */
+
+refcount_p rc_cache_take(int cache_class)
+{
+    rc_cache_t *cache = &rc_cache[cache_class];
+    rc_cache_block_p block = NULL;
+
+    spin_block(&cache->lock) {
+        block = cache->head;
+
+        if(block) {
+            cache->head = block->next;
+            cache->num_free--;
+        }
+    }
+
+    if(block) {
+        mem_set(block, 0, (cache_class + 1) * RC_CACHE_CLASS_SIZE);
+    }
+
+    return (refcount_p)block;
+}
+
+
+
+/*
+ * rc_cache_give
+ *
+ * Keep a released block for reuse.  Returns zero if the block must be
+ * freed instead.
+ */
+
+int rc_cache_give(refcount_p rc)
+{
+    rc_cache_t *cache = NULL;
+    int kept = 0;
+
+    if(rc->cache_class < 0) {
+        return 0;
+    }
+
+    cache = &rc_cache[rc->cache_class];
+
+    spin_block(&cache->lock) {
+        if(cache->num_free < RC_CACHE_MAX_FREE) {
+            rc_cache_block_p block = (rc_cache_block_p)(void *)rc;
+
+            block->next = cache->head;
+            cache->head = block;
+            cache->num_free++;
+
+            kept = 1;
+        }
+    }
+
+    return kept;
+}
+
+
+
+/*
+ * rc_cache_flush
+ *
+ * Free all the cached blocks.  Called when the library shuts down.
+ */
+
+void rc_cache_flush(void)
+{
+    for(int i=0; i < RC_CACHE_NUM_CLASSES; i++) {
+        rc_cache_t *cache = &rc_cache[i];
+        rc_cache_block_p block = NULL;
+
+        spin_block(&cache->lock) {
+            block = cache->head;
+            cache->head = NULL;
+            cache->num_free = 0;
+        }
+
+        while(block) {
+            rc_cache_block_p next = block->next;
+
+            mem_free(block);
+
+            block = next;
+        }
+    }
+}
@@ -37,12 +37,37 @@
 
 typedef void (*rc_cleanup_func)(void *);
 
-#define rc_alloc(size, cleaner) rc_alloc_impl(__func__, __LINE__, size, cleaner)
+/*
+ * Where each reference was taken and dropped is logged at the spew level.
+ * Build with RC_TRACK_CALLERS=0 to leave that out of the hot path.
+ */
+#ifndef RC_TRACK_CALLERS
+    #define RC_TRACK_CALLERS (1)
+#endif
+
+#if RC_TRACK_CALLERS
+    #define RC_CALLER __func__, __LINE__
+#else
+    #define RC_CALLER "", 0
+#endif
+
+#define rc_alloc(size, cleaner) rc_alloc_impl(RC_CALLER, size, cleaner)
 extern void *rc_alloc_impl(const char *func, int line_num, int size, rc_cleanup_func cleaner);
 
-#define rc_inc(ref) rc_inc_impl(__func__, __LINE__, ref)
+#define rc_inc(ref) rc_inc_impl(RC_CALLER, ref)
 extern void *rc_inc_impl(const char *func, int line_num, void *ref);
 
-#define rc_dec(ref) rc_dec_impl(__func__, __LINE__, ref)
+#define rc_dec(ref) rc_dec_impl(RC_CALLER, ref)
 extern void *rc_dec_impl(const char *func, int line_num, void *ref);
 
+/*
+ * A recycler is called when the count drops to zero, before the clean up
+ * function.  If it returns non-zero it has kept the reference, with a count
+ * of one, for reuse (in a pool for instance) and nothing is freed.
+ */
+typedef int (*rc_recycle_func)(void *);
+extern void rc_set_recycler(void *ref, rc_recycle_func recycler);
+
+/* free the small blocks kept for reuse. */
+extern void rc_cache_flush(void);
+
@@ -0,0 +1,68 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <limits.h>
+#include <platform.h>
+#include <util/attr.h>
+#include <util/debug.h>
+#include <util/socket_opts.h>
+
+
+static int get_opt(attr attribs, const char *name, int def, int min_val, int max_val)
+{
+    int val = attr_get_int(attribs, name, def);
+
+    if(val < min_val || val > max_val) {
+        pdebug(DEBUG_WARN, "Attribute %s must be between %d and %d, using %d.", name, min_val, max_val, def);
+        return def;
+    }
+
+    return val;
+}
+
+
+void socket_options_from_attr(attr attribs, socket_options_t *opts)
+{
+    socket_options_init(opts);
+
+    opts->tcp_nodelay = get_opt(attribs, "tcp_nodelay", opts->tcp_nodelay, 0, 1);
+    opts->send_buffer_size = get_opt(attribs, "socket_send_buffer", opts->send_buffer_size, 0, INT_MAX);
+    opts->recv_buffer_size = get_opt(attribs, "socket_recv_buffer", opts->recv_buffer_size, 0, INT_MAX);
+    opts->keepalive_idle_s = get_opt(attribs, "tcp_keepalive_idle_s", opts->keepalive_idle_s, 0, 86400);
+    opts->keepalive_interval_s = get_opt(attribs, "tcp_keepalive_interval_s", opts->keepalive_interval_s, 0, 86400);
+    opts->keepalive_count = get_opt(attribs, "tcp_keepalive_count", opts->keepalive_count, 0, 127);
+    opts->tcp_quickack = get_opt(attribs, "tcp_quickack", opts->tcp_quickack, 0, 1);
+    opts->busy_poll_us = get_opt(attribs, "socket_busy_poll_us", opts->busy_poll_us, 0, 1000000);
+    opts->dscp = get_opt(attribs, "dscp", opts->dscp, -1, 63);
+    opts->priority = get_opt(attribs, "socket_priority", opts->priority, -1, 6);
+}
@@ -0,0 +1,86 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#pragma once
+
+/*
+ * Static trace points.
+ *
+ * With ENABLE_TRACING set in CMake these become USDT probes on Linux (if
+ * sys/sdt.h is available) or TraceLogging (ETW) events on Windows under the
+ * "libplctag" provider.  Otherwise they compile to nothing.  All arguments
+ * are passed as 64-bit integers.
+ *
+ * For example: bpftrace -e 'usdt:./libplctag.so:libplctag:send_eip_request { @[arg0] = count(); }'
+ */
+
+#include <stdint.h>
+
+#if defined(PLCTAG_USE_USDT)
+
+#include <sys/sdt.h>
+
+#define plctag_trace_startup() do { } while(0)
+#define plctag_trace_teardown() do { } while(0)
+
+#define plctag_trace1(name, a1) DTRACE_PROBE1(libplctag, name, (int64_t)(a1))
+#define plctag_trace2(name, a1, a2) DTRACE_PROBE2(libplctag, name, (int64_t)(a1), (int64_t)(a2))
+#define plctag_trace3(name, a1, a2, a3) DTRACE_PROBE3(libplctag, name, (int64_t)(a1), (int64_t)(a2), (int64_t)(a3))
+
+#elif defined(PLCTAG_USE_ETW)
+
+#include <windows.h>
+#include <TraceLoggingProvider.h>
+
+TRACELOGGING_DECLARE_PROVIDER(plctag_trace_provider);
+
+#define plctag_trace_startup() TraceLoggingRegister(plctag_trace_provider)
+#define plctag_trace_teardown() TraceLoggingUnregister(plctag_trace_provider)
+
+#define plctag_trace1(name, a1) \
+    TraceLoggingWrite(plctag_trace_provider, #name, TraceLoggingInt64((int64_t)(a1), "arg0"))
+#define plctag_trace2(name, a1, a2) \
+    TraceLoggingWrite(plctag_trace_provider, #name, TraceLoggingInt64((int64_t)(a1), "arg0"), TraceLoggingInt64((int64_t)(a2), "arg1"))
+#define plctag_trace3(name, a1, a2, a3) \
+    TraceLoggingWrite(plctag_trace_provider, #name, TraceLoggingInt64((int64_t)(a1), "arg0"), TraceLoggingInt64((int64_t)(a2), "arg1"), TraceLoggingInt64((int64_t)(a3), "arg2"))
+
+#else
+
+#define plctag_trace_startup() do { } while(0)
+#define plctag_trace_teardown() do { } while(0)
+
+#define plctag_trace1(name, a1) do { } while(0)
+#define plctag_trace2(name, a1, a2) do { } while(0)
+#define plctag_trace3(name, a1, a2, a3) do { } while(0)
+
+#endif
@@ -37,16 +37,29 @@
 #include <util/debug.h>
 #include <util/vector.h>
 
+/*
+ * The elements are kept in a ring so that adding or removing at either
+ * end does not move anything.  Element i is at data[(head + i) % capacity].
+ * Small vectors keep their elements inside the vector itself and only go
+ * to the heap when they grow past that.
+ */
+
+#define VECTOR_INLINE_CAPACITY (8)
+
 struct vector_t {
     int len;
     int capacity;
     int max_inc;
+    int head;
     void **data;
+    void *inline_data[VECTOR_INLINE_CAPACITY];
 };
 
+#define VECTOR_SLOT(vec, index) ((vec)->data[((vec)->head + (index)) % (vec)->capacity])
 
 
 static int ensure_capacity(vector_p vec, int capacity);
+static void move_elements(vector_p vec, int to_index, int from_index, int count);
 
 
 vector_p vector_create(int capacity, int max_inc)
@@ -72,14 +85,20 @@ vector_p vector_create(int capacity, int max_inc)
     }
 
     vec->len = 0;
-    vec->capacity = capacity;
+    vec->head = 0;
     vec->max_inc = max_inc;
 
-    vec->data = mem_alloc(capacity * (int)sizeof(void *));
-    if(!vec->data) {
-        pdebug(DEBUG_ERROR,"Unable to allocate memory for vector data!");
-        vector_destroy(vec);
-        return NULL;
+    if(capacity <= VECTOR_INLINE_CAPACITY) {
+        vec->capacity = VECTOR_INLINE_CAPACITY;
+        vec->data = vec->inline_data;
+    } else {
+        vec->capacity = capacity;
+        vec->data = mem_alloc(capacity * (int)sizeof(void *));
+        if(!vec->data) {
+            pdebug(DEBUG_ERROR,"Unable to allocate memory for vector data!");
+            vector_destroy(vec);
+            return NULL;
+        }
     }
 
     pdebug(DEBUG_SPEW,"Done");
@@ -129,14 +148,15 @@ int vector_put(vector_p vec, int index, void * data)
         return rc;
     }
 
-    /* reference the new data. */
-    vec->data[index] = data;
-
-    /* adjust the length, if needed */
-    if(index >= vec->len) {
-        vec->len = index+1;
+    /* adjust the length, if needed, the skipped elements are empty. */
+    while(vec->len <= index) {
+        VECTOR_SLOT(vec, vec->len) = NULL;
+        vec->len++;
     }
 
+    /* reference the new data. */
+    VECTOR_SLOT(vec, index) = data;
+
     pdebug(DEBUG_SPEW,"Done");
 
     return rc;
@@ -160,7 +180,7 @@ void * vector_get(vector_p vec, int index)
 
     pdebug(DEBUG_SPEW,"Done");
 
-    return vec->data[index];
+    return VECTOR_SLOT(vec, index);
 }
 
 
@@ -170,32 +190,174 @@ void * vector_remove(vector_p vec, int index)
 
     pdebug(DEBUG_SPEW,"Starting");
 
+    if(vector_remove_many(vec, index, 1, &result) != PLCTAG_STATUS_OK) {
+        return NULL;
+    }
+
+    pdebug(DEBUG_SPEW,"Done");
+
+    return result;
+}
+
+
+
+int vector_insert(vector_p vec, int index, void *data)
+{
+    return vector_insert_many(vec, index, &data, 1);
+}
+
+
+
+/*
+ * vector_insert_many
+ *
+ * Insert count elements before index, index may be the length to add at
+ * the end.  Whichever side of the insertion point is shorter is moved.
+ */
+
+int vector_insert_many(vector_p vec, int index, void **data, int count)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_SPEW,"Starting");
+
+    if(!vec || (!data && count > 0)) {
+        pdebug(DEBUG_WARN,"Null pointer or invalid pointer to vector passed!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(index < 0 || index > vec->len || count < 0) {
+        pdebug(DEBUG_WARN,"Index or count is out of bounds!");
+        return PLCTAG_ERR_OUT_OF_BOUNDS;
+    }
+
+    if(count == 0) {
+        return PLCTAG_STATUS_OK;
+    }
+
+    rc = ensure_capacity(vec, vec->len + count);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN,"Unable to ensure capacity!");
+        return rc;
+    }
+
+    if(index < vec->len - index) {
+        /* move the front down. */
+        vec->head = (vec->head + vec->capacity - count) % vec->capacity;
+        vec->len += count;
+        move_elements(vec, 0, count, index);
+    } else {
+        /* move the back up. */
+        vec->len += count;
+        move_elements(vec, index + count, index, vec->len - count - index);
+    }
+
+    for(int i=0; i < count; i++) {
+        VECTOR_SLOT(vec, index + i) = data[i];
+    }
+
+    pdebug(DEBUG_SPEW,"Done");
+
+    return rc;
+}
+
+
+
+/*
+ * vector_remove_many
+ *
+ * Take count elements out starting at index.  If removed is not NULL the
+ * elements are copied there.  Whichever side of the hole is shorter is
+ * moved to close it.
+ */
+
+int vector_remove_many(vector_p vec, int index, int count, void **removed)
+{
+    int tail_count = 0;
+
+    pdebug(DEBUG_SPEW,"Starting");
+
     /* check to see if the vector ref is valid */
     if(!vec) {
         pdebug(DEBUG_WARN,"Null pointer or invalid pointer to vector passed!");
-        return NULL;
+        return PLCTAG_ERR_NULL_PTR;
     }
 
-    if(index < 0 || index >= vec->len) {
+    if(index < 0 || count < 0 || index + count > vec->len) {
         pdebug(DEBUG_WARN,"Index is out of bounds!");
-        return NULL;
+        return PLCTAG_ERR_OUT_OF_BOUNDS;
     }
 
-    /* get the value in this slot before we overwrite it. */
-    result = vec->data[index];
+    for(int i=0; i < count; i++) {
+        if(removed) {
+            removed[i] = VECTOR_SLOT(vec, index + i);
+        }
+    }
 
-    /* move the rest of the data over this. */
-    mem_move(&vec->data[index], &vec->data[index+1], (int)((sizeof(void *) * (size_t)(vec->len - index - 1))));
+    tail_count = vec->len - index - count;
 
-    /* make sure that we do not have old data hanging around. */
-    vec->data[vec->len - 1] = NULL;
+    if(index < tail_count) {
+        /* move the front up over the hole. */
+        move_elements(vec, count, 0, index);
+
+        /* make sure that we do not have old data hanging around. */
+        for(int i=0; i < count; i++) {
+            VECTOR_SLOT(vec, i) = NULL;
+        }
+
+        vec->head = (vec->head + count) % vec->capacity;
+    } else {
+        /* move the back down over the hole. */
+        move_elements(vec, index, index + count, tail_count);
+
+        for(int i=0; i < count; i++) {
+            VECTOR_SLOT(vec, vec->len - count + i) = NULL;
+        }
+    }
 
     /* adjust the length to the new size */
-    vec->len--;
+    vec->len -= count;
+
+    if(vec->len == 0) {
+        vec->head = 0;
+    }
 
     pdebug(DEBUG_SPEW,"Done");
 
-    return result;
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+int vector_push_back(vector_p vec, void *data)
+{
+    return vector_insert_many(vec, (vec ? vec->len : 0), &data, 1);
+}
+
+
+int vector_push_front(vector_p vec, void *data)
+{
+    return vector_insert_many(vec, 0, &data, 1);
+}
+
+
+void *vector_pop_front(vector_p vec)
+{
+    if(!vec || vec->len == 0) {
+        return NULL;
+    }
+
+    return vector_remove(vec, 0);
+}
+
+
+void *vector_pop_back(vector_p vec)
+{
+    if(!vec || vec->len == 0) {
+        return NULL;
+    }
+
+    return vector_remove(vec, vec->len - 1);
 }
 
 
@@ -209,7 +371,10 @@ int vector_destroy(vector_p vec)
         return PLCTAG_ERR_NULL_PTR;
     }
 
-    mem_free(vec->data);
+    if(vec->data && vec->data != vec->inline_data) {
+        mem_free(vec->data);
+    }
+
     mem_free(vec);
 
     pdebug(DEBUG_SPEW,"Done.");
@@ -227,7 +392,7 @@ int vector_destroy(vector_p vec)
 
 int ensure_capacity(vector_p vec, int capacity)
 {
-    int new_inc = 0;
+    int new_capacity = 0;
     void * *new_data = NULL;
 
     if(!vec) {
@@ -241,37 +406,54 @@ int ensure_capacity(vector_p vec, int capacity)
         return PLCTAG_STATUS_OK;
     }
 
-    /* calculate the new capacity
+    /*
+     * calculate the new capacity
      *
-     * Start by guessing 50% larger.  Clamp that against 1 at the
-     * low end and the max increment passed when the vector was created.
+     * Grow by half of the current size, clamped against the max increment
+     * passed when the vector was created, but always at least enough for
+     * what was asked for.
      */
-    new_inc = vec->capacity / 2;
+    new_capacity = vec->capacity + (vec->capacity / 2 > vec->max_inc ? vec->max_inc : vec->capacity / 2);
 
-    if(new_inc > vec->max_inc) {
-        new_inc = vec->max_inc;
-    }
-
-    if(new_inc < 1) {
-        new_inc = 1;
+    if(new_capacity < capacity) {
+        new_capacity = capacity;
     }
 
     /* allocate the new data area */
-    new_data = (void * *)mem_alloc((int)((sizeof(void *) * (size_t)(vec->capacity + new_inc))));
+    new_data = (void * *)mem_alloc((int)((sizeof(void *) * (size_t)(new_capacity))));
     if(!new_data) {
         pdebug(DEBUG_ERROR,"Unable to allocate new data area!");
         return PLCTAG_ERR_NO_MEM;
     }
 
-    mem_copy(new_data, vec->data, (int)((size_t)(vec->capacity) * sizeof(void *)));
+    /* unwrap the ring as we copy it. */
+    for(int i=0; i < vec->len; i++) {
+        new_data[i] = VECTOR_SLOT(vec, i);
+    }
 
-    mem_free(vec->data);
+    if(vec->data != vec->inline_data) {
+        mem_free(vec->data);
+    }
 
     vec->data = new_data;
-
-    vec->capacity += new_inc;
+    vec->head = 0;
+    vec->capacity = new_capacity;
 
     return PLCTAG_STATUS_OK;
 }
 
 
+
+/* move count elements, the ranges may overlap. */
+void move_elements(vector_p vec, int to_index, int from_index, int count)
+{
+    if(to_index < from_index) {
+        for(int i=0; i < count; i++) {
+            VECTOR_SLOT(vec, to_index + i) = VECTOR_SLOT(vec, from_index + i);
+        }
+    } else if(to_index > from_index) {
+        for(int i=count - 1; i >= 0; i--) {
+            VECTOR_SLOT(vec, to_index + i) = VECTOR_SLOT(vec, from_index + i);
+        }
+    }
+}
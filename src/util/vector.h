@@ -42,5 +42,16 @@ extern int vector_put(vector_p vec, int index, void * ref);
 extern void *vector_get(vector_p vec, int index);
 extern int vector_on_each(vector_p vec, int (*callback_func)(vector_p vec, int index, void **data, int arg_count, void **args), int num_args, ...);
 extern void *vector_remove(vector_p vec, int index);
+
+/* insert before index, shifting the rest.  Index may be the length. */
+extern int vector_insert(vector_p vec, int index, void *ref);
+extern int vector_insert_many(vector_p vec, int index, void **refs, int count);
+extern int vector_remove_many(vector_p vec, int index, int count, void **removed);
+
+/* the ends are cheap to add to or take from, the vector is a ring. */
+extern int vector_push_back(vector_p vec, void *ref);
+extern int vector_push_front(vector_p vec, void *ref);
+extern void *vector_pop_front(vector_p vec);
+extern void *vector_pop_back(vector_p vec);
 extern int vector_destroy(vector_p vec);
 
@@ -0,0 +1,274 @@
+#ifndef LIBPLCTAG_HPP
+#define LIBPLCTAG_HPP
+
+// Header-only C++17 API for libplctag.
+//
+// Tag owns a tag handle and is move-only.  Values are read and written in
+// place with get<T>()/set<T>() and the bulk calls copy straight into and out
+// of caller buffers, so nothing here allocates after the tag is created.
+// TagGroup reads or writes a set of tags in one batch so their requests can
+// be packed together.
+//
+// Status codes are returned from the calls used in the IO path.  Only
+// creating a tag throws, since a constructor has no other way to fail.
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#if __has_include(<span>)
+#include <span>
+#endif
+
+#include <libplctag.h>
+
+namespace libplctag
+{
+
+class Error : public std::runtime_error
+{
+public:
+	explicit Error(int status) : std::runtime_error(plc_tag_decode_error(status)), status_(status) {}
+
+	int status() const noexcept { return status_; }
+
+private:
+	int status_;
+};
+
+namespace detail
+{
+
+template <typename T>
+inline constexpr bool always_false = false;
+
+// get one value at a byte offset, picked at compile time from the type.
+template <typename T>
+inline T get(int32_t id, int offset) noexcept
+{
+	if constexpr (std::is_same_v<T, bool>) { return plc_tag_get_uint8(id, offset) != 0; }
+	else if constexpr (std::is_same_v<T, int8_t>) { return plc_tag_get_int8(id, offset); }
+	else if constexpr (std::is_same_v<T, uint8_t>) { return plc_tag_get_uint8(id, offset); }
+	else if constexpr (std::is_same_v<T, int16_t>) { return plc_tag_get_int16(id, offset); }
+	else if constexpr (std::is_same_v<T, uint16_t>) { return plc_tag_get_uint16(id, offset); }
+	else if constexpr (std::is_same_v<T, int32_t>) { return plc_tag_get_int32(id, offset); }
+	else if constexpr (std::is_same_v<T, uint32_t>) { return plc_tag_get_uint32(id, offset); }
+	else if constexpr (std::is_same_v<T, int64_t>) { return plc_tag_get_int64(id, offset); }
+	else if constexpr (std::is_same_v<T, uint64_t>) { return plc_tag_get_uint64(id, offset); }
+	else if constexpr (std::is_same_v<T, float>) { return plc_tag_get_float32(id, offset); }
+	else if constexpr (std::is_same_v<T, double>) { return plc_tag_get_float64(id, offset); }
+	else { static_assert(always_false<T>, "libplctag: unsupported tag value type"); }
+}
+
+template <typename T>
+inline int set(int32_t id, int offset, T val) noexcept
+{
+	if constexpr (std::is_same_v<T, bool>) { return plc_tag_set_uint8(id, offset, val ? 1 : 0); }
+	else if constexpr (std::is_same_v<T, int8_t>) { return plc_tag_set_int8(id, offset, val); }
+	else if constexpr (std::is_same_v<T, uint8_t>) { return plc_tag_set_uint8(id, offset, val); }
+	else if constexpr (std::is_same_v<T, int16_t>) { return plc_tag_set_int16(id, offset, val); }
+	else if constexpr (std::is_same_v<T, uint16_t>) { return plc_tag_set_uint16(id, offset, val); }
+	else if constexpr (std::is_same_v<T, int32_t>) { return plc_tag_set_int32(id, offset, val); }
+	else if constexpr (std::is_same_v<T, uint32_t>) { return plc_tag_set_uint32(id, offset, val); }
+	else if constexpr (std::is_same_v<T, int64_t>) { return plc_tag_set_int64(id, offset, val); }
+	else if constexpr (std::is_same_v<T, uint64_t>) { return plc_tag_set_uint64(id, offset, val); }
+	else if constexpr (std::is_same_v<T, float>) { return plc_tag_set_float32(id, offset, val); }
+	else if constexpr (std::is_same_v<T, double>) { return plc_tag_set_float64(id, offset, val); }
+	else { static_assert(always_false<T>, "libplctag: unsupported tag value type"); }
+}
+
+// bulk copies use the library's array calls where there is one.
+template <typename T>
+inline int get_array(int32_t id, int offset, T *out, int count) noexcept
+{
+	if constexpr (std::is_same_v<T, int16_t>) { return plc_tag_get_int16_array(id, offset, out, count); }
+	else if constexpr (std::is_same_v<T, int32_t>) { return plc_tag_get_int32_array(id, offset, out, count); }
+	else if constexpr (std::is_same_v<T, int64_t>) { return plc_tag_get_int64_array(id, offset, out, count); }
+	else if constexpr (std::is_same_v<T, float>) { return plc_tag_get_float32_array(id, offset, out, count); }
+	else if constexpr (std::is_same_v<T, double>) { return plc_tag_get_float64_array(id, offset, out, count); }
+	else
+	{
+		for (int i = 0; i < count; i++)
+		{
+			out[i] = get<T>(id, offset + i * (int)sizeof(T));
+		}
+
+		int rc = plc_tag_status(id);
+
+		return (rc < 0 ? rc : PLCTAG_STATUS_OK);
+	}
+}
+
+template <typename T>
+inline int set_array(int32_t id, int offset, const T *in, int count) noexcept
+{
+	if constexpr (std::is_same_v<T, int16_t>) { return plc_tag_set_int16_array(id, offset, in, count); }
+	else if constexpr (std::is_same_v<T, int32_t>) { return plc_tag_set_int32_array(id, offset, in, count); }
+	else if constexpr (std::is_same_v<T, int64_t>) { return plc_tag_set_int64_array(id, offset, in, count); }
+	else if constexpr (std::is_same_v<T, float>) { return plc_tag_set_float32_array(id, offset, in, count); }
+	else if constexpr (std::is_same_v<T, double>) { return plc_tag_set_float64_array(id, offset, in, count); }
+	else
+	{
+		for (int i = 0; i < count; i++)
+		{
+			int rc = set<T>(id, offset + i * (int)sizeof(T), in[i]);
+
+			if (rc != PLCTAG_STATUS_OK)
+			{
+				return rc;
+			}
+		}
+
+		return PLCTAG_STATUS_OK;
+	}
+}
+
+} // namespace detail
+
+class Tag
+{
+public:
+	Tag() noexcept = default;
+
+	// attrib is the usual attribute string, e.g. "protocol=ab-eip&gateway=...&name=...".
+	Tag(const char *attrib, int timeout_ms) : id_(plc_tag_create(attrib, timeout_ms))
+	{
+		if (id_ < 0)
+		{
+			int status = id_;
+
+			id_ = 0;
+			throw Error(status);
+		}
+	}
+
+	Tag(const std::string &attrib, int timeout_ms) : Tag(attrib.c_str(), timeout_ms) {}
+
+	~Tag() { reset(); }
+
+	Tag(const Tag &) = delete;
+	Tag &operator=(const Tag &) = delete;
+
+	Tag(Tag &&other) noexcept : id_(std::exchange(other.id_, 0)) {}
+
+	Tag &operator=(Tag &&other) noexcept
+	{
+		if (this != &other)
+		{
+			reset();
+			id_ = std::exchange(other.id_, 0);
+		}
+
+		return *this;
+	}
+
+	// destroy the tag now instead of in the destructor.
+	void reset() noexcept
+	{
+		if (id_ > 0)
+		{
+			plc_tag_destroy(id_);
+		}
+
+		id_ = 0;
+	}
+
+	// give up ownership of the handle without destroying it.
+	int32_t release() noexcept { return std::exchange(id_, 0); }
+
+	int32_t id() const noexcept { return id_; }
+	explicit operator bool() const noexcept { return id_ > 0; }
+
+	int read(int timeout_ms) noexcept { return plc_tag_read(id_, timeout_ms); }
+	int write(int timeout_ms) noexcept { return plc_tag_write(id_, timeout_ms); }
+	int abort() noexcept { return plc_tag_abort(id_); }
+	int status() const noexcept { return plc_tag_status(id_); }
+	int size() const noexcept { return plc_tag_get_size(id_); }
+
+	int get_attribute(const char *name, int default_value) const noexcept { return plc_tag_get_int_attribute(id_, name, default_value); }
+	int set_attribute(const char *name, int value) noexcept { return plc_tag_set_int_attribute(id_, name, value); }
+
+	// single values at a byte offset.  Check status() if the offset may be bad.
+	template <typename T>
+	T get(int offset = 0) const noexcept { return detail::get<T>(id_, offset); }
+
+	template <typename T>
+	int set(int offset, T val) noexcept { return detail::set<T>(id_, offset, val); }
+
+	bool get_bit(int bit) const noexcept { return plc_tag_get_bit(id_, bit) == 1; }
+	int set_bit(int bit, bool val) noexcept { return plc_tag_set_bit(id_, bit, val ? 1 : 0); }
+
+	// bulk copies into and out of caller buffers.
+	template <typename T>
+	int get(int offset, T *out, std::size_t count) const noexcept { return detail::get_array<T>(id_, offset, out, (int)count); }
+
+	template <typename T>
+	int set(int offset, const T *in, std::size_t count) noexcept { return detail::set_array<T>(id_, offset, in, (int)count); }
+
+	int get_raw(int offset, uint8_t *out, std::size_t len) const noexcept { return plc_tag_get_raw_bytes(id_, offset, out, (int)len); }
+	int set_raw(int offset, const uint8_t *in, std::size_t len) noexcept { return plc_tag_set_raw_bytes(id_, offset, const_cast<uint8_t *>(in), (int)len); }
+
+#if defined(__cpp_lib_span)
+	template <typename T>
+	int get(int offset, std::span<T> out) const noexcept { return get<T>(offset, out.data(), out.size()); }
+
+	template <typename T>
+	int set(int offset, std::span<const T> in) noexcept { return set<T>(offset, in.data(), in.size()); }
+#endif
+
+	// strings are copied into the caller's buffer, with a terminating zero.
+	int get_string(int offset, char *out, std::size_t len) const noexcept { return plc_tag_get_string(id_, offset, out, (int)len); }
+	int set_string(int offset, const char *val) noexcept { return plc_tag_set_string(id_, offset, val); }
+	int string_length(int offset) const noexcept { return plc_tag_get_string_length(id_, offset); }
+
+private:
+	int32_t id_ = 0;
+};
+
+// Read or write a set of tags at once.  The tags are not owned, they
+// must outlive the group.  All storage is set up by add().
+class TagGroup
+{
+public:
+	TagGroup() = default;
+
+	explicit TagGroup(std::size_t expected) { reserve(expected); }
+
+	void reserve(std::size_t expected)
+	{
+		ids_.reserve(expected);
+		statuses_.reserve(expected);
+	}
+
+	void add(const Tag &tag)
+	{
+		ids_.push_back(tag.id());
+		statuses_.push_back(PLCTAG_STATUS_OK);
+	}
+
+	void clear() noexcept
+	{
+		ids_.clear();
+		statuses_.clear();
+	}
+
+	std::size_t size() const noexcept { return ids_.size(); }
+
+	// returns the first error, the status of each tag is in status(i).
+	int read(int timeout_ms) noexcept { return ids_.empty() ? PLCTAG_STATUS_OK : plc_tag_read_many(ids_.data(), (int)ids_.size(), statuses_.data(), timeout_ms); }
+	int write(int timeout_ms) noexcept { return ids_.empty() ? PLCTAG_STATUS_OK : plc_tag_write_many(ids_.data(), (int)ids_.size(), statuses_.data(), timeout_ms); }
+
+	int status(std::size_t index) const noexcept { return statuses_[index]; }
+
+private:
+	std::vector<int32_t> ids_;
+	std::vector<int> statuses_;
+};
+
+} // namespace libplctag
+
+#endif
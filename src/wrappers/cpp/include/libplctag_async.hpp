@@ -0,0 +1,312 @@
+#ifndef LIBPLCTAG_ASYNC_HPP
+#define LIBPLCTAG_ASYNC_HPP
+
+// Asynchronous reads and writes on top of the tag callback.
+//
+// AsyncTag registers the library callback for its tag.  read_async() and
+// write_async() start the operation without blocking and return a
+// std::future with the final status.  With C++20 coroutines, co_await
+// tag.read() and co_await tag.write() suspend the coroutine until the
+// operation finishes and give the status.  No thread is needed per
+// operation.
+//
+// The future is set, or the coroutine resumed, on the library callback
+// thread.  Do not block there for long.  Only one operation may be in
+// flight on a tag at a time, a second one gets PLCTAG_ERR_BUSY.  If the tag
+// is destroyed or aborted with an operation in flight, the operation
+// finishes with PLCTAG_ERR_ABORT.
+
+#include <atomic>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+#if __has_include(<coroutine>) && defined(__cpp_impl_coroutine)
+#include <coroutine>
+#define LIBPLCTAG_HAVE_COROUTINES 1
+#endif
+
+#include "libplctag.hpp"
+
+namespace libplctag
+{
+
+namespace detail
+{
+
+enum class AsyncOp : int
+{
+	NONE = 0,
+	CLAIMED = -1,
+	READ = PLCTAG_EVENT_READ_COMPLETED,
+	WRITE = PLCTAG_EVENT_WRITE_COMPLETED,
+};
+
+struct AsyncState
+{
+	std::atomic<int> pending{(int)AsyncOp::NONE};
+	int result = PLCTAG_STATUS_OK;
+	bool has_promise = false;
+	std::promise<int> promise;
+#if defined(LIBPLCTAG_HAVE_COROUTINES)
+	std::coroutine_handle<> waiter;
+#endif
+
+	// finish the operation if it is still the one in flight.  Only one caller wins.
+	void complete(AsyncOp op, int status)
+	{
+		int expected = (int)op;
+
+		if (!pending.compare_exchange_strong(expected, (int)AsyncOp::NONE))
+		{
+			return;
+		}
+
+		result = status;
+
+#if defined(LIBPLCTAG_HAVE_COROUTINES)
+		if (waiter)
+		{
+			std::exchange(waiter, nullptr).resume();
+			return;
+		}
+#endif
+
+		if (has_promise)
+		{
+			has_promise = false;
+			promise.set_value(status);
+		}
+	}
+
+	void complete_any(int status)
+	{
+		complete(AsyncOp::READ, status);
+		complete(AsyncOp::WRITE, status);
+	}
+};
+
+// the callback only gets the tag ID, so the states are found by ID.
+struct AsyncRegistry
+{
+	std::mutex mutex;
+	std::unordered_map<int32_t, std::shared_ptr<AsyncState>> states;
+
+	static AsyncRegistry &instance()
+	{
+		static AsyncRegistry registry;
+		return registry;
+	}
+
+	std::shared_ptr<AsyncState> find(int32_t id)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		auto it = states.find(id);
+
+		return (it == states.end() ? nullptr : it->second);
+	}
+};
+
+inline void async_callback(int32_t tag_id, int event, int status)
+{
+	// hold a reference so the tag can be destroyed while we finish.
+	std::shared_ptr<AsyncState> state = AsyncRegistry::instance().find(tag_id);
+
+	if (!state)
+	{
+		return;
+	}
+
+	switch (event)
+	{
+	case PLCTAG_EVENT_READ_COMPLETED:
+		state->complete(AsyncOp::READ, status);
+		break;
+
+	case PLCTAG_EVENT_WRITE_COMPLETED:
+		state->complete(AsyncOp::WRITE, status);
+		break;
+
+	case PLCTAG_EVENT_ABORTED:
+		state->complete_any(PLCTAG_ERR_ABORT);
+		break;
+
+	default:
+		break;
+	}
+}
+
+// take the tag for one operation.  False if another one is in flight.
+inline bool async_claim(AsyncState &state)
+{
+	int expected = (int)AsyncOp::NONE;
+
+	return state.pending.compare_exchange_strong(expected, (int)AsyncOp::CLAIMED);
+}
+
+// the waiter or promise must be set up before this, the callback may finish the operation at once.
+inline void async_start(int32_t id, std::shared_ptr<AsyncState> state, AsyncOp op)
+{
+	int rc = PLCTAG_STATUS_OK;
+
+	state->pending.store((int)op);
+
+	rc = (op == AsyncOp::READ ? plc_tag_read(id, 0) : plc_tag_write(id, 0));
+
+	if (rc != PLCTAG_STATUS_PENDING)
+	{
+		state->complete(op, rc);
+	}
+}
+
+} // namespace detail
+
+class AsyncTag : public Tag
+{
+public:
+	AsyncTag() noexcept = default;
+
+	AsyncTag(const char *attrib, int timeout_ms) : Tag(attrib, timeout_ms), state_(std::make_shared<detail::AsyncState>())
+	{
+		{
+			auto &registry = detail::AsyncRegistry::instance();
+			std::lock_guard<std::mutex> lock(registry.mutex);
+
+			registry.states[id()] = state_;
+		}
+
+		int rc = plc_tag_register_callback(id(), detail::async_callback);
+
+		if (rc != PLCTAG_STATUS_OK)
+		{
+			unregister();
+			throw Error(rc);
+		}
+	}
+
+	AsyncTag(const std::string &attrib, int timeout_ms) : AsyncTag(attrib.c_str(), timeout_ms) {}
+
+	~AsyncTag() { unregister(); }
+
+	AsyncTag(AsyncTag &&other) noexcept = default;
+
+	AsyncTag &operator=(AsyncTag &&other) noexcept
+	{
+		if (this != &other)
+		{
+			unregister();
+			Tag::operator=(std::move(other));
+			state_ = std::move(other.state_);
+		}
+
+		return *this;
+	}
+
+	// start a read, the future gets the final status.
+	std::future<int> read_async() { return start_future(detail::AsyncOp::READ); }
+	std::future<int> write_async() { return start_future(detail::AsyncOp::WRITE); }
+
+#if defined(LIBPLCTAG_HAVE_COROUTINES)
+	class Awaiter
+	{
+	public:
+		Awaiter(int32_t id, std::shared_ptr<detail::AsyncState> state, detail::AsyncOp op) noexcept : id_(id), state_(std::move(state)), op_(op) {}
+
+		bool await_ready() const noexcept { return !state_; }
+
+		bool await_suspend(std::coroutine_handle<> handle)
+		{
+			if (!detail::async_claim(*state_))
+			{
+				busy_ = true;
+				return false;
+			}
+
+			// the coroutine may be resumed, and this awaiter gone, as soon as the operation starts.
+			state_->waiter = handle;
+			detail::async_start(id_, state_, op_);
+
+			return true;
+		}
+
+		int await_resume() const noexcept
+		{
+			if (!state_)
+			{
+				return PLCTAG_ERR_NULL_PTR;
+			}
+
+			return (busy_ ? PLCTAG_ERR_BUSY : state_->result);
+		}
+
+	private:
+		int32_t id_;
+		std::shared_ptr<detail::AsyncState> state_;
+		detail::AsyncOp op_;
+		bool busy_ = false;
+	};
+
+	// co_await tag.read() gives the final status of the read.
+	Awaiter read() noexcept { return Awaiter(id(), state_, detail::AsyncOp::READ); }
+	Awaiter write() noexcept { return Awaiter(id(), state_, detail::AsyncOp::WRITE); }
+#endif
+
+	// the blocking calls are still there.
+	int read(int timeout_ms) noexcept { return Tag::read(timeout_ms); }
+	int write(int timeout_ms) noexcept { return Tag::write(timeout_ms); }
+
+private:
+	std::future<int> start_future(detail::AsyncOp op)
+	{
+		std::promise<int> ready;
+
+		if (!state_)
+		{
+			ready.set_value(PLCTAG_ERR_NULL_PTR);
+			return ready.get_future();
+		}
+
+		if (!detail::async_claim(*state_))
+		{
+			ready.set_value(PLCTAG_ERR_BUSY);
+			return ready.get_future();
+		}
+
+		state_->promise = std::promise<int>();
+		state_->has_promise = true;
+
+		std::future<int> result = state_->promise.get_future();
+
+		detail::async_start(id(), state_, op);
+
+		return result;
+	}
+
+	void unregister() noexcept
+	{
+		if (!state_)
+		{
+			return;
+		}
+
+		if (id() > 0)
+		{
+			plc_tag_unregister_callback(id());
+
+			auto &registry = detail::AsyncRegistry::instance();
+			std::lock_guard<std::mutex> lock(registry.mutex);
+
+			registry.states.erase(id());
+		}
+
+		state_->complete_any(PLCTAG_ERR_ABORT);
+		state_.reset();
+	}
+
+	std::shared_ptr<detail::AsyncState> state_;
+};
+
+} // namespace libplctag
+
+#endif
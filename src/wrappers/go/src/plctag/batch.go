@@ -0,0 +1,266 @@
+/***************************************************************************
+ *   Copyright (C) 2019 Aníbal Limón <limon.anibal@gmail.com>              *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Library General Public License for more details.                  *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+package plctag
+
+/*
+#cgo pkg-config: libplctag
+#include <stdlib.h>
+#include <stdint.h>
+#include <libplctag.h>
+
+static int plctag_status_many(int32_t *tags, int num_tags, int *statuses)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    for(int i = 0; i < num_tags; i++) {
+        statuses[i] = plc_tag_status(tags[i]);
+
+        if(rc == PLCTAG_STATUS_OK && statuses[i] != PLCTAG_STATUS_OK) {
+            rc = statuses[i];
+        }
+    }
+
+    return rc;
+}
+*/
+import "C"
+import "unsafe"
+
+/*
+ * Batch calls.  Each one crosses into C once for the whole slice instead of
+ * once per element or per tag, so decoding an array or polling a set of
+ * tags does not pay the cgo cost over and over.  The slices are copied
+ * into and out of directly, the data is converted to the host byte order.
+ */
+
+func GetRawBytes(tag int32, offset int, buf []byte) int {
+	if len(buf) == 0 {
+		return STATUS_OK
+	}
+	result := C.plc_tag_get_raw_bytes(C.int32_t(tag), C.int(offset), (*C.uint8_t)(unsafe.Pointer(&buf[0])), C.int(len(buf)))
+	return int(result)
+}
+
+func SetRawBytes(tag int32, offset int, buf []byte) int {
+	if len(buf) == 0 {
+		return STATUS_OK
+	}
+	result := C.plc_tag_set_raw_bytes(C.int32_t(tag), C.int(offset), (*C.uint8_t)(unsafe.Pointer(&buf[0])), C.int(len(buf)))
+	return int(result)
+}
+
+func GetInt64Slice(tag int32, offset int, vals []int64) int {
+	if len(vals) == 0 {
+		return STATUS_OK
+	}
+	result := C.plc_tag_get_int64_array(C.int32_t(tag), C.int(offset), (*C.int64_t)(unsafe.Pointer(&vals[0])), C.int(len(vals)))
+	return int(result)
+}
+
+func SetInt64Slice(tag int32, offset int, vals []int64) int {
+	if len(vals) == 0 {
+		return STATUS_OK
+	}
+	result := C.plc_tag_set_int64_array(C.int32_t(tag), C.int(offset), (*C.int64_t)(unsafe.Pointer(&vals[0])), C.int(len(vals)))
+	return int(result)
+}
+
+/* the unsigned types have the same bits as the signed ones. */
+func GetUint64Slice(tag int32, offset int, vals []uint64) int {
+	if len(vals) == 0 {
+		return STATUS_OK
+	}
+	result := C.plc_tag_get_int64_array(C.int32_t(tag), C.int(offset), (*C.int64_t)(unsafe.Pointer(&vals[0])), C.int(len(vals)))
+	return int(result)
+}
+
+func SetUint64Slice(tag int32, offset int, vals []uint64) int {
+	if len(vals) == 0 {
+		return STATUS_OK
+	}
+	result := C.plc_tag_set_int64_array(C.int32_t(tag), C.int(offset), (*C.int64_t)(unsafe.Pointer(&vals[0])), C.int(len(vals)))
+	return int(result)
+}
+
+func GetInt32Slice(tag int32, offset int, vals []int32) int {
+	if len(vals) == 0 {
+		return STATUS_OK
+	}
+	result := C.plc_tag_get_int32_array(C.int32_t(tag), C.int(offset), (*C.int32_t)(unsafe.Pointer(&vals[0])), C.int(len(vals)))
+	return int(result)
+}
+
+func SetInt32Slice(tag int32, offset int, vals []int32) int {
+	if len(vals) == 0 {
+		return STATUS_OK
+	}
+	result := C.plc_tag_set_int32_array(C.int32_t(tag), C.int(offset), (*C.int32_t)(unsafe.Pointer(&vals[0])), C.int(len(vals)))
+	return int(result)
+}
+
+func GetUint32Slice(tag int32, offset int, vals []uint32) int {
+	if len(vals) == 0 {
+		return STATUS_OK
+	}
+	result := C.plc_tag_get_int32_array(C.int32_t(tag), C.int(offset), (*C.int32_t)(unsafe.Pointer(&vals[0])), C.int(len(vals)))
+	return int(result)
+}
+
+func SetUint32Slice(tag int32, offset int, vals []uint32) int {
+	if len(vals) == 0 {
+		return STATUS_OK
+	}
+	result := C.plc_tag_set_int32_array(C.int32_t(tag), C.int(offset), (*C.int32_t)(unsafe.Pointer(&vals[0])), C.int(len(vals)))
+	return int(result)
+}
+
+func GetInt16Slice(tag int32, offset int, vals []int16) int {
+	if len(vals) == 0 {
+		return STATUS_OK
+	}
+	result := C.plc_tag_get_int16_array(C.int32_t(tag), C.int(offset), (*C.int16_t)(unsafe.Pointer(&vals[0])), C.int(len(vals)))
+	return int(result)
+}
+
+func SetInt16Slice(tag int32, offset int, vals []int16) int {
+	if len(vals) == 0 {
+		return STATUS_OK
+	}
+	result := C.plc_tag_set_int16_array(C.int32_t(tag), C.int(offset), (*C.int16_t)(unsafe.Pointer(&vals[0])), C.int(len(vals)))
+	return int(result)
+}
+
+func GetUint16Slice(tag int32, offset int, vals []uint16) int {
+	if len(vals) == 0 {
+		return STATUS_OK
+	}
+	result := C.plc_tag_get_int16_array(C.int32_t(tag), C.int(offset), (*C.int16_t)(unsafe.Pointer(&vals[0])), C.int(len(vals)))
+	return int(result)
+}
+
+func SetUint16Slice(tag int32, offset int, vals []uint16) int {
+	if len(vals) == 0 {
+		return STATUS_OK
+	}
+	result := C.plc_tag_set_int16_array(C.int32_t(tag), C.int(offset), (*C.int16_t)(unsafe.Pointer(&vals[0])), C.int(len(vals)))
+	return int(result)
+}
+
+/* single bytes need no conversion. */
+func GetInt8Slice(tag int32, offset int, vals []int8) int {
+	if len(vals) == 0 {
+		return STATUS_OK
+	}
+	result := C.plc_tag_get_raw_bytes(C.int32_t(tag), C.int(offset), (*C.uint8_t)(unsafe.Pointer(&vals[0])), C.int(len(vals)))
+	return int(result)
+}
+
+func SetInt8Slice(tag int32, offset int, vals []int8) int {
+	if len(vals) == 0 {
+		return STATUS_OK
+	}
+	result := C.plc_tag_set_raw_bytes(C.int32_t(tag), C.int(offset), (*C.uint8_t)(unsafe.Pointer(&vals[0])), C.int(len(vals)))
+	return int(result)
+}
+
+func GetFloat64Slice(tag int32, offset int, vals []float64) int {
+	if len(vals) == 0 {
+		return STATUS_OK
+	}
+	result := C.plc_tag_get_float64_array(C.int32_t(tag), C.int(offset), (*C.double)(unsafe.Pointer(&vals[0])), C.int(len(vals)))
+	return int(result)
+}
+
+func SetFloat64Slice(tag int32, offset int, vals []float64) int {
+	if len(vals) == 0 {
+		return STATUS_OK
+	}
+	result := C.plc_tag_set_float64_array(C.int32_t(tag), C.int(offset), (*C.double)(unsafe.Pointer(&vals[0])), C.int(len(vals)))
+	return int(result)
+}
+
+func GetFloat32Slice(tag int32, offset int, vals []float32) int {
+	if len(vals) == 0 {
+		return STATUS_OK
+	}
+	result := C.plc_tag_get_float32_array(C.int32_t(tag), C.int(offset), (*C.float)(unsafe.Pointer(&vals[0])), C.int(len(vals)))
+	return int(result)
+}
+
+func SetFloat32Slice(tag int32, offset int, vals []float32) int {
+	if len(vals) == 0 {
+		return STATUS_OK
+	}
+	result := C.plc_tag_set_float32_array(C.int32_t(tag), C.int(offset), (*C.float)(unsafe.Pointer(&vals[0])), C.int(len(vals)))
+	return int(result)
+}
+
+/*
+ * Multi-tag calls.  statuses must be at least as long as tags and gets the
+ * status of each tag.  The return value is the first error.  ReadMany and
+ * WriteMany start all the operations before waiting so the requests can be
+ * packed together.  With a timeout of zero they return at once, use
+ * StatusMany or Notify to find out when they finish.
+ */
+
+func ReadMany(tags []int32, statuses []int, timeout int) int {
+	if len(tags) == 0 {
+		return STATUS_OK
+	}
+	if len(statuses) < len(tags) {
+		return ERR_TOO_SMALL
+	}
+	cstatuses := make([]C.int, len(tags))
+	result := C.plc_tag_read_many((*C.int32_t)(unsafe.Pointer(&tags[0])), C.int(len(tags)), &cstatuses[0], C.int(timeout))
+	for i, s := range cstatuses {
+		statuses[i] = int(s)
+	}
+	return int(result)
+}
+
+func WriteMany(tags []int32, statuses []int, timeout int) int {
+	if len(tags) == 0 {
+		return STATUS_OK
+	}
+	if len(statuses) < len(tags) {
+		return ERR_TOO_SMALL
+	}
+	cstatuses := make([]C.int, len(tags))
+	result := C.plc_tag_write_many((*C.int32_t)(unsafe.Pointer(&tags[0])), C.int(len(tags)), &cstatuses[0], C.int(timeout))
+	for i, s := range cstatuses {
+		statuses[i] = int(s)
+	}
+	return int(result)
+}
+
+func StatusMany(tags []int32, statuses []int) int {
+	if len(tags) == 0 {
+		return STATUS_OK
+	}
+	if len(statuses) < len(tags) {
+		return ERR_TOO_SMALL
+	}
+	cstatuses := make([]C.int, len(tags))
+	result := C.plctag_status_many((*C.int32_t)(unsafe.Pointer(&tags[0])), C.int(len(tags)), &cstatuses[0])
+	for i, s := range cstatuses {
+		statuses[i] = int(s)
+	}
+	return int(result)
+}
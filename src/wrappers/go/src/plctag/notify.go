@@ -0,0 +1,94 @@
+/***************************************************************************
+ *   Copyright (C) 2019 Aníbal Limón <limon.anibal@gmail.com>              *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Library General Public License for more details.                  *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+package plctag
+
+/*
+#cgo pkg-config: libplctag
+#include <stdint.h>
+#include <libplctag.h>
+
+extern void goTagEvent(int32_t tag_id, int event, int status);
+*/
+import "C"
+import "sync"
+
+const (
+	EVENT_READ_STARTED = C.PLCTAG_EVENT_READ_STARTED
+	EVENT_READ_COMPLETED = C.PLCTAG_EVENT_READ_COMPLETED
+	EVENT_WRITE_STARTED = C.PLCTAG_EVENT_WRITE_STARTED
+	EVENT_WRITE_COMPLETED = C.PLCTAG_EVENT_WRITE_COMPLETED
+	EVENT_ABORTED = C.PLCTAG_EVENT_ABORTED
+	EVENT_DESTROYED = C.PLCTAG_EVENT_DESTROYED
+	EVENT_VALUE_CHANGED = C.PLCTAG_EVENT_VALUE_CHANGED
+	EVENT_CREATED = C.PLCTAG_EVENT_CREATED
+)
+
+type Event struct {
+	Tag int32
+	Event int
+	Status int
+}
+
+/*
+ * The library calls goTagEvent from its own thread.  The event is sent on
+ * the channel given to Notify.  The send blocks the library thread until
+ * there is room, so give Notify a buffered channel and keep reading it.
+ */
+
+var (
+	notifyMutex sync.RWMutex
+	notifyChans = make(map[int32]chan<- Event)
+)
+
+//export goTagEvent
+func goTagEvent(tag C.int32_t, event C.int, status C.int) {
+	notifyMutex.RLock()
+	ch, ok := notifyChans[int32(tag)]
+	notifyMutex.RUnlock()
+
+	if ok {
+		ch <- Event{Tag: int32(tag), Event: int(event), Status: int(status)}
+	}
+}
+
+/* send the events of tag to ch.  Several tags may share one channel. */
+func Notify(tag int32, ch chan<- Event) int {
+	notifyMutex.Lock()
+	notifyChans[tag] = ch
+	notifyMutex.Unlock()
+
+	result := int(C.plc_tag_register_callback(C.int32_t(tag), (*[0]byte)(C.goTagEvent)))
+	if result != STATUS_OK {
+		notifyMutex.Lock()
+		delete(notifyChans, tag)
+		notifyMutex.Unlock()
+	}
+	return result
+}
+
+func StopNotify(tag int32) int {
+	result := C.plc_tag_unregister_callback(C.int32_t(tag))
+
+	notifyMutex.Lock()
+	delete(notifyChans, tag)
+	notifyMutex.Unlock()
+
+	return int(result)
+}
@@ -33,6 +33,9 @@
 
 package libplctag;
 
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+
 import dev.java.net.jna.Library;
 import dev.java.net.jna.Native;
 import dev.java.net.jna.NativeLibrary;
@@ -317,6 +320,192 @@ static {
     }
 
 
+    /*
+     * Bulk data routines.
+     *
+     * These copy between the tag data and a direct ByteBuffer in one native
+     * call instead of one call per value.  The buffer is filled or drained
+     * from its position to its limit and the position is moved past the
+     * bytes copied.
+     *
+     * getBytes()/setBytes() copy the bytes as the PLC has them.  The typed
+     * calls convert each element to the host byte order and set the
+     * buffer's order to match, so buf.getInt() and friends read the right
+     * values.
+     */
+
+    public int getBytes(int offset, ByteBuffer buf) {
+        return bulkCopy(BULK_RAW, offset, buf, 1, false);
+    }
+
+    public int setBytes(int offset, ByteBuffer buf) {
+        return bulkCopy(BULK_RAW, offset, buf, 1, true);
+    }
+
+    public int getInt64s(int offset, ByteBuffer buf) {
+        return bulkCopy(BULK_INT64, offset, buf, 8, false);
+    }
+
+    public int setInt64s(int offset, ByteBuffer buf) {
+        return bulkCopy(BULK_INT64, offset, buf, 8, true);
+    }
+
+    public int getInt32s(int offset, ByteBuffer buf) {
+        return bulkCopy(BULK_INT32, offset, buf, 4, false);
+    }
+
+    public int setInt32s(int offset, ByteBuffer buf) {
+        return bulkCopy(BULK_INT32, offset, buf, 4, true);
+    }
+
+    public int getInt16s(int offset, ByteBuffer buf) {
+        return bulkCopy(BULK_INT16, offset, buf, 2, false);
+    }
+
+    public int setInt16s(int offset, ByteBuffer buf) {
+        return bulkCopy(BULK_INT16, offset, buf, 2, true);
+    }
+
+    public int getFloat64s(int offset, ByteBuffer buf) {
+        return bulkCopy(BULK_FLOAT64, offset, buf, 8, false);
+    }
+
+    public int setFloat64s(int offset, ByteBuffer buf) {
+        return bulkCopy(BULK_FLOAT64, offset, buf, 8, true);
+    }
+
+    public int getFloat32s(int offset, ByteBuffer buf) {
+        return bulkCopy(BULK_FLOAT32, offset, buf, 4, false);
+    }
+
+    public int setFloat32s(int offset, ByteBuffer buf) {
+        return bulkCopy(BULK_FLOAT32, offset, buf, 4, true);
+    }
+
+
+    /*
+     * Multi-tag IO.
+     *
+     * Start a read or write on all the tags before waiting so that the
+     * requests can be packed together.  statuses gets the status of each
+     * tag and must be at least as long as tags.  The first error is
+     * returned.  With a timeout of zero this returns at once and the
+     * statuses are PLCTAG_STATUS_PENDING until each tag is done.
+     */
+
+    public static int readMany(Tag[] tags, int[] statuses, int timeout) {
+        int[] ids = Tag.tagIds(tags, statuses);
+
+        if(ids == null) {
+            return Tag.PLCTAG_ERR_TOO_SMALL;
+        }
+
+        return Tag.plc_tag_read_many(ids, ids.length, statuses, timeout);
+    }
+
+    public static int writeMany(Tag[] tags, int[] statuses, int timeout) {
+        int[] ids = Tag.tagIds(tags, statuses);
+
+        if(ids == null) {
+            return Tag.PLCTAG_ERR_TOO_SMALL;
+        }
+
+        return Tag.plc_tag_write_many(ids, ids.length, statuses, timeout);
+    }
+
+
+    /*
+     * bulk helpers
+     */
+
+    private static final int BULK_RAW = 0;
+    private static final int BULK_INT64 = 1;
+    private static final int BULK_INT32 = 2;
+    private static final int BULK_INT16 = 3;
+    private static final int BULK_FLOAT64 = 4;
+    private static final int BULK_FLOAT32 = 5;
+
+    private int bulkCopy(int kind, int offset, ByteBuffer buf, int elem_size, boolean to_tag) {
+        int rc = Tag.PLCTAG_STATUS_OK;
+        int count = 0;
+        ByteBuffer view = null;
+
+        if(buf == null) {
+            return Tag.PLCTAG_ERR_NULL_PTR;
+        }
+
+        // the native side needs memory that does not move.
+        if(!buf.isDirect()) {
+            return Tag.PLCTAG_ERR_BAD_PARAM;
+        }
+
+        if(kind != BULK_RAW) {
+            buf.order(ByteOrder.nativeOrder());
+        }
+
+        count = buf.remaining() / elem_size;
+
+        if(count == 0) {
+            return Tag.PLCTAG_STATUS_OK;
+        }
+
+        // the native call gets the address of the buffer start, so start it at the position.
+        view = buf.slice();
+
+        switch(kind) {
+            case BULK_RAW:
+                rc = (to_tag ? Tag.plc_tag_set_raw_bytes(this.tag_id, offset, view, count) : Tag.plc_tag_get_raw_bytes(this.tag_id, offset, view, count));
+                break;
+
+            case BULK_INT64:
+                rc = (to_tag ? Tag.plc_tag_set_int64_array(this.tag_id, offset, view, count) : Tag.plc_tag_get_int64_array(this.tag_id, offset, view, count));
+                break;
+
+            case BULK_INT32:
+                rc = (to_tag ? Tag.plc_tag_set_int32_array(this.tag_id, offset, view, count) : Tag.plc_tag_get_int32_array(this.tag_id, offset, view, count));
+                break;
+
+            case BULK_INT16:
+                rc = (to_tag ? Tag.plc_tag_set_int16_array(this.tag_id, offset, view, count) : Tag.plc_tag_get_int16_array(this.tag_id, offset, view, count));
+                break;
+
+            case BULK_FLOAT64:
+                rc = (to_tag ? Tag.plc_tag_set_float64_array(this.tag_id, offset, view, count) : Tag.plc_tag_get_float64_array(this.tag_id, offset, view, count));
+                break;
+
+            case BULK_FLOAT32:
+                rc = (to_tag ? Tag.plc_tag_set_float32_array(this.tag_id, offset, view, count) : Tag.plc_tag_get_float32_array(this.tag_id, offset, view, count));
+                break;
+
+            default:
+                rc = Tag.PLCTAG_ERR_UNSUPPORTED;
+                break;
+        }
+
+        if(rc == Tag.PLCTAG_STATUS_OK) {
+            buf.position(buf.position() + (count * elem_size));
+        }
+
+        return rc;
+    }
+
+    private static int[] tagIds(Tag[] tags, int[] statuses) {
+        int[] ids = null;
+
+        if(tags == null || statuses == null || statuses.length < tags.length) {
+            return null;
+        }
+
+        ids = new int[tags.length];
+
+        for(int i=0; i < tags.length; i++) {
+            ids[i] = tags[i].tag_id;
+        }
+
+        return ids;
+    }
+
+
 
 
 
@@ -597,6 +786,76 @@ static {
      */
     private static native int plc_tag_set_float32(int tag_id, int offset, float val);
 
+    /**
+     * Original signature : <code>int plc_tag_read_many(int32_t *, int, int *, int)</code>
+     */
+    private static native int plc_tag_read_many(int[] tags, int num_tags, int[] statuses, int timeout);
+
+    /**
+     * Original signature : <code>int plc_tag_write_many(int32_t *, int, int *, int)</code>
+     */
+    private static native int plc_tag_write_many(int[] tags, int num_tags, int[] statuses, int timeout);
+
+    /**
+     * Original signature : <code>int plc_tag_get_raw_bytes(int32_t, int, uint8_t*, int)</code>
+     */
+    private static native int plc_tag_get_raw_bytes(int tag_id, int offset, ByteBuffer buffer, int buffer_length);
+
+    /**
+     * Original signature : <code>int plc_tag_set_raw_bytes(int32_t, int, uint8_t*, int)</code>
+     */
+    private static native int plc_tag_set_raw_bytes(int tag_id, int offset, ByteBuffer buffer, int buffer_length);
+
+    /**
+     * Original signature : <code>int plc_tag_get_int64_array(int32_t, int, int64_t*, int)</code>
+     */
+    private static native int plc_tag_get_int64_array(int tag_id, int offset, ByteBuffer buffer, int count);
+
+    /**
+     * Original signature : <code>int plc_tag_set_int64_array(int32_t, int, const int64_t*, int)</code>
+     */
+    private static native int plc_tag_set_int64_array(int tag_id, int offset, ByteBuffer buffer, int count);
+
+    /**
+     * Original signature : <code>int plc_tag_get_int32_array(int32_t, int, int32_t*, int)</code>
+     */
+    private static native int plc_tag_get_int32_array(int tag_id, int offset, ByteBuffer buffer, int count);
+
+    /**
+     * Original signature : <code>int plc_tag_set_int32_array(int32_t, int, const int32_t*, int)</code>
+     */
+    private static native int plc_tag_set_int32_array(int tag_id, int offset, ByteBuffer buffer, int count);
+
+    /**
+     * Original signature : <code>int plc_tag_get_int16_array(int32_t, int, int16_t*, int)</code>
+     */
+    private static native int plc_tag_get_int16_array(int tag_id, int offset, ByteBuffer buffer, int count);
+
+    /**
+     * Original signature : <code>int plc_tag_set_int16_array(int32_t, int, const int16_t*, int)</code>
+     */
+    private static native int plc_tag_set_int16_array(int tag_id, int offset, ByteBuffer buffer, int count);
+
+    /**
+     * Original signature : <code>int plc_tag_get_float64_array(int32_t, int, double*, int)</code>
+     */
+    private static native int plc_tag_get_float64_array(int tag_id, int offset, ByteBuffer buffer, int count);
+
+    /**
+     * Original signature : <code>int plc_tag_set_float64_array(int32_t, int, const double*, int)</code>
+     */
+    private static native int plc_tag_set_float64_array(int tag_id, int offset, ByteBuffer buffer, int count);
+
+    /**
+     * Original signature : <code>int plc_tag_get_float32_array(int32_t, int, float*, int)</code>
+     */
+    private static native int plc_tag_get_float32_array(int tag_id, int offset, ByteBuffer buffer, int count);
+
+    /**
+     * Original signature : <code>int plc_tag_set_float32_array(int32_t, int, const float*, int)</code>
+     */
+    private static native int plc_tag_set_float32_array(int tag_id, int offset, ByteBuffer buffer, int count);
+
 
     /**
      * finalize
@@ -0,0 +1,280 @@
+#!/usr/bin/python
+#
+# asyncio support for the libplctag Python wrapper (Python 3.5+).
+#
+# The library calls a callback when a tag finishes being created, read or
+# written.  The callback runs on a library thread, so it only queues the
+# event and writes one byte to a pipe the event loop is watching.  The loop
+# then finishes the matching futures.  A burst of completions costs one
+# wake up of the loop, and no thread is blocked per operation.
+#
+# Usage:
+#
+#   tag = await AsyncTag.create(b"protocol=ab-eip&gateway=...&name=...")
+#   status = await tag.read()
+#   value = plc_tag_get_int32(tag.id, 0)
+#   statuses = await read_many([tag1, tag2, tag3])
+#   tag.close()
+#
+# The operations return the library status code like the rest of the
+# wrapper.  Cancelling one, for example with asyncio.wait_for(), aborts it.
+
+import asyncio
+import collections
+import ctypes
+import os
+import threading
+
+from .libplctag import lib, PLCTAG_STATUS_OK, PLCTAG_STATUS_PENDING
+
+PLCTAG_ERR_ABORT = -1
+PLCTAG_ERR_BUSY = -39
+
+PLCTAG_EVENT_READ_COMPLETED = 2
+PLCTAG_EVENT_WRITE_COMPLETED = 4
+PLCTAG_EVENT_ABORTED = 5
+PLCTAG_EVENT_DESTROYED = 6
+PLCTAG_EVENT_CREATED = 8
+
+_EVENT_KIND = {
+    PLCTAG_EVENT_READ_COMPLETED: 'read',
+    PLCTAG_EVENT_WRITE_COMPLETED: 'write',
+    PLCTAG_EVENT_CREATED: 'create',
+}
+
+_CallbackType = ctypes.CFUNCTYPE(None, ctypes.c_int32, ctypes.c_int, ctypes.c_int)
+
+_plcTagCreateEx = lib.plc_tag_create_ex
+_plcTagCreateEx.restype = ctypes.c_int32
+_plcTagCreateEx.argtypes = [ctypes.c_char_p, _CallbackType, ctypes.c_int]
+
+_plcTagUnregisterCallback = lib.plc_tag_unregister_callback
+_plcTagUnregisterCallback.restype = ctypes.c_int
+_plcTagUnregisterCallback.argtypes = [ctypes.c_int32]
+
+_plcTagRead = lib.plc_tag_read
+_plcTagRead.restype = ctypes.c_int
+_plcTagRead.argtypes = [ctypes.c_int32, ctypes.c_int]
+
+_plcTagWrite = lib.plc_tag_write
+_plcTagWrite.restype = ctypes.c_int
+_plcTagWrite.argtypes = [ctypes.c_int32, ctypes.c_int]
+
+_plcTagAbort = lib.plc_tag_abort
+_plcTagAbort.restype = ctypes.c_int
+_plcTagAbort.argtypes = [ctypes.c_int32]
+
+_plcTagDestroy = lib.plc_tag_destroy
+_plcTagDestroy.restype = ctypes.c_int
+_plcTagDestroy.argtypes = [ctypes.c_int32]
+
+
+class _Bridge(object):
+    # Carries tag events from the library threads to one event loop.
+
+    def __init__(self, loop):
+        self.loop = loop
+        self.thread_id = threading.get_ident()
+        self.events = collections.deque()
+        self.waiters = {}
+        self.lock = threading.Lock()
+        self.signalled = False
+        self.read_fd, self.write_fd = os.pipe()
+        os.set_blocking(self.read_fd, False)
+        os.set_blocking(self.write_fd, False)
+
+        try:
+            loop.add_reader(self.read_fd, self._drain)
+            self.use_pipe = True
+        except NotImplementedError:
+            # the Windows proactor loop cannot watch a pipe.
+            self.use_pipe = False
+
+    def post(self, tag_id, event, status):
+        # events raised while the loop thread is inside a library call are handled right away.
+        if threading.get_ident() == self.thread_id:
+            self._dispatch(tag_id, event, status)
+            return
+
+        self.events.append((tag_id, event, status))
+
+        with self.lock:
+            if self.signalled:
+                return
+            self.signalled = True
+
+        if self.use_pipe:
+            try:
+                os.write(self.write_fd, b'x')
+            except (BlockingIOError, OSError):
+                pass
+        else:
+            self.loop.call_soon_threadsafe(self._drain)
+
+    def _drain(self):
+        if self.use_pipe:
+            try:
+                os.read(self.read_fd, 4096)
+            except (BlockingIOError, OSError):
+                pass
+
+        # clear the flag first so that new events signal again.
+        with self.lock:
+            self.signalled = False
+
+        while self.events:
+            tag_id, event, status = self.events.popleft()
+            self._dispatch(tag_id, event, status)
+
+    def _dispatch(self, tag_id, event, status):
+        if event == PLCTAG_EVENT_ABORTED:
+            for kind in ('read', 'write'):
+                self._finish(tag_id, kind, PLCTAG_ERR_ABORT)
+            return
+
+        kind = _EVENT_KIND.get(event)
+        if kind is not None:
+            self._finish(tag_id, kind, status)
+
+    def _finish(self, tag_id, kind, status):
+        future = self.waiters.pop((tag_id, kind), None)
+        if future is not None and not future.done():
+            future.set_result(status)
+
+    def expect(self, tag_id, kind):
+        if (tag_id, kind) in self.waiters:
+            return None
+        future = self.loop.create_future()
+        self.waiters[(tag_id, kind)] = future
+        return future
+
+    def forget(self, tag_id, kind):
+        self.waiters.pop((tag_id, kind), None)
+
+
+# The callback only gets the tag ID.  Events for a tag that is still being
+# set up are kept until it is registered.
+_bridges = {}
+_tag_bridges = {}
+_early_events = {}
+_registry_lock = threading.Lock()
+_creating = threading.local()
+
+
+def _on_event(tag_id, event, status):
+    with _registry_lock:
+        bridge = _tag_bridges.get(tag_id)
+        if bridge is None:
+            bridge = getattr(_creating, 'bridge', None)
+        if bridge is None:
+            _early_events.setdefault(tag_id, []).append((event, status))
+            return
+    bridge.post(tag_id, event, status)
+
+_callback = _CallbackType(_on_event)
+
+
+def _get_bridge(loop):
+    bridge = _bridges.get(loop)
+    if bridge is None:
+        bridge = _Bridge(loop)
+        _bridges[loop] = bridge
+    return bridge
+
+
+class AsyncTag(object):
+
+    def __init__(self, tag_id, bridge):
+        self.id = tag_id
+        self._bridge = bridge
+
+    @classmethod
+    async def create(cls, attributes, loop=None):
+        # the tag is finished by the library in the background.
+        if isinstance(attributes, str):
+            attributes = attributes.encode()
+
+        loop = loop or asyncio.get_event_loop()
+        bridge = _get_bridge(loop)
+
+        _creating.bridge = bridge
+        try:
+            tag_id = _plcTagCreateEx(attributes, _callback, 0)
+        finally:
+            _creating.bridge = None
+
+        if tag_id < 0:
+            raise IOError("tag creation failed with status %d" % tag_id)
+
+        future = bridge.expect(tag_id, 'create')
+
+        with _registry_lock:
+            _tag_bridges[tag_id] = bridge
+            early = _early_events.pop(tag_id, [])
+
+        for event, status in early:
+            bridge.post(tag_id, event, status)
+
+        status = await future
+        tag = cls(tag_id, bridge)
+
+        if status != PLCTAG_STATUS_OK:
+            tag.close()
+            raise IOError("tag creation failed with status %d" % status)
+
+        return tag
+
+    async def read(self):
+        return await self._run('read', _plcTagRead)
+
+    async def write(self):
+        return await self._run('write', _plcTagWrite)
+
+    async def _run(self, kind, start_func):
+        future = self._bridge.expect(self.id, kind)
+        if future is None:
+            return PLCTAG_ERR_BUSY
+
+        rc = start_func(self.id, 0)
+
+        # errors found before the operation started do not raise an event.
+        if rc != PLCTAG_STATUS_PENDING and not future.done():
+            self._bridge.forget(self.id, kind)
+            future.set_result(rc)
+
+        try:
+            return await future
+        except asyncio.CancelledError:
+            self._bridge.forget(self.id, kind)
+            _plcTagAbort(self.id)
+            raise
+
+    def close(self):
+        if self.id <= 0:
+            return
+
+        _plcTagUnregisterCallback(self.id)
+
+        with _registry_lock:
+            _tag_bridges.pop(self.id, None)
+
+        for kind in ('read', 'write'):
+            self._bridge._finish(self.id, kind, PLCTAG_ERR_ABORT)
+
+        _plcTagDestroy(self.id)
+        self.id = 0
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc):
+        self.close()
+
+
+async def read_many(tags):
+    # the reads are all started before any is waited on, so they can be packed together.
+    return await asyncio.gather(*(tag.read() for tag in tags))
+
+
+async def write_many(tags):
+    return await asyncio.gather(*(tag.write() for tag in tags))
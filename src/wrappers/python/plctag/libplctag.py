@@ -198,6 +198,23 @@ plcTagGetFloat32 = defineFloatFunc(lib.plc_tag_get_float32, [ctypes.c_int, ctype
 # Creates IntFunc because it returns int for the result, but notice it takes a float for the val
 plcTagSetFloat32 = defineIntFunc(lib.plc_tag_set_float32, [ctypes.c_int, ctypes.c_int, ctypes.c_float])
 
+# Create the bulk tag data accessors.  These take a pointer to the caller's
+# buffer so whole arrays are copied and byte swapped in one foreign call.
+
+plcTagGetRawBytes = defineIntFunc(lib.plc_tag_get_raw_bytes, [ctypes.c_int, ctypes.c_int, ctypes.c_void_p, ctypes.c_int])
+plcTagSetRawBytes = defineIntFunc(lib.plc_tag_set_raw_bytes, [ctypes.c_int, ctypes.c_int, ctypes.c_void_p, ctypes.c_int])
+
+plcTagGetInt64Array = defineIntFunc(lib.plc_tag_get_int64_array, [ctypes.c_int, ctypes.c_int, ctypes.c_void_p, ctypes.c_int])
+plcTagSetInt64Array = defineIntFunc(lib.plc_tag_set_int64_array, [ctypes.c_int, ctypes.c_int, ctypes.c_void_p, ctypes.c_int])
+plcTagGetInt32Array = defineIntFunc(lib.plc_tag_get_int32_array, [ctypes.c_int, ctypes.c_int, ctypes.c_void_p, ctypes.c_int])
+plcTagSetInt32Array = defineIntFunc(lib.plc_tag_set_int32_array, [ctypes.c_int, ctypes.c_int, ctypes.c_void_p, ctypes.c_int])
+plcTagGetInt16Array = defineIntFunc(lib.plc_tag_get_int16_array, [ctypes.c_int, ctypes.c_int, ctypes.c_void_p, ctypes.c_int])
+plcTagSetInt16Array = defineIntFunc(lib.plc_tag_set_int16_array, [ctypes.c_int, ctypes.c_int, ctypes.c_void_p, ctypes.c_int])
+plcTagGetFloat64Array = defineIntFunc(lib.plc_tag_get_float64_array, [ctypes.c_int, ctypes.c_int, ctypes.c_void_p, ctypes.c_int])
+plcTagSetFloat64Array = defineIntFunc(lib.plc_tag_set_float64_array, [ctypes.c_int, ctypes.c_int, ctypes.c_void_p, ctypes.c_int])
+plcTagGetFloat32Array = defineIntFunc(lib.plc_tag_get_float32_array, [ctypes.c_int, ctypes.c_int, ctypes.c_void_p, ctypes.c_int])
+plcTagSetFloat32Array = defineIntFunc(lib.plc_tag_set_float32_array, [ctypes.c_int, ctypes.c_int, ctypes.c_void_p, ctypes.c_int])
+
 
 
 ##############################################################################
@@ -447,6 +464,118 @@ def plc_tag_get_float32(tag, offset):
 def plc_tag_set_float32(tag, offset, value):
     return plcTagSetFloat32(tag, offset, value)
 
+# Bulk access
+#
+# The buffer can be anything that supports the buffer protocol: a bytearray,
+# an array.array, a memoryview or a NumPy array.  The data is copied straight
+# into or out of its memory, there is no per element call.  The typed calls
+# convert from the tag's byte order to the machine's.  The unsigned and 8-bit
+# types have the same layout as their signed or raw counterparts, so fill
+# buffers of those types with the matching call.
+
+PLCTAG_ERR_NOT_ALLOWED = -18
+PLCTAG_ERR_TOO_SMALL = -34
+
+def _bulk(func, tag, offset, buffer, count, elem_size, writes_buffer):
+    view = memoryview(buffer).cast('B')
+    if view.nbytes < count * elem_size:
+        return PLCTAG_ERR_TOO_SMALL
+    if view.readonly:
+        # bytes and the like can only be copied into the tag.
+        if writes_buffer:
+            return PLCTAG_ERR_NOT_ALLOWED
+        data = ctypes.create_string_buffer(view.tobytes(), view.nbytes)
+    else:
+        data = (ctypes.c_char * view.nbytes).from_buffer(view)
+    return func(tag, offset, ctypes.addressof(data), count)
+
+def plc_tag_get_raw_bytes(tag, offset, buffer, length):
+    return _bulk(plcTagGetRawBytes, tag, offset, buffer, length, 1, True)
+
+def plc_tag_set_raw_bytes(tag, offset, buffer, length):
+    return _bulk(plcTagSetRawBytes, tag, offset, buffer, length, 1, False)
+
+def plc_tag_get_int64_array(tag, offset, buffer, count):
+    return _bulk(plcTagGetInt64Array, tag, offset, buffer, count, 8, True)
+
+def plc_tag_set_int64_array(tag, offset, buffer, count):
+    return _bulk(plcTagSetInt64Array, tag, offset, buffer, count, 8, False)
+
+def plc_tag_get_int32_array(tag, offset, buffer, count):
+    return _bulk(plcTagGetInt32Array, tag, offset, buffer, count, 4, True)
+
+def plc_tag_set_int32_array(tag, offset, buffer, count):
+    return _bulk(plcTagSetInt32Array, tag, offset, buffer, count, 4, False)
+
+def plc_tag_get_int16_array(tag, offset, buffer, count):
+    return _bulk(plcTagGetInt16Array, tag, offset, buffer, count, 2, True)
+
+def plc_tag_set_int16_array(tag, offset, buffer, count):
+    return _bulk(plcTagSetInt16Array, tag, offset, buffer, count, 2, False)
+
+def plc_tag_get_float64_array(tag, offset, buffer, count):
+    return _bulk(plcTagGetFloat64Array, tag, offset, buffer, count, 8, True)
+
+def plc_tag_set_float64_array(tag, offset, buffer, count):
+    return _bulk(plcTagSetFloat64Array, tag, offset, buffer, count, 8, False)
+
+def plc_tag_get_float32_array(tag, offset, buffer, count):
+    return _bulk(plcTagGetFloat32Array, tag, offset, buffer, count, 4, True)
+
+def plc_tag_set_float32_array(tag, offset, buffer, count):
+    return _bulk(plcTagSetFloat32Array, tag, offset, buffer, count, 4, False)
+
+# NumPy helpers
+#
+# plc_tag_get_numpy() returns the tag data as a NumPy array of the dtype,
+# already in the machine's byte order.  Pass out= to reuse an array between
+# reads.  plc_tag_set_numpy() copies an array into the tag data.  NumPy is
+# only needed if these are called.
+
+_BULK_BY_KIND = {
+    ('i', 1): (plcTagGetRawBytes, plcTagSetRawBytes),
+    ('u', 1): (plcTagGetRawBytes, plcTagSetRawBytes),
+    ('b', 1): (plcTagGetRawBytes, plcTagSetRawBytes),
+    ('i', 2): (plcTagGetInt16Array, plcTagSetInt16Array),
+    ('u', 2): (plcTagGetInt16Array, plcTagSetInt16Array),
+    ('i', 4): (plcTagGetInt32Array, plcTagSetInt32Array),
+    ('u', 4): (plcTagGetInt32Array, plcTagSetInt32Array),
+    ('i', 8): (plcTagGetInt64Array, plcTagSetInt64Array),
+    ('u', 8): (plcTagGetInt64Array, plcTagSetInt64Array),
+    ('f', 4): (plcTagGetFloat32Array, plcTagSetFloat32Array),
+    ('f', 8): (plcTagGetFloat64Array, plcTagSetFloat64Array),
+}
+
+def _numpy_bulk(dtype):
+    funcs = _BULK_BY_KIND.get((dtype.kind, dtype.itemsize))
+    if funcs is None:
+        raise TypeError("unsupported tag data type %s" % dtype)
+    return funcs
+
+def plc_tag_get_numpy(tag, dtype, count=None, offset=0, out=None):
+    import numpy
+    dtype = numpy.dtype(dtype).newbyteorder('=')
+    get_func = _numpy_bulk(dtype)[0]
+    if out is None:
+        if count is None:
+            count = (plcTagGetSize(tag) - offset) // dtype.itemsize
+        out = numpy.empty(count, dtype=dtype)
+    elif count is None:
+        count = out.size
+    if not out.flags['C_CONTIGUOUS'] or out.dtype != dtype or out.size < count:
+        raise ValueError("out must be a contiguous array of at least %d %s" % (count, dtype))
+    rc = get_func(tag, offset, out.ctypes.data, count)
+    if rc != PLCTAG_STATUS_OK:
+        raise IOError("plc_tag_get_numpy failed: %s" % plc_tag_decode_error(rc))
+    return out
+
+def plc_tag_set_numpy(tag, values, offset=0):
+    import numpy
+    values = numpy.ascontiguousarray(values)
+    values = values.astype(values.dtype.newbyteorder('='), copy=False)
+    set_func = _numpy_bulk(values.dtype)[1]
+    return set_func(tag, offset, values.ctypes.data, values.size)
+
 # String, library dependent
 
 if plc_tag_check_lib_version(2, 2, 0) == 0: